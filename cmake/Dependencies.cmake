@@ -83,6 +83,8 @@ set(DATATYPES_FLOAT
   "float"
   "double"
   "rccl_bfloat16"
+  "rccl_float8_e4m3"
+  "rccl_float8_e5m2"
   )
 
 function(expand_collectives FILE FUNC)
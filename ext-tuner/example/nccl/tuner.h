@@ -0,0 +1,73 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_TUNER_H_
+#define NCCL_TUNER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Error type for plugins */
+typedef enum { ncclSuccess                 =  0,
+               ncclUnhandledCudaError      =  1,
+               ncclSystemError             =  2,
+               ncclInternalError           =  3,
+               ncclInvalidArgument         =  4,
+               ncclRemoteError             =  6 } ncclResult_t;
+
+typedef enum {NCCL_LOG_NONE=0, NCCL_LOG_VERSION=1, NCCL_LOG_WARN=2, NCCL_LOG_INFO=3, NCCL_LOG_ABORT=4, NCCL_LOG_TRACE=5} ncclDebugLogLevel;
+typedef enum {NCCL_INIT=1, NCCL_COLL=2, NCCL_P2P=4, NCCL_SHM=8, NCCL_NET=16, NCCL_GRAPH=32, NCCL_TUNING=64, NCCL_ENV=128, NCCL_ALLOC=256, NCCL_CALL=512, NCCL_ALL=~0} ncclDebugLogSubSys;
+
+typedef void (*ncclDebugLogger_t)(ncclDebugLogLevel level, unsigned long flags, const char *file, int line, const char *fmt, ...);
+
+typedef enum { ncclFuncBroadcast, ncclFuncReduce, ncclFuncAllGather, ncclFuncReduceScatter, ncclFuncAllReduce, ncclFuncSendRecv, ncclFuncSend, ncclFuncRecv, ncclFuncAllToAllPivot, ncclNumFuncs} ncclFunc_t;
+
+#define NCCL_NUM_ALGORITHMS 6 // Tree/Ring/CollNet*
+#define NCCL_ALGO_TREE 0
+#define NCCL_ALGO_RING 1
+#define NCCL_ALGO_COLLNET_DIRECT 2
+#define NCCL_ALGO_COLLNET_CHAIN 3
+#define NCCL_ALGO_NVLS 4
+#define NCCL_ALGO_NVLS_TREE 5
+
+#define NCCL_NUM_PROTOCOLS 3 // Simple/LL/LL128
+#define NCCL_PROTO_LL 0
+#define NCCL_PROTO_LL128 1
+#define NCCL_PROTO_SIMPLE 2
+
+// Summary of the communicator the tuner is initialized for
+typedef struct {
+  int nRanks;
+  int nNodes;
+  int localRanks; // ranks of this node
+  int nChannels; // collective channels
+  int cudaArch; // device architecture, as used to pick the kernels
+  float bwIntra; // ring graph bandwidth per channel in GB/s, within a node
+  float bwInter; // between nodes
+  int typeIntra; // ring graph link types (PATH_* values)
+  int typeInter;
+} ncclTunerTopo_v1_t;
+
+typedef struct {
+  // Name of the tuner
+  const char* name;
+
+  // Initializes the tuner for a communicator, the returned context is passed to the other calls.
+  ncclResult_t (*init)(const ncclTunerTopo_v1_t* topo, ncclDebugLogger_t logFunction, void** context);
+
+  // Picks the algorithm, protocol and channel count of a collective. costTable holds the time in us of each
+  // algorithm/protocol pair from the internal model, -1 for the unavailable ones. The tuner can either set
+  // *algorithm and *protocol, and optionally *nChannels, or leave them to -1 and update costTable, the
+  // cheapest available pair being used then.
+  // Decisions must only depend on the arguments: all ranks have to pick the same, and they are memoized.
+  ncclResult_t (*getCollInfo)(void* context, ncclFunc_t collType, size_t nBytes, int collNetSupport, int nvlsSupport,
+      int numPipeOps, float costTable[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS], int* algorithm, int* protocol, int* nChannels);
+
+  // Releases the context
+  ncclResult_t (*destroy)(void* context);
+} ncclTuner_v1_t;
+
+#endif
@@ -0,0 +1,44 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include <nccl/tuner.h>
+
+#define __hidden __attribute__ ((visibility("hidden")))
+
+struct pluginContext {
+  int nNodes;
+};
+
+__hidden ncclResult_t pluginInit(const ncclTunerTopo_v1_t* topo, ncclDebugLogger_t logFunction, void** context) {
+  struct pluginContext* ctx = (struct pluginContext*)malloc(sizeof(struct pluginContext));
+  if (ctx == NULL) return ncclSystemError;
+  ctx->nNodes = topo->nNodes;
+  *context = ctx;
+  return ncclSuccess;
+}
+
+// Example policy: large multi-node allreduces always run Ring/Simple, everything else is left to the model.
+__hidden ncclResult_t pluginGetCollInfo(void* context, ncclFunc_t collType, size_t nBytes, int collNetSupport, int nvlsSupport,
+    int numPipeOps, float costTable[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS], int* algorithm, int* protocol, int* nChannels) {
+  struct pluginContext* ctx = (struct pluginContext*)context;
+  if (collType == ncclFuncAllReduce && ctx->nNodes > 1 && nBytes >= (64 << 20) && costTable[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] >= 0) {
+    *algorithm = NCCL_ALGO_RING;
+    *protocol = NCCL_PROTO_SIMPLE;
+  }
+  return ncclSuccess;
+}
+
+__hidden ncclResult_t pluginDestroy(void* context) {
+  free(context);
+  return ncclSuccess;
+}
+
+const ncclTuner_v1_t ncclTunerPlugin_v1 = {
+  .name = "Example",
+  .init = pluginInit,
+  .getCollInfo = pluginGetCollInfo,
+  .destroy = pluginDestroy,
+};
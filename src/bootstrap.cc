@@ -11,7 +11,12 @@
 #include "net.h"
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stddef.h>
 #include "proxy.h"
+#include "param.h"
 #include "signals.h" // [RCCL]
 
 struct bootstrapRootArgs {
@@ -58,6 +63,13 @@ ncclResult_t bootstrapNetInit() {
   return ncclSuccess;
 }
 
+// Address of the bootstrap interface, with port 0
+ncclResult_t bootstrapGetNetIfAddr(union ncclSocketAddress* addr) {
+  NCCLCHECK(bootstrapNetInit());
+  memcpy(addr, &bootstrapNetIfAddr, sizeof(union ncclSocketAddress));
+  return ncclSuccess;
+}
+
 /* Socket Interface Selection type */
 enum bootstrapInterface_t { findSubnetIf = -1, dontCareIf = -2 };
 
@@ -81,10 +93,146 @@ static ncclResult_t bootstrapNetRecv(struct ncclSocket* sock, void* data, int si
 struct extInfo {
   int rank;
   int nranks;
+  int hier; // Checked in through a node leader, which gets the reply for it
   union ncclSocketAddress extAddressListenRoot;
   union ncclSocketAddress extAddressListen;
 };
 
+// Reply of the root to a node leader, for each rank that checked in through it
+struct extNext {
+  int rank;
+  union ncclSocketAddress nextAddress;
+};
+
+// Ranks check in with the root through one leader per node (1), directly (0), or through leaders above BOOTSTRAP_HIER_MIN_RANKS (-1)
+RCCL_PARAM(BootstrapHier, "BOOTSTRAP_HIER", -1);
+#define BOOTSTRAP_HIER_MIN_RANKS 128
+#define BOOTSTRAP_LOCAL_RETRIES 10000 // 1ms apart
+
+static ncclResult_t bootstrapLocalIo(int op, int fd, void* data, int size) {
+  char* ptr = (char*)data;
+  int offset = 0;
+  while (offset < size) {
+    ssize_t bytes = op == NCCL_SOCKET_SEND ? send(fd, ptr+offset, size-offset, MSG_NOSIGNAL) : recv(fd, ptr+offset, size-offset, 0);
+    if (bytes == 0) {
+      WARN("Bootstrap : local peer closed the connection");
+      return ncclRemoteError;
+    }
+    if (bytes < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      WARN("Bootstrap : local %s failed : %s", op == NCCL_SOCKET_SEND ? "send" : "recv", strerror(errno));
+      return ncclSystemError;
+    }
+    offset += bytes;
+  }
+  return ncclSuccess;
+}
+
+/* Ranks of a node meet on an abstract unix socket named after the
+ * communicator and the host. The first one to bind it is the node leader and
+ * listens on it, the others connect to it. Hosts sharing a hash in different
+ * network namespaces just end up with a leader each.
+ */
+static ncclResult_t bootstrapLocalJoin(uint64_t magic, int* fd, int* leader) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  int len = snprintf(addr.sun_path+1, sizeof(addr.sun_path)-1, "nccl-bootstrap-%lx-%lx", magic, getHostHash());
+  socklen_t addrLen = offsetof(struct sockaddr_un, sun_path)+1+len;
+
+  SYSCHECK(*fd = socket(AF_UNIX, SOCK_STREAM, 0), "socket");
+  if (bind(*fd, (struct sockaddr*)&addr, addrLen) == 0) {
+    if (listen(*fd, SOMAXCONN) != 0) {
+      WARN("Bootstrap : local listen failed : %s", strerror(errno));
+      close(*fd);
+      return ncclSystemError;
+    }
+    *leader = 1;
+    return ncclSuccess;
+  }
+  if (errno != EADDRINUSE) {
+    WARN("Bootstrap : local bind failed : %s", strerror(errno));
+    close(*fd);
+    return ncclSystemError;
+  }
+  *leader = 0;
+  // The leader may have bound the name without listening yet
+  for (int retries=0; connect(*fd, (struct sockaddr*)&addr, addrLen) != 0; retries++) {
+    close(*fd);
+    if ((errno != ECONNREFUSED && errno != EAGAIN) || retries == BOOTSTRAP_LOCAL_RETRIES) {
+      WARN("Bootstrap : connection to the node leader failed : %s", strerror(errno));
+      return ncclSystemError;
+    }
+    usleep(1000);
+    SYSCHECK(*fd = socket(AF_UNIX, SOCK_STREAM, 0), "socket");
+  }
+  return ncclSuccess;
+}
+
+/* Forwards the check-ins of the other ranks of the node to the root, until
+ * the root replies with the ring neighbor of each of them. The root only
+ * replies once every rank checked in, so no rank can connect after that.
+ */
+static ncclResult_t bootstrapLeaderGather(struct ncclSocket* rootSock, int listenFd, int rank, union ncclSocketAddress* nextAddr) {
+  ncclResult_t ret = ncclSuccess;
+  struct extInfo info;
+  struct extNext next;
+  int* localRanks = NULL;
+  int* localFds = NULL;
+  int nLocals = 0, maxLocals = 0, count;
+  int rootFd;
+
+  NCCLCHECK(ncclSocketGetFd(rootSock, &rootFd));
+  while (1) {
+    struct pollfd pfds[2] = { { listenFd, POLLIN, 0 }, { rootFd, POLLIN, 0 } };
+    int nReady = poll(pfds, 2, 500);
+    if (nReady < 0 && errno == EINTR) continue;
+    SYSCHECKGOTO(nReady, ret, exit);
+    if (pfds[1].revents) break;
+    if (pfds[0].revents == 0) continue;
+    if (nLocals == maxLocals) {
+      NCCLCHECKGOTO(ncclRealloc(&localRanks, maxLocals, maxLocals+8), ret, exit);
+      NCCLCHECKGOTO(ncclRealloc(&localFds, maxLocals, maxLocals+8), ret, exit);
+      maxLocals += 8;
+    }
+    int fd = accept(listenFd, NULL, NULL);
+    SYSCHECKGOTO(fd, ret, exit);
+    localFds[nLocals++] = fd;
+    NCCLCHECKGOTO(bootstrapLocalIo(NCCL_SOCKET_RECV, fd, &info, sizeof(info)), ret, exit);
+    localRanks[nLocals-1] = info.rank;
+    info.hier = 1;
+    NCCLCHECKGOTO(bootstrapNetSend(rootSock, &info, sizeof(info)), ret, exit);
+  }
+  TRACE(NCCL_INIT, "rank %d forwarded %d local ranks to root", rank, nLocals);
+
+  NCCLCHECKGOTO(ncclSocketRecv(rootSock, &count, sizeof(int)), ret, exit);
+  if (count != nLocals+1) {
+    WARN("Bootstrap : root replied for %d ranks, %d checked in through rank %d", count, nLocals+1, rank);
+    ret = ncclInternalError;
+    goto exit;
+  }
+  for (int i=0; i<count; i++) {
+    NCCLCHECKGOTO(ncclSocketRecv(rootSock, &next, sizeof(next)), ret, exit);
+    if (next.rank == rank) {
+      memcpy(nextAddr, &next.nextAddress, sizeof(union ncclSocketAddress));
+      continue;
+    }
+    int l = 0;
+    while (l < nLocals && localRanks[l] != next.rank) l++;
+    if (l == nLocals) {
+      WARN("Bootstrap : root replied for rank %d which did not check in through rank %d", next.rank, rank);
+      ret = ncclInternalError;
+      goto exit;
+    }
+    NCCLCHECKGOTO(bootstrapLocalIo(NCCL_SOCKET_SEND, localFds[l], &next.nextAddress, sizeof(union ncclSocketAddress)), ret, exit);
+  }
+exit:
+  for (int l=0; l<nLocals; l++) close(localFds[l]);
+  free(localRanks);
+  free(localFds);
+  return ret;
+}
+
 #include <sys/resource.h>
 
 static ncclResult_t setFilesLimit() {
@@ -105,22 +253,57 @@ static void *bootstrapRoot(void* rargs) {
   union ncclSocketAddress *rankAddresses = NULL;
   union ncclSocketAddress *rankAddressesRoot = NULL; // for initial rank <-> root information exchange
   union ncclSocketAddress *zero = NULL;
+  // Node leaders keep their connection open for the other ranks of their node
+  struct ncclSocket* leaderSocks = NULL;
+  struct pollfd* pfds = NULL;
+  int* rankLeader = NULL; // Index of the leader a rank checked in through, -1 if it came directly
+  int nLeaders = 0, maxLeaders = 0;
   NCCLCHECKGOTO(ncclCalloc(&zero, 1), res, out);
   setFilesLimit();
 
   TRACE(NCCL_INIT, "BEGIN");
   /* Receive addresses from all ranks */
   do {
-    struct ncclSocket sock;
-    NCCLCHECKGOTO(ncclSocketInit(&sock), res, out);
-    NCCLCHECKGOTO(ncclSocketAccept(&sock, listenSock), res, out);
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, &info, sizeof(info)), res, out);
-    NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+    int l = -1;
+    if (nLeaders > 0) {
+      int nReady;
+      pfds[0].fd = listenSock->fd;
+      pfds[0].events = POLLIN;
+      for (int i=0; i<nLeaders; i++) {
+        pfds[i+1].fd = leaderSocks[i].fd;
+        pfds[i+1].events = POLLIN;
+      }
+      do {
+        nReady = poll(pfds, nLeaders+1, -1);
+      } while (nReady < 0 && errno == EINTR);
+      SYSCHECKGOTO(nReady, res, out);
+      for (int i=0; i<nLeaders && l == -1; i++) if (pfds[i+1].revents) l = i;
+    }
+    if (l >= 0) {
+      NCCLCHECKGOTO(bootstrapNetRecv(leaderSocks+l, &info, sizeof(info)), res, out);
+    } else {
+      struct ncclSocket sock;
+      NCCLCHECKGOTO(ncclSocketInit(&sock), res, out);
+      NCCLCHECKGOTO(ncclSocketAccept(&sock, listenSock), res, out);
+      NCCLCHECKGOTO(bootstrapNetRecv(&sock, &info, sizeof(info)), res, out);
+      if (info.hier) {
+        if (nLeaders == maxLeaders) {
+          NCCLCHECKGOTO(ncclRealloc(&leaderSocks, maxLeaders, maxLeaders+16), res, out);
+          NCCLCHECKGOTO(ncclRealloc(&pfds, maxLeaders ? maxLeaders+1 : 0, maxLeaders+17), res, out);
+          maxLeaders += 16;
+        }
+        memcpy(leaderSocks+nLeaders, &sock, sizeof(struct ncclSocket));
+        l = nLeaders++;
+      } else {
+        NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+      }
+    }
 
     if (c == 0) {
       nranks = info.nranks;
       NCCLCHECKGOTO(ncclCalloc(&rankAddresses, nranks), res, out);
       NCCLCHECKGOTO(ncclCalloc(&rankAddressesRoot, nranks), res, out);
+      NCCLCHECKGOTO(ncclCalloc(&rankLeader, nranks), res, out);
     }
 
     if (nranks != info.nranks) {
@@ -136,14 +319,30 @@ static void *bootstrapRoot(void* rargs) {
     // Save the connection handle for that rank
     memcpy(rankAddressesRoot+info.rank, &info.extAddressListenRoot, sizeof(union ncclSocketAddress));
     memcpy(rankAddresses+info.rank, &info.extAddressListen, sizeof(union ncclSocketAddress));
+    rankLeader[info.rank] = l;
 
     ++c;
     TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info.rank, c, nranks);
   } while (c < nranks);
-  TRACE(NCCL_INIT, "COLLECTED ALL %d HANDLES", nranks);
+  TRACE(NCCL_INIT, "COLLECTED ALL %d HANDLES from %d leaders", nranks, nLeaders);
+
+  // Leaders get the connect handles of the ranks of their node in one message
+  for (int l=0; l<nLeaders; ++l) {
+    int count = 0;
+    for (int r=0; r<nranks; ++r) if (rankLeader[r] == l) count++;
+    NCCLCHECKGOTO(ncclSocketSend(leaderSocks+l, &count, sizeof(int)), res, out);
+    for (int r=0; r<nranks; ++r) {
+      if (rankLeader[r] != l) continue;
+      struct extNext next;
+      next.rank = r;
+      memcpy(&next.nextAddress, rankAddresses+(r+1)%nranks, sizeof(union ncclSocketAddress));
+      NCCLCHECKGOTO(ncclSocketSend(leaderSocks+l, &next, sizeof(next)), res, out);
+    }
+  }
 
   // Send the connect handle for the next rank in the AllGather ring
   for (int r=0; r<nranks; ++r) {
+    if (rankLeader[r] != -1) continue;
     int next = (r+1) % nranks;
     struct ncclSocket sock;
     NCCLCHECKGOTO(ncclSocketInit(&sock, rankAddressesRoot+r, magic, ncclSocketTypeBootstrap), res, out);
@@ -158,6 +357,10 @@ out:
     ncclSocketClose(listenSock);
     free(listenSock);
   }
+  for (int l=0; l<nLeaders; ++l) ncclSocketClose(leaderSocks+l);
+  free(leaderSocks);
+  free(pfds);
+  free(rankLeader);
   if (rankAddresses) free(rankAddresses);
   if (rankAddressesRoot) free(rankAddressesRoot);
   if (zero) free(zero);
@@ -205,6 +408,11 @@ ncclResult_t bootstrapGetUniqueId(struct ncclBootstrapHandle* handle) {
   return ncclSuccess;
 }
 
+// Messages to a peer share one connection, opened by the first of them and kept until the
+// communicator is destroyed, instead of one connection per message (0). Receives read ahead on the
+// connection of their peer and keep the messages of other tags for later.
+RCCL_PARAM(BootstrapPeerConns, "BOOTSTRAP_PEER_CONNS", 1);
+
 struct unexConn {
   int peer;
   int tag;
@@ -212,6 +420,16 @@ struct unexConn {
   struct unexConn* next;
 };
 
+// Message read from the connection of a peer before the receive it belongs to was posted
+struct unexMsg {
+  int peer;
+  int tag;
+  int size;
+  char* data;
+  struct unexMsg* next;
+};
+#define BOOTSTRAP_UNEX_BUCKETS 64
+
 struct bootstrapState {
   struct ncclSocket listenSock;
   struct ncclSocket ringRecvSocket;
@@ -219,6 +437,14 @@ struct bootstrapState {
   union ncclSocketAddress* peerCommAddresses;
   union ncclSocketAddress* peerProxyAddresses;
   struct unexConn* unexpectedConnections;
+  // Connections to and from each peer, opened by the first message (RCCL_BOOTSTRAP_PEER_CONNS)
+  struct ncclSocket** peerSendSockets;
+  struct ncclSocket** peerRecvSockets;
+  struct unexMsg* unexpectedMessages[BOOTSTRAP_UNEX_BUCKETS]; // hashed by peer and tag, in arrival order
+  // Bruck AllGather: sockets to rank-2^k and from rank+2^k, connected on first use
+  int nBruckSteps;
+  struct ncclSocket* bruckSendSockets;
+  struct ncclSocket* bruckRecvSockets;
   int cudaDev;
   int rank;
   int nranks;
@@ -226,6 +452,9 @@ struct bootstrapState {
   volatile uint32_t *abortFlag;
 };
 
+// The ring only needs the sockets set up at init, it gathers the addresses the other algorithms use
+static ncclResult_t bootstrapRingAllGather(struct bootstrapState* state, char* data, int size);
+
 ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm* comm) {
   int rank = comm->rank;
   int nranks = comm->nRanks;
@@ -239,6 +468,10 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   state->rank = rank;
   state->nranks = nranks;
   state->abortFlag = comm->abortFlag;
+  NCCLCHECK(ncclCalloc(&state->peerSendSockets, nranks));
+  NCCLCHECK(ncclCalloc(&state->peerRecvSockets, nranks));
+  // Each rank keeps the connections of the peers it exchanged with
+  if (rcclParamBootstrapPeerConns()) setFilesLimit();
   comm->bootstrap = state;
   comm->magic = state->magic = handle->magic;
 
@@ -255,6 +488,30 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   NCCLCHECK(ncclSocketListen(&state->listenSock));
   NCCLCHECK(ncclSocketGetAddr(&state->listenSock, &info.extAddressListen));
 
+  // Only the node leaders talk to the root, the other ranks check in through them
+  info.hier = rcclParamBootstrapHier();
+  if (info.hier == -1) info.hier = nranks > BOOTSTRAP_HIER_MIN_RANKS ? 1 : 0;
+  if (info.hier) {
+    int localFd, leader;
+    NCCLCHECK(bootstrapLocalJoin(comm->magic, &localFd, &leader));
+    if (leader) {
+      NCCLCHECK(ncclSocketInit(&sock, &handle->addr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
+      NCCLCHECK(ncclSocketConnect(&sock));
+      NCCLCHECK(bootstrapNetSend(&sock, &info, sizeof(info)));
+      ncclResult_t res = bootstrapLeaderGather(&sock, localFd, rank, &nextAddr);
+      close(localFd);
+      NCCLCHECK(res);
+      NCCLCHECK(ncclSocketClose(&sock));
+    } else {
+      ncclResult_t res = bootstrapLocalIo(NCCL_SOCKET_SEND, localFd, &info, sizeof(info));
+      if (res == ncclSuccess) res = bootstrapLocalIo(NCCL_SOCKET_RECV, localFd, &nextAddr, sizeof(union ncclSocketAddress));
+      close(localFd);
+      NCCLCHECK(res);
+    }
+    TRACE(NCCL_INIT, "rank %d checked in %s node leader", rank, leader ? "as" : "through");
+    goto connectRing;
+  }
+
   // Create socket for root to contact me
   NCCLCHECK(ncclSocketInit(&listenSockRoot, &bootstrapNetIfAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
   NCCLCHECK(ncclSocketListen(&listenSockRoot));
@@ -283,6 +540,7 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   NCCLCHECK(ncclSocketClose(&sock));
   NCCLCHECK(ncclSocketClose(&listenSockRoot));
 
+connectRing:
   NCCLCHECK(ncclSocketInit(&state->ringSendSocket, &nextAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
   NCCLCHECK(ncclSocketConnect(&state->ringSendSocket));
   // Accept the connect request from the previous rank in the AllGather ring
@@ -292,7 +550,7 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   // AllGather all listen handlers
   NCCLCHECK(ncclCalloc(&state->peerCommAddresses, nranks));
   NCCLCHECK(ncclSocketGetAddr(&state->listenSock, state->peerCommAddresses+rank));
-  NCCLCHECK(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union ncclSocketAddress)));
+  NCCLCHECK(bootstrapRingAllGather(state, (char*)state->peerCommAddresses, sizeof(union ncclSocketAddress)));
 
   // Create the service proxy
   NCCLCHECK(ncclCalloc(&state->peerProxyAddresses, nranks));
@@ -323,6 +581,8 @@ ncclResult_t bootstrapSplit(struct ncclBootstrapHandle* handle, struct ncclComm*
   state->rank = rank;
   state->nranks = nranks;
   state->abortFlag = comm->abortFlag;
+  NCCLCHECKGOTO(ncclCalloc(&state->peerSendSockets, nranks), ret, fail);
+  NCCLCHECKGOTO(ncclCalloc(&state->peerRecvSockets, nranks), ret, fail);
   comm->bootstrap = state;
   comm->magic = state->magic = handle->magic;
 
@@ -349,7 +609,7 @@ ncclResult_t bootstrapSplit(struct ncclBootstrapHandle* handle, struct ncclComm*
   // AllGather all listen handlers
   NCCLCHECKGOTO(ncclCalloc(&state->peerCommAddresses, nranks), ret, fail);
   memcpy(state->peerCommAddresses+rank, &listenAddr, sizeof(union ncclSocketAddress));
-  NCCLCHECKGOTO(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union ncclSocketAddress)), ret, fail);
+  NCCLCHECKGOTO(bootstrapRingAllGather(state, (char*)state->peerCommAddresses, sizeof(union ncclSocketAddress)), ret, fail);
 
   if (parent->config.splitShare) {
     /* map local rank to top parent local rank. */
@@ -378,9 +638,77 @@ fail:
   goto exit;
 }
 
+static ncclResult_t bootstrapAccept(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock);
+static ncclResult_t bootstrapConnect(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock);
+
+// Ring (0), Bruck (1), or picked from the number of ranks and the size (-1)
+RCCL_PARAM(BootstrapAllGather, "BOOTSTRAP_ALLGATHER", -1);
+#define BOOTSTRAP_BRUCK_MIN_RANKS 16
+#define BOOTSTRAP_BRUCK_MAX_SIZE (1<<20)
+#define BOOTSTRAP_TAG_BRUCK INT_MIN // + step, out of the range of the other tags
+#define BOOTSTRAP_TAG_CONN (INT_MIN+64) // opens the connection of a peer, past the Bruck steps
+
+// Moves size bytes both ways at once, peers send before they receive
+static ncclResult_t bootstrapSendRecv(struct ncclSocket* sendSock, void* sendData, struct ncclSocket* recvSock, void* recvData, int size) {
+  int sendOffset = 0, recvOffset = 0;
+  while (sendOffset < size || recvOffset < size) {
+    if (sendOffset < size) NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_SEND, sendSock, sendData, size, &sendOffset));
+    if (recvOffset < size) NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_RECV, recvSock, recvData, size, &recvOffset));
+  }
+  return ncclSuccess;
+}
+
+/* Bruck AllGather, in ceil(log2(nranks)) steps
+ * tmp holds the slices of rank, rank+1, ... in order. At step k with dist=2^k,
+ * send the first min(dist, nranks-dist) slices to rank-dist and receive as
+ * many from rank+dist behind them. Sends connect first and accepts queue the
+ * connections of other steps, so setting up the sockets cannot deadlock.
+ */
+static ncclResult_t bootstrapBruckAllGather(struct bootstrapState* state, char* data, int size) {
+  ncclResult_t ret = ncclSuccess;
+  int rank = state->rank;
+  int nranks = state->nranks;
+  char* tmp = NULL;
+
+  if (nranks == 1) return ncclSuccess;
+  if (state->nBruckSteps == 0) {
+    int nSteps = 0;
+    while ((1<<nSteps) < nranks) nSteps++;
+    NCCLCHECK(ncclCalloc(&state->bruckSendSockets, nSteps));
+    NCCLCHECK(ncclCalloc(&state->bruckRecvSockets, nSteps));
+    for (int k=0; k<nSteps; k++) {
+      int dist = 1<<k;
+      NCCLCHECK(bootstrapConnect(state, (rank-dist+nranks)%nranks, BOOTSTRAP_TAG_BRUCK+k, state->bruckSendSockets+k));
+      NCCLCHECK(bootstrapAccept(state, (rank+dist)%nranks, BOOTSTRAP_TAG_BRUCK+k, state->bruckRecvSockets+k));
+      state->nBruckSteps = k+1;
+    }
+  }
+
+  NCCLCHECK(ncclCalloc(&tmp, (size_t)nranks*size));
+  memcpy(tmp, data+(size_t)rank*size, size);
+  for (int k=0; k<state->nBruckSteps; k++) {
+    int dist = 1<<k;
+    int count = std::min(dist, nranks-dist);
+    NCCLCHECKGOTO(bootstrapSendRecv(state->bruckSendSockets+k, tmp, state->bruckRecvSockets+k, tmp+(size_t)dist*size, count*size), ret, exit);
+  }
+  for (int i=0; i<nranks; i++) memcpy(data+(size_t)((rank+i)%nranks)*size, tmp+(size_t)i*size, size);
+exit:
+  free(tmp);
+  return ret;
+}
+
 ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
-  char* data = (char*)allData;
+  int algo = rcclParamBootstrapAllGather();
+  if (algo == -1) algo = state->nranks >= BOOTSTRAP_BRUCK_MIN_RANKS && size <= BOOTSTRAP_BRUCK_MAX_SIZE ? 1 : 0;
+  // The Bruck steps move up to nranks/2 slices at once
+  if (algo == 1 && (int64_t)size*state->nranks > INT_MAX) algo = 0;
+  TRACE(NCCL_INIT, "rank %d nranks %d size %d algo %s", state->rank, state->nranks, size, algo == 1 ? "Bruck" : "Ring");
+  if (algo == 1) return bootstrapBruckAllGather(state, (char*)allData, size);
+  return bootstrapRingAllGather(state, (char*)allData, size);
+}
+
+static ncclResult_t bootstrapRingAllGather(struct bootstrapState* state, char* data, int size) {
   int rank = state->rank;
   int nranks = state->nranks;
 
@@ -404,15 +732,39 @@ ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
   return ncclSuccess;
 }
 
+// Opens a connection to peer, matched on its side by bootstrapAccept() with the same tag
+static ncclResult_t bootstrapConnect(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock) {
+  NCCLCHECK(ncclSocketInit(sock, state->peerCommAddresses+peer, state->magic, ncclSocketTypeBootstrap));
+  NCCLCHECK(ncclSocketConnect(sock));
+  NCCLCHECK(bootstrapNetSend(sock, &state->rank, sizeof(int)));
+  NCCLCHECK(bootstrapNetSend(sock, &tag, sizeof(int)));
+  return ncclSuccess;
+}
+
 ncclResult_t bootstrapSend(void* commState, int peer, int tag, void* data, int size) {
   ncclResult_t ret = ncclSuccess;
   struct bootstrapState* state = (struct bootstrapState*)commState;
   struct ncclSocket sock;
 
-  NCCLCHECKGOTO(ncclSocketInit(&sock, state->peerCommAddresses+peer, state->magic, ncclSocketTypeBootstrap), ret, fail);
-  NCCLCHECKGOTO(ncclSocketConnect(&sock), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(&sock, &state->rank, sizeof(int)), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(&sock, &tag, sizeof(int)), ret, fail);
+  if (rcclParamBootstrapPeerConns()) {
+    if (state->peerSendSockets[peer] == NULL) {
+      struct ncclSocket* peerSock;
+      NCCLCHECK(ncclCalloc(&peerSock, 1));
+      ret = bootstrapConnect(state, peer, BOOTSTRAP_TAG_CONN, peerSock);
+      if (ret != ncclSuccess) {
+        (void)ncclSocketClose(peerSock);
+        free(peerSock);
+        return ret;
+      }
+      state->peerSendSockets[peer] = peerSock;
+    }
+    // Messages are framed by their tag, then their size
+    NCCLCHECK(ncclSocketSend(state->peerSendSockets[peer], &tag, sizeof(int)));
+    NCCLCHECK(bootstrapNetSend(state->peerSendSockets[peer], data, size));
+    return ncclSuccess;
+  }
+
+  NCCLCHECKGOTO(bootstrapConnect(state, peer, tag, &sock), ret, fail);
   NCCLCHECKGOTO(bootstrapNetSend(&sock, data, size), ret, fail);
 
 exit:
@@ -530,34 +882,136 @@ static void unexpectedFree(struct bootstrapState* state) {
   return;
 }
 
-// We can't know who we'll receive from, so we need to receive everything at once
-ncclResult_t bootstrapRecv(void* commState, int peer, int tag, void* data, int size) {
-  ncclResult_t ret = ncclSuccess;
-  struct bootstrapState* state = (struct bootstrapState*)commState;
-  struct ncclSocket sock;
+static int unexpectedMsgBucket(int peer, int tag) {
+  return (int)(((uint32_t)peer*2654435761u ^ (uint32_t)tag) % BOOTSTRAP_UNEX_BUCKETS);
+}
+
+static ncclResult_t unexpectedMsgEnqueue(struct bootstrapState* state, int peer, int tag, int size, char* data) {
+  struct unexMsg* unex;
+  NCCLCHECK(ncclCalloc(&unex, 1));
+  unex->peer = peer;
+  unex->tag = tag;
+  unex->size = size;
+  unex->data = data;
+  struct unexMsg** list = state->unexpectedMessages+unexpectedMsgBucket(peer, tag);
+  while (*list) list = &(*list)->next;
+  *list = unex;
+  return ncclSuccess;
+}
+
+// Takes the oldest message of peer with this tag, if one was already read
+static ncclResult_t unexpectedMsgDequeue(struct bootstrapState* state, int peer, int tag, void* data, int size, int* found) {
+  *found = 0;
+  for (struct unexMsg** list = state->unexpectedMessages+unexpectedMsgBucket(peer, tag); *list; list = &(*list)->next) {
+    struct unexMsg* elem = *list;
+    if (elem->peer != peer || elem->tag != tag) continue;
+    *list = elem->next;
+    *found = 1;
+    ncclResult_t ret = ncclSuccess;
+    if (elem->size > size) {
+      WARN("Message truncated : received %d bytes instead of %d", elem->size, size);
+      ret = ncclInternalError;
+    } else {
+      memcpy(data, elem->data, elem->size);
+    }
+    free(elem->data);
+    free(elem);
+    return ret;
+  }
+  return ncclSuccess;
+}
+
+static int unexpectedMsgFree(struct bootstrapState* state) {
+  int nMsgs = 0;
+  for (int b=0; b<BOOTSTRAP_UNEX_BUCKETS; b++) {
+    while (state->unexpectedMessages[b]) {
+      struct unexMsg* elem = state->unexpectedMessages[b];
+      state->unexpectedMessages[b] = elem->next;
+      free(elem->data);
+      free(elem);
+      nMsgs++;
+    }
+  }
+  return nMsgs;
+}
+
+// Accepts the next connection. Connections of peers (BOOTSTRAP_TAG_CONN) are kept for their
+// messages, the others carry a single message with their tag.
+static ncclResult_t bootstrapAcceptNext(struct bootstrapState* state, struct ncclSocket* sock, int* peer, int* tag) {
+  NCCLCHECK(ncclSocketInit(sock));
+  NCCLCHECK(ncclSocketAccept(sock, &state->listenSock));
+  NCCLCHECK(bootstrapNetRecv(sock, peer, sizeof(int)));
+  NCCLCHECK(bootstrapNetRecv(sock, tag, sizeof(int)));
+  if (*tag == BOOTSTRAP_TAG_CONN) {
+    if (*peer < 0 || *peer >= state->nranks || state->peerRecvSockets[*peer] != NULL) {
+      WARN("Bootstrap : unexpected connection from rank %d", *peer);
+      return ncclInternalError;
+    }
+    NCCLCHECK(ncclCalloc(state->peerRecvSockets+*peer, 1));
+    memcpy(state->peerRecvSockets[*peer], sock, sizeof(struct ncclSocket));
+  }
+  return ncclSuccess;
+}
+
+// We can't know who we'll receive from, so we accept everyone and queue the unexpected connections
+static ncclResult_t bootstrapAccept(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock) {
   int newPeer, newTag;
 
   // Search unexpected connections first
   int found;
-  NCCLCHECK(unexpectedDequeue(state, peer, tag, &sock, &found));
-  if (found) {
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, ((char*)data), size), ret, fail);
-    goto exit;
-  }
+  NCCLCHECK(unexpectedDequeue(state, peer, tag, sock, &found));
+  if (found) return ncclSuccess;
 
   // Then look for new connections
   while (1) {
-    NCCLCHECKGOTO(ncclSocketInit(&sock), ret, fail);
-    NCCLCHECKGOTO(ncclSocketAccept(&sock, &state->listenSock), ret, fail);
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, &newPeer, sizeof(int)), ret, fail);
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, &newTag, sizeof(int)), ret, fail);
-    if (newPeer == peer && newTag == tag) {
-      NCCLCHECKGOTO(bootstrapNetRecv(&sock, ((char*)data), size), ret, fail);
-      goto exit;
-    }
+    NCCLCHECK(bootstrapAcceptNext(state, sock, &newPeer, &newTag));
+    if (newTag == BOOTSTRAP_TAG_CONN) continue;
+    if (newPeer == peer && newTag == tag) return ncclSuccess;
     // Unexpected connection. Save for later.
-    NCCLCHECKGOTO(unexpectedEnqueue(state, newPeer, newTag, &sock), ret, fail);
+    NCCLCHECK(unexpectedEnqueue(state, newPeer, newTag, sock));
   }
+}
+
+ncclResult_t bootstrapRecv(void* commState, int peer, int tag, void* data, int size) {
+  ncclResult_t ret = ncclSuccess;
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  struct ncclSocket sock;
+  int found;
+
+  NCCLCHECK(unexpectedMsgDequeue(state, peer, tag, data, size, &found));
+  if (found) return ncclSuccess;
+  NCCLCHECKGOTO(ncclSocketInit(&sock), ret, fail);
+  NCCLCHECKGOTO(unexpectedDequeue(state, peer, tag, &sock, &found), ret, fail);
+  while (!found) {
+    struct ncclSocket* peerSock = state->peerRecvSockets[peer];
+    if (peerSock == NULL) {
+      // Until peer connects, messages of other peers may queue their connection
+      int newPeer, newTag;
+      NCCLCHECKGOTO(bootstrapAcceptNext(state, &sock, &newPeer, &newTag), ret, fail);
+      if (newTag == BOOTSTRAP_TAG_CONN) {
+        // sock is now owned by peerRecvSockets
+        NCCLCHECKGOTO(ncclSocketInit(&sock), ret, fail);
+        continue;
+      }
+      if (newPeer == peer && newTag == tag) break;
+      NCCLCHECKGOTO(unexpectedEnqueue(state, newPeer, newTag, &sock), ret, fail);
+      continue;
+    }
+    // Messages of peer come in order, keep the ones of other tags for their receive
+    int msgTag, msgSize;
+    char* msgData;
+    NCCLCHECKGOTO(ncclSocketRecv(peerSock, &msgTag, sizeof(int)), ret, fail);
+    if (msgTag == tag) return bootstrapNetRecv(peerSock, data, size);
+    NCCLCHECKGOTO(ncclSocketRecv(peerSock, &msgSize, sizeof(int)), ret, fail);
+    NCCLCHECKGOTO(ncclCalloc(&msgData, std::max(msgSize, 1)), ret, fail);
+    ret = ncclSocketRecv(peerSock, msgData, msgSize);
+    if (ret == ncclSuccess) ret = unexpectedMsgEnqueue(state, peer, msgTag, msgSize, msgData);
+    if (ret != ncclSuccess) {
+      free(msgData);
+      goto fail;
+    }
+  }
+  NCCLCHECKGOTO(bootstrapNetRecv(&sock, ((char*)data), size), ret, fail);
 exit:
   NCCLCHECK(ncclSocketClose(&sock));
   return ret;
@@ -565,6 +1019,34 @@ fail:
   goto exit;
 }
 
+static ncclResult_t bootstrapPeerConnsClose(struct bootstrapState* state) {
+  for (int r=0; r<state->nranks; r++) {
+    if (state->peerSendSockets && state->peerSendSockets[r]) {
+      NCCLCHECK(ncclSocketClose(state->peerSendSockets[r]));
+      free(state->peerSendSockets[r]);
+    }
+    if (state->peerRecvSockets && state->peerRecvSockets[r]) {
+      NCCLCHECK(ncclSocketClose(state->peerRecvSockets[r]));
+      free(state->peerRecvSockets[r]);
+    }
+  }
+  free(state->peerSendSockets);
+  free(state->peerRecvSockets);
+  state->peerSendSockets = state->peerRecvSockets = NULL;
+  return ncclSuccess;
+}
+
+static ncclResult_t bootstrapBruckClose(struct bootstrapState* state) {
+  for (int k=0; k<state->nBruckSteps; k++) {
+    NCCLCHECK(ncclSocketClose(state->bruckSendSockets+k));
+    NCCLCHECK(ncclSocketClose(state->bruckRecvSockets+k));
+  }
+  free(state->bruckSendSockets);
+  free(state->bruckRecvSockets);
+  state->nBruckSteps = 0;
+  return ncclSuccess;
+}
+
 ncclResult_t bootstrapClose(void* commState) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
   if (state->unexpectedConnections != NULL) {
@@ -574,10 +1056,16 @@ ncclResult_t bootstrapClose(void* commState) {
       return ncclInternalError;
     }
   }
+  if (unexpectedMsgFree(state) && *state->abortFlag == 0) {
+    WARN("Unexpected messages are not empty");
+    return ncclInternalError;
+  }
 
   NCCLCHECK(ncclSocketClose(&state->listenSock));
   NCCLCHECK(ncclSocketClose(&state->ringSendSocket));
   NCCLCHECK(ncclSocketClose(&state->ringRecvSocket));
+  NCCLCHECK(bootstrapBruckClose(state));
+  NCCLCHECK(bootstrapPeerConnsClose(state));
 
   free(state->peerCommAddresses);
   free(state);
@@ -591,6 +1079,9 @@ ncclResult_t bootstrapAbort(void* commState) {
   NCCLCHECK(ncclSocketClose(&state->listenSock));
   NCCLCHECK(ncclSocketClose(&state->ringSendSocket));
   NCCLCHECK(ncclSocketClose(&state->ringRecvSocket));
+  NCCLCHECK(bootstrapBruckClose(state));
+  NCCLCHECK(bootstrapPeerConnsClose(state));
+  unexpectedMsgFree(state);
   free(state->peerCommAddresses);
   free(state->peerProxyAddresses);
   free(state);
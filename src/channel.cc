@@ -11,6 +11,7 @@
 ncclResult_t initChannel(struct ncclComm* comm, int channelId) {
   struct ncclChannel* channel = &comm->channels[channelId];
   if (channel->id != -1) return ncclSuccess;
+  ncclMemScope memScope(&comm->sharedRes->memUsage, ncclMemTagChannels);
 
   int nRanks = comm->nRanks;
   int nPeers = nRanks + 1 /* Collnet */ + comm->localRanks /* NVLS */;
@@ -27,30 +28,21 @@ ncclResult_t initChannel(struct ncclComm* comm, int channelId) {
     // shared between communicators hence should not be tied to comm.
     if (sharedRes->peers[channelId] == NULL) {
       NCCLCHECK(ncclCalloc(sharedRes->peers + channelId, sharedRes->tpNRanks));
+      NCCLCHECK(ncclCalloc(sharedRes->devPeers + channelId, sharedRes->tpNRanks));
     }
     channel->peers = ncclMemoryStackAlloc<struct ncclChannelPeer*>(&comm->memPermanent, nPeers);
-    for (int r = 0; r < nRanks; r++) {
-      channel->peers[r] = comm->sharedRes->peers[channelId] + comm->topParentRanks[r];
-      ncclAtomicRefCountIncrement(&channel->peers[r]->refCount);
-    }
   }
 
   if (channel->devPeers == NULL) {
-    if (sharedRes->devPeers[channelId] == NULL) {
-      NCCLCHECK(ncclCudaCallocAsync(sharedRes->devPeers + channelId, sharedRes->tpNRanks, sharedRes->deviceStream.cudaStream));
-    }
-    /* channel->devPeers is not shared, so just free it when calling commFree() */
-    NCCLCHECK(ncclCudaCallocAsync(&channel->devPeers, nPeers, sharedRes->deviceStream.cudaStream));
-    ncclCommPushCudaFree(comm, channel->devPeers);
-    for (int r = 0; r < nRanks; r++) {
-      uintptr_t addr = (uintptr_t)(comm->sharedRes->devPeers[channelId] + comm->topParentRanks[r]);
-      NCCLCHECK(ncclCudaMemcpyAsync((uintptr_t*)(channel->devPeers + r), (uintptr_t*)&addr, 1, sharedRes->deviceStream.cudaStream));
-    }
+    /* channel->devPeers is not shared, it lives in the arena as long as sharedRes */
+    NCCLCHECK(ncclDevArenaCallocAsync(&sharedRes->devArena, &channel->devPeers, nPeers, sharedRes->deviceStream.cudaStream));
   }
+  // Peers of ring, tree and p2p connections are added as they are connected, send/recv to self
+  // uses the entry of this rank without connecting
+  NCCLCHECK(initChannelPeer(comm, channelId, comm->rank, sharedRes->deviceStream.cudaStream));
 
   channel->ring.userRanks = ncclMemoryStackAlloc<int>(&comm->memPermanent, nRanks);
-  NCCLCHECK(ncclCudaCallocAsync(&channel->devRingUserRanks, nRanks, sharedRes->deviceStream.cudaStream));
-  ncclCommPushCudaFree(comm, channel->devRingUserRanks);
+  NCCLCHECK(ncclDevArenaCallocAsync(&sharedRes->devArena, &channel->devRingUserRanks, nRanks, sharedRes->deviceStream.cudaStream));
 
   NCCLCHECK(ncclStrongStreamRelease(ncclCudaGraphNone(), &sharedRes->deviceStream));
   CUDACHECK(hipEventRecord(sharedRes->deviceStream.scratchEvent, sharedRes->deviceStream.cudaStream));
@@ -59,9 +51,38 @@ ncclResult_t initChannel(struct ncclComm* comm, int channelId) {
   return ncclSuccess;
 }
 
+// Peer entries take a few KB on the host and the device, so with many ranks they are only
+// allocated for the ranks this rank connects with. Split children sharing resources share the
+// entries of their top parent ranks.
+static pthread_mutex_t channelPeerLock = PTHREAD_MUTEX_INITIALIZER;
+
+ncclResult_t initChannelPeer(struct ncclComm* comm, int channelId, int peer, cudaStream_t stream) {
+  struct ncclChannel* channel = &comm->channels[channelId];
+  if (channel->peers[peer] != NULL) return ncclSuccess;
+  struct ncclSharedResources* sharedRes = comm->sharedRes;
+  ncclMemScope memScope(&sharedRes->memUsage, ncclMemTagChannels);
+  int tpPeer = comm->topParentRanks[peer];
+  ncclResult_t ret = ncclSuccess;
+
+  pthread_mutex_lock(&channelPeerLock);
+  if (sharedRes->peers[channelId][tpPeer] == NULL) {
+    NCCLCHECKGOTO(ncclDevArenaCallocAsync(&sharedRes->devArena, sharedRes->devPeers[channelId] + tpPeer, 1, stream), ret, exit);
+    NCCLCHECKGOTO(ncclCalloc(sharedRes->peers[channelId] + tpPeer, 1), ret, exit);
+  }
+  channel->peers[peer] = sharedRes->peers[channelId][tpPeer];
+  ncclAtomicRefCountIncrement(&channel->peers[peer]->refCount);
+exit:
+  pthread_mutex_unlock(&channelPeerLock);
+  NCCLCHECK(ret);
+  uintptr_t addr = (uintptr_t)sharedRes->devPeers[channelId][tpPeer];
+  NCCLCHECK(ncclCudaMemcpyAsync((uintptr_t*)(channel->devPeers + peer), &addr, 1, stream));
+  return ncclSuccess;
+}
+
 ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share) {
   struct ncclChannel* channel = &comm->channels[channelId];
   struct ncclSharedResources* sharedRes = comm->sharedRes;
+  ncclMemScope memScope(&sharedRes->memUsage, ncclMemTagChannels);
 
   if (channel->nvlsPeers != NULL)
     return ncclSuccess;
@@ -83,7 +104,7 @@ ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclCo
     }
   } else {
     NCCLCHECK(ncclCalloc(&channel->nvlsPeers, comm->localRanks));
-    NCCLCHECK(ncclCudaCallocAsync(&channel->nvlsDevPeers, comm->localRanks, sharedRes->deviceStream.cudaStream));
+    NCCLCHECK(ncclDevArenaCallocAsync(&sharedRes->devArena, &channel->nvlsDevPeers, comm->localRanks, sharedRes->deviceStream.cudaStream));
     for (int r = 0; r < comm->localRanks; ++r) {
       uintptr_t addr = (uintptr_t)(channel->nvlsDevPeers + r);
       channel->peers[comm->nRanks + 1 + r] = channel->nvlsPeers + r;
@@ -100,6 +121,7 @@ ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclCo
 ncclResult_t initCollnetChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share) {
   struct ncclChannel* channel = &comm->channels[channelId];
   struct ncclSharedResources* sharedRes = comm->sharedRes;
+  ncclMemScope memScope(&sharedRes->memUsage, ncclMemTagChannels);
   uintptr_t addr;
 
   if (channel->collnetPeers != NULL)
@@ -119,7 +141,7 @@ ncclResult_t initCollnetChannel(struct ncclComm* comm, int channelId, struct ncc
     ncclAtomicRefCountIncrement(&parent->channels[channelId].collnetPeers->refCount);
   } else {
     NCCLCHECK(ncclCalloc(&channel->collnetPeers, 1));
-    NCCLCHECK(ncclCudaCallocAsync(&channel->collnetDevPeers, 1, sharedRes->deviceStream.cudaStream));
+    NCCLCHECK(ncclDevArenaCallocAsync(&sharedRes->devArena, &channel->collnetDevPeers, 1, sharedRes->deviceStream.cudaStream));
     addr = (uintptr_t)channel->collnetDevPeers;
     channel->peers[comm->nRanks] = channel->collnetPeers;
     NCCLCHECK(ncclCudaMemcpyAsync((uintptr_t*)(channel->devPeers + comm->nRanks), (uintptr_t*)&addr, 1, sharedRes->deviceStream.cudaStream));
@@ -150,10 +172,8 @@ ncclResult_t freeChannel(struct ncclChannel* channel, int nRanks, int collnetNRa
         }
         if (r == nRanks) {
           free(channel->collnetPeers);
-          ncclCudaFree(channel->collnetDevPeers);
         } else if (r == nPeers - 1) {
           free(channel->nvlsPeers);
-          ncclCudaFree(channel->nvlsDevPeers);
         }
       }
     }
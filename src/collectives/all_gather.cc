@@ -6,6 +6,7 @@
  ************************************************************************/
 
 #include "enqueue.h"
+#include "argcheck.h"
 #include "collectives.h"
 
 #include "msccl/msccl_lifecycle.h"
@@ -21,7 +22,7 @@ ncclResult_t ncclAllGather(const void* sendbuff, void* recvbuff, size_t sendcoun
   size_t msgsize = sendcount * ncclTypeSize(datatype);
   NVTX3_FUNC_WITH_PARAMS(AllGather, AllGatherSchema, msgsize)
 
-  if (mscclAvailable() && !mscclIsCaller()) {
+  if (mscclAvailable() && !mscclIsCaller() && !(comm && comm->readyFlags)) {
     return mscclEnqueueCheck(
       sendbuff, nullptr, nullptr, recvbuff, nullptr, nullptr,
       sendcount, datatype, 0, 0, ncclSum, mscclFuncAllGather, comm, stream);
@@ -32,3 +33,61 @@ ncclResult_t ncclAllGather(const void* sendbuff, void* recvbuff, size_t sendcoun
     ALLGATHER_CHUNKSTEPS, ALLGATHER_SLICESTEPS };
   return ncclEnqueueCheck(&info);
 }
+
+// Uneven segments are forwarded along the ring with one ncclBroadcast per segment, rooted at its
+// owner, all in one group so that they share a launch and split the channels. Per link this moves
+// the same volume as a ring allgather of the padded size minus the padding.
+NCCL_API(ncclResult_t, ncclAllGatherV, const void* sendbuff, size_t sendcount, void* recvbuff,
+    const size_t recvcounts[], const size_t rdispls[], ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclAllGatherV(const void* sendbuff, size_t sendcount, void* recvbuff,
+    const size_t recvcounts[], const size_t rdispls[], ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "AllGatherV", "comm"));
+  NCCLCHECK(PtrCheck((void*)recvcounts, "AllGatherV", "recvcounts"));
+  NCCLCHECK(PtrCheck((void*)rdispls, "AllGatherV", "rdispls"));
+  if (datatype < 0 || datatype >= ncclNumTypes) {
+    WARN("AllGatherV : invalid type %d", datatype);
+    return ncclInvalidArgument;
+  }
+  int nRanks = comm->nRanks;
+  if (recvcounts[comm->rank] != sendcount) {
+    WARN("AllGatherV : sendcount %zu differs from recvcounts[%d] = %zu", sendcount, comm->rank, recvcounts[comm->rank]);
+    return ncclInvalidArgument;
+  }
+
+  bool even = true;
+  for (int r=0; r<nRanks && even; r++) even = recvcounts[r] == sendcount && rdispls[r] == r*sendcount;
+  if (even) return ncclAllGather(sendbuff, recvbuff, sendcount, datatype, comm, stream);
+
+  size_t typeSize = ncclTypeSize(datatype);
+  NCCLCHECK(ncclGroupStart());
+  for (int r=0; r<nRanks; r++) {
+    if (recvcounts[r] == 0) continue;
+    char* segment = (char*)recvbuff+rdispls[r]*typeSize;
+    NCCLCHECK(ncclBroadcast(r == comm->rank ? sendbuff : segment, segment, recvcounts[r], datatype, r, comm, stream));
+  }
+  NCCLCHECK(ncclGroupEnd());
+  return ncclSuccess;
+}
+
+// The counters live in ncclDevComm, which kernels copy at launch, so they are switched with a
+// plain copy while no operation of the communicator runs
+NCCL_API(ncclResult_t, ncclCommSetReadyFlags, ncclComm_t comm, uint64_t* flags);
+ncclResult_t ncclCommSetReadyFlags(ncclComm_t comm, uint64_t* flags) {
+  NCCLCHECK(PtrCheck(comm, "CommSetReadyFlags", "comm"));
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  if (flags && comm->checkPointers) {
+    ncclResult_t ret = CudaPtrCheck(flags, comm, "flags", "CommSetReadyFlags");
+    if (ret != ncclSuccess) {
+      CUDACHECK(cudaSetDevice(savedDev));
+      return ret;
+    }
+  }
+  CUDACHECK(cudaMemcpy(&comm->devComm->readyFlags, &flags, sizeof(flags), cudaMemcpyHostToDevice));
+  CUDACHECK(cudaSetDevice(savedDev));
+  comm->readyFlags = flags;
+  INFO(NCCL_COLL, "comm %p rank %d ready flags %p", comm, comm->rank, flags);
+  return ncclSuccess;
+}
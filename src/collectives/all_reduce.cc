@@ -6,10 +6,400 @@
  ************************************************************************/
 
 #include "enqueue.h"
+#include "graph.h"
 #include "nccl.h"
+#include "collectives.h"
+#include "bootstrap.h"
+#include "argcheck.h"
 
 #include "msccl/msccl_lifecycle.h"
 
+RCCL_PARAM(HierAllReduce, "HIER_ALLREDUCE", 0);
+
+// Hierarchical allreduce (RCCL_HIER_ALLREDUCE): a reduce-scatter inside the node over xGMI, an
+// allreduce of each shard across nodes on the rail of its local rank, i.e. on the NIC of that GPU,
+// and an allgather inside the node. Each phase runs on its own child communicator, created by the
+// first eligible allreduce (or hierarchical alltoall). 1 uses it when the tuning model of the
+// phases beats the flat algorithms, 2 whenever the allreduce is eligible.
+ncclResult_t ncclHierCommsInit(struct ncclComm* comm) {
+  comm->hierState = -1;
+  // Shards are per local rank, every node needs the same number of ranks
+  for (int n=0; n<comm->nNodes; n++) {
+    if (comm->nodeRanks[n].localRanks != comm->localRanks) {
+      INFO(NCCL_INIT, "Hierarchical collectives disabled, nodes have different numbers of ranks");
+      return ncclSuccess;
+    }
+  }
+  ncclConfig_t config = NCCL_CONFIG_INITIALIZER;
+  config.blocking = 1;
+  NCCLCHECK(ncclCommSplit(comm, comm->node, comm->localRank, &comm->hierIntraComm, &config));
+  NCCLCHECK(ncclCommSplit(comm, comm->localRank, comm->node, &comm->hierRailComm, &config));
+
+  // Local ranks sit on different rails, whose NICs may differ: as for the Rabenseifner allreduce,
+  // the model is evaluated per power of two of the size and only the sizes where the phases win on
+  // all ranks are kept, so that they all take the same path.
+  comm->hierArSizeMask = 0;
+  if (rcclParamHierAllReduce() == 1) {
+    uint64_t* masks;
+    NCCLCHECK(ncclCalloc(&masks, comm->nRanks));
+    for (int b=0; b<64; b++) {
+      size_t bytes = 1ULL << b;
+      float flatTime, rsTime, arTime, agTime;
+      NCCLCHECK(ncclTopoGetCollTime(comm, ncclFuncAllReduce, bytes, &flatTime));
+      NCCLCHECK(ncclTopoGetCollTime(comm->hierIntraComm, ncclFuncReduceScatter, bytes, &rsTime));
+      NCCLCHECK(ncclTopoGetCollTime(comm->hierRailComm, ncclFuncAllReduce, bytes/comm->localRanks, &arTime));
+      NCCLCHECK(ncclTopoGetCollTime(comm->hierIntraComm, ncclFuncAllGather, bytes, &agTime));
+      if (flatTime < 0 || rsTime < 0 || arTime < 0 || agTime < 0 || rsTime+arTime+agTime >= flatTime) continue;
+      masks[comm->rank] |= 1ULL << b;
+    }
+    ncclResult_t ret = bootstrapAllGather(comm->bootstrap, masks, sizeof(uint64_t));
+    comm->hierArSizeMask = ~0ULL;
+    for (int r=0; r<comm->nRanks; r++) comm->hierArSizeMask &= masks[r];
+    free(masks);
+    NCCLCHECK(ret);
+  }
+  comm->hierState = 1;
+  INFO(NCCL_INIT, "Hierarchical collectives over %d nodes of %d ranks, allreduce size mask 0x%lx",
+      comm->nNodes, comm->localRanks, comm->hierArSizeMask);
+  return ncclSuccess;
+}
+
+// The hierarchical collectives run each phase as a collective of its own on a child communicator,
+// ordered on the stream, so they can not be part of a group and need a blocking communicator that
+// is ready. Callers add their own conditions, which must evaluate the same on all ranks.
+bool ncclHierEligible(struct ncclComm* comm) {
+  return comm != NULL && comm->hierState >= 0 && ncclGroupDepth == 0 && comm->config.blocking &&
+      comm->initState == ncclSuccess;
+}
+
+// Phases that move whole node blocks (alltoall, gather, scatter) need ranks numbered node by node
+bool ncclHierRanksContiguous(struct ncclComm* comm) {
+  for (int n=0; n<comm->nNodes; n++) {
+    for (int l=0; l<comm->nodeRanks[n].localRanks; l++) {
+      if (comm->nodeRanks[n].localRankToRank[l] != n*comm->localRanks+l) return false;
+    }
+  }
+  return true;
+}
+
+// Grows one of the staging buffers of the hierarchical collectives. Growing waits for the device,
+// as previous calls may still be using the old buffer, so it is skipped (*ok = false) under capture.
+ncclResult_t ncclHierStagingReserve(struct ncclComm* comm, char** buff, size_t* buffBytes, size_t bytes,
+    cudaStream_t stream, bool* ok) {
+  *ok = false;
+  if (*buffBytes < bytes) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    int savedDev;
+    CUDACHECK(cudaGetDevice(&savedDev));
+    CUDACHECK(cudaSetDevice(comm->cudaDev));
+    CUDACHECK(cudaDeviceSynchronize());
+    if (*buff) NCCLCHECK(ncclCudaFree(*buff));
+    *buff = nullptr;
+    *buffBytes = 0;
+    NCCLCHECK(ncclCudaCalloc(buff, bytes, comm->sideStream));
+    *buffBytes = bytes;
+    CUDACHECK(cudaSetDevice(savedDev));
+  }
+  *ok = true;
+  return ncclSuccess;
+}
+
+static ncclResult_t hierAllReduce(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclRedOp_t op, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  if (rcclParamHierAllReduce() == 0 || !ncclHierEligible(comm)) return ncclSuccess;
+  if (comm->nNodes == 1 || comm->localRanks == 1 || count == 0 || count % comm->localRanks) return ncclSuccess;
+  // User defined reduction operators only exist on this communicator
+  if (op < 0 || op >= ncclNumOps || datatype < 0 || datatype >= ncclNumTypes) return ncclSuccess;
+
+  if (comm->hierState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+  }
+
+  size_t typeSize = ncclTypeSize(datatype);
+  size_t shard = count/comm->localRanks;
+  if (rcclParamHierAllReduce() == 1) {
+    int log2Bytes = 63 - __builtin_clzll(count*typeSize);
+    if ((comm->hierArSizeMask & (1ULL << log2Bytes)) == 0) return ncclSuccess;
+  }
+
+  char* shardBuff = (char*)recvbuff + comm->localRank*shard*typeSize;
+  NCCLCHECK(ncclReduceScatter(sendbuff, shardBuff, shard, datatype, op, comm->hierIntraComm, stream));
+  NCCLCHECK(ncclAllReduce(shardBuff, shardBuff, shard, datatype, op, comm->hierRailComm, stream));
+  NCCLCHECK(ncclAllGather(shardBuff, recvbuff, shard, datatype, comm->hierIntraComm, stream));
+  *done = true;
+  return ncclSuccess;
+}
+
+RCCL_PARAM(RabenseifnerAllReduce, "RABENSEIFNER_ALLREDUCE", 0);
+
+// Rabenseifner allreduce (RCCL_RABENSEIFNER_ALLREDUCE): the hierarchical allreduce with recursive
+// halving and doubling across nodes instead of a rail allreduce, so that its latency grows with
+// log2(nNodes) while it still moves each byte about twice. Shards are reduce-scattered inside the
+// node, then each step of the halving reduce-scatters the part of the shard both nodes of a pair
+// still hold, keeping one half, and the doubling allgathers them back in reverse order. With a node
+// count that is not a power of two, the first 2*(nNodes-2^k) nodes first fold in pairs, the even
+// node reducing into the odd one which takes part in the steps and sends the result back. Pairs run
+// on 2-rank communicators split from the rail communicator and sharing its resources. 1 uses it
+// when the tuning model of the phases beats the flat algorithms, 2 whenever the allreduce is eligible.
+static ncclResult_t rabCommsInit(struct ncclComm* comm) {
+  struct ncclComm* rail = comm->hierRailComm;
+  int nNodes = rail->nRanks, node = rail->rank;
+  int steps = 0;
+  while ((2<<steps) <= nNodes) steps++;
+  comm->rabState = -1;
+  if (steps > RCCL_RAB_MAX_STEPS) return ncclSuccess;
+  int nFolded = nNodes - (1<<steps);
+  ncclConfig_t config = NCCL_CONFIG_INITIALIZER;
+  config.blocking = 1;
+  config.splitShare = 1;
+  // Odd nodes get rank 1 of their pair, so they are the root of the fold
+  int folding = node < 2*nFolded;
+  NCCLCHECK(ncclCommSplit(rail, folding ? node/2 : NCCL_SPLIT_NOCOLOR, node%2, &comm->rabFoldComm, &config));
+  comm->rabRank = folding ? (node%2 ? node/2 : -1) : node-nFolded;
+  comm->rabSteps = steps;
+  for (int s=0; s<steps; s++) {
+    int mask = 1<<s;
+    int color = comm->rabRank == -1 ? NCCL_SPLIT_NOCOLOR : comm->rabRank & ~mask;
+    NCCLCHECK(ncclCommSplit(rail, color, comm->rabRank & mask ? 1 : 0, comm->rabStepComms+s, &config));
+  }
+
+  // The tuning model is evaluated once per power of two of the size and the ranks only keep the
+  // sizes where it wins for all of them: the pairs they estimate differ, not their decision.
+  uint64_t* masks;
+  NCCLCHECK(ncclCalloc(&masks, comm->nRanks));
+  for (int b=0; b<64; b++) {
+    size_t shardBytes = (1ULL << b)/comm->localRanks;
+    float flatTime, rsTime, agTime, time, rabTime;
+    NCCLCHECK(ncclTopoGetCollTime(comm, ncclFuncAllReduce, 1ULL << b, &flatTime));
+    NCCLCHECK(ncclTopoGetCollTime(comm->hierIntraComm, ncclFuncReduceScatter, 1ULL << b, &rsTime));
+    NCCLCHECK(ncclTopoGetCollTime(comm->hierIntraComm, ncclFuncAllGather, 1ULL << b, &agTime));
+    if (flatTime < 0 || rsTime < 0 || agTime < 0) continue;
+    rabTime = rsTime + agTime;
+    struct ncclComm* pair = comm->rabFoldComm ? comm->rabFoldComm : comm->rabStepComms[0];
+    if (nFolded && pair) {
+      NCCLCHECK(ncclTopoGetCollTime(pair, ncclFuncReduce, shardBytes, &time));
+      rabTime += time;
+      NCCLCHECK(ncclTopoGetCollTime(pair, ncclFuncBroadcast, shardBytes, &time));
+      rabTime += time;
+    }
+    for (int s=0; s<steps; s++) {
+      if (comm->rabStepComms[s]) pair = comm->rabStepComms[s];
+      if (pair == NULL) break;
+      NCCLCHECK(ncclTopoGetCollTime(pair, ncclFuncReduceScatter, shardBytes >> s, &time));
+      rabTime += time;
+      NCCLCHECK(ncclTopoGetCollTime(pair, ncclFuncAllGather, shardBytes >> s, &time));
+      rabTime += time;
+    }
+    if (rabTime < flatTime) masks[comm->rank] |= 1ULL << b;
+  }
+  ncclResult_t ret = bootstrapAllGather(comm->bootstrap, masks, sizeof(uint64_t));
+  comm->rabSizeMask = ~0ULL;
+  for (int r=0; r<comm->nRanks; r++) comm->rabSizeMask &= masks[r];
+  free(masks);
+  NCCLCHECK(ret);
+
+  comm->rabState = 1;
+  INFO(NCCL_INIT, "Rabenseifner allreduce over %d nodes, %d halving steps, %d nodes folded, size mask 0x%lx",
+      nNodes, steps, nFolded, comm->rabSizeMask);
+  return ncclSuccess;
+}
+
+static ncclResult_t rabAllReduce(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclRedOp_t op, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  int64_t mode = rcclParamRabenseifnerAllReduce();
+  if (mode == 0 || !ncclHierEligible(comm) || comm->rabState < 0) return ncclSuccess;
+  if (comm->nNodes < 2 || count == 0) return ncclSuccess;
+  // User defined reduction operators only exist on this communicator
+  if (op < 0 || op >= ncclNumOps || datatype < 0 || datatype >= ncclNumTypes) return ncclSuccess;
+  int steps = 0;
+  while ((2<<steps) <= comm->nNodes) steps++;
+  int nFolded = comm->nNodes - (1<<steps);
+  // Folding averages pairs before the steps, which would weigh the nodes unevenly
+  if (op == ncclAvg && nFolded) return ncclSuccess;
+  // Every step halves the part of the shard, which must stay a whole number of elements
+  if (count % ((size_t)comm->localRanks << steps)) return ncclSuccess;
+
+  if (comm->hierState == 0 || comm->rabState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    if (comm->hierState == 0) NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+    NCCLCHECK(rabCommsInit(comm));
+    if (comm->rabState < 0) return ncclSuccess;
+  }
+
+  size_t typeSize = ncclTypeSize(datatype);
+  size_t shard = count/comm->localRanks;
+  if (mode == 1) {
+    int log2Bytes = 63 - __builtin_clzll(count*typeSize);
+    if ((comm->rabSizeMask & (1ULL << log2Bytes)) == 0) return ncclSuccess;
+  }
+
+  char* shardBuff = (char*)recvbuff + comm->localRank*shard*typeSize;
+  NCCLCHECK(ncclReduceScatter(sendbuff, shardBuff, shard, datatype, op, comm->hierIntraComm, stream));
+  if (comm->rabFoldComm) NCCLCHECK(ncclReduce(shardBuff, shardBuff, shard, datatype, op, 1, comm->rabFoldComm, stream));
+  if (comm->rabRank != -1) {
+    // Keep the half of our bit at each step, in place, then gather them back in reverse order
+    size_t offset = 0, len = shard;
+    for (int s=0; s<steps; s++) {
+      int keep = comm->rabStepComms[s]->rank;
+      len /= 2;
+      NCCLCHECK(ncclReduceScatter(shardBuff+offset*typeSize, shardBuff+(offset+keep*len)*typeSize, len, datatype, op,
+          comm->rabStepComms[s], stream));
+      offset += keep*len;
+    }
+    for (int s=steps-1; s>=0; s--) {
+      int keep = comm->rabStepComms[s]->rank;
+      NCCLCHECK(ncclAllGather(shardBuff+offset*typeSize, shardBuff+(offset-keep*len)*typeSize, len, datatype,
+          comm->rabStepComms[s], stream));
+      offset -= keep*len;
+      len *= 2;
+    }
+  }
+  if (comm->rabFoldComm) NCCLCHECK(ncclBroadcast(shardBuff, shardBuff, shard, datatype, 1, comm->rabFoldComm, stream));
+  NCCLCHECK(ncclAllGather(shardBuff, recvbuff, shard, datatype, comm->hierIntraComm, stream));
+  *done = true;
+  return ncclSuccess;
+}
+
+RCCL_PARAM(QuickAllReduce, "QUICK_ALLREDUCE", 0);
+RCCL_PARAM(QuickAllReduceMaxBytes, "QUICK_ALLREDUCE_MAX_BYTES", 512*1024);
+
+// One-shot and two-shot allreduce (RCCL_QUICK_ALLREDUCE) for small sum allreduces on a single node
+// where all GPUs are connected by P2P. Each rank stages its input in a fine-grained area mapped by
+// all the other ranks. One-shot then reduces the inputs of all ranks, two-shot reduces one shard per
+// rank and gathers the reduced shards. Areas are set up by the first eligible allreduce and never
+// depend on the user buffers, so the kernel can be captured in graphs. 1 uses it when the tuning
+// model beats the flat algorithms, 2 whenever the allreduce is eligible.
+struct ncclQuickAllReduce {
+  char* buff; // our area, RCCL_QUICK_AR_DATA_OFFSET + 4*maxBytes
+  char** devPeers; // areas of all the ranks, mapped in our address space
+  void* ipcPtrs[RCCL_QUICK_AR_MAX_RANKS]; // areas of other processes, to close
+  size_t maxBytes;
+  int wallClockKHz; // rate of wall_clock64() in ncclAllReducePartial deadlines
+};
+
+static ncclResult_t quickAllReduceInit(struct ncclComm* comm) {
+  struct ncclQuickAllReduce* qar;
+  struct qarPeerInfo {
+    uint64_t pidHash;
+    char* buff;
+    cudaIpcMemHandle_t ipc;
+  }* infos = NULL;
+  char* peers[RCCL_QUICK_AR_MAX_RANKS];
+  ncclResult_t ret = ncclSuccess;
+  comm->quickArState = -1;
+  NCCLCHECK(ncclCalloc(&qar, 1));
+  comm->quickAr = qar;
+  qar->maxBytes = ROUNDUP(rcclParamQuickAllReduceMaxBytes(), sizeof(uint4)*RCCL_QUICK_AR_MAX_BLOCKS);
+  NCCLCHECK(ncclCudaCalloc(&qar->buff, RCCL_QUICK_AR_DATA_OFFSET + 4*qar->maxBytes, comm->sideStream, true));
+  CUDACHECK(hipDeviceGetAttribute(&qar->wallClockKHz, hipDeviceAttributeWallClockRate, comm->cudaDev));
+
+  NCCLCHECK(ncclCalloc(&infos, comm->nRanks));
+  infos[comm->rank].pidHash = comm->peerInfo[comm->rank].pidHash;
+  infos[comm->rank].buff = qar->buff;
+  CUDACHECKGOTO(cudaIpcGetMemHandle(&infos[comm->rank].ipc, qar->buff), ret, exit);
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, infos, sizeof(struct qarPeerInfo)), ret, exit);
+  for (int r=0; r<comm->nRanks; r++) {
+    if (infos[r].pidHash == infos[comm->rank].pidHash) {
+      // Same process, the area is usable once peer access is enabled
+      int peerDev = comm->peerInfo[r].cudaDev;
+      if (peerDev != comm->cudaDev) {
+        cudaError_t err = cudaDeviceEnablePeerAccess(peerDev, 0);
+        if (err == cudaErrorPeerAccessAlreadyEnabled) (void)cudaGetLastError();
+        else CUDACHECKGOTO(err, ret, exit);
+      }
+      peers[r] = infos[r].buff;
+    } else {
+      CUDACHECKGOTO(cudaIpcOpenMemHandle(qar->ipcPtrs+r, infos[r].ipc, cudaIpcMemLazyEnablePeerAccess), ret, exit);
+      peers[r] = (char*)qar->ipcPtrs[r];
+    }
+  }
+  NCCLCHECKGOTO(ncclCudaCalloc(&qar->devPeers, comm->nRanks, comm->sideStream), ret, exit);
+  NCCLCHECKGOTO(ncclCudaMemcpy(qar->devPeers, peers, comm->nRanks), ret, exit);
+  comm->quickArState = 1;
+  INFO(NCCL_INIT, "Quick allreduce up to %zu bytes over %d ranks", qar->maxBytes, comm->nRanks);
+exit:
+  free(infos);
+  return ret;
+}
+
+ncclResult_t ncclQuickAllReduceFree(struct ncclComm* comm) {
+  struct ncclQuickAllReduce* qar = comm->quickAr;
+  if (qar == NULL) return ncclSuccess;
+  for (int r=0; r<RCCL_QUICK_AR_MAX_RANKS; r++) {
+    if (qar->ipcPtrs[r]) CUDACHECKIGNORE(cudaIpcCloseMemHandle(qar->ipcPtrs[r]));
+  }
+  if (qar->devPeers) NCCLCHECK(ncclCudaFree(qar->devPeers));
+  if (qar->buff) NCCLCHECK(ncclCudaFree(qar->buff));
+  free(qar);
+  comm->quickAr = NULL;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclQuickAllReducePeers(struct ncclComm* comm, cudaStream_t stream, char*** devPeers) {
+  *devPeers = NULL;
+  if (comm->quickArState < 0 || comm->initState != ncclSuccess) return ncclSuccess;
+  if (comm->nNodes != 1 || comm->nRanks < 2 || comm->nRanks > RCCL_QUICK_AR_MAX_RANKS) return ncclSuccess;
+  if (comm->intraHighestTransportType != TRANSPORT_P2P) return ncclSuccess;
+  if (comm->quickArState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    NCCLCHECK(quickAllReduceInit(comm));
+    if (comm->quickArState < 0) return ncclSuccess;
+  }
+  *devPeers = comm->quickAr->devPeers;
+  return ncclSuccess;
+}
+
+static ncclResult_t quickAllReduce(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclRedOp_t op, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  if (rcclParamQuickAllReduce() == 0 || comm == NULL) return ncclSuccess;
+  // Every rank must take the same decision, from arguments and topology only
+  if (ncclGroupDepth > 0 || !comm->config.blocking) return ncclSuccess;
+  if (op != ncclSum || (datatype != ncclFloat32 && datatype != ncclFloat16 && datatype != ncclBfloat16)) return ncclSuccess;
+  size_t nBytes = count*ncclTypeSize(datatype);
+  if (nBytes == 0 || nBytes % sizeof(uint4) || nBytes > rcclParamQuickAllReduceMaxBytes()) return ncclSuccess;
+  char** devPeers;
+  NCCLCHECK(ncclQuickAllReducePeers(comm, stream, &devPeers));
+  if (devPeers == NULL) return ncclSuccess;
+
+  float flatTime, oneShotTime, twoShotTime;
+  NCCLCHECK(ncclTopoGetQuickAllReduceTime(comm, nBytes, &oneShotTime, &twoShotTime));
+  if (oneShotTime < 0) return ncclSuccess;
+  if (rcclParamQuickAllReduce() == 1) {
+    NCCLCHECK(ncclTopoGetCollTime(comm, ncclFuncAllReduce, nBytes, &flatTime));
+    if (flatTime >= 0 && std::min(oneShotTime, twoShotTime) >= flatTime) return ncclSuccess;
+  }
+  int twoShot = twoShotTime < oneShotTime;
+
+  struct ncclQuickAllReduce* qar = comm->quickAr;
+  size_t nVecs = nBytes/sizeof(uint4);
+  size_t slotVecs = qar->maxBytes/sizeof(uint4)/RCCL_QUICK_AR_MAX_BLOCKS;
+  // One block per slot, which may exceed the CU budget of ncclGroupSetMaxCTAs()
+  if (ncclGroupMaxCTAs > 0 && DIVUP(nVecs, slotVecs) > (size_t)ncclGroupMaxCTAs) return ncclSuccess;
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  hipLaunchKernelGGL(ncclQuickAllReduceKernel, dim3(DIVUP(nVecs, slotVecs)), dim3(RCCL_QUICK_AR_NTHREADS), 0, stream,
+      devPeers, comm->rank, comm->nRanks, sendbuff, recvbuff, nVecs, slotVecs, qar->maxBytes, (int)datatype, twoShot);
+  CUDACHECK(cudaGetLastError());
+  CUDACHECK(cudaSetDevice(savedDev));
+  *done = true;
+  return ncclSuccess;
+}
+
 NCCL_API(ncclResult_t, ncclAllReduce, const void* sendbuff, void* recvbuff, size_t count,
     ncclDataType_t datatype, ncclRedOp_t op, ncclComm* comm, cudaStream_t stream);
 ncclResult_t ncclAllReduce(const void* sendbuff, void* recvbuff, size_t count,
@@ -27,14 +417,76 @@ ncclResult_t ncclAllReduce(const void* sendbuff, void* recvbuff, size_t count,
   NvtxParamsAllReduce payload{count * ncclTypeSize(datatype), op};
   NVTX3_FUNC_WITH_PARAMS(AllReduce, AllReduceSchema, payload)
 
-  if (mscclAvailable() && !mscclIsCaller()) {
+  // MSCCL programs only know the builtin reductions, not the epilogue of FuncSumEpilogue.
+  if (mscclAvailable() && !mscclIsCaller() && !(comm && ncclRedOpHasEpilogue(comm, op))) {
     return mscclEnqueueCheck(
       sendbuff, nullptr, nullptr, recvbuff, nullptr, nullptr,
       count, datatype, 0, 0, op, mscclFuncAllReduce, comm, stream);
   }
 
+  bool done;
+  NCCLCHECK(quickAllReduce(sendbuff, recvbuff, count, datatype, op, comm, stream, &done));
+  if (!done) NCCLCHECK(rabAllReduce(sendbuff, recvbuff, count, datatype, op, comm, stream, &done));
+  if (!done) NCCLCHECK(hierAllReduce(sendbuff, recvbuff, count, datatype, op, comm, stream, &done));
+  if (done) return ncclCaptureRecordBuffers(comm, stream, sendbuff, payload.bytes, recvbuff, payload.bytes);
+
   struct ncclInfo info = { ncclFuncAllReduce, "AllReduce",
     sendbuff, recvbuff, count, datatype, op, 0, comm, stream, /* Args */
     ALLREDUCE_CHUNKSTEPS, ALLREDUCE_SLICESTEPS };
   return ncclEnqueueCheck(&info);
 }
+
+// Straggler-tolerant allreduce for reductions that can do with an approximate result, e.g. gradients
+// the framework corrects in the next step. Runs over the quick allreduce areas of a single node:
+// each rank stages its input, then waits at most timeoutUs for the others and sums the inputs that
+// arrived in time, skipping the others. Ranks may thus get different sums, each with the mask of
+// the ranks it missed. A late rank still sums the inputs of all the ranks that were on time.
+NCCL_API(ncclResult_t, ncclAllReducePartial, const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclRedOp_t op, uint64_t timeoutUs, uint32_t* missingMask, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclAllReducePartial(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclRedOp_t op, uint64_t timeoutUs, uint32_t* missingMask, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "AllReducePartial", "comm"));
+  NCCLCHECK(PtrCheck(missingMask, "AllReducePartial", "missingMask"));
+  if (ncclGroupDepth > 0) {
+    WARN("AllReducePartial : can not be called within a group");
+    return ncclInvalidUsage;
+  }
+  if (op != ncclSum || (datatype != ncclFloat32 && datatype != ncclFloat16 && datatype != ncclBfloat16)) {
+    WARN("AllReducePartial : only sums of float32, float16 and bfloat16 are supported");
+    return ncclInvalidArgument;
+  }
+  if (comm->nRanks == 1) {
+    if (count > 0 && sendbuff != recvbuff)
+      CUDACHECK(cudaMemcpyAsync(recvbuff, sendbuff, count*ncclTypeSize(datatype), cudaMemcpyDeviceToDevice, stream));
+    CUDACHECK(cudaMemsetAsync(missingMask, 0, sizeof(uint32_t), stream));
+    return ncclCaptureRecordBuffers(comm, stream, sendbuff, count*ncclTypeSize(datatype), recvbuff, count*ncclTypeSize(datatype));
+  }
+  char** devPeers;
+  NCCLCHECK(ncclQuickAllReducePeers(comm, stream, &devPeers));
+  if (devPeers == NULL) {
+    WARN("AllReducePartial : needs a single node with P2P between up to %d GPUs, set up outside of graph capture", RCCL_QUICK_AR_MAX_RANKS);
+    return ncclInvalidUsage;
+  }
+  struct ncclQuickAllReduce* qar = comm->quickAr;
+  size_t nBytes = count*ncclTypeSize(datatype);
+  if (nBytes == 0 || nBytes % sizeof(uint4) || nBytes > qar->maxBytes) {
+    WARN("AllReducePartial : %zu bytes is not a multiple of %zu up to RCCL_QUICK_ALLREDUCE_MAX_BYTES (%zu)", nBytes, sizeof(uint4), qar->maxBytes);
+    return ncclInvalidArgument;
+  }
+
+  size_t nVecs = nBytes/sizeof(uint4);
+  size_t slotVecs = qar->maxBytes/sizeof(uint4)/RCCL_QUICK_AR_MAX_BLOCKS;
+  uint64_t deadline = timeoutUs < UINT64_MAX/1000/qar->wallClockKHz ? timeoutUs*qar->wallClockKHz/1000 : UINT64_MAX;
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  hipLaunchKernelGGL(ncclPartialArStageKernel, dim3(DIVUP(nVecs, slotVecs)), dim3(RCCL_QUICK_AR_NTHREADS), 0, stream,
+      devPeers, comm->rank, comm->nRanks, sendbuff, nVecs, slotVecs, qar->maxBytes, deadline);
+  CUDACHECK(cudaGetLastError());
+  hipLaunchKernelGGL(ncclPartialArReduceKernel, dim3(DIVUP(nVecs, slotVecs)), dim3(RCCL_QUICK_AR_NTHREADS), 0, stream,
+      devPeers, comm->rank, comm->nRanks, recvbuff, nVecs, slotVecs, qar->maxBytes, (int)datatype, missingMask);
+  CUDACHECK(cudaGetLastError());
+  CUDACHECK(cudaSetDevice(savedDev));
+  return ncclCaptureRecordBuffers(comm, stream, sendbuff, nBytes, recvbuff, nBytes);
+}
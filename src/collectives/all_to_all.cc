@@ -9,9 +9,115 @@
 #include "enqueue.h"
 #include "collectives.h"
 #include "graph/topo.h"
+#include "rccl_vars.h"
+#include "register.h"
 
 #include "msccl/msccl_lifecycle.h"
 
+RCCL_PARAM(HierAllToAll, "HIER_ALLTOALL", 0);
+
+// Hierarchical alltoall (RCCL_HIER_ALLTOALL), a 2D alltoall on the child communicators of the
+// hierarchical allreduce: blocks are first exchanged inside the node over xGMI, so that each GPU
+// holds everything its node sends to the GPUs of its rail, then each GPU exchanges with its rail
+// peers only, on its own NIC. Blocks are transposed locally before each phase so that both phases
+// are plain alltoalls and the rail phase lands in place. 1 uses it from 2 nodes on, larger values
+// are the minimum number of nodes.
+static ncclResult_t hierAllToAll(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  int64_t minNodes = rcclParamHierAllToAll();
+  if (minNodes <= 0 || !ncclHierEligible(comm)) return ncclSuccess;
+  if (comm->nNodes < std::max<int64_t>(minNodes, 2) || comm->localRanks == 1 || count == 0) return ncclSuccess;
+  if (datatype < 0 || datatype >= ncclNumTypes) return ncclSuccess;
+
+  if (comm->hierState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    // The rail phase writes node blocks in place, ranks must be numbered node by node
+    if (!ncclHierRanksContiguous(comm)) {
+      INFO(NCCL_INIT, "Hierarchical alltoall disabled, ranks are not contiguous within nodes");
+      comm->hierState = -1;
+      return ncclSuccess;
+    }
+    NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+  }
+
+  int nNodes = comm->nNodes, localRanks = comm->localRanks;
+  size_t block = count*ncclTypeSize(datatype);
+  size_t bytes = comm->nRanks*block;
+  bool staged;
+  NCCLCHECK(ncclHierStagingReserve(comm, &comm->hierA2AStaging, &comm->hierA2AStagingBytes, 2*bytes, stream, &staged));
+  if (!staged) return ncclSuccess;
+  char* a = comm->hierA2AStaging;
+  char* b = comm->hierA2AStaging + bytes;
+
+  // sendbuff[node][local] -> a[local][node], one contiguous run per local peer
+  for (int l=0; l<localRanks; l++) {
+    CUDACHECK(cudaMemcpy2DAsync(a+l*nNodes*block, block, (const char*)sendbuff+l*block, localRanks*block,
+        block, nNodes, cudaMemcpyDeviceToDevice, stream));
+  }
+  // b[source local][node]: what each local rank sends to our rail peers
+  NCCLCHECK(ncclAllToAll(a, b, nNodes*count, datatype, comm->hierIntraComm, stream));
+  // b[source local][node] -> a[node][source local], one contiguous run per rail peer
+  for (int n=0; n<nNodes; n++) {
+    CUDACHECK(cudaMemcpy2DAsync(a+n*localRanks*block, block, b+n*block, nNodes*block,
+        block, localRanks, cudaMemcpyDeviceToDevice, stream));
+  }
+  // Rail peer n delivers the blocks of ranks n*localRanks..(n+1)*localRanks-1
+  NCCLCHECK(ncclAllToAll(a, recvbuff, localRanks*count, datatype, comm->hierRailComm, stream));
+  *done = true;
+  return ncclSuccess;
+}
+
+RCCL_PARAM(DirectAllToAll, "DIRECT_ALLTOALL", 0);
+
+// Direct alltoall (RCCL_DIRECT_ALLTOALL) on a single node where all GPUs are connected by P2P, for
+// output buffers registered with ncclCommRegister(). The first call with a registration maps it on
+// all local ranks, then one kernel writes each block of the input straight to its place in the output
+// of its destination, between flag barriers in the quick allreduce areas, instead of N-1 sends and
+// receives staged through the connection buffers. Whether a call takes this path depends on the
+// local registration, so it is opt-in: all ranks must register their output buffers for the same
+// calls, or ranks taking different paths hang.
+static ncclResult_t directAllToAll(const void* sendbuff, void* recvbuff, size_t count,
+    ncclDataType_t datatype, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  if (rcclParamDirectAllToAll() == 0 || comm == NULL) return ncclSuccess;
+  // One kernel per call, it can not be part of a group
+  if (ncclGroupDepth > 0 || !comm->config.blocking || comm->initState != ncclSuccess) return ncclSuccess;
+  if (comm->nNodes != 1 || count == 0 || datatype < 0 || datatype >= ncclNumTypes) return ncclSuccess;
+  size_t block = count*ncclTypeSize(datatype);
+  if (block % sizeof(uint4)) return ncclSuccess;
+  struct ncclReg* recvReg = ncclRegFind(comm, recvbuff, comm->nRanks*block);
+  if (recvReg == NULL) return ncclSuccess;
+  char** devPeers;
+  NCCLCHECK(ncclQuickAllReducePeers(comm, stream, &devPeers));
+  if (devPeers == NULL) return ncclSuccess;
+
+  void* regBufSend[NCCL_MAX_LOCAL_RANKS];
+  void* regBufRecv[NCCL_MAX_LOCAL_RANKS];
+  NCCLCHECK(ncclRegGetPeerBuffers(comm, recvReg, recvbuff, recvReg, recvbuff, regBufSend, regBufRecv));
+  struct rcclDirectA2ADsts dsts;
+  for (int r=0; r<comm->nRanks; r++) {
+    char* output = r == comm->rank ? (char*)recvbuff : (char*)regBufRecv[comm->rankToLocalRank[r]];
+    dsts.ptrs[r] = output + comm->rank*block;
+  }
+  size_t nVecs = block/sizeof(uint4);
+  // Every rank must run the same grid, which only depends on the arguments
+  int nBlocks = std::min<size_t>(DIVUP(nVecs, 4*RCCL_QUICK_AR_NTHREADS), RCCL_QUICK_AR_MAX_BLOCKS);
+  if (ncclGroupMaxCTAs > 0) nBlocks = std::min(nBlocks, ncclGroupMaxCTAs);
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  hipLaunchKernelGGL(ncclDirectAllToAllKernel, dim3(nBlocks), dim3(RCCL_QUICK_AR_NTHREADS), 0, stream,
+      devPeers, comm->rank, comm->nRanks, sendbuff, dsts, nVecs);
+  CUDACHECK(cudaGetLastError());
+  CUDACHECK(cudaSetDevice(savedDev));
+  *done = true;
+  return ncclSuccess;
+}
+
 NCCL_API(ncclResult_t, ncclAllToAll, const void* sendbuff, void* recvbuff, size_t count, ncclDataType_t datatype,
   ncclComm_t comm, hipStream_t stream);
 ncclResult_t ncclAllToAll(const void* sendbuff, void* recvbuff, size_t count, ncclDataType_t datatype,
@@ -22,6 +128,12 @@ ncclResult_t ncclAllToAll(const void* sendbuff, void* recvbuff, size_t count, nc
       count, datatype, 0, 0, ncclSum, mscclFuncAllToAll, comm, stream);
   }
 
+  bool done;
+  NCCLCHECK(hierAllToAll(sendbuff, recvbuff, count, datatype, comm, stream, &done));
+  if (!done) NCCLCHECK(directAllToAll(sendbuff, recvbuff, count, datatype, comm, stream, &done));
+  if (done) return ncclCaptureRecordBuffers(comm, stream, sendbuff, comm->nRanks*count*ncclTypeSize(datatype),
+      recvbuff, comm->nRanks*count*ncclTypeSize(datatype));
+
   size_t rankOffset = count * ncclTypeSize(datatype);
   size_t rankAlign = rankOffset & ((~rankOffset) + 1);
   // Determine Pivot A2A support now that we know number of channels
@@ -8,9 +8,135 @@
 
 #include "enqueue.h"
 #include "collectives.h"
+#include "argcheck.h"
+#include "bootstrap.h"
+#include "rccl_vars.h"
 
 #include "msccl/msccl_lifecycle.h"
 
+// Blocks from the ranks of node n follow each other in recvbuff
+static bool nodeInPlace(int n, int localRanks, const size_t recvcounts[], const size_t rdispls[]) {
+  for (int s=1; s<localRanks; s++) {
+    int r = n*localRanks+s;
+    if (rdispls[r] != rdispls[r-1]+recvcounts[r-1]) return false;
+  }
+  return true;
+}
+
+// Hierarchical alltoallv (RCCL_HIER_ALLTOALL), the node-level aggregation of the hierarchical
+// alltoall for variable blocks: each rank first hands every local peer, over xGMI, the blocks it
+// sends to the rail of that peer, then each rank sends one aggregated message per remote node to
+// its rail peer there. NIC messages per rank drop from nRanks to nNodes, which is what bounds MoE
+// alltoalls of small blocks at scale. The local peers that forward our blocks can not know their
+// sizes, so the send counts are first exchanged inside the node through the bootstrap.
+static ncclResult_t hierAllToAllv(const void *sendbuff, const size_t sendcounts[], const size_t sdispls[],
+    void *recvbuff, const size_t recvcounts[], const size_t rdispls[],
+    ncclDataType_t datatype, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  int64_t minNodes = rcclParamHierAllToAll();
+  if (minNodes <= 0 || !ncclHierEligible(comm)) return ncclSuccess;
+  if (comm->nNodes < std::max<int64_t>(minNodes, 2) || comm->localRanks == 1) return ncclSuccess;
+  if (datatype < 0 || datatype >= ncclNumTypes) return ncclSuccess;
+  // Counts are exchanged on the host at every call, graphs would replay stale ones
+  cudaStreamCaptureStatus status;
+  CUDACHECK(cudaStreamIsCapturing(stream, &status));
+  if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+
+  if (comm->hierState == 0) {
+    // Rail peers deliver whole node blocks, ranks must be numbered node by node
+    if (!ncclHierRanksContiguous(comm)) {
+      INFO(NCCL_INIT, "Hierarchical alltoall disabled, ranks are not contiguous within nodes");
+      comm->hierState = -1;
+      return ncclSuccess;
+    }
+    NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+  }
+
+  int nRanks = comm->nRanks, nNodes = comm->nNodes, localRanks = comm->localRanks, localRank = comm->localRank;
+  size_t typeSize = ncclTypeSize(datatype);
+  size_t* allCounts; // [local rank][peer], send counts of every rank of the node
+  NCCLCHECK(ncclCalloc(&allCounts, localRanks*nRanks));
+  ncclResult_t ret = ncclSuccess;
+  size_t fwdCount = 0, scatterCount = 0;
+  bool staged;
+  char* fwdBuff;
+  char* scatterBuff;
+  memcpy(allCounts+localRank*nRanks, sendcounts, nRanks*sizeof(size_t));
+  NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->localRankToRank, localRank, localRanks,
+      allCounts, nRanks*sizeof(size_t)), ret, exit);
+
+  // What the node sends to rank (n, localRank) is forwarded by us, staged by node then source
+  for (int n=0; n<nNodes; n++) {
+    for (int s=0; s<localRanks; s++) fwdCount += allCounts[s*nRanks+n*localRanks+localRank];
+  }
+  // Node blocks are received in place, unless recvbuff does not hold them back to back
+  for (int n=0; n<nNodes; n++) {
+    if (nodeInPlace(n, localRanks, recvcounts, rdispls)) continue;
+    for (int s=0; s<localRanks; s++) scatterCount += recvcounts[n*localRanks+s];
+  }
+  NCCLCHECKGOTO(ncclHierStagingReserve(comm, &comm->hierA2AStaging, &comm->hierA2AStagingBytes,
+      std::max<size_t>((fwdCount+scatterCount)*typeSize, 1), stream, &staged), ret, exit);
+  if (!staged) goto exit;
+  fwdBuff = comm->hierA2AStaging;
+  scatterBuff = comm->hierA2AStaging + fwdCount*typeSize;
+
+  NCCLCHECKGOTO(ncclGroupStart(), ret, exit);
+  for (int l=0; l<localRanks; l++) {
+    for (int n=0; n<nNodes; n++) {
+      int r = n*localRanks+l;
+      if (sendcounts[r]) NCCLCHECKGOTO(ncclSend((const char*)sendbuff+sdispls[r]*typeSize, sendcounts[r], datatype, l, comm->hierIntraComm, stream), ret, exit);
+    }
+  }
+  {
+    size_t offset = 0;
+    for (int n=0; n<nNodes; n++) {
+      for (int s=0; s<localRanks; s++) {
+        size_t count = allCounts[s*nRanks+n*localRanks+localRank];
+        if (count) NCCLCHECKGOTO(ncclRecv(fwdBuff+offset*typeSize, count, datatype, s, comm->hierIntraComm, stream), ret, exit);
+        offset += count;
+      }
+    }
+  }
+  NCCLCHECKGOTO(ncclGroupEnd(), ret, exit);
+
+  NCCLCHECKGOTO(ncclGroupStart(), ret, exit);
+  {
+    size_t sendOffset = 0, scatterOffset = 0;
+    for (int n=0; n<nNodes; n++) {
+      size_t nodeSend = 0, nodeRecv = 0;
+      for (int s=0; s<localRanks; s++) nodeSend += allCounts[s*nRanks+n*localRanks+localRank];
+      for (int s=0; s<localRanks; s++) nodeRecv += recvcounts[n*localRanks+s];
+      if (nodeSend) NCCLCHECKGOTO(ncclSend(fwdBuff+sendOffset*typeSize, nodeSend, datatype, n, comm->hierRailComm, stream), ret, exit);
+      sendOffset += nodeSend;
+      if (nodeRecv == 0) continue;
+      bool inPlace = nodeInPlace(n, localRanks, recvcounts, rdispls);
+      char* nodeBuff = inPlace ? (char*)recvbuff+rdispls[n*localRanks]*typeSize : scatterBuff+scatterOffset*typeSize;
+      NCCLCHECKGOTO(ncclRecv(nodeBuff, nodeRecv, datatype, n, comm->hierRailComm, stream), ret, exit);
+      if (!inPlace) scatterOffset += nodeRecv;
+    }
+  }
+  NCCLCHECKGOTO(ncclGroupEnd(), ret, exit);
+
+  // Scatter the node blocks that could not land in place
+  if (scatterCount) {
+    size_t offset = 0;
+    for (int n=0; n<nNodes; n++) {
+      if (nodeInPlace(n, localRanks, recvcounts, rdispls)) continue;
+      for (int s=0; s<localRanks; s++) {
+        int r = n*localRanks+s;
+        if (recvcounts[r]) CUDACHECKGOTO(cudaMemcpyAsync((char*)recvbuff+rdispls[r]*typeSize, scatterBuff+offset*typeSize,
+            recvcounts[r]*typeSize, cudaMemcpyDeviceToDevice, stream), ret, exit);
+        offset += recvcounts[r];
+      }
+    }
+  }
+  *done = true;
+exit:
+  free(allCounts);
+  return ret;
+}
+
 NCCL_API(ncclResult_t, ncclAllToAllv, const void *sendbuff, const size_t sendcounts[], const size_t sdispls[],
     void *recvbuff, const size_t recvcounts[], const size_t rdispls[],
     ncclDataType_t datatype, ncclComm_t comm, hipStream_t stream);
@@ -23,6 +149,17 @@ ncclResult_t ncclAllToAllv(const void *sendbuff, const size_t sendcounts[], cons
       0, datatype, 0, 0, ncclSum, mscclFuncAllToAllv, comm, stream);
   }
 
+  bool hierDone;
+  NCCLCHECK(hierAllToAllv(sendbuff, sendcounts, sdispls, recvbuff, recvcounts, rdispls, datatype, comm, stream, &hierDone));
+  if (hierDone) {
+    size_t sendBytes = 0, recvBytes = 0;
+    for (int r=0; r<comm->nRanks; r++) {
+      if (sendcounts[r]) sendBytes = std::max(sendBytes, (sdispls[r]+sendcounts[r])*ncclTypeSize(datatype));
+      if (recvcounts[r]) recvBytes = std::max(recvBytes, (rdispls[r]+recvcounts[r])*ncclTypeSize(datatype));
+    }
+    return ncclCaptureRecordBuffers(comm, stream, sendbuff, sendBytes, recvbuff, recvBytes);
+  }
+
   int nRanks;
   NCCLCHECK(ncclCommCount(comm, &nRanks));
   NCCLCHECK(ncclGroupStart());
@@ -45,3 +182,74 @@ ncclResult_t ncclAllToAllv(const void *sendbuff, const size_t sendcounts[], cons
   NCCLCHECK(ncclGroupEnd());
   return ncclSuccess;
 }
+
+// Blocks are exchanged through staging slots of maxcount elements per peer so
+// that no size has to be known on the host: a pack kernel gathers them, a
+// regular AllToAll of maxcount elements moves the slots and an unpack kernel
+// scatters them into recvbuff.
+NCCL_API(ncclResult_t, ncclAllToAllvDevice, const void *sendbuff, const size_t* sendcounts, const size_t* sdispls,
+    void *recvbuff, const size_t* recvcounts, const size_t* rdispls, size_t maxcount,
+    ncclDataType_t datatype, ncclComm_t comm, hipStream_t stream);
+ncclResult_t ncclAllToAllvDevice(const void *sendbuff, const size_t* sendcounts, const size_t* sdispls,
+    void *recvbuff, const size_t* recvcounts, const size_t* rdispls, size_t maxcount,
+    ncclDataType_t datatype, ncclComm_t comm, hipStream_t stream) {
+  NCCLCHECK(PtrCheck(comm, "AllToAllvDevice", "comm"));
+  if (datatype < 0 || datatype >= ncclNumTypes) {
+    WARN("AllToAllvDevice : invalid type %d", datatype);
+    return ncclInvalidArgument;
+  }
+  // The kernels are launched right away, so the AllToAll in between must be too.
+  if (ncclGroupDepth > 0 || !comm->config.blocking) {
+    WARN("AllToAllvDevice : cannot be called within a group or on a non-blocking communicator");
+    return ncclInvalidUsage;
+  }
+  if (maxcount == 0) return ncclSuccess;
+  if (sendcounts == nullptr || sdispls == nullptr || recvcounts == nullptr || rdispls == nullptr) {
+    WARN("AllToAllvDevice : counts and displacements must be device arrays");
+    return ncclInvalidArgument;
+  }
+
+  int nRanks;
+  NCCLCHECK(ncclCommCount(comm, &nRanks));
+  size_t typeSize = ncclTypeSize(datatype);
+  size_t slotsBytes = nRanks*maxcount*typeSize;
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  if (comm->allToAllvStagingBytes < 2*slotsBytes) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) {
+      WARN("AllToAllvDevice : staging for maxcount %zu must be allocated by an uncaptured call first", maxcount);
+      return ncclInvalidUsage;
+    }
+    // Uses of the slots are chained through doneEvent, the last one completes previous calls
+    CUDACHECK(cudaEventSynchronize(comm->doneEvent));
+    if (comm->allToAllvStaging) NCCLCHECK(ncclCudaFree(comm->allToAllvStaging));
+    comm->allToAllvStaging = nullptr;
+    comm->allToAllvStagingBytes = 0;
+    NCCLCHECK(ncclCudaCalloc(&comm->allToAllvStaging, 2*slotsBytes, comm->sideStream));
+    comm->allToAllvStagingBytes = 2*slotsBytes;
+  }
+  char* sendSlots = comm->allToAllvStaging;
+  char* recvSlots = comm->allToAllvStaging + slotsBytes;
+  // The slots are shared by calls on all streams, order this call after the last launch of comm
+  // like ncclLaunchPrepare() does, and make the next one wait for the unpack kernel.
+  if (stream != comm->lastStream && comm->lastStream != nullptr) {
+    CUDACHECK(cudaStreamWaitEvent(stream, comm->doneEvent, 0));
+  }
+
+  dim3 grid(std::min<size_t>(DIVUP(maxcount*typeSize, NCCL_MAX_NTHREADS*sizeof(uint4)), 16), nRanks);
+  hipLaunchKernelGGL(ncclAllToAllvPackKernel, grid, dim3(NCCL_MAX_NTHREADS), 0, stream,
+      sendSlots, (const char*)sendbuff, sendcounts, sdispls, typeSize, maxcount, 1);
+  CUDACHECK(cudaGetLastError());
+  NCCLCHECK(ncclAllToAll(sendSlots, recvSlots, maxcount, datatype, comm, stream));
+  hipLaunchKernelGGL(ncclAllToAllvPackKernel, grid, dim3(NCCL_MAX_NTHREADS), 0, stream,
+      (char*)recvbuff, recvSlots, recvcounts, rdispls, typeSize, maxcount, 0);
+  CUDACHECK(cudaGetLastError());
+  CUDACHECK(cudaEventRecord(comm->doneEvent, stream));
+  comm->lastStream = stream;
+  CUDACHECK(cudaSetDevice(savedDev));
+  // Displacements are only known on the device, blocks of maxcount elements bound the buffers of dense layouts
+  return ncclCaptureRecordBuffers(comm, stream, sendbuff, slotsBytes, recvbuff, slotsBytes);
+}
@@ -0,0 +1,53 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "enqueue.h"
+#include "collectives.h"
+#include "argcheck.h"
+
+// Barriers move no data, so they skip algorithm selection and the data path of a 1-element
+// allreduce. On a single node with P2P between all GPUs, one kernel flags the arrival of this
+// rank in the quick allreduce area of every peer and waits for theirs. Elsewhere, and when the
+// first barrier is captured before the areas exist, ranks run a dissemination barrier: in round
+// k each rank signals rank+2^k and waits for rank-2^k with zero-byte send/recv, which only
+// exchange flags over the connections the p2p operations already use.
+NCCL_API(ncclResult_t, ncclBarrier, ncclComm_t comm, hipStream_t stream);
+ncclResult_t ncclBarrier(ncclComm_t comm, hipStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "Barrier", "comm"));
+  if (ncclGroupDepth > 0) {
+    WARN("Barrier : can not be called within a group");
+    return ncclInvalidUsage;
+  }
+  if (comm->nRanks == 1) return ncclSuccess;
+
+  char** devPeers;
+  NCCLCHECK(ncclQuickAllReducePeers(comm, stream, &devPeers));
+  if (devPeers != NULL) {
+    int savedDev;
+    CUDACHECK(cudaGetDevice(&savedDev));
+    CUDACHECK(cudaSetDevice(comm->cudaDev));
+    hipLaunchKernelGGL(ncclBarrierKernel, dim3(1), dim3(RCCL_QUICK_AR_MAX_RANKS), 0, stream,
+        devPeers, comm->rank, comm->nRanks);
+    CUDACHECK(cudaGetLastError());
+    CUDACHECK(cudaSetDevice(savedDev));
+    return ncclSuccess;
+  }
+
+  // Each round must be issued once the previous one returned, which a non-blocking communicator
+  // only guarantees after polling ncclCommGetAsyncError
+  if (!comm->config.blocking) {
+    WARN("Barrier : non-blocking communicators only support the intra-node barrier");
+    return ncclInvalidUsage;
+  }
+  for (int dist = 1; dist < comm->nRanks; dist <<= 1) {
+    NCCLCHECK(ncclGroupStart());
+    NCCLCHECK(ncclSend(NULL, 0, ncclInt8, (comm->rank + dist) % comm->nRanks, comm, stream));
+    NCCLCHECK(ncclRecv(NULL, 0, ncclInt8, (comm->rank - dist + comm->nRanks) % comm->nRanks, comm, stream));
+    NCCLCHECK(ncclGroupEnd());
+  }
+  return ncclSuccess;
+}
@@ -7,9 +7,132 @@
 
 #include "enqueue.h"
 #include "collectives.h"
+#include "graph.h"
+#include "trees.h"
 
 #include "msccl/msccl_lifecycle.h"
 
+RCCL_PARAM(TreeBroadcast, "TREE_BROADCAST", 0);
+RCCL_PARAM(TreeBroadcastChunkBytes, "TREE_BROADCAST_CHUNK_BYTES", 32*1024*1024);
+
+// Parent and children of u in tree t of the double binary tree over the nNodes-1 nodes other than
+// the root node, u being the distance to the root node minus one. The parent of both tree roots is
+// the root node, -1 here.
+static void treeBroadcastPeers(int nNodes, int u, int t, int* up, int* down) {
+  int up0, up1, parentChildType;
+  if (t == 0) ncclGetDtree(nNodes-1, u, &up0, down, down+1, &parentChildType, &up1, &up1, &up1, &parentChildType);
+  else ncclGetDtree(nNodes-1, u, &up0, &up0, &up0, &parentChildType, &up1, down, down+1, &parentChildType);
+  *up = t == 0 ? up0 : up1;
+}
+
+static int treeBroadcastDepth(int nNodes, int u, int t) {
+  int depth = 1, up, down[2];
+  for (treeBroadcastPeers(nNodes, u, t, &up, down); up != -1; treeBroadcastPeers(nNodes, u, t, &up, down)) {
+    u = up;
+    depth++;
+  }
+  return depth;
+}
+
+// Bytes of chunk k of tree t, false when it does not exist. The first half of the buffer flows down
+// tree 0 and the second half down tree 1.
+static bool treeBroadcastChunk(size_t nBytes, size_t chunkBytes, int t, int k, size_t* offset, size_t* bytes) {
+  size_t treeOffset = t == 0 ? 0 : nBytes/2;
+  size_t treeBytes = t == 0 ? nBytes/2 : nBytes-nBytes/2;
+  if (k < 0 || k*chunkBytes >= treeBytes) return false;
+  *offset = treeOffset + k*chunkBytes;
+  *bytes = std::min(chunkBytes, treeBytes - k*chunkBytes);
+  return true;
+}
+
+// Pipelined tree broadcast (RCCL_TREE_BROADCAST), on the child communicators of the hierarchical
+// allreduce. Across nodes, the ranks with the local rank of the root form two binary trees below the
+// root node with ncclGetDtree(), where the inner nodes of one tree are leaves of the other, and each
+// tree carries half of the buffer in chunks of RCCL_TREE_BROADCAST_CHUNK_BYTES. In stage s, a node at
+// depth d of a tree receives chunk s-d+1 from its parent, and forwards chunk s-d to its children and
+// to its own ranks, so the broadcast takes nChunks + log2(nNodes) stages instead of the nNodes hops of
+// the ring fill. 1 uses it when its tuning model beats the flat broadcast, 2 whenever eligible.
+static ncclResult_t treeBroadcast(const void* sendbuff, void* recvbuff, size_t count, ncclDataType_t datatype,
+    int root, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  int64_t mode = rcclParamTreeBroadcast();
+  if (mode == 0 || comm == NULL || comm->hierState < 0) return ncclSuccess;
+  // Stages are ordered on the stream, they can not be part of a group
+  if (ncclGroupDepth > 0 || !comm->config.blocking || comm->initState != ncclSuccess) return ncclSuccess;
+  if (comm->nNodes < 2 || count == 0 || rcclParamTreeBroadcastChunkBytes() <= 0) return ncclSuccess;
+  if (datatype < 0 || datatype >= ncclNumTypes || root < 0 || root >= comm->nRanks) return ncclSuccess;
+
+  int nNodes = comm->nNodes;
+  int rootNode = comm->rankToNode[root], rootLocal = comm->rankToLocalRank[root];
+  size_t nBytes = count*ncclTypeSize(datatype);
+  size_t chunkBytes = rcclParamTreeBroadcastChunkBytes();
+  int nChunks = DIVUP(nBytes-nBytes/2, chunkBytes);
+  int maxDepth = 1, treeRoot[2] = {0, 0};
+  for (int t=0; t<2; t++) {
+    for (int u=0; u<nNodes-1; u++) {
+      int depth = treeBroadcastDepth(nNodes, u, t);
+      if (depth == 1) treeRoot[t] = u;
+      maxDepth = std::max(maxDepth, depth);
+    }
+  }
+  int nStages = nChunks + maxDepth;
+
+  if (comm->hierState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+  }
+  if (mode == 1) {
+    float flatTime, treeTime;
+    NCCLCHECK(ncclTopoGetCollTime(comm, ncclFuncBroadcast, nBytes, &flatTime));
+    NCCLCHECK(ncclTopoGetTreeBroadcastTime(comm, std::min(chunkBytes, nBytes-nBytes/2), nStages, &treeTime));
+    if (flatTime < 0 || treeTime < 0 || treeTime >= flatTime) return ncclSuccess;
+  }
+
+  // Depth and rail peers of this node in each tree, the root node is at depth 0
+  int depth[2], up[2], down[2][2];
+  for (int t=0; t<2; t++) {
+    if (comm->node == rootNode) {
+      depth[t] = 0;
+      up[t] = -1;
+      down[t][0] = (treeRoot[t]+1+rootNode) % nNodes;
+      down[t][1] = -1;
+      continue;
+    }
+    int u = (comm->node-rootNode-1+nNodes) % nNodes;
+    depth[t] = treeBroadcastDepth(nNodes, u, t);
+    treeBroadcastPeers(nNodes, u, t, up+t, down[t]);
+    up[t] = up[t] == -1 ? rootNode : (up[t]+1+rootNode) % nNodes;
+    for (int c=0; c<2; c++) {
+      if (down[t][c] != -1) down[t][c] = (down[t][c]+1+rootNode) % nNodes;
+    }
+  }
+
+  bool leader = comm->localRank == rootLocal;
+  const char* src = comm->rank == root ? (const char*)sendbuff : (const char*)recvbuff;
+  char* dst = (char*)recvbuff;
+  for (int s=0; s<nStages; s++) {
+    NCCLCHECK(ncclGroupStart());
+    for (int t=0; t<2; t++) {
+      size_t offset, bytes;
+      if (leader && depth[t] > 0 && treeBroadcastChunk(nBytes, chunkBytes, t, s-depth[t]+1, &offset, &bytes)) {
+        NCCLCHECK(ncclRecv(dst+offset, bytes, ncclInt8, up[t], comm->hierRailComm, stream));
+      }
+      if (treeBroadcastChunk(nBytes, chunkBytes, t, s-depth[t], &offset, &bytes)) {
+        for (int c=0; leader && c<2; c++) {
+          if (down[t][c] != -1) NCCLCHECK(ncclSend(src+offset, bytes, ncclInt8, down[t][c], comm->hierRailComm, stream));
+        }
+        NCCLCHECK(ncclBroadcast(src+offset, dst+offset, bytes, ncclInt8, rootLocal, comm->hierIntraComm, stream));
+      }
+    }
+    NCCLCHECK(ncclGroupEnd());
+  }
+  *done = true;
+  return ncclSuccess;
+}
+
 NCCL_API(ncclResult_t, ncclBroadcast, const void* sendbuff, void* recvbuff, size_t count, ncclDataType_t datatype, int root,
     ncclComm_t comm, cudaStream_t stream);
 ncclResult_t ncclBroadcast(const void* sendbuff, void* recvbuff, size_t count, ncclDataType_t datatype, int root,
@@ -31,6 +154,10 @@ ncclResult_t ncclBroadcast(const void* sendbuff, void* recvbuff, size_t count, n
       count, datatype, root, 0, ncclSum, mscclFuncBroadcast, comm, stream);
   }
 
+  bool treeDone;
+  NCCLCHECK(treeBroadcast(sendbuff, recvbuff, count, datatype, root, comm, stream, &treeDone));
+  if (treeDone) return ncclSuccess;
+
   struct ncclInfo info = { ncclFuncBroadcast, "Broadcast",
     sendbuff, recvbuff, count, datatype, ncclSum, root, comm, stream, /* Args */
     BROADCAST_CHUNKSTEPS, BROADCAST_SLICESTEPS };
@@ -0,0 +1,11 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "all_gather.h"
+#include "common.h"
+#include "collectives.h"
+
+RCCL_SPECIALIZED_KERNELS_AllGather(IMPL_SPECIALIZED_KERN)
@@ -0,0 +1,11 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "all_reduce.h"
+#include "common.h"
+#include "collectives.h"
+
+RCCL_SPECIALIZED_KERNELS_AllReduce(IMPL_SPECIALIZED_KERN)
@@ -0,0 +1,29 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "devcomm.h"
+#include "collectives.h"
+
+// Moves the per-peer blocks of ncclAllToAllvDevice() between the user buffer
+// (at displs[peer], counts[peer] elements) and fixed size staging slots of
+// maxCount elements. blockIdx.y is the peer.
+__global__ void ncclAllToAllvPackKernel(char* dst, const char* src, const size_t* counts, const size_t* displs,
+    size_t typeSize, size_t maxCount, int pack) {
+  int peer = blockIdx.y;
+  size_t count = counts[peer];
+  if (count > maxCount) count = maxCount; // Larger counts are truncated to the slot size
+  size_t bytes = count*typeSize;
+  char* d = dst + (pack ? peer*maxCount : displs[peer])*typeSize;
+  const char* s = src + (pack ? displs[peer] : peer*maxCount)*typeSize;
+  size_t tid = blockIdx.x*blockDim.x + threadIdx.x;
+  size_t nthreads = gridDim.x*blockDim.x;
+  if (((uintptr_t)d | (uintptr_t)s | bytes) % sizeof(uint4) == 0) {
+    for (size_t i = tid; i < bytes/sizeof(uint4); i += nthreads)
+      reinterpret_cast<uint4*>(d)[i] = reinterpret_cast<const uint4*>(s)[i];
+  } else {
+    for (size_t i = tid; i < bytes; i += nthreads) d[i] = s[i];
+  }
+}
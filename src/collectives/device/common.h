@@ -63,7 +63,9 @@
   NCCL_FUNC4(func, devredop, half, nullForFloat), \
   NCCL_FUNC4(func, devredop, float, nullForFloat), \
   NCCL_FUNC4(func, devredop, double, nullForFloat), \
-  NCCL_FUNC4(func, devredop, rccl_bfloat16, nullForFloat)
+  NCCL_FUNC4(func, devredop, rccl_bfloat16, nullForFloat), \
+  NCCL_FUNC4(func, devredop, rccl_float8_e4m3, nullForFloat), \
+  NCCL_FUNC4(func, devredop, rccl_float8_e5m2, nullForFloat)
 #define NCCL_FUNCS3B(func, devredop) \
   NCCL_FUNC4(func, devredop, int8_t, 0), \
   NCCL_FUNC4(func, devredop, int8_t, 0), \
@@ -74,6 +76,8 @@
   NCCL_FUNC4(func, devredop, int8_t, 0), \
   NCCL_FUNC4(func, devredop, int8_t, 0), \
   NCCL_FUNC4(func, devredop, int8_t, 0), \
+  NCCL_FUNC4(func, devredop, int8_t, 0), \
+  NCCL_FUNC4(func, devredop, int8_t, 0), \
   NCCL_FUNC4(func, devredop, int8_t, 0)
 
 // Must be consistent with ncclRedOp_t
@@ -121,14 +125,16 @@ static const __device__ constexpr ncclKernelFunc_t ncclFuncs[]{
 #if defined(RCCL_BFLOAT16)
   NCCL_ONERANK_REDUCE_NAME(PreMulSum, rccl_bfloat16),
 #endif
+  NCCL_ONERANK_REDUCE_NAME(PreMulSum, rccl_float8_e4m3),
+  NCCL_ONERANK_REDUCE_NAME(PreMulSum, rccl_float8_e5m2),
   NCCL_FUNC_NAME(SendRecv, RING, SIMPLE, Sum, int8_t),
   NCCL_FUNC_NAME(AllToAllPivot, RING, SIMPLE, Sum, int8_t),
 #endif
 #endif
 };
 
-static_assert(FUNC_INDEX_P2P == 5410, "Wrong P2P function index");
-static_assert(FUNC_INDEX_ALLTOALL_PIVOT == 5411, "Wrong AllToAllPivot function index");
+static_assert(FUNC_INDEX_P2P == 6492, "Wrong P2P function index");
+static_assert(FUNC_INDEX_ALLTOALL_PIVOT == 6493, "Wrong AllToAllPivot function index");
 
 #ifndef USE_INDIRECT_FUNCTION_CALL
 template<unsigned short f, unsigned short l, bool u>
@@ -188,7 +194,7 @@ void NCCL_CALL_FUNCTIONS(unsigned short funcIndex) noexcept {
   else
     assert("Unsupported function index");
 #else
-  if (funcIndex < 1080) {
+  if (funcIndex < 1296) {
     if (funcIndex % 18 == 0) ncclFunction_Broadcast_TREE_LL_Sum_int8_t();
     else if (USING_LL128 && funcIndex % 18 == 1) ncclFunction_Broadcast_TREE_LL128_Sum_int8_t();
     else if (!USING_LL128 && funcIndex % 18 == 1) ncclFunction_Broadcast_TREE_LL_Sum_int8_t();
@@ -206,8 +212,8 @@ void NCCL_CALL_FUNCTIONS(unsigned short funcIndex) noexcept {
     else if (!USING_LL128 && funcIndex % 18 == 10) ncclFunction_Broadcast_COLLNET_CHAIN_LL_Sum_int8_t();
     else ncclFunction_Broadcast_COLLNET_CHAIN_SIMPLE_Sum_int8_t();
   }
-  else if (funcIndex < 2160) Caller<1080, 2160, USING_LL128>::call(funcIndex);
-  else if (funcIndex < 3240) {
+  else if (funcIndex < 2592) Caller<1296, 2592, USING_LL128>::call(funcIndex);
+  else if (funcIndex < 3888) {
     if (funcIndex % 18 == 0) ncclFunction_AllGather_TREE_LL_Sum_int8_t();
     else if (USING_LL128 && funcIndex % 18 == 1) ncclFunction_AllGather_TREE_LL128_Sum_int8_t();
     else if (!USING_LL128 && funcIndex % 18 == 1) ncclFunction_AllGather_TREE_LL_Sum_int8_t();
@@ -225,9 +231,9 @@ void NCCL_CALL_FUNCTIONS(unsigned short funcIndex) noexcept {
     else if (!USING_LL128 && funcIndex % 18 == 10) ncclFunction_AllGather_COLLNET_CHAIN_LL_Sum_int8_t();
     else ncclFunction_AllGather_COLLNET_CHAIN_SIMPLE_Sum_int8_t();
   }
-  else if (funcIndex < 5400) Caller<3240, 5400, USING_LL128>::call(funcIndex);
+  else if (funcIndex < 6480) Caller<3888, 6480, USING_LL128>::call(funcIndex);
   else {
-    switch (funcIndex - 5400) {
+    switch (funcIndex - 6480) {
       case 0:
         ncclFunction_OneRankReduce_PreMulSum_int8_t();
         break;
@@ -259,9 +265,15 @@ void NCCL_CALL_FUNCTIONS(unsigned short funcIndex) noexcept {
         ncclFunction_OneRankReduce_PreMulSum_rccl_bfloat16();
         break;
       case 10:
-        ncclFunction_SendRecv_RING_SIMPLE_Sum_int8_t();
+        ncclFunction_OneRankReduce_PreMulSum_rccl_float8_e4m3();
         break;
       case 11:
+        ncclFunction_OneRankReduce_PreMulSum_rccl_float8_e5m2();
+        break;
+      case 12:
+        ncclFunction_SendRecv_RING_SIMPLE_Sum_int8_t();
+        break;
+      case 13:
         ncclFunction_AllToAllPivot_RING_SIMPLE_Sum_int8_t();
       default:
         break;
@@ -336,7 +348,7 @@ class ncclFunction {
     } \
     collTrace->type = end_type; \
   }
-  #define traceData(data2, data4, data8_0, data8_1) { \
+  #define traceData(data2, data4, data8_0, data8_1) if (ncclShmem.work.header.isTraced) { \
     INC_COLL_TRACE \
     collTrace->funcIndex = data2; \
     collTrace->data_0 = data4; \
@@ -366,9 +378,15 @@ struct ncclShmemData {
   uint64_t redOpArgs[NCCL_MAX_NVLS_ARITY+1];
   int channelId;
   int aborted;
+#ifdef COMPACT_SHMEM
+  struct ncclDevComm* comm;
+  struct ncclDevChannel* channel;
+#else
   alignas(16) struct ncclDevComm comm;
   alignas(16) struct ncclDevChannel channel;
+#endif
   alignas(16) struct ncclWork work;
+  alignas(16) struct ncclWork workNext; // next work of the chain, loaded while `work` runs
 #ifdef ENABLE_COLLTRACE
   struct ncclCollTrace* collTrace;
   union ncclCollTraceTail* collTraceTail;
@@ -379,11 +397,23 @@ struct ncclShmemData {
 #if defined(ENABLE_NPKIT)
   NpKitEvent event_buffer[LDS_NUM_EVENTS];
   uint64_t event_buffer_head;
+  uint64_t event_count; // events of the current work, bounded by max_events_per_collective
 #endif
 };
 static_assert(offsetof(struct ncclShmemData, work)%16 == 0, "ncclShmem.work needs to be 16B aligned");
 
 extern __shared__ ncclShmemData ncclShmem;
+
+// The communicator and channel of the block. A COMPACT_SHMEM build (ENABLE_COMPACT_SHMEM) keeps them
+// in global memory and only their addresses in LDS, which leaves more LDS to compute kernels sharing
+// the CU, they are only read when a work sets up its primitives.
+#ifdef COMPACT_SHMEM
+#define ncclShmemComm (*ncclShmem.comm)
+#define ncclShmemChannel (*ncclShmem.channel)
+#else
+#define ncclShmemComm ncclShmem.comm
+#define ncclShmemChannel ncclShmem.channel
+#endif
 #if __CUDA_ARCH__ >= 700
   extern __shared__ ulong2 ncclShmemPerWarp[/*ncclShmemDynamicSize()/sizeof(ulong2)*/];
 #else
@@ -418,6 +448,31 @@ inline __device__ void copyToShmem16(int tid, void* dst, void const* src, int by
   }
 }
 
+// gfx90a and gfx94x can load global memory straight into LDS, one dword per lane of a wave
+#if defined(__gfx90a__) || defined(__gfx940__) || defined(__gfx941__) || defined(__gfx942__)
+#if __has_builtin(__builtin_amdgcn_global_load_lds)
+#define NCCL_WORK_LDS_DMA 1
+#endif
+#endif
+#ifndef NCCL_WORK_LDS_DMA
+#define NCCL_WORK_LDS_DMA 0
+#endif
+
+// Starts loading the work at src into dst in LDS. With NCCL_WORK_LDS_DMA the first wave issues it
+// as LDS DMA, which holds no registers while in flight, and must wait for vmcnt before dst is read.
+// Other targets copy it through registers right away, like copyToShmem16().
+inline __device__ void loadWorkToShmem(int tid, struct ncclWork* dst, struct ncclWork const* src) {
+#if NCCL_WORK_LDS_DMA
+  static_assert(sizeof(ncclWork) == 4*WARP_SIZE, "ncclWork must be one dword per lane of a wave");
+  if (tid < WARP_SIZE) {
+    __builtin_amdgcn_global_load_lds((__attribute__((address_space(1))) void*)((char*)src + 4*tid),
+        (__attribute__((address_space(3))) void*)dst, 4, 0, 0);
+  }
+#else
+  copyToShmem16(tid, dst, src, sizeof(ncclWork));
+#endif
+}
+
 template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto>
 struct RunWorkElement {
   __device__ void run(ncclWorkElem*) {
@@ -431,8 +486,10 @@ struct RunWork {
   // here from the LL ncclKernel.
   __device__ __forceinline__ void run(ncclWork *w) {
     int wid = threadIdx.x / WARP_SIZE;
-    ncclWorkElem* we = w->header.type == ncclWorkTypeRegColl ? &w->regElems[0].elem : &w->elems[0];
-    int stride = w->header.type == ncclWorkTypeRegColl ? sizeof(ncclWorkElemReg) : sizeof(ncclWorkElem);
+    ncclWorkElem* we = w->header.type == ncclWorkTypeRegColl ? &w->regElems[0].elem :
+                       w->header.type == ncclWorkTypeUpdateColl ? &w->updateElems[0].elem : &w->elems[0];
+    int stride = w->header.type == ncclWorkTypeRegColl ? sizeof(ncclWorkElemReg) :
+                 w->header.type == ncclWorkTypeUpdateColl ? sizeof(ncclWorkElemUpdate) : sizeof(ncclWorkElem);
     #pragma unroll 1
     while ((char*)we + stride <= (char*)(w+1) && we->isUsed) {
       if (wid < we->nWarps) {
@@ -464,26 +521,9 @@ static __forceinline__ __device__ void ncclRedopPtrDeref(struct ncclWorkElem* we
   }
 }
 
-template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto, int FnIndex, bool COLLTRACE>
-__forceinline__ __device__ void ncclKernel(
-    struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead
-  )  {
-  const int tid = threadIdx.x;
-  int x = tid;
+// Warps 1-3 reset the group barriers and abort flag, warp 0 is left to the caller.
+static __forceinline__ __device__ void ncclShmemResetBarriers(int tid) {
   switch (tid/WARP_SIZE) {
-  case 0:
-    if (channelMask & (1ull<<x)) {
-      int y = __popcll(channelMask & ((1ull<<x)-1));
-      if (blockIdx.x == y) ncclShmem.channelId = x;
-    }
-    if (32 < MAXCHANNELS) {
-      x = 32 + tid;
-      if (channelMask & (1ull<<x)) {
-        int y = __popcll(channelMask & ((1ull<<x)-1));
-        if (blockIdx.x == y) ncclShmem.channelId = x;
-      }
-    }
-    break;
   case 1:
     if (tid < WARP_SIZE + NCCL_MAX_GROUPS)
       ncclShmem.groups[tid-WARP_SIZE].barrier = 0;
@@ -499,16 +539,41 @@ __forceinline__ __device__ void ncclKernel(
   default:
     break;
   }
-  __synclds(); // publish ncclShmem.channelId
-  // To map blockId to channelId, we need the n'th set bit of channelMask which
-  // is the inverse of counting the number of set bits among the the first n.
-  int channelId = ncclShmem.channelId;
+}
+
+// Whether the kernel of FnIndex runs funcIndex inline. Copy collectives share their int8_t
+// functions across datatypes, so any datatype of the same algorithm and protocol matches.
+template<ncclFunc_t Fn, int FnIndex>
+__forceinline__ __device__ bool ncclKernelRunsInline(int funcIndex) {
+  if (Fn == ncclFuncAllGather || Fn == ncclFuncBroadcast) {
+    constexpr int TypeStride = NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS;
+    return funcIndex/(ncclNumTypes*TypeStride) == FnIndex/(ncclNumTypes*TypeStride) &&
+           funcIndex%TypeStride == FnIndex%TypeStride;
+  }
+  return funcIndex == FnIndex;
+}
+
+// Runs the chain of work structs starting at ncclWorkAt(workHead, workIx), in NCCL_WORK_UNIT units, on channelId.
+template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto, int FnIndex, bool COLLTRACE>
+__forceinline__ __device__ void ncclKernelRunWork(
+    struct ncclDevComm* comm, int channelId, struct ncclWork* workHead, int workIx
+  )  {
+  const int tid = threadIdx.x;
 
   if (true) {
     void *dst, *src;
     int bytes;
     // Use first 3 warps to load comm, channel, and work into shmem
     switch (tid/WARP_SIZE) {
+#ifdef COMPACT_SHMEM
+    case 0:
+      if (tid == 0) {
+        ncclShmem.comm = comm;
+        ncclShmem.channel = &((ncclDevCommAndChannels*)comm)->channels[channelId];
+      }
+      bytes = 0;
+      break;
+#else
     case 0:
       dst = &ncclShmem.comm;
       src = comm;
@@ -522,9 +587,10 @@ __forceinline__ __device__ void ncclKernel(
       bytes = sizeof(ncclDevChannel);
       static_assert(sizeof(ncclDevChannel) <= 16*WARP_SIZE, "ncclDevChannel cannot be loaded by a single warp in one insn.");
       break;
+#endif
     case 2:
       dst = &ncclShmem.work;
-      src = workHead + blockIdx.x;
+      src = ncclWorkAt(workHead, workIx);
       bytes = sizeof(ncclWork);
       static_assert(sizeof(ncclWork) <= 16*WARP_SIZE, "ncclWork cannot be loaded by a single warp in one insn.");
       break;
@@ -544,7 +610,7 @@ __forceinline__ __device__ void ncclKernel(
 #ifdef ENABLE_PROFILING
   if (tid == 0) {
     ncclShmem.prof.count = 0;
-    ncclShmem.prof.seq = ncclShmem.comm.devProf[blockIdx.x].seq;
+    ncclShmem.prof.seq = ncclShmemComm.devProf[blockIdx.x].seq;
   }
 #endif
   if (tid == 0) __insert_timestamp(__LINE__);
@@ -553,7 +619,7 @@ __forceinline__ __device__ void ncclKernel(
   while (true) {
     // Notify host that all fifo reads are complete.
     if (tid == 0 && ncclShmem.work.header.isLast && ncclShmem.work.header.inFifo) {
-      *ncclShmem.channel.workFifoDone = ncclShmem.work.header.doneAcks;
+      *ncclShmemChannel.workFifoDone = ncclShmem.work.header.doneAcks;
     }
 
     __syncwarp();
@@ -562,10 +628,28 @@ __forceinline__ __device__ void ncclKernel(
     } else if (ncclShmem.work.header.type == ncclWorkTypeRegColl) {
       if (tid < NCCL_MAX_WORK_ELEMENTS_REG) ncclRedopPtrDeref(&ncclShmem.work.regElems[tid].elem);
     }
+    // Clear whatever followed a one unit work in the fifo, loaded along with it
+    if (ncclWorkUnits(ncclShmem.work.header.type) == 1 && NCCL_WORK_UNIT/16 <= tid && tid < NCCL_WORK_SIZE/16) {
+      ulong2* dst2 = (ulong2*)&ncclShmem.work + tid;
+      dst2->x = dst2->y = 0;
+    }
+#if defined(ENABLE_NPKIT)
+    if (tid == 0) ncclShmem.event_count = 0;
+#endif
     __synclds();
 
+    // Load the next work into ncclShmem.workNext before running this one. The fifo is usually in
+    // host memory, with LDS DMA the load completes while the work runs instead of stalling the
+    // block between the two, and it holds no registers during the work.
+    bool prefetch = !ncclShmem.work.header.isLast;
+    if (prefetch) loadWorkToShmem(tid, &ncclShmem.workNext, ncclWorkAt(workHead, ncclShmem.work.header.workNext));
+
     if (tid == 0) __insert_timestamp(__LINE__);
-    if (ncclShmem.work.header.funcIndex == FnIndex) {
+    uint64_t statsStart;
+    if (tid == 0 && ncclShmemComm.statsTicks) statsStart = wall_clock64();
+    if (ncclShmem.work.header.type == ncclWorkTypeLink) {
+      // Only leads to the wide first work of the block
+    } else if (ncclKernelRunsInline<Fn, FnIndex>(ncclShmem.work.header.funcIndex)) {
       RunWork<Fn, T, RedOp, Algo, Proto>().run(&ncclShmem.work);
     } else {
 #ifdef USE_INDIRECT_FUNCTION_CALL
@@ -579,11 +663,17 @@ __forceinline__ __device__ void ncclKernel(
 #endif
     }
 
-    int workIxNext = ncclShmem.work.header.workNext;
+    if (tid == 0 && ncclShmemComm.statsTicks) {
+      ncclShmemComm.statsTicks[ncclShmem.channelId*ncclStatsNumClasses + ncclShmem.work.header.statsClass] += wall_clock64() - statsStart;
+    }
+
+#if NCCL_WORK_LDS_DMA
+    if (prefetch && tid < WARP_SIZE) asm volatile("s_waitcnt vmcnt(0)");
+#endif
     __synclds();
     if (ncclShmem.work.header.isLast) break;
 
-    copyToShmem16(tid, &ncclShmem.work, workHead + workIxNext, sizeof(ncclWork));
+    copyToShmem16(tid, &ncclShmem.work, &ncclShmem.workNext, sizeof(ncclWork));
 
     { // Check whether the last operation was aborted and make sure all threads exit
       int aborted = tid == 0 ? *comm->abortFlag : 0;
@@ -592,19 +682,108 @@ __forceinline__ __device__ void ncclKernel(
         break;
       }
     }
-    if (COLLTRACE && tid == 0) traceKernelLaunch(ncclCollTraceCollLaunchType);
+    if (COLLTRACE && tid == 0 && ncclShmem.work.header.isTraced) traceKernelLaunch(ncclCollTraceCollLaunchType);
   }
   if (COLLTRACE && tid == 0) traceKernelEnd(ncclCollTraceKernelEndType);
 
 #ifdef ENABLE_PROFILING
-  if (ncclShmem.comm.devProf->seq < PROFILE_NUM_LAUNCHES) {
+  if (ncclShmemComm.devProf->seq < PROFILE_NUM_LAUNCHES) {
     __synclds();
-    copyToShmem16(tid, ncclShmem.comm.devProf+MAXCHANNELS*ncclShmem.prof.seq+blockIdx.x, &ncclShmem.prof, sizeof(struct ncclProf));
-    if (tid == 0) ncclShmem.comm.devProf[blockIdx.x].seq++;
+    copyToShmem16(tid, ncclShmemComm.devProf+MAXCHANNELS*ncclShmem.prof.seq+blockIdx.x, &ncclShmem.prof, sizeof(struct ncclProf));
+    if (tid == 0) ncclShmemComm.devProf[blockIdx.x].seq++;
   }
 #endif
 }
 
+template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto, int FnIndex, bool COLLTRACE>
+__forceinline__ __device__ void ncclKernel(
+    struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead
+  )  {
+  const int tid = threadIdx.x;
+  int x = tid;
+  if (tid < WARP_SIZE) {
+    if (channelMask & (1ull<<x)) {
+      int y = __popcll(channelMask & ((1ull<<x)-1));
+      if (blockIdx.x == y) ncclShmem.channelId = x;
+    }
+    if (32 < MAXCHANNELS) {
+      x = 32 + tid;
+      if (channelMask & (1ull<<x)) {
+        int y = __popcll(channelMask & ((1ull<<x)-1));
+        if (blockIdx.x == y) ncclShmem.channelId = x;
+      }
+    }
+  } else {
+    ncclShmemResetBarriers(tid);
+  }
+  __synclds(); // publish ncclShmem.channelId
+  // To map blockId to channelId, we need the n'th set bit of channelMask which
+  // is the inverse of counting the number of set bits among the the first n.
+  int channelId = ncclShmem.channelId;
+
+  ncclKernelRunWork<Fn, T, RedOp, Algo, Proto, FnIndex, COLLTRACE>(comm, channelId, workHead, blockIdx.x);
+}
+
+// Fused kernel: every block runs one channel of one of the fused plans.
+template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto, int FnIndex>
+__forceinline__ __device__ void ncclFusedKernelImpl(struct ncclFusedLaunch const& launch) {
+  const int tid = threadIdx.x;
+  struct ncclFusedBlock const* b = &launch.blocks[blockIdx.x];
+  ncclShmemResetBarriers(tid);
+  if (tid == 0) ncclShmem.channelId = b->channelId;
+  __synclds(); // publish ncclShmem.channelId
+  ncclKernelRunWork<Fn, T, RedOp, Algo, Proto, FnIndex, false>(b->comm, b->channelId, b->workHead, b->workIx);
+}
+
+// Resident kernel: block b stays on channel b and runs the work of every
+// doorbell whose channelMask contains b, until the host sets queue->stop or
+// the communicator is aborted.
+template<ncclFunc_t Fn, typename T, typename RedOp, int Algo, int Proto, int FnIndex>
+__forceinline__ __device__ void ncclResidentKernelImpl(
+    struct ncclDevComm* comm, struct ncclResidentQueue* queue
+  )  {
+  __shared__ int residentExit;
+  const int tid = threadIdx.x;
+  const int channelId = blockIdx.x;
+  uint64_t seq = 0;
+
+  ncclShmemResetBarriers(tid);
+  if (tid == 0) ncclShmem.channelId = channelId;
+
+  while (true) {
+    if (tid == 0) {
+      int exit = 0;
+      while (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == seq) {
+        if (__atomic_load_n(&queue->stop, __ATOMIC_RELAXED) || *comm->abortFlag) {
+          exit = 1;
+          break;
+        }
+        __builtin_amdgcn_s_sleep(8);
+      }
+      residentExit = exit;
+    }
+    __synclds(); // publish residentExit
+    if (residentExit) break;
+
+    seq++;
+    struct ncclResidentSlot* slot = queue->slots + (seq-1)%NCCL_RESIDENT_QUEUE_DEPTH;
+    uint64_t channelMask = __atomic_load_n(&slot->channelMask, __ATOMIC_RELAXED);
+    if (channelMask & (1ull<<channelId)) {
+      int workIx = __popcll(channelMask & ((1ull<<channelId)-1));
+      struct ncclWork* workHead = __atomic_load_n(&slot->workHead, __ATOMIC_RELAXED);
+      ncclKernelRunWork<Fn, T, RedOp, Algo, Proto, FnIndex, false>(comm, channelId, workHead, workIx);
+      __synclds();
+      if (tid == 0) {
+        // Results have to be visible before the launch stream is released.
+        __threadfence_system();
+        __atomic_fetch_sub(&slot->pending, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&queue->done, 1, __ATOMIC_RELEASE);
+      }
+    }
+    __synclds(); // residentExit is rewritten by the next poll
+  }
+}
+
 #ifdef ENABLE_COLLTRACE
 #define IMPL_COLL_KERN(func, algo, proto, devredop, type, fIndex) \
 __launch_bounds__(NCCL_MAX_NTHREADS, 1) \
@@ -624,6 +803,23 @@ __global__ void NCCL_KERN_NAME(func, algo, proto, devredop, type)(struct ncclDev
 }
 #endif
 
+#define IMPL_RESIDENT_KERN(func) \
+__launch_bounds__(NCCL_MAX_NTHREADS, 1) \
+__global__ void ncclResidentKernel(struct ncclDevComm* comm, struct ncclResidentQueue* queue) { \
+  ncclResidentKernelImpl<ncclFunc##func, int8_t, FuncSum<int8_t>, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE, FUNC_INDEX_P2P>(comm, queue); \
+}
+
+#define IMPL_FUSED_KERN(func) \
+__launch_bounds__(NCCL_MAX_NTHREADS, 1) \
+__global__ void ncclFusedKernel(struct ncclFusedLaunch launch) { \
+  ncclFusedKernelImpl<ncclFunc##func, int8_t, FuncSum<int8_t>, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE, FUNC_INDEX_P2P>(launch); \
+}
+
+// Kernel of an RCCL_SPECIALIZED_KERNELS entry
+#define IMPL_SPECIALIZED_KERN(func, algo, proto, devredop, type, ncclType) \
+  IMPL_COLL_KERN(func, algo, proto, devredop, type, \
+    FUNC_INDEX(ncclFunc##func, ncclDev##devredop, ncclType, NCCL_ALGO_##algo, NCCL_PROTO_##proto))
+
 // Examples :     AllReduce, RING, LL,    Sum,   uint8
 /* Functions for aggregation case */
 
@@ -669,7 +865,9 @@ __device__  __attribute__((noinline)) void NCCL_FUNC_NAME(func, algo, proto, dev
   IMPL_COLL3(func, devredop, half) \
   IMPL_COLL3(func, devredop, float) \
   IMPL_COLL3(func, devredop, double) \
-  IMPL_COLL3(func, devredop, rccl_bfloat16)
+  IMPL_COLL3(func, devredop, rccl_bfloat16) \
+  IMPL_COLL3(func, devredop, rccl_float8_e4m3) \
+  IMPL_COLL3(func, devredop, rccl_float8_e5m2)
 
 #define IMPL_COLL2A(func, devredop) \
   IMPL_COLL3(func, devredop, int8_t) \
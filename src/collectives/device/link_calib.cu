@@ -0,0 +1,14 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "devcomm.h"
+#include "collectives.h"
+
+__global__ void ncclCalibCopyKernel(const uint4* src, uint4* dst, size_t nVecs) {
+  size_t tid = blockIdx.x*blockDim.x + threadIdx.x;
+  size_t nthreads = gridDim.x*blockDim.x;
+  for (size_t i = tid; i < nVecs; i += nthreads) dst[i] = src[i];
+}
@@ -26,6 +26,10 @@ extern __shared__ struct mscclShmemData mscclShmem;
 #define GET_WORKINDEX_FROM_FLAG(__FLAG__) \
   (__FLAG__) / (MSCCL_MAX_ITER*MSCCL_MAX_NUM_STEPS)
 
+// identifies a step in NpKit and colltrace events: 12 bits of loop iteration, 4 bits of transmission type, 8 bits of step
+#define MSCCL_STEP_ID(__ITER__,__TYPE__,__STEP__) \
+  ((((uint32_t)(__ITER__) & 0xfff) << 12) | (((uint32_t)(__TYPE__) & 0xf) << 8) | ((uint32_t)(__STEP__) & 0xff))
+
 #ifdef ENABLE_COLLTRACE
   #define INC_COLL_TRACE \
     uint32_t pos = atomicAdd(&ncclShmem.collTraceTail->tail, 1)%COLLTRACE_NUM_ITEMS; \
@@ -153,7 +157,7 @@ for (int r = 0; r < numloops; r++) { \
 
 template<typename T, typename RedOp, typename Proto, bool fullOps>
 __device__ __forceinline__ void mscclRunInterpreter(
-  struct ncclDevComm* comm, struct mscclAlgo* algo, struct mscclWork* work) {
+  struct ncclDevComm* comm, struct mscclDevAlgo* algo, struct mscclWork* work) {
   const int tid = threadIdx.x;
   const int bid = blockIdx.x;
   const int nthreads = NCCL_MAX_NTHREADS;
@@ -164,10 +168,38 @@ __device__ __forceinline__ void mscclRunInterpreter(
      timestamp_entry = NPKIT_GET_GPU_TIMESTAMP();
   }
 #endif
-  // initialize mscclShmem.mscclTB
-  threadBlockCopy(
-    (uint32_t *)&mscclShmem.mscclTB, (uint32_t *)(algo->mscclTBs + bid),
-    sizeof(struct mscclThreadBlock) / sizeof(uint32_t), tid, nthreads);
+  // initialize mscclShmem.mscclTB from the compact copy of the thread block, one array per warp
+  {
+    const struct mscclDevThreadBlock* devTB =
+      (const struct mscclDevThreadBlock*)((const char*)algo + algo->tbOffsets[bid]);
+    const char* src = (const char*)(devTB + 1);
+    const int nSteps = devTB->nSteps;
+    const int nDependencies = devTB->nDependencies;
+    const int nReductions = devTB->nReductions;
+    const uint32_t *arraySrcs[4];
+    uint32_t *arrayDsts[4];
+    int arrayBytes[4];
+    arrayBytes[0] = nSteps * sizeof(struct mscclTransmission);
+    arrayBytes[1] = nDependencies * sizeof(int8_t);
+    arrayBytes[2] = nDependencies * sizeof(int16_t);
+    arrayBytes[3] = nReductions * sizeof(int16_t);
+    arrayDsts[0] = (uint32_t *)mscclShmem.mscclTB.transmissions;
+    arrayDsts[1] = (uint32_t *)mscclShmem.mscclTB.dependentBid;
+    arrayDsts[2] = (uint32_t *)mscclShmem.mscclTB.dependentStep;
+    arrayDsts[3] = (uint32_t *)mscclShmem.mscclTB.reductionSrcOffsets;
+    for (int a = 0; a < 4; a++) {
+      arraySrcs[a] = (const uint32_t *)src;
+      src += ROUNDUP(arrayBytes[a], 16);
+    }
+    const int w = tid/WARP_SIZE;
+    if (w < 4) threadBlockCopy(arrayDsts[w], arraySrcs[w], DIVUP(arrayBytes[w], sizeof(uint32_t)), tid%WARP_SIZE, WARP_SIZE);
+    if (tid == 0) {
+      mscclShmem.mscclTB.sendPeer = devTB->sendPeer;
+      mscclShmem.mscclTB.recvPeer = devTB->recvPeer;
+      mscclShmem.mscclTB.nSteps = nSteps;
+      mscclShmem.mscclTB.channelId = devTB->channelId;
+    }
+  }
   __synclds(); // publish mscclShmem.mscclTB.channelId
 
   // initialize ncclShmem and mscclShmem.work
@@ -177,6 +209,14 @@ __device__ __forceinline__ void mscclRunInterpreter(
     int bytes = 0;
     // Use first 3 warps to load comm, channel, and work into shmem
     switch (tid/WARP_SIZE) {
+#ifdef COMPACT_SHMEM
+    case 0:
+      if (tid == 0) {
+        ncclShmem.comm = comm;
+        ncclShmem.channel = &((ncclDevCommAndChannels*)comm)->channels[channelId];
+      }
+      break;
+#else
     case 0:
       dst = &ncclShmem.comm;
       src = comm;
@@ -188,6 +228,7 @@ __device__ __forceinline__ void mscclRunInterpreter(
       src = &((ncclDevCommAndChannels*)comm)->channels[channelId];
       bytes = sizeof(ncclDevChannel);
       break;
+#endif
     case 2:
       dst = &mscclShmem.work;
       src = work + blockIdx.x;
@@ -212,6 +253,7 @@ __device__ __forceinline__ void mscclRunInterpreter(
   int xcc_id = 0;
   if (tid == 0) {
     ncclShmem.event_buffer_head = 0;
+    ncclShmem.event_count = 0;
 #if defined(__gfx940__) || defined(__gfx941__) || defined(__gfx942__)
     asm volatile ("s_getreg_b32 %0, hwreg(HW_REG_XCC_ID)" : "=s" (xcc_id));
 #endif
@@ -228,7 +270,7 @@ __device__ __forceinline__ void mscclRunInterpreter(
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_TIME_SYNC_CPU)
   if (tid == 0) {
-    uint64_t* cpuTimestamp = ncclShmem.comm.cpuTimestamp;
+    uint64_t* cpuTimestamp = ncclShmemComm.cpuTimestamp;
     NpKit::CollectGpuEventLDS(NPKIT_EVENT_TIME_SYNC_CPU, 0, xcc_id, *cpuTimestamp);
   }
 #endif
@@ -246,7 +288,9 @@ __device__ __forceinline__ void mscclRunInterpreter(
   int recvPeer = mscclShmem.mscclTB.recvPeer;
   int sendPeer = mscclShmem.mscclTB.sendPeer;
 
-  const ssize_t chunkSize = int(Proto::calcBytePerStep()/sizeof(T) * (Proto::Id == NCCL_PROTO_SIMPLE ? MSCCL_CHUNKSTEPS : 1));
+  // With mixed protocols the host sizes loop iterations so that all thread blocks agree
+  const ssize_t chunkSize = mscclShmem.work.chunkSize ? mscclShmem.work.chunkSize :
+    int(Proto::calcBytePerStep()/sizeof(T) * (Proto::Id == NCCL_PROTO_SIMPLE ? MSCCL_CHUNKSTEPS : 1));
   int minChunkSize;
   if (Proto::Id == NCCL_PROTO_LL)
     minChunkSize = nthreads*(Proto::calcBytePerGrain()/sizeof(T));
@@ -303,12 +347,19 @@ __device__ __forceinline__ void mscclRunInterpreter(
 
     ssize_t srcOffset, dstOffset;
     T *srcPointer, *dstPointer;
-    int step = 0;
     for (int i = 0; i < mscclShmem.mscclTB.nSteps; i++){
       struct mscclTransmission* t = &mscclShmem.mscclTB.transmissions[i];
+#ifdef ENABLE_COLLTRACE
+      uint64_t stepStart = wall_clock64(), waitEnd = stepStart;
+#endif
       // first wait if there is a dependence
       int16_t numDependencies = t->numDependencies;
       if (numDependencies > 0){
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_DEP_WAIT_ENTRY)
+        if (tid == 0) {
+          NpKit::CollectGpuEventLDS(NPKIT_EVENT_MSCCL_DEP_WAIT_ENTRY, 0, MSCCL_STEP_ID(iter, t->type, i), NPKIT_GET_GPU_TIMESTAMP());
+        }
+#endif
         if (tid < numDependencies) {
           int16_t dependentPointer = t->dependencePointer;
           int8_t dependentBid = mscclShmem.mscclTB.dependentBid[dependentPointer+tid];
@@ -319,9 +370,21 @@ __device__ __forceinline__ void mscclRunInterpreter(
             if (curFlag >= goalFlag && GET_WORKINDEX_FROM_FLAG(curFlag) == workIndex) break;
           }
         }
-        step += numDependencies-1;
         barrier(nthreads);
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_DEP_WAIT_EXIT)
+        if (tid == 0) {
+          NpKit::CollectGpuEventLDS(NPKIT_EVENT_MSCCL_DEP_WAIT_EXIT, 0, MSCCL_STEP_ID(iter, t->type, i), NPKIT_GET_GPU_TIMESTAMP());
+        }
+#endif
+#ifdef ENABLE_COLLTRACE
+        waitEnd = wall_clock64();
+#endif
       }
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_STEP_ENTRY)
+      if (tid == 0) {
+        NpKit::CollectGpuEventLDS(NPKIT_EVENT_MSCCL_STEP_ENTRY, 0, MSCCL_STEP_ID(iter, t->type, i), NPKIT_GET_GPU_TIMESTAMP());
+      }
+#endif
 
       srcPointer = (t->srcBuffer == MSCCL_INPUT_BUFFER) ? thisInput : ((t->srcBuffer == MSCCL_OUTPUT_BUFFER) ? thisOutput : thisScratch);
       dstPointer = (t->dstBuffer == MSCCL_INPUT_BUFFER) ? thisInput : ((t->dstBuffer == MSCCL_OUTPUT_BUFFER) ? thisOutput : thisScratch);
@@ -434,7 +497,6 @@ __device__ __forceinline__ void mscclRunInterpreter(
             }
             prims.reduce(srcs, numReductions, &dst, 1, thisNelem);
           }
-          if (c == 0) step += (numReductions-1); // only advance step once!
         } else if (fullOps && t->type == MSCCL_RECV_COPY_SEND)
           prims.recvCopySend(dstOffset, thisNelem);
         else if (fullOps && t->type == MSCCL_RECV_REDUCE_SEND)
@@ -459,9 +521,21 @@ __device__ __forceinline__ void mscclRunInterpreter(
         else
           return;
       }
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_STEP_EXIT)
+      if (tid == 0) {
+        NpKit::CollectGpuEventLDS(NPKIT_EVENT_MSCCL_STEP_EXIT, nelem*t->count*sizeof(T), MSCCL_STEP_ID(iter, t->type, i), NPKIT_GET_GPU_TIMESTAMP());
+      }
+#endif
+#ifdef ENABLE_COLLTRACE
+      // time waiting for dependencies and time moving data, in wall clock ticks
+      if (fullOps && tid == 0) {
+        uint64_t stepEnd = wall_clock64();
+        traceData(__LINE__, MSCCL_STEP_ID(iter, t->type, i), waitEnd - stepStart, stepEnd - waitEnd);
+      }
+#endif
+      // dependencies refer to transmissions, as fused and numbered by the parser
       if (t->hasDependence && tid == nthreads-1)
-        __atomic_store_n(&mscclFlags[bid].flag, (uint64_t) COMPUTE_FLAG(workIndex, iter, step), __ATOMIC_RELAXED);
-      step++;
+        __atomic_store_n(&mscclFlags[bid].flag, (uint64_t) COMPUTE_FLAG(workIndex, iter, i), __ATOMIC_RELAXED);
     }
   }
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_RUN_EXIT)
@@ -471,9 +545,7 @@ __device__ __forceinline__ void mscclRunInterpreter(
 #endif
 #if defined(ENABLE_NPKIT)
   __synclds();
-  NpKitEventCollectContext* ctx = ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx;
-  copyToShmem16(tid, ctx->event_buffer+ctx->event_buffer_head, ncclShmem.event_buffer, sizeof(NpKitEvent)*ncclShmem.event_buffer_head);
-  if (tid == 0) ctx->event_buffer_head += ncclShmem.event_buffer_head;
+  NpKit::FlushGpuEventsLDS(ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx, tid, nthreads);
 #endif
 
   if (fullOps && tid == 0) {
@@ -481,15 +553,33 @@ __device__ __forceinline__ void mscclRunInterpreter(
   }
 }
 
+// Algorithms whose channels use different protocols are launched through the
+// Simple entries, every thread block then runs with the protocol of its channel
+template<typename T, typename RedOp, bool fullOps>
+__device__ __forceinline__ void mscclRunMixedInterpreter(
+  struct ncclDevComm* comm, struct mscclDevAlgo* algo, struct mscclWork* work) {
+  const struct mscclDevThreadBlock* devTB =
+    (const struct mscclDevThreadBlock*)((const char*)algo + algo->tbOffsets[blockIdx.x]);
+  switch (devTB->protocol) {
+    case NCCL_PROTO_LL:
+      mscclRunInterpreter<T, RedOp, ProtoLL, fullOps>(comm, algo, work);
+      return;
+    case NCCL_PROTO_LL128:
+      mscclRunInterpreter<T, RedOp, ProtoLL128, fullOps>(comm, algo, work);
+      return;
+  }
+  mscclRunInterpreter<T, RedOp, ProtoSimple<MSCCL_CHUNKSTEPS/MSCCL_SLICESTEPS, MSCCL_SLICESTEPS>, fullOps>(comm, algo, work);
+}
+
 #define MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, type, fullOps) \
-__global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, LL, fullOps)(struct ncclDevComm* comm, struct mscclAlgo* algo, struct mscclWork* work) { \
+__global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, LL, fullOps)(struct ncclDevComm* comm, struct mscclDevAlgo* algo, struct mscclWork* work) { \
   mscclRunInterpreter<type, Func##devredop<type>, ProtoLL, fullOps>(comm, algo, work); \
 } \
-__global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, LL128, fullOps)(struct ncclDevComm* comm, struct mscclAlgo* algo, struct mscclWork* work) { \
+__global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, LL128, fullOps)(struct ncclDevComm* comm, struct mscclDevAlgo* algo, struct mscclWork* work) { \
   mscclRunInterpreter<type, Func##devredop<type>, ProtoLL128, fullOps>(comm, algo, work); \
 } \
-__global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, Simple, fullOps)(struct ncclDevComm* comm, struct mscclAlgo* algo, struct mscclWork* work) { \
-  mscclRunInterpreter<type, Func##devredop<type>, ProtoSimple<MSCCL_CHUNKSTEPS/MSCCL_SLICESTEPS, MSCCL_SLICESTEPS>, fullOps>(comm, algo, work); \
+__global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, Simple, fullOps)(struct ncclDevComm* comm, struct mscclDevAlgo* algo, struct mscclWork* work) { \
+  mscclRunMixedInterpreter<type, Func##devredop<type>, fullOps>(comm, algo, work); \
 }
 
 #define MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP(devredop) \
@@ -502,7 +592,9 @@ __global__ void MSCCL_KERNEL_ENTRY_NAME(devredop, type, Simple, fullOps)(struct
   MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, half, fullOps) \
   MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, float, fullOps) \
   MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, double, fullOps) \
-  MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, rccl_bfloat16, fullOps)
+  MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, rccl_bfloat16, fullOps) \
+  MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, rccl_float8_e4m3, fullOps) \
+  MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, rccl_float8_e5m2, fullOps)
 
 #define MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_NOFLOAT(devredop) \
   MSCCL_IMPL_KERNEL_ENTRY_FUNC_DEVREDOP_TYPE(devredop, int8_t, fullOps) \
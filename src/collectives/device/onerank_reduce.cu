@@ -11,6 +11,22 @@
 #include "common.h"
 
 namespace {
+  // ncclReduceScatterUpdateAllGather() on one rank: the gradient is already
+  // reduced, only the optimizer step is left.
+  template<typename T>
+  __device__ void oneRankUpdate(ncclWorkElemUpdate *wu) {
+    if constexpr (IsFloatingPoint<T>::value) {
+      ncclWorkElem *we = &wu->elem;
+      intptr_t eltN = we->count;
+      intptr_t i0 = eltN*we->bid/we->nChannels;
+      intptr_t i1 = eltN*(we->bid+1)/we->nChannels;
+      T *params = (T*)we->recvbuff;
+      T const *grads = (T const*)we->sendbuff;
+      for (intptr_t i = i0 + threadIdx.x; i < i1; i += blockDim.x)
+        applyUpdate<T>(wu->update, params+i, grads+i, i);
+    }
+  }
+
   template<typename T, typename RedOp>
 #ifdef USE_INDIRECT_FUNCTION_CALL
   __device__ void oneRankReduce() {
@@ -20,6 +36,10 @@ namespace {
     ncclWork *w = &ncclShmem.work;
     int tid = threadIdx.x;
     int tn = blockDim.x;
+    if (w->header.type == ncclWorkTypeUpdateColl) {
+      oneRankUpdate<T>(&w->updateElems[0]);
+      return;
+    }
     #pragma unroll 1
     for(int e=0; e < NCCL_MAX_WORK_ELEMENTS && w->elems[e].isUsed; e++) {
       ncclWorkElem *we = &w->elems[e];
@@ -42,8 +62,14 @@ namespace {
       dst += i0;
       void *vsrc = (void*)src;
       void *vdst = (void*)dst;
-      reduceCopy<COLL_UNROLL, RedOp, T, 0,1,1, 0,1,1, /*PreOpSrcs=*/1>
-        (tid, tn, we->redOpArg, &(we->redOpArg), true, 1, &vsrc, 1, &vdst, i1-i0);
+      using Epilogue = typename EpilogueRedOp<T, FuncSum<T>>::Type;
+      if (!std::is_same<Epilogue, FuncSum<T>>::value && we->epilogue) {
+        reduceCopy<COLL_UNROLL, Epilogue, T, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>
+          (tid, tn, we->redOpArg, nullptr, true, 1, &vsrc, 1, &vdst, i1-i0);
+      } else {
+        reduceCopy<COLL_UNROLL, RedOp, T, 0,1,1, 0,1,1, /*PreOpSrcs=*/1>
+          (tid, tn, we->redOpArg, &(we->redOpArg), true, 1, &vsrc, 1, &vdst, i1-i0);
+      }
     }
   }
 }
@@ -72,3 +98,5 @@ INSTANTIATE(PreMulSum, rccl_bfloat16)
 #endif
 INSTANTIATE(PreMulSum, float)
 INSTANTIATE(PreMulSum, double)
+INSTANTIATE(PreMulSum, rccl_float8_e4m3)
+INSTANTIATE(PreMulSum, rccl_float8_e5m2)
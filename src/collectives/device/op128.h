@@ -166,6 +166,8 @@ template<int Size> __device__ BytePack<Size> ld_volatile_global(uintptr_t addr);
 //template<int Size> __device__ BytePack<Size> ld_shared(uint32_t addr);
 //template<int Size> __device__ BytePack<Size> ld_volatile_shared(uint32_t addr);
 template<int Size> __device__ void st_global(uintptr_t addr, BytePack<Size> value);
+// Non-temporal store, for data no kernel of this GPU reads back soon
+template<int Size> __device__ void st_nt_global(uintptr_t addr, BytePack<Size> value);
 //template<int Size> __device__ void st_shared(uint32_t addr, BytePack<Size> value);
 
 template<> __device__ __forceinline__ BytePack<0> ld_global<0>(uintptr_t addr) { return {}; }
@@ -173,6 +175,7 @@ template<> __device__ __forceinline__ BytePack<0> ld_volatile_global<0>(uintptr_
 //template<> __device__ __forceinline__ BytePack<0> ld_shared<0>(uint32_t addr) { return {}; }
 //template<> __device__ __forceinline__ BytePack<0> ld_volatile_shared<0>(uint32_t addr) { return {}; }
 template<> __device__ __forceinline__ void st_global<0>(uintptr_t addr, BytePack<0> value) {}
+template<> __device__ __forceinline__ void st_nt_global<0>(uintptr_t addr, BytePack<0> value) {}
 //template<> __device__ __forceinline__ void st_shared<0>(uint32_t addr, BytePack<0> value) {}
 
 // Used to define implementations for above prototypes.
@@ -197,6 +200,10 @@ template<> __device__ __forceinline__ void st_global<0>(uintptr_t addr, BytePack
   __device__ __forceinline__ void st_##space<bytes>(addr_cxx_ty addr, BytePack<bytes> value) { \
     data_cxx_ty tmp = value.native; \
     *((data_cxx_ty *)addr) = tmp; \
+  } \
+  template<> \
+  __device__ __forceinline__ void st_nt_##space<bytes>(addr_cxx_ty addr, BytePack<bytes> value) { \
+    __builtin_nontemporal_store(value.native, (data_cxx_ty *)addr); \
   }
 // Single-byte types use 4-byte registers since there is no 1-byte register
 // character for asm blocks. See https://docs.nvidia.com/cuda/inline-ptx-assembly/index.html#constraints
@@ -229,6 +236,11 @@ DEFINE_ld_st(8, uint64_t, b64, l, global, uintptr_t, l)
   __device__ __forceinline__ void st_##space<16>(addr_cxx_ty addr, BytePack<16> value) { \
     *((uint64_t*)addr) = value.u64[0]; \
     *((uint64_t*)addr+1) = value.u64[1]; \
+  } \
+  template<> \
+  __device__ __forceinline__ void st_nt_##space<16>(addr_cxx_ty addr, BytePack<16> value) { \
+    __builtin_nontemporal_store(value.u64[0], (uint64_t*)addr); \
+    __builtin_nontemporal_store(value.u64[1], (uint64_t*)addr+1); \
   }
 DEFINE_ld_st_16(global, uintptr_t, l)
 //DEFINE_ld_st_16(shared, uint32_t, r)
@@ -31,7 +31,11 @@ class Primitives<
                        DirectWrite = 0x200,
                        DirectRead = 0x400,
                        ThreadsSynced = 0x800,
-                       NvlsMinPolling = 0x1000;
+                       NvlsMinPolling = 0x1000,
+                       DirectDrain = 0x2000,
+                       CoarseFifo = 0x4000,
+                       NtSendStores = 0x8000,
+                       NtOutputStores = 0x10000;
   const int tid, tidInBlock;
   const int nthreads;
   int nworkers;
@@ -65,6 +69,12 @@ public:
 private:
 #endif
 
+  // Non-temporal stores for a copy, when RCCL_SIMPLE_NT_STORES asks for them for all its destinations
+  template<int Send, int Dst>
+  __device__ __forceinline__ bool ntStores() const {
+    return (Send || Dst) && (!Send || (flags & NtSendStores)) && (!Dst || (flags & NtOutputStores));
+  }
+
   // Don't use barrier 0 as it's used by the final sync
   inline __device__ void barrier() {
     flags |= ThreadsSynced;
@@ -81,7 +91,7 @@ private:
   inline __device__ bool checkAbort(int &spins) {
     spins++;
     if (!(flags & Aborted) && spins == NCCL_SPINS_BEFORE_CHECK_ABORT) {
-      if (atomicAdd_system((unsigned int *)ncclShmem.comm.abortFlag, 0)) {
+      if (atomicAdd_system((unsigned int *)ncclShmemComm.abortFlag, 0)) {
         flags |= Aborted;
         ncclShmem.aborted = 1;
       }
@@ -119,10 +129,13 @@ private:
         __builtin_amdgcn_s_sleep(1);
         connStepCache = loadStepValue(connStepPtr);
         if (checkAbort(spins)) break;
-        //if (spins == 0) printf("r=%d b=%d t=%d SPUN OUT got=%d want=%d\n", ncclShmem.comm.rank, blockIdx.x, threadIdx.x, int(connStepCache + (isSendNotRecv ? NCCL_STEPS : 0)), int(step+StepPerSlice));
+        //if (spins == 0) printf("r=%d b=%d t=%d SPUN OUT got=%d want=%d\n", ncclShmemComm.rank, blockIdx.x, threadIdx.x, int(connStepCache + (isSendNotRecv ? NCCL_STEPS : 0)), int(step+StepPerSlice));
         if (spins == 0) traceData(__LINE__, threadIdx.x, int(connStepCache + (isSendNotRecv ? NCCL_STEPS : 0)), int(step+StepPerSlice));
       }
       __asm__ __volatile__("s_wakeup");
+      // Lines of a coarse-grained FIFO may still be cached from the previous round,
+      // drop them before the workers read the step
+      if (!isSendNotRecv && (flags & CoarseFifo)) __builtin_amdgcn_fence(__ATOMIC_ACQUIRE, "");
     }
 
     if (flags & (Recv*RoleWaitRecv | Send*RoleWaitSend)) {
@@ -159,12 +172,17 @@ private:
 
   template<int Recv, int Send>
   inline __device__ void postPeer(bool dataStored) {
-    if (Send && (flags & RolePostSend) && dataStored)
+    if (Send && (flags & RolePostSend) && dataStored) {
+      // Writes to a coarse-grained FIFO may sit in L2 until written back at system scope
+      if (flags & CoarseFifo)
+        __builtin_amdgcn_fence(__ATOMIC_RELEASE, "");
+      else
 #ifdef __GFX9__
-      __builtin_amdgcn_buffer_wbinvl1();
+        __builtin_amdgcn_buffer_wbinvl1();
 #else
-      __threadfence_system();
+        __threadfence_system();
 #endif
+    }
 
     if ((flags & Send*RolePostSend) && next_hdp_reg)
       STORE((unsigned int *)next_hdp_reg, 0x1);
@@ -233,7 +251,7 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY)
             if (tid == 0) {
               NpKit::CollectGpuEvent(NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY, sliceSize*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-                  ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+                  ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
             }
 #endif
 
@@ -247,7 +265,7 @@ private:
               (tid, nworkers, /*redArg*/0, /*preOpArgs*/nullptr, /*postOp*/false,
                1, ncclShmem.groups[group].srcs,
                fan.nsend(), ncclShmem.groups[group].dsts+1,
-               workSize);
+               workSize, ntStores<1, 0>());
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_PRIM_COLLECT_DATA_PROCESS_TIME)
             if (tid == 0) {
@@ -259,7 +277,7 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT)
             if (tid == 0) {
               NpKit::CollectGpuEvent(NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT, sliceSize*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-                  ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+                  ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
             }
 #endif
 
@@ -269,7 +287,7 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY)
           if (tid == 0) {
             NpKit::CollectGpuEvent(NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY, sliceSize*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-                ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+                ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
           }
 #endif
 
@@ -283,7 +301,7 @@ private:
             (tid, nworkers, ncclShmem.redOpArgs[0],  nullptr, postOp,
              Recv, ncclShmem.groups[group].srcs,
              Dst, ncclShmem.groups[group].dsts,
-             workSize);
+             workSize, ntStores<0, Dst>());
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_PRIM_COLLECT_DATA_PROCESS_TIME)
           if (tid == 0) {
@@ -295,15 +313,25 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT)
           if (tid == 0) {
             NpKit::CollectGpuEvent(NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT, sliceSize*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-                ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+                ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
           }
 #endif
 
+        } else if (DirectSend && ncclShmem.groups[group].dsts[Dst] == nullptr) {
+          // Empty send to a peer pulling from our output buffer (ring allgather), only the
+          // local copy is left, if any
+          if (Dst) {
+            reduceCopy<Unroll, RedOp, T, 0, Recv+Src, Recv*MaxRecv+Src, 0, 1, 1, /*PreOpSrcs*/0>
+              (tid, nworkers, ncclShmem.redOpArgs[0], nullptr, postOp,
+               Recv*fan.nrecv()+Src, ncclShmem.groups[group].srcs,
+               1, ncclShmem.groups[group].dsts,
+               workSize, ntStores<0, 1>());
+          }
         } else {
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY)
           if (tid == 0) {
             NpKit::CollectGpuEvent(NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY, sliceSize*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-                ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+                ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
           }
 #endif
 
@@ -321,7 +349,7 @@ private:
             (tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, postOp,
              Recv*fan.nrecv()+Src, ncclShmem.groups[group].srcs,
              Send*fan.nsend()+Dst, ncclShmem.groups[group].dsts,
-             workSize);
+             workSize, ntStores<Send, Dst>());
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_PRIM_COLLECT_DATA_PROCESS_TIME)
           if (tid == 0) {
@@ -333,7 +361,7 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT)
           if (tid == 0) {
             NpKit::CollectGpuEvent(NPKIT_EVENT_PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT, sliceSize*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-                ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+                ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
           }
 #endif
 
@@ -368,7 +396,7 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_GENERIC_OP_ENTRY)
     if (tid == 0) {
       NpKit::CollectGpuEvent(NPKIT_EVENT_MSCCL_GENERIC_OP_ENTRY, nelem*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-          ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+          ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
     }
 #endif
 
@@ -400,7 +428,7 @@ private:
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_MSCCL_GENERIC_OP_EXIT)
     if (tid == 0) {
       NpKit::CollectGpuEvent(NPKIT_EVENT_MSCCL_GENERIC_OP_EXIT, nelem*sizeof(T), 0, NPKIT_GET_GPU_TIMESTAMP(),
-          ncclShmem.comm.npKitEventCollectContexts + npKitCtxIdx);
+          ncclShmemComm.npKitEventCollectContexts + npKitCtxIdx);
     }
 #endif
 
@@ -441,7 +469,7 @@ private:
             void* src0 = (T*)ncclShmem.groups[group].srcs[0] + pOffset;
             int realPeerSize = min(realSize, totalElem-pOffset);
             if (realPeerSize > 0 && ncclShmem.groups[group].dsts[i] != nullptr) {
-              reduceCopy<Unroll, RedOp, T, 0, 1, 1, 0, 1, 1, PreOpSrcs>(tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, false, 1, &src0, 1, ncclShmem.groups[group].dsts+i, realPeerSize);
+              reduceCopy<Unroll, RedOp, T, 0, 1, 1, 0, 1, 1, PreOpSrcs>(tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, false, 1, &src0, 1, ncclShmem.groups[group].dsts+i, realPeerSize, ntStores<1, 0>());
               // Mark for threadfence at the end
               fenceNeeded |= true;
             }
@@ -461,7 +489,7 @@ private:
             void* dst0 = (T*)ncclShmem.groups[group].dsts[0] + pOffset;
             int realPeerSize = min(realSize, totalElem-pOffset);
             if (DirectRecv && ncclShmem.groups[group].srcs[i] == dst0) realPeerSize = 0;
-            if (realPeerSize > 0) reduceCopy<Unroll, RedOp, T, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>(tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, postOp, 1, ncclShmem.groups[group].srcs+i, 1, &dst0, realPeerSize);
+            if (realPeerSize > 0) reduceCopy<Unroll, RedOp, T, 0,1,1, 0,1,1, /*PreOpSrcs=*/0>(tid, nworkers, ncclShmem.redOpArgs[0], ncclShmem.redOpArgs, postOp, 1, ncclShmem.groups[group].srcs+i, 1, &dst0, realPeerSize, ntStores<0, 1>());
           }
         }
       }
@@ -486,6 +514,7 @@ private:
         connStepPtr = conn->tail;
         connStepCache = loadStepValue(connStepPtr);
         flags |= (conn->offsFifo != nullptr) ? OffsFifoEnabled : 0;
+        flags |= (conn->flags & NCCL_COARSE_SIMPLE) ? CoarseFifo : 0;
         if (Direct) {
           // User buffers have been registered
           if ((conn->flags & (NCCL_IPC_READ|NCCL_IPC_WRITE)) && e != nullptr && e->regUsed) {
@@ -498,6 +527,9 @@ private:
           } else if (conn->flags & (NCCL_DIRECT_WRITE|NCCL_DIRECT_READ)) {
             if (connIndex == 1 && P2p == 0) {
               flags |= DirectRead;  // scatter-reduce use direct pull
+            } else if (e != nullptr && (e->direct & NCCL_DIRECT_READ_RING)) {
+              // ring allgather pulls from the output buffer of the previous rank
+              flags |= (conn->flags & NCCL_DIRECT_READ) ? DirectRead : 0;
             } else {
               // direct read not allowed in non-register case
               // otherwise, in one-to-multi send, we could mix empty send and intermediate send
@@ -520,6 +552,7 @@ private:
       if (flags & RolePostSend) {
         connStepPtr = conn->tail;
 	    next_hdp_reg = conn->next_hdp_reg;
+        flags |= (conn->flags & NCCL_COARSE_SIMPLE) ? CoarseFifo : 0;
       }
       if (flags & RoleWaitSend) {
         ncclShmem.groups[group].sendConns[index] = conn; // WaitSend role saves since that's who needs it in setDataPtrs()
@@ -546,6 +579,9 @@ private:
           } else if (conn->flags & (NCCL_DIRECT_WRITE|NCCL_DIRECT_READ)) {
             if (connIndex == 1 && P2p == 0) {
               flags |= DirectRead;  // scatter-reduce use direct pull
+            } else if (e != nullptr && (e->direct & NCCL_DIRECT_READ_RING)) {
+              // the next rank pulls from our output buffer, see ~Primitives()
+              flags |= (conn->flags & NCCL_DIRECT_READ) ? DirectRead|DirectDrain : 0;
             } else {
               // direct read not allowed in non-register case
               // otherwise, in one-to-multi send, we could mix empty send and intermediate send
@@ -564,7 +600,7 @@ private:
       uint8_t connIndexRecv = 0, uint8_t connIndexSend = 0, struct ncclWorkElem* e = nullptr
     ):
     tid(tid), nthreads(nthreads), tidInBlock(threadIdx.x), group(group),
-    stepSize(ncclShmem.comm.buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS/sizeof(T)) {
+    stepSize(ncclShmemComm.buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS/sizeof(T)) {
 
     // For send operations, we need an extra warp to overlap the threadfence and the copy
     barriers = &ncclShmem.groups[group].barrier;
@@ -594,18 +630,25 @@ private:
     } else if (g == ng - 1) {
       if (index < nsend) flags |= RolePostSend;
     }
+    flags |= (ncclShmemComm.simpleNtStores & NCCL_NT_STORES_SEND) ? NtSendStores : 0;
+    flags |= (ncclShmemComm.simpleNtStores & NCCL_NT_STORES_OUTPUT) ? NtOutputStores : 0;
 
     int peer = 0;
     if (flags & (RoleWaitRecv|RolePostRecv)) peer = recvPeers[index];
     if (flags & (RoleWaitSend|RolePostSend)) peer = sendPeers[index];
 
-    loadRecvConn(ncclShmem.channel.peers[peer], connIndexRecv, e);
-    loadSendConn(ncclShmem.channel.peers[peer], connIndexSend, e);
+    loadRecvConn(ncclShmemChannel.peers[peer], connIndexRecv, e);
+    loadSendConn(ncclShmemChannel.peers[peer], connIndexSend, e);
 
     setDataPtrs(inputBuf, outputBuf, redOpArg, (struct ncclWorkElemReg*)e);
   }
 
   __forceinline__ __device__ ~Primitives() {
+    // The next rank may still be reading our output buffer, which the user owns again once we return
+    if (flags & DirectDrain) {
+      int spins = 0;
+      while (loadStepValue(connStepPtr) < step && !checkAbort(spins));
+    }
     // Ensure ncclShmem.groups[].send/recvConns are available
     if (!(flags & ThreadsSynced))
       barrier();
@@ -710,6 +753,12 @@ private:
     if (flags & RoleOutput) userBuff = (T*)outputBuf;
   }
 
+  // Wait for all threads of the group, e.g. around work done on the user
+  // buffers between two primitives.
+  __device__ __forceinline__ void syncThreads() {
+    barrier();
+  }
+
   __device__ __forceinline__ void send(intptr_t inpIx, int eltN) {
     genericOp<0, 0, 0, 1, Input, -1>(inpIx, -1, eltN, false);
   }
@@ -727,7 +776,7 @@ private:
     genericOp<0, 0, 1, 0, -1, Output>(-1, outIx, eltN, postOp);
   }
   __device__ __forceinline__ void directRecv(intptr_t outIx, int eltN) {
-    genericOp<1, 0, 1, 0, -1, Output>(-1, outIx, eltN, /*postOp=*/false);
+    genericOp<1, 0, 1, 0, -1, Output>(outIx, outIx, eltN, /*postOp=*/false);
   }
 
   __device__ __forceinline__ void copySend(intptr_t inpIx, intptr_t outIx, int eltN, bool postOp=false) {
@@ -744,7 +793,7 @@ private:
     genericOp<0, 0, 1, 1, -1, Output>(-1, outIx, eltN, postOp);
   }
   __device__ __forceinline__ void directRecvCopySend(intptr_t outIx, int eltN) {
-    genericOp<1, 1, 1, 1, -1, Output>(-1, outIx, eltN, false);
+    genericOp<1, 1, 1, 1, -1, Output>(outIx, outIx, eltN, false);
   }
   __device__ __forceinline__ void recvCopyDirectSend(intptr_t outIx, int eltN, bool postOp=false) {
     genericOp<0, 1, 1, 1, -1, Output>(-1, outIx, eltN, postOp);
@@ -0,0 +1,273 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "devcomm.h"
+#include "collectives.h"
+#include <hip/hip_fp16.h>
+
+template<typename T> __device__ inline float qarToFloat(T x) { return float(x); }
+template<> __device__ inline float qarToFloat<half>(half x) { return __half2float(x); }
+template<typename T> __device__ inline T qarFromFloat(float x) { return T(x); }
+template<> __device__ inline half qarFromFloat<half>(float x) { return __float2half(x); }
+
+// User buffers may not be 16-byte aligned, our mapped areas always are
+__device__ inline uint4 qarLoad(const char* p, size_t i, bool aligned) {
+  if (aligned) return reinterpret_cast<const uint4*>(p)[i];
+  uint4 v;
+  for (int b = 0; b < sizeof(uint4); b++) reinterpret_cast<char*>(&v)[b] = p[i*sizeof(uint4)+b];
+  return v;
+}
+
+__device__ inline void qarStore(char* p, size_t i, uint4 v, bool aligned) {
+  if (aligned) {
+    reinterpret_cast<uint4*>(p)[i] = v;
+    return;
+  }
+  for (int b = 0; b < sizeof(uint4); b++) p[i*sizeof(uint4)+b] = reinterpret_cast<const char*>(&v)[b];
+}
+
+// dst[i] = sum of srcs[s][i] for i in [lo, hi). Sources are summed in rank order on
+// every rank, so all ranks get bitwise identical results.
+template<typename T>
+__device__ inline void qarReduce(char* dst, bool aligned, const uint4* const* srcs, int nSrcs, size_t lo, size_t hi) {
+  constexpr int N = sizeof(uint4)/sizeof(T);
+  for (size_t i = lo + threadIdx.x; i < hi; i += blockDim.x) {
+    float acc[N];
+    uint4 v = srcs[0][i];
+    for (int k = 0; k < N; k++) acc[k] = qarToFloat(reinterpret_cast<const T*>(&v)[k]);
+    for (int s = 1; s < nSrcs; s++) {
+      v = srcs[s][i];
+      for (int k = 0; k < N; k++) acc[k] += qarToFloat(reinterpret_cast<const T*>(&v)[k]);
+    }
+    for (int k = 0; k < N; k++) reinterpret_cast<T*>(&v)[k] = qarFromFloat<T>(acc[k]);
+    qarStore(dst, i, v, aligned);
+  }
+}
+
+// Tells every peer this block reached the barrier, then waits for all of them. `arrived` is the
+// offset in the flags of the per-rank epochs of this barrier.
+__device__ inline void qarBarrierAt(char* const* peers, size_t arrived, int rank, int nRanks, uint64_t epoch) {
+  __syncthreads();
+  if (threadIdx.x < nRanks) {
+    __threadfence_system();
+    uint64_t* peer = (uint64_t*)(peers[threadIdx.x] + arrived);
+    __atomic_store_n(peer + rank, epoch, __ATOMIC_RELEASE);
+    uint64_t* mine = (uint64_t*)(peers[rank] + arrived);
+    while (__atomic_load_n(mine + threadIdx.x, __ATOMIC_ACQUIRE) < epoch);
+    __threadfence_system();
+  }
+  __syncthreads();
+}
+
+__device__ inline void qarBarrier(char* const* peers, int phase, int rank, int nRanks, uint64_t epoch) {
+  size_t arrived = offsetof(struct rcclQuickArFlags, arrived) + (phase*RCCL_QUICK_AR_MAX_BLOCKS + blockIdx.x)*RCCL_QUICK_AR_MAX_RANKS*sizeof(uint64_t);
+  qarBarrierAt(peers, arrived, rank, nRanks, epoch);
+}
+
+template<typename T>
+__device__ void qarRun(char* const* peers, int rank, int nRanks, const char* input, char* output, bool aligned,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, int twoShot) {
+  __shared__ uint64_t epoch;
+  __shared__ const uint4* srcs[RCCL_QUICK_AR_MAX_RANKS];
+  struct rcclQuickArFlags* flags = (struct rcclQuickArFlags*)peers[rank];
+  if (threadIdx.x == 0) epoch = flags->epochs[blockIdx.x] + 1;
+  __syncthreads();
+  size_t dataOffset = RCCL_QUICK_AR_DATA_OFFSET + (epoch & 1)*maxBytes;
+  if (threadIdx.x < nRanks) srcs[threadIdx.x] = (const uint4*)(peers[threadIdx.x] + dataOffset);
+  char* mine = peers[rank] + dataOffset;
+  size_t lo = blockIdx.x*slotVecs;
+  size_t hi = min(lo + slotVecs, nVecs);
+
+  // Inputs are only readable by peers once staged in our mapped area
+  for (size_t i = lo + threadIdx.x; i < hi; i += blockDim.x) qarStore(mine, i, qarLoad(input, i, aligned), true);
+  qarBarrier(peers, 0, rank, nRanks, epoch);
+  if (!twoShot) {
+    qarReduce<T>(output, aligned, srcs, nRanks, lo, hi);
+  } else {
+    // Reduce our shard of the slot in place, then read the other shards from their owners
+    size_t n = hi - lo;
+    qarReduce<T>(mine, true, srcs, nRanks, lo + rank*n/nRanks, lo + (rank+1)*n/nRanks);
+    qarBarrier(peers, 1, rank, nRanks, epoch);
+    for (int r = 0; r < nRanks; r++) {
+      for (size_t i = lo + r*n/nRanks + threadIdx.x; i < lo + (r+1)*n/nRanks; i += blockDim.x) qarStore(output, i, srcs[r][i], aligned);
+    }
+  }
+  __syncthreads();
+  if (threadIdx.x == 0) flags->epochs[blockIdx.x] = epoch;
+}
+
+__global__ __launch_bounds__(RCCL_QUICK_AR_NTHREADS)
+void ncclQuickAllReduceKernel(char* const* peers, int rank, int nRanks, const void* sendbuff, void* recvbuff,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, int type, int twoShot) {
+  const char* input = (const char*)sendbuff;
+  char* output = (char*)recvbuff;
+  bool aligned = ((uintptr_t)input | (uintptr_t)output) % sizeof(uint4) == 0;
+  switch (type) {
+    case ncclFloat32:
+      qarRun<float>(peers, rank, nRanks, input, output, aligned, nVecs, slotVecs, maxBytes, twoShot);
+      break;
+    case ncclFloat16:
+      qarRun<half>(peers, rank, nRanks, input, output, aligned, nVecs, slotVecs, maxBytes, twoShot);
+      break;
+    case ncclBfloat16:
+      qarRun<rccl_bfloat16>(peers, rank, nRanks, input, output, aligned, nVecs, slotVecs, maxBytes, twoShot);
+      break;
+  }
+}
+
+// Blocks split the vectors of every destination block, and start with the next rank so that all
+// ranks do not write to the same peer at the same time. The first barrier makes sure peers are done
+// with their output buffer, the second that all our blocks landed in it before any rank leaves.
+__global__ __launch_bounds__(RCCL_QUICK_AR_NTHREADS)
+void ncclDirectAllToAllKernel(char* const* peers, int rank, int nRanks, const void* sendbuff,
+    struct rcclDirectA2ADsts dsts, size_t nVecs) {
+  __shared__ uint64_t epoch;
+  struct rcclQuickArFlags* flags = (struct rcclQuickArFlags*)peers[rank];
+  if (threadIdx.x == 0) epoch = flags->a2aEpochs[blockIdx.x] + 1;
+  __syncthreads();
+  size_t arrived = offsetof(struct rcclQuickArFlags, a2aArrived) + blockIdx.x*RCCL_QUICK_AR_MAX_RANKS*sizeof(uint64_t);
+  size_t phaseBytes = RCCL_QUICK_AR_MAX_BLOCKS*RCCL_QUICK_AR_MAX_RANKS*sizeof(uint64_t);
+  qarBarrierAt(peers, arrived, rank, nRanks, epoch);
+
+  size_t blockVecs = DIVUP(nVecs, gridDim.x);
+  size_t lo = blockIdx.x*blockVecs;
+  size_t hi = min(lo + blockVecs, nVecs);
+  for (int s = 1; s <= nRanks; s++) {
+    int r = (rank + s) % nRanks;
+    const char* src = (const char*)sendbuff + r*nVecs*sizeof(uint4);
+    char* dst = dsts.ptrs[r];
+    bool aligned = ((uintptr_t)src | (uintptr_t)dst) % sizeof(uint4) == 0;
+    for (size_t i = lo + threadIdx.x; i < hi; i += blockDim.x) qarStore(dst, i, qarLoad(src, i, aligned), aligned);
+  }
+
+  qarBarrierAt(peers, arrived + phaseBytes, rank, nRanks, epoch);
+  if (threadIdx.x == 0) flags->a2aEpochs[blockIdx.x] = epoch;
+}
+
+// Every rank flags its arrival in the areas of all the others, thread r then waits for rank r
+__global__ __launch_bounds__(RCCL_QUICK_AR_MAX_RANKS)
+void ncclBarrierKernel(char* const* peers, int rank, int nRanks) {
+  struct rcclQuickArFlags* mine = (struct rcclQuickArFlags*)peers[rank];
+  uint64_t epoch = mine->barrierEpoch + 1;
+  if (threadIdx.x < nRanks) {
+    // Writes of the work before the barrier must be visible to peers before they leave it
+    __threadfence_system();
+    struct rcclQuickArFlags* peer = (struct rcclQuickArFlags*)peers[threadIdx.x];
+    __atomic_store_n(&peer->barrierArrived[rank], epoch, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&mine->barrierArrived[threadIdx.x], __ATOMIC_ACQUIRE) < epoch);
+    __threadfence_system();
+  }
+  __syncthreads();
+  if (threadIdx.x == 0) mine->barrierEpoch = epoch;
+}
+
+__device__ inline size_t qarPartialOffset(uint64_t epoch, size_t maxBytes) {
+  return RCCL_QUICK_AR_DATA_OFFSET + (2 + (epoch & 1))*maxBytes;
+}
+
+// True in all threads of the last block of the grid to get there, which then sees the writes of
+// all the others. The counter is reset for the next kernel using it.
+__device__ inline bool qarLastBlock(uint32_t* counter) {
+  __shared__ bool last;
+  __syncthreads();
+  if (threadIdx.x == 0) {
+    __threadfence_system();
+    last = atomicAdd(counter, 1) == gridDim.x - 1;
+    if (last) {
+      *counter = 0;
+      __threadfence_system();
+    }
+  }
+  __syncthreads();
+  return last;
+}
+
+// Bounded staleness: the half an epoch stages into was last used two calls before, and is only
+// overwritten once every peer, on time or not, is done with it. Ranks may thus run one call ahead
+// of a straggler, and wait for it beyond that.
+__global__ __launch_bounds__(RCCL_QUICK_AR_NTHREADS)
+void ncclPartialArStageKernel(char* const* peers, int rank, int nRanks, const void* sendbuff,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, uint64_t deadline) {
+  __shared__ uint32_t present;
+  struct rcclQuickArFlags* flags = (struct rcclQuickArFlags*)peers[rank];
+  uint64_t epoch = flags->partialEpoch + 1;
+  if (threadIdx.x < nRanks) {
+    while (__atomic_load_n(&flags->partialRead[threadIdx.x], __ATOMIC_ACQUIRE) + 2 < epoch);
+  }
+  __syncthreads();
+  const char* input = (const char*)sendbuff;
+  bool aligned = (uintptr_t)input % sizeof(uint4) == 0;
+  char* mine = peers[rank] + qarPartialOffset(epoch, maxBytes);
+  size_t lo = blockIdx.x*slotVecs;
+  size_t hi = min(lo + slotVecs, nVecs);
+  for (size_t i = lo + threadIdx.x; i < hi; i += blockDim.x) qarStore(mine, i, qarLoad(input, i, aligned), true);
+  if (!qarLastBlock(&flags->partialBlocks[0])) return;
+
+  // Our input is staged: flag it to every peer, then give each of them until the deadline
+  if (threadIdx.x == 0) present = 0;
+  __syncthreads();
+  if (threadIdx.x < nRanks) {
+    struct rcclQuickArFlags* peer = (struct rcclQuickArFlags*)peers[threadIdx.x];
+    __atomic_store_n(&peer->partialArrived[rank], epoch, __ATOMIC_RELEASE);
+    uint64_t start = wall_clock64();
+    bool arrived;
+    while (!(arrived = __atomic_load_n(&flags->partialArrived[threadIdx.x], __ATOMIC_ACQUIRE) >= epoch) &&
+           wall_clock64() - start < deadline);
+    if (arrived) atomicOr(&present, 1u << threadIdx.x);
+    __threadfence_system();
+  }
+  __syncthreads();
+  if (threadIdx.x == 0) flags->partialPresent = present;
+}
+
+template<typename T>
+__device__ void qarPartialReduce(char* const* peers, int rank, int nRanks, char* output, bool aligned,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, uint32_t* missingMask) {
+  __shared__ const uint4* srcs[RCCL_QUICK_AR_MAX_RANKS];
+  __shared__ int nSrcs;
+  struct rcclQuickArFlags* flags = (struct rcclQuickArFlags*)peers[rank];
+  uint64_t epoch = flags->partialEpoch + 1;
+  uint32_t present = flags->partialPresent;
+  if (threadIdx.x == 0) {
+    nSrcs = 0;
+    for (int r = 0; r < nRanks; r++) {
+      if (present & (1u << r)) srcs[nSrcs++] = (const uint4*)(peers[r] + qarPartialOffset(epoch, maxBytes));
+    }
+  }
+  __syncthreads();
+  size_t lo = blockIdx.x*slotVecs;
+  size_t hi = min(lo + slotVecs, nVecs);
+  qarReduce<T>(output, aligned, srcs, nSrcs, lo, hi);
+  if (!qarLastBlock(&flags->partialBlocks[1])) return;
+
+  // Peers may overwrite what we read, and what we skipped, once we are done with this epoch
+  if (threadIdx.x < nRanks) {
+    struct rcclQuickArFlags* peer = (struct rcclQuickArFlags*)peers[threadIdx.x];
+    __atomic_store_n(&peer->partialRead[rank], epoch, __ATOMIC_RELEASE);
+  }
+  if (threadIdx.x == 0) {
+    *missingMask = ~present & ((1u << nRanks) - 1);
+    flags->partialEpoch = epoch;
+  }
+}
+
+__global__ __launch_bounds__(RCCL_QUICK_AR_NTHREADS)
+void ncclPartialArReduceKernel(char* const* peers, int rank, int nRanks, void* recvbuff,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, int type, uint32_t* missingMask) {
+  char* output = (char*)recvbuff;
+  bool aligned = (uintptr_t)output % sizeof(uint4) == 0;
+  switch (type) {
+    case ncclFloat32:
+      qarPartialReduce<float>(peers, rank, nRanks, output, aligned, nVecs, slotVecs, maxBytes, missingMask);
+      break;
+    case ncclFloat16:
+      qarPartialReduce<half>(peers, rank, nRanks, output, aligned, nVecs, slotVecs, maxBytes, missingMask);
+      break;
+    case ncclBfloat16:
+      qarPartialReduce<rccl_bfloat16>(peers, rank, nRanks, output, aligned, nVecs, slotVecs, maxBytes, missingMask);
+      break;
+  }
+}
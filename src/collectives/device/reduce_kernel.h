@@ -32,6 +32,7 @@ struct FuncMax  { using EltType = T; __device__ FuncMax(uint64_t opArg=0) {}; };
 
 template<typename T> struct FuncPreMulSum;
 template<typename T> struct FuncSumPostDiv;
+template<typename T> struct FuncSumEpilogue;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Trait classes for reduction functions. Given a function (FuncSum, etc.)
@@ -262,6 +263,124 @@ struct Apply_Reduce<FuncSum<int8_t>, /*EltPerPack=*/4> {
 #endif
 #endif
 
+// FP8 values are reduced in float and rounded once per reduction, saturating
+// to the largest finite value instead of overflowing.
+#define SPECIALIZE_REDUCE_FP8(T) \
+  SPECIALIZE_REDUCE(FuncSum, T, 1, T, T((float)(x) + (float)(y))) \
+  SPECIALIZE_REDUCE(FuncProd, T, 1, T, T((float)(x) * (float)(y))) \
+  SPECIALIZE_REDUCE(FuncMin, T, 1, T, T(fminf((float)(x), (float)(y)))) \
+  SPECIALIZE_REDUCE(FuncMax, T, 1, T, T(fmaxf((float)(x), (float)(y))))
+
+SPECIALIZE_REDUCE_FP8(rccl_float8_e4m3)
+SPECIALIZE_REDUCE_FP8(rccl_float8_e5m2)
+#undef SPECIALIZE_REDUCE_FP8
+
+////////////////////////////////////////////////////////////////////////////////
+// Packed half and bfloat16 reductions for CDNA. The generic recursion splits
+// packs down to these 2- and 4-wide cases instead of single elements.
+//
+// Halves reduce two at a time with v_pk_{add,mul,min,max}_f16. bfloat16 has no
+// packed arithmetic on these targets: each 32-bit word is widened to two floats
+// with a shift and a mask, reduced with v_pk_{add,mul}_f32 where gfx90a/gfx94x
+// have them, and rounded back to nearest even like rccl_bfloat16(float) does,
+// so results are bitwise identical to the element-wise path.
+
+#if defined(__gfx908__) || defined(__gfx90a__) || defined(__gfx940__) || defined(__gfx941__) || defined(__gfx942__)
+  #define RCCL_PACKED_HALF 1
+#endif
+
+#if RCCL_PACKED_HALF
+  typedef _Float16 rcclHalf2 __attribute__((ext_vector_type(2)));
+  typedef _Float16 rcclHalf4 __attribute__((ext_vector_type(4)));
+  typedef float rcclFloat2 __attribute__((ext_vector_type(2)));
+  typedef float rcclFloat4 __attribute__((ext_vector_type(4)));
+
+  template<typename Vec>
+  __device__ __forceinline__ Vec rcclPackedMin(Vec x, Vec y) {
+  #if __has_builtin(__builtin_elementwise_min)
+    return __builtin_elementwise_min(x, y);
+  #else
+    return x < y ? x : y;
+  #endif
+  }
+  template<typename Vec>
+  __device__ __forceinline__ Vec rcclPackedMax(Vec x, Vec y) {
+  #if __has_builtin(__builtin_elementwise_max)
+    return __builtin_elementwise_max(x, y);
+  #else
+    return x > y ? x : y;
+  #endif
+  }
+
+  SPECIALIZE_REDUCE(FuncSum, half, 2, rcclHalf2, x + y)
+  SPECIALIZE_REDUCE(FuncSum, half, 4, rcclHalf4, x + y)
+  SPECIALIZE_REDUCE(FuncProd, half, 2, rcclHalf2, x * y)
+  SPECIALIZE_REDUCE(FuncProd, half, 4, rcclHalf4, x * y)
+  SPECIALIZE_REDUCE(FuncMin, half, 2, rcclHalf2, rcclPackedMin(x, y))
+  SPECIALIZE_REDUCE(FuncMin, half, 4, rcclHalf4, rcclPackedMin(x, y))
+  SPECIALIZE_REDUCE(FuncMax, half, 2, rcclHalf2, rcclPackedMax(x, y))
+  SPECIALIZE_REDUCE(FuncMax, half, 4, rcclHalf4, rcclPackedMax(x, y))
+
+#if defined(RCCL_BFLOAT16)
+  __device__ __forceinline__ rcclFloat2 rcclBf16x2ToFloat2(uint32_t v) {
+    rcclFloat2 f;
+    f.x = __uint_as_float(v << 16);
+    f.y = __uint_as_float(v & 0xffff0000u);
+    return f;
+  }
+  __device__ __forceinline__ rcclFloat4 rcclBf16x4ToFloat4(uint64_t v) {
+    rcclFloat2 lo = rcclBf16x2ToFloat2(uint32_t(v));
+    rcclFloat2 hi = rcclBf16x2ToFloat2(uint32_t(v >> 32));
+    rcclFloat4 f = {lo.x, lo.y, hi.x, hi.y};
+    return f;
+  }
+  // Same rounding as rccl_bfloat16::float_to_bfloat16, returned in the low 16 bits.
+  __device__ __forceinline__ uint32_t rcclFloatToBf16Bits(float f) {
+    uint32_t u = __float_as_uint(f);
+    if (~u & 0x7f800000) u += 0x7fff + ((u >> 16) & 1);
+    else if (u & 0xffff) u |= 0x10000;
+    return u >> 16;
+  }
+  __device__ __forceinline__ uint32_t rcclFloat2ToBf16x2(rcclFloat2 f) {
+    return rcclFloatToBf16Bits(f.x) | (rcclFloatToBf16Bits(f.y) << 16);
+  }
+  __device__ __forceinline__ uint64_t rcclFloat4ToBf16x4(rcclFloat4 f) {
+    return uint64_t(rcclFloat2ToBf16x2(f.xy)) | (uint64_t(rcclFloat2ToBf16x2(f.zw)) << 32);
+  }
+
+  #define SPECIALIZE_REDUCE_BF16(Fn, expr_of_x_y) \
+    template<> \
+    struct Apply_Reduce<Fn<rccl_bfloat16>, 2> { \
+      __device__ __forceinline__ static BytePack<4> reduce( \
+          Fn<rccl_bfloat16> fn, BytePack<4> a, BytePack<4> b \
+        ) { \
+        rcclFloat2 x = rcclBf16x2ToFloat2(a.u32); \
+        rcclFloat2 y = rcclBf16x2ToFloat2(b.u32); \
+        a.u32 = rcclFloat2ToBf16x2(expr_of_x_y); \
+        return a; \
+      } \
+    }; \
+    template<> \
+    struct Apply_Reduce<Fn<rccl_bfloat16>, 4> { \
+      __device__ __forceinline__ static BytePack<8> reduce( \
+          Fn<rccl_bfloat16> fn, BytePack<8> a, BytePack<8> b \
+        ) { \
+        rcclFloat4 x = rcclBf16x4ToFloat4(a.u64); \
+        rcclFloat4 y = rcclBf16x4ToFloat4(b.u64); \
+        a.u64 = rcclFloat4ToBf16x4(expr_of_x_y); \
+        return a; \
+      } \
+    };
+
+  SPECIALIZE_REDUCE_BF16(FuncSum, x + y)
+  SPECIALIZE_REDUCE_BF16(FuncProd, x * y)
+  SPECIALIZE_REDUCE_BF16(FuncMin, rcclPackedMin(x, y))
+  SPECIALIZE_REDUCE_BF16(FuncMax, rcclPackedMax(x, y))
+
+  #undef SPECIALIZE_REDUCE_BF16
+#endif
+#endif
+
 #undef SPECIALIZE_REDUCE
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -406,6 +525,31 @@ struct FuncPreMulSum<half> {
   };
 #endif
 
+// FP8 scalars are carried as float bits in opArg (see ncclRedOpCreatePreMulSum)
+// so that scaling, e.g. by 1/nRanks for ncclAvg, does not lose precision.
+#define DEFINE_FuncPreMulSum_FP8(T) \
+  template<> \
+  struct FuncPreMulSum<T> { \
+    using EltType = T; \
+    float scalar; \
+    __device__ FuncPreMulSum(uint64_t opArg=0) { \
+      union { uint32_t u32; float val; }; \
+      u32 = uint32_t(opArg); \
+      scalar = val; \
+    } \
+  }; \
+  template<> \
+  struct Apply_PreOp<FuncPreMulSum<T>, /*EltPerPack=*/1> { \
+    static constexpr bool IsIdentity = false; \
+    __device__ static BytePack<sizeof(T)> preOp(FuncPreMulSum<T> fn, BytePack<sizeof(T)> a) { \
+      return toPack<T>(T((float)(fromPack<T>(a)) * fn.scalar)); \
+    } \
+  };
+
+DEFINE_FuncPreMulSum_FP8(rccl_float8_e4m3)
+DEFINE_FuncPreMulSum_FP8(rccl_float8_e5m2)
+#undef DEFINE_FuncPreMulSum_FP8
+
 template<typename T>
 struct Apply_Reduce<FuncPreMulSum<T>, /*EltPerPack=*/1> {
   __device__ static BytePack<sizeof(T)> reduce(FuncPreMulSum<T> fn, BytePack<sizeof(T)> a, BytePack<sizeof(T)> b) {
@@ -477,6 +621,70 @@ struct Apply_PreOp<FuncPreMulSum<half>, /*EltPerPack=*/1> {
   #endif
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// Packed FuncPreMulSum for half and bfloat16 on CDNA. The sum dispatches to the
+// packed FuncSum above and the scalar is applied to a whole pack at once.
+
+#if RCCL_PACKED_HALF
+  template<>
+  struct Apply_Reduce<FuncPreMulSum<half>, /*EltPerPack=*/2> {
+    __device__ static BytePack<4> reduce(FuncPreMulSum<half> fn, BytePack<4> a, BytePack<4> b) {
+      return Apply_Reduce<FuncSum<half>, 2>::reduce(FuncSum<half>(), a, b);
+    }
+  };
+  template<>
+  struct Apply_Reduce<FuncPreMulSum<half>, /*EltPerPack=*/4> {
+    __device__ static BytePack<8> reduce(FuncPreMulSum<half> fn, BytePack<8> a, BytePack<8> b) {
+      return Apply_Reduce<FuncSum<half>, 4>::reduce(FuncSum<half>(), a, b);
+    }
+  };
+  template<>
+  struct Apply_PreOp<FuncPreMulSum<half>, /*EltPerPack=*/2> {
+    static constexpr bool IsIdentity = false;
+    __device__ static BytePack<4> preOp(FuncPreMulSum<half> fn, BytePack<4> a) {
+      return toPack<rcclHalf2>(fromPack<rcclHalf2>(a) * (_Float16)fn.scalar);
+    }
+  };
+  template<>
+  struct Apply_PreOp<FuncPreMulSum<half>, /*EltPerPack=*/4> {
+    static constexpr bool IsIdentity = false;
+    __device__ static BytePack<8> preOp(FuncPreMulSum<half> fn, BytePack<8> a) {
+      return toPack<rcclHalf4>(fromPack<rcclHalf4>(a) * (_Float16)fn.scalar);
+    }
+  };
+
+#if defined(RCCL_BFLOAT16)
+  template<>
+  struct Apply_Reduce<FuncPreMulSum<rccl_bfloat16>, /*EltPerPack=*/2> {
+    __device__ static BytePack<4> reduce(FuncPreMulSum<rccl_bfloat16> fn, BytePack<4> a, BytePack<4> b) {
+      return Apply_Reduce<FuncSum<rccl_bfloat16>, 2>::reduce(FuncSum<rccl_bfloat16>(), a, b);
+    }
+  };
+  template<>
+  struct Apply_Reduce<FuncPreMulSum<rccl_bfloat16>, /*EltPerPack=*/4> {
+    __device__ static BytePack<8> reduce(FuncPreMulSum<rccl_bfloat16> fn, BytePack<8> a, BytePack<8> b) {
+      return Apply_Reduce<FuncSum<rccl_bfloat16>, 4>::reduce(FuncSum<rccl_bfloat16>(), a, b);
+    }
+  };
+  template<>
+  struct Apply_PreOp<FuncPreMulSum<rccl_bfloat16>, /*EltPerPack=*/2> {
+    static constexpr bool IsIdentity = false;
+    __device__ static BytePack<4> preOp(FuncPreMulSum<rccl_bfloat16> fn, BytePack<4> a) {
+      a.u32 = rcclFloat2ToBf16x2(rcclBf16x2ToFloat2(a.u32) * fn.scalar);
+      return a;
+    }
+  };
+  template<>
+  struct Apply_PreOp<FuncPreMulSum<rccl_bfloat16>, /*EltPerPack=*/4> {
+    static constexpr bool IsIdentity = false;
+    __device__ static BytePack<8> preOp(FuncPreMulSum<rccl_bfloat16> fn, BytePack<8> a) {
+      a.u64 = rcclFloat4ToBf16x4(rcclBf16x4ToFloat4(a.u64) * fn.scalar);
+      return a;
+    }
+  };
+#endif
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // FuncSumPostDiv
 
@@ -489,6 +697,10 @@ template<>
 struct IsFloatingPoint<rccl_bfloat16>: std::true_type {};
 #endif
 template<>
+struct IsFloatingPoint<rccl_float8_e4m3>: std::true_type {};
+template<>
+struct IsFloatingPoint<rccl_float8_e5m2>: std::true_type {};
+template<>
 struct IsFloatingPoint<float>: std::true_type {};
 template<>
 struct IsFloatingPoint<double>: std::true_type {};
@@ -532,6 +744,106 @@ struct Apply_PostOp<FuncSumPostDiv<T>, /*EltPerPack=*/1> {
   }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// FuncSumEpilogue: a sum followed by an elementwise epilogue, see
+// ncclRedOpCreateSumEpilogue(). opArg holds two floats, the scale in the low
+// word and the clipping bound in the high word. The epilogue is the postOp, so
+// it is applied by the last reduction step while it writes the output, and the
+// copies which follow forward the final values to the other ranks.
+
+template<typename T>
+struct FuncSumEpilogue {
+  using EltType = T;
+  float scale;
+  float clip;
+  __device__ FuncSumEpilogue(uint64_t opArg=0) {
+    union { uint64_t u64; float f32[2]; };
+    u64 = opArg;
+    scale = f32[0];
+    clip = f32[1];
+  }
+};
+
+// Reduce exactly like FuncSum, including its packed specializations.
+template<typename T, int EltPerPack>
+struct Apply_Reduce<FuncSumEpilogue<T>, EltPerPack> {
+  template<int Size>
+  __device__ static BytePack<Size> reduce(FuncSumEpilogue<T> fn, BytePack<Size> a, BytePack<Size> b) {
+    return Apply_Reduce<FuncSum<T>, EltPerPack>::reduce(FuncSum<T>(), a, b);
+  }
+};
+template<typename T>
+struct Apply_Reduce<FuncSumEpilogue<T>, /*EltPerPack=*/0> {
+  __device__ static BytePack<0> reduce(FuncSumEpilogue<T> fn, BytePack<0> a, BytePack<0> b) {
+    return {};
+  }
+};
+
+// Epilogues compute in float, or in double for double.
+template<typename T>
+struct EpilogueAcc {
+  using Type = float;
+  __device__ static float load(T x) { return (float)x; }
+  __device__ static T store(float x) { return T(x); }
+};
+template<>
+struct EpilogueAcc<half> {
+  using Type = float;
+  __device__ static float load(half x) { return __half2float(x); }
+  __device__ static half store(float x) { return __float2half(x); }
+};
+template<>
+struct EpilogueAcc<double> {
+  using Type = double;
+  __device__ static double load(double x) { return x; }
+  __device__ static double store(double x) { return x; }
+};
+
+template<typename T>
+struct Apply_PostOp<FuncSumEpilogue<T>, /*EltPerPack=*/1> {
+  static constexpr bool IsIdentity = false;
+  __device__ static BytePack<sizeof(T)> postOp(FuncSumEpilogue<T> fn, BytePack<sizeof(T)> a) {
+    using Acc = typename EpilogueAcc<T>::Type;
+    Acc x = EpilogueAcc<T>::load(fromPack<T>(a)) * fn.scale;
+    // Plain comparisons let NaNs through, fminf/fmaxf would clip them to a bound.
+    x = x < -fn.clip ? Acc(-fn.clip) : x > fn.clip ? Acc(fn.clip) : x;
+    return toPack<T>(EpilogueAcc<T>::store(x));
+  }
+};
+
+// AllReduce work elements carrying an epilogue run FuncSumEpilogue<T> in place
+// of FuncSum<T>. Epilogues only exist for floating point types.
+template<typename T, typename RedOp>
+struct EpilogueRedOp { using Type = RedOp; };
+template<typename T>
+struct EpilogueRedOp<T, FuncSum<T>> {
+  using Type = typename std::conditional<IsFloatingPoint<T>::value, FuncSumEpilogue<T>, FuncSum<T>>::type;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Optimizer step of ncclReduceScatterUpdateAllGather() on one element of the
+// shard of this rank: *grad is the reduced gradient, *param the parameter and
+// stateIx the index of the element in the expAvg/expAvgSq state of the shard.
+
+template<typename T>
+__device__ __forceinline__ void applyUpdate(struct ncclDevUpdate const& u, T* param, T const* grad, intptr_t stateIx) {
+  using Acc = typename EpilogueAcc<T>::Type;
+  Acc g = EpilogueAcc<T>::load(*grad) * Acc(u.gradScale);
+  Acc p = EpilogueAcc<T>::load(*param);
+  if (u.type == ncclUpdateAdam) {
+    T* m = (T*)u.expAvg + stateIx;
+    T* v = (T*)u.expAvgSq + stateIx;
+    Acc mi = Acc(u.beta1)*EpilogueAcc<T>::load(*m) + Acc(1.0f-u.beta1)*g;
+    Acc vi = Acc(u.beta2)*EpilogueAcc<T>::load(*v) + Acc(1.0f-u.beta2)*g*g;
+    *m = EpilogueAcc<T>::store(mi);
+    *v = EpilogueAcc<T>::store(vi);
+    g = (mi/Acc(u.biasCorrection1)) / (sqrt(vi/Acc(u.biasCorrection2)) + Acc(u.eps));
+  }
+  // Decoupled weight decay, as in SGD with L2 and AdamW.
+  p -= Acc(u.lr)*(g + Acc(u.weightDecay)*p);
+  *param = EpilogueAcc<T>::store(p);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Apply_LoadMultimem
 
@@ -9,3 +9,5 @@
 #include "collectives.h"
 
 IMPL_COLL_P(SendRecv);
+IMPL_RESIDENT_KERN(SendRecv);
+IMPL_FUSED_KERN(SendRecv);
@@ -0,0 +1,63 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "devcomm.h"
+#include "collectives.h"
+#include <hip/hip_fp16.h>
+
+template<typename T> __device__ inline T sparseSum(T a, T b) { return a + b; }
+template<> __device__ inline half sparseSum<half>(half a, half b) { return __float2half(__half2float(a) + __half2float(b)); }
+template<> __device__ inline rccl_bfloat16 sparseSum<rccl_bfloat16>(rccl_bfloat16 a, rccl_bfloat16 b) {
+  return rccl_bfloat16(float(a) + float(b));
+}
+
+// Indices of one rank are distinct, so no two threads touch the same element
+template<typename T>
+__device__ inline void sparseScatter(T* dst, const int64_t* indices, const T* values, size_t nnz, size_t count) {
+  size_t tid = blockIdx.x*blockDim.x + threadIdx.x;
+  size_t nthreads = gridDim.x*blockDim.x;
+  for (size_t i = tid; i < nnz; i += nthreads) {
+    int64_t index = indices[i];
+    if (index < 0 || (uint64_t)index >= count) continue;
+    dst[index] = sparseSum(dst[index], values[i]);
+  }
+}
+
+__global__ void ncclSparseScatterKernel(void* dst, const int64_t* indices, const void* values, size_t nnz,
+    size_t count, int type) {
+  switch (type) {
+    case ncclInt8:
+      sparseScatter<int8_t>((int8_t*)dst, indices, (const int8_t*)values, nnz, count);
+      break;
+    case ncclUint8:
+      sparseScatter<uint8_t>((uint8_t*)dst, indices, (const uint8_t*)values, nnz, count);
+      break;
+    case ncclInt32:
+      sparseScatter<int32_t>((int32_t*)dst, indices, (const int32_t*)values, nnz, count);
+      break;
+    case ncclUint32:
+      sparseScatter<uint32_t>((uint32_t*)dst, indices, (const uint32_t*)values, nnz, count);
+      break;
+    case ncclInt64:
+      sparseScatter<int64_t>((int64_t*)dst, indices, (const int64_t*)values, nnz, count);
+      break;
+    case ncclUint64:
+      sparseScatter<uint64_t>((uint64_t*)dst, indices, (const uint64_t*)values, nnz, count);
+      break;
+    case ncclFloat16:
+      sparseScatter<half>((half*)dst, indices, (const half*)values, nnz, count);
+      break;
+    case ncclFloat32:
+      sparseScatter<float>((float*)dst, indices, (const float*)values, nnz, count);
+      break;
+    case ncclFloat64:
+      sparseScatter<double>((double*)dst, indices, (const double*)values, nnz, count);
+      break;
+    case ncclBfloat16:
+      sparseScatter<rccl_bfloat16>((rccl_bfloat16*)dst, indices, (const rccl_bfloat16*)values, nnz, count);
+      break;
+  }
+}
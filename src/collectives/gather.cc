@@ -8,9 +8,61 @@
 
 #include "enqueue.h"
 #include "collectives.h"
+#include "rccl_vars.h"
 
 #include "msccl/msccl_lifecycle.h"
 
+RCCL_PARAM(HierGatherScatter, "HIER_GATHER_SCATTER", 0);
+
+// Hierarchical gather (RCCL_HIER_GATHER_SCATTER), on the child communicators of the hierarchical
+// allreduce: each node first gathers its blocks over xGMI on the rank with the local rank of the
+// root, then these rail leaders send whole node blocks to the root over the rail of the root. The
+// root and its NIC then serve one peer per node instead of every rank. 1 uses it from 2 nodes on,
+// larger values are the minimum number of nodes.
+static ncclResult_t hierGather(const void* sendbuff, void* recvbuff, size_t sendcount,
+    ncclDataType_t datatype, int root, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  int64_t minNodes = rcclParamHierGatherScatter();
+  if (minNodes <= 0 || !ncclHierEligible(comm)) return ncclSuccess;
+  if (comm->nNodes < std::max<int64_t>(minNodes, 2) || comm->localRanks == 1 || sendcount == 0) return ncclSuccess;
+  if (datatype < 0 || datatype >= ncclNumTypes || root < 0 || root >= comm->nRanks) return ncclSuccess;
+  // Node blocks land in place in recvbuff, ranks must be numbered node by node
+  if (!ncclHierRanksContiguous(comm)) return ncclSuccess;
+
+  if (comm->hierState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+  }
+
+  int rootNode = comm->rankToNode[root], rootLocal = comm->rankToLocalRank[root];
+  size_t nodeCount = comm->localRanks*sendcount;
+  size_t nodeBytes = nodeCount*ncclTypeSize(datatype);
+  // Every rank reserves the node block, so that all of them fall back together under capture
+  bool staged;
+  NCCLCHECK(ncclHierStagingReserve(comm, &comm->hierRootStaging, &comm->hierRootStagingBytes, nodeBytes, stream, &staged));
+  if (!staged) return ncclSuccess;
+  // The node of the root gathers straight into recvbuff
+  char* nodeBuff = comm->node == rootNode ? (char*)recvbuff+rootNode*nodeBytes : comm->hierRootStaging;
+
+  NCCLCHECK(ncclGather(sendbuff, nodeBuff, sendcount, datatype, rootLocal, comm->hierIntraComm, stream));
+  if (comm->localRank == rootLocal) {
+    NCCLCHECK(ncclGroupStart());
+    if (comm->node == rootNode) {
+      for (int n=0; n<comm->nNodes; n++) {
+        if (n != rootNode) NCCLCHECK(ncclRecv((char*)recvbuff+n*nodeBytes, nodeCount, datatype, n, comm->hierRailComm, stream));
+      }
+    } else {
+      NCCLCHECK(ncclSend(nodeBuff, nodeCount, datatype, rootNode, comm->hierRailComm, stream));
+    }
+    NCCLCHECK(ncclGroupEnd());
+  }
+  *done = true;
+  return ncclSuccess;
+}
+
 NCCL_API(ncclResult_t, ncclGather, const void* sendbuff, void* recvbuff, size_t sendcount,
     ncclDataType_t datatype, int root, ncclComm_t comm, hipStream_t stream);
 ncclResult_t ncclGather(const void* sendbuff, void* recvbuff, size_t sendcount,
@@ -21,6 +73,10 @@ ncclResult_t ncclGather(const void* sendbuff, void* recvbuff, size_t sendcount,
         sendcount, datatype, root, 0, ncclSum, mscclFuncGather, comm, stream);
     }
 
+    bool hierDone;
+    NCCLCHECK(hierGather(sendbuff, recvbuff, sendcount, datatype, root, comm, stream, &hierDone));
+    if (hierDone) return ncclSuccess;
+
     int nRanks;
     NCCLCHECK(ncclCommCount(comm, &nRanks));
     size_t rankOffset = sendcount * ncclTypeSize(datatype);
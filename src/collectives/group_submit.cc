@@ -0,0 +1,130 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "enqueue.h"
+#include "collectives.h"
+#include "argcheck.h"
+
+#include "msccl/msccl_lifecycle.h"
+
+#include <vector>
+
+static ncclResult_t opDescToInfo(ncclOpDesc_t const* desc, ncclComm_t comm, struct ncclInfo* info) {
+  static const struct { ncclFunc_t coll; const char* opName; int chunkSteps; int sliceSteps; } ops[ncclNumOpTypes] = {
+    { ncclFuncBroadcast, "Broadcast", BROADCAST_CHUNKSTEPS, BROADCAST_SLICESTEPS },
+    { ncclFuncReduce, "Reduce", REDUCE_CHUNKSTEPS, REDUCE_SLICESTEPS },
+    { ncclFuncAllGather, "AllGather", ALLGATHER_CHUNKSTEPS, ALLGATHER_SLICESTEPS },
+    { ncclFuncReduceScatter, "ReduceScatter", REDUCESCATTER_CHUNKSTEPS, REDUCESCATTER_SLICESTEPS },
+    { ncclFuncAllReduce, "AllReduce", ALLREDUCE_CHUNKSTEPS, ALLREDUCE_SLICESTEPS },
+    { ncclFuncSend, "Send", 1, 1 },
+    { ncclFuncRecv, "Recv", 1, 1 }
+  };
+  if ((unsigned)desc->type >= ncclNumOpTypes) {
+    WARN("GroupSubmit : invalid operation type %d", desc->type);
+    return ncclInvalidArgument;
+  }
+  bool p2p = desc->type == ncclOpSend || desc->type == ncclOpRecv;
+  bool reduces = desc->type == ncclOpReduce || desc->type == ncclOpReduceScatter || desc->type == ncclOpAllReduce;
+  bool rooted = p2p || desc->type == ncclOpBroadcast || desc->type == ncclOpReduce;
+  // Send tasks take their buffer from recvbuff, as in ncclSend
+  *info = { ops[desc->type].coll, ops[desc->type].opName,
+    p2p ? nullptr : desc->sendbuff, desc->type == ncclOpSend ? (void*)desc->sendbuff : desc->recvbuff,
+    desc->count, desc->datatype, reduces ? desc->op : ncclSum, rooted ? desc->root : 0, comm, desc->stream, /* Args */
+    ops[desc->type].chunkSteps, ops[desc->type].sliceSteps };
+  return ncclSuccess;
+}
+
+// MSCCL picks a program per call, so descriptors go through the public APIs when it is loaded
+static ncclResult_t opDescCall(ncclOpDesc_t const* desc, ncclComm_t comm) {
+  switch (desc->type) {
+  case ncclOpBroadcast:
+    return ncclBroadcast(desc->sendbuff, desc->recvbuff, desc->count, desc->datatype, desc->root, comm, desc->stream);
+  case ncclOpReduce:
+    return ncclReduce(desc->sendbuff, desc->recvbuff, desc->count, desc->datatype, desc->op, desc->root, comm, desc->stream);
+  case ncclOpAllGather:
+    return ncclAllGather(desc->sendbuff, desc->recvbuff, desc->count, desc->datatype, comm, desc->stream);
+  case ncclOpReduceScatter:
+    return ncclReduceScatter(desc->sendbuff, desc->recvbuff, desc->count, desc->datatype, desc->op, comm, desc->stream);
+  case ncclOpAllReduce:
+    return ncclAllReduce(desc->sendbuff, desc->recvbuff, desc->count, desc->datatype, desc->op, comm, desc->stream);
+  case ncclOpSend:
+    return ncclSend(desc->sendbuff, desc->count, desc->datatype, desc->root, comm, desc->stream);
+  case ncclOpRecv:
+    return ncclRecv(desc->recvbuff, desc->count, desc->datatype, desc->root, comm, desc->stream);
+  default:
+    WARN("GroupSubmit : invalid operation type %d", desc->type);
+    return ncclInvalidArgument;
+  }
+}
+
+NCCL_API(ncclResult_t, ncclGroupSubmit, const ncclOpDesc_t* ops, int nOps, ncclComm_t comm);
+ncclResult_t ncclGroupSubmit(const ncclOpDesc_t* ops, int nOps, ncclComm_t comm) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "GroupSubmit", "comm"));
+  if (nOps < 0 || (nOps > 0 && ops == NULL)) {
+    WARN("GroupSubmit : invalid ops %p nOps %d", ops, nOps);
+    return ncclInvalidArgument;
+  }
+  if (nOps == 0) return ncclSuccess;
+
+  if (mscclAvailable() && !mscclIsCaller()) {
+    ncclResult_t ret = ncclSuccess;
+    NCCLCHECK(ncclGroupStart());
+    for (int i = 0; i < nOps && ret == ncclSuccess; i++) ret = opDescCall(&ops[i], comm);
+    ncclResult_t endRet = ncclGroupEnd();
+    return ret != ncclSuccess ? ret : endRet;
+  }
+
+  std::vector<struct ncclInfo> infos(nOps);
+  for (int i = 0; i < nOps; i++) NCCLCHECK(opDescToInfo(&ops[i], comm, &infos[i]));
+  return ncclEnqueueCheckBatch(comm, infos.data(), nOps);
+}
+
+NCCL_API(ncclResult_t, ncclCommWarmup, const ncclOpDesc_t* hints, int nHints, ncclComm_t comm, hipStream_t stream);
+ncclResult_t ncclCommWarmup(const ncclOpDesc_t* hints, int nHints, ncclComm_t comm, hipStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "CommWarmup", "comm"));
+  if (nHints < 0 || (nHints > 0 && hints == NULL)) {
+    WARN("CommWarmup : invalid hints %p nHints %d", hints, nHints);
+    return ncclInvalidArgument;
+  }
+  if (nHints == 0) return ncclSuccess;
+
+  // One scratch region for the inputs and one for the outputs, sized for the largest hint. Concurrent
+  // receives may land in the same bytes, the results are thrown away.
+  size_t sendBytes = 0, recvBytes = 0;
+  for (int i = 0; i < nHints; i++) {
+    if ((unsigned)hints[i].type >= ncclNumOpTypes || hints[i].datatype < 0 || hints[i].datatype >= ncclNumTypes) {
+      WARN("CommWarmup : invalid hint %d, type %d datatype %d", i, hints[i].type, hints[i].datatype);
+      return ncclInvalidArgument;
+    }
+    size_t bytes = hints[i].count*ncclTypeSize(hints[i].datatype);
+    sendBytes = std::max(sendBytes, hints[i].type == ncclOpReduceScatter ? bytes*comm->nRanks : bytes);
+    recvBytes = std::max(recvBytes, hints[i].type == ncclOpAllGather ? bytes*comm->nRanks : bytes);
+  }
+  bool ok;
+  NCCLCHECK(ncclHierStagingReserve(comm, &comm->warmupScratch, &comm->warmupScratchBytes, sendBytes + recvBytes, stream, &ok));
+  if (!ok) {
+    WARN("CommWarmup : can not be captured");
+    return ncclInvalidUsage;
+  }
+
+  // Collectives each get their own launch, as they would alone, and the point-to-point hints all go
+  // together so that sends and receives between the same peers can not deadlock. Within a group,
+  // all of them are launched by the outermost ncclGroupEnd.
+  std::vector<ncclOpDesc_t> descs(hints, hints + nHints);
+  std::vector<ncclOpDesc_t> p2ps;
+  for (auto& desc : descs) {
+    desc.sendbuff = comm->warmupScratch;
+    desc.recvbuff = comm->warmupScratch + sendBytes;
+    desc.stream = stream;
+    if (desc.type == ncclOpSend || desc.type == ncclOpRecv) p2ps.push_back(desc);
+    else NCCLCHECK(ncclGroupSubmit(&desc, 1, comm));
+  }
+  if (!p2ps.empty()) NCCLCHECK(ncclGroupSubmit(p2ps.data(), (int)p2ps.size(), comm));
+  INFO(NCCL_INIT, "comm %p rank %d warmup: %d hints, %zu bytes of scratch", comm, comm->rank, nHints, sendBytes + recvBytes);
+  return ncclSuccess;
+}
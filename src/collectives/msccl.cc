@@ -23,12 +23,11 @@ ncclResult_t mscclLoadAlgo(const char *mscclAlgoFilePath, mscclAlgoHandle_t *msc
 
   struct mscclAlgo* hostAlgo;
   NCCLCHECK(ncclCalloc(&hostAlgo, 1));
-  NCCLCHECK(mscclGetAlgoFromXmlFile(mscclAlgoFilePath, hostAlgo, rank));
+  NCCLCHECK(mscclGetAlgoFromCachedXmlFile(mscclAlgoFilePath, hostAlgo, rank));
   status.hostAlgos[*mscclAlgoHandle] = hostAlgo;
 
-  struct mscclAlgo* devAlgo;
-  NCCLCHECK(ncclCudaMalloc(&devAlgo, 1));
-  CUDACHECK(hipMemcpy(devAlgo, hostAlgo, sizeof(struct mscclAlgo), hipMemcpyHostToDevice));
+  struct mscclDevAlgo* devAlgo;
+  NCCLCHECK(mscclSetupDevAlgos(&hostAlgo, 1, &devAlgo));
   status.devAlgos[*mscclAlgoHandle] = devAlgo;
 
   return ncclSuccess;
@@ -46,7 +45,7 @@ ncclResult_t mscclRunAlgo(
     mscclAlgoHandle_t mscclAlgoHandle, ncclComm_t comm, hipStream_t stream) {
   mscclStatus& status = mscclGetStatus();
   struct mscclAlgo* hostAlgo = status.hostAlgos[mscclAlgoHandle];
-  struct mscclAlgo* devAlgo = status.devAlgos[mscclAlgoHandle];
+  struct mscclDevAlgo* devAlgo = status.devAlgos[mscclAlgoHandle];
 
   NCCLCHECK(mscclGetCaptureStatus(stream));
 
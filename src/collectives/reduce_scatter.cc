@@ -6,8 +6,10 @@
  ************************************************************************/
 
 #include "enqueue.h"
+#include "argcheck.h"
 #include "collectives.h"
 #include "nccl.h"
+#include <math.h>
 
 #include "msccl/msccl_lifecycle.h"
 
@@ -38,3 +40,94 @@ ncclResult_t ncclReduceScatter(const void* sendbuff, void* recvbuff, size_t recv
     REDUCESCATTER_CHUNKSTEPS, REDUCESCATTER_SLICESTEPS };
   return ncclEnqueueCheck(&info);
 }
+
+NCCL_API(ncclResult_t, ncclReduceScatterUpdateAllGather, void* sendbuff, void* recvbuff, size_t recvcount,
+    ncclDataType_t datatype, const ncclUpdate_t* update, ncclComm* comm, cudaStream_t stream);
+ncclResult_t ncclReduceScatterUpdateAllGather(void* sendbuff, void* recvbuff, size_t recvcount,
+    ncclDataType_t datatype, const ncclUpdate_t* update, ncclComm* comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "ReduceScatterUpdateAllGather", "comm"));
+  NCCLCHECK(PtrCheck((void*)update, "ReduceScatterUpdateAllGather", "update"));
+  switch (datatype) {
+  case ncclFloat16: case ncclFloat32: case ncclFloat64: case ncclBfloat16:
+  case ncclFloat8e4m3: case ncclFloat8e5m2:
+    break;
+  default:
+    WARN("ReduceScatterUpdateAllGather : datatype %d is not a floating point type", datatype);
+    return ncclInvalidArgument;
+  }
+  if (update->type == ncclUpdateAdam) {
+    if (update->expAvg == nullptr || update->expAvgSq == nullptr || update->step < 1) {
+      WARN("ReduceScatterUpdateAllGather : Adam needs expAvg, expAvgSq and a step of at least 1");
+      return ncclInvalidArgument;
+    }
+  } else if (update->type != ncclUpdateSgd) {
+    WARN("ReduceScatterUpdateAllGather : invalid update type %d", update->type);
+    return ncclInvalidArgument;
+  }
+  // The shard count is only known per rank once the communicator is initialized.
+  NCCLCHECK(ncclCommEnsureReady(comm));
+  size_t bytes = comm->nRanks*recvcount*ncclTypeSize(datatype);
+  if ((char*)sendbuff < (char*)recvbuff + bytes && (char*)recvbuff < (char*)sendbuff + bytes) {
+    WARN("ReduceScatterUpdateAllGather : sendbuff and recvbuff must not overlap");
+    return ncclInvalidArgument;
+  }
+
+  struct ncclDevUpdate devUpdate = {};
+  devUpdate.type = update->type;
+  devUpdate.lr = update->lr;
+  devUpdate.gradScale = update->gradScale;
+  devUpdate.weightDecay = update->weightDecay;
+  if (update->type == ncclUpdateAdam) {
+    devUpdate.beta1 = update->beta1;
+    devUpdate.beta2 = update->beta2;
+    devUpdate.eps = update->eps;
+    devUpdate.biasCorrection1 = 1.0f - powf(update->beta1, update->step);
+    devUpdate.biasCorrection2 = 1.0f - powf(update->beta2, update->step);
+    devUpdate.expAvg = update->expAvg;
+    devUpdate.expAvgSq = update->expAvgSq;
+  }
+
+  // An AllReduce of nranks*recvcount elements for the algorithm selection and
+  // the proxy, the kernel splits it back into shards.
+  struct ncclInfo info = { ncclFuncAllReduce, "ReduceScatterUpdateAllGather",
+    sendbuff, recvbuff, comm->nRanks*recvcount, datatype, ncclSum, 0, comm, stream, /* Args */
+    ALLREDUCE_CHUNKSTEPS, ALLREDUCE_SLICESTEPS };
+  info.update = &devUpdate;
+  return ncclEnqueueCheck(&info);
+}
+
+// Uneven shards are reduced along the ring with one ncclReduce per shard, rooted at its owner, all in
+// one group so that they share a launch and split the channels. Per link this moves the same volume
+// as a ring reduce-scatter of the padded size minus the padding.
+NCCL_API(ncclResult_t, ncclReduceScatterV, const void* sendbuff, const size_t sendcounts[], const size_t sdispls[],
+    void* recvbuff, size_t recvcount, ncclDataType_t datatype, ncclRedOp_t op, ncclComm* comm, cudaStream_t stream);
+ncclResult_t ncclReduceScatterV(const void* sendbuff, const size_t sendcounts[], const size_t sdispls[],
+    void* recvbuff, size_t recvcount, ncclDataType_t datatype, ncclRedOp_t op, ncclComm* comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "ReduceScatterV", "comm"));
+  NCCLCHECK(PtrCheck((void*)sendcounts, "ReduceScatterV", "sendcounts"));
+  NCCLCHECK(PtrCheck((void*)sdispls, "ReduceScatterV", "sdispls"));
+  if (datatype < 0 || datatype >= ncclNumTypes) {
+    WARN("ReduceScatterV : invalid type %d", datatype);
+    return ncclInvalidArgument;
+  }
+  int nRanks = comm->nRanks;
+  if (sendcounts[comm->rank] != recvcount) {
+    WARN("ReduceScatterV : recvcount %zu differs from sendcounts[%d] = %zu", recvcount, comm->rank, sendcounts[comm->rank]);
+    return ncclInvalidArgument;
+  }
+
+  bool even = true;
+  for (int r=0; r<nRanks && even; r++) even = sendcounts[r] == recvcount && sdispls[r] == r*recvcount;
+  if (even) return ncclReduceScatter(sendbuff, recvbuff, recvcount, datatype, op, comm, stream);
+
+  size_t typeSize = ncclTypeSize(datatype);
+  NCCLCHECK(ncclGroupStart());
+  for (int r=0; r<nRanks; r++) {
+    if (sendcounts[r] == 0) continue;
+    NCCLCHECK(ncclReduce((const char*)sendbuff+sdispls[r]*typeSize, recvbuff, sendcounts[r], datatype, op, r, comm, stream));
+  }
+  NCCLCHECK(ncclGroupEnd());
+  return ncclSuccess;
+}
@@ -8,9 +8,57 @@
 
 #include "enqueue.h"
 #include "collectives.h"
+#include "rccl_vars.h"
 
 #include "msccl/msccl_lifecycle.h"
 
+// Hierarchical scatter (RCCL_HIER_GATHER_SCATTER, see gather.cc): the root sends whole node blocks
+// over its rail to the rank of each node with its local rank, which then scatter them inside their
+// node over xGMI.
+static ncclResult_t hierScatter(const void* sendbuff, void* recvbuff, size_t recvcount,
+    ncclDataType_t datatype, int root, ncclComm* comm, cudaStream_t stream, bool* done) {
+  *done = false;
+  int64_t minNodes = rcclParamHierGatherScatter();
+  if (minNodes <= 0 || !ncclHierEligible(comm)) return ncclSuccess;
+  if (comm->nNodes < std::max<int64_t>(minNodes, 2) || comm->localRanks == 1 || recvcount == 0) return ncclSuccess;
+  if (datatype < 0 || datatype >= ncclNumTypes || root < 0 || root >= comm->nRanks) return ncclSuccess;
+  // Node blocks are read in place from sendbuff, ranks must be numbered node by node
+  if (!ncclHierRanksContiguous(comm)) return ncclSuccess;
+
+  if (comm->hierState == 0) {
+    cudaStreamCaptureStatus status;
+    CUDACHECK(cudaStreamIsCapturing(stream, &status));
+    if (status != cudaStreamCaptureStatusNone) return ncclSuccess;
+    NCCLCHECK(ncclHierCommsInit(comm));
+    if (comm->hierState < 0) return ncclSuccess;
+  }
+
+  int rootNode = comm->rankToNode[root], rootLocal = comm->rankToLocalRank[root];
+  size_t nodeCount = comm->localRanks*recvcount;
+  size_t nodeBytes = nodeCount*ncclTypeSize(datatype);
+  // Every rank reserves the node block, so that all of them fall back together under capture
+  bool staged;
+  NCCLCHECK(ncclHierStagingReserve(comm, &comm->hierRootStaging, &comm->hierRootStagingBytes, nodeBytes, stream, &staged));
+  if (!staged) return ncclSuccess;
+  // The node of the root scatters straight from sendbuff
+  char* nodeBuff = comm->node == rootNode ? (char*)sendbuff+rootNode*nodeBytes : comm->hierRootStaging;
+
+  if (comm->localRank == rootLocal) {
+    NCCLCHECK(ncclGroupStart());
+    if (comm->node == rootNode) {
+      for (int n=0; n<comm->nNodes; n++) {
+        if (n != rootNode) NCCLCHECK(ncclSend((const char*)sendbuff+n*nodeBytes, nodeCount, datatype, n, comm->hierRailComm, stream));
+      }
+    } else {
+      NCCLCHECK(ncclRecv(nodeBuff, nodeCount, datatype, rootNode, comm->hierRailComm, stream));
+    }
+    NCCLCHECK(ncclGroupEnd());
+  }
+  NCCLCHECK(ncclScatter(nodeBuff, recvbuff, recvcount, datatype, rootLocal, comm->hierIntraComm, stream));
+  *done = true;
+  return ncclSuccess;
+}
+
 NCCL_API(ncclResult_t, ncclScatter, const void* sendbuff, void* recvbuff, size_t recvcount, ncclDataType_t datatype, int root,
     ncclComm_t comm, hipStream_t stream);
 ncclResult_t ncclScatter(const void* sendbuff, void* recvbuff, size_t recvcount, ncclDataType_t datatype, int root,
@@ -21,6 +69,10 @@ ncclResult_t ncclScatter(const void* sendbuff, void* recvbuff, size_t recvcount,
         recvcount, datatype, root, 0, ncclSum, mscclFuncScatter, comm, stream);
     }
 
+    bool hierDone;
+    NCCLCHECK(hierScatter(sendbuff, recvbuff, recvcount, datatype, root, comm, stream, &hierDone));
+    if (hierDone) return ncclSuccess;
+
     int nRanks;
     NCCLCHECK(ncclCommCount(comm, &nRanks));
     size_t rankOffset = recvcount * ncclTypeSize(datatype);
@@ -0,0 +1,106 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "enqueue.h"
+#include "collectives.h"
+#include "argcheck.h"
+#include "bootstrap.h"
+#include <vector>
+
+// Sparse inputs are gathered as (index, value) pairs while that moves less than a dense ring
+// allreduce of the output would: past RCCL_SPARSE_DENSE_PERCENT percent of the dense volume, the
+// pairs are scattered into the output and reduced with ncclAllReduce instead.
+RCCL_PARAM(SparseDensePercent, "SPARSE_DENSE_PERCENT", 100);
+
+static ncclResult_t sparseScatter(void* dst, const int64_t* indices, const void* values, size_t nnz, size_t count,
+    ncclDataType_t datatype, ncclComm* comm, cudaStream_t stream) {
+  if (nnz == 0) return ncclSuccess;
+  int nBlocks = std::min<size_t>(DIVUP(nnz, 256), 1024);
+  hipLaunchKernelGGL(ncclSparseScatterKernel, dim3(nBlocks), dim3(256), 0, stream,
+      dst, indices, values, nnz, count, (int)datatype);
+  CUDACHECK(cudaGetLastError());
+  return ncclSuccess;
+}
+
+// Every rank gathers the pairs of all the others with ncclAllGatherV and adds them to the zeroed
+// output one rank after the other, so sums are done in rank order and match on all ranks. Ranks
+// exchange their pair counts through the bootstrap first, which sizes the gather and lets them all
+// take the same path.
+NCCL_API(ncclResult_t, ncclSparseAllReduce, const int64_t* sendindices, const void* sendvalues, size_t nnz,
+    void* recvbuff, size_t count, ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream);
+ncclResult_t ncclSparseAllReduce(const int64_t* sendindices, const void* sendvalues, size_t nnz,
+    void* recvbuff, size_t count, ncclDataType_t datatype, ncclComm_t comm, cudaStream_t stream) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  NCCLCHECK(PtrCheck(comm, "SparseAllReduce", "comm"));
+  if (ncclGroupDepth > 0) {
+    WARN("SparseAllReduce : can not be called within a group");
+    return ncclInvalidUsage;
+  }
+  if (!comm->config.blocking) {
+    WARN("SparseAllReduce : non-blocking communicators are not supported");
+    return ncclInvalidUsage;
+  }
+  if (datatype < 0 || datatype >= ncclNumTypes || datatype == ncclFloat8e4m3 || datatype == ncclFloat8e5m2) {
+    WARN("SparseAllReduce : invalid type %d", datatype);
+    return ncclInvalidArgument;
+  }
+  if (nnz > 0 && (sendindices == NULL || sendvalues == NULL)) {
+    WARN("SparseAllReduce : %zu pairs but sendindices %p and sendvalues %p", nnz, sendindices, sendvalues);
+    return ncclInvalidArgument;
+  }
+  if (count > 0 && recvbuff == NULL) {
+    WARN("SparseAllReduce : recvbuff is NULL");
+    return ncclInvalidArgument;
+  }
+
+  int nRanks = comm->nRanks;
+  size_t typeSize = ncclTypeSize(datatype);
+  std::vector<size_t> nnzs(nRanks), displs(nRanks);
+  nnzs[comm->rank] = nnz;
+  NCCLCHECK(bootstrapAllGather(comm->bootstrap, nnzs.data(), sizeof(size_t)));
+  size_t total = 0;
+  for (int r = 0; r < nRanks; r++) {
+    displs[r] = total;
+    total += nnzs[r];
+  }
+
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  CUDACHECK(cudaMemsetAsync(recvbuff, 0, count*typeSize, stream));
+  NCCLCHECK(ncclCaptureRecordBuffers(comm, stream, recvbuff, count*typeSize, sendindices, nnz*sizeof(int64_t)));
+  NCCLCHECK(ncclCaptureRecordBuffers(comm, stream, sendvalues, nnz*typeSize));
+
+  // A ring allreduce moves 2*(nRanks-1)/nRanks of the output per rank, the gather all foreign pairs
+  double sparseBytes = (double)(total - nnz)*(sizeof(int64_t) + typeSize);
+  double denseBytes = 2.0*(nRanks - 1)/nRanks*count*typeSize;
+  bool sparse = sparseBytes*100 <= denseBytes*rcclParamSparseDensePercent();
+  size_t stagingBytes = total*(sizeof(int64_t) + typeSize);
+  if (sparse && total > 0) {
+    NCCLCHECK(ncclHierStagingReserve(comm, &comm->sparseStaging, &comm->sparseStagingBytes, stagingBytes, stream, &sparse));
+    if (!sparse) INFO(NCCL_COLL, "SparseAllReduce: no staging for %zu pairs during capture, reducing densely", total);
+  }
+
+  if (sparse) {
+    int64_t* indices = (int64_t*)comm->sparseStaging;
+    char* values = comm->sparseStaging + total*sizeof(int64_t);
+    if (total > 0) {
+      NCCLCHECK(ncclGroupStart());
+      NCCLCHECK(ncclAllGatherV(sendindices, nnz, indices, nnzs.data(), displs.data(), ncclInt64, comm, stream));
+      NCCLCHECK(ncclAllGatherV(sendvalues, nnz, values, nnzs.data(), displs.data(), datatype, comm, stream));
+      NCCLCHECK(ncclGroupEnd());
+    }
+    for (int r = 0; r < nRanks; r++)
+      NCCLCHECK(sparseScatter(recvbuff, indices + displs[r], values + displs[r]*typeSize, nnzs[r], count, datatype, comm, stream));
+  } else {
+    NCCLCHECK(sparseScatter(recvbuff, sendindices, sendvalues, nnz, count, datatype, comm, stream));
+    NCCLCHECK(ncclAllReduce(recvbuff, recvbuff, count, datatype, ncclSum, comm, stream));
+  }
+  INFO(NCCL_COLL, "SparseAllReduce: %zu of %zu pairs on rank %d, %zu in total, %s", nnz, count, comm->rank, total,
+      sparse ? "gathered" : "reduced densely");
+  CUDACHECK(cudaSetDevice(savedDev));
+  return ncclSuccess;
+}
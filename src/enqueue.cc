@@ -7,6 +7,7 @@
 
 #include "enqueue.h"
 #include "argcheck.h"
+#include "register.h"
 #include "coll_net.h"
 #include "graph/topo.h"
 #include <hip/hip_runtime.h>
@@ -14,11 +15,18 @@
 #include "gdrwrap.h"
 #include "bootstrap.h"
 #include <cstring>
+#include <mutex>
 #include "channel.h"
 #include "rocmwrap.h"
 #include "rccl_vars.h"
+#include "chrome_trace.h"
+#include "watchdog.h"
+#include "call_record.h"
+#include "clock_sync.h"
 #include <cstring> // std::memcpy
+#include <cstddef> // offsetof
 #include <cinttypes> // PRIx64
+#include <cmath> // INFINITY
 
 static void* const ncclKernelGeneric = (void*)NCCL_KERN_NAME(SendRecv, RING, SIMPLE, Sum, int8_t);
 
@@ -41,46 +49,145 @@ static ncclKernelMatch const ncclKerns[1] = {
 };
 #endif
 
-static ncclResult_t computeColl(struct ncclInfo* info /* input */, int* workFuncIndex, struct ncclWorkElem* work, struct ncclProxyOp* proxyOp /* output */);
+// Kernels of RCCL_SPECIALIZED_KERNELS, see collectives.h
+struct ncclSpecializedKernel {
+  ncclFunc_t coll;
+  ncclDevRedOp_t op;
+  ncclDataType_t datatype;
+  int algorithm, protocol;
+  void* kernelFn;
+};
 
+#ifndef BUILD_ALLREDUCE_ONLY
+#define NCCL_SPECIALIZED_KERN_ENTRY(func, algo, proto, devredop, type, ncclType) \
+  {ncclFunc##func, ncclDev##devredop, ncclType, NCCL_ALGO_##algo, NCCL_PROTO_##proto, (void*)NCCL_KERN_NAME(func, algo, proto, devredop, type)},
+static ncclSpecializedKernel const ncclSpecializedKerns[] = {
+  RCCL_SPECIALIZED_KERNELS(NCCL_SPECIALIZED_KERN_ENTRY)
+};
+#undef NCCL_SPECIALIZED_KERN_ENTRY
+static constexpr int ncclSpecializedKernCount = sizeof(ncclSpecializedKerns)/sizeof(ncclSpecializedKerns[0]);
+#else
+static ncclSpecializedKernel const* const ncclSpecializedKerns = nullptr;
+static constexpr int ncclSpecializedKernCount = 0;
+#endif
+
+RCCL_PARAM(SpecializedKernels, "SPECIALIZED_KERNELS", 1);
+// Only set up the generic kernels at init, each specialized kernel when a device first uses it,
+// so that with deferred code object loading unused kernels are never touched.
+RCCL_PARAM(LazyKernelInit, "LAZY_KERNEL_INIT", 0);
 NCCL_PARAM(L1SharedMemoryCarveout, "L1_SHARED_MEMORY_CARVEOUT", 0);
 
+// Specialized kernels set up on each device, one bit per ncclSpecializedKerns entry
+static uint64_t ncclSpecializedKernReady[MAX_ALLOC_TRACK_NGPU];
+static pthread_mutex_t ncclSpecializedKernLock = PTHREAD_MUTEX_INITIALIZER;
+static_assert(ncclSpecializedKernCount <= 64, "ncclSpecializedKernReady has one bit per specialized kernel");
+
+static ncclResult_t ncclInitKernel(void* fn, int cudaArch, size_t* stackSize);
+
+// Specialized kernel running `info` inline, or null for the generic kernel.
+static void* ncclSpecializedKernelFn(struct ncclComm* comm, struct ncclInfo const* info) {
+  if (ncclGetKernelIndex(comm) != 0 || comm->nRanks == 1 || !rcclParamSpecializedKernels()) return nullptr;
+  bool copy = info->coll == ncclFuncAllGather || info->coll == ncclFuncBroadcast;
+  for (int k=0; k < ncclSpecializedKernCount; k++) {
+    ncclSpecializedKernel const* s = &ncclSpecializedKerns[k];
+    if (s->coll == info->coll && s->op == info->opFull.op && (copy || s->datatype == info->datatype) &&
+        s->algorithm == info->algorithm && s->protocol == info->protocol) {
+      if (rcclParamLazyKernelInit() && comm->cudaDev < MAX_ALLOC_TRACK_NGPU &&
+          !(__atomic_load_n(&ncclSpecializedKernReady[comm->cudaDev], __ATOMIC_ACQUIRE) & (1ull<<k))) {
+        pthread_mutex_lock(&ncclSpecializedKernLock);
+        if (!(ncclSpecializedKernReady[comm->cudaDev] & (1ull<<k))) {
+          // Fall back to the generic kernel rather than fail the launch
+          if (ncclInitKernel(s->kernelFn, 10*comm->compCap, nullptr) != ncclSuccess) {
+            pthread_mutex_unlock(&ncclSpecializedKernLock);
+            return nullptr;
+          }
+          __atomic_fetch_or(&ncclSpecializedKernReady[comm->cudaDev], 1ull<<k, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&ncclSpecializedKernLock);
+      }
+      return s->kernelFn;
+    }
+  }
+  return nullptr;
+}
+
+static ncclResult_t computeColl(struct ncclInfo* info /* input */, int* workFuncIndex, struct ncclWorkElem* work, struct ncclProxyOp* proxyOp /* output */);
+
+// Sets the launch attributes of one kernel and returns its stack size
+static ncclResult_t ncclInitKernel(void* fn, int cudaArch, size_t* stackSize) {
+  ncclResult_t result = ncclSuccess;
+  int carveout = ncclParamL1SharedMemoryCarveout();
+
+  if (stackSize) {
+    cudaFuncAttributes attr = {0};
+    *stackSize = 0;
+    CUDACHECKGOTO(cudaFuncGetAttributes(&attr, fn), result, ignore0);
+    *stackSize = attr.localSizeBytes;
+  ignore0:;
+  }
+
+  if (carveout) {
+    CUDACHECKGOTO(cudaFuncSetAttribute(fn,
+      cudaFuncAttributePreferredSharedMemoryCarveout, carveout),
+      result, ignore1);
+  ignore1:;
+  }
+
+  if (ncclShmemDynamicSize(cudaArch) != 0) {
+    CUDACHECKGOTO(cudaFuncSetAttribute(fn,
+      cudaFuncAttributeMaxDynamicSharedMemorySize, ncclShmemDynamicSize(cudaArch)),
+      result, exit);
+  }
+exit:
+  return result;
+}
+
+// Kernels set up on each device by a previous communicator, with their maximum stack size.
+// Querying a kernel makes HIP load its code object, so later communicators on the device
+// (splits, one per rank of a multi-GPU process) reuse the first result. Devices have their own
+// lock, so that the init threads of ncclCommInitAll() set up their devices in parallel.
+static bool ncclKernelsReady[MAX_ALLOC_TRACK_NGPU];
+static size_t ncclKernelsMaxStackSize[MAX_ALLOC_TRACK_NGPU];
+static std::mutex ncclKernelsLock[MAX_ALLOC_TRACK_NGPU];
+
+static ncclResult_t ncclInitKernels(int cudaArch, size_t* maxStackSize);
+
 // Returns maximum kernel stack size of all CUDA kernels
 ncclResult_t ncclInitKernelsForDevice(int cudaArch, size_t* maxStackSize) {
-  constexpr int KernelCount = sizeof(ncclKerns)/sizeof(ncclKerns[0]);
+  int dev;
+  CUDACHECK(cudaGetDevice(&dev));
+  if (dev >= MAX_ALLOC_TRACK_NGPU) return ncclInitKernels(cudaArch, maxStackSize);
+
+  ncclResult_t result = ncclSuccess;
+  std::lock_guard<std::mutex> lock(ncclKernelsLock[dev]);
+  if (!ncclKernelsReady[dev]) {
+    result = ncclInitKernels(cudaArch, &ncclKernelsMaxStackSize[dev]);
+    // Retry with the next communicator if some kernel could not be set up
+    ncclKernelsReady[dev] = result == ncclSuccess;
+  }
+  if (maxStackSize) *maxStackSize = ncclKernelsMaxStackSize[dev];
+  return result;
+}
+
+static ncclResult_t ncclInitKernels(int cudaArch, size_t* maxStackSize) {
+  constexpr int GenericCount = sizeof(ncclKerns)/sizeof(ncclKerns[0]);
+  int kernelCount = GenericCount + (rcclParamLazyKernelInit() ? 0 : ncclSpecializedKernCount);
   ncclResult_t result = ncclSuccess;
 
   if (maxStackSize) *maxStackSize = 0;
-  int carveout = ncclParamL1SharedMemoryCarveout();
 
   // Keep track if we already visited a function pointer.
   void* lru[2] = {nullptr, nullptr};
-  for (int i=0; i < KernelCount; i++) {
-    void* fn = ncclKerns[i].kernelFn;
-    if (fn == lru[0] || fn == lru[1]) goto next_kernel;
+  for (int i=0; i < kernelCount; i++) {
+    void* fn = i < GenericCount ? ncclKerns[i].kernelFn : ncclSpecializedKerns[i-GenericCount].kernelFn;
+    if (fn == lru[0] || fn == lru[1]) continue;
     lru[1] = lru[0];
     lru[0] = fn;
 
-    if (maxStackSize) {
-      cudaFuncAttributes attr = {0};
-      CUDACHECKGOTO(cudaFuncGetAttributes(&attr, fn), result, ignore0);
-      if (attr.localSizeBytes > *maxStackSize) *maxStackSize = attr.localSizeBytes;
-    ignore0:;
-    }
-
-    if (carveout) {
-      CUDACHECKGOTO(cudaFuncSetAttribute(fn,
-        cudaFuncAttributePreferredSharedMemoryCarveout, carveout),
-        result, ignore1);
-    ignore1:;
-    }
-
-    if (ncclShmemDynamicSize(cudaArch) != 0) {
-      CUDACHECKGOTO(cudaFuncSetAttribute(fn,
-        cudaFuncAttributeMaxDynamicSharedMemorySize, ncclShmemDynamicSize(cudaArch)),
-        result, next_kernel);
-    }
-  next_kernel:;
+    size_t stackSize;
+    ncclResult_t res = ncclInitKernel(fn, cudaArch, maxStackSize ? &stackSize : nullptr);
+    if (res != ncclSuccess) result = res;
+    if (maxStackSize && stackSize > *maxStackSize) *maxStackSize = stackSize;
   }
   return result;
 }
@@ -89,6 +196,14 @@ ncclResult_t ncclInitKernelsForDevice(int cudaArch, size_t* maxStackSize) {
 /*       Launch system : synchronization and CUDA kernel launch              */
 /*****************************************************************************/
 
+// Work lists come from a pool and go back to it with their plan in reclaimPlan(), so that
+// recycled plans find their per-channel queues without allocating.
+static inline struct ncclWorkList* allocWorkList(struct ncclComm* comm) {
+  if (comm->memPool_ncclWorkList.head != nullptr) comm->workListPoolHits++;
+  else comm->workListPoolMisses++;
+  return ncclMemoryPoolAlloc<struct ncclWorkList>(&comm->memPool_ncclWorkList, &comm->memPermanent);
+}
+
 static void appendWorkElemColl(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int channelId,
     int funcIndex, struct ncclWorkElem const *elem, int bid
@@ -104,7 +219,7 @@ static void appendWorkElemColl(
     q->work.elems[e].isUsed = 1;
     return;
   }
-  q = ncclMemoryStackAlloc<struct ncclWorkList>(&comm->memScoped);
+  q = allocWorkList(comm);
   q->work.header.type = ncclWorkTypeColl;
   q->work.header.funcIndex = funcIndex;
   q->work.elems[0] = *elem; // C++ struct assignment
@@ -130,7 +245,7 @@ static void appendWorkElemColl(
     q->work.regElems[e].elem.isUsed = 1;
     return;
   }
-  q = ncclMemoryStackAlloc<struct ncclWorkList>(&comm->memScoped);
+  q = allocWorkList(comm);
   q->work.header.type = ncclWorkTypeRegColl;
   q->work.header.funcIndex = funcIndex;
   q->work.regElems[0] = *elem; // C++ struct assignment
@@ -141,6 +256,23 @@ static void appendWorkElemColl(
   ncclIntruQueueEnqueue(&chan->workQueue, q);
 }
 
+static void appendWorkElemColl(
+    struct ncclComm* comm, struct ncclKernelPlan* plan, int channelId,
+    int funcIndex, struct ncclWorkElemUpdate const *elem, int bid
+  ) {
+  // Never shares its ncclWork, the update takes the room of further elements.
+  struct ncclKernelPlan::Channel* chan = &plan->channels[channelId];
+  struct ncclWorkList* q = allocWorkList(comm);
+  q->work.header.type = ncclWorkTypeUpdateColl;
+  q->work.header.funcIndex = funcIndex;
+  q->work.updateElems[0] = *elem; // C++ struct assignment
+  q->work.updateElems[0].elem.bid = bid;
+  q->work.updateElems[0].elem.isUsed = 1;
+  chan->nWorkElem = NCCL_MAX_WORK_ELEMENTS;
+  chan->nWork += 1;
+  ncclIntruQueueEnqueue(&chan->workQueue, q);
+}
+
 static void finishWorkP2p(struct ncclWork* work, int WarpSize) {
   int nElem = 0;
   for (int e=0; e < NCCL_MAX_WORK_ELEMENTS_P2P; e++) {
@@ -189,7 +321,7 @@ static void appendWorkElemP2p(
   NewWork:
     finishWorkP2p(&q->work, comm->WarpSize);
   }
-  q = ncclMemoryStackAlloc<struct ncclWorkList>(&comm->memScoped);
+  q = allocWorkList(comm);
   q->work.header.type = ncclWorkTypeP2p;
   q->work.header.funcIndex = FUNC_INDEX_P2P;
   chan->p2pTailElem[ncclWorkP2pTypeRecv-1] = 0;
@@ -200,10 +332,32 @@ static void appendWorkElemP2p(
   ncclIntruQueueEnqueue(&chan->workQueue, q);
 }
 
+RCCL_PARAM(TraceSampleInterval, "TRACE_SAMPLE_INTERVAL", 1); // Trace 1 in N operations, by opCount
+RCCL_PARAM(TraceSampleChannels, "TRACE_SAMPLE_CHANNELS", -1); // Mask of traced channels (thread blocks)
+RCCL_PARAM(TraceSampleMinBytes, "TRACE_SAMPLE_MIN_BYTES", 0); // Skip operations smaller than this
+
+// Whether colltrace and NpKit record the operation on this channel. opCount
+// advances in lockstep on all ranks so they sample the same operations.
+static bool traceSampled(uint64_t opCount, int channelId, size_t bytes) {
+  int64_t interval = rcclParamTraceSampleInterval();
+  if (interval > 1 && opCount % interval != 0) return false;
+  if (!((uint64_t)rcclParamTraceSampleChannels() & (1ull<<channelId))) return false;
+  return bytes >= (size_t)rcclParamTraceSampleMinBytes();
+}
+
+// ncclStatsClass_t the operation is counted under by ncclCommGetStats()
+static ncclStatsClass_t statsClass(ncclFunc_t coll) {
+  if (coll == ncclFuncAllToAllPivot) return ncclStatsAllToAllPivot;
+  if (coll >= ncclFuncSendRecv) return ncclStatsSendRecv;
+  return (ncclStatsClass_t)coll;
+}
+
 static ncclResult_t addProxyOpIfNeeded(struct ncclComm* comm, struct ncclKernelPlan* plan, struct ncclProxyOp* op) {
   bool needed = true;
   NCCLCHECK(ncclProxySaveOp(comm, op, &needed));
   if (needed) {
+    if (comm->memPool_ncclProxyOp.head != nullptr) comm->proxyOpPoolHits++;
+    else comm->proxyOpPoolMisses++;
     struct ncclProxyOp* q = ncclMemoryPoolAlloc<struct ncclProxyOp>(&comm->memPool_ncclProxyOp, &comm->memPermanent);
     *q = *op; // C++ struct assignment
     ncclIntruQueueEnqueue(&plan->channels[op->channelId].proxyOpQueue, q);
@@ -216,27 +370,28 @@ static ncclResult_t addProxyOpIfNeeded(struct ncclComm* comm, struct ncclKernelP
 static ncclResult_t addCollToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget, int funcIndex,
     struct ncclWorkElem const* workElem, struct ncclProxyOp const* proxyOp,
-    int nCollChannels, int nBid, size_t bytes, bool regBufUsed, void* regBufSend[], void* regBufRecv[]
+    int nCollChannels, int nBid, size_t bytes, bool regBufUsed, void* regBufSend[], void* regBufRecv[],
+    struct ncclDevUpdate const* update, ncclStatsClass_t stats, int firstChannel = 0
   ) {
   struct ncclKernelPlan::Channel *chans = plan->channels;
 
-  // Choose the `nBid` least loaded channels to do the work. This ensures
-  // all bids go to different channels in case they need to synchronize.
+  // Choose the `nBid` least loaded channels among [firstChannel, nCollChannels) to do the work. This
+  // ensures all bids go to different channels in case they need to synchronize.
   int least[/*nBid*/MAXCHANNELS];
-  least[0] = 0;
+  least[0] = firstChannel;
   int maxIndexInLeast = 0;
-  size_t maxBytesInLeast = chans[0].collBytes;
+  size_t maxBytesInLeast = chans[firstChannel].collBytes;
   // Initialize least[] such that the first nBid channels are accounted for.
   for (int b=1; b < nBid; b++) {
-    least[b] = b;
-    if (maxBytesInLeast < chans[b].collBytes) {
+    least[b] = firstChannel+b;
+    if (maxBytesInLeast < chans[firstChannel+b].collBytes) {
       maxIndexInLeast = b;
-      maxBytesInLeast = chans[b].collBytes;
+      maxBytesInLeast = chans[firstChannel+b].collBytes;
     }
   }
   // Sort in the rest of the channels. If a channel has less work than the max
   // member of least[], replace that member and compute the new max.
-  for (int c=nBid; c < nCollChannels; c++) {
+  for (int c=firstChannel+nBid; c < nCollChannels; c++) {
     if (chans[c].collBytes < maxBytesInLeast) {
       least[maxIndexInLeast] = c;
       maxBytesInLeast = chans[least[0]].collBytes;
@@ -251,6 +406,7 @@ static ncclResult_t addCollToPlan(
   }
 
   uint64_t opCount = uint64_t(plan->collOpCount++)<<1 | 0;
+  size_t totalBytes = bytes;
   bytes /= nBid;
   for (int bid=0; bid < nBid; bid++) {
     int c = least[bid];
@@ -258,7 +414,13 @@ static ncclResult_t addCollToPlan(
 
     // Add work elem
     *nWorkBudget += chans[c].nWork;
-    if (!regBufUsed) {
+    if (update != nullptr) {
+      struct ncclWorkElemUpdate workElemUpdate;
+      workElemUpdate.elem = *workElem; // C++ struct assignment
+      workElemUpdate.elem.update = 1;
+      workElemUpdate.update = *update; // C++ struct assignment
+      appendWorkElemColl(comm, plan, c, funcIndex, &workElemUpdate, bid);
+    } else if (!regBufUsed) {
       appendWorkElemColl(comm, plan, c, funcIndex, workElem, bid);
     } else {
       // Buffer registration in play which could only for CollNet at the moment.
@@ -283,6 +445,12 @@ static ncclResult_t addCollToPlan(
       appendWorkElemColl(comm, plan, c, funcIndex, &workElemReg, bid);
     }
     *nWorkBudget -= chans[c].nWork; // subtract delta of chans[c].nWork
+    struct ncclWorkHeader* header = &ncclIntruQueueTail(&chans[c].workQueue)->work.header;
+    header->statsClass = stats;
+    if (traceSampled(workElem->opCount, c, totalBytes)) {
+      header->isTraced = 1;
+      plan->traced = true;
+    }
 
     // Add proxy task. Empty collectives do not make it to the proxy thread
     // since they don't imply synchronization for the user like p2p.
@@ -297,12 +465,35 @@ static ncclResult_t addCollToPlan(
 }
 
 NCCL_PARAM(P2pLLThreshold, "P2P_LL_THRESHOLD", 16384);
+RCCL_PARAM(NetRegUserBufferMin, "NET_REG_USER_BUFFER_MIN", 0); // Min bytes sent/received straight from/to user buffers, 0 to disable
+
+// Large SIMPLE transfers over a GDR capable network connection can skip the
+// copy to the connection buffers: the proxy registers the user buffer and
+// calls isend/irecv on it directly. Each side decides on its own since the
+// messages on the wire are the same either way.
+static bool p2pNetRegUserBuffer(struct ncclConnector* connector, int protocol, void* addr, size_t bytes) {
+  ssize_t minBytes = rcclParamNetRegUserBufferMin();
+  if (minBytes <= 0 || addr == nullptr || bytes < (size_t)minBytes || bytes > INT_MAX || protocol != NCCL_PROTO_SIMPLE) return false;
+  if (connector->transportComm != &netTransport.send && connector->transportComm != &netTransport.recv) return false;
+  // The proxy must see our pointers (no PXN) and the NIC must reach GPU memory.
+  if (!connector->proxyConn.sameProcess || !connector->conn.shared || !(connector->conn.flags & NCCL_DIRECT_NIC)) return false;
+  cudaPointerAttributes attr;
+  if (cudaPointerGetAttributes(&attr, addr) != cudaSuccess) {
+    (void) cudaGetLastError();
+    return false;
+  }
+#if ROCM_VERSION < 50500
+  return attr.memoryType == cudaMemoryTypeDevice;
+#else
+  return attr.type == cudaMemoryTypeDevice;
+#endif
+}
 
 // Put p2p op in plan assuming there is space in nWorkBudget, so you must
 // ensure *nWorkBudget >= 1 upon entry.
 static ncclResult_t addP2pToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget,
-    bool isSendNotRecv, int peer, int chunk, void *addr, size_t bytes, uint32_t connIndex, bool fuseOk
+    bool isSendNotRecv, int peer, int chunk, int nPeerChannels, void *addr, size_t bytes, uint32_t connIndex, bool fuseOk
   ) {
   struct ncclInfo info = {
     isSendNotRecv ? ncclFuncSend : ncclFuncRecv,
@@ -312,18 +503,24 @@ static ncclResult_t addP2pToPlan(
   };
 
   int channelId;
-  NCCLCHECK(ncclChannelCompute(comm, peer, chunk%comm->p2pnChannelsPerPeer, info.coll, &channelId));
+  NCCLCHECK(ncclChannelCompute(comm, peer, chunk%nPeerChannels, info.coll, &channelId));
   info.channelId = channelId;
 
   // 1 is connIndex
-  struct ncclConnInfo* conn = isSendNotRecv ?
-    &comm->channels[channelId].peers[peer]->send[1].conn : &comm->channels[channelId].peers[peer]->recv[1].conn;
+  struct ncclConnector* connector = isSendNotRecv ?
+    &comm->channels[channelId].peers[peer]->send[1] : &comm->channels[channelId].peers[peer]->recv[1];
+  struct ncclConnInfo* conn = &connector->conn;
   // do not use LL on gfx11
   info.protocol = ((conn->buffs[NCCL_PROTO_LL] != nullptr) && bytes <= ncclParamP2pLLThreshold()) ? NCCL_PROTO_LL : NCCL_PROTO_SIMPLE;
 
   struct ncclProxyOp proxyOp = {};
   NCCLCHECK(ncclProxyComputeP2p(&info, &proxyOp));
   proxyOp.connIndex = connIndex;
+  if (p2pNetRegUserBuffer(connector, info.protocol, addr, bytes)) {
+    proxyOp.reg = 1;
+    proxyOp.regBuff = addr;
+    proxyOp.nbytes = bytes;
+  }
 
   struct ncclWorkElemP2p elem = {0};
   elem.proto = info.protocol;
@@ -337,10 +534,17 @@ static ncclResult_t addP2pToPlan(
   elem.chunkSize = info.chunkSize; // computed by ncclProxyComputeP2p
   elem.opCount = (uint16_t)comm->opCount;
   elem.connIndex = connIndex;
+  elem.reg = proxyOp.reg;
 
   *nWorkBudget += plan->channels[channelId].nWork;
   appendWorkElemP2p(comm, plan, channelId, &elem, fuseOk);
   *nWorkBudget -= plan->channels[channelId].nWork;
+  struct ncclWorkHeader* header = &ncclIntruQueueTail(&plan->channels[channelId].workQueue)->work.header;
+  header->statsClass = ncclStatsSendRecv;
+  if (traceSampled(comm->opCount, channelId, bytes)) {
+    header->isTraced = 1;
+    plan->traced = true;
+  }
 
   // Calculate the opCount after appendWorkElemP2p since it will always return
   // with channel->nWork equal to one plus the work index this p2p settled in.
@@ -370,6 +574,10 @@ static void finishPlan(struct ncclKernelPlan* plan) {
   plan->channelMask = channelMask;
   plan->hasProxyOps = hasProxyOps;
   plan->threadPerBlock = std::max(plan->threadPerBlock, 3*plan->comm->WarpSize);
+#ifdef ENABLE_COLLTRACE
+  // Nothing sampled, launch the kernel without trace points
+  if (!plan->traced && plan->kernelFn == ncclKerns[1].kernelFn) plan->kernelFn = ncclKerns[0].kernelFn;
+#endif
 }
 
 static ncclResult_t registerIntraNodeBuffers(
@@ -420,6 +628,7 @@ static ncclResult_t registerIntraNodeBuffers(
         struct ncclPointerList* q = ncclMemoryPoolAlloc<struct ncclPointerList>(&comm->memPool_ncclPointerList, &comm->memPermanent);
         q->ptr = base;
         ncclIntruQueueEnqueue(&plan->ipcMemQueue, q);
+        comm->statsRegisteredPeerBuffers++;
       }
     }
   }
@@ -435,12 +644,8 @@ NCCL_PARAM(GraphRegister, "GRAPH_REGISTER", 0);
 static ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNetTypeSupport);
 static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps);
 
-static ncclResult_t scheduleCollTasksToPlan(
-    struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget
-  ) {
+static void getBytePerChannel(struct ncclComm* comm, size_t* bytePerChannel) {
   struct ncclTasks* tasks = &comm->tasks;
-
-  size_t bytePerChannel[/*collNetSupport*/2];
   if (comm->channelSize > 0) {
     // Set by user
     bytePerChannel[/*collNetSupport=*/0] = comm->channelSize;
@@ -459,6 +664,147 @@ static ncclResult_t scheduleCollTasksToPlan(
       bytePerChannel[collNetSupport] /= 2;
     }
   }
+}
+
+// Algorithms the queued collectives are going to run with, for RCCL_RUNTIME_CONNECT to connect them before the launch.
+// Ranges are scheduled as aggregated or one by one depending on the work budget so both choices are included.
+ncclResult_t ncclCollPredictAlgos(struct ncclComm* comm, uint32_t* algoMask, uint32_t* protoMask) {
+  struct ncclTasks* tasks = &comm->tasks;
+  size_t bytePerChannel[/*collNetSupport*/2];
+  getBytePerChannel(comm, bytePerChannel);
+  *algoMask = tasks->nTasksColl ? 1<<NCCL_ALGO_RING : 0; // Ring is the fallback of any algorithm left unconnected
+  *protoMask = tasks->nTasksColl ? 1<<NCCL_PROTO_SIMPLE : 0; // And SIMPLE the fallback of any protocol
+  if (tasks->nTasksColl && comm->tuner) *algoMask |= 1<<NCCL_ALGO_TREE; // May be explored by RCCL_ONLINE_TUNE
+
+  struct ncclTaskColl* head = ncclIntruQueueHead(&tasks->collQueue);
+  while (head != nullptr) {
+    struct ncclInfo aggInfo = {};
+    aggInfo.comm = comm;
+    aggInfo.coll = head->func;
+    aggInfo.datatype = head->datatype;
+    aggInfo.opFull = head->op;
+    aggInfo.op = (ncclRedOp_t)(int)head->op.op;
+    aggInfo.count = head->count;
+    aggInfo.maxChannels = head->maxChannels;
+    int nAggChannels = 0;
+    int nAggOps = 1;
+    struct ncclTaskColl* aggEnd = head->next;
+    int collNetSupport = 0;
+    NCCLCHECK(getCollNetSupport(&aggInfo, &collNetSupport));
+    while (aggEnd != nullptr && head->update == nullptr && aggEnd->update == nullptr &&
+           aggEnd->func == aggInfo.coll &&
+           aggEnd->datatype == aggInfo.datatype &&
+           aggEnd->op.op == aggInfo.opFull.op &&
+           aggEnd->maxChannels == aggInfo.maxChannels) {
+      aggInfo.count += aggEnd->count;
+      int nc = DIVUP(aggEnd->count*ncclTypeSize(aggInfo.datatype), bytePerChannel[collNetSupport]);
+      nc = std::max(1, std::min(nc, comm->nChannels));
+      nAggChannels += nc;
+      nAggOps++;
+      aggEnd = aggEnd->next;
+    }
+    if (nAggOps > 1) {
+      NCCLCHECK(ncclInfoSetDerived(&aggInfo, comm->nRanks));
+      aggInfo.nChannels = std::min(comm->nChannels, nAggChannels);
+      if (aggInfo.maxChannels > 0) aggInfo.nChannels = std::min(aggInfo.nChannels, aggInfo.maxChannels);
+      NCCLCHECK(getAlgoInfo(&aggInfo, collNetSupport, DIVUP(nAggChannels, aggInfo.nChannels)));
+      *algoMask |= 1<<aggInfo.algorithm;
+      *protoMask |= 1<<aggInfo.protocol;
+    }
+    for (; head != aggEnd; head = head->next) {
+      struct ncclInfo info = {};
+      info.comm = comm;
+      info.coll = head->func;
+      info.count = head->count;
+      info.datatype = head->datatype;
+      info.opFull = head->op;
+      info.op = (ncclRedOp_t)(int)head->op.op;
+      info.maxChannels = head->maxChannels;
+      NCCLCHECK(ncclInfoSetDerived(&info, comm->nRanks));
+      NCCLCHECK(getAlgoInfo(&info, collNetSupport, 1));
+      *algoMask |= 1<<info.algorithm;
+      *protoMask |= 1<<info.protocol;
+    }
+  }
+  return ncclSuccess;
+}
+
+// Large allreduces can run as a ring on half of their channels and a tree on the other half at the
+// same time, which pays when the two are bounded by different links, e.g. the tree by the network and
+// the ring by xGMI. The bytes are split in inverse proportion to the modeled time of each algorithm,
+// so that both parts finish together. Off unless RCCL_SPLIT_ALGO_THRESHOLD is set.
+RCCL_PARAM(SplitAlgoThreshold, "SPLIT_ALGO_THRESHOLD", 0);
+
+static ncclResult_t collSplitAlgos(struct ncclComm* comm, struct ncclInfo* info, bool* split, int* otherAlgo, size_t* firstCount) {
+  *split = false;
+  int64_t threshold = rcclParamSplitAlgoThreshold();
+  if (threshold <= 0 || info->nBytes < (size_t)threshold || comm->nRanks == 1) return ncclSuccess;
+  if (info->coll != ncclFuncAllReduce || info->update != nullptr || info->opFull.epilogue || info->tuneSample != nullptr) return ncclSuccess;
+  if (info->protocol != NCCL_PROTO_SIMPLE || info->maxChannels > 0 || info->nChannels < 2) return ncclSuccess;
+  if (info->algorithm == NCCL_ALGO_RING) *otherAlgo = NCCL_ALGO_TREE;
+  else if (info->algorithm == NCCL_ALGO_TREE) *otherAlgo = NCCL_ALGO_RING;
+  else return ncclSuccess;
+  // Trees connected at runtime only exist when ncclCollPredictAlgos() asked for them
+  if (comm->runtimeConnect && *otherAlgo == NCCL_ALGO_TREE && !(comm->runtimeConnectedAlgos & (1<<NCCL_ALGO_TREE))) return ncclSuccess;
+
+  float time, otherTime;
+  NCCLCHECK(ncclTopoGetAlgoTime(info, info->algorithm, NCCL_PROTO_SIMPLE, 1, &time));
+  NCCLCHECK(ncclTopoGetAlgoTime(info, *otherAlgo, NCCL_PROTO_SIMPLE, 1, &otherTime));
+  if (time <= 0 || otherTime <= 0) return ncclSuccess;
+  // Keep the second part 4KB aligned
+  size_t align = 4096/ncclTypeSize(info->datatype);
+  size_t count = (size_t)(info->count*(double)otherTime/(time + otherTime))/align*align;
+  if (count == 0 || count >= info->count) return ncclSuccess;
+  *firstCount = count;
+  *split = true;
+  return ncclSuccess;
+}
+
+// Adds the first `firstCount` elements of the collective with the algorithm of `info` and the rest
+// with `otherAlgo`, on the first and the second half of the channels of `info`, so the two parts
+// never share a channel.
+static ncclResult_t addSplitCollToPlan(
+    struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget,
+    struct ncclInfo const* info, int otherAlgo, size_t firstCount
+  ) {
+  size_t typeSize = ncclTypeSize(info->datatype);
+  for (int part=0; part < 2; part++) {
+    struct ncclInfo partInfo = *info; // C++ struct assignment
+    if (part == 0) {
+      partInfo.count = firstCount;
+      partInfo.nChannels = info->nChannels/2;
+    } else {
+      partInfo.sendbuff = (char const*)info->sendbuff + firstCount*typeSize;
+      partInfo.recvbuff = (char*)info->recvbuff + firstCount*typeSize;
+      partInfo.count = info->count - firstCount;
+      partInfo.algorithm = otherAlgo;
+      partInfo.nChannels = info->nChannels - info->nChannels/2;
+      partInfo.nThreads = comm->maxThreads[otherAlgo][info->protocol];
+    }
+    NCCLCHECK(ncclInfoSetDerived(&partInfo, comm->nRanks));
+    int workFuncIndex;
+    struct ncclWorkElem workElem = {};
+    struct ncclProxyOp proxyOp = {};
+    NCCLCHECK(computeColl(&partInfo, &workFuncIndex, &workElem, &proxyOp));
+    int firstChannel = part == 0 ? 0 : info->nChannels/2;
+    NCCLCHECK(addCollToPlan(comm, plan, nWorkBudget, workFuncIndex, &workElem, &proxyOp,
+      firstChannel+partInfo.nChannels, partInfo.nChannels, partInfo.nBytes, false, nullptr, nullptr, nullptr,
+      statsClass(info->coll), firstChannel));
+    plan->threadPerBlock = std::max(plan->threadPerBlock, partInfo.nThreads);
+  }
+  comm->stats[statsClass(info->coll)].algoProto[otherAlgo][info->protocol]++;
+  TRACE(NCCL_COLL, "%ld Bytes split: %zu elements algo %d, %zu elements algo %d", info->nBytes,
+      firstCount, info->algorithm, info->count - firstCount, otherAlgo);
+  return ncclSuccess;
+}
+
+static ncclResult_t scheduleCollTasksToPlan(
+    struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget
+  ) {
+  struct ncclTasks* tasks = &comm->tasks;
+
+  size_t bytePerChannel[/*collNetSupport*/2];
+  getBytePerChannel(comm, bytePerChannel);
 
   while (tasks->nTasksColl != 0) {
     struct ncclTaskColl* head = ncclIntruQueueHead(&tasks->collQueue);
@@ -469,6 +815,7 @@ static ncclResult_t scheduleCollTasksToPlan(
     aggInfo.opFull = head->op;
     aggInfo.op = (ncclRedOp_t)(int)head->op.op;
     aggInfo.count = head->count;
+    aggInfo.maxChannels = head->maxChannels;
     int nAggChannels = 0;
     int nAggOps = 1;
     struct ncclTaskColl* aggEnd = head->next;
@@ -476,10 +823,11 @@ static ncclResult_t scheduleCollTasksToPlan(
     NCCLCHECK(getCollNetSupport(&aggInfo, &collNetSupport));
 
     // Find a range of ops that can be aggregated together.
-    while (aggEnd != nullptr &&
+    while (aggEnd != nullptr && head->update == nullptr && aggEnd->update == nullptr &&
            aggEnd->func == aggInfo.coll &&
            aggEnd->datatype == aggInfo.datatype &&
-           aggEnd->op.op == aggInfo.opFull.op) {
+           aggEnd->op.op == aggInfo.opFull.op &&
+           aggEnd->maxChannels == aggInfo.maxChannels) {
       aggInfo.count += aggEnd->count;
       int nc = DIVUP(aggEnd->count*ncclTypeSize(aggInfo.datatype), bytePerChannel[collNetSupport]);
       nc = std::max(1, std::min(nc, comm->nChannels));
@@ -491,6 +839,7 @@ static ncclResult_t scheduleCollTasksToPlan(
     if (nAggOps > 1) {
       NCCLCHECK(ncclInfoSetDerived(&aggInfo, comm->nRanks));
       aggInfo.nChannels = std::min(comm->nChannels, nAggChannels);
+      if (aggInfo.maxChannels > 0) aggInfo.nChannels = std::min(aggInfo.nChannels, aggInfo.maxChannels);
       int opPerChannel = DIVUP(nAggChannels, aggInfo.nChannels);
       NCCLCHECK(getAlgoInfo(&aggInfo, collNetSupport, opPerChannel));
     }
@@ -508,11 +857,16 @@ static ncclResult_t scheduleCollTasksToPlan(
       info.op = (ncclRedOp_t)(int)head->op.op;
       info.chunkSteps = head->chunkSteps;
       info.sliceSteps = head->sliceSteps;
+      info.maxChannels = head->maxChannels;
+      info.update = head->update;
       NCCLCHECK(ncclInfoSetDerived(&info, comm->nRanks));
       if (nAggOps > 1) {
         int maxChannels = aggInfo.algorithm == NCCL_ALGO_NVLS || aggInfo.algorithm == NCCL_ALGO_NVLS_TREE ? comm->nvlsChannels : comm->nChannels;
+        if (info.maxChannels > 0) maxChannels = std::min(maxChannels, info.maxChannels);
+        int modelChannels;
+        NCCLCHECK(ncclTopoGetAlgoChannels(&info, aggInfo.algorithm, aggInfo.protocol, maxChannels, &modelChannels));
         info.nChannels = DIVUP(info.nBytes, bytePerChannel[collNetSupport]);
-        info.nChannels = std::max(1, std::min(info.nChannels, maxChannels));
+        info.nChannels = modelChannels > 0 ? modelChannels : std::max(1, std::min(info.nChannels, maxChannels));
         info.algorithm = aggInfo.algorithm;
         info.protocol = aggInfo.protocol;
         info.nThreads = aggInfo.nThreads;
@@ -522,22 +876,69 @@ static ncclResult_t scheduleCollTasksToPlan(
       struct ncclWorkElem workElem = {};
       struct ncclProxyOp proxyOp = {};
       NCCLCHECK(computeColl(&info, &workFuncIndex, &workElem, &proxyOp));
+      if (comm->runtimeConnect && ((info.algorithm == NCCL_ALGO_TREE && !(comm->runtimeConnectedAlgos & (1<<NCCL_ALGO_TREE))) ||
+          ((info.algorithm == NCCL_ALGO_RING || info.algorithm == NCCL_ALGO_TREE) && !(comm->collProtoMask & (1<<info.protocol))))) {
+        // Not predicted by ncclCollPredictAlgos(), fall back to the rings which are always connected by then, with
+        // the SIMPLE buffers they always have. Every rank takes the same decision as they all connect the same
+        // algorithms and protocols.
+        info.algorithm = NCCL_ALGO_RING;
+        info.protocol = NCCL_PROTO_SIMPLE;
+        info.nChannels = info.maxChannels > 0 ? std::min(comm->nChannels, info.maxChannels) : comm->nChannels;
+        info.nThreads = comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE];
+        workElem = {};
+        proxyOp = {};
+        NCCLCHECK(computeColl(&info, &workFuncIndex, &workElem, &proxyOp));
+      }
 
       if (*nWorkBudget < info.nChannels) return ncclSuccess; // Ensure room for addCollToPlan()
 
+      bool split = false;
+      int splitAlgo;
+      size_t splitCount;
+      if (nAggOps == 1) NCCLCHECK(collSplitAlgos(comm, &info, &split, &splitAlgo, &splitCount));
+
       bool regBufUsed = false;
       void* regBufSend[NCCL_MAX_LOCAL_RANKS];
       void* regBufRecv[NCCL_MAX_LOCAL_RANKS];
-      if (plan->persistent && ncclParamGraphRegister() &&
-          info.algorithm == NCCL_ALGO_COLLNET_DIRECT &&   // limited to CollNetDirect for now
+      if (info.algorithm == NCCL_ALGO_COLLNET_DIRECT &&   // limited to CollNetDirect for now
           comm->intraHighestTransportType == TRANSPORT_P2P && // only when all ranks can p2p each other
           comm->intraRanks < comm->localRanks) { // only with inter-process & intra-node peers
-        NCCLCHECK(registerIntraNodeBuffers(comm, plan, &info, &regBufUsed, regBufSend, regBufRecv));
+        struct ncclReg* sendReg = ncclRegFind(comm, info.sendbuff, info.nBytes);
+        struct ncclReg* recvReg = ncclRegFind(comm, info.recvbuff, info.nBytes);
+        if (sendReg && recvReg) {
+          // Buffers registered with ncclCommRegister(), peer mappings are cached in the comm
+          NCCLCHECK(ncclRegGetPeerBuffers(comm, sendReg, info.sendbuff, recvReg, info.recvbuff, regBufSend, regBufRecv));
+          regBufUsed = true;
+        } else if (plan->persistent && ncclParamGraphRegister()) {
+          NCCLCHECK(registerIntraNodeBuffers(comm, plan, &info, &regBufUsed, regBufSend, regBufRecv));
+        }
       }
 
       int maxChannels = info.algorithm == NCCL_ALGO_NVLS || aggInfo.algorithm == NCCL_ALGO_NVLS_TREE ? comm->nvlsChannels : comm->nChannels;
-      NCCLCHECK(addCollToPlan(comm, plan, nWorkBudget, workFuncIndex, &workElem, &proxyOp,
-        maxChannels, info.nChannels, info.nBytes, regBufUsed, regBufSend, regBufRecv));
+      // Keep the collective on the first channels of its CU budget, so that it does not widen the grid
+      if (info.maxChannels > 0) maxChannels = std::min(maxChannels, std::max(info.maxChannels, info.nChannels));
+      if (split) {
+        NCCLCHECK(addSplitCollToPlan(comm, plan, nWorkBudget, &info, splitAlgo, splitCount));
+      } else {
+        NCCLCHECK(addCollToPlan(comm, plan, nWorkBudget, workFuncIndex, &workElem, &proxyOp,
+          maxChannels, info.nChannels, info.nBytes, regBufUsed, regBufSend, regBufRecv, info.update, statsClass(info.coll)));
+      }
+      comm->stats[statsClass(info.coll)].calls++;
+      comm->stats[statsClass(info.coll)].bytes += info.nBytes;
+      comm->stats[statsClass(info.coll)].algoProto[info.algorithm][info.protocol]++;
+      if (info.tuneSample && plan->collOpCount == 1) plan->tuneSample = info.tuneSample;
+      else if (plan->collOpCount == 1 && ncclBwReportSample(comm)) {
+        float modelUs;
+        NCCLCHECK(ncclTopoGetAlgoTime(&info, info.algorithm, info.protocol, 1, &modelUs));
+        plan->bwSample = true;
+        plan->bwFunc = info.coll;
+        plan->bwAlgorithm = info.algorithm;
+        plan->bwProtocol = info.protocol;
+        plan->bwBytes = info.nBytes;
+        plan->bwModelUs = modelUs;
+      } else if (plan->collOpCount > 1) {
+        plan->bwSample = false; // Would time the whole plan
+      }
       tasks->nTasksColl -= 1;
       tasks->collBytesTotal -= info.nBytes;
       ncclIntruQueueDequeue(&tasks->collQueue);
@@ -545,8 +946,10 @@ static ncclResult_t scheduleCollTasksToPlan(
 
       plan->threadPerBlock = std::max(plan->threadPerBlock, info.nThreads);
       if (!plan->kernelSpecialized) {
-        plan->kernelFn = ncclKerns[ncclGetKernelIndex(comm)].kernelFn;
-        plan->kernelSpecialized = ncclKerns[ncclGetKernelIndex(comm)].specialized;
+        // The first collective picks the kernel, the others of the plan go through ncclFuncs
+        void* fn = ncclSpecializedKernelFn(comm, &info);
+        plan->kernelFn = fn ? fn : ncclKerns[ncclGetKernelIndex(comm)].kernelFn;
+        plan->kernelSpecialized = fn ? true : ncclKerns[ncclGetKernelIndex(comm)].specialized;
       }
     }
   }
@@ -564,6 +967,24 @@ static size_t calcP2pChunkSize(size_t totalSize, int minChannels, int maxChannel
 }
 
 RCCL_PARAM(P2pNetThreshold, "P2P_NET_THRESHOLD", 131072);
+RCCL_PARAM(P2pRoundsInFlight, "P2P_ROUNDS_IN_FLIGHT", 0); // Max peer rounds per kernel plan, 0 for no limit
+// Sends and receives of at least RCCL_P2P_WIDE_THRESHOLD bytes are striped over RCCL_P2P_WIDE_NCHANNELS
+// channels (all p2p channels by default) instead of the p2pnChannelsPerPeer ones, so a large transfer to
+// a single peer, as in pipeline parallelism, is not limited to the bandwidth of a few channels. The
+// extra channels of a peer are connected on the first such transfer. Both ends derive the striping from
+// the size, so they split it the same way.
+RCCL_PARAM(P2pWideThreshold, "P2P_WIDE_THRESHOLD", 0);
+RCCL_PARAM(P2pWideNChannels, "P2P_WIDE_NCHANNELS", -1);
+
+// Channels a send or receive of bytes is striped over, a power of two
+static int p2pPeerNChannels(struct ncclComm* comm, ssize_t bytes) {
+  int64_t threshold = rcclParamP2pWideThreshold();
+  if (threshold <= 0 || bytes < threshold) return comm->p2pnChannelsPerPeer;
+  int64_t wide = rcclParamP2pWideNChannels();
+  int nChannels = wide > 0 ? std::min<int64_t>(wide, comm->p2pnChannels) : comm->p2pnChannels;
+  nChannels = 1 << log2i(nChannels);
+  return std::max(nChannels, comm->p2pnChannelsPerPeer);
+}
 
 static ncclResult_t scheduleP2pTasksToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget
@@ -572,6 +993,10 @@ static ncclResult_t scheduleP2pTasksToPlan(
   int nRanks = comm->nRanks;
   struct ncclTasks::Peer* peers = tasks->peers;
   int const *sendOrder = tasks->p2pSendOrder;
+  if (tasks->nTasksP2p != 0) {
+    plan->tuneSample = nullptr; // Would be timed along with the tuned collective
+    plan->bwSample = false;
+  }
   int const *recvOrder = tasks->p2pRecvOrder;
 
   plan->threadPerBlock = std::max(plan->threadPerBlock, NCCL_MAX_NTHREADS);
@@ -593,6 +1018,10 @@ static ncclResult_t scheduleP2pTasksToPlan(
     while (nChannelsMax*nRanks > comm->p2pnChannels*4 && nChannelsMax > 1) nChannelsMax /= 2;
   }
 
+  // Bound how many schedule steps a plan covers. Channels cannot run ahead of
+  // their peers by more than that many rounds, limiting incast at receivers.
+  int roundsInFlight = rcclParamP2pRoundsInFlight();
+  int rounds = 0;
   bool fuseOk;
   // We can perform 8 send/recv per round per CTA. Make sure we jump between fused blocks at node boundaries.
   while (tasks->nTasksP2p != 0) {
@@ -617,14 +1046,22 @@ static ncclResult_t scheduleP2pTasksToPlan(
         }
       }
       if (send != nullptr || recv != nullptr) {
+        if (roundsInFlight > 0 && rounds++ == roundsInFlight) return ncclSuccess; // rest goes to the next plan
         char* recvPtr = recv ? (char*)recv->buff : nullptr;
         char* sendPtr = send ? (char*)send->buff : nullptr;
         ssize_t recvBytes = recv ? recv->bytes : 0;
         ssize_t sendBytes = send ? send->bytes : 0;
         ssize_t minSize = stepSize/8;
         ssize_t maxSize = comm->nNodes > 1 ? stepSize : stepSize*32;
-        ssize_t recvChunkBytesMax = calcP2pChunkSize(recvBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
-        ssize_t sendChunkBytesMax = calcP2pChunkSize(sendBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
+        int recvStripe = p2pPeerNChannels(comm, recvBytes);
+        int sendStripe = p2pPeerNChannels(comm, sendBytes);
+        // Wide transfers use all their channels whatever the number of ranks
+        ssize_t recvChunkBytesMax = recvStripe > comm->p2pnChannelsPerPeer ?
+          calcP2pChunkSize(recvBytes, recvStripe, recvStripe, minSize, maxSize) :
+          calcP2pChunkSize(recvBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
+        ssize_t sendChunkBytesMax = sendStripe > comm->p2pnChannelsPerPeer ?
+          calcP2pChunkSize(sendBytes, sendStripe, sendStripe, minSize, maxSize) :
+          calcP2pChunkSize(sendBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
         // Zero size send/recv are syncs, encode here with -1.
         recvBytes = recv && recvBytes == 0 ? -1 : recvBytes;
         sendBytes = send && sendBytes == 0 ? -1 : sendBytes;
@@ -646,7 +1083,7 @@ static ncclResult_t scheduleP2pTasksToPlan(
           if (recvChunkBytes != 0) {
             if (recvChunkBytes == -1) recvChunkBytes = 0;
             if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
-            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/false, recvPeer, recv->chunk, recvPtr, recvChunkBytes, recvIdx, fuseOk));
+            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/false, recvPeer, recv->chunk, recvStripe, recvPtr, recvChunkBytes, recvIdx, fuseOk));
             fuseOk = true;
             recvPtr += recvChunkBytes;
             recvBytes -= recvChunkBytes;
@@ -660,7 +1097,7 @@ static ncclResult_t scheduleP2pTasksToPlan(
           if (sendChunkBytes != 0) {
             if (sendChunkBytes == -1) sendChunkBytes = 0;
             if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
-            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/true, sendPeer, send->chunk, sendPtr, sendChunkBytes, sendIdx, fuseOk));
+            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/true, sendPeer, send->chunk, sendStripe, sendPtr, sendChunkBytes, sendIdx, fuseOk));
             fuseOk = true;
             sendPtr += sendChunkBytes;
             sendBytes -= sendChunkBytes;
@@ -690,7 +1127,7 @@ static inline uint32_t rollingMin32(uint32_t a, uint32_t b) {
 
 // Spin until its safe to increase comm->workFifoSent to desiredSent.
 static void waitWorkFifoAvailable(struct ncclComm* comm, uint32_t desiredSent) {
-  if (__builtin_expect(rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent), false)) {
+  if (__builtin_expect(rollingLess32(comm->workFifoAckdMin + comm->workFifoUnits, desiredSent), false)) {
     while (1) {
       // We have to poll for notifications from device.
       uint32_t* doneLive = comm->workFifoDone;
@@ -722,31 +1159,46 @@ static void waitWorkFifoAvailable(struct ncclComm* comm, uint32_t desiredSent) {
       comm->workFifoAckdMin = ackdAll;
 
       // See if that was enough.
-      if (!rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent)) break;
+      if (!rollingLess32(comm->workFifoAckdMin + comm->workFifoUnits, desiredSent)) break;
       sched_yield();
     }
   }
 }
 
+// Takes the next units of the fifo for a work, skipping to the start when they would wrap around its end.
+static inline uint32_t reserveWorkUnits(uint32_t* ixSent, uint32_t ixMask, int units) {
+  if (((*ixSent + units-1) & ixMask) < (*ixSent & ixMask)) *ixSent = (*ixSent + ixMask) & ~ixMask;
+  uint32_t ix = *ixSent;
+  *ixSent += units;
+  return ix;
+}
+
 static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* plan) {
   bool persistent = plan->persistent;
   int channelUbound = plan->channelUbound;
-  int nWork = 0;
-  for (int c=0; c < channelUbound; c++) nWork += plan->channels[c].nWork;
+  // Units taken at most: wide works may need a link or to skip the last unit of the fifo.
+  int nUnits = 0;
+  for (int c=0; c < channelUbound; c++) {
+    for (struct ncclWorkList* q = ncclIntruQueueHead(&plan->channels[c].workQueue); q != nullptr; q = q->next) {
+      nUnits += ncclWorkUnits(q->work.header.type) == 1 ? 1 : 4;
+    }
+  }
 
   struct ncclWork* workHeap;
   if (!persistent) {
     workHeap = comm->workFifoHeap;
   } else {
-    workHeap = ncclMemoryStackAlloc<struct ncclWork>(&comm->memScoped, nWork);
+    workHeap = ncclMemoryStackAlloc<struct ncclWork>(&comm->memScoped, DIVUP(nUnits*NCCL_WORK_UNIT, NCCL_WORK_SIZE));
+    NCCLCHECK(ncclCalloc(&plan->workUnits, nUnits));
+    plan->nWorkUnits = 0;
   }
-  uint32_t ixMask = persistent ? ~uint32_t(0) : comm->workFifoDepth-1;
+  uint32_t ixMask = persistent ? ~uint32_t(0) : comm->workFifoUnits-1;
   uint32_t ixSent;
   if (persistent) {
     ixSent = 0;
   } else {
     ixSent = comm->workFifoSent;
-    // First work for a channel has to be at workHeap+blockIdx.x which means
+    // First work for a channel has to be at workHead+blockIdx.x which means
     // we cannot tolerate fifo wraparound. So round up to the wrap boundary
     // if not doing so would incur crossing it.
     if (((ixSent + plan->channelCount-1) & ixMask) < (ixSent & ixMask)) {
@@ -756,7 +1208,7 @@ static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* pla
       // this way the skipped slots will be considered consumed as well.
       comm->workFifoSent = ixSent;
     }
-    waitWorkFifoAvailable(comm, ixSent + nWork);
+    waitWorkFifoAvailable(comm, ixSent + nUnits);
   }
   uint32_t ixHead = ixSent;
   ixSent += plan->channelCount;
@@ -766,29 +1218,54 @@ static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* pla
     // Offset of first work equals number of channels below with work.
     uint32_t ix = ixHead + channelsWithWork;
     channelsWithWork += q != nullptr ? 1 : 0;
+    if (q != nullptr && ncclWorkUnits(q->work.header.type) > 1) {
+      // The first unit only links to the wide first work.
+      struct ncclWork link = {};
+      link.header = q->work.header;
+      link.header.type = ncclWorkTypeLink;
+      link.header.isLast = 0;
+      uint32_t ixWork = reserveWorkUnits(&ixSent, ixMask, 2);
+      link.header.workNext = int32_t(ixWork & ixMask) - int32_t(ixHead & ixMask);
+      memcpy(ncclWorkAt(workHeap, ix & ixMask), &link, NCCL_WORK_UNIT);
+      ix = ixWork;
+    }
     while (q != nullptr) {
+      int units = ncclWorkUnits(q->work.header.type);
+      uint32_t ixNext = 0;
       if (q->next != nullptr) {
-        q->work.header.workNext = int32_t(ixSent & ixMask) - int32_t(ixHead & ixMask);
+        ixNext = reserveWorkUnits(&ixSent, ixMask, ncclWorkUnits(q->next->work.header.type));
+        q->work.header.workNext = int32_t(ixNext & ixMask) - int32_t(ixHead & ixMask);
       } else {
         q->work.header.inFifo = !persistent ? 1 : 0;
-        // Tell channel to ack us back ix+1 indicating that all slots up to and
-        // including ix have been consumed.
-        q->work.header.doneAcks = ix+1;
-        comm->channels[c].workFifoSent = ix+1;
+        // Tell channel to ack us back ix+units indicating that all units up to
+        // and including those of this work have been consumed.
+        q->work.header.doneAcks = ix+units;
+        comm->channels[c].workFifoSent = ix+units;
       }
-      workHeap[ix & ixMask] = q->work; // C++ struct assignment
+      memcpy(ncclWorkAt(workHeap, ix & ixMask), &q->work, units*NCCL_WORK_UNIT);
+      if (persistent) plan->workUnits[plan->nWorkUnits++] = ix;
       q = q->next;
-      if (q != nullptr) ix = ixSent++;
+      ix = ixNext;
     }
   }
 
   if (!persistent) {
     comm->workFifoSent = ixSent;
     if (comm->workFifoHeapGdrHandle != nullptr) wc_store_fence();
-    plan->workHead = &comm->devWorkFifoHeap[ixHead & ixMask];
+    plan->workHead = ncclWorkAt(comm->devWorkFifoHeap, ixHead & ixMask);
+    if (comm->watchdog) ncclWatchdogLaunch(comm, plan);
   } else {
+    // Kernels load a whole ncclWork even for a one unit work at the end
+    int nWork = DIVUP(ixSent*NCCL_WORK_UNIT, NCCL_WORK_SIZE) + 1;
     NCCLCHECK(ncclCudaMalloc(&plan->workHead, nWork));
-    NCCLCHECK(ncclCudaMemcpy(plan->workHead, workHeap, nWork));
+    NCCLCHECK(ncclCudaMemcpy(plan->workHead, workHeap, DIVUP(ixSent*NCCL_WORK_UNIT, NCCL_WORK_SIZE)));
+    plan->workBytes = nWork*sizeof(struct ncclWork);
+    comm->statsPersistentWorkBytes += plan->workBytes;
+    plan->nWorkHost = DIVUP(ixSent*NCCL_WORK_UNIT, NCCL_WORK_SIZE);
+    NCCLCHECK(ncclCalloc(&plan->workHost, plan->nWorkHost));
+    memcpy(plan->workHost, workHeap, plan->nWorkHost*sizeof(struct ncclWork));
+    plan->persistentNext = comm->persistentPlans;
+    comm->persistentPlans = plan;
   }
   return ncclSuccess;
 }
@@ -837,12 +1314,29 @@ static ncclResult_t hostStreamPlanTask(struct ncclComm* comm, struct ncclKernelP
   return ncclSuccess;
 }
 
+// Runs the host tasks of a plan and of the plans following it in the launch, so a launch
+// adds at most one host node to a graph or one host function to the host stream.
 static void HIPRT_CB hostStreamPlanCallback(void *plan_) {
   NVTX3_FUNC_RANGE_IN(nccl_domain);
   struct ncclKernelPlan* plan = (struct ncclKernelPlan*)plan_;
-  ncclResult_t result = hostStreamPlanTask(plan->comm, plan);
-  if (result != ncclSuccess) {
-    WARN("hostStreamPlanCallback() failed : %s", ncclGetErrorString(result));
+  while (plan != nullptr) {
+    // A non-persistent plan may be reclaimed as soon as its task is done
+    struct ncclKernelPlan* next = plan->next;
+    if (plan->hasProxyOps) {
+      ncclResult_t result = hostStreamPlanTask(plan->comm, plan);
+      if (result != ncclSuccess) {
+        WARN("hostStreamPlanCallback() failed : %s", ncclGetErrorString(result));
+      }
+    }
+    plan = next;
+  }
+}
+
+void ncclPlanFreeWorkLists(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  for (int c=0; c < plan->channelUbound; c++) {
+    while (!ncclIntruQueueEmpty(&plan->channels[c].workQueue)) {
+      ncclMemoryPoolFree(&comm->memPool_ncclWorkList, ncclIntruQueueDequeue(&plan->channels[c].workQueue));
+    }
   }
 }
 
@@ -851,17 +1345,45 @@ static ncclResult_t reclaimPlan(struct ncclComm* comm, struct ncclCommCallback*
   if (plan->persistent) {
     comm->persistentRefs -= 1;
     NCCLCHECK(ncclCudaFree(plan->workHead));
+    comm->statsPersistentWorkBytes -= plan->workBytes;
+    for (struct ncclKernelPlan** p = &comm->persistentPlans; *p != nullptr; p = &(*p)->persistentNext) {
+      if (*p == plan) {
+        *p = plan->persistentNext;
+        break;
+      }
+    }
+    free(plan->workHost);
+    free(plan->workUnits);
     while (!ncclIntruQueueEmpty(&plan->ipcMemQueue)) {
       struct ncclPointerList* q = ncclIntruQueueDequeue(&plan->ipcMemQueue);
       CUDACHECKIGNORE(cudaIpcCloseMemHandle(q->ptr));
+      comm->statsRegisteredPeerBuffers--;
       ncclMemoryPoolFree(&comm->memPool_ncclPointerList, q);
     }
   }
   ncclMemoryPoolTakeAll(&comm->memPool_ncclProxyOp, &plan->memPool_ncclProxyOp);
-  ncclMemoryPoolFree(&comm->memPool_ncclKernelPlan, plan);
+  ncclPlanFreeWorkLists(comm, plan);
+  // Keep the plan for allocPlan(), its channelUbound tells how much to reset.
+  plan->next = comm->planFreeList;
+  comm->planFreeList = plan;
   return ncclSuccess;
 }
 
+static struct ncclKernelPlan* allocPlan(struct ncclComm* comm) {
+  struct ncclKernelPlan* plan = comm->planFreeList;
+  if (plan != nullptr) {
+    comm->planFreeList = plan->next;
+    comm->planPoolHits++;
+    int channelUbound = plan->channelUbound;
+    memset((void*)plan, 0, offsetof(struct ncclKernelPlan, channels));
+    memset((void*)plan->channels, 0, channelUbound*sizeof(struct ncclKernelPlan::Channel));
+  } else {
+    comm->planPoolMisses++;
+    plan = ncclMemoryPoolAlloc<struct ncclKernelPlan>(&comm->memPool_ncclKernelPlan, &comm->memPermanent);
+  }
+  return plan;
+}
+
 static void persistentDestructor(void* plans_) {
   struct ncclKernelPlan* plan = (struct ncclKernelPlan*)plans_;
   struct ncclComm* comm = plan->comm;
@@ -881,6 +1403,7 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
   // Poll for callbacks sent to us from other threads. Typically these free
   // resources from to our memory pools.
   NCCLCHECK(ncclCommPollCallbacks(comm, /*waitSome=*/false));
+  NCCLCHECK(ncclCollFreeRetiredConns(comm));
 
   // We already have one frame present which holds all of our tasks (which we
   // are about to schedule). Now push an additional frame for allocating
@@ -889,14 +1412,15 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
 
   if (tasks->nTasksColl + tasks->nTasksP2p != 0) {
     do {
-      struct ncclKernelPlan* plan = ncclMemoryPoolAlloc<struct ncclKernelPlan>(&comm->memPool_ncclKernelPlan, &comm->memPermanent);
+      struct ncclKernelPlan* plan = allocPlan(comm);
       ncclIntruQueueEnqueue(&comm->planQueue, plan);
       nPlans += 1;
       plan->comm = comm;
       plan->reclaimer.fn = reclaimPlan;
       plan->persistent = persistent;
 
-      // Non-persistent kernels fill up at most half of our fifo per kernel.
+      // Non-persistent kernels fill up at most a quarter of our fifo per kernel with one unit works, and all of
+      // it in the unlikely case they are all wide.
       int nWorkBudget = plan->persistent ? INT_MAX : comm->workFifoDepth/2;
       int nWorkBudgetOld = nWorkBudget;
 
@@ -958,17 +1482,12 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
     if (persistent || comm->persistentRefs != 0 || ncclCudaLaunchBlocking) {
       // We have to launch host tasks to push proxy args. We are careful to only
       // do this if necessary since host tasks impose a high performance cost in CUDA.
-      bool acquired = false;
-      for (struct ncclKernelPlan* plan=planHead; plan != nullptr; plan = plan->next) {
-        if (plan->hasProxyOps) {
-          if (!acquired) {
-            acquired = true;
-            NCCLCHECKGOTO(ncclStrongStreamAcquire(tasks->capturingGraph, &comm->sharedRes->hostStream), result, failure);
-          }
-          NCCLCHECKGOTO(ncclStrongStreamLaunchHost(tasks->capturingGraph, &comm->sharedRes->hostStream, hostStreamPlanCallback, plan), result, failure);
-        }
-      }
-      if (acquired) {
+      struct ncclKernelPlan* firstProxyPlan = planHead;
+      while (firstProxyPlan != nullptr && !firstProxyPlan->hasProxyOps) firstProxyPlan = firstProxyPlan->next;
+      if (firstProxyPlan != nullptr) {
+        // One host task for all plans, it skips the ones without proxy ops
+        NCCLCHECKGOTO(ncclStrongStreamAcquire(tasks->capturingGraph, &comm->sharedRes->hostStream), result, failure);
+        NCCLCHECKGOTO(ncclStrongStreamLaunchHost(tasks->capturingGraph, &comm->sharedRes->hostStream, hostStreamPlanCallback, firstProxyPlan), result, failure);
         // Make to-be-launched kernels dependent on just-launched host stream tasks.
         if (tasks->numStreams != 1) NCCLCHECKGOTO(ncclStrongStreamWaitStream(tasks->capturingGraph, launchStream, &comm->sharedRes->hostStream), result, failure);
         NCCLCHECKGOTO(ncclStrongStreamRelease(tasks->capturingGraph, &comm->sharedRes->hostStream), result, failure);
@@ -996,12 +1515,76 @@ ncclResult_t ncclLaunchKernelBefore_NoUncapturedCuda(struct ncclComm* comm, stru
   return ncclSuccess;
 }
 
+// Resident kernel mode (RCCL_RESIDENT_KERNEL). WARNING: the resident kernel only returns when the
+// communicator is destroyed or aborted, so while it is alive hipDeviceSynchronize(),
+// torch.cuda.synchronize(), hipDeviceReset() and anything else waiting for all work of the device
+// never return. Only use it when the application syncs on its own streams or events. Collectives
+// on the default stream, where device-wide syncs are the norm, keep using regular launches.
+RCCL_PARAM(ResidentKernel, "RESIDENT_KERNEL", 0);
+RCCL_PARAM(ResidentKernelCus, "RESIDENT_KERNEL_CUS", 0);
+
+// Launch the resident kernel on its own stream, one block per channel.
+static ncclResult_t residentKernelStart(struct ncclComm* comm) {
+  int nBlocks = std::max(comm->nChannels, comm->p2pnChannels);
+  int cus = rcclParamResidentKernelCus();
+  if (cus > 0 && cus < nBlocks) nBlocks = cus;
+  NCCLCHECK(ncclCudaHostCalloc(&comm->residentQueue, 1));
+  CUDACHECK(hipStreamCreateWithFlags(&comm->residentStream, hipStreamNonBlocking));
+  void *args[2] = {&comm->devComm, &comm->residentQueue};
+  CUDACHECK(hipLaunchKernel((void*)ncclResidentKernel, dim3(nBlocks), dim3(NCCL_MAX_NTHREADS), args,
+    ncclShmemDynamicSize(comm->cudaArch), comm->residentStream));
+  comm->residentNBlocks = nBlocks;
+  comm->residentSeq = 0;
+  comm->residentDone = 0;
+  INFO(NCCL_INIT, "comm %p rank %d resident kernel started on %d blocks", comm, comm->rank, nBlocks);
+  static bool warned = false;
+  if (!warned) {
+    warned = true;
+    WARN("RCCL_RESIDENT_KERNEL: the resident kernel runs until the communicator is destroyed, "
+         "hipDeviceSynchronize() and hipDeviceReset() hang until then");
+  }
+  return ncclSuccess;
+}
+
+// Hand a plan to the resident kernel. The stream writes the doorbell once prior
+// work on it is done and then waits for every channel of the plan to finish, so
+// ordering is the same as if the kernel had been launched on the stream.
+static ncclResult_t residentKernelRing(struct ncclComm* comm, struct ncclKernelPlan* plan, hipStream_t stream) {
+  uint64_t seq = comm->residentSeq + 1;
+  struct ncclResidentSlot* slot = &comm->residentQueue->slots[(seq-1)%NCCL_RESIDENT_QUEUE_DEPTH];
+  // Slot may still be in use by a doorbell NCCL_RESIDENT_QUEUE_DEPTH launches ago.
+  while (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) != 0) {
+    if (__atomic_load_n(comm->abortFlag, __ATOMIC_RELAXED)) return ncclInternalError;
+    sched_yield();
+  }
+  slot->workHead = plan->workHead;
+  slot->channelMask = plan->channelMask;
+  __atomic_store_n(&slot->pending, (uint32_t)plan->channelCount, __ATOMIC_RELEASE);
+  comm->residentSeq = seq;
+  comm->residentDone += plan->channelCount;
+  CUDACHECK(hipStreamWriteValue64(stream, &comm->residentQueue->head, seq, 0));
+  CUDACHECK(hipStreamWaitValue64(stream, &comm->residentQueue->done, comm->residentDone, hipStreamWaitValueGte, ~uint64_t(0)));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclResidentKernelStop(struct ncclComm* comm) {
+  if (comm->residentQueue == nullptr) return ncclSuccess;
+  // Blocks drain the doorbells already written and then exit.
+  __atomic_store_n(&comm->residentQueue->stop, 1, __ATOMIC_RELEASE);
+  CUDACHECK(hipStreamSynchronize(comm->residentStream));
+  CUDACHECK(hipStreamDestroy(comm->residentStream));
+  NCCLCHECK(ncclCudaHostFree(comm->residentQueue));
+  comm->residentQueue = nullptr;
+  return ncclSuccess;
+}
+
 #if CUDART_VERSION >= 12000
 // NCCL uses the "Remote" Mem Sync domain by default
 NCCL_PARAM(MemSyncDomain, "MEM_SYNC_DOMAIN", cudaLaunchMemSyncDomainRemote);
 #endif
 
 ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  ncclChromeTraceScope traceScope("ncclLaunchKernel", comm->opCount);
   struct ncclTasks* tasks = &comm->tasks;
   void *fn = plan->kernelFn;
   cudaStream_t launchStream = tasks->streams->stream;
@@ -1009,8 +1592,40 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
   dim3 block = {(unsigned)plan->threadPerBlock, 1, 1};
   size_t smem = ncclShmemDynamicSize(comm->cudaArch);
   void *args[3] = {&comm->devComm, &plan->channelMask, &plan->workHead};
+  // Graph captured plans, plans using channels outside of the resident
+  // kernel's blocks and plans on a default stream go through a regular launch.
+  bool defaultStream = launchStream == nullptr || launchStream == hipStreamPerThread;
+  if (rcclParamResidentKernel() && defaultStream) {
+    static bool warned = false;
+    if (!warned) {
+      warned = true;
+      WARN("RCCL_RESIDENT_KERNEL: not used for collectives on the default stream, which is likely to be synchronized device-wide");
+    }
+  }
+  if (rcclParamResidentKernel() && !plan->persistent && !defaultStream) {
+    if (comm->residentQueue == nullptr) NCCLCHECK(residentKernelStart(comm));
+    if (plan->channelUbound <= comm->residentNBlocks) {
+      NCCLCHECK(residentKernelRing(comm, plan, launchStream));
+      if (tasks->numStreams == 1) {
+        CUDACHECK(hipEventRecord(comm->doneEvent, launchStream));
+        comm->lastStream = launchStream;
+      }
+      return ncclSuccess;
+    }
+  }
   if (tasks->numStreams == 1) {
-    CUDACHECK(hipExtLaunchKernel(plan->kernelFn, grid, block, args, 0, tasks->streams->stream, NULL, comm->doneEvent, 0));
+    hipEvent_t start = NULL, stop = NULL;
+    if (plan->tuneSample && plan->collOpCount == 1 && !plan->persistent) {
+      ncclTunerSampleLaunched(plan->tuneSample, &start, &stop);
+    } else if (plan->bwSample && plan->collOpCount == 1 && !plan->persistent) {
+      NCCLCHECK(ncclBwReportLaunched(comm, plan, &start, &stop));
+    }
+    if (stop) {
+      CUDACHECK(hipExtLaunchKernel(plan->kernelFn, grid, block, args, 0, tasks->streams->stream, start, stop, 0));
+      CUDACHECK(hipEventRecord(comm->doneEvent, tasks->streams->stream));
+    } else {
+      CUDACHECK(hipExtLaunchKernel(plan->kernelFn, grid, block, args, 0, tasks->streams->stream, NULL, comm->doneEvent, 0));
+    }
     comm->lastStream = tasks->streams->stream;
     return ncclSuccess;
   }
@@ -1066,6 +1681,53 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
   return ncclSuccess;
 }
 
+RCCL_PARAM(FusedLaunch, "FUSED_LAUNCH", 0);
+
+// Whether `plan` of `comm` can join a fused launch started by `plan0` of
+// `comm0` which already occupies `nBlocks` blocks.
+bool ncclLaunchCanFuse(struct ncclComm* comm0, struct ncclKernelPlan* plan0, struct ncclComm* comm, struct ncclKernelPlan* plan, int nBlocks) {
+  if (comm == comm0 || comm->cudaDev != comm0->cudaDev) return false;
+  if (plan->persistent || plan0->persistent || rcclParamResidentKernel()) return false;
+  // Only the generic kernel has a fused variant.
+  if (plan->kernelFn != ncclKernelGeneric || plan0->kernelFn != ncclKernelGeneric) return false;
+  if (comm->tasks.numStreams != 1 || comm0->tasks.numStreams != 1) return false;
+  if (comm->tasks.streams->stream != comm0->tasks.streams->stream) return false;
+  return nBlocks + plan->channelCount <= MAXCHANNELS;
+}
+
+// Launch plans of several comms as a single kernel, one block per channel of
+// each plan. Work FIFOs were already uploaded by ncclLaunchKernelBefore.
+ncclResult_t ncclLaunchKernelFused(int nPlans, struct ncclComm** comms, struct ncclKernelPlan** plans) {
+  ncclChromeTraceScope traceScope("ncclLaunchKernelFused", comms[0]->opCount);
+  struct ncclFusedLaunch launch;
+  int nBlocks = 0;
+  int threadPerBlock = 0;
+  for (int p=0; p < nPlans; p++) {
+    struct ncclKernelPlan* plan = plans[p];
+    int workIx = 0;
+    for (int c=0; c < plan->channelUbound; c++) {
+      if ((plan->channelMask & (1ull<<c)) == 0) continue;
+      launch.blocks[nBlocks].comm = comms[p]->devComm;
+      launch.blocks[nBlocks].workHead = plan->workHead;
+      launch.blocks[nBlocks].channelId = c;
+      launch.blocks[nBlocks].workIx = workIx++;
+      nBlocks++;
+    }
+    threadPerBlock = std::max(threadPerBlock, plan->threadPerBlock);
+  }
+  cudaStream_t launchStream = comms[0]->tasks.streams->stream;
+  dim3 grid = {(unsigned)nBlocks, 1, 1};
+  dim3 block = {(unsigned)threadPerBlock, 1, 1};
+  void *args[1] = {&launch};
+  CUDACHECK(hipExtLaunchKernel((void*)ncclFusedKernel, grid, block, args, 0, launchStream, NULL, comms[0]->doneEvent, 0));
+  for (int p=0; p < nPlans; p++) {
+    if (p != 0) CUDACHECK(hipEventRecord(comms[p]->doneEvent, launchStream));
+    comms[p]->lastStream = launchStream;
+  }
+  TRACE(NCCL_COLL, "Fused launch of %d plans on %d blocks", nPlans, nBlocks);
+  return ncclSuccess;
+}
+
 ncclResult_t ncclLaunchKernelAfter_NoCuda(struct ncclComm* comm, struct ncclKernelPlan* plan) {
   if (!(plan->persistent || comm->persistentRefs != 0 || ncclCudaLaunchBlocking)) {
     // If this isn't being captured and there aren't any CUDA graphs alive
@@ -1123,9 +1785,47 @@ static inline ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNet
   return ncclSuccess;
 }
 
+// The tuner plugin either picks the algorithm and protocol itself or updates the model costs to pick from.
+static ncclResult_t tunerPluginSelect(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps, float times[][NCCL_NUM_PROTOCOLS], int* nChannels, bool* tuned) {
+  struct ncclComm* comm = info->comm;
+  static bool warned = false;
+  float costs[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  memcpy(costs, times, sizeof(costs));
+  int a = -1, p = -1, nc = 0;
+  if (comm->tunerPlugin->getCollInfo(comm->tunerPluginContext, info->coll, info->nBytes, collNetTypeSupport,
+        comm->nvlsSupport, numPipeOps, costs, &a, &p, &nc) != ncclSuccess) {
+    if (!warned) WARN("Tuner plugin %s failed for %s of %ld bytes, using the model", comm->tunerPlugin->name, ncclFuncStr[info->coll], info->nBytes);
+    warned = true;
+    return ncclSuccess;
+  }
+  if (a < 0 || p < 0) {
+    float minTime = -1;
+    for (int x=0; x<NCCL_NUM_ALGORITHMS; x++) {
+      for (int y=0; y<NCCL_NUM_PROTOCOLS; y++) {
+        if (times[x][y] < 0 || costs[x][y] < 0 || (minTime >= 0 && costs[x][y] >= minTime)) continue;
+        a = x;
+        p = y;
+        minTime = costs[x][y];
+      }
+    }
+    if (minTime < 0) return ncclSuccess;
+  } else if (a >= NCCL_NUM_ALGORITHMS || p >= NCCL_NUM_PROTOCOLS || times[a][p] < 0) {
+    if (!warned) WARN("Tuner plugin %s picked unavailable algorithm %d protocol %d for %s, using the model", comm->tunerPlugin->name, a, p, ncclFuncStr[info->coll]);
+    warned = true;
+    return ncclSuccess;
+  }
+  info->algorithm = a;
+  info->protocol = p;
+  *nChannels = std::max(nc, 0);
+  *tuned = true;
+  return ncclSuccess;
+}
+
 // numPipeOps: number of pipelined ops. Can be greater than 1 in aggregation mode. Used to adjust latency.
 static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps) {
   struct ncclComm* comm = info->comm;
+  bool tuned = false;
+  int tunedChannels = 0, tunedThreads = 0;
   if (comm->nRanks == 1 || info->coll == ncclFuncAllToAllPivot) {
     info->algorithm = NCCL_ALGO_RING;
     info->protocol = NCCL_PROTO_SIMPLE;
@@ -1135,6 +1835,8 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
     // Find algorithm / protocol.
     info->algorithm = -1;
     info->protocol = -1;
+    float times[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+    for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) times[a][p] = -1;
     int nAlgos = NCCL_NUM_ALGORITHMS;
     for (int a=0; a<nAlgos; a++) {
       if ((a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) && collNetTypeSupport != 1) continue;
@@ -1145,6 +1847,7 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
       for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
         float time;
         NCCLCHECK(ncclTopoGetAlgoTime(info, a, p, numPipeOps, &time));
+        times[a][p] = time;
         if (time >= 0 && time < minTime) {
           info->algorithm = a;
           info->protocol = p;
@@ -1158,9 +1861,20 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
     }
     //if (comm->rank == 0) INFO(NCCL_TUNING, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
     TRACE(NCCL_COLL, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
+    struct ncclTuningRule* rule = ncclTopoGetTuningRule(info);
+    if (rule && times[rule->algorithm][rule->protocol] >= 0) {
+      info->algorithm = rule->algorithm;
+      info->protocol = rule->protocol;
+      tunedChannels = rule->nChannels;
+      tunedThreads = rule->nThreads;
+      tuned = true;
+    }
+    if (comm->tunerPlugin && !tuned) NCCLCHECK(tunerPluginSelect(info, collNetTypeSupport, numPipeOps, times, &tunedChannels, &tuned));
+    if (info->tune && !tuned) NCCLCHECK(ncclTunerSelect(info, times, &tunedChannels, &tuned));
   }
 
   int nc = (info->nChannels > 0) ? info->nChannels : comm->nChannels;
+  if (info->maxChannels > 0) nc = std::min(nc, info->maxChannels);
   int nt = comm->maxThreads[info->algorithm][info->protocol];
   int threadThreshold = comm->threadThresholds[info->algorithm][info->protocol];
   if (info->algorithm == NCCL_ALGO_COLLNET_DIRECT) {
@@ -1179,7 +1893,10 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
     nc = comm->nvlsChannels;
   } else {
     // Ring/Tree channel tuning
-    while (info->nBytes < nc*nt*threadThreshold) {
+    int modelChannels;
+    NCCLCHECK(ncclTopoGetAlgoChannels(info, info->algorithm, info->protocol, nc, &modelChannels));
+    if (modelChannels > 0) nc = modelChannels;
+    else while (info->nBytes < nc*nt*threadThreshold) {
       if (nc >= 2) nc--;
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
       // do not reduce threads count on VEGA
@@ -1189,6 +1906,7 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
       else break;
     }
   }
+  if (tunedChannels > 0) nc = std::min(tunedChannels, comm->nChannels);
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
 #else
   if (info->protocol == NCCL_PROTO_SIMPLE) {
@@ -1201,6 +1919,9 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
   if (info->coll == ncclFuncAllToAllPivot) {
     int pivotA2ANumUniRings = comm->topo->pivotA2ANumBiRings * 2;
     info->nChannels = comm->nChannels / pivotA2ANumUniRings * pivotA2ANumUniRings;
+  } else if (tuned) {
+    // Picked by a tuner, not subject to the fixed overrides below
+    info->nChannels = nc;
   } else if (info->coll == ncclFuncAllReduce && comm->topo->pivotA2ANumBiRings == 3) {
     static int userTuneInput = -2;
     if (userTuneInput == -2) {
@@ -1229,7 +1950,16 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
   } else {
     info->nChannels = nc;
   }
-  info->nThreads = nt;
+  if (info->maxChannels > 0 && info->nChannels > info->maxChannels) {
+    // CU budget of the group, the pivot alltoall still needs whole rings
+    if (info->coll == ncclFuncAllToAllPivot) {
+      int pivotA2ANumUniRings = comm->topo->pivotA2ANumBiRings * 2;
+      info->nChannels = std::max(pivotA2ANumUniRings, info->maxChannels / pivotA2ANumUniRings * pivotA2ANumUniRings);
+    } else {
+      info->nChannels = info->maxChannels;
+    }
+  }
+  info->nThreads = tunedThreads > 0 ? tunedThreads : nt;
   return ncclSuccess;
 }
 
@@ -1289,13 +2019,83 @@ static ncclResult_t getLoopInfo(struct ncclInfo* info) {
 
 RCCL_PARAM(IntraNetThreshold, "INTRANET_THRESHOLD", 8388608);
 
+// Returns the cache slot for the signature of `info`. Whether the slot holds a
+// matching entry must still be checked with algoCacheMatch().
+static inline struct ncclAlgoCacheEntry* algoCacheSlot(struct ncclComm* comm, struct ncclInfo const* info) {
+  uint64_t h = info->count;
+  h ^= uint64_t(info->coll) | uint64_t(info->datatype)<<8 | uint64_t(info->opFull.op)<<16 | uint64_t(info->chunkSteps)<<24 | uint64_t(info->sliceSteps)<<40 |
+       uint64_t(info->maxChannels)<<56;
+  h *= 0x9e3779b97f4a7c13u; // Knuth's 64-bit magical hash constant
+  return &comm->algoCache[(h >> 32) & (comm->algoCacheSize-1)];
+}
+
+static inline bool algoCacheMatch(struct ncclComm* comm, struct ncclAlgoCacheEntry const* e, struct ncclInfo const* info) {
+  return e->epoch == comm->algoCacheEpoch && e->count == info->count && e->coll == info->coll &&
+         e->datatype == info->datatype && e->op == info->opFull.op &&
+         e->chunkSteps == info->chunkSteps && e->sliceSteps == info->sliceSteps && e->maxChannels == info->maxChannels;
+}
+
+RCCL_PARAM(P2pReadColl, "P2P_READ_COLL", 1);
+RCCL_PARAM(RingNetMinLoops, "RING_NET_MIN_LOOPS", 2); // Loops per channel of a multi-node ring allreduce, 0 to keep full chunks
+RCCL_PARAM(RingNetMinChunkSize, "RING_NET_MIN_CHUNK_SIZE", 262144);
+
 static ncclResult_t computeColl(struct ncclInfo* info /* input */, int* workFuncIndex, struct ncclWorkElem* work, struct ncclProxyOp* proxyOp /* output */) {
   int collNetTypeSupport = 0;
+  struct ncclAlgoCacheEntry* cacheEntry = nullptr;
+  // Only the ring kernels write the ready flags of ncclCommSetReadyFlags()
+  bool ringOnly = info->coll == ncclFuncAllGather && info->comm->readyFlags != nullptr;
   // Check whether algo and proto have been preset (as in aggregation case)
   // If so, skip the calculation
   if (info->nChannels > 0 && info->nThreads > 0) goto comp_next;
+  if (info->update != nullptr) {
+    // The update runs between the two halves of the ring allreduce kernel,
+    // which only exists for the simple protocol.
+    info->algorithm = NCCL_ALGO_RING;
+    info->protocol = NCCL_PROTO_SIMPLE;
+    info->nChannels = info->comm->nChannels;
+    info->nThreads = info->comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE];
+    goto comp_next;
+  }
+  // A tuner plugin may change its mind from call to call, so it is asked every time
+  if (info->comm->algoCacheSize > 0 && info->comm->nRanks > 1 && !ringOnly && info->comm->tunerPlugin == nullptr) {
+    cacheEntry = algoCacheSlot(info->comm, info);
+    if (algoCacheMatch(info->comm, cacheEntry, info)) {
+      // Same signature seen before: replay the decision and only patch the
+      // fields which vary from call to call.
+      info->comm->algoCacheHits++;
+      info->algorithm = cacheEntry->algorithm;
+      info->protocol = cacheEntry->protocol;
+      info->nChannels = cacheEntry->nChannels;
+      info->nThreads = cacheEntry->nThreads;
+      info->pattern = cacheEntry->pattern;
+      info->nstepsPerLoop = cacheEntry->nstepsPerLoop;
+      info->nchunksPerLoop = cacheEntry->nchunksPerLoop;
+      *workFuncIndex = cacheEntry->workFuncIndex;
+      *work = cacheEntry->work; // C++ struct assignment
+      work->sendbuff = info->sendbuff;
+      work->recvbuff = info->recvbuff;
+      work->root = info->root;
+      work->redOpArg = info->opFull.scalarArg;
+      work->redOpArgIsPtr = info->opFull.scalarArgIsPtr;
+      work->epilogue = info->opFull.epilogue;
+      work->opCount = info->comm->opCount;
+      *proxyOp = cacheEntry->proxyOp; // C++ struct assignment
+      proxyOp->root = info->root;
+      return ncclSuccess;
+    }
+    info->comm->algoCacheMisses++;
+  }
   NCCLCHECK(getCollNetSupport(info, &collNetTypeSupport));
+  info->tune = true;
   NCCLCHECK(getAlgoInfo(info, collNetTypeSupport, 1));
+  if (info->tuneExploring) cacheEntry = nullptr;
+  if (ringOnly && info->algorithm != NCCL_ALGO_RING) {
+    info->algorithm = NCCL_ALGO_RING;
+    info->protocol = NCCL_PROTO_SIMPLE;
+    info->nChannels = info->comm->nChannels;
+    info->nThreads = info->comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE];
+    info->tuneSample = nullptr; // Would time the ring instead of the tuner candidate
+  }
 
 comp_next:
   // Set nstepsPerLoop and nchunksPerLoop
@@ -1309,6 +2109,7 @@ comp_next:
   work->nWarps = info->nThreads / info->comm->WarpSize;
   work->redOpArg = info->opFull.scalarArg;
   work->redOpArgIsPtr = info->opFull.scalarArgIsPtr;
+  work->epilogue = info->opFull.epilogue;
   work->opCount = info->comm->opCount;
 
   if (info->comm->nRanks == 1) {
@@ -1329,6 +2130,12 @@ comp_next:
       proxyOp->connIndex = NCCL_CONN_IDX_P2P_NET;
     }
   }
+  // Ring allgather pulls straight from the output buffer of the previous rank over P2P read
+  // connections (NCCL_P2P_READ_ENABLE), the kernel falls back per connection otherwise
+  if (info->coll == ncclFuncAllGather && info->algorithm == NCCL_ALGO_RING && info->protocol == NCCL_PROTO_SIMPLE &&
+      rcclParamP2pReadColl()) {
+    work->direct = NCCL_DIRECT_READ_RING;
+  }
 
   int stepSize   = info->comm->buffSizes[info->protocol]/NCCL_STEPS;
   int chunkSteps = (info->protocol == NCCL_PROTO_SIMPLE && info->algorithm == NCCL_ALGO_RING) ? info->chunkSteps : 1;
@@ -1378,6 +2185,17 @@ comp_next:
     if ((info->nBytes < (4 * (concurrentOps*chunkSize))) && (chunkSize > 65536)) chunkSize = 65536;
     if ((info->nBytes < (1 * (concurrentOps*chunkSize))) && (chunkSize > 32768)) chunkSize = 32768;
     work->lastChunkSize = chunkSize / ncclTypeSize(info->datatype);
+  } else if (info->algorithm == NCCL_ALGO_RING && info->protocol == NCCL_PROTO_SIMPLE && info->coll == ncclFuncAllReduce &&
+             info->update == nullptr && info->comm->nNodes > 1 && rcclParamRingNetMinLoops() > 0) {
+    // Rings crossing the network pipeline mid-size allreduces deeper with smaller chunks, rings within
+    // a node keep full chunks since xGMI steps are cheap. Every rank sees the same nNodes and so picks
+    // the same chunk size.
+    while (info->nBytes / ((size_t)info->nChannels*info->comm->nRanks*chunkSize) < rcclParamRingNetMinLoops() &&
+           chunkSize > rcclParamRingNetMinChunkSize()) chunkSize /= 2;
+    // The kernel rounds chunks up to a multiple of this, which must not overflow the steps
+    int align = info->nThreads*sizeof(uint64_t);
+    chunkSize = std::max(align, chunkSize/align*align);
+    if (chunkSize != stepSize*chunkSteps) work->lastChunkSize = chunkSize / ncclTypeSize(info->datatype);
   } else if (info->protocol == NCCL_PROTO_LL) {
     const ssize_t sliceSize = stepSize*sizeof(uint64_t)/sizeof(union ncclLLFifoLine);
     const ssize_t loopSize = info->nChannels*info->nchunksPerLoop*(ssize_t)sliceSize;
@@ -1422,6 +2240,27 @@ comp_next:
   TRACE(NCCL_COLL,"opCount %lx slicesteps %d spl %d cpl %d nbytes %zi -> protocol %d nchannels %d nthreads %d, nloops %d nsteps %d chunksize %d comm %p",
       proxyOp->opCount, sliceSteps, info->nstepsPerLoop, info->nchunksPerLoop, info->nBytes, info->protocol, info->nChannels, info->nThreads,
       nLoops, proxyOp->nsteps, chunkSize, info->comm);
+
+  if (cacheEntry != nullptr) {
+    cacheEntry->epoch = info->comm->algoCacheEpoch;
+    cacheEntry->coll = info->coll;
+    cacheEntry->datatype = info->datatype;
+    cacheEntry->op = info->opFull.op;
+    cacheEntry->chunkSteps = info->chunkSteps;
+    cacheEntry->sliceSteps = info->sliceSteps;
+    cacheEntry->maxChannels = info->maxChannels;
+    cacheEntry->count = info->count;
+    cacheEntry->algorithm = info->algorithm;
+    cacheEntry->protocol = info->protocol;
+    cacheEntry->nChannels = info->nChannels;
+    cacheEntry->nThreads = info->nThreads;
+    cacheEntry->pattern = info->pattern;
+    cacheEntry->nstepsPerLoop = info->nstepsPerLoop;
+    cacheEntry->nchunksPerLoop = info->nchunksPerLoop;
+    cacheEntry->workFuncIndex = *workFuncIndex;
+    cacheEntry->work = *work; // C++ struct assignment
+    cacheEntry->proxyOp = *proxyOp; // C++ struct assignment
+  }
   return ncclSuccess;
 }
 
@@ -1445,6 +2284,7 @@ static ncclResult_t hostToDevRedOp(
   };
   u64 = 0;
   opFull->scalarArgIsPtr = false;
+  opFull->epilogue = false;
   switch (int(op)) {
   case ncclSum:  opFull->op = ncclDevSum;  break;
   case ncclProd: opFull->op = ncclDevProd; break;
@@ -1468,6 +2308,8 @@ static ncclResult_t hostToDevRedOp(
       break;
     #endif
     case ncclFloat32:
+    case ncclFloat8e4m3:
+    case ncclFloat8e5m2:
       opFull->op = ncclDevPreMulSum;
       f32 = float(1.0/comm->nRanks);
       break;
@@ -1493,10 +2335,39 @@ static ncclResult_t hostToDevRedOp(
   return ncclSuccess;
 }
 
+// Whether a reduction leaves the data unchanged on a single rank: the builtin
+// operators, and multiplications or divisions by one such as ncclAvg. These are
+// copies, and nothing at all in place.
+static bool oneRankRedOpIsCopy(struct ncclDevRedOpFull const* opFull, ncclDataType_t datatype) {
+  if (opFull->epilogue) return false;
+  if (opFull->op < ncclDevPreMulSum) return true;
+  if (opFull->scalarArgIsPtr) return false;
+  if (opFull->op == ncclDevSumPostDiv) return opFull->scalarArg == 1;
+  if (opFull->op != ncclDevPreMulSum) return false;
+  uint64_t one;
+  size_t bytes = ncclTypeSize(datatype);
+  switch ((int)datatype) {
+  case ncclInt8:  case ncclInt32:  case ncclInt64:
+  case ncclUint8: case ncclUint32: case ncclUint64:
+    one = 1; break;
+  case ncclFloat16: one = 0x3c00; break;
+  case ncclBfloat16: one = 0x3f80; break;
+  case ncclFloat32: one = 0x3f800000; break;
+  case ncclFloat8e4m3: case ncclFloat8e5m2: // Scalars of fp8 types are floats
+    one = 0x3f800000; bytes = sizeof(float); break;
+  case ncclFloat64: one = 0x3ff0000000000000; break;
+  default: return false;
+  }
+  uint64_t mask = bytes == 8 ? ~uint64_t(0) : (uint64_t(1)<<(8*bytes))-1;
+  return (opFull->scalarArg & mask) == one;
+}
+
 // Converts `info` to a task and adds it to `comm->tasks`. The exception is with
 // single rank communicators, collectives are issued as `ncclMemcpyAsync`s and
 // thus don't need a task.
-static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* info) {
+// p2pTask or collTask, when given, is a zeroed task already allocated in `comm->memScoped`.
+static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* info,
+    struct ncclTaskP2p* p2pTask = nullptr, struct ncclTaskColl* collTask = nullptr) {
   ncclTasks *tasks = &comm->tasks;
   if (info->coll == ncclFuncSend || info->coll == ncclFuncRecv) {
     int peer = info->root;
@@ -1505,7 +2376,7 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* inf
 
     // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
     ncclGroupCommJoin(info->comm);
-    struct ncclTaskP2p* p2p = ncclMemoryStackAlloc<struct ncclTaskP2p>(&comm->memScoped);
+    struct ncclTaskP2p* p2p = p2pTask ? p2pTask : ncclMemoryStackAlloc<struct ncclTaskP2p>(&comm->memScoped);
     p2p->buff = (void*)info->recvbuff;
     p2p->bytes = nBytes;
     p2p->chunk = 0;
@@ -1513,31 +2384,36 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* inf
       isSendNotRecv ? &tasks->peers[peer].sendQueue : &tasks->peers[peer].recvQueue,
       p2p);
     tasks->nTasksP2p += 1;
+    comm->stats[ncclStatsSendRecv].calls++;
+    comm->stats[ncclStatsSendRecv].bytes += nBytes;
 
     // Mark channels that need pre-connect
     if (comm->rank != peer) {
       int channelBaseId;
       NCCLCHECK(ncclChannelComputeBase(comm, peer, info->coll, &channelBaseId));
-      if (!(isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen)) {
-        (isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen) = true;
-        for (int c=0; c < comm->p2pnChannelsPerPeer; c++) {
+      int* seen = isSendNotRecv ? &tasks->peers[peer].sendSeen : &tasks->peers[peer].recvSeen;
+      int nPeerChannels = p2pPeerNChannels(comm, nBytes);
+      if (*seen < nPeerChannels) {
+        int c0 = *seen;
+        *seen = nPeerChannels;
+        for (int c=c0; c < nPeerChannels; c++) {
           int channelId;
           NCCLCHECK(ncclChannelComputeFromBase(comm, channelBaseId, c, &channelId));
           if (isSendNotRecv) {
-            if (comm->channels[channelId].peers[peer]->send[1].connected == 0) { // P2P uses only 1 connector
+            if (!ncclChannelPeerConnected(comm->channels+channelId, peer, true, 1)) { // P2P uses only 1 connector
               comm->connectSend[peer] |= (1UL<<channelId);
               ncclGroupCommPreconnect(comm);
             }
-            if (comm->p2pNet && comm->channels[channelId].peers[peer]->send[NCCL_CONN_IDX_P2P_NET].connected == 0) {
+            if (comm->p2pNet && !ncclChannelPeerConnected(comm->channels+channelId, peer, true, NCCL_CONN_IDX_P2P_NET)) {
               comm->connectSend[peer+comm->nRanks*NCCL_CONN_IDX_P2P_NET] |= (1UL<<channelId);
               ncclGroupCommPreconnect(comm);
             }
           } else {
-            if (comm->channels[channelId].peers[peer]->recv[1].connected == 0) { // P2P uses only 1 connector
+            if (!ncclChannelPeerConnected(comm->channels+channelId, peer, false, 1)) { // P2P uses only 1 connector
               comm->connectRecv[peer] |= (1UL<<channelId);
               ncclGroupCommPreconnect(comm);
             }
-            if (comm->p2pNet && comm->channels[channelId].peers[peer]->recv[NCCL_CONN_IDX_P2P_NET].connected == 0) {
+            if (comm->p2pNet && !ncclChannelPeerConnected(comm->channels+channelId, peer, false, NCCL_CONN_IDX_P2P_NET)) {
               comm->connectRecv[peer+comm->nRanks*NCCL_CONN_IDX_P2P_NET] |= (1UL<<channelId);
               ncclGroupCommPreconnect(comm);
             }
@@ -1550,18 +2426,23 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* inf
     // op handle may be destroyed before ncclGroupEnd().
     struct ncclDevRedOpFull opFull;
     NCCLCHECK(hostToDevRedOp(&opFull, info->op, info->datatype, comm));
+    if (opFull.epilogue && info->coll != ncclFuncAllReduce) {
+      WARN("%s : reduction operators with an epilogue are only supported by AllReduce", info->opName);
+      return ncclInvalidArgument;
+    }
 
     // User-defined reduction ops may need alter the data even for unitary reductions
-    if (comm->nRanks == 1 && opFull.op < ncclDevPreMulSum) {
+    if (comm->nRanks == 1 && oneRankRedOpIsCopy(&opFull, info->datatype) && info->update == nullptr) {
       if (info->sendbuff != info->recvbuff) {
         size_t bytes = info->count*ncclTypeSize(info->datatype);
         CUDACHECK(cudaMemcpyAsync(info->recvbuff, info->sendbuff, bytes, cudaMemcpyDeviceToDevice, info->stream));
+        NCCLCHECK(ncclCaptureRecordBuffers(comm, info->stream, info->sendbuff, bytes, info->recvbuff, bytes));
       }
       return ncclSuccess;
     } else {
       // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
       ncclGroupCommJoin(info->comm);
-      struct ncclTaskColl* t = ncclMemoryStackAlloc<struct ncclTaskColl>(&comm->memScoped);
+      struct ncclTaskColl* t = collTask ? collTask : ncclMemoryStackAlloc<struct ncclTaskColl>(&comm->memScoped);
       t->func = info->coll;
       t->sendbuff = info->sendbuff;
       t->recvbuff = info->recvbuff;
@@ -1571,6 +2452,11 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* inf
       t->op = opFull; // C++ struct assignment
       t->chunkSteps = info->chunkSteps;
       t->sliceSteps = info->sliceSteps;
+      t->maxChannels = ncclGroupMaxCTAs;
+      if (info->update != nullptr) {
+        t->update = ncclMemoryStackAlloc<struct ncclDevUpdate>(&comm->memScoped);
+        *t->update = *info->update; // C++ struct assignment
+      }
       ncclIntruQueueEnqueue(&tasks->collQueue, t);
       tasks->collBytesTotal += info->nBytes;
       tasks->nTasksColl += 1;
@@ -1605,7 +2491,24 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* inf
   return ncclSuccess;
 }
 
+// Host time of the call for rccl_replayer, on the clock of rank 0 when clocks are synchronized
+static uint64_t enqueueTimeUs() {
+  return ncclDebugLevel >= NCCL_LOG_INFO && (ncclDebugMask & NCCL_COLL) ? ncclClockSyncToGlobal(ncclChromeTraceNow())/1000 : 0;
+}
+
+static void enqueueLog(struct ncclInfo* info, uint64_t timeUs) {
+  if (ncclCallRecordOn) ncclCallRecordAdd(info);
+  INFO(NCCL_COLL,"%s: opCount %lx sendbuff %p recvbuff %p count %zi datatype %d op %d root %d comm %p [nranks=%d] stream %p task %d globalrank %d timeUs %lu",
+      info->opName, info->comm->opCount, info->sendbuff, info->recvbuff, info->count,
+      info->datatype, info->op, info->root, info->comm, info->comm->nRanks, info->stream,
+      info->comm->tasks.nTasksP2p + info->comm->tasks.nTasksColl,
+      info->comm->localRankToRank[info->comm->localRank], timeUs);
+  TRACE_CALL("nccl%s(%" PRIx64 ",%" PRIx64 ",%zi,%d,%d,%d,%p,%p)", info->opName, reinterpret_cast<int64_t>(info->sendbuff), reinterpret_cast<int64_t>(info->recvbuff), info->count, info->datatype, info->op, info->root, info->comm, info->stream);
+}
+
 ncclResult_t ncclEnqueueCheck(struct ncclInfo* info) {
+  ncclChromeTraceScope traceScope(info->opName, info->comm ? info->comm->opCount : 0,
+    info->count*std::max(0, ncclTypeSize(info->datatype)));
   NCCLCHECK(ncclGroupStartInternal());
   ncclResult_t ret = ncclSuccess;
   int devOld = -1;
@@ -1619,13 +2522,7 @@ ncclResult_t ncclEnqueueCheck(struct ncclInfo* info) {
     CUDACHECKGOTO(cudaSetDevice(info->comm->cudaDev), ret, fail);
   }
   NCCLCHECKGOTO(ArgsCheck(info), ret, fail);
-
-  INFO(NCCL_COLL,"%s: opCount %lx sendbuff %p recvbuff %p count %zi datatype %d op %d root %d comm %p [nranks=%d] stream %p task %d globalrank %d",
-      info->opName, info->comm->opCount, info->sendbuff, info->recvbuff, info->count,
-      info->datatype, info->op, info->root, info->comm, info->comm->nRanks, info->stream,
-      info->comm->tasks.nTasksP2p + info->comm->tasks.nTasksColl,
-      info->comm->localRankToRank[info->comm->localRank]);
-  TRACE_CALL("nccl%s(%" PRIx64 ",%" PRIx64 ",%zi,%d,%d,%d,%p,%p)", info->opName, reinterpret_cast<int64_t>(info->sendbuff), reinterpret_cast<int64_t>(info->recvbuff), info->count, info->datatype, info->op, info->root, info->comm, info->stream);
+  enqueueLog(info, enqueueTimeUs());
 
   NCCLCHECKGOTO(taskAppend(info->comm, info), ret, fail);
 
@@ -1642,12 +2539,58 @@ fail:
   goto exit;
 }
 
-NCCL_API(ncclResult_t, ncclRedOpCreatePreMulSum, ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm);
-ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm) {
-  NCCLCHECK(PtrCheck(comm, "ncclRedOpCreatePreMulSum", "comm"));
-  /* join init thread before creating PreMulSum op. */
-  NCCLCHECK(ncclCommEnsureReady(comm));
+ncclResult_t ncclEnqueueCheckBatch(struct ncclComm* comm, struct ncclInfo* infos, int nInfos) {
+  ncclChromeTraceScope traceScope("GroupSubmit", comm ? comm->opCount : 0);
+  NCCLCHECK(ncclGroupStartInternal());
+  ncclResult_t ret = ncclSuccess;
+  int devOld = -1;
+  int nP2p = 0, nColl = 0;
+  struct ncclTaskP2p* p2pTasks = nullptr;
+  struct ncclTaskColl* collTasks = nullptr;
+  uint64_t timeUs;
 
+  NCCLCHECKGOTO(PtrCheck(comm, "GroupSubmit", "comm"), ret, fail);
+  // Check whether communicator is ready to communicate
+  NCCLCHECKGOTO(ncclCommEnsureReady(comm), ret, fail);
+
+  if (comm->checkPointers) {
+    CUDACHECKGOTO(cudaGetDevice(&devOld), ret, fail);
+    CUDACHECKGOTO(cudaSetDevice(comm->cudaDev), ret, fail);
+  }
+  // Nothing is appended unless every operation is valid
+  for (int i = 0; i < nInfos; i++) {
+    NCCLCHECKGOTO(ArgsCheck(&infos[i]), ret, fail);
+    if (infos[i].coll == ncclFuncSend || infos[i].coll == ncclFuncRecv) nP2p++;
+    else nColl++;
+  }
+
+  // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
+  ncclGroupCommJoin(comm);
+  if (nP2p) p2pTasks = ncclMemoryStackAlloc<struct ncclTaskP2p>(&comm->memScoped, nP2p);
+  if (nColl) collTasks = ncclMemoryStackAlloc<struct ncclTaskColl>(&comm->memScoped, nColl);
+  timeUs = enqueueTimeUs();
+  for (int i = 0; i < nInfos; i++) {
+    struct ncclInfo* info = &infos[i];
+    enqueueLog(info, timeUs);
+    if (info->coll == ncclFuncSend || info->coll == ncclFuncRecv) {
+      NCCLCHECKGOTO(taskAppend(comm, info, p2pTasks++, nullptr), ret, fail);
+    } else {
+      NCCLCHECKGOTO(taskAppend(comm, info, nullptr, collTasks++), ret, fail);
+    }
+  }
+
+exit:
+  if (devOld != -1) CUDACHECK(cudaSetDevice(devOld));
+  ncclGroupErrCheck(ret);
+  NCCLCHECK(ncclGroupEndInternal());
+  if (comm && !comm->config.blocking) { NCCLCHECK(ncclCommGetAsyncError(comm, &ret)) };
+  return ret;
+fail:
+  if (comm && !comm->config.blocking) (void) ncclCommSetAsyncError(comm, ret);
+  goto exit;
+}
+
+static ncclUserRedOp* ncclUserRedOpAlloc(ncclComm_t comm, ncclDataType_t datatype, ncclRedOp_t *op) {
   if (comm->userRedOpFreeHead == comm->userRedOpCapacity) {
     // double capacity and resize
     int cap = 2*comm->userRedOpCapacity;
@@ -1667,20 +2610,72 @@ ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataTyp
 
   user->freeNext = -1; // allocated
   user->datatype = datatype;
+  user->opFull.epilogue = false;
+  *op = ncclRedOp_t(int(ncclNumOps) + ix);
+  *op = ncclUserRedOpMangle(comm, *op);
+  return user;
+}
+
+NCCL_API(ncclResult_t, ncclRedOpCreatePreMulSum, ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm);
+ncclResult_t ncclRedOpCreatePreMulSum(ncclRedOp_t *op, void *scalar, ncclDataType_t datatype, ncclScalarResidence_t residence, ncclComm_t comm) {
+  NCCLCHECK(PtrCheck(comm, "ncclRedOpCreatePreMulSum", "comm"));
+  /* join init thread before creating PreMulSum op. */
+  NCCLCHECK(ncclCommEnsureReady(comm));
+
+  ncclUserRedOp *user = ncclUserRedOpAlloc(comm, datatype, op);
   user->opFull.op = ncclDevPreMulSum;
   if (residence == ncclScalarHostImmediate) {
     user->opFull.scalarArgIsPtr = false;
-    std::memcpy(&user->opFull.scalarArg, scalar, ncclTypeSize(datatype));
+    // FP8 scalars are given as float, see FuncPreMulSum.
+    bool isFp8 = datatype == ncclFloat8e4m3 || datatype == ncclFloat8e5m2;
+    std::memcpy(&user->opFull.scalarArg, scalar, isFp8 ? sizeof(float) : ncclTypeSize(datatype));
   } else {
     user->opFull.scalarArgIsPtr = true;
     user->opFull.scalarArg = reinterpret_cast<uint64_t>(scalar);
   }
-  *op = ncclRedOp_t(int(ncclNumOps) + ix);
-  *op = ncclUserRedOpMangle(comm, *op);
   TRACE_CALL("ncclRedOpCreatePreMulSum(%d,%p,%d,%d,%p)", *op, scalar, datatype, residence, comm);
   return ncclSuccess;
 }
 
+NCCL_API(ncclResult_t, ncclRedOpCreateSumEpilogue, ncclRedOp_t *op, const ncclRedOpEpilogue_t *epilogue, ncclDataType_t datatype, ncclComm_t comm);
+ncclResult_t ncclRedOpCreateSumEpilogue(ncclRedOp_t *op, const ncclRedOpEpilogue_t *epilogue, ncclDataType_t datatype, ncclComm_t comm) {
+  NCCLCHECK(PtrCheck(comm, "ncclRedOpCreateSumEpilogue", "comm"));
+  NCCLCHECK(PtrCheck(op, "ncclRedOpCreateSumEpilogue", "op"));
+  NCCLCHECK(PtrCheck((void*)epilogue, "ncclRedOpCreateSumEpilogue", "epilogue"));
+  switch (datatype) {
+  case ncclFloat16: case ncclFloat32: case ncclFloat64: case ncclBfloat16:
+  case ncclFloat8e4m3: case ncclFloat8e5m2:
+    break;
+  default:
+    WARN("ncclRedOpCreateSumEpilogue : datatype %d is not a floating point type", datatype);
+    return ncclInvalidArgument;
+  }
+  if (!(epilogue->clip >= 0.0f)) {
+    WARN("ncclRedOpCreateSumEpilogue : clip %g must be non-negative", epilogue->clip);
+    return ncclInvalidArgument;
+  }
+  NCCLCHECK(ncclCommEnsureReady(comm));
+
+  ncclUserRedOp *user = ncclUserRedOpAlloc(comm, datatype, op);
+  // Runs the Sum kernels, the epilogue is applied by FuncSumEpilogue as the
+  // postOp of the last reduction step. Scale and clip are packed into scalarArg.
+  user->opFull.op = ncclDevSum;
+  user->opFull.scalarArgIsPtr = false;
+  user->opFull.epilogue = true;
+  float args[2] = {epilogue->scale, epilogue->clip > 0.0f ? epilogue->clip : INFINITY};
+  static_assert(sizeof(args) == sizeof(user->opFull.scalarArg), "Epilogue arguments must fit in scalarArg");
+  std::memcpy(&user->opFull.scalarArg, args, sizeof(args));
+  TRACE_CALL("ncclRedOpCreateSumEpilogue(%d,%g,%g,%d,%p)", *op, epilogue->scale, epilogue->clip, datatype, comm);
+  return ncclSuccess;
+}
+
+bool ncclRedOpHasEpilogue(struct ncclComm* comm, ncclRedOp_t op) {
+  if (int(op) < int(ncclNumOps) || int(ncclMaxRedOp) < int(op)) return false;
+  int ix = int(ncclUserRedOpMangle(comm, op)) - int(ncclNumOps);
+  if (ix < 0 || comm->userRedOpCapacity <= ix || comm->userRedOps[ix].freeNext != -1) return false;
+  return comm->userRedOps[ix].opFull.epilogue;
+}
+
 NCCL_API(ncclResult_t, ncclRedOpDestroy, ncclRedOp_t op, ncclComm_t comm);
 ncclResult_t ncclRedOpDestroy(ncclRedOp_t op, ncclComm_t comm) {
   if (0 <= int(op) && int(op) < int(ncclNumOps)) {
@@ -1707,3 +2702,155 @@ ncclResult_t ncclRedOpDestroy(ncclRedOp_t op, ncclComm_t comm) {
   TRACE_CALL("ncclRedOpDestroy(%d,%p)", op, comm);
   return ncclSuccess;
 }
+
+// Moves *ptr by newBase-oldBase when it points into [oldBase, oldBase+bytes)
+static bool rebasePtr(uint64_t* ptr, uintptr_t oldBase, uintptr_t newBase, size_t bytes) {
+  if (*ptr < oldBase || *ptr - oldBase >= bytes) return false;
+  *ptr = *ptr - oldBase + newBase;
+  return true;
+}
+
+// Patches the host copy of the works of plan, and tells whether any pointer moved. Registered
+// works hold addresses of the buffers of peers, or the proxy accesses the buffer directly, so
+// those can not be moved: pass 0 only looks for them.
+static ncclResult_t graphUpdatePlan(struct ncclKernelPlan* plan, int pass, uintptr_t oldBase, uintptr_t newBase,
+    size_t bytes, int* nUpdated) {
+  for (int i = 0; i < plan->nWorkUnits; i++) {
+    struct ncclWork* work = ncclWorkAt(plan->workHost, plan->workUnits[i]);
+    struct ncclWorkElem* elem = nullptr;
+    uint64_t p;
+    int n = 0;
+    switch (work->header.type) {
+    case ncclWorkTypeColl:
+      elem = &work->elems[0];
+      break;
+    case ncclWorkTypeUpdateColl:
+      elem = &work->updateElems[0].elem;
+      if (pass == 1) {
+        p = (uintptr_t)work->updateElems[0].update.expAvg;
+        if (rebasePtr(&p, oldBase, newBase, bytes)) { work->updateElems[0].update.expAvg = (void*)p; n++; }
+        p = (uintptr_t)work->updateElems[0].update.expAvgSq;
+        if (rebasePtr(&p, oldBase, newBase, bytes)) { work->updateElems[0].update.expAvgSq = (void*)p; n++; }
+      }
+      break;
+    case ncclWorkTypeRegColl:
+      p = (uintptr_t)work->regElems[0].elem.sendbuff;
+      if (rebasePtr(&p, oldBase, newBase, bytes)) goto registered;
+      p = (uintptr_t)work->regElems[0].elem.recvbuff;
+      if (rebasePtr(&p, oldBase, newBase, bytes)) goto registered;
+      break;
+    case ncclWorkTypeP2p:
+      for (int e = 0; e < NCCL_MAX_WORK_ELEMENTS_P2P; e++) {
+        struct ncclWorkElemP2p* p2p = &work->p2pElems[e];
+        if (p2p->p2pType == ncclWorkP2pTypeUnused) continue;
+        p = uint64_t(p2p->buffHi32)<<32 | p2p->buffLo32;
+        if (!rebasePtr(&p, oldBase, newBase, bytes)) continue;
+        if (p2p->reg) goto registered;
+        if (pass == 1) {
+          p2p->buffHi32 = p>>32;
+          p2p->buffLo32 = uint32_t(p);
+          n++;
+        }
+      }
+      break;
+    default:
+      break;
+    }
+    if (elem && elem->isUsed && pass == 1) {
+      p = (uintptr_t)elem->sendbuff;
+      if (rebasePtr(&p, oldBase, newBase, bytes)) { elem->sendbuff = (const void*)p; n++; }
+      p = (uintptr_t)elem->recvbuff;
+      if (rebasePtr(&p, oldBase, newBase, bytes)) { elem->recvbuff = (void*)p; n++; }
+      if (elem->redOpArgIsPtr && rebasePtr(&elem->redOpArg, oldBase, newBase, bytes)) n++;
+    }
+    *nUpdated += n;
+    continue;
+  registered:
+    WARN("CommGraphUpdateBuffers : buffer %p of a captured operation was registered for peer access, "
+        "re-capture instead or capture with NCCL_GRAPH_REGISTER=0", (void*)oldBase);
+    return ncclInvalidUsage;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t reclaimCapturedBuffers(struct ncclComm* comm, struct ncclCommCallback* me) {
+  struct ncclCapturedBuffers* cap = (struct ncclCapturedBuffers*)me; // cast from first member `reclaimer`
+  for (struct ncclCapturedBuffers** p = &comm->capturedBuffers; *p != nullptr; p = &(*p)->next) {
+    if (*p == cap) {
+      *p = cap->next;
+      break;
+    }
+  }
+  free(cap);
+  return ncclSuccess;
+}
+
+static void capturedBuffersDestructor(void* cap_) {
+  struct ncclCapturedBuffers* cap = (struct ncclCapturedBuffers*)cap_;
+  ncclIntruQueueMpscEnqueue(&cap->comm->callbackQueue, &cap->reclaimer);
+}
+
+ncclResult_t ncclCaptureRecordBuffers(struct ncclComm* comm, cudaStream_t stream, const void* buff0, size_t bytes0,
+    const void* buff1, size_t bytes1) {
+  struct ncclCudaGraph graph;
+  NCCLCHECK(ncclCudaGetCapturingGraph(&graph, stream));
+  if (!ncclCudaGraphValid(graph)) return ncclSuccess;
+  struct ncclCapturedBuffers* cap;
+  NCCLCHECK(ncclCalloc(&cap, 1));
+  cap->reclaimer.fn = reclaimCapturedBuffers;
+  cap->comm = comm;
+  cap->base[0] = (uintptr_t)buff0;
+  cap->bytes[0] = buff0 ? bytes0 : 0;
+  cap->base[1] = (uintptr_t)buff1;
+  cap->bytes[1] = buff1 ? bytes1 : 0;
+  ncclResult_t ret = ncclCudaGraphAddDestructor(graph, capturedBuffersDestructor, cap);
+  if (ret != ncclSuccess) {
+    free(cap);
+    return ret;
+  }
+  cap->next = comm->capturedBuffers;
+  comm->capturedBuffers = cap;
+  return ncclSuccess;
+}
+
+// Captured plans keep a host copy of their work, patched here and copied over the device work
+// the graph launches with. Everything else baked in at capture, like counts, the split over
+// channels and proxy operations, does not depend on where the buffers are.
+NCCL_API(ncclResult_t, ncclCommGraphUpdateBuffers, ncclComm_t comm, const void* oldbuff, const void* newbuff, size_t bytes, int* nUpdated);
+ncclResult_t ncclCommGraphUpdateBuffers(ncclComm_t comm, const void* oldbuff, const void* newbuff, size_t bytes, int* nUpdated) {
+  NCCLCHECK(PtrCheck(comm, "CommGraphUpdateBuffers", "comm"));
+  if (oldbuff == NULL || newbuff == NULL) {
+    WARN("CommGraphUpdateBuffers : oldbuff %p and newbuff %p can not be NULL", oldbuff, newbuff);
+    return ncclInvalidArgument;
+  }
+  // Graphs referencing plans of comm may have been destroyed since
+  NCCLCHECK(ncclCommPollCallbacks(comm, false));
+  for (struct ncclCapturedBuffers* cap = comm->capturedBuffers; cap != nullptr; cap = cap->next) {
+    for (int b = 0; b < 2; b++) {
+      if (cap->bytes[b] == 0) continue;
+      if (cap->base[b] < (uintptr_t)oldbuff + bytes && (uintptr_t)oldbuff < cap->base[b] + cap->bytes[b]) {
+        WARN("CommGraphUpdateBuffers : buffer %p was captured by an operation launched outside of kernel plans, "
+            "which can not be moved, re-capture instead", (void*)cap->base[b]);
+        return ncclInvalidUsage;
+      }
+    }
+  }
+  int updated = 0;
+  int savedDev;
+  CUDACHECK(cudaGetDevice(&savedDev));
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  for (int pass = 0; pass < 2; pass++) {
+    for (struct ncclKernelPlan* plan = comm->persistentPlans; plan != nullptr; plan = plan->persistentNext) {
+      int n = 0;
+      NCCLCHECK(graphUpdatePlan(plan, pass, (uintptr_t)oldbuff, (uintptr_t)newbuff, bytes, &n));
+      if (n == 0) continue;
+      NCCLCHECK(ncclCudaMemcpy(plan->workHead, plan->workHost, plan->nWorkHost));
+      updated += n;
+    }
+  }
+  CUDACHECK(cudaSetDevice(savedDev));
+  INFO(NCCL_COLL, "comm %p rank %d moved %d pointers of captured operations from %p to %p (%zu bytes)",
+      comm, comm->rank, updated, oldbuff, newbuff, bytes);
+  if (nUpdated) *nUpdated = updated;
+  return ncclSuccess;
+}
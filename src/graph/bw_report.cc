@@ -0,0 +1,176 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "core.h"
+#include "comm.h"
+#include "graph.h"
+#include <algorithm>
+
+// Bandwidth efficiency report: with RCCL_BW_REPORT=N, one in N kernels holding a single collective is
+// timed with events, like the online tuner does, and the times are aggregated per function, algorithm,
+// protocol and log2 size bucket. The report compares the achieved bandwidth with the tuning model:
+// efficiency is the modeled time of ncclTopoGetAlgoTime() over the measured one. It is logged under
+// NCCL_DEBUG_SUBSYS=TUNING every RCCL_BW_REPORT_INTERVAL_S seconds and when the communicator is destroyed.
+
+RCCL_PARAM(BwReport, "BW_REPORT", 0);
+RCCL_PARAM(BwReportIntervalS, "BW_REPORT_INTERVAL_S", 60);
+
+#define NCCL_BW_REPORT_SLOTS 16 // Timed kernels in flight
+#define NCCL_BW_REPORT_NBUCKETS 48
+
+struct ncclBwReportSlot {
+  hipEvent_t start, stop;
+  bool busy;
+  int func, algorithm, protocol, bucket;
+  size_t nBytes;
+  float modelUs;
+};
+
+struct ncclBwReportEntry {
+  uint64_t count;
+  double sumUs, minUs;
+  double sumBytes;
+  double sumModelUs;
+};
+
+struct ncclBwReportBucket {
+  struct ncclBwReportEntry entries[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+};
+
+struct ncclBwReport {
+  int interval; // sample one in interval collectives
+  uint64_t nCalls;
+  uint64_t lastLogNs;
+  uint64_t logIntervalNs;
+  struct ncclBwReportSlot slots[NCCL_BW_REPORT_SLOTS];
+  struct ncclBwReportBucket* buckets[NCCL_NUM_FUNCTIONS][NCCL_BW_REPORT_NBUCKETS];
+};
+
+ncclResult_t ncclBwReportInit(struct ncclComm* comm) {
+  if (rcclParamBwReport() <= 0) return ncclSuccess;
+  struct ncclBwReport* report;
+  NCCLCHECK(ncclCalloc(&report, 1));
+  report->interval = rcclParamBwReport();
+  report->logIntervalNs = std::max((int64_t)rcclParamBwReportIntervalS(), (int64_t)0)*1000000000ULL;
+  report->lastLogNs = clockNano();
+  comm->bwReport = report;
+  INFO(NCCL_INIT|NCCL_TUNING, "Bandwidth report timing one in %d collectives", report->interval);
+  return ncclSuccess;
+}
+
+// Bus bandwidth over algorithm bandwidth, as rccl-tests computes it
+static double busBwFactor(int func, int nRanks) {
+  switch (func) {
+    case ncclFuncAllReduce: return 2.0*(nRanks-1)/nRanks;
+    case ncclFuncAllGather:
+    case ncclFuncReduceScatter: return (double)(nRanks-1)/nRanks;
+    default: return 1;
+  }
+}
+
+static void bwReportLog(struct ncclComm* comm, struct ncclBwReport* report) {
+  for (int f=0; f<NCCL_NUM_FUNCTIONS; f++) {
+    for (int b=0; b<NCCL_BW_REPORT_NBUCKETS; b++) {
+      struct ncclBwReportBucket* bucket = report->buckets[f][b];
+      if (bucket == NULL) continue;
+      for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+        for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+          struct ncclBwReportEntry* e = &bucket->entries[a][p];
+          if (e->count == 0) continue;
+          double algBw = e->sumBytes/e->sumUs/1e3; // GB/s
+          INFO(NCCL_TUNING, "BW report %s %s/%s %lu-%lu bytes: %lu timed, avg %.1f us min %.1f us, algBw %.2f GB/s busBw %.2f GB/s, "
+              "model bw %.2f GB/s, efficiency %.2f", ncclFuncStr[f], ncclAlgoStr[a], ncclProtoStr[p], 1UL<<b, (2UL<<b)-1,
+              e->count, e->sumUs/e->count, e->minUs, algBw, algBw*busBwFactor(f, comm->nRanks),
+              comm->bandwidths[f][a][p], e->sumModelUs/e->sumUs);
+        }
+      }
+    }
+  }
+}
+
+// Accounts the timed kernels that completed, waiting for all of them when wait is set
+static ncclResult_t bwReportPoll(struct ncclComm* comm, struct ncclBwReport* report, bool wait) {
+  for (int s=0; s<NCCL_BW_REPORT_SLOTS; s++) {
+    struct ncclBwReportSlot* slot = report->slots+s;
+    if (!slot->busy) continue;
+    if (wait) {
+      CUDACHECK(hipEventSynchronize(slot->stop));
+    } else {
+      hipError_t err = hipEventQuery(slot->stop);
+      if (err == hipErrorNotReady) continue;
+      CUDACHECK(err);
+    }
+    float ms;
+    CUDACHECK(hipEventElapsedTime(&ms, slot->start, slot->stop));
+    slot->busy = false;
+    struct ncclBwReportBucket* bucket = report->buckets[slot->func][slot->bucket];
+    if (bucket == NULL) {
+      NCCLCHECK(ncclCalloc(&bucket, 1));
+      report->buckets[slot->func][slot->bucket] = bucket;
+    }
+    struct ncclBwReportEntry* e = &bucket->entries[slot->algorithm][slot->protocol];
+    double us = ms*1e3;
+    e->minUs = e->count ? std::min(e->minUs, us) : us;
+    e->count++;
+    e->sumUs += us;
+    e->sumBytes += slot->nBytes;
+    e->sumModelUs += slot->modelUs;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclBwReportFree(struct ncclComm* comm) {
+  struct ncclBwReport* report = comm->bwReport;
+  if (report == NULL) return ncclSuccess;
+  NCCLCHECK(bwReportPoll(comm, report, true));
+  bwReportLog(comm, report);
+  for (int s=0; s<NCCL_BW_REPORT_SLOTS; s++) {
+    if (report->slots[s].start) CUDACHECK(hipEventDestroy(report->slots[s].start));
+    if (report->slots[s].stop) CUDACHECK(hipEventDestroy(report->slots[s].stop));
+  }
+  for (int f=0; f<NCCL_NUM_FUNCTIONS; f++) {
+    for (int b=0; b<NCCL_BW_REPORT_NBUCKETS; b++) free(report->buckets[f][b]);
+  }
+  free(report);
+  comm->bwReport = NULL;
+  return ncclSuccess;
+}
+
+bool ncclBwReportSample(struct ncclComm* comm) {
+  struct ncclBwReport* report = comm->bwReport;
+  return report && report->nCalls++ % report->interval == 0;
+}
+
+ncclResult_t ncclBwReportLaunched(struct ncclComm* comm, struct ncclKernelPlan* plan, hipEvent_t* start, hipEvent_t* stop) {
+  struct ncclBwReport* report = comm->bwReport;
+  *start = *stop = NULL;
+  if (report == NULL || !plan->bwSample) return ncclSuccess;
+  NCCLCHECK(bwReportPoll(comm, report, false));
+  uint64_t now = clockNano();
+  if (report->logIntervalNs && now - report->lastLogNs >= report->logIntervalNs) {
+    bwReportLog(comm, report);
+    report->lastLogNs = now;
+  }
+  struct ncclBwReportSlot* slot = NULL;
+  for (int s=0; s<NCCL_BW_REPORT_SLOTS && slot == NULL; s++) {
+    if (!report->slots[s].busy) slot = report->slots+s;
+  }
+  if (slot == NULL) return ncclSuccess; // Kernels in flight hold all the slots, skip this one
+  if (slot->start == NULL) {
+    CUDACHECK(hipEventCreate(&slot->start));
+    CUDACHECK(hipEventCreate(&slot->stop));
+  }
+  slot->busy = true;
+  slot->func = plan->bwFunc;
+  slot->algorithm = plan->bwAlgorithm;
+  slot->protocol = plan->bwProtocol;
+  slot->nBytes = plan->bwBytes;
+  slot->modelUs = plan->bwModelUs;
+  slot->bucket = std::min((int)log2i(std::max(plan->bwBytes, (size_t)1)), NCCL_BW_REPORT_NBUCKETS-1);
+  *start = slot->start;
+  *stop = slot->stop;
+  return ncclSuccess;
+}
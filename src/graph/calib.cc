@@ -0,0 +1,360 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "core.h"
+#include "graph.h"
+#include "topo.h"
+#include "comm.h"
+#include "net.h"
+#include "bootstrap.h"
+#include "collectives.h"
+#include "nvmlwrap.h"
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Link calibration (RCCL_CALIBRATE). The GDR, P2P read and latency decisions are heuristics on the
+// PCI topology and the GPU architecture, which are wrong on some platforms. With this set, every rank
+// measures at init, within RCCL_CALIBRATE_TIME_MS:
+//  - its GPU loading from and storing to the memory of the other GPUs of the node it can access,
+//  - its GPU storing to and loading from pinned host memory,
+//  - each NIC sending from and receiving into its GPU memory and between host buffers, over a
+//    loopback connection, and the latency of small host messages.
+// Results are cached per node in /dev/shm like the topology, under the same key, so a GPU is only
+// measured once per boot. Ranks then exchange them so all of them take the same decisions.
+RCCL_PARAM(Calibrate, "CALIBRATE", 0);
+RCCL_PARAM(CalibrateTimeMs, "CALIBRATE_TIME_MS", 500);
+
+#define CALIB_VERSION 1
+#define CALIB_COPY_BYTES (16<<20)
+#define CALIB_COPY_ITERS 4
+#define CALIB_NET_BYTES (4<<20)
+#define CALIB_NET_ITERS 8
+#define CALIB_LAT_ITERS 32
+
+// What one rank measures from its GPU, as cached and exchanged
+struct calibRecord {
+  int version;
+  int64_t busId;
+  float d2hBw;
+  float h2dBw;
+  float lat;
+  int nPeers;
+  int64_t peerIds[NCCL_TOPO_CALIB_MAX_GPUS];
+  float readBw[NCCL_TOPO_CALIB_MAX_GPUS];
+  float writeBw[NCCL_TOPO_CALIB_MAX_GPUS];
+  int nNets;
+  int64_t netIds[NCCL_TOPO_CALIB_MAX_NETS];
+  float gdrReadBw[NCCL_TOPO_CALIB_MAX_NETS];
+  float gdrWriteBw[NCCL_TOPO_CALIB_MAX_NETS];
+  float hostBw[NCCL_TOPO_CALIB_MAX_NETS];
+};
+
+static bool calibExpired(uint64_t deadline) {
+  if (clockNano() < deadline) return false;
+  INFO(NCCL_INIT, "Link calibration ran out of time, set RCCL_CALIBRATE_TIME_MS to measure more links");
+  return true;
+}
+
+// GB/s of the copy kernel from src to dst on the current GPU
+static ncclResult_t calibCopyBw(const void* src, void* dst, cudaStream_t stream, float* bw) {
+  int dev, nSms;
+  float ms;
+  cudaEvent_t start, stop;
+  CUDACHECK(cudaGetDevice(&dev));
+  CUDACHECK(cudaDeviceGetAttribute(&nSms, cudaDevAttrMultiProcessorCount, dev));
+  CUDACHECK(cudaEventCreate(&start));
+  CUDACHECK(cudaEventCreate(&stop));
+  size_t nVecs = CALIB_COPY_BYTES/sizeof(uint4);
+  for (int i=-1; i<CALIB_COPY_ITERS; i++) {
+    // The first copy warms up the link and the kernel
+    if (i == 0) CUDACHECK(cudaEventRecord(start, stream));
+    hipLaunchKernelGGL(ncclCalibCopyKernel, dim3(nSms*4), dim3(256), 0, stream, (const uint4*)src, (uint4*)dst, nVecs);
+  }
+  CUDACHECK(cudaGetLastError());
+  CUDACHECK(cudaEventRecord(stop, stream));
+  CUDACHECK(cudaEventSynchronize(stop));
+  CUDACHECK(cudaEventElapsedTime(&ms, start, stop));
+  CUDACHECK(cudaEventDestroy(start));
+  CUDACHECK(cudaEventDestroy(stop));
+  *bw = (float)CALIB_COPY_BYTES*CALIB_COPY_ITERS/ms/1.0e6;
+  return ncclSuccess;
+}
+
+// Loads and stores of the current GPU to the memory of GPU peerId, 0 if it can not access it
+static ncclResult_t calibP2p(struct ncclComm* comm, int64_t peerId, char* local, cudaStream_t stream, float* readBw, float* writeBw) {
+  char busId[NVML_DEVICE_PCI_BUS_ID_BUFFER_SIZE];
+  int peerDev, canAccess;
+  char* remote = NULL;
+  ncclResult_t ret = ncclSuccess;
+  bool enabled = false;
+  cudaError_t err;
+  *readBw = *writeBw = 0;
+  NCCLCHECK(int64ToBusId(peerId, busId));
+  // Only GPUs visible to this process can be measured
+  if (cudaDeviceGetByPCIBusId(&peerDev, busId) != cudaSuccess) {
+    cudaGetLastError();
+    return ncclSuccess;
+  }
+  CUDACHECK(cudaDeviceCanAccessPeer(&canAccess, comm->cudaDev, peerDev));
+  if (!canAccess) return ncclSuccess;
+  err = cudaDeviceEnablePeerAccess(peerDev, 0);
+  if (err == cudaErrorPeerAccessAlreadyEnabled) cudaGetLastError();
+  else if (err != cudaSuccess) return ncclSuccess;
+  else enabled = true;
+  CUDACHECKGOTO(cudaSetDevice(peerDev), ret, exit);
+  ret = ncclCudaMalloc(&remote, CALIB_COPY_BYTES);
+  CUDACHECKGOTO(cudaSetDevice(comm->cudaDev), ret, exit);
+  if (ret != ncclSuccess) goto exit;
+  NCCLCHECKGOTO(calibCopyBw(remote, local, stream, readBw), ret, exit);
+  NCCLCHECKGOTO(calibCopyBw(local, remote, stream, writeBw), ret, exit);
+exit:
+  if (remote) ncclCudaFree(remote);
+  if (enabled) cudaDeviceDisablePeerAccess(peerDev);
+  return ret;
+}
+
+// Time in us of one transfer of bytes from sendBuf to recvBuf over a loopback connection of NIC dev
+static ncclResult_t calibNetTime(struct ncclComm* comm, int dev, void* sendBuf, int sendType, void* recvBuf, int recvType,
+    int bytes, int iters, float* us) {
+  void *lComm = NULL, *sComm = NULL, *rComm = NULL;
+  void *sHandle = NULL, *rHandle = NULL;
+  ncclNetHandle_t handle;
+  ncclResult_t ret = ncclSuccess;
+  uint64_t t0 = 0;
+  NCCLCHECK(comm->ncclNet->listen(dev, &handle, &lComm));
+  while (sComm == NULL || rComm == NULL) {
+    if (*comm->abortFlag) {
+      ret = ncclInternalError;
+      goto exit;
+    }
+    if (sComm == NULL) NCCLCHECKGOTO(comm->ncclNet->connect(dev, &handle, &sComm), ret, exit);
+    if (rComm == NULL) NCCLCHECKGOTO(comm->ncclNet->accept(lComm, &rComm), ret, exit);
+  }
+  NCCLCHECKGOTO(comm->ncclNet->regMr(sComm, sendBuf, bytes, sendType, &sHandle), ret, exit);
+  NCCLCHECKGOTO(comm->ncclNet->regMr(rComm, recvBuf, bytes, recvType, &rHandle), ret, exit);
+  for (int i=-1; i<iters; i++) {
+    void *sReq = NULL, *rReq = NULL;
+    int tag = 0, size = bytes, sDone = 0, rDone = 0;
+    if (i == 0) t0 = clockNano();
+    while (rReq == NULL) NCCLCHECKGOTO(comm->ncclNet->irecv(rComm, 1, &recvBuf, &size, &tag, &rHandle, &rReq), ret, exit);
+    while (sReq == NULL) NCCLCHECKGOTO(comm->ncclNet->isend(sComm, sendBuf, bytes, tag, sHandle, &sReq), ret, exit);
+    while (!sDone || !rDone) {
+      if (!sDone) NCCLCHECKGOTO(comm->ncclNet->test(sReq, &sDone, &size), ret, exit);
+      if (!rDone) NCCLCHECKGOTO(comm->ncclNet->test(rReq, &rDone, &size), ret, exit);
+    }
+  }
+  *us = (clockNano()-t0)/1.0e3/iters;
+exit:
+  if (sHandle) comm->ncclNet->deregMr(sComm, sHandle);
+  if (rHandle) comm->ncclNet->deregMr(rComm, rHandle);
+  if (rComm) comm->ncclNet->closeRecv(rComm);
+  if (sComm) comm->ncclNet->closeSend(sComm);
+  comm->ncclNet->closeListen(lComm);
+  return ret;
+}
+
+static ncclResult_t calibNet(struct ncclComm* comm, struct ncclTopoNode* net, char* gpuBuf, char* hostBuf,
+    uint64_t deadline, struct calibRecord* rec, int n) {
+  int dev = net->id;
+  float us;
+  NCCLCHECK(calibNetTime(comm, dev, hostBuf, NCCL_PTR_HOST, hostBuf+CALIB_NET_BYTES, NCCL_PTR_HOST, sizeof(uint64_t), CALIB_LAT_ITERS, &us));
+  if (rec->lat == 0 || us < rec->lat) rec->lat = us;
+  NCCLCHECK(calibNetTime(comm, dev, hostBuf, NCCL_PTR_HOST, hostBuf+CALIB_NET_BYTES, NCCL_PTR_HOST, CALIB_NET_BYTES, CALIB_NET_ITERS, &us));
+  rec->hostBw[n] = CALIB_NET_BYTES/us/1.0e3;
+  if (net->net.gdrSupport == 0 || comm->peerInfo[comm->rank].gdrSupport == 0 || clockNano() > deadline) return ncclSuccess;
+  NCCLCHECK(calibNetTime(comm, dev, gpuBuf, NCCL_PTR_CUDA, hostBuf, NCCL_PTR_HOST, CALIB_NET_BYTES, CALIB_NET_ITERS, &us));
+  rec->gdrReadBw[n] = CALIB_NET_BYTES/us/1.0e3;
+  NCCLCHECK(calibNetTime(comm, dev, hostBuf, NCCL_PTR_HOST, gpuBuf, NCCL_PTR_CUDA, CALIB_NET_BYTES, CALIB_NET_ITERS, &us));
+  rec->gdrWriteBw[n] = CALIB_NET_BYTES/us/1.0e3;
+  return ncclSuccess;
+}
+
+// Measures what it can within the time limit, links that fail stay at 0
+static ncclResult_t calibMeasure(struct ncclComm* comm, struct ncclTopoSystem* system, struct calibRecord* rec) {
+  uint64_t deadline = clockNano() + rcclParamCalibrateTimeMs()*1000000ULL;
+  char* gpuBuf = NULL;
+  char* hostBuf = NULL;
+  cudaStream_t stream;
+  ncclResult_t ret = ncclSuccess;
+  rec->version = CALIB_VERSION;
+  rec->busId = comm->busId;
+  CUDACHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  NCCLCHECKGOTO(ncclCudaMalloc(&gpuBuf, CALIB_COPY_BYTES), ret, exit);
+  NCCLCHECKGOTO(ncclCudaHostCalloc(&hostBuf, std::max(CALIB_COPY_BYTES, 2*CALIB_NET_BYTES)), ret, exit);
+
+  if (calibCopyBw(gpuBuf, hostBuf, stream, &rec->d2hBw) != ncclSuccess ||
+      calibCopyBw(hostBuf, gpuBuf, stream, &rec->h2dBw) != ncclSuccess) {
+    INFO(NCCL_INIT, "Link calibration could not measure host memory accesses of GPU %lx", comm->busId);
+    rec->d2hBw = rec->h2dBw = 0;
+  }
+  for (int g=0; g<system->nodes[GPU].count && rec->nPeers<NCCL_TOPO_CALIB_MAX_GPUS; g++) {
+    int64_t peerId = system->nodes[GPU].nodes[g].id;
+    if (peerId == comm->busId) continue;
+    if (calibExpired(deadline)) goto exit;
+    int p = rec->nPeers++;
+    rec->peerIds[p] = peerId;
+    if (calibP2p(comm, peerId, gpuBuf, stream, rec->readBw+p, rec->writeBw+p) != ncclSuccess) {
+      INFO(NCCL_INIT, "Link calibration could not measure P2P from GPU %lx to %lx", comm->busId, peerId);
+      rec->readBw[p] = rec->writeBw[p] = 0;
+    }
+  }
+  for (int n=0; n<system->nodes[NET].count && rec->nNets<NCCL_TOPO_CALIB_MAX_NETS; n++) {
+    if (calibExpired(deadline)) goto exit;
+    struct ncclTopoNode* net = system->nodes[NET].nodes+n;
+    int i = rec->nNets++;
+    rec->netIds[i] = net->id;
+    ncclDebugNoWarn = NCCL_NET;
+    if (calibNet(comm, net, gpuBuf, hostBuf, deadline, rec, i) != ncclSuccess) {
+      INFO(NCCL_INIT, "Link calibration could not measure NIC %ld from GPU %lx", net->id, comm->busId);
+    }
+    ncclDebugNoWarn = 0;
+  }
+exit:
+  if (hostBuf) ncclCudaHostFree(hostBuf);
+  if (gpuBuf) ncclCudaFree(gpuBuf);
+  cudaStreamDestroy(stream);
+  return ret;
+}
+
+// Loads the record of our GPU from the node cache, or measures and stores it. The lock also keeps
+// the ranks of the node from measuring at the same time and competing for the links.
+static ncclResult_t calibGetRecord(struct ncclComm* comm, struct ncclTopoSystem* system, struct calibRecord* rec) {
+  uint64_t key;
+  char path[PATH_MAX], lockPath[PATH_MAX+8], tmpPath[PATH_MAX+32];
+  struct calibRecord* cached = NULL;
+  int nCached = 0;
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECK(ncclTopoCacheKey(comm, &key));
+  snprintf(path, sizeof(path), "/dev/shm/rccl-calib-%u-%lx-%lx.bin", (unsigned)getuid(), getHostHash(), key);
+  snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+  int lockFd = open(lockPath, O_RDWR|O_CREAT, 0600);
+  if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0) {
+    INFO(NCCL_INIT, "Link calibration cache %s unavailable : %s", lockPath, strerror(errno));
+    if (lockFd >= 0) close(lockFd);
+    return calibMeasure(comm, system, rec);
+  }
+
+  FILE* file = fopen(path, "r");
+  if (file) {
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    nCached = size > 0 ? size/sizeof(struct calibRecord) : 0;
+    if (nCached > 0) {
+      NCCLCHECKGOTO(ncclCalloc(&cached, nCached+1), ret, exit);
+      if (fread(cached, sizeof(struct calibRecord), nCached, file) != (size_t)nCached) nCached = 0;
+    }
+    fclose(file);
+  }
+  for (int i=0; i<nCached; i++) {
+    if (cached[i].version == CALIB_VERSION && cached[i].busId == comm->busId) {
+      *rec = cached[i];
+      INFO(NCCL_INIT, "Loaded link calibration of GPU %lx from %s", comm->busId, path);
+      goto exit;
+    }
+  }
+
+  NCCLCHECKGOTO(calibMeasure(comm, system, rec), ret, exit);
+  if (cached == NULL) NCCLCHECKGOTO(ncclCalloc(&cached, 1), ret, exit);
+  cached[nCached++] = *rec;
+  // Readers wait on the lock, the rename only protects them from a rank killed while writing
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, getpid());
+  file = fopen(tmpPath, "w");
+  if (file == NULL || fwrite(cached, sizeof(struct calibRecord), nCached, file) != (size_t)nCached ||
+      fclose(file) != 0 || rename(tmpPath, path) != 0) {
+    INFO(NCCL_INIT, "Could not store link calibration cache %s : %s", path, strerror(errno));
+    unlink(tmpPath);
+  }
+exit:
+  free(cached);
+  flock(lockFd, LOCK_UN);
+  close(lockFd);
+  return ret;
+}
+
+static int calibGpuIndex(struct ncclTopoCalib* calib, int64_t id) {
+  for (int g=0; g<calib->nGpus; g++) if (calib->gpuIds[g] == id) return g;
+  return -1;
+}
+
+static int calibNetIndex(struct ncclTopoCalib* calib, int64_t id) {
+  for (int n=0; n<calib->nNets; n++) if (calib->netIds[n] == id) return n;
+  return -1;
+}
+
+ncclResult_t ncclTopoCalibrate(struct ncclComm* comm, struct ncclTopoSystem* system) {
+  struct ncclTopoCalib* calib = &system->calib;
+  memset(calib, 0, sizeof(*calib));
+  if (rcclParamCalibrate() == 0) return ncclSuccess;
+
+  struct calibRecord* records;
+  ncclResult_t ret = ncclSuccess;
+  NCCLCHECK(ncclCalloc(&records, comm->nRanks));
+  NCCLCHECKGOTO(calibGetRecord(comm, system, records+comm->rank), ret, exit);
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, records, sizeof(struct calibRecord)), ret, exit);
+
+  calib->nGpus = std::min(system->nodes[GPU].count, NCCL_TOPO_CALIB_MAX_GPUS);
+  for (int g=0; g<calib->nGpus; g++) calib->gpuIds[g] = system->nodes[GPU].nodes[g].id;
+  calib->nNets = std::min(system->nodes[NET].count, NCCL_TOPO_CALIB_MAX_NETS);
+  for (int n=0; n<calib->nNets; n++) calib->netIds[n] = system->nodes[NET].nodes[n].id;
+  for (int r=0; r<comm->nRanks; r++) {
+    struct calibRecord* rec = records+r;
+    calib->netLat = std::max(calib->netLat, rec->lat);
+    if (comm->peerInfo[r].hostHash != comm->peerInfo[comm->rank].hostHash) continue;
+    int g = calibGpuIndex(calib, rec->busId);
+    if (g == -1) continue;
+    calib->d2hBw[g] = rec->d2hBw;
+    calib->h2dBw[g] = rec->h2dBw;
+    for (int p=0; p<rec->nPeers; p++) {
+      int g2 = calibGpuIndex(calib, rec->peerIds[p]);
+      if (g2 == -1) continue;
+      calib->p2pReadBw[g][g2] = rec->readBw[p];
+      calib->p2pWriteBw[g][g2] = rec->writeBw[p];
+      INFO(NCCL_INIT, "Link calibration GPU %lx -> %lx : read %.1f GB/s write %.1f GB/s", rec->busId, rec->peerIds[p],
+          rec->readBw[p], rec->writeBw[p]);
+    }
+    for (int i=0; i<rec->nNets; i++) {
+      int n = calibNetIndex(calib, rec->netIds[i]);
+      if (n == -1) continue;
+      calib->gdrReadBw[g][n] = rec->gdrReadBw[i];
+      calib->gdrWriteBw[g][n] = rec->gdrWriteBw[i];
+      calib->hostBw[g][n] = rec->hostBw[i];
+      INFO(NCCL_INIT, "Link calibration GPU %lx / NIC %ld : GDR read %.1f GB/s write %.1f GB/s, host %.1f GB/s (GPU %.1f/%.1f GB/s)",
+          rec->busId, rec->netIds[i], rec->gdrReadBw[i], rec->gdrWriteBw[i], rec->hostBw[i], rec->d2hBw, rec->h2dBw);
+    }
+  }
+  INFO(NCCL_INIT, "Link calibration host path latency %.1f us", calib->netLat);
+exit:
+  free(records);
+  return ret;
+}
+
+ncclResult_t ncclTopoCalibGdr(struct ncclTopoSystem* system, int64_t busId, int netDev, int read, float* gdrBw, float* hostBw) {
+  struct ncclTopoCalib* calib = &system->calib;
+  *gdrBw = *hostBw = 0;
+  int g = calibGpuIndex(calib, busId);
+  int n = calibNetIndex(calib, netDev);
+  if (g == -1 || n == -1) return ncclSuccess;
+  // Without GDR, data goes through a host buffer the GPU stores to before sends and loads from after receives
+  *gdrBw = read ? calib->gdrReadBw[g][n] : calib->gdrWriteBw[g][n];
+  *hostBw = std::min(calib->hostBw[g][n], read ? calib->d2hBw[g] : calib->h2dBw[g]);
+  if (*gdrBw == 0 || *hostBw == 0) *gdrBw = *hostBw = 0;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoCalibP2pRead(struct ncclTopoSystem* system, int64_t sendId, int64_t recvId, int* read) {
+  struct ncclTopoCalib* calib = &system->calib;
+  int s = calibGpuIndex(calib, sendId);
+  int r = calibGpuIndex(calib, recvId);
+  if (s == -1 || r == -1) return ncclSuccess;
+  // With P2P read the receiver loads from the memory of the sender, otherwise the sender stores to the receiver
+  float readBw = calib->p2pReadBw[r][s];
+  float writeBw = calib->p2pWriteBw[s][r];
+  if (readBw == 0 || writeBw == 0) return ncclSuccess;
+  *read = readBw > writeBw ? 1 : 0;
+  return ncclSuccess;
+}
@@ -67,6 +67,20 @@ ncclResult_t ncclTopoPreset(struct ncclComm* comm, struct ncclTopoGraph** graphs
     topoRanks->ringPrev[c] = channel->ring.prev;
     topoRanks->ringNext[c] = channel->ring.next;
     topoRanks->nvlsHeads[c] = nvlsIntra[0];
+
+    topoRanks->ringRecvNet[c] = topoRanks->ringSendNet[c] = -1;
+    topoRanks->ringRecvRail[c] = topoRanks->ringSendRail[c] = -1;
+    struct ncclTopoSystem* system = comm->topo;
+    if (system->nodes[NET].count && system->nodes[GPU].count != system->nRanks) {
+      int* ringInter = graphs[NCCL_ALGO_RING]->inter+c*2;
+      int recvIndex, sendIndex;
+      topoRanks->ringRecvNet[c] = ringInter[0];
+      topoRanks->ringSendNet[c] = ringInter[1];
+      if (ncclTopoIdToIndex(system, NET, ringInter[0], &recvIndex) == ncclSuccess)
+        topoRanks->ringRecvRail[c] = system->nodes[NET].nodes[recvIndex].net.rail;
+      if (ncclTopoIdToIndex(system, NET, ringInter[1], &sendIndex) == ncclSuccess)
+        topoRanks->ringSendRail[c] = system->nodes[NET].nodes[sendIndex].net.rail;
+    }
   }
   // Duplicate channels rings/trees
   struct ncclChannel* channel0 = comm->channels;
@@ -227,6 +241,35 @@ static ncclResult_t connectRings(struct ncclComm* comm, int* ringRecv, int* ring
   return ncclSuccess;
 }
 
+// NIC binding of each ring channel, printed by the first rank of each node. With rails, ring edges
+// between the send NIC of a node and the receive NIC of the next one on different rails go through
+// the spine, which rank 0 warns about: the nodes either have different rail maps or searched
+// different graphs.
+static void reportNetRails(struct ncclComm* comm, int* firstRanks, struct ncclTopoRanks** allTopoRanks) {
+  int nNodes = comm->nNodes;
+  if (nNodes == 1) return;
+  struct ncclTopoRanks* mine = allTopoRanks[comm->rank];
+  if (comm->rank == firstRanks[comm->rankToNode[comm->rank]]) {
+    for (int c=0; c<comm->nChannels; c++) {
+      INFO(NCCL_INIT|NCCL_NET, "Channel %02d : ring enters on NET/%d rail %d, leaves on NET/%d rail %d", c,
+          mine->ringRecvNet[c], mine->ringRecvRail[c], mine->ringSendNet[c], mine->ringSendRail[c]);
+    }
+  }
+  if (comm->rank != 0) return;
+  int crossRail = 0;
+  for (int c=0; c<comm->nChannels; c++) {
+    for (int n=0; n<nNodes; n++) {
+      int sendRail = allTopoRanks[firstRanks[n]]->ringSendRail[c];
+      int recvRail = allTopoRanks[firstRanks[(n+1)%nNodes]]->ringRecvRail[c];
+      if (sendRail == -1 || recvRail == -1 || sendRail == recvRail) continue;
+      if (crossRail++ == 0) {
+        WARN("Ring channel %d goes from rail %d on node %d to rail %d on node %d", c, sendRail, n, recvRail, (n+1)%nNodes);
+      }
+    }
+  }
+  if (crossRail > 1) WARN("%d ring edges between nodes cross rails", crossRail);
+}
+
 static ncclResult_t getIndexes(int* ranks, int* indexes, int nNodes) {
  for (int n=0; n<nNodes; n++) indexes[n] = ranks[n];
  return ncclSuccess;
@@ -250,8 +293,48 @@ static ncclResult_t setTreeDown(struct ncclTree* tree, int* indexes, int d) {
   return ncclSuccess;
 }
 
-static ncclResult_t connectTrees(struct ncclComm* comm, int* treeToParent, int* treeToChild0, int* treeToChild1, int* treePatterns) {
+// Double k-ary variant of connectTrees(). The inter-node children of a node alternate between its
+// treeToChild0 and treeToChild1 ranks, like the two children of the binary trees.
+static ncclResult_t connectKTrees(struct ncclComm* comm, int arity, int* treeToParent, int* treeToChild0, int* treeToChild1) {
   const int nChannels = (comm->nChannels > MAXCHANNELS/2) ? comm->nChannels/2 : comm->nChannels, nNodes = comm->nNodes, node = comm->node;
+  int depth = comm->nRanks/nNodes - 1 + ncclGetKtreeDepth(nNodes, arity);
+
+  int up[2], childType[2] = { 0, 0 };
+  int down[2][NCCL_MAX_KTREE_ARITY];
+  NCCLCHECK(ncclGetKDtree(nNodes, node, arity, up, down[0], childType, up+1, down[1], childType+1));
+  for (int t=0; t<2; t++) {
+    for (int c=0; c<nChannels; c++) {
+      struct ncclChannel* channel = comm->channels+t*nChannels+c;
+      // Without duplicated channels, the second tree has its own tree ranks
+      int tc = comm->nChannels <= MAXCHANNELS/2 ? c : t*nChannels+c;
+      int* ttp = treeToParent+tc*nNodes;
+      int* ttc0 = treeToChild0+tc*nNodes;
+      int* ttc1 = treeToChild1+tc*nNodes;
+      if (comm->rank == ttp[node]) {
+        NCCLCHECK(setTreeUp(&channel->tree, childType[t] == 0 ? ttc0 : ttc1, up[t]));
+      }
+      for (int i=0; i<arity; i++) {
+        if (comm->rank == (i%2 == 0 ? ttc0 : ttc1)[node]) NCCLCHECK(setTreeDown(&channel->tree, ttp, down[t][i]));
+      }
+      if (comm->rank == ttp[node] ||
+          comm->rank == ttc0[node] ||
+          comm->rank == ttc1[node]) {
+        char line[64];
+        int offset = 0;
+        for (int i=0; i<NCCL_MAX_TREE_ARITY; i++) offset += snprintf(line+offset, sizeof(line)-offset, "%s%d", i ? "/" : "", channel->tree.down[i]);
+        INFO(NCCL_GRAPH, "Tree %d : %d -> %d -> %s", t*nChannels+c, channel->tree.up, comm->rank, line);
+      }
+      channel->tree.depth = depth;
+    }
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t connectTrees(struct ncclComm* comm, int* treeToParent, int* treeToChild0, int* treeToChild1, int* treePatterns, struct ncclTopoGraph* treeGraph) {
+  const int nChannels = (comm->nChannels > MAXCHANNELS/2) ? comm->nChannels/2 : comm->nChannels, nNodes = comm->nNodes, node = comm->node;
+
+  NCCLCHECK(ncclTopoGetTreeArity(comm, treeGraph, treePatterns, &comm->treeArity));
+  if (comm->treeArity > 2) return connectKTrees(comm, comm->treeArity, treeToParent, treeToChild0, treeToChild1);
 
   // Compute tree depth. Not an exact value but a good approximation in most
   // cases
@@ -548,7 +631,8 @@ ncclResult_t ncclTopoPostset(struct ncclComm* comm, int* firstRanks, int* treePa
 
   // Connect rings and trees. This should also duplicate the channels.
   NCCLCHECK(connectRings(comm, ringRecv, ringSend, ringPrev, ringNext));
-  NCCLCHECK(connectTrees(comm, treeToParent, treeToChild0, treeToChild1, treePatterns));
+  reportNetRails(comm, firstRanks, allTopoRanks);
+  NCCLCHECK(connectTrees(comm, treeToParent, treeToChild0, treeToChild1, treePatterns, graphs[NCCL_ALGO_TREE]));
   NCCLCHECK(connectNvls(comm, nvlsHeads, graphs[NCCL_ALGO_NVLS]));
 
   // Duplicate ringPrev/ringNext for ncclBuildRing
@@ -0,0 +1,242 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "core.h"
+#include "comm.h"
+#include "graph.h"
+#include "bootstrap.h"
+#include <algorithm>
+
+// Online tuning: the first collectives of each function and log2 size bucket run the best modeled
+// algorithm/protocol/channel configurations in turn, the kernels being timed with events. Once all
+// were timed, the ranks take the configuration fastest on the slowest rank and keep it from then on.
+
+RCCL_PARAM(OnlineTune, "ONLINE_TUNE", 0);
+RCCL_PARAM(OnlineTuneCandidates, "ONLINE_TUNE_CANDIDATES", 4); // Configurations explored per size bucket
+RCCL_PARAM(OnlineTuneTrials, "ONLINE_TUNE_TRIALS", 4); // Timed launches per configuration
+
+#define NCCL_TUNER_MAX_CANDIDATES 8
+#define NCCL_TUNER_MAX_TRIALS 16
+#define NCCL_TUNER_NBUCKETS 48
+
+enum ncclTunerState { ncclTunerStateExplore, ncclTunerStateAgree, ncclTunerStateDecided };
+
+struct ncclTunerSample {
+  hipEvent_t start, stop;
+  bool launched; // set by ncclLaunchKernel() when the plan held this collective only
+};
+
+struct ncclTunerCandidate {
+  int algorithm, protocol;
+  int nChannels; // 0 for the channel count of the model
+  float modelTime;
+  struct ncclTunerSample samples[NCCL_TUNER_MAX_TRIALS];
+};
+
+struct ncclTunerBucket {
+  enum ncclTunerState state;
+  int nCandidates; // candidates[0] is the choice of the model
+  int nLaunches; // round robin over the candidates
+  int best;
+  struct ncclTunerCandidate candidates[NCCL_TUNER_MAX_CANDIDATES];
+};
+
+struct ncclTuner {
+  int nCandidates, nTrials;
+  int nAgree; // buckets explored and waiting for ncclTunerAgree()
+  struct ncclTunerBucket* buckets[NCCL_NUM_FUNCTIONS][NCCL_TUNER_NBUCKETS];
+};
+
+ncclResult_t ncclTunerInit(struct ncclComm* comm) {
+  if (rcclParamOnlineTune() == 0 || comm->nRanks == 1) return ncclSuccess;
+  struct ncclTuner* tuner;
+  NCCLCHECK(ncclCalloc(&tuner, 1));
+  tuner->nCandidates = std::min(std::max((int)rcclParamOnlineTuneCandidates(), 1), NCCL_TUNER_MAX_CANDIDATES);
+  tuner->nTrials = std::min(std::max((int)rcclParamOnlineTuneTrials(), 1), NCCL_TUNER_MAX_TRIALS);
+  comm->tuner = tuner;
+  INFO(NCCL_INIT|NCCL_TUNING, "Online tuning of up to %d configurations timed %d times per size bucket", tuner->nCandidates, tuner->nTrials);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTunerFree(struct ncclComm* comm) {
+  struct ncclTuner* tuner = comm->tuner;
+  if (tuner == NULL) return ncclSuccess;
+  for (int f=0; f<NCCL_NUM_FUNCTIONS; f++) {
+    for (int b=0; b<NCCL_TUNER_NBUCKETS; b++) {
+      struct ncclTunerBucket* bucket = tuner->buckets[f][b];
+      if (bucket == NULL) continue;
+      for (int c=0; c<bucket->nCandidates; c++) {
+        for (int t=0; t<NCCL_TUNER_MAX_TRIALS; t++) {
+          struct ncclTunerSample* sample = bucket->candidates[c].samples+t;
+          if (sample->start) CUDACHECK(hipEventDestroy(sample->start));
+          if (sample->stop) CUDACHECK(hipEventDestroy(sample->stop));
+        }
+      }
+      free(bucket);
+    }
+  }
+  free(tuner);
+  comm->tuner = NULL;
+  return ncclSuccess;
+}
+
+static void addCandidate(struct ncclTunerBucket* bucket, int a, int p, int nChannels, float modelTime) {
+  struct ncclTunerCandidate* cand = bucket->candidates+bucket->nCandidates++;
+  cand->algorithm = a;
+  cand->protocol = p;
+  cand->nChannels = nChannels;
+  cand->modelTime = modelTime;
+}
+
+// The best modeled algorithm/protocol pairs, and the best one with all and half of the channels.
+static void tunerCandidates(struct ncclComm* comm, struct ncclTuner* tuner, struct ncclTunerBucket* bucket, float times[][NCCL_NUM_PROTOCOLS]) {
+  int order[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+  int nPairs = 0;
+  for (int i=0; i<NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS; i++) {
+    if (times[i/NCCL_NUM_PROTOCOLS][i%NCCL_NUM_PROTOCOLS] >= 0) order[nPairs++] = i;
+  }
+  std::stable_sort(order, order+nPairs, [times](int x, int y) {
+    return times[x/NCCL_NUM_PROTOCOLS][x%NCCL_NUM_PROTOCOLS] < times[y/NCCL_NUM_PROTOCOLS][y%NCCL_NUM_PROTOCOLS];
+  });
+  int nFirst = std::min(nPairs, std::max(1, tuner->nCandidates-2));
+  int next = 0;
+  for (; next<nFirst; next++) {
+    int a = order[next]/NCCL_NUM_PROTOCOLS, p = order[next]%NCCL_NUM_PROTOCOLS;
+    addCandidate(bucket, a, p, 0, times[a][p]);
+  }
+  if (nPairs > 0 && (bucket->candidates[0].algorithm == NCCL_ALGO_RING || bucket->candidates[0].algorithm == NCCL_ALGO_TREE)) {
+    int a = bucket->candidates[0].algorithm, p = bucket->candidates[0].protocol;
+    if (bucket->nCandidates < tuner->nCandidates) addCandidate(bucket, a, p, comm->nChannels, times[a][p]);
+    if (bucket->nCandidates < tuner->nCandidates && comm->nChannels > 1) addCandidate(bucket, a, p, comm->nChannels/2, times[a][p]);
+  }
+  for (; next<nPairs && bucket->nCandidates < tuner->nCandidates; next++) {
+    int a = order[next]/NCCL_NUM_PROTOCOLS, p = order[next]%NCCL_NUM_PROTOCOLS;
+    addCandidate(bucket, a, p, 0, times[a][p]);
+  }
+  bucket->state = bucket->nCandidates > 1 ? ncclTunerStateExplore : ncclTunerStateDecided;
+}
+
+ncclResult_t ncclTunerSelect(struct ncclInfo* info, float times[][NCCL_NUM_PROTOCOLS], int* nChannels, bool* tuned) {
+  struct ncclComm* comm = info->comm;
+  struct ncclTuner* tuner = comm->tuner;
+  *nChannels = 0;
+  *tuned = false;
+  if (tuner == NULL || info->coll >= NCCL_NUM_FUNCTIONS) return ncclSuccess;
+  int b = std::min((int)log2i(std::max(info->nBytes, (size_t)1)), NCCL_TUNER_NBUCKETS-1);
+  struct ncclTunerBucket* bucket = tuner->buckets[info->coll][b];
+  if (bucket == NULL) {
+    NCCLCHECK(ncclCalloc(&bucket, 1));
+    tunerCandidates(comm, tuner, bucket, times);
+    tuner->buckets[info->coll][b] = bucket;
+  }
+  if (bucket->nCandidates == 0) return ncclSuccess;
+
+  struct ncclTunerCandidate* cand;
+  if (bucket->state == ncclTunerStateDecided) {
+    cand = bucket->candidates+bucket->best;
+  } else {
+    // Decisions change until the ranks agreed, keep them out of the algorithm cache
+    info->tuneExploring = true;
+    if (bucket->state == ncclTunerStateAgree) return ncclSuccess;
+    cand = bucket->candidates + bucket->nLaunches%bucket->nCandidates;
+    struct ncclTunerSample* sample = cand->samples + bucket->nLaunches/bucket->nCandidates;
+    if (sample->start == NULL) {
+      CUDACHECK(hipEventCreate(&sample->start));
+      CUDACHECK(hipEventCreate(&sample->stop));
+    }
+    sample->launched = false;
+    info->tuneSample = sample;
+    if (++bucket->nLaunches == bucket->nCandidates*tuner->nTrials) {
+      bucket->state = ncclTunerStateAgree;
+      tuner->nAgree++;
+    }
+  }
+  info->algorithm = cand->algorithm;
+  info->protocol = cand->protocol;
+  *nChannels = cand->nChannels;
+  *tuned = true;
+  return ncclSuccess;
+}
+
+void ncclTunerSampleLaunched(struct ncclTunerSample* sample, hipEvent_t* start, hipEvent_t* stop) {
+  sample->launched = true;
+  *start = sample->start;
+  *stop = sample->stop;
+}
+
+bool ncclTunerPending(struct ncclComm* comm) {
+  return comm->tuner && comm->tuner->nAgree > 0;
+}
+
+// Called by all ranks at the same point, the groupLaunch() after buckets finished exploring.
+ncclResult_t ncclTunerAgree(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclTuner* tuner = comm->tuner;
+  float* times = NULL;
+  int n, i;
+  if (tuner == NULL || tuner->nAgree == 0) return ncclSuccess;
+  n = tuner->nAgree*NCCL_TUNER_MAX_CANDIDATES;
+  NCCLCHECKGOTO(ncclCalloc(&times, n*comm->nRanks), ret, exit);
+
+  // Fastest launch of each candidate, -1 when none could be timed
+  i = 0;
+  for (int f=0; f<NCCL_NUM_FUNCTIONS; f++) {
+    for (int b=0; b<NCCL_TUNER_NBUCKETS; b++) {
+      struct ncclTunerBucket* bucket = tuner->buckets[f][b];
+      if (bucket == NULL || bucket->state != ncclTunerStateAgree) continue;
+      for (int c=0; c<bucket->nCandidates; c++) {
+        float best = -1;
+        for (int t=0; t<tuner->nTrials; t++) {
+          struct ncclTunerSample* sample = bucket->candidates[c].samples+t;
+          if (!sample->launched) continue;
+          float ms;
+          CUDACHECKGOTO(hipEventSynchronize(sample->stop), ret, exit);
+          CUDACHECKGOTO(hipEventElapsedTime(&ms, sample->start, sample->stop), ret, exit);
+          if (best < 0 || ms < best) best = ms;
+        }
+        times[comm->rank*n + i*NCCL_TUNER_MAX_CANDIDATES + c] = best;
+      }
+      i++;
+    }
+  }
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, times, n*sizeof(float)), ret, exit);
+
+  i = 0;
+  for (int f=0; f<NCCL_NUM_FUNCTIONS; f++) {
+    for (int b=0; b<NCCL_TUNER_NBUCKETS; b++) {
+      struct ncclTunerBucket* bucket = tuner->buckets[f][b];
+      if (bucket == NULL || bucket->state != ncclTunerStateAgree) continue;
+      float bestTime = -1;
+      bucket->best = 0;
+      for (int c=0; c<bucket->nCandidates; c++) {
+        // A collective takes as long as its slowest rank
+        float time = 0;
+        for (int r=0; r<comm->nRanks && time >= 0; r++) {
+          float t = times[r*n + i*NCCL_TUNER_MAX_CANDIDATES + c];
+          time = t < 0 ? -1 : std::max(time, t);
+        }
+        if (time >= 0 && (bestTime < 0 || time < bestTime)) {
+          bestTime = time;
+          bucket->best = c;
+        }
+      }
+      bucket->state = ncclTunerStateDecided;
+      struct ncclTunerCandidate* cand = bucket->candidates+bucket->best;
+      if (comm->rank == 0) {
+        INFO(NCCL_TUNING, "Online tuning %s %ld-%ld bytes -> %s/%s %d channels %.1f us (model %s/%s)",
+            ncclFuncStr[f], 1L<<b, (2L<<b)-1, ncclAlgoStr[cand->algorithm], ncclProtoStr[cand->protocol],
+            cand->nChannels, bestTime*1000, ncclAlgoStr[bucket->candidates[0].algorithm], ncclProtoStr[bucket->candidates[0].protocol]);
+      }
+      i++;
+    }
+  }
+  tuner->nAgree = 0;
+  ncclAlgoCacheInvalidate(comm);
+
+exit:
+  free(times);
+  return ret;
+}
@@ -12,6 +12,7 @@
 #include "net.h"
 #include "channel.h"
 #include "xml.h"
+#include "rccl_vars.h"
 
 // Pre-compute GPU->NIC, GPU->GPU and NIC->GPU paths
 
@@ -365,6 +366,19 @@ ncclResult_t ncclTopoCheckGdr(struct ncclTopoSystem* system, int64_t busId, int
   if (net->net.gdrSupport == 0) return ncclSuccess;
   if (gpu->gpu.gdrSupport == 0) return ncclSuccess;
 
+  // Measured bandwidths override the heuristics below, unless the user set them
+  NCCLCHECK(ncclGetLevel(&ncclTopoUserGdrLevel, NULL, "NCCL_NET_GDR_LEVEL"));
+  if (ncclTopoUserGdrLevel == -2 && (!read || ncclParamNetGdrRead() == -2)) {
+    float gdrBw, hostBw;
+    NCCLCHECK(ncclTopoCalibGdr(system, busId, netDev, read, &gdrBw, &hostBw));
+    if (gdrBw > 0) {
+      *useGdr = gdrBw >= hostBw ? 1 : 0;
+      INFO(NCCL_NET,"GPU Direct RDMA %s for GPU %lx / HCA %d (calibrated %.1f GB/s, %.1f GB/s through the host), read %d",
+          *useGdr ? "Enabled" : "Disabled", busId, netDev, gdrBw, hostBw, read);
+      return ncclSuccess;
+    }
+  }
+
   if (read) { // For reads (sends) only enable under certain conditions
     int gdrReadParam = ncclParamNetGdrRead();
     if (gdrReadParam == 0) return ncclSuccess;
@@ -497,7 +511,8 @@ ncclResult_t ncclTopoGetIntermediateRank(struct ncclTopoSystem* system, int rank
   return ncclSuccess;
 }
 
-NCCL_PARAM(PxnDisable, "PXN_DISABLE", 1);
+// 2 enables PXN on gfx94x nodes with xGMI between all GPUs only
+NCCL_PARAM(PxnDisable, "PXN_DISABLE", 2);
 
 // Net v4 plugins don't have non-blocking connect/accept. We can't therefore use
 // remote proxies without risking deadlocks
@@ -511,6 +526,7 @@ int ncclPxnDisable(struct ncclComm* comm) {
       pxnDisable = ncclParamPxnDisable();
     }
   }
+  if (pxnDisable == 2) return comm && comm->topo && comm->topo->xgmiPxn ? 0 : 1;
   return pxnDisable;
 }
 
@@ -567,6 +583,51 @@ static bool rcclPathOverride(struct ncclTopoSystem* system, uint64_t distance) {
   }
 }
 
+RCCL_PARAM(NetBalance, "NET_BALANCE", 0);
+
+struct ncclTopoRelay {
+  int gpu, net;
+};
+
+static int pathSharedLinks(struct ncclTopoLinkList* path1, struct ncclTopoLinkList* path2) {
+  int shared = 0;
+  for (int i=0; i<path1->count; i++) {
+    for (int j=0; j<path2->count; j++) shared += path1->list[i] == path2->list[j];
+  }
+  return shared;
+}
+
+// PXN relay of GPU g for NIC n (RCCL_NET_BALANCE). Instead of always relaying through the GPU closest
+// to the NIC, count for each eligible GPU how many links of its path to the NIC are already used by
+// the relays chosen so far, PCI switch uplinks included, and take the least loaded one. Ties go to
+// the GPU closest to the NIC, then to the highest bandwidth. *relay is -1 when no GPU qualifies.
+static ncclResult_t pxnBalancedRelay(struct ncclTopoSystem* system, int g, int n, int localGpuIndex,
+    struct ncclTopoRelay* relays, int nRelays, int* relay) {
+  struct ncclTopoNode* gpu = system->nodes[GPU].nodes+g;
+  int bestLoad = -1;
+  *relay = -1;
+  for (int p=0; p<system->nodes[GPU].count; p++) {
+    if (p == g) continue;
+    struct ncclTopoNode* peerNode = system->nodes[GPU].nodes+p;
+    struct ncclTopoLinkList* path = peerNode->paths[NET]+n;
+    if (path->type > PATH_PXB || peerNode->paths[GPU][g].type > PATH_NVL) continue;
+    if (path->bw <= gpu->paths[NET][n].bw && gpu->paths[NET][n].type <= PATH_PXB) continue;
+    int load = 0;
+    for (int r=0; r<nRelays; r++) {
+      load += pathSharedLinks(path, system->nodes[GPU].nodes[relays[r].gpu].paths[NET]+relays[r].net);
+    }
+    bool better = bestLoad == -1 || load < bestLoad;
+    if (!better && load == bestLoad && *relay != localGpuIndex) {
+      better = p == localGpuIndex || path->bw > system->nodes[GPU].nodes[*relay].paths[NET][n].bw;
+    }
+    if (better) {
+      bestLoad = load;
+      *relay = p;
+    }
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm* comm) {
   // Precompute paths between GPUs/NICs.
 
@@ -625,6 +686,15 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm
     }
   }
 
+  // On gfx94x nodes with xGMI between all GPUs, every GPU can reach the NIC of its rail through
+  // the GPU next to it, so PXN is enabled by default (NCCL_PXN_DISABLE=2)
+  system->xgmiPxn = system->nodes[GPU].count > 1 && IsArchMatch(system->nodes[GPU].nodes[0].gpu.gcn, "gfx94");
+  for (int g=0; g<system->nodes[GPU].count && system->xgmiPxn; g++) {
+    for (int p=0; p<system->nodes[GPU].count; p++) {
+      if (p != g && system->nodes[GPU].nodes[g].paths[GPU][p].type > PATH_NVL) system->xgmiPxn = false;
+    }
+  }
+
   // Special handling of gfx94x
 
 #if !defined(TOPO_EXPL)
@@ -646,6 +716,8 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm
 #endif
 
   // Update paths for NICs (no GPU Direct, PXN, ...)
+  struct ncclTopoRelay relays[NCCL_TOPO_MAX_NODES];
+  int nRelays = 0;
   for (int n=0; n<system->nodes[NET].count; n++) {
     struct ncclTopoNode* netNode = system->nodes[NET].nodes+n;
 
@@ -655,18 +727,24 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm
       if (ncclPxnDisable(comm) != 1) {
         int localGpuIndex;
         NCCLCHECK(ncclTopoGetLocalGpu(system, system->nodes[NET].nodes[n].id, &localGpuIndex));
+        if (rcclParamNetBalance()) NCCLCHECK(pxnBalancedRelay(system, g, n, localGpuIndex, relays, nRelays, &localGpuIndex));
         if (localGpuIndex != g && localGpuIndex != -1) {
           // PXN = PCI + NVLink.
           struct ncclTopoNode* peerNode = system->nodes[GPU].nodes+localGpuIndex;
+          // The relay runs at the speed of the slower of its hops, which a single xGMI link can be
+          float pxnBw = std::min(peerNode->paths[NET][n].bw, gpu->paths[GPU][localGpuIndex].bw);
           // Only use PXN for NIC n if remote GPU p ...
           if (peerNode->paths[NET][n].type <= PATH_PXB && // Is connected to the NIC through PCI
               peerNode->paths[GPU][g].type <= PATH_NVL && // Is connected to us through NVLink
-              (peerNode->paths[NET][n].bw > gpu->paths[NET][n].bw || // Has either higher BW to that NIC
-               gpu->paths[NET][n].type > PATH_PXB))                  // or avoids going through a CPU
-          // We can use that GPU as relay to communicate with that NIC.
-          // Only enabling it in the GPU->NIC direction for now to favor
-          // receiving locally and sending remotely (consistent with net.cc)
-          NCCLCHECK(addInterStep(system, GPU, localGpuIndex, GPU, g, NET, n));
+              (pxnBw > gpu->paths[NET][n].bw ||           // Has either higher BW to that NIC
+               (gpu->paths[NET][n].type > PATH_PXB &&     // or avoids going through a CPU
+                pxnBw >= gpu->paths[NET][n].bw))) {       // without losing bandwidth
+            // We can use that GPU as relay to communicate with that NIC.
+            // Only enabling it in the GPU->NIC direction for now to favor
+            // receiving locally and sending remotely (consistent with net.cc)
+            NCCLCHECK(addInterStep(system, GPU, localGpuIndex, GPU, g, NET, n));
+            if (nRelays < NCCL_TOPO_MAX_NODES) relays[nRelays++] = { localGpuIndex, n };
+          }
         }
       }
       // Update path when we dont want to / can't use GPU Direct RDMA.
@@ -794,6 +872,43 @@ void ncclTopoFree(struct ncclTopoSystem* system) {
   free(system);
 }
 
+// Searches change link bandwidths as they go, concurrent ones each need their own copy
+ncclResult_t ncclTopoDupSystem(struct ncclTopoSystem* system, struct ncclTopoSystem** dup) {
+  struct ncclTopoSystem* s;
+  NCCLCHECK(ncclCalloc(&s, 1));
+  memcpy(s, system, sizeof(struct ncclTopoSystem));
+  // Links and paths only point within the system, move them by the same offset
+  ptrdiff_t delta = (char*)s - (char*)system;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<s->nodes[t].count; n++) {
+      struct ncclTopoNode* node = s->nodes[t].nodes+n;
+      for (int l=0; l<node->nlinks; l++) node->links[l].remNode = (struct ncclTopoNode*)((char*)node->links[l].remNode + delta);
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) node->paths[p] = NULL;
+    }
+  }
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<s->nodes[t].count; n++) {
+      struct ncclTopoNode* node = s->nodes[t].nodes+n;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        struct ncclTopoLinkList* paths = system->nodes[t].nodes[n].paths[p];
+        if (paths == NULL) continue;
+        ncclResult_t ret = ncclCalloc(node->paths+p, s->nodes[p].count);
+        if (ret != ncclSuccess) {
+          ncclTopoFree(s);
+          return ret;
+        }
+        memcpy(node->paths[p], paths, s->nodes[p].count*sizeof(struct ncclTopoLinkList));
+        for (int i=0; i<s->nodes[p].count; i++) {
+          struct ncclTopoLinkList* path = node->paths[p]+i;
+          for (int h=0; h<path->count; h++) path->list[h] = (struct ncclTopoLink*)((char*)path->list[h] + delta);
+        }
+      }
+    }
+  }
+  *dup = s;
+  return ncclSuccess;
+}
+
 NCCL_PARAM(NChannelsPerNetPeer, "NCHANNELS_PER_NET_PEER", 1);
 NCCL_PARAM(NChannelsPerPeer, "NCHANNELS_PER_PEER", -2);
 
@@ -866,6 +981,9 @@ ncclResult_t ncclTopoComputeP2pChannels(struct ncclComm* comm) {
     comm->p2pnChannels = nextPow2(comm->p2pnChannels);
   }
 
+  // Comms placing p2p operations by top parent ranks also spread them over the same channels
+  if (comm->p2pTopParentChannels) comm->p2pnChannels = comm->sharedRes->tpP2pNChannels;
+
   // Init channels that weren't used so far
   for (int c=comm->nChannels; c<std::max(comm->nChannels, comm->p2pnChannels); c++) NCCLCHECK(initChannel(comm, c));
 
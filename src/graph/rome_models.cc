@@ -27,6 +27,9 @@ THE SOFTWARE.
 #include <sys/time.h>
 #include <algorithm>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <string>
 #include "rome_models.h"
 
 struct rcclRomeModel {
@@ -625,6 +628,202 @@ static struct rcclRomeModel romeTopoModels[] = {
   rome_model_81,
 };
 
+#define NBUILTIN_MODELS (sizeof(romeTopoModels)/sizeof(romeTopoModels[0]))
+
+// Models read from RCCL_TOPO_MODEL_FILE, a ':' separated list of files holding models in the format
+// written by RCCL_DUMP_ROME_MODEL_FILE. They are tried before the built-in models and are not
+// restricted to Rome CPUs, so new platforms can be described without rebuilding.
+static struct rcclRomeModel* fileModels = NULL;
+static int nFileModels = 0;
+static pthread_once_t fileModelsOnce = PTHREAD_ONCE_INIT;
+
+static const struct { const char* name; int type; } modelPathTypes[] = {
+  { "LOC", PATH_LOC }, { "NVL", PATH_NVL }, { "XGMI", PATH_NVL }, { "NVB", PATH_NVB }, { "PIX", PATH_PIX },
+  { "PXB", PATH_PXB }, { "PXN", PATH_PXN }, { "PHB", PATH_PHB }, { "SYS", PATH_SYS }, { "NET", PATH_NET }, { "DIS", PATH_DIS },
+};
+
+static char* modelSkip(char* p) {
+  while (*p) {
+    if (isspace(*p) || *p == ',') p++;
+    else if (p[0] == '/' && p[1] == '/') { while (*p && *p != '\n') p++; }
+    else break;
+  }
+  return p;
+}
+
+// Integer or PATH_ value, NULL on error
+static char* modelParseValue(char* p, int64_t* value) {
+  if (strncmp(p, "PATH_", 5) == 0) {
+    p += 5;
+    for (int t = 0; t < sizeof(modelPathTypes)/sizeof(modelPathTypes[0]); t++) {
+      size_t len = strlen(modelPathTypes[t].name);
+      if (strncmp(p, modelPathTypes[t].name, len) == 0 && !isalnum(p[len])) {
+        *value = modelPathTypes[t].type;
+        return p+len;
+      }
+    }
+    return NULL;
+  }
+  char* end;
+  *value = strtoll(p, &end, 0);
+  return end == p ? NULL : end;
+}
+
+// "{ v, v, ... }"
+static char* modelParseList(char* p, int64_t* values, int maxValues, int* count) {
+  *count = 0;
+  p = modelSkip(p+1);
+  while (*p && *p != '}') {
+    if (*count == maxValues) return NULL;
+    if ((p = modelParseValue(p, values+(*count)++)) == NULL) return NULL;
+    p = modelSkip(p);
+  }
+  return *p ? p+1 : NULL;
+}
+
+// One or more adjacent "..." literals
+static char* modelParseString(char* p, const char** str) {
+  std::string value;
+  while (*p == '"') {
+    char* end = strchr(p+1, '"');
+    if (end == NULL) return NULL;
+    value.append(p+1, end-p-1);
+    p = modelSkip(end+1);
+  }
+  *str = strdup(value.c_str());
+  return p;
+}
+
+// Parses "{ .field = value, ... }" at p, returns the position after the closing brace or NULL.
+static char* modelParse(char* p, struct rcclRomeModel* m, int64_t* values) {
+  const int maxValues = NCCL_TOPO_MAX_NODES*NCCL_TOPO_MAX_NODES;
+  int nGpuIds = 0, nNicIds = 0, nGpuNuma = 0, nNicNuma = 0, nConn = 0, nGdr = 0;
+  m->pattern = m->ringBase = m->options = "";
+  p = modelSkip(p+1);
+  while (*p == '.') {
+    char* name = ++p;
+    while (isalnum(*p) || *p == '_') p++;
+    size_t len = p-name;
+    p = modelSkip(p);
+    if (*p != '=') return NULL;
+    p = modelSkip(p+1);
+#define FIELD(f) (len == strlen(f) && strncmp(name, f, len) == 0)
+    if (*p == '"') {
+      const char** str;
+      if (FIELD("pattern")) str = &m->pattern;
+      else if (FIELD("ringBase")) str = &m->ringBase;
+      else if (FIELD("options")) str = &m->options;
+      else if (FIELD("treeBase")) str = &m->treeBase;
+      else return NULL;
+      if ((p = modelParseString(p, str)) == NULL) return NULL;
+    } else if (*p == '{') {
+      int count;
+      if ((p = modelParseList(p, values, maxValues, &count)) == NULL) return NULL;
+      if (count > NCCL_TOPO_MAX_NODES && !FIELD("connMatrix") && !FIELD("gdrLevel")) return NULL;
+      for (int i = 0; i < count; i++) {
+        if (FIELD("gpuIds")) m->gpuIds[i] = values[i];
+        else if (FIELD("nicIds")) m->nicIds[i] = values[i];
+        else if (FIELD("gpuNuma")) m->gpuNuma[i] = values[i];
+        else if (FIELD("nicNuma")) m->nicNuma[i] = values[i];
+        else if (FIELD("connMatrix")) m->connMatrix[i] = values[i];
+        else if (FIELD("gdrLevel")) m->gdrLevel[i] = values[i];
+        else return NULL;
+      }
+      if (FIELD("gpuIds")) nGpuIds = count;
+      else if (FIELD("nicIds")) nNicIds = count;
+      else if (FIELD("gpuNuma")) nGpuNuma = count;
+      else if (FIELD("nicNuma")) nNicNuma = count;
+      else if (FIELD("connMatrix")) nConn = count;
+      else if (FIELD("gdrLevel")) nGdr = count;
+    } else {
+      int64_t value;
+      if ((p = modelParseValue(p, &value)) == NULL) return NULL;
+      if (FIELD("nGpus")) m->nGpus = value;
+      else if (FIELD("nCpus")) m->nCpus = value;
+      else if (FIELD("nNics")) m->nNics = value;
+      else if (FIELD("nLinks")) m->nLinks = value;
+      else return NULL;
+    }
+#undef FIELD
+    p = modelSkip(p);
+  }
+  if (*p != '}') return NULL;
+  // Every table must be complete, the matchers index them without further checks
+  if (m->nGpus <= 0 || m->nGpus > NCCL_TOPO_MAX_NODES || m->nNics < 0 || m->nNics > NCCL_TOPO_MAX_NODES ||
+      nGpuIds != m->nGpus || nGpuNuma != m->nGpus || nConn != m->nGpus*m->nGpus ||
+      nNicIds != m->nNics || nNicNuma != m->nNics || nGdr != m->nNics*m->nGpus || m->ringBase[0] == 0) return NULL;
+  return p+1;
+}
+
+static ncclResult_t loadModelFile(const char* path, int64_t* values) {
+  ncclResult_t ret = ncclSuccess;
+  char* buf = NULL;
+  char* p;
+  long size;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    WARN("Unable to open topology model file %s", path);
+    return ncclSystemError;
+  }
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  NCCLCHECKGOTO(ncclCalloc(&buf, size+1), ret, exit);
+  if (fread(buf, 1, size, file) != size) {
+    WARN("Unable to read topology model file %s", path);
+    ret = ncclSystemError;
+    goto exit;
+  }
+  p = buf;
+  while ((p = strchr(p, '{')) != NULL) {
+    NCCLCHECKGOTO(ncclRealloc(&fileModels, nFileModels, nFileModels+1), ret, exit);
+    struct rcclRomeModel* m = fileModels+nFileModels;
+    char* end = modelParse(p, m, values);
+    if (end == NULL) {
+      WARN("Invalid topology model at offset %ld of %s", (long)(p-buf), path);
+      ret = ncclInvalidUsage;
+      goto exit;
+    }
+    INFO(NCCL_GRAPH, "Loaded topology model %d (%d GPUs, %d NICs) from %s", nFileModels, m->nGpus, m->nNics, path);
+    nFileModels++;
+    p = end;
+  }
+exit:
+  free(buf);
+  fclose(file);
+  return ret;
+}
+
+static void loadFileModels() {
+  const char* env = getenv("RCCL_TOPO_MODEL_FILE");
+  if (env == NULL) return;
+  INFO(NCCL_ENV, "RCCL_TOPO_MODEL_FILE set by environment to %s", env);
+  int64_t* values;
+  if (ncclCalloc(&values, NCCL_TOPO_MAX_NODES*NCCL_TOPO_MAX_NODES) != ncclSuccess) return;
+  char* paths = strdup(env);
+  char* state;
+  for (char* path = strtok_r(paths, ":", &state); path; path = strtok_r(NULL, ":", &state)) {
+    // A broken file is reported and skipped, the models read before it are kept
+    loadModelFile(path, values);
+  }
+  free(paths);
+  free(values);
+}
+
+static int romeModelCount() {
+  pthread_once(&fileModelsOnce, loadFileModels);
+  return nFileModels + NBUILTIN_MODELS;
+}
+
+static struct rcclRomeModel* romeModel(int i) {
+  return i < nFileModels ? fileModels+i : romeTopoModels+(i-nFileModels);
+}
+
+static void romeModelName(int i, char* line) {
+  if (i < nFileModels) sprintf(line, "Found matching topology model %d from RCCL_TOPO_MODEL_FILE", i);
+  else sprintf(line, "Found matching Rome model index %d", i-nFileModels);
+}
+
 /* Parse user defined rings. Format is like :
  * "0 1|1 0|0 1 2 3|3 2 1 0|N0 0 2 3 1 N1|1 3 2 0|0 1 2 3 4 5 6 7|N2 7 6 5 4 3 2 1 0 N1"
  * Network interfaces can be optionally specified by N prefix.
@@ -1145,76 +1344,81 @@ static ncclResult_t parseRomeSystem(struct ncclTopoSystem* system, struct rcclRo
   return ncclSuccess;
 }
 
-static bool permuteGpuIds(int *g, int n, int last, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int* time, bool nbio, bool ignore_numa) {
-  (*time) ++;
-  if (n == last) {
-    int i, j;
-    // match GPU numa
-    if (!ignore_numa) {
-      for (i = 0; i < ref->nGpus; i++)
-        if (ref->gpuNuma[i] != topo->gpuNuma[g[i]]) break;
-      if (i < ref->nGpus) return false;
+// Model matching is a backtracking search in the spirit of VF2: GPUs (then NICs) of the reference
+// model are assigned one at a time and each assignment is checked against the ones already made, so
+// inconsistent partial mappings are cut at once instead of after completing all n! permutations.
+// Nodes are first screened by their XGMI degree and bandwidth. The assignments are tried in the
+// order of the former exhaustive permutation, so the same mapping is found.
+
+// XGMI link count and bandwidth of each GPU, the labels screening the candidates
+static void modelGpuLabels(struct rcclRomeModel* m, int* degree, int* bw) {
+  for (int i = 0; i < m->nGpus; i++) {
+    degree[i] = bw[i] = 0;
+    for (int j = 0; j < m->nGpus; j++) {
+      int c = m->connMatrix[i*m->nGpus+j] + m->connMatrix[j*m->nGpus+i];
+      if (c) degree[i]++;
+      bw[i] += c;
     }
+  }
+}
+
+// Can reference GPU n be mapped to g[n], given the mapping of GPUs 0..n-1
+static bool matchGpu(int *g, int n, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int* refLabels, int* topoLabels, bool nbio, bool ignore_numa) {
+  int t = g[n], ng = ref->nGpus;
+  if (refLabels[n] != topoLabels[t] || refLabels[ng+n] != topoLabels[ng+t]) return false;
+  // match GPU numa
+  if (!ignore_numa && ref->gpuNuma[n] != topo->gpuNuma[t]) return false;
+  for (int j = 0; j <= n; j++) {
     // match XGMI connection
-    for (i = 0; i < ref->nGpus; i++) {
-      for (j = 0; j < ref->nGpus; j++) {
-        if (ref->connMatrix[i*ref->nGpus+j] != topo->connMatrix[g[i]*ref->nGpus+g[j]]) break;
-        if ((ref->gpuIds[i]-ref->gpuIds[j])*(topo->gpuIds[g[i]]-topo->gpuIds[g[j]]) < 0) break;
-      }
-      if (j < ref->nGpus) break;
-    }
-    if (i < ref->nGpus) return false;
+    if (ref->connMatrix[n*ng+j] != topo->connMatrix[t*ng+g[j]]) return false;
+    if (ref->connMatrix[j*ng+n] != topo->connMatrix[g[j]*ng+t]) return false;
+    if ((ref->gpuIds[n]-ref->gpuIds[j])*(topo->gpuIds[t]-topo->gpuIds[g[j]]) < 0) return false;
     // match NBIO
-    if (nbio) {
-      for (i = 0; i < ref->nGpus; i++) {
-        for (j = 0; j < ref->nGpus; j++) {
-          if (i == j) continue;
-          bool nbio_ref = (ref->gpuIds[i]&0xf0000) == (ref->gpuIds[j]&0xf0000);
-          bool nbio_topo = (topo->gpuIds[g[i]]&0xf0000) == (topo->gpuIds[g[j]]&0xf0000);
-          if (nbio_ref != nbio_topo) break;
-          if (nbio_ref && ((ref->gpuIds[i]-ref->gpuIds[j])*(topo->gpuIds[g[i]]-topo->gpuIds[g[j]]) < 0)) break;
-        }
-        if (j < ref->nGpus) break;
-      }
-      if (i < ref->nGpus) return false;
-    }
-    return true;
-  } else {
-    for (int i = n; i <= last; i++) {
-      std::swap(g[n], g[i]);
-      if (permuteGpuIds(g, n+1, last, ref, topo, time, nbio, ignore_numa)) return true;
-      std::swap(g[n], g[i]);
+    if (nbio && j != n) {
+      bool nbio_ref = (ref->gpuIds[n]&0xf0000) == (ref->gpuIds[j]&0xf0000);
+      bool nbio_topo = (topo->gpuIds[t]&0xf0000) == (topo->gpuIds[g[j]]&0xf0000);
+      if (nbio_ref != nbio_topo) return false;
     }
   }
+  return true;
+}
+
+static bool searchGpuIds(int *g, int n, int last, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int* refLabels, int* topoLabels, int* time, bool nbio, bool ignore_numa) {
+  for (int i = n; i <= last; i++) {
+    (*time) ++;
+    std::swap(g[n], g[i]);
+    if (matchGpu(g, n, ref, topo, refLabels, topoLabels, nbio, ignore_numa) &&
+        (n == last || searchGpuIds(g, n+1, last, ref, topo, refLabels, topoLabels, time, nbio, ignore_numa))) return true;
+    std::swap(g[n], g[i]);
+  }
   return false;
 }
 
+static bool permuteGpuIds(int *g, int last, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int* time, bool nbio, bool ignore_numa) {
+  int refLabels[2*NCCL_TOPO_MAX_NODES], topoLabels[2*NCCL_TOPO_MAX_NODES];
+  modelGpuLabels(ref, refLabels, refLabels+ref->nGpus);
+  modelGpuLabels(topo, topoLabels, topoLabels+topo->nGpus);
+  return searchGpuIds(g, 0, last, ref, topo, refLabels, topoLabels, time, nbio, ignore_numa);
+}
+
+// Can reference NIC s be mapped to n[s], given the GPU mapping g
+static bool matchNet(int *n, int *g, int s, struct rcclRomeModel* ref, struct rcclRomeModel* topo, bool ignore_numa) {
+  // match NET numa
+  if (!ignore_numa && ref->nicNuma[s] != topo->nicNuma[n[s]]) return false;
+  // match gdr level
+  for (int j = 0; j < ref->nGpus; j++) {
+    if (ref->gdrLevel[s*ref->nGpus+j] != topo->gdrLevel[n[s]*ref->nGpus+g[j]]) return false;
+  }
+  return true;
+}
+
 static bool permuteNetIds(int *n, int *g, int s, int last, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int* time, bool ignore_numa) {
-  (*time) ++;
-  if (s == last) {
-    int i, j;
-    // match NET numa
-    if (!ignore_numa) {
-      for (i = 0; i < ref->nNics; i++) {
-        if (ref->nicNuma[i] != topo->nicNuma[n[i]]) break;
-      }
-      if (i < ref->nNics) return false;
-    }
-    // match gdr level
-    for (i = 0; i < ref->nNics; i++) {
-      for (j = 0; j < ref->nGpus; j++) {
-        if (ref->gdrLevel[i*ref->nGpus+j] != topo->gdrLevel[n[i]*ref->nGpus+g[j]]) break;
-      }
-      if (j < ref->nGpus) break;
-    }
-    if (i < ref->nNics) return false;
-    return true;
-  } else {
-    for (int i = s; i <= last; i++) {
-      std::swap(n[s], n[i]);
-      if (permuteNetIds(n, g, s+1, last, ref, topo, time, ignore_numa)) return true;
-      std::swap(n[s], n[i]);
-    }
+  for (int i = s; i <= last; i++) {
+    (*time) ++;
+    std::swap(n[s], n[i]);
+    if (matchNet(n, g, s, ref, topo, ignore_numa) &&
+        (s == last || permuteNetIds(n, g, s+1, last, ref, topo, time, ignore_numa))) return true;
+    std::swap(n[s], n[i]);
   }
   return false;
 }
@@ -1228,7 +1432,9 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
   int ncpus = system->nodes[CPU].count;
   int nnets = system->nodes[NET].count;
 
-  if (ngpus > 8) return ncclSuccess;
+  int nModels = romeModelCount();
+  // larger systems can only match models from RCCL_TOPO_MODEL_FILE
+  if (ngpus > 8 && nFileModels == 0) return ncclSuccess;
   // only valid on Rome
   int arch, vendor, model;
   NCCLCHECK(ncclTopoCpuType(system, &arch, &vendor, &model));
@@ -1239,7 +1445,7 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
   NCCLCHECK(parseRomeSystem(system, &romeTopo, pattern));
 
   // recognize system as Rome 4P2H even if no matching model
-  if (ngpus > 4 && romeTopo.nLinks) system->type |= RCCL_TOPO_4P2H_ROME;
+  if (ngpus > 4 && ngpus <= 8 && romeTopo.nLinks) system->type |= RCCL_TOPO_4P2H_ROME;
 
   int g[NCCL_TOPO_MAX_NODES], n[NCCL_TOPO_MAX_NODES];
   int time = 0;
@@ -1256,34 +1462,40 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
   }
   if (i < romeTopo.nGpus) match_nbio = false;
 
-  for (i = 0; i < sizeof(romeTopoModels)/sizeof(romeTopoModels[0]); i++) {
-    bool ignore_cpu = checkOption(romeTopoModels[i].options, "noCpuCheck");
+  struct rcclRomeModel* ref = NULL;
+  for (i = 0; i < nModels; i++) {
+    ref = romeModel(i);
+    // built-in models of larger systems are left to parse1H16P() and parse4H4P()
+    if (i >= nFileModels && ngpus > 8) continue;
+    // models from files describe the platform they were dumped on
+    bool ignore_cpu = i < nFileModels || checkOption(ref->options, "noCpuCheck");
     if (!ignore_cpu && (arch != NCCL_TOPO_CPU_ARCH_X86 || vendor != NCCL_TOPO_CPU_VENDOR_AMD || model != NCCL_TOPO_CPU_TYPE_ROME))
       continue;
-    bool ignore_numa = checkOption(romeTopoModels[i].options, "disableNumaMatching");
-    if (!ignore_numa && romeTopo.nCpus != romeTopoModels[i].nCpus) continue;
-    if (romeTopo.nGpus != romeTopoModels[i].nGpus ||
-      romeTopo.nNics != romeTopoModels[i].nNics || romeTopo.nLinks != romeTopoModels[i].nLinks) continue;
-    if (!ignore_numa && strcmp(romeTopoModels[i].pattern, pattern)) continue;
-    // permute GPU IDs
+    bool ignore_numa = checkOption(ref->options, "disableNumaMatching");
+    if (!ignore_numa && romeTopo.nCpus != ref->nCpus) continue;
+    if (romeTopo.nGpus != ref->nGpus ||
+      romeTopo.nNics != ref->nNics || romeTopo.nLinks != ref->nLinks) continue;
+    if (!ignore_numa && strcmp(ref->pattern, pattern)) continue;
+    // match GPU IDs
     for (int j = 0; j < ngpus; j++) g[j] = (j+2)%ngpus;
-    if (!permuteGpuIds(g, 0, ngpus-1, romeTopoModels+i, &romeTopo, &time, ignore_cpu ? false : match_nbio, ignore_numa)) continue;
+    if (!permuteGpuIds(g, ngpus-1, ref, &romeTopo, &time, ignore_cpu ? false : match_nbio, ignore_numa)) continue;
     if (nnets > 1) {
-      // permute NET IDs
+      // match NET IDs
       for (int j = 0; j < nnets; j++) n[j] = (j+2)%nnets;
-      if (permuteNetIds(n, g, 0, nnets-1, romeTopoModels+i, &romeTopo, &time, ignore_numa)) break;
+      if (permuteNetIds(n, g, 0, nnets-1, ref, &romeTopo, &time, ignore_numa)) break;
     } else break;
   }
   gettimeofday(&tve, NULL);
   float t = (tve.tv_sec - tvs.tv_sec)*1E3 + (tve.tv_usec - tvs.tv_usec)/1E3;
-  if (i >= sizeof(romeTopoModels)/sizeof(romeTopoModels[0])) {
-    //printf("No solution in %.2fms (%d iter)\n", t, time);
+  if (i >= nModels) {
+    TRACE(NCCL_GRAPH, "No matching topology model in %.2fms (%d iter)", t, time);
     return ncclSuccess;
   }
 
   char line[1024];
-  //sprintf(line, "Found matching Rome model index %d in %.2fms (%d iter) with GPU mapping: ", i, t, time);
-  sprintf(line, "Found matching Rome model index %d with GPU mapping: ", i);
+  romeModelName(i, line);
+  TRACE(NCCL_GRAPH, "%s in %.2fms (%d iter)", line, t, time);
+  strcat(line, " with GPU mapping: ");
   int offset = strlen(line);
   for (int k = 0; k < ngpus; k++) {
     sprintf(line+offset, "%d ", g[k]);
@@ -1298,19 +1510,45 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
     }
   }
   INFO(NCCL_GRAPH, "%s", line);
-  parseOptions(system, romeTopoModels[i].options);
+  parseOptions(system, ref->options);
 
   // create 4P2H based on reference and remapped ids
-  NCCLCHECK(parseGraph(romeTopoModels[i].ringBase, system, graph, g, nnets > 1 ? n : NULL));
-  if (romeTopoModels[i].treeBase != nullptr) NCCLCHECK(parseGraphLight(romeTopoModels[i].treeBase, system, graph, g));
+  NCCLCHECK(parseGraph(ref->ringBase, system, graph, g, nnets > 1 ? n : NULL));
+  if (ref->treeBase != nullptr) NCCLCHECK(parseGraphLight(ref->treeBase, system, graph, g));
   return ncclSuccess;
 }
 
+// Maps model GPU k to the lowest unused GPU of NUMA node k/numaGpus whose XGMI connections agree with
+// the GPUs mapped so far. Mappings are thus tried in lexicographic order, the order in which the
+// per NUMA node permutations were formerly enumerated.
+static bool match1H16P(int* g, bool* used, int k, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int numaGpus, int* n) {
+  int ng = ref->nGpus;
+  if (k == ng) {
+    if (ref->nNics <= 1) return true;
+    // permute NET IDs
+    int time = 0;
+    for (int m = 0; m < ref->nNics; m++) n[m] = (m+2)%ref->nNics;
+    return permuteNetIds(n, g, 0, ref->nNics-1, ref, topo, &time, false);
+  }
+  for (int t = 0; t < ng; t++) {
+    if (used[t] || topo->gpuNuma[t] != k/numaGpus) continue;
+    g[k] = t;
+    int m;
+    for (m = 0; m <= k; m++) {
+      if (ref->connMatrix[k*ng+m] != topo->connMatrix[t*ng+g[m]]) break;
+      if (ref->connMatrix[m*ng+k] != topo->connMatrix[g[m]*ng+t]) break;
+    }
+    if (m <= k) continue;
+    used[t] = true;
+    if (match1H16P(g, used, k+1, ref, topo, numaGpus, n)) return true;
+    used[t] = false;
+  }
+  return false;
+}
+
 ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   #define NUMA_CPUS 4
   #define NUMA_GPUS 4
-  #define NUMA_PERMUTE_COUNT 24
-  #define TOTAL_PERMUTE_COUNT (NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT)
 
   static char ringRemap[256];
   int i;
@@ -1333,90 +1571,42 @@ ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* gra
   // only match for system with 16 GPUs
   if (ngpus != 16 || ncpus != NUMA_CPUS) return ncclSuccess;
 
-  int gcnt = 0;
-  int *g16, n[NCCL_TOPO_MAX_NODES];
-  int *all_gpu_permutations = (int *)malloc(TOTAL_PERMUTE_COUNT*NUMA_CPUS*NUMA_GPUS*sizeof(int));
+  int g16[NCCL_TOPO_MAX_NODES], n[NCCL_TOPO_MAX_NODES];
+  int nModels = romeModelCount();
+  struct rcclRomeModel* ref = NULL;
   struct timeval tvs, tve;
   gettimeofday(&tvs, NULL);
-  for (i = 0; i < sizeof(romeTopoModels)/sizeof(romeTopoModels[0]); i++) {
-    if (romeTopo.nCpus != romeTopoModels[i].nCpus || romeTopo.nGpus != romeTopoModels[i].nGpus ||
-      romeTopo.nNics != romeTopoModels[i].nNics || romeTopo.nLinks != romeTopoModels[i].nLinks) continue;
-    if (strcmp(romeTopoModels[i].pattern, pattern)) continue;
-    int j, r[ngpus], g[ngpus];
-    int numa_gpu_permutations[NUMA_CPUS][NUMA_PERMUTE_COUNT][NUMA_GPUS];
-    // permute GPUs for each CPU NUMA nodes
+  for (i = 0; i < nModels; i++) {
+    ref = romeModel(i);
+    if (romeTopo.nCpus != ref->nCpus || romeTopo.nGpus != ref->nGpus ||
+      romeTopo.nNics != ref->nNics || romeTopo.nLinks != ref->nLinks) continue;
+    if (strcmp(ref->pattern, pattern)) continue;
+    // model and system must have NUMA_GPUS GPUs on each CPU NUMA node
+    int j;
     for (j = 0; j < ncpus; j++) {
-      int ngpusPerNuma = 0, cnt = 0, npermute = 0;
+      int refGpus = 0, topoGpus = 0;
       for (int k = 0; k < ngpus; k++) {
-        if (romeTopoModels[i].gpuNuma[k] != j) continue;
-        r[ngpusPerNuma++] = k;
+        if (ref->gpuNuma[k] == j) refGpus++;
+        if (romeTopo.gpuNuma[k] == j) topoGpus++;
       }
-      if (ngpusPerNuma == 0) continue;
-      if (ngpusPerNuma != NUMA_GPUS) break;
-      gcnt++;
-      // init GPU mapping
-      for (int k = 0; k < ngpus; k++) {
-        if (romeTopo.gpuNuma[k] != j) continue;
-        g[(2+cnt++)%ngpusPerNuma] = k;
-      }
-      std::sort(g, g+ngpusPerNuma);
-      do {
-        for (int n = 0; n < ngpusPerNuma; n++)
-          numa_gpu_permutations[j][npermute][n] = g[n];
-        npermute++;
-      } while (std::next_permutation(g, g+ngpusPerNuma));
-      if (npermute != NUMA_PERMUTE_COUNT) break;
+      if (refGpus != NUMA_GPUS || topoGpus != NUMA_GPUS) break;
     }
     if (j < ncpus) continue;
-    // permute GPUs for all CPU NUMA nodes
-    for (int a = 0; a < NUMA_PERMUTE_COUNT; a++) {
-      for (int b = 0; b < NUMA_PERMUTE_COUNT; b++) {
-        for (int c = 0; c < NUMA_PERMUTE_COUNT; c++) {
-          for (int d = 0; d < NUMA_PERMUTE_COUNT; d++) {
-            uint64_t offset = ((a*NUMA_PERMUTE_COUNT+b)*NUMA_PERMUTE_COUNT+c)*NUMA_PERMUTE_COUNT+d;
-            //offset = (offset+TOTAL_PERMUTE_COUNT/2)%TOTAL_PERMUTE_COUNT;
-            offset *= (NUMA_CPUS*NUMA_GPUS);
-            memcpy(all_gpu_permutations+offset, &numa_gpu_permutations[0][a][0], NUMA_GPUS*sizeof(int));
-            memcpy(all_gpu_permutations+offset+NUMA_GPUS, &numa_gpu_permutations[1][b][0], NUMA_GPUS*sizeof(int));
-            memcpy(all_gpu_permutations+offset+NUMA_GPUS*2, &numa_gpu_permutations[2][c][0], NUMA_GPUS*sizeof(int));
-            memcpy(all_gpu_permutations+offset+NUMA_GPUS*3, &numa_gpu_permutations[3][d][0], NUMA_GPUS*sizeof(int));
-          }
-        }
-      }
-    }
-    // match all GPUs' XGMI connection
-    int p;
-    for (p = 0; p < TOTAL_PERMUTE_COUNT; p++) {
-      g16 = all_gpu_permutations+p*NUMA_CPUS*NUMA_GPUS;
-      int k;
-      for (k = 0; k < romeTopoModels[i].nGpus; k++) {
-        int m;
-        for (m = 0; m < romeTopoModels[i].nGpus; m++) {
-          if (romeTopoModels[i].connMatrix[k*romeTopoModels[i].nGpus+m] != romeTopo.connMatrix[g16[k]*romeTopoModels[i].nGpus+g16[m]]) break;
-        }
-        if (m < romeTopoModels[i].nGpus) break;
-      }
-      if (k < romeTopoModels[i].nGpus) continue;
-      //printf("found match %d: ", p); for (int n = 0; n < NUMA_CPUS*NUMA_GPUS; n++) printf("%d ", g16[n]); printf("\n");
-      if (nnets > 1) {
-        // permute NET IDs
-        int time = 0;
-        for (int m = 0; m < nnets; m++) n[m] = (m+2)%nnets;
-        if (permuteNetIds(n, g16, 0, nnets-1, romeTopoModels+i, &romeTopo, &time, false)) break;
-      } else break;
-    }
-    if (p < TOTAL_PERMUTE_COUNT) break;
+    // match all GPUs' XGMI connection, GPUs of NUMA node j filling model GPUs j*NUMA_GPUS..
+    bool used[NCCL_TOPO_MAX_NODES] = { false };
+    if (match1H16P(g16, used, 0, ref, &romeTopo, NUMA_GPUS, n)) break;
   }
   gettimeofday(&tve, NULL);
   float t = (tve.tv_sec - tvs.tv_sec)*1E3 + (tve.tv_usec - tvs.tv_usec)/1E3;
-  if (i >= sizeof(romeTopoModels)/sizeof(romeTopoModels[0])) {
-    //printf("No solution in %.2fms\n", t);
+  if (i >= nModels) {
+    TRACE(NCCL_GRAPH, "No matching 16P1H model in %.2fms", t);
     return ncclSuccess;
   }
 
   char line[1024];
-  //sprintf(line, "Found matching Rome model index %d in %.2fms with GPU mapping: ", i, t);
-  sprintf(line, "Found matching Rome model index %d with GPU mapping: ", i);
+  romeModelName(i, line);
+  TRACE(NCCL_GRAPH, "%s in %.2fms", line, t);
+  strcat(line, " with GPU mapping: ");
   int offset = strlen(line);
   for (int k = 0; k < ngpus; k++) {
     sprintf(line+offset, "%d ", g16[k]);
@@ -1432,14 +1622,12 @@ ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* gra
   }
   INFO(NCCL_GRAPH, "%s", line);
   system->type |= RCCL_TOPO_16P1H;
-  parseOptions(system, romeTopoModels[i].options);
+  parseOptions(system, ref->options);
 
   // create 16P1H based on reference and remapped ids
-  NCCLCHECK(parseGraph(romeTopoModels[i].ringBase, system, graph, g16, nnets > 1 ? n : NULL));
+  NCCLCHECK(parseGraph(ref->ringBase, system, graph, g16, nnets > 1 ? n : NULL));
 
-  if (romeTopoModels[i].treeBase != nullptr) NCCLCHECK(parseGraphLight(romeTopoModels[i].treeBase, system, graph, g16));
-  // clean up
-  free(all_gpu_permutations);
+  if (ref->treeBase != nullptr) NCCLCHECK(parseGraphLight(ref->treeBase, system, graph, g16));
   return ncclSuccess;
 }
 
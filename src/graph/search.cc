@@ -10,8 +10,12 @@
 #include "topo.h"
 #include "xml.h"
 #include <math.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include "rome_models.h"
+#include "rccl_vars.h"
+#include <algorithm>
 
 NCCL_PARAM(CrossNic, "CROSS_NIC", 2);
 
@@ -40,6 +44,10 @@ ncclResult_t ncclTopoSearchInit(struct ncclTopoSystem* system) {
   system->maxBw = 0.0;
   system->totalBw = 0.0;
   int inter = system->nodes[NET].count;
+  system->netRails = inter > 0;
+  for (int n=0; n<inter; n++) {
+    if (system->nodes[NET].nodes[n].net.rail == NCCL_TOPO_UNDEF) system->netRails = false;
+  }
   if (inter == 0 && system->nodes[GPU].count == 1) {
     system->maxBw = LOC_BW;
     return ncclSuccess;
@@ -278,6 +286,27 @@ ncclResult_t ncclTopoSearchRec(struct ncclTopoSystem* system, struct ncclTopoGra
 #define FORCED_ORDER_PCI 1
 #define FORCED_ORDER_REPLAY 2
 
+// Parallel search. The first GPUs tried for the first channel are the top level branches of the
+// search, numbered in the order they are tried. A search thread only explores the branches of its
+// range and stops once a thread with an earlier range found a graph with maxChannels.
+struct ncclTopoSearchShared {
+  int perfect;       // first thread having found a graph with maxChannels
+};
+
+struct ncclTopoSearchBranches {
+  int next;          // top level branches seen so far
+  int first, last;   // range explored, last excluded
+  int thread;
+  struct ncclTopoSearchShared* shared;
+};
+
+static thread_local struct ncclTopoSearchBranches* searchBranches = NULL;
+
+static bool ncclTopoSearchStopped(struct ncclTopoSearchBranches* branches) {
+  struct ncclTopoSearchShared* shared = branches->shared;
+  return __atomic_load_n(&shared->perfect, __ATOMIC_RELAXED) < branches->thread;
+}
+
 ncclResult_t ncclTopoReplayGetGpu(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int step, int* g) {
   *g = -1;
   if (graph->nChannels == 0) return ncclInternalError;
@@ -296,6 +325,10 @@ ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopo
 ncclResult_t ncclTopoSearchTryGpu(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* saveGraph, int step, int backToNet, int backToFirstRank, int forcedOrder, int *time, int type, int index, int g) {
   const uint64_t flag = 1ULL<<(graph->nChannels);
   struct ncclTopoNode* gpu;
+  if (searchBranches && step == 0 && graph->nChannels == 0) {
+    int b = searchBranches->next++;
+    if (b < searchBranches->first || b >= searchBranches->last) return ncclSuccess;
+  }
   NCCLCHECK(ncclTopoFollowPath(system, graph, type, index, GPU, g, 1, &gpu));
   if (gpu) {
     gpu->used ^= flag;
@@ -406,6 +439,13 @@ ncclResult_t ncclTopoCompareGraphs(struct ncclTopoSystem* system, struct ncclTop
 //    might have been choosen by GPU 0 (case with multiple independent communicators per node)
 // 3. Then add the NETs to the final list if they were not already added by another closer GPU.
 
+// Bandwidth left on the most loaded link of a path, links being shared by all GPUs of the graph
+static float pathResidualBw(struct ncclTopoLinkList* path) {
+  float bw = path->bw;
+  for (int i=0; i<path->count; i++) bw = std::min(bw, path->list[i]->bw);
+  return bw;
+}
+
 ncclResult_t ncclTopoSelectNets(struct ncclTopoSystem* system, int typeInter, int gpu, int* nets, int* netCountRet) {
   int netCount = 0;
   int localNetCount;
@@ -429,6 +469,12 @@ ncclResult_t ncclTopoSelectNets(struct ncclTopoSystem* system, int typeInter, in
         for (int i=0; i<localNetCount-1; i++) localNets[i] = localNets[i+1];
         localNets[localNetCount-1] = net0;
       }
+      // Try first the NICs which channels already placed by any GPU left the most bandwidth to
+      if (rcclParamNetBalance()) {
+        std::stable_sort(localNets, localNets+localNetCount, [paths](int n1, int n2) {
+          return pathResidualBw(paths+n1) > pathResidualBw(paths+n2);
+        });
+      }
       // Append NICs to list
       for (int i=0; i<localNetCount; i++) {
         int n = localNets[i];
@@ -448,6 +494,10 @@ ncclResult_t ncclTopoSelectNets(struct ncclTopoSystem* system, int typeInter, in
 ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* saveGraph, struct ncclTopoNode* gpu, int step, int backToNet, int backToFirstRank, int forcedOrder, int *time) {
   if ((*time) <= 0) return ncclSuccess;
   (*time)--;
+  if (searchBranches && ((*time) & 0xff) == 0 && ncclTopoSearchStopped(searchBranches)) {
+    *time = 0;
+    return ncclSuccess;
+  }
 
   int ngpus = system->nodes[GPU].count;
   if (step == ngpus) {
@@ -482,6 +532,7 @@ ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopo
         struct ncclTopoNode* net = system->nodes[NET].nodes+n;
         if (graph->pattern == NCCL_TOPO_PATTERN_TREE && net->id != startNet->id) continue; // Trees are symmetric
         if (graph->crossNic != 1 && (net->net.asic != startNet->net.asic || net->net.port != startNet->net.port)) continue;
+        if (system->netRails && net->net.rail != startNet->net.rail) continue;
 
         // Balanced Tree : count half of the bandwidth on first two GPUs
         int nextBackToNet = -1;
@@ -854,86 +905,115 @@ float sm90SpeedArrayInter[] = { 48.0, 45.0, 42.0, 40.0, 30.0, 24.0, 20.0, 17.5,
 #endif
 
 RCCL_PARAM(ModelMatchingDisable, "MODEL_MATCHING_DISABLE", 0);
+RCCL_PARAM(SearchThreads, "SEARCH_THREADS", 0); // Threads splitting each graph search pass, 0 or 1 to search on the caller
+RCCL_PARAM(SearchBudgetSteps, "SEARCH_BUDGET_STEPS", 0); // Search steps of a graph search over all its passes, 0 for none
+
+struct ncclTopoSearchWorker {
+  pthread_t thread;
+  struct ncclTopoSystem* system;
+  struct ncclTopoGraph graph;
+  struct ncclTopoGraph saveGraph; // best graph of the range
+  struct ncclTopoSearchBranches branches;
+  int time;
+  ncclResult_t result;
+};
 
-ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph) {
-  int ngpus = system->nodes[GPU].count;
-  graph->crossNic = ncclParamCrossNic();
-  int crossNic = (system->nodes[NET].count > 1) && graph->crossNic &&
-	 (graph->pattern == NCCL_TOPO_PATTERN_RING ||
-	  graph->pattern == NCCL_TOPO_PATTERN_BALANCED_TREE ||
-	  graph->pattern == NCCL_TOPO_PATTERN_SPLIT_TREE) ? 1 : 0;
-  graph->bwIntra = graph->bwInter = 0;
-  graph->latencyInter = 0;
-  if (graph->crossNic == 2) graph->crossNic = 0;
-  graph->typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
-  graph->typeInter = PATH_PIX;
-  graph->nChannels = 0;
-  graph->nIntraChannels = 0;
-  memset(graph->intraNets, 0, MAXCHANNELS*NCCL_TOPO_MAX_NODES*2*sizeof(int));
-  int trySameChannels = graph->pattern == NCCL_TOPO_PATTERN_NVLS ? 0 : 1;
-  graph->sameChannels = trySameChannels;
-
-  char* str = getenv("NCCL_GRAPH_FILE");
-  if (str) {
-    INFO(NCCL_ENV, "NCCL_GRAPH_FILE set by environment to %s", str);
-    struct ncclXml* xml;
-    NCCLCHECK(ncclCalloc(&xml, 1));
-    NCCLCHECK(ncclTopoGetXmlGraphFromFile(str, xml));
-    int nChannels;
-    NCCLCHECK(ncclTopoGetGraphFromXml(xml->nodes, system, graph, &nChannels));
-    INFO(NCCL_GRAPH, "Search %d : %d channels loaded from XML graph", graph->id, nChannels);
-    free(xml);
-    if (graph->nChannels > 0) return ncclSuccess;
+static void* ncclTopoSearchWorkerThread(void* arg) {
+  struct ncclTopoSearchWorker* worker = (struct ncclTopoSearchWorker*)arg;
+  searchBranches = &worker->branches;
+  worker->result = ncclTopoSearchRec(worker->system, &worker->graph, &worker->saveGraph, &worker->time);
+  if (worker->time == -1) {
+    // Ranges after this one can no longer be picked, stop them
+    struct ncclTopoSearchShared* shared = worker->branches.shared;
+    int perfect = __atomic_load_n(&shared->perfect, __ATOMIC_RELAXED);
+    while (worker->branches.thread < perfect &&
+        !__atomic_compare_exchange_n(&shared->perfect, &perfect, worker->branches.thread, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
   }
+  return NULL;
+}
 
-  str = getenv("NCCL_RINGS");
-  char* strTrees = getenv("RCCL_TREES");
+// One search pass from tmpGraph, improving graph. With several threads, the top level branches are
+// split in contiguous ranges, each searched with the full step budget over a copy of the system.
+// Range results are merged in order so the graph only depends on the thread count, not on timing.
+static ncclResult_t ncclTopoSearchPass(struct ncclTopoSystem* system, struct ncclTopoGraph* tmpGraph, struct ncclTopoGraph* graph, int* time,
+    int nThreads, struct ncclTopoSearchShared* shared) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclTopoSearchBranches* callerBranches = searchBranches;
+  struct ncclTopoSearchBranches branches = { 0, 0, INT_MAX, 0, shared };
+  struct ncclTopoSearchWorker* workers = NULL;
+  int nBranches, nStarted = 0, remaining = *time;
+  bool perfect = false;
+
+  if (nThreads > 1) {
+    // Count the top level branches, exploring none of them
+    int t = *time;
+    NCCLCHECKGOTO(ncclCalloc(&workers, nThreads), ret, exit);
+    memcpy(&workers[0].graph, tmpGraph, sizeof(struct ncclTopoGraph));
+    memcpy(&workers[0].saveGraph, graph, sizeof(struct ncclTopoGraph));
+    branches.last = 0;
+    searchBranches = &branches;
+    NCCLCHECKGOTO(ncclTopoSearchRec(system, &workers[0].graph, &workers[0].saveGraph, &t), ret, exit);
+    nBranches = branches.next;
+    nThreads = std::min(nThreads, nBranches);
+  }
+  if (nThreads <= 1) {
+    branches.next = 0;
+    branches.last = INT_MAX;
+    searchBranches = NULL;
+    NCCLCHECKGOTO(ncclTopoSearchRec(system, tmpGraph, graph, time), ret, exit);
+    goto exit;
+  }
 
-  if (str || strTrees) {
-    // user supplied topo
-    if (strTrees) {
-      NCCLCHECK(parseGraphLight(strTrees, system, graph, NULL));
-      system->treeDefined=true;
-    } else {
-      NCCLCHECK(parseGraph(str, system, graph, NULL, NULL));
-      int arch, vendor, model;
-      NCCLCHECK(ncclTopoCpuType(system, &arch, &vendor, &model));
-      if (graph->nChannels && arch == NCCL_TOPO_CPU_ARCH_X86 && vendor == NCCL_TOPO_CPU_VENDOR_AMD && model == NCCL_TOPO_CPU_TYPE_ROME) {
-        system->type |= RCCL_TOPO_4P2H_ROME;
-      }
+  shared->perfect = INT_MAX;
+  for (int w=0; w<nThreads; w++) {
+    struct ncclTopoSearchWorker* worker = workers+w;
+    NCCLCHECKGOTO(ncclTopoDupSystem(system, &worker->system), ret, join);
+    memcpy(&worker->graph, tmpGraph, sizeof(struct ncclTopoGraph));
+    memcpy(&worker->saveGraph, graph, sizeof(struct ncclTopoGraph));
+    worker->branches.next = 0;
+    worker->branches.first = (int)((int64_t)nBranches*w/nThreads);
+    worker->branches.last = (int)((int64_t)nBranches*(w+1)/nThreads);
+    worker->branches.thread = w;
+    worker->branches.shared = shared;
+    worker->time = *time;
+    if (pthread_create(&worker->thread, NULL, ncclTopoSearchWorkerThread, worker) != 0) {
+      WARN("Unable to create graph search thread %d : %s", w, strerror(errno));
+      ncclTopoFree(worker->system);
+      ret = ncclSystemError;
+      goto join;
     }
-  } else if (!rcclParamModelMatchingDisable() && !graph->collNet) {
-    // try to match 8P6L
-    NCCLCHECK(parseChordalRing(system, graph));
-    if (graph->nChannels) return ncclSuccess;
-    // try to match Rome 4P2H
-    NCCLCHECK(parseRome4P2H(system, graph));
-    if (graph->nChannels) return ncclSuccess;
-    // try to match 1H16P
-    NCCLCHECK(parse1H16P(system, graph));
-    if (graph->nChannels) return ncclSuccess;
-    // try to match 4H4P
-    NCCLCHECK(parse4H4P(system, graph));
+    ncclSetThreadName(worker->thread, "NCCL Search %d/%d", graph->id, w);
+    nStarted++;
   }
-  if (graph->nChannels) return ncclSuccess;
-
-  if ((graph->pattern == NCCL_TOPO_PATTERN_RING) && (system->type & RCCL_TOPO_4P2H_ROME) && (ngpus == system->nRanks)) {
-    // limit single node max channels when searching ring graph on Rome
-    graph->maxChannels = 2;
+join:
+  for (int w=0; w<nStarted; w++) {
+    pthread_join(workers[w].thread, NULL);
+    ncclTopoFree(workers[w].system);
   }
-  if (ngpus == 1) if (graph->pattern != NCCL_TOPO_PATTERN_RING) graph->pattern = NCCL_TOPO_PATTERN_TREE;
-
-  int ccMin;
-  NCCLCHECK(ncclTopoGetCompCap(system, &ccMin, NULL));
-  if (graph->pattern == NCCL_TOPO_PATTERN_NVLS && (system->nodes[NVS].count == 0 || ccMin < 90)) return ncclSuccess;
-
-  if (ngpus == 1) if (graph->pattern != NCCL_TOPO_PATTERN_RING) graph->pattern = NCCL_TOPO_PATTERN_TREE;
-
-  if (system->nodes[NET].count == 0 && graph->pattern == NCCL_TOPO_PATTERN_NVLS) {
-    // Force intra-node NVLS algorithm to pull evenly from all GPUs.
-    graph->minChannels = graph->maxChannels = system->nodes[GPU].count;
+  if (ret != ncclSuccess) goto exit;
+  for (int w=0; w<nThreads; w++) {
+    struct ncclTopoSearchWorker* worker = workers+w;
+    NCCLCHECKGOTO(worker->result, ret, exit);
+    int copy = 0;
+    NCCLCHECKGOTO(ncclTopoCompareGraphs(system, &worker->saveGraph, graph, &copy), ret, exit);
+    if (copy) memcpy(graph, &worker->saveGraph, sizeof(struct ncclTopoGraph));
+    if (worker->time == -1) {
+      perfect = true;
+      break;
+    }
+    remaining = std::min(remaining, worker->time);
   }
+  *time = perfect ? -1 : remaining;
+
+exit:
+  searchBranches = callerBranches;
+  free(workers);
+  return ret;
+}
 
+// Generic search, once the user and model provided graphs are ruled out
+static ncclResult_t ncclTopoSearchGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int crossNic, int trySameChannels, int ccMin) {
+  int ngpus = system->nodes[GPU].count;
   struct ncclTopoGraph tmpGraph;
   memcpy(&tmpGraph, graph, sizeof(struct ncclTopoGraph));
 
@@ -955,6 +1035,12 @@ ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph
   while ((speedArray[speedIndex] > maxBw || speedArray[speedIndex]*graph->minChannels > totalBw) && speedIndex < nspeeds-1) speedIndex++;
   tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[speedIndex];
   int64_t globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
+  int nThreads = rcclParamSearchThreads();
+  // The budget counts steps rather than time so that all ranks stop at the same graph
+  int64_t budgetSteps = rcclParamSearchBudgetSteps();
+  int64_t stepsLeft = budgetSteps > 0 ? budgetSteps : INT64_MAX;
+  struct ncclTopoSearchShared shared = { INT_MAX };
+  bool expired = false;
 
 search:
   int time = tmpGraph.sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
@@ -962,7 +1048,12 @@ search:
   tmpGraph.nChannels = 0;
   globalTimeout -= time;
 
-  NCCLCHECK(ncclTopoSearchRec(system, &tmpGraph, graph, &time));
+  if (time > stepsLeft) time = (int)stepsLeft;
+  if (time > 0) {
+    int passSteps = time;
+    NCCLCHECK(ncclTopoSearchPass(system, &tmpGraph, graph, &time, nThreads, &shared));
+    if (time >= 0) stepsLeft -= passSteps - time;
+  }
 #if 0
   printf("Pattern %d, crossNic %d, Bw %g/%g, type %d/%d, channels %d-%d sameChannels %d -> nChannels %dx%g/%g %s\n", tmpGraph.pattern, tmpGraph.crossNic, tmpGraph.bwInter, tmpGraph.bwIntra, tmpGraph.typeInter, tmpGraph.typeIntra, tmpGraph.minChannels, tmpGraph.maxChannels, tmpGraph.sameChannels, graph->nChannels, graph->bwInter, graph->bwIntra, time == 0 ? "TIMEOUT" : time == -1 ? "PERFECT" : "");
   for (int c=0; c<graph->nChannels; c++) {
@@ -977,6 +1068,12 @@ search:
   // Optimal solution, stop here
   if (time == -1) goto done;
   if (graph->nChannels*graph->bwInter >= system->totalBw) goto done;
+  // Out of steps, keep the best graph found
+  if (stepsLeft <= 0) {
+    if (!expired) INFO(NCCL_GRAPH, "Search %d : %ld steps budget used with %d channels", graph->id, budgetSteps, graph->nChannels);
+    expired = true;
+    goto done;
+  }
 
   if (pass == 1) {
     // First pass, we don't have a solution yet ; try other options
@@ -1077,6 +1174,277 @@ done:
   return ncclSuccess;
 }
 
+/* Graph cache
+ * Search results only depend on the trimmed system and the graph
+ * constraints, so nodes of the same kind cache them in RCCL_GRAPH_CACHE_DIR
+ * under a hash of both. Graphs are stored in the NCCL_GRAPH_FILE format,
+ * which names GPUs by device so the files are shared by all ranks.
+ */
+static uint64_t hashMix(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i=0; i<size; i++) hash = ((hash << 5) + hash) ^ bytes[i];
+  return hash;
+}
+#define HASH_MIX(hash, value) hash = hashMix(hash, &(value), sizeof(value))
+
+static uint64_t ncclTopoSearchHash(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int crossNic) {
+  uint64_t hash = 5381;
+  int version = NCCL_GRAPH_XML_VERSION;
+  int singleNode = system->nodes[GPU].count == system->nRanks;
+  HASH_MIX(hash, version);
+  HASH_MIX(hash, singleNode);
+  HASH_MIX(hash, system->type);
+  HASH_MIX(hash, system->maxBw);
+  HASH_MIX(hash, system->totalBw);
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    HASH_MIX(hash, system->nodes[t].count);
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      HASH_MIX(hash, node->id);
+      if (t == GPU) {
+        HASH_MIX(hash, node->gpu.dev);
+        HASH_MIX(hash, node->gpu.cudaCompCap);
+        HASH_MIX(hash, node->gpu.gdrSupport);
+        if (node->gpu.gcn) hash = hashMix(hash, node->gpu.gcn, strlen(node->gpu.gcn));
+      } else if (t == NET) {
+        HASH_MIX(hash, node->net.asic);
+        HASH_MIX(hash, node->net.port);
+        HASH_MIX(hash, node->net.bw);
+        HASH_MIX(hash, node->net.gdrSupport);
+        HASH_MIX(hash, node->net.collSupport);
+        HASH_MIX(hash, node->net.maxChannels);
+        HASH_MIX(hash, node->net.rail);
+      } else if (t == CPU) {
+        HASH_MIX(hash, node->cpu.arch);
+        HASH_MIX(hash, node->cpu.vendor);
+        HASH_MIX(hash, node->cpu.model);
+      }
+      for (int l=0; l<node->nlinks; l++) {
+        HASH_MIX(hash, node->links[l].type);
+        HASH_MIX(hash, node->links[l].bw);
+        HASH_MIX(hash, node->links[l].remNode->type);
+        HASH_MIX(hash, node->links[l].remNode->id);
+      }
+      // Path types capture the P2P and GDR settings
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        if (node->paths[p] == NULL) continue;
+        for (int i=0; i<system->nodes[p].count; i++) {
+          HASH_MIX(hash, node->paths[p][i].type);
+          HASH_MIX(hash, node->paths[p][i].bw);
+        }
+      }
+    }
+  }
+  HASH_MIX(hash, graph->id);
+  HASH_MIX(hash, graph->pattern);
+  HASH_MIX(hash, graph->collNet);
+  HASH_MIX(hash, graph->minChannels);
+  HASH_MIX(hash, graph->maxChannels);
+  HASH_MIX(hash, crossNic);
+  return hash;
+}
+
+// A cached graph that does not load or refers to missing devices is searched again
+static ncclResult_t ncclTopoLoadCachedGraph(const char* file, struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclXml* xml;
+  int nChannels = 0;
+  if (access(file, R_OK) != 0) return ncclSystemError;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  struct ncclTopoGraph cached;
+  memcpy(&cached, graph, sizeof(struct ncclTopoGraph));
+  NCCLCHECKGOTO(ncclTopoGetXmlGraphFromFile(file, xml), ret, exit);
+  NCCLCHECKGOTO(ncclTopoGetGraphFromXml(xml->nodes, system, &cached, &nChannels), ret, exit);
+  if (nChannels == 0 || nChannels > graph->maxChannels || cached.pattern != graph->pattern) {
+    ret = ncclInvalidUsage;
+    goto exit;
+  }
+  memcpy(graph, &cached, sizeof(struct ncclTopoGraph));
+  INFO(NCCL_GRAPH, "Search %d : %d channels loaded from graph cache %s", graph->id, nChannels, file);
+exit:
+  free(xml);
+  if (ret != ncclSuccess) INFO(NCCL_GRAPH, "Search %d : ignoring graph cache %s", graph->id, file);
+  return ret;
+}
+
+// Written aside and renamed, ranks of a node store the same graph at the same time
+static void ncclTopoStoreCachedGraph(const char* file, struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  struct ncclXml* xml;
+  char tmpFile[PATH_MAX];
+  if (ncclCalloc(&xml, 1) != ncclSuccess) return;
+  static int storeCount = 0;
+  snprintf(tmpFile, PATH_MAX, "%s.%d.%d", file, getpid(), __atomic_fetch_add(&storeCount, 1, __ATOMIC_RELAXED));
+  if (ncclTopoGetXmlFromGraphs(1, &graph, system, xml) == ncclSuccess &&
+      ncclTopoDumpXmlToFile(tmpFile, xml) == ncclSuccess &&
+      rename(tmpFile, file) == 0) {
+    INFO(NCCL_GRAPH, "Search %d : stored %d channels in graph cache %s", graph->id, graph->nChannels, file);
+  } else {
+    unlink(tmpFile);
+  }
+  free(xml);
+}
+
+/* Split children first try the graph of their parent, restricted to their own
+ * GPUs in the same channel order. Neighbors the parent already connected stay
+ * neighbors, and their shared connections are reused. The restricted chains
+ * must still fit the path types the parent graph was searched with.
+ */
+static ncclResult_t ncclTopoDeriveGraph(struct ncclTopoSystem* parentSystem, struct ncclTopoGraph* parentGraph, struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int* derived) {
+  ncclResult_t ret = ncclSuccess;
+  int ngpus = system->nodes[GPU].count;
+  int parentGpus = parentSystem->nodes[GPU].count;
+  int multiNode = system->nodes[NET].count && ngpus != system->nRanks;
+  int parentMultiNode = parentSystem->nodes[NET].count && parentGpus != parentSystem->nRanks;
+  int nChannels = std::min(parentGraph->nChannels, graph->maxChannels);
+  int backToNet, backToFirstRank;
+  int* intra = NULL;
+
+  *derived = 0;
+  if (parentGraph->nChannels == 0 || parentGraph->nIntraChannels || parentGraph->pattern != graph->pattern ||
+      parentGraph->collNet != graph->collNet || graph->pattern == NCCL_TOPO_PATTERN_NVLS) return ncclSuccess;
+  if (multiNode != parentMultiNode || nChannels < graph->minChannels) return ncclSuccess;
+  NCCLCHECK(ncclTopoSearchParams(system, graph->pattern, &backToNet, &backToFirstRank));
+  NCCLCHECK(ncclCalloc(&intra, nChannels*ngpus));
+
+  for (int c=0; c<nChannels; c++) {
+    int idx[NCCL_TOPO_MAX_NODES];
+    int g = 0;
+    for (int p=0; p<parentGpus; p++) {
+      int parentRank = parentGraph->intra[c*parentGpus+p];
+      int64_t id = -1;
+      for (int i=0; i<parentGpus; i++) if (parentSystem->nodes[GPU].nodes[i].gpu.rank == parentRank) id = parentSystem->nodes[GPU].nodes[i].id;
+      for (int i=0; i<ngpus; i++) if (system->nodes[GPU].nodes[i].id == id && g < ngpus) idx[g++] = i;
+    }
+    if (g != ngpus) goto exit;
+    for (int i=0; i<g; i++) {
+      struct ncclTopoNode* gpu = system->nodes[GPU].nodes+idx[i];
+      int next = i+1 < g ? idx[i+1] : i == backToFirstRank ? idx[0] : -1;
+      if (next != -1 && next != idx[i] && gpu->paths[GPU][next].type > parentGraph->typeIntra) goto exit;
+      intra[c*ngpus+i] = gpu->gpu.rank;
+    }
+    if (multiNode) {
+      for (int n=0; n<2; n++) {
+        int netIdx;
+        struct ncclTopoNode* gpu = system->nodes[GPU].nodes+idx[n == 0 ? 0 : backToNet];
+        if (ncclTopoIdToIndex(system, NET, parentGraph->inter[c*2+n], &netIdx) != ncclSuccess) goto exit;
+        if (gpu->paths[NET][netIdx].type > parentGraph->typeInter) goto exit;
+      }
+    }
+  }
+
+  memcpy(graph->intra, intra, nChannels*ngpus*sizeof(int));
+  memcpy(graph->inter, parentGraph->inter, nChannels*2*sizeof(int));
+  graph->nChannels = nChannels;
+  graph->crossNic = parentGraph->crossNic;
+  graph->bwIntra = parentGraph->bwIntra;
+  graph->bwInter = parentGraph->bwInter;
+  graph->latencyInter = parentGraph->latencyInter;
+  graph->typeIntra = parentGraph->typeIntra;
+  graph->typeInter = parentGraph->typeInter;
+  graph->sameChannels = parentGraph->sameChannels;
+  *derived = 1;
+  INFO(NCCL_GRAPH, "Search %d : %d channels derived from the parent communicator", graph->id, nChannels);
+exit:
+  free(intra);
+  return ret;
+}
+
+ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoSystem* parentSystem, struct ncclTopoGraph* parentGraph) {
+  int ngpus = system->nodes[GPU].count;
+  graph->crossNic = ncclParamCrossNic();
+  int crossNic = (system->nodes[NET].count > 1) && graph->crossNic &&
+	 (graph->pattern == NCCL_TOPO_PATTERN_RING ||
+	  graph->pattern == NCCL_TOPO_PATTERN_BALANCED_TREE ||
+	  graph->pattern == NCCL_TOPO_PATTERN_SPLIT_TREE) ? 1 : 0;
+  graph->bwIntra = graph->bwInter = 0;
+  graph->latencyInter = 0;
+  if (graph->crossNic == 2) graph->crossNic = 0;
+  graph->typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
+  graph->typeInter = PATH_PIX;
+  graph->nChannels = 0;
+  graph->nIntraChannels = 0;
+  memset(graph->intraNets, 0, MAXCHANNELS*NCCL_TOPO_MAX_NODES*2*sizeof(int));
+  int trySameChannels = graph->pattern == NCCL_TOPO_PATTERN_NVLS ? 0 : 1;
+  graph->sameChannels = trySameChannels;
+
+  char* str = getenv("NCCL_GRAPH_FILE");
+  if (str) {
+    INFO(NCCL_ENV, "NCCL_GRAPH_FILE set by environment to %s", str);
+    struct ncclXml* xml;
+    NCCLCHECK(ncclCalloc(&xml, 1));
+    NCCLCHECK(ncclTopoGetXmlGraphFromFile(str, xml));
+    int nChannels;
+    NCCLCHECK(ncclTopoGetGraphFromXml(xml->nodes, system, graph, &nChannels));
+    INFO(NCCL_GRAPH, "Search %d : %d channels loaded from XML graph", graph->id, nChannels);
+    free(xml);
+    if (graph->nChannels > 0) return ncclSuccess;
+  }
+
+  str = getenv("NCCL_RINGS");
+  char* strTrees = getenv("RCCL_TREES");
+
+  if (str || strTrees) {
+    // user supplied topo
+    if (strTrees) {
+      NCCLCHECK(parseGraphLight(strTrees, system, graph, NULL));
+      system->treeDefined=true;
+    } else {
+      NCCLCHECK(parseGraph(str, system, graph, NULL, NULL));
+      int arch, vendor, model;
+      NCCLCHECK(ncclTopoCpuType(system, &arch, &vendor, &model));
+      if (graph->nChannels && arch == NCCL_TOPO_CPU_ARCH_X86 && vendor == NCCL_TOPO_CPU_VENDOR_AMD && model == NCCL_TOPO_CPU_TYPE_ROME) {
+        system->type |= RCCL_TOPO_4P2H_ROME;
+      }
+    }
+  } else if (!rcclParamModelMatchingDisable() && !graph->collNet) {
+    // try to match 8P6L
+    NCCLCHECK(parseChordalRing(system, graph));
+    if (graph->nChannels) return ncclSuccess;
+    // try to match Rome 4P2H
+    NCCLCHECK(parseRome4P2H(system, graph));
+    if (graph->nChannels) return ncclSuccess;
+    // try to match 1H16P
+    NCCLCHECK(parse1H16P(system, graph));
+    if (graph->nChannels) return ncclSuccess;
+    // try to match 4H4P
+    NCCLCHECK(parse4H4P(system, graph));
+  }
+  if (graph->nChannels) return ncclSuccess;
+
+  if ((graph->pattern == NCCL_TOPO_PATTERN_RING) && (system->type & RCCL_TOPO_4P2H_ROME) && (ngpus == system->nRanks)) {
+    // limit single node max channels when searching ring graph on Rome
+    graph->maxChannels = 2;
+  }
+  if (ngpus == 1) if (graph->pattern != NCCL_TOPO_PATTERN_RING) graph->pattern = NCCL_TOPO_PATTERN_TREE;
+
+  int ccMin;
+  NCCLCHECK(ncclTopoGetCompCap(system, &ccMin, NULL));
+  if (graph->pattern == NCCL_TOPO_PATTERN_NVLS && (system->nodes[NVS].count == 0 || ccMin < 90)) return ncclSuccess;
+
+  if (ngpus == 1) if (graph->pattern != NCCL_TOPO_PATTERN_RING) graph->pattern = NCCL_TOPO_PATTERN_TREE;
+
+  if (system->nodes[NET].count == 0 && graph->pattern == NCCL_TOPO_PATTERN_NVLS) {
+    // Force intra-node NVLS algorithm to pull evenly from all GPUs.
+    graph->minChannels = graph->maxChannels = system->nodes[GPU].count;
+  }
+
+  if (parentGraph) {
+    int derived;
+    NCCLCHECK(ncclTopoDeriveGraph(parentSystem, parentGraph, system, graph, &derived));
+    if (derived) return ncclSuccess;
+  }
+
+  char* cacheDir = getenv("RCCL_GRAPH_CACHE_DIR");
+  char cacheFile[PATH_MAX];
+  if (cacheDir) {
+    snprintf(cacheFile, PATH_MAX, "%s/rccl_graph_%016lx.xml", cacheDir, ncclTopoSearchHash(system, graph, crossNic));
+    if (ncclTopoLoadCachedGraph(cacheFile, system, graph) == ncclSuccess) return ncclSuccess;
+  }
+  NCCLCHECK(ncclTopoSearchGraph(system, graph, crossNic, trySameChannels, ccMin));
+  if (cacheDir && graph->nChannels) ncclTopoStoreCachedGraph(cacheFile, system, graph);
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoPrintGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   INFO(NCCL_GRAPH, "Pattern %d, crossNic %d, nChannels %d, bw %f/%f, type %s/%s, sameChannels %d", graph->pattern, graph->crossNic, graph->nChannels, graph->bwIntra, graph->bwInter, topoPathTypeStr[graph->typeIntra], topoPathTypeStr[graph->typeInter], graph->sameChannels);
   int ngpus = system->nodes[GPU].count;
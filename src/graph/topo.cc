@@ -13,7 +13,9 @@
 #include "net.h"
 #include "coll_net.h"
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include "xml.h"
 #include "cpuset.h"
 
@@ -128,6 +130,7 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
     n->net.port = NCCL_TOPO_UNDEF;
     n->net.bw = 0.0;
     n->net.latency = 0.0;
+    n->net.rail = NCCL_TOPO_UNDEF;
   }
   *node = n;
   return ncclSuccess;
@@ -326,6 +329,22 @@ ncclResult_t ncclTopoSortSystem(struct ncclTopoSystem* system) {
   return ncclSuccess;
 }
 
+// Rails of a rail-optimized fabric, where inter-node traffic must stay on the leaf switch of a
+// rail: a "rail" attribute of the net nodes of the topology XML, or RCCL_NET_RAILS, the rail of
+// each net device in order ("0,1,2,3,0,1,2,3" for two NICs per rail). Rings and trees only leave a
+// node through a NIC of the rail they entered it from once all the NICs have a rail.
+static int netRailFromEnv(int dev) {
+  static const char* rails = ncclGetEnv("RCCL_NET_RAILS");
+  const char* str = rails;
+  if (str == NULL) return NCCL_TOPO_UNDEF;
+  for (int d=0; d<dev && str; d++) {
+    str = strchr(str, ',');
+    if (str) str++;
+  }
+  if (str == NULL || *str == '\0' || *str == ',') return NCCL_TOPO_UNDEF;
+  return strtol(str, NULL, 0);
+}
+
 ncclResult_t ncclTopoAddNet(struct ncclXmlNode* xmlNet, struct ncclTopoSystem* system, struct ncclTopoNode* nic, int64_t busId) {
   int dev;
   NCCLCHECK(xmlGetAttrInt(xmlNet, "dev", &dev));
@@ -347,6 +366,9 @@ ncclResult_t ncclTopoAddNet(struct ncclXmlNode* xmlNet, struct ncclTopoSystem* s
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "gdr", &net->net.gdrSupport, 0));
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "maxconn", &net->net.maxChannels, MAXCHANNELS));
   NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "coll", &net->net.collSupport, 0));
+  NCCLCHECK(xmlGetAttrIntDefault(xmlNet, "rail", &net->net.rail, NCCL_TOPO_UNDEF));
+  int rail = netRailFromEnv(dev);
+  if (rail != NCCL_TOPO_UNDEF) net->net.rail = rail;
   net->net.busId = busId;
   ncclDebugNoWarn = 0;
 
@@ -548,6 +570,22 @@ ncclResult_t ncclTopoAddXGMI(struct ncclXmlNode* node, struct ncclTopoSystem* sy
     }
     if (remote) {
       float nvlSpeed = ncclTopoXGMISpeed(gpu->gpu.gcn);
+      // Links trained to fewer lanes or a lower speed than nominal get proportionally less bandwidth
+      int width, speed, nominalSpeed = ncclTopoXGMILinkSpeed(gpu->gpu.gcn);
+      NCCLCHECK(xmlGetAttrIntDefault(node, "width", &width, 0));
+      NCCLCHECK(xmlGetAttrIntDefault(node, "speed", &speed, 0));
+      if (width > 0 && speed > 0 && nominalSpeed > 0) {
+        float ratio = std::min(1.0f, (float)(width*speed)/(XGMI_LINK_LANES*nominalSpeed));
+        bool first = true; // Metrics are per GPU, report them with its first link
+        for (int l=0; l<gpu->nlinks; l++) if (gpu->links[l].type == LINK_NVL) first = false;
+        if (ratio < 1.0f && first) {
+          WARN("xGMI links of GPU %lx run at x%d %d Gbps instead of x%d %d Gbps, using %.0f%% of their bandwidth",
+              pBusId, width, speed, XGMI_LINK_LANES, nominalSpeed, ratio*100);
+        } else if (first) {
+          INFO(NCCL_GRAPH, "xGMI links of GPU %lx run at x%d %d Gbps", pBusId, width, speed);
+        }
+        nvlSpeed *= ratio;
+      }
       NCCLCHECK(ncclTopoConnectNodes(gpu, remote, LINK_NVL, count*nvlSpeed));
       if (remote->type != GPU) {
         NCCLCHECK(ncclTopoConnectNodes(remote, gpu, LINK_NVL, count*nvlSpeed));
@@ -671,9 +709,8 @@ static ncclResult_t xmlInitAttrFloat(struct ncclXmlNode* node, const char* attrN
 }
 
 
-ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** system) {
-  struct ncclXml* xml;
-  NCCLCHECK(ncclCalloc(&xml, 1));
+// Builds the XML of the node from the topology file, then the GPUs and NICs found in /sys
+static ncclResult_t topoBuildXml(struct ncclComm* comm, struct ncclXml* xml) {
   char* xmlTopoFile = getenv("NCCL_TOPO_FILE");
   if (xmlTopoFile) {
     INFO(NCCL_ENV, "NCCL_TOPO_FILE set by environment to %s", xmlTopoFile);
@@ -746,8 +783,144 @@ ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** sy
 
   // Remove XML branches which don't have a node with keep="1" (typically when importing a topology)
   NCCLCHECK(ncclTopoTrimXml(xml));
+  return ncclSuccess;
+}
+
+// Node-level cache of the XML (RCCL_TOPO_CACHE). Building it crawls /sys and queries every GPU, in
+// every rank of every communicator. The first rank of a node to build it for a set of GPUs and NICs
+// stores it in /dev/shm, named after the host, its boot id and a hash of everything the XML is built
+// from, and the other ranks and later communicators load it instead. A lock file serializes the
+// ranks of the node so only one of them builds it.
+RCCL_PARAM(TopoCache, "TOPO_CACHE", 1);
+
+static void topoCacheHash(uint64_t* hash, const void* data, size_t size) {
+  for (size_t i=0; i<size; i++) *hash = (*hash ^ ((const unsigned char*)data)[i]) * 0x100000001b3ULL;
+}
+
+static void topoCacheHashNet(uint64_t* hash, ncclNetProperties_t* props) {
+  topoCacheHash(hash, props->name, strlen(props->name));
+  topoCacheHash(hash, props->pciPath, strlen(props->pciPath));
+  topoCacheHash(hash, &props->guid, sizeof(props->guid));
+  topoCacheHash(hash, &props->ptrSupport, sizeof(props->ptrSupport));
+  topoCacheHash(hash, &props->speed, sizeof(props->speed));
+  topoCacheHash(hash, &props->port, sizeof(props->port));
+  topoCacheHash(hash, &props->latency, sizeof(props->latency));
+  topoCacheHash(hash, &props->maxComms, sizeof(props->maxComms));
+}
+
+// Everything topoBuildXml() reads, except the ranks of the GPUs which are set after loading. Also
+// keys the link calibration cache.
+ncclResult_t ncclTopoCacheKey(struct ncclComm* comm, uint64_t* key) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int version = NCCL_TOPO_XML_VERSION;
+  topoCacheHash(&hash, &version, sizeof(version));
+  const char* xmlTopoFile = getenv("NCCL_TOPO_FILE");
+  if (xmlTopoFile == NULL) xmlTopoFile = "/var/run/nvidia-topologyd/virtualTopology.xml";
+  struct stat st;
+  topoCacheHash(&hash, xmlTopoFile, strlen(xmlTopoFile));
+  if (stat(xmlTopoFile, &st) == 0) {
+    topoCacheHash(&hash, &st.st_mtime, sizeof(st.st_mtime));
+    topoCacheHash(&hash, &st.st_size, sizeof(st.st_size));
+  }
+  for (int r=0; r<comm->nRanks; r++) {
+    if (comm->peerInfo[r].hostHash != comm->peerInfo[comm->rank].hostHash) continue;
+    topoCacheHash(&hash, &comm->peerInfo[r].busId, sizeof(comm->peerInfo[r].busId));
+    topoCacheHash(&hash, &comm->peerInfo[r].gdrSupport, sizeof(comm->peerInfo[r].gdrSupport));
+  }
+  topoCacheHash(&hash, comm->ncclNet->name, strlen(comm->ncclNet->name));
+  topoCacheHash(&hash, &comm->dmaBufSupport, sizeof(comm->dmaBufSupport));
+  int netDevCount = 0;
+  if (collNetSupport(comm)) {
+    NCCLCHECK(collNetDevices(comm, &netDevCount));
+    for (int n=0; n<netDevCount; n++) {
+      ncclNetProperties_t props;
+      NCCLCHECK(collNetGetProperties(comm, n, &props));
+      topoCacheHashNet(&hash, &props);
+    }
+  }
+  topoCacheHash(&hash, &netDevCount, sizeof(netDevCount));
+  if (netDevCount == 0) NCCLCHECK(comm->ncclNet->devices(&netDevCount));
+  for (int n=0; n<netDevCount; n++) {
+    ncclNetProperties_t props;
+    NCCLCHECK(comm->ncclNet->getProperties(n, &props));
+    topoCacheHashNet(&hash, &props);
+  }
+  *key = hash;
+  return ncclSuccess;
+}
 
-  xmlTopoFile = getenv("NCCL_TOPO_DUMP_FILE");
+// Gives the GPUs of a cached XML the ranks of this communicator, *valid is false if one is missing
+static ncclResult_t topoCacheSetRanks(struct ncclComm* comm, struct ncclXml* xml, bool* valid) {
+  struct ncclXmlNode* top;
+  int version;
+  *valid = false;
+  NCCLCHECK(xmlFindTag(xml, "system", &top));
+  if (top == NULL) return ncclSuccess;
+  NCCLCHECK(xmlGetAttrIntDefault(top, "version", &version, 0));
+  if (version != NCCL_TOPO_XML_VERSION) return ncclSuccess;
+  for (int r=0; r<comm->nRanks; r++) {
+    if (comm->peerInfo[r].hostHash != comm->peerInfo[comm->rank].hostHash) continue;
+    char busId[NVML_DEVICE_PCI_BUS_ID_BUFFER_SIZE];
+    struct ncclXmlNode* pciNode;
+    struct ncclXmlNode* gpuNode;
+    NCCLCHECK(int64ToBusId(comm->peerInfo[r].busId, busId));
+    NCCLCHECK(xmlFindTagKv(xml, "pci", &pciNode, "busid", busId));
+    if (pciNode == NULL) return ncclSuccess;
+    NCCLCHECK(xmlGetSub(pciNode, "gpu", &gpuNode));
+    if (gpuNode == NULL) return ncclSuccess;
+    NCCLCHECK(xmlSetAttrInt(gpuNode, "rank", r));
+  }
+  *valid = true;
+  return ncclSuccess;
+}
+
+static ncclResult_t topoGetXml(struct ncclComm* comm, struct ncclXml* xml) {
+  uint64_t key;
+  char path[PATH_MAX], lockPath[PATH_MAX+8], tmpPath[PATH_MAX+32];
+  if (rcclParamTopoCache() == 0) return topoBuildXml(comm, xml);
+  NCCLCHECK(ncclTopoCacheKey(comm, &key));
+  snprintf(path, sizeof(path), "/dev/shm/rccl-topo-%u-%lx-%lx.xml", (unsigned)getuid(), getHostHash(), key);
+  snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+  int lockFd = open(lockPath, O_RDWR|O_CREAT, 0600);
+  if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0) {
+    INFO(NCCL_GRAPH, "Topology cache %s unavailable : %s", lockPath, strerror(errno));
+    if (lockFd >= 0) close(lockFd);
+    return topoBuildXml(comm, xml);
+  }
+
+  ncclResult_t ret = ncclSuccess;
+  bool valid = false;
+  if (access(path, R_OK) == 0) {
+    if (ncclTopoGetXmlFromFile(path, xml, 0) == ncclSuccess) {
+      NCCLCHECKGOTO(topoCacheSetRanks(comm, xml, &valid), ret, exit);
+    }
+    if (valid) {
+      INFO(NCCL_GRAPH, "Loaded cached topology %s", path);
+      goto exit;
+    }
+    INFO(NCCL_GRAPH, "Cached topology %s does not match this node, rebuilding it", path);
+    memset(xml, 0, sizeof(struct ncclXml));
+  }
+  NCCLCHECKGOTO(topoBuildXml(comm, xml), ret, exit);
+  // Readers wait on the lock, the rename only protects them from a rank killed while writing
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, getpid());
+  NCCLCHECKGOTO(ncclTopoDumpXmlToFile(tmpPath, xml), ret, exit);
+  if (rename(tmpPath, path) != 0) {
+    INFO(NCCL_GRAPH, "Could not store topology cache %s : %s", path, strerror(errno));
+    unlink(tmpPath);
+  }
+exit:
+  flock(lockFd, LOCK_UN);
+  close(lockFd);
+  return ret;
+}
+
+ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** system) {
+  struct ncclXml* xml;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  NCCLCHECK(topoGetXml(comm, xml));
+
+  char* xmlTopoFile = getenv("NCCL_TOPO_DUMP_FILE");
   if (xmlTopoFile && comm->rank == ncclParamTopoDumpFileRank()) {
     INFO(NCCL_ENV, "NCCL_TOPO_DUMP_FILE set by environment to %s", xmlTopoFile);
     NCCLCHECK(ncclTopoDumpXmlToFile(xmlTopoFile, xml));
@@ -957,6 +1130,52 @@ ncclResult_t ncclTopoGetCpuAffinity(struct ncclTopoSystem* system, int rank, cpu
   return ncclSuccess;
 }
 
+ncclResult_t ncclTopoGetNetCpuAffinity(struct ncclTopoSystem* system, int net, cpu_set_t* affinity) {
+  CPU_ZERO(affinity);
+  int n;
+  if (ncclTopoIdToIndex(system, NET, net, &n) != ncclSuccess) return ncclSuccess;
+  struct ncclTopoNode* netNode = system->nodes[NET].nodes+n;
+  if (netNode->paths[CPU] == NULL) return ncclSuccess;
+  // Find closer CPU
+  int cpuIndex = -1, minHops = 0;
+  for (int c=0; c<system->nodes[CPU].count; c++) {
+    int nHops = netNode->paths[CPU][c].count;
+    if (cpuIndex == -1 || nHops < minHops) {
+      cpuIndex = c;
+      minHops = nHops;
+    }
+  }
+  if (cpuIndex == -1) return ncclSuccess;
+
+  cpu_set_t mask;
+  SYSCHECK(sched_getaffinity(0, sizeof(cpu_set_t), &mask), "sched_getaffinity");
+  cpu_set_t* cpuMask = &system->nodes[CPU].nodes[cpuIndex].cpu.affinity;
+  if (ncclParamIgnoreCpuAffinity())
+    memcpy(affinity, cpuMask, sizeof(cpu_set_t));
+  else
+    CPU_AND(affinity, &mask, cpuMask);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoGetLocalNuma(struct ncclTopoSystem* system, int rank, int* numaId) {
+  *numaId = -1;
+  for (int g=0; g<system->nodes[GPU].count; g++) {
+    struct ncclTopoNode* gpu = system->nodes[GPU].nodes+g;
+    if (gpu->gpu.rank != rank || gpu->paths[CPU] == NULL) continue;
+    // Find closer CPU
+    int cpuIndex = -1, minHops = 0;
+    for (int c=0; c<system->nodes[CPU].count; c++) {
+      int nHops = gpu->paths[CPU][c].count;
+      if (cpuIndex == -1 || nHops < minHops) {
+        cpuIndex = c;
+        minHops = nHops;
+      }
+    }
+    if (cpuIndex != -1) *numaId = system->nodes[CPU].nodes[cpuIndex].id;
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoGetGpuCount(struct ncclTopoSystem* system, int* count) {
   *count = system->nodes[GPU].count;
   return ncclSuccess;
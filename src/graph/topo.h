@@ -30,6 +30,10 @@
 #define VEGA_XGMI_WIDTH 24.0
 #define MI200_XGMI_WIDTH 36.0
 #define GFX94X_XGMI_WIDTH 48.0
+// Nominal width (lanes) and speed (Gbps) of one xGMI link, links reporting less are degraded
+#define XGMI_LINK_LANES 16
+#define MI200_XGMI_LINK_SPEED 25
+#define GFX94X_XGMI_LINK_SPEED 32
 
 // Intel CPU convert GPU P2P traffic into 64B PCI TLPs, so GPU
 // to GPU traffic consumes more PCI bandwidth.
@@ -137,6 +141,7 @@ struct ncclTopoNode {
       int collSupport;
       int maxChannels;
       int64_t busId;
+      int rail; // Switch plane of the NIC in a rail-optimized fabric, NCCL_TOPO_UNDEF if unknown
     }net;
     struct {
       int arch;
@@ -161,6 +166,25 @@ struct ncclTopoNodeSet {
   struct ncclTopoNode nodes[NCCL_TOPO_MAX_NODES];
 };
 
+// Link calibration of the node (RCCL_CALIBRATE), see calib.cc. Bandwidths are in GB/s, 0 where
+// nothing was measured, in which case the heuristics decide.
+#define NCCL_TOPO_CALIB_MAX_GPUS 16
+#define NCCL_TOPO_CALIB_MAX_NETS 16
+struct ncclTopoCalib {
+  int nGpus;
+  int nNets;
+  int64_t gpuIds[NCCL_TOPO_CALIB_MAX_GPUS];
+  int64_t netIds[NCCL_TOPO_CALIB_MAX_NETS];
+  float p2pReadBw[NCCL_TOPO_CALIB_MAX_GPUS][NCCL_TOPO_CALIB_MAX_GPUS];  // [g1][g2]: g1 loading from memory of g2
+  float p2pWriteBw[NCCL_TOPO_CALIB_MAX_GPUS][NCCL_TOPO_CALIB_MAX_GPUS]; // [g1][g2]: g1 storing to memory of g2
+  float d2hBw[NCCL_TOPO_CALIB_MAX_GPUS]; // GPU storing to pinned host memory
+  float h2dBw[NCCL_TOPO_CALIB_MAX_GPUS]; // GPU loading from pinned host memory
+  float gdrReadBw[NCCL_TOPO_CALIB_MAX_GPUS][NCCL_TOPO_CALIB_MAX_NETS];  // NIC sending from GPU memory
+  float gdrWriteBw[NCCL_TOPO_CALIB_MAX_GPUS][NCCL_TOPO_CALIB_MAX_NETS]; // NIC receiving into GPU memory
+  float hostBw[NCCL_TOPO_CALIB_MAX_GPUS][NCCL_TOPO_CALIB_MAX_NETS];     // NIC between host buffers
+  float netLat; // Host path latency through the NICs in us, the highest of all ranks
+};
+
 struct ncclTopoSystem {
   struct ncclTopoNodeSet nodes[NCCL_TOPO_NODE_TYPES];
   float maxBw;
@@ -176,6 +200,9 @@ struct ncclTopoSystem {
   bool ll128Enabled;
   float baseBw;
   bool mscclEnabled;
+  bool netRails; // All NICs have a rail, rings and trees leave nodes on the rail they entered from
+  bool xgmiPxn; // gfx94x GPUs all connected by xGMI, where PXN is enabled by default
+  struct ncclTopoCalib calib;
 };
 
 ncclResult_t ncclTopoGetNode(struct ncclTopoSystem* system, struct ncclTopoNode** node, int type, uint64_t id);
@@ -186,6 +213,7 @@ ncclResult_t ncclTopoPrintPaths(struct ncclTopoSystem* system);
 ncclResult_t ncclTopoLoadSystem(const char* xmlTopoFile, struct ncclTopoSystem* system);
 ncclResult_t ncclTopoGetIntermediateRank(struct ncclTopoSystem* system, int rank, int netDev, int* intermediateRank);
 
+ncclResult_t ncclTopoCacheKey(struct ncclComm* comm, uint64_t* key);
 ncclResult_t ncclTopoGetSystemFromXml(struct ncclXml* xml, struct ncclTopoSystem** topoSystem);
 ncclResult_t ncclTopoGetGraphFromXml(struct ncclXmlNode *xmlGraphs, struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int* nChannels);
 ncclResult_t ncclTopoGetXmlFromGraphs(int ngraphs, struct ncclTopoGraph** graphs, struct ncclTopoSystem* system, struct ncclXml *xml);
@@ -235,6 +263,16 @@ static float ncclTopoXGMISpeed(const char* gcn) {
     return VEGA_XGMI_WIDTH;
 }
 
+// 0 when unknown
+static int ncclTopoXGMILinkSpeed(const char* gcn) {
+  if (IsArchMatch(gcn, "gfx90a"))
+    return MI200_XGMI_LINK_SPEED;
+  else if (IsArchMatch(gcn, "gfx94"))
+    return GFX94X_XGMI_LINK_SPEED;
+  else
+    return 0;
+}
+
 #if ENABLE_COLLTRACE
   #define ncclGetKernelIndex(p_comm) ((p_comm)->collTraceThread ? 1 : 0)
 #else
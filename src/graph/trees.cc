@@ -107,3 +107,45 @@ ncclResult_t ncclGetDtree(int nranks, int rank, int* s0, int* d0_0, int* d0_1, i
   }
   return ncclSuccess;
 }
+
+/* K-ary tree in breadth first order, rooted at 0 : the children of rank r are
+ * k*r+1 ... k*r+k. It is log_k(nranks) deep instead of log2(nranks) for the
+ * btree, at the cost of k children per parent. The children alternate their
+ * parentChildType so that the parent can split them over its two tree ranks.
+ * d must hold k entries, -1 for missing children.
+ *
+ * Illustration (k=4) :
+ *                   0
+ *     _____________/|\_____________
+ *    1         2         3         4
+ *  / /\ \    / /\ \    / /\ \
+ * 5 6  7 8  9 10 11 12 13 14 ...
+ */
+ncclResult_t ncclGetKtree(int nranks, int rank, int k, int* u, int* d, int* parentChildType) {
+  *u = rank == 0 ? -1 : (rank-1)/k;
+  if (rank > 0) *parentChildType = ((rank-1)%k) % 2;
+  for (int i=0; i<k; i++) {
+    int down = k*rank+1+i;
+    d[i] = down < nranks ? down : -1;
+  }
+  return ncclSuccess;
+}
+
+/* Build a double k-ary tree. The second tree is the mirror of the first one,
+ * so that the inner nodes of one tree (the first ranks) are leaves of the other.
+ */
+ncclResult_t ncclGetKDtree(int nranks, int rank, int k, int* u0, int* d0, int* parentChildType0, int* u1, int* d1, int* parentChildType1) {
+  ncclGetKtree(nranks, rank, k, u0, d0, parentChildType0);
+  int u;
+  ncclGetKtree(nranks, nranks-1-rank, k, &u, d1, parentChildType1);
+  *u1 = u == -1 ? -1 : nranks-1-u;
+  for (int i=0; i<k; i++) d1[i] = d1[i] == -1 ? -1 : nranks-1-d1[i];
+  return ncclSuccess;
+}
+
+// Levels below the root of a k-ary tree of nranks, log2i(nranks) for k=2.
+int ncclGetKtreeDepth(int nranks, int k) {
+  int depth = 0;
+  for (long span = 1; span < nranks; span = span*k+1) depth++;
+  return depth;
+}
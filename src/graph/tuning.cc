@@ -9,6 +9,7 @@
 #include "devcomm.h"
 #include "comm.h"
 #include "topo.h"
+#include "trees.h"
 
 NCCL_PARAM(Nthreads, "NTHREADS", -2);
 NCCL_PARAM(Ll128Nthreads, "LL128_NTHREADS", -2);
@@ -164,11 +165,11 @@ static struct tuningModel tuning_model_2 {
 static struct tuningModel tuning_model_3 {
   .hwLat = {
     /* NVLINK */
-    { /* Tree (LL/LL128/Simple)*/ { 0.8, 0.0, 2.5 }, /* Ring (LL/LL128/Simple)*/ { 0.8, 0.0, 3.6 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 0.8 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 0.0 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+    { /* Tree (LL/LL128/Simple)*/ { 0.8, 0.0, 2.5 }, /* Ring (LL/LL128/Simple)*/ { 0.8, 0.0, 3.6 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 0.8 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 2.5 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
     /* PCI */
     { /* Tree (LL/LL128/Simple)*/ { 2.2, 2.2, 5.7 }, /* Ring (LL/LL128/Simple)*/ { 2.2, 2.2, 5.7 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 5.7 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 5.7 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
     /* NET */
-    { /* Tree (LL/LL128/Simple)*/ { 12.5, 0.0, 22.4 }, /* Ring (LL/LL128/Simple)*/ { 9.5, 0.0, 19.8 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 12.5 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 0.0 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+    { /* Tree (LL/LL128/Simple)*/ { 12.5, 0.0, 22.4 }, /* Ring (LL/LL128/Simple)*/ { 9.5, 0.0, 19.8 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 12.5 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 22.4 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
   },
 
   .bwRatio = {
@@ -221,12 +222,43 @@ static struct tuningModel tuning_model_4 {
   },
 };
 
+static struct tuningModel tuning_model_5 {
+  .hwLat = {
+    /* NVLINK */
+    { /* Tree (LL/LL128/Simple)*/ { 0.8, 1.2, 2.5 }, /* Ring (LL/LL128/Simple)*/ { 0.8, 1.6, 3.6 }, /* CollNetDirect (Simple)*/ { 0.8, 1.2, 2.5 }, /* CollNetChain (Simple)*/ { 0.8, 1.2, 2.5 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+    /* PCI */
+    { /* Tree (LL/LL128/Simple)*/ { 2.2, 2.2, 5.7 }, /* Ring (LL/LL128/Simple)*/ { 2.2, 2.2, 5.7 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 5.7 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 5.7 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+    /* NET */
+    { /* Tree (LL/LL128/Simple)*/ { 32.2, 34.4, 47.6 }, /* Ring (LL/LL128/Simple)*/ { 35.4, 87.8, 209.2 }, /* CollNetDirect (Simple)*/ { 0.0, 0.0, 47.6 }, /* CollNetChain (Simple)*/ { 0.0, 0.0, 47.6 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+  },
+
+  .bwRatio = {
+    /* 2 nodes */
+    { /* Tree (LL/LL128/Simple)*/ { 0.16, 1.09, 1.61 }, /* Ring (LL/LL128/Simple)*/ { 0.15, 0.58, 1.00 }, /* CollNetDirect (Simple)*/ { 0.00, 0.00, 1.00 }, /* CollNetChain (Simple)*/ { 0.00, 0.00, 1.00 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+    /* more than 2 nodes */
+    { /* Tree (LL/LL128/Simple)*/ { 0.16, 1.09, 1.08 }, /* Ring (LL/LL128/Simple)*/ { 0.15, 0.58, 1.00 }, /* CollNetDirect (Simple)*/ { 0.00, 0.00, 1.00 }, /* CollNetChain (Simple)*/ { 0.00, 0.00, 1.00 }, /* NVLS */ { 0, 0, 0 }, /* NVLS Tree */ { 0, 0, 0 } },
+  },
+
+  .treeCorrectionFactor = {
+    { 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 1.0, 0.1, 0.1, 0.2, 0.4, 0.6, 0.5, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, },
+    { 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.2, 0.2, 0.3, 0.5, 1.0, 0.8, 0.5, 0.4, 0.3, 0.2, 0.2, 0.2, 0.2, 0.2, 0.2, 0.2, 0.2, 0.2, },
+    { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.8, 0.4, 0.3, 0.3, 0.1, 0.1, 1.0, 1.0, 0.7, 0.5, 0.6, 0.5, 0.6, 0.6, 0.5, 0.6, 0.6, 0.6, 0.7, },
+  },
+
+  .ringCorrectionFactor = {
+    { 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.2, 0.2, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, },
+    { 0.4, 0.5, 0.5, 0.4, 0.4, 0.4, 0.4, 0.3, 0.3, 0.4, 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.9, 0.7, 0.5, 0.4, 0.3, 0.3, },
+    { 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 1.0, 1.0, 0.8, 0.5, 0.1, 0.5, 0.2, 0.3, 0.4, 0.5, 0.7, 0.9, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, },
+  },
+};
+
 static struct tuningModel rcclTuningModel[] = {
   tuning_model_0,
   tuning_model_1,
   tuning_model_2,
   tuning_model_3,
   tuning_model_4,
+  tuning_model_5,
 };
 
 /* Array indexes used below */
@@ -260,6 +292,135 @@ static const double perChMaxTreeBws[3][3] = {
 // Network post overhead in ns (1000 = 1 us)
 NCCL_PARAM(NetOverhead, "NET_OVERHEAD", -2);
 
+// RCCL_TUNING_FILE holds lines of either kind, fields separated by spaces and '#' starting comments:
+//   rule  <coll> <minBytes> <maxBytes> <nNodes|*> <ranksPerNode|*> <algorithm> <protocol> <nChannels|0> <nThreads|0>
+//   model <coll> <nNodes|*> <ranksPerNode|*> <algorithm> <protocol> <latency us> <bandwidth GB/s>
+// Rules pick the algorithm/protocol, and the channel and thread counts unless 0, of collectives in the size range.
+// Model entries replace the latency and bandwidth of the model, RCCL_TUNING_DUMP_FILE writes them all.
+static int tuningFind(const char* name, const char* const* names, int n) {
+  for (int i=0; i<n; i++) if (strcasecmp(name, names[i]) == 0) return i;
+  return -1;
+}
+
+static bool tuningMatch(const char* str, int value) {
+  return strcmp(str, "*") == 0 || atoi(str) == value;
+}
+
+static ncclResult_t tuningFileLoad(struct ncclComm* comm) {
+  const char* path = getenv("RCCL_TUNING_FILE");
+  if (path == NULL) return ncclSuccess;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    WARN("Could not open RCCL_TUNING_FILE %s : %s", path, strerror(errno));
+    return ncclSuccess;
+  }
+  free(comm->tuningRules);
+  comm->tuningRules = NULL;
+  comm->nTuningRules = 0;
+  int maxRules = 0, nModel = 0, lineNum = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    lineNum++;
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    char kind[16], collStr[32], nodesStr[16], rpnStr[16], algoStr[32], protoStr[32];
+    if (sscanf(line, "%15s", kind) != 1) continue;
+    struct ncclTuningRule rule;
+    float lat = 0, bw = 0;
+    bool isRule = strcmp(kind, "rule") == 0;
+    if (isRule) {
+      if (sscanf(line, "%*s %31s %zu %zu %15s %15s %31s %31s %d %d", collStr, &rule.minBytes, &rule.maxBytes,
+            nodesStr, rpnStr, algoStr, protoStr, &rule.nChannels, &rule.nThreads) != 9) {
+        WARN("%s:%d: malformed rule", path, lineNum);
+        continue;
+      }
+    } else if (strcmp(kind, "model") == 0) {
+      if (sscanf(line, "%*s %31s %15s %15s %31s %31s %f %f", collStr, nodesStr, rpnStr, algoStr, protoStr, &lat, &bw) != 7) {
+        WARN("%s:%d: malformed model entry", path, lineNum);
+        continue;
+      }
+    } else {
+      WARN("%s:%d: unknown entry %s", path, lineNum, kind);
+      continue;
+    }
+    if (!tuningMatch(nodesStr, comm->nNodes) || !tuningMatch(rpnStr, comm->maxLocalRanks)) continue;
+    int c = tuningFind(collStr, ncclFuncStr, NCCL_NUM_FUNCTIONS);
+    int a = tuningFind(algoStr, ncclAlgoStr, NCCL_NUM_ALGORITHMS);
+    int p = tuningFind(protoStr, ncclProtoStr, NCCL_NUM_PROTOCOLS);
+    if (c < 0 || a < 0 || p < 0) {
+      WARN("%s:%d: unknown collective, algorithm or protocol", path, lineNum);
+      continue;
+    }
+    // Algorithms disabled by the environment or not supported by the system stay unavailable
+    if (comm->bandwidths[c][a][p] == 0 && (isRule || bw != 0)) {
+      WARN("%s:%d: %s/%s is not available for %s", path, lineNum, ncclAlgoStr[a], ncclProtoStr[p], ncclFuncStr[c]);
+      continue;
+    }
+    if (!isRule) {
+      comm->latencies[c][a][p] = lat;
+      comm->bandwidths[c][a][p] = bw;
+      nModel++;
+      continue;
+    }
+    int maxThreads = p == NCCL_PROTO_LL128 ? NCCL_LL128_MAX_NTHREADS : NCCL_MAX_NTHREADS;
+    if (rule.nChannels < 0 || rule.nChannels > MAXCHANNELS ||
+        (rule.nThreads != 0 && (rule.nThreads % comm->WarpSize || rule.nThreads < 4*comm->WarpSize || rule.nThreads > maxThreads))) {
+      WARN("%s:%d: invalid channel or thread count", path, lineNum);
+      continue;
+    }
+    rule.coll = c;
+    rule.algorithm = a;
+    rule.protocol = p;
+    if (comm->nTuningRules == maxRules) {
+      NCCLCHECK(ncclRealloc(&comm->tuningRules, maxRules, maxRules ? 2*maxRules : 16));
+      maxRules = maxRules ? 2*maxRules : 16;
+    }
+    comm->tuningRules[comm->nTuningRules++] = rule;
+  }
+  fclose(file);
+  INFO(NCCL_INIT|NCCL_TUNING, "Loaded %d rules and %d model entries from RCCL_TUNING_FILE %s", comm->nTuningRules, nModel, path);
+  return ncclSuccess;
+}
+
+static ncclResult_t tuningFileDump(struct ncclComm* comm) {
+  const char* path = getenv("RCCL_TUNING_DUMP_FILE");
+  if (path == NULL || comm->rank != 0) return ncclSuccess;
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    WARN("Could not open RCCL_TUNING_DUMP_FILE %s : %s", path, strerror(errno));
+    return ncclSuccess;
+  }
+  fprintf(file, "# RCCL tuning model of %d nodes with %d ranks per node\n", comm->nNodes, comm->maxLocalRanks);
+  fprintf(file, "# rule  <coll> <minBytes> <maxBytes> <nNodes|*> <ranksPerNode|*> <algorithm> <protocol> <nChannels|0> <nThreads|0>\n");
+  fprintf(file, "# model <coll> <nNodes|*> <ranksPerNode|*> <algorithm> <protocol> <latency us> <bandwidth GB/s>\n");
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+      for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+        if (comm->bandwidths[c][a][p] == 0) continue;
+        fprintf(file, "model %s %d %d %s %s %.9g %.9g\n", ncclFuncStr[c], comm->nNodes, comm->maxLocalRanks,
+            ncclAlgoStr[a], ncclProtoStr[p], comm->latencies[c][a][p], comm->bandwidths[c][a][p]);
+      }
+    }
+  }
+  for (int r=0; r<comm->nTuningRules; r++) {
+    struct ncclTuningRule* rule = comm->tuningRules+r;
+    fprintf(file, "rule %s %zu %zu %d %d %s %s %d %d\n", ncclFuncStr[rule->coll], rule->minBytes, rule->maxBytes,
+        comm->nNodes, comm->maxLocalRanks, ncclAlgoStr[rule->algorithm], ncclProtoStr[rule->protocol], rule->nChannels, rule->nThreads);
+  }
+  fclose(file);
+  INFO(NCCL_INIT|NCCL_TUNING, "Tuning model dumped to RCCL_TUNING_DUMP_FILE %s", path);
+  return ncclSuccess;
+}
+
+struct ncclTuningRule* ncclTopoGetTuningRule(struct ncclInfo* info) {
+  struct ncclComm* comm = info->comm;
+  for (int r=0; r<comm->nTuningRules; r++) {
+    struct ncclTuningRule* rule = comm->tuningRules+r;
+    if (rule->coll == info->coll && info->nBytes >= rule->minBytes && info->nBytes <= rule->maxBytes) return rule;
+  }
+  return NULL;
+}
+
 static float getNetOverhead(struct ncclComm* comm) {
   if (ncclParamNetOverhead() != -2) return ncclParamNetOverhead() * .001;
   int cpuArch, cpuVendor, cpuModel;
@@ -270,6 +431,8 @@ static float getNetOverhead(struct ncclComm* comm) {
 }
 
 ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCompCap, struct ncclTopoGraph** graphs) {
+  // Any decision memoized so far was based on the previous model.
+  ncclAlgoCacheInvalidate(comm);
   int simpleDefaultThreads = (graphs[NCCL_ALGO_RING]->bwIntra*graphs[NCCL_ALGO_RING]->nChannels <= PCI_BW) ? 256 : NCCL_SIMPLE_MAX_NTHREADS;
   comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] =
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
@@ -294,6 +457,14 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
     getNthreads("NCCL_LL128_NTHREADS", ncclParamLl128Nthreads(), NCCL_LL128_MAX_NTHREADS/4, NCCL_LL128_MAX_NTHREADS, NCCL_LL128_MAX_NTHREADS);
 #endif
 
+#if defined(ENABLE_LL128)
+  // gfx94x systems matching no Rome model get their own table, which carries LL128 entries
+  if (comm->topo->tuning == 0 && IsArchMatch(comm->topo->nodes[GPU].nodes[0].gpu.gcn, "gfx94")) {
+    comm->topo->tuning = 5;
+    comm->topo->ll128Enabled = true;
+  }
+#endif
+
   int nNodes = comm->nNodes;
   int nRanks = comm->nRanks;
   if (nRanks <= 1) return ncclSuccess;
@@ -311,6 +482,7 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
   // De-penalize Tree/Simple latency on Power systems to favor Tree than Ring
   //if (cpuArch == NCCL_TOPO_CPU_ARCH_POWER) hwLat[NCCL_HW_PCI][NCCL_ALGO_TREE][NCCL_PROTO_SIMPLE] = hwLat[NCCL_HW_PCI][NCCL_ALGO_RING][NCCL_PROTO_SIMPLE];
   float ppn = (float)nRanks / nNodes; // if ppn < 2, then we are sending/receiving at the same GPU through the NIC, apply some bw discount
+  int treeArity = std::max(comm->treeArity, 2);
 
   int intraHw[NCCL_NUM_ALGORITHMS], hw[NCCL_NUM_ALGORITHMS];
   for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) intraHw[a] = graphs[a]->typeIntra == LINK_NVL ? NCCL_HW_NVLINK : NCCL_HW_PCI;
@@ -352,14 +524,16 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
         if (a == NCCL_ALGO_TREE && graphs[a]->pattern == NCCL_TOPO_PATTERN_TREE) busBw *= .85;
         if (a == NCCL_ALGO_COLLNET_DIRECT && p != NCCL_PROTO_SIMPLE) busBw = 0;  // Not used
         if (a == NCCL_ALGO_COLLNET_CHAIN && p != NCCL_PROTO_SIMPLE) busBw = 0;  // Not used
+        if (a == NCCL_ALGO_COLLNET_DIRECT && p == NCCL_PROTO_SIMPLE && minCompCap >= 90) busBw *= .85;
+#endif
         if (a == NCCL_ALGO_COLLNET_DIRECT && p == NCCL_PROTO_SIMPLE) {
           // Collnet+Direct requires all GPUs to have a local NIC to work at full speed
           float factor = ppn / (1.0*graphs[a]->nChannels); // GPU/NIC ratio
           factor -= (factor-1)/2;
           busBw /= factor;
         }
-#endif
-        if (a == NCCL_ALGO_COLLNET_DIRECT && p == NCCL_PROTO_SIMPLE && minCompCap >= 90) busBw *= .85;
+        // Inner nodes of k-ary trees move data to/from k nodes instead of 2
+        if (a == NCCL_ALGO_TREE && treeArity > 2) busBw *= 2.0/treeArity;
 
         // Convert bus BW to algorithm BW
         float ratio;
@@ -373,7 +547,11 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
         float intraLat = rcclTuningModel[comm->topo->tuning].hwLat[intraHw[a]][a][p];
         float interLat =  graphs[a]->latencyInter ? graphs[a]->latencyInter : rcclTuningModel[comm->topo->tuning].hwLat[NCCL_HW_NET][a][p];
         //if (nNodes > 1 && p == NCCL_PROTO_LL) intraLat *= 1.8;
+        // Measured by the link calibration, if it is slower than the model
+        interLat = std::max(interLat, comm->topo->calib.netLat);
         if (p == NCCL_PROTO_SIMPLE) interLat += graphs[a]->latencyInter;
+        // PXN sends go through the GPU next to the NIC first
+        if (graphs[a]->typeInter == PATH_PXN) interLat += rcclTuningModel[comm->topo->tuning].hwLat[NCCL_HW_NVLINK][a][p];
 
         if (a == NCCL_ALGO_RING) {
           float lat = rcclTuningModel[comm->topo->tuning].hwLat[hw[a]][a][p];
@@ -396,7 +574,7 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
           }
         } else if (a == NCCL_ALGO_TREE) {
           comm->latencies[coll][a][p] +=
-            2 * ((nRanks/nNodes-1) * intraLat + log2i(nNodes) * interLat);
+            2 * ((nRanks/nNodes-1) * intraLat + ncclGetKtreeDepth(nNodes, treeArity) * interLat);
         } else if (a == NCCL_ALGO_COLLNET_DIRECT) {
           comm->latencies[coll][a][p] +=
             2 * (std::min(1, (nRanks/nNodes-1)) * intraLat + (nRanks/nNodes-1) * 0.5) + interLat;  // Add 0.5 arity serialization latency
@@ -441,10 +619,10 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
       if (comm->rank == 0) WARN("CollNet is not supported or fails to initialize, ignoring NCCL_ALGO=COLLNET");
     }
   } else {
-    // Disable CollNet+Direct if not on an NVSwitch system
+    // Disable CollNet+Direct if not on an NVSwitch system, or on AMD a node with xGMI between all GPUs
     int nvsCount = 0;
     NCCLCHECK(ncclTopoGetNvsCount(comm->topo, &nvsCount));
-    if (nvsCount == 0) algoEnable[NCCL_ALGO_COLLNET_DIRECT] = 0;
+    if (nvsCount == 0 && !(comm->topo->type & RCCL_TOPO_XGMI_ALL)) algoEnable[NCCL_ALGO_COLLNET_DIRECT] = 0;
   }
 
   for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
@@ -453,9 +631,10 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
     if (pEnable == 2 && p == NCCL_PROTO_LL128) {
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
 #if defined(ENABLE_LL128)
-      // Enable LL128 by default only on gfx90a with available tuning table
-      pEnable = (graphs[a]->typeInter <= PATH_PXB) && graphs[a]->typeIntra <= PATH_NVL &&
-        (IsArchMatch(comm->topo->nodes[GPU].nodes[0].gpu.gcn, "gfx90a") && comm->topo->ll128Enabled) ? 1 : 0;
+      // Enable LL128 by default only on gfx90a/gfx94x with available tuning table
+      pEnable = (graphs[a]->typeInter <= PATH_PXB || (comm->topo->xgmiPxn && graphs[a]->typeInter <= PATH_PXN)) && graphs[a]->typeIntra <= PATH_NVL &&
+        ((IsArchMatch(comm->topo->nodes[GPU].nodes[0].gpu.gcn, "gfx90a") || IsArchMatch(comm->topo->nodes[GPU].nodes[0].gpu.gcn, "gfx94")) &&
+         comm->topo->ll128Enabled) ? 1 : 0;
 #else
       pEnable = 0;
 #endif
@@ -479,6 +658,9 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
     if (algoEnable[a] == 0) comm->bandwidths[c][a][p] = 0;
   }
 
+  NCCLCHECK(tuningFileLoad(comm));
+  NCCLCHECK(tuningFileDump(comm));
+
   if (comm->rank == 0) {
     char line[1024];
     for (int block=0; block<2; block++) {
@@ -576,8 +758,151 @@ ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int proto
     lat *= info->comm->minCompCap < 80 ? 1.9 : 1.4; // Plateau effect of ring
   }
 #endif
+  if (info->maxChannels > 0) {
+    // Fewer CUs than the bandwidth was modeled with, from ncclGroupSetMaxCTAs()
+    int fullChannels = algorithm == NCCL_ALGO_NVLS || algorithm == NCCL_ALGO_NVLS_TREE ? info->comm->nvlsChannels : info->comm->nChannels;
+    if (info->maxChannels < fullChannels) bw = bw * info->maxChannels / fullChannels;
+  }
   // Tree pipelining saves latency in aggregation cases
   int latCount = algorithm == NCCL_ALGO_RING ? numPipeOps : DIVUP(numPipeOps, NCCL_MAX_WORK_ELEMENTS);
   *time = lat * latCount + (info->nBytes) / (1000 * bw);
   return ncclSuccess;
 }
+
+ncclResult_t ncclTopoGetCollTime(struct ncclComm* comm, ncclFunc_t coll, size_t nBytes, float* time) {
+  *time = -1;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      float bw = comm->bandwidths[coll][a][p];
+      if (bw <= 0) continue;
+      float t = comm->latencies[coll][a][p] + nBytes / (1000 * bw);
+      if (*time < 0 || t < *time) *time = t;
+    }
+  }
+  return ncclSuccess;
+}
+
+// Model of the one-shot and two-shot allreduce (RCCL_QUICK_ALLREDUCE). A barrier costs one xGMI hop
+// of LL, and a GPU pulls the (nRanks-1) other inputs in one-shot, or twice (nRanks-1)/nRanks of the
+// data in two-shot, at the bus bandwidth of the ring allgather.
+ncclResult_t ncclTopoGetQuickAllReduceTime(struct ncclComm* comm, size_t nBytes, float* oneShotTime, float* twoShotTime) {
+  int nRanks = comm->nRanks;
+  float busBw = comm->bandwidths[ncclFuncAllGather][NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] * (nRanks-1) / nRanks;
+  *oneShotTime = *twoShotTime = -1;
+  if (busBw <= 0) return ncclSuccess;
+  float launchLat = baseLat[NCCL_ALGO_RING][NCCL_PROTO_LL];
+  float barrierLat = rcclTuningModel[comm->topo->tuning].hwLat[NCCL_HW_NVLINK][NCCL_ALGO_RING][NCCL_PROTO_LL];
+  *oneShotTime = launchLat + barrierLat + (nRanks-1) * nBytes / (1000 * busBw);
+  *twoShotTime = launchLat + 2*barrierLat + 2.0 * (nRanks-1) / nRanks * nBytes / (1000 * busBw);
+  return ncclSuccess;
+}
+
+// Model of the pipelined tree broadcast (RCCL_TREE_BROADCAST). In each of the nStages, a rail leader
+// forwards at most two chunks, one per tree, at the bus bandwidth of the ring broadcast of its rail
+// after one network hop, then its node broadcasts them over xGMI.
+ncclResult_t ncclTopoGetTreeBroadcastTime(struct ncclComm* comm, size_t chunkBytes, int nStages, float* time) {
+  struct ncclComm* rail = comm->hierRailComm;
+  *time = -1;
+  float railBw = rail->bandwidths[ncclFuncBroadcast][NCCL_ALGO_RING][NCCL_PROTO_SIMPLE];
+  if (railBw <= 0) return ncclSuccess;
+  float hopLat = baseLat[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] +
+    rcclTuningModel[rail->topo->tuning].hwLat[NCCL_HW_NET][NCCL_ALGO_RING][NCCL_PROTO_SIMPLE];
+  float stageTime = hopLat + 2 * chunkBytes / (1000 * railBw);
+  if (comm->hierIntraComm->nRanks > 1) {
+    float intraTime;
+    NCCLCHECK(ncclTopoGetCollTime(comm->hierIntraComm, ncclFuncBroadcast, 2 * chunkBytes, &intraTime));
+    if (intraTime < 0) return ncclSuccess;
+    stageTime += intraTime;
+  }
+  *time = nStages * stageTime;
+  return ncclSuccess;
+}
+
+RCCL_PARAM(ChannelModel, "CHANNEL_MODEL", 0);
+
+// Channel count model of rings and trees (RCCL_CHANNEL_MODEL). A channel moves its share of the data
+// over each hop with at most NCCL_STEPS buffer slots in flight, so it only gets its share of the
+// bandwidth when what a hop carries, and what the buffers hold, covers the bandwidth-delay product
+// of the hop. Past that point more channels only add latency bound transfers. The smallest count
+// within 5% of the best modeled time is used. *nChannels is 0 when the model does not apply.
+ncclResult_t ncclTopoGetAlgoChannels(struct ncclInfo* info, int algorithm, int protocol, int maxChannels, int* nChannels) {
+  struct ncclComm* comm = info->comm;
+  *nChannels = 0;
+  if (rcclParamChannelModel() == 0 || comm->nRanks == 1 || info->nBytes == 0) return ncclSuccess;
+  if (algorithm != NCCL_ALGO_RING && algorithm != NCCL_ALGO_TREE) return ncclSuccess;
+  float bw = comm->bandwidths[info->coll][algorithm][protocol];
+  if (bw <= 0) return ncclSuccess;
+
+  int nRanks = comm->nRanks, nNodes = comm->nNodes;
+  int nHops = algorithm == NCCL_ALGO_TREE ? 2*(nRanks/nNodes-1 + ncclGetKtreeDepth(nNodes, std::max(comm->treeArity, 2))) :
+    info->coll == ncclFuncAllReduce ? 2*(nRanks-1) :
+    info->coll == ncclFuncReduceScatter || info->coll == ncclFuncAllGather ? nRanks-1 :
+    nRanks;
+  float hopLat = (comm->latencies[info->coll][algorithm][protocol] - baseLat[algorithm][protocol]) / std::max(nHops, 1);
+  if (hopLat <= 0) return ncclSuccess;
+  double bwPerChannel = bw / comm->nChannels; // GB/s, 1000 bytes per us
+  double bdp = bwPerChannel*1000*hopLat;
+  double buffBytes = comm->buffSizes[protocol] *
+    (protocol == NCCL_PROTO_LL ? 0.5 : protocol == NCCL_PROTO_LL128 ? (double)NCCL_LL128_DATAELEMS/NCCL_LL128_LINEELEMS : 1.0);
+
+  float times[MAXCHANNELS];
+  float best = -1;
+  maxChannels = std::min(maxChannels, MAXCHANNELS);
+  for (int nc=1; nc<=maxChannels; nc++) {
+    // Rings move a 1/nRanks slice per hop, trees pipeline all of it through each hop
+    double hopBytes = algorithm == NCCL_ALGO_RING ? (double)info->nBytes/((double)nc*nRanks) : (double)info->nBytes/nc;
+    double channelBw = bwPerChannel * std::min(1.0, std::min(hopBytes, buffBytes)/bdp);
+    times[nc-1] = info->nBytes / (1000*nc*channelBw);
+    if (best < 0 || times[nc-1] < best) best = times[nc-1];
+  }
+  int nc = 1;
+  while (nc < maxChannels && times[nc-1] > best*1.05) nc++;
+  *nChannels = nc;
+  return ncclSuccess;
+}
+
+RCCL_PARAM(TreeArity, "TREE_ARITY", 0);
+
+// Arity of the inter-node trees. RCCL_TREE_ARITY=k builds double k-ary trees instead of the double
+// binary tree, -1 picks the k minimizing the small message latency depth(k)*(interLat + k*step), each
+// level costing the network latency plus the time for the parent to take one LL step from each child.
+// k is bounded by the device fan-in/out: rank has NCCL_MAX_TREE_ARITY-1 peers down, one of them
+// intra-node, and balanced trees split the inter-node children over the two tree ranks of a node.
+ncclResult_t ncclTopoGetTreeArity(struct ncclComm* comm, struct ncclTopoGraph* treeGraph, int* treePatterns, int* arity) {
+  *arity = 2;
+  int64_t param = rcclParamTreeArity();
+  if (param == 0 || param == 2 || comm->nNodes <= 2) return ncclSuccess;
+
+  bool balanced = true;
+  for (int n=0; n<comm->nNodes; n++) balanced &= treePatterns[n] == NCCL_TOPO_PATTERN_BALANCED_TREE;
+  int devArity = NCCL_MAX_TREE_ARITY-1;
+  int intra = comm->maxLocalRanks > 1 ? 1 : 0;
+  int maxArity = std::min(NCCL_MAX_KTREE_ARITY, balanced && intra ? 2*(devArity-1) : devArity-intra);
+  if (maxArity <= 2) {
+    INFO(NCCL_INIT|NCCL_TUNING, "RCCL_TREE_ARITY=%ld ignored, k-ary trees need a build with ENABLE_KTREE", param);
+    return ncclSuccess;
+  }
+
+  if (param > 0) {
+    *arity = std::min((int)param, maxArity);
+    if (*arity < 2 || *arity != param) {
+      *arity = std::max(*arity, 2);
+      WARN("RCCL_TREE_ARITY=%ld out of range, using %d (at most %d)", param, *arity, maxArity);
+    }
+  } else {
+    float interLat = treeGraph->latencyInter ? treeGraph->latencyInter :
+      rcclTuningModel[comm->topo->tuning].hwLat[NCCL_HW_NET][NCCL_ALGO_TREE][NCCL_PROTO_LL];
+    // Data of one LL step, in us at the inter-node bandwidth of a channel (GB/s, 1000 bytes per us)
+    float step = treeGraph->bwInter > 0 ? NCCL_LL_LINES_PER_THREAD*NCCL_LL_MAX_NTHREADS*sizeof(uint64_t) / (1000*treeGraph->bwInter) : 0;
+    float best = -1;
+    for (int k=2; k<=maxArity; k++) {
+      float time = ncclGetKtreeDepth(comm->nNodes, k) * (interLat + k*step);
+      if (best < 0 || time < best*0.99) {
+        best = time;
+        *arity = k;
+      }
+    }
+  }
+  INFO(NCCL_INIT|NCCL_TUNING, "Inter-node trees of arity %d over %d nodes, depth %d", *arity, comm->nNodes, ncclGetKtreeDepth(comm->nNodes, *arity));
+  return ncclSuccess;
+}
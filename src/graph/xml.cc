@@ -603,6 +603,9 @@ ncclResult_t ncclTopoGetXmlFromSys(struct ncclXmlNode* pciNode, struct ncclXml*
   return ncclSuccess;
 }
 
+// Records the current width and speed of the xGMI links of each GPU next to its links, see ncclTopoAddXGMI()
+RCCL_PARAM(XgmiLinkMetrics, "XGMI_LINK_METRICS", 1);
+
 ncclResult_t ncclTopoGetXmlFromGpu(struct ncclXmlNode* pciNode, uint32_t rocmDev, struct ncclXml* xml, struct ncclXmlNode** gpuNodeRet) {
   struct ncclXmlNode* gpuNode = NULL;
   NCCLCHECK(xmlGetSub(pciNode, "gpu", &gpuNode));
@@ -671,6 +674,8 @@ ncclResult_t ncclTopoGetXmlFromGpu(struct ncclXmlNode* pciNode, uint32_t rocmDev
     NCCLCHECK(xmlGetAttr(pciNode, "busid", &busId));
     uint32_t deviceCnt;
     NCCLCHECK(rocm_smi_getNumDevice(&deviceCnt));
+    int xgmiWidth = 0, xgmiSpeed = 0;
+    if (rcclParamXgmiLinkMetrics() && rocm_smi_getXgmiLinkMetrics(dev, &xgmiWidth, &xgmiSpeed) != ncclSuccess) xgmiWidth = xgmiSpeed = 0;
     for (int i=0; i<deviceCnt; i++) {
       if (i != dev) {
         RSMI_IO_LINK_TYPE rsmi_type;
@@ -689,6 +694,10 @@ ncclResult_t ncclTopoGetXmlFromGpu(struct ncclXmlNode* pciNode, uint32_t rocmDev
               NCCLCHECK(xmlAddNode(xml, gpuNode, "xgmi", &nvlNode));
               NCCLCHECK(xmlSetAttr(nvlNode, "target", lowerId));
               NCCLCHECK(xmlSetAttrInt(nvlNode, "count", count));
+              if (xgmiWidth) {
+                NCCLCHECK(xmlSetAttrInt(nvlNode, "width", xgmiWidth));
+                NCCLCHECK(xmlSetAttrInt(nvlNode, "speed", xgmiSpeed));
+              }
             }
           }
         }
@@ -788,10 +797,8 @@ ncclResult_t ncclTopoFillGpu(struct ncclXml* xml, const char* busId, struct nccl
   NCCLCHECK(ncclTopoGetXmlFromSys(node, xml));
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
   uint32_t devIndex;
-  static int rocmsmiInit = 0;
-  if (rocmsmiInit == 0) {
-    rocmsmiInit = (rocm_smi_init() != ncclSuccess) ? 2 : 1;
-  }
+  // Initialized once, also when the init threads of ncclCommInitAll() get here together
+  static int rocmsmiInit = (rocm_smi_init() != ncclSuccess) ? 2 : 1;
   if (rocmsmiInit == 1) {
     if (rocm_smi_getDeviceIndexByPciBusId(busId, &devIndex) != ncclSuccess) devIndex = -1;
   }
@@ -11,6 +11,8 @@
 #include "enqueue.h"
 #include "transport.h"
 #include "channel.h"
+#include "rccl_vars.h"
+#include "chrome_trace.h"
 #include <assert.h>
 
 #include "msccl/msccl_lifecycle.h"
@@ -23,6 +25,7 @@ __thread struct ncclIntruQueue<struct ncclAsyncJob, &ncclAsyncJob::next> ncclAsy
 __thread struct ncclGroupJob *ncclGroupJobMainPtr = NULL;
 __thread struct ncclGroupJob ncclGroupJobMain;
 __thread int ncclGroupBlocking = -1; /* default mode */
+__thread int ncclGroupMaxCTAs = 0; /* no limit */
 __thread bool ncclGroupJobAbortFlag = false;
 
 void* ncclAsyncJobMain(void* arg);
@@ -62,6 +65,21 @@ ncclResult_t ncclAsyncLaunch(
   return ret;
 }
 
+// Async jobs of groups run on worker threads kept across groups. The jobs of a group may wait for
+// each other, e.g. preconnects of comms of the same process, so a job never waits for a worker: one
+// is started whenever more jobs are queued than workers are idle. groupLaunch sleeps on jobDone
+// until a job completes instead of polling.
+RCCL_PARAM(GroupWorkers, "GROUP_WORKERS", 1);
+
+static pthread_mutex_t workerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workerCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobDoneCond = PTHREAD_COND_INITIALIZER;
+static struct ncclIntruQueue<struct ncclAsyncJob, &ncclAsyncJob::workerNext> workerJobs;
+static int workerCount = 0;
+static int workerIdle = 0;
+static int workerPending = 0;
+static uint64_t jobsCompleted = 0;
+
 void* ncclAsyncJobMain(void* arg) {
   struct ncclAsyncJob* job = (struct ncclAsyncJob*)arg;
   job->result = job->func(job);
@@ -69,9 +87,81 @@ void* ncclAsyncJobMain(void* arg) {
     INFO(NCCL_INIT,"%s:%d -> %d [Async thread]", __FILE__, __LINE__, job->result);
   }
   __atomic_store_n(&job->state, ncclGroupJobDone, __ATOMIC_RELEASE);
+  // job may be freed from here on
+  pthread_mutex_lock(&workerMutex);
+  jobsCompleted++;
+  pthread_cond_broadcast(&jobDoneCond);
+  pthread_mutex_unlock(&workerMutex);
   return arg;
 }
 
+static void* asyncWorkerMain(void* arg) {
+  pthread_mutex_lock(&workerMutex);
+  while (true) {
+    while (ncclIntruQueueEmpty(&workerJobs)) {
+      workerIdle++;
+      pthread_cond_wait(&workerCond, &workerMutex);
+      workerIdle--;
+    }
+    struct ncclAsyncJob* job = ncclIntruQueueDequeue(&workerJobs);
+    workerPending--;
+    pthread_mutex_unlock(&workerMutex);
+    ncclAsyncJobMain(job);
+    pthread_mutex_lock(&workerMutex);
+  }
+  return nullptr;
+}
+
+// Runs job on a worker thread, or on a thread of its own without RCCL_GROUP_WORKERS
+static ncclResult_t asyncJobStart(struct ncclAsyncJob* job) {
+  if (!rcclParamGroupWorkers()) {
+    SYSCHECK(pthread_create(&job->thread, nullptr, ncclAsyncJobMain, job), "pthread_create");
+    return ncclSuccess;
+  }
+  ncclResult_t ret = ncclSuccess;
+  pthread_mutex_lock(&workerMutex);
+  if (workerPending + 1 > workerIdle) {
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, asyncWorkerMain, nullptr) != 0) {
+      WARN("Unable to create a group worker thread : %s", strerror(errno));
+      ret = ncclSystemError;
+      goto exit;
+    }
+    pthread_detach(thread);
+    ncclSetThreadName(thread, "NCCL Group %2d", workerCount);
+    workerCount++;
+  }
+  workerPending++;
+  ncclIntruQueueEnqueue(&workerJobs, job);
+  pthread_cond_signal(&workerCond);
+exit:
+  pthread_mutex_unlock(&workerMutex);
+  return ret;
+}
+
+// Number of async jobs completed so far, to wait for the next one with asyncJobsWait()
+static uint64_t asyncJobsCompleted() {
+  pthread_mutex_lock(&workerMutex);
+  uint64_t completed = jobsCompleted;
+  pthread_mutex_unlock(&workerMutex);
+  return completed;
+}
+
+// Waits for a job to complete after the first `completed` ones. Wakes up every millisecond
+// regardless, so an abort of the group from another thread is still noticed.
+static void asyncJobsWait(uint64_t completed) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&workerMutex);
+  if (jobsCompleted == completed) pthread_cond_timedwait(&jobDoneCond, &workerMutex, &deadline);
+  pthread_mutex_unlock(&workerMutex);
+}
+
 ncclResult_t ncclAsyncJobComplete(struct ncclAsyncJob* job) {
   ncclResult_t ret;
   SYSCHECK(pthread_join(job->thread, NULL), "pthread_join");
@@ -119,15 +209,37 @@ exit:
   return ret;
 }
 
+NCCL_API(ncclResult_t, ncclGroupSetMaxCTAs, int maxCTAs);
+ncclResult_t ncclGroupSetMaxCTAs(int maxCTAs) {
+  if (maxCTAs < 0) {
+    WARN("GroupSetMaxCTAs : invalid value %d", maxCTAs);
+    return ncclInvalidArgument;
+  }
+  ncclGroupMaxCTAs = std::min(maxCTAs, MAXCHANNELS);
+  TRACE_CALL("ncclGroupSetMaxCTAs(%d)", maxCTAs);
+  return ncclSuccess;
+}
+
 struct ncclPreconnectJob {
   struct ncclAsyncJob base;
   struct ncclComm* comm;
+  bool p2p;
 };
 ncclResult_t ncclPreconnectFunc(struct ncclAsyncJob* job_) {
   struct ncclPreconnectJob* job = (struct ncclPreconnectJob*)job_;
   struct ncclComm* comm = job->comm;
   CUDACHECK(cudaSetDevice(comm->cudaDev));
   if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
+  if (comm->runtimeConnectProtos) {
+    NCCLCHECK(ncclCollGrowProtos(comm, comm->runtimeConnectProtos));
+    comm->runtimeConnectProtos = 0;
+  }
+  if (comm->runtimeConnectAlgos) {
+    NCCLCHECK(ncclCollPreconnect(comm, comm->runtimeConnectAlgos));
+    comm->runtimeConnectAlgos = 0;
+  }
+  NCCLCHECK(ncclTunerAgree(comm));
+  if (!job->p2p) return ncclSuccess;
   NCCLCHECK(ncclTransportP2pSetup(comm, NULL, 1));
   if (comm->p2pNet) NCCLCHECK(ncclTransportP2pSetup(comm, NULL, NCCL_CONN_IDX_P2P_NET));
   return ncclSuccess;
@@ -202,6 +314,102 @@ failure:
   return result;
 }
 
+static bool useFusedLaunches(struct ncclComm* head) {
+  if (!rcclParamFusedLaunch() || ncclParamLaunchMode == ncclLaunchModeGroup) return false;
+  if (head->groupNext == nullptr) return false;
+  // Graph captured groups keep the per-clique capture checks of doLaunches().
+  for (struct ncclComm* comm = head; comm != nullptr; comm = comm->groupNext) {
+    if (ncclCudaGraphValid(comm->tasks.capturingGraph)) return false;
+  }
+  return true;
+}
+
+// Same as doLaunches() without launch barriers, but in each round the next
+// plan of comms sharing a device and stream are merged into a single launch.
+static ncclResult_t doFusedLaunches(struct ncclComm* head) {
+  ncclResult_t result = ncclSuccess;
+  struct ncclComm* fuseComms[MAXCHANNELS];
+  struct ncclKernelPlan* fusePlans[MAXCHANNELS];
+  struct ncclComm** comms = nullptr;
+  struct ncclKernelPlan** plans = nullptr;
+  int nComms = 0;
+
+  for (struct ncclComm* comm = head; comm != nullptr; comm = comm->groupNext) nComms++;
+  NCCLCHECKGOTO(ncclCalloc(&comms, nComms), result, failure);
+  NCCLCHECKGOTO(ncclCalloc(&plans, nComms), result, failure);
+  nComms = 0;
+  for (struct ncclComm* comm = head; comm != nullptr; comm = comm->groupNext) {
+    comms[nComms++] = comm;
+    CUDACHECKGOTO(cudaSetDevice(comm->cudaDev), result, failure);
+    NCCLCHECKGOTO(ncclLaunchPrepare(comm), result, failure);
+  }
+
+  while (true) { // Iterate rounds of launches, one plan per comm.
+    bool moreRounds = false;
+    for (int i = 0; i < nComms; i++) {
+      plans[i] = comms[i]->unlaunchedPlansHead;
+      if (plans[i] != nullptr) {
+        comms[i]->unlaunchedPlansHead = plans[i]->next;
+        moreRounds = true;
+      }
+    }
+    if (!moreRounds) break;
+
+    for (int i = 0; i < nComms; i++) {
+      if (plans[i] == nullptr) continue;
+      int nFused = 0;
+      int nBlocks = plans[i]->channelCount;
+      fuseComms[nFused] = comms[i];
+      fusePlans[nFused++] = plans[i];
+      for (int j = i+1; j < nComms && nFused < MAXCHANNELS; j++) {
+        if (plans[j] != nullptr && ncclLaunchCanFuse(comms[i], plans[i], comms[j], plans[j], nBlocks)) {
+          nBlocks += plans[j]->channelCount;
+          fuseComms[nFused] = comms[j];
+          fusePlans[nFused++] = plans[j];
+          plans[j] = nullptr;
+        }
+      }
+      plans[i] = nullptr;
+
+      for (int f = 0; f < nFused; f++) {
+        CUDACHECKGOTO(cudaSetDevice(fuseComms[f]->cudaDev), result, failure);
+        NCCLCHECKGOTO(ncclLaunchKernelBefore_NoUncapturedCuda(fuseComms[f], fusePlans[f]), result, failure);
+      }
+      if (nFused == 1) {
+        NCCLCHECKGOTO(ncclLaunchKernel(fuseComms[0], fusePlans[0]), result, failure);
+      } else {
+        NCCLCHECKGOTO(ncclLaunchKernelFused(nFused, fuseComms, fusePlans), result, failure);
+      }
+      for (int f = 0; f < nFused; f++) {
+        NCCLCHECKGOTO(ncclLaunchKernelAfter_NoCuda(fuseComms[f], fusePlans[f]), result, failure);
+      }
+    }
+  }
+
+  for (int i = 0; i < nComms; i++) {
+    CUDACHECKGOTO(cudaSetDevice(comms[i]->cudaDev), result, failure);
+    NCCLCHECKGOTO(ncclLaunchFinish(comms[i]), result, failure);
+  }
+failure:
+  free(comms);
+  free(plans);
+  return result;
+}
+
+// Reset comm->tasks to empty. Task memory itself lives in comm->memScoped.
+static void groupResetTasks(struct ncclComm* comm) {
+  comm->tasks.nTasksColl = 0;
+  comm->tasks.nTasksP2p = 0;
+  comm->tasks.streams = nullptr;
+  comm->tasks.numStreams = 0;
+  ncclIntruQueueConstruct(&comm->tasks.collQueue);
+  comm->tasks.collBytesTotal = 0;
+  for (int i = 0; i < comm->nRanks; i++) {
+    ncclIntruQueueConstruct(&comm->tasks.peers[i].sendQueue);
+    ncclIntruQueueConstruct(&comm->tasks.peers[i].recvQueue);
+  }
+}
+
 static void groupCleanup(struct ncclComm** groupCommHeadPtr, struct ncclComm** groupCommPreconnectHeadPtr, struct ncclIntruQueue<struct ncclAsyncJob, &ncclAsyncJob::next>* asyncJobsPtr, ncclResult_t* groupErrorPtr, ncclResult_t error) {
   struct ncclComm* comm = *groupCommHeadPtr;
 
@@ -213,8 +421,8 @@ static void groupCleanup(struct ncclComm** groupCommHeadPtr, struct ncclComm** g
     // is needed.
     comm->preconnectNext = reinterpret_cast<struct ncclComm*>(0x1);
     for (int i = 0; i < comm->nRanks; i++) {
-      comm->tasks.peers[i].sendSeen = false;
-      comm->tasks.peers[i].recvSeen = false;
+      comm->tasks.peers[i].sendSeen = 0;
+      comm->tasks.peers[i].recvSeen = 0;
       comm->connectSend[i] = 0UL;
       comm->connectRecv[i] = 0UL;
     }
@@ -232,19 +440,11 @@ static void groupCleanup(struct ncclComm** groupCommHeadPtr, struct ncclComm** g
             ncclMemoryPoolFree(&comm->memPool_ncclProxyOp, pxop);
           }
         }
+        ncclPlanFreeWorkLists(comm, plan);
         ncclMemoryPoolFree(&comm->memPool_ncclKernelPlan, plan);
       }
     }
-    // Reset comm->tasks to empty.
-    comm->tasks.nTasksColl = 0;
-    comm->tasks.nTasksP2p = 0;
-    comm->tasks.streams = nullptr;
-    ncclIntruQueueConstruct(&comm->tasks.collQueue);
-    comm->tasks.collBytesTotal = 0;
-    for (int i = 0; i < comm->nRanks; i++) {
-      ncclIntruQueueConstruct(&comm->tasks.peers[i].sendQueue);
-      ncclIntruQueueConstruct(&comm->tasks.peers[i].recvQueue);
-    }
+    groupResetTasks(comm);
 
     if (!comm->config.blocking)
       (void) ncclCommSetAsyncError(comm, error);
@@ -267,7 +467,348 @@ static void groupCleanup(struct ncclComm** groupCommHeadPtr, struct ncclComm** g
   return;
 }
 
+RCCL_PARAM(LaunchPipeline, "LAUNCH_PIPELINE", 0);
+
+// Helper thread preparing and launching a comm's plans after ncclGroupEnd()
+// has returned (RCCL_LAUNCH_PIPELINE). The user stream writes values[0] and
+// then waits on values[1] while the helper's stream waits on values[0] before
+// the kernels, so work is ordered as if launched on the user stream.
+struct ncclLaunchPipeline {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool pending; // a group was handed over and is not launched yet
+  bool stop;
+  ncclResult_t result; // first error, returned by ncclLaunchPipelineWait()
+  uint64_t seq;
+  uint64_t* values; // in cudaHost memory
+  cudaStream_t stream;
+  struct ncclComm* comm;
+};
+
+static ncclResult_t pipelineLaunch(struct ncclLaunchPipeline* pipe) {
+  struct ncclComm* comm = pipe->comm;
+  struct ncclKernelPlan* plan;
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  CUDACHECK(hipStreamWaitValue64(pipe->stream, &pipe->values[0], pipe->seq, hipStreamWaitValueGte, ~uint64_t(0)));
+  NCCLCHECK(ncclLaunchPrepare(comm));
+  while ((plan = comm->unlaunchedPlansHead) != nullptr) {
+    comm->unlaunchedPlansHead = plan->next;
+    NCCLCHECK(ncclLaunchKernelBefore_NoUncapturedCuda(comm, plan));
+    NCCLCHECK(ncclLaunchKernel(comm, plan));
+    NCCLCHECK(ncclLaunchKernelAfter_NoCuda(comm, plan));
+  }
+  NCCLCHECK(ncclLaunchFinish(comm));
+  CUDACHECK(hipStreamWriteValue64(pipe->stream, &pipe->values[1], pipe->seq, 0));
+  return ncclSuccess;
+}
+
+static void* pipelineMain(void* arg) {
+  struct ncclLaunchPipeline* pipe = (struct ncclLaunchPipeline*)arg;
+  struct ncclComm* comm = pipe->comm;
+  pthread_mutex_lock(&pipe->mutex);
+  while (true) {
+    while (!pipe->pending && !pipe->stop) pthread_cond_wait(&pipe->cond, &pipe->mutex);
+    if (!pipe->pending) break;
+    pthread_mutex_unlock(&pipe->mutex);
+
+    ncclResult_t ret = pipelineLaunch(pipe);
+    if (ret == ncclSuccess) {
+      (void) ncclGroupCommLeave(comm);
+    } else {
+      WARN("Pipelined launch failed on comm %p rank %d : %s", comm, comm->rank, ncclGetErrorString(ret));
+      // Release the user stream, the error is reported on the next use of comm.
+      __atomic_store_n(&pipe->values[1], pipe->seq, __ATOMIC_RELEASE);
+      struct ncclComm* head = comm;
+      struct ncclComm* preconnectHead = nullptr;
+      struct ncclIntruQueue<struct ncclAsyncJob, &ncclAsyncJob::next> jobs;
+      ncclResult_t groupError;
+      ncclIntruQueueConstruct(&jobs);
+      groupCleanup(&head, &preconnectHead, &jobs, &groupError, ret);
+    }
+
+    pthread_mutex_lock(&pipe->mutex);
+    if (pipe->result == ncclSuccess) pipe->result = ret;
+    __atomic_store_n(&pipe->pending, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pipe->cond);
+  }
+  pthread_mutex_unlock(&pipe->mutex);
+  return nullptr;
+}
+
+// Order the user stream after the helper's launch and hand comm's tasks over.
+// On failure comm is left in the group list for groupCleanup().
+static ncclResult_t pipelineSubmit(struct ncclComm** headPtr) {
+  struct ncclComm* comm = *headPtr;
+  struct ncclLaunchPipeline* pipe = comm->launchPipe;
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  if (pipe == nullptr) {
+    NCCLCHECK(ncclCalloc(&pipe, 1));
+    pipe->comm = comm;
+    pthread_mutex_init(&pipe->mutex, nullptr);
+    pthread_cond_init(&pipe->cond, nullptr);
+    NCCLCHECK(ncclCudaHostCalloc(&pipe->values, 2));
+    CUDACHECK(cudaStreamCreateWithFlags(&pipe->stream, cudaStreamNonBlocking));
+    pthread_create(&pipe->thread, nullptr, pipelineMain, pipe);
+    ncclSetThreadName(pipe->thread, "NCCL Launch%2d", comm->cudaDev);
+    comm->launchPipe = pipe;
+  }
+  cudaStream_t userStream = comm->tasks.streams->stream;
+  pipe->seq++;
+  CUDACHECK(hipStreamWriteValue64(userStream, &pipe->values[0], pipe->seq, 0));
+  CUDACHECK(hipStreamWaitValue64(userStream, &pipe->values[1], pipe->seq, hipStreamWaitValueGte, ~uint64_t(0)));
+  comm->tasks.streams->stream = pipe->stream;
+
+  *headPtr = comm->groupNext;
+  comm->groupNext = nullptr; // Group of one owned by the helper until ncclGroupCommLeave()
+  pthread_mutex_lock(&pipe->mutex);
+  pipe->pending = true;
+  pthread_cond_signal(&pipe->cond);
+  pthread_mutex_unlock(&pipe->mutex);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclLaunchPipelineWait(struct ncclComm* comm) {
+  struct ncclLaunchPipeline* pipe = comm->launchPipe;
+  ncclResult_t ret;
+  if (pipe == nullptr) return ncclSuccess;
+  if (!__atomic_load_n(&pipe->pending, __ATOMIC_ACQUIRE) && pipe->result == ncclSuccess) return ncclSuccess;
+  pthread_mutex_lock(&pipe->mutex);
+  while (pipe->pending) pthread_cond_wait(&pipe->cond, &pipe->mutex);
+  ret = pipe->result;
+  pipe->result = ncclSuccess;
+  pthread_mutex_unlock(&pipe->mutex);
+  return ret;
+}
+
+ncclResult_t ncclLaunchPipelineDestroy(struct ncclComm* comm) {
+  struct ncclLaunchPipeline* pipe = comm->launchPipe;
+  if (pipe == nullptr) return ncclSuccess;
+  pthread_mutex_lock(&pipe->mutex);
+  pipe->stop = true;
+  pthread_cond_signal(&pipe->cond);
+  pthread_mutex_unlock(&pipe->mutex);
+  pthread_join(pipe->thread, nullptr);
+  CUDACHECK(cudaStreamDestroy(pipe->stream));
+  NCCLCHECK(ncclCudaHostFree(pipe->values));
+  pthread_mutex_destroy(&pipe->mutex);
+  pthread_cond_destroy(&pipe->cond);
+  free(pipe);
+  comm->launchPipe = nullptr;
+  return ncclSuccess;
+}
+
+static bool usePipelinedLaunches(struct ncclComm* head) {
+  if (!rcclParamLaunchPipeline() || ncclParamLaunchMode == ncclLaunchModeGroup || mscclAvailable()) return false;
+  for (struct ncclComm* comm = head; comm != nullptr; comm = comm->groupNext) {
+    if (!comm->config.blocking || comm->tasks.numStreams != 1) return false;
+    if (ncclCudaGraphValid(comm->tasks.capturingGraph)) return false;
+  }
+  return true;
+}
+
+RCCL_PARAM(AutoGraph, "AUTO_GRAPH", 0);
+
+#define NCCL_AUTO_GRAPH_CACHE 8
+
+// Groups already launched RCCL_AUTO_GRAPH times are captured into a graph
+// through the persistent plan path and replayed while their fingerprint stays
+// the same. Any other group takes the regular launch path.
+struct ncclAutoGraphEntry {
+  uint64_t hash;
+  cudaStream_t stream;
+  int nTasksColl, nTasksP2p;
+  size_t collBytesTotal;
+  int hits;
+  uint64_t lastUse;
+#if CUDART_VERSION >= 11030
+  cudaGraph_t graph;
+  cudaGraphExec_t graphExec;
+#endif
+};
+
+struct ncclAutoGraphCache {
+  struct ncclAutoGraphEntry entries[NCCL_AUTO_GRAPH_CACHE];
+  uint64_t clock;
+  uint64_t captures, replays;
+};
+
+static inline uint64_t autoGraphMix(uint64_t h, uint64_t v) {
+  return (h ^ v) * 0x100000001b3ULL;
+}
+
+// Everything that goes into building the plans: task arguments, the stream
+// and the tuning epoch.
+static uint64_t autoGraphHash(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  h = autoGraphMix(h, (uint64_t)(uintptr_t)tasks->streams->stream);
+  h = autoGraphMix(h, comm->algoCacheEpoch);
+  for (struct ncclTaskColl* t = ncclIntruQueueHead(&tasks->collQueue); t != nullptr; t = t->next) {
+    h = autoGraphMix(h, t->func);
+    h = autoGraphMix(h, (uint64_t)(uintptr_t)t->sendbuff);
+    h = autoGraphMix(h, (uint64_t)(uintptr_t)t->recvbuff);
+    h = autoGraphMix(h, t->count);
+    h = autoGraphMix(h, ((uint64_t)t->root << 32) | (uint32_t)t->datatype);
+    h = autoGraphMix(h, ((uint64_t)t->op.op << 1) | t->op.scalarArgIsPtr);
+    h = autoGraphMix(h, t->op.scalarArg);
+    h = autoGraphMix(h, ((uint64_t)t->chunkSteps << 32) | (uint32_t)t->sliceSteps);
+    if (t->update != nullptr) {
+      // Hyperparameters are baked into the captured work
+      uint64_t u[(sizeof(struct ncclDevUpdate)+7)/8] = {};
+      memcpy(u, t->update, sizeof(struct ncclDevUpdate));
+      for (uint64_t v : u) h = autoGraphMix(h, v);
+    }
+  }
+  if (tasks->nTasksP2p != 0) {
+    for (int peer = 0; peer < comm->nRanks; peer++) {
+      for (struct ncclTaskP2p* p = ncclIntruQueueHead(&tasks->peers[peer].sendQueue); p != nullptr; p = p->next) {
+        h = autoGraphMix(h, ((uint64_t)peer << 1) | 0);
+        h = autoGraphMix(h, (uint64_t)(uintptr_t)p->buff);
+        h = autoGraphMix(h, p->bytes);
+      }
+      for (struct ncclTaskP2p* p = ncclIntruQueueHead(&tasks->peers[peer].recvQueue); p != nullptr; p = p->next) {
+        h = autoGraphMix(h, ((uint64_t)peer << 1) | 1);
+        h = autoGraphMix(h, (uint64_t)(uintptr_t)p->buff);
+        h = autoGraphMix(h, p->bytes);
+      }
+    }
+  }
+  return h;
+}
+
+static bool useAutoGraph(struct ncclComm* head, bool preconnected) {
+#if CUDART_VERSION >= 11030
+  if (rcclParamAutoGraph() <= 0 || preconnected || mscclAvailable() || rcclParamResidentKernel()) return false;
+  if (head->groupNext != nullptr || !head->config.blocking) return false;
+  if (head->tasks.numStreams != 1 || ncclCudaGraphValid(head->tasks.capturingGraph)) return false;
+  return head->tasks.nTasksColl + head->tasks.nTasksP2p != 0;
+#else
+  return false;
+#endif
+}
+
+#if CUDART_VERSION >= 11030
+static void autoGraphEvict(struct ncclAutoGraphEntry* e) {
+  if (e->graphExec) (void) cudaGraphExecDestroy(e->graphExec);
+  if (e->graph) (void) cudaGraphDestroy(e->graph);
+  memset(e, 0, sizeof(*e));
+}
+
+// Order graph launches against comm's other launches through doneEvent and lastStream,
+// the same way as regular kernel launches.
+static ncclResult_t autoGraphWaitLast(struct ncclComm* comm, cudaStream_t stream) {
+  if (comm->lastStream != stream && comm->lastStream != nullptr) {
+    CUDACHECK(hipStreamWaitEvent(stream, comm->doneEvent, 0));
+  }
+  comm->lastStream = stream;
+  return ncclSuccess;
+}
+
+static ncclResult_t autoGraphLaunchExec(struct ncclComm* comm, cudaGraphExec_t graphExec, cudaStream_t stream) {
+  CUDACHECK(cudaGraphLaunch(graphExec, stream));
+  CUDACHECK(hipEventRecord(comm->doneEvent, stream));
+  comm->lastStream = stream;
+  return ncclSuccess;
+}
+
+// Capture comm's plans into a graph then launch it. The persistent plans are
+// reclaimed through their graph destructor once the graph is destroyed.
+static ncclResult_t autoGraphCapture(struct ncclComm* comm, struct ncclAutoGraphEntry* e) {
+  ncclResult_t ret = ncclSuccess;
+  cudaStream_t stream = comm->tasks.streams->stream;
+  cudaGraph_t graph = nullptr;
+  NCCLCHECK(autoGraphWaitLast(comm, stream));
+  CUDACHECK(cudaStreamBeginCapture(stream, cudaStreamCaptureModeRelaxed));
+  NCCLCHECKGOTO(ncclCudaGetCapturingGraph(&comm->tasks.capturingGraph, stream), ret, end);
+  NCCLCHECKGOTO(doLaunches(comm), ret, end);
+end:
+  comm->tasks.capturingGraph = ncclCudaGraphNone();
+  if (cudaStreamEndCapture(stream, &graph) != cudaSuccess && ret == ncclSuccess) ret = ncclUnhandledCudaError;
+  if (ret != ncclSuccess) {
+    if (graph) (void) cudaGraphDestroy(graph);
+    return ret;
+  }
+  if (cudaGraphInstantiate(&e->graphExec, graph, nullptr, nullptr, 0) != cudaSuccess) {
+    WARN("Failed to instantiate captured graph on comm %p rank %d", comm, comm->rank);
+    (void) cudaGraphDestroy(graph);
+    e->graphExec = nullptr;
+    return ncclUnhandledCudaError;
+  }
+  e->graph = graph;
+  NCCLCHECK(autoGraphLaunchExec(comm, e->graphExec, stream));
+  return ncclSuccess;
+}
+#endif
+
+// Launch comm's group through the graph cache. *launched is false when the
+// group has to take the regular launch path.
+static ncclResult_t autoGraphLaunch(struct ncclComm* comm, bool* launched) {
+  *launched = false;
+#if CUDART_VERSION >= 11030
+  struct ncclTasks* tasks = &comm->tasks;
+  struct ncclAutoGraphCache* cache = comm->autoGraph;
+  if (cache == nullptr) {
+    NCCLCHECK(ncclCalloc(&cache, 1));
+    comm->autoGraph = cache;
+  }
+  uint64_t hash = autoGraphHash(comm);
+  cudaStream_t stream = tasks->streams->stream;
+  struct ncclAutoGraphEntry* e = nullptr;
+  struct ncclAutoGraphEntry* lru = &cache->entries[0];
+  for (int i = 0; i < NCCL_AUTO_GRAPH_CACHE; i++) {
+    struct ncclAutoGraphEntry* x = &cache->entries[i];
+    if (x->hits != 0 && x->hash == hash && x->stream == stream && x->nTasksColl == tasks->nTasksColl &&
+        x->nTasksP2p == tasks->nTasksP2p && x->collBytesTotal == tasks->collBytesTotal) {
+      e = x;
+      break;
+    }
+    if (x->lastUse < lru->lastUse) lru = x;
+  }
+  if (e == nullptr) {
+    // Unseen group, remember it and launch normally.
+    autoGraphEvict(lru);
+    lru->hash = hash;
+    lru->stream = stream;
+    lru->nTasksColl = tasks->nTasksColl;
+    lru->nTasksP2p = tasks->nTasksP2p;
+    lru->collBytesTotal = tasks->collBytesTotal;
+    lru->hits = 1;
+    lru->lastUse = ++cache->clock;
+    return ncclSuccess;
+  }
+  e->lastUse = ++cache->clock;
+  CUDACHECK(cudaSetDevice(comm->cudaDev));
+  if (e->graphExec) {
+    NCCLCHECK(autoGraphWaitLast(comm, stream));
+    NCCLCHECK(autoGraphLaunchExec(comm, e->graphExec, stream));
+    groupResetTasks(comm);
+    cache->replays++;
+    *launched = true;
+  } else if (++e->hits > rcclParamAutoGraph()) {
+    NCCLCHECK(autoGraphCapture(comm, e));
+    cache->captures++;
+    INFO(NCCL_COLL, "comm %p rank %d captured group of %d collectives %d p2p into graph", comm, comm->rank, e->nTasksColl, e->nTasksP2p);
+    *launched = true;
+  }
+#endif
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutoGraphDestroy(struct ncclComm* comm) {
+  struct ncclAutoGraphCache* cache = comm->autoGraph;
+  if (cache == nullptr) return ncclSuccess;
+  INFO(NCCL_INIT, "comm %p rank %d auto graph: %lu captures %lu replays", comm, comm->rank, cache->captures, cache->replays);
+#if CUDART_VERSION >= 11030
+  for (int i = 0; i < NCCL_AUTO_GRAPH_CACHE; i++) autoGraphEvict(&cache->entries[i]);
+#endif
+  free(cache);
+  comm->autoGraph = nullptr;
+  return ncclSuccess;
+}
+
 static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
+  ncclChromeTraceScope traceScope("groupLaunch");
   int savedDev;
   ncclResult_t ret = ncclSuccess;
   bool jobsDone = false;
@@ -280,6 +821,30 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
 
   CUDACHECKGOTO(cudaGetDevice(&savedDev), ret, fail);
 
+  // Collectives of comms with runtime connect first connect their algorithms on the preconnect jobs, which comms
+  // without p2p to preconnect get one for. Online tuning agrees on the explored sizes there too, as the ranks of
+  // comms driven by a single thread have to do it concurrently.
+  for (struct ncclComm* comm = groupCommHeadMain; comm != nullptr; comm = comm->groupNext) {
+    if (comm->runtimeConnect && comm->tasks.nTasksColl != 0) {
+      uint32_t algos, protos;
+      NCCLCHECKGOTO(ncclCollPredictAlgos(comm, &algos, &protos), ret, fail);
+      comm->runtimeConnectAlgos = algos & ~comm->runtimeConnectedAlgos;
+      if (comm->lazyProtoBuffers) comm->runtimeConnectProtos = protos & ~comm->collProtoMask;
+    }
+    if (comm->runtimeConnectAlgos == 0 && comm->runtimeConnectProtos == 0 && !ncclTunerPending(comm)) continue;
+    if (comm->preconnectNext != reinterpret_cast<struct ncclComm*>(0x1)) continue;
+    struct ncclPreconnectJob* job;
+    NCCLCHECKGOTO(ncclCalloc(&job, 1), ret, fail);
+    job->base.func = ncclPreconnectFunc;
+    job->base.undo = nullptr;
+    job->base.destructor = free;
+    job->base.state = ncclGroupJobRunning;
+    job->base.abortFlag = comm->abortFlag;
+    job->comm = comm;
+    job->p2p = false;
+    ncclIntruQueueEnqueue(asyncJobsMain, &job->base);
+  }
+
   if (groupCommPreconnectHeadMain != nullptr) {
     struct ncclComm* comm = groupCommPreconnectHeadMain;
     do {
@@ -291,6 +856,7 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
       job->base.state = ncclGroupJobRunning;
       job->base.abortFlag = comm->abortFlag;
       job->comm = comm;
+      job->p2p = true;
       ncclIntruQueueEnqueue(asyncJobsMain, &job->base);
 
       struct ncclComm* next = comm->preconnectNext;
@@ -302,11 +868,12 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
   if (!ncclIntruQueueEmpty(asyncJobsMain)) {
     struct ncclAsyncJob* job = ncclIntruQueueHead(asyncJobsMain);
     do {
-      SYSCHECKGOTO(pthread_create(&job->thread, nullptr, ncclAsyncJobMain, job), ret, fail);
+      NCCLCHECKGOTO(asyncJobStart(job), ret, fail);
       job = job->next;
     } while (job != nullptr);
 
     do {
+      uint64_t completed = asyncJobsCompleted();
       jobsDone = true;
       job = ncclIntruQueueHead(asyncJobsMain);
       do {
@@ -314,7 +881,7 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
         if (state == ncclGroupJobRunning) {
           jobsDone = false;
         } else if (state == ncclGroupJobDone) {
-          if (pthread_join(job->thread, nullptr) != 0) {
+          if (!rcclParamGroupWorkers() && pthread_join(job->thread, nullptr) != 0) {
             WARN("Error waiting for pthread_join : %s", strerror(errno));
             ret = ncclSystemError;
           }
@@ -336,16 +903,35 @@ static ncclResult_t groupLaunch(struct ncclAsyncJob *job_) {
         job = job->next;
       } while (job != nullptr);
       // Let preconnect threads progress.
-      if (jobsDone == false) usleep(1);
+      if (jobsDone == false) asyncJobsWait(completed);
     } while (jobsDone == false);
 
     if (ret != ncclSuccess) goto fail;
   }
 
+  if (groupCommHeadMain != nullptr && usePipelinedLaunches(groupCommHeadMain)) {
+    // Comms leave the group from their helper threads once launched.
+    while (*gjob->groupCommHeadPtr != nullptr) {
+      NCCLCHECKGOTO(pipelineSubmit(gjob->groupCommHeadPtr), ret, fail);
+    }
+    groupCommHeadMain = nullptr;
+  }
+
+  if (groupCommHeadMain != nullptr && useAutoGraph(groupCommHeadMain, groupCommPreconnectHeadMain != nullptr)) {
+    bool launched;
+    NCCLCHECKGOTO(autoGraphLaunch(groupCommHeadMain, &launched), ret, fail);
+    if (launched) goto launchDone;
+  }
+
   if (groupCommHeadMain != nullptr) {
-    NCCLCHECKGOTO(doLaunches(groupCommHeadMain), ret, fail);
+    if (useFusedLaunches(groupCommHeadMain)) {
+      NCCLCHECKGOTO(doFusedLaunches(groupCommHeadMain), ret, fail);
+    } else {
+      NCCLCHECKGOTO(doLaunches(groupCommHeadMain), ret, fail);
+    }
   }
 
+launchDone:
   /* this atomic must happen before cleanup and setting state of communicators */
   __atomic_store_n(&gjob->doneFlag, true, __ATOMIC_RELEASE);
 
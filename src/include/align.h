@@ -19,6 +19,11 @@
 #define ALIGN_SIZE(size, align) \
   size = ((size + (align) - 1) / (align)) * (align);
 
+#define CACHE_LINE_SIZE 64
+// Memory polled across devices, e.g. the connection counters of comm.h, is laid out in lines of
+// the largest coherence granularity involved: 64B on the CPU, 128B in the L2 of CDNA GPUs.
+#define CONN_LINE_SIZE 128
+
 #if !__CUDA_ARCH__
   #ifndef __host__
     #define __host__
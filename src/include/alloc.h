@@ -21,14 +21,55 @@
 
 uint64_t clockNano(); // from utils.h with which we have a circular dependency
 
+// Memory accounting of ncclCommGetMemUsage(). Allocations made while a thread has a usage set
+// are added to it under the tag of the thread. Init sets the usage of the shared resources of the
+// comm, proxy threads the one of their proxy state. Frees are not tracked: what the accounted
+// subsystems allocate is held until the comm is destroyed.
+enum ncclMemKind { ncclMemDevice = 0, ncclMemHostPinned = 1, ncclMemHost = 2, ncclMemNumKinds = 3 };
+struct ncclMemUsage {
+  uint64_t bytes[ncclMemNumKinds][NCCL_MEM_MAX_TAGS];
+};
+extern __thread struct ncclMemUsage* ncclMemUsageCurrent;
+extern __thread int ncclMemTagCurrent;
+
+static inline void ncclMemAccount(enum ncclMemKind kind, size_t bytes) {
+  if (ncclMemUsageCurrent) __atomic_fetch_add(&ncclMemUsageCurrent->bytes[kind][ncclMemTagCurrent], bytes, __ATOMIC_RELAXED);
+}
+
+// Sets the usage and tag of the thread until the end of the scope. A null usage keeps the
+// current one, for scopes that only change the tag.
+struct ncclMemScope {
+  struct ncclMemUsage* prevUsage;
+  int prevTag;
+  ncclMemScope(struct ncclMemUsage* usage, int tag) : prevUsage(ncclMemUsageCurrent), prevTag(ncclMemTagCurrent) {
+    if (usage) ncclMemUsageCurrent = usage;
+    ncclMemTagCurrent = tag;
+  }
+  ~ncclMemScope() {
+    ncclMemUsageCurrent = prevUsage;
+    ncclMemTagCurrent = prevTag;
+  }
+};
+
+// Pinned host memory on huge pages, see RCCL_HOST_HUGEPAGE_SIZE. ncclHugePagesHostAlloc leaves
+// *ptr NULL when the buffer should use regular pages, ncclHugePagesHostFree sets *freed when ptr
+// came from it.
+size_t ncclHugePageSize();
+ncclResult_t ncclHugePagesHostAlloc(void** ptr, size_t size);
+ncclResult_t ncclHugePagesHostFree(void* ptr, bool* freed);
+
 template <typename T>
 ncclResult_t ncclCudaHostCallocDebug(T** ptr, size_t nelem, const char *filefunc, int line) {
   ncclResult_t result = ncclSuccess;
   cudaStreamCaptureMode mode = cudaStreamCaptureModeRelaxed;
   *ptr = nullptr;
   CUDACHECK(cudaThreadExchangeStreamCaptureMode(&mode));
-  CUDACHECKGOTO(hipHostMalloc(ptr, nelem*sizeof(T), cudaHostAllocMapped), result, finish);
-  memset(*ptr, 0, nelem*sizeof(T));
+  NCCLCHECKGOTO(ncclHugePagesHostAlloc((void**)ptr, nelem*sizeof(T)), result, finish);
+  if (*ptr == nullptr) {
+    CUDACHECKGOTO(hipHostMalloc(ptr, nelem*sizeof(T), cudaHostAllocMapped), result, finish);
+    memset(*ptr, 0, nelem*sizeof(T));
+  }
+  ncclMemAccount(ncclMemHostPinned, nelem*sizeof(T));
 finish:
   CUDACHECK(cudaThreadExchangeStreamCaptureMode(&mode));
   if (*ptr == nullptr) WARN("Failed to CUDA host alloc %ld bytes", nelem*sizeof(T));
@@ -38,6 +79,9 @@ finish:
 #define ncclCudaHostCalloc(...) ncclCudaHostCallocDebug(__VA_ARGS__, __FILE__, __LINE__)
 
 inline ncclResult_t ncclCudaHostFree(void* ptr) {
+  bool freed;
+  NCCLCHECK(ncclHugePagesHostFree(ptr, &freed));
+  if (freed) return ncclSuccess;
   CUDACHECK(cudaFreeHost(ptr));
   return ncclSuccess;
 }
@@ -51,6 +95,7 @@ ncclResult_t ncclCallocDebug(T** ptr, size_t nelem, const char *filefunc, int li
   }
   //INFO(NCCL_ALLOC, "%s:%d malloc Size %ld pointer %p", filefunc, line, nelem*sizeof(T), p);
   memset(p, 0, nelem*sizeof(T));
+  ncclMemAccount(ncclMemHost, nelem*sizeof(T));
   *ptr = (T*)p;
   return ncclSuccess;
 }
@@ -70,6 +115,7 @@ ncclResult_t ncclRealloc(T** ptr, size_t oldNelem, size_t nelem) {
   memcpy(p, oldp, oldNelem*sizeof(T));
   free(oldp);
   memset(p+oldNelem, 0, (nelem-oldNelem)*sizeof(T));
+  ncclMemAccount(ncclMemHost, (nelem-oldNelem)*sizeof(T));
   *ptr = (T*)p;
   INFO(NCCL_ALLOC, "Mem Realloc old size %ld, new size %ld pointer %p", oldNelem*sizeof(T), nelem*sizeof(T), *ptr);
   return ncclSuccess;
@@ -125,6 +171,7 @@ static inline ncclResult_t ncclCuMemAlloc(void **ptr, CUmemGenericAllocationHand
   accessDesc.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
   CUCHECK(cuMemSetAccess((CUdeviceptr)*ptr, size, &accessDesc, 1));
   if (handlep) *handlep = handle;
+  ncclMemAccount(ncclMemDevice, size);
   TRACE(NCCL_ALLOC, "CuMem Alloc Size %zi pointer %p handle %llx", size, *ptr, handle);
   return result;
 }
@@ -173,6 +220,7 @@ ncclResult_t ncclCudaMallocDebug(const char *filefunc, int line, T** ptr, size_t
 #endif
   } else
     CUDACHECKGOTO(cudaMalloc(ptr, nelem*sizeof(T)), result, finish);
+  ncclMemAccount(ncclMemDevice, nelem*sizeof(T));
 finish:
   CUDACHECK(cudaThreadExchangeStreamCaptureMode(&mode));
   if (*ptr == nullptr) WARN("Failed to CUDA malloc %ld bytes", nelem*sizeof(T));
@@ -209,6 +257,7 @@ ncclResult_t ncclCudaCallocDebug(const char *filefunc, int line, T** ptr, size_t
     __atomic_fetch_add(&allocTracker[dev].totalAlloc, 1, __ATOMIC_RELAXED);
     __atomic_fetch_add(&allocTracker[dev].totalAllocSize, nelem*sizeof(T), __ATOMIC_RELAXED);
   }
+  ncclMemAccount(ncclMemDevice, nelem*sizeof(T));
 finish:
   CUDACHECK(cudaThreadExchangeStreamCaptureMode(&mode));
   if (*ptr == nullptr) WARN("Failed to CUDA calloc %ld bytes", nelem*sizeof(T));
@@ -238,6 +287,7 @@ ncclResult_t ncclCudaCallocAsyncDebug(const char *filefunc, int line, T** ptr, s
     __atomic_fetch_add(&allocTracker[dev].totalAlloc, 1, __ATOMIC_RELAXED);
     __atomic_fetch_add(&allocTracker[dev].totalAllocSize, nelem*sizeof(T), __ATOMIC_RELAXED);
   }
+  ncclMemAccount(ncclMemDevice, nelem*sizeof(T));
 finish:
   CUDACHECK(cudaThreadExchangeStreamCaptureMode(&mode));
   if (*ptr == nullptr) WARN("Failed to CUDA calloc async %ld bytes", nelem*sizeof(T));
@@ -299,6 +349,7 @@ inline ncclResult_t ncclIbMallocDebug(void** ptr, size_t size, const char *filef
   int ret = posix_memalign(&p, page_size, size_aligned);
   if (ret != 0) return ncclSystemError;
   memset(p, 0, size);
+  ncclMemAccount(ncclMemHost, size_aligned);
   *ptr = p;
   INFO(NCCL_ALLOC, "%s:%d Ib Alloc Size %ld pointer %p", filefunc, line, size, *ptr);
   return ncclSuccess;
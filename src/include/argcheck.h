@@ -11,6 +11,7 @@
 #include "info.h"
 
 ncclResult_t PtrCheck(void* ptr, const char* opname, const char* ptrname);
+ncclResult_t CudaPtrCheck(const void* pointer, struct ncclComm* comm, const char* ptrname, const char* opname);
 ncclResult_t ArgsCheck(struct ncclInfo* info);
 
 #endif
@@ -0,0 +1,58 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_CALL_RECORD_H_
+#define NCCL_CALL_RECORD_H_
+
+#include "nccl.h"
+#include <stdint.h>
+
+struct ncclComm;
+struct ncclInfo;
+
+// Binary recording of the collective and p2p calls of the process
+// (RCCL_CALL_RECORD_FILE), see misc/call_record.cc. tools/rccl_replayer reads
+// the files directly. The layout below is mirrored in rcclReplayer.hpp.
+#define NCCL_CALL_RECORD_MAGIC "RCCLCALL"
+#define NCCL_CALL_RECORD_VERSION 1
+
+// Starts the file, and every file concatenated to another one
+struct ncclCallRecordHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  int32_t pid;
+  int32_t reserved;
+  char hostname[40];
+};
+static_assert(sizeof(struct ncclCallRecordHeader) == 64, "ncclCallRecordHeader must be 64 bytes");
+
+struct ncclCallRecord {
+  uint64_t timeNs;    // Host time of the call, on the clock of rank 0 with clock sync
+  uint64_t commHash;
+  uint64_t opCount;
+  uint64_t count;
+  uint64_t stream;    // Stream handle, identifies the stream within the process
+  int32_t rank;
+  int32_t nRanks;
+  int32_t root;       // Peer for Send and Recv
+  uint32_t task;      // Index of the call in its group
+  uint8_t func;       // ncclFunc_t
+  uint8_t datatype;
+  uint8_t op;
+  uint8_t inPlace;
+  uint32_t reserved;
+};
+static_assert(sizeof(struct ncclCallRecord) == 64, "ncclCallRecord must be 64 bytes");
+
+extern int ncclCallRecordOn;
+
+ncclResult_t ncclCallRecordInit(int rank);
+ncclResult_t ncclCallRecordFinalize();
+// Called from ncclEnqueueCheck for every call once its arguments are checked
+void ncclCallRecordAdd(struct ncclInfo* info);
+
+#endif
@@ -9,26 +9,47 @@
 #include "comm.h"
 
 ncclResult_t initChannel(struct ncclComm* comm, int channelid);
+// Allocates the entry of a peer on a channel if needed, before connecting to it
+ncclResult_t initChannelPeer(struct ncclComm* comm, int channelId, int peer, cudaStream_t stream);
 ncclResult_t initNvlsChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share);
 ncclResult_t initCollnetChannel(struct ncclComm* comm, int channelId, struct ncclComm* parent, bool share);
 ncclResult_t freeChannel(struct ncclChannel* channel, int nRanks, int collnetNRanks, int nvlsNRanks);
+// Whether the connector connIndex to a peer is connected, peers without an entry are not
+static inline bool ncclChannelPeerConnected(struct ncclChannel* channel, int peer, bool send, int connIndex) {
+  struct ncclChannelPeer* p = channel->peers[peer];
+  return p != NULL && (send ? p->send : p->recv)[connIndex].connected;
+}
+
 static ncclResult_t ncclChannelComputeBase(struct ncclComm* comm, int peer, int coll, int*channelBase) {
   int p2pGroupSize = NCCL_MAX_WORK_ELEMENTS_P2P/2;
   int peerNode = comm->rankToNode[peer];
   int peerIndex = comm->rankToLocalRank[peer];
   int nsteps = comm->maxLocalRanks;
   int rankIndex = comm->rankToLocalRank[comm->rank];
+  int node = comm->node;
+  int nNodes = comm->nNodes;
+  if (comm->p2pTopParentChannels) {
+    struct ncclSharedResources* res = comm->sharedRes;
+    int tpPeer = comm->topParentRanks[peer];
+    int tpRank = comm->topParentRanks[comm->rank];
+    peerNode = res->tpRankToNode[tpPeer];
+    peerIndex = res->tpRankToLocalRank[tpPeer];
+    nsteps = res->tpMaxLocalRanks;
+    rankIndex = res->tpRankToLocalRank[tpRank];
+    node = res->tpRankToNode[tpRank];
+    nNodes = res->tpNNodes;
+  }
   int step, delta;
   if (coll == ncclFuncSend) {
     step = (nsteps + peerIndex - rankIndex)%nsteps;
-    delta = (comm->nNodes + peerNode - comm->node) % comm->nNodes;
+    delta = (nNodes + peerNode - node) % nNodes;
   } else if (coll == ncclFuncRecv) {
     step = (nsteps + rankIndex - peerIndex)%nsteps;
-    delta = (comm->nNodes + comm->node - peerNode) % comm->nNodes;
+    delta = (nNodes + node - peerNode) % nNodes;
   } else {
     return ncclInternalError;
   }
-  *channelBase = comm->nNodes > 1 ? delta+(step/p2pGroupSize) : step;
+  *channelBase = nNodes > 1 ? delta+(step/p2pGroupSize) : step;
   return ncclSuccess;
 }
 
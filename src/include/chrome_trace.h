@@ -0,0 +1,59 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_CHROME_TRACE_H_
+#define NCCL_CHROME_TRACE_H_
+
+#include "nccl.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+union NpKitEvent;
+
+// Per-rank Chrome trace combining host, proxy and NpKit device events, written
+// to RCCL_CHROME_TRACE_FILE when the last communicator of the process is
+// destroyed. See misc/chrome_trace.cc.
+
+extern int ncclChromeTraceOn;
+static inline bool ncclChromeTraceEnabled() { return ncclChromeTraceOn; }
+
+// Nanoseconds of the system clock, the clock NpKit CPU timestamps use
+uint64_t ncclChromeTraceNow();
+
+ncclResult_t ncclChromeTraceInit(int rank);
+// Output path of a per-process trace file: %r in pattern is replaced by the
+// rank, %h/%p by the host name and pid; without %r ".<rank>" is appended
+std::string ncclTracePathForRank(const char* pattern, int rank);
+ncclResult_t ncclChromeTraceFinalize();
+
+// Host span on the calling thread
+void ncclChromeTraceHost(const char* name, uint64_t startNs, uint64_t endNs, uint64_t opCount, size_t bytes);
+// Network proxy step, or one state of it, on the lane of its channel
+void ncclChromeTraceProxy(const char* name, uint64_t startNs, uint64_t endNs, int channelId, int peer, uint64_t step);
+// Sample of a counter track, name must outlive the trace
+void ncclChromeTraceCounter(const char* name, uint64_t ns, double value);
+// NpKit events of GPU buffer bufIdx, in collection order. Timestamps are
+// placed on the host timeline with the TIME_SYNC_CPU/GPU pairs they contain.
+// events holds ringSize entries and the nEvents to trace start at index first.
+void ncclChromeTraceNpKit(int bufIdx, const union NpKitEvent* events, uint64_t nEvents, uint64_t first,
+    uint64_t ringSize, double gpuClockKhz);
+
+// Records the enclosing scope as a host span
+struct ncclChromeTraceScope {
+  const char* name;
+  uint64_t start;
+  uint64_t opCount;
+  size_t bytes;
+  ncclChromeTraceScope(const char* name, uint64_t opCount = 0, size_t bytes = 0)
+    : name(ncclChromeTraceEnabled() ? name : nullptr), start(this->name ? ncclChromeTraceNow() : 0),
+      opCount(opCount), bytes(bytes) {}
+  ~ncclChromeTraceScope() {
+    if (name) ncclChromeTraceHost(name, start, ncclChromeTraceNow(), opCount, bytes);
+  }
+};
+
+#endif
@@ -0,0 +1,30 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_CLOCK_SYNC_H_
+#define NCCL_CLOCK_SYNC_H_
+
+#include "nccl.h"
+#include <stdint.h>
+
+struct ncclComm;
+
+// Cross-rank clock synchronization (RCCL_CLOCK_SYNC), see misc/clock_sync.cc.
+// Ranks estimate the offset and drift of their system clock against rank 0 of
+// the first communicator of the process, so trace timestamps of all ranks land
+// on one timeline.
+
+// Collective, called by all ranks at the end of init. No-op when disabled.
+ncclResult_t ncclClockSyncInit(struct ncclComm* comm);
+ncclResult_t ncclClockSyncDestroy(struct ncclComm* comm);
+
+// Converts a system clock timestamp (ncclChromeTraceNow()) of this process to
+// the clock of rank 0. Returns localNs unchanged when no estimate exists.
+uint64_t ncclClockSyncToGlobal(uint64_t localNs);
+// True once an estimate exists, the trace writers then keep absolute timestamps
+bool ncclClockSyncActive();
+
+#endif
@@ -17,6 +17,7 @@ struct ncclDevRedOpFull {
   ncclDevRedOp_t op;
   bool scalarArgIsPtr;
   uint64_t scalarArg;
+  bool epilogue; // ncclDevSum with the FuncSumEpilogue of scalarArg, see ncclRedOpCreateSumEpilogue()
 };
 
 #define FUNC_INDEX_P2P (ncclNumTypes+NCCL_NUM_FUNCTIONS*NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS*ncclNumTypes*ncclNumDevRedOps)
@@ -51,6 +52,63 @@ struct ncclDevRedOpFull {
   extern __global__ void NCCL_KERN_NAME_DEBUG(func, algo, proto, devredop, type)(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead);
 #endif
 
+// Persistent kernel polling a doorbell queue instead of being launched per plan.
+extern __global__ void ncclResidentKernel(struct ncclDevComm* comm, struct ncclResidentQueue* queue);
+// Kernel running plans of several communicators, one block per channel.
+extern __global__ void ncclFusedKernel(struct ncclFusedLaunch launch);
+// Gathers/scatters ncclAllToAllvDevice() blocks to/from fixed size staging slots.
+extern __global__ void ncclAllToAllvPackKernel(char* dst, const char* src, const size_t* counts, const size_t* displs,
+    size_t typeSize, size_t maxCount, int pack);
+// Adds the nnz (index, value) pairs of one rank of ncclSparseAllReduce() to the dense output.
+// Indices of a rank are distinct, out of range ones are skipped.
+extern __global__ void ncclSparseScatterKernel(void* dst, const int64_t* indices, const void* values, size_t nnz,
+    size_t count, int type);
+// Copy timed by the link calibration (RCCL_CALIBRATE), see graph/calib.cc. With the source or
+// the destination on a peer GPU or in host memory, it measures loads or stores over that link.
+extern __global__ void ncclCalibCopyKernel(const uint4* src, uint4* dst, size_t nVecs);
+
+// One-shot and two-shot intra-node allreduce (RCCL_QUICK_ALLREDUCE), see collectives/all_reduce.cc.
+// Each rank owns a fine-grained area mapped by all local ranks: these flags, then two
+// alternating data halves of maxBytes from RCCL_QUICK_AR_DATA_OFFSET, then two more
+// for ncclAllReducePartial.
+#define RCCL_QUICK_AR_MAX_RANKS 16
+#define RCCL_QUICK_AR_MAX_BLOCKS 64
+#define RCCL_QUICK_AR_NTHREADS 256
+#define RCCL_QUICK_AR_DATA_OFFSET 65536
+struct rcclQuickArFlags {
+  uint64_t epochs[RCCL_QUICK_AR_MAX_BLOCKS]; // calls run by each block, only touched by this rank
+  uint64_t arrived[2][RCCL_QUICK_AR_MAX_BLOCKS][RCCL_QUICK_AR_MAX_RANKS]; // barrier epochs, written by peers
+  uint64_t barrierEpoch; // ncclBarrier calls run, only touched by this rank
+  uint64_t barrierArrived[RCCL_QUICK_AR_MAX_RANKS]; // ncclBarrier epochs, written by peers
+  uint64_t partialEpoch; // ncclAllReducePartial calls run, only touched by this rank
+  uint32_t partialBlocks[2]; // blocks done staging and reducing the current call, only touched by this rank
+  uint32_t partialPresent; // ranks reduced by the current call, only touched by this rank
+  uint64_t partialArrived[RCCL_QUICK_AR_MAX_RANKS]; // ncclAllReducePartial epochs staged by peers, written by peers
+  uint64_t partialRead[RCCL_QUICK_AR_MAX_RANKS]; // epochs of our staged input peers are done with, written by peers
+  uint64_t a2aEpochs[RCCL_QUICK_AR_MAX_BLOCKS]; // direct alltoalls run by each block, only touched by this rank
+  uint64_t a2aArrived[2][RCCL_QUICK_AR_MAX_BLOCKS][RCCL_QUICK_AR_MAX_RANKS]; // direct alltoall barrier epochs, written by peers
+};
+static_assert(sizeof(struct rcclQuickArFlags) <= RCCL_QUICK_AR_DATA_OFFSET, "Quick allreduce flags overlap data");
+// Block b always handles the slotVecs 16-byte vectors from b*slotVecs, so a slot is only
+// reused by the same block of the same rank, after a barrier of the previous call.
+extern __global__ void ncclQuickAllReduceKernel(char* const* peers, int rank, int nRanks, const void* sendbuff, void* recvbuff,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, int type, int twoShot);
+// Intra-node ncclBarrier over the same areas, one block of RCCL_QUICK_AR_MAX_RANKS threads
+extern __global__ void ncclBarrierKernel(char* const* peers, int rank, int nRanks);
+// Intra-node ncclAllToAll (RCCL_DIRECT_ALLTOALL), see collectives/all_to_all.cc: block r of the input,
+// nVecs 16-byte vectors, is written to dsts.ptrs[r], between two barriers over the same areas.
+struct rcclDirectA2ADsts {
+  char* ptrs[RCCL_QUICK_AR_MAX_RANKS];
+};
+extern __global__ void ncclDirectAllToAllKernel(char* const* peers, int rank, int nRanks, const void* sendbuff,
+    struct rcclDirectA2ADsts dsts, size_t nVecs);
+// ncclAllReducePartial: the stage kernel copies the input to our area and waits up to deadline
+// wall clock ticks for the peers, the reduce kernel sums the ranks that arrived in time.
+extern __global__ void ncclPartialArStageKernel(char* const* peers, int rank, int nRanks, const void* sendbuff,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, uint64_t deadline);
+extern __global__ void ncclPartialArReduceKernel(char* const* peers, int rank, int nRanks, void* recvbuff,
+    size_t nVecs, size_t slotVecs, size_t maxBytes, int type, uint32_t* missingMask);
+
 #define SINGLE_ARG(...) __VA_ARGS__
 #define CONCAT(a,b) a##b
 #define MACRO_IF(cond, t, f) CONCAT(MACRO_IF_, cond)(SINGLE_ARG(t), SINGLE_ARG(f))
@@ -81,7 +139,9 @@ struct ncclDevRedOpFull {
   DECL3(func, devredop, half, /*undef=*/undefForFloat) \
   DECL3(func, devredop, float, /*undef=*/undefForFloat) \
   DECL3(func, devredop, double, /*undef=*/undefForFloat) \
-  DECL3(func, devredop, rccl_bfloat16, /*undef=*/undefForFloat)
+  DECL3(func, devredop, rccl_bfloat16, /*undef=*/undefForFloat) \
+  DECL3(func, devredop, rccl_float8_e4m3, /*undef=*/undefForFloat) \
+  DECL3(func, devredop, rccl_float8_e5m2, /*undef=*/undefForFloat)
 #else
 #define DECL2(func, devredop, undefForFloat) \
   DECL3(func, devredop, int8_t, /*undef=*/0) \
@@ -92,7 +152,9 @@ struct ncclDevRedOpFull {
   DECL3(func, devredop, uint64_t, /*undef=*/0) \
   DECL3(func, devredop, half, /*undef=*/undefForFloat) \
   DECL3(func, devredop, float, /*undef=*/undefForFloat) \
-  DECL3(func, devredop, double, /*undef=*/undefForFloat)
+  DECL3(func, devredop, double, /*undef=*/undefForFloat) \
+  DECL3(func, devredop, rccl_float8_e4m3, /*undef=*/undefForFloat) \
+  DECL3(func, devredop, rccl_float8_e5m2, /*undef=*/undefForFloat)
 #endif
 
 #define DECL(func) \
@@ -111,6 +173,22 @@ DECL(AllReduce)
 DECL5(SendRecv, RING, SIMPLE, Sum, int8_t)
 DECL5(AllToAllPivot, RING, SIMPLE, Sum, int8_t)
 
+// Combinations with a kernel of their own (collectives/device/*_specialized.cu), which runs that
+// function inline instead of calling it through ncclFuncs. Copy collectives run the same code for
+// every datatype, their int8_t entry covers all of them. Edit to match the hot paths of a workload.
+#define RCCL_SPECIALIZED_KERNELS_AllReduce(X) \
+  X(AllReduce,     RING, SIMPLE, Sum, rccl_bfloat16, ncclBfloat16) \
+  X(AllReduce,     RING, SIMPLE, Sum, half,          ncclFloat16) \
+  X(AllReduce,     RING, SIMPLE, Sum, float,         ncclFloat32)
+#define RCCL_SPECIALIZED_KERNELS_ReduceScatter(X) \
+  X(ReduceScatter, RING, SIMPLE, Sum, rccl_bfloat16, ncclBfloat16)
+#define RCCL_SPECIALIZED_KERNELS_AllGather(X) \
+  X(AllGather,     RING, SIMPLE, Sum, int8_t,        ncclInt8)
+#define RCCL_SPECIALIZED_KERNELS(X) \
+  RCCL_SPECIALIZED_KERNELS_AllReduce(X) \
+  RCCL_SPECIALIZED_KERNELS_ReduceScatter(X) \
+  RCCL_SPECIALIZED_KERNELS_AllGather(X)
+
 extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, int8_t)();
 extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, uint8_t)();
 extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, int32_t)();
@@ -123,6 +201,8 @@ extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, rccl_bfloat16)();
 #endif
 extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, float)();
 extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, double)();
+extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, rccl_float8_e4m3)();
+extern __device__ void NCCL_ONERANK_REDUCE_NAME(PreMulSum, rccl_float8_e5m2)();
 
 // CHUNKSIZE must be a multiple of SLICESIZE
 #define ALLREDUCE_SLICESTEPS (NCCL_STEPS/4)
@@ -0,0 +1,47 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_COLLTRACE_FILE_H_
+#define NCCL_COLLTRACE_FILE_H_
+
+#ifdef ENABLE_COLLTRACE
+#include "nccl.h"
+#include "devcomm.h"
+
+struct ncclComm;
+struct ncclCollTraceFile;
+
+// Binary kernel collective trace (RCCL_KERNEL_COLL_TRACE_FILE), see
+// misc/colltrace_file.cc and tools/scripts/colltrace_decoder.py. Records are
+// appended raw to a memory-mapped per-rank file instead of being printed.
+#define NCCL_COLLTRACE_FILE_MAGIC "RCCLCTRC"
+#define NCCL_COLLTRACE_FILE_VERSION 1
+
+struct ncclCollTraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;  // sizeof(struct ncclCollTrace)
+  int32_t rank;
+  int32_t nRanks;
+  uint64_t commHash;
+  int64_t busId;
+  double rtcFreqHz;     // timeStamp ticks per second
+  uint32_t nNames;      // Function name table following the header
+  uint16_t nameLength;  // Bytes per name, zero padded
+  uint16_t funcIndexP2p;
+  uint64_t nRecords;    // Records following the names, updated as they are appended
+};
+static_assert(sizeof(struct ncclCollTraceFileHeader) == 64, "ncclCollTraceFileHeader must be 64 bytes");
+
+// pattern: output path, %r is replaced by the rank and %c by the communicator hash,
+// without %r ".<commHash>.<rank>" is appended
+ncclResult_t ncclCollTraceFileOpen(struct ncclComm* comm, const char* pattern, const char* names, int nNames,
+    int nameLength, int funcIndexP2p, double rtcFreqHz, struct ncclCollTraceFile** file);
+ncclResult_t ncclCollTraceFileAppend(struct ncclCollTraceFile* file, const volatile struct ncclCollTrace* record);
+ncclResult_t ncclCollTraceFileClose(struct ncclCollTraceFile* file);
+#endif
+
+#endif
@@ -13,6 +13,8 @@
 #include "collectives.h"
 #include "proxy.h"
 #include "strongstream.h"
+#include "nccl_tuner.h"
+#include "dev_arena.h"
 
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
 #define HIPRT_CB
@@ -29,7 +31,6 @@ struct cudaLaunchParams {
 #endif
 #endif
 
-#define CACHE_LINE_SIZE 64
 #define MEM_ALIGN 4096
 #define CUDA_IPC_MIN 2097152UL
 
@@ -38,15 +39,17 @@ struct cudaLaunchParams {
 #define NCCL_LL128_THREAD_THRESHOLD 8
 #define NCCL_SIMPLE_THREAD_THRESHOLD 64
 
+// Fields written by different agents sit in separate CONN_LINE_SIZE lines, so that a GPU or the
+// proxy polling one counter does not pull the line another agent is writing.
 struct ncclSendMem {
   union {
     struct {
-      uint64_t head;
-      char pad1[CACHE_LINE_SIZE-sizeof(uint64_t)];
-      void* ptrExchange;
+      uint64_t head; // Written by the consumer
+      char pad1[CONN_LINE_SIZE-sizeof(uint64_t)];
+      void* ptrExchange; // Written by the peer GPU for direct communication
       uint64_t redOpArgExchange[2];
-      char pad2[CACHE_LINE_SIZE-sizeof(void*)-2*sizeof(uint64_t)];
-      int offsFifo[NCCL_STEPS];
+      char pad2[CONN_LINE_SIZE-sizeof(void*)-2*sizeof(uint64_t)];
+      int offsFifo[NCCL_STEPS]; // Written by the proxy
     };
     char pad3[MEM_ALIGN];
   };
@@ -55,10 +58,12 @@ struct ncclSendMem {
 struct ncclRecvMem {
   union {
     struct {
-      uint64_t tail;
-      char pad1[CACHE_LINE_SIZE-sizeof(uint64_t)];
-      int sizesFifo[NCCL_STEPS];
-      int offsFifo[NCCL_STEPS];
+      uint64_t tail; // Written by the producer
+      char pad1[CONN_LINE_SIZE-sizeof(uint64_t)];
+      int sizesFifo[NCCL_STEPS]; // Written by the producer GPU, read by the proxy
+      char pad2[CONN_LINE_SIZE-NCCL_STEPS*sizeof(int)];
+      int offsFifo[NCCL_STEPS]; // Written by the proxy
+      char pad3[CONN_LINE_SIZE-NCCL_STEPS*sizeof(int)];
       int flush; // For GDRCopy-based flush
     };
     char pad4[MEM_ALIGN];
@@ -68,6 +73,7 @@ struct ncclRecvMem {
 enum helperThreadState {ThreadStart, ThreadStop};
 
 #define NCCL_IPC_POOL_SIZE (2*NCCL_MAX_LOCAL_RANKS*NCCL_MAX_OPS)
+#define RCCL_RAB_MAX_STEPS 16 // recursive halving steps of the Rabenseifner allreduce, up to 65536 nodes
 
 struct ncclGraphHelperResources {
   ncclComm* comm;
@@ -101,11 +107,23 @@ struct ncclCommCallback {
   ncclResult_t(*fn)(struct ncclComm* comm, struct ncclCommCallback* cb);
 };
 
+// Buffers of an operation captured outside of kernel plans (quick and hierarchical allreduce, direct and
+// hierarchical alltoall, alltoallv, sparse allreduce, copies of one rank), which ncclCommGraphUpdateBuffers()
+// can not move. Reclaimed through the graph destructor like persistent plans.
+struct ncclCapturedBuffers {
+  struct ncclCommCallback reclaimer;
+  struct ncclComm* comm;
+  struct ncclCapturedBuffers* next; // comm->capturedBuffers
+  uintptr_t base[2];
+  size_t bytes[2];
+};
+
 struct ncclSharedResources {
   int refCount;
   struct ncclComm* owner; /* comm which creates this shared res. */
-  struct ncclChannelPeer* peers[MAXCHANNELS];
-  struct ncclDevChannelPeer* devPeers[MAXCHANNELS];
+  /* Peer entries of the top parent ranks, NULL until a comm connects to the rank (initChannelPeer) */
+  struct ncclChannelPeer** peers[MAXCHANNELS];
+  struct ncclDevChannelPeer** devPeers[MAXCHANNELS];
   /* P2P operation counter, one per channel */
   uint64_t p2pOpCount[MAXCHANNELS];
   /* Collective operation counter */
@@ -115,12 +133,20 @@ struct ncclSharedResources {
   int tpNChannels;
   int tpP2pNChannels;
   int tpP2pChunkSize;
+  int tpNNodes;
+  int tpMaxLocalRanks;
   uint64_t magic;
 
   // top parent rank to localRank translation table
   int* tpRankToLocalRank;
+  // top parent rank to node translation table
+  int* tpRankToNode;
   // Internal streams
   struct ncclStrongStream deviceStream, hostStream;
+  // Long-lived device objects of the comms, freed with the shared resources
+  struct ncclDevArena devArena;
+  // Allocations of the comms and of their proxy, see ncclCommGetMemUsage()
+  struct ncclMemUsage memUsage;
 
   /* proxy related shared res */
   struct ncclProxyState* proxyState;
@@ -169,6 +195,7 @@ struct ncclKernelPlan {
 
   bool persistent; // aka captured in a graph
   bool kernelSpecialized;
+  bool traced; // holds work sampled for colltrace and NpKit
   void *kernelFn;
   int channelUbound; // only channels c < channelUbound are present
   int channelCount; // number of channels present
@@ -177,11 +204,26 @@ struct ncclKernelPlan {
   int threadPerBlock;
   // workHeap fields are null until uploadWorkFifo() or preparePersistentKernel()
   struct ncclWork* workHead;
+  size_t workBytes; // Device allocation of workHead, persistent plans only
 
   int collOpCount; // zero based for this plan
+  struct ncclTunerSample* tuneSample; // timed at launch when the plan holds this one collective
+  // RCCL_BW_REPORT sample of the one collective of the plan, see graph/bw_report.cc
+  bool bwSample;
+  int bwFunc, bwAlgorithm, bwProtocol;
+  size_t bwBytes;
+  float bwModelUs;
 
   struct ncclIntruQueue<struct ncclPointerList, &ncclPointerList::next> ipcMemQueue;
 
+  // Persistent plans only: host copy of the work at workHead and the unit index of each of its
+  // works, so ncclCommGraphUpdateBuffers() can patch buffer pointers after capture
+  struct ncclWork* workHost;
+  int nWorkHost;
+  uint32_t* workUnits;
+  int nWorkUnits;
+  struct ncclKernelPlan* persistentNext; // comm->persistentPlans
+
   struct Channel {
     int nWork;
     union {
@@ -194,6 +236,46 @@ struct ncclKernelPlan {
   } channels[MAXCHANNELS];
 };
 
+// Device allocation already validated by CudaPtrCheck(). Entries are only
+// valid while their generation matches comm->ptrCacheGen.
+struct ncclPtrCacheEntry {
+  uint32_t gen; // 0 means empty
+  uint32_t hits; // revalidated once RCCL_CHECK_POINTERS_CACHE_HITS is reached
+  uintptr_t base;
+  size_t size;
+};
+
+// RCCL_TUNING_FILE rule matching the node count and ranks per node of the communicator
+struct ncclTuningRule {
+  int coll;
+  size_t minBytes, maxBytes; // inclusive
+  int algorithm, protocol;
+  int nChannels, nThreads; // 0 to keep those of the model
+};
+
+// Memoized result of getAlgoInfo()/computeColl() for one collective signature.
+// Entries are only valid while their epoch matches comm->algoCacheEpoch.
+struct ncclAlgoCacheEntry {
+  uint32_t epoch; // 0 means empty
+  uint8_t coll;
+  uint8_t datatype;
+  uint8_t op; // ncclDevRedOp_t
+  int chunkSteps, sliceSteps;
+  int maxChannels;
+  size_t count;
+
+  int algorithm;
+  int protocol;
+  int nChannels;
+  int nThreads;
+  ncclPattern_t pattern;
+  int nstepsPerLoop;
+  int nchunksPerLoop;
+  int workFuncIndex;
+  struct ncclWorkElem work; // buffers, root, redOpArg and opCount patched on hit
+  struct ncclProxyOp proxyOp; // root patched on hit
+};
+
 struct ncclComm {
   struct ncclMemoryStack memPermanent, memScoped;
   // List of destructors to run when comm is destructed
@@ -206,6 +288,40 @@ struct ncclComm {
   struct ncclChannel channels[MAXCHANNELS];
   struct ncclPeerInfo* peerInfo;
   struct ncclTopoSystem* topo;
+  // Ring, tree, CollNet and NVLS graphs indexed by graph id, kept with splitShare for split children to derive theirs
+  // from and with runtime connect to connect rings and trees later
+  struct ncclTopoGraph* graphs;
+  // RCCL_RUNTIME_CONNECT: (1<<NCCL_ALGO_*) masks of the algorithms connected and of those the next launch needs
+  int runtimeConnect;
+  uint32_t runtimeConnectedAlgos;
+  uint32_t runtimeConnectAlgos;
+  // RCCL_LAZY_PROTO_BUFFERS: (1<<NCCL_PROTO_*) masks of the protocols ring and tree connections have buffers for and
+  // of those the next launch adds, and the connections they had before, freed once retiredConnsEvent completes
+  int lazyProtoBuffers;
+  uint32_t collProtoMask;
+  uint32_t runtimeConnectProtos;
+  struct ncclConnector* retiredConns;
+  int nRetiredConns;
+  hipEvent_t retiredConnsEvent;
+  // Init time of each ncclInitPhase_t in ms: this rank, then min/avg/max over the ranks
+  double initProfile[ncclInitPhaseNum][4];
+  uint64_t initPhaseStart;
+  // Time of the init thread in ms, in total and setting up the device before bootstrap
+  double initTotalMs;
+  double initDeviceMs;
+  // ncclInitPhase_t running on the init thread, ncclInitPhaseNum once done. See ncclCommGetInitPhase().
+  int initPhase;
+
+  // Runtime statistics per ncclStatsClass_t, see ncclCommGetStats(). Only
+  // updated by the thread enqueuing and scheduling on the comm.
+  struct {
+    uint64_t calls, bytes;
+    uint64_t algoProto[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  } stats[ncclStatsNumClasses];
+  // Persistent plans alive and what they hold, see ncclCommStats_t version 2
+  uint64_t statsPersistentWorkBytes, statsRegisteredPeerBuffers;
+  uint64_t* statsTicks; // device [MAXCHANNELS][ncclStatsNumClasses] wall clock ticks, null with RCCL_COMM_STATS_TIME=0
+  double statsClockKhz;
 
   ncclNet_t* ncclNet;
   ncclCollNet_t* ncclCollNet;
@@ -240,6 +356,11 @@ struct ncclComm {
   struct ncclNodeRanks* nodeRanks;
 
   bool checkPointers;
+  struct ncclPtrCacheEntry* ptrCache; // allocated when checkPointers is set
+  int ptrCacheSize; // 0 when disabled
+  int ptrCacheNext; // next entry to replace
+  uint32_t ptrCacheGen;
+  uint64_t ptrCacheHits, ptrCacheMisses;
   bool dmaBufSupport;
 
   // Counter for tracking CUDA launches (P2P and collectives included)
@@ -253,6 +374,9 @@ struct ncclComm {
   int p2pnChannels;
   int p2pnChannelsPerPeer;
   int p2pChannels[MAXCHANNELS];
+  // Place p2p operations by top parent ranks, so that a pair of GPUs uses the same connections
+  // in all the comms sharing resources
+  bool p2pTopParentChannels;
 
   // Should this comm allocate LL buffers for network P2P connections?
   bool allocP2pNetLLBuffers;
@@ -266,6 +390,40 @@ struct ncclComm {
   float latencies[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   float bandwidths[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   int maxThreads[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  int treeArity; // Arity of the inter-node trees, 2 for the double binary tree
+  struct ncclTuningRule* tuningRules;
+  int nTuningRules;
+
+  // Hierarchical allreduce and alltoall (RCCL_HIER_ALLREDUCE, RCCL_HIER_ALLTOALL), see collectives/all_reduce.cc
+  int hierState; // 0 until the first eligible collective, then 1 when ready or -1 when unavailable
+  struct ncclComm* hierIntraComm; // ranks of this node, by local rank
+  struct ncclComm* hierRailComm; // ranks with this local rank, by node
+  uint64_t hierArSizeMask; // bit log2(bytes) set where the tuning model prefers the hierarchical allreduce on all ranks
+  // Recursive halving/doubling allreduce across nodes (RCCL_RABENSEIFNER_ALLREDUCE), see collectives/all_reduce.cc
+  int rabState; // 0 until the first eligible allreduce, then 1 when ready or -1 when unavailable
+  int rabSteps; // log2 of the largest power of two <= nNodes
+  int rabRank; // rank among the 2^rabSteps nodes taking part in the steps, -1 for nodes folded into their neighbor
+  struct ncclComm* rabFoldComm; // this node and its neighbor for the first 2*(nNodes-2^rabSteps) nodes, else NULL
+  struct ncclComm* rabStepComms[RCCL_RAB_MAX_STEPS]; // this node and its partner of each step, by bit
+  uint64_t rabSizeMask; // bit log2(bytes) set where the tuning model prefers it on all ranks
+  // One-shot and two-shot allreduce (RCCL_QUICK_ALLREDUCE) and intra-node ncclBarrier, see collectives/all_reduce.cc
+  int quickArState; // 0 until the first eligible allreduce or barrier, then 1 when ready or -1 when unavailable
+  struct ncclQuickAllReduce* quickAr;
+  // Cross-rank progress watchdog (RCCL_WATCHDOG_INTERVAL_MS), see misc/watchdog.cc
+  struct ncclWatchdog* watchdog;
+  // Clock offset to rank 0 for aligned traces (RCCL_CLOCK_SYNC_INTERVAL_MS), see misc/clock_sync.cc
+  struct ncclClockSync* clockSync;
+
+  // Algorithm/protocol selection cache (see computeColl() in enqueue.cc)
+  struct ncclAlgoCacheEntry* algoCache;
+  int algoCacheSize; // power of 2, 0 when disabled
+  uint32_t algoCacheEpoch; // bumped whenever tuning changes
+  uint64_t algoCacheHits, algoCacheMisses;
+  struct ncclTuner* tuner; // RCCL_ONLINE_TUNE, see graph/online_tuning.cc
+  struct ncclBwReport* bwReport; // RCCL_BW_REPORT, see graph/bw_report.cc
+  // Tuner plugin consulted before the model, see misc/tuner_plugin.cc
+  ncclTuner_t* tunerPlugin;
+  void* tunerPluginContext;
 
   /* This attribute can indicate the states of communicators and return code of
    * asynchronous NCCL operations. */
@@ -286,6 +444,7 @@ struct ncclComm {
 
   // Operation pool.
   int workFifoDepth; // size of workFifoHeap[], power of 2
+  int workFifoUnits; // NCCL_WORK_UNITs in workFifoHeap[], indexing workFifoSent and the acks
   struct ncclWork* workFifoHeap;
   struct ncclWork* devWorkFifoHeap;
   void* workFifoHeapGdrHandle;
@@ -328,12 +487,21 @@ struct ncclComm {
   struct ncclMemoryPool memPool_ncclProxyOp;
   struct ncclMemoryPool memPool_ncclKernelPlan;
   struct ncclMemoryPool memPool_ncclPointerList;
+  struct ncclMemoryPool memPool_ncclWorkList;
+  // Reclaimed kernel plans linked through plan->next. Their channels at or
+  // above plan->channelUbound are still zero so only the rest needs a reset.
+  struct ncclKernelPlan* planFreeList;
+  uint64_t planPoolHits, planPoolMisses;
+  uint64_t proxyOpPoolHits, proxyOpPoolMisses;
+  uint64_t workListPoolHits, workListPoolMisses;
   // Next comm in this thread's active ncclGroup[Start|End](). Holds "0x1" when
   // this comm is not yet in a group.
   struct ncclComm* groupNext;
   // Subset of those in groupNext list. Holds 0x1 if not needing preconnect.
   struct ncclComm* preconnectNext;
   int persistentRefs; // number of persistent plan-lists capturing this comm
+  struct ncclKernelPlan* persistentPlans; // live persistent plans, linked by persistentNext
+  struct ncclCapturedBuffers* capturedBuffers; // live captures outside of plans
   struct ncclTasks tasks;
 
   hipStream_t sideStream; // [RCCL] Cached non-captured stream
@@ -353,6 +521,39 @@ struct ncclComm {
   hipEvent_t doneEvent;
   hipStream_t lastStream;
 
+  // Resident kernel mode (RCCL_RESIDENT_KERNEL), started on first launch.
+  struct ncclResidentQueue* residentQueue; // in cudaHost memory, null until started
+  hipStream_t residentStream;
+  int residentNBlocks; // channels c < residentNBlocks are served by the resident kernel
+  uint64_t residentSeq; // doorbells rung
+  uint64_t residentDone; // value of residentQueue->done once all doorbells are consumed
+
+  // Helper thread launching this comm's groups (RCCL_LAUNCH_PIPELINE), null until first use.
+  struct ncclLaunchPipeline* launchPipe;
+  // Captured graphs of repeated groups (RCCL_AUTO_GRAPH), null until first use.
+  struct ncclAutoGraphCache* autoGraph;
+  // Buffers registered with ncclCommRegister() and their peer mappings, null until first registration.
+  struct ncclRegCache* regCache;
+
+  // Staging slots of ncclAllToAllvDevice(), send half then recv half.
+  char* allToAllvStaging;
+  size_t allToAllvStagingBytes;
+  // Transpose buffers of the hierarchical ncclAllToAll(), two halves of nRanks blocks, and
+  // forwarded then scattered blocks of the hierarchical ncclAllToAllv().
+  char* hierA2AStaging;
+  size_t hierA2AStagingBytes;
+  // Node block of the rail leader in the hierarchical ncclGather() / ncclScatter().
+  char* hierRootStaging;
+  size_t hierRootStagingBytes;
+  // User counters of ncclCommSetReadyFlags(), also in devComm, forces allgathers on the ring.
+  uint64_t* readyFlags;
+  // Gathered indices then values of ncclSparseAllReduce().
+  char* sparseStaging;
+  size_t sparseStagingBytes;
+  // Inputs then outputs of the operations run by ncclCommWarmup().
+  char* warmupScratch;
+  size_t warmupScratchBytes;
+
 #ifdef ENABLE_COLLTRACE
   struct ncclCollTrace* collTrace;
   union ncclCollTraceTail *collTraceTail;
@@ -370,6 +571,8 @@ struct ncclComm {
 
   // Whether this comm is compatible with MSCCL
   bool mscclCompatible;
+  // Identifies the layout and bandwidths MSCCL algorithms are synthesized for
+  uint64_t mscclLayoutHash;
 };
 
 enum ncclLaunchMode {
@@ -450,6 +653,28 @@ static inline ncclRedOp_t ncclUserRedOpMangle(ncclComm *comm, ncclRedOp_t op) {
   return op1 < int(ncclNumOps) ? op : ncclRedOp_t(op1);
 }
 
+// Drop all memoized algorithm decisions. Must be called whenever latencies,
+// bandwidths, thread counts or thresholds of the communicator change.
+static inline void ncclAlgoCacheInvalidate(struct ncclComm* comm) {
+  comm->algoCacheEpoch++;
+  if (comm->algoCacheEpoch == 0) comm->algoCacheEpoch = 1; // 0 marks empty entries
+}
+
+// Forget all validated pointers, e.g. when application memory may have been
+// released.
+static inline void ncclPtrCacheInvalidate(struct ncclComm* comm) {
+  comm->ptrCacheGen++;
+  if (comm->ptrCacheGen == 0) comm->ptrCacheGen = 1; // 0 marks empty entries
+}
+
+// Protocols with a buffer in the connections of connIndex, and the size of that buffer
+static inline uint32_t ncclConnProtoMask(struct ncclComm* comm, int connIndex) {
+  return connIndex == 0 ? comm->collProtoMask : (1U<<NCCL_NUM_PROTOCOLS)-1;
+}
+static inline int ncclConnBuffSize(struct ncclComm* comm, uint32_t protoMask, int p) {
+  return (protoMask & (1U<<p)) ? comm->buffSizes[p] : 0;
+}
+
 ncclResult_t ncclCommEnsureReady(ncclComm_t comm);
 ncclResult_t ncclCommSetAsyncError(ncclComm_t comm, ncclResult_t nextState);
 
@@ -58,4 +58,59 @@ static ncclResult_t ncclCpusetToStr(cpu_set_t* mask, char* str) {
   return ncclSuccess;
 }
 
+// Convert a cpu list, e.g. 0-3,8,10-11 to cpu_set_t
+
+static ncclResult_t ncclCpulistToCpuset(const char* str, cpu_set_t* mask) {
+  CPU_ZERO(mask);
+  const char* p = str;
+  while (*p) {
+    char* end;
+    long first = strtol(p, &end, 10);
+    if (end == p || first < 0) return ncclInvalidArgument;
+    long last = first;
+    if (*end == '-') {
+      p = end+1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) return ncclInvalidArgument;
+    }
+    if (last >= CPU_SETSIZE) return ncclInvalidArgument;
+    for (long c=first; c<=last; c++) CPU_SET(c, mask);
+    p = end;
+    if (*p == ',') p++;
+    else if (*p) return ncclInvalidArgument;
+  }
+  return ncclSuccess;
+}
+
+// Get the CPUs the operator assigned to a helper thread role through
+// RCCL_THREAD_AFFINITY, e.g. "service=0-1;progress=2-5;socket=6,7".
+// Returns an empty set if the role is not listed.
+
+static ncclResult_t ncclThreadAffinityOverride(const char* role, cpu_set_t* mask) {
+  CPU_ZERO(mask);
+  const char* env = getenv("RCCL_THREAD_AFFINITY");
+  if (env == NULL) return ncclSuccess;
+  size_t roleLen = strlen(role);
+  for (const char* p = env; *p; ) {
+    const char* end = strchr(p, ';');
+    size_t len = end ? end-p : strlen(p);
+    if (len > roleLen && strncmp(p, role, roleLen) == 0 && p[roleLen] == '=') {
+      char list[256];
+      size_t listLen = len-roleLen-1;
+      if (listLen >= sizeof(list)) return ncclInvalidArgument;
+      memcpy(list, p+roleLen+1, listLen);
+      list[listLen] = '\0';
+      if (ncclCpulistToCpuset(list, mask) != ncclSuccess) {
+        WARN("Invalid CPU list '%s' for %s in RCCL_THREAD_AFFINITY", list, role);
+        CPU_ZERO(mask);
+        return ncclInvalidArgument;
+      }
+      return ncclSuccess;
+    }
+    p += len;
+    if (*p == ';') p++;
+  }
+  return ncclSuccess;
+}
+
 #endif
@@ -0,0 +1,48 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_DEV_ARENA_H_
+#define NCCL_DEV_ARENA_H_
+
+#include "nccl.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Device objects that live as long as the communicators of a ncclSharedResources (devComm,
+// channel peers, ring ranks...) are carved out of a few slabs of RCCL_DEV_ARENA_SLAB_BYTES instead
+// of one hipMalloc each, and are all freed with the arena. Objects come zeroed, see misc/dev_arena.cc.
+enum ncclDevArenaType { ncclDevArenaCoarse = 0, ncclDevArenaFineGrain = 1, ncclDevArenaNumTypes = 2 };
+
+struct ncclDevArenaSlab {
+  struct ncclDevArenaSlab* next;
+  char* base;
+  size_t size;
+  size_t used;
+};
+
+struct ncclDevArena {
+  pthread_mutex_t lock; // Split children sharing resources may init concurrently
+  struct ncclDevArenaSlab* slabs[ncclDevArenaNumTypes]; // Slab being filled first
+  uint64_t nSlabs;
+  uint64_t slabBytes;   // Device memory held by the slabs
+  uint64_t usedBytes;   // Handed out, including alignment
+};
+
+ncclResult_t ncclDevArenaInit(struct ncclDevArena* arena);
+ncclResult_t ncclDevArenaAllocAsync(struct ncclDevArena* arena, void** ptr, size_t bytes, size_t align,
+    enum ncclDevArenaType type, hipStream_t stream, const char* filefunc, int line);
+// Frees every slab, the objects must no longer be in use by the device
+ncclResult_t ncclDevArenaDestroy(struct ncclDevArena* arena);
+
+template <typename T>
+ncclResult_t ncclDevArenaCallocAsyncDebug(const char* filefunc, int line, struct ncclDevArena* arena, T** ptr,
+    size_t nelem, hipStream_t stream, enum ncclDevArenaType type = ncclDevArenaCoarse) {
+  return ncclDevArenaAllocAsync(arena, (void**)ptr, nelem*sizeof(T), alignof(T), type, stream, filefunc, line);
+}
+#define ncclDevArenaCallocAsync(...) ncclDevArenaCallocAsyncDebug(__FILE__, __LINE__, __VA_ARGS__)
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "nccl.h"
 #include "rccl_bfloat16.h"
+#include "rccl_float8.h"
 #include "align.h"
 #if defined(ENABLE_NPKIT)
 #include "npkit/npkit_struct.h"
@@ -87,6 +88,12 @@ static_assert(NCCL_LL_CLEAN_MASK % NCCL_STEPS == 0, "Invalid NCCL_LL_CLEAN_MASK
 #define NCCL_IPC_WRITE    0x08
 #define NCCL_IPC_READ     0x10
 #define NCCL_NVLS_MIN_POLL 0x20
+#define NCCL_DIRECT_READ_RING 0x40 // ncclWorkElem::direct only, ring allgather pulling over P2P read connections
+#define NCCL_COARSE_SIMPLE 0x80 // SIMPLE buffer in coarse-grained memory, see RCCL_P2P_COARSE_SIMPLE
+
+// ncclDevComm::simpleNtStores, see RCCL_SIMPLE_NT_STORES
+#define NCCL_NT_STORES_SEND   0x1 // Connection buffers and peer buffers written directly
+#define NCCL_NT_STORES_OUTPUT 0x2 // Local output buffers
 
 struct ncclConnInfo {
   // Regular comm mechanism
@@ -143,8 +150,15 @@ struct ncclRing {
 
 // The root of each tree only has one node down (+1 intra-node).
 #define NCCL_MAX_TREE_ARITY_TOP 2
+#if defined(ENABLE_KTREE)
+// Nodes inside k-ary trees split up to four nodes down over their two tree ranks (+1 intra-node).
+#define NCCL_MAX_TREE_ARITY 5
+#else
 // Nodes inside the binary tree can have to two nodes down (+1 intra-node).
 #define NCCL_MAX_TREE_ARITY 3
+#endif
+// Largest arity of the inter-node trees (RCCL_TREE_ARITY)
+#define NCCL_MAX_KTREE_ARITY (NCCL_MAX_TREE_ARITY-1)
 struct ncclTree {
   int depth;
   int up;
@@ -197,7 +211,9 @@ enum ncclWorkType : uint8_t {
    ncclWorkTypeUnused=0,
    ncclWorkTypeColl=1,
    ncclWorkTypeP2p=2,
-   ncclWorkTypeRegColl=3
+   ncclWorkTypeRegColl=3,
+   ncclWorkTypeUpdateColl=4,
+   ncclWorkTypeLink=5 // Runs nothing, only points to the next work, see ncclWorkUnits()
 };
 enum ncclWorkP2PType : uint8_t {
   ncclWorkP2pTypeUnused=0,
@@ -207,12 +223,14 @@ enum ncclWorkP2PType : uint8_t {
 
 struct ncclWorkHeader {
   union {
-    int32_t workNext;  // when isLast=0: Offset from kernel argument workHead
+    int32_t workNext;  // when isLast=0: Offset in NCCL_WORK_UNITs from kernel argument workHead
     uint32_t doneAcks; // when isLast=1: Monotonic (mod 1<<32) ack value to send back.
   };
   uint16_t funcIndex;
   uint8_t isLast:1; // last work for this kernel
   uint8_t inFifo:1; // is this work in the fifo
+  uint8_t isTraced:1; // sampled for colltrace and NpKit, see RCCL_TRACE_SAMPLE_*
+  uint8_t statsClass:3; // ncclStatsClass_t the kernel time is accounted to
   enum ncclWorkType type;
 };
 
@@ -228,7 +246,8 @@ struct ncclWorkElem {
   uint8_t nChannels;
   struct {
     uint32_t root:28;
-    uint32_t pad_0:2;
+    uint32_t epilogue:1; // AllReduce of a ncclRedOpCreateSumEpilogue() op, see FuncSumEpilogue
+    uint32_t update:1; // ncclReduceScatterUpdateAllGather(), element of a ncclWorkElemUpdate
     uint32_t connIndex:2;
   };
 
@@ -251,7 +270,8 @@ static_assert((NCCL_WORK_SIZE - alignUp(sizeof(ncclWorkHeader), alignof(ncclWork
 
 struct ncclWorkElemP2p {
   struct {
-    int32_t peer:28;
+    int32_t peer:27;
+    uint32_t reg:1; // The proxy moves the data straight from/to the user buffer
     uint32_t connIndex:2;
     int32_t proto:2;
   };
@@ -288,6 +308,26 @@ struct ncclWorkElemReg {
 #define NCCL_MAX_WORK_ELEMENTS_REG ((NCCL_WORK_SIZE - alignUp(sizeof(ncclWorkHeader), alignof(ncclWorkElemReg)))/sizeof(ncclWorkElemReg))
 static_assert(NCCL_MAX_WORK_ELEMENTS_REG == 1, "Sanity check: NCCL_MAX_WORK_ELEMENTS_REG == 1");
 
+// Optimizer step applied between the ReduceScatter and AllGather phases of
+// ncclReduceScatterUpdateAllGather(), see ncclUpdate_t.
+struct ncclDevUpdate {
+  uint8_t type; // ncclUpdateType_t
+  float lr;
+  float gradScale;
+  float weightDecay;
+  float beta1, beta2, eps;
+  float biasCorrection1, biasCorrection2; // 1-beta^step
+  void* expAvg;
+  void* expAvgSq;
+};
+
+struct ncclWorkElemUpdate {
+  struct ncclWorkElem elem;
+  struct ncclDevUpdate update;
+};
+
+#define NCCL_MAX_WORK_ELEMENTS_UPDATE 1
+
 // Number of named barriers supported by CUDA
 #define NCCL_MAX_GROUPS (NCCL_MAX_NTHREADS/WARP_SIZE)
 
@@ -298,11 +338,29 @@ struct ncclWork {
     struct ncclWorkElem elems[NCCL_MAX_WORK_ELEMENTS];
     struct ncclWorkElemP2p p2pElems[NCCL_MAX_WORK_ELEMENTS_P2P];
     struct ncclWorkElemReg regElems[NCCL_MAX_WORK_ELEMENTS_REG];
+    struct ncclWorkElemUpdate updateElems[NCCL_MAX_WORK_ELEMENTS_UPDATE];
   };
 };
 static_assert(sizeof(struct ncclWork) == NCCL_WORK_SIZE, "Sanity check: sizeof(struct ncclWork) == NCCL_WORK_SIZE");
 static_assert(sizeof(struct ncclWork)%16 == 0, "Sanity check: sizeof(struct ncclWork)%16 == 0");
 
+/* Works are packed in the fifo in units of half an ncclWork: collective and */
+/* p2p works take one unit and registered or update works, which are wide, */
+/* two. The first work of each block is one unit at workHead+workIx units, */
+/* so a wide one goes behind a link work, and works never wrap around the */
+/* end of the fifo. workNext, workIx and doneAcks all count units. Kernels */
+/* load a whole ncclWork and clear what follows a one unit work. */
+#define NCCL_WORK_UNIT (NCCL_WORK_SIZE/2)
+static_assert(alignUp(sizeof(ncclWorkHeader), alignof(ncclWorkElem)) + NCCL_MAX_WORK_ELEMENTS*sizeof(ncclWorkElem) <= NCCL_WORK_UNIT, "Collective works have to fit in one unit");
+static_assert(alignUp(sizeof(ncclWorkHeader), alignof(ncclWorkElemP2p)) + NCCL_MAX_WORK_ELEMENTS_P2P*sizeof(ncclWorkElemP2p) <= NCCL_WORK_UNIT, "P2p works have to fit in one unit");
+
+inline __host__ __device__ int ncclWorkUnits(enum ncclWorkType type) {
+  return type == ncclWorkTypeRegColl || type == ncclWorkTypeUpdateColl ? 2 : 1;
+}
+inline __host__ __device__ struct ncclWork* ncclWorkAt(struct ncclWork* workHead, int workIx) {
+  return (struct ncclWork*)((char*)workHead + workIx*NCCL_WORK_UNIT);
+}
+
 struct ncclDevChannelPeer {
   // Stripped version of ncclChannelPeer where we only keep the ncclConnInfo
   // instead of the full ncclConnector.
@@ -401,6 +459,15 @@ struct ncclDevComm {
   // Channels, device side
   struct ncclDevChannel* channels/*[MAXCHANNELS]*/;
 
+  // Wall clock ticks spent in work, [MAXCHANNELS][ncclStatsNumClasses], may be null
+  uint64_t* statsTicks;
+
+  // Destinations the SIMPLE protocol writes with non-temporal stores, NCCL_NT_STORES_* bits
+  int simpleNtStores;
+
+  // Bytes of the block of each rank ring allgathers delivered, [nRanks], see ncclCommSetReadyFlags()
+  uint64_t* readyFlags;
+
 #if defined(ENABLE_NPKIT)
   NpKitEventCollectContext* npKitEventCollectContexts;
   uint64_t* cpuTimestamp;
@@ -422,6 +489,36 @@ struct alignas(16) ncclDevCommAndChannels {
   struct ncclDevChannel channels[MAXCHANNELS];
 };
 
+// Per-block arguments of a launch fusing plans of several communicators on
+// the same device and stream (RCCL_FUSED_LAUNCH). Passed by value.
+struct ncclFusedBlock {
+  struct ncclDevComm* comm;
+  struct ncclWork* workHead;
+  int channelId;
+  int workIx; // first work of the block is ncclWorkAt(workHead, workIx)
+};
+struct ncclFusedLaunch {
+  struct ncclFusedBlock blocks[MAXCHANNELS];
+};
+
+// Doorbell queue polled by the resident kernel (RCCL_RESIDENT_KERNEL). The host
+// fills slots[(seq-1)%NCCL_RESIDENT_QUEUE_DEPTH] and then has the launch stream
+// write head=seq, so blocks only see a doorbell once prior stream work is done.
+// Every block running work for a doorbell decrements the slot's pending count
+// and increments done, which the launch stream waits on.
+#define NCCL_RESIDENT_QUEUE_DEPTH 256
+struct ncclResidentSlot {
+  struct ncclWork* workHead;
+  uint64_t channelMask;
+  uint32_t pending; // blocks that have yet to consume this slot
+};
+struct ncclResidentQueue {
+  uint64_t head; // written by the launch stream
+  uint64_t done; // written by the kernel
+  uint32_t stop; // written by the host on comm destruction
+  struct ncclResidentSlot slots[NCCL_RESIDENT_QUEUE_DEPTH];
+};
+
 #ifdef __CUDA_ARCH__
   #define NCCL_CUDA_ARCH __CUDA_ARCH__
 #else
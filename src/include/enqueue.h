@@ -17,10 +17,37 @@
 
 ncclResult_t ncclInitKernelsForDevice(int cudaArch, size_t* maxStackSize);
 ncclResult_t ncclEnqueueCheck(struct ncclInfo* info);
+// Enqueues operations of one communicator in one group, checking all of them before appending any
+ncclResult_t ncclEnqueueCheckBatch(struct ncclComm* comm, struct ncclInfo* infos, int nInfos);
+bool ncclRedOpHasEpilogue(struct ncclComm* comm, ncclRedOp_t op);
 ncclResult_t ncclLaunchPrepare(struct ncclComm* comm);
+ncclResult_t ncclCollPredictAlgos(struct ncclComm* comm, uint32_t* algoMask, uint32_t* protoMask);
 ncclResult_t ncclLaunchKernelBefore_NoUncapturedCuda(struct ncclComm* comm, struct ncclKernelPlan* plan);
 ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan);
 ncclResult_t ncclLaunchKernelAfter_NoCuda(struct ncclComm* comm, struct ncclKernelPlan* plan);
 ncclResult_t ncclLaunchFinish(struct ncclComm* comm);
+ncclResult_t ncclResidentKernelStop(struct ncclComm* comm);
+// Returns the work lists of a plan to comm->memPool_ncclWorkList
+void ncclPlanFreeWorkLists(struct ncclComm* comm, struct ncclKernelPlan* plan);
+// Splits comm->hierIntraComm and comm->hierRailComm, sets comm->hierState (collectives/all_reduce.cc)
+ncclResult_t ncclHierCommsInit(struct ncclComm* comm);
+// True when the hierarchical collectives can run their phases on comm (collectives/all_reduce.cc)
+bool ncclHierEligible(struct ncclComm* comm);
+// True when ranks are numbered node by node (collectives/all_reduce.cc)
+bool ncclHierRanksContiguous(struct ncclComm* comm);
+// Grows a staging buffer of the hierarchical collectives, *ok is false when it can not (collectives/all_reduce.cc)
+ncclResult_t ncclHierStagingReserve(struct ncclComm* comm, char** buff, size_t* buffBytes, size_t bytes,
+    cudaStream_t stream, bool* ok);
+// Maps the areas of the one-shot and two-shot allreduce on first use, *devPeers is NULL when they are
+// unavailable: several nodes, no P2P between local GPUs or first use under graph capture (collectives/all_reduce.cc)
+ncclResult_t ncclQuickAllReducePeers(struct ncclComm* comm, cudaStream_t stream, char*** devPeers);
+// Releases the areas of the one-shot and two-shot allreduce (collectives/all_reduce.cc)
+ncclResult_t ncclQuickAllReduceFree(struct ncclComm* comm);
+// Records the buffers of an operation launched on stream without a kernel plan when stream is captured, so that
+// ncclCommGraphUpdateBuffers() refuses to move them. Unused buffers are NULL.
+ncclResult_t ncclCaptureRecordBuffers(struct ncclComm* comm, cudaStream_t stream, const void* buff0, size_t bytes0,
+    const void* buff1 = NULL, size_t bytes1 = 0);
+bool ncclLaunchCanFuse(struct ncclComm* comm0, struct ncclKernelPlan* plan0, struct ncclComm* comm, struct ncclKernelPlan* plan, int nBlocks);
+ncclResult_t ncclLaunchKernelFused(int nPlans, struct ncclComm** comms, struct ncclKernelPlan** plans);
 
 #endif // End include guard
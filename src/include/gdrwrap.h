@@ -50,6 +50,27 @@ static inline void wc_store_fence(void) { std::atomic_thread_fence(std::memory_o
 static inline void wc_store_fence(void) { atomic_thread_fence(memory_order_release); }
 #endif
 #endif
+
+// Proxy stores of heads and tails to GDR mapped memory are write combined. Progress functions
+// make them with ncclGdcStore() and declare an ncclGdcFlushScope, which fences once when they
+// return, so the updates of all the channels of an op go out together instead of one fence each.
+extern __thread bool ncclGdcPending;
+static inline void ncclGdcStore(volatile uint64_t* gdcPtr, volatile uint64_t* hostPtr, uint64_t value) {
+  if (gdcPtr) {
+    *gdcPtr = value;
+    ncclGdcPending = true;
+  } else {
+    *hostPtr = value;
+  }
+}
+struct ncclGdcFlushScope {
+  ~ncclGdcFlushScope() {
+    if (ncclGdcPending) {
+      wc_store_fence(); // Flush out WC writes
+      ncclGdcPending = false;
+    }
+  }
+};
 #endif
 
 //#define GDR_DIRECT 1
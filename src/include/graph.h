@@ -26,6 +26,7 @@ ncclResult_t ncclTopoPrint(struct ncclTopoSystem* system);
 
 ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm* comm);
 void ncclTopoFree(struct ncclTopoSystem* system);
+ncclResult_t ncclTopoDupSystem(struct ncclTopoSystem* system, struct ncclTopoSystem** dup);
 ncclResult_t ncclTopoTrimSystem(struct ncclTopoSystem* system, struct ncclComm* comm);
 ncclResult_t ncclTopoComputeP2pChannels(struct ncclComm* comm);
 ncclResult_t ncclTopoGetNvbGpus(struct ncclTopoSystem* system, int rank, int* nranks, int** ranks);
@@ -39,6 +40,10 @@ ncclResult_t ncclTopoCheckGdr(struct ncclTopoSystem* topo, int64_t busId, int ne
 ncclResult_t ncclTopoGetIntraNetDev(struct ncclTopoSystem* system, int rank, struct ncclTopoGraph* graph, int channelId, int type, int* dev);
 ncclResult_t ncclTopoGetLinkType(struct ncclTopoSystem* system, int cudaDev1, int cudaDev2, bool* isXGMI, int maxInter=MAX_XGMI_INTER_GPUS, int nInter=0, int *inter=nullptr);
 ncclResult_t ncclTopoNeedFlush(struct ncclTopoSystem* system, int64_t busId, int* flush);
+// Link calibration (RCCL_CALIBRATE), measured bandwidths are 0 and *read unchanged where unknown
+ncclResult_t ncclTopoCalibrate(struct ncclComm* comm, struct ncclTopoSystem* system);
+ncclResult_t ncclTopoCalibGdr(struct ncclTopoSystem* system, int64_t busId, int netDev, int read, float* gdrBw, float* hostBw);
+ncclResult_t ncclTopoCalibP2pRead(struct ncclTopoSystem* system, int64_t sendId, int64_t recvId, int* read);
 ncclResult_t ncclTopoCheckNet(struct ncclTopoSystem* system, int64_t id1, int64_t id2, int* net);
 int ncclPxnDisable(struct ncclComm* comm);
 ncclResult_t ncclTopoGetPxnRanks(struct ncclComm* comm, int** intermediateRanks, int* nranks);
@@ -46,6 +51,10 @@ ncclResult_t ncclTopoGetLocalRank(struct ncclTopoSystem* system, int rank, int*
 
 // Find CPU affinity
 ncclResult_t ncclTopoGetCpuAffinity(struct ncclTopoSystem* system, int rank, cpu_set_t* affinity);
+// CPUs local to NET device net, subset of the current affinity. Empty if unknown.
+ncclResult_t ncclTopoGetNetCpuAffinity(struct ncclTopoSystem* system, int net, cpu_set_t* affinity);
+// NUMA node closest to the GPU of rank, -1 if unknown.
+ncclResult_t ncclTopoGetLocalNuma(struct ncclTopoSystem* system, int rank, int* numaId);
 
 #define NCCL_TOPO_CPU_ARCH_X86 1
 #define NCCL_TOPO_CPU_ARCH_POWER 2
@@ -98,7 +107,8 @@ struct ncclTopoGraph {
   int intraNets[MAXCHANNELS*NCCL_TOPO_MAX_NODES*2];
   char treeBase[NCCL_TOPO_MAX_NODES][NCCL_TOPO_MAX_NODES*4];
 };
-ncclResult_t ncclTopoCompute(struct ncclTopoSystem* system, struct ncclTopoGraph* graph);
+// With a parent graph, a split child first tries to derive its graph from it
+ncclResult_t ncclTopoCompute(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoSystem* parentSystem = NULL, struct ncclTopoGraph* parentGraph = NULL);
 
 ncclResult_t ncclTopoPrintGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph);
 ncclResult_t ncclTopoDumpGraphs(struct ncclTopoSystem* system, int ngraphs, struct ncclTopoGraph** graphs);
@@ -112,6 +122,11 @@ struct ncclTopoRanks {
   int treeToChild0[MAXCHANNELS];
   int treeToChild1[MAXCHANNELS];
   int nvlsHeads[MAXCHANNELS];
+  // NICs of the ring entering and leaving the node, and their rails, -1 when unknown
+  int ringRecvNet[MAXCHANNELS];
+  int ringSendNet[MAXCHANNELS];
+  int ringRecvRail[MAXCHANNELS];
+  int ringSendRail[MAXCHANNELS];
 };
 
 ncclResult_t ncclTopoPreset(struct ncclComm* comm, struct ncclTopoGraph** graphs, struct ncclTopoRanks* topoRanks);
@@ -121,7 +136,40 @@ ncclResult_t ncclTopoPostset(struct ncclComm* comm, int* firstRanks, int* treePa
 ncclResult_t ncclTreeBasePostset(struct ncclComm* comm, struct ncclTopoGraph* treeGraph);
 
 ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCompCap, struct ncclTopoGraph** graphs);
+// Arity of the inter-node trees, 2 unless RCCL_TREE_ARITY asks for k-ary trees
+ncclResult_t ncclTopoGetTreeArity(struct ncclComm* comm, struct ncclTopoGraph* treeGraph, int* treePatterns, int* arity);
 #include "info.h"
 ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int protocol, int numPipeOps, float* time);
+// Best modeled time of a collective over the enabled algorithms and protocols, -1 if none
+ncclResult_t ncclTopoGetCollTime(struct ncclComm* comm, ncclFunc_t coll, size_t nBytes, float* time);
+ncclResult_t ncclTopoGetQuickAllReduceTime(struct ncclComm* comm, size_t nBytes, float* oneShotTime, float* twoShotTime);
+// Time of the pipelined tree broadcast over the hierarchical communicators of comm, -1 if unknown
+ncclResult_t ncclTopoGetTreeBroadcastTime(struct ncclComm* comm, size_t chunkBytes, int nStages, float* time);
+// Channels a ring or tree collective needs to fill its pipeline, 0 unless RCCL_CHANNEL_MODEL is set
+ncclResult_t ncclTopoGetAlgoChannels(struct ncclInfo* info, int algorithm, int protocol, int maxChannels, int* nChannels);
+// First RCCL_TUNING_FILE rule covering the collective, NULL if none
+struct ncclTuningRule* ncclTopoGetTuningRule(struct ncclInfo* info);
+
+// Online tuning (RCCL_ONLINE_TUNE)
+struct ncclTunerSample;
+struct ncclKernelPlan;
+ncclResult_t ncclTunerInit(struct ncclComm* comm);
+ncclResult_t ncclTunerFree(struct ncclComm* comm);
+// Overrides the algorithm and protocol picked from the model times (-1 when not available) once tuned or while
+// exploring. *nChannels is set when the channel count is tuned too.
+ncclResult_t ncclTunerSelect(struct ncclInfo* info, float times[][NCCL_NUM_PROTOCOLS], int* nChannels, bool* tuned);
+void ncclTunerSampleLaunched(struct ncclTunerSample* sample, hipEvent_t* start, hipEvent_t* stop);
+bool ncclTunerPending(struct ncclComm* comm);
+ncclResult_t ncclTunerAgree(struct ncclComm* comm);
+
+// Bandwidth efficiency report (RCCL_BW_REPORT), see graph/bw_report.cc
+ncclResult_t ncclBwReportInit(struct ncclComm* comm);
+ncclResult_t ncclBwReportFree(struct ncclComm* comm);
+bool ncclBwReportSample(struct ncclComm* comm);
+ncclResult_t ncclBwReportLaunched(struct ncclComm* comm, struct ncclKernelPlan* plan, hipEvent_t* start, hipEvent_t* stop);
+
+// Tuner plugin (NCCL_TUNER_PLUGIN)
+ncclResult_t ncclTunerPluginLoad(struct ncclComm* comm, struct ncclTopoGraph* ringGraph);
+ncclResult_t ncclTunerPluginUnload(struct ncclComm* comm);
 
 #endif
@@ -16,6 +16,9 @@ void ncclGroupCommJoin(struct ncclComm* comm);
 void ncclGroupCommPreconnect(struct ncclComm* comm);
 ncclResult_t ncclGroupCommLeave(struct ncclComm* comm);
 void ncclGroupJobAbort();
+ncclResult_t ncclLaunchPipelineWait(struct ncclComm* comm);
+ncclResult_t ncclLaunchPipelineDestroy(struct ncclComm* comm);
+ncclResult_t ncclAutoGraphDestroy(struct ncclComm* comm);
 
 typedef ncclResult_t(*ncclInitFunc_t)(ncclComm_t* newcomm, int ndev, ncclUniqueId commId, int myrank, int cudaDev);
 
@@ -29,6 +32,7 @@ typedef enum ncclGroupJobState {
 
 struct ncclAsyncJob {
   struct ncclAsyncJob* next;
+  struct ncclAsyncJob* workerNext; /* queue of the group worker threads */
   pthread_t thread;
   ncclResult_t result;
   ncclResult_t(*func)(struct ncclAsyncJob*);
@@ -68,6 +72,7 @@ extern __thread ncclResult_t ncclGroupError;
 extern __thread struct ncclComm* ncclGroupCommHead;
 extern __thread struct ncclComm* ncclGroupCommPreconnectHead;
 extern __thread int ncclGroupBlocking;
+extern __thread int ncclGroupMaxCTAs; // limit of ncclGroupSetMaxCTAs(), 0 for none
 extern __thread struct ncclGroupJob *ncclGroupJobMainPtr;
 extern __thread struct ncclGroupJob ncclGroupJobMain;
 
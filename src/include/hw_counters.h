@@ -0,0 +1,23 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_HW_COUNTERS_H_
+#define NCCL_HW_COUNTERS_H_
+
+#include "nccl.h"
+
+struct ncclComm;
+
+// NIC port and xGMI link counter sampling (RCCL_HW_COUNTER_INTERVAL_MS), see
+// misc/hw_counters.cc. Rates go to the Chrome trace, RCCL_HW_COUNTER_FILE and
+// a summary when the last communicator is destroyed.
+ncclResult_t ncclHwCountersInit(struct ncclComm* comm);
+ncclResult_t ncclHwCountersFinalize();
+
+// Defined in transport/net_ib.cc, returns the number of devices
+int ncclIbGetDevPorts(const char** devNames, int* ports, int maxDevs);
+
+#endif
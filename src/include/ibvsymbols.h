@@ -32,6 +32,8 @@ struct ncclIbvSymbols {
   int (*ibv_internal_dereg_mr)(struct ibv_mr *mr);
   struct ibv_cq * (*ibv_internal_create_cq)(struct ibv_context *context, int cqe, void *cq_context, struct ibv_comp_channel *channel, int comp_vector);
   int (*ibv_internal_destroy_cq)(struct ibv_cq *cq);
+  struct ibv_srq * (*ibv_internal_create_srq)(struct ibv_pd *pd, struct ibv_srq_init_attr *srq_init_attr);
+  int (*ibv_internal_destroy_srq)(struct ibv_srq *srq);
   struct ibv_qp * (*ibv_internal_create_qp)(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr);
   int (*ibv_internal_modify_qp)(struct ibv_qp *qp, struct ibv_qp_attr *attr, int attr_mask);
   int (*ibv_internal_destroy_qp)(struct ibv_qp *qp);
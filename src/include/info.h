@@ -54,11 +54,18 @@ struct ncclInfo {
   ncclPattern_t pattern;
   int nChannels;
   int nThreads;
+  int maxChannels; // ncclGroupSetMaxCTAs() limit of the call, 0 for none
   size_t nBytes;
   int nstepsPerLoop;
   int nchunksPerLoop;
   int chunkSize;
   int channelId;
+  // Online tuning
+  bool tune;
+  bool tuneExploring;
+  struct ncclTunerSample* tuneSample;
+  // Optimizer step of ncclReduceScatterUpdateAllGather(), runs as a ring/simple AllReduce
+  const struct ncclDevUpdate* update;
 };
 
 inline ncclResult_t ncclInfoSetDerived(struct ncclInfo* info, int nRanks) {
@@ -81,6 +88,8 @@ struct ncclTaskColl {
   ncclDataType_t datatype;
   ncclDevRedOpFull op;
   int chunkSteps, sliceSteps;
+  int maxChannels; // See ncclInfo::maxChannels
+  struct ncclDevUpdate* update; // Copy in comm->memScoped, see ncclInfo::update
 };
 struct ncclTaskP2p {
   ncclTaskP2p *next;
@@ -97,7 +106,7 @@ struct ncclCudaStreamList {
 };
 struct ncclTasks {
   struct Peer {
-    bool sendSeen, recvSeen;
+    int sendSeen, recvSeen; // Channels checked for preconnect
     struct ncclIntruQueue<struct ncclTaskP2p, &ncclTaskP2p::next> sendQueue;
     struct ncclIntruQueue<struct ncclTaskP2p, &ncclTaskP2p::next> recvQueue;
   };
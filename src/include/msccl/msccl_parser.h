@@ -100,6 +100,9 @@ static ncclResult_t mscclXmlFindTag(struct mscclXml* xml, const char* tagName, s
 
 ncclResult_t mscclGetAlgoFromXmlFile(const char* xmlGraphFile, struct mscclAlgo* algo, int rank);
 
+// Same as mscclGetAlgoFromXmlFile, going through RCCL_MSCCL_CACHE_DIR when set
+ncclResult_t mscclGetAlgoFromCachedXmlFile(const char* xmlGraphFile, struct mscclAlgo* algo, int rank);
+
 ncclResult_t mscclGetAlgoMetaFromXmlFile(const char* xmlGraphFile, struct mscclAlgoMeta* algoMeta);
 
 #endif
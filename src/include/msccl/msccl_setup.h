@@ -23,8 +23,11 @@ ncclResult_t mscclSetupCount(struct mscclAlgo* hostAlgo, ncclComm_t comm, size_t
 
 ncclResult_t mscclSetupProxy(struct mscclAlgo* hostAlgo, ncclComm_t comm, hipStream_t stream);
 
+// Uploads the used part of the thread blocks of each algorithm
+ncclResult_t mscclSetupDevAlgos(struct mscclAlgo** hostAlgos, int nAlgos, struct mscclDevAlgo** devAlgos);
+
 ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count,
-    ncclDataType_t dataType, ncclRedOp_t op, struct mscclAlgo* hostAlgo, struct mscclAlgo* devAlgo,
+    ncclDataType_t dataType, ncclRedOp_t op, struct mscclAlgo* hostAlgo, struct mscclDevAlgo* devAlgo,
     ncclComm_t comm, hipStream_t stream);
 
 ncclResult_t mscclInitWorkFifoStatus(mscclWorkFifoStatus* workFifoStatus);
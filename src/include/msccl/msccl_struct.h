@@ -13,12 +13,12 @@
 #include "devcomm.h"
 #include "msccl/msccl_scheduler.h"
 
-#define MSCCL_MAX_NUM_STEPS 64
+#define MSCCL_MAX_NUM_STEPS 256
 #define MSCCL_MAX_NUM_THREAD_BLOCKS_PER_CHANNEL 32
-#define MSCCL_MAX_NUM_THREAD_BLOCKS 64
+#define MSCCL_MAX_NUM_THREAD_BLOCKS 128 // bounded by mscclThreadBlock::dependentBid
 #define MSCCL_MAX_COUNT 72 // max concurrent number of msccl chunk transmission
 #define MSCCL_MAX_REDUCE_FUSION 16
-#define MSCCL_MAX_NUM_ALGOS 1024
+#define MSCCL_MAX_NUM_ALGOS 4096
 
 #define MSCCL_SLICESTEPS (NCCL_STEPS/4)
 #define MSCCL_CHUNKSTEPS (NCCL_STEPS/2)
@@ -56,7 +56,7 @@ struct mscclThreadBlock {
   // step is used to index into these arrays
   struct mscclTransmission transmissions[MSCCL_MAX_NUM_STEPS]; // 4KB
   int8_t dependentBid[MSCCL_MAX_NUM_STEPS]; // -1 if not dependent on any thread block, 256 bytes
-  int16_t dependentStep[MSCCL_MAX_NUM_STEPS]; // 512 bytes
+  int16_t dependentStep[MSCCL_MAX_NUM_STEPS]; // transmission waited on, 512 bytes
   int16_t reductionSrcOffsets[MSCCL_MAX_NUM_STEPS]; // 512 bytes
   int16_t sendPeer;
   int16_t recvPeer;
@@ -65,6 +65,31 @@ struct mscclThreadBlock {
 }; // 5384 bytes
 
 static_assert(sizeof(struct mscclThreadBlock) % sizeof(uint64_t) == 0, "Sanity check: sizeof(struct mscclThreadBlock) % sizeof(uint64_t) != 0");
+static_assert(MSCCL_MAX_NUM_THREAD_BLOCKS <= INT8_MAX+1, "MSCCL_MAX_NUM_THREAD_BLOCKS must be representable by datatype of dependentBid");
+
+// Device copy of a thread block. The header is followed by nSteps transmissions,
+// nDependencies dependentBid entries, nDependencies dependentStep entries and
+// nReductions reductionSrcOffsets entries, each array padded to 16 bytes so that
+// the interpreter loads them with aligned copies into mscclThreadBlock.
+struct mscclDevThreadBlock {
+  int16_t sendPeer;
+  int16_t recvPeer;
+  uint16_t nSteps;
+  int16_t channelId;
+  uint16_t nDependencies;
+  uint16_t nReductions;
+  uint8_t protocol; // of the channel
+  uint8_t pad[3];
+}; // 16 bytes
+
+static_assert(sizeof(struct mscclDevThreadBlock) == 16, "mscclDevThreadBlock must be 16 bytes");
+static_assert(sizeof(struct mscclTransmission) == 16, "mscclTransmission must be 16 bytes");
+
+// Device copy of an algorithm, only as large as its thread blocks. Thread block b
+// starts tbOffsets[b] bytes from the start of the copy.
+struct mscclDevAlgo {
+  uint32_t tbOffsets[MSCCL_MAX_NUM_THREAD_BLOCKS];
+};
 
 struct mscclFlag {
   uint64_t flag;
@@ -80,6 +105,7 @@ struct mscclChannelPeerInfo {
 };
 
 struct mscclChannelInfo {
+  int protocol; // shared by all thread blocks of the channel
   struct mscclChannelPeerInfo sendPeerInfo[MSCCL_MAX_NUM_THREAD_BLOCKS_PER_CHANNEL];
   int nSendPeers;
   struct mscclChannelPeerInfo recvPeerInfo[MSCCL_MAX_NUM_THREAD_BLOCKS_PER_CHANNEL];
@@ -107,6 +133,8 @@ struct mscclAlgoMeta {
   bool inPlace;
   // Whether this algorithm is suitable for out-of-place.
   bool outOfPlace;
+  // Layout the algorithm was synthesized for, 0 for algorithm files
+  uint64_t layoutHash = 0;
 };
 
 struct mscclAlgo {
@@ -114,6 +142,8 @@ struct mscclAlgo {
   int nChunksPerLoop;
   // the protocol that the algorithm needs to use
   int protocol;
+  // protocols used by the channels, one bit each. Thread blocks can override the protocol of the algorithm
+  int protocolMask;
   // number of channels needed by MSCCL algorithm
   int nChannels;
   // number of ranks required by this algorithm
@@ -128,7 +158,10 @@ struct mscclAlgo {
   int chunkSteps;
   // number of steps per slice for this algorithm
   int sliceSteps;
-  // bid is used as an index into this array
+  // bounds on the bytes of an MSCCL chunk moved per loop iteration, 0 for no bound
+  int64_t minChunkBytes;
+  int64_t maxChunkBytes;
+  // bid is used as an index into this array. Only the used part is uploaded to the device
   struct mscclThreadBlock mscclTBs[MSCCL_MAX_NUM_THREAD_BLOCKS];
   // used to calculate proxy info
   struct mscclChannelInfo mscclChannels[MAXCHANNELS];
@@ -148,6 +181,16 @@ struct mscclAlgo {
   uint8_t typeMask;
 };
 
+// Operations sharing a measured selection
+struct mscclTuneBucket {
+  std::vector<int> candidates; // index in algoMetas, -1 for the built-in RCCL algorithms
+  std::vector<hipEvent_t> events; // start and stop of each trial
+  int nTrials = 0;
+  bool decided = false;
+  int choice = 0; // index in candidates
+  int64_t nOps = 0; // since the choice was made
+};
+
 enum mscclGroupStatus {
   mscclNoGroup,
   mscclGroupSupportedOp,
@@ -162,6 +205,7 @@ struct mscclSavedSchedulerParam {
   std::vector<size_t> savedRDisPls;
   ncclComm_t comm;
   hipStream_t stream;
+  struct mscclTuneBucket* tuneBucket; // set when the operation is timed by measured selection
 };
 
 enum mscclCaptureStatus {
@@ -170,11 +214,23 @@ enum mscclCaptureStatus {
   mscclExistingCapture
 };
 
+// Steps posted by an operation on the channels using one protocol
+struct mscclProtoSizes {
+  int stepSize;
+  int chunkSteps;
+  int sliceSteps;
+  int chunkSize;
+  uint32_t maxAllowedCount;
+};
+
 struct mscclProxyArg {
   struct mscclAlgo* hostAlgo;
   ncclComm_t comm;
-  mscclProxyArg(struct mscclAlgo* hostAlgo, ncclComm_t comm) 
-    : hostAlgo(hostAlgo), comm(comm) {}
+  // Sizes of the operation, mscclStatus holds those of the last launch by the time a graph is replayed
+  size_t nBytes;
+  struct mscclProtoSizes protoSizes[NCCL_NUM_PROTOCOLS];
+  int nLoops;
+  ncclDataType_t dataType;
 };
 
 typedef std::map<unsigned long long, std::vector<struct mscclProxyArg>> mscclSavedProxyArgs;
@@ -200,23 +256,33 @@ struct mscclWorkFifoStatus {
 
 typedef std::map<unsigned long long, mscclWorkFifoStatus> mscclSavedGraphWorkFifoStatus;
 
+// Buffers the kernels of a captured graph refer to. They live as long as MSCCL
+// so replays never see them moved by eager launches or later captures.
+struct mscclGraphState {
+  struct mscclFlag* syncFlags; // cleared at the start of each replay
+  void* scratchBuffer;
+  uint64_t scratchBufferSize;
+  std::vector<void*> retiredScratchBuffers; // outgrown during the capture, still used by earlier kernels
+  uint32_t workIndex;
+};
+
+typedef std::map<unsigned long long, mscclGraphState> mscclSavedGraphStates;
+
 struct mscclStatus {
   std::vector<mscclAlgoHandle_t> freeAlgoHandles;
   std::map<mscclAlgoHandle_t, mscclAlgo *> hostAlgos;
-  std::map<mscclAlgoHandle_t, mscclAlgo *> devAlgos;
+  std::map<mscclAlgoHandle_t, mscclDevAlgo *> devAlgos;
   struct mscclFlag* syncFlags;
   void *scratchBuffer;
   uint64_t scratchBufferSize;
   size_t nBytes;
-  int stepSize;
-  int chunkSteps;
-  int sliceSteps;
-  int chunkSize;
-  int chunkEffectiveSize;
+  struct mscclProtoSizes protoSizes[NCCL_NUM_PROTOCOLS];
+  int nLoops;
+  uint32_t iterSize; // elements per MSCCL chunk in a loop iteration when protocols are mixed or iterations are shrunk, 0 otherwise
   uint32_t workIndex;
-  uint32_t maxAllowedCount;
   ncclDataType_t dataType;
   std::map<ncclComm_t, std::set<mscclAlgoHandle_t>> connectedAlgos;
+  std::map<ncclComm_t, std::map<std::pair<uint64_t, std::vector<int>>, mscclTuneBucket>> tuneBuckets;
   hipStream_t lastStream;
   void* mscclSchedulerLib;
   mscclSchedulerInterface* mscclSchedulerPtr;
@@ -227,6 +293,7 @@ struct mscclStatus {
   bool needsProxy;
   mscclWorkFifoStatus defaultWorkFifoStatus;
   mscclSavedGraphWorkFifoStatus graphWorkFifoStatus;
+  mscclSavedGraphStates graphStates;
 };
 
 #pragma pack(push)
@@ -247,6 +314,8 @@ struct mscclWork {
   bool hasReduce;
   bool redOpArgIsPtr;
   uint32_t fnIndex;
+  uint32_t chunkSize; // elements per MSCCL chunk in a loop iteration, 0 for the protocol default
+  uint32_t pad[3];
 };
 static_assert(sizeof(struct mscclWork) % 16 == 0, "mscclWork needs to be 16B aligned");
 
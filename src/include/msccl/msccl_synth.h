@@ -0,0 +1,23 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef MSCCL_SYNTH_H_
+#define MSCCL_SYNTH_H_
+
+#include <vector>
+
+#include "comm.h"
+#include "msccl/msccl_struct.h"
+
+// Sets comm->mscclLayoutHash and, unless metas already holds them, writes the
+// algorithms synthesized for the layout of comm and appends their metas.
+// Collective over comm.
+ncclResult_t mscclSynthesizeAlgos(ncclComm_t comm, std::vector<mscclAlgoMeta>& metas);
+
+// Removes the files written by mscclSynthesizeAlgos
+void mscclSynthesizeCleanup();
+
+#endif
@@ -37,7 +37,8 @@ typedef struct {
   int maxRecvs;   // Maximum number of grouped receives.
 }ncclNetProperties_v6_t;
 
-typedef ncclNetProperties_v6_t ncclNetProperties_t;
+typedef ncclNetProperties_v6_t ncclNetProperties_v7_t;
+typedef ncclNetProperties_v7_t ncclNetProperties_t;
 
 typedef struct {
   // Name of the network (mainly for logs)
@@ -47,7 +48,7 @@ typedef struct {
   // Return the number of adapters.
   ncclResult_t (*devices)(int* ndev);
   // Get various device properties.
-  ncclResult_t (*getProperties)(int dev, ncclNetProperties_v6_t* props);
+  ncclResult_t (*getProperties)(int dev, ncclNetProperties_v7_t* props);
   // Create a receiving object and provide a handle to connect to it. The
   // handle can be up to NCCL_NET_HANDLE_MAXSIZE bytes and will be exchanged
   // between ranks to create a connection.
@@ -84,11 +85,74 @@ typedef struct {
   ncclResult_t (*closeSend)(void* sendComm);
   ncclResult_t (*closeRecv)(void* recvComm);
   ncclResult_t (*closeListen)(void* listenComm);
-} ncclNet_v6_t;
+  // Batched calls. Each one does what n calls of the function it is named after would do, in
+  // order, so the proxy hands over all the operations of a progress pass at once. They are
+  // optional: when NULL, the proxy issues the calls one by one.
+  // Post n sends, possibly on different comms. requests[i] is set as isend would set it,
+  // NULL if send i cannot be posted yet.
+  ncclResult_t (*isendv)(int n, void** sendComms, void** data, int* sizes, int* tags, void** mhandles, void** requests);
+  // Post n multi-receives, possibly on different comms. Receive i groups nRecvs[i] buffers,
+  // taken in turn from data, sizes, tags and mhandles, and requests[i] is set as irecv would
+  // set it.
+  ncclResult_t (*irecvv)(int n, void** recvComms, int* nRecvs, void** data, int* sizes, int* tags, void** mhandles, void** requests);
+  // Test n requests. done[i] and sizes[i] are set as test would set them for requests[i];
+  // sizes, or any sizes[i], can be NULL. NULL requests are skipped and reported not done.
+  ncclResult_t (*testSome)(int n, void** requests, int* done, int** sizes);
+  // Register n buffers, each as regMr would.
+  ncclResult_t (*regMrv)(int n, void** comms, void** data, size_t* sizes, int* types, void** mhandles);
+} ncclNet_v7_t;
 
-typedef ncclNet_v6_t ncclNet_t;
+typedef ncclNet_v7_t ncclNet_t;
 
-#define NCCL_PLUGIN_SYMBOL ncclNetPlugin_v6
+#define NCCL_PLUGIN_SYMBOL ncclNetPlugin_v7
+
+// v6 struct for backwards compatibility
+typedef struct {
+  // Name of the network (mainly for logs)
+  const char* name;
+  // Initialize the network.
+  ncclResult_t (*init)(ncclDebugLogger_t logFunction);
+  // Return the number of adapters.
+  ncclResult_t (*devices)(int* ndev);
+  // Get various device properties.
+  ncclResult_t (*getProperties)(int dev, ncclNetProperties_v6_t* props);
+  // Create a receiving object and provide a handle to connect to it. The
+  // handle can be up to NCCL_NET_HANDLE_MAXSIZE bytes and will be exchanged
+  // between ranks to create a connection.
+  ncclResult_t (*listen)(int dev, void* handle, void** listenComm);
+  // Connect to a handle and return a sending comm object for that peer.
+  // This call must not block for the connection to be established, and instead
+  // should return successfully with sendComm == NULL with the expectation that
+  // it will be called again until sendComm != NULL.
+  ncclResult_t (*connect)(int dev, void* handle, void** sendComm);
+  // Finalize connection establishment after remote peer has called connect.
+  // This call must not block for the connection to be established, and instead
+  // should return successfully with recvComm == NULL with the expectation that
+  // it will be called again until recvComm != NULL.
+  ncclResult_t (*accept)(void* listenComm, void** recvComm);
+  // Register/Deregister memory. Comm can be either a sendComm or a recvComm.
+  // Type is either NCCL_PTR_HOST or NCCL_PTR_CUDA.
+  ncclResult_t (*regMr)(void* comm, void* data, int size, int type, void** mhandle);
+  /* DMA-BUF support */
+  ncclResult_t (*regMrDmaBuf)(void* comm, void* data, size_t size, int type, uint64_t offset, int fd, void** mhandle);
+  ncclResult_t (*deregMr)(void* comm, void* mhandle);
+  // Asynchronous send to a peer.
+  // May return request == NULL if the call cannot be performed (or would block)
+  ncclResult_t (*isend)(void* sendComm, void* data, int size, int tag, void* mhandle, void** request);
+  // Asynchronous recv from a peer.
+  // May return request == NULL if the call cannot be performed (or would block)
+  ncclResult_t (*irecv)(void* recvComm, int n, void** data, int* sizes, int* tags, void** mhandles, void** request);
+  // Perform a flush/fence to make sure all data received with NCCL_PTR_CUDA is
+  // visible to the GPU
+  ncclResult_t (*iflush)(void* recvComm, int n, void** data, int* sizes, void** mhandles, void** request);
+  // Test whether a request is complete. If size is not NULL, it returns the
+  // number of bytes sent/received.
+  ncclResult_t (*test)(void* request, int* done, int* sizes);
+  // Close and free send/recv comm objects
+  ncclResult_t (*closeSend)(void* sendComm);
+  ncclResult_t (*closeRecv)(void* recvComm);
+  ncclResult_t (*closeListen)(void* listenComm);
+} ncclNet_v6_t;
 
 typedef struct {
   // Name of the collective network (mainly for logs)
@@ -0,0 +1,51 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_TUNER_H_
+#define NCCL_TUNER_H_
+
+#include "nccl.h"
+#include "nccl_net.h"
+#include "devcomm.h"
+
+// Summary of the communicator the tuner is initialized for
+typedef struct {
+  int nRanks;
+  int nNodes;
+  int localRanks; // ranks of this node
+  int nChannels; // collective channels
+  int cudaArch; // device architecture, as used to pick the kernels
+  float bwIntra; // ring graph bandwidth per channel in GB/s, within a node
+  float bwInter; // between nodes
+  int typeIntra; // ring graph link types (PATH_* values)
+  int typeInter;
+} ncclTunerTopo_v1_t;
+
+typedef struct {
+  // Name of the tuner
+  const char* name;
+
+  // Initializes the tuner for a communicator, the returned context is passed to the other calls.
+  ncclResult_t (*init)(const ncclTunerTopo_v1_t* topo, ncclDebugLogger_t logFunction, void** context);
+
+  // Picks the algorithm, protocol and channel count of a collective. costTable holds the time in us of each
+  // algorithm/protocol pair from the internal model, -1 for the unavailable ones. The tuner can either set
+  // *algorithm and *protocol, and optionally *nChannels, or leave them to -1 and update costTable, the
+  // cheapest available pair being used then.
+  // Decisions must only depend on the arguments: all ranks have to pick the same, and they are memoized.
+  ncclResult_t (*getCollInfo)(void* context, ncclFunc_t collType, size_t nBytes, int collNetSupport, int nvlsSupport,
+      int numPipeOps, float costTable[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS], int* algorithm, int* protocol, int* nChannels);
+
+  // Releases the context
+  ncclResult_t (*destroy)(void* context);
+} ncclTuner_v1_t;
+
+typedef ncclTuner_v1_t ncclTuner_t;
+typedef ncclTunerTopo_v1_t ncclTunerTopo_t;
+
+#define NCCL_TUNER_PLUGIN_SYMBOL "ncclTunerPlugin_v1"
+
+#endif
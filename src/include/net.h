@@ -21,6 +21,12 @@ int ncclNetVersion(struct ncclComm* comm);
 // Test whether the current GPU support GPU Direct RDMA.
 ncclResult_t ncclGpuGdrSupport(struct ncclComm* comm, int* gdrSupport);
 
+// Traffic class and service level of the comm the proxy thread is connecting
+// for, NCCL_CONFIG_UNDEF_INT for the network defaults. Set around the
+// connect/accept calls, plugins built into RCCL read them there.
+extern __thread int ncclNetTrafficClass;
+extern __thread int ncclNetServiceLevel;
+
 extern ncclNet_t ncclNetIb;
 extern ncclNet_t ncclNetSocket;
 
@@ -8,6 +8,7 @@
 
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <hip/hip_runtime.h>
 
@@ -28,15 +29,22 @@ class NpKit {
 
   static ncclResult_t Dump(const std::string& dump_dir);
 
+  // Adds the GPU events to the Chrome trace (RCCL_CHROME_TRACE_FILE)
+  static ncclResult_t ExportTrace();
+
   static ncclResult_t Shutdown();
 
   static NpKitEventCollectContext* GetGpuEventCollectContexts();
 
   static inline __device__ void CollectGpuEvent(uint8_t type, int64_t size, uint32_t rsvd, uint64_t timestamp,
                                                 NpKitEventCollectContext* ctx) {
+#if defined(ENABLE_NPKIT)
+    if (!ncclShmem.work.header.isTraced) return;
+    if (ctx->max_events_per_collective && ncclShmem.event_count++ >= ctx->max_events_per_collective) return;
+#endif
     uint64_t event_buffer_head = ctx->event_buffer_head;
-    if (event_buffer_head < kMaxNumGpuEventsPerBuffer) {
-      NpKitEvent& event = ctx->event_buffer[event_buffer_head];
+    if (ctx->streaming || event_buffer_head < kMaxNumGpuEventsPerBuffer) {
+      NpKitEvent& event = ctx->event_buffer[event_buffer_head & (kMaxNumGpuEventsPerBuffer - 1)];
       event.fields.type = type;
       event.fields.size = size < 0 ? 0 : size;
       event.fields.rsvd = rsvd;
@@ -58,6 +66,25 @@ class NpKit {
 #endif
   }
 
+  // Appends the events collected in LDS to ctx, all threads of the block take part
+  static inline __device__ void FlushGpuEventsLDS(NpKitEventCollectContext* ctx, int tid, int nthreads) {
+#if defined(ENABLE_NPKIT)
+    uint64_t event_buffer_head = ctx->event_buffer_head;
+    uint64_t num_events = ncclShmem.event_buffer_head;
+    if (ctx->max_events_per_collective && num_events > ctx->max_events_per_collective) {
+      num_events = ctx->max_events_per_collective;
+    }
+    if (!ctx->streaming) {
+      uint64_t num_free = event_buffer_head < kMaxNumGpuEventsPerBuffer ? kMaxNumGpuEventsPerBuffer - event_buffer_head : 0;
+      if (num_events > num_free) num_events = num_free;
+    }
+    for (uint64_t i = tid; i < num_events; i += nthreads) {
+      ctx->event_buffer[(event_buffer_head + i) & (kMaxNumGpuEventsPerBuffer - 1)] = ncclShmem.event_buffer[i];
+    }
+    if (tid == 0) ctx->event_buffer_head = event_buffer_head + num_events;
+#endif
+  }
+
   static void CollectCpuEvent(uint8_t type, int64_t size, uint32_t rsvd, uint64_t timestamp, int channel_id);
 
   static uint64_t *GetCpuTimestamp();
@@ -65,6 +92,13 @@ class NpKit {
  private:
   static void CpuTimestampUpdateThread();
 
+  static void StreamThread(int cuda_dev);
+
+  static ncclResult_t StreamDrain(bool final);
+
+  static void StreamWrite(uint16_t source, uint16_t buf_idx, const NpKitEvent* events, uint64_t num_events,
+                          uint64_t num_dropped);
+
   // 64K * 512 * 16B = 512MB per GPU
   static const uint64_t kMaxNumGpuEventsPerBuffer = 1ULL << 16;
 
@@ -82,6 +116,17 @@ class NpKit {
 
   static std::thread* cpu_timestamp_update_thread_;
   static volatile bool cpu_timestamp_update_thread_should_stop_;
+
+  // Streaming state, set up when NPKIT_STREAM_INTERVAL_MS is set
+  static uint64_t stream_interval_ms_;
+  static FILE* stream_file_;
+  static std::thread* stream_thread_;
+  static volatile bool stream_thread_should_stop_;
+  static NpKitEvent* stream_staging_[2]; // pinned, one is written out while the other is filled
+  static NpKitEventCollectContext* stream_contexts_; // pinned snapshot of the GPU contexts
+  static uint64_t* stream_tails_; // first event not drained yet, GPU buffers then CPU ones
+  static uint64_t* stream_ready_; // heads seen by the previous drain, all events before are written
+  static std::vector<uint8_t> stream_encoded_;
 };
 
 #endif
@@ -126,5 +126,10 @@
 #define NPKIT_EVENT_MSCCL_RECV_REDUCE_COPY_EXIT                 0x65
 #define NPKIT_EVENT_MSCCL_INIT_ENTRY                            0x66
 #define NPKIT_EVENT_MSCCL_INIT_EXIT                             0x67
+// rsvd of MSCCL step events holds MSCCL_STEP_ID(iteration, transmission type, step)
+#define NPKIT_EVENT_MSCCL_DEP_WAIT_ENTRY                        0x68
+#define NPKIT_EVENT_MSCCL_DEP_WAIT_EXIT                         0x69
+#define NPKIT_EVENT_MSCCL_STEP_ENTRY                            0x6A
+#define NPKIT_EVENT_MSCCL_STEP_EXIT                             0x6B
 
 #endif
@@ -22,9 +22,26 @@ union NpKitEvent {
 
 struct NpKitEventCollectContext {
   NpKitEvent* event_buffer;
-  uint64_t event_buffer_head;
+  uint64_t event_buffer_head; // events collected so far, they wrap around event_buffer when streaming
+  uint64_t streaming;
+  uint64_t max_events_per_collective; // 0 for no limit
 };
 
+// Record of the stream written by NpKit when NPKIT_STREAM_INTERVAL_MS is set. It is
+// followed by num_bytes of events, each encoded as its type byte then the LEB128
+// varints of its size, its rsvd and the zigzag delta of its timestamp to the
+// previous event of the record.
+struct NpKitStreamRecord {
+  uint32_t magic;
+  uint16_t source; // 0 for GPU event buffers, 1 for CPU ones
+  uint16_t buf_idx;
+  uint32_t num_events;
+  uint32_t num_bytes;
+  uint64_t num_dropped; // events overwritten before they could be drained
+};
+
+#define NPKIT_STREAM_MAGIC 0x534b504e // "NPKS"
+
 #pragma pack(pop)
 
 #endif
@@ -15,6 +15,8 @@ void setEnvFile(const char* fileName);
 void initEnv();
 
 void ncclLoadParam(char const* env, int64_t deftVal, int64_t uninitialized, int64_t* cache);
+// String parameters, from the environment or the config files, logged under NCCL_ENV when set
+const char* ncclGetEnv(const char* name);
 
 #define NCCL_PARAM(name, env, deftVal) \
   int64_t ncclParam##name() { \
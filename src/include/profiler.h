@@ -32,6 +32,12 @@ enum ncclProxyProfileState {
 };
 
 ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state);
-void ncclProfilingDump();
+void ncclProfilingDump(struct ncclProxyState* proxyState);
+
+// Step latency histograms (RCCL_PROXY_HISTOGRAMS)
+void ncclProxyHistInit();
+void ncclProxyHistIdle(struct ncclProxyState* proxyState, int idle);
+void ncclProxyHistCheckDump(struct ncclProxyState* proxyState);
+void ncclProxyHistFree(struct ncclProxyState* proxyState);
 
 #endif
@@ -14,6 +14,7 @@
 #include "socket.h"
 #include "ipcsocket.h"
 #include <pthread.h>
+#include <sched.h>
 #include "shm.h"
 #include "p2p.h"
 
@@ -28,28 +29,33 @@ static_assert(NCCL_MAX_WORK_ELEMENTS <= MAXCHANNELS, "Not enough sub space for m
 
 struct ncclProxyOp {
   struct ncclProxyConnection* connection;
-  int channelId;
-  int nsteps;
   ssize_t nbytes;
+  int nsteps;
   struct {
-    int root:30;
+    int root:29;
     uint32_t connIndex:2;
+    uint32_t reg:1; // p2p data moved straight from/to regBuff, see addP2pToPlan()
   };
   int next;
+  int chunkSize;
 
   uint64_t opCount;
-  int sliceSteps;
-  int chunkSteps;
-  int chunkSize;
+  uint8_t channelId;
+  uint8_t sliceSteps;
+  uint8_t chunkSteps;
   uint8_t /*ncclDataType_t*/ dtype;
   uint8_t /*ncclDevRedOp_t*/ redOp;
   uint8_t /*ncclPattern_t*/ pattern;
   uint8_t protocol;
+  int8_t priority; // ncclConfig_t priority of the comm, set by SaveProxy()
+  void* regBuff;
 
   union {
     uint64_t unused;
     // For use by enqueue.cc
     struct ncclProxyOp *enqNext;
+    // Top parent rank of the connection peer, set by SaveProxy()
+    int peer;
   };
 };
 static_assert(sizeof(struct ncclProxyOp) == 64, "Keep ProxyOp aligned with cache lines for effective prefetch");
@@ -62,6 +68,10 @@ struct ncclProxySubArgs {
   int peer;
 
   int groupSize; // Number of consecutive sub operations sharing the same recvComm
+  int reg;          // The network moves nbytes straight from/to regBuff, in nsteps messages
+  int regChunkSize; // Bytes per message when reg
+  void* regBuff;
+  void* regMhandle;
   uint64_t base;
   uint64_t posted;
   uint64_t received;
@@ -70,7 +80,9 @@ struct ncclProxySubArgs {
   uint64_t done;
   uint64_t end;
   void* requests[NCCL_STEPS];
-  void* profilingEvents[NCCL_STEPS];
+  void* flushBatches[NCCL_STEPS]; // Batched GDR flush covering the step, see net.cc
+  uint64_t stepNs[NCCL_STEPS][3]; // State timestamps of in-flight steps, see ncclProxyConnStats
+  uint64_t traceNs[NCCL_STEPS][4]; // Chrome trace timestamps of the states of in-flight steps
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_SEND_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_SEND_EXIT)
   int npKitSizesFifo[NCCL_STEPS];
@@ -91,6 +103,7 @@ struct ncclProxyArgs {
   uint8_t /*ncclDevRedOp_t*/ redOp;
   uint8_t /*ncclPattern_t*/ pattern;
   uint8_t protocol;
+  int8_t priority;
   int state;
   char* sharedBuff[NCCL_STEPS];
   int sharedSize[NCCL_STEPS];
@@ -110,13 +123,35 @@ struct ncclProxyArgs {
 // Otherwise we'd be unable to post half of them to free new elements.
 #define MAX_OPS_PER_PEER (2*MAXCHANNELS*NCCL_MAX_WORK_ELEMENTS_P2P)
 #define NCCL_MAX_LOCAL_RANKS 64
+// Chain of ops ending at ops[last] published by a local rank. The entry of
+// ring slot s is ready when seq == s+1 and free again when seq == s+RING_SIZE.
+struct ncclProxyPostEntry {
+  uint64_t seq;
+  int first;
+  int last;
+};
+// Every chain holds at least one op so there can never be more chains posted
+// than ops, and producers never wait for a free slot.
+#define NCCL_PROXY_POST_RING_SIZE (MAX_OPS_PER_PEER*NCCL_MAX_LOCAL_RANKS)
+
+// Free ops of a local rank, which it takes all at once and the progress thread
+// gives back. Each on its own cache line so ranks do not contend on each other's.
+struct alignas(CACHE_LINE_SIZE) ncclProxyFreeOps {
+  volatile int head;
+};
+
+// Fields written by producers and by the progress thread are on separate cache lines.
 struct ncclProxyOpsPool {
   struct ncclProxyOp ops[MAX_OPS_PER_PEER*NCCL_MAX_LOCAL_RANKS];
-  volatile int nextOps;
-  volatile int nextOpsEnd;
-  volatile int freeOps[NCCL_MAX_LOCAL_RANKS];
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
+  struct ncclProxyFreeOps freeOps[NCCL_MAX_LOCAL_RANKS];
+  // Lock-free multi-producer single-consumer ring of posted op chains.
+  alignas(CACHE_LINE_SIZE) uint64_t postHead; // next slot to reserve, fetch-and-add by producers
+  alignas(CACHE_LINE_SIZE) uint64_t postTail; // next slot to consume, only used by the progress thread
+  struct ncclProxyPostEntry posts[NCCL_PROXY_POST_RING_SIZE];
+  // Futex the progress thread sleeps on when it has nothing to do. Producers
+  // only bump and wake it when sleeping is set.
+  alignas(CACHE_LINE_SIZE) int sleeping;
+  int wakeSeq;
 };
 
 struct ncclProxyOps {
@@ -150,6 +185,13 @@ struct ncclSharedNetComms {
   int recvRefCount[MAXCHANNELS];
 };
 
+enum ncclProxyIdleTier {
+  ncclProxyIdleSpin = 0,
+  ncclProxyIdleYield = 1,
+  ncclProxyIdleSleep = 2,
+  ncclProxyIdleTiers = 3
+};
+
 struct ncclProxyPool;
 struct ncclProxyProgressState {
   // Used by main threads to send work to progress thread
@@ -165,15 +207,93 @@ struct ncclProxyProgressState {
   struct ncclProxyArgs* pool;
   struct ncclProxyPool* pools;
   int nextOps;
+  int nextOpsEnd;
+  uint64_t sweeps; // Calls of progressOps(), to pace the ops of low priority comms
+  // Time spent and wakeups served while idle in each tier of proxyPostWait()
+  uint64_t idleNs[ncclProxyIdleTiers];
+  uint64_t idleWakes[ncclProxyIdleTiers];
 };
 
-// Expected proxy response fifo
+// Additional progress thread (RCCL_PROXY_PROGRESS_THREADS). It owns the ops of
+// channels c with c % nShards == its index, handed over by the main progress
+// thread through a single producer/single consumer ring, so that ops of one
+// connection are always appended and progressed in order by the same thread.
+#define NCCL_PROXY_SHARD_RING_SIZE 512
+struct ncclProxyShard {
+  struct ncclProxyProgressState state; // opsPool unused
+  struct ncclProxyState* proxyState;
+  int index;
+  struct ncclProxyOp ring[NCCL_PROXY_SHARD_RING_SIZE];
+  uint64_t head; // written by the main progress thread
+  uint64_t tail; // written by the shard
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int sleeping;
+  int busyPoll; // never yields while it has ops, see RCCL_PROXY_SEND_THREAD
+};
+
+// Step latency histograms kept with RCCL_PROXY_HISTOGRAMS, see
+// ncclProxyLatencyQuery(). Buckets are log-linear in ns with
+// NCCL_PROXY_HIST_SUB_BITS significant bits, values saturate at 2^MAX_EXP ns.
+#define NCCL_PROXY_HIST_SUB_BITS 3
+#define NCCL_PROXY_HIST_MAX_EXP 40
+#define NCCL_PROXY_HIST_BUCKETS ((NCCL_PROXY_HIST_MAX_EXP-NCCL_PROXY_HIST_SUB_BITS+2)<<NCCL_PROXY_HIST_SUB_BITS)
+struct ncclProxyHist {
+  uint64_t count;
+  uint64_t sumNs;
+  uint64_t maxNs;
+  uint32_t buckets[NCCL_PROXY_HIST_BUCKETS];
+};
+
+// Histograms of one connection, written by the progress thread owning it.
+// Allocated on its first step and never freed before the proxy state.
+#define NCCL_PROXY_CONN_METRICS ncclProxyMetricIdle
+struct ncclProxyConnStats {
+  struct ncclProxyConnStats* next;
+  int peer; // Top parent rank
+  int channelId;
+  int send;
+  struct ncclProxyHist hists[NCCL_PROXY_CONN_METRICS];
+};
+
+// Ring of the latest step state records of one progress thread, see
+// ncclProxyTraceSnapshot(). Written by its thread only, head is published
+// after the record so readers can detect overwritten entries.
+struct ncclProxyTraceRing {
+  struct ncclProxyTraceRing* next;
+  uint64_t head; // Records written since the start
+  uint64_t mask;
+  ncclProxyTraceRecord_t* records; // [mask+1]
+};
+
+// Async Setup/Connect calls to one proxy, encoded as a ncclProxyMsgBatch message
+struct ncclProxyCallBatch {
+  char* buff;
+  int size;
+  int cap;
+  int count;
+  void* newestOpId;
+  void* lastPolledOpId;
+};
+
+// Open addressing table of outstanding async proxy calls, keyed by opId
 struct ncclExpectedProxyResponse {
-  void*    opId;
+  void*    opId; // NULL if the slot is empty
   int      respSize;
   bool     done;
   void*    respBuff;
-  struct   ncclExpectedProxyResponse* next;
+  int      respCap;
+};
+
+#define NCCL_PROXY_RESP_FREE_BUFFS 64
+struct ncclExpectedProxyResponses {
+  struct ncclExpectedProxyResponse* table;
+  int size; // power of two
+  int count;
+  // Response buffers kept for reuse by the next calls
+  void* freeBuffs[NCCL_PROXY_RESP_FREE_BUFFS];
+  int freeCaps[NCCL_PROXY_RESP_FREE_BUFFS];
+  int nFreeBuffs;
 };
 
 struct ncclProxyAsyncOp {
@@ -208,6 +328,7 @@ struct ncclProxyState {
   ncclNet_t* ncclNet;
   ncclCollNet_t* ncclCollNet;
   volatile uint32_t* abortFlag;
+  struct ncclMemUsage* memUsage; // Of the shared resources, allocations of the proxy threads are accounted to
   // Service thread
   pthread_t thread;
   struct ncclSocket* listenSock;
@@ -217,15 +338,30 @@ struct ncclProxyState {
   // Used by main thread
   union ncclSocketAddress* peerAddresses;
   struct ncclSocket* peerSocks;
+  struct ncclProxyCallBatch* callBatches; // [tpNLocalRanks] async calls not sent yet
   struct ncclProxyOps* proxyOps;
   void** sharedDevMems;
   struct ncclIpcSocket peerIpcSock; // cuMEM API support (UDS)
 
   // Progress thread
   struct ncclProxyProgressState progressState;
+  int nProgressShards; // progress threads sharing channels, including the main one
+  int sendShard; // index of the thread progressing all net sends (RCCL_PROXY_SEND_THREAD), 0 if none
+  struct ncclProxyShard* progressShards; // [nProgressShards + (sendShard != 0)], entry 0 unused
+  cpu_set_t cpuAffinity; // CPUs local to the GPU, applied to shards if not empty
+  cpu_set_t channelAffinity[MAXCHANNELS]; // CPUs local to the NIC of each channel, empty if none
 
   // Queue of expected responses from the proxy
-  struct ncclExpectedProxyResponse* expectedResponses;
+  struct ncclExpectedProxyResponses expectedResponses;
+
+  // RCCL_PROXY_HISTOGRAMS
+  struct ncclProxyConnStats* connStats; // Lock-free list, pushed by the progress threads
+  struct ncclProxyHist idleHist;        // Idle periods of the main progress thread
+  uint64_t idleStartNs;
+  uint64_t histDumpSeq;
+
+  // RCCL_PROXY_TRACE_RING
+  struct ncclProxyTraceRing* traceRings; // Lock-free list, one per progress thread
 };
 
 enum proxyConnectState {
@@ -247,6 +383,8 @@ struct ncclProxyConnection {
   void* transportResources;
   proxyConnectState state;
   struct ncclCollNetSharedRes* collNet;
+  struct ncclProxyState* proxyState;
+  struct ncclProxyConnStats* stats;
 };
 
 typedef ncclResult_t (*threadFunc_t)(struct ncclProxyArgs*);
@@ -273,6 +411,7 @@ enum ncclProxyMsgType {
   ncclProxyMsgAbort = 7,
   ncclProxyMsgStop = 8,
   ncclProxyMsgConvertFd = 9, // cuMem API support (UDS)
+  ncclProxyMsgBatch = 10, // Several Setup/Connect calls in one message
 };
 
 // This function is called by a client of the proxy that needs to invoke any of the non-progress proxyOp types
@@ -283,6 +422,8 @@ ncclResult_t ncclProxyCallAsync(struct ncclComm* comm, struct ncclProxyConnector
 // This function will internally call ncclProxyCallAsync() and spin until ncclPollProxyResponse() confirms the result is received
 ncclResult_t ncclProxyCallBlocking(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, int type, void* reqBuff, int reqSize, void* respBuff, int respSize);
 ncclResult_t ncclPollProxyResponse(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, void* respBuff, void* opId);
+// Send the async calls queued for the proxy of proxyConn
+ncclResult_t ncclProxyCallFlush(struct ncclComm* comm, struct ncclProxyConnector* proxyConn);
 
 ncclResult_t ncclProxyClientConvertFdBlocking(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, int fd, int* convertedFd);
 
@@ -0,0 +1,92 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef RCCL_FLOAT8_H_
+#define RCCL_FLOAT8_H_
+
+#include <stdint.h>
+
+// 8-bit floating point types of the OCP FP8 specification:
+//  - E4M3: 4 exponent bits (bias 7), 3 mantissa bits, no infinities, max 448.
+//  - E5M2: 5 exponent bits (bias 15), 2 mantissa bits, IEEE-like, max 57344.
+// Conversions from float round to nearest even and saturate to the largest
+// finite value, so reductions never overflow into infinities or NaN.
+
+#if __cplusplus < 201103L || (!defined(__HCC__) && !defined(__HIPCC__) && !defined(__HIP_PLATFORM_HCC__))
+
+typedef struct { uint8_t data; } rccl_float8_e4m3;
+typedef struct { uint8_t data; } rccl_float8_e5m2;
+
+#else
+
+#include <math.h>
+#include <hip/hip_runtime.h>
+
+template<int ExpBits, int ManBits, bool HasInf>
+struct rcclFloat8Format {
+  static constexpr int Bias = (1 << (ExpBits-1)) - 1;
+  // E4M3 only reserves S.1111.111 for NaN, E5M2 reserves the whole top exponent.
+  static constexpr uint8_t MaxFinite = HasInf ? uint8_t(((1 << ExpBits) - 2) << ManBits | ((1 << ManBits) - 1))
+                                              : uint8_t(0x7e);
+  static constexpr uint8_t NaN = 0x7f;
+
+  static __host__ __device__ inline uint8_t fromFloat(float f) {
+    union { float f32; uint32_t u32; } v = {f};
+    uint8_t sign = (v.u32 >> 24) & 0x80;
+    uint32_t a = v.u32 & 0x7fffffff;
+    if (a > 0x7f800000) return sign | NaN;
+    // Smallest float which is a normal value of the 8-bit type.
+    if (a < uint32_t(127 - Bias + 1) << 23) {
+      // Subnormal: count in units of the smallest subnormal, ties to even.
+      // Rounding up to 1<<ManBits yields the smallest normal encoding.
+      float q = rintf(ldexpf(fabsf(v.f32), Bias - 1 + ManBits));
+      return sign | uint8_t(q);
+    }
+    constexpr int Shift = 23 - ManBits;
+    a += (1u << (Shift-1)) - 1 + ((a >> Shift) & 1);
+    uint32_t r = (a >> Shift) - (uint32_t(127 - Bias) << ManBits);
+    return sign | uint8_t(r > MaxFinite ? MaxFinite : r);
+  }
+
+  static __host__ __device__ inline float toFloat(uint8_t x) {
+    uint32_t sign = uint32_t(x & 0x80) << 24;
+    uint32_t e = (x >> ManBits) & ((1 << ExpBits) - 1);
+    uint32_t m = x & ((1 << ManBits) - 1);
+    union { uint32_t u32; float f32; } v;
+    if (HasInf ? e == (1u << ExpBits) - 1 : (x & 0x7f) == NaN) {
+      v.u32 = sign | 0x7f800000 | (HasInf ? m << (23 - ManBits) : 0x400000);
+    } else if (e == 0) {
+      v.f32 = ldexpf(float(m), 1 - Bias - ManBits);
+      v.u32 |= sign;
+    } else {
+      v.u32 = sign | ((e - Bias + 127) << 23) | (m << (23 - ManBits));
+    }
+    return v.f32;
+  }
+};
+
+struct rccl_float8_e4m3 {
+  using Format = rcclFloat8Format<4, 3, false>;
+  uint8_t data;
+  __host__ __device__ rccl_float8_e4m3() = default;
+  explicit __host__ __device__ rccl_float8_e4m3(float f) : data(Format::fromFloat(f)) {}
+  __host__ __device__ operator float() const { return Format::toFloat(data); }
+};
+
+struct rccl_float8_e5m2 {
+  using Format = rcclFloat8Format<5, 2, true>;
+  uint8_t data;
+  __host__ __device__ rccl_float8_e5m2() = default;
+  explicit __host__ __device__ rccl_float8_e5m2(float f) : data(Format::fromFloat(f)) {}
+  __host__ __device__ operator float() const { return Format::toFloat(data); }
+};
+
+static_assert(sizeof(rccl_float8_e4m3) == 1, "rccl_float8_e4m3 must be 1 byte");
+static_assert(sizeof(rccl_float8_e5m2) == 1, "rccl_float8_e5m2 must be 1 byte");
+
+#endif
+
+#endif // RCCL_FLOAT8_H_
@@ -26,5 +26,11 @@ THE SOFTWARE.
 #include "param.h"
 
 RCCL_PARAM_DECLARE(EnableHipGraph);  // Opt-in environment variable for enabling hipGraph
+RCCL_PARAM_DECLARE(FusedLaunch);     // Opt-in environment variable for fusing launches of grouped comms
+RCCL_PARAM_DECLARE(ResidentKernel);  // Opt-in environment variable for the resident kernel mode
+RCCL_PARAM_DECLARE(ProxyNicAffinity); // Opt-in environment variable for pinning proxy threads near their NIC
+RCCL_PARAM_DECLARE(NetBalance);       // Opt-in environment variable for balancing NICs and PCI links shared by local GPUs
+RCCL_PARAM_DECLARE(HierGatherScatter); // Opt-in environment variable for node-hierarchical gather and scatter
+RCCL_PARAM_DECLARE(HierAllToAll);      // Opt-in environment variable for node-hierarchical alltoall and alltoallv
 
 #endif
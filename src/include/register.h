@@ -0,0 +1,45 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_REGISTER_H_
+#define NCCL_REGISTER_H_
+
+#include "comm.h"
+
+// Buffer registered with ncclCommRegister()
+struct ncclReg {
+  char* addr;
+  size_t size;
+  size_t baseOffset;        // Offset of addr in its allocation, which ipc refers to
+  cudaIpcMemHandle_t ipc;
+  void** peerAddrs;         // addr of the same registration on each local rank, null until first use
+  struct ncclReg* next;
+};
+
+// Allocation of a local peer opened in this process
+struct ncclRegPeerMapping {
+  cudaIpcMemHandle_t ipc;
+  void* base;
+  struct ncclRegPeerMapping* next;
+};
+
+struct ncclRegCache {
+  struct ncclReg* regs;
+  // Mappings are shared by all registrations landing in the same peer
+  // allocation, and kept until the communicator is destroyed.
+  struct ncclRegPeerMapping* mappings;
+};
+
+// Returns the registration containing [data, data+size), or NULL
+struct ncclReg* ncclRegFind(struct ncclComm* comm, const void* data, size_t size);
+// Fills regBufSend/regBufRecv with the buffers of each local rank. The first use
+// of a registration exchanges it with the other local ranks, so it must be used
+// by all of them at the same time.
+ncclResult_t ncclRegGetPeerBuffers(struct ncclComm* comm, struct ncclReg* sendReg, const void* sendbuff,
+    struct ncclReg* recvReg, void* recvbuff, void* regBufSend[], void* regBufRecv[]);
+ncclResult_t ncclRegCleanup(struct ncclComm* comm);
+
+#endif
@@ -34,5 +34,11 @@ ncclResult_t rocm_smi_getNumDevice(uint32_t* num_devs);
 ncclResult_t rocm_smi_getDevicePciBusIdString(uint32_t deviceIndex, char* pciBusId, size_t len);
 ncclResult_t rocm_smi_getDeviceIndexByPciBusId(const char* pciBusId, uint32_t* deviceIndex);
 ncclResult_t rocm_smi_getLinkInfo(int srcDev, int dstDev, RSMI_IO_LINK_TYPE* rsmi_type, int *hops, int *count);
+// Current width (lanes) and speed (Gbps) of the xGMI links of a device
+ncclResult_t rocm_smi_getXgmiLinkMetrics(uint32_t deviceIndex, int* width, int* speed);
+// xGMI outbound data counters of a device, one per link, in 32 byte beats
+ncclResult_t rocm_smi_xgmiCountersCreate(uint32_t deviceIndex, int maxLinks, rsmi_event_handle_t* handles, int* nLinks);
+ncclResult_t rocm_smi_xgmiCountersRead(int nLinks, const rsmi_event_handle_t* handles, uint64_t* beats);
+ncclResult_t rocm_smi_xgmiCountersDestroy(int nLinks, rsmi_event_handle_t* handles);
 
 #endif
@@ -11,6 +11,8 @@
 
 typedef void* ncclShmHandle_t;
 ncclResult_t ncclShmOpen(char* shmPath, size_t shmSize, void** shmPtr, void** devShmPtr, int refcount, ncclShmHandle_t* handle);
+// Same as ncclShmOpen, a segment created by this call prefers NUMA node numaId (if >= 0) and huge pages (if hugePages)
+ncclResult_t ncclShmOpenNuma(char* shmPath, size_t shmSize, void** shmPtr, void** devShmPtr, int refcount, int numaId, int hugePages, ncclShmHandle_t* handle);
 ncclResult_t ncclShmClose(ncclShmHandle_t handle);
 ncclResult_t ncclShmUnlink(ncclShmHandle_t handle);
 
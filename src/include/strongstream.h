@@ -69,7 +69,8 @@ ncclResult_t ncclCudaGraphAddDestructor(struct ncclCudaGraph graph, cudaHostFn_t
  */
 struct ncclStrongStream;
 
-ncclResult_t ncclStrongStreamConstruct(struct ncclStrongStream* ss);
+// priority is a HIP stream priority, 0 by default
+ncclResult_t ncclStrongStreamConstruct(struct ncclStrongStream* ss, int priority = 0);
 ncclResult_t ncclStrongStreamDestruct(struct ncclStrongStream* ss);
 
 // Acquire-fence the strong stream.
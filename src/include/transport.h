@@ -102,6 +102,12 @@ struct ncclTransport {
 
 ncclResult_t ncclTransportP2pConnect(struct ncclComm* comm, int channelId, int nrecv, int* peerRecv, int nsend, int* peerSend, int connIndex);
 ncclResult_t ncclTransportP2pSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, int connIndex, int* highestTransportType=NULL, bool* needsProxy=NULL);
+// Connects the rings and/or trees in algoMask (1<<NCCL_ALGO_RING, 1<<NCCL_ALGO_TREE) left unconnected by RCCL_RUNTIME_CONNECT
+ncclResult_t ncclCollPreconnect(struct ncclComm* comm, uint32_t algoMask);
+// Adds the protocols of protoMask to the ring and tree connections, see RCCL_LAZY_PROTO_BUFFERS
+ncclResult_t ncclCollGrowProtos(struct ncclComm* comm, uint32_t protoMask);
+// Frees the connections retired by ncclCollGrowProtos once the work launched before them completed
+ncclResult_t ncclCollFreeRetiredConns(struct ncclComm* comm);
 
 ncclResult_t ncclNvlsInit(struct ncclComm* comm);
 ncclResult_t ncclNvlsSetup(struct ncclComm* comm, struct ncclComm* parent);
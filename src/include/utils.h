@@ -100,6 +100,8 @@ T* ncclMemoryStackAlloc(struct ncclMemoryStack* me, size_t n=1);
  * a backing `ncclMemoryStack` passed during Alloc(). If memory
  * backing any currently held object is deallocated then it is an error to do
  * anything other than reconstruct it, after which it is a valid empty pool.
+ * Cells are whole cache lines, and an empty pool is refilled with a batch of
+ * them, about NCCL_MEMORY_POOL_REFILL_BYTES, from a single stack allocation.
  */
 struct ncclMemoryPool;
 
@@ -255,10 +257,18 @@ inline void ncclMemoryStackPop(struct ncclMemoryStack* me) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#define NCCL_MEMORY_POOL_REFILL_BYTES 4096
+
 struct ncclMemoryPool {
   struct Cell {
     Cell *next;
   };
+  template<typename T>
+  struct CellOf {
+    static constexpr int align = alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE;
+    static constexpr int size = alignUp(sizeof(T), align);
+    static constexpr int refill = size >= NCCL_MEMORY_POOL_REFILL_BYTES ? 1 : NCCL_MEMORY_POOL_REFILL_BYTES/size;
+  };
   template<int Size, int Align>
   union CellSized {
     Cell cell;
@@ -275,14 +285,22 @@ inline void ncclMemoryPoolConstruct(struct ncclMemoryPool* me) {
 template<typename T>
 inline T* ncclMemoryPoolAlloc(struct ncclMemoryPool* me, struct ncclMemoryStack* backing) {
   using Cell = ncclMemoryPool::Cell;
-  using CellSized = ncclMemoryPool::CellSized<sizeof(T), alignof(T)>;
+  using CellOf = ncclMemoryPool::CellOf<T>;
+  using CellSized = ncclMemoryPool::CellSized<CellOf::size, CellOf::align>;
   Cell* cell;
   if (__builtin_expect(me->head != nullptr, true)) {
     cell = me->head;
     me->head = cell->next;
   } else {
     // Use the internal allocate() since it doesn't memset to 0 yet.
-    cell = (Cell*)ncclMemoryStack::allocate(backing, sizeof(CellSized), alignof(CellSized));
+    CellSized* cells = (CellSized*)ncclMemoryStack::allocate(backing, CellOf::refill*sizeof(CellSized), alignof(CellSized));
+    cell = &cells[0].cell;
+    if (CellOf::refill > 1) {
+      for (int i=1; i<CellOf::refill-1; i++) cells[i].cell.next = &cells[i+1].cell;
+      cells[CellOf::refill-1].cell.next = nullptr;
+      me->head = &cells[1].cell;
+      me->tail = &cells[CellOf::refill-1].cell;
+    }
   }
   memset(cell, 0, sizeof(T));
   return reinterpret_cast<T*>(cell);
@@ -0,0 +1,27 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_WATCHDOG_H_
+#define NCCL_WATCHDOG_H_
+
+#include "nccl.h"
+
+struct ncclComm;
+struct ncclKernelPlan;
+
+// Cross-rank progress watchdog (RCCL_WATCHDOG_INTERVAL_MS), see misc/watchdog.cc.
+// Every rank sends a summary of its launched and completed kernel plans to rank
+// 0 of the communicator, which reports the lagging ranks and channels when
+// progress stalls and keeps per-rank lag histograms.
+
+// Collective, called by all ranks at the end of init. No-op when disabled.
+ncclResult_t ncclWatchdogInit(struct ncclComm* comm);
+ncclResult_t ncclWatchdogDestroy(struct ncclComm* comm);
+
+// Records the fifo acks of a plan just uploaded, called when comm->watchdog is set
+void ncclWatchdogLaunch(struct ncclComm* comm, struct ncclKernelPlan* plan);
+
+#endif
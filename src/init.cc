@@ -18,13 +18,22 @@
 #include "enqueue.h"
 #include "graph.h"
 #include "argcheck.h"
+#include "register.h"
 #if defined(ENABLE_NPKIT)
 #include "npkit/npkit.h"
 #endif
+#include "chrome_trace.h"
+#include "watchdog.h"
+#include "call_record.h"
+#include "clock_sync.h"
+#include "hw_counters.h"
+#include "colltrace_file.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <hip/hip_runtime.h>
 #include <string.h>
+#include <algorithm>
+#include <mutex>
 #include <errno.h>
 #include <assert.h>
 #include <dlfcn.h>
@@ -58,14 +67,17 @@ const char* ncclFuncStr[NCCL_NUM_FUNCTIONS+2] = { "Broadcast", "Reduce", "AllGat
 const char* ncclAlgoStr[NCCL_NUM_ALGORITHMS] = { "Tree", "Ring", "CollNetDirect", "CollNetChain", "NVLS", "NVLSTree" };
 const char* ncclProtoStr[NCCL_NUM_PROTOCOLS] = { "LL", "LL128", "Simple" };
 const char* ncclDevRedOpStr[ncclNumDevRedOps] = { "Sum", "Prod", "Max", "Min", "PreMulSum", "SumPostDiv" };
-const char *ncclTypeStr[ncclNumTypes] = {"_i8", "_u8", "_i32", "_u32", "_i64", "_u64", "_f16", "_f32", "_f64", "_b16"};
+const char *ncclTypeStr[ncclNumTypes] = {"_i8", "_u8", "_i32", "_u32", "_i64", "_u64", "_f16", "_f32", "_f64", "_b16", "_e4m3", "_e5m2"};
 
 NCCL_PARAM(GroupCudaStream, "GROUP_CUDA_STREAM", NCCL_GROUP_CUDA_STREAM);
 
 NCCL_PARAM(CheckPointers, "CHECK_POINTERS", 0);
+RCCL_PARAM(CheckPointersCacheSize, "CHECK_POINTERS_CACHE_SIZE", 64); // Number of validated allocations remembered, 0 to disable
 NCCL_PARAM(CommBlocking, "COMM_BLOCKING", NCCL_CONFIG_UNDEF_INT);
 
 struct allocationTracker allocTracker[MAX_ALLOC_TRACK_NGPU] = {};
+__thread struct ncclMemUsage* ncclMemUsageCurrent = nullptr;
+__thread int ncclMemTagCurrent = ncclMemTagOther;
 static ncclResult_t commReclaim(ncclComm_t comm);
 
 static uint64_t hashUniqueId(ncclUniqueId const &id) {
@@ -207,7 +219,13 @@ void *ncclCommThreadMain(void *arg) {
   sprintf(line, "SendRecvRingSimpleSum_i8");
   line += MAX_NAME_LENGTH;
   sprintf(line, "AllToAllPivotRingSimpleSum_i8");
+  // Binary mode, the file is opened with the first record once commHash is known
+  const char* traceFilePattern = getenv("RCCL_KERNEL_COLL_TRACE_FILE");
+  struct ncclCollTraceFile* traceFile = NULL;
+  // Poll continuously while records arrive, back off up to 1ms when idle
+  int sleepUs = 1000;
   do {
+    int nRecords = 0;
     for (int channel = 0; channel < MAXCHANNELS; channel++) {
       int tail = comm->collTraceTail[channel].tail%COLLTRACE_NUM_ITEMS;
       int count;
@@ -215,15 +233,25 @@ void *ncclCommThreadMain(void *arg) {
         count = tail - head[channel];
       else
         count = COLLTRACE_NUM_ITEMS + head[channel] - tail;
-      if (!count) {
-        usleep(1000); //sleep 1ms
+      if (!count)
         continue;
-      }
       for (int i = 0; i < count; i++) {
         volatile struct ncclCollTrace *td = comm->collTrace+COLLTRACE_NUM_ITEMS*channel+head[channel];
         uint8_t type = td->type;
         if (type == ncclCollTraceNotReady)
           break;
+        nRecords++;
+        if (traceFilePattern && traceFile == NULL &&
+            ncclCollTraceFileOpen(comm, traceFilePattern, func_names, FUNC_INDEX_P2P+2, MAX_NAME_LENGTH, FUNC_INDEX_P2P,
+              vega_gpu_rtc_freq, &traceFile) != ncclSuccess) {
+          traceFilePattern = NULL; // Fall back to printing
+        }
+        if (traceFile && ncclCollTraceFileAppend(traceFile, td) == ncclSuccess) {
+          td->type = ncclCollTraceNotReady;
+          head[channel] ++;
+          head[channel] %= COLLTRACE_NUM_ITEMS;
+          continue;
+        }
         char line[1024];
         int offset = 0;
         uint16_t fIdx = td->funcIndex;
@@ -277,7 +305,14 @@ void *ncclCommThreadMain(void *arg) {
         head[channel] %= COLLTRACE_NUM_ITEMS;
       }
     }
+    if (nRecords) {
+      sleepUs = 0;
+    } else {
+      sleepUs = std::min(std::max(2*sleepUs, 10), 1000);
+      usleep(sleepUs);
+    }
   } while(!comm->collTraceExit);
+  ncclCollTraceFileClose(traceFile);
   free(func_names);
   pthread_exit(NULL);
 }
@@ -346,11 +381,36 @@ static ncclResult_t commFree(ncclComm_t comm) {
     pthread_join(comm->proxyState->thread, nullptr);
   }
 
+  NCCLCHECK(ncclWatchdogDestroy(comm));
+  NCCLCHECK(ncclClockSyncDestroy(comm));
+  NCCLCHECK(ncclLaunchPipelineDestroy(comm));
+  NCCLCHECK(ncclAutoGraphDestroy(comm));
+  NCCLCHECK(ncclResidentKernelStop(comm));
+  NCCLCHECK(ncclRegCleanup(comm));
+  NCCLCHECK(ncclQuickAllReduceFree(comm));
+
   delete[] comm->userRedOps;
 
   free(comm->connectSend);
   free(comm->connectRecv);
 
+  if (comm->algoCache) {
+    INFO(NCCL_TUNING, "comm %p rank %d algorithm cache: %lu hits %lu misses", comm, comm->rank, comm->algoCacheHits, comm->algoCacheMisses);
+    free(comm->algoCache);
+  }
+  if (comm->allToAllvStaging) NCCLCHECK(ncclCudaFree(comm->allToAllvStaging));
+  if (comm->hierA2AStaging) NCCLCHECK(ncclCudaFree(comm->hierA2AStaging));
+  if (comm->hierRootStaging) NCCLCHECK(ncclCudaFree(comm->hierRootStaging));
+  if (comm->sparseStaging) NCCLCHECK(ncclCudaFree(comm->sparseStaging));
+  if (comm->warmupScratch) NCCLCHECK(ncclCudaFree(comm->warmupScratch));
+  if (comm->ptrCache) {
+    INFO(NCCL_INIT, "comm %p rank %d pointer check cache: %lu hits %lu misses", comm, comm->rank, comm->ptrCacheHits, comm->ptrCacheMisses);
+    free(comm->ptrCache);
+  }
+  INFO(NCCL_INIT, "comm %p rank %d kernel plan pool: %lu hits %lu misses, proxy op pool: %lu hits %lu misses, work list pool: %lu hits %lu misses",
+    comm, comm->rank, comm->planPoolHits, comm->planPoolMisses, comm->proxyOpPoolHits, comm->proxyOpPoolMisses,
+    comm->workListPoolHits, comm->workListPoolMisses);
+
 #ifdef ENABLE_PROFILING
   struct ncclProf *prof, *prof_seq;
   prof = (struct ncclProf*)malloc(sizeof(struct ncclProf)*MAXCHANNELS*PROFILE_NUM_LAUNCHES);
@@ -378,6 +438,11 @@ static ncclResult_t commFree(ncclComm_t comm) {
   free(comm->peerInfo);
   if (comm->topo)
     ncclTopoFree(comm->topo);
+  free(comm->graphs);
+  NCCLCHECK(ncclTunerFree(comm));
+  NCCLCHECK(ncclBwReportFree(comm));
+  NCCLCHECK(ncclTunerPluginUnload(comm));
+  free(comm->tuningRules);
   if (comm->nodeRanks) {
     for (int n=0; n<comm->nNodes; n++) free(comm->nodeRanks[n].localRankToRank);
     free(comm->nodeRanks);
@@ -391,6 +456,11 @@ static ncclResult_t commFree(ncclComm_t comm) {
 
   for (int channel=0; channel<MAXCHANNELS; channel++)
     NCCLCHECK(freeChannel(comm->channels+channel, comm->nRanks, 1, comm->localRanks));
+  for (int i=0; i<comm->nRetiredConns; i++)
+    NCCLCHECK(comm->retiredConns[i].transportComm->free(comm->retiredConns+i));
+  free(comm->retiredConns);
+  if (comm->retiredConnsEvent != NULL)
+    CUDACHECK(hipEventDestroy(comm->retiredConnsEvent));
 
   if (comm->doneEvent != NULL)
     CUDACHECK(hipEventDestroy(comm->doneEvent));
@@ -398,13 +468,17 @@ static ncclResult_t commFree(ncclComm_t comm) {
   if (comm->sharedRes) {
     if (ncclAtomicRefCountDecrement(&comm->sharedRes->refCount) == 0) {
       for (int c=0; c<MAXCHANNELS; c++) {
-        if (comm->sharedRes->peers[c]) free(comm->sharedRes->peers[c]);
-        if (comm->sharedRes->devPeers[c]) ncclCudaFree(comm->sharedRes->devPeers[c]);
+        if (comm->sharedRes->peers[c] == NULL) continue;
+        for (int r=0; r<comm->sharedRes->tpNRanks; r++) free(comm->sharedRes->peers[c][r]);
+        free(comm->sharedRes->peers[c]);
+        free(comm->sharedRes->devPeers[c]);
       }
       free(comm->sharedRes->tpRankToLocalRank);
+      free(comm->sharedRes->tpRankToNode);
       NCCLCHECK(ncclStrongStreamDestruct(&comm->sharedRes->hostStream));
       NCCLCHECK(ncclStrongStreamDestruct(&comm->sharedRes->deviceStream));
       NCCLCHECK(ncclProxyDestroy(comm));
+      NCCLCHECK(ncclDevArenaDestroy(&comm->sharedRes->devArena));
       free(comm->sharedRes);
     }
   }
@@ -447,6 +521,12 @@ NCCL_PARAM(DisableGraphHelper, "GRAPH_HELPER_DISABLE", 0);
 // GDRCOPY support: FIFO_ENABLE when enabled locates a workFifo in CUDA memory
 NCCL_PARAM(GdrCopyFifoEnable, "GDRCOPY_FIFO_ENABLE", 1);
 NCCL_PARAM(WorkFifoDepth, "WORK_FIFO_DEPTH", 64<<10);
+RCCL_PARAM(AlgoCacheSize, "ALGO_CACHE_SIZE", 1024); // Number of memoized algorithm decisions, 0 to disable
+RCCL_PARAM(CommStatsTime, "COMM_STATS_TIME", 1); // Kernels account their time per channel for ncclCommGetStats()
+// Bulk data of the SIMPLE protocol is written with non-temporal stores so it does not evict the
+// cache working set of kernels overlapping the collective: bit 0 for what is sent to peers, bit 1
+// for local output buffers, which the application may read right after the collective
+RCCL_PARAM(SimpleNtStores, "SIMPLE_NT_STORES", 0);
 enum ncclLaunchMode ncclParamLaunchMode;
 
 
@@ -475,6 +555,9 @@ ncclResult_t ncclCommEnsureReady(ncclComm_t comm) {
   /* comm must be ready, or error will be reported */
   ncclResult_t ret = ncclSuccess;
 
+  // Pipelined launches own comm->tasks until they are done.
+  NCCLCHECK(ncclLaunchPipelineWait(comm));
+
   if (*comm->abortFlag) {
     ncclGroupJobAbort();
   } else {
@@ -491,6 +574,16 @@ exit:
   return ret;
 }
 
+// HIP priority of the internal streams of a comm, from its priority attribute
+static ncclResult_t commStreamPriority(struct ncclComm* comm, int* streamPriority) {
+  int least, greatest;
+  *streamPriority = 0;
+  if (comm->config.priority == 0) return ncclSuccess;
+  CUDACHECK(cudaDeviceGetStreamPriorityRange(&least, &greatest));
+  *streamPriority = comm->config.priority > 0 ? greatest : least;
+  return ncclSuccess;
+}
+
 static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, int ndev, int rank) {
   if (ndev < 1) {
     WARN("invalid device count (%d) requested", ndev);
@@ -535,15 +628,20 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
   TRACE(NCCL_INIT,"comm %p rank %d nranks %d cudaDev %d busId %lx compCap %d", comm, rank, ndev, comm->cudaDev, comm->busId, comm->compCap);
 
   // RCCL: create persistent stream for calloc
-  CUDACHECK(hipStreamCreateWithFlags(&comm->sideStream, hipStreamNonBlocking));
+  int streamPriority;
+  NCCLCHECK(commStreamPriority(comm, &streamPriority));
+  CUDACHECK(hipStreamCreateWithPriority(&comm->sideStream, hipStreamNonBlocking, streamPriority));
   comm->checkPointers = ncclParamCheckPointers() == 1 ? true : false;
+  comm->ptrCacheSize = comm->checkPointers ? std::max(0, (int)rcclParamCheckPointersCacheSize()) : 0;
+  if (comm->ptrCacheSize > 0) NCCLCHECK(ncclCalloc(&comm->ptrCache, comm->ptrCacheSize));
+  comm->ptrCacheGen = 1;
   comm->dmaBufSupport = (dmaBufSupported(comm) == ncclSuccess) ? true : false;
 
 #ifdef ENABLE_COLLTRACE
   NCCLCHECK(ncclCudaHostCalloc(&comm->collTraceTail, MAXCHANNELS));
   NCCLCHECK(ncclCudaHostCalloc(&comm->collTrace, COLLTRACE_NUM_ITEMS*MAXCHANNELS));
   comm->collTraceExit = 0;
-  if ((ncclDebugLevel >= NCCL_LOG_INFO) && rcclParamKernelCollTraceEnable())
+  if ((ncclDebugLevel >= NCCL_LOG_INFO || getenv("RCCL_KERNEL_COLL_TRACE_FILE")) && rcclParamKernelCollTraceEnable())
     pthread_create(&comm->collTraceThread, NULL, ncclCommThreadMain, (void *)comm);
   else
     comm->collTraceThread = 0;
@@ -554,6 +652,15 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
   ncclMemoryPoolConstruct(&comm->memPool_ncclKernelPlan);
   ncclMemoryPoolConstruct(&comm->memPool_ncclProxyOp);
   ncclMemoryPoolConstruct(&comm->memPool_ncclPointerList);
+  ncclMemoryPoolConstruct(&comm->memPool_ncclWorkList);
+
+  comm->algoCacheSize = rcclParamAlgoCacheSize();
+  if (comm->algoCacheSize < 0 || 0 != (comm->algoCacheSize & (comm->algoCacheSize-1))) {
+    WARN("RCCL_ALGO_CACHE_SIZE=%d is being ignored because it is not a power of 2.", comm->algoCacheSize);
+    comm->algoCacheSize = 1024;
+  }
+  if (comm->algoCacheSize > 0) NCCLCHECK(ncclCalloc(&comm->algoCache, comm->algoCacheSize));
+  comm->algoCacheEpoch = 1;
 
   comm->groupNext = reinterpret_cast<struct ncclComm*>(0x1);
   comm->preconnectNext = reinterpret_cast<struct ncclComm*>(0x1);
@@ -574,8 +681,10 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
     sharedRes->owner = comm;
     sharedRes->tpNRanks = comm->nRanks;
     NCCLCHECK(ncclCalloc(&sharedRes->tpRankToLocalRank, comm->nRanks));
-    NCCLCHECK(ncclStrongStreamConstruct(&sharedRes->deviceStream));
-    NCCLCHECK(ncclStrongStreamConstruct(&sharedRes->hostStream));
+    NCCLCHECK(ncclCalloc(&sharedRes->tpRankToNode, comm->nRanks));
+    NCCLCHECK(ncclStrongStreamConstruct(&sharedRes->deviceStream, streamPriority));
+    NCCLCHECK(ncclStrongStreamConstruct(&sharedRes->hostStream, streamPriority));
+    NCCLCHECK(ncclDevArenaInit(&sharedRes->devArena));
     comm->sharedRes = sharedRes;
     sharedRes->refCount = 1;
   } else {
@@ -597,40 +706,47 @@ static ncclResult_t commAlloc(struct ncclComm* comm, struct ncclComm* parent, in
 static ncclResult_t devCommSetup(ncclComm_t comm) {
   ncclResult_t ret = ncclSuccess;
   int nRanks = comm->nRanks;
-  struct ncclDevCommAndChannels tmpCommAndChans;
+  ncclMemScope memScope(nullptr, ncclMemTagChannels);
+  // Copies are staged in pinned memory, so that they run asynchronously on the device stream
+  // of the comm and leave the streams of the application alone during a non-blocking init
+  struct ncclDevCommAndChannels *tmpCommAndChans = NULL;
   struct ncclDevCommAndChannels *devCommAndChans = NULL;
+  int* userRanksStaging = NULL;
 
   NCCLCHECKGOTO(ncclStrongStreamAcquireUncaptured(&comm->sharedRes->deviceStream), ret, fail);
-  NCCLCHECKGOTO(ncclCudaCallocAsync(&devCommAndChans, 1, comm->sharedRes->deviceStream.cudaStream), ret, fail);
-  ncclCommPushCudaFree(comm, devCommAndChans);
+  NCCLCHECKGOTO(ncclCudaHostCalloc(&tmpCommAndChans, 1), ret, fail);
+  NCCLCHECKGOTO(ncclCudaHostCalloc(&userRanksStaging, MAXCHANNELS*nRanks), ret, fail);
+  NCCLCHECKGOTO(ncclDevArenaCallocAsync(&comm->sharedRes->devArena, &devCommAndChans, 1, comm->sharedRes->deviceStream.cudaStream), ret, fail);
   comm->devComm = &devCommAndChans->comm;
-  tmpCommAndChans.comm.rank = comm->rank;
-  tmpCommAndChans.comm.nRanks = nRanks;
-  tmpCommAndChans.comm.abortFlag = comm->abortFlag;
+  tmpCommAndChans->comm.rank = comm->rank;
+  tmpCommAndChans->comm.nRanks = nRanks;
+  tmpCommAndChans->comm.abortFlag = comm->abortFlag;
   for (int p=0; p < NCCL_NUM_PROTOCOLS; p++) {
-    tmpCommAndChans.comm.buffSizes[p] = comm->buffSizes[p];
+    tmpCommAndChans->comm.buffSizes[p] = comm->buffSizes[p];
   }
-  tmpCommAndChans.comm.channels = &devCommAndChans->channels[0];
+  tmpCommAndChans->comm.channels = &devCommAndChans->channels[0];
 
   comm->workFifoDepth = ncclParamWorkFifoDepth();
   if (0 != (comm->workFifoDepth & (comm->workFifoDepth-1))) {
     WARN("NCCL_WORK_FIFO_DEPTH=%d is being ignored because it is not a power of 2.", comm->workFifoDepth);
     comm->workFifoDepth = 64<<10;
   }
-  tmpCommAndChans.comm.workFifoDepth = comm->workFifoDepth;
+  tmpCommAndChans->comm.workFifoDepth = comm->workFifoDepth;
+  comm->workFifoUnits = comm->workFifoDepth*(NCCL_WORK_SIZE/NCCL_WORK_UNIT);
 
   if (ncclGdrCopy != NULL && ncclParamGdrCopyFifoEnable() == 1) {
-    // The workFifoHeap lives in GDR mapped CUDA memory.
-    NCCLCHECKGOTO(ncclGdrCudaCalloc(&comm->workFifoHeap, &comm->devWorkFifoHeap, comm->workFifoDepth, &comm->workFifoHeapGdrHandle, comm->sideStream), ret, fail);
+    // The workFifoHeap lives in GDR mapped CUDA memory. Kernels load a whole ncclWork even for a one unit work
+    // at the end, hence the extra one.
+    NCCLCHECKGOTO(ncclGdrCudaCalloc(&comm->workFifoHeap, &comm->devWorkFifoHeap, comm->workFifoDepth+1, &comm->workFifoHeapGdrHandle, comm->sideStream), ret, fail);
     ncclCommPushCudaGdrFree(comm, comm->workFifoHeapGdrHandle);
   } else {
     // The workFifoHeap lives in cudaHost memory.
     comm->workFifoHeapGdrHandle = nullptr;
-    NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->workFifoHeap, comm->workFifoDepth), ret, fail);
+    NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->workFifoHeap, comm->workFifoDepth+1), ret, fail);
     ncclCommPushCudaHostFree(comm, comm->workFifoHeap);
     comm->devWorkFifoHeap = comm->workFifoHeap;
   }
-  tmpCommAndChans.comm.workFifoHeap = comm->devWorkFifoHeap;
+  tmpCommAndChans->comm.workFifoHeap = comm->devWorkFifoHeap;
 
   NCCLCHECKGOTO(ncclCudaHostCalloc(&comm->workFifoDone, MAXCHANNELS), ret, fail);
   ncclCommPushCudaHostFree(comm, comm->workFifoDone);
@@ -638,42 +754,59 @@ static ncclResult_t devCommSetup(ncclComm_t comm) {
   comm->workFifoAckdMin = 0;
 
   for (int c=0; c < MAXCHANNELS; c++) {
-    tmpCommAndChans.channels[c].peers = comm->channels[c].devPeers;
-    tmpCommAndChans.channels[c].ring = comm->channels[c].ring;
-    tmpCommAndChans.channels[c].ring.userRanks = comm->channels[c].devRingUserRanks;
-    tmpCommAndChans.channels[c].tree = comm->channels[c].tree;
-    tmpCommAndChans.channels[c].collnetChain = comm->channels[c].collnetChain;
-    tmpCommAndChans.channels[c].collnetDirect = comm->channels[c].collnetDirect;
-    tmpCommAndChans.channels[c].binTree = comm->channels[c].binTree;
-    tmpCommAndChans.channels[c].nvls = comm->channels[c].nvls;
-    tmpCommAndChans.channels[c].workFifoDone = &comm->workFifoDone[c];
+    tmpCommAndChans->channels[c].peers = comm->channels[c].devPeers;
+    tmpCommAndChans->channels[c].ring = comm->channels[c].ring;
+    tmpCommAndChans->channels[c].ring.userRanks = comm->channels[c].devRingUserRanks;
+    tmpCommAndChans->channels[c].tree = comm->channels[c].tree;
+    tmpCommAndChans->channels[c].collnetChain = comm->channels[c].collnetChain;
+    tmpCommAndChans->channels[c].collnetDirect = comm->channels[c].collnetDirect;
+    tmpCommAndChans->channels[c].binTree = comm->channels[c].binTree;
+    tmpCommAndChans->channels[c].nvls = comm->channels[c].nvls;
+    tmpCommAndChans->channels[c].workFifoDone = &comm->workFifoDone[c];
 
     if (comm->channels[c].ring.userRanks != nullptr) {
-      NCCLCHECKGOTO(ncclCudaMemcpyAsync(tmpCommAndChans.channels[c].ring.userRanks, comm->channels[c].ring.userRanks, nRanks, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+      memcpy(userRanksStaging+c*nRanks, comm->channels[c].ring.userRanks, nRanks*sizeof(int));
+      NCCLCHECKGOTO(ncclCudaMemcpyAsync(tmpCommAndChans->channels[c].ring.userRanks, userRanksStaging+c*nRanks, nRanks, comm->sharedRes->deviceStream.cudaStream), ret, fail);
     }
   }
 
 #ifdef ENABLE_COLLTRACE
-  tmpCommAndChans.comm.collTrace = comm->collTrace;
-  tmpCommAndChans.comm.collTraceTail = comm->collTraceTail;
-  tmpCommAndChans.comm.collTraceThread = comm->collTraceThread;
+  tmpCommAndChans->comm.collTrace = comm->collTrace;
+  tmpCommAndChans->comm.collTraceTail = comm->collTraceTail;
+  tmpCommAndChans->comm.collTraceThread = comm->collTraceThread;
 #endif
 
+  NCCLCHECKGOTO(ncclChromeTraceInit(comm->rank), ret, fail);
+  NCCLCHECKGOTO(ncclHwCountersInit(comm), ret, fail);
+  NCCLCHECKGOTO(ncclCallRecordInit(comm->rank), ret, fail);
+
 #if defined(ENABLE_NPKIT)
   // Init NPKit
-  NCCLCHECK(NpKit::Init(comm->rank));
-  tmpCommAndChans.comm.npKitEventCollectContexts = NpKit::GetGpuEventCollectContexts();
-  tmpCommAndChans.comm.cpuTimestamp = NpKit::GetCpuTimestamp();
+  {
+    ncclMemScope npKitScope(nullptr, ncclMemTagNpKit);
+    NCCLCHECK(NpKit::Init(comm->rank));
+  }
+  tmpCommAndChans->comm.npKitEventCollectContexts = NpKit::GetGpuEventCollectContexts();
+  tmpCommAndChans->comm.cpuTimestamp = NpKit::GetCpuTimestamp();
 #endif
 
 #ifdef ENABLE_PROFILING
-  NCCLCHECK(ncclCudaCalloc(&tmpCommAndChans.comm.devProf, MAXCHANNELS*PROFILE_NUM_LAUNCHES, comm->sideStream));
+  NCCLCHECK(ncclCudaCalloc(&tmpCommAndChans->comm.devProf, MAXCHANNELS*PROFILE_NUM_LAUNCHES, comm->sideStream));
 #endif
 
-  NCCLCHECKGOTO(ncclCudaMemcpyAsync(devCommAndChans, &tmpCommAndChans, 1, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+  if (rcclParamCommStatsTime()) {
+    NCCLCHECKGOTO(ncclDevArenaCallocAsync(&comm->sharedRes->devArena, &comm->statsTicks, MAXCHANNELS*ncclStatsNumClasses, comm->sharedRes->deviceStream.cudaStream), ret, fail);
+    comm->statsClockKhz = GetDeviceWallClockRateInKhz(comm->cudaDev);
+  }
+  tmpCommAndChans->comm.statsTicks = comm->statsTicks;
+  tmpCommAndChans->comm.simpleNtStores = rcclParamSimpleNtStores() & (NCCL_NT_STORES_SEND|NCCL_NT_STORES_OUTPUT);
+
+  NCCLCHECKGOTO(ncclCudaMemcpyAsync(devCommAndChans, tmpCommAndChans, 1, comm->sharedRes->deviceStream.cudaStream), ret, fail);
 exit:
   CUDACHECK(cudaStreamSynchronize(comm->sharedRes->deviceStream.cudaStream));
   NCCLCHECK(ncclStrongStreamRelease(ncclCudaGraphNone(), &comm->sharedRes->deviceStream));
+  if (tmpCommAndChans) NCCLCHECK(ncclCudaHostFree(tmpCommAndChans));
+  if (userRanksStaging) NCCLCHECK(ncclCudaHostFree(userRanksStaging));
   return ret;
 fail:
   goto exit;
@@ -763,6 +896,15 @@ NCCL_PARAM(P2pNetChunkSize, "P2P_NET_CHUNKSIZE", (1 << 17)); /* 128 kB */
 NCCL_PARAM(P2pPciChunkSize, "P2P_PCI_CHUNKSIZE", (1 << 17)); /* 128 kB */
 NCCL_PARAM(P2pNvlChunkSize, "P2P_NVL_CHUNKSIZE", (1 << 19)); /* 512 kB */
 
+// Estimated device memory of the buffers of one channel: the ring and tree connections of a rank
+// receive into a buffer of each protocol
+#define NCCL_MEM_CAP_CONNS_PER_CHANNEL (1 + 1 + NCCL_MAX_TREE_ARITY)
+static size_t channelBuffBytes(struct ncclComm* comm) {
+  size_t bytes = 0;
+  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) bytes += comm->buffSizes[p];
+  return bytes*NCCL_MEM_CAP_CONNS_PER_CHANNEL;
+}
+
 static ncclResult_t computeBuffSizes(struct ncclComm* comm) {
   int cpuArch, cpuVendor, cpuModel;
   NCCLCHECK(ncclTopoCpuType(comm->topo, &cpuArch, &cpuVendor, &cpuModel));
@@ -776,6 +918,29 @@ static ncclResult_t computeBuffSizes(struct ncclComm* comm) {
     comm->buffSizes[p] = envs[p] != -2 ? envs[p] : defaults[p];
   }
 
+  // Within memoryCapMB, first the SIMPLE and LL128 buffers left to their defaults shrink down to a
+  // quarter, then channels are dropped, though not below minCTAs. nChannels and the config agree
+  // across ranks here, so do the results. P2P buffers are not part of the estimate.
+  if (comm->config.memoryCapMB > 0) {
+    size_t cap = (size_t)comm->config.memoryCapMB << 20;
+    for (int halvings = 0; halvings < 2 && comm->nChannels*channelBuffBytes(comm) > cap; halvings++) {
+      for (int p : {NCCL_PROTO_LL128, NCCL_PROTO_SIMPLE}) {
+        if (envs[p] == -2) comm->buffSizes[p] /= 2;
+      }
+    }
+    int nChannels = std::max(std::min(comm->config.minCTAs, comm->nChannels), (int)std::min<size_t>(comm->nChannels, cap/channelBuffBytes(comm)));
+    nChannels = std::max(nChannels, 1);
+    if (nChannels < comm->nChannels) {
+      INFO(NCCL_INIT, "Memory cap %d MB : using %d channels instead of %d", comm->config.memoryCapMB, nChannels, comm->nChannels);
+      comm->nChannels = nChannels;
+    }
+    if (comm->nChannels*channelBuffBytes(comm) > cap) {
+      WARN("Memory cap %d MB is lower than the %zu MB of a single channel", comm->config.memoryCapMB, channelBuffBytes(comm) >> 20);
+    }
+    INFO(NCCL_INIT, "Memory cap %d MB : buffer sizes %d/%d/%d for LL/LL128/Simple", comm->config.memoryCapMB,
+        comm->buffSizes[NCCL_PROTO_LL], comm->buffSizes[NCCL_PROTO_LL128], comm->buffSizes[NCCL_PROTO_SIMPLE]);
+  }
+
   if (comm->nNodes > 1) comm->p2pChunkSize = ncclParamP2pNetChunkSize();
   else if (ncclTopoPathAllNVLink(comm->topo)) comm->p2pChunkSize = ncclParamP2pNvlChunkSize();
   else comm->p2pChunkSize = ncclParamP2pPciChunkSize();
@@ -999,11 +1164,259 @@ fail:
   goto exit;
 }
 
+RCCL_PARAM(P2pSchedule, "P2P_SCHEDULE", 0); // 0: delta order, 1: pairwise exchange, 2: node staggered, 3: rail aligned
+RCCL_PARAM(P2pScheduleNodeSenders, "P2P_SCHEDULE_NODE_SENDERS", 1); // Ranks of a node sending to the same node per step with P2P_SCHEDULE=2
+
+// Setup p2p structures in comm->tasks. Step i of the schedule sends to
+// p2pSendOrder[i] and receives from p2pRecvOrder[i]; every schedule keeps
+// these matched across ranks, i.e. if we send to peer at step i, peer
+// receives from us at step i.
+static ncclResult_t setupP2pSchedule(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  int node = comm->node;
+  int nNodes = comm->nNodes;
+  struct ncclNodeRanks *nodeRanks = comm->nodeRanks;
+  int localRank = comm->localRank;
+  // We want to fuse along node boundaries. Make sure nsteps is a multiple or divides 8.
+  int steps = ALIGN_POWER(comm->maxLocalRanks, NCCL_MAX_WORK_ELEMENTS_P2P/2);
+  tasks->p2pOrderSteps = comm->nNodes * steps;
+  tasks->peers = ncclMemoryStackAlloc<ncclTasks::Peer>(&comm->memPermanent, tasks->p2pOrderSteps);
+  tasks->p2pSendOrder = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
+  tasks->p2pRecvOrder = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
+
+  int schedule = rcclParamP2pSchedule();
+  int nodeSenders = std::max(1, (int)rcclParamP2pScheduleNodeSenders());
+  if (schedule < 0 || schedule > 3) {
+    WARN("Invalid RCCL_P2P_SCHEDULE=%d, using default schedule", schedule);
+    schedule = 0;
+  }
+  if (schedule == 1 && (nNodes & (nNodes-1)) != 0) {
+    INFO(NCCL_INIT, "Pairwise p2p schedule needs a power of two number of nodes (%d), using default schedule", nNodes);
+    schedule = 0;
+  }
+
+  // Node deltas in the order they are scheduled.
+  int* nodeDeltas;
+  NCCLCHECK(ncclCalloc(&nodeDeltas, nNodes));
+  int n=0;
+  // schedule delta 0, +1, -1, +2, -2, ...
+  // also make sure we don't do 0 twice, nor +n/2 and -n/2 if n is even.
+  for (int d=0; d <= nNodes/4; d++) {
+    int deltas[4] = { d, (nNodes-d)%nNodes, nNodes/2-d, (nNodes-(nNodes/2-d))%nNodes };
+    int index = 0;
+    while (index < 4) {
+      nodeDeltas[n++] = deltas[index];
+      index++;
+      if (index == 1 && deltas[1] == deltas[0]) index++;
+      if (index == 2 && deltas[2] == deltas[0]) index++;
+      if (index == 3 && deltas[3] == deltas[2]) index++;
+      if (index == 3 && deltas[3] == deltas[1]) index++;
+    }
+  }
+  assert(n == nNodes);
+
+  for (int i=0; i < tasks->p2pOrderSteps; i++) {
+    // Rail aligned schedules iterate over nodes first so that ranks exchange
+    // with the same local rank (same rail) of every node before crossing rails.
+    int k = schedule == 3 ? i%nNodes : i/steps;
+    int step = schedule == 3 ? i/nNodes : i%steps;
+    int recvIndex = (localRank-step+steps)%steps;
+    int sendIndex = (localRank+step)%steps;
+    int recvNode, sendNode;
+    if (schedule == 1) {
+      // Pairwise exchange, we send to and receive from the same node.
+      recvNode = sendNode = node ^ k;
+    } else if (schedule == 2) {
+      // Stagger the node delta by the sender's local rank so that at most
+      // nodeSenders ranks of a node target the same node at each step.
+      sendNode = (node+nodeDeltas[(k+localRank/nodeSenders)%nNodes])%nNodes;
+      recvNode = (node+nNodes-nodeDeltas[(k+recvIndex/nodeSenders)%nNodes])%nNodes;
+    } else {
+      sendNode = (node+nodeDeltas[k])%nNodes;
+      recvNode = (node+nNodes-nodeDeltas[k])%nNodes;
+    }
+    tasks->p2pRecvOrder[i] = recvIndex < nodeRanks[recvNode].localRanks ? nodeRanks[recvNode].localRankToRank[recvIndex] : -1;
+    tasks->p2pSendOrder[i] = sendIndex < nodeRanks[sendNode].localRanks ? nodeRanks[sendNode].localRankToRank[sendIndex] : -1;
+  }
+  free(nodeDeltas);
+  if (schedule != 0) INFO(NCCL_INIT, "Using p2p schedule %d over %d nodes, %d steps per node", schedule, nNodes, steps);
+  return ncclSuccess;
+}
+
+RCCL_PARAM(InitParallelSearch, "INIT_PARALLEL_SEARCH", 1); // Search the NVLS and CollNet graphs next to the ring and tree ones
+RCCL_PARAM(SplitDeriveGraphs, "SPLIT_DERIVE_GRAPHS", 1); // Split children with splitShare restrict the parent graphs instead of searching
+RCCL_PARAM(SplitShareP2pChannels, "SPLIT_SHARE_P2P_CHANNELS", 1); // Split children with splitShare place p2p operations like their top parent
+RCCL_PARAM(RuntimeConnect, "RUNTIME_CONNECT", 0); // Connect rings and trees when the first collective using them is launched
+RCCL_PARAM(LazyProtoBuffers, "LAZY_PROTO_BUFFERS", 0); // Give rings and trees LL and LL128 buffers once collectives use them, implies runtime connect
+
+static ncclResult_t connectRings(struct ncclComm* comm, struct ncclTopoGraph* ringGraph, int* highestTransportType, bool* needsProxy) {
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->ring.prev, 1, &channel->ring.next, 0));
+  }
+  NCCLCHECK(ncclTransportP2pSetup(comm, ringGraph, 0, highestTransportType, needsProxy));
+  if (comm->useIntraNet) {
+    // Connect NET for intranode use
+    for (int c=0; c<comm->nChannels; c++) {
+      struct ncclChannel* channel = comm->channels+c;
+      NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->ring.prev, 1, &channel->ring.next, NCCL_CONN_IDX_P2P_NET));
+    }
+    NCCLCHECK(ncclTransportP2pSetup(comm, ringGraph, NCCL_CONN_IDX_P2P_NET));
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t connectTrees(struct ncclComm* comm, struct ncclTopoGraph* treeGraph, int* highestTransportType, bool* needsProxy) {
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, NCCL_MAX_TREE_ARITY, channel->tree.down, 1, &channel->tree.up, 0));
+    NCCLCHECK(ncclTransportP2pConnect(comm, c, 1, &channel->tree.up, NCCL_MAX_TREE_ARITY, channel->tree.down, 0));
+  }
+  NCCLCHECK(ncclTransportP2pSetup(comm, treeGraph, 0, highestTransportType, needsProxy));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCollPreconnect(struct ncclComm* comm, uint32_t algoMask) {
+  ncclResult_t ret = ncclSuccess;
+  uint64_t* savedSend = NULL;
+  uint64_t* savedRecv = NULL;
+  algoMask &= ~comm->runtimeConnectedAlgos;
+  if (algoMask == 0) return ncclSuccess;
+  // The connect masks are shared with p2p operations which were queued but not connected yet: put those aside so the
+  // collective graphs are set up on their own.
+  NCCLCHECKGOTO(ncclCalloc(&savedSend, comm->nRanks*NCCL_MAX_CONNS), ret, exit);
+  NCCLCHECKGOTO(ncclCalloc(&savedRecv, comm->nRanks*NCCL_MAX_CONNS), ret, exit);
+  memcpy(savedSend, comm->connectSend, comm->nRanks*NCCL_MAX_CONNS*sizeof(uint64_t));
+  memcpy(savedRecv, comm->connectRecv, comm->nRanks*NCCL_MAX_CONNS*sizeof(uint64_t));
+  memset(comm->connectSend, 0, comm->nRanks*NCCL_MAX_CONNS*sizeof(uint64_t));
+  memset(comm->connectRecv, 0, comm->nRanks*NCCL_MAX_CONNS*sizeof(uint64_t));
+  if (algoMask & (1<<NCCL_ALGO_RING)) {
+    NCCLCHECKGOTO(connectRings(comm, comm->graphs+0, NULL, NULL), ret, restore);
+    INFO(NCCL_INIT, "Connected all rings comm %p nRanks %02d busId %lx at runtime", comm, comm->nRanks, comm->busId);
+  }
+  if (algoMask & (1<<NCCL_ALGO_TREE)) {
+    NCCLCHECKGOTO(connectTrees(comm, comm->graphs+1, NULL, NULL), ret, restore);
+    INFO(NCCL_INIT, "Connected all trees comm %p at runtime", comm);
+  }
+  comm->runtimeConnectedAlgos |= algoMask;
+restore:
+  memcpy(comm->connectSend, savedSend, comm->nRanks*NCCL_MAX_CONNS*sizeof(uint64_t));
+  memcpy(comm->connectRecv, savedRecv, comm->nRanks*NCCL_MAX_CONNS*sizeof(uint64_t));
+exit:
+  free(savedSend);
+  free(savedRecv);
+  return ret;
+}
+
+// Adds protocols to the connections of rings and trees, connecting those already connected again. Connections are
+// retired rather than freed, as kernels and proxy operations launched before may still use them: the new ones
+// reach the device through the shared device stream, ordered after those kernels, and retiredConnsEvent is
+// recorded there for ncclCollFreeRetiredConns. This only happens the first time each protocol is needed, so at
+// most twice.
+ncclResult_t ncclCollGrowProtos(struct ncclComm* comm, uint32_t protoMask) {
+  protoMask &= ~comm->collProtoMask;
+  if (protoMask == 0) return ncclSuccess;
+  comm->collProtoMask |= protoMask;
+  uint32_t connectedAlgos = comm->runtimeConnectedAlgos;
+
+  for (int c=0; c<comm->nChannels; c++) {
+    for (int r=0; r<comm->nRanks; r++) {
+      struct ncclChannelPeer* peer = comm->channels[c].peers[r];
+      if (peer == NULL) continue;
+      for (struct ncclConnector* conn : {peer->send, peer->recv}) {
+        if (!conn->connected) continue;
+        NCCLCHECK(ncclRealloc(&comm->retiredConns, comm->nRetiredConns, comm->nRetiredConns+1));
+        comm->retiredConns[comm->nRetiredConns++] = *conn;
+        memset(conn, 0, sizeof(*conn));
+      }
+    }
+  }
+  comm->runtimeConnectedAlgos = 0;
+  if (connectedAlgos) NCCLCHECK(ncclCollPreconnect(comm, connectedAlgos));
+  INFO(NCCL_INIT, "Reconnected rings and trees comm %p with protocols mask %x at runtime", comm, comm->collProtoMask);
+
+  if (comm->nRetiredConns) {
+    // Kernels of single stream launches are ordered by doneEvent rather than by the device stream
+    if (comm->retiredConnsEvent == NULL) CUDACHECK(hipEventCreateWithFlags(&comm->retiredConnsEvent, hipEventDisableTiming));
+    NCCLCHECK(ncclStrongStreamAcquireUncaptured(&comm->sharedRes->deviceStream));
+    if (comm->lastStream != nullptr) CUDACHECK(hipStreamWaitEvent(comm->sharedRes->deviceStream.cudaStream, comm->doneEvent, 0));
+    CUDACHECK(hipEventRecord(comm->retiredConnsEvent, comm->sharedRes->deviceStream.cudaStream));
+    NCCLCHECK(ncclStrongStreamRelease(ncclCudaGraphNone(), &comm->sharedRes->deviceStream));
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCollFreeRetiredConns(struct ncclComm* comm) {
+  if (comm->nRetiredConns == 0) return ncclSuccess;
+  hipError_t err = hipEventQuery(comm->retiredConnsEvent);
+  if (err == hipErrorNotReady) return ncclSuccess;
+  CUDACHECK(err);
+  for (int i=0; i<comm->nRetiredConns; i++)
+    NCCLCHECK(comm->retiredConns[i].transportComm->free(comm->retiredConns+i));
+  free(comm->retiredConns);
+  comm->retiredConns = NULL;
+  comm->nRetiredConns = 0;
+  return ncclSuccess;
+}
+
+// Graph search running on a helper thread, over its own copy of the topology
+struct ncclTopoSearchJob {
+  pthread_t thread;
+  struct ncclTopoSystem* system;
+  struct ncclTopoGraph* graph;
+  struct ncclTopoSystem* parentSystem;
+  struct ncclTopoGraph* parentGraph;
+  ncclResult_t result;
+  int started;
+};
+
+static void* ncclTopoSearchThread(void* arg) {
+  struct ncclTopoSearchJob* job = (struct ncclTopoSearchJob*)arg;
+  job->result = ncclTopoCompute(job->system, job->graph, job->parentSystem, job->parentGraph);
+  return NULL;
+}
+
+static ncclResult_t ncclTopoSearchStart(struct ncclTopoSearchJob* job, struct ncclTopoSystem* system, struct ncclTopoGraph* graph,
+    struct ncclTopoSystem* parentSystem, struct ncclTopoGraph* parentGraph) {
+  NCCLCHECK(ncclTopoDupSystem(system, &job->system));
+  job->graph = graph;
+  job->parentSystem = parentSystem;
+  job->parentGraph = parentGraph;
+  if (pthread_create(&job->thread, NULL, ncclTopoSearchThread, job) != 0) {
+    WARN("Unable to create a thread for graph search %d : %s", graph->id, strerror(errno));
+    ncclTopoFree(job->system);
+    return ncclSystemError;
+  }
+  ncclSetThreadName(job->thread, "NCCL Search %d", graph->id);
+  job->started = 1;
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoSearchWait(struct ncclTopoSearchJob* job) {
+  if (job->started == 0) return ncclSuccess;
+  pthread_join(job->thread, NULL);
+  ncclTopoFree(job->system);
+  job->started = 0;
+  return job->result;
+}
+
+// Names of ncclInitPhase_t, for the report printed at the end of init
+static const char* initPhaseNames[ncclInitPhaseNum] = { "bootstrap", "allgather1", "topo", "paths", "search ring", "search tree",
+  "search collnet", "search nvls", "allgather3", "channels", "proxy create", "connect rings", "connect trees", "connect other",
+  "tuning", "proxy connect", "devcomm", "finish" };
+#define INIT_PHASE_END(phase) do { \
+  uint64_t now = clockNano(); \
+  comm->initProfile[phase][0] += (now-comm->initPhaseStart)/1e6; \
+  comm->initPhaseStart = now; \
+  __atomic_store_n(&comm->initPhase, (phase)+1, __ATOMIC_RELEASE); \
+} while (0)
+
 static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* parent = NULL) {
   // We use 2 AllGathers
   // 1. { peerInfo, comm, compCap}
   // 2. { nChannels, graphInfo, topoRanks }
   ncclResult_t ret = ncclSuccess;
+  ncclMemScope memScope(&comm->sharedRes->memUsage, ncclMemTagOther);
   int rank = comm->rank;
   int nranks = comm->nRanks;
   cpu_set_t affinitySave;
@@ -1046,6 +1459,10 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   int highestTransportType = TRANSPORT_P2P;
   bool needsProxy = false;
   bool mscclNeedsProxy = needsProxy;
+  struct ncclTopoSearchJob nvlsJob = { 0 }, collNetJob = { 0 };
+  int parallelSearch = rcclParamInitParallelSearch();
+  struct ncclTopoSystem* parentTopo = parent && parent->config.splitShare && parent->graphs && rcclParamSplitDeriveGraphs() ? parent->topo : NULL;
+#define PARENT_GRAPH(graph) (parentTopo ? parent->graphs+(graph).id : NULL)
 
   // AllGather1 - begin
   NCCLCHECKGOTO(ncclCalloc(&comm->peerInfo, nranks+1), ret, fail); // Extra rank to represent CollNet root
@@ -1060,6 +1477,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     }
   }
   // AllGather1 - end
+  INIT_PHASE_END(ncclInitPhaseAllGather1);
 
   do {
     // Compute intra-process ranks
@@ -1100,6 +1518,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   // Topo detection / System graph creation
   NCCLCHECKGOTO(ncclTopoGetSystem(comm, &comm->topo), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseTopo);
   // save nRanks to ncclTopoSystem as indicator of multi-node
   comm->topo->nRanks = comm->nRanks;
   // init netGdrLevel
@@ -1113,6 +1532,8 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   comm->topo->mscclEnabled = false;
   // Topology hint if tree has been defined by model or User
   comm->topo->treeDefined = false;
+  // Measure the links of the node, before anything depends on GDR or P2P read choices
+  NCCLCHECKGOTO(ncclTopoCalibrate(comm, comm->topo), ret, fail);
   // Compute paths between GPUs and NICs
   NCCLCHECKGOTO(ncclTopoComputePaths(comm->topo, comm), ret, fail);
   // Remove inaccessible GPUs and unused NICs
@@ -1145,6 +1566,15 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   // Determine local Nvls support
   NCCLCHECK(ncclNvlsInit(comm));
+  INIT_PHASE_END(ncclInitPhasePaths);
+
+  // NVLS does not depend on the other graphs, search it meanwhile
+  nvlsGraph.id = 3;
+  nvlsGraph.pattern = NCCL_TOPO_PATTERN_NVLS;
+  nvlsGraph.collNet = 0;
+  nvlsGraph.minChannels = 1;
+  nvlsGraph.maxChannels = MAXCHANNELS;
+  if (comm->nvlsSupport && parallelSearch) NCCLCHECKGOTO(ncclTopoSearchStart(&nvlsJob, comm->topo, &nvlsGraph, parentTopo, PARENT_GRAPH(nvlsGraph)), ret, fail);
 
   // Get rings and trees
   ringGraph.id = 0;
@@ -1152,39 +1582,65 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   ringGraph.collNet = 0;
   ringGraph.minChannels = 1;
   ringGraph.maxChannels = MAXCHANNELS/2;
-  NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &ringGraph), ret, fail);
+  NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &ringGraph, parentTopo, PARENT_GRAPH(ringGraph)), ret, fail);
   NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &ringGraph), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseSearchRing);
+
+  // Trees and CollNet only need the number of ring channels
+  collNetGraph.id = 2;
+  collNetGraph.pattern = NCCL_TOPO_PATTERN_TREE;
+  collNetGraph.collNet = 1;
+  collNetGraph.minChannels = collNetGraph.maxChannels = ringGraph.nChannels;
+  if (comm->collNetSupport && parallelSearch) NCCLCHECKGOTO(ncclTopoSearchStart(&collNetJob, comm->topo, &collNetGraph, parentTopo, PARENT_GRAPH(collNetGraph)), ret, fail);
 
   treeGraph.id = 1;
   treeGraph.pattern = NCCL_TOPO_PATTERN_BALANCED_TREE;
   treeGraph.collNet = 0;
   treeGraph.minChannels = comm->topo->nodes[NET].count != 0 ? 1 : ringGraph.nChannels;
   treeGraph.maxChannels = ringGraph.nChannels;
-  NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &treeGraph), ret, fail);
+  NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &treeGraph, parentTopo, PARENT_GRAPH(treeGraph)), ret, fail);
   NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &treeGraph), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseSearchTree);
 
-  collNetGraph.id = 2;
-  collNetGraph.pattern = NCCL_TOPO_PATTERN_TREE;
-  collNetGraph.collNet = 1;
-  collNetGraph.minChannels = collNetGraph.maxChannels = ringGraph.nChannels;
   if (comm->collNetSupport) {
-    NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &collNetGraph), ret, fail);
+    if (parallelSearch) {
+      NCCLCHECKGOTO(ncclTopoSearchWait(&collNetJob), ret, fail);
+    } else {
+      NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &collNetGraph, parentTopo, PARENT_GRAPH(collNetGraph)), ret, fail);
+    }
     NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &collNetGraph), ret, fail);
   } else {
     collNetGraph.nChannels = 0;
   }
+  INIT_PHASE_END(ncclInitPhaseSearchCollNet);
 
-  nvlsGraph.id = 3;
-  nvlsGraph.pattern = NCCL_TOPO_PATTERN_NVLS;
-  nvlsGraph.collNet = 0;
-  nvlsGraph.minChannels = 1;
-  nvlsGraph.maxChannels = MAXCHANNELS;
   if (comm->nvlsSupport) {
-    NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &nvlsGraph), ret, fail);
+    if (parallelSearch) {
+      NCCLCHECKGOTO(ncclTopoSearchWait(&nvlsJob), ret, fail);
+    } else {
+      NCCLCHECKGOTO(ncclTopoCompute(comm->topo, &nvlsGraph, parentTopo, PARENT_GRAPH(nvlsGraph)), ret, fail);
+    }
     NCCLCHECKGOTO(ncclTopoPrintGraph(comm->topo, &nvlsGraph), ret, fail);
   } else {
     nvlsGraph.nChannels = 0;
   }
+  INIT_PHASE_END(ncclInitPhaseSearchNvls);
+#undef PARENT_GRAPH
+
+  // Lazy protocol buffers leave out comms sharing their connections, whose children may use other protocols, and
+  // CollNet and NVLS which connect intra-node peers at init
+  comm->lazyProtoBuffers = rcclParamLazyProtoBuffers() && !comm->config.splitShare && comm->sharedRes->owner == comm &&
+      !comm->collNetSupport && !comm->nvlsSupport;
+  comm->runtimeConnect = (rcclParamRuntimeConnect() || comm->lazyProtoBuffers) && comm->nRanks > 1 && !mscclEnabled();
+  comm->lazyProtoBuffers &= comm->runtimeConnect;
+  comm->collProtoMask = comm->lazyProtoBuffers ? 1<<NCCL_PROTO_SIMPLE : (1<<NCCL_NUM_PROTOCOLS)-1;
+  if (comm->config.splitShare || comm->runtimeConnect) {
+    NCCLCHECKGOTO(ncclCalloc(&comm->graphs, 4), ret, fail);
+    memcpy(comm->graphs+ringGraph.id, &ringGraph, sizeof(struct ncclTopoGraph));
+    memcpy(comm->graphs+treeGraph.id, &treeGraph, sizeof(struct ncclTopoGraph));
+    memcpy(comm->graphs+collNetGraph.id, &collNetGraph, sizeof(struct ncclTopoGraph));
+    memcpy(comm->graphs+nvlsGraph.id, &nvlsGraph, sizeof(struct ncclTopoGraph));
+  }
 
   bool allXgmi, hasPeerAccess;
   allXgmi = true;
@@ -1263,6 +1719,7 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   NCCLCHECKGOTO(ncclTopoPreset(comm, graphs, &allGather3Data[rank].topoRanks), ret, fail);
 
   NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, allGather3Data, sizeof(*allGather3Data)), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseAllGather3);
 
   // Determine nNodes, firstRanks, ...
   NCCLCHECKGOTO(ncclCalloc(&nodesFirstRank, nranks), ret, fail);
@@ -1385,7 +1842,11 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   NCCLCHECKGOTO(computeBuffSizes(comm), ret, fail);
 
-  // Compute nChannels per peer for p2p
+  // Compute nChannels per peer for p2p. Split children sharing resources send between two GPUs on
+  // the channels their top parent uses, which connects each pair once for all of them instead of
+  // once per comm: the connections and their buffers are shared, and the shared device stream
+  // orders the kernels of the comms using them.
+  comm->p2pTopParentChannels = comm->sharedRes->owner != comm && rcclParamSplitShareP2pChannels();
   NCCLCHECKGOTO(ncclTopoComputeP2pChannels(comm), ret, fail);
 
   /* until now, all info of comm should be known. We can initialize shared resources and
@@ -1396,7 +1857,10 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
     comm->sharedRes->magic = comm->magic;
     comm->sharedRes->tpNChannels = comm->nChannels;
     comm->sharedRes->tpP2pNChannels = comm->p2pnChannels;
+    comm->sharedRes->tpNNodes = comm->nNodes;
+    comm->sharedRes->tpMaxLocalRanks = comm->maxLocalRanks;
     memcpy(comm->sharedRes->tpRankToLocalRank, comm->rankToLocalRank, sizeof(int) * comm->nRanks);
+    memcpy(comm->sharedRes->tpRankToNode, comm->rankToNode, sizeof(int) * comm->nRanks);
   }
   NCCLCHECKGOTO(ncclCalloc(&topParentLocalRanks, comm->localRanks), ret, fail);
   for (int i = 0; i < comm->localRanks; ++i) {
@@ -1405,40 +1869,36 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   }
   comm->topParentLocalRanks = topParentLocalRanks;
 
+  INIT_PHASE_END(ncclInitPhaseChannels);
+
   // Launch proxy service thread, after this, the proxy calls can be used.
   NCCLCHECKGOTO(ncclProxyCreate(comm), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseProxyCreate);
 
   // Connect with prev/next for each ring
   for (int c=0; c<comm->nChannels; c++) {
-    struct ncclChannel* channel = comm->channels+c;
     NCCLCHECKGOTO(setupChannel(comm, c, rank, nranks, rings+c*nranks), ret, fail);
-    if (comm->nRanks == 1) continue;
-    NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, 1, &channel->ring.prev, 1, &channel->ring.next, 0), ret, fail);
   }
-  NCCLCHECKGOTO(ncclTransportP2pSetup(comm, &ringGraph, 0, &highestTransportType, &needsProxy), ret, fail);
-  mscclNeedsProxy |= needsProxy;
-  if (ringGraph.nIntraChannels && rcclParamP2pNetDisable() == 0) {
-    comm->useIntraNet = 1;
-    // Connect NET for intranode use
-    for (int c=0; c<comm->nChannels; c++) {
-      struct ncclChannel* channel = comm->channels+c;
-      if (comm->nRanks == 1) continue;
-      NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, 1, &channel->ring.prev, 1, &channel->ring.next, NCCL_CONN_IDX_P2P_NET), ret, fail);
-    }
-    NCCLCHECKGOTO(ncclTransportP2pSetup(comm, &ringGraph, NCCL_CONN_IDX_P2P_NET), ret, fail);
+  if (ringGraph.nIntraChannels && rcclParamP2pNetDisable() == 0) comm->useIntraNet = 1;
+  if (comm->runtimeConnect) {
+    // Keep the graphs as reduced over the ranks, those are what the transports get selected with
+    memcpy(comm->graphs+ringGraph.id, &ringGraph, sizeof(struct ncclTopoGraph));
+    memcpy(comm->graphs+treeGraph.id, &treeGraph, sizeof(struct ncclTopoGraph));
+    INFO(NCCL_INIT, "Runtime connect enabled: rings and trees are connected by the first collective using them");
+  } else if (comm->nRanks > 1) {
+    NCCLCHECKGOTO(connectRings(comm, &ringGraph, &highestTransportType, &needsProxy), ret, fail);
+    mscclNeedsProxy |= needsProxy;
+    INFO(NCCL_INIT, "Connected all rings comm %p nRanks %02d busId %lx", comm, comm->nRanks, comm->busId);
   }
-  INFO(NCCL_INIT, "Connected all rings comm %p nRanks %02d busId %lx", comm, comm->nRanks, comm->busId);
+  INIT_PHASE_END(ncclInitPhaseConnectRings);
 
   // Connect Trees
-  for (int c=0; c<comm->nChannels; c++) {
-    struct ncclChannel* channel = comm->channels+c;
-    if (comm->nRanks == 1) continue;
-    NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, NCCL_MAX_TREE_ARITY, channel->tree.down, 1, &channel->tree.up, 0), ret, fail);
-    NCCLCHECKGOTO(ncclTransportP2pConnect(comm, c, 1, &channel->tree.up, NCCL_MAX_TREE_ARITY, channel->tree.down, 0), ret, fail);
+  if (!comm->runtimeConnect && comm->nRanks > 1) {
+    NCCLCHECKGOTO(connectTrees(comm, &treeGraph, &highestTransportType, &needsProxy), ret, fail);
+    mscclNeedsProxy |= needsProxy;
+    INFO(NCCL_INIT, "Connected all trees");
   }
-  NCCLCHECKGOTO(ncclTransportP2pSetup(comm, &treeGraph, 0, &highestTransportType, &needsProxy), ret, fail);
-  mscclNeedsProxy |= needsProxy;
-  INFO(NCCL_INIT, "Connected all trees");
+  INIT_PHASE_END(ncclInitPhaseConnectTrees);
 
   // Setup NVLS
   NCCLCHECKGOTO(ncclNvlsSetup(comm, parent), ret, fail);
@@ -1459,55 +1919,18 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 #endif
 
   TRACE(NCCL_INIT, "rank %d nranks %d - CONNECTED %d RINGS AND TREES", rank, nranks, comm->nChannels);
+  INIT_PHASE_END(ncclInitPhaseConnectOther);
 
   // Compute time models for algorithm and protocol combinations
   NCCLCHECKGOTO(ncclTopoTuneModel(comm, comm->minCompCap, comm->maxCompCap, graphs), ret, fail);
+  NCCLCHECKGOTO(ncclTunerInit(comm), ret, fail);
+  NCCLCHECKGOTO(ncclBwReportInit(comm), ret, fail);
+  NCCLCHECKGOTO(ncclTunerPluginLoad(comm, &ringGraph), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseTuning);
 
   INFO(NCCL_INIT, "%d coll channels, %d nvls channels, %d p2p channels, %d p2p channels per peer", comm->nChannels, comm->nvlsChannels, comm->p2pnChannels, comm->p2pnChannelsPerPeer);
 
-  do { // Setup p2p structures in comm->tasks
-    struct ncclTasks* tasks = &comm->tasks;
-    int node = comm->node;
-    int nNodes = comm->nNodes;
-    struct ncclNodeRanks *nodeRanks = comm->nodeRanks;
-    int localRank = comm->localRank;
-    // We want to fuse along node boundaries. Make sure nsteps is a multiple or divides 8.
-    int steps = ALIGN_POWER(comm->maxLocalRanks, NCCL_MAX_WORK_ELEMENTS_P2P/2);
-    tasks->p2pOrderSteps = comm->nNodes * steps;
-    tasks->peers = ncclMemoryStackAlloc<ncclTasks::Peer>(&comm->memPermanent, tasks->p2pOrderSteps);
-    tasks->p2pSendOrder = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
-    tasks->p2pRecvOrder = ncclMemoryStackAlloc<int>(&comm->memPermanent, tasks->p2pOrderSteps);
-    int i=0;
-    // schedule delta 0, +1, -1, +2, -2, ...
-    // also make sure we don't do 0 twice, nor +n/2 and -n/2 if n is even.
-    for (int d=0; d <= nNodes/4; d++) {
-      int deltas[4] = { d, (nNodes-d)%nNodes, nNodes/2-d, (nNodes-(nNodes/2-d))%nNodes };
-      int index = 0;
-      int delta = deltas[index];
-    sched_delta:
-      int recvNode = (node+nNodes-delta)%nNodes;
-      int sendNode = (node+delta)%nNodes;
-      for (int step=0; step < steps; step++) {
-        int recvIndex = (localRank-step+steps)%steps;
-	int recvRank = recvIndex < nodeRanks[recvNode].localRanks ? nodeRanks[recvNode].localRankToRank[recvIndex] : -1;
-        tasks->p2pRecvOrder[i] = recvRank;
-        int sendIndex = (localRank+step)%steps;
-        int sendRank = sendIndex < nodeRanks[sendNode].localRanks ? nodeRanks[sendNode].localRankToRank[sendIndex] : -1;
-        tasks->p2pSendOrder[i] = sendRank;
-        i++;
-      }
-      index++;
-      if (index == 1 && deltas[1] == deltas[0]) index++;
-      if (index == 2 && deltas[2] == deltas[0]) index++;
-      if (index == 3 && deltas[3] == deltas[2]) index++;
-      if (index == 3 && deltas[3] == deltas[1]) index++;
-      if (index < 4) {
-        delta = deltas[index];
-        goto sched_delta;
-      }
-    }
-    assert(i == tasks->p2pOrderSteps);
-  } while (0);
+  NCCLCHECKGOTO(setupP2pSchedule(comm), ret, fail);
 
   if (ncclParamNvbPreconnect()) {
     // Connect p2p when using NVB path
@@ -1518,13 +1941,13 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
       int channelId;
       for (int c=0; c<comm->p2pnChannelsPerPeer; c++) {
         NCCLCHECKGOTO(ncclChannelCompute(comm, peer, c, ncclFuncSend, &channelId), ret, fail);
-        if (comm->channels[channelId].peers[peer]->send[1].connected == 0) {
+        if (!ncclChannelPeerConnected(comm->channels+channelId, peer, true, 1)) {
           comm->connectSend[peer] |= (1UL<<channelId);
         }
       }
       for (int c=0; c<comm->p2pnChannelsPerPeer; c++) {
         NCCLCHECKGOTO(ncclChannelCompute(comm, peer, c, ncclFuncRecv, &channelId), ret, fail);
-        if (comm->channels[channelId].peers[peer]->recv[1].connected == 0) {
+        if (!ncclChannelPeerConnected(comm->channels+channelId, peer, false, 1)) {
           comm->connectRecv[peer] |= (1UL<<channelId);
         }
       }
@@ -1567,8 +1990,11 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
 
   // Call devCommSetup before the last barrier, making sure we don't have a thread running in front and starting to
   // launch NCCL kernels before all cuda mem allocation is complete. That could cause a deadlock.
+  INIT_PHASE_END(ncclInitPhaseProxyConnect);
   NCCLCHECKGOTO(devCommSetup(comm), ret, fail);
+  INIT_PHASE_END(ncclInitPhaseDevComm);
   if (mscclEnabled()) {
+    ncclMemScope mscclScope(nullptr, ncclMemTagMsccl);
     NCCLCHECK(mscclInit(comm));
     mscclStatus& status = mscclGetStatus();
     status.needsProxy |= mscclNeedsProxy;
@@ -1580,8 +2006,12 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, struct ncclComm* p
   // We should have allocated all buffers, collective fifos, ... we can
   // restore the affinity.
   TRACE(NCCL_INIT, "rank %d nranks %d - DONE", rank, nranks);
+  INIT_PHASE_END(ncclInitPhaseFinish);
 
 exit:
+  // Searches left running when failing early still use the graphs on our stack
+  ncclTopoSearchWait(&nvlsJob);
+  ncclTopoSearchWait(&collNetJob);
   if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &affinitySave);
   /* If split resource is shared, we are not able to unlink the proxy ops pool here since the child comm can
    * attach the proxy ops pool of parent at any time; otherwise, unlink it here to make sure the pool will be
@@ -1623,14 +2053,27 @@ struct ncclCommInitRankAsyncJob {
   // for ncclCommSplit
   struct ncclComm* parent;
   int color, key;
+  // for ncclCommShrink, sorted parent ranks left out of the child
+  int* excludeRanks;
+  int excludeCount;
 };
 
+static void commInitJobFree(void* job_) {
+  struct ncclCommInitRankAsyncJob* job = (struct ncclCommInitRankAsyncJob*)job_;
+  free(job->excludeRanks);
+  free(job);
+}
+
 struct ncclCommFinalizeAsyncJob {
   struct ncclAsyncJob base;
   ncclComm_t comm;
 };
 
 NCCL_PARAM(CommSplitShareResources, "COMM_SPLIT_SHARE_RESOURCES", NCCL_CONFIG_UNDEF_INT);
+RCCL_PARAM(NetCompress, "NET_COMPRESS", 0); // Default of the netCompress config attribute
+RCCL_PARAM(CommPriority, "COMM_PRIORITY", 0); // Default of the priority config attribute
+RCCL_PARAM(CommMemoryCapMB, "COMM_MEMORY_CAP_MB", 0); // Default of the memoryCapMB config attribute
+RCCL_PARAM(LowPriorityMaxCTAs, "LOW_PRIORITY_MAX_CTAS", 0); // Default maxCTAs of low priority comms, 0 for no limit
 
 static ncclResult_t commGetSplitInfo(struct ncclComm* comm, struct ncclComm* parent, int color, int key, int* nRanksRet, int* myRankRet, int* parentRanksRet) {
   int* colors = NULL;
@@ -1678,6 +2121,138 @@ fail:
   goto exit;
 }
 
+// Survivors of ncclCommShrink keep their order. They all know the exclude list, so unlike a split
+// this needs no allgather over the parent, in which the excluded ranks could not take part.
+static void commGetShrinkInfo(struct ncclComm* parent, const int* excludeRanks, int excludeCount, int* nRanksRet, int* myRankRet, int* parentRanksRet) {
+  int nRanks = 0, e = 0;
+  for (int i = 0; i < parent->nRanks; i++) {
+    while (e < excludeCount && excludeRanks[e] < i) e++;
+    if (e < excludeCount && excludeRanks[e] == i) continue;
+    if (i == parent->rank) *myRankRet = nRanks;
+    parentRanksRet[nRanks++] = i;
+  }
+  *nRanksRet = nRanks;
+}
+
+RCCL_PARAM(InitProfile, "INIT_PROFILE", 1); // Gather the init phase times over the ranks, rank 0 prints them
+
+static ncclResult_t initProfileReport(struct ncclComm* comm) {
+  double* times;
+  int nranks = comm->nRanks;
+  for (int p=0; p<ncclInitPhaseNum; p++) comm->initProfile[p][1] = comm->initProfile[p][2] = comm->initProfile[p][3] = -1;
+  if (rcclParamInitProfile() == 0) return ncclSuccess;
+
+  NCCLCHECK(ncclCalloc(&times, (size_t)nranks*ncclInitPhaseNum));
+  for (int p=0; p<ncclInitPhaseNum; p++) times[comm->rank*ncclInitPhaseNum+p] = comm->initProfile[p][0];
+  ncclResult_t ret = bootstrapAllGather(comm->bootstrap, times, ncclInitPhaseNum*sizeof(double));
+  if (ret != ncclSuccess) goto exit;
+  for (int p=0; p<ncclInitPhaseNum; p++) {
+    double minTime = times[p], maxTime = times[p], sum = 0;
+    int maxRank = 0;
+    for (int r=0; r<nranks; r++) {
+      double t = times[r*ncclInitPhaseNum+p];
+      minTime = std::min(minTime, t);
+      if (t > maxTime) { maxTime = t; maxRank = r; }
+      sum += t;
+    }
+    comm->initProfile[p][1] = minTime;
+    comm->initProfile[p][2] = sum/nranks;
+    comm->initProfile[p][3] = maxTime;
+    if (comm->rank == 0) {
+      INFO(NCCL_INIT, "Init profile %-14s min %9.2f avg %9.2f max %9.2f ms (rank %d) comm %p nRanks %02d",
+          initPhaseNames[p], minTime, sum/nranks, maxTime, maxRank, comm, nranks);
+    }
+  }
+exit:
+  free(times);
+  return ret;
+}
+
+NCCL_API(ncclResult_t, ncclCommGetInitProfile, const ncclComm_t comm, ncclInitPhase_t phase, double* localMs,
+    double* minMs, double* avgMs, double* maxMs);
+ncclResult_t ncclCommGetInitProfile(const ncclComm_t comm, ncclInitPhase_t phase, double* localMs,
+    double* minMs, double* avgMs, double* maxMs) {
+  NCCLCHECK(PtrCheck(comm, "CommGetInitProfile", "comm"));
+  if (comm->initState != ncclSuccess) return comm->initState;
+  if (phase < 0 || phase >= ncclInitPhaseNum) {
+    WARN("CommGetInitProfile : invalid phase %d", phase);
+    return ncclInvalidArgument;
+  }
+  if (localMs) *localMs = comm->initProfile[phase][0];
+  if (minMs) *minMs = comm->initProfile[phase][1];
+  if (avgMs) *avgMs = comm->initProfile[phase][2];
+  if (maxMs) *maxMs = comm->initProfile[phase][3];
+  return ncclSuccess;
+}
+
+static_assert(NCCL_NUM_ALGORITHMS <= NCCL_STATS_MAX_ALGORITHMS && NCCL_NUM_PROTOCOLS <= NCCL_STATS_MAX_PROTOCOLS,
+  "ncclCollStats_t::algoProto too small");
+
+NCCL_API(ncclResult_t, ncclCommGetStats, const ncclComm_t comm, ncclCommStats_t* stats);
+ncclResult_t ncclCommGetStats(const ncclComm_t comm, ncclCommStats_t* stats) {
+  NCCLCHECK(PtrCheck(comm, "CommGetStats", "comm"));
+  NCCLCHECK(PtrCheck(stats, "CommGetStats", "stats"));
+  if (comm->initState != ncclSuccess) return comm->initState;
+  if (stats->version < 1 || stats->version > NCCL_COMM_STATS_VERSION) {
+    WARN("CommGetStats : unsupported version %u, expected at most %d", stats->version, NCCL_COMM_STATS_VERSION);
+    return ncclInvalidArgument;
+  }
+  uint64_t ticks[MAXCHANNELS][ncclStatsNumClasses] = {};
+  if (comm->statsTicks) {
+    // Not on the null stream, which would wait for a resident kernel
+    CUDACHECK(cudaMemcpyAsync(ticks, comm->statsTicks, sizeof(ticks), cudaMemcpyDeviceToHost, comm->sideStream));
+    CUDACHECK(cudaStreamSynchronize(comm->sideStream));
+  }
+  for (int k=0; k < ncclStatsNumClasses; k++) {
+    ncclCollStats_t* out = stats->colls+k;
+    memset(out, 0, sizeof(*out));
+    out->calls = comm->stats[k].calls;
+    out->bytes = comm->stats[k].bytes;
+    for (int a=0; a < NCCL_NUM_ALGORITHMS; a++) {
+      for (int p=0; p < NCCL_NUM_PROTOCOLS; p++) out->algoProto[a][p] = comm->stats[k].algoProto[a][p];
+    }
+    uint64_t busiest = 0;
+    for (int c=0; c < MAXCHANNELS; c++) busiest = std::max(busiest, ticks[c][k]);
+    out->deviceTimeUs = comm->statsTicks ? busiest*1.0E3/comm->statsClockKhz : 0;
+  }
+  if (stats->version >= 2) {
+    stats->persistentPlans = comm->persistentRefs;
+    stats->persistentWorkBytes = comm->statsPersistentWorkBytes;
+    stats->registeredPeerBuffers = comm->statsRegisteredPeerBuffers;
+  }
+  if (stats->version >= 3) {
+    struct ncclDevArena* arena = &comm->sharedRes->devArena;
+    pthread_mutex_lock(&arena->lock);
+    stats->arenaSlabs = arena->nSlabs;
+    stats->arenaSlabBytes = arena->slabBytes;
+    stats->arenaUsedBytes = arena->usedBytes;
+    pthread_mutex_unlock(&arena->lock);
+  }
+  if (stats->version >= 4) {
+    stats->planPoolHits = comm->planPoolHits;
+    stats->planPoolMisses = comm->planPoolMisses;
+    stats->proxyOpPoolHits = comm->proxyOpPoolHits;
+    stats->proxyOpPoolMisses = comm->proxyOpPoolMisses;
+    stats->workListPoolHits = comm->workListPoolHits;
+    stats->workListPoolMisses = comm->workListPoolMisses;
+  }
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommGetMemUsage, const ncclComm_t comm, ncclMemUsage_t* usage);
+ncclResult_t ncclCommGetMemUsage(const ncclComm_t comm, ncclMemUsage_t* usage) {
+  NCCLCHECK(PtrCheck(comm, "CommGetMemUsage", "comm"));
+  NCCLCHECK(PtrCheck(usage, "CommGetMemUsage", "usage"));
+  if (comm->initState != ncclSuccess) return comm->initState;
+  struct ncclMemUsage* memUsage = &comm->sharedRes->memUsage;
+  for (int t=0; t < NCCL_MEM_MAX_TAGS; t++) {
+    usage->device[t] = __atomic_load_n(&memUsage->bytes[ncclMemDevice][t], __ATOMIC_RELAXED);
+    usage->hostPinned[t] = __atomic_load_n(&memUsage->bytes[ncclMemHostPinned][t], __ATOMIC_RELAXED);
+    usage->host[t] = __atomic_load_n(&memUsage->bytes[ncclMemHost][t], __ATOMIC_RELAXED);
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
   struct ncclCommInitRankAsyncJob* job = (struct ncclCommInitRankAsyncJob*)job_;
   ncclComm_t comm = job->comm;
@@ -1688,6 +2263,8 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
   int* parentRanks = NULL;
   int cudaArch;
   int64_t stackSize = rcclParamStackSizeOverride() ? rcclParamStackSizeOverride() : maxLocalSizeBytes;
+  uint64_t bootstrapStart;
+  uint64_t initStart = clockNano();
 
   CUDACHECKGOTO(cudaSetDevice(cudaDev), res, fail);
   CUDACHECKGOTO(cudaDeviceGetAttribute(&archMajor, cudaDevAttrComputeCapabilityMajor, cudaDev), res, fail);
@@ -1704,18 +2281,29 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
   }
 #endif
 
+  bootstrapStart = clockNano();
+  comm->initDeviceMs = (bootstrapStart-initStart)/1e6;
   if (job->parent) {
     NCCLCHECKGOTO(ncclCalloc(&parentRanks, job->parent->nRanks), res, fail);
-    NCCLCHECKGOTO(commGetSplitInfo(comm, job->parent, job->color, job->key, &job->nranks, &job->myrank, parentRanks), res, fail);
-    // Negative color does not create a new comm object. We needed to take part in the allgather, but we're done now.
-    if (job->color == NCCL_SPLIT_NOCOLOR) goto exit;
-    snprintf((char*)&job->commId, sizeof(job->commId), "%016lx-%d", job->parent->commHash, job->color);
+    if (job->excludeRanks) {
+      commGetShrinkInfo(job->parent, job->excludeRanks, job->excludeCount, &job->nranks, &job->myrank, parentRanks);
+      snprintf((char*)&job->commId, sizeof(job->commId), "%016lx-x%016lx", job->parent->commHash,
+          getHash((const char*)job->excludeRanks, job->excludeCount*sizeof(int)));
+    } else {
+      NCCLCHECKGOTO(commGetSplitInfo(comm, job->parent, job->color, job->key, &job->nranks, &job->myrank, parentRanks), res, fail);
+      // Negative color does not create a new comm object. We needed to take part in the allgather, but we're done now.
+      if (job->color == NCCL_SPLIT_NOCOLOR) goto exit;
+      snprintf((char*)&job->commId, sizeof(job->commId), "%016lx-%d", job->parent->commHash, job->color);
+    }
     NCCLCHECKGOTO(commAlloc(comm, job->parent, job->nranks, job->myrank), res, fail);
     NCCLCHECKGOTO(bootstrapSplit((struct ncclBootstrapHandle*)&job->commId, comm, job->parent, job->color, job->key, parentRanks), res, fail);
   } else {
     NCCLCHECKGOTO(commAlloc(comm, NULL, job->nranks, job->myrank), res, fail);
     NCCLCHECKGOTO(bootstrapInit((struct ncclBootstrapHandle*)&job->commId, comm), res, fail);
   }
+  comm->initPhaseStart = clockNano();
+  comm->initProfile[ncclInitPhaseBootstrap][0] = (comm->initPhaseStart-bootstrapStart)/1e6;
+  __atomic_store_n(&comm->initPhase, ncclInitPhaseAllGather1, __ATOMIC_RELEASE);
 
   comm->cudaArch = cudaArch;
   comm->commHash = getHash(job->commId.internal, NCCL_UNIQUE_ID_BYTES);
@@ -1723,16 +2311,25 @@ static ncclResult_t ncclCommInitRankFunc(struct ncclAsyncJob* job_) {
   INFO(NCCL_INIT,"comm %p rank %d nranks %d cudaDev %d busId %lx commId 0x%llx - Init START", comm, comm->rank, comm->nRanks, comm->cudaDev, comm->busId, (unsigned long long)hashUniqueId(job->commId));
 
   NCCLCHECKGOTO(initTransportsRank(comm, job->parent), res, fail);
+  NCCLCHECKGOTO(initProfileReport(comm), res, fail);
+  NCCLCHECKGOTO(ncclWatchdogInit(comm), res, fail);
+  NCCLCHECKGOTO(ncclClockSyncInit(comm), res, fail);
 
   // update communicator state
+  comm->initTotalMs = (clockNano()-initStart)/1e6;
   comm->initState = ncclSuccess;
 
   // Trace this call for replay tool
   if (job->parent) {
     /* unlink child abort flag. */
     __atomic_store_n(&job->parent->childAbortFlag, NULL, __ATOMIC_RELEASE);
-    TRACE_CALL("ncclCommSplit(%p, %d, %d, %p, %d, %d)",
-                job->parent, job->color, job->key, comm, comm->rank, comm->nRanks);
+    if (job->excludeRanks) {
+      TRACE_CALL("ncclCommShrink(%p, %d, %p, %d, %d)",
+                  job->parent, job->excludeCount, comm, comm->rank, comm->nRanks);
+    } else {
+      TRACE_CALL("ncclCommSplit(%p, %d, %d, %p, %d, %d)",
+                  job->parent, job->color, job->key, comm, comm->rank, comm->nRanks);
+    }
   } else {
     TRACE_CALL("ncclCommInitRank(%p, %d, 0x%llx, %d, %d)",
                 comm, comm->nRanks, (unsigned long long)hashUniqueId(job->commId), comm->rank, comm->cudaDev);
@@ -1899,13 +2496,49 @@ static ncclResult_t parseCommConfig(ncclComm_t comm, ncclConfig_t *config) {
     goto fail;
   }
 
+  if (internalConfigPtr->trafficClass != NCCL_CONFIG_UNDEF_INT && (internalConfigPtr->trafficClass < 0 || internalConfigPtr->trafficClass > 255)) {
+    WARN("Invalid config trafficClass attribute value %d", internalConfigPtr->trafficClass);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->serviceLevel != NCCL_CONFIG_UNDEF_INT && (internalConfigPtr->serviceLevel < 0 || internalConfigPtr->serviceLevel > 15)) {
+    WARN("Invalid config serviceLevel attribute value %d", internalConfigPtr->serviceLevel);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->netCompress != NCCL_CONFIG_UNDEF_INT && internalConfigPtr->netCompress != 0 && internalConfigPtr->netCompress != 1) {
+    WARN("Invalid config netCompress attribute value %d", internalConfigPtr->netCompress);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->priority != NCCL_CONFIG_UNDEF_INT && (internalConfigPtr->priority < -1 || internalConfigPtr->priority > 1)) {
+    WARN("Invalid config priority attribute value %d", internalConfigPtr->priority);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
+  if (internalConfigPtr->memoryCapMB != NCCL_CONFIG_UNDEF_INT && internalConfigPtr->memoryCapMB < 0) {
+    WARN("Invalid config memoryCapMB attribute value %d", internalConfigPtr->memoryCapMB);
+    ret = ncclInvalidArgument;
+    goto fail;
+  }
+
   /* default config value can be tuned on different platform. */
   NCCL_CONFIG_DEFAULT(internalConfigPtr, blocking, NCCL_CONFIG_UNDEF_INT, 1, "Blocking", "%d");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, cgaClusterSize, NCCL_CONFIG_UNDEF_INT, 4, "CGA cluster size", "%d");
+  NCCL_CONFIG_DEFAULT(internalConfigPtr, priority, NCCL_CONFIG_UNDEF_INT, std::min(std::max((int)rcclParamCommPriority(), -1), 1), "Priority", "%d");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, minCTAs, NCCL_CONFIG_UNDEF_INT, 1, "Min CTAs", "%d");
-  NCCL_CONFIG_DEFAULT(internalConfigPtr, maxCTAs, NCCL_CONFIG_UNDEF_INT, MAXCHANNELS, "Max CTAs", "%d");
+  // Low priority comms leave CUs to the others, unless told how many CTAs to use
+  NCCL_CONFIG_DEFAULT(internalConfigPtr, maxCTAs, NCCL_CONFIG_UNDEF_INT,
+      internalConfigPtr->priority < 0 && rcclParamLowPriorityMaxCTAs() > 0 ?
+      std::max((int)rcclParamLowPriorityMaxCTAs(), internalConfigPtr->minCTAs) : MAXCHANNELS, "Max CTAs", "%d");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, netName, NCCL_CONFIG_UNDEF_PTR, NULL, "Net name", "%s");
   NCCL_CONFIG_DEFAULT(internalConfigPtr, splitShare, NCCL_CONFIG_UNDEF_INT, 0, "Split share", "%d");
+  NCCL_CONFIG_DEFAULT(internalConfigPtr, netCompress, NCCL_CONFIG_UNDEF_INT, rcclParamNetCompress(), "Net compress", "%d");
+  NCCL_CONFIG_DEFAULT(internalConfigPtr, memoryCapMB, NCCL_CONFIG_UNDEF_INT, std::max((int)rcclParamCommMemoryCapMB(), 0), "Memory cap MB", "%d");
 
   /* assign config to communicator */
   comm->config.blocking = internalConfigPtr->blocking;
@@ -1914,6 +2547,12 @@ static ncclResult_t parseCommConfig(ncclComm_t comm, ncclConfig_t *config) {
   comm->config.maxCTAs = internalConfigPtr->maxCTAs;
   comm->config.netName = internalConfigPtr->netName;
   comm->config.splitShare = internalConfigPtr->splitShare;
+  // Left undefined, the network uses its own defaults (NCCL_IB_TC/NCCL_IB_SL)
+  comm->config.trafficClass = internalConfigPtr->trafficClass;
+  comm->config.serviceLevel = internalConfigPtr->serviceLevel;
+  comm->config.netCompress = internalConfigPtr->netCompress;
+  comm->config.priority = internalConfigPtr->priority;
+  comm->config.memoryCapMB = internalConfigPtr->memoryCapMB;
 
   NCCLCHECKGOTO(envConfigOverride(comm), ret, fail);
 
@@ -2011,6 +2650,7 @@ ncclResult_t ncclCommInitAll(ncclComm_t* comms, int ndev, const int* devlist) {
   int totalnDev;
   int *gpuFlags = NULL;
   ncclConfig_t config = NCCL_CONFIG_INITIALIZER;
+  uint64_t initAllStart;
 
   constexpr nvtxPayloadSchemaEntry_t CommInitAllSchema[] = {
     {0, NVTX_PAYLOAD_ENTRY_TYPE_INT, "No. of devices"}
@@ -2051,6 +2691,7 @@ ncclResult_t ncclCommInitAll(ncclComm_t* comms, int ndev, const int* devlist) {
 
   ncclUniqueId uniqueId;
   NCCLCHECKGOTO(ncclGetUniqueId(&uniqueId), ret, fail);
+  initAllStart = clockNano();
   NCCLCHECKGOTO(ncclGroupStart(), ret, fail);
   for (int i=0; i<ndev; i++) {
     // Ignore return codes .. we need to call ncclGroupEnd to clean up anyway
@@ -2058,6 +2699,14 @@ ncclResult_t ncclCommInitAll(ncclComm_t* comms, int ndev, const int* devlist) {
   }
   NCCLCHECKGOTO(ncclGroupEnd(), ret, fail);
 
+  // Each device is initialized by its own thread of the group, the total is close to the
+  // slowest device when they do not serialize each other
+  for (int i=0; i<ndev; i++) {
+    INFO(NCCL_INIT, "CommInitAll : rank %d cudaDev %d init %.2f ms (device setup %.2f ms)",
+        i, comms[i]->cudaDev, comms[i]->initTotalMs, comms[i]->initDeviceMs);
+  }
+  INFO(NCCL_INIT, "CommInitAll : %d devices initialized in %.2f ms", ndev, (clockNano()-initAllStart)/1e6);
+
 fail:
   free(gpuFlags);
   return ret;
@@ -2119,9 +2768,11 @@ static ncclResult_t commDestroySync(struct ncclAsyncJob* job_) {
     NCCLCHECKGOTO(ncclStrongStreamSynchronize(&comm->sharedRes->hostStream), ret, fail);
     NCCLCHECKGOTO(ncclStrongStreamSynchronize(&comm->sharedRes->deviceStream), ret, fail);
   }
+  // Cached graphs hold persistent plans referencing us.
+  NCCLCHECKGOTO(ncclAutoGraphDestroy(comm), ret, fail);
   NCCLCHECKGOTO(ncclCommPollCallbacks(comm, false), ret, fail);
   // And keep polling until all graphs referencing us die.
-  while (comm->persistentRefs != 0) {
+  while (comm->persistentRefs != 0 || comm->capturedBuffers != nullptr) {
     NCCLCHECKGOTO(ncclCommPollCallbacks(comm, /*waitSome=*/true), ret, fail);
   }
 
@@ -2152,6 +2803,10 @@ static ncclResult_t commCleanup(ncclComm_t comm) {
   }
 
 #if defined(ENABLE_NPKIT)
+  // Comms of the process may be cleaned up concurrently by commReclaim
+  static std::mutex npkitMutex;
+  std::lock_guard<std::mutex> lock(npkitMutex);
+  NCCLCHECK(NpKit::ExportTrace());
   // Dump NPKit events and shutdown
   const char* npkitDumpDir = getenv("NPKIT_DUMP_DIR");
   if (npkitDumpDir == nullptr) {
@@ -2161,12 +2816,65 @@ static ncclResult_t commCleanup(ncclComm_t comm) {
   }
   NCCLCHECK(NpKit::Shutdown());
 #endif
+  NCCLCHECK(ncclCallRecordFinalize());
+  NCCLCHECK(ncclHwCountersFinalize());
+  NCCLCHECK(ncclChromeTraceFinalize());
+  return ncclSuccess;
+}
 
-  if (mscclEnabled()) {
-    NCCLCHECK(mscclTeardown());
+RCCL_PARAM(ParallelTeardown, "PARALLEL_TEARDOWN", 1);
+
+// One teardown step of commReclaim applied to an intra-process comm, on a helper thread
+struct ncclTeardownJob {
+  pthread_t thread;
+  ncclComm_t comm;
+  int rank;
+  int cudaDev;
+  ncclResult_t (*func)(ncclComm_t comm);
+  ncclResult_t result;
+  int started;
+};
+
+static void* ncclTeardownThread(void* arg) {
+  struct ncclTeardownJob* job = (struct ncclTeardownJob*)arg;
+  job->result = job->func(job->comm);
+  return NULL;
+}
+
+// Applies func to all comms of the process and waits for it to complete on all of them. Each step
+// only releases resources of its own comm, so with RCCL_PARALLEL_TEARDOWN it runs on one thread per
+// comm and the GPUs synchronize, close their connections and free their memory at the same time.
+// Returns the last error, like the serial loops did.
+static ncclResult_t commReclaimStep(struct ncclTeardownJob* jobs, int nJobs, ncclResult_t (*func)(ncclComm_t), const char* step) {
+  ncclResult_t ret = ncclSuccess;
+  bool parallel = rcclParamParallelTeardown() && nJobs > 1;
+  for (int i = 0; i < nJobs; i++) {
+    struct ncclTeardownJob* job = jobs+i;
+    job->func = func;
+    job->started = 0;
+    if (parallel && pthread_create(&job->thread, NULL, ncclTeardownThread, job) == 0) {
+      ncclSetThreadName(job->thread, "NCCL Teardown %2d", job->cudaDev);
+      job->started = 1;
+    } else {
+      job->result = func(job->comm);
+    }
   }
+  for (int i = 0; i < nJobs; i++) {
+    struct ncclTeardownJob* job = jobs+i;
+    if (job->started) pthread_join(job->thread, NULL);
+    if (job->result != ncclSuccess) {
+      WARN("commReclaim: comm %p (rank = %d) failed to %s in destroy/abort, error %d", job->comm, job->rank, step, job->result);
+      ret = job->result;
+    }
+  }
+  return ret;
+}
 
-  return ncclSuccess;
+static ncclResult_t commDestroySyncStep(ncclComm_t comm) {
+  if (comm->finalizeCalled) return ncclSuccess;
+  struct ncclCommFinalizeAsyncJob job;
+  job.comm = comm;
+  return commDestroySync((struct ncclAsyncJob*) &job);
 }
 
 static ncclResult_t commFinalize(ncclComm_t comm, bool userCalled) {
@@ -2223,7 +2931,6 @@ fail:
 static ncclResult_t commReclaim(ncclComm_t comm) {
   ncclResult_t ret = ncclSuccess;
   ncclResult_t state;
-  int curRank; /* Debug info */
 
   NCCLCHECKGOTO(ncclCommGetAsyncError(comm, &state), ret, fail);
   TRACE(NCCL_INIT, "commReclaim: reclaim comm %p rank %d state %d", comm, comm->rank, state);
@@ -2242,27 +2949,24 @@ static ncclResult_t commReclaim(ncclComm_t comm) {
     assert(intracomm0 != NULL && finalizeRankCnt != NULL);
     curRankCnt = __atomic_add_fetch(finalizeRankCnt, 1, __ATOMIC_ACQ_REL);
     if (curRankCnt == intraRanks) {
-      ncclComm_t curIntraComm;
-      ncclComm_t nextIntraComm = intracomm0;
+      struct ncclTeardownJob* jobs = NULL;
+      int nJobs = 0;
+      uint64_t start = clockNano();
+      NCCLCHECKGOTO(ncclCalloc(&jobs, intraRanks), ret, fail);
+      for (ncclComm_t c = intracomm0; c && nJobs < intraRanks; c = c->intraNext) {
+        jobs[nJobs].comm = c;
+        jobs[nJobs].rank = c->rank;
+        jobs[nJobs].cudaDev = c->cudaDev;
+        nJobs++;
+      }
 
       /* this is  the last call to ncclCommDestroy/Abort, we need to make sure all comms
-       * in the process have been finalized before we free local resources. */
-      while (nextIntraComm) {
-        curIntraComm = nextIntraComm;
-        curRank = curIntraComm->rank;
-        nextIntraComm = nextIntraComm->intraNext;
-
-        if (curIntraComm->finalizeCalled == false) {
-          struct ncclCommFinalizeAsyncJob job;
-          job.comm = curIntraComm;
-          /* every comm aborts, commDestroySync should not be blocked. */
-          if ((ret = commDestroySync((struct ncclAsyncJob*) &job)) != ncclSuccess)
-            WARN("commReclaim: comm %p (rank = %d) in abort, error %d", curIntraComm, curRank, ret);
-        }
-      }
+       * in the process have been finalized before we free local resources.
+       * every comm aborts, commDestroySync should not be blocked. */
+      ret = commReclaimStep(jobs, nJobs, commDestroySyncStep, "synchronize");
 
-      /* ncclProxyStop() loop must be put after commDestroySync() loop. Namely, you cannot do:
-       *  while(...) {
+      /* ncclProxyStop() step must be put after commDestroySync() step. Namely, you cannot do:
+       *  for each comm {
        *     commDestroySync(...);
        *     ncclProxyStop(...);
        *  }
@@ -2272,29 +2976,23 @@ static ncclResult_t commReclaim(ncclComm_t comm) {
        * This is not a problem for multi-process case, since intermediate memory is opened by CUDA IPC
        * or mmap where memory free is guarded by CUDA driver and operating system, so we will not have
        * invalid memory access issue. */
-      nextIntraComm = intracomm0;
-      while (nextIntraComm) {
-        curIntraComm = nextIntraComm;
-        curRank = curIntraComm->rank;
-        nextIntraComm = nextIntraComm->intraNext;
-
-        /* free intraprocess proxy resources. */
-        if ((ret = ncclProxyStop(curIntraComm)) != ncclSuccess) {
-          WARN("commReclaim: comm %p (rank = %d) destroys proxy resource error %d", curIntraComm, curRank, ret);
-        }
-      }
+      ncclResult_t stepRet = commReclaimStep(jobs, nJobs, ncclProxyStop, "destroy proxy resources");
+      if (stepRet != ncclSuccess) ret = stepRet;
 
       /* free local resources. */
-      nextIntraComm = intracomm0;
-      while (nextIntraComm) {
-        curIntraComm = nextIntraComm;
-        curRank = curIntraComm->rank;
-        nextIntraComm = nextIntraComm->intraNext;
-
-        if ((ret = commCleanup(curIntraComm)) != ncclSuccess) {
-          WARN("commReclaim: cleanup comm %p rank %d failed in destroy/abort, error %d", curIntraComm, curRank, ret);
+      stepRet = commReclaimStep(jobs, nJobs, commCleanup, "clean up");
+      if (stepRet != ncclSuccess) ret = stepRet;
+
+      /* MSCCL keeps state local to the calling thread */
+      for (int i = 0; i < nJobs && mscclEnabled(); i++) {
+        if ((stepRet = mscclTeardown()) != ncclSuccess) {
+          WARN("commReclaim: MSCCL teardown failed in destroy/abort, error %d", stepRet);
+          ret = stepRet;
         }
       }
+      INFO(NCCL_INIT, "commReclaim: %d comms torn down in %.2f ms%s", nJobs, (clockNano()-start)/1e6,
+          rcclParamParallelTeardown() && nJobs > 1 ? " in parallel" : "");
+      free(jobs);
     }
   }
 
@@ -2327,6 +3025,18 @@ ncclResult_t ncclCommDestroy(ncclComm_t comm) {
   /* init thread must be joined before we destroy the comm. */
   NCCLCHECK(ncclCommEnsureReady(comm));
 
+  // Child communicators of the hierarchical allreduce and alltoall, the pairs of nodes first as
+  // they share the resources of the rail communicator
+  if (comm->rabFoldComm) NCCLCHECK(ncclCommDestroy(comm->rabFoldComm));
+  for (int s=0; s<comm->rabSteps; s++) {
+    if (comm->rabStepComms[s]) NCCLCHECK(ncclCommDestroy(comm->rabStepComms[s]));
+    comm->rabStepComms[s] = NULL;
+  }
+  comm->rabFoldComm = NULL;
+  if (comm->hierIntraComm) NCCLCHECK(ncclCommDestroy(comm->hierIntraComm));
+  if (comm->hierRailComm) NCCLCHECK(ncclCommDestroy(comm->hierRailComm));
+  comm->hierIntraComm = comm->hierRailComm = NULL;
+
   NCCLCHECK(commReclaim(comm));
   INFO(NCCL_INIT,"comm %p rank %d nranks %d cudaDev %d busId %lx - Destroy COMPLETE", comm, rank, nranks, cudaDev, busId);
 
@@ -2359,14 +3069,25 @@ ncclResult_t ncclCommAbort(ncclComm_t comm) {
    * and we should ignore the init error here. */
   ncclCommEnsureReady(comm);
 
+  if (comm->rabFoldComm) (void) ncclCommAbort(comm->rabFoldComm);
+  for (int s=0; s<comm->rabSteps; s++) {
+    if (comm->rabStepComms[s]) (void) ncclCommAbort(comm->rabStepComms[s]);
+    comm->rabStepComms[s] = NULL;
+  }
+  comm->rabFoldComm = NULL;
+  if (comm->hierIntraComm) (void) ncclCommAbort(comm->hierIntraComm);
+  if (comm->hierRailComm) (void) ncclCommAbort(comm->hierRailComm);
+  comm->hierIntraComm = comm->hierRailComm = NULL;
+
   (void) commReclaim(comm);
   INFO(NCCL_INIT,"comm %p rank %d nranks %d cudaDev %d busId %lx - Abort COMPLETE", comm, rank, nranks, cudaDev, busId);
 
   return ncclSuccess;
 }
 
-NCCL_API(ncclResult_t, ncclCommSplit, ncclComm_t comm, int color, int key, ncclComm_t *newcomm, ncclConfig_t *config);
-ncclResult_t ncclCommSplit(ncclComm_t comm, int color, int key, ncclComm_t *newcomm, ncclConfig_t *config) {
+// Takes ownership of excludeRanks, which is NULL for a split
+static ncclResult_t commSplitInternal(ncclComm_t comm, int color, int key, int* excludeRanks, int excludeCount,
+    ncclComm_t *newcomm, ncclConfig_t *config) {
   struct ncclCommInitRankAsyncJob *job = NULL;
   struct ncclComm* childComm = NCCL_COMM_NULL;
   ncclResult_t res = ncclSuccess;
@@ -2409,14 +3130,18 @@ ncclResult_t ncclCommSplit(ncclComm_t comm, int color, int key, ncclComm_t *newc
   job->parent = comm;
   job->color = color;
   job->key = key;
+  job->excludeRanks = excludeRanks;
+  job->excludeCount = excludeCount;
+  excludeRanks = NULL;
   job->cudaDev = comm->cudaDev;
-  NCCLCHECKGOTO(ncclAsyncLaunch(&job->base, ncclCommInitRankFunc, NULL, free, comm), res, fail);
+  NCCLCHECKGOTO(ncclAsyncLaunch(&job->base, ncclCommInitRankFunc, NULL, commInitJobFree, comm), res, fail);
 
 exit:
   ncclGroupErrCheck(res);
   NCCLCHECK(ncclGroupEndInternal());
   return res;
 fail:
+  free(excludeRanks);
   if (childComm) {
     if (comm && !comm->config.splitShare) {
       if (childComm->abortFlag) ncclCudaHostFree((void*)childComm->abortFlag);
@@ -2428,6 +3153,76 @@ fail:
   goto exit;
 }
 
+NCCL_API(ncclResult_t, ncclCommSplit, ncclComm_t comm, int color, int key, ncclComm_t *newcomm, ncclConfig_t *config);
+ncclResult_t ncclCommSplit(ncclComm_t comm, int color, int key, ncclComm_t *newcomm, ncclConfig_t *config) {
+  return commSplitInternal(comm, color, key, NULL, 0, newcomm, config);
+}
+
+// Only the survivors call ncclCommShrink. With splitShare on the parent the child reuses its proxy,
+// its connections to the surviving peers and restricts its graphs, so only the ring and tree
+// neighbors that changed are connected.
+NCCL_API(ncclResult_t, ncclCommShrink, ncclComm_t comm, const int* excludeRanks, int excludeCount, ncclComm_t *newcomm, ncclConfig_t *config);
+ncclResult_t ncclCommShrink(ncclComm_t comm, const int* excludeRanks, int excludeCount, ncclComm_t *newcomm, ncclConfig_t *config) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  int* sorted = NULL;
+  int nSorted = 0;
+  NCCLCHECK(PtrCheck(comm, "CommShrink", "comm"));
+  NCCLCHECK(PtrCheck(newcomm, "CommShrink", "newcomm"));
+  if (excludeCount < 0 || (excludeCount > 0 && excludeRanks == NULL)) {
+    WARN("CommShrink : invalid exclude list of %d ranks", excludeCount);
+    return ncclInvalidArgument;
+  }
+  // Sorted without duplicates, so that every survivor derives the same ranks and id
+  NCCLCHECK(ncclCalloc(&sorted, std::max(excludeCount, 1)));
+  for (int i = 0; i < excludeCount; i++) {
+    int r = excludeRanks[i];
+    if (r < 0 || r >= comm->nRanks || r == comm->rank) {
+      WARN("CommShrink : rank %d can not be excluded by rank %d of %d", r, comm->rank, comm->nRanks);
+      free(sorted);
+      return ncclInvalidArgument;
+    }
+    sorted[nSorted++] = r;
+  }
+  std::sort(sorted, sorted+nSorted);
+  nSorted = std::unique(sorted, sorted+nSorted) - sorted;
+  return commSplitInternal(comm, 0, comm->rank, sorted, nSorted, newcomm, config);
+}
+
+// Joining ranks have no connection to reuse and the shared resources of the parent are indexed by
+// its ranks, so the grown communicator goes through a full init. Current ranks keep their rank and
+// the configuration of comm, joining ranks take the ranks from comm's size on.
+NCCL_API(ncclResult_t, ncclCommGrow, ncclComm_t comm, int nranks, ncclUniqueId commId, int rank, ncclComm_t *newcomm, ncclConfig_t *config);
+ncclResult_t ncclCommGrow(ncclComm_t comm, int nranks, ncclUniqueId commId, int rank, ncclComm_t *newcomm, ncclConfig_t *config) {
+  NVTX3_FUNC_RANGE_IN(nccl_domain);
+  int cudaDev;
+  ncclResult_t ret = ncclSuccess;
+  ncclConfig_t internalConfig = NCCL_CONFIG_INITIALIZER;
+  ncclConfig_t *internalConfigPtr = config ? config : &internalConfig;
+  if (comm) {
+    if (nranks < comm->nRanks) {
+      WARN("CommGrow : can not grow a communicator of %d ranks to %d ranks", comm->nRanks, nranks);
+      return ncclInvalidArgument;
+    }
+    rank = comm->rank;
+    cudaDev = comm->cudaDev;
+    if (config == NULL) internalConfigPtr = &comm->config;
+  } else {
+    rocmLibraryInit();
+    CUDACHECK(cudaGetDevice(&cudaDev));
+  }
+  NCCLCHECK(ncclGroupStartInternal());
+  NCCLCHECKGOTO(ncclCommInitRankDev(newcomm, nranks, commId, rank, cudaDev, internalConfigPtr), ret, fail);
+
+exit:
+  ncclGroupErrCheck(ret);
+  NCCLCHECK(ncclGroupEndInternal());
+  if (newcomm && *newcomm && !(*newcomm)->config.blocking) (void) ncclCommGetAsyncError(*newcomm, &ret);
+  return ret;
+fail:
+  if (newcomm && *newcomm && !(*newcomm)->config.blocking) (void) ncclCommSetAsyncError(*newcomm, ret);
+  goto exit;
+}
+
 NCCL_API(const char*, ncclGetErrorString, ncclResult_t code);
 const char* ncclGetErrorString(ncclResult_t code) {
   switch (code) {
@@ -2457,6 +3252,18 @@ ncclResult_t ncclCommGetAsyncError(ncclComm_t comm, ncclResult_t *asyncError) {
   NCCLCHECK(PtrCheck(asyncError, "ncclGetAsyncError", "asyncError"));
 
   *asyncError = __atomic_load_n(&comm->asyncResult, __ATOMIC_ACQUIRE);
+  if (*asyncError == ncclInProgress) {
+    int phase = __atomic_load_n(&comm->initPhase, __ATOMIC_ACQUIRE);
+    if (phase < ncclInitPhaseNum) TRACE(NCCL_INIT, "comm %p rank %d init in progress, phase %s", comm, comm->rank, initPhaseNames[phase]);
+  }
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommGetInitPhase, const ncclComm_t comm, ncclInitPhase_t* phase);
+ncclResult_t ncclCommGetInitPhase(const ncclComm_t comm, ncclInitPhase_t* phase) {
+  NCCLCHECK(PtrCheck(comm, "CommGetInitPhase", "comm"));
+  NCCLCHECK(PtrCheck(phase, "CommGetInitPhase", "phase"));
+  *phase = (ncclInitPhase_t)__atomic_load_n(&comm->initPhase, __ATOMIC_ACQUIRE);
   return ncclSuccess;
 }
 
@@ -6,12 +6,61 @@
 
 #include "argcheck.h"
 #include "comm.h"
+#include "param.h"
 
-static ncclResult_t CudaPtrCheck(const void* pointer, struct ncclComm* comm, const char* ptrname, const char* opname) {
+RCCL_PARAM(CheckPointersCacheHits, "CHECK_POINTERS_CACHE_HITS", 1024); // Hits before a cached allocation is queried again
+
+// Look up the allocation containing pointer among the ones already validated.
+static bool ptrCacheLookup(struct ncclComm* comm, const void* pointer) {
+  uintptr_t addr = reinterpret_cast<uintptr_t>(pointer);
+  for (int i = 0; i < comm->ptrCacheSize; i++) {
+    struct ncclPtrCacheEntry* e = &comm->ptrCache[i];
+    if (e->gen == comm->ptrCacheGen && addr - e->base < e->size) {
+      // Allocations can be freed behind our back: the range must still be mapped as the same
+      // allocation, which only looks up the address map of the runtime, and the full attributes
+      // are queried again every once in a while.
+      void* base;
+      size_t size;
+      if (++e->hits >= rcclParamCheckPointersCacheHits() ||
+          hipMemGetAddressRange(&base, &size, const_cast<void*>(pointer)) != hipSuccess ||
+          reinterpret_cast<uintptr_t>(base) != e->base || size != e->size) {
+        (void) hipGetLastError();
+        e->gen = 0;
+        return false;
+      }
+      comm->ptrCacheHits++;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void ptrCacheInsert(struct ncclComm* comm, const void* pointer) {
+  void* base;
+  size_t size;
+  comm->ptrCacheMisses++;
+  // Not all memory (e.g. registered host memory) has an address range, those
+  // are simply checked every time.
+  if (hipMemGetAddressRange(&base, &size, const_cast<void*>(pointer)) != hipSuccess) {
+    (void) hipGetLastError();
+    return;
+  }
+  struct ncclPtrCacheEntry* e = &comm->ptrCache[comm->ptrCacheNext];
+  comm->ptrCacheNext = (comm->ptrCacheNext+1) % comm->ptrCacheSize;
+  e->gen = comm->ptrCacheGen;
+  e->hits = 0;
+  e->base = reinterpret_cast<uintptr_t>(base);
+  e->size = size;
+}
+
+ncclResult_t CudaPtrCheck(const void* pointer, struct ncclComm* comm, const char* ptrname, const char* opname) {
+  if (comm->ptrCacheSize > 0 && ptrCacheLookup(comm, pointer)) return ncclSuccess;
   cudaPointerAttributes attr;
   cudaError_t err = cudaPointerGetAttributes(&attr, pointer);
   if (err != cudaSuccess || attr.devicePointer == NULL) {
     WARN("%s : %s %p is not a valid pointer", opname, ptrname, pointer);
+    // Memory has been freed or was never ours, don't trust what we cached.
+    ncclPtrCacheInvalidate(comm);
     return ncclInvalidArgument;
   }
 #if ROCM_VERSION < 50500
@@ -22,6 +71,7 @@ static ncclResult_t CudaPtrCheck(const void* pointer, struct ncclComm* comm, con
     WARN("%s : %s allocated on device %d mismatchs with NCCL device %d", opname, ptrname, attr.device, comm->cudaDev);
     return ncclInvalidArgument;
   }
+  if (comm->ptrCacheSize > 0) ptrCacheInsert(comm, pointer);
   return ncclSuccess;
 }
 
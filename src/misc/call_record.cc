@@ -0,0 +1,115 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "call_record.h"
+#include "comm.h"
+#include "info.h"
+#include "chrome_trace.h"
+#include "clock_sync.h"
+#include <mutex>
+#include <string>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Binary call recording.
+ *
+ * Set RCCL_CALL_RECORD_FILE to the output path (%r, %h and %p expand as for
+ * RCCL_CHROME_TRACE_FILE). Each process writes one file with a 64 byte
+ * ncclCallRecord per collective and p2p call of all its communicators, with
+ * what rccl_replayer needs to replay the call: function, count, datatype,
+ * op, root or peer, communicator, rank, stream, position in the group and
+ * host time. Unlike the NCCL_DEBUG_SUBSYS=COLL lines this needs no INFO
+ * logging and costs a copy to a buffer under a mutex per call, so it can stay
+ * on in production. Records are written out every
+ * NCCL_CALL_RECORD_BUFFER calls and when the last communicator is destroyed.
+ * Timestamps move to the clock of rank 0 when they are written, so they use
+ * the clock sync estimate current at that time. Files of several processes
+ * can be concatenated, each one starts with its header. */
+
+#define NCCL_CALL_RECORD_BUFFER 4096
+
+int ncclCallRecordOn = 0;
+
+static std::mutex recordMutex;
+static int recordRefs = 0;
+static FILE* recordFile = nullptr;
+static std::string recordPath;
+static struct ncclCallRecord recordBuffer[NCCL_CALL_RECORD_BUFFER];
+static int recordCount = 0;
+static uint64_t recordTotal = 0;
+
+// Called with recordMutex held
+static void recordFlush() {
+  if (recordCount == 0) return;
+  for (int i=0; i<recordCount; i++) recordBuffer[i].timeNs = ncclClockSyncToGlobal(recordBuffer[i].timeNs);
+  if (fwrite(recordBuffer, sizeof(struct ncclCallRecord), recordCount, recordFile) != (size_t)recordCount) {
+    WARN("Could not write RCCL_CALL_RECORD_FILE %s : %s, recording stopped", recordPath.c_str(), strerror(errno));
+    __atomic_store_n(&ncclCallRecordOn, 0, __ATOMIC_RELAXED);
+  }
+  recordTotal += recordCount;
+  recordCount = 0;
+}
+
+ncclResult_t ncclCallRecordInit(int rank) {
+  std::lock_guard<std::mutex> lock(recordMutex);
+  if (recordRefs++ > 0) return ncclSuccess;
+  const char* pattern = getenv("RCCL_CALL_RECORD_FILE");
+  if (pattern == nullptr || pattern[0] == '\0') return ncclSuccess;
+  recordPath = ncclTracePathForRank(pattern, rank);
+  recordFile = fopen(recordPath.c_str(), "w");
+  if (recordFile == nullptr) {
+    WARN("Could not open RCCL_CALL_RECORD_FILE %s : %s", recordPath.c_str(), strerror(errno));
+    return ncclSuccess;
+  }
+  struct ncclCallRecordHeader header = {};
+  memcpy(header.magic, NCCL_CALL_RECORD_MAGIC, sizeof(header.magic));
+  header.version = NCCL_CALL_RECORD_VERSION;
+  header.recordSize = sizeof(struct ncclCallRecord);
+  header.pid = getpid();
+  getHostName(header.hostname, sizeof(header.hostname), '\0');
+  fwrite(&header, sizeof(header), 1, recordFile);
+  recordCount = 0;
+  recordTotal = 0;
+  INFO(NCCL_INIT, "Recording calls of rank %d to %s", rank, recordPath.c_str());
+  __atomic_store_n(&ncclCallRecordOn, 1, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
+void ncclCallRecordAdd(struct ncclInfo* info) {
+  struct ncclComm* comm = info->comm;
+  uint64_t now = ncclChromeTraceNow();
+  std::lock_guard<std::mutex> lock(recordMutex);
+  if (!ncclCallRecordOn) return;
+  struct ncclCallRecord* r = recordBuffer + recordCount;
+  r->timeNs = now;
+  r->commHash = comm->commHash;
+  r->opCount = comm->opCount;
+  r->count = info->count;
+  r->stream = (uint64_t)(uintptr_t)info->stream;
+  r->rank = comm->rank;
+  r->nRanks = comm->nRanks;
+  r->root = info->root;
+  r->task = comm->tasks.nTasksP2p + comm->tasks.nTasksColl;
+  r->func = info->coll;
+  r->datatype = info->datatype;
+  r->op = info->op;
+  r->inPlace = info->sendbuff == info->recvbuff;
+  r->reserved = 0;
+  if (++recordCount == NCCL_CALL_RECORD_BUFFER) recordFlush();
+}
+
+ncclResult_t ncclCallRecordFinalize() {
+  std::lock_guard<std::mutex> lock(recordMutex);
+  if (recordRefs == 0 || --recordRefs > 0) return ncclSuccess;
+  if (recordFile == nullptr) return ncclSuccess;
+  if (ncclCallRecordOn) recordFlush();
+  __atomic_store_n(&ncclCallRecordOn, 0, __ATOMIC_RELEASE);
+  fclose(recordFile);
+  recordFile = nullptr;
+  INFO(NCCL_INIT, "Recorded %lu calls to %s", recordTotal, recordPath.c_str());
+  return ncclSuccess;
+}
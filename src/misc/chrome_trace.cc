@@ -0,0 +1,324 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "chrome_trace.h"
+#include "clock_sync.h"
+#include "alloc.h"
+#include "debug.h"
+#include "devcomm.h"
+#include "param.h"
+#include "utils.h"
+#include "npkit/npkit_event.h"
+#include "npkit/npkit_struct.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* Chrome trace sink.
+ *
+ * Set RCCL_CHROME_TRACE_FILE to the output path, where %r is replaced by the
+ * rank and %h/%p by the host name and pid; without %r ".<rank>" is appended.
+ * Each process writes one file, with the rank of its first communicator.
+ * Host spans (ncclEnqueueCheck, groupLaunch, ncclLaunchKernel) are on the
+ * lane of their thread, network proxy steps on one lane per channel, hardware
+ * counter rates (RCCL_HW_COUNTER_INTERVAL_MS) as counter tracks and, in NpKit
+ * builds, GPU events on one lane per NpKit buffer. Events are kept in a
+ * preallocated array of RCCL_CHROME_TRACE_MAX_EVENTS entries, later ones are
+ * counted and dropped, and written out in the Chrome JSON trace format when
+ * the last communicator is destroyed. All timestamps are system clock
+ * nanoseconds, which NpKit also uses for NPKIT_EVENT_TIME_SYNC_CPU, so GPU
+ * timestamps land on the host timeline through the TIME_SYNC_CPU/GPU pairs.
+ * With clock sync (RCCL_CLOCK_SYNC_INTERVAL_MS) timestamps are moved to the
+ * clock of rank 0 and kept absolute, so the files of all ranks line up. */
+RCCL_PARAM(ChromeTraceMaxEvents, "CHROME_TRACE_MAX_EVENTS", 1<<22);
+
+int ncclChromeTraceOn = 0;
+
+enum ncclChromeTraceKind { kindHost, kindProxy, kindGpu, kindCounter };
+
+struct ncclChromeTraceEvent {
+  uint64_t startNs;
+  uint64_t endNs;
+  const char* name;
+  uint64_t arg0, arg1;
+  int32_t tid; // OS thread id, channel or NpKit buffer
+  uint8_t kind;
+  char ph; // Chrome phase: X, B, E, i or C
+};
+
+static std::mutex traceMutex;
+static int traceRefs = 0;
+static int traceRank = -1;
+static std::string tracePath;
+static struct ncclChromeTraceEvent* traceEvents = nullptr;
+static uint64_t traceMaxEvents = 0;
+static uint64_t traceNEvents = 0;
+
+uint64_t ncclChromeTraceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static struct ncclChromeTraceEvent* traceAlloc() {
+  uint64_t i = __atomic_fetch_add(&traceNEvents, 1, __ATOMIC_RELAXED);
+  return i < traceMaxEvents ? traceEvents+i : nullptr;
+}
+
+static int traceTid() {
+  static thread_local int tid = syscall(SYS_gettid);
+  return tid;
+}
+
+void ncclChromeTraceHost(const char* name, uint64_t startNs, uint64_t endNs, uint64_t opCount, size_t bytes) {
+  struct ncclChromeTraceEvent* e = traceAlloc();
+  if (e == nullptr) return;
+  *e = { startNs, endNs, name, opCount, bytes, traceTid(), kindHost, 'X' };
+}
+
+void ncclChromeTraceProxy(const char* name, uint64_t startNs, uint64_t endNs, int channelId, int peer, uint64_t step) {
+  struct ncclChromeTraceEvent* e = traceAlloc();
+  if (e == nullptr) return;
+  *e = { startNs, endNs, name, (uint64_t)peer, step, channelId, kindProxy, 'X' };
+}
+
+void ncclChromeTraceCounter(const char* name, uint64_t ns, double value) {
+  struct ncclChromeTraceEvent* e = traceAlloc();
+  if (e == nullptr) return;
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  *e = { ns, ns, name, bits, 0, 0, kindCounter, 'C' };
+}
+
+#define NPKIT_NAME(event) { NPKIT_EVENT_##event, #event }
+static const struct { int type; const char* name; } npKitEventNames[] = {
+  NPKIT_NAME(ALL_REDUCE_RING_ENTRY), NPKIT_NAME(ALL_REDUCE_RING_EXIT), NPKIT_NAME(ALL_REDUCE_TREE_UPDOWN_ENTRY),
+  NPKIT_NAME(ALL_REDUCE_TREE_UPDOWN_EXIT), NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_ENTRY),
+  NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_EXIT), NPKIT_NAME(COPY_SEND_ENTRY), NPKIT_NAME(COPY_SEND_EXIT),
+  NPKIT_NAME(DIRECT_COPY_SEND_ENTRY), NPKIT_NAME(DIRECT_COPY_SEND_EXIT), NPKIT_NAME(DIRECT_RECV_ENTRY),
+  NPKIT_NAME(DIRECT_RECV_EXIT), NPKIT_NAME(DIRECT_RECV_COPY_SEND_ENTRY), NPKIT_NAME(DIRECT_RECV_COPY_SEND_EXIT),
+  NPKIT_NAME(DIRECT_RECV_REDUCE_COPY_SEND_ENTRY), NPKIT_NAME(DIRECT_RECV_REDUCE_COPY_SEND_EXIT),
+  NPKIT_NAME(DIRECT_SEND_ENTRY), NPKIT_NAME(DIRECT_SEND_EXIT), NPKIT_NAME(DIRECT_SEND_FROM_OUTPUT_ENTRY),
+  NPKIT_NAME(DIRECT_SEND_FROM_OUTPUT_EXIT), NPKIT_NAME(RECV_ENTRY), NPKIT_NAME(RECV_EXIT),
+  NPKIT_NAME(RECV_COPY_SEND_ENTRY), NPKIT_NAME(RECV_COPY_SEND_EXIT), NPKIT_NAME(RECV_REDUCE_COPY_ENTRY),
+  NPKIT_NAME(RECV_REDUCE_COPY_EXIT), NPKIT_NAME(RECV_REDUCE_COPY_SEND_ENTRY), NPKIT_NAME(RECV_REDUCE_COPY_SEND_EXIT),
+  NPKIT_NAME(RECV_REDUCE_SEND_ENTRY), NPKIT_NAME(RECV_REDUCE_SEND_EXIT), NPKIT_NAME(SEND_ENTRY),
+  NPKIT_NAME(SEND_EXIT), NPKIT_NAME(SEND_FROM_OUTPUT_ENTRY), NPKIT_NAME(SEND_FROM_OUTPUT_EXIT),
+  NPKIT_NAME(PRIM_SIMPLE_WAIT_PEER_ENTRY), NPKIT_NAME(PRIM_SIMPLE_WAIT_PEER_EXIT),
+  NPKIT_NAME(PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_ENTRY), NPKIT_NAME(PRIM_SIMPLE_REDUCE_OR_COPY_MULTI_EXIT),
+  NPKIT_NAME(PRIM_LL_WAIT_SEND_ENTRY), NPKIT_NAME(PRIM_LL_WAIT_SEND_EXIT), NPKIT_NAME(PRIM_LL_DATA_PROCESS_ENTRY),
+  NPKIT_NAME(PRIM_LL_DATA_PROCESS_EXIT), NPKIT_NAME(PRIM_LL128_WAIT_SEND_ENTRY),
+  NPKIT_NAME(PRIM_LL128_WAIT_SEND_EXIT), NPKIT_NAME(PRIM_LL128_DATA_PROCESS_ENTRY),
+  NPKIT_NAME(PRIM_LL128_DATA_PROCESS_EXIT), NPKIT_NAME(NET_SEND_ENTRY), NPKIT_NAME(NET_SEND_EXIT),
+  NPKIT_NAME(NET_RECV_ENTRY), NPKIT_NAME(NET_RECV_EXIT), NPKIT_NAME(TIME_SYNC_GPU), NPKIT_NAME(TIME_SYNC_CPU),
+  NPKIT_NAME(ALL_REDUCE_RING_SEND_ENTRY), NPKIT_NAME(ALL_REDUCE_RING_SEND_EXIT),
+  NPKIT_NAME(ALL_REDUCE_RING_RECV_REDUCE_SEND_ENTRY), NPKIT_NAME(ALL_REDUCE_RING_RECV_REDUCE_SEND_EXIT),
+  NPKIT_NAME(ALL_REDUCE_RING_DIRECT_RECV_REDUCE_COPY_SEND_ENTRY),
+  NPKIT_NAME(ALL_REDUCE_RING_DIRECT_RECV_REDUCE_COPY_SEND_EXIT),
+  NPKIT_NAME(ALL_REDUCE_RING_DIRECT_RECV_COPY_SEND_ENTRY), NPKIT_NAME(ALL_REDUCE_RING_DIRECT_RECV_COPY_SEND_EXIT),
+  NPKIT_NAME(ALL_REDUCE_RING_DIRECT_RECV_ENTRY), NPKIT_NAME(ALL_REDUCE_RING_DIRECT_RECV_EXIT),
+  NPKIT_NAME(ALL_REDUCE_TREE_UPDOWN_REDUCE_ENTRY), NPKIT_NAME(ALL_REDUCE_TREE_UPDOWN_REDUCE_EXIT),
+  NPKIT_NAME(ALL_REDUCE_TREE_UPDOWN_BROADCAST_ENTRY), NPKIT_NAME(ALL_REDUCE_TREE_UPDOWN_BROADCAST_EXIT),
+  NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_REDUCE_BROADCAST_ENTRY), NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_REDUCE_BROADCAST_EXIT),
+  NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_REDUCE_ENTRY), NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_REDUCE_EXIT),
+  NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_BROADCAST_ENTRY), NPKIT_NAME(ALL_REDUCE_TREE_SPLIT_BROADCAST_EXIT),
+  NPKIT_NAME(SEND_RECV_LOCAL_COPY_ENTRY), NPKIT_NAME(SEND_RECV_LOCAL_COPY_EXIT), NPKIT_NAME(SEND_RECV_SEND_ENTRY),
+  NPKIT_NAME(SEND_RECV_SEND_EXIT), NPKIT_NAME(SEND_RECV_RECV_ENTRY), NPKIT_NAME(SEND_RECV_RECV_EXIT),
+  NPKIT_NAME(ALL_GATHER_RING_ENTRY), NPKIT_NAME(ALL_GATHER_RING_EXIT), NPKIT_NAME(ALL_GATHER_RING_SEND_ENTRY),
+  NPKIT_NAME(ALL_GATHER_RING_SEND_EXIT), NPKIT_NAME(ALL_GATHER_RING_RECV_COPY_SEND_ENTRY),
+  NPKIT_NAME(ALL_GATHER_RING_RECV_COPY_SEND_EXIT), NPKIT_NAME(ALL_GATHER_RING_DIRECT_RECV_ENTRY),
+  NPKIT_NAME(ALL_GATHER_RING_DIRECT_RECV_EXIT), NPKIT_NAME(NET_TEST_ENTRY), NPKIT_NAME(NET_TEST_EXIT),
+  NPKIT_NAME(MSCCL_GENERIC_OP_ENTRY), NPKIT_NAME(MSCCL_GENERIC_OP_EXIT), NPKIT_NAME(MSCCL_REDUCE_ENTRY),
+  NPKIT_NAME(MSCCL_REDUCE_EXIT), NPKIT_NAME(MSCCL_SEND_ENTRY), NPKIT_NAME(MSCCL_SEND_EXIT),
+  NPKIT_NAME(MSCCL_RECV_ENTRY), NPKIT_NAME(MSCCL_RECV_EXIT), NPKIT_NAME(MSCCL_RUN_ENTRY), NPKIT_NAME(MSCCL_RUN_EXIT),
+  NPKIT_NAME(MSCCL_RECV_REDUCE_COPY_ENTRY), NPKIT_NAME(MSCCL_RECV_REDUCE_COPY_EXIT), NPKIT_NAME(MSCCL_INIT_ENTRY),
+  NPKIT_NAME(MSCCL_INIT_EXIT), NPKIT_NAME(MSCCL_DEP_WAIT_ENTRY), NPKIT_NAME(MSCCL_DEP_WAIT_EXIT),
+  NPKIT_NAME(MSCCL_STEP_ENTRY), NPKIT_NAME(MSCCL_STEP_EXIT)
+};
+
+static const char* npKitEventName(int type) {
+  static const char* names[256];
+  static std::once_flag once;
+  std::call_once(once, []() {
+    for (auto& n : npKitEventNames) names[n.type & 0xff] = n.name;
+  });
+  return names[type & 0xff];
+}
+
+static bool endsWith(const char* s, const char* suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s+n-m, suffix) == 0;
+}
+
+void ncclChromeTraceNpKit(int bufIdx, const union NpKitEvent* events, uint64_t nEvents, uint64_t first,
+    uint64_t ringSize, double gpuClockKhz) {
+  uint64_t syncCpuNs = 0, syncGpu = 0;
+  bool cpuPending = false, synced = false;
+  for (uint64_t i=0; i < nEvents; i++) {
+    const union NpKitEvent* ev = events + (first+i)%ringSize;
+    int type = ev->fields.type;
+    if (type == NPKIT_EVENT_TIME_SYNC_CPU) {
+      syncCpuNs = ev->fields.timestamp;
+      cpuPending = true;
+      continue;
+    }
+    if (type == NPKIT_EVENT_TIME_SYNC_GPU) {
+      if (cpuPending) {
+        syncGpu = ev->fields.timestamp;
+        synced = true;
+      }
+      cpuPending = false;
+      continue;
+    }
+    const char* name = npKitEventName(type);
+    if (!synced || name == nullptr) continue;
+    struct ncclChromeTraceEvent* e = traceAlloc();
+    if (e == nullptr) return;
+    int64_t ticks = (int64_t)(ev->fields.timestamp - syncGpu);
+    uint64_t ns = syncCpuNs + (int64_t)(ticks*1.0E6/gpuClockKhz);
+    char ph = endsWith(name, "_ENTRY") ? 'B' : endsWith(name, "_EXIT") ? 'E' : 'i';
+    *e = { ns, ns, name, ev->fields.size, ev->fields.rsvd, bufIdx, kindGpu, ph };
+  }
+}
+
+std::string ncclTracePathForRank(const char* pattern, int rank) {
+  std::string path;
+  bool hasRank = false;
+  for (const char* c = pattern; *c; c++) {
+    if (c[0] == '%' && c[1] == 'r') {
+      path += std::to_string(rank);
+      hasRank = true;
+      c++;
+    } else if (c[0] == '%' && c[1] == 'p') {
+      path += std::to_string(getpid());
+      c++;
+    } else if (c[0] == '%' && c[1] == 'h') {
+      char hostname[1024];
+      getHostName(hostname, sizeof(hostname), '.');
+      path += hostname;
+      c++;
+    } else {
+      path += *c;
+    }
+  }
+  if (!hasRank) path += "." + std::to_string(rank);
+  return path;
+}
+
+ncclResult_t ncclChromeTraceInit(int rank) {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if (traceRefs++ > 0) return ncclSuccess;
+  const char* pattern = getenv("RCCL_CHROME_TRACE_FILE");
+  if (pattern == nullptr || pattern[0] == '\0') return ncclSuccess;
+  int64_t maxEvents = rcclParamChromeTraceMaxEvents();
+  if (maxEvents <= 0) return ncclSuccess;
+  traceMaxEvents = maxEvents;
+  NCCLCHECK(ncclCalloc(&traceEvents, traceMaxEvents));
+  traceNEvents = 0;
+  traceRank = rank;
+  tracePath = ncclTracePathForRank(pattern, rank);
+  INFO(NCCL_INIT, "Chrome trace of rank %d goes to %s, at most %lu events", rank, tracePath.c_str(), traceMaxEvents);
+  __atomic_store_n(&ncclChromeTraceOn, 1, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
+static void traceWriteName(FILE* f, const struct ncclChromeTraceEvent* e) {
+  int len = strlen(e->name);
+  if (e->ph == 'B') len -= strlen("_ENTRY");
+  if (e->ph == 'E') len -= strlen("_EXIT");
+  fprintf(f, "\"name\": \"%.*s\"", len, e->name);
+}
+
+static void traceWrite() {
+  FILE* f = fopen(tracePath.c_str(), "w");
+  if (f == nullptr) {
+    WARN("Could not open RCCL_CHROME_TRACE_FILE %s : %s", tracePath.c_str(), strerror(errno));
+    return;
+  }
+  uint64_t n = std::min(traceNEvents, traceMaxEvents);
+  uint64_t baseNs = UINT64_MAX;
+  bool synced = ncclClockSyncActive();
+  for (uint64_t i=0; i < n; i++) {
+    if (synced) {
+      traceEvents[i].startNs = ncclClockSyncToGlobal(traceEvents[i].startNs);
+      traceEvents[i].endNs = ncclClockSyncToGlobal(traceEvents[i].endNs);
+    }
+    baseNs = std::min(baseNs, traceEvents[i].startNs);
+  }
+  if (synced) baseNs = 0;
+  const int pid = traceRank;
+  // Proxy and GPU lanes get their own thread ids, above those of the OS
+  const int proxyLane = 1<<22, gpuLane = 1<<23;
+  fprintf(f, "{\"traceEvents\": [\n");
+  fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}", pid, pid);
+  std::vector<bool> proxySeen(MAXCHANNELS), gpuSeen;
+  for (uint64_t i=0; i < n; i++) {
+    const struct ncclChromeTraceEvent* e = traceEvents+i;
+    int tid = e->tid;
+    if (e->kind == kindProxy) {
+      tid = proxyLane + e->tid;
+      if (e->tid >= 0 && e->tid < MAXCHANNELS && !proxySeen[e->tid]) {
+        proxySeen[e->tid] = true;
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"proxy channel %d\"}}", pid, tid, e->tid);
+      }
+    } else if (e->kind == kindGpu) {
+      tid = gpuLane + e->tid;
+      if ((size_t)e->tid >= gpuSeen.size()) gpuSeen.resize(e->tid+1);
+      if (!gpuSeen[e->tid]) {
+        gpuSeen[e->tid] = true;
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"gpu buffer %d\"}}", pid, tid, e->tid);
+      }
+    }
+    if (e->kind == kindProxy) {
+      // Steps in flight overlap on a channel, async spans keep them apart
+      const char* fmt = ",\n{\"name\": \"%s\", \"cat\": \"proxy\", \"ph\": \"%c\", \"id\": %lu, \"pid\": %d, \"tid\": %d, \"ts\": %.3f";
+      fprintf(f, fmt, e->name, 'b', i, pid, tid, (e->startNs-baseNs)/1.0E3);
+      fprintf(f, ", \"args\": {\"peer\": %d, \"step\": %lu}}", (int)e->arg0, e->arg1);
+      fprintf(f, fmt, e->name, 'e', i, pid, tid, (e->endNs-baseNs)/1.0E3);
+      fprintf(f, "}");
+      continue;
+    }
+    if (e->kind == kindCounter) {
+      double value;
+      memcpy(&value, &e->arg0, sizeof(value));
+      fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"hw\", \"ph\": \"C\", \"pid\": %d, \"ts\": %.3f, \"args\": {\"value\": %g}}",
+          e->name, pid, (e->startNs-baseNs)/1.0E3, value);
+      continue;
+    }
+    fprintf(f, ",\n{");
+    traceWriteName(f, e);
+    fprintf(f, ", \"cat\": \"%s\", \"ph\": \"%c\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f",
+        e->kind == kindHost ? "host" : "gpu", e->ph, pid, tid, (e->startNs-baseNs)/1.0E3);
+    if (e->ph == 'X') fprintf(f, ", \"dur\": %.3f", (e->endNs-e->startNs)/1.0E3);
+    if (e->ph == 'i') fprintf(f, ", \"s\": \"t\"");
+    if (e->kind == kindHost) {
+      fprintf(f, ", \"args\": {\"opCount\": %lu, \"bytes\": %lu}}", e->arg0, e->arg1);
+    } else {
+      fprintf(f, ", \"args\": {\"size\": %lu, \"rsvd\": %lu}}", e->arg0, e->arg1);
+    }
+  }
+  fprintf(f, "\n],\n\"otherData\": {\"droppedEvents\": %lu, \"clockSynced\": %s}}\n", traceNEvents > n ? traceNEvents-n : 0,
+      synced ? "true" : "false");
+  fclose(f);
+  if (traceNEvents > n) {
+    WARN("Chrome trace dropped %lu events, raise RCCL_CHROME_TRACE_MAX_EVENTS", traceNEvents-n);
+  }
+}
+
+ncclResult_t ncclChromeTraceFinalize() {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if (traceRefs == 0 || --traceRefs > 0) return ncclSuccess;
+  if (!ncclChromeTraceOn) return ncclSuccess;
+  __atomic_store_n(&ncclChromeTraceOn, 0, __ATOMIC_RELEASE);
+  traceWrite();
+  free(traceEvents);
+  traceEvents = nullptr;
+  traceMaxEvents = 0;
+  return ncclSuccess;
+}
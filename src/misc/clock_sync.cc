@@ -0,0 +1,261 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "clock_sync.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "socket.h"
+#include "param.h"
+#include "chrome_trace.h"
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+/* Cross-rank clock synchronization.
+ *
+ * Trace timestamps are taken from the system clock of each host (NpKit GPU
+ * timestamps are placed on it through the TIME_SYNC_CPU/GPU pairs), so traces
+ * of different nodes are off by the clock skew between hosts. The first
+ * communicator of the process measures, every RCCL_CLOCK_SYNC_INTERVAL_MS, the
+ * offset of the local clock against its rank 0: each rank sends
+ * RCCL_CLOCK_SYNC_ROUNDS ping-pongs to rank 0 over dedicated sockets, rank 0
+ * replies with its clock and the round trip with the lowest latency gives the
+ * offset, assuming symmetric paths. Offsets are kept with the local time they
+ * were measured at; timestamps are corrected by interpolating between them,
+ * which follows clock drift, and past the last one by extrapolating the drift
+ * measured since the first one. The interval defaults to 1000 ms when a Chrome
+ * trace or NpKit dump is requested and to 0 (disabled) otherwise. */
+RCCL_PARAM(ClockSyncIntervalMs, "CLOCK_SYNC_INTERVAL_MS", -1);
+RCCL_PARAM(ClockSyncRounds, "CLOCK_SYNC_ROUNDS", 16);
+
+#define NCCL_CLOCK_SYNC_MAX_SAMPLES 4096
+
+struct ncclClockSyncSample {
+  uint64_t localNs;
+  int64_t offsetNs; // rank 0 clock minus local clock
+  uint64_t rttNs;
+};
+
+struct ncclClockSync {
+  struct ncclComm* comm;
+  pthread_t thread;
+  int stop;
+  uint64_t intervalMs;
+  int rounds;
+  // Rank != 0
+  struct ncclSocket sock;
+  // Rank 0
+  struct ncclSocket listenSock;
+  struct ncclSocket* peers; // [nRanks-1]
+};
+
+static std::mutex syncMutex;
+static struct ncclClockSync* syncOwner = nullptr;
+static std::vector<struct ncclClockSyncSample> syncSamples;
+
+static void clockSyncAddSample(const struct ncclClockSyncSample& s) {
+  std::lock_guard<std::mutex> lock(syncMutex);
+  if (syncSamples.size() == NCCL_CLOCK_SYNC_MAX_SAMPLES) {
+    // Keep every other sample, the first one anchors the drift estimate
+    size_t n = 0;
+    for (size_t i=0; i<syncSamples.size(); i+=2) syncSamples[n++] = syncSamples[i];
+    syncSamples.resize(n);
+  }
+  syncSamples.push_back(s);
+}
+
+bool ncclClockSyncActive() {
+  std::lock_guard<std::mutex> lock(syncMutex);
+  return !syncSamples.empty();
+}
+
+uint64_t ncclClockSyncToGlobal(uint64_t localNs) {
+  std::lock_guard<std::mutex> lock(syncMutex);
+  size_t n = syncSamples.size();
+  if (n == 0) return localNs;
+  const struct ncclClockSyncSample* first = &syncSamples[0];
+  const struct ncclClockSyncSample* last = &syncSamples[n-1];
+  double offset;
+  if (localNs <= first->localNs) {
+    offset = first->offsetNs;
+  } else if (localNs >= last->localNs) {
+    double drift = n > 1 ? double(last->offsetNs - first->offsetNs)/(last->localNs - first->localNs) : 0;
+    offset = last->offsetNs + drift*(localNs - last->localNs);
+  } else {
+    auto next = std::upper_bound(syncSamples.begin(), syncSamples.end(), localNs,
+        [](uint64_t ns, const struct ncclClockSyncSample& s) { return ns < s.localNs; });
+    auto prev = next-1;
+    offset = prev->offsetNs + double(next->offsetNs - prev->offsetNs)*(localNs - prev->localNs)/(next->localNs - prev->localNs);
+  }
+  return localNs + (int64_t)offset;
+}
+
+// Rank != 0: ping-pongs with rank 0 and records the offset of the fastest round trip
+static ncclResult_t clockSyncMeasure(struct ncclClockSync* cs) {
+  struct ncclClockSyncSample best = {};
+  best.rttNs = UINT64_MAX;
+  for (int r=0; r<cs->rounds; r++) {
+    uint64_t t0 = ncclChromeTraceNow(), remote;
+    NCCLCHECK(ncclSocketSend(&cs->sock, &t0, sizeof(t0)));
+    NCCLCHECK(ncclSocketRecv(&cs->sock, &remote, sizeof(remote)));
+    uint64_t t1 = ncclChromeTraceNow();
+    if (t1 - t0 < best.rttNs) {
+      best.rttNs = t1 - t0;
+      best.localNs = t0 + (t1 - t0)/2;
+      best.offsetNs = (int64_t)(remote - best.localNs);
+    }
+  }
+  clockSyncAddSample(best);
+  return ncclSuccess;
+}
+
+// Rank 0: answers the ping-pongs of all ranks until stopped
+static void clockSyncServe(struct ncclClockSync* cs) {
+  int nPeers = cs->comm->nRanks-1;
+  std::vector<struct pollfd> fds(nPeers);
+  for (int i=0; i<nPeers; i++) {
+    fds[i].events = POLLIN;
+    if (ncclSocketGetFd(cs->peers+i, &fds[i].fd) != ncclSuccess) fds[i].fd = -1;
+  }
+  while (!__atomic_load_n(&cs->stop, __ATOMIC_ACQUIRE)) {
+    if (poll(fds.data(), nPeers, 100) <= 0) continue;
+    for (int i=0; i<nPeers; i++) {
+      if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+      uint64_t ping;
+      ssize_t bytes = recv(fds[i].fd, &ping, sizeof(ping), MSG_WAITALL);
+      uint64_t now = ncclChromeTraceNow();
+      if (bytes != sizeof(ping) || send(fds[i].fd, &now, sizeof(now), MSG_NOSIGNAL) != sizeof(now)) {
+        fds[i].fd = -1; // Peer communicator destroyed
+      }
+    }
+  }
+}
+
+static void* clockSyncThread(void* arg) {
+  struct ncclClockSync* cs = (struct ncclClockSync*)arg;
+  if (cs->comm->rank == 0) {
+    clockSyncServe(cs);
+    return NULL;
+  }
+  uint64_t next = clockNano() + cs->intervalMs*1000000;
+  while (!__atomic_load_n(&cs->stop, __ATOMIC_ACQUIRE)) {
+    if (clockNano() < next) {
+      usleep(std::min<uint64_t>(cs->intervalMs*1000, 10000));
+      continue;
+    }
+    next += cs->intervalMs*1000000;
+    if (clockSyncMeasure(cs) != ncclSuccess) {
+      INFO(NCCL_INIT, "Clock sync: rank %d lost rank 0, keeping the last estimate", cs->comm->rank);
+      break;
+    }
+  }
+  return NULL;
+}
+
+ncclResult_t ncclClockSyncInit(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  union ncclSocketAddress* addrs = NULL;
+  struct ncclClockSync* cs = NULL;
+  int* unsynced = NULL;
+  int64_t intervalMs = rcclParamClockSyncIntervalMs();
+  if (intervalMs < 0) intervalMs = (ncclChromeTraceEnabled() || getenv("NPKIT_DUMP_DIR")) ? 1000 : 0;
+  if (intervalMs == 0 || comm->nRanks == 1) return ncclSuccess;
+
+  // Only the first communicator of every process is synchronized, all ranks need to agree
+  NCCLCHECKGOTO(ncclCalloc(&unsynced, comm->nRanks), ret, fail);
+  {
+    std::lock_guard<std::mutex> lock(syncMutex);
+    unsynced[comm->rank] = syncOwner == nullptr;
+  }
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, unsynced, sizeof(int)), ret, fail);
+  for (int r=0; r<comm->nRanks; r++) if (!unsynced[r]) goto exit;
+
+  NCCLCHECKGOTO(ncclCalloc(&cs, 1), ret, fail);
+  cs->comm = comm;
+  cs->intervalMs = intervalMs;
+  cs->rounds = std::max<int64_t>(rcclParamClockSyncRounds(), 1);
+  NCCLCHECKGOTO(ncclCalloc(&addrs, comm->nRanks), ret, fail);
+  if (comm->rank == 0) {
+    NCCLCHECKGOTO(bootstrapGetNetIfAddr(addrs), ret, fail);
+    NCCLCHECKGOTO(ncclSocketInit(&cs->listenSock, addrs, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag), ret, fail);
+    NCCLCHECKGOTO(ncclSocketListen(&cs->listenSock), ret, fail);
+    NCCLCHECKGOTO(ncclSocketGetAddr(&cs->listenSock, addrs), ret, fail);
+  }
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, addrs, sizeof(union ncclSocketAddress)), ret, fail);
+  {
+    std::lock_guard<std::mutex> lock(syncMutex);
+    syncOwner = cs;
+    syncSamples.clear();
+  }
+  if (comm->rank == 0) {
+    NCCLCHECKGOTO(ncclCalloc(&cs->peers, comm->nRanks-1), ret, fail);
+    for (int i=0; i<comm->nRanks-1; i++) {
+      NCCLCHECKGOTO(ncclSocketInit(cs->peers+i), ret, fail);
+      NCCLCHECKGOTO(ncclSocketAccept(cs->peers+i, &cs->listenSock), ret, fail);
+    }
+    // Rank 0 is the reference
+    clockSyncAddSample({ ncclChromeTraceNow(), 0, 0 });
+    pthread_create(&cs->thread, NULL, clockSyncThread, cs);
+  } else {
+    NCCLCHECKGOTO(ncclSocketInit(&cs->sock, addrs, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag), ret, fail);
+    NCCLCHECKGOTO(ncclSocketConnect(&cs->sock), ret, fail);
+    // First estimate before any traced operation
+    NCCLCHECKGOTO(clockSyncMeasure(cs), ret, fail);
+    INFO(NCCL_INIT, "Clock sync: rank %d offset to rank 0 %ld ns, round trip %lu ns, every %lu ms",
+        comm->rank, syncSamples[0].offsetNs, syncSamples[0].rttNs, cs->intervalMs);
+    pthread_create(&cs->thread, NULL, clockSyncThread, cs);
+  }
+  ncclSetThreadName(cs->thread, "NCCL ClockSync%2d", comm->cudaDev);
+  comm->clockSync = cs;
+exit:
+  free(addrs);
+  free(unsynced);
+  return ret;
+fail:
+  if (cs) {
+    std::lock_guard<std::mutex> lock(syncMutex);
+    if (syncOwner == cs) syncOwner = nullptr;
+    syncSamples.clear();
+    free(cs->peers);
+    free(cs);
+  }
+  goto exit;
+}
+
+ncclResult_t ncclClockSyncDestroy(struct ncclComm* comm) {
+  struct ncclClockSync* cs = comm->clockSync;
+  if (cs == NULL) return ncclSuccess;
+  __atomic_store_n(&cs->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(cs->thread, NULL);
+  if (comm->rank == 0) {
+    for (int i=0; i<comm->nRanks-1; i++) NCCLCHECK(ncclSocketClose(cs->peers+i));
+    NCCLCHECK(ncclSocketClose(&cs->listenSock));
+    free(cs->peers);
+  } else {
+    NCCLCHECK(ncclSocketClose(&cs->sock));
+    std::lock_guard<std::mutex> lock(syncMutex);
+    size_t n = syncSamples.size();
+    const struct ncclClockSyncSample& first = syncSamples[0];
+    const struct ncclClockSyncSample& last = syncSamples[n-1];
+    double driftPpm = n > 1 ? double(last.offsetNs - first.offsetNs)/(last.localNs - first.localNs)*1e6 : 0;
+    INFO(NCCL_INIT, "Clock sync: rank %d offset to rank 0 %ld ns, drift %.3f ppm over %zu samples",
+        comm->rank, last.offsetNs, driftPpm, n);
+  }
+  {
+    // Samples stay for the trace writers, which run when the last communicator goes
+    std::lock_guard<std::mutex> lock(syncMutex);
+    syncOwner = nullptr;
+  }
+  free(cs);
+  comm->clockSync = NULL;
+  return ncclSuccess;
+}
@@ -0,0 +1,141 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifdef ENABLE_COLLTRACE
+#include "colltrace_file.h"
+#include "comm.h"
+#include "checks.h"
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Binary kernel collective trace.
+ *
+ * With RCCL_KERNEL_COLL_TRACE_FILE set, the colltrace thread of each
+ * communicator copies the ncclCollTrace records of the device rings to a
+ * memory-mapped file instead of formatting them through INFO, which at high
+ * collective rates made it fall behind and perturbed the run. The file holds
+ * a ncclCollTraceFileHeader, the function name table and the raw records;
+ * nRecords in the header is updated after each record so a file left by a
+ * crashed or hung process stays readable. The file grows by
+ * NCCL_COLLTRACE_FILE_CHUNK records at a time and is truncated to its content
+ * when the communicator is destroyed. tools/scripts/colltrace_decoder.py turns
+ * it back into the text lines of NCCL_DEBUG_SUBSYS=COLL. */
+
+#define NCCL_COLLTRACE_FILE_CHUNK (1<<20) // Records, 32 MB
+
+struct ncclCollTraceFile {
+  int fd;
+  std::string path;
+  char* map;
+  size_t mapSize;
+  size_t recordsOffset;
+  struct ncclCollTraceFileHeader* header;
+};
+
+static std::string collTracePath(const char* pattern, struct ncclComm* comm) {
+  std::string path;
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%lx", comm->commHash);
+  bool hasRank = false;
+  for (const char* c = pattern; *c; c++) {
+    if (c[0] == '%' && c[1] == 'r') {
+      path += std::to_string(comm->rank);
+      hasRank = true;
+      c++;
+    } else if (c[0] == '%' && c[1] == 'c') {
+      path += hash;
+      c++;
+    } else {
+      path += *c;
+    }
+  }
+  if (!hasRank) path += std::string(".") + hash + "." + std::to_string(comm->rank);
+  return path;
+}
+
+static ncclResult_t collTraceFileMap(struct ncclCollTraceFile* file, size_t size) {
+  if (file->map) munmap(file->map, file->mapSize);
+  file->map = NULL;
+  if (ftruncate(file->fd, size) != 0) {
+    WARN("Could not extend %s to %zu bytes : %s", file->path.c_str(), size, strerror(errno));
+    return ncclSystemError;
+  }
+  char* map = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+  if (map == MAP_FAILED) {
+    WARN("Could not map %s size %zu : %s", file->path.c_str(), size, strerror(errno));
+    return ncclSystemError;
+  }
+  file->map = map;
+  file->mapSize = size;
+  file->header = (struct ncclCollTraceFileHeader*)map;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCollTraceFileOpen(struct ncclComm* comm, const char* pattern, const char* names, int nNames,
+    int nameLength, int funcIndexP2p, double rtcFreqHz, struct ncclCollTraceFile** file) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclCollTraceFile* f = new ncclCollTraceFile();
+  struct ncclCollTraceFileHeader* h;
+  f->fd = -1;
+  f->path = collTracePath(pattern, comm);
+  SYSCHECKGOTO(f->fd = open(f->path.c_str(), O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH), ret, fail);
+  f->recordsOffset = sizeof(struct ncclCollTraceFileHeader) + (size_t)nNames*nameLength;
+  f->recordsOffset = ALIGN_SIZE(f->recordsOffset, sizeof(struct ncclCollTrace));
+  NCCLCHECKGOTO(collTraceFileMap(f, f->recordsOffset + NCCL_COLLTRACE_FILE_CHUNK*sizeof(struct ncclCollTrace)), ret, fail);
+  memcpy(f->map + sizeof(struct ncclCollTraceFileHeader), names, (size_t)nNames*nameLength);
+  h = f->header;
+  h->version = NCCL_COLLTRACE_FILE_VERSION;
+  h->recordSize = sizeof(struct ncclCollTrace);
+  h->rank = comm->rank;
+  h->nRanks = comm->nRanks;
+  h->commHash = comm->commHash;
+  h->busId = comm->busId;
+  h->rtcFreqHz = rtcFreqHz;
+  h->nNames = nNames;
+  h->nameLength = nameLength;
+  h->funcIndexP2p = funcIndexP2p;
+  h->nRecords = 0;
+  // Magic last, a reader never sees a half written header
+  memcpy(h->magic, NCCL_COLLTRACE_FILE_MAGIC, sizeof(h->magic));
+  INFO(NCCL_INIT|NCCL_COLL, "Kernel collective trace of rank %d goes to %s", comm->rank, f->path.c_str());
+  *file = f;
+  return ncclSuccess;
+fail:
+  if (f->map) munmap(f->map, f->mapSize);
+  if (f->fd >= 0) close(f->fd);
+  delete f;
+  return ret;
+}
+
+ncclResult_t ncclCollTraceFileAppend(struct ncclCollTraceFile* file, const volatile struct ncclCollTrace* record) {
+  uint64_t n = file->header->nRecords;
+  size_t offset = file->recordsOffset + n*sizeof(struct ncclCollTrace);
+  if (offset + sizeof(struct ncclCollTrace) > file->mapSize) {
+    NCCLCHECK(collTraceFileMap(file, file->mapSize + NCCL_COLLTRACE_FILE_CHUNK*sizeof(struct ncclCollTrace)));
+  }
+  struct ncclCollTrace* dst = (struct ncclCollTrace*)(file->map + offset);
+  const volatile uint64_t* src = (const volatile uint64_t*)record;
+  for (size_t i=0; i<sizeof(struct ncclCollTrace)/sizeof(uint64_t); i++) ((uint64_t*)dst)[i] = src[i];
+  __atomic_store_n(&file->header->nRecords, n+1, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCollTraceFileClose(struct ncclCollTraceFile* file) {
+  if (file == NULL) return ncclSuccess;
+  uint64_t n = file->header->nRecords;
+  size_t size = file->recordsOffset + n*sizeof(struct ncclCollTrace);
+  INFO(NCCL_COLL, "Kernel collective trace wrote %lu records to %s", n, file->path.c_str());
+  munmap(file->map, file->mapSize);
+  if (ftruncate(file->fd, size) != 0) WARN("Could not truncate %s to %zu bytes : %s", file->path.c_str(), size, strerror(errno));
+  close(file->fd);
+  delete file;
+  return ncclSuccess;
+}
+#endif
@@ -0,0 +1,97 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "dev_arena.h"
+#include "alloc.h"
+#include "checks.h"
+#include "param.h"
+#include <algorithm>
+
+// Every hipMalloc is a driver call rounded up to the allocation granularity, and a comm with
+// many channels and ranks makes a few per channel. Slabs are zeroed when they are allocated and
+// objects are never freed one by one, so an allocation is a bump of the offset in the current
+// slab. Objects larger than half a slab get a slab of their own next to the current one.
+// 0 gives every object its own slab, which matches the behavior without the arena.
+RCCL_PARAM(DevArenaSlabBytes, "DEV_ARENA_SLAB_BYTES", 4 << 20);
+
+#define NCCL_DEV_ARENA_MIN_ALIGN 16
+
+ncclResult_t ncclDevArenaInit(struct ncclDevArena* arena) {
+  memset(arena, 0, sizeof(*arena));
+  pthread_mutex_init(&arena->lock, NULL);
+  return ncclSuccess;
+}
+
+static ncclResult_t slabAlloc(struct ncclDevArena* arena, size_t size, enum ncclDevArenaType type, hipStream_t stream,
+    struct ncclDevArenaSlab** slabOut) {
+  struct ncclDevArenaSlab* slab;
+  NCCLCHECK(ncclCalloc(&slab, 1));
+  ncclResult_t ret = ncclCudaCalloc(&slab->base, size, stream, type == ncclDevArenaFineGrain);
+  if (ret != ncclSuccess) {
+    free(slab);
+    return ret;
+  }
+  slab->size = size;
+  arena->nSlabs++;
+  arena->slabBytes += size;
+  *slabOut = slab;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclDevArenaAllocAsync(struct ncclDevArena* arena, void** ptr, size_t bytes, size_t align,
+    enum ncclDevArenaType type, hipStream_t stream, const char* filefunc, int line) {
+  ncclResult_t ret = ncclSuccess;
+  size_t slabSize = std::max<int64_t>(rcclParamDevArenaSlabBytes(), 0);
+  struct ncclDevArenaSlab* slab;
+  size_t offset;
+  *ptr = nullptr;
+  align = std::max(align, (size_t)NCCL_DEV_ARENA_MIN_ALIGN);
+
+  pthread_mutex_lock(&arena->lock);
+  slab = arena->slabs[type];
+  offset = slab ? ROUNDUP(slab->used, align) : 0;
+  if (slab == nullptr || offset + bytes > slab->size) {
+    struct ncclDevArenaSlab* current = arena->slabs[type];
+    if (slabSize == 0 || bytes > slabSize/2) {
+      NCCLCHECKGOTO(slabAlloc(arena, std::max(bytes, (size_t)NCCL_DEV_ARENA_MIN_ALIGN), type, stream, &slab), ret, exit);
+      if (current) {
+        slab->next = current->next;
+        current->next = slab;
+      } else {
+        arena->slabs[type] = slab;
+      }
+    } else {
+      NCCLCHECKGOTO(slabAlloc(arena, slabSize, type, stream, &slab), ret, exit);
+      slab->next = current;
+      arena->slabs[type] = slab;
+    }
+    offset = 0;
+  }
+  slab->used = offset + bytes;
+  arena->usedBytes += bytes;
+  *ptr = slab->base + offset;
+  TRACE(NCCL_ALLOC, "%s:%d Device arena alloc size %zu pointer %p", filefunc, line, bytes, *ptr);
+exit:
+  pthread_mutex_unlock(&arena->lock);
+  if (*ptr == nullptr) WARN("Failed to allocate %zu bytes from the device arena", bytes);
+  return ret;
+}
+
+ncclResult_t ncclDevArenaDestroy(struct ncclDevArena* arena) {
+  for (int t = 0; t < ncclDevArenaNumTypes; t++) {
+    struct ncclDevArenaSlab* slab = arena->slabs[t];
+    while (slab) {
+      struct ncclDevArenaSlab* next = slab->next;
+      NCCLCHECK(ncclCudaFree(slab->base));
+      free(slab);
+      slab = next;
+    }
+    arena->slabs[t] = nullptr;
+  }
+  INFO(NCCL_ALLOC, "Device arena freed %lu slabs of %lu bytes, %lu bytes used", arena->nSlabs, arena->slabBytes, arena->usedBytes);
+  pthread_mutex_destroy(&arena->lock);
+  return ncclSuccess;
+}
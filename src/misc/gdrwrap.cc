@@ -6,6 +6,8 @@
 
 #include "gdrwrap.h"
 
+__thread bool ncclGdcPending = false;
+
 #ifndef GDR_DIRECT
 #include "core.h"
 
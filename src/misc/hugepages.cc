@@ -0,0 +1,91 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "alloc.h"
+#include "checks.h"
+#include "param.h"
+#include <map>
+#include <mutex>
+
+// Staging buffers of the proxy are read and written by the NIC and the GPUs through the IOMMU,
+// and with 4KB pages a few MB of them already take more IOTLB entries than the hardware caches.
+// Large pinned host buffers are mapped from hugetlbfs pages instead (reserved through
+// /proc/sys/vm/nr_hugepages or the hugepages= boot option) and registered with HIP. Buffers
+// smaller than half a huge page, and any buffer when no huge page is left, use regular pages.
+RCCL_PARAM(HostHugePageSize, "HOST_HUGEPAGE_SIZE", 0); // 2097152 or 1073741824, 0 for regular pages
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static std::mutex hugePagesMutex;
+static std::map<void*, size_t> hugePagesMaps; // Mapped size of each buffer
+
+size_t ncclHugePageSize() {
+  static size_t pageSize = []() -> size_t {
+    int64_t size = rcclParamHostHugePageSize();
+    if (size == 0) return 0;
+    if (size != (1 << 21) && size != (1 << 30)) {
+      WARN("RCCL_HOST_HUGEPAGE_SIZE=%ld is not 2MB (2097152) or 1GB (1073741824), using regular pages", size);
+      return 0;
+    }
+    return size;
+  }();
+  return pageSize;
+}
+
+ncclResult_t ncclHugePagesHostAlloc(void** ptr, size_t size) {
+  *ptr = NULL;
+  size_t pageSize = ncclHugePageSize();
+  if (pageSize == 0 || size < pageSize/2) return ncclSuccess;
+
+  size_t mapSize = DIVUP(size, pageSize)*pageSize;
+  int pageShift = pageSize == (1 << 30) ? 30 : 21;
+  void* hostPtr = mmap(NULL, mapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|(pageShift << MAP_HUGE_SHIFT), -1, 0);
+  if (hostPtr == MAP_FAILED) {
+    INFO(NCCL_ALLOC, "No %zu KB huge pages left for %zu bytes of pinned host memory, using regular pages : %s", pageSize >> 10, size, strerror(errno));
+    return ncclSuccess;
+  }
+  // Callers use the host pointer on the device too, which registered memory only allows when
+  // HIP maps it at the same address
+  void* devPtr = NULL;
+  hipError_t err = hipHostRegister(hostPtr, mapSize, hipHostRegisterMapped);
+  if (err == hipSuccess) {
+    err = hipHostGetDevicePointer(&devPtr, hostPtr, 0);
+    if (err != hipSuccess || devPtr != hostPtr) (void)hipHostUnregister(hostPtr);
+  }
+  if (err != hipSuccess || devPtr != hostPtr) {
+    INFO(NCCL_ALLOC, "Could not register %zu KB huge pages at %p with HIP, using regular pages : %s", pageSize >> 10, hostPtr,
+        err != hipSuccess ? hipGetErrorString(err) : "device address differs");
+    (void)hipGetLastError();
+    munmap(hostPtr, mapSize);
+    return ncclSuccess;
+  }
+  {
+    std::lock_guard<std::mutex> lock(hugePagesMutex);
+    hugePagesMaps[hostPtr] = mapSize;
+  }
+  *ptr = hostPtr;
+  INFO(NCCL_ALLOC, "Allocated %zu bytes of pinned host memory at %p on %zu KB huge pages", size, hostPtr, pageSize >> 10);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclHugePagesHostFree(void* ptr, bool* freed) {
+  *freed = false;
+  if (ncclHugePageSize() == 0 || ptr == NULL) return ncclSuccess;
+  size_t mapSize;
+  {
+    std::lock_guard<std::mutex> lock(hugePagesMutex);
+    auto it = hugePagesMaps.find(ptr);
+    if (it == hugePagesMaps.end()) return ncclSuccess;
+    mapSize = it->second;
+    hugePagesMaps.erase(it);
+  }
+  *freed = true;
+  CUDACHECK(hipHostUnregister(ptr));
+  SYSCHECK(munmap(ptr, mapSize), "munmap");
+  return ncclSuccess;
+}
@@ -0,0 +1,223 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "hw_counters.h"
+#include "comm.h"
+#include "param.h"
+#include "utils.h"
+#include "chrome_trace.h"
+#include "rocm_smi_wrap.h"
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Hardware counter sampler.
+ *
+ * Enabled with RCCL_HW_COUNTER_INTERVAL_MS > 0. A thread of the process reads
+ * every interval:
+ *   for each IB device and port of the process (ncclIbDevs), the sysfs port
+ *   counters port_xmit_data, port_rcv_data and port_xmit_wait (ticks the port
+ *   had data but no credits, which PFC pauses and congestion raise) and, when
+ *   the driver exposes them, the hw_counters np_ecn_marked_roce_packets,
+ *   np_cnp_sent and rp_cnp_handled;
+ *   for the GPU of each communicator, the ROCm SMI xGMI outbound data counter
+ *   of each link.
+ * Counters become per second rates. They go to the Chrome trace as counter
+ * tracks, as CSV lines to RCCL_HW_COUNTER_FILE when set, and the average and
+ * peak rate of each counter are logged when the last communicator is
+ * destroyed, so a slow collective can be lined up with the fabric. */
+RCCL_PARAM(HwCounterIntervalMs, "HW_COUNTER_INTERVAL_MS", 0);
+
+#define HW_XGMI_MAX_LINKS 8
+#define HW_XGMI_BEAT_BYTES 32
+
+struct hwCounter {
+  const char* name; // Interned, outlives the Chrome trace
+  double scale;     // Units per counter increment
+  std::string path; // sysfs file, empty for xGMI links
+  int xgmi;         // Index in hwXgmis
+  int link;
+  uint64_t last;
+  uint64_t lastNs;
+  double sumRate;
+  double maxRate;
+  uint64_t nSamples;
+};
+
+struct hwXgmi {
+  int64_t busId;
+  int nLinks;
+  int failed;
+  rsmi_event_handle_t handles[HW_XGMI_MAX_LINKS];
+  uint64_t beats[HW_XGMI_MAX_LINKS];
+};
+
+static std::mutex hwMutex;
+static int hwRefs = 0;
+static int hwStop = 0;
+static pthread_t hwThread;
+static uint64_t hwIntervalMs = 0;
+static std::vector<struct hwCounter> hwCounters;
+static std::vector<struct hwXgmi> hwXgmis;
+static FILE* hwFile = nullptr;
+static std::deque<std::string> hwNames;
+
+static const char* hwIntern(const std::string& name) {
+  hwNames.push_back(name);
+  return hwNames.back().c_str();
+}
+
+static bool hwReadSysfs(const std::string& path, uint64_t* value) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (f == nullptr) return false;
+  unsigned long long v;
+  bool ok = fscanf(f, "%llu", &v) == 1;
+  fclose(f);
+  if (ok) *value = v;
+  return ok;
+}
+
+static void hwAddIbCounters() {
+  const char* devNames[MAXCHANNELS];
+  int ports[MAXCHANNELS];
+  int nDevs = ncclIbGetDevPorts(devNames, ports, MAXCHANNELS);
+  static const struct { const char* file; const char* name; double scale; } ibCounters[] = {
+    { "counters/port_xmit_data", "xmit MB/s", 4/1e6 },
+    { "counters/port_rcv_data", "rcv MB/s", 4/1e6 },
+    { "counters/port_xmit_wait", "xmit_wait/s", 1 },
+    { "hw_counters/np_ecn_marked_roce_packets", "ecn_marked/s", 1 },
+    { "hw_counters/np_cnp_sent", "cnp_sent/s", 1 },
+    { "hw_counters/rp_cnp_handled", "cnp_handled/s", 1 },
+  };
+  for (int d=0; d<nDevs; d++) {
+    for (auto& c : ibCounters) {
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "/sys/class/infiniband/%s/ports/%d/%s", devNames[d], ports[d], c.file);
+      uint64_t value;
+      if (!hwReadSysfs(path, &value)) continue;
+      struct hwCounter counter = {};
+      counter.name = hwIntern(std::string(devNames[d]) + ":" + std::to_string(ports[d]) + " " + c.name);
+      counter.scale = c.scale;
+      counter.path = path;
+      counter.xgmi = -1;
+      hwCounters.push_back(counter);
+    }
+  }
+}
+
+static void hwAddXgmiCounters(int64_t busId) {
+  for (auto& x : hwXgmis) if (x.busId == busId) return;
+  char busIdStr[] = "00000000:00:00.0";
+  uint32_t deviceIndex;
+  if (int64ToBusId(busId, busIdStr) != ncclSuccess) return;
+  if (rocm_smi_init() != ncclSuccess || rocm_smi_getDeviceIndexByPciBusId(busIdStr, &deviceIndex) != ncclSuccess) return;
+  struct hwXgmi xgmi = {};
+  xgmi.busId = busId;
+  if (rocm_smi_xgmiCountersCreate(deviceIndex, HW_XGMI_MAX_LINKS, xgmi.handles, &xgmi.nLinks) != ncclSuccess || xgmi.nLinks == 0) {
+    INFO(NCCL_INIT, "No xGMI counters for GPU %s", busIdStr);
+    return;
+  }
+  hwXgmis.push_back(xgmi);
+  for (int l=0; l<xgmi.nLinks; l++) {
+    struct hwCounter counter = {};
+    counter.name = hwIntern(std::string("gpu ") + busIdStr + " xgmi" + std::to_string(l) + " MB/s");
+    counter.scale = HW_XGMI_BEAT_BYTES/1e6;
+    counter.xgmi = hwXgmis.size()-1;
+    counter.link = l;
+    hwCounters.push_back(counter);
+  }
+}
+
+// Called with hwMutex held
+static void hwSample() {
+  uint64_t now = clockNano();
+  for (auto& x : hwXgmis) {
+    if (!x.failed && rocm_smi_xgmiCountersRead(x.nLinks, x.handles, x.beats) != ncclSuccess) x.failed = 1;
+  }
+  for (auto& c : hwCounters) {
+    uint64_t value;
+    if (c.xgmi >= 0) {
+      struct hwXgmi* x = &hwXgmis[c.xgmi];
+      if (x->failed) continue;
+      value = x->beats[c.link];
+    } else if (!hwReadSysfs(c.path, &value)) {
+      continue;
+    }
+    if (c.lastNs && value >= c.last) {
+      double rate = (value - c.last)*c.scale*1e9/(now - c.lastNs);
+      c.sumRate += rate;
+      c.maxRate = std::max(c.maxRate, rate);
+      c.nSamples++;
+      if (ncclChromeTraceEnabled()) ncclChromeTraceCounter(c.name, ncclChromeTraceNow(), rate);
+      if (hwFile) fprintf(hwFile, "%lu,%s,%.3f\n", now, c.name, rate);
+    }
+    c.last = value;
+    c.lastNs = now;
+  }
+}
+
+static void* hwThreadMain(void*) {
+  uint64_t next = clockNano();
+  while (1) {
+    {
+      std::lock_guard<std::mutex> lock(hwMutex);
+      if (hwStop) break;
+      if (clockNano() >= next) {
+        hwSample();
+        next += hwIntervalMs*1000000;
+      }
+    }
+    usleep(std::min<uint64_t>(hwIntervalMs*1000, 10000));
+  }
+  return nullptr;
+}
+
+ncclResult_t ncclHwCountersInit(struct ncclComm* comm) {
+  int64_t intervalMs = rcclParamHwCounterIntervalMs();
+  if (intervalMs <= 0) return ncclSuccess;
+  std::lock_guard<std::mutex> lock(hwMutex);
+  if (hwRefs++ == 0) {
+    hwIntervalMs = intervalMs;
+    hwStop = 0;
+    hwAddIbCounters();
+    const char* path = getenv("RCCL_HW_COUNTER_FILE");
+    if (path) {
+      hwFile = fopen(path, "w");
+      if (hwFile == nullptr) WARN("Could not open RCCL_HW_COUNTER_FILE %s : %s", path, strerror(errno));
+      else fprintf(hwFile, "timestampNs,counter,rate\n");
+    }
+    pthread_create(&hwThread, NULL, hwThreadMain, NULL);
+    ncclSetThreadName(hwThread, "NCCL HwCounters");
+  }
+  hwAddXgmiCounters(comm->busId);
+  INFO(NCCL_INIT, "Sampling %zu hardware counters every %lu ms", hwCounters.size(), hwIntervalMs);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclHwCountersFinalize() {
+  {
+    std::lock_guard<std::mutex> lock(hwMutex);
+    if (hwRefs == 0 || --hwRefs > 0) return ncclSuccess;
+    hwStop = 1;
+  }
+  pthread_join(hwThread, nullptr);
+  for (auto& c : hwCounters) {
+    if (c.nSamples == 0) continue;
+    INFO(NCCL_INIT, "Hardware counter %s: avg %.1f max %.1f over %lu samples", c.name, c.sumRate/c.nSamples, c.maxRate, c.nSamples);
+  }
+  for (auto& x : hwXgmis) rocm_smi_xgmiCountersDestroy(x.nLinks, x.handles);
+  hwXgmis.clear();
+  hwCounters.clear();
+  if (hwFile) fclose(hwFile);
+  hwFile = nullptr;
+  return ncclSuccess;
+}
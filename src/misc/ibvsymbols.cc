@@ -45,6 +45,8 @@ ncclResult_t buildIbvSymbols(struct ncclIbvSymbols* ibvSymbols) {
   ASSIGN_SYM(ibvSymbols, ibv_dereg_mr, ibv_internal_dereg_mr);
   ASSIGN_SYM(ibvSymbols, ibv_create_cq, ibv_internal_create_cq);
   ASSIGN_SYM(ibvSymbols, ibv_destroy_cq, ibv_internal_destroy_cq);
+  ASSIGN_SYM(ibvSymbols, ibv_create_srq, ibv_internal_create_srq);
+  ASSIGN_SYM(ibvSymbols, ibv_destroy_srq, ibv_internal_destroy_srq);
   ASSIGN_SYM(ibvSymbols, ibv_create_qp, ibv_internal_create_qp);
   ASSIGN_SYM(ibvSymbols, ibv_modify_qp, ibv_internal_modify_qp);
   ASSIGN_SYM(ibvSymbols, ibv_destroy_qp, ibv_internal_destroy_qp);
@@ -117,6 +119,8 @@ ncclResult_t buildIbvSymbols(struct ncclIbvSymbols* ibvSymbols) {
   LOAD_SYM(ibvhandle, "ibv_dereg_mr", ibvSymbols->ibv_internal_dereg_mr);
   LOAD_SYM(ibvhandle, "ibv_create_cq", ibvSymbols->ibv_internal_create_cq);
   LOAD_SYM(ibvhandle, "ibv_destroy_cq", ibvSymbols->ibv_internal_destroy_cq);
+  LOAD_SYM(ibvhandle, "ibv_create_srq", ibvSymbols->ibv_internal_create_srq);
+  LOAD_SYM(ibvhandle, "ibv_destroy_srq", ibvSymbols->ibv_internal_destroy_srq);
   LOAD_SYM(ibvhandle, "ibv_create_qp", ibvSymbols->ibv_internal_create_qp);
   LOAD_SYM(ibvhandle, "ibv_modify_qp", ibvSymbols->ibv_internal_modify_qp);
   LOAD_SYM(ibvhandle, "ibv_destroy_qp", ibvSymbols->ibv_internal_destroy_qp);
@@ -145,6 +149,8 @@ teardown:
   ibvSymbols->ibv_internal_dereg_mr = NULL;
   ibvSymbols->ibv_internal_create_cq = NULL;
   ibvSymbols->ibv_internal_destroy_cq = NULL;
+  ibvSymbols->ibv_internal_create_srq = NULL;
+  ibvSymbols->ibv_internal_destroy_srq = NULL;
   ibvSymbols->ibv_internal_create_qp = NULL;
   ibvSymbols->ibv_internal_modify_qp = NULL;
   ibvSymbols->ibv_internal_destroy_qp = NULL;
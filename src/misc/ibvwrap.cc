@@ -167,6 +167,23 @@ ncclResult_t wrap_ibv_dereg_mr(struct ibv_mr *mr) { /*returns 0 on success, or t
   IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_dereg_mr, ibv_internal_dereg_mr(mr), 0, "ibv_dereg_mr");
 }
 
+ncclResult_t wrap_ibv_advise_mr_prefetch(struct ibv_pd *pd, uint32_t lkey, void *addr, size_t length, int write) {
+#ifdef NCCL_BUILD_RDMA_CORE
+  struct ibv_sge sge;
+  sge.addr = (uint64_t)addr;
+  sge.length = length;
+  sge.lkey = lkey;
+  int ret = ibv_advise_mr(pd, write ? IB_UVERBS_ADVISE_MR_ADVICE_PREFETCH_WRITE : IB_UVERBS_ADVISE_MR_ADVICE_PREFETCH, 0, &sge, 1);
+  if (ret != 0) {
+    WARN("Call to ibv_advise_mr failed with error %s", strerror(ret));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+#else
+  return ncclInvalidUsage;
+#endif
+}
+
 ncclResult_t wrap_ibv_create_cq(struct ibv_cq **ret, struct ibv_context *context, int cqe, void *cq_context, struct ibv_comp_channel *channel, int comp_vector) {
   IBV_PTR_CHECK_ERRNO(ibvSymbols, ibv_internal_create_cq, ibv_internal_create_cq(context, cqe, cq_context, channel, comp_vector), *ret, NULL, "ibv_create_cq");
 }
@@ -175,6 +192,14 @@ ncclResult_t wrap_ibv_destroy_cq(struct ibv_cq *cq) {
   IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_cq, ibv_internal_destroy_cq(cq), 0, "ibv_destroy_cq");
 }
 
+ncclResult_t wrap_ibv_create_srq(struct ibv_srq **ret, struct ibv_pd *pd, struct ibv_srq_init_attr *srq_init_attr) {
+  IBV_PTR_CHECK_ERRNO(ibvSymbols, ibv_internal_create_srq, ibv_internal_create_srq(pd, srq_init_attr), *ret, NULL, "ibv_create_srq");
+}
+
+ncclResult_t wrap_ibv_destroy_srq(struct ibv_srq *srq) {
+  IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_srq, ibv_internal_destroy_srq(srq), 0, "ibv_destroy_srq");
+}
+
 ncclResult_t wrap_ibv_destroy_qp(struct ibv_qp *qp) {
   IBV_INT_CHECK_RET_ERRNO(ibvSymbols, ibv_internal_destroy_qp, ibv_internal_destroy_qp(qp), 0, "ibv_destroy_qp");
 }
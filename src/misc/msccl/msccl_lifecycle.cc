@@ -3,10 +3,12 @@
  * Licensed under the MIT License.
  ************************************************************************/
 
+#include <algorithm>
 #include <atomic>
 #include <map>
 #include <mutex>
 #include <set>
+#include <thread>
 
 #include <dirent.h>
 #include <dlfcn.h>
@@ -14,6 +16,7 @@
 #include <link.h>
 
 #include "alloc.h"
+#include "bootstrap.h"
 #include "checks.h"
 #include "graph/topo.h"
 
@@ -21,9 +24,16 @@
 #include "msccl/msccl_parser.h"
 #include "msccl/msccl_setup.h"
 #include "msccl/msccl_status.h"
+#include "msccl/msccl_synth.h"
 
 RCCL_PARAM(MscclEnabled, "MSCCL_ENABLE", 1);
 RCCL_PARAM(MscclForceEnabled, "MSCCL_FORCE_ENABLE", 0);
+RCCL_PARAM(MscclLazyLoad, "MSCCL_LAZY_LOAD", 0);
+RCCL_PARAM(MscclAutotune, "MSCCL_AUTOTUNE", 0);
+RCCL_PARAM(MscclAutotuneIters, "MSCCL_AUTOTUNE_ITERS", 3);
+RCCL_PARAM(MscclAutotuneInterval, "MSCCL_AUTOTUNE_INTERVAL", 0);
+RCCL_PARAM(MscclSynthesize, "MSCCL_SYNTHESIZE", 0);
+RCCL_PARAM(MscclLoadThreads, "MSCCL_LOAD_THREADS", 0);
 static const char* mscclAlgoFilePathEnv = "MSCCL_ALGO_FILE_PATH";
 static std::atomic<bool> mscclInitialized;
 static std::mutex mscclLifecycleMutex;
@@ -77,20 +87,35 @@ static const char* mscclUnitTestAlgoDefaultDir = "msccl-unit-test-algorithms";
 static const char* mscclAlgoShareDirPath = "../share/rccl/msccl-algorithms";
 static const char* mscclUnitTestAlgoShareDirPath = "../share/rccl/msccl-unit-test-algorithms";
 
+// Synthesized algorithms only fit communicators with the layout they were made for
+static bool mscclMetaFitsComm(const mscclAlgoMeta& m, ncclComm_t comm) {
+  return m.nRanks == comm->nRanks && (m.layoutHash == 0 || m.layoutHash == comm->mscclLayoutHash);
+}
+
 static ncclResult_t mscclInternalSchedulerInit(ncclComm_t comm, int* numChannelsRequired) {
   static bool mscclAlgoMetaLoaded = false;
   mscclStatus& status = mscclGetStatus();
 
   *numChannelsRequired = 0;
+  // Synthesized algorithms only differ between communicators with different layouts
+  if (rcclParamMscclSynthesize()) {
+    NCCLCHECK(mscclSynthesizeAlgos(comm, status.algoMetas));
+  }
   // Query numChannelsRequired from loaded algorithm metas
   if (mscclAlgoMetaLoaded) {
     for (auto& m : status.algoMetas) {
-      if (comm->nRanks == m.nRanks) {
+      if (mscclMetaFitsComm(m, comm)) {
         *numChannelsRequired = std::max(*numChannelsRequired, m.nChannels);
       }
     }
+    status.rankToAlgoHandles.resize(status.algoMetas.size());
     return ncclSuccess;
   }
+  for (auto& m : status.algoMetas) {
+    if (mscclMetaFitsComm(m, comm)) {
+      *numChannelsRequired = std::max(*numChannelsRequired, m.nChannels);
+    }
+  }
 
   const char* mscclAlgoDir = getenv(mscclAlgoDirEnv);
   const char* mscclAlgoShareDir = nullptr;
@@ -139,7 +164,7 @@ static ncclResult_t mscclInternalSchedulerInit(ncclComm_t comm, int* numChannels
     fullPath += "/";
     fullPath += entry->d_name;
     NCCLCHECK(mscclGetAlgoMetaFromXmlFile(fullPath.c_str(), &(status.algoMetas.back())));
-    if (status.algoMetas.back().nRanks == comm->nRanks) {
+    if (mscclMetaFitsComm(status.algoMetas.back(), comm)) {
       *numChannelsRequired = std::max(*numChannelsRequired, status.algoMetas.back().nChannels);
     }
   }
@@ -191,6 +216,79 @@ ncclResult_t mscclSchedulerInit(ncclComm_t comm, int* numChannelsRequired) {
   return ncclSuccess;
 }
 
+// Parses the algorithms of metas for rank on a pool of threads and uploads them
+// together. Caller holds mscclLifecycleMutex.
+static ncclResult_t mscclLoadAlgos(const std::vector<size_t>& metas, int rank) {
+  mscclStatus& status = mscclGetStatus();
+  const size_t nAlgos = metas.size();
+  if (nAlgos == 0) return ncclSuccess;
+  if (status.freeAlgoHandles.size() < nAlgos) {
+    WARN("MSCCL: MSCCL_MAX_NUM_ALGOS (%d) limit reached", MSCCL_MAX_NUM_ALGOS);
+    return ncclInvalidUsage;
+  }
+
+  std::vector<struct mscclAlgo*> hostAlgos(nAlgos, nullptr);
+  std::vector<ncclResult_t> results(nAlgos, ncclSuccess);
+  std::atomic<size_t> next(0);
+  auto parse = [&]() {
+    for (size_t j = next++; j < nAlgos; j = next++) {
+      results[j] = ncclCalloc(&hostAlgos[j], 1);
+      if (results[j] == ncclSuccess) {
+        results[j] = mscclGetAlgoFromCachedXmlFile(status.algoMetas[metas[j]].filePath.c_str(), hostAlgos[j], rank);
+      }
+    }
+  };
+  int64_t nThreads = rcclParamMscclLoadThreads();
+  if (nThreads <= 0) nThreads = std::min(16u, std::max(1u, std::thread::hardware_concurrency()));
+  nThreads = std::min(nThreads, (int64_t)nAlgos);
+  std::vector<std::thread> threads;
+  for (int64_t t = 1; t < nThreads; t++) threads.emplace_back(parse);
+  parse();
+  for (auto& t : threads) t.join();
+
+  ncclResult_t ret = ncclSuccess;
+  for (auto r : results) {
+    if (r != ncclSuccess) {
+      ret = r;
+      break;
+    }
+  }
+  std::vector<struct mscclDevAlgo*> devAlgos(nAlgos, nullptr);
+  if (ret == ncclSuccess) ret = mscclSetupDevAlgos(hostAlgos.data(), nAlgos, devAlgos.data());
+  if (ret != ncclSuccess) {
+    for (auto hostAlgo : hostAlgos) free(hostAlgo);
+    return ret;
+  }
+  for (size_t j = 0; j < nAlgos; j++) {
+    mscclAlgoHandle_t mscclAlgoHandle = status.freeAlgoHandles.back();
+    status.freeAlgoHandles.pop_back();
+    status.hostAlgos[mscclAlgoHandle] = hostAlgos[j];
+    status.devAlgos[mscclAlgoHandle] = devAlgos[j];
+    status.rankToAlgoHandles[metas[j]][rank] = mscclAlgoHandle;
+  }
+  INFO(NCCL_INIT, "MSCCL: loaded %zu algorithms for rank %d on %ld threads", nAlgos, rank, nThreads);
+  return ncclSuccess;
+}
+
+// Loads algorithm i for the rank of comm and connects it, unless already done.
+// Connecting is collective over comm. Caller holds mscclLifecycleMutex.
+static ncclResult_t mscclLoadAndConnectAlgo(size_t i, ncclComm_t comm, mscclAlgoHandle_t* mscclAlgoHandle) {
+  mscclStatus& status = mscclGetStatus();
+  auto &handles = status.rankToAlgoHandles[i];
+  auto it = handles.find(comm->rank);
+  if (it == handles.end()) {
+    NCCLCHECK(mscclLoadAlgo(status.algoMetas[i].filePath.c_str(), mscclAlgoHandle, comm->rank));
+    handles[comm->rank] = *mscclAlgoHandle;
+  } else {
+    *mscclAlgoHandle = it->second;
+  }
+  if (status.connectedAlgos[comm].find(*mscclAlgoHandle) == status.connectedAlgos[comm].end()) {
+    NCCLCHECK(mscclSetupConnections(status.hostAlgos[*mscclAlgoHandle], comm));
+    status.connectedAlgos[comm].insert(*mscclAlgoHandle);
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t mscclInit(ncclComm_t comm) {
   // Always initialize thread local status
   mscclThreadLocalStatus threadLocalStatus = mscclGetThreadLocalStatus();
@@ -215,21 +313,19 @@ ncclResult_t mscclInit(ncclComm_t comm) {
     // Pre-process all algorithms for internal scheduler and for different comms.
     // This is a temp fix to bypass the issue that stream cannot be synchronized during HIP graph capturing,
     // should use dynamic loading approach after the issue is fixed.
-    if (comm->mscclCompatible && !status.mscclSchedulerPtr) {
+    // With RCCL_MSCCL_LAZY_LOAD, algorithms are instead loaded the first time they are selected.
+    if (comm->mscclCompatible && !status.mscclSchedulerPtr && !rcclParamMscclLazyLoad()) {
+      std::vector<size_t> toLoad;
       for (size_t i = 0; i < status.algoMetas.size(); i++) {
-        auto &m = status.algoMetas[i];
-        mscclAlgoHandle_t mscclAlgoHandle;
-        if (m.nRanks == comm->nRanks) {
-          // Load algorithms
-          if (status.rankToAlgoHandles[i].find(comm->rank) == status.rankToAlgoHandles[i].end()) {
-            NCCLCHECK(mscclLoadAlgo(m.filePath.c_str(), &mscclAlgoHandle, comm->rank));
-            status.rankToAlgoHandles[i][comm->rank] = mscclAlgoHandle;
-          }
-          // Connect algorithms
-          if (status.connectedAlgos[comm].find(mscclAlgoHandle) == status.connectedAlgos[comm].end()) {
-            NCCLCHECK(mscclSetupConnections(status.hostAlgos[mscclAlgoHandle], comm));
-            status.connectedAlgos[comm].insert(mscclAlgoHandle);
-          }
+        if (mscclMetaFitsComm(status.algoMetas[i], comm) && status.rankToAlgoHandles[i].count(comm->rank) == 0) {
+          toLoad.push_back(i);
+        }
+      }
+      NCCLCHECK(mscclLoadAlgos(toLoad, comm->rank));
+      for (size_t i = 0; i < status.algoMetas.size(); i++) {
+        if (mscclMetaFitsComm(status.algoMetas[i], comm)) {
+          mscclAlgoHandle_t mscclAlgoHandle;
+          NCCLCHECK(mscclLoadAndConnectAlgo(i, comm, &mscclAlgoHandle));
         }
       }
     }
@@ -262,8 +358,122 @@ ncclResult_t mscclGroupStart() {
   return ncclSuccess;
 }
 
-static ncclResult_t mscclInternalSchedulerSelectAlgo(struct mscclSchedulerParam* param) {
+// Schedules algorithm i if the rank of comm has it loaded and connected, or loads it now
+static ncclResult_t mscclScheduleAlgo(int i, struct mscclSavedSchedulerParam* savedParam, bool load) {
   mscclStatus& status = mscclGetStatus();
+  struct mscclSchedulerParam* param = &savedParam->p;
+  auto it = status.rankToAlgoHandles[i].find(param->rank);
+  if (it != status.rankToAlgoHandles[i].end() &&
+      status.connectedAlgos[savedParam->comm].count(it->second)) {
+    param->handle = it->second;
+    param->scheduled = true;
+  } else if (load) {
+    std::lock_guard<std::mutex> lock(mscclLifecycleMutex);
+    NCCLCHECK(mscclLoadAndConnectAlgo(i, savedParam->comm, &param->handle));
+    param->scheduled = true;
+  }
+  return ncclSuccess;
+}
+
+/* Measured selection
+ * Operations are bucketed by function, type, placement, power of two size and
+ * the set of algorithm files able to run them. The first operations of a
+ * bucket cycle through its candidates, the algorithm files and the built-in
+ * RCCL algorithms, timed with events on the user stream. Ranks then exchange
+ * their times and all pick the candidate whose slowest rank is fastest. With
+ * RCCL_MSCCL_AUTOTUNE_INTERVAL, buckets are measured again every so many
+ * operations so choices follow changes of the system.
+ */
+static ncclResult_t mscclAutotuneDecide(ncclComm_t comm, struct mscclTuneBucket* bucket) {
+  int nCandidates = bucket->candidates.size();
+  std::vector<float> times(nCandidates*comm->nRanks, 0);
+  float* myTimes = times.data() + comm->rank*nCandidates;
+  // Events come in start/stop pairs, one per trial. The first round is a warmup.
+  for (size_t e = 0; e + 1 < bucket->events.size(); e += 2) {
+    int trial = e/2;
+    if (trial >= nCandidates) {
+      float ms;
+      CUDACHECK(hipEventSynchronize(bucket->events[e+1]));
+      CUDACHECK(hipEventElapsedTime(&ms, bucket->events[e], bucket->events[e+1]));
+      myTimes[trial % nCandidates] += ms;
+    }
+  }
+  for (auto event : bucket->events) CUDACHECK(hipEventDestroy(event));
+  bucket->events.clear();
+  NCCLCHECK(bootstrapAllGather(comm->bootstrap, times.data(), nCandidates*sizeof(float)));
+
+  float bestTime = 0;
+  for (int c = 0; c < nCandidates; c++) {
+    float time = 0;
+    for (int r = 0; r < comm->nRanks; r++) time = std::max(time, times[r*nCandidates+c]);
+    if (c == 0 || time < bestTime) {
+      bestTime = time;
+      bucket->choice = c;
+    }
+  }
+  int best = bucket->candidates[bucket->choice];
+  INFO(NCCL_TUNING, "MSCCL: rank %d picked %s (%.3f ms) among %d candidates",
+    comm->rank, best >= 0 ? mscclGetStatus().algoMetas[best].filePath.c_str() : "RCCL built-in", bestTime, nCandidates);
+  bucket->decided = true;
+  bucket->nOps = 0;
+  return ncclSuccess;
+}
+
+// Sets *selected when the choice is made by measurement. Operations to time get tuneBucket set.
+static ncclResult_t mscclAutotuneSelectAlgo(struct mscclSavedSchedulerParam* savedParam, bool isInPlace,
+    const std::vector<int>& matches, bool canMeasure, bool* selected) {
+  mscclStatus& status = mscclGetStatus();
+  struct mscclSchedulerParam* param = &savedParam->p;
+  *selected = false;
+
+  uint64_t key = (uint64_t)log2i(param->count * ncclTypeSize(param->dataType)) << 16 |
+    param->dataType << 9 | (isInPlace ? 1 : 0) << 8 | param->func;
+  struct mscclTuneBucket* bucket;
+  {
+    std::lock_guard<std::mutex> lock(mscclLifecycleMutex);
+    bucket = &status.tuneBuckets[savedParam->comm][std::make_pair(key, matches)];
+  }
+  if (bucket->candidates.empty()) {
+    bucket->candidates = matches;
+    bucket->candidates.push_back(-1);
+  }
+
+  if (!bucket->decided) {
+    if (!canMeasure) return ncclSuccess;
+    int nCandidates = bucket->candidates.size();
+    if (bucket->nTrials < nCandidates*(rcclParamMscclAutotuneIters()+1)) {
+      int c = bucket->candidates[bucket->nTrials++ % nCandidates];
+      if (c >= 0) NCCLCHECK(mscclScheduleAlgo(c, savedParam, true));
+      savedParam->tuneBucket = bucket;
+      *selected = true;
+      return ncclSuccess;
+    }
+    NCCLCHECK(mscclAutotuneDecide(savedParam->comm, bucket));
+  }
+
+  int c = bucket->candidates[bucket->choice];
+  if (c >= 0) NCCLCHECK(mscclScheduleAlgo(c, savedParam, canMeasure));
+  *selected = true;
+  int64_t interval = rcclParamMscclAutotuneInterval();
+  if (interval > 0 && ++bucket->nOps >= interval) {
+    bucket->decided = false;
+    bucket->nTrials = 0;
+  }
+  return ncclSuccess;
+}
+
+// Records a start or stop event of an operation timed by measured selection
+static ncclResult_t mscclAutotuneRecord(struct mscclTuneBucket* bucket, hipStream_t stream) {
+  hipEvent_t event;
+  CUDACHECK(hipEventCreate(&event));
+  bucket->events.push_back(event);
+  CUDACHECK(hipEventRecord(event, stream));
+  return ncclSuccess;
+}
+
+static ncclResult_t mscclInternalSchedulerSelectAlgo(struct mscclSavedSchedulerParam* savedParam) {
+  mscclStatus& status = mscclGetStatus();
+  struct mscclSchedulerParam* param = &savedParam->p;
   param->scheduled = false;
 
   
@@ -288,23 +498,45 @@ static ncclResult_t mscclInternalSchedulerSelectAlgo(struct mscclSchedulerParam*
     isInPlace = (char*)param->recvBuff == (char*)param->sendBuff + param->rank * param->count * ncclTypeSize(param->dataType);
   }
 
-  // Search suitable algorithms
+  // Search suitable algorithms. Measured selection ignores the size ranges of the
+  // algorithm files, they are tuned for the systems the algorithms were written on.
+  bool autotune = rcclParamMscclAutotune();
+  std::vector<int> matches;
   for (size_t i = 0; i < status.algoMetas.size(); i++) {
     auto &m = status.algoMetas[i];
     size_t nBytes = param->count * ncclTypeSize(param->dataType) * m.sizeMultiplier;
     bool msgSizeIsValid =
       param->count > 0 && (param->count % m.nChunksPerLoop) == 0 &&
-      nBytes >= m.minBytes && (m.maxBytes == 0 || nBytes <= m.maxBytes);
+      (autotune || (nBytes >= m.minBytes && (m.maxBytes == 0 || nBytes <= m.maxBytes)));
     if (msgSizeIsValid &&
-        m.nRanks == param->nRanks &&
+        mscclMetaFitsComm(m, savedParam->comm) &&
         m.func == param->func &&
         (isInPlace ? m.inPlace : m.outOfPlace)) {
-      param->handle = status.rankToAlgoHandles[i][param->rank];
-      param->scheduled = true;
-      return ncclSuccess;
+      matches.push_back(i);
     }
   }
 
+  // Loading synchronizes the stream and connects peers, so it can only happen
+  // outside of groups and graph capture. Every rank makes the same choice.
+  hipStreamCaptureStatus captureStatus;
+  CUDACHECK(hipStreamIsCapturing(savedParam->stream, &captureStatus));
+  bool canLoad = captureStatus == hipStreamCaptureStatusNone && mscclGetThreadLocalStatus().groupStatus == mscclNoGroup;
+
+  if (autotune && matches.size()) {
+    bool selected;
+    NCCLCHECK(mscclAutotuneSelectAlgo(savedParam, isInPlace, matches, canLoad, &selected));
+    if (selected) return ncclSuccess;
+    // Still measuring, use the first algorithm that fits its size range
+    matches.erase(std::remove_if(matches.begin(), matches.end(), [&](int i) {
+      auto &m = status.algoMetas[i];
+      size_t nBytes = param->count * ncclTypeSize(param->dataType) * m.sizeMultiplier;
+      return nBytes < m.minBytes || (m.maxBytes != 0 && nBytes > m.maxBytes);
+    }), matches.end());
+  }
+  for (int i : matches) {
+    NCCLCHECK(mscclScheduleAlgo(i, savedParam, rcclParamMscclLazyLoad() && canLoad));
+    if (param->scheduled) break;
+  }
   return ncclSuccess;
 }
 
@@ -314,7 +546,7 @@ static ncclResult_t mscclSchedulerSelectAlgo(struct mscclSavedSchedulerParam* pa
     NCCLCHECK(status.mscclSchedulerPtr->selectAlgo(&(param->p)));
   } else {
     if (param->comm->topo->mscclEnabled || rcclParamMscclForceEnabled()) {
-      NCCLCHECK(mscclInternalSchedulerSelectAlgo(&(param->p)));
+      NCCLCHECK(mscclInternalSchedulerSelectAlgo(param));
     } else {
       param->p.scheduled = false;
     }
@@ -344,6 +576,7 @@ static ncclResult_t mscclSetSavedSchedulerParam(
   param->p.nRanks = comm->nRanks;
   param->comm = comm;
   param->stream = stream;
+  param->tuneBucket = nullptr;
   param->p.opCount = comm->opCount;
   return ncclSuccess;
 }
@@ -467,16 +700,22 @@ ncclResult_t mscclEnqueueCheck(
     &threadLocalStatus.savedSchedulerParams.back()));
 
   switch (threadLocalStatus.groupStatus) {
-    case mscclNoGroup:
+    case mscclNoGroup: {
+      struct mscclTuneBucket* tuneBucket = nullptr;
       if (comm->mscclCompatible) {
           NCCLCHECK(mscclSchedulerSelectAlgo(&threadLocalStatus.savedSchedulerParams.back()));
+          tuneBucket = threadLocalStatus.savedSchedulerParams.back().tuneBucket;
+          if (tuneBucket) NCCLCHECK(mscclAutotuneRecord(tuneBucket, stream));
           if (threadLocalStatus.savedSchedulerParams.back().p.scheduled) {
             NCCLCHECK(mscclRunSavedParams());
+            if (tuneBucket) NCCLCHECK(mscclAutotuneRecord(tuneBucket, stream));
             break;
           }
         }
       NCCLCHECK(mscclFallBackSavedParams());
+      if (tuneBucket) NCCLCHECK(mscclAutotuneRecord(tuneBucket, stream));
       break;
+    }
     case mscclGroupSupportedOp:
       if (comm->mscclCompatible) {
           NCCLCHECK(mscclSchedulerSelectAlgo(&threadLocalStatus.savedSchedulerParams.back()));
@@ -522,6 +761,7 @@ static ncclResult_t mscclInternalSchedulerTeardown() {
   }
   status.algoMetas.clear();
   status.rankToAlgoHandles.clear();
+  mscclSynthesizeCleanup();
   return ret;
 }
 
@@ -552,6 +792,12 @@ ncclResult_t mscclTeardown() {
     status.scratchBuffer = nullptr;
     status.scratchBufferSize = 0;
     status.connectedAlgos.clear();
+    for (auto &c : status.tuneBuckets) {
+      for (auto &b : c.second) {
+        for (auto event : b.second.events) CUDACHECK(hipEventDestroy(event));
+      }
+    }
+    status.tuneBuckets.clear();
     if (status.mscclSchedulerPtr) {
       NCCLCHECK(status.mscclSchedulerPtr->teardown());
       status.mscclSchedulerPtr = nullptr;
@@ -564,6 +810,13 @@ ncclResult_t mscclTeardown() {
     for (auto &p : status.graphWorkFifoStatus) {
       NCCLCHECK(mscclDestroyWorkFifoStatus(&(p.second)));
     }
+    status.graphWorkFifoStatus.clear();
+    for (auto &p : status.graphStates) {
+      CUDACHECK(hipFree(p.second.syncFlags));
+      CUDACHECK(hipFree(p.second.scratchBuffer));
+      for (auto buffer : p.second.retiredScratchBuffers) CUDACHECK(hipFree(buffer));
+    }
+    status.graphStates.clear();
     mscclInitialized.store(false, std::memory_order_release);
   }
 
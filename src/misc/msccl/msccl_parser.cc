@@ -10,7 +10,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <limits.h>
 #include <ctype.h>
+#include <algorithm>
+#include <memory>
 #include "core.h"
 #include "collectives.h"
 #include "msccl/msccl_parser.h"
@@ -219,7 +223,7 @@ ncclResult_t mscclAlgoXmlThreadBlock(FILE* file, struct mscclXml* xmlGraph, stru
   return ncclSuccess;
 }
 
-static int currentRank;
+static thread_local int currentRank;
 
 ncclResult_t mscclAlgoXmlGpu(FILE* file, struct mscclXml* xmlGraph, struct mscclXmlNode* head) {
   int thisrank;
@@ -301,6 +305,107 @@ ncclResult_t mscclProtocolStrToId(const char *protocol, int *protocolId) {
   return ncclSuccess;
 }
 
+static bool mscclTransferHasSend(int type) {
+  return type == MSCCL_SEND || type == MSCCL_RECV_COPY_SEND || type == MSCCL_RECV_REDUCE_SEND || type == MSCCL_RECV_REDUCE_COPY_SEND;
+}
+
+static bool mscclTransferHasRecv(int type) {
+  return type == MSCCL_RECV || type == MSCCL_RECV_COPY_SEND || type == MSCCL_RECV_REDUCE_SEND ||
+    type == MSCCL_RECV_REDUCE_COPY || type == MSCCL_RECV_REDUCE_COPY_SEND;
+}
+
+// Merges adjacent transmissions of a thread block that have the same type and
+// cover contiguous chunks, so that they cost one primitive call instead of
+// several. Nothing may wait in between: the first one must not be waited on
+// and the second one must not wait. stepToTransfer maps the steps of the
+// algorithm file to transmissions, -2 for nop steps which are folded into the
+// next transmission, and is updated.
+static void mscclFuseTransmissions(struct mscclThreadBlock* sTB, struct mscclChannelPeerInfo* sendPeerInfo,
+    struct mscclChannelPeerInfo* recvPeerInfo, int* stepToTransfer) {
+  int next = sTB->nSteps-1;
+  for (int s = MSCCL_MAX_NUM_STEPS-1; s >= 0; s--) {
+    if (stepToTransfer[s] == -2) stepToTransfer[s] = next;
+    else if (stepToTransfer[s] >= 0) next = stepToTransfer[s];
+  }
+
+  int newIndex[MSCCL_MAX_NUM_STEPS];
+  int nSteps = 0;
+  for (int i = 0; i < sTB->nSteps; i++) {
+    struct mscclTransmission* t = &sTB->transmissions[i];
+    struct mscclTransmission* last = nSteps > 0 ? &sTB->transmissions[nSteps-1] : NULL;
+    if (last && t->type == last->type && t->type != MSCCL_REDUCE &&
+        t->numDependencies == 0 && !last->hasDependence &&
+        t->srcBuffer == last->srcBuffer && t->srcOffset == last->srcOffset + last->count &&
+        t->dstBuffer == last->dstBuffer && t->dstOffset == last->dstOffset + last->count &&
+        last->count + t->count < MSCCL_MAX_COUNT) {
+      struct mscclChannelPeerInfo* peerInfos[2] = {
+        mscclTransferHasSend(t->type) ? sendPeerInfo : NULL, mscclTransferHasRecv(t->type) ? recvPeerInfo : NULL };
+      for (auto peerInfo : peerInfos) {
+        if (peerInfo == NULL) continue;
+        peerInfo->nTransmissionsOfCount[last->count]--;
+        peerInfo->nTransmissionsOfCount[t->count]--;
+        peerInfo->nTransmissionsOfCount[last->count + t->count]++;
+      }
+      last->count += t->count;
+      last->hasDependence = t->hasDependence;
+      newIndex[i] = nSteps-1;
+      continue;
+    }
+    if (i != nSteps) sTB->transmissions[nSteps] = *t;
+    newIndex[i] = nSteps++;
+  }
+  sTB->nSteps = nSteps;
+  for (int s = 0; s < MSCCL_MAX_NUM_STEPS; s++) {
+    if (stepToTransfer[s] >= 0) stepToTransfer[s] = newIndex[stepToTransfer[s]];
+  }
+}
+
+// Turns the dependencies on steps of the algorithm file into dependencies on
+// transmissions, which the kernel signals and waits on. Flags only grow within
+// a loop iteration, so a wait on a thread block already covered by an earlier
+// wait of the same thread block is dropped, as are waits on the thread block
+// itself. Only transmissions that are still waited on signal their completion.
+static ncclResult_t mscclRelaxDependencies(struct mscclAlgo* algo, int stepToTransfer[][MSCCL_MAX_NUM_STEPS]) {
+  std::unique_ptr<bool[][MSCCL_MAX_NUM_STEPS]> waitedOn(new bool[MSCCL_MAX_NUM_THREAD_BLOCKS][MSCCL_MAX_NUM_STEPS]());
+  for (int b = 0; b < algo->nBlocks; b++) {
+    struct mscclThreadBlock* sTB = &algo->mscclTBs[b];
+    int waited[MSCCL_MAX_NUM_THREAD_BLOCKS];
+    for (int c = 0; c < MSCCL_MAX_NUM_THREAD_BLOCKS; c++) waited[c] = -1;
+    int nDeps = 0;
+    for (int i = 0; i < sTB->nSteps; i++) {
+      struct mscclTransmission* t = &sTB->transmissions[i];
+      int wait[MSCCL_MAX_NUM_THREAD_BLOCKS];
+      for (int c = 0; c < MSCCL_MAX_NUM_THREAD_BLOCKS; c++) wait[c] = -1;
+      for (int d = t->dependencePointer; d < t->dependencePointer + t->numDependencies; d++) {
+        int dependBid = sTB->dependentBid[d];
+        int dependStep = sTB->dependentStep[d];
+        if (dependBid >= algo->nBlocks || dependStep < 0 || dependStep >= MSCCL_MAX_NUM_STEPS ||
+            stepToTransfer[dependBid][dependStep] < 0) {
+          WARN("MSCCL: thread block %d depends on step %d of thread block %d which does not exist", b, dependStep, dependBid);
+          return ncclInvalidUsage;
+        }
+        int target = stepToTransfer[dependBid][dependStep];
+        if (dependBid != b && target > waited[dependBid]) wait[dependBid] = std::max(wait[dependBid], target);
+      }
+      t->dependencePointer = nDeps;
+      for (int c = 0; c < MSCCL_MAX_NUM_THREAD_BLOCKS; c++) {
+        if (wait[c] < 0) continue;
+        sTB->dependentBid[nDeps] = c;
+        sTB->dependentStep[nDeps] = wait[c];
+        nDeps++;
+        waited[c] = wait[c];
+        waitedOn[c][wait[c]] = true;
+      }
+      t->numDependencies = nDeps - t->dependencePointer;
+    }
+  }
+  for (int b = 0; b < algo->nBlocks; b++) {
+    struct mscclThreadBlock* sTB = &algo->mscclTBs[b];
+    for (int i = 0; i < sTB->nSteps; i++) sTB->transmissions[i].hasDependence = waitedOn[b][i];
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, int rank) {
   struct mscclXml* xml;
   NCCLCHECK(ncclCalloc(&xml, 1));
@@ -380,6 +485,18 @@ ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, in
   NCCLCHECK(mscclXmlGetAttrInt64(topNode, "maxBytes", &maxBytes));
   algo->maxBytes = maxBytes;
 
+  // Optional bounds on the per iteration chunk size picked at launch
+  const char* chunkBytes;
+  NCCLCHECK(mscclXmlGetAttr(topNode, "minchunkbytes", &chunkBytes));
+  algo->minChunkBytes = chunkBytes ? strtoll(chunkBytes, NULL, 0) : 0;
+  NCCLCHECK(mscclXmlGetAttr(topNode, "maxchunkbytes", &chunkBytes));
+  algo->maxChunkBytes = chunkBytes ? strtoll(chunkBytes, NULL, 0) : 0;
+  if (algo->minChunkBytes < 0 || algo->maxChunkBytes < 0 ||
+      (algo->maxChunkBytes && algo->minChunkBytes > algo->maxChunkBytes)) {
+    WARN("MSCCL: invalid chunk size bounds %ld-%ld", algo->minChunkBytes, algo->maxChunkBytes);
+    return ncclInvalidUsage;
+  }
+
   int inplace;
   NCCLCHECK(mscclXmlGetAttrInt(topNode, "inplace", &inplace));
   algo->inPlace = (bool)inplace;
@@ -395,6 +512,9 @@ ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, in
     if (strcmp(node->name, "gpu") == 0) {
       int blockExists[MSCCL_MAX_NUM_THREAD_BLOCKS];
       memset(blockExists, 0, sizeof(int[MSCCL_MAX_NUM_THREAD_BLOCKS]));
+      std::unique_ptr<int[][MSCCL_MAX_NUM_STEPS]> stepToTransfer(new int[MSCCL_MAX_NUM_THREAD_BLOCKS][MSCCL_MAX_NUM_STEPS]);
+      int channelProtocols[MAXCHANNELS];
+      for (int c = 0; c < MAXCHANNELS; c++) channelProtocols[c] = -1;
       int id, nScratchChunks, nInputChunks, nOutputChunks;
       NCCLCHECK(mscclXmlGetAttrInt(node, "id", &id));
       if (id == rank) {
@@ -455,6 +575,20 @@ ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, in
             // setting the summary of the msccl algorithm in msccl channels
             mscclChannelInfo* mscclChannel = &algo->mscclChannels[sTB->channelId];
 
+            // Thread blocks may pick another protocol than the algorithm, e.g. for the hops
+            // crossing nodes, but connections are per channel so their channel must agree
+            const char* tbProtocol;
+            int protocol = algo->protocol;
+            NCCLCHECK(mscclXmlGetAttr(threadBlockNode, "proto", &tbProtocol));
+            if (tbProtocol) NCCLCHECK(mscclProtocolStrToId(tbProtocol, &protocol));
+            if (channelProtocols[channelId] != -1 && channelProtocols[channelId] != protocol) {
+              WARN("MSCCL: thread blocks of channel %d on GPU %d use different protocols", channelId, id);
+              return ncclInvalidUsage;
+            }
+            channelProtocols[channelId] = protocol;
+            mscclChannel->protocol = protocol;
+            algo->protocolMask |= (1<<protocol);
+
             int numDependencies = 0;
             int oldDependencePointer = 0; // Indicator of where the dependencies started for nop
 
@@ -464,6 +598,7 @@ ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, in
             int numReductions = 0;
 
             int numTransfers = 0;
+            for (int st=0; st<MSCCL_MAX_NUM_STEPS; st++) stepToTransfer[bid][st] = -1;
             for (int st=0; st<threadBlockNode->nSubs; st++) {
               struct mscclXmlNode* stepNode = threadBlockNode->subs[st];
               if (strcmp(stepNode->name, "step") == 0) {
@@ -653,9 +788,13 @@ ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, in
                   numTransfers++;
                   sTB->nSteps = numTransfers;
                 }
+                stepToTransfer[bid][s] = transferType == -1 ? -2 : numTransfers-1;
               }
             }
 
+            mscclFuseTransmissions(sTB, &mscclChannel->sendPeerInfo[mscclChannel->nSendPeers],
+              &mscclChannel->recvPeerInfo[mscclChannel->nRecvPeers], stepToTransfer[bid]);
+
             // finish up mscclChannel calculation
 
             for (int c = 1; c <= MSCCL_MAX_COUNT; c++) {
@@ -694,6 +833,10 @@ ncclResult_t mscclGetAlgoFromXmlFile(const char* str, struct mscclAlgo* algo, in
             algo->nBlocks = i+1;
           }
         }
+        NCCLCHECK(mscclRelaxDependencies(algo, stepToTransfer.get()));
+        // A single protocol overriding the one of the algorithm needs no mixed launch
+        if (algo->protocolMask == 0) algo->protocolMask = 1<<algo->protocol;
+        if (__builtin_popcount(algo->protocolMask) == 1) algo->protocol = __builtin_ctz(algo->protocolMask);
 
       }
     }
@@ -790,3 +933,95 @@ ncclResult_t mscclGetAlgoMetaFromXmlFile(const char* str, struct mscclAlgoMeta*
   free(node);
   return ncclSuccess;
 }
+
+/* Binary algorithm cache
+ * Parsing an algorithm walks the XML a character at a time into a full
+ * mscclXml, which dominates init when every rank loads many algorithms.
+ * When RCCL_MSCCL_CACHE_DIR is set, the parsed mscclAlgo of each rank is
+ * stored there under a hash of the XML contents and mapped back afterwards.
+ */
+#define MSCCL_CACHE_MAGIC 0x4843414c4343534dULL // "MSCCLACH"
+#define MSCCL_CACHE_VERSION 5
+
+struct mscclCacheHeader {
+  uint64_t magic;
+  uint64_t xmlHash;
+  uint32_t version;
+  uint32_t algoSize;
+  int32_t rank;
+  int32_t pad;
+};
+
+static ncclResult_t mscclXmlFileHash(const char* xmlFilePath, uint64_t* hash) {
+  int fd = open(xmlFilePath, O_RDONLY);
+  if (fd < 0) {
+    WARN("Could not open MSCCL XML algorithm file %s : %s", xmlFilePath, strerror(errno));
+    return ncclSystemError;
+  }
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    WARN("Could not map MSCCL XML algorithm file %s : %s", xmlFilePath, strerror(errno));
+    return ncclSystemError;
+  }
+  uint64_t h = 5381;
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (off_t i = 0; i < st.st_size; i++) h = ((h << 5) + h) ^ bytes[i];
+  munmap(data, st.st_size);
+  *hash = h;
+  return ncclSuccess;
+}
+
+static bool mscclLoadCachedAlgo(const char* cacheFile, uint64_t xmlHash, int rank, struct mscclAlgo* algo) {
+  const size_t size = sizeof(struct mscclCacheHeader) + sizeof(struct mscclAlgo);
+  int fd = open(cacheFile, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size == size) data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+  const struct mscclCacheHeader* header = (const struct mscclCacheHeader*)data;
+  bool valid = header->magic == MSCCL_CACHE_MAGIC && header->version == MSCCL_CACHE_VERSION &&
+    header->algoSize == sizeof(struct mscclAlgo) && header->xmlHash == xmlHash && header->rank == rank;
+  if (valid) memcpy(algo, header+1, sizeof(struct mscclAlgo));
+  munmap(data, size);
+  return valid;
+}
+
+static void mscclStoreCachedAlgo(const char* cacheFile, uint64_t xmlHash, int rank, struct mscclAlgo* algo) {
+  // Ranks sharing the cache directory, or loading threads, may store the same file, write it aside and rename it in place
+  char tmpFile[PATH_MAX];
+  snprintf(tmpFile, PATH_MAX, "%s.%d.%lx.tmp", cacheFile, getpid(), (unsigned long)pthread_self());
+  FILE* file = fopen(tmpFile, "w");
+  if (file == NULL) {
+    INFO(NCCL_INIT, "MSCCL: could not create algorithm cache %s : %s", tmpFile, strerror(errno));
+    return;
+  }
+  struct mscclCacheHeader header = { MSCCL_CACHE_MAGIC, xmlHash, MSCCL_CACHE_VERSION, sizeof(struct mscclAlgo), rank, 0 };
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(algo, sizeof(struct mscclAlgo), 1, file) == 1;
+  if (fclose(file) != 0) written = false;
+  if (!written || rename(tmpFile, cacheFile) != 0) {
+    INFO(NCCL_INIT, "MSCCL: could not store algorithm cache %s", cacheFile);
+    unlink(tmpFile);
+  }
+}
+
+ncclResult_t mscclGetAlgoFromCachedXmlFile(const char* str, struct mscclAlgo* algo, int rank) {
+  const char* cacheDir = getenv("RCCL_MSCCL_CACHE_DIR");
+  if (cacheDir == NULL) return mscclGetAlgoFromXmlFile(str, algo, rank);
+
+  uint64_t xmlHash;
+  NCCLCHECK(mscclXmlFileHash(str, &xmlHash));
+  char cacheFile[PATH_MAX];
+  snprintf(cacheFile, PATH_MAX, "%s/msccl_%016lx_%d.bin", cacheDir, xmlHash, rank);
+  if (mscclLoadCachedAlgo(cacheFile, xmlHash, rank, algo)) {
+    INFO(NCCL_INIT, "MSCCL: loaded %s from cache %s", str, cacheFile);
+    return ncclSuccess;
+  }
+  NCCLCHECK(mscclGetAlgoFromXmlFile(str, algo, rank));
+  mscclStoreCachedAlgo(cacheFile, xmlHash, rank, algo);
+  return ncclSuccess;
+}
@@ -21,6 +21,9 @@ RCCL_PARAM(MscclEnableDoneEvent, "MSCCL_ENABLE_DONE_EVENT", 1);
 #endif
 
 RCCL_PARAM(MscclWorkFifoDepth, "MSCCL_WORK_FIFO_DEPTH", 64<<10);
+RCCL_PARAM(MscclDynamicChunk, "MSCCL_DYNAMIC_CHUNK", 1);
+// Bytes all thread blocks of an algorithm move together in a loop iteration before it is split further
+RCCL_PARAM(MscclMinLoopBytes, "MSCCL_MIN_LOOP_BYTES", 1<<20);
 
 ncclResult_t mscclGetCaptureStatus(hipStream_t stream) {
   mscclStatus& status = mscclGetStatus();
@@ -34,6 +37,11 @@ ncclResult_t mscclGetCaptureStatus(hipStream_t stream) {
       threadLocalStatus.captureStatus = mscclNewCapture;
       savedProxyArgs[captureId] = std::vector<struct mscclProxyArg>();
       NCCLCHECK(mscclInitWorkFifoStatus(&(status.graphWorkFifoStatus[captureId])));
+      struct mscclGraphState& graphState = status.graphStates[captureId];
+      NCCLCHECK(ncclCudaCalloc(&graphState.syncFlags, MSCCL_MAX_NUM_THREAD_BLOCKS));
+      graphState.scratchBuffer = nullptr;
+      graphState.scratchBufferSize = 0;
+      graphState.workIndex = 1;
     } else {
       INFO(NCCL_NET,"mscclGetCaptureStatus: captureId %llu is same with the previous one\n", captureId);
       threadLocalStatus.captureStatus = mscclExistingCapture;
@@ -48,29 +56,149 @@ ncclResult_t mscclGetCaptureStatus(hipStream_t stream) {
 
 ncclResult_t mscclSetupCount(struct mscclAlgo* hostAlgo, ncclComm_t comm, size_t count, ncclDataType_t dataType) {
   mscclStatus& status = mscclGetStatus();
-  status.stepSize = comm->buffSizes[hostAlgo->protocol] / NCCL_STEPS;
-  status.chunkSteps = hostAlgo->protocol == NCCL_PROTO_SIMPLE ? hostAlgo->chunkSteps : 1;
-  status.sliceSteps = hostAlgo->protocol == NCCL_PROTO_SIMPLE ? hostAlgo->sliceSteps : 1;
-  status.chunkSize  = status.stepSize * status.chunkSteps;
-  status.chunkEffectiveSize = status.chunkSize;
-  if (hostAlgo->protocol == NCCL_PROTO_LL) status.chunkEffectiveSize /= 2;
-  if (hostAlgo->protocol == NCCL_PROTO_LL128) status.chunkEffectiveSize = (status.chunkSize / NCCL_LL128_LINEELEMS) * NCCL_LL128_DATAELEMS;
   status.dataType = dataType;
   status.nBytes = count * ncclTypeSize(status.dataType) * hostAlgo->sizeMultiplier;
-  status.maxAllowedCount = std::max((uint32_t)1, (uint32_t)(status.chunkEffectiveSize / DIVUP(status.nBytes, (size_t)(hostAlgo->nChunksPerLoop))));
-  if (status.maxAllowedCount == 0){
-    WARN("MSCCL: something went wrong. Max allowed count is 0\n");
-    return ncclInternalError;
+  size_t mscclChunkBytes = DIVUP(status.nBytes, (size_t)(hostAlgo->nChunksPerLoop));
+  size_t chunkEffectiveSizes[NCCL_NUM_PROTOCOLS];
+  size_t iterBytes = SIZE_MAX;
+  for (int p = 0; p < NCCL_NUM_PROTOCOLS; p++) {
+    if ((hostAlgo->protocolMask & (1<<p)) == 0) continue;
+    struct mscclProtoSizes* sizes = status.protoSizes + p;
+    sizes->stepSize = comm->buffSizes[p] / NCCL_STEPS;
+    sizes->chunkSteps = p == NCCL_PROTO_SIMPLE ? hostAlgo->chunkSteps : 1;
+    sizes->sliceSteps = p == NCCL_PROTO_SIMPLE ? hostAlgo->sliceSteps : 1;
+    sizes->chunkSize = sizes->stepSize * sizes->chunkSteps;
+    chunkEffectiveSizes[p] = sizes->chunkSize;
+    if (p == NCCL_PROTO_LL) chunkEffectiveSizes[p] /= 2;
+    if (p == NCCL_PROTO_LL128) chunkEffectiveSizes[p] = (sizes->chunkSize / NCCL_LL128_LINEELEMS) * NCCL_LL128_DATAELEMS;
+    iterBytes = std::min(iterBytes, chunkEffectiveSizes[p]);
+  }
+  // Dependencies between thread blocks count loop iterations, so with mixed protocols all
+  // iterations are sized for the protocol carrying the least, and kept a multiple of the
+  // Simple grain so that every protocol splits the last one the same way
+  const size_t grain = NCCL_MAX_NTHREADS * sizeof(uint64_t);
+  bool fixedIter = __builtin_popcount(hostAlgo->protocolMask) > 1;
+  if (fixedIter) iterBytes = std::max(grain, iterBytes / grain * grain);
+  if (rcclParamMscclDynamicChunk() && mscclChunkBytes > grain) {
+    // Shrink iterations so that chunks can be pipelined through every step of the longest
+    // thread block, as long as all thread blocks together still move enough per iteration
+    int maxSteps = 1;
+    for (int i = 0; i < hostAlgo->nBlocks; i++) maxSteps = std::max(maxSteps, (int)hostAlgo->mscclTBs[i].nSteps);
+    size_t minBytes = std::max((int64_t)DIVUP(rcclParamMscclMinLoopBytes(), hostAlgo->nBlocks), hostAlgo->minChunkBytes);
+    size_t bytes = std::max(DIVUP(mscclChunkBytes, (size_t)maxSteps), minBytes);
+    if (hostAlgo->maxChunkBytes) bytes = std::min(bytes, (size_t)hostAlgo->maxChunkBytes);
+    bytes = std::max(grain, bytes / grain * grain);
+    if (bytes < iterBytes) {
+      iterBytes = bytes;
+      fixedIter = true;
+    }
   }
-  if (status.maxAllowedCount >= MSCCL_MAX_COUNT) {
-    status.maxAllowedCount = MSCCL_MAX_COUNT - 1;
+  status.iterSize = fixedIter ? iterBytes / ncclTypeSize(dataType) : 0;
+  status.nLoops = DIVUP(mscclChunkBytes, iterBytes);
+  for (int p = 0; p < NCCL_NUM_PROTOCOLS; p++) {
+    if ((hostAlgo->protocolMask & (1<<p)) == 0) continue;
+    struct mscclProtoSizes* sizes = status.protoSizes + p;
+    sizes->maxAllowedCount = std::max((uint32_t)1, (uint32_t)(chunkEffectiveSizes[p] / std::min(mscclChunkBytes, iterBytes)));
+    if (sizes->maxAllowedCount >= MSCCL_MAX_COUNT) {
+      sizes->maxAllowedCount = MSCCL_MAX_COUNT - 1;
+    }
   }
   return ncclSuccess;
 }
 
+static void mscclSetupDevAlgoImage(struct mscclAlgo* hostAlgo, std::vector<char>& image) {
+  image.assign(sizeof(struct mscclDevAlgo), 0);
+  auto append = [&image](const void* data, size_t bytes) {
+    size_t offset = image.size();
+    image.resize(offset + ROUNDUP(bytes, 16), 0);
+    if (bytes) memcpy(image.data() + offset, data, bytes);
+  };
+  struct mscclDevAlgo header = {};
+  for (int b = 0; b < hostAlgo->nBlocks; b++) {
+    struct mscclThreadBlock* tb = hostAlgo->mscclTBs + b;
+    int nDependencies = 0, nReductions = 0;
+    for (int i = 0; i < tb->nSteps; i++) {
+      struct mscclTransmission* t = tb->transmissions + i;
+      if (t->numDependencies > 0) nDependencies = std::max(nDependencies, t->dependencePointer + t->numDependencies);
+      if (t->numReductions > 0) nReductions = std::max(nReductions, t->reductionPointer + t->numReductions);
+    }
+    struct mscclDevThreadBlock devTB = {};
+    devTB.sendPeer = tb->sendPeer;
+    devTB.recvPeer = tb->recvPeer;
+    devTB.nSteps = tb->nSteps;
+    devTB.channelId = tb->channelId;
+    devTB.nDependencies = nDependencies;
+    devTB.nReductions = nReductions;
+    devTB.protocol = hostAlgo->mscclChannels[tb->channelId].protocol;
+    header.tbOffsets[b] = image.size();
+    append(&devTB, sizeof(devTB));
+    append(tb->transmissions, tb->nSteps * sizeof(struct mscclTransmission));
+    append(tb->dependentBid, nDependencies * sizeof(int8_t));
+    append(tb->dependentStep, nDependencies * sizeof(int16_t));
+    append(tb->reductionSrcOffsets, nReductions * sizeof(int16_t));
+  }
+  memcpy(image.data(), &header, sizeof(header));
+}
+
+ncclResult_t mscclSetupDevAlgos(struct mscclAlgo** hostAlgos, int nAlgos, struct mscclDevAlgo** devAlgos) {
+  ncclResult_t ret = ncclSuccess;
+  std::vector<std::vector<char>> images(nAlgos);
+  size_t totalSize = 0;
+  char* staging = nullptr;
+  hipStream_t stream = nullptr;
+  for (int a = 0; a < nAlgos; a++) {
+    devAlgos[a] = nullptr;
+    mscclSetupDevAlgoImage(hostAlgos[a], images[a]);
+    totalSize += images[a].size();
+  }
+  for (int a = 0; a < nAlgos; a++) {
+    NCCLCHECKGOTO(ncclCudaMalloc((char**)devAlgos + a, images[a].size()), ret, fail);
+  }
+  if (nAlgos > 0) {
+    // Stage everything in pinned memory so that the copies run asynchronously and are waited on once, on
+    // a stream of our own: a synchronous copy would also wait for the streams of the application
+    NCCLCHECKGOTO(ncclCudaHostCalloc(&staging, totalSize), ret, fail);
+    CUDACHECKGOTO(hipStreamCreateWithFlags(&stream, hipStreamNonBlocking), ret, fail);
+    size_t offset = 0;
+    for (int a = 0; a < nAlgos; a++) {
+      memcpy(staging + offset, images[a].data(), images[a].size());
+      CUDACHECKGOTO(hipMemcpyAsync(devAlgos[a], staging + offset, images[a].size(), hipMemcpyHostToDevice, stream), ret, fail);
+      offset += images[a].size();
+    }
+    CUDACHECKGOTO(hipStreamSynchronize(stream), ret, fail);
+  }
+  INFO(NCCL_INIT, "MSCCL: uploaded %zu bytes for %d algorithms", totalSize, nAlgos);
+exit:
+  if (stream) (void)hipStreamDestroy(stream);
+  if (staging) ncclCudaHostFree(staging);
+  return ret;
+fail:
+  for (int a = 0; a < nAlgos; a++) {
+    if (devAlgos[a]) ncclCudaFree(devAlgos[a]);
+    devAlgos[a] = nullptr;
+  }
+  goto exit;
+}
+
+// Persistent state of the graph being captured, nullptr when launching eagerly
+static struct mscclGraphState* mscclGetGraphState() {
+  mscclThreadLocalStatus& threadLocalStatus = mscclGetThreadLocalStatus();
+  if (threadLocalStatus.captureStatus == mscclNoCapture) return nullptr;
+  return &mscclGetStatus().graphStates[threadLocalStatus.captureId];
+}
+
 ncclResult_t mscclSetupScratch(struct mscclAlgo* hostAlgo, hipStream_t stream) {
   mscclStatus& status = mscclGetStatus();
   size_t sizeNeeded = (status.nBytes * (size_t)(hostAlgo->nScratchChunks)) / (size_t)(hostAlgo->nChunksPerLoop);
+  struct mscclGraphState* graphState = mscclGetGraphState();
+  if (graphState) {
+    if (sizeNeeded > graphState->scratchBufferSize) {
+      if (graphState->scratchBuffer) graphState->retiredScratchBuffers.push_back(graphState->scratchBuffer);
+      NCCLCHECK(ncclCudaMalloc((char**)&graphState->scratchBuffer, sizeNeeded, true));
+      graphState->scratchBufferSize = sizeNeeded;
+    }
+    return ncclSuccess;
+  }
   if (sizeNeeded > status.scratchBufferSize){
     NCCLCHECK(ncclCudaFree(status.scratchBuffer));
     NCCLCHECK(ncclCudaMalloc((char**)&status.scratchBuffer, sizeNeeded, true));
@@ -82,8 +210,15 @@ ncclResult_t mscclSetupScratch(struct mscclAlgo* hostAlgo, hipStream_t stream) {
 ncclResult_t mscclSetupSyncFlags(hipStream_t stream) {
   mscclStatus& status = mscclGetStatus();
   mscclThreadLocalStatus& threadLocalStatus = mscclGetThreadLocalStatus();
-  if (threadLocalStatus.captureStatus == mscclNewCapture ||
-      status.workIndex > (1ULL << (8*sizeof(status.workIndex))) - 2 * NCCL_MAX_OPS - 1) {
+  struct mscclGraphState* graphState = mscclGetGraphState();
+  if (graphState) {
+    // Captured, so each replay starts from cleared flags and the work indices of the capture
+    if (threadLocalStatus.captureStatus == mscclNewCapture) {
+      CUDACHECK(hipMemsetAsync(graphState->syncFlags, 0, sizeof(struct mscclFlag) * MSCCL_MAX_NUM_THREAD_BLOCKS, stream));
+    }
+    return ncclSuccess;
+  }
+  if (status.workIndex > (1ULL << (8*sizeof(status.workIndex))) - 2 * NCCL_MAX_OPS - 1) {
     CUDACHECK(hipMemsetAsync(status.syncFlags, 0, sizeof(struct mscclFlag) * MSCCL_MAX_NUM_THREAD_BLOCKS, stream));
     status.workIndex = 1; // setting the workIndex back to 1 for next iterations
     status.graphFirstKernel = false;
@@ -129,33 +264,34 @@ ncclResult_t mscclSetupConnections(struct mscclAlgo* hostAlgo, ncclComm_t comm)
   return ncclSuccess;
 }
 
-static ncclResult_t mscclSetupProxyImpl(struct mscclAlgo* hostAlgo, ncclComm_t comm) {
-  mscclStatus& status = mscclGetStatus();
-  mscclThreadLocalStatus& threadLocalStatus = mscclGetThreadLocalStatus();
+static ncclResult_t mscclSetupProxyImpl(const struct mscclProxyArg* arg) {
+  struct mscclAlgo* hostAlgo = arg->hostAlgo;
+  ncclComm_t comm = arg->comm;
   struct ncclProxyOp proxyOp = {};
   proxyOp.connIndex = 0;
-  proxyOp.sliceSteps = status.sliceSteps;
-  proxyOp.chunkSteps = status.chunkSteps;
-  proxyOp.chunkSize = status.chunkSize;
-  proxyOp.protocol = hostAlgo->protocol;
-  proxyOp.dtype = status.dataType;
+  proxyOp.dtype = arg->dataType;
   proxyOp.redOp = 0;
   proxyOp.pattern = 0;
   proxyOp.root = 0;
-  proxyOp.nbytes = status.stepSize*proxyOp.sliceSteps;
   proxyOp.opCount = comm->sharedRes->collOpCount;
-  int nLoops = (int)(DIVUP(status.nBytes, (size_t)((size_t)hostAlgo->nChunksPerLoop*(size_t)status.chunkEffectiveSize)));
-  int nLoopsChunkSteps = nLoops * status.chunkSteps;
   for (int ch = 0; ch < hostAlgo->nChannels; ch++) {
     proxyOp.channelId = ch;
     struct mscclChannelInfo* mscclChannel = hostAlgo->mscclChannels + ch;
     struct ncclChannel* ncclChannel = comm->channels + ch;
+    if (mscclChannel->nRecvPeers == 0 && mscclChannel->nSendPeers == 0) continue;
+    const struct mscclProtoSizes* sizes = arg->protoSizes + mscclChannel->protocol;
+    proxyOp.sliceSteps = sizes->sliceSteps;
+    proxyOp.chunkSteps = sizes->chunkSteps;
+    proxyOp.chunkSize = sizes->chunkSize;
+    proxyOp.protocol = mscclChannel->protocol;
+    proxyOp.nbytes = sizes->stepSize*proxyOp.sliceSteps;
+    int nLoopsChunkSteps = arg->nLoops * sizes->chunkSteps;
     for (int i = 0; i < mscclChannel->nRecvPeers; i++){
       struct mscclChannelPeerInfo* recvPeer = mscclChannel->recvPeerInfo + i;
       int nRecvs = 0;
       for (int j = 0; j < recvPeer->nExistingCounts; j++){
         int c = recvPeer->existingCounts[j];
-        int nStepsInCount = DIVUP(c, status.maxAllowedCount);
+        int nStepsInCount = DIVUP(c, sizes->maxAllowedCount);
         nRecvs += recvPeer->nTransmissionsOfCount[c] * nStepsInCount;
       }
       proxyOp.nsteps = nLoopsChunkSteps * nRecvs;
@@ -168,7 +304,7 @@ static ncclResult_t mscclSetupProxyImpl(struct mscclAlgo* hostAlgo, ncclComm_t c
       int nSends = 0;
       for (int j = 0; j < sendPeer->nExistingCounts; j++){
         int c = sendPeer->existingCounts[j];
-        int nStepsInCount = DIVUP(c, status.maxAllowedCount);
+        int nStepsInCount = DIVUP(c, sizes->maxAllowedCount);
         nSends += sendPeer->nTransmissionsOfCount[c] * nStepsInCount;
       }
       proxyOp.nsteps = nLoopsChunkSteps * nSends;
@@ -186,7 +322,7 @@ static void HIPRT_CB mscclSetupProxyCallback(void *args) {
   std::vector<struct mscclProxyArg>* params = (std::vector<struct mscclProxyArg>*)args;
   INFO(NCCL_NET,"mscclSetupProxyCallback: proxy args size: %ld\n", params->size());
   for (auto &p : *params) {
-    mscclSetupProxyImpl(p.hostAlgo, p.comm);
+    mscclSetupProxyImpl(&p);
   }    
 }
 
@@ -194,9 +330,16 @@ ncclResult_t mscclSetupProxy(struct mscclAlgo* hostAlgo, ncclComm_t comm, hipStr
   mscclStatus& status = mscclGetStatus();
   mscclThreadLocalStatus& threadLocalStatus = mscclGetThreadLocalStatus();
   mscclSavedProxyArgs& savedProxyArgs = mscclGetSavedProxyArgs();
+  struct mscclProxyArg arg;
+  arg.hostAlgo = hostAlgo;
+  arg.comm = comm;
+  arg.nBytes = status.nBytes;
+  memcpy(arg.protoSizes, status.protoSizes, sizeof(arg.protoSizes));
+  arg.nLoops = status.nLoops;
+  arg.dataType = status.dataType;
   if (threadLocalStatus.captureStatus == mscclNoCapture) {
     INFO(NCCL_NET,"mscclSetupProxy: no capture\n");
-    NCCLCHECK(mscclSetupProxyImpl(hostAlgo, comm));
+    NCCLCHECK(mscclSetupProxyImpl(&arg));
   } else if (status.needsProxy) {
     INFO(NCCL_NET,"mscclSetupProxy: capture\n");
     if (savedProxyArgs[threadLocalStatus.captureId].size() == 0) {
@@ -209,7 +352,7 @@ ncclResult_t mscclSetupProxy(struct mscclAlgo* hostAlgo, ncclComm_t comm, hipStr
       p.userData = params;
       CUDACHECK(hipGraphAddHostNode(&callbackNode, threadLocalStatus.graph, nullptr, 0, &p));
     }
-    mscclGetSavedProxyArgs()[threadLocalStatus.captureId].emplace_back(hostAlgo, comm);
+    mscclGetSavedProxyArgs()[threadLocalStatus.captureId].push_back(arg);
   }
   return ncclSuccess;
 }
@@ -257,6 +400,8 @@ static ncclResult_t hostToDevRedOp(
       break;
     #endif
     case ncclFloat32:
+    case ncclFloat8e4m3:
+    case ncclFloat8e5m2:
       opFull->op = ncclDevPreMulSum;
       f32 = float(1.0/comm->nRanks);
       break;
@@ -302,7 +447,9 @@ static ncclResult_t hostToDevRedOp(
   MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, half, fullOps), \
   MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, float, fullOps), \
   MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, double, fullOps), \
-  MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, rccl_bfloat16, fullOps)
+  MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, rccl_bfloat16, fullOps), \
+  MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, rccl_float8_e4m3, fullOps), \
+  MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, rccl_float8_e5m2, fullOps)
 
 #define MSCCL_KERNEL_ENTRY_DEVREDOP_NOFLOAT(devredop, fullOps) \
   MSCCL_KERNEL_ENTRY_DEVREDOP_TYPE(devredop, int8_t, fullOps), \
@@ -314,6 +461,8 @@ static ncclResult_t hostToDevRedOp(
   MSCCL_KERNEL_ENTRY_DEVREDOP_NULL(), \
   MSCCL_KERNEL_ENTRY_DEVREDOP_NULL(), \
   MSCCL_KERNEL_ENTRY_DEVREDOP_NULL(), \
+  MSCCL_KERNEL_ENTRY_DEVREDOP_NULL(), \
+  MSCCL_KERNEL_ENTRY_DEVREDOP_NULL(), \
   MSCCL_KERNEL_ENTRY_DEVREDOP_NULL()
 
 #define MSCCL_KERNEL_ENTRY() \
@@ -388,7 +537,7 @@ static void mscclWaitWorkFifoAvailable(uint32_t desiredSent, mscclWorkFifoStatus
 RCCL_PARAM(MscclForceFullOps, "MSCCL_FORCE_FULLOPS", 0);
 
 ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count,
-    ncclDataType_t dataType, ncclRedOp_t op, struct mscclAlgo* hostAlgo, struct mscclAlgo* devAlgo,
+    ncclDataType_t dataType, ncclRedOp_t op, struct mscclAlgo* hostAlgo, struct mscclDevAlgo* devAlgo,
     ncclComm_t comm, hipStream_t stream) {
   mscclStatus& status = mscclGetStatus();
   mscclThreadLocalStatus& threadLocalStatus = mscclGetThreadLocalStatus();
@@ -400,7 +549,9 @@ ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count
           true;
 #endif
 
-  if (enableDoneEvent && (status.lastStream != stream && status.lastStream != nullptr)) {
+  // Eager launches on another stream are not part of a captured graph, so it cannot wait for them
+  struct mscclGraphState* graphState = mscclGetGraphState();
+  if (enableDoneEvent && graphState == nullptr && (status.lastStream != stream && status.lastStream != nullptr)) {
     CUDACHECK(hipStreamWaitEvent(stream, comm->doneEvent, 0));
   }
 
@@ -410,7 +561,10 @@ ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count
   ncclDevRedOpFull opFull = {};
   NCCLCHECK(hostToDevRedOp(&opFull, op, dataType, comm));
 
-  uint32_t fnIndex = (opFull.op * ncclNumTypes + dataType) * NCCL_NUM_PROTOCOLS + hostAlgo->protocol;
+  // The Simple kernels run every thread block with the protocol of its channel when they differ
+  bool mixedProtocols = __builtin_popcount(hostAlgo->protocolMask) > 1;
+  int protocol = mixedProtocols ? NCCL_PROTO_SIMPLE : hostAlgo->protocol;
+  uint32_t fnIndex = (opFull.op * ncclNumTypes + dataType) * NCCL_NUM_PROTOCOLS + protocol;
   uint8_t fullOpMask = (1<<MSCCL_RECV_COPY_SEND) |
                         (1<<MSCCL_RECV_REDUCE_SEND) |
                         (1<<MSCCL_RECV_REDUCE_COPY_SEND) |
@@ -420,16 +574,17 @@ ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count
   if ((hostAlgo->typeMask & fullOpMask) || rcclParamMscclForceFullOps())
     fnIndex += sizeof(mscclKernelEntries)/sizeof(void *)/2;
 
+  uint32_t* workIndex = graphState ? &graphState->workIndex : &status.workIndex;
   mscclWork work;
-  work.syncFlags = status.syncFlags;
-  work.scratchBuffer = status.scratchBuffer;
+  work.syncFlags = graphState ? graphState->syncFlags : status.syncFlags;
+  work.scratchBuffer = graphState ? graphState->scratchBuffer : status.scratchBuffer;
   work.sendBuff = sendBuff;
   work.recvBuff = recvBuff;
   work.sizePerMscclChunk = count * hostAlgo->sizeMultiplier / hostAlgo->nChunksPerLoop; // count is sum of all ranks in MSCCL kernel
   work.redOpArg = opFull.scalarArg;
-  work.workIndex = status.workIndex;
+  work.workIndex = *workIndex;
   work.nChunksPerLoop = hostAlgo->nChunksPerLoop;
-  work.maxAllowedCount = status.maxAllowedCount;
+  work.chunkSize = status.iterSize;
   work.hasReduce = hostAlgo->hasReduce;
   work.redOpArgIsPtr = opFull.scalarArgIsPtr;
   work.fnIndex = fnIndex;
@@ -462,6 +617,7 @@ ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count
   }
   mscclWaitWorkFifoAvailable(workFifoSent + numBlocks, workFifoStatus);
   for (int i = 0; i < numBlocks; i++) {
+    work.maxAllowedCount = status.protoSizes[hostAlgo->mscclChannels[hostAlgo->mscclTBs[i].channelId].protocol].maxAllowedCount;
     work.workFifoDoneAck = workFifoSent + i;
     work.workFifoDone = workFifoStatus->workFifoDone + i;
     workFifoStatus->workFifoSentPerThreadBlock[i] = workFifoSent + i;
@@ -478,8 +634,8 @@ ncclResult_t mscclSetupKernel(const void* sendBuff, void* recvBuff, size_t count
   } else {
     CUDACHECK(hipExtLaunchKernel(func, grid, block, args, 0, stream, NULL, NULL, 0));
   }
-  status.workIndex++;
-  status.lastStream = stream;
+  (*workIndex)++;
+  if (graphState == nullptr) status.lastStream = stream;
   return ncclSuccess;
 }
 
@@ -0,0 +1,439 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "bootstrap.h"
+#include "graph/topo.h"
+#include "msccl/msccl_parser.h"
+#include "msccl/msccl_synth.h"
+
+/* Algorithm synthesis
+ * Instead of relying on XML files written for one GPU and node count,
+ * AllGather and AllToAll schedules are generated for the layout of the
+ * communicator: all-pairs, hierarchical (across nodes, then within nodes)
+ * and, for AllGather, ring of rings. An alpha-beta model over the link
+ * bandwidths of the topology picks the size range in which each schedule
+ * and protocol is expected to be the fastest, the others are not written.
+ * Schedules are written in the XML format and loaded like algorithm files.
+ */
+
+enum { mscclSynthAllPairs, mscclSynthHierarchical, mscclSynthRing, mscclSynthNumPatterns };
+static const char* mscclSynthPatternStr[mscclSynthNumPatterns] = { "allpairs", "hierarchical", "ring" };
+static const char* mscclSynthProtoStr[2] = { "LL", "Simple" };
+// Latency of a step in us, by protocol, within a node and across nodes
+static const float mscclSynthLatency[2][2] = { { 1.0, 5.0 }, { 4.0, 10.0 } };
+// Fraction of the link bandwidth carrying data, by protocol
+static const float mscclSynthBwRatio[2] = { 0.5, 1.0 };
+// Cost in us of every peer a rank drives a thread block for
+#define MSCCL_SYNTH_PEER_COST 0.5
+#define MSCCL_SYNTH_RING_CHANNELS 2
+// Sizes are compared at powers of two in between
+#define MSCCL_SYNTH_MIN_LOG2_BYTES 10
+#define MSCCL_SYNTH_MAX_LOG2_BYTES 32
+
+struct mscclSynthStep {
+  const char* type;
+  char srcBuf;
+  int srcOff;
+  char dstBuf;
+  int dstOff;
+  int cnt;
+  int depBid; // thread block and step this one waits for, -1 if none
+  int depStep;
+  int hasDep;
+};
+
+struct mscclSynthTb {
+  int send;
+  int recv;
+  int chan;
+  std::vector<struct mscclSynthStep> steps;
+};
+
+struct mscclSynthGpu {
+  int iChunks;
+  int oChunks;
+  int sChunks;
+  std::vector<struct mscclSynthTb> tbs;
+};
+
+// Bandwidths in GB/s, the minimum over all ranks
+struct mscclSynthBw {
+  float pair; // between two GPUs of a node
+  float gpu;  // out of a GPU to all the others of its node
+  float net;  // share of the NICs of a node per GPU
+};
+
+struct mscclSynthLayout {
+  int nRanks;
+  int nNodes;
+  int localRanks; // 0 unless all nodes have the same number of ranks
+  bool contiguous; // ranks of node m are m*localRanks to (m+1)*localRanks-1
+  std::vector<std::vector<int>> nodeRanks;
+  struct mscclSynthBw bw;
+};
+
+static std::string mscclSynthDir;
+static std::vector<std::string> mscclSynthFiles;
+
+static ncclResult_t mscclSynthGetLayout(ncclComm_t comm, struct mscclSynthLayout* layout) {
+  layout->nRanks = comm->nRanks;
+  layout->nNodes = comm->nNodes;
+  layout->nodeRanks.resize(comm->nNodes);
+  layout->localRanks = comm->nodeRanks[0].localRanks;
+  layout->contiguous = true;
+  for (int m = 0; m < comm->nNodes; m++) {
+    struct ncclNodeRanks* node = comm->nodeRanks+m;
+    layout->nodeRanks[m].assign(node->localRankToRank, node->localRankToRank + node->localRanks);
+    if (node->localRanks != layout->localRanks) layout->localRanks = 0;
+  }
+  for (int m = 0; m < comm->nNodes && layout->localRanks; m++) {
+    for (int k = 0; k < layout->localRanks; k++) {
+      if (layout->nodeRanks[m][k] != m*layout->localRanks + k) layout->contiguous = false;
+    }
+  }
+  if (layout->localRanks == 0) layout->contiguous = false;
+
+  struct ncclTopoSystem* system = comm->topo;
+  std::vector<struct mscclSynthBw> bws(comm->nRanks);
+  struct mscclSynthBw* mine = bws.data() + comm->rank;
+  mine->pair = mine->gpu = mine->net = 0;
+  int g;
+  NCCLCHECK(ncclTopoRankToIndex(system, comm->rank, &g));
+  if (g >= 0) {
+    struct ncclTopoNode* gpu = system->nodes[GPU].nodes+g;
+    for (int i = 0; i < system->nodes[GPU].count; i++) {
+      if (i == g) continue;
+      float bw = gpu->paths[GPU][i].bw;
+      mine->pair = mine->pair == 0 ? bw : std::min(mine->pair, bw);
+    }
+    for (int l = 0; l < gpu->nlinks; l++) {
+      if (gpu->links[l].remNode->type == GPU) mine->gpu += gpu->links[l].bw;
+    }
+    // Without direct links, transfers to all peers share the same PCI path
+    if (mine->gpu == 0) mine->gpu = mine->pair;
+  }
+  for (int n = 0; n < system->nodes[NET].count; n++) mine->net += system->nodes[NET].nodes[n].net.bw;
+  mine->net /= comm->localRanks;
+
+  // Decisions must be the same on all ranks
+  NCCLCHECK(bootstrapAllGather(comm->bootstrap, bws.data(), sizeof(struct mscclSynthBw)));
+  layout->bw = bws[0];
+  for (int r = 1; r < comm->nRanks; r++) {
+    // Ranks alone on their node see no GPU peer
+    if (bws[r].pair > 0) layout->bw.pair = layout->bw.pair > 0 ? std::min(layout->bw.pair, bws[r].pair) : bws[r].pair;
+    if (bws[r].gpu > 0) layout->bw.gpu = layout->bw.gpu > 0 ? std::min(layout->bw.gpu, bws[r].gpu) : bws[r].gpu;
+    layout->bw.net = std::min(layout->bw.net, bws[r].net);
+  }
+  return ncclSuccess;
+}
+
+static uint64_t mscclSynthLayoutHash(const struct mscclSynthLayout& layout) {
+  uint64_t hash = 5381;
+  auto mix = [&hash](const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ bytes[i];
+  };
+  mix(&layout.nRanks, sizeof(layout.nRanks));
+  for (auto& ranks : layout.nodeRanks) {
+    int n = ranks.size();
+    mix(&n, sizeof(n));
+    mix(ranks.data(), n*sizeof(int));
+  }
+  mix(&layout.bw, sizeof(layout.bw));
+  return hash;
+}
+
+static bool mscclSynthValid(const struct mscclSynthLayout& layout, int pattern, mscclFunc_t func) {
+  int n = layout.nRanks, N = layout.nNodes, L = layout.localRanks;
+  switch (pattern) {
+    case mscclSynthAllPairs:
+      return n-1 <= MSCCL_MAX_NUM_THREAD_BLOCKS;
+    case mscclSynthHierarchical:
+      // Within nodes, a thread block sends and receives one chunk per node
+      return N > 1 && L > 1 && layout.contiguous && (N-1)+(L-1) <= MSCCL_MAX_NUM_THREAD_BLOCKS &&
+        2*N+1 <= MSCCL_MAX_NUM_STEPS && L < MSCCL_MAX_COUNT;
+    case mscclSynthRing:
+      return func == mscclFuncAllGather && n+1 <= MSCCL_MAX_NUM_STEPS;
+  }
+  return false;
+}
+
+// Estimated time in us to run a collective of nBytes, the output of an AllGather or the input of an AllToAll
+static double mscclSynthCost(const struct mscclSynthLayout& layout, int pattern, mscclFunc_t func, int proto, double nBytes) {
+  int n = layout.nRanks, N = layout.nNodes;
+  int L = n / N;
+  double chunk = nBytes / n;
+  double ratio = mscclSynthBwRatio[proto] * 1e3; // GB/s to bytes/us
+  double pair = layout.bw.pair * ratio, gpu = layout.bw.gpu * ratio, net = layout.bw.net * ratio;
+  double latIntra = mscclSynthLatency[proto][0], latInter = mscclSynthLatency[proto][1];
+  auto xfer = [](double bytes, double bw) { return bytes == 0 ? 0 : bw > 0 ? bytes / bw : 1e30; };
+
+  switch (pattern) {
+    case mscclSynthAllPairs:
+      return (N > 1 ? latInter : latIntra) + MSCCL_SYNTH_PEER_COST*(n-1) +
+        std::max(std::max(xfer(chunk*(L-1), gpu), L > 1 ? xfer(chunk, pair) : 0), xfer(chunk*(n-L), net));
+    case mscclSynthHierarchical: {
+      double perNode = func == mscclFuncAllToAll ? chunk*L : chunk;
+      return latInter + xfer(perNode*(N-1), net) +
+        latIntra + std::max(xfer(chunk*N*(L-1), gpu), xfer(chunk*N, pair)) + MSCCL_SYNTH_PEER_COST*(N-1+L-1);
+    }
+    case mscclSynthRing: {
+      int C = MSCCL_SYNTH_RING_CHANNELS;
+      double linkBw = N > 1 ? std::min(pair > 0 ? pair : net*L/C, net*L/C) : pair;
+      return (n-1) * ((N > 1 ? latInter : latIntra) + xfer(chunk/C, linkBw)) + MSCCL_SYNTH_PEER_COST*2;
+    }
+  }
+  return 1e30;
+}
+
+static struct mscclSynthStep mscclSynthMakeStep(const char* type, char srcBuf, int srcOff, char dstBuf, int dstOff,
+    int cnt = 1, int depBid = -1, int depStep = -1) {
+  return { type, srcBuf, srcOff, dstBuf, dstOff, cnt, depBid, depStep, 0 };
+}
+
+// Thread blocks share a channel until it has as many peers as it can hold
+static int mscclSynthAddTb(struct mscclSynthGpu& gpu, int peer) {
+  int bid = gpu.tbs.size();
+  gpu.tbs.push_back({ peer, peer, bid / MSCCL_MAX_NUM_THREAD_BLOCKS_PER_CHANNEL, {} });
+  return bid;
+}
+
+// Every rank exchanges directly with every other rank. Sends and receives
+// alternate so that two peers never both wait for room to send.
+static void mscclSynthAllPairsGpus(const struct mscclSynthLayout& layout, mscclFunc_t func, bool inPlace,
+    std::vector<struct mscclSynthGpu>& gpus) {
+  int n = layout.nRanks;
+  bool allToAll = func == mscclFuncAllToAll;
+  gpus.resize(n);
+  for (int r = 0; r < n; r++) {
+    struct mscclSynthGpu& gpu = gpus[r];
+    gpu.iChunks = allToAll ? n : (inPlace ? 0 : 1);
+    gpu.oChunks = n;
+    gpu.sChunks = 0;
+    for (int p = 0; p < n; p++) {
+      if (p == r) continue;
+      struct mscclSynthTb& tb = gpu.tbs[mscclSynthAddTb(gpu, p)];
+      if (allToAll) tb.steps.push_back(mscclSynthMakeStep("s", 'i', p, 'o', r));
+      else tb.steps.push_back(mscclSynthMakeStep("s", inPlace ? 'o' : 'i', inPlace ? r : 0, 'o', r));
+      tb.steps.push_back(mscclSynthMakeStep("r", 'o', p, 'o', p));
+    }
+    if (!inPlace) gpu.tbs[0].steps.push_back(mscclSynthMakeStep("cpy", 'i', allToAll ? r : 0, 'o', r));
+  }
+}
+
+// Ranks first exchange with the ranks of the same local index on the other
+// nodes, then forward what they received to the other ranks of their node.
+// For AllToAll, the first phase carries all chunks meant for a node at once.
+static void mscclSynthHierarchicalGpus(const struct mscclSynthLayout& layout, mscclFunc_t func, bool inPlace,
+    std::vector<struct mscclSynthGpu>& gpus) {
+  int n = layout.nRanks, N = layout.nNodes, L = layout.localRanks;
+  bool allToAll = func == mscclFuncAllToAll;
+  gpus.resize(n);
+  for (int r = 0; r < n; r++) {
+    int a = r / L, j = r % L;
+    struct mscclSynthGpu& gpu = gpus[r];
+    gpu.iChunks = allToAll ? n : (inPlace ? 0 : 1);
+    gpu.oChunks = n;
+    gpu.sChunks = allToAll ? n : 0;
+    char ownBuf = inPlace ? 'o' : 'i';
+    int ownOff = inPlace ? r : 0;
+
+    std::vector<int> interBid(N, -1);
+    for (int m = 0; m < N; m++) {
+      if (m == a) continue;
+      interBid[m] = mscclSynthAddTb(gpu, m*L+j);
+      struct mscclSynthTb& tb = gpu.tbs[interBid[m]];
+      if (allToAll) {
+        tb.steps.push_back(mscclSynthMakeStep("s", 'i', m*L, 's', a*L, L));
+        tb.steps.push_back(mscclSynthMakeStep("r", 's', m*L, 's', m*L, L));
+      } else {
+        tb.steps.push_back(mscclSynthMakeStep("s", ownBuf, ownOff, 'o', r));
+        tb.steps.push_back(mscclSynthMakeStep("r", 'o', m*L+j, 'o', m*L+j));
+      }
+    }
+    for (int k = 0; k < L; k++) {
+      if (k == j) continue;
+      struct mscclSynthTb& tb = gpu.tbs[mscclSynthAddTb(gpu, a*L+k)];
+      for (int m = 0; m < N; m++) {
+        if (m == a) {
+          if (allToAll) tb.steps.push_back(mscclSynthMakeStep("s", 'i', a*L+k, 'o', r));
+          else tb.steps.push_back(mscclSynthMakeStep("s", ownBuf, ownOff, 'o', r));
+        } else {
+          // Forward what the first phase received from node m
+          if (allToAll) tb.steps.push_back(mscclSynthMakeStep("s", 's', m*L+k, 'o', m*L+j, 1, interBid[m], 1));
+          else tb.steps.push_back(mscclSynthMakeStep("s", 'o', m*L+j, 'o', m*L+j, 1, interBid[m], 1));
+        }
+        tb.steps.push_back(mscclSynthMakeStep("r", 'o', m*L+k, 'o', m*L+k));
+      }
+    }
+    if (!inPlace) gpu.tbs[0].steps.push_back(mscclSynthMakeStep("cpy", 'i', allToAll ? r : 0, 'o', r));
+  }
+}
+
+// Rings going through the ranks of each node in turn. Each channel carries its
+// own slice of every chunk, odd channels run backwards to use both directions.
+static void mscclSynthRingGpus(const struct mscclSynthLayout& layout, bool inPlace, std::vector<struct mscclSynthGpu>& gpus) {
+  int n = layout.nRanks, C = MSCCL_SYNTH_RING_CHANNELS;
+  std::vector<int> order, pos(n);
+  for (auto& ranks : layout.nodeRanks) order.insert(order.end(), ranks.begin(), ranks.end());
+  for (int q = 0; q < n; q++) pos[order[q]] = q;
+  auto at = [&](int q) { return order[((q % n) + n) % n]; };
+
+  gpus.resize(n);
+  for (int r = 0; r < n; r++) {
+    struct mscclSynthGpu& gpu = gpus[r];
+    gpu.iChunks = inPlace ? 0 : C;
+    gpu.oChunks = n*C;
+    gpu.sChunks = 0;
+    for (int c = 0; c < C; c++) {
+      int dir = c % 2 ? -1 : 1, q = pos[r];
+      gpu.tbs.push_back({ at(q+dir), at(q-dir), c, {} });
+      struct mscclSynthTb& tb = gpu.tbs.back();
+      tb.steps.push_back(mscclSynthMakeStep("s", inPlace ? 'o' : 'i', inPlace ? r*C+c : c, 'o', r*C+c));
+      for (int t = 1; t < n; t++) {
+        int src = at(q - t*dir);
+        tb.steps.push_back(mscclSynthMakeStep(t < n-1 ? "rcs" : "r", 'o', src*C+c, 'o', src*C+c));
+      }
+      if (!inPlace) tb.steps.push_back(mscclSynthMakeStep("cpy", 'i', c, 'o', r*C+c));
+    }
+  }
+}
+
+static ncclResult_t mscclSynthWrite(const char* path, const char* name, int proto, mscclFunc_t func, bool inPlace,
+    int nChunksPerLoop, int64_t minBytes, int64_t maxBytes, std::vector<struct mscclSynthGpu>& gpus) {
+  int nChannels = 0;
+  for (auto& gpu : gpus) {
+    for (auto& tb : gpu.tbs) {
+      nChannels = std::max(nChannels, tb.chan+1);
+      for (auto& step : tb.steps) {
+        if (step.depBid >= 0) gpu.tbs[step.depBid].steps[step.depStep].hasDep = 1;
+      }
+    }
+  }
+
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    WARN("MSCCL: could not write synthesized algorithm %s : %s", path, strerror(errno));
+    return ncclSystemError;
+  }
+  fprintf(file, "<algo name=\"%s\" proto=\"%s\" nchannels=\"%d\" nchunksperloop=\"%d\" ngpus=\"%d\" coll=\"%s\" inplace=\"%d\" outofplace=\"%d\" minBytes=\"%ld\" maxBytes=\"%ld\">\n",
+    name, mscclSynthProtoStr[proto], nChannels, nChunksPerLoop, (int)gpus.size(), func == mscclFuncAllToAll ? "alltoall" : "allgather",
+    inPlace ? 1 : 0, inPlace ? 0 : 1, minBytes, maxBytes);
+  for (size_t r = 0; r < gpus.size(); r++) {
+    struct mscclSynthGpu& gpu = gpus[r];
+    fprintf(file, "  <gpu id=\"%zu\" i_chunks=\"%d\" o_chunks=\"%d\" s_chunks=\"%d\">\n", r, gpu.iChunks, gpu.oChunks, gpu.sChunks);
+    for (size_t t = 0; t < gpu.tbs.size(); t++) {
+      struct mscclSynthTb& tb = gpu.tbs[t];
+      fprintf(file, "    <tb id=\"%zu\" send=\"%d\" recv=\"%d\" chan=\"%d\">\n", t, tb.send, tb.recv, tb.chan);
+      for (size_t s = 0; s < tb.steps.size(); s++) {
+        struct mscclSynthStep& step = tb.steps[s];
+        fprintf(file, "      <step s=\"%zu\" type=\"%s\" srcbuf=\"%c\" srcoff=\"%d\" dstbuf=\"%c\" dstoff=\"%d\" cnt=\"%d\" depid=\"%d\" deps=\"%d\" hasdep=\"%d\"/>\n",
+          s, step.type, step.srcBuf, step.srcOff, step.dstBuf, step.dstOff, step.cnt, step.depBid, step.depStep, step.hasDep);
+      }
+      fprintf(file, "    </tb>\n");
+    }
+    fprintf(file, "  </gpu>\n");
+  }
+  fprintf(file, "</algo>\n");
+  if (fclose(file) != 0) {
+    WARN("MSCCL: could not write synthesized algorithm %s : %s", path, strerror(errno));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t mscclSynthesizeAlgos(ncclComm_t comm, std::vector<mscclAlgoMeta>& metas) {
+  struct mscclSynthLayout layout;
+  NCCLCHECK(mscclSynthGetLayout(comm, &layout));
+  uint64_t hash = mscclSynthLayoutHash(layout);
+  comm->mscclLayoutHash = hash;
+  if (layout.nRanks < 2) return ncclSuccess;
+  for (auto& m : metas) {
+    if (m.layoutHash == hash) return ncclSuccess;
+  }
+
+  if (mscclSynthDir.empty()) {
+    char dir[] = "/tmp/rccl-msccl-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+      WARN("MSCCL: could not create a directory for synthesized algorithms : %s", strerror(errno));
+      return ncclSystemError;
+    }
+    mscclSynthDir = dir;
+  }
+
+  struct { mscclFunc_t func; bool inPlace; } colls[] = {
+    { mscclFuncAllGather, true }, { mscclFuncAllGather, false }, { mscclFuncAllToAll, false } };
+  for (auto& coll : colls) {
+    std::vector<std::pair<int, int>> candidates; // pattern, protocol
+    for (int p = 0; p < mscclSynthNumPatterns; p++) {
+      if (!mscclSynthValid(layout, p, coll.func)) continue;
+      for (int proto = 0; proto < 2; proto++) candidates.emplace_back(p, proto);
+    }
+    if (candidates.empty()) continue;
+
+    // Each candidate gets the first run of sizes in which it is the fastest
+    std::vector<int> first(candidates.size(), -1), last(candidates.size(), -1);
+    int prev = -1;
+    for (int l = MSCCL_SYNTH_MIN_LOG2_BYTES; l <= MSCCL_SYNTH_MAX_LOG2_BYTES; l++) {
+      int best = 0;
+      double bestCost = 0;
+      for (size_t c = 0; c < candidates.size(); c++) {
+        double cost = mscclSynthCost(layout, candidates[c].first, coll.func, candidates[c].second, (double)(1ULL << l));
+        if (c == 0 || cost < bestCost) {
+          best = c;
+          bestCost = cost;
+        }
+      }
+      if (first[best] == -1) first[best] = last[best] = l;
+      else if (prev == best) last[best] = l;
+      prev = best;
+    }
+
+    for (size_t c = 0; c < candidates.size(); c++) {
+      if (first[c] == -1) continue;
+      int pattern = candidates[c].first, proto = candidates[c].second;
+      int64_t minBytes = first[c] == MSCCL_SYNTH_MIN_LOG2_BYTES ? 0 : (1LL << (first[c]-1)) + 1;
+      int64_t maxBytes = last[c] == MSCCL_SYNTH_MAX_LOG2_BYTES ? 0 : (1LL << last[c]);
+
+      std::vector<struct mscclSynthGpu> gpus;
+      int nChunksPerLoop = layout.nRanks;
+      if (pattern == mscclSynthAllPairs) mscclSynthAllPairsGpus(layout, coll.func, coll.inPlace, gpus);
+      if (pattern == mscclSynthHierarchical) mscclSynthHierarchicalGpus(layout, coll.func, coll.inPlace, gpus);
+      if (pattern == mscclSynthRing) {
+        mscclSynthRingGpus(layout, coll.inPlace, gpus);
+        nChunksPerLoop *= MSCCL_SYNTH_RING_CHANNELS;
+      }
+
+      const char* collStr = coll.func == mscclFuncAllToAll ? "alltoall" : "allgather";
+      char name[64], path[PATH_MAX];
+      snprintf(name, sizeof(name), "%s_%s", collStr, mscclSynthPatternStr[pattern]);
+      snprintf(path, PATH_MAX, "%s/%s-%s-%s-%s-%016lx.xml", mscclSynthDir.c_str(), collStr, mscclSynthPatternStr[pattern],
+        mscclSynthProtoStr[proto], coll.inPlace ? "inplace" : "outofplace", hash);
+      NCCLCHECK(mscclSynthWrite(path, name, proto, coll.func, coll.inPlace, nChunksPerLoop, minBytes, maxBytes, gpus));
+      mscclSynthFiles.push_back(path);
+      metas.emplace_back();
+      NCCLCHECK(mscclGetAlgoMetaFromXmlFile(path, &metas.back()));
+      metas.back().layoutHash = hash;
+      INFO(NCCL_INIT|NCCL_TUNING, "MSCCL: synthesized %s for %ld to %ld bytes", path, minBytes, maxBytes);
+    }
+  }
+  return ncclSuccess;
+}
+
+void mscclSynthesizeCleanup() {
+  for (auto& file : mscclSynthFiles) unlink(file.c_str());
+  mscclSynthFiles.clear();
+  if (!mscclSynthDir.empty()) rmdir(mscclSynthDir.c_str());
+  mscclSynthDir.clear();
+}
@@ -3,12 +3,16 @@
  * Licensed under the MIT License.
  ************************************************************************/
 
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <unistd.h>
 
 #include "alloc.h"
 #include "npkit/npkit.h"
+#include "chrome_trace.h"
+#include "clock_sync.h"
 #include "archinfo.h"
 
 uint64_t NpKit::rank_ = 0;
@@ -24,6 +28,18 @@ uint64_t* NpKit::cpu_timestamp_ = nullptr;
 std::thread* NpKit::cpu_timestamp_update_thread_ = nullptr;
 volatile bool NpKit::cpu_timestamp_update_thread_should_stop_ = false;
 
+uint64_t NpKit::stream_interval_ms_ = 0;
+FILE* NpKit::stream_file_ = nullptr;
+std::thread* NpKit::stream_thread_ = nullptr;
+volatile bool NpKit::stream_thread_should_stop_ = false;
+NpKitEvent* NpKit::stream_staging_[2] = {nullptr, nullptr};
+NpKitEventCollectContext* NpKit::stream_contexts_ = nullptr;
+uint64_t* NpKit::stream_tails_ = nullptr;
+uint64_t* NpKit::stream_ready_ = nullptr;
+std::vector<uint8_t> NpKit::stream_encoded_;
+static hipStream_t stream_copy_stream = nullptr;
+static hipEvent_t stream_copied[2] = {nullptr, nullptr};
+
 void NpKit::CpuTimestampUpdateThread() {
   uint64_t init_system_clock = std::chrono::system_clock::now().time_since_epoch().count();
   uint64_t init_steady_clock = std::chrono::steady_clock::now().time_since_epoch().count();
@@ -35,12 +51,135 @@ void NpKit::CpuTimestampUpdateThread() {
   }
 }
 
+void NpKit::StreamWrite(uint16_t source, uint16_t buf_idx, const NpKitEvent* events, uint64_t num_events,
+                        uint64_t num_dropped) {
+  std::vector<uint8_t>& encoded = stream_encoded_;
+  auto put = [&encoded](uint64_t value) {
+    while (value >= 0x80) {
+      encoded.push_back((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    encoded.push_back(value);
+  };
+  encoded.clear();
+  uint64_t prev_timestamp = 0;
+  for (uint64_t i = 0; i < num_events; i++) {
+    int64_t delta = (int64_t)(events[i].fields.timestamp - prev_timestamp);
+    encoded.push_back(events[i].fields.type);
+    put(events[i].fields.size);
+    put(events[i].fields.rsvd);
+    put(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    prev_timestamp = events[i].fields.timestamp;
+  }
+  NpKitStreamRecord record = {NPKIT_STREAM_MAGIC, source, buf_idx, (uint32_t)num_events, (uint32_t)encoded.size(), num_dropped};
+  if (fwrite(&record, sizeof(record), 1, stream_file_) != 1 ||
+      fwrite(encoded.data(), 1, encoded.size(), stream_file_) != encoded.size()) {
+    WARN("NpKit: failed to write event stream");
+  }
+}
+
+// Appends the events of all buffers to the stream. Events collected after the previous
+// drain may still be in flight, so they are left for the next one unless this is the final drain.
+ncclResult_t NpKit::StreamDrain(bool final) {
+  CUDACHECK(hipMemcpyAsync(stream_contexts_, gpu_collect_contexts_, kNumGpuEventBuffers * sizeof(NpKitEventCollectContext),
+                           hipMemcpyDeviceToHost, stream_copy_stream));
+  CUDACHECK(hipStreamSynchronize(stream_copy_stream));
+
+  // GPU buffers go through the two staging buffers, one is written out while the next buffer is copied into the other
+  int pending = -1, p = 0;
+  uint64_t pending_events = 0, pending_dropped = 0;
+  for (uint64_t i = 0; i < kNumGpuEventBuffers; i++) {
+    uint64_t head = stream_contexts_[i].event_buffer_head;
+    uint64_t ready = final ? head : stream_ready_[i];
+    uint64_t tail = stream_tails_[i], dropped = 0;
+    stream_ready_[i] = head;
+    if (ready <= tail) continue;
+    if (ready - tail > kMaxNumGpuEventsPerBuffer) {
+      dropped = ready - tail - kMaxNumGpuEventsPerBuffer;
+      tail = ready - kMaxNumGpuEventsPerBuffer;
+    }
+    uint64_t num_events = ready - tail;
+    uint64_t first = tail & (kMaxNumGpuEventsPerBuffer - 1);
+    uint64_t num_first = std::min(num_events, kMaxNumGpuEventsPerBuffer - first);
+    CUDACHECK(hipMemcpyAsync(stream_staging_[p], gpu_event_buffers_[i] + first, num_first * sizeof(NpKitEvent),
+                             hipMemcpyDeviceToHost, stream_copy_stream));
+    if (num_first < num_events) {
+      CUDACHECK(hipMemcpyAsync(stream_staging_[p] + num_first, gpu_event_buffers_[i], (num_events - num_first) * sizeof(NpKitEvent),
+                               hipMemcpyDeviceToHost, stream_copy_stream));
+    }
+    CUDACHECK(hipEventRecord(stream_copied[p], stream_copy_stream));
+    stream_tails_[i] = ready;
+    if (pending >= 0) {
+      CUDACHECK(hipEventSynchronize(stream_copied[p ^ 1]));
+      StreamWrite(0, pending, stream_staging_[p ^ 1], pending_events, pending_dropped);
+    }
+    pending = i;
+    pending_events = num_events;
+    pending_dropped = dropped;
+    p ^= 1;
+  }
+  if (pending >= 0) {
+    CUDACHECK(hipEventSynchronize(stream_copied[p ^ 1]));
+    StreamWrite(0, pending, stream_staging_[p ^ 1], pending_events, pending_dropped);
+  }
+
+  // CPU buffers are in host memory and written out directly
+  for (uint64_t i = 0; i < kNumCpuEventBuffers; i++) {
+    uint64_t head = *(volatile uint64_t*)&cpu_collect_contexts_[i].event_buffer_head;
+    uint64_t* ready_ptr = stream_ready_ + kNumGpuEventBuffers + i;
+    uint64_t* tail_ptr = stream_tails_ + kNumGpuEventBuffers + i;
+    uint64_t ready = final ? head : *ready_ptr;
+    uint64_t tail = *tail_ptr, dropped = 0;
+    *ready_ptr = head;
+    if (ready <= tail) continue;
+    if (ready - tail > kMaxNumCpuEventsPerBuffer) {
+      dropped = ready - tail - kMaxNumCpuEventsPerBuffer;
+      tail = ready - kMaxNumCpuEventsPerBuffer;
+    }
+    uint64_t num_events = ready - tail;
+    uint64_t first = tail & (kMaxNumCpuEventsPerBuffer - 1);
+    uint64_t num_first = std::min(num_events, kMaxNumCpuEventsPerBuffer - first);
+    StreamWrite(1, i, cpu_event_buffers_[i] + first, num_first, dropped);
+    if (num_first < num_events) StreamWrite(1, i, cpu_event_buffers_[i], num_events - num_first, 0);
+    *tail_ptr = ready;
+  }
+  fflush(stream_file_);
+  return ncclSuccess;
+}
+
+void NpKit::StreamThread(int cuda_dev) {
+  if (hipSetDevice(cuda_dev) != hipSuccess) {
+    WARN("NpKit: streaming thread failed to set device %d", cuda_dev);
+    return;
+  }
+  auto next_drain = std::chrono::steady_clock::now();
+  while (!stream_thread_should_stop_) {
+    next_drain += std::chrono::milliseconds(stream_interval_ms_);
+    while (!stream_thread_should_stop_ && std::chrono::steady_clock::now() < next_drain) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (stream_thread_should_stop_ || StreamDrain(false) != ncclSuccess) break;
+  }
+}
+
 ncclResult_t NpKit::Init(int rank) {
   uint64_t i = 0;
   NpKitEventCollectContext ctx;
   ctx.event_buffer_head = 0;
   rank_ = rank;
 
+  // Streaming drains the buffers to NPKIT_DUMP_DIR while running, they are then used as rings
+  const char* stream_interval_str = getenv("NPKIT_STREAM_INTERVAL_MS");
+  const char* max_events_str = getenv("NPKIT_MAX_EVENTS_PER_COLLECTIVE");
+  const char* dump_dir = getenv("NPKIT_DUMP_DIR");
+  stream_interval_ms_ = stream_interval_str ? strtoull(stream_interval_str, nullptr, 0) : 0;
+  if (stream_interval_ms_ && dump_dir == nullptr) {
+    WARN("NpKit: NPKIT_STREAM_INTERVAL_MS needs NPKIT_DUMP_DIR, streaming disabled");
+    stream_interval_ms_ = 0;
+  }
+  ctx.streaming = stream_interval_ms_ != 0;
+  ctx.max_events_per_collective = max_events_str ? strtoull(max_events_str, nullptr, 0) : 0;
+
   // Init event data structures
   NCCLCHECK(ncclCalloc(&gpu_event_buffers_, kNumGpuEventBuffers));
   NCCLCHECK(ncclCudaCalloc(&gpu_collect_contexts_, kNumGpuEventBuffers));
@@ -52,6 +191,7 @@ ncclResult_t NpKit::Init(int rank) {
 
   NCCLCHECK(ncclCalloc(&cpu_event_buffers_, kNumCpuEventBuffers));
   NCCLCHECK(ncclCalloc(&cpu_collect_contexts_, kNumCpuEventBuffers));
+  ctx.max_events_per_collective = 0;
   for (i = 0; i < kNumCpuEventBuffers; i++) {
     NCCLCHECK(ncclCalloc(cpu_event_buffers_ + i, kMaxNumCpuEventsPerBuffer));
     ctx.event_buffer = cpu_event_buffers_[i];
@@ -65,15 +205,48 @@ ncclResult_t NpKit::Init(int rank) {
   cpu_timestamp_update_thread_should_stop_ = false;
   cpu_timestamp_update_thread_ = new std::thread(CpuTimestampUpdateThread);
 
+  if (stream_interval_ms_) {
+    std::string stream_file_path = dump_dir;
+    stream_file_path += "/npkit_stream_rank_";
+    stream_file_path += std::to_string(rank_);
+    stream_file_ = fopen(stream_file_path.c_str(), "wb");
+    if (stream_file_ == nullptr) {
+      WARN("NpKit: could not open %s : %s", stream_file_path.c_str(), strerror(errno));
+      return ncclSystemError;
+    }
+    NCCLCHECK(ncclCudaHostCalloc(stream_staging_, kMaxNumGpuEventsPerBuffer));
+    NCCLCHECK(ncclCudaHostCalloc(stream_staging_ + 1, kMaxNumGpuEventsPerBuffer));
+    NCCLCHECK(ncclCudaHostCalloc(&stream_contexts_, kNumGpuEventBuffers));
+    NCCLCHECK(ncclCalloc(&stream_tails_, kNumGpuEventBuffers + kNumCpuEventBuffers));
+    NCCLCHECK(ncclCalloc(&stream_ready_, kNumGpuEventBuffers + kNumCpuEventBuffers));
+    CUDACHECK(hipStreamCreateWithFlags(&stream_copy_stream, hipStreamNonBlocking));
+    CUDACHECK(hipEventCreateWithFlags(stream_copied, hipEventDisableTiming));
+    CUDACHECK(hipEventCreateWithFlags(stream_copied + 1, hipEventDisableTiming));
+    int cuda_dev;
+    CUDACHECK(hipGetDevice(&cuda_dev));
+    stream_thread_should_stop_ = false;
+    stream_thread_ = new std::thread(StreamThread, cuda_dev);
+  }
+
   return ncclSuccess;
 }
 
 ncclResult_t NpKit::Dump(const std::string& dump_dir) {
   uint64_t i = 0;
   std::string dump_file_path;
+  bool streaming = stream_file_ != nullptr;
+
+  // Streamed events only need the last drain
+  if (stream_thread_) {
+    stream_thread_should_stop_ = true;
+    stream_thread_->join();
+    delete stream_thread_;
+    stream_thread_ = nullptr;
+  }
+  if (streaming) NCCLCHECK(StreamDrain(true));
 
   // Dump CPU events
-  for (i = 0; i < kNumCpuEventBuffers; i++) {
+  for (i = 0; i < kNumCpuEventBuffers && !streaming; i++) {
     dump_file_path = dump_dir;
     dump_file_path += "/cpu_events_rank_";
     dump_file_path += std::to_string(rank_);
@@ -102,8 +275,18 @@ ncclResult_t NpKit::Dump(const std::string& dump_dir) {
   clock_period_den_file.write(clock_period_den_str.c_str(), clock_period_den_str.length());
   clock_period_den_file.close();
 
+  // Dump offset of the CPU clock to rank 0 (RCCL_CLOCK_SYNC_INTERVAL_MS), in ns
+  dump_file_path = dump_dir;
+  dump_file_path += "/cpu_clock_offset_ns_rank_";
+  dump_file_path += std::to_string(rank_);
+  uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  std::string clock_offset_str = std::to_string((int64_t)(ncclClockSyncToGlobal(now_ns) - now_ns));
+  auto clock_offset_file = std::fstream(dump_file_path, std::ios::out);
+  clock_offset_file.write(clock_offset_str.c_str(), clock_offset_str.length());
+  clock_offset_file.close();
+
   // Dump GPU events, reuse CPU struct
-  for (i = 0; i < kNumGpuEventBuffers; i++) {
+  for (i = 0; i < kNumGpuEventBuffers && !streaming; i++) {
     dump_file_path = dump_dir;
     dump_file_path += "/gpu_events_rank_";
     dump_file_path += std::to_string(rank_);
@@ -131,6 +314,23 @@ ncclResult_t NpKit::Dump(const std::string& dump_dir) {
   return ncclSuccess;
 }
 
+ncclResult_t NpKit::ExportTrace() {
+  if (!ncclChromeTraceEnabled()) return ncclSuccess;
+  // Not through cpu_event_buffers_, Dump() still has to write them
+  std::vector<NpKitEvent> events(kMaxNumGpuEventsPerBuffer);
+  NpKitEventCollectContext ctx;
+  double gpu_clock_khz = GetDeviceWallClockRateInKhz(0);
+  for (uint64_t i = 0; i < kNumGpuEventBuffers; i++) {
+    NCCLCHECK(ncclCudaMemcpy(&ctx, gpu_collect_contexts_ + i, 1));
+    if (ctx.event_buffer_head == 0) continue;
+    NCCLCHECK(ncclCudaMemcpy(events.data(), gpu_event_buffers_[i], kMaxNumGpuEventsPerBuffer));
+    uint64_t num_events = std::min(ctx.event_buffer_head, kMaxNumGpuEventsPerBuffer);
+    uint64_t first = ctx.streaming ? ctx.event_buffer_head - num_events : 0;
+    ncclChromeTraceNpKit(i, events.data(), num_events, first, kMaxNumGpuEventsPerBuffer, gpu_clock_khz);
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t NpKit::Shutdown() {
   uint64_t i = 0;
 
@@ -138,6 +338,26 @@ ncclResult_t NpKit::Shutdown() {
   cpu_timestamp_update_thread_should_stop_ = true;
   cpu_timestamp_update_thread_->join();
 
+  // Stop streaming, events not dumped yet are lost
+  if (stream_thread_) {
+    stream_thread_should_stop_ = true;
+    stream_thread_->join();
+    delete stream_thread_;
+    stream_thread_ = nullptr;
+  }
+  if (stream_file_) {
+    fclose(stream_file_);
+    stream_file_ = nullptr;
+    NCCLCHECK(ncclCudaHostFree(stream_staging_[0]));
+    NCCLCHECK(ncclCudaHostFree(stream_staging_[1]));
+    NCCLCHECK(ncclCudaHostFree(stream_contexts_));
+    free(stream_tails_);
+    free(stream_ready_);
+    CUDACHECK(hipEventDestroy(stream_copied[0]));
+    CUDACHECK(hipEventDestroy(stream_copied[1]));
+    CUDACHECK(hipStreamDestroy(stream_copy_stream));
+  }
+
   // Free CPU event data structures
   for (i = 0; i < kNumCpuEventBuffers; i++) {
     free(cpu_event_buffers_[i]);
@@ -164,8 +384,8 @@ NpKitEventCollectContext* NpKit::GetGpuEventCollectContexts() {
 
 void NpKit::CollectCpuEvent(uint8_t type, int64_t size, uint32_t rsvd, uint64_t timestamp, int channel_id) {
   uint64_t event_buffer_head = cpu_collect_contexts_[channel_id].event_buffer_head;
-  if (event_buffer_head < kMaxNumCpuEventsPerBuffer) {
-    NpKitEvent& event = cpu_collect_contexts_[channel_id].event_buffer[event_buffer_head];
+  if (cpu_collect_contexts_[channel_id].streaming || event_buffer_head < kMaxNumCpuEventsPerBuffer) {
+    NpKitEvent& event = cpu_collect_contexts_[channel_id].event_buffer[event_buffer_head & (kMaxNumCpuEventsPerBuffer - 1)];
     event.fields.type = type;
     event.fields.size = size < 0 ? 0 : size;
     event.fields.rsvd = rsvd;
@@ -59,6 +59,14 @@ void initEnv() {
   setEnvFile(confFilePath);
 }
 
+const char* ncclGetEnv(const char* name) {
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, initEnv);
+  const char* str = getenv(name);
+  if (str) INFO(NCCL_ENV, "%s set by environment to %s", name, str);
+  return str;
+}
+
 void ncclLoadParam(char const* env, int64_t deftVal, int64_t uninitialized, int64_t* cache) {
   static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
   pthread_mutex_lock(&mutex);
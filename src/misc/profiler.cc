@@ -5,111 +5,469 @@
  ************************************************************************/
 
 #include "profiler.h"
-
-//#define PROFILE_PROXY 1
-#ifdef PROFILE_PROXY
-#include "timer.h"
+#include "comm.h"
+#include "argcheck.h"
+#include "param.h"
 #include "alloc.h"
+#include "chrome_trace.h"
+#include <signal.h>
+#include <algorithm>
+#include <unordered_map>
+
+/* Proxy event rings.
+ *
+ * Each progress thread appends the step states it goes through to its own ring
+ * of RCCL_PROXY_TRACE_RING records (rounded up to a power of two, 0 disables),
+ * overwriting the oldest ones. A record costs a clock read and a 16 byte store,
+ * so the rings stay on by default and hold the last moments of a slow job.
+ * They are read without stopping the threads by ncclProxyTraceSnapshot() and
+ * the RCCL_PROXY_HIST_DUMP_SIGNAL dump. With NCCL_PROXY_PROFILE=<file> the
+ * rings default to 64K records and are written as a Chrome trace when the
+ * proxy stops. */
+RCCL_PARAM(ProxyTraceRing, "PROXY_TRACE_RING", -1);
+
+static int proxyTraceSize = -1;
+static thread_local struct ncclProxyTraceRing* proxyTraceRing = NULL;
+static thread_local struct ncclProxyState* proxyTraceOwner = NULL;
+
+static int proxyTraceRingSize() {
+  int64_t n = rcclParamProxyTraceRing();
+  if (n < 0) n = getenv("NCCL_PROXY_PROFILE") ? 1<<16 : 1<<12;
+  if (n == 0) return 0;
+  int size = 1;
+  while (size < n && size < (1<<24)) size <<= 1;
+  return size;
+}
+
+static ncclResult_t proxyRingRecord(struct ncclProxyArgs* args, int s, int step, int state) {
+  struct ncclProxySubArgs* sub = args->subs+s;
+  struct ncclProxyState* proxyState = sub->connection->proxyState;
+  struct ncclProxyTraceRing* ring = proxyTraceRing;
+  if (proxyTraceOwner != proxyState) {
+    NCCLCHECK(ncclCalloc(&ring, 1));
+    NCCLCHECK(ncclCalloc(&ring->records, proxyTraceSize));
+    ring->mask = proxyTraceSize-1;
+    ring->next = __atomic_load_n(&proxyState->traceRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&proxyState->traceRings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    proxyTraceRing = ring;
+    proxyTraceOwner = proxyState;
+  }
+  ncclProxyTraceRecord_t* r = ring->records + (ring->head & ring->mask);
+  r->timestampNs = clockNano();
+  r->channel = sub->channelId;
+  r->peer = sub->peer;
+  r->state = state;
+  r->send = sub->connection->send;
+  r->step = step;
+  __atomic_store_n(&ring->head, ring->head+1, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
+// Copies the records of a ring to out, oldest first, and returns their number.
+// Entries the writer may have overwritten during the copy are dropped.
+static int proxyTraceRingCopy(struct ncclProxyTraceRing* ring, ncclProxyTraceRecord_t* out) {
+  const uint64_t size = ring->mask+1;
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t start = head > size ? head-size : 0;
+  for (uint64_t i=start; i<head; i++) out[i-start] = ring->records[i & ring->mask];
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  uint64_t newHead = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint64_t valid = newHead >= size ? newHead-size+1 : 0;
+  if (valid <= start) return head-start;
+  if (valid >= head) return 0;
+  memmove(out, out+(valid-start), (head-valid)*sizeof(ncclProxyTraceRecord_t));
+  return head-valid;
+}
+
+// Records of all the rings of proxyState, sorted by time. Caller frees *records.
+static ncclResult_t proxyTraceCollect(struct ncclProxyState* proxyState, ncclProxyTraceRecord_t** records, int* nRecords) {
+  *records = NULL;
+  *nRecords = 0;
+  struct ncclProxyTraceRing* rings = __atomic_load_n(&proxyState->traceRings, __ATOMIC_ACQUIRE);
+  size_t cap = 0;
+  for (struct ncclProxyTraceRing* ring = rings; ring; ring = ring->next) cap += ring->mask+1;
+  if (cap == 0) return ncclSuccess;
+  NCCLCHECK(ncclCalloc(records, cap));
+  int n = 0;
+  for (struct ncclProxyTraceRing* ring = rings; ring; ring = ring->next) n += proxyTraceRingCopy(ring, *records+n);
+  std::stable_sort(*records, *records+n, [](const ncclProxyTraceRecord_t& a, const ncclProxyTraceRecord_t& b) {
+    return a.timestampNs < b.timestampNs;
+  });
+  *nRecords = n;
+  return ncclSuccess;
+}
+
+static inline uint64_t proxyTraceKey(const ncclProxyTraceRecord_t* r) {
+  return ((uint64_t)r->channel << 48) | ((uint64_t)(uint16_t)r->peer << 32) | ((uint64_t)r->send << 16) | r->step;
+}
+
+// Calls fn(prev, next) for each state a step spent from record prev to record
+// next, the following record of the same step.
+template<typename F>
+static void proxyTraceForEachState(const ncclProxyTraceRecord_t* records, int n, F fn) {
+  std::unordered_map<uint64_t, int> last;
+  for (int i=0; i<n; i++) {
+    const ncclProxyTraceRecord_t* r = records+i;
+    uint64_t key = proxyTraceKey(r);
+    auto it = last.find(key);
+    if (it != last.end() && records[it->second].state < r->state) fn(records+it->second, r);
+    if (r->state == ncclProxyProfileEnd) {
+      if (it != last.end()) last.erase(it);
+    } else {
+      last[key] = i;
+    }
+  }
+}
 
 static const char* profilingStateSendStr[] = { "BufferWait", "GPUWait", "SendWait", "", "End" };
 static const char* profilingStateRecvStr[] = { "BufferWait", "RecvWait", "FlushWait", "GPUWait", "End" };
-static const char* profilingEventStr[] = { "SendRecv", "Sleep", "Idle", "Append" };
-struct ncclProxyProfileEvent {
-  double timestamp[6];
-  uint64_t opCount;
-  int peer;
-  int step;
-  uint16_t channel;
-  uint8_t type; // send / recv
-  uint8_t opIndex;
-};
 
-struct ncclProxyProfileEvent* profilingEvents = NULL;
-int profilingIndex = 0;
-double profilingStart = 0;
-#define MAX_EVENTS 200000
+struct proxyTraceStateStats {
+  uint64_t count;
+  uint64_t totalNs;
+  uint64_t maxNs;
+};
 
-ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state) {
-  if (profilingEvents == NULL) {
-    NCCLCHECK(ncclCalloc(&profilingEvents, MAX_EVENTS));
-    profilingStart = gettime();
-  }
-  struct ncclProxyProfileEvent* event = NULL;
-  if (state%8 == 0) {
-    if (profilingIndex == MAX_EVENTS) return ncclSuccess;
-    args->subs[sub].profilingEvents[step%NCCL_STEPS] = event = profilingEvents+profilingIndex++;
-    if (state == ncclProxyProfileBegin) {
-      // Proxy operation information
-      event->opCount = args->opCount;
-      event->channel = args->subs[sub].channelId;
-      event->peer = args->subs[sub].peer;
-      event->type = args->pattern;
-      event->step = step;
-      event->opIndex = (((uint64_t)args)/sizeof(struct ncclProxyArgs))%256;
-    } else event->peer = -state;
-  } else {
-    event = (struct ncclProxyProfileEvent*)args->subs[sub].profilingEvents[step%NCCL_STEPS];
-    if (state == ncclProxyProfileEnd) args->subs[sub].profilingEvents[step%NCCL_STEPS] = NULL;
-    if (state == ncclProxyProfileAppendEnd) event->opCount = args->opCount;
+static void proxyTraceDump(struct ncclProxyState* proxyState, FILE* f) {
+  ncclProxyTraceRecord_t* records;
+  int n;
+  if (proxyTraceCollect(proxyState, &records, &n) != ncclSuccess || n == 0) return;
+  struct proxyTraceStateStats stats[2][ncclProxyProfileEnd] = {};
+  proxyTraceForEachState(records, n, [&](const ncclProxyTraceRecord_t* prev, const ncclProxyTraceRecord_t* next) {
+    struct proxyTraceStateStats* st = &stats[prev->send][prev->state];
+    uint64_t ns = next->timestampNs - prev->timestampNs;
+    st->count++;
+    st->totalNs += ns;
+    if (ns > st->maxNs) st->maxNs = ns;
+  });
+  fprintf(f, "[%d] Proxy step states over the last %.1f ms (us):\n", proxyState->cudaDev,
+      (records[n-1].timestampNs-records[0].timestampNs)/1e6);
+  for (int send=1; send>=0; send--) {
+    fprintf(f, "  %s:", send ? "send" : "recv");
+    for (int state=0; state<ncclProxyProfileEnd; state++) {
+      struct proxyTraceStateStats* st = &stats[send][state];
+      if (st->count == 0) continue;
+      fprintf(f, " %s n=%lu avg=%.1f max=%.1f total=%.1f", (send ? profilingStateSendStr : profilingStateRecvStr)[state],
+          st->count, st->totalNs/1e3/st->count, st->maxNs/1e3, st->totalNs/1e3);
+    }
+    fprintf(f, "\n");
   }
-  // Timestamp
-  event->timestamp[state%8] = gettime()-profilingStart;
-  return ncclSuccess;
+  const char* path = getenv("RCCL_PROXY_TRACE_FILE");
+  FILE* rf = path ? fopen(path, "a") : NULL;
+  if (path && rf == NULL) WARN("Could not open RCCL_PROXY_TRACE_FILE %s : %s", path, strerror(errno));
+  if (rf) {
+    fprintf(rf, "# dev %d\ntimestampNs,channel,peer,send,state,step\n", proxyState->cudaDev);
+    for (int i=0; i<n; i++) {
+      const ncclProxyTraceRecord_t* r = records+i;
+      fprintf(rf, "%lu,%d,%d,%d,%d,%d\n", r->timestampNs, r->channel, r->peer, r->send, r->state, r->step);
+    }
+    fclose(rf);
+  }
+  free(records);
 }
 
-void ncclProfilingDump() {
+void ncclProfilingDump(struct ncclProxyState* proxyState) {
   static int dumpDone = 0;
-  if (dumpDone) return;
-  dumpDone = 1;
   const char* str = getenv("NCCL_PROXY_PROFILE");
-  if (!str) { free(profilingEvents); return; }
+  if (str == NULL || __atomic_exchange_n(&dumpDone, 1, __ATOMIC_RELAXED)) return;
+  ncclProxyTraceRecord_t* records;
+  int n;
+  if (proxyTraceCollect(proxyState, &records, &n) != ncclSuccess) return;
   FILE* f = fopen(str, "w");
+  if (f == NULL) {
+    WARN("Could not open NCCL_PROXY_PROFILE %s : %s", str, strerror(errno));
+    free(records);
+    return;
+  }
   fprintf(f, "[\n");
+  const uint64_t t0 = n ? records[0].timestampNs : 0;
+  proxyTraceForEachState(records, n, [&](const ncclProxyTraceRecord_t* prev, const ncclProxyTraceRecord_t* next) {
+    const char* name = (prev->send ? profilingStateSendStr : profilingStateRecvStr)[prev->state];
+    const int id = prev-records;
+    fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"b\", \"id\": %d, \"pid\": %d, \"tid\": 1, \"ts\": %f, \"args\": { \"peer\": %d, \"step\": %d } },\n",
+        name, id, prev->channel, (prev->timestampNs-t0)/1e3, prev->peer, prev->step);
+    fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"e\", \"id\": %d, \"pid\": %d, \"tid\": 1, \"ts\": %f },\n",
+        name, id, prev->channel, (next->timestampNs-t0)/1e3);
+  });
+  fprintf(f, "{} ]\n");
+  fclose(f);
+  free(records);
+}
 
-  for (int i=0; i<profilingIndex; i++) {
-    struct ncclProxyProfileEvent* e = profilingEvents+i;
-    const int sendrecv = e->peer >= 0;
-    const char* typeStr = sendrecv ? (e->type == ncclPatternSend ? "Send" : "Recv") :
-      profilingEventStr[-(e->peer/8)];
-
-
-    if (sendrecv) {
-      int state = ncclProxyProfileBegin;
-      const char** stateStr = e->type == ncclPatternSend ? profilingStateSendStr : profilingStateRecvStr;
-      fprintf(f, "{\"name\": \"%s-%d-%d\", \"cat\": \"NET\", \"ph\": \"b\", \"id\": %d, \"pid\": %d, \"tid\": 1, \"ts\": %f, \"args\": { \"opCount\": %ld, \"proxyOpIndex\":%d } },\n",
-          typeStr, e->peer, e->step, i, e->channel, e->timestamp[state], e->opCount, e->opIndex);
-
-      while (state<ncclProxyProfileEnd) {
-        if (e->timestamp[state]) {
-          const char* name = stateStr[state];
-          fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"b\", \"id\": %d, \"pid\": %d, \"tid\": 1, \"ts\": %f },\n",
-              name, i, e->channel, e->timestamp[state]);
-          state++;
-          while (e->timestamp[state] == 0) state++;
-          fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"e\", \"id\": %d, \"pid\": %d, \"tid\": 1, \"ts\": %f },\n",
-              name, i, e->channel, e->timestamp[state]);
-        }
-      }
-
-      fprintf(f, "{\"name\": \"%s-%d-%d\", \"cat\": \"NET\", \"ph\": \"e\", \"id\": %d, \"pid\": %d, \"tid\": 1, \"ts\": %f },\n",
-          typeStr, e->peer, e->step, i, e->channel, e->timestamp[state]);
-    } else {
-      if (e->peer == -ncclProxyProfileAppend) {
-      fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"b\", \"id\": %d, \"pid\": -1, \"tid\": 1, \"ts\": %f, \"args\": { \"added\": %ld } },\n",
-          typeStr, i, e->timestamp[0], e->opCount);
-      } else {
-        fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"b\", \"id\": %d, \"pid\": -1, \"tid\": 1, \"ts\": %f },\n",
-          typeStr, i, e->timestamp[0]);
-      }
-      fprintf(f, "{\"name\": \"%s\", \"cat\": \"NET\", \"ph\": \"e\", \"id\": %d, \"pid\": -1, \"tid\": 1, \"ts\": %f },\n",
-          typeStr, i, e->timestamp[1]);
+/* Step latency histograms.
+ *
+ * Enabled with RCCL_PROXY_HISTOGRAMS=1, independently of the event rings. The
+ * progress thread stamps each step when it reaches a profiling state and, once
+ * the step is done, adds its latencies to the histograms of its connection:
+ *   send: step = post->done, GPU wait = post->data ready, net wait = isend->done
+ *   recv: step = irecv->done, net wait = irecv->received, GPU wait = flushed->done
+ * Histograms are written by the owning progress thread only and read without
+ * locking, so a query concurrent with traffic may be off by a few samples. */
+RCCL_PARAM(ProxyHistograms, "PROXY_HISTOGRAMS", 0);
+RCCL_PARAM(ProxyHistDumpSignal, "PROXY_HIST_DUMP_SIGNAL", -1);
+
+static int proxyHistEnabled = -1;
+static uint64_t proxyHistSignalSeq = 0;
+
+static inline int proxyHistBucket(uint64_t v) {
+  if (v < (1 << NCCL_PROXY_HIST_SUB_BITS)) return (int)v;
+  int e = 63 - __builtin_clzll(v);
+  if (e > NCCL_PROXY_HIST_MAX_EXP) return NCCL_PROXY_HIST_BUCKETS-1;
+  return ((e-NCCL_PROXY_HIST_SUB_BITS+1) << NCCL_PROXY_HIST_SUB_BITS) +
+    (int)((v >> (e-NCCL_PROXY_HIST_SUB_BITS)) & ((1 << NCCL_PROXY_HIST_SUB_BITS)-1));
+}
+
+// Midpoint of a bucket, in ns
+static inline double proxyHistValue(int b) {
+  if (b < (1 << NCCL_PROXY_HIST_SUB_BITS)) return b;
+  int e = (b >> NCCL_PROXY_HIST_SUB_BITS) + NCCL_PROXY_HIST_SUB_BITS - 1;
+  uint64_t width = 1ULL << (e-NCCL_PROXY_HIST_SUB_BITS);
+  uint64_t low = (1ULL << e) + (b & ((1 << NCCL_PROXY_HIST_SUB_BITS)-1))*width;
+  return low + width/2.0;
+}
+
+static inline void proxyHistAdd(struct ncclProxyHist* hist, uint64_t v) {
+  hist->buckets[proxyHistBucket(v)]++;
+  hist->count++;
+  hist->sumNs += v;
+  if (v > hist->maxNs) hist->maxNs = v;
+}
+
+static void proxyHistMerge(struct ncclProxyHist* dst, const struct ncclProxyHist* src) {
+  for (int b=0; b<NCCL_PROXY_HIST_BUCKETS; b++) dst->buckets[b] += src->buckets[b];
+  dst->count += src->count;
+  dst->sumNs += src->sumNs;
+  if (src->maxNs > dst->maxNs) dst->maxNs = src->maxNs;
+}
+
+// Returns the latency in ns below which a fraction p of the samples fall
+static double proxyHistPercentile(const struct ncclProxyHist* hist, double p) {
+  if (hist->count == 0) return 0;
+  uint64_t target = (uint64_t)(p*hist->count);
+  if (target >= hist->count) target = hist->count-1;
+  uint64_t seen = 0;
+  for (int b=0; b<NCCL_PROXY_HIST_BUCKETS; b++) {
+    seen += hist->buckets[b];
+    if (seen > target) return std::min(proxyHistValue(b), (double)hist->maxNs);
+  }
+  return hist->maxNs;
+}
+
+static ncclResult_t proxyHistRecord(struct ncclProxyArgs* args, int s, int step, int state) {
+  struct ncclProxySubArgs* sub = args->subs+s;
+  uint64_t* t = sub->stepNs[step%NCCL_STEPS];
+  uint64_t now = clockNano();
+  if (state != ncclProxyProfileEnd) {
+    t[state-1] = now;
+    return ncclSuccess;
+  }
+  struct ncclProxyConnection* connection = sub->connection;
+  struct ncclProxyConnStats* stats = connection->stats;
+  if (stats == NULL) {
+    NCCLCHECK(ncclCalloc(&stats, 1));
+    stats->peer = sub->peer;
+    stats->channelId = sub->channelId;
+    stats->send = connection->send;
+    struct ncclProxyState* proxyState = connection->proxyState;
+    stats->next = __atomic_load_n(&proxyState->connStats, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&proxyState->connStats, &stats->next, stats, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    connection->stats = stats;
+  }
+  struct ncclProxyHist* hists = stats->hists;
+  if (connection->send) {
+    if (t[0]) proxyHistAdd(hists+ncclProxyMetricStep, now-t[0]);
+    if (t[0] && t[1]) proxyHistAdd(hists+ncclProxyMetricGpuWait, t[1]-t[0]);
+    if (t[1]) proxyHistAdd(hists+ncclProxyMetricNetWait, now-t[1]);
+  } else {
+    if (t[0]) proxyHistAdd(hists+ncclProxyMetricStep, now-t[0]);
+    if (t[0] && t[1]) proxyHistAdd(hists+ncclProxyMetricNetWait, t[1]-t[0]);
+    if (t[2]) proxyHistAdd(hists+ncclProxyMetricGpuWait, now-t[2]);
+  }
+  t[0] = t[1] = t[2] = 0;
+  return ncclSuccess;
+}
+
+// Chrome trace spans of the states of a step, see misc/chrome_trace.cc
+static const char* traceSendStateStr[] = { "Send BufferWait", "Send GPUWait", "Send SendWait" };
+static const char* traceRecvStateStr[] = { "Recv BufferWait", "Recv RecvWait", "Recv FlushWait", "Recv GPUWait" };
+
+static void proxyTraceRecord(struct ncclProxyArgs* args, int s, int step, int state) {
+  struct ncclProxySubArgs* sub = args->subs+s;
+  uint64_t* t = sub->traceNs[step%NCCL_STEPS];
+  uint64_t now = ncclChromeTraceNow();
+  if (state != ncclProxyProfileEnd) {
+    t[state] = now;
+    return;
+  }
+  const int send = sub->connection->send;
+  const char** stateStr = send ? traceSendStateStr : traceRecvStateStr;
+  const int nStates = send ? 3 : 4;
+  for (int i=0; i<nStates; i++) {
+    if (t[i] == 0) continue;
+    uint64_t end = now;
+    for (int j=i+1; j<nStates; j++) {
+      if (t[j]) { end = t[j]; break; }
     }
+    ncclChromeTraceProxy(stateStr[i], t[i], end, sub->channelId, sub->peer, step);
+    t[i] = 0;
   }
-  fprintf(f, "{} ]\n");
-  fclose(f);
-  free(profilingEvents);
 }
-#else
-ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state) { return ncclSuccess; }
-void ncclProfilingDump() {}
-#endif
+
+ncclResult_t ncclProfilingRecord(struct ncclProxyArgs* args, int sub, int step, int state) {
+  if (ncclChromeTraceEnabled() && state <= ncclProxyProfileEnd) proxyTraceRecord(args, sub, step, state);
+  if (proxyHistEnabled == -1) proxyHistEnabled = rcclParamProxyHistograms() ? 1 : 0;
+  if (proxyHistEnabled && state > ncclProxyProfileBegin && state <= ncclProxyProfileEnd) {
+    NCCLCHECK(proxyHistRecord(args, sub, step, state));
+  }
+  if (proxyTraceSize == -1) proxyTraceSize = proxyTraceRingSize();
+  if (proxyTraceSize && state <= ncclProxyProfileEnd) NCCLCHECK(proxyRingRecord(args, sub, step, state));
+  return ncclSuccess;
+}
+
+void ncclProxyHistIdle(struct ncclProxyState* proxyState, int idle) {
+  if (proxyHistEnabled != 1) return;
+  uint64_t now = clockNano();
+  if (idle) {
+    proxyState->idleStartNs = now;
+  } else if (proxyState->idleStartNs) {
+    proxyHistAdd(&proxyState->idleHist, now-proxyState->idleStartNs);
+    proxyState->idleStartNs = 0;
+  }
+}
+
+static void proxyHistSignal(int signal) {
+  __atomic_fetch_add(&proxyHistSignalSeq, 1, __ATOMIC_RELAXED);
+}
+
+void ncclProxyHistInit() {
+  static int sigDone = 0;
+  const int sig = rcclParamProxyHistDumpSignal();
+  if (sig != -1 && __atomic_exchange_n(&sigDone, 1, __ATOMIC_RELAXED) == 0) signal(sig, proxyHistSignal);
+}
+
+static const char* proxyHistMetricStr[] = { "step", "gpuwait", "netwait", "idle" };
+
+static void proxyHistPrint(FILE* f, const char* name, const struct ncclProxyHist* hist) {
+  if (hist->count == 0) return;
+  fprintf(f, " %s n=%lu p50=%.1f p99=%.1f max=%.1f", name, hist->count,
+      proxyHistPercentile(hist, .5)/1e3, proxyHistPercentile(hist, .99)/1e3, hist->maxNs/1e3);
+}
+
+static void proxyHistDump(struct ncclProxyState* proxyState) {
+  const char* path = getenv("RCCL_PROXY_HIST_FILE");
+  FILE* f = path ? fopen(path, "a") : stdout;
+  if (f == NULL) {
+    WARN("Could not open RCCL_PROXY_HIST_FILE %s : %s", path, strerror(errno));
+    return;
+  }
+  fprintf(f, "[%d] Proxy step latencies (us):\n", proxyState->cudaDev);
+  for (struct ncclProxyConnStats* stats = __atomic_load_n(&proxyState->connStats, __ATOMIC_ACQUIRE); stats; stats = stats->next) {
+    fprintf(f, "  %s peer %d channel %d:", stats->send ? "send to" : "recv from", stats->peer, stats->channelId);
+    for (int m=0; m<NCCL_PROXY_CONN_METRICS; m++) proxyHistPrint(f, proxyHistMetricStr[m], stats->hists+m);
+    fprintf(f, "\n");
+  }
+  fprintf(f, "  progress:");
+  proxyHistPrint(f, proxyHistMetricStr[ncclProxyMetricIdle], &proxyState->idleHist);
+  fprintf(f, "\n");
+  if (path) fclose(f); else fflush(f);
+}
+
+void ncclProxyHistCheckDump(struct ncclProxyState* proxyState) {
+  uint64_t seq = __atomic_load_n(&proxyHistSignalSeq, __ATOMIC_RELAXED);
+  if (seq == proxyState->histDumpSeq) return;
+  proxyState->histDumpSeq = seq;
+  proxyHistDump(proxyState);
+  const char* path = getenv("RCCL_PROXY_HIST_FILE");
+  FILE* f = path ? fopen(path, "a") : stdout;
+  if (f == NULL) return;
+  proxyTraceDump(proxyState, f);
+  if (path) fclose(f); else fflush(f);
+}
+
+void ncclProxyHistFree(struct ncclProxyState* proxyState) {
+  if (proxyState->connStats && getenv("RCCL_PROXY_HIST_FILE")) proxyHistDump(proxyState);
+  struct ncclProxyConnStats* stats = proxyState->connStats;
+  while (stats) {
+    struct ncclProxyConnStats* next = stats->next;
+    free(stats);
+    stats = next;
+  }
+  proxyState->connStats = NULL;
+  struct ncclProxyTraceRing* ring = proxyState->traceRings;
+  while (ring) {
+    struct ncclProxyTraceRing* next = ring->next;
+    free(ring->records);
+    free(ring);
+    ring = next;
+  }
+  proxyState->traceRings = NULL;
+}
+
+NCCL_API(ncclResult_t, ncclProxyLatencyQuery, const ncclComm_t comm, int peer, ncclProxyMetric_t metric,
+    int nPercentiles, const double* percentiles, double* latenciesUs, uint64_t* count);
+ncclResult_t ncclProxyLatencyQuery(const ncclComm_t comm, int peer, ncclProxyMetric_t metric,
+    int nPercentiles, const double* percentiles, double* latenciesUs, uint64_t* count) {
+  NCCLCHECK(PtrCheck(comm, "ProxyLatencyQuery", "comm"));
+  NCCLCHECK(PtrCheck(count, "ProxyLatencyQuery", "count"));
+  if (nPercentiles < 0 || (nPercentiles > 0 && (percentiles == NULL || latenciesUs == NULL))) {
+    WARN("ProxyLatencyQuery : invalid percentile arguments (nPercentiles %d)", nPercentiles);
+    return ncclInvalidArgument;
+  }
+  if (metric < ncclProxyMetricStep || metric >= ncclProxyMetricNum) {
+    WARN("ProxyLatencyQuery : invalid metric %d", metric);
+    return ncclInvalidArgument;
+  }
+  NCCLCHECK(ncclCommEnsureReady(comm));
+  if (peer < -1 || peer >= comm->nRanks) {
+    WARN("ProxyLatencyQuery : invalid peer %d, comm has %d ranks", peer, comm->nRanks);
+    return ncclInvalidArgument;
+  }
+  for (int p=0; p<nPercentiles; p++) {
+    if (!(percentiles[p] >= 0 && percentiles[p] <= 1)) {
+      WARN("ProxyLatencyQuery : percentile %g not in [0, 1]", percentiles[p]);
+      return ncclInvalidArgument;
+    }
+  }
+
+  struct ncclProxyHist* hist;
+  NCCLCHECK(ncclCalloc(&hist, 1));
+  struct ncclProxyState* proxyState = comm->sharedRes->proxyState;
+  if (metric == ncclProxyMetricIdle) {
+    proxyHistMerge(hist, &proxyState->idleHist);
+  } else {
+    int topPeer = peer == -1 ? -1 : comm->topParentRanks[peer];
+    for (struct ncclProxyConnStats* stats = __atomic_load_n(&proxyState->connStats, __ATOMIC_ACQUIRE); stats; stats = stats->next) {
+      if (topPeer == -1 || stats->peer == topPeer) proxyHistMerge(hist, stats->hists+metric);
+    }
+  }
+  *count = hist->count;
+  for (int p=0; p<nPercentiles; p++) latenciesUs[p] = proxyHistPercentile(hist, percentiles[p])/1e3;
+  free(hist);
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclProxyTraceSnapshot, const ncclComm_t comm, ncclProxyTraceRecord_t* records, int maxRecords,
+    int* nRecords);
+ncclResult_t ncclProxyTraceSnapshot(const ncclComm_t comm, ncclProxyTraceRecord_t* records, int maxRecords,
+    int* nRecords) {
+  NCCLCHECK(PtrCheck(comm, "ProxyTraceSnapshot", "comm"));
+  NCCLCHECK(PtrCheck(nRecords, "ProxyTraceSnapshot", "nRecords"));
+  if (maxRecords < 0 || (maxRecords > 0 && records == NULL)) {
+    WARN("ProxyTraceSnapshot : invalid records arguments (maxRecords %d)", maxRecords);
+    return ncclInvalidArgument;
+  }
+  NCCLCHECK(ncclCommEnsureReady(comm));
+
+  ncclProxyTraceRecord_t* all;
+  int n;
+  NCCLCHECK(proxyTraceCollect(comm->sharedRes->proxyState, &all, &n));
+  if (maxRecords == 0) {
+    *nRecords = n;
+  } else {
+    int first = n > maxRecords ? n-maxRecords : 0;
+    memcpy(records, all+first, (n-first)*sizeof(ncclProxyTraceRecord_t));
+    *nRecords = n-first;
+  }
+  free(all);
+  return ncclSuccess;
+}
@@ -22,6 +22,7 @@ THE SOFTWARE.
 #include "rocm_smi_wrap.h"
 #include "core.h"
 #include "utils.h"
+#include <algorithm>
 
 #define ROCMSMICHECK(cmd) do {               \
   rsmi_status_t ret = cmd;                   \
@@ -116,3 +117,69 @@ ncclResult_t rocm_smi_getLinkInfo(int srcIndex, int dstIndex, RSMI_IO_LINK_TYPE*
   }
   return ncclSuccess;
 }
+
+// Current width in lanes and speed in Gbps of the xGMI links of a device, from its GPU metrics.
+// Not fatal either: the caller keeps the nominal bandwidth when metrics do not report them.
+ncclResult_t rocm_smi_getXgmiLinkMetrics(uint32_t deviceIndex, int* width, int* speed) {
+  *width = *speed = 0;
+#if defined USE_ROCM_SMI64CONFIG && rocm_smi_VERSION_MAJOR >= 6
+  rsmi_version_t version;
+  ROCMSMICHECK(rsmi_version_get(&version));
+  if (version.major < 6) return ncclSystemError;
+  rsmi_gpu_metrics_t metrics;
+  if (rsmi_dev_gpu_metrics_info_get(deviceIndex, &metrics) != RSMI_STATUS_SUCCESS) return ncclSystemError;
+  // Unsupported fields read as all ones
+  if (metrics.xgmi_link_width == 0 || metrics.xgmi_link_width == UINT16_MAX) return ncclSystemError;
+  if (metrics.xgmi_link_speed == 0 || metrics.xgmi_link_speed == UINT16_MAX) return ncclSystemError;
+  *width = metrics.xgmi_link_width;
+  *speed = metrics.xgmi_link_speed;
+  return ncclSuccess;
+#else
+  return ncclSystemError;
+#endif
+}
+
+// Counter errors are not fatal, the caller runs without xGMI counters
+#define ROCMSMICOUNTERCHECK(cmd) do {        \
+  rsmi_status_t ret = cmd;                   \
+  if( ret != RSMI_STATUS_SUCCESS ) {         \
+    const char *err;                         \
+    rsmi_status_string(ret, &err);           \
+    INFO(NCCL_INIT, "ROCm SMI counter failure %s", err); \
+    return ncclSystemError;                  \
+  }                                          \
+} while(false)
+
+ncclResult_t rocm_smi_xgmiCountersCreate(uint32_t deviceIndex, int maxLinks, rsmi_event_handle_t* handles, int* nLinks) {
+  *nLinks = 0;
+  ROCMSMICOUNTERCHECK(rsmi_dev_counter_group_supported(deviceIndex, RSMI_EVNT_GRP_XGMI_DATA_OUT));
+  int n = std::min(maxLinks, RSMI_EVNT_XGMI_DATA_OUT_LAST-RSMI_EVNT_XGMI_DATA_OUT_FIRST+1);
+  for (int l = 0; l < n; l++) {
+    rsmi_status_t ret = rsmi_dev_counter_create(deviceIndex, (rsmi_event_type_t)(RSMI_EVNT_XGMI_DATA_OUT_FIRST+l), handles+l);
+    if (ret == RSMI_STATUS_SUCCESS) ret = rsmi_counter_control(handles[l], RSMI_CNTR_CMD_START, NULL);
+    if (ret != RSMI_STATUS_SUCCESS) {
+      rocm_smi_xgmiCountersDestroy(*nLinks, handles);
+      *nLinks = 0;
+      ROCMSMICOUNTERCHECK(ret);
+    }
+    (*nLinks)++;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t rocm_smi_xgmiCountersRead(int nLinks, const rsmi_event_handle_t* handles, uint64_t* beats) {
+  for (int l = 0; l < nLinks; l++) {
+    rsmi_counter_value_t value;
+    ROCMSMICOUNTERCHECK(rsmi_counter_read(handles[l], &value));
+    beats[l] = value.value;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t rocm_smi_xgmiCountersDestroy(int nLinks, rsmi_event_handle_t* handles) {
+  for (int l = 0; l < nLinks; l++) {
+    rsmi_counter_control(handles[l], RSMI_CNTR_CMD_STOP, NULL);
+    rsmi_dev_counter_destroy(handles[l]);
+  }
+  return ncclSuccess;
+}
@@ -5,6 +5,7 @@
  ************************************************************************/
 
 #include "shm.h"
+#include "alloc.h"
 #include "checks.h"
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -15,6 +16,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <utils.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 struct shmHandleInternal {
   int fd;
@@ -44,7 +47,29 @@ static void shmHandleInit(int fd, char* shmPath, size_t shmSize, size_t realShmS
   return;
 }
 
+// Prefer numaId for the pages of a new segment and optionally back it with transparent huge pages. Must run
+// before the first touch; failures only cost locality, so they are reported and ignored.
+static void shmPlace(char* shmPath, char* hptr, size_t size, int numaId, int hugePages) {
+  if (hugePages && madvise(hptr, size, MADV_HUGEPAGE) != 0) {
+    INFO(NCCL_ALLOC, "madvise(MADV_HUGEPAGE) on %s failed : %s", shmPath, strerror(errno));
+  }
+  if (numaId >= 0) {
+    unsigned long nodeMask[4] = {0};
+    if (numaId >= (int)(sizeof(nodeMask)*8)) return;
+    nodeMask[numaId/(sizeof(unsigned long)*8)] = 1UL << (numaId%(sizeof(unsigned long)*8));
+    if (syscall(SYS_mbind, hptr, size, MPOL_PREFERRED, nodeMask, sizeof(nodeMask)*8, 0) != 0) {
+      INFO(NCCL_ALLOC, "mbind of %s to NUMA node %d failed : %s", shmPath, numaId, strerror(errno));
+    } else {
+      INFO(NCCL_ALLOC, "Placed %s on NUMA node %d%s", shmPath, numaId, hugePages ? " with huge pages" : "");
+    }
+  }
+}
+
 ncclResult_t ncclShmOpen(char* shmPath, size_t shmSize, void** shmPtr, void** devShmPtr, int refcount, ncclShmHandle_t* handle) {
+  return ncclShmOpenNuma(shmPath, shmSize, shmPtr, devShmPtr, refcount, -1, 0, handle);
+}
+
+ncclResult_t ncclShmOpenNuma(char* shmPath, size_t shmSize, void** shmPtr, void** devShmPtr, int refcount, int numaId, int hugePages, ncclShmHandle_t* handle) {
   int fd = -1;
   char* hptr = NULL;
   void* dptr = NULL;
@@ -86,6 +111,9 @@ ncclResult_t ncclShmOpen(char* shmPath, size_t shmSize, void** shmPtr, void** de
   }
 
   if (create) {
+    // Segments live on tmpfs, whose pages can only be huge through transparent huge pages, so
+    // that is what RCCL_HOST_HUGEPAGE_SIZE gets them
+    shmPlace(shmPath, hptr, realShmSize, numaId, hugePages || ncclHugePageSize() != 0);
     *(int*)(hptr + shmSize) = refcount;
   } else {
     int remref = ncclAtomicRefCountDecrement((int*)(hptr + shmSize));
@@ -8,6 +8,7 @@
 #include "rocmwrap.h"
 #include "checks.h"
 #include "param.h"
+#include <algorithm>
 
 // Tracks the chain of graph nodes for a given graph captured identified by
 // its graph id. This state has to live for as long as captured work is being
@@ -26,10 +27,16 @@ struct ncclStrongStreamGraph {
   // maintain a dynamically sized array of tip nodes.
   int tipCount, tipCapacity;
   cudaGraphNode_t* tipNodes;
+  // With RCCL_GRAPH_COMPACT_CAPTURE, the one serialEvent record node of the graph
+  // and the tips it currently depends on. Each release moves it to the new tips.
+  cudaGraphNode_t recordNode;
+  int recordDepCount, recordDepCapacity;
+  cudaGraphNode_t* recordDeps;
 };
 
 static void ncclStrongStreamGraphDelete(struct ncclStrongStreamGraph* g) {
   free(g->tipNodes);
+  free(g->recordDeps);
   free(g);
 }
 
@@ -85,8 +92,8 @@ ncclResult_t ncclCudaGraphAddDestructor(struct ncclCudaGraph graph, cudaHostFn_t
 
 ////////////////////////////////////////////////////////////////////////////////
 
-ncclResult_t ncclStrongStreamConstruct(struct ncclStrongStream* ss) {
-  CUDACHECK(cudaStreamCreateWithFlags(&ss->cudaStream, cudaStreamNonBlocking));
+ncclResult_t ncclStrongStreamConstruct(struct ncclStrongStream* ss, int priority) {
+  CUDACHECK(cudaStreamCreateWithPriority(&ss->cudaStream, cudaStreamNonBlocking, priority));
   #if CUDART_VERSION >= 11030
     CUDACHECK(cudaEventCreateWithFlags(&ss->serialEvent, cudaEventDisableTiming));
     ss->everCaptured = false;
@@ -127,6 +134,11 @@ ncclResult_t ncclStrongStreamDestruct(struct ncclStrongStream* ss) {
 }
 
 NCCL_PARAM(GraphMixingSupport, "GRAPH_MIXING_SUPPORT", 1)
+// Graphs only need the serialEvent recorded once all of their work on a strong stream is
+// done, yet every release adds a record node to the chain, i.e. one per captured collective.
+// Compact capture keeps a single record node per graph and strong stream, hanging off the
+// tips, and moves it on each release, so the chain holds only the work nodes.
+RCCL_PARAM(GraphCompactCapture, "GRAPH_COMPACT_CAPTURE", 0);
 
 static void ensureTips(struct ncclStrongStreamGraph* g, int n) {
   if (g->tipCapacity < n) {
@@ -173,6 +185,10 @@ ncclResult_t ncclStrongStreamAcquire(
       g->tipNodes = nullptr;
       g->tipCapacity = 0;
       g->tipCount = 0;
+      g->recordNode = nullptr;
+      g->recordDeps = nullptr;
+      g->recordDepCapacity = 0;
+      g->recordDepCount = 0;
       g->next = ss->graphHead;
       ss->graphHead = g;
       g->alive = true;
@@ -218,6 +234,32 @@ static ncclResult_t checkGraphId(struct ncclStrongStreamGraph* g, unsigned long
   return ncclSuccess;
 }
 
+#if CUDART_VERSION >= 11030
+// Make the record node of the graph depend on the current tips instead of the previous ones,
+// which the current tips descend from. The tips are left as they are.
+static ncclResult_t moveRecordNode(struct ncclCudaGraph graph, struct ncclStrongStream* ss, struct ncclStrongStreamGraph* g) {
+  if (g->recordNode == nullptr) {
+    CUDACHECK(cudaGraphAddEventRecordNode(&g->recordNode, graph.graph, g->tipNodes, g->tipCount, ss->serialEvent));
+  } else {
+    int n = std::max(g->recordDepCount, g->tipCount);
+    cudaGraphNode_t* to = (cudaGraphNode_t*)malloc(n*sizeof(cudaGraphNode_t));
+    if (to == nullptr) return ncclSystemError;
+    for (int i=0; i < n; i++) to[i] = g->recordNode;
+    cudaError_t err = cudaGraphRemoveDependencies(graph.graph, g->recordDeps, to, g->recordDepCount);
+    if (err == cudaSuccess) err = cudaGraphAddDependencies(graph.graph, g->tipNodes, to, g->tipCount);
+    free(to);
+    CUDACHECK(err);
+  }
+  if (g->recordDepCapacity < g->tipCount) {
+    g->recordDeps = (cudaGraphNode_t*)realloc(g->recordDeps, g->tipCount*sizeof(cudaGraphNode_t));
+    g->recordDepCapacity = g->tipCount;
+  }
+  memcpy(g->recordDeps, g->tipNodes, g->tipCount*sizeof(cudaGraphNode_t));
+  g->recordDepCount = g->tipCount;
+  return ncclSuccess;
+}
+#endif
+
 ncclResult_t ncclStrongStreamRelease(struct ncclCudaGraph graph, struct ncclStrongStream* ss) {
   #if CUDART_VERSION >= 11030
     bool mixing = ncclParamGraphMixingSupport();
@@ -230,9 +272,13 @@ ncclResult_t ncclStrongStreamRelease(struct ncclCudaGraph graph, struct ncclStro
       } else {
         struct ncclStrongStreamGraph* g = ss->graphHead;
         NCCLCHECK(checkGraphId(g, graph.graphId));
-        ensureTips(g, 1);
-        CUDACHECK(cudaGraphAddEventRecordNode(&g->tipNodes[0], graph.graph, g->tipNodes, g->tipCount, ss->serialEvent));
-        g->tipCount = 1;
+        if (rcclParamGraphCompactCapture()) {
+          NCCLCHECK(moveRecordNode(graph, ss, g));
+        } else {
+          ensureTips(g, 1);
+          CUDACHECK(cudaGraphAddEventRecordNode(&g->tipNodes[0], graph.graph, g->tipNodes, g->tipCount, ss->serialEvent));
+          g->tipCount = 1;
+        }
         ss->serialEventNeedsRecord = false;
       }
     }
@@ -0,0 +1,96 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "core.h"
+#include "comm.h"
+#include "graph.h"
+#include "nccl_tuner.h"
+#include <dlfcn.h>
+#include <pthread.h>
+
+static pthread_mutex_t tunerPluginLock = PTHREAD_MUTEX_INITIALIZER;
+static int tunerPluginRefCount;
+static void* tunerPluginLib;
+static ncclTuner_t* tunerPlugin;
+
+// Loaded on first use and shared by all communicators, each getting its own context.
+static ncclTuner_t* tunerPluginOpen() {
+  if (tunerPluginRefCount > 0) {
+    tunerPluginRefCount++;
+    return tunerPlugin;
+  }
+  char tunerPluginName[128];
+  const char* envPluginName = getenv("NCCL_TUNER_PLUGIN");
+  if (envPluginName && strlen(envPluginName)) {
+    snprintf(tunerPluginName, 128, "librccl-tuner-%s.so", envPluginName);
+    INFO(NCCL_INIT|NCCL_TUNING, "TUNER/Plugin : Plugin name set by env to %s", tunerPluginName);
+  } else {
+    sprintf(tunerPluginName, "librccl-tuner.so");
+  }
+  tunerPluginLib = dlopen(tunerPluginName, RTLD_NOW | RTLD_LOCAL);
+  if (tunerPluginLib == nullptr) {
+    INFO(NCCL_INIT|NCCL_TUNING, "TUNER/Plugin : Plugin load (%s) returned %d : %s", tunerPluginName, errno, dlerror());
+    INFO(NCCL_INIT|NCCL_TUNING, "TUNER/Plugin : No plugin found, using internal tuning model");
+    return nullptr;
+  }
+  tunerPlugin = (ncclTuner_t*)dlsym(tunerPluginLib, NCCL_TUNER_PLUGIN_SYMBOL);
+  if (tunerPlugin == nullptr) {
+    INFO(NCCL_INIT|NCCL_TUNING, "TUNER/Plugin : Failed to find " NCCL_TUNER_PLUGIN_SYMBOL " symbol, using internal tuning model");
+    dlclose(tunerPluginLib);
+    tunerPluginLib = nullptr;
+    return nullptr;
+  }
+  INFO(NCCL_INIT|NCCL_TUNING, "TUNER/Plugin : Loaded tuner plugin %s", tunerPlugin->name);
+  tunerPluginRefCount = 1;
+  return tunerPlugin;
+}
+
+static void tunerPluginClose() {
+  if (--tunerPluginRefCount > 0) return;
+  if (tunerPluginLib) dlclose(tunerPluginLib);
+  tunerPluginLib = nullptr;
+  tunerPlugin = nullptr;
+}
+
+ncclResult_t ncclTunerPluginLoad(struct ncclComm* comm, struct ncclTopoGraph* ringGraph) {
+  pthread_mutex_lock(&tunerPluginLock);
+  ncclTuner_t* plugin = tunerPluginOpen();
+  pthread_mutex_unlock(&tunerPluginLock);
+  if (plugin == nullptr) return ncclSuccess;
+
+  ncclTunerTopo_t topo;
+  topo.nRanks = comm->nRanks;
+  topo.nNodes = comm->nNodes;
+  topo.localRanks = comm->localRanks;
+  topo.nChannels = comm->nChannels;
+  topo.cudaArch = comm->cudaArch;
+  topo.bwIntra = ringGraph->bwIntra;
+  topo.bwInter = ringGraph->bwInter;
+  topo.typeIntra = ringGraph->typeIntra;
+  topo.typeInter = ringGraph->typeInter;
+  void* context = nullptr;
+  if (plugin->init(&topo, ncclDebugLog, &context) != ncclSuccess) {
+    WARN("TUNER/Plugin : %s failed to initialize, using internal tuning model", plugin->name);
+    pthread_mutex_lock(&tunerPluginLock);
+    tunerPluginClose();
+    pthread_mutex_unlock(&tunerPluginLock);
+    return ncclSuccess;
+  }
+  comm->tunerPlugin = plugin;
+  comm->tunerPluginContext = context;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTunerPluginUnload(struct ncclComm* comm) {
+  if (comm->tunerPlugin == nullptr) return ncclSuccess;
+  comm->tunerPlugin->destroy(comm->tunerPluginContext);
+  comm->tunerPlugin = nullptr;
+  comm->tunerPluginContext = nullptr;
+  pthread_mutex_lock(&tunerPluginLock);
+  tunerPluginClose();
+  pthread_mutex_unlock(&tunerPluginLock);
+  return ncclSuccess;
+}
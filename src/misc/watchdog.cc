@@ -0,0 +1,373 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "watchdog.h"
+#include "comm.h"
+#include "bootstrap.h"
+#include "socket.h"
+#include "param.h"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+/* Cross-rank progress watchdog.
+ *
+ * Enabled with RCCL_WATCHDOG_INTERVAL_MS > 0. Each rank runs a thread that
+ * every interval summarizes the progress of its kernel plans:
+ *   launched  plans uploaded to the work fifo,
+ *   completed plans whose fifo entries all channels acknowledged,
+ *   per channel, whether work is pending and whether its acknowledgments
+ *   stopped advancing for RCCL_WATCHDOG_TIMEOUT_MS.
+ * Summaries go to rank 0 over dedicated sockets connected at init, so the
+ * exchange never contends with the bootstrap ring and a hung rank cannot block
+ * the others. Rank 0 keeps per-rank histograms of how many plans each rank
+ * completed behind the most advanced one, and when a channel stalls or a rank
+ * goes silent for the timeout it reports the ranks that launched fewer plans
+ * (usually the ones that did not call the collective yet), the stalled
+ * channels and their ring neighbors. Plans of captured graphs do not use the
+ * work fifo and are not tracked. */
+RCCL_PARAM(WatchdogIntervalMs, "WATCHDOG_INTERVAL_MS", 0);
+RCCL_PARAM(WatchdogTimeoutMs, "WATCHDOG_TIMEOUT_MS", 10000);
+
+static_assert(MAXCHANNELS <= 64, "Watchdog channel masks are 64 bits");
+
+#define NCCL_WATCHDOG_PLANS 64 // Launched plans remembered, power of 2
+#define NCCL_WATCHDOG_LAG_BUCKETS 16 // Lag histogram buckets: 0, 1, 2-3, 4-7, ...
+
+struct ncclWatchdogPlan {
+  uint64_t channelMask;
+  uint32_t acks[MAXCHANNELS];
+};
+
+struct ncclWatchdogSummary {
+  int32_t rank;
+  uint32_t stallMs; // Longest time a channel with pending work did not advance
+  uint64_t launched;
+  uint64_t completed;
+  uint64_t pendingMask;
+  uint64_t stalledMask;
+};
+
+struct ncclWatchdogPeer {
+  struct ncclSocket sock;
+  int rank;
+  int closed;
+  int offset;
+  struct ncclWatchdogSummary recvBuf;
+};
+
+struct ncclWatchdog {
+  struct ncclComm* comm;
+  pthread_t thread;
+  int stop;
+  uint64_t intervalMs;
+  uint64_t timeoutMs;
+
+  // Written by the launching thread, launched is published after the plan
+  struct ncclWatchdogPlan plans[NCCL_WATCHDOG_PLANS];
+  uint64_t launched;
+
+  // Watchdog thread
+  uint32_t lastDone[MAXCHANNELS];
+  uint64_t lastDoneNs[MAXCHANNELS];
+
+  // Rank != 0
+  struct ncclSocket sock;
+  int sendOffset;
+  int sendFailed;
+  struct ncclWatchdogSummary sendBuf;
+
+  // Rank 0, indexed by rank
+  struct ncclSocket listenSock;
+  struct ncclWatchdogPeer* peers; // [nRanks-1], in accept order
+  struct ncclWatchdogSummary* summaries;
+  uint64_t* summaryNs;
+  uint64_t* lagHist; // [nRanks][NCCL_WATCHDOG_LAG_BUCKETS]
+  uint64_t reportedCompleted; // maxCompleted when the last stall was reported, ~0 if none
+};
+
+static inline bool rollingLess32(uint32_t a, uint32_t b) {
+  constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
+  return a-b > PositiveMax;
+}
+
+void ncclWatchdogLaunch(struct ncclComm* comm, struct ncclKernelPlan* plan) {
+  struct ncclWatchdog* wd = comm->watchdog;
+  uint64_t n = wd->launched;
+  struct ncclWatchdogPlan* p = wd->plans + (n & (NCCL_WATCHDOG_PLANS-1));
+  uint64_t mask = plan->channelMask;
+  for (uint64_t m = mask; m; m &= m-1) {
+    int c = __builtin_ctzll(m);
+    __atomic_store_n(p->acks+c, comm->channels[c].workFifoSent, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&p->channelMask, mask, __ATOMIC_RELAXED);
+  __atomic_store_n(&wd->launched, n+1, __ATOMIC_RELEASE);
+}
+
+// Plans may be overwritten while we read them, which at worst misplaces the
+// completed count by a plan or two for one interval.
+static void watchdogSummarize(struct ncclWatchdog* wd, struct ncclWatchdogSummary* s) {
+  struct ncclComm* comm = wd->comm;
+  uint64_t now = clockNano();
+  uint32_t done[MAXCHANNELS];
+  uint64_t quiesced = 0;
+  memset(s, 0, sizeof(*s));
+  s->rank = comm->rank;
+  for (int c=0; c<MAXCHANNELS; c++) {
+    done[c] = __atomic_load_n(comm->workFifoDone+c, __ATOMIC_RELAXED);
+    uint32_t sent = __atomic_load_n(&comm->channels[c].workFifoSent, __ATOMIC_RELAXED);
+    if (done[c] == sent) {
+      quiesced |= 1ULL << c;
+      wd->lastDoneNs[c] = 0;
+      continue;
+    }
+    s->pendingMask |= 1ULL << c;
+    if (wd->lastDoneNs[c] == 0 || done[c] != wd->lastDone[c]) {
+      wd->lastDone[c] = done[c];
+      wd->lastDoneNs[c] = now;
+    }
+    uint64_t stallMs = (now - wd->lastDoneNs[c])/1000000;
+    if (stallMs > s->stallMs) s->stallMs = stallMs;
+    if (stallMs >= wd->timeoutMs) s->stalledMask |= 1ULL << c;
+  }
+
+  uint64_t launched = __atomic_load_n(&wd->launched, __ATOMIC_ACQUIRE);
+  uint64_t oldest = launched > NCCL_WATCHDOG_PLANS ? launched-NCCL_WATCHDOG_PLANS : 0;
+  s->launched = launched;
+  s->completed = oldest;
+  for (uint64_t i=launched; i>oldest; i--) {
+    struct ncclWatchdogPlan* p = wd->plans + ((i-1) & (NCCL_WATCHDOG_PLANS-1));
+    uint64_t mask = __atomic_load_n(&p->channelMask, __ATOMIC_RELAXED);
+    bool complete = true;
+    for (uint64_t m = mask & ~quiesced; m; m &= m-1) {
+      int c = __builtin_ctzll(m);
+      if (rollingLess32(done[c], __atomic_load_n(p->acks+c, __ATOMIC_RELAXED))) { complete = false; break; }
+    }
+    if (complete) { s->completed = i; break; }
+  }
+}
+
+static inline int watchdogLagBucket(uint64_t lag) {
+  int b = lag == 0 ? 0 : 64 - __builtin_clzll(lag);
+  return std::min(b, NCCL_WATCHDOG_LAG_BUCKETS-1);
+}
+
+static std::string watchdogLagString(const uint64_t* hist) {
+  std::string str;
+  char buf[64];
+  for (int b=0; b<NCCL_WATCHDOG_LAG_BUCKETS; b++) {
+    if (hist[b] == 0) continue;
+    if (b == 0) snprintf(buf, sizeof(buf), " 0:%lu", hist[b]);
+    else if (b == NCCL_WATCHDOG_LAG_BUCKETS-1) snprintf(buf, sizeof(buf), " %lu+:%lu", 1UL<<(b-1), hist[b]);
+    else snprintf(buf, sizeof(buf), " %lu-%lu:%lu", 1UL<<(b-1), (1UL<<b)-1, hist[b]);
+    str += buf;
+  }
+  return str;
+}
+
+static void watchdogRingPeers(struct ncclComm* comm, int c, int rank, int* prev, int* next) {
+  *prev = *next = -1;
+  if (c >= comm->nChannels || comm->channels[c].ring.userRanks == NULL) return;
+  int* userRanks = comm->channels[c].ring.userRanks;
+  for (int i=0; i<comm->nRanks; i++) {
+    if (userRanks[i] != rank) continue;
+    *prev = userRanks[(i+comm->nRanks-1)%comm->nRanks];
+    *next = userRanks[(i+1)%comm->nRanks];
+    return;
+  }
+}
+
+static void watchdogReport(struct ncclWatchdog* wd, uint64_t now, uint64_t maxLaunched, uint64_t maxCompleted) {
+  struct ncclComm* comm = wd->comm;
+  WARN("Watchdog: comm %p commHash %lx nRanks %d stalled, plans launched %lu, completed %lu",
+      comm, comm->commHash, comm->nRanks, maxLaunched, maxCompleted);
+  for (int r=0; r<comm->nRanks; r++) {
+    struct ncclWatchdogSummary* s = wd->summaries+r;
+    if (wd->summaryNs[r] == 0) continue;
+    uint64_t silentMs = (now - wd->summaryNs[r])/1000000;
+    if (silentMs >= wd->timeoutMs) {
+      WARN("Watchdog:   rank %d silent for %lu ms, last launched %lu completed %lu", r, silentMs, s->launched, s->completed);
+    } else if (s->launched < maxLaunched) {
+      WARN("Watchdog:   rank %d lagging, launched %lu of %lu plans", r, s->launched, maxLaunched);
+    }
+    for (uint64_t m = s->stalledMask; m; m &= m-1) {
+      int c = __builtin_ctzll(m), prev, next;
+      watchdogRingPeers(comm, c, r, &prev, &next);
+      WARN("Watchdog:   rank %d channel %d stalled %u ms at completed %lu, ring prev %d next %d",
+          r, c, s->stallMs, s->completed, prev, next);
+    }
+  }
+  for (int r=0; r<comm->nRanks; r++) {
+    const uint64_t* hist = wd->lagHist+r*NCCL_WATCHDOG_LAG_BUCKETS;
+    uint64_t lagged = 0;
+    for (int b=1; b<NCCL_WATCHDOG_LAG_BUCKETS; b++) lagged += hist[b];
+    if (lagged) WARN("Watchdog:   rank %d completed-plan lag histogram%s", r, watchdogLagString(hist).c_str());
+  }
+}
+
+// Rank 0: drains the summaries received since the last call and analyzes them
+static void watchdogMonitor(struct ncclWatchdog* wd) {
+  struct ncclComm* comm = wd->comm;
+  uint64_t now = clockNano();
+  watchdogSummarize(wd, wd->summaries);
+  wd->summaryNs[0] = now;
+  for (int i=0; i<comm->nRanks-1; i++) {
+    struct ncclWatchdogPeer* peer = wd->peers+i;
+    if (peer->closed) continue;
+    int fd;
+    if (ncclSocketGetFd(&peer->sock, &fd) != ncclSuccess) continue;
+    while (1) {
+      ssize_t bytes = recv(fd, (char*)&peer->recvBuf + peer->offset, sizeof(peer->recvBuf) - peer->offset, MSG_DONTWAIT);
+      if (bytes == 0 || (bytes < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        // Peer communicator destroyed, stop tracking it
+        peer->closed = 1;
+        wd->summaryNs[peer->rank] = 0;
+        break;
+      }
+      if (bytes < 0) break;
+      peer->offset += bytes;
+      if (peer->offset == sizeof(peer->recvBuf)) {
+        wd->summaries[peer->rank] = peer->recvBuf;
+        wd->summaryNs[peer->rank] = now;
+        peer->offset = 0;
+      }
+    }
+  }
+
+  uint64_t maxLaunched = 0, maxCompleted = 0;
+  for (int r=0; r<comm->nRanks; r++) {
+    if (wd->summaryNs[r] == 0) continue;
+    maxLaunched = std::max(maxLaunched, wd->summaries[r].launched);
+    maxCompleted = std::max(maxCompleted, wd->summaries[r].completed);
+  }
+  bool stalled = false;
+  for (int r=0; r<comm->nRanks; r++) {
+    if (wd->summaryNs[r] == 0) continue;
+    struct ncclWatchdogSummary* s = wd->summaries+r;
+    wd->lagHist[r*NCCL_WATCHDOG_LAG_BUCKETS + watchdogLagBucket(maxCompleted - s->completed)]++;
+    if (s->stalledMask || (now - wd->summaryNs[r])/1000000 >= wd->timeoutMs) stalled = true;
+  }
+  if (stalled && wd->reportedCompleted != maxCompleted) {
+    watchdogReport(wd, now, maxLaunched, maxCompleted);
+    wd->reportedCompleted = maxCompleted;
+  } else if (!stalled) {
+    wd->reportedCompleted = ~0ULL;
+  }
+}
+
+// Rank != 0: sends the current summary unless the previous one is still in flight
+static void watchdogSend(struct ncclWatchdog* wd) {
+  int fd;
+  if (wd->sendFailed || ncclSocketGetFd(&wd->sock, &fd) != ncclSuccess) return;
+  if (wd->sendOffset == 0) watchdogSummarize(wd, &wd->sendBuf);
+  ssize_t bytes = send(fd, (char*)&wd->sendBuf + wd->sendOffset, sizeof(wd->sendBuf) - wd->sendOffset, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (bytes < 0) {
+    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return;
+    INFO(NCCL_INIT, "Watchdog: rank %d lost rank 0 : %s", wd->comm->rank, strerror(errno));
+    wd->sendFailed = 1;
+    return;
+  }
+  wd->sendOffset = (wd->sendOffset + bytes) % sizeof(wd->sendBuf);
+}
+
+static void* watchdogThread(void* arg) {
+  struct ncclWatchdog* wd = (struct ncclWatchdog*)arg;
+  uint64_t next = clockNano() + wd->intervalMs*1000000;
+  while (!__atomic_load_n(&wd->stop, __ATOMIC_ACQUIRE)) {
+    if (clockNano() < next) {
+      usleep(std::min<uint64_t>(wd->intervalMs*1000, 10000));
+      continue;
+    }
+    next += wd->intervalMs*1000000;
+    if (wd->comm->rank == 0) watchdogMonitor(wd);
+    else watchdogSend(wd);
+  }
+  return NULL;
+}
+
+ncclResult_t ncclWatchdogInit(struct ncclComm* comm) {
+  ncclResult_t ret = ncclSuccess;
+  union ncclSocketAddress* addrs = NULL;
+  struct ncclWatchdog* wd = NULL;
+  int64_t intervalMs = rcclParamWatchdogIntervalMs();
+  if (intervalMs <= 0 || comm->nRanks == 1) return ncclSuccess;
+
+  NCCLCHECKGOTO(ncclCalloc(&wd, 1), ret, fail);
+  wd->comm = comm;
+  wd->intervalMs = intervalMs;
+  wd->timeoutMs = std::max<int64_t>(rcclParamWatchdogTimeoutMs(), intervalMs);
+  wd->reportedCompleted = ~0ULL;
+  NCCLCHECKGOTO(ncclCalloc(&addrs, comm->nRanks), ret, fail);
+  if (comm->rank == 0) {
+    NCCLCHECKGOTO(bootstrapGetNetIfAddr(addrs), ret, fail);
+    NCCLCHECKGOTO(ncclSocketInit(&wd->listenSock, addrs, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag), ret, fail);
+    NCCLCHECKGOTO(ncclSocketListen(&wd->listenSock), ret, fail);
+    NCCLCHECKGOTO(ncclSocketGetAddr(&wd->listenSock, addrs), ret, fail);
+  }
+  NCCLCHECKGOTO(bootstrapAllGather(comm->bootstrap, addrs, sizeof(union ncclSocketAddress)), ret, fail);
+  if (comm->rank == 0) {
+    NCCLCHECKGOTO(ncclCalloc(&wd->peers, comm->nRanks-1), ret, fail);
+    NCCLCHECKGOTO(ncclCalloc(&wd->summaries, comm->nRanks), ret, fail);
+    NCCLCHECKGOTO(ncclCalloc(&wd->summaryNs, comm->nRanks), ret, fail);
+    NCCLCHECKGOTO(ncclCalloc(&wd->lagHist, comm->nRanks*NCCL_WATCHDOG_LAG_BUCKETS), ret, fail);
+    for (int i=0; i<comm->nRanks-1; i++) {
+      struct ncclWatchdogPeer* peer = wd->peers+i;
+      NCCLCHECKGOTO(ncclSocketInit(&peer->sock), ret, fail);
+      NCCLCHECKGOTO(ncclSocketAccept(&peer->sock, &wd->listenSock), ret, fail);
+      NCCLCHECKGOTO(ncclSocketRecv(&peer->sock, &peer->rank, sizeof(int)), ret, fail);
+    }
+    // Ranks that never report are silent from now on
+    for (int r=0; r<comm->nRanks; r++) wd->summaryNs[r] = clockNano();
+  } else {
+    NCCLCHECKGOTO(ncclSocketInit(&wd->sock, addrs, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag), ret, fail);
+    NCCLCHECKGOTO(ncclSocketConnect(&wd->sock), ret, fail);
+    NCCLCHECKGOTO(ncclSocketSend(&wd->sock, &comm->rank, sizeof(int)), ret, fail);
+  }
+  comm->watchdog = wd;
+  pthread_create(&wd->thread, NULL, watchdogThread, wd);
+  ncclSetThreadName(wd->thread, "NCCL Watchdog%2d", comm->cudaDev);
+  INFO(NCCL_INIT, "Watchdog: every %lu ms, stall timeout %lu ms", wd->intervalMs, wd->timeoutMs);
+exit:
+  free(addrs);
+  return ret;
+fail:
+  if (wd) {
+    free(wd->peers);
+    free(wd->summaries);
+    free(wd->summaryNs);
+    free(wd->lagHist);
+    free(wd);
+  }
+  goto exit;
+}
+
+ncclResult_t ncclWatchdogDestroy(struct ncclComm* comm) {
+  struct ncclWatchdog* wd = comm->watchdog;
+  if (wd == NULL) return ncclSuccess;
+  __atomic_store_n(&wd->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(wd->thread, NULL);
+  if (comm->rank == 0) {
+    for (int r=0; r<comm->nRanks; r++) {
+      std::string lag = watchdogLagString(wd->lagHist+r*NCCL_WATCHDOG_LAG_BUCKETS);
+      if (!lag.empty()) INFO(NCCL_INIT, "Watchdog: rank %d completed-plan lag histogram%s", r, lag.c_str());
+    }
+    for (int i=0; i<comm->nRanks-1; i++) NCCLCHECK(ncclSocketClose(&wd->peers[i].sock));
+    NCCLCHECK(ncclSocketClose(&wd->listenSock));
+    free(wd->peers);
+    free(wd->summaries);
+    free(wd->summaryNs);
+    free(wd->lagHist);
+  } else {
+    NCCLCHECK(ncclSocketClose(&wd->sock));
+  }
+  free(wd);
+  comm->watchdog = NULL;
+  return ncclSuccess;
+}
@@ -14,8 +14,11 @@
 #include "profiler.h"
 #define ENABLE_TIMER 0
 #include "timer.h"
+#include "cpuset.h"
 
 #include <sys/syscall.h>
+#include <linux/futex.h>
+#include <algorithm>
 #include <assert.h>
 
 static bool NeedProxy(int type, int pattern, int root, struct ncclRing* ring, int nranks) {
@@ -38,107 +41,153 @@ struct ncclProxyPool {
   struct ncclProxyArgs elems[PROXYARGS_ALLOCATE_SIZE];
 };
 
-static void expectedProxyResponseFree(struct ncclProxyState* state) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  struct ncclExpectedProxyResponse* prev = NULL;
+#define NCCL_PROXY_RESP_TABLE_INIT 64
 
-  while (elem) {
-    prev = elem;
-    elem = elem->next;
-    free(prev->respBuff);
-    free(prev);
-  }
+static inline uint32_t expectedProxyResponseHash(void* opId, int size) {
+  return (uint32_t)(((uint64_t)opId * 0x9E3779B97F4A7C15ULL) >> 32) & (size-1);
 }
 
-static ncclResult_t expectedProxyResponseStore(struct ncclProxyState* state, void* opId, void* respBuff, int respSize) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  while (elem) {
-    if (elem->opId == opId) {
-      if (respSize != elem->respSize) {
-        WARN("Mismatched response size for opId=%p", opId);
-        return ncclInternalError;
-      }
+// Return the slot holding opId, or the empty slot where it would go.
+static struct ncclExpectedProxyResponse* expectedProxyResponseSlot(struct ncclExpectedProxyResponses* resps, void* opId) {
+  uint32_t i = expectedProxyResponseHash(opId, resps->size);
+  while (resps->table[i].opId != NULL && resps->table[i].opId != opId) i = (i+1) & (resps->size-1);
+  return resps->table+i;
+}
 
-      if (elem->done) {
-        WARN("Storing response for already completed opId=%p", opId);
-        return ncclInternalError;
-      }
+static struct ncclExpectedProxyResponse* expectedProxyResponseFind(struct ncclProxyState* state, void* opId) {
+  struct ncclExpectedProxyResponses* resps = &state->expectedResponses;
+  if (resps->count == 0) return NULL;
+  struct ncclExpectedProxyResponse* elem = expectedProxyResponseSlot(resps, opId);
+  return elem->opId ? elem : NULL;
+}
 
-      memcpy(elem->respBuff, respBuff, respSize);
-      free(respBuff);
-      elem->done = true;
+static void expectedProxyResponseFreeBuff(struct ncclExpectedProxyResponses* resps, void* buff, int cap) {
+  if (resps->nFreeBuffs == NCCL_PROXY_RESP_FREE_BUFFS) {
+    free(buff);
+    return;
+  }
+  resps->freeBuffs[resps->nFreeBuffs] = buff;
+  resps->freeCaps[resps->nFreeBuffs] = cap;
+  resps->nFreeBuffs++;
+}
+
+static ncclResult_t expectedProxyResponseAllocBuff(struct ncclExpectedProxyResponses* resps, int size, void** buff, int* cap) {
+  for (int b = resps->nFreeBuffs-1; b >= 0; b--) {
+    if (resps->freeCaps[b] >= size) {
+      *buff = resps->freeBuffs[b];
+      *cap = resps->freeCaps[b];
+      resps->nFreeBuffs--;
+      resps->freeBuffs[b] = resps->freeBuffs[resps->nFreeBuffs];
+      resps->freeCaps[b] = resps->freeCaps[resps->nFreeBuffs];
       return ncclSuccess;
     }
-    elem = elem->next;
   }
+  *cap = std::max(size, 64);
+  NCCLCHECK(ncclCalloc((char**)buff, *cap));
+  return ncclSuccess;
+}
 
-  WARN("Proxy response for opId=%p doesn't match any expected response", opId);
-  return ncclInternalError;
+// Remove a slot, shifting back the following entries of its probe sequence.
+static void expectedProxyResponseErase(struct ncclExpectedProxyResponses* resps, struct ncclExpectedProxyResponse* elem) {
+  expectedProxyResponseFreeBuff(resps, elem->respBuff, elem->respCap);
+  uint32_t mask = resps->size-1;
+  uint32_t i = elem - resps->table;
+  uint32_t j = i;
+  while (true) {
+    j = (j+1) & mask;
+    if (resps->table[j].opId == NULL) break;
+    uint32_t home = expectedProxyResponseHash(resps->table[j].opId, resps->size);
+    // Move entry j to i unless its home lies cyclically in (i, j]
+    if (((j-home) & mask) >= ((j-i) & mask)) {
+      resps->table[i] = resps->table[j];
+      i = j;
+    }
+  }
+  resps->table[i].opId = NULL;
+  resps->count--;
+}
+
+static ncclResult_t expectedProxyResponseGrow(struct ncclExpectedProxyResponses* resps) {
+  struct ncclExpectedProxyResponse* old = resps->table;
+  int oldSize = resps->size;
+  resps->size = oldSize ? oldSize*2 : NCCL_PROXY_RESP_TABLE_INIT;
+  NCCLCHECK(ncclCalloc(&resps->table, resps->size));
+  for (int i = 0; i < oldSize; i++) {
+    if (old[i].opId) *expectedProxyResponseSlot(resps, old[i].opId) = old[i];
+  }
+  free(old);
+  return ncclSuccess;
+}
+
+static void expectedProxyResponseFree(struct ncclProxyState* state) {
+  struct ncclExpectedProxyResponses* resps = &state->expectedResponses;
+  for (int i = 0; i < resps->size; i++) {
+    if (resps->table[i].opId) free(resps->table[i].respBuff);
+  }
+  for (int b = 0; b < resps->nFreeBuffs; b++) free(resps->freeBuffs[b]);
+  free(resps->table);
+  memset(resps, 0, sizeof(*resps));
+}
+
+static ncclResult_t expectedProxyResponseStore(struct ncclProxyState* state, void* opId, void* respBuff, int respSize) {
+  struct ncclExpectedProxyResponse* elem = expectedProxyResponseFind(state, opId);
+  if (elem == NULL) {
+    WARN("Proxy response for opId=%p doesn't match any expected response", opId);
+    return ncclInternalError;
+  }
+  if (respSize != elem->respSize) {
+    WARN("Mismatched response size for opId=%p", opId);
+    return ncclInternalError;
+  }
+
+  if (elem->done) {
+    WARN("Storing response for already completed opId=%p", opId);
+    return ncclInternalError;
+  }
+
+  if (respBuff != elem->respBuff) memcpy(elem->respBuff, respBuff, respSize);
+  elem->done = true;
+  return ncclSuccess;
 }
 
 static ncclResult_t expectedProxyResponseEnqueue(struct ncclProxyState* state, void* opId, int respSize) {
-  struct ncclExpectedProxyResponse* ex;
-  NCCLCHECK(ncclCalloc(&ex, 1));
+  struct ncclExpectedProxyResponses* resps = &state->expectedResponses;
+  // Keep the load factor under 1/2
+  if (2*(resps->count+1) > resps->size) NCCLCHECK(expectedProxyResponseGrow(resps));
+  struct ncclExpectedProxyResponse* ex = expectedProxyResponseSlot(resps, opId);
+  if (ex->opId) {
+    WARN("Proxy call with opId=%p is already outstanding", opId);
+    return ncclInternalError;
+  }
   ex->opId = opId;
 
   // Pre-alloc response buffer
-  ex->respBuff = malloc(respSize);
+  NCCLCHECK(expectedProxyResponseAllocBuff(resps, respSize, &ex->respBuff, &ex->respCap));
   ex->respSize = respSize;
   ex->done     = false;
-
-  // Enqueue
-  struct ncclExpectedProxyResponse* list = state->expectedResponses;
-  if (list == NULL) {
-    state->expectedResponses = ex;
-    return ncclSuccess;
-  }
-  while (list->next) list = list->next;
-  list->next = ex;
+  resps->count++;
   return ncclSuccess;
 }
 
 static ncclResult_t expectedProxyResponseDequeue(struct ncclProxyState* state, void* opId, void* respBuff, int* found) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  struct ncclExpectedProxyResponse* prev = NULL;
+  struct ncclExpectedProxyResponse* elem = expectedProxyResponseFind(state, opId);
   *found = 0;
-  while (elem) {
-    if ((elem->opId == opId) && elem->done) {
-      if (prev == NULL) {
-        state->expectedResponses = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      memcpy(respBuff, elem->respBuff, elem->respSize);
-      free(elem->respBuff);
-      free(elem);
-      *found = 1;
-      return ncclSuccess;
-    }
-    prev = elem;
-    elem = elem->next;
+  if (elem && elem->done) {
+    memcpy(respBuff, elem->respBuff, elem->respSize);
+    expectedProxyResponseErase(&state->expectedResponses, elem);
+    *found = 1;
   }
   return ncclSuccess;
 }
 
 static ncclResult_t expectedProxyResponseRemove(struct ncclProxyState* state, void* opId) {
-  struct ncclExpectedProxyResponse* elem = state->expectedResponses;
-  struct ncclExpectedProxyResponse* prev = NULL;
-  while (elem) {
-    if (elem->opId == opId) {
-      if (prev == NULL) {
-        state->expectedResponses = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      free(elem->respBuff);
-      free(elem);
-      return ncclSuccess;
-    }
-    prev = elem;
-    elem = elem->next;
+  struct ncclExpectedProxyResponse* elem = expectedProxyResponseFind(state, opId);
+  if (elem == NULL) {
+    WARN("Couldn't find opId=%p", opId);
+    return ncclInternalError;
   }
-  WARN("Couldn't find opId=%p", opId);
-  return ncclInternalError;
+  expectedProxyResponseErase(&state->expectedResponses, elem);
+  return ncclSuccess;
 }
 
 static ncclResult_t asyncProxyOpEnqueue(struct ncclProxyLocalPeer* peer, ncclProxyAsyncOp* op) {
@@ -354,7 +403,11 @@ static ncclResult_t ncclProxyOpToArgs(struct ncclProxyOp* op, struct ncclProxyAr
   sub->channelId = op->channelId;
   sub->nsteps = op->nsteps;
   sub->nbytes = op->nbytes;
-  sub->peer = op->root;
+  sub->peer = op->peer;
+  sub->reg = op->reg;
+  sub->regChunkSize = op->chunkSize;
+  sub->regBuff = op->regBuff;
+  sub->regMhandle = NULL;
   args->nsubs = subIndex+1;
   if (subIndex) {
     if ((args->sliceSteps != op->sliceSteps) ||
@@ -381,6 +434,7 @@ static ncclResult_t ncclProxyOpToArgs(struct ncclProxyOp* op, struct ncclProxyAr
   args->redOp = op->redOp;
   args->pattern = op->pattern;
   args->protocol = op->protocol;
+  args->priority = op->priority;
   args->state = ncclProxyOpReady;
   args->progress = op->connection->tcomm->proxyProgress;
   args->proxyAppendPtr = op->connection->proxyAppendPtr;
@@ -412,6 +466,11 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
       // Create the list
       DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld) as first element\n", OP_INDEX(args), shared, args->opCount);
       state->active = args;
+    } else if (args->priority > 0) {
+      // High priority comms are progressed first
+      args->next = state->active;
+      state->active = args;
+      DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld) as first element\n", OP_INDEX(args), shared, args->opCount);
     } else {
       // Append element at the end of the list
       struct ncclProxyArgs* last = state->active;
@@ -424,19 +483,85 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
   return ncclSuccess;
 }
 
+static void proxyPostWake(struct ncclProxyOpsPool* pool) {
+  __atomic_fetch_add(&pool->wakeSeq, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, &pool->wakeSeq, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Publish the op chain nextOps..nextOpsEnd to the progress thread.
 ncclResult_t ncclProxyPost(struct ncclProxyOpsPool* pool, int nextOps, int nextOpsEnd) {
-  pthread_mutex_lock(&pool->mutex);
-  if (pool->nextOps == -1) {
-    pool->nextOps = nextOps;
-    pthread_cond_signal(&pool->cond);
-  } else {
-    pool->ops[pool->nextOpsEnd].next = nextOps;
-  }
-  pool->nextOpsEnd = nextOpsEnd;
-  pthread_mutex_unlock(&pool->mutex);
+  uint64_t slot = __atomic_fetch_add(&pool->postHead, 1, __ATOMIC_RELAXED);
+  struct ncclProxyPostEntry* post = pool->posts + slot % NCCL_PROXY_POST_RING_SIZE;
+  // The ring is sized for every op to be posted alone, this never spins.
+  while (__atomic_load_n(&post->seq, __ATOMIC_ACQUIRE) != slot) sched_yield();
+  post->first = nextOps;
+  post->last = nextOpsEnd;
+  __atomic_store_n(&post->seq, slot+1, __ATOMIC_RELEASE);
+  // Pairs with the fence in proxyPostWait(): either we see the progress
+  // thread sleeping or it sees our entry.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->sleeping, __ATOMIC_RELAXED)) proxyPostWake(pool);
   return ncclSuccess;
 }
 
+// Consume all ready chains at once and append them to state->nextOps.
+static void proxyPostDrain(struct ncclProxyOpsPool* pool, struct ncclProxyProgressState* state) {
+  uint64_t tail = pool->postTail;
+  while (true) {
+    struct ncclProxyPostEntry* post = pool->posts + tail % NCCL_PROXY_POST_RING_SIZE;
+    if (__atomic_load_n(&post->seq, __ATOMIC_ACQUIRE) != tail+1) break;
+    if (state->nextOps == -1) {
+      state->nextOps = post->first;
+    } else {
+      pool->ops[state->nextOpsEnd].next = post->first;
+    }
+    state->nextOpsEnd = post->last;
+    __atomic_store_n(&post->seq, tail+NCCL_PROXY_POST_RING_SIZE, __ATOMIC_RELEASE);
+    tail++;
+  }
+  pool->postTail = tail;
+}
+
+static bool proxyPostEmpty(struct ncclProxyOpsPool* pool) {
+  struct ncclProxyPostEntry* post = pool->posts + pool->postTail % NCCL_PROXY_POST_RING_SIZE;
+  return __atomic_load_n(&post->seq, __ATOMIC_ACQUIRE) != pool->postTail+1;
+}
+
+RCCL_PARAM(ProxyIdleSpinUs, "PROXY_IDLE_SPIN_US", 50);
+RCCL_PARAM(ProxyIdleYieldUs, "PROXY_IDLE_YIELD_US", 2000);
+
+// Wait until a chain is posted or we are asked to stop. Busy poll the ring for
+// RCCL_PROXY_IDLE_SPIN_US, then poll it between sched_yield() calls for
+// RCCL_PROXY_IDLE_YIELD_US, then sleep on the futex until a producer wakes us.
+static void proxyPostWait(struct ncclProxyOpsPool* pool, struct ncclProxyProgressState* state) {
+  const uint64_t spinNs = std::max(0L, (long)rcclParamProxyIdleSpinUs())*1000;
+  const uint64_t pollNs = spinNs + std::max(0L, (long)rcclParamProxyIdleYieldUs())*1000;
+  uint64_t start = clockNano(), now = start;
+  bool ready = false;
+  while (now-start < pollNs) {
+    if (!proxyPostEmpty(pool) || __atomic_load_n(&state->stop, __ATOMIC_ACQUIRE)) { ready = true; break; }
+    if (now-start >= spinNs) sched_yield();
+    now = clockNano();
+  }
+  uint64_t spun = std::min(now-start, spinNs);
+  state->idleNs[ncclProxyIdleSpin] += spun;
+  state->idleNs[ncclProxyIdleYield] += now-start-spun;
+  if (ready) {
+    state->idleWakes[now-start < spinNs ? ncclProxyIdleSpin : ncclProxyIdleYield]++;
+    return;
+  }
+
+  __atomic_store_n(&pool->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int wakeSeq = __atomic_load_n(&pool->wakeSeq, __ATOMIC_SEQ_CST);
+  if (proxyPostEmpty(pool) && !__atomic_load_n(&state->stop, __ATOMIC_SEQ_CST)) {
+    syscall(SYS_futex, &pool->wakeSeq, FUTEX_WAIT, wakeSeq, NULL, NULL, 0);
+  }
+  __atomic_store_n(&pool->sleeping, 0, __ATOMIC_RELAXED);
+  state->idleNs[ncclProxyIdleSleep] += clockNano()-now;
+  state->idleWakes[ncclProxyIdleSleep]++;
+}
+
 static ncclResult_t ncclLocalOpAppend(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, struct ncclProxyOp* proxyOp) {
   int tpLocalRank = comm->topParentLocalRanks[comm->localRank];
   struct ncclProxyOps* proxyOps = comm->proxyState->proxyOps;
@@ -452,9 +577,9 @@ static ncclResult_t ncclLocalOpAppend(struct ncclComm* comm, struct ncclProxyCon
     proxyOps->freeOp = op->next;
   } else {
     int freeOp;
-    while ((freeOp = pool->freeOps[tpLocalRank]) == -1) sched_yield();
+    while ((freeOp = pool->freeOps[tpLocalRank].head) == -1) sched_yield();
     int freeOpNew;
-    while ((freeOpNew = __sync_val_compare_and_swap(pool->freeOps+tpLocalRank, freeOp, -1)) != freeOp) freeOp = freeOpNew;
+    while ((freeOpNew = __sync_val_compare_and_swap(&pool->freeOps[tpLocalRank].head, freeOp, -1)) != freeOp) freeOp = freeOpNew;
     opIndex = freeOp;
     op = pool->ops+opIndex;
     proxyOps->freeOp = op->next;
@@ -513,6 +638,8 @@ static ncclResult_t SaveProxy(struct ncclComm* comm, struct ncclChannel* channel
 
   if (justInquire) *justInquire = true;
   else {
+    op->peer = comm->topParentRanks[peer];
+    op->priority = comm->config.priority;
     NCCLCHECK(ncclLocalOpAppend(comm, &connector->proxyConn, op));
   }
   return ncclSuccess;
@@ -675,11 +802,23 @@ static ncclResult_t removeOp(struct ncclProxyProgressState* state, struct ncclPr
   return ncclSuccess;
 }
 
+RCCL_PARAM(ProxyLowPriorityInterval, "PROXY_LOW_PRIORITY_INTERVAL", 4);
+
 static ncclResult_t progressOps(struct ncclProxyState* proxyState, struct ncclProxyProgressState* state, struct ncclProxyArgs* opStart, int* idle) {
   struct ncclProxyArgs* prevOp = NULL;
   struct ncclProxyArgs* op = opStart;
+  // High priority ops are at the head of the list. While some are active, the ops of low priority
+  // comms (ncclConfig_t priority -1) only progress every RCCL_PROXY_LOW_PRIORITY_INTERVAL sweeps.
+  bool highActive = false;
+  bool lowTurn = state->sweeps++ % std::max(1L, (long)rcclParamProxyLowPriorityInterval()) == 0;
   while (op) {
     if (op->state == ncclProxyOpNone) return ncclInternalError;
+    highActive |= op->priority > 0;
+    if (op->priority < 0 && highActive && !lowTurn) {
+      prevOp = op;
+      op = op->next;
+      continue;
+    }
     TIME_START(0); TIME_START(1);
     NCCLCHECK(op->progress(proxyState, op));
     if (op->idle) { TIME_STOP(1); TIME_CANCEL(0); } else { TIME_CANCEL(1); TIME_STOP(0); }
@@ -697,6 +836,41 @@ static ncclResult_t progressOps(struct ncclProxyState* proxyState, struct ncclPr
 }
 
 NCCL_PARAM(ProxyAppendBatchSize, "PROXY_APPEND_BATCH_SIZE", 16);
+RCCL_PARAM(ProxyProgressThreads, "PROXY_PROGRESS_THREADS", 1);
+// Progress the sends of all net connections on a dedicated thread that busy polls while it has
+// any, so a step the kernel posts is picked up and handed to the NIC without waiting for a sweep
+// over the receives and the other transports, or for a sched_yield() of the shared thread.
+RCCL_PARAM(ProxySendThread, "PROXY_SEND_THREAD", 0);
+
+// Append op to the progress state owning its channel. CollNet connections
+// share args across channels of a network device and stay on the main thread.
+// All ops of a connection go to the same thread since they share its steps.
+static ncclResult_t proxyDispatch(struct ncclProxyState* proxyState, struct ncclProxyOp* op) {
+  int shardIndex = 0;
+  if (op->connection->collNet == NULL) {
+    if (proxyState->sendShard && op->connection->send && op->connection->transport == TRANSPORT_NET) shardIndex = proxyState->sendShard;
+    else if (proxyState->nProgressShards > 1) shardIndex = op->channelId % proxyState->nProgressShards;
+  }
+  if (shardIndex == 0) return ProxyAppend(&proxyState->progressState, op);
+
+  struct ncclProxyShard* shard = proxyState->progressShards+shardIndex;
+  uint64_t head = shard->head;
+  while (head - __atomic_load_n(&shard->tail, __ATOMIC_ACQUIRE) == NCCL_PROXY_SHARD_RING_SIZE) {
+    if (*proxyState->abortFlag) return ncclInternalError;
+    sched_yield();
+  }
+  shard->ring[head % NCCL_PROXY_SHARD_RING_SIZE] = *op;
+  __atomic_store_n(&shard->head, head+1, __ATOMIC_RELEASE);
+  // Pairs with the fence in proxyShardWait(): either we see the shard
+  // sleeping or it sees the new head.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shard->sleeping, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&shard->mutex);
+    pthread_cond_signal(&shard->cond);
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  return ncclSuccess;
+}
 
 static ncclResult_t ncclProxyGetPostedOps(struct ncclProxyState* proxyState, int* added) {
   struct ncclProxyProgressState* state = &proxyState->progressState;
@@ -706,28 +880,18 @@ static ncclResult_t ncclProxyGetPostedOps(struct ncclProxyState* proxyState, int
   struct ncclProxyArgs profArgs; // Only used for profiling purposes
   if (state->nextOps != -1) goto process_nextops;
 
-  // If we have ops to progress, no need to block waiting for something to arrive or even wait for the lock
-  // to be available. Exit, continue progress, and come back later.
-  if (state->active != NULL && (pool->nextOps == -1 || pthread_mutex_trylock(&pool->mutex) != 0)) return ncclSuccess;
-
-  if (state->active == NULL) {
-    pthread_mutex_lock(&pool->mutex);
-    while (pool->nextOps == -1 && !state->stop) {
-      struct ncclProxyArgs profArgs; // Only used for profiling purposes
-      ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileSleep);
-      pthread_cond_wait(&pool->cond, &pool->mutex);
-      ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileWakeup);
-    }
-    if (state->stop) { // We might have been woken up to stop.
-      pthread_mutex_unlock(&pool->mutex);
-      return ncclSuccess;
-    }
-  }
+  proxyPostDrain(pool, state);
+  // If we have ops to progress, no need to block waiting for something to arrive.
+  // Exit, continue progress, and come back later.
+  if (state->nextOps == -1 && state->active != NULL) return ncclSuccess;
 
-  state->nextOps = pool->nextOps;
-  pool->nextOps = pool->nextOpsEnd = -1;
-  pthread_mutex_unlock(&pool->mutex);
-  if (state->nextOps == -1) return ncclInternalError;
+  while (state->nextOps == -1) {
+    if (__atomic_load_n(&state->stop, __ATOMIC_SEQ_CST)) return ncclSuccess; // We might have been woken up to stop.
+    ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileSleep);
+    proxyPostWait(pool, state);
+    ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileWakeup);
+    proxyPostDrain(pool, state);
+  }
 
 process_nextops:
   ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileAppend);
@@ -748,7 +912,7 @@ process_nextops:
     lastPeer = peer;
     if (peerOp->connection == NULL) return ncclInternalError;
     if (peerOp->next != -1) __builtin_prefetch(pool->ops+peerOp->next);
-    NCCLCHECK(ProxyAppend(state, peerOp));
+    NCCLCHECK(proxyDispatch(proxyState, peerOp));
     (*added)++;
     int lastOpIndex = opIndex;
     opIndex = peerOp->next;
@@ -765,19 +929,19 @@ process_nextops:
   for (int i = 0; i < proxyState->tpLocalnRanks; i++) {
     if (freeOp[i] == -1) continue;
     int newFree = freeOp[i];
-    int oldFree = pool->freeOps[i];
+    int oldFree = pool->freeOps[i].head;
     pool->ops[freeOpEnd[i]].next = oldFree;
     if (oldFree == -1) {
       // Nothing for the main thread to consume, we can set it.
-      pool->freeOps[i] = newFree;
+      pool->freeOps[i].head = newFree;
     } else {
       // The main thread may recycle free ops at any time, replace the freeOps value atomically and check it worked.
-      int swap = __sync_val_compare_and_swap(pool->freeOps+i, oldFree, newFree);
+      int swap = __sync_val_compare_and_swap(&pool->freeOps[i].head, oldFree, newFree);
       if (swap != oldFree) {
         if (swap != -1) return ncclInternalError;
         // Ops were recycled while we were trying to swap, just set the value directly now.
         pool->ops[freeOpEnd[i]].next = -1;
-        pool->freeOps[i] = newFree;
+        pool->freeOps[i].head = newFree;
       }
     }
   }
@@ -826,6 +990,23 @@ static int setProxyThreadContext(struct ncclProxyState* proxyState) {
   return 0;
 }
 
+RCCL_PARAM(ProxyNicAffinity, "PROXY_NIC_AFFINITY", 0);
+
+// Pin the calling proxy thread. RCCL_THREAD_AFFINITY wins, then the CPUs local
+// to the NIC driving channelId, then the CPUs local to the GPU if gpuFallback.
+static void proxySetAffinity(struct ncclProxyState* proxyState, const char* role, int channelId, bool gpuFallback) {
+  cpu_set_t mask;
+  if (ncclThreadAffinityOverride(role, &mask) != ncclSuccess || CPU_COUNT(&mask) == 0) {
+    mask = proxyState->channelAffinity[channelId];
+    if (CPU_COUNT(&mask) == 0 && gpuFallback) mask = proxyState->cpuAffinity;
+  }
+  if (CPU_COUNT(&mask) == 0) return;
+  char affinityStr[sizeof(cpu_set_t)*2];
+  ncclCpusetToStr(&mask, affinityStr);
+  INFO(NCCL_INIT, "[Proxy %s] channel %d affinity set to %s", role, channelId, affinityStr);
+  sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+}
+
 // Set to SIGUSR1 or SIGUSR2 to help debug proxy state during hangs
 NCCL_PARAM(ProxyDumpSignal, "PROXY_DUMP_SIGNAL", -1);
 NCCL_PARAM(ProgressAppendOpFreq, "PROGRESS_APPENDOP_FREQ", 8);
@@ -837,12 +1018,14 @@ void* ncclProxyProgress(void *proxyState_) {
   } else if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
     WARN("[Proxy Progress] Failed to set CUDA device %d", proxyState->cudaDev);
   }
-  // if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
+  proxySetAffinity(proxyState, "progress", 0, proxyState->nProgressShards > 1);
+  ncclMemScope memScope(proxyState->memUsage, ncclMemTagProxy);
 
   struct ncclProxyProgressState* state = &proxyState->progressState;
   state->nextOps = -1;
   const int sig = ncclParamProxyDumpSignal();
   if (sig != -1) signal(sig, ncclDumpProxyState);
+  ncclProxyHistInit();
   ncclLastProxyState = state;
   char threadName[NCCL_THREAD_NAMELEN];
   snprintf(threadName, NCCL_THREAD_NAMELEN, "NCCL Progress%2d", proxyState->cudaDev);
@@ -865,6 +1048,8 @@ void* ncclProxyProgress(void *proxyState_) {
     }
     if (lastIdle == 0 && idle == 1) ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileIdle);
     if (lastIdle == 1 && idle == 0) ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileActive);
+    if (lastIdle != idle) ncclProxyHistIdle(proxyState, idle);
+    ncclProxyHistCheckDump(proxyState);
     if (idle || (++proxyOpAppendCounter == ncclParamProgressAppendOpFreq())) {
       int added = 0;
       proxyOpAppendCounter = 0;
@@ -884,6 +1069,97 @@ void* ncclProxyProgress(void *proxyState_) {
   return NULL;
 }
 
+// Block until ops are handed over to an idle shard or it is asked to stop.
+static void proxyShardWait(struct ncclProxyShard* shard) {
+  pthread_mutex_lock(&shard->mutex);
+  __atomic_store_n(&shard->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&shard->head, __ATOMIC_ACQUIRE) == shard->tail && !shard->state.stop) {
+    pthread_cond_wait(&shard->cond, &shard->mutex);
+  }
+  __atomic_store_n(&shard->sleeping, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+static void* ncclProxyShardProgress(void* shard_) {
+  struct ncclProxyShard* shard = (struct ncclProxyShard*)shard_;
+  struct ncclProxyState* proxyState = shard->proxyState;
+  struct ncclProxyProgressState* state = &shard->state;
+  if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
+    WARN("[Proxy Progress] Failed to set CUDA device %d", proxyState->cudaDev);
+  }
+  if (shard->busyPoll) proxySetAffinity(proxyState, "send", 0, true);
+  else proxySetAffinity(proxyState, "progress", shard->index, true);
+
+  while ((state->stop == false || state->active) && *proxyState->abortFlag == 0) {
+    int idle = 1;
+    ncclResult_t ret = progressOps(proxyState, state, state->active, &idle);
+    if (ret != ncclSuccess) {
+      INFO(NCCL_ALL,"%s:%d -> %d [Proxy Shard %d]", __FILE__, __LINE__, ret, shard->index);
+      return NULL;
+    }
+    uint64_t head = __atomic_load_n(&shard->head, __ATOMIC_ACQUIRE);
+    if (head == shard->tail) {
+      if (state->active == NULL && state->stop == false) proxyShardWait(shard);
+      else if (idle && !shard->busyPoll) sched_yield();
+      continue;
+    }
+    for (uint64_t tail = shard->tail; tail != head; tail++) {
+      ret = ProxyAppend(state, shard->ring + tail % NCCL_PROXY_SHARD_RING_SIZE);
+      if (ret != ncclSuccess) {
+        INFO(NCCL_ALL,"%s:%d -> %d [Proxy Shard %d]", __FILE__, __LINE__, ret, shard->index);
+        return NULL;
+      }
+    }
+    __atomic_store_n(&shard->tail, head, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static ncclResult_t proxyShardsCreate(struct ncclProxyState* proxyState) {
+  int nShards = std::min(std::max(1, (int)rcclParamProxyProgressThreads()), MAXCHANNELS);
+  int sendThread = rcclParamProxySendThread() ? 1 : 0;
+  proxyState->nProgressShards = nShards;
+  proxyState->sendShard = sendThread ? nShards : 0;
+  if (nShards + sendThread == 1) return ncclSuccess;
+  NCCLCHECK(ncclCalloc(&proxyState->progressShards, nShards + sendThread));
+  for (int i = 1; i < nShards + sendThread; i++) {
+    struct ncclProxyShard* shard = proxyState->progressShards+i;
+    shard->proxyState = proxyState;
+    shard->index = i;
+    shard->busyPoll = i == proxyState->sendShard;
+    pthread_mutex_init(&shard->mutex, NULL);
+    pthread_cond_init(&shard->cond, NULL);
+    pthread_create(&shard->state.thread, NULL, ncclProxyShardProgress, shard);
+    if (shard->busyPoll) ncclSetThreadName(shard->state.thread, "NCCL NetSend%2d", proxyState->cudaDev);
+    else ncclSetThreadName(shard->state.thread, "NCCL Progress%2d.%d", proxyState->cudaDev, i);
+  }
+  if (nShards > 1) INFO(NCCL_INIT, "Proxy progress sharded over %d threads by channel", nShards);
+  if (sendThread) INFO(NCCL_INIT, "Proxy net sends progressed by a dedicated busy polling thread");
+  return ncclSuccess;
+}
+
+static void proxyShardsDestroy(struct ncclProxyState* proxyState) {
+  if (proxyState->progressShards == NULL) return;
+  for (int i = 1; i < proxyState->nProgressShards + (proxyState->sendShard ? 1 : 0); i++) {
+    struct ncclProxyShard* shard = proxyState->progressShards+i;
+    pthread_mutex_lock(&shard->mutex);
+    shard->state.stop = true;
+    pthread_cond_signal(&shard->cond);
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_join(shard->state.thread, NULL);
+    while (shard->state.pools != NULL) {
+      struct ncclProxyPool *next = shard->state.pools->next;
+      free(shard->state.pools);
+      shard->state.pools = next;
+    }
+    pthread_mutex_destroy(&shard->mutex);
+    pthread_cond_destroy(&shard->cond);
+  }
+  free(proxyState->progressShards);
+  proxyState->progressShards = NULL;
+}
+
 ncclResult_t ncclProxyStart(struct ncclComm* comm) {
   struct ncclProxyOps* proxyOps = comm->proxyState->proxyOps;
   if (proxyOps == NULL) return ncclSuccess;
@@ -903,6 +1179,7 @@ ncclResult_t ncclProxyStart(struct ncclComm* comm) {
 static ncclResult_t ncclProxyProgressCreate(struct ncclProxyState* proxyState) {
   struct ncclProxyProgressState* state = &proxyState->progressState;
   if (!state->thread) {
+    NCCLCHECK(proxyShardsCreate(proxyState));
     pthread_create(&state->thread, NULL, ncclProxyProgress, proxyState);
     ncclSetThreadName(state->thread, "NCCL Progress%2d", proxyState->tpLocalnRanks);
   }
@@ -914,12 +1191,16 @@ ncclResult_t ncclProxyProgressDestroy(struct ncclProxyState* proxyState) {
 
   // Request the proxy to stop and then wake it
   if (state->opsPool) {
-    pthread_mutex_lock(&state->opsPool->mutex);
-    state->stop = true;
-    pthread_cond_signal(&state->opsPool->cond);
-    pthread_mutex_unlock(&state->opsPool->mutex);
+    __atomic_store_n(&state->stop, true, __ATOMIC_SEQ_CST);
+    proxyPostWake(state->opsPool);
     pthread_join(state->thread, NULL);
+    INFO(NCCL_PROXY, "Proxy idle: spin %lu us (%lu wakes), yield %lu us (%lu wakes), sleep %lu us (%lu wakes)",
+        state->idleNs[ncclProxyIdleSpin]/1000, state->idleWakes[ncclProxyIdleSpin],
+        state->idleNs[ncclProxyIdleYield]/1000, state->idleWakes[ncclProxyIdleYield],
+        state->idleNs[ncclProxyIdleSleep]/1000, state->idleWakes[ncclProxyIdleSleep]);
   }
+  // Shards only receive ops from the main progress thread, stop them after it.
+  proxyShardsDestroy(proxyState);
 
   // Free off any memory allocated for the proxy arg pools
   while (state->pools != NULL) {
@@ -928,7 +1209,7 @@ ncclResult_t ncclProxyProgressDestroy(struct ncclProxyState* proxyState) {
     state->pools = next;
   }
 
-  ncclProfilingDump();
+  ncclProfilingDump(proxyState);
   TIME_PRINT("Proxy");
   return ncclSuccess;
 }
@@ -1024,6 +1305,7 @@ ncclResult_t ncclProxyConnect(struct ncclComm* comm, int transport, int send, in
   proxyConn->tpRank = tpProxyRank;
   if (sharedProxyState->peerSocks == NULL) {
     NCCLCHECK(ncclCalloc(&sharedProxyState->peerSocks, comm->sharedRes->tpNLocalRanks));
+    NCCLCHECK(ncclCalloc(&sharedProxyState->callBatches, comm->sharedRes->tpNLocalRanks));
     NCCLCHECK(ncclCalloc(&sharedProxyState->proxyOps, comm->sharedRes->tpNLocalRanks));
     NCCLCHECK(ncclCalloc(&sharedProxyState->sharedDevMems, comm->sharedRes->tpNLocalRanks));
     for (int i = 0; i < comm->sharedRes->tpNLocalRanks; ++i) {
@@ -1098,7 +1380,55 @@ error:
   return ret;
 }
 
-const char* ncclProxyMsgTypeStr[] = { "Unknown", "Init", "SharedInit", "Setup", "Connect", "Start", "Close", "Abort", "Stop", "ConvertFd" };
+const char* ncclProxyMsgTypeStr[] = { "Unknown", "Init", "SharedInit", "Setup", "Connect", "Start", "Close", "Abort", "Stop", "ConvertFd", "Batch" };
+
+RCCL_PARAM(ProxyCallBatch, "PROXY_CALL_BATCH", 64);
+
+static ncclResult_t proxyCallBatchAppend(struct ncclProxyCallBatch* batch, const void* data, int size) {
+  if (batch->size + size > batch->cap) {
+    int cap = std::max(batch->size + size, 2*batch->cap);
+    NCCLCHECK(ncclRealloc(&batch->buff, batch->cap, cap));
+    batch->cap = cap;
+  }
+  memcpy(batch->buff+batch->size, data, size);
+  batch->size += size;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclProxyCallFlush(struct ncclComm* comm, struct ncclProxyConnector* proxyConn) {
+  struct ncclProxyState* sharedProxyState = comm->proxyState;
+  if (sharedProxyState->callBatches == NULL) return ncclSuccess;
+  struct ncclProxyCallBatch* batch = sharedProxyState->callBatches + proxyConn->tpLocalRank;
+  if (batch->count == 0) return ncclSuccess;
+  // The header was reserved when the first call was queued
+  int header[2] = { ncclProxyMsgBatch, batch->count };
+  memcpy(batch->buff, header, sizeof(header));
+  INFO(NCCL_PROXY, "Sending %d proxy calls (%d bytes) to local rank %d", batch->count, batch->size, proxyConn->tpLocalRank);
+  NCCLCHECK(ncclSocketSend(sharedProxyState->peerSocks + proxyConn->tpLocalRank, batch->buff, batch->size));
+  batch->size = batch->count = 0;
+  batch->newestOpId = batch->lastPolledOpId = NULL;
+  return ncclSuccess;
+}
+
+// Queue a Setup/Connect call; it uses the layout of a single call message.
+static ncclResult_t proxyCallBatchQueue(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, int type, void* reqBuff, int reqSize, int respSize, void* opId) {
+  struct ncclProxyCallBatch* batch = comm->proxyState->callBatches + proxyConn->tpLocalRank;
+  if (batch->count == 0) {
+    int header[2] = { ncclProxyMsgBatch, 0 };
+    NCCLCHECK(proxyCallBatchAppend(batch, header, sizeof(header)));
+  }
+  NCCLCHECK(proxyCallBatchAppend(batch, &type, sizeof(int)));
+  NCCLCHECK(proxyCallBatchAppend(batch, &proxyConn->connection, sizeof(void*)));
+  NCCLCHECK(proxyCallBatchAppend(batch, &reqSize, sizeof(int)));
+  NCCLCHECK(proxyCallBatchAppend(batch, &respSize, sizeof(int)));
+  if (reqSize) NCCLCHECK(proxyCallBatchAppend(batch, reqBuff, reqSize));
+  NCCLCHECK(proxyCallBatchAppend(batch, &opId, sizeof(opId)));
+  batch->count++;
+  batch->newestOpId = opId;
+  if (batch->count >= rcclParamProxyCallBatch()) NCCLCHECK(ncclProxyCallFlush(comm, proxyConn));
+  return ncclSuccess;
+}
+
 ncclResult_t ncclProxyCallAsync(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, int type, void* reqBuff, int reqSize, int respSize, void* opId) {
   struct ncclSocket* sock;
   ncclResult_t ret = ncclSuccess;
@@ -1109,6 +1439,15 @@ ncclResult_t ncclProxyCallAsync(struct ncclComm* comm, struct ncclProxyConnector
   sock = sharedProxyState->peerSocks + proxyConn->tpLocalRank;
   if (sock == NULL) return ncclInternalError;
 
+  // Setup and Connect calls are batched until their responses are needed
+  if (rcclParamProxyCallBatch() > 1 && (type == ncclProxyMsgSetup || type == ncclProxyMsgConnect)) {
+    NCCLCHECK(proxyCallBatchQueue(comm, proxyConn, type, reqBuff, reqSize, respSize, opId));
+    NCCLCHECK(expectedProxyResponseEnqueue(sharedProxyState, opId, respSize));
+    return ncclSuccess;
+  }
+  // Keep calls in order
+  NCCLCHECK(ncclProxyCallFlush(comm, proxyConn));
+
   NCCLCHECKGOTO(ncclSocketSend(sock, &type, sizeof(int)), ret, error);
   NCCLCHECKGOTO(ncclSocketSend(sock, &proxyConn->connection, sizeof(void*)), ret, error);
   NCCLCHECKGOTO(ncclSocketSend(sock, &reqSize, sizeof(int)), ret, error);
@@ -1135,13 +1474,30 @@ ncclResult_t ncclPollProxyResponse(struct ncclComm* comm, struct ncclProxyConnec
   }
   if (sharedProxyState->peerSocks == NULL) return ncclInternalError;
 
+  // The newest queued call can't have completed. Give the caller a chance to
+  // queue more calls before sending them, unless it polls it again right away.
+  struct ncclProxyCallBatch* batch = sharedProxyState->callBatches + proxyConn->tpLocalRank;
+  if (batch->count) {
+    if (opId == batch->newestOpId && opId != batch->lastPolledOpId) {
+      batch->lastPolledOpId = opId;
+      return ncclInProgress;
+    }
+    NCCLCHECK(ncclProxyCallFlush(comm, proxyConn));
+  }
+
   // Check response queue
   int found = 0;
   NCCLCHECK(expectedProxyResponseDequeue(sharedProxyState, opId, respBuff, &found));
-  if (found == 0) {
-    // Attempt to read in a new response header from the proxy thread
-    struct ncclSocket* sock = sharedProxyState->peerSocks + proxyConn->tpLocalRank;
+  if (found) {
+    INFO(NCCL_PROXY, "ncclPollProxyResponse Dequeued cached opId=%p", opId);
+    return ncclSuccess;
+  }
 
+  // Drain all the responses already sent by the proxy thread, storing the
+  // ones for other calls, until ours arrives or the socket is empty.
+  struct ncclSocket* sock = sharedProxyState->peerSocks + proxyConn->tpLocalRank;
+  while (true) {
+    // Attempt to read in a new response header from the proxy thread
     void* recvOpId;
     int offset = 0;
     if (ncclSuccess != ncclSocketProgress(NCCL_SOCKET_RECV, sock, &recvOpId, sizeof(recvOpId), &offset)) {
@@ -1163,31 +1519,24 @@ ncclResult_t ncclPollProxyResponse(struct ncclComm* comm, struct ncclProxyConnec
     int respSize = 0;
     NCCLCHECK(ncclSocketRecv(sock, &respSize, sizeof(respSize)));
 
-    // If there's a respSize to recv
-    if (respSize > 0) {
-      if (recvOpId != opId) {
-        // Unexpected response, need to buffer the socket data
-        respBuff = malloc(respSize);
-      }
-      assert(respBuff != NULL);
-      NCCLCHECK(ncclSocketRecv(sock, respBuff, respSize));
-    }
-
     if (recvOpId == opId) {
+      if (respSize > 0) NCCLCHECK(ncclSocketRecv(sock, respBuff, respSize));
       INFO(NCCL_PROXY, "recvOpId=%p matches expected opId=%p", recvOpId, opId);
       NCCLCHECK(expectedProxyResponseRemove(sharedProxyState, recvOpId));
       return ncclSuccess;
-    } else {
-      INFO(NCCL_PROXY, "Queuing opId=%p respBuff=%p respSize=%d", recvOpId, respBuff, respSize);
-      // Store the result and mark response as completed
-      NCCLCHECK(expectedProxyResponseStore(sharedProxyState, recvOpId, respBuff, respSize));
-      return ncclInProgress;
     }
-  } else {
-    INFO(NCCL_PROXY, "ncclPollProxyResponse Dequeued cached opId=%p", opId);
-  }
 
-  return ncclSuccess;
+    // Unexpected response, receive it straight into its pre-allocated buffer
+    struct ncclExpectedProxyResponse* elem = expectedProxyResponseFind(sharedProxyState, recvOpId);
+    if (elem == NULL || elem->respSize != respSize) {
+      WARN("Proxy response for opId=%p (size %d) doesn't match any expected response", recvOpId, respSize);
+      return ncclInternalError;
+    }
+    if (respSize > 0) NCCLCHECK(ncclSocketRecv(sock, elem->respBuff, respSize));
+    INFO(NCCL_PROXY, "Queuing opId=%p respBuff=%p respSize=%d", recvOpId, elem->respBuff, respSize);
+    // Mark response as completed
+    NCCLCHECK(expectedProxyResponseStore(sharedProxyState, recvOpId, elem->respBuff, respSize));
+  }
 }
 
 ncclResult_t ncclProxyCallBlocking(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, int type, void* reqBuff, int reqSize, void* respBuff, int respSize) {
@@ -1196,6 +1545,7 @@ ncclResult_t ncclProxyCallBlocking(struct ncclComm* comm, struct ncclProxyConnec
   void* opId = malloc(1);
 
   NCCLCHECKGOTO(ncclProxyCallAsync(comm, proxyConn, type, reqBuff, reqSize, respSize, opId), res, fail);
+  NCCLCHECKGOTO(ncclProxyCallFlush(comm, proxyConn), res, fail);
 
   do {
     res = ncclPollProxyResponse(comm, proxyConn, respBuff, opId);
@@ -1218,22 +1568,13 @@ static ncclResult_t proxyProgressInit(struct ncclProxyState* proxyState) {
     shmPath[0] = '\0';
     NCCLCHECK(ncclShmOpen(shmPath, size, (void**)&pool, NULL, proxyState->tpLocalnRanks + 1, &state->handle));
     // Init pool
-    pool->nextOps = -1;
+    for (uint64_t i = 0; i < NCCL_PROXY_POST_RING_SIZE; i++) pool->posts[i].seq = i;
 
     for (int r = 0; r < proxyState->tpLocalnRanks; r++) {
-      pool->freeOps[r] = r*MAX_OPS_PER_PEER;
+      pool->freeOps[r].head = r*MAX_OPS_PER_PEER;
       for (int i=0; i<MAX_OPS_PER_PEER-1; i++) pool->ops[r*MAX_OPS_PER_PEER+i].next = r*MAX_OPS_PER_PEER+i+1;
       pool->ops[(r+1)*MAX_OPS_PER_PEER-1].next = -1;
     }
-
-    // Setup mutex/cond to work inter-process
-    pthread_mutexattr_t mutexAttr;
-    pthread_mutexattr_init(&mutexAttr);
-    pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&pool->mutex, &mutexAttr);
-    pthread_condattr_t condAttr;
-    pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
-    pthread_cond_init(&pool->cond, &condAttr);
     state->opsPool = pool;
 
     memcpy(state->opsPoolShmSuffix, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof("XXXXXX")-1);
@@ -1271,6 +1612,7 @@ static ncclResult_t proxyConnInit(struct ncclProxyLocalPeer* peer, struct ncclPr
   (*connection)->send = req->send;
   (*connection)->tpLocalRank = req->tpLocalRank;
   (*connection)->sameProcess = req->sameProcess;
+  (*connection)->proxyState = proxyState;
   peer->tpLocalRank = req->tpLocalRank;
   peer->tpRank = req->tpRank;
 
@@ -1398,15 +1740,32 @@ static bool proxyMatchOpType(int type) {
   }
 }
 
+// Start all the Setup/Connect calls of a ncclProxyMsgBatch message
+static ncclResult_t proxyServiceInitBatch(struct ncclProxyLocalPeer* peer, struct ncclProxyConnectionPool* connectionPool, struct ncclProxyState* proxyState, int* asyncOpCount) {
+  int count;
+  NCCLCHECK(ncclSocketRecv(&peer->sock, &count, sizeof(int)));
+  for (int i = 0; i < count; i++) {
+    int type;
+    NCCLCHECK(ncclSocketRecv(&peer->sock, &type, sizeof(int)));
+    if (type != ncclProxyMsgSetup && type != ncclProxyMsgConnect) {
+      WARN("[Service thread] Unexpected command %d in batch from localRank %d", type, peer->tpLocalRank);
+      return ncclInternalError;
+    }
+    NCCLCHECK(proxyServiceInitOp(type, peer, connectionPool, proxyState, asyncOpCount));
+  }
+  return ncclSuccess;
+}
+
 void* ncclProxyService(void* _args) {
   struct ncclProxyState* proxyState =  (struct ncclProxyState*) _args;
-  // if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
   if (setProxyThreadContext(proxyState)) {
     INFO(NCCL_INIT, "[Proxy Service] Created CUDA context on device %d", proxyState->cudaDev);
   } else if (cudaSetDevice(proxyState->cudaDev) != cudaSuccess) {
     WARN("[Proxy Service] Failed to set CUDA device %d", proxyState->cudaDev);
   }
-  // if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
+  proxySetAffinity(proxyState, "service", 0, false);
+  // Connection setup allocates the buffers
+  ncclMemScope memScope(proxyState->memUsage, ncclMemTagBuffers);
 
   // Prepare poll descriptor
   struct ncclProxyConnectionPool connectionPool;
@@ -1508,6 +1867,8 @@ void* ncclProxyService(void* _args) {
             closeConn = 1;
           } else if (type == ncclProxyMsgClose) {
             closeConn = 1;
+          } else if (type == ncclProxyMsgBatch) {
+            res = proxyServiceInitBatch(peers+s, &connectionPool, proxyState, &asyncOpCount);
           } else if (proxyMatchOpType(type)) {
             res = proxyServiceInitOp(type, peers+s, &connectionPool, proxyState, &asyncOpCount);
           } else {
@@ -1573,6 +1934,7 @@ ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
     proxyState->tpLocalnRanks = comm->localRanks;
     proxyState->cudaDev = comm->cudaDev;
     proxyState->abortFlag = comm->abortFlag;
+    proxyState->memUsage = &comm->sharedRes->memUsage;
     proxyState->p2pnChannels = comm->p2pnChannels;
     proxyState->p2pChunkSize = comm->p2pChunkSize;
     proxyState->nChannels = comm->nChannels;
@@ -1581,6 +1943,16 @@ ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
     proxyState->ncclNet = comm->ncclNet;
     proxyState->ncclCollNet = comm->ncclCollNet;
     memcpy(proxyState->buffSizes, comm->buffSizes, sizeof(comm->buffSizes));
+    proxyState->cpuAffinity = comm->cpuAffinity;
+    if (rcclParamProxyNicAffinity()) {
+      // Channels are spread over the NICs local to this GPU, see ncclTopoGetLocalNet().
+      // It fails when there is no local NIC, leaving the affinities empty.
+      for (int c = 0; c < MAXCHANNELS; c++) {
+        int net;
+        if (ncclTopoGetLocalNet(comm->topo, comm->rank, c, &net) != ncclSuccess) break;
+        NCCLCHECK(ncclTopoGetNetCpuAffinity(comm->topo, net, proxyState->channelAffinity+c));
+      }
+    }
 
     pthread_create(&comm->proxyState->thread, NULL, ncclProxyService, comm->proxyState);
     ncclSetThreadName(comm->proxyState->thread, "NCCL Service %2d", comm->cudaDev);
@@ -1636,9 +2008,14 @@ ncclResult_t ncclProxyDestroy(struct ncclComm* comm) {
   assert(sharedProxyState->refCount == 0);
   free(sharedProxyState->peerAddresses);
   free(sharedProxyState->peerSocks);
+  if (sharedProxyState->callBatches) {
+    for (int i = 0; i < comm->sharedRes->tpNLocalRanks; i++) free(sharedProxyState->callBatches[i].buff);
+    free(sharedProxyState->callBatches);
+  }
   free(sharedProxyState->proxyOps);
   free(sharedProxyState->sharedDevMems);
   expectedProxyResponseFree(sharedProxyState);
+  ncclProxyHistFree(sharedProxyState);
   free(sharedProxyState);
   return ncclSuccess;
 }
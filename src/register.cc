@@ -0,0 +1,165 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "register.h"
+#include "argcheck.h"
+#include "bootstrap.h"
+#include "alloc.h"
+#include <cstring>
+
+struct ncclReg* ncclRegFind(struct ncclComm* comm, const void* data, size_t size) {
+  if (comm->regCache == NULL) return NULL;
+  for (struct ncclReg* reg = comm->regCache->regs; reg; reg = reg->next) {
+    if ((const char*)data >= reg->addr && (const char*)data + size <= reg->addr + reg->size) return reg;
+  }
+  return NULL;
+}
+
+static ncclResult_t regOpenPeer(struct ncclRegCache* cache, cudaIpcMemHandle_t* ipc, void** base) {
+  struct ncclRegPeerMapping* map;
+  for (map = cache->mappings; map; map = map->next) {
+    if (memcmp(&map->ipc, ipc, sizeof(cudaIpcMemHandle_t)) == 0) {
+      *base = map->base;
+      return ncclSuccess;
+    }
+  }
+  NCCLCHECK(ncclCalloc(&map, 1));
+  cudaError_t err = cudaIpcOpenMemHandle(&map->base, *ipc, cudaIpcMemLazyEnablePeerAccess);
+  if (err != cudaSuccess) {
+    WARN("Failed to open IPC handle of a registered buffer : %s", cudaGetErrorString(err));
+    free(map);
+    return ncclUnhandledCudaError;
+  }
+  map->ipc = *ipc;
+  map->next = cache->mappings;
+  cache->mappings = map;
+  *base = map->base;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclRegGetPeerBuffers(struct ncclComm* comm, struct ncclReg* sendReg, const void* sendbuff,
+    struct ncclReg* recvReg, void* recvbuff, void* regBufSend[], void* regBufRecv[]) {
+  struct ncclReg* regs[2] = { sendReg, recvReg };
+  int localRank = comm->localRank;
+
+  if (sendReg->peerAddrs == NULL || recvReg->peerAddrs == NULL) {
+    struct RegPair {
+      cudaIpcMemHandle_t ipc[2]; // {send, recv}
+      size_t baseOffset[2]; // {send, recv}
+    };
+    struct RegPair* pairs;
+    ncclResult_t ret = ncclSuccess;
+    NCCLCHECK(ncclCalloc(&pairs, comm->localRanks));
+    for (int sr=0; sr<2; sr++) {
+      pairs[localRank].ipc[sr] = regs[sr]->ipc;
+      pairs[localRank].baseOffset[sr] = regs[sr]->baseOffset;
+    }
+    NCCLCHECKGOTO(bootstrapIntraNodeAllGather(comm->bootstrap, comm->localRankToRank, comm->localRank, comm->localRanks, pairs, sizeof(struct RegPair)), ret, exit);
+    for (int sr=0; sr<2; sr++) {
+      struct ncclReg* reg = regs[sr];
+      if (reg->peerAddrs) continue; // Same registration for send and recv
+      NCCLCHECKGOTO(ncclCalloc(&reg->peerAddrs, comm->localRanks), ret, exit);
+      for (int i=0; i<comm->localRanks; i++) {
+        if (i == localRank) continue;
+        void* base;
+        ret = regOpenPeer(comm->regCache, &pairs[i].ipc[sr], &base);
+        if (ret != ncclSuccess) {
+          // Opened mappings stay in the cache, only forget the partial registration
+          free(reg->peerAddrs);
+          reg->peerAddrs = NULL;
+          goto exit;
+        }
+        reg->peerAddrs[i] = (char*)base + pairs[i].baseOffset[sr];
+      }
+    }
+exit:
+    free(pairs);
+    if (ret != ncclSuccess) return ret;
+  }
+
+  // Buffers are used at the same offset of the registration on every rank
+  for (int i=0; i<comm->localRanks; i++) {
+    regBufSend[i] = i == localRank ? nullptr : (char*)sendReg->peerAddrs[i] + ((const char*)sendbuff - sendReg->addr);
+    regBufRecv[i] = i == localRank ? nullptr : (char*)recvReg->peerAddrs[i] + ((char*)recvbuff - recvReg->addr);
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclRegCleanup(struct ncclComm* comm) {
+  struct ncclRegCache* cache = comm->regCache;
+  if (cache == NULL) return ncclSuccess;
+  while (cache->regs) {
+    struct ncclReg* reg = cache->regs;
+    cache->regs = reg->next;
+    free(reg->peerAddrs);
+    free(reg);
+  }
+  while (cache->mappings) {
+    struct ncclRegPeerMapping* map = cache->mappings;
+    cache->mappings = map->next;
+    CUDACHECKIGNORE(cudaIpcCloseMemHandle(map->base));
+    free(map);
+  }
+  free(cache);
+  comm->regCache = NULL;
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommRegister, const ncclComm_t comm, void* buff, size_t size, void** handle);
+ncclResult_t ncclCommRegister(const ncclComm_t comm, void* buff, size_t size, void** handle) {
+  NCCLCHECK(PtrCheck(comm, "CommRegister", "comm"));
+  NCCLCHECK(PtrCheck(buff, "CommRegister", "buff"));
+  NCCLCHECK(PtrCheck(handle, "CommRegister", "handle"));
+  if (size == 0) {
+    WARN("CommRegister : size must be positive");
+    return ncclInvalidArgument;
+  }
+  struct ncclReg* reg;
+  void* base;
+  size_t baseSize;
+  NCCLCHECK(ncclCalloc(&reg, 1));
+  if (hipMemGetAddressRange(&base, &baseSize, buff) != hipSuccess ||
+      (char*)buff + size > (char*)base + baseSize ||
+      cudaIpcGetMemHandle(&reg->ipc, buff) != cudaSuccess) {
+    (void)cudaGetLastError();
+    WARN("CommRegister : %p size %zu is not within a device allocation", buff, size);
+    free(reg);
+    return ncclInvalidArgument;
+  }
+  if (comm->regCache == NULL) {
+    ncclResult_t ret = ncclCalloc(&comm->regCache, 1);
+    if (ret != ncclSuccess) { free(reg); return ret; }
+  }
+  reg->addr = (char*)buff;
+  reg->size = size;
+  reg->baseOffset = (char*)buff - (char*)base;
+  reg->next = comm->regCache->regs;
+  comm->regCache->regs = reg;
+  *handle = reg;
+  INFO(NCCL_INIT, "comm %p rank %d registered buffer %p size %zu", comm, comm->rank, buff, size);
+  return ncclSuccess;
+}
+
+NCCL_API(ncclResult_t, ncclCommDeregister, const ncclComm_t comm, void* handle);
+ncclResult_t ncclCommDeregister(const ncclComm_t comm, void* handle) {
+  NCCLCHECK(PtrCheck(comm, "CommDeregister", "comm"));
+  NCCLCHECK(PtrCheck(handle, "CommDeregister", "handle"));
+  if (comm->regCache) {
+    for (struct ncclReg** prev = &comm->regCache->regs; *prev; prev = &(*prev)->next) {
+      if (*prev == handle) {
+        struct ncclReg* reg = *prev;
+        *prev = reg->next;
+        free(reg->peerAddrs);
+        free(reg);
+        // The buffer is likely to be freed next, stop trusting the validated ranges
+        ncclPtrCacheInvalidate(comm);
+        return ncclSuccess;
+      }
+    }
+  }
+  WARN("CommDeregister : unknown handle %p", handle);
+  return ncclInvalidArgument;
+}
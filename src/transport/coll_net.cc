@@ -463,8 +463,12 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
 
   resources->sendMem = (struct ncclSendMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, sendMem);
   resources->recvMem = (struct ncclRecvMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, recvMem);
-  // Don't give credits yet in shared mode.
+  // Don't give credits yet in shared mode. The GPU reads the head from GDR memory when there is some.
   resources->sendMem->head = -NCCL_STEPS;
+  if (resources->gdcSync) {
+    *resources->gdcSync = resources->sendMem->head;
+    wc_store_fence(); // Flush out WC write
+  }
 
   // Allocate & Register shared buffers for the Simple protocol
   int bank = resources->useGdr ? NCCL_NET_MAP_SHARED_DEVMEM : NCCL_NET_MAP_SHARED_HOSTMEM;
@@ -482,6 +486,19 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
                                                   &resources->sendMhandles[NCCL_PROTO_SIMPLE]));
     (void)close(dmabuf_fd);
   } else // FALL-THROUGH to nv_peermem GDR path
+#else
+  /* DMA-BUF support */
+  if (resources->useGdr && resources->useDmaBuf && pfn_hsa_amd_portable_export_dmabuf) {
+    int dmabuf_fd;
+    uint64_t offset;
+    CUCHECK(hsa_amd_portable_export_dmabuf((const void*)mapMem->cpuPtr, mapMem->size, &dmabuf_fd, &offset));
+    NCCLCHECK(proxyState->ncclCollNet->regMrDmaBuf(resources->collNetComm, mapMem->cpuPtr, mapMem->size,
+                                                  NCCL_PTR_CUDA, offset, dmabuf_fd,
+                                                  &resources->sendMhandles[NCCL_PROTO_SIMPLE]));
+    (void)close(dmabuf_fd);
+    INFO(NCCL_INIT|NCCL_NET, "CollNet : hsa_amd_portable_export_dmabuf buffer %p size %d handle %x offset %ld",
+      mapMem->cpuPtr, mapMem->size, dmabuf_fd, offset);
+  } else // FALL-THROUGH to peer memory GDR path
 #endif
   {
     NCCLCHECK(proxyState->ncclCollNet->regMr(resources->collNetComm, mapMem->cpuPtr, mapMem->size,
@@ -551,6 +568,19 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
                                                   &resources->mhandles[NCCL_PROTO_SIMPLE]));
     (void)close(dmabuf_fd);
   } else // FALL-THROUGH to nv_peermem GDR path
+#else
+  /* DMA-BUF support */
+  if (resources->useGdr && resources->useDmaBuf && pfn_hsa_amd_portable_export_dmabuf) {
+    int dmabuf_fd;
+    uint64_t offset;
+    CUCHECK(hsa_amd_portable_export_dmabuf((const void*)mapMem->cpuPtr, mapMem->size, &dmabuf_fd, &offset));
+    NCCLCHECK(proxyState->ncclCollNet->regMrDmaBuf(resources->collNetComm, mapMem->cpuPtr, mapMem->size,
+                                                  NCCL_PTR_CUDA, offset, dmabuf_fd,
+                                                  &resources->mhandles[NCCL_PROTO_SIMPLE]));
+    (void)close(dmabuf_fd);
+    INFO(NCCL_INIT|NCCL_NET, "CollNet : hsa_amd_portable_export_dmabuf buffer %p size %d handle %x offset %ld",
+      mapMem->cpuPtr, mapMem->size, dmabuf_fd, offset);
+  } else // FALL-THROUGH to peer memory GDR path
 #endif
   {
     NCCLCHECK(proxyState->ncclCollNet->regMr(resources->collNetComm, mapMem->cpuPtr, mapMem->size,
@@ -615,6 +645,7 @@ static ncclResult_t recvProxyFree(struct ncclProxyConnection* connection, struct
   (s % COLLNET_GROUP_NSUBS == COLLNET_GROUP_NSUBS-1 || s == args->nsubs-1)
 
 static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args) {
+  ncclGdcFlushScope gdcFlush;
   if (args->state == ncclProxyOpReady) {
     for (int s=0; s<args->nsubs; s++) {
       struct ncclProxySubArgs* sub = args->subs+s;
@@ -645,10 +676,8 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
         NCCLCHECK(sharedBuffersGet(sub->connection->collNet, 0, sharedBuffSlot, 0, &offset));
         resources->recvMem->offsFifo[buffSlot] = offset + s*args->chunkSize;
         __sync_synchronize();
-        volatile uint64_t* sendHead = resources->gdcSync ? resources->gdcSync : &resources->sendMem->head;
         sub->posted += args->sliceSteps;
-        *sendHead = sub->base + sub->posted - NCCL_STEPS;
-        if (resources->gdcSync) wc_store_fence(); // Flush out WC write
+        ncclGdcStore(resources->gdcSync, &resources->sendMem->head, sub->base + sub->posted - NCCL_STEPS);
       }
       // Enforce sync between operations of the same group.
       bool groupSync = (((s == 0) && ((sub+args->nsubs-1)->received == sub->received)) || (s && (sub-1)->received > sub->received));
@@ -730,6 +759,7 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
 }
 
 static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args) {
+  ncclGdcFlushScope gdcFlush;
   if (args->state == ncclProxyOpReady) {
     for (int s=0; s<args->nsubs; s++) {
       struct ncclProxySubArgs* sub = args->subs+s;
@@ -824,9 +854,7 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
         volatile int* offsFifo = (volatile int*)resources->recvMem->offsFifo;
         offsFifo[buffSlot] = offset + (s%COLLNET_GROUP_NSUBS)*args->chunkSize;
         __sync_synchronize();
-        volatile uint64_t* recvTail = resources->gdcSync ? resources->gdcSync : &resources->recvMem->tail;
-        *recvTail = sub->base + sub->flushed;
-        if (resources->gdcSync) wc_store_fence(); // Flush out WC write
+        ncclGdcStore(resources->gdcSync, &resources->recvMem->tail, sub->base + sub->flushed);
         sub->transmitted += args->sliceSteps;
         args->idle = 0;
         continue;
@@ -88,6 +88,18 @@ struct connectMap {
   } offsets;
 };
 
+// User buffers registered with the network for zero-copy p2p, see netRegGet()
+#define NET_REG_CACHE_SIZE 16
+struct netRegEntry {
+  uintptr_t base;
+  size_t size;
+  unsigned long long bufferId;
+  void* mhandle;
+  uint64_t lastUsed;
+  int pending;          // RCCL_NET_REG_ASYNC: the registration worker owns the entry
+  ncclResult_t result;  // Result of the asynchronous registration
+};
+
 struct sendResources {
   struct connectMap map;
   void* netSendComm;
@@ -101,17 +113,27 @@ struct sendResources {
   int useGdr;
   int useDmaBuf;
   int maxRecvs;
+  int trafficClass;
+  int serviceLevel;
   uint64_t* gdcSync;
   void* gdrDesc;
   int shared;
   int channelId;
   int connIndex;
+  uint32_t protoMask;               // Protocols with a dedicated buffer
   char* buffers[NCCL_NUM_PROTOCOLS];
   int buffSizes[NCCL_NUM_PROTOCOLS];
   void* mhandles[NCCL_NUM_PROTOCOLS];
   uint64_t step;
   uint64_t llLastCleaning;
   volatile uint32_t* curr_hdp_reg;  // Curr GPU in ring (for rdma transport use only)
+  struct netRegEntry regCache[NET_REG_CACHE_SIZE];
+  uint64_t regClock;
+  int compress;
+  char* compBuff;                   // Staging slots of the compressed SIMPLE steps, see netCompress()
+  void* compMhandle;
+  uint64_t compRawBytes;
+  uint64_t compWireBytes;
 };
 
 struct recvResources {
@@ -130,18 +152,29 @@ struct recvResources {
   int useDmaBuf;
   int needFlush;
   int maxRecvs;
+  int trafficClass;
+  int serviceLevel;
   uint64_t* gdcSync;
   uint64_t* gdcFlush;
   void* gdrDesc;
+  int flushBatch;
   int shared;
   int channelId;
   int connIndex;
+  uint32_t protoMask;               // Protocols with a dedicated buffer
   char* buffers[NCCL_NUM_PROTOCOLS];
   int buffSizes[NCCL_NUM_PROTOCOLS];
   void* mhandles[NCCL_NUM_PROTOCOLS];
   uint64_t step;
   uint64_t llLastCleaning;
   volatile uint32_t* curr_hdp_reg;  // Curr GPU in ring (for rdma transport use only)
+  struct netRegEntry regCache[NET_REG_CACHE_SIZE];
+  uint64_t regClock;
+  int compress;
+  char* compBuff;                   // Staging slots of the compressed SIMPLE steps, see netCompress()
+  void* compMhandle;
+  uint64_t compRawBytes;
+  uint64_t compWireBytes;
 };
 
 /* Determine if two peers can communicate with NET */
@@ -170,9 +203,17 @@ struct setupReq {
   int needFlush;
   int channelId;
   int connIndex;
+  int trafficClass;
+  int serviceLevel;
+  int compress;
+  uint32_t protoMask;
   uint32_t* curr_hdp_reg;
 };
 
+// QoS of the comm the proxy thread is currently connecting for, see net.h
+__thread int ncclNetTrafficClass = NCCL_CONFIG_UNDEF_INT;
+__thread int ncclNetServiceLevel = NCCL_CONFIG_UNDEF_INT;
+
 /* Determine if we will use this transport for this peer and return connect
  * information for this peer */
 static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclConnect* connectInfo, struct ncclConnector* send, int channelId, int connIndex) {
@@ -182,13 +223,19 @@ static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
   send->conn.shared = req.shared = (graph || mscclAvailable() && mscclIsCaller()) ? 0 : ncclParamNetSharedBuffers() != -2 ? ncclParamNetSharedBuffers() : 1;
   req.channelId = channelId;
   req.connIndex = connIndex;
+  req.protoMask = ncclConnProtoMask(comm, connIndex);
   req.curr_hdp_reg = 0;
   req.netDev = -1;
+  req.trafficClass = comm->config.trafficClass;
+  req.serviceLevel = comm->config.serviceLevel;
+  // Compressed steps are encoded by the proxy, so they must stay in host memory
+  req.compress = comm->config.netCompress == 1 && !req.shared;
 
   int proxyRank = myInfo->rank;
   if (connIndex == NCCL_CONN_IDX_P2P_NET) NCCLCHECK(ncclTopoGetIntraNetDev(comm->topo, myInfo->rank, graph, channelId, 1, &req.netDev));
   if (req.netDev < 0) NCCLCHECK(ncclTopoGetNetDev(comm, myInfo->rank, graph, channelId, peerInfo->rank, &req.netDev, &proxyRank));
   NCCLCHECK(ncclTopoCheckGdr(comm->topo, myInfo->busId, req.netDev, 1, &req.useGdr));
+  if (req.compress) req.useGdr = 0;
   send->conn.flags |= req.useGdr ? NCCL_DIRECT_NIC : 0;
   if (req.useGdr && !IsArchMatch(comm->topo->nodes[GPU].nodes[0].gpu.gcn, "gfx90a") && !IsArchMatch(comm->topo->nodes[GPU].nodes[0].gpu.gcn, "gfx94")) {
     CUDACHECK(hipDeviceGetAttribute((int*)&req.curr_hdp_reg, hipDeviceAttributeHdpMemFlushCntl, myInfo->cudaDev));
@@ -204,11 +251,11 @@ static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
   NCCLCHECK(ncclProxyCallBlocking(comm, &send->proxyConn, ncclProxyMsgSetup, &req, sizeof(req), NULL, 0));
 
   if (proxyRank == myInfo->rank) {
-    INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%lx] -> %d[%lx] [send] via NET/%s/%d%s%s comm %p nRanks %02d", channelId, connIndex, myInfo->rank, myInfo->busId, peerInfo->rank, peerInfo->busId, comm->ncclNet->name, req.netDev,
-        req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "", comm, comm->nRanks);
+    INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%lx] -> %d[%lx] [send] via NET/%s/%d%s%s%s comm %p nRanks %02d", channelId, connIndex, myInfo->rank, myInfo->busId, peerInfo->rank, peerInfo->busId, comm->ncclNet->name, req.netDev,
+        req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "", req.compress ? "/Compress" : "", comm, comm->nRanks);
   } else {
-    INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%lx] -> %d[%lx] [send] via NET/%s/%d(%d)%s%s comm %p nRanks %02d", channelId, connIndex, myInfo->rank, myInfo->busId, peerInfo->rank, peerInfo->busId, comm->ncclNet->name, req.netDev,
-        proxyRank, req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "", comm, comm->nRanks);
+    INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%lx] -> %d[%lx] [send] via NET/%s/%d(%d)%s%s%s comm %p nRanks %02d", channelId, connIndex, myInfo->rank, myInfo->busId, peerInfo->rank, peerInfo->busId, comm->ncclNet->name, req.netDev,
+        proxyRank, req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "", req.compress ? "/Compress" : "", comm, comm->nRanks);
   }
   *((int*)connectInfo) = tpProxyRank;
   return ncclSuccess;
@@ -218,6 +265,8 @@ static ncclResult_t sendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
 NCCL_PARAM(GdrCopySyncEnable, "GDRCOPY_SYNC_ENABLE", 1);
 // GDRCOPY support: FLUSH_ENABLE When enabled uses a PCI-E read to flush GDRDMA buffers
 NCCL_PARAM(GdrCopyFlushEnable, "GDRCOPY_FLUSH_ENABLE", 0);
+// Share one GDR flush between the receives completed on a NIC, see netFlushBatchJoin()
+RCCL_PARAM(NetFlushBatch, "NET_FLUSH_BATCH", 1);
 
 /* Setup recv connector */
 static ncclResult_t recvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, struct ncclConnect* connectInfo, struct ncclConnector* recv, int channelId, int connIndex) {
@@ -227,13 +276,20 @@ static ncclResult_t recvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
   recv->conn.shared = req.shared = (graph || mscclAvailable() && mscclIsCaller()) ? 0 : ncclParamNetSharedBuffers() != -2 ? ncclParamNetSharedBuffers() : 1;
   req.channelId = channelId;
   req.connIndex = connIndex;
+  req.protoMask = ncclConnProtoMask(comm, connIndex);
   req.netDev = -1;
+  req.trafficClass = comm->config.trafficClass;
+  req.serviceLevel = comm->config.serviceLevel;
+  req.compress = comm->config.netCompress == 1 && !req.shared;
 
   // Use myInfo->rank as the receiver uses its own NIC
   int proxyRank = myInfo->rank, tpProxyRank;
   if (connIndex == NCCL_CONN_IDX_P2P_NET) NCCLCHECK(ncclTopoGetIntraNetDev(comm->topo, myInfo->rank, graph, channelId, 0, &req.netDev));
   if (req.netDev < 0) NCCLCHECK(ncclTopoGetNetDev(comm, myInfo->rank, graph, channelId, myInfo->rank, &req.netDev, &proxyRank));
   NCCLCHECK(ncclTopoCheckGdr(comm->topo, myInfo->busId, req.netDev, 0, &req.useGdr));
+  if (req.compress) req.useGdr = 0;
+
+  recv->conn.flags |= req.useGdr ? NCCL_DIRECT_NIC : 0;
 
   // Determine whether we need to flush the GDR buffer on recv or not
   if (req.useGdr) NCCLCHECK(ncclTopoNeedFlush(comm->topo, myInfo->busId, &req.needFlush));
@@ -247,8 +303,8 @@ static ncclResult_t recvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph
   req.tpRank = comm->topParentRanks[myInfo->rank];
   req.tpRemoteRank = comm->topParentRanks[peerInfo->rank];
   NCCLCHECK(ncclProxyCallBlocking(comm, &recv->proxyConn, ncclProxyMsgSetup, &req, sizeof(req), connectInfo, sizeof(ncclNetHandle_t)));
-  INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%lx] -> %d[%lx] [receive] via NET/%s/%d%s%s comm %p nRanks %02d", channelId, connIndex, peerInfo->rank, peerInfo->busId, myInfo->rank, myInfo->busId, comm->ncclNet->name, req.netDev,
-      req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "", comm, comm->nRanks);
+  INFO(NCCL_INIT|NCCL_NET,"Channel %02d/%d : %d[%lx] -> %d[%lx] [receive] via NET/%s/%d%s%s%s comm %p nRanks %02d", channelId, connIndex, peerInfo->rank, peerInfo->busId, myInfo->rank, myInfo->busId, comm->ncclNet->name, req.netDev,
+      req.useGdr ? "/GDRDMA" : "", req.shared ? "/Shared" : "", req.compress ? "/Compress" : "", comm, comm->nRanks);
   return ncclSuccess;
 }
 
@@ -519,6 +575,122 @@ static ncclResult_t proxySharedInit(struct ncclProxyConnection* connection, stru
   return ncclSuccess;
 }
 
+/* On-wire compression (ncclConfig_t.netCompress, default RCCL_NET_COMPRESS).
+ *
+ * Sparse gradients and padded buffers carry long runs of zeros. When enabled,
+ * the SIMPLE buffers of ring/tree connections stay in host memory: the send
+ * proxy encodes each step into a registered staging slot and sends the slot,
+ * the receive proxy decodes it back into the step buffer before posting the
+ * tail to the GPU. The code works on 32-bit words, each run starts with a
+ * token giving its length, with the top bit set for a run of zero words, or
+ * clear for a run of literal words which follow the token. Steps which would
+ * not shrink are sent raw. All ranks must use the same setting.
+ */
+#define NET_COMPRESS_MAGIC 0x525aU
+#define NET_COMPRESS_RAW 0x1U
+#define NET_COMPRESS_ZERO_RUN 0x80000000U
+
+struct netCompressHeader {
+  uint32_t flags; // NET_COMPRESS_MAGIC << 16 | NET_COMPRESS_RAW when sent as is
+  uint32_t size;  // Size of the step before compression
+};
+
+static int netCompressSlotSize(int stepSize) {
+  return stepSize + sizeof(struct netCompressHeader);
+}
+
+// Encode nWords words into out, return the number of words written or -1 if
+// the code would not be smaller than the input.
+static int netCompressRuns(const uint32_t* in, int nWords, uint32_t* out) {
+  int o = 0;
+  for (int i=0; i<nWords; ) {
+    int start = i;
+    if (in[i] == 0) {
+      while (i < nWords && in[i] == 0) i++;
+      if (o == nWords) return -1;
+      out[o++] = NET_COMPRESS_ZERO_RUN | (i-start);
+    } else {
+      // Single zero words are cheaper inside a literal run than as their own run
+      while (i < nWords && (in[i] != 0 || (i+1 < nWords && in[i+1] != 0))) i++;
+      if (o+1+i-start > nWords) return -1;
+      out[o++] = i-start;
+      memcpy(out+o, in+start, (i-start)*sizeof(uint32_t));
+      o += i-start;
+    }
+  }
+  return o;
+}
+
+// Encode size bytes of src into the staging slot dst, return the number of bytes to send.
+static int netCompress(const char* src, int size, char* dst) {
+  struct netCompressHeader* hdr = (struct netCompressHeader*)dst;
+  char* payload = (char*)(hdr+1);
+  int nWords = size / sizeof(uint32_t);
+  int tail = size - nWords*sizeof(uint32_t);
+  int nOut = netCompressRuns((const uint32_t*)src, nWords, (uint32_t*)payload);
+  hdr->size = size;
+  if (nOut < 0) {
+    hdr->flags = NET_COMPRESS_MAGIC << 16 | NET_COMPRESS_RAW;
+    memcpy(payload, src, size);
+    return sizeof(struct netCompressHeader) + size;
+  }
+  hdr->flags = NET_COMPRESS_MAGIC << 16;
+  memcpy(payload+nOut*sizeof(uint32_t), src+nWords*sizeof(uint32_t), tail);
+  return sizeof(struct netCompressHeader) + nOut*sizeof(uint32_t) + tail;
+}
+
+// Decode a received slot of wireSize bytes into dst, return the decoded size
+// or -1 if the slot is malformed.
+static int netDecompress(const char* src, int wireSize, char* dst, int maxSize) {
+  const struct netCompressHeader* hdr = (const struct netCompressHeader*)src;
+  if (wireSize < (int)sizeof(struct netCompressHeader) || (hdr->flags >> 16) != NET_COMPRESS_MAGIC || hdr->size > (uint32_t)maxSize) return -1;
+  const char* payload = (const char*)(hdr+1);
+  int payloadSize = wireSize - sizeof(struct netCompressHeader);
+  int size = hdr->size;
+  if (hdr->flags & NET_COMPRESS_RAW) {
+    if (payloadSize != size) return -1;
+    memcpy(dst, payload, size);
+    return size;
+  }
+  int nWords = size / sizeof(uint32_t);
+  int tail = size - nWords*sizeof(uint32_t);
+  if (payloadSize < tail || (payloadSize-tail) % sizeof(uint32_t)) return -1;
+  const uint32_t* in = (const uint32_t*)payload;
+  uint32_t* out = (uint32_t*)dst;
+  int nIn = (payloadSize-tail) / sizeof(uint32_t);
+  int i = 0, o = 0;
+  while (o < nWords) {
+    if (i == nIn) return -1;
+    uint32_t token = in[i++];
+    int n = token & ~NET_COMPRESS_ZERO_RUN;
+    if (n == 0 || n > nWords-o) return -1;
+    if (token & NET_COMPRESS_ZERO_RUN) {
+      memset(out+o, 0, n*sizeof(uint32_t));
+    } else {
+      if (n > nIn-i) return -1;
+      memcpy(out+o, in+i, n*sizeof(uint32_t));
+      i += n;
+    }
+    o += n;
+  }
+  if (i != nIn) return -1;
+  memcpy(dst+nWords*sizeof(uint32_t), in+i, tail);
+  return size;
+}
+
+static ncclResult_t netCompressInit(struct ncclProxyState* proxyState, void* netComm, int buffSize, char** compBuff, void** compMhandle) {
+  int size = NCCL_STEPS*netCompressSlotSize(buffSize/NCCL_STEPS);
+  NCCLCHECK(ncclCalloc(compBuff, size));
+  NCCLCHECK(proxyState->ncclNet->regMr(netComm, *compBuff, size, NCCL_PTR_HOST, compMhandle));
+  return ncclSuccess;
+}
+
+static void netCompressReport(const char* dir, int channelId, int peer, uint64_t rawBytes, uint64_t wireBytes) {
+  if (rawBytes == 0) return;
+  INFO(NCCL_NET, "NET/Compress : channel %02d %s peer %d : %lu bytes as %lu on the wire, ratio %.2f",
+      channelId, dir, peer, rawBytes, wireBytes, (double)rawBytes/wireBytes);
+}
+
 static ncclResult_t sendProxySetup(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
   struct setupReq* req = (struct setupReq*) reqBuff;
   if (reqSize != sizeof(struct setupReq)) return ncclInternalError;
@@ -535,6 +707,10 @@ static ncclResult_t sendProxySetup(struct ncclProxyConnection* connection, struc
   resources->useGdr = req->useGdr;
   resources->channelId = req->channelId;
   resources->connIndex = req->connIndex;
+  resources->protoMask = req->protoMask;
+  resources->trafficClass = req->trafficClass;
+  resources->serviceLevel = req->serviceLevel;
+  resources->compress = req->compress;
   resources->curr_hdp_reg = req->curr_hdp_reg;
   ncclNetProperties_t props;
   NCCLCHECK(proxyState->ncclNet->getProperties(req->netDev, &props));
@@ -565,6 +741,10 @@ static ncclResult_t recvProxySetup(struct ncclProxyConnection* connection, struc
   resources->needFlush = req->needFlush;
   resources->channelId = req->channelId;
   resources->connIndex = req->connIndex;
+  resources->protoMask = req->protoMask;
+  resources->trafficClass = req->trafficClass;
+  resources->serviceLevel = req->serviceLevel;
+  resources->compress = req->compress;
   ncclNetProperties_t props;
   NCCLCHECK(proxyState->ncclNet->getProperties(req->netDev, &props));
   /* DMA-BUF support */
@@ -578,10 +758,45 @@ static ncclResult_t recvProxySetup(struct ncclProxyConnection* connection, struc
   return ncclSuccess;
 }
 
+// Batched network calls (net API v7). Plugins without them (v6 and older), or without one of
+// them, get the calls one by one.
+static ncclResult_t netIsendv(ncclNet_t* net, int n, void** comms, void** data, int* sizes, int* tags, void** mhandles, void** requests) {
+  if (n == 0) return ncclSuccess;
+  if (net->isendv) return net->isendv(n, comms, data, sizes, tags, mhandles, requests);
+  for (int i=0; i<n; i++) NCCLCHECK(net->isend(comms[i], data[i], sizes[i], tags[i], mhandles[i], requests+i));
+  return ncclSuccess;
+}
+
+static ncclResult_t netIrecvv(ncclNet_t* net, int n, void** comms, int* nRecvs, void** data, int* sizes, int* tags, void** mhandles, void** requests) {
+  if (n == 0) return ncclSuccess;
+  if (net->irecvv) return net->irecvv(n, comms, nRecvs, data, sizes, tags, mhandles, requests);
+  for (int i=0, r=0; i<n; r+=nRecvs[i++]) NCCLCHECK(net->irecv(comms[i], nRecvs[i], data+r, sizes+r, tags+r, mhandles+r, requests+i));
+  return ncclSuccess;
+}
+
+static ncclResult_t netTestSome(ncclNet_t* net, int n, void** requests, int* done, int** sizes) {
+  if (n == 0) return ncclSuccess;
+  if (net->testSome) return net->testSome(n, requests, done, sizes);
+  for (int i=0; i<n; i++) {
+    done[i] = 0;
+    if (requests[i]) NCCLCHECK(net->test(requests[i], done+i, sizes ? sizes[i] : NULL));
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t netRegMrv(ncclNet_t* net, int n, void** comms, void** data, size_t* sizes, int* types, void** mhandles) {
+  if (n == 0) return ncclSuccess;
+  if (net->regMrv) return net->regMrv(n, comms, data, sizes, types, mhandles);
+  for (int i=0; i<n; i++) NCCLCHECK(net->regMr(comms[i], data[i], sizes[i], types[i], mhandles+i));
+  return ncclSuccess;
+}
+
 static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
   struct sendResources* resources = (struct sendResources*)(connection->transportResources);
   if (reqSize != sizeof(ncclNetHandle_t)) return ncclInternalError;
   ncclResult_t ret = ncclSuccess;
+  ncclNetTrafficClass = resources->trafficClass;
+  ncclNetServiceLevel = resources->serviceLevel;
 
   if (resources->shared) {
     // Shared buffers
@@ -628,6 +843,7 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
 
   if (resources->shared == 0) { // Only allocate dedicated buffers for ring/tree, not for p2p
     for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      if (!(resources->protoMask & (1<<p))) continue;
       NCCL_NET_MAP_ADD_POINTER(map, 0, p!= NCCL_PROTO_LL && resources->useGdr, proxyState->buffSizes[p], buffs[p]);
       resources->buffSizes[p] = proxyState->buffSizes[p];
     }
@@ -683,10 +899,21 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
   resources->sendMem = (struct ncclSendMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, sendMem);
   resources->recvMem = (struct ncclRecvMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, recvMem);
 
-  // Don't give credits yet in shared mode.
+  // Don't give credits yet in shared mode. The GPU reads the head from GDR memory when there is some.
   resources->sendMem->head = map->shared ? -NCCL_STEPS : 0;
+  if (resources->gdcSync) {
+    *resources->gdcSync = resources->sendMem->head;
+    wc_store_fence(); // Flush out WC write
+  }
   for (int i=0; i<NCCL_STEPS; i++) resources->recvMem->sizesFifo[i] = -1;
 
+  int nRegs = 0;
+  int regProtos[NCCL_NUM_PROTOCOLS];
+  void* regComms[NCCL_NUM_PROTOCOLS];
+  void* regData[NCCL_NUM_PROTOCOLS];
+  size_t regSizes[NCCL_NUM_PROTOCOLS];
+  int regTypes[NCCL_NUM_PROTOCOLS];
+  void* regMhandles[NCCL_NUM_PROTOCOLS];
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
     resources->buffers[p] = NCCL_NET_MAP_GET_POINTER(map, cpu, buffs[p]);
     if (resources->buffers[p]) {
@@ -713,10 +940,20 @@ static ncclResult_t sendProxyConnect(struct ncclProxyConnection* connection, str
       } else // FALL-THROUGH to nv_peermem GDR path
 #endif
       {
-        NCCLCHECK(proxyState->ncclNet->regMr(resources->netSendComm, resources->buffers[p], resources->buffSizes[p], NCCL_NET_MAP_DEV_MEM(map, buffs[p]) ? NCCL_PTR_CUDA : NCCL_PTR_HOST, &resources->mhandles[p]));
+        // Registered below along with the buffers of the other protocols
+        regProtos[nRegs] = p;
+        regComms[nRegs] = resources->netSendComm;
+        regData[nRegs] = resources->buffers[p];
+        regSizes[nRegs] = resources->buffSizes[p];
+        regTypes[nRegs++] = NCCL_NET_MAP_DEV_MEM(map, buffs[p]) ? NCCL_PTR_CUDA : NCCL_PTR_HOST;
       }
     }
   }
+  NCCLCHECK(netRegMrv(proxyState->ncclNet, nRegs, regComms, regData, regSizes, regTypes, regMhandles));
+  for (int r=0; r<nRegs; r++) resources->mhandles[regProtos[r]] = regMhandles[r];
+  if (resources->compress) {
+    NCCLCHECK(netCompressInit(proxyState, resources->netSendComm, resources->buffSizes[NCCL_PROTO_SIMPLE], &resources->compBuff, &resources->compMhandle));
+  }
 
   //NCCLCHECK(netDumpMap(map));
   if (respSize != sizeof(struct connectMap)) return ncclInternalError;
@@ -729,6 +966,8 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
   struct recvResources* resources = (struct recvResources*)(connection->transportResources);
   resources->tpRemoteProxyRank = *(int*)reqBuff;
   ncclResult_t ret = ncclSuccess;
+  ncclNetTrafficClass = resources->trafficClass;
+  ncclNetServiceLevel = resources->serviceLevel;
 
   // Finish connection establishment from remote peer
   if (resources->shared) {
@@ -778,6 +1017,7 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
 
   if (resources->shared == 0) { // Only allocate dedicated buffers for ring/tree, not for p2p
     for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      if (!(resources->protoMask & (1<<p))) continue;
       NCCL_NET_MAP_ADD_POINTER(map, 0, resources->useGdr, proxyState->buffSizes[p], buffs[p]);
       resources->buffSizes[p] = proxyState->buffSizes[p];
     }
@@ -826,9 +1066,18 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
     }
     if (ncclParamGdrCopyFlushEnable()) resources->gdcFlush = cpuPtr + 1;
   }
+  // Flushes can only be shared when they are a PCI-E read, see netFlushBatchJoin()
+  resources->flushBatch = rcclParamNetFlushBatch() && (resources->gdcFlush || strcmp(proxyState->ncclNet->name, "IB") == 0);
 
   resources->sendMem = (struct ncclSendMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, sendMem);
   resources->recvMem = (struct ncclRecvMem*) NCCL_NET_MAP_GET_POINTER(map, cpu, recvMem);
+  int nRegs = 0;
+  int regProtos[NCCL_NUM_PROTOCOLS];
+  void* regComms[NCCL_NUM_PROTOCOLS];
+  void* regData[NCCL_NUM_PROTOCOLS];
+  size_t regSizes[NCCL_NUM_PROTOCOLS];
+  int regTypes[NCCL_NUM_PROTOCOLS];
+  void* regMhandles[NCCL_NUM_PROTOCOLS];
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
     resources->buffers[p] = NCCL_NET_MAP_GET_POINTER(map, cpu, buffs[p]);
     if (resources->buffers[p]) {
@@ -855,10 +1104,20 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
       } else // FALL-THROUGH to nv_peermem GDR path
 #endif
       {
-        NCCLCHECK(proxyState->ncclNet->regMr(resources->netRecvComm, resources->buffers[p], resources->buffSizes[p], NCCL_NET_MAP_DEV_MEM(map, buffs[p]) ? NCCL_PTR_CUDA : NCCL_PTR_HOST, &resources->mhandles[p]));
+        // Registered below along with the buffers of the other protocols
+        regProtos[nRegs] = p;
+        regComms[nRegs] = resources->netRecvComm;
+        regData[nRegs] = resources->buffers[p];
+        regSizes[nRegs] = resources->buffSizes[p];
+        regTypes[nRegs++] = NCCL_NET_MAP_DEV_MEM(map, buffs[p]) ? NCCL_PTR_CUDA : NCCL_PTR_HOST;
       }
     }
   }
+  NCCLCHECK(netRegMrv(proxyState->ncclNet, nRegs, regComms, regData, regSizes, regTypes, regMhandles));
+  for (int r=0; r<nRegs; r++) resources->mhandles[regProtos[r]] = regMhandles[r];
+  if (resources->compress) {
+    NCCLCHECK(netCompressInit(proxyState, resources->netRecvComm, resources->buffSizes[NCCL_PROTO_SIMPLE], &resources->compBuff, &resources->compMhandle));
+  }
 
   //NCCLCHECK(netDumpMap(map));
   if (respSize != sizeof(struct connectMap)) return ncclInternalError;
@@ -866,6 +1125,176 @@ static ncclResult_t recvProxyConnect(struct ncclProxyConnection* connection, str
   return ncclSuccess;
 }
 
+static ncclResult_t netRegRegister(ncclNet_t* net, void* netComm, int useDmaBuf, void* base, size_t baseSize, void** mhandle) {
+  if (useDmaBuf && pfn_hsa_amd_portable_export_dmabuf) {
+    int dmabuf_fd;
+    uint64_t offset;
+    CUCHECK(hsa_amd_portable_export_dmabuf((const void*)base, baseSize, &dmabuf_fd, &offset));
+    ncclResult_t res = net->regMrDmaBuf(netComm, base, baseSize, NCCL_PTR_CUDA, offset, dmabuf_fd, mhandle);
+    (void)close(dmabuf_fd);
+    NCCLCHECK(res);
+  } else {
+    NCCLCHECK(net->regMr(netComm, base, (int)baseSize, NCCL_PTR_CUDA, mhandle));
+  }
+  TRACE(NCCL_NET, "Registered user buffer %p size %ld for zero-copy", base, baseSize);
+  return ncclSuccess;
+}
+
+// With RCCL_NET_REG_ASYNC, registrations of user buffers run on a background
+// worker so that pinning a new buffer does not stall the other channels of the
+// progress thread. The entry stays pending until the worker is done with it.
+RCCL_PARAM(NetRegAsync, "NET_REG_ASYNC", 0);
+
+struct netRegJob {
+  struct netRegJob* next;
+  ncclNet_t* net;
+  void* netComm;
+  int useDmaBuf;
+  struct netRegEntry* entry;
+};
+
+static pthread_mutex_t netRegJobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netRegJobCond = PTHREAD_COND_INITIALIZER;
+static struct netRegJob* netRegJobHead = NULL;
+static struct netRegJob* netRegJobTail = NULL;
+static pthread_t netRegThread;
+static int netRegThreadStarted = 0;
+
+static void* netRegWorker(void* arg) {
+  while (1) {
+    pthread_mutex_lock(&netRegJobLock);
+    while (netRegJobHead == NULL) pthread_cond_wait(&netRegJobCond, &netRegJobLock);
+    struct netRegJob* job = netRegJobHead;
+    netRegJobHead = job->next;
+    if (netRegJobHead == NULL) netRegJobTail = NULL;
+    pthread_mutex_unlock(&netRegJobLock);
+
+    struct netRegEntry* e = job->entry;
+    e->result = netRegRegister(job->net, job->netComm, job->useDmaBuf, (void*)e->base, e->size, &e->mhandle);
+    if (e->result != ncclSuccess) e->mhandle = NULL;
+    __atomic_store_n(&e->pending, 0, __ATOMIC_RELEASE);
+    free(job);
+  }
+  return NULL;
+}
+
+static ncclResult_t netRegEnqueue(ncclNet_t* net, void* netComm, int useDmaBuf, struct netRegEntry* e) {
+  struct netRegJob* job;
+  NCCLCHECK(ncclCalloc(&job, 1));
+  job->net = net;
+  job->netComm = netComm;
+  job->useDmaBuf = useDmaBuf;
+  job->entry = e;
+  e->pending = 1;
+  pthread_mutex_lock(&netRegJobLock);
+  if (netRegThreadStarted == 0) {
+    if (pthread_create(&netRegThread, NULL, netRegWorker, NULL) != 0) {
+      pthread_mutex_unlock(&netRegJobLock);
+      e->pending = 0;
+      free(job);
+      WARN("Unable to create the user buffer registration thread");
+      return ncclSystemError;
+    }
+    ncclSetThreadName(netRegThread, "NCCL NetReg");
+    pthread_detach(netRegThread); // will not be pthread_join()'d
+    netRegThreadStarted = 1;
+  }
+  if (netRegJobTail) netRegJobTail->next = job; else netRegJobHead = job;
+  netRegJobTail = job;
+  pthread_cond_signal(&netRegJobCond);
+  pthread_mutex_unlock(&netRegJobLock);
+  return ncclSuccess;
+}
+
+// Returns the network handle of the user buffer holding [buff, buff+size).
+// The whole allocation is registered so other offsets hit the same entry,
+// the buffer id tells a reallocation at the same address apart.
+// Returns ncclInProgress while an asynchronous registration is running.
+static ncclResult_t netRegGet(struct ncclProxyState* proxyState, void* netComm, int useDmaBuf, struct netRegEntry* cache, uint64_t* clock,
+    void* buff, size_t size, void** mhandle) {
+  void* base;
+  size_t baseSize;
+  unsigned long long bufferId;
+  CUDACHECK(hipMemGetAddressRange(&base, &baseSize, buff));
+  CUDACHECK(hipPointerGetAttribute(&bufferId, HIP_POINTER_ATTRIBUTE_BUFFER_ID, (hipDeviceptr_t)buff));
+  if (baseSize > INT_MAX) { // regMr takes an int size, only register what we need
+    base = buff;
+    baseSize = size;
+  }
+
+  (*clock)++;
+  struct netRegEntry* lru = NULL;
+  for (int i=0; i<NET_REG_CACHE_SIZE; i++) {
+    struct netRegEntry* e = cache+i;
+    int pending = __atomic_load_n(&e->pending, __ATOMIC_ACQUIRE);
+    if ((e->mhandle || pending || e->result != ncclSuccess) && e->bufferId == bufferId && e->base == (uintptr_t)base && e->size == baseSize) {
+      e->lastUsed = *clock;
+      if (pending) return ncclInProgress;
+      if (e->result != ncclSuccess) {
+        ncclResult_t res = e->result;
+        e->result = ncclSuccess;
+        e->base = 0;
+        return res;
+      }
+      *mhandle = e->mhandle;
+      return ncclSuccess;
+    }
+    if (!pending && (lru == NULL || e->lastUsed < lru->lastUsed)) lru = e;
+  }
+  if (lru == NULL) return ncclInProgress; // Every entry is being registered
+  if (lru->mhandle) {
+    NCCLCHECK(proxyState->ncclNet->deregMr(netComm, lru->mhandle));
+    lru->mhandle = NULL;
+  }
+  lru->base = (uintptr_t)base;
+  lru->size = baseSize;
+  lru->bufferId = bufferId;
+  lru->lastUsed = *clock;
+  lru->result = ncclSuccess;
+  if (rcclParamNetRegAsync()) {
+    NCCLCHECK(netRegEnqueue(proxyState->ncclNet, netComm, useDmaBuf, lru));
+    return ncclInProgress;
+  }
+  ncclResult_t res = netRegRegister(proxyState->ncclNet, netComm, useDmaBuf, base, baseSize, &lru->mhandle);
+  if (res != ncclSuccess) {
+    lru->mhandle = NULL;
+    lru->base = 0;
+    return res;
+  }
+  *mhandle = lru->mhandle;
+  return ncclSuccess;
+}
+
+// Starts registering the user buffers of an op as soon as the proxy sees it,
+// rather than when each sub gets its turn
+static void netRegPrefetch(struct ncclProxyState* proxyState, struct ncclProxyArgs* args, int send) {
+  if (!rcclParamNetRegAsync()) return;
+  for (int s=0; s<args->nsubs; s++) {
+    struct ncclProxySubArgs* sub = args->subs+s;
+    if (!sub->reg || sub->regMhandle) continue;
+    ncclResult_t res;
+    if (send) {
+      struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
+      res = netRegGet(proxyState, resources->netSendComm, resources->useDmaBuf, resources->regCache, &resources->regClock, sub->regBuff, sub->nbytes, &sub->regMhandle);
+    } else {
+      struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
+      res = netRegGet(proxyState, resources->netRecvComm, resources->useDmaBuf, resources->regCache, &resources->regClock, sub->regBuff, sub->nbytes, &sub->regMhandle);
+    }
+    // Errors are reported again when the sub itself asks for the handle
+    if (res != ncclSuccess) sub->regMhandle = NULL;
+  }
+}
+
+static ncclResult_t netRegFree(struct ncclProxyState* proxyState, void* netComm, struct netRegEntry* cache) {
+  for (int i=0; i<NET_REG_CACHE_SIZE; i++) {
+    // Wait for the worker, it may still use netComm
+    while (__atomic_load_n(&cache[i].pending, __ATOMIC_ACQUIRE)) sched_yield();
+    if (cache[i].mhandle) NCCLCHECK(proxyState->ncclNet->deregMr(netComm, cache[i].mhandle));
+    cache[i].mhandle = NULL;
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t sendProxyFree(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState) {
   struct sendResources* resources = (struct sendResources*)(connection->transportResources);
   if (connection->state == connSharedInitialized) { // NVB Preconnect
@@ -879,6 +1308,12 @@ static ncclResult_t sendProxyFree(struct ncclProxyConnection* connection, struct
         NCCLCHECK(proxyState->ncclNet->deregMr(resources->netSendComm, resources->mhandles[p]));
       }
     }
+    if (resources->compBuff) {
+      netCompressReport("send to", resources->channelId, resources->tpRemoteRank, resources->compRawBytes, resources->compWireBytes);
+      NCCLCHECK(proxyState->ncclNet->deregMr(resources->netSendComm, resources->compMhandle));
+      free(resources->compBuff);
+    }
+    NCCLCHECK(netRegFree(proxyState, resources->netSendComm, resources->regCache));
     struct connectMapMem* mems = resources->map.mems;
     if (resources->map.sameProcess) {
       NCCLCHECK(ncclCudaHostFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr));
@@ -924,6 +1359,12 @@ static ncclResult_t recvProxyFree(struct ncclProxyConnection* connection, struct
         NCCLCHECK(proxyState->ncclNet->deregMr(resources->netRecvComm, resources->mhandles[p]));
       }
     }
+    if (resources->compBuff) {
+      netCompressReport("receive from", resources->channelId, resources->tpRemoteRank, resources->compRawBytes, resources->compWireBytes);
+      NCCLCHECK(proxyState->ncclNet->deregMr(resources->netRecvComm, resources->compMhandle));
+      free(resources->compBuff);
+    }
+    NCCLCHECK(netRegFree(proxyState, resources->netRecvComm, resources->regCache));
     struct connectMapMem* mems = resources->map.mems;
     NCCLCHECK(ncclCudaHostFree(mems[NCCL_NET_MAP_HOSTMEM].cpuPtr));
     NCCLCHECK(ncclCudaFree(mems[NCCL_NET_MAP_DEVMEM].cpuPtr));
@@ -958,7 +1399,103 @@ static_assert(NCCL_STEPS <= NCCL_NET_MAX_REQUESTS, "Not enough net requests to c
 static int g_npkit_net_poll_cnt = 0;
 #endif
 
+RCCL_PARAM(NetCoalesceSteps, "NET_COALESCE_STEPS", 1);
+
+// Adjacent SIMPLE p2p steps are contiguous in a non-shared buffer when every
+// step fills its slot, so they can travel as one network message. Both sides
+// derive the same factor from the connection and the op; 1 means disabled.
+// Compressed steps are encoded one by one, so they are never coalesced.
+static int netCoalesceFactor(struct ncclProxyArgs* args, int stepSize, int shared, int compress) {
+  int coalesce = std::min((int)rcclParamNetCoalesceSteps(), NCCL_STEPS);
+  if (coalesce <= 1 || shared || compress || args->protocol != NCCL_PROTO_SIMPLE || args->sliceSteps != 1 || args->chunkSize != stepSize ||
+      (args->pattern != ncclPatternSend && args->pattern != ncclPatternRecv)) return 1;
+  while (NCCL_STEPS % coalesce) coalesce--; // Groups must not wrap around the buffer
+  return coalesce;
+}
+
+// Number of steps starting at step carried by the same network message.
+// Groups are aligned on the factor so they never wrap around the buffer.
+static int netCoalesceSteps(struct ncclProxyArgs* args, struct ncclProxySubArgs* sub, int coalesce, uint64_t step) {
+  if (coalesce == 1) return args->sliceSteps;
+  int nSteps = coalesce - (sub->base+step) % coalesce;
+  return std::min<uint64_t>(nSteps, sub->nsteps-step);
+}
+
+// Zero-copy send of a user buffer, see addP2pToPlan(). The kernel only runs
+// two empty steps: step 0 tells us the buffer is ready, step 1 is posted once
+// the network is done with it. posted/received count these kernel steps,
+// transmitted/done count the nsteps network messages.
+#define NET_REG_SEND_KERNEL_STEPS 2
+// A send of the GPU data of one sub, handed to the network along with the sends of the other
+// subs once they have all been looked at
+struct sendPost {
+  int s;
+  int buffSlot;
+  int nSteps;
+  int coalesced;
+  int rawSize; // Size before compression, -1 if not compressed
+};
+
+static ncclResult_t sendProxyProgressReg(struct ncclProxyState* proxyState, struct ncclProxyArgs* args, struct ncclProxySubArgs* sub, int s) {
+  struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
+  volatile uint64_t* recvTail = &resources->recvMem->tail;
+  if (sub->regMhandle == NULL) {
+    ncclResult_t res = netRegGet(proxyState, resources->netSendComm, resources->useDmaBuf, resources->regCache, &resources->regClock,
+          sub->regBuff, sub->nbytes, &sub->regMhandle);
+    if (res == ncclInProgress) return ncclSuccess;
+    NCCLCHECK(res);
+  }
+  int toPost = sub->done == sub->nsteps ? NET_REG_SEND_KERNEL_STEPS : 1;
+  if (sub->posted < toPost) {
+    int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
+    resources->recvMem->offsFifo[buffSlot] = 0;
+    __sync_synchronize();
+    sub->posted++;
+    ncclGdcStore(resources->gdcSync, &resources->sendMem->head, sub->base + sub->posted - NCCL_STEPS);
+    args->idle = 0;
+    return ncclSuccess;
+  }
+  if (sub->transmitted < sub->nsteps && sub->transmitted < sub->done + NCCL_STEPS && *recvTail > sub->base) {
+    int slot = sub->transmitted%NCCL_STEPS;
+    ssize_t offset = sub->transmitted*sub->regChunkSize;
+    int size = std::min<ssize_t>(sub->regChunkSize, sub->nbytes-offset);
+    if (resources->curr_hdp_reg && args->hdp_flushed < *recvTail) {
+      args->hdp_flushed = *recvTail;
+      *resources->curr_hdp_reg = 1;
+    }
+    NCCLCHECK(proxyState->ncclNet->isend(resources->netSendComm, (char*)sub->regBuff+offset, size, resources->tpRank, sub->regMhandle, sub->requests+slot));
+    if (sub->requests[slot] != NULL) {
+      TRACE(NCCL_NET, "sendProxy [%ld/%d] Isend of user buffer posted, req %p", sub->transmitted, slot, sub->requests[slot]);
+      ncclProfilingRecord(args, s, sub->transmitted, ncclProxyProfileSendWait);
+      sub->transmitted++;
+      args->idle = 0;
+      return ncclSuccess;
+    }
+  }
+  if (sub->done < sub->transmitted) {
+    int done;
+    int slot = sub->done%NCCL_STEPS;
+    NCCLCHECK(proxyState->ncclNet->test(sub->requests[slot], &done, NULL));
+    if (done) {
+      TRACE(NCCL_NET, "sendProxy [%ld/%d] user buffer request %p done", sub->done, slot, sub->requests[slot]);
+      ncclProfilingRecord(args, s, sub->done, ncclProxyProfileEnd);
+      sub->done++;
+      args->idle = 0;
+    }
+    return ncclSuccess;
+  }
+  if (sub->posted == NET_REG_SEND_KERNEL_STEPS && *recvTail >= sub->base + NET_REG_SEND_KERNEL_STEPS) {
+    for (int i=0; i<NET_REG_SEND_KERNEL_STEPS; i++) resources->recvMem->sizesFifo[(sub->base+i)%NCCL_STEPS] = -1;
+    sub->received = NET_REG_SEND_KERNEL_STEPS;
+    resources->step = sub->base + NET_REG_SEND_KERNEL_STEPS;
+    args->done++;
+    args->idle = 0;
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args) {
+  ncclGdcFlushScope gdcFlush;
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
   g_npkit_net_poll_cnt++;
 #endif
@@ -968,9 +1505,10 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
       struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
       // Round to next multiple of sliceSteps
       sub->base = ROUNDUP(resources->step, args->chunkSteps);
-      sub->posted = sub->transmitted = sub->done = 0;
+      sub->posted = sub->received = sub->transmitted = sub->done = 0;
       for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileBegin);
     }
+    netRegPrefetch(proxyState, args, 1);
     args->state = ncclProxyOpProgress;
     args->hdp_flushed = 0;
   }
@@ -978,8 +1516,103 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
   if (args->state == ncclProxyOpProgress) {
     int p = args->protocol;
     int maxDepth = std::min(NCCL_STEPS, NCCL_SHARED_STEPS/args->nsubs);
+    // Check whether the network has completed some send operations, testing the oldest send of
+    // every sub at once.
+    int nTests = 0;
+    int testSubs[NCCL_PROXY_MAX_SUBS];
+    void* testRequests[NCCL_PROXY_MAX_SUBS];
+    int testDone[NCCL_PROXY_MAX_SUBS];
+    for (int s=0; s<args->nsubs; s++) {
+      struct ncclProxySubArgs* sub = args->subs+s;
+      if (sub->reg || sub->done == sub->nsteps || sub->done >= sub->transmitted) continue;
+      int buffSlot = (sub->base+sub->done)%NCCL_STEPS;
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_SEND_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_SEND_EXIT)
+      if (sub->timestamp[buffSlot] == 0)
+        sub->timestamp[buffSlot] = *(volatile uint64_t*)NpKit::GetCpuTimestamp();
+#endif
+      testSubs[nTests] = s;
+      testRequests[nTests++] = sub->requests[buffSlot];
+    }
+    NCCLCHECK(netTestSome(proxyState->ncclNet, nTests, testRequests, testDone, NULL));
+    for (int t=0; t<nTests; t++) {
+      if (!testDone[t]) continue;
+      int s = testSubs[t];
+      struct ncclProxySubArgs* sub = args->subs+s;
+      struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
+      int coalesce = netCoalesceFactor(args, resources->buffSizes[p] / NCCL_STEPS, resources->shared, resources->compress);
+      int buffSlot = (sub->base+sub->done)%NCCL_STEPS;
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_SEND_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_SEND_EXIT)
+      NpKit::CollectCpuEvent(
+          NPKIT_EVENT_NET_SEND_EXIT,
+#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
+          g_npkit_net_poll_cnt,
+#else
+          sub->npKitSizesFifo[buffSlot],
+#endif
+          uint64_t(sub->requests+buffSlot)/sizeof(void*),
+          sub->timestamp[buffSlot], sub->channelId);
+#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
+      g_npkit_net_poll_cnt = 0;
+#endif
+#endif
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_TEST_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_TEST_EXIT)
+      NpKit::CollectCpuEvent(
+          NPKIT_EVENT_NET_TEST_ENTRY,
+#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
+          g_npkit_net_poll_cnt,
+#else
+          sub->npKitSizesFifo[buffSlot],
+#endif
+          uint64_t(sub->requests+buffSlot)/sizeof(void*),
+          sub->timestamp[buffSlot], sub->channelId);
+#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
+      g_npkit_net_poll_cnt = 0;
+#endif
+#endif
+#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_TEST_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_TEST_EXIT)
+      NpKit::CollectCpuEvent(
+          NPKIT_EVENT_NET_TEST_EXIT,
+#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
+          g_npkit_net_poll_cnt,
+#else
+          sub->npKitSizesFifo[buffSlot],
+#endif
+          uint64_t(sub->requests+buffSlot)/sizeof(void*),
+          *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
+#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
+      g_npkit_net_poll_cnt = 0;
+#endif
+#endif
+
+      TRACE(NCCL_NET, "sendProxy [%ld/%d] request %p done", sub->done, buffSlot, sub->requests[buffSlot]);
+      int nDone = netCoalesceSteps(args, sub, coalesce, sub->done);
+      sub->done += nDone;
+      for (uint64_t step=sub->done-nDone; step<sub->done; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileEnd);
+
+      if (resources->shared == 0) {
+        ncclGdcStore(resources->gdcSync, &resources->sendMem->head, sub->base + sub->done);
+      }
+      args->idle = 0;
+      if (sub->done == sub->nsteps) {
+        resources->step = sub->base + sub->nsteps;
+        args->done++;
+      }
+    }
+
+    int nPosts = 0;
+    struct sendPost posts[NCCL_PROXY_MAX_SUBS];
+    void* postComms[NCCL_PROXY_MAX_SUBS];
+    void* postData[NCCL_PROXY_MAX_SUBS];
+    int postSizes[NCCL_PROXY_MAX_SUBS];
+    int postTags[NCCL_PROXY_MAX_SUBS];
+    void* postMhandles[NCCL_PROXY_MAX_SUBS];
+    void* postRequests[NCCL_PROXY_MAX_SUBS];
     for (int s=0; s<args->nsubs; s++) {
       struct ncclProxySubArgs* sub = args->subs+s;
+      if (sub->reg) {
+        if (sub->received < NET_REG_SEND_KERNEL_STEPS) NCCLCHECK(sendProxyProgressReg(proxyState, args, sub, s));
+        continue;
+      }
       if (sub->done == sub->nsteps) continue;
       struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
       void* mhandle = resources->mhandles[p];
@@ -987,8 +1620,10 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
       char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
       int buffSize = stepSize*args->sliceSteps;
       if (sub->nbytes < buffSize) buffSize = sub->nbytes;
-      // Post buffers to the GPU
-      if (sub->posted < sub->nsteps && sub->posted < sub->done + maxDepth) {
+      int coalesce = netCoalesceFactor(args, stepSize, resources->shared, resources->compress);
+      // Post buffers to the GPU. Without shared buffers the GPU is only held back by the head,
+      // let it fill the whole buffer so coalesced groups can complete.
+      if (sub->posted < sub->nsteps && sub->posted < sub->done + (coalesce > 1 ? NCCL_STEPS : maxDepth)) {
         int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
         if (resources->shared) {
           int sharedBuffSlot = sub->posted%maxDepth;
@@ -996,10 +1631,8 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
           NCCLCHECK(sharedBuffersGet(proxyState, sub->channelId, sharedBuffSlot*args->nsubs+s, &offset));
           resources->recvMem->offsFifo[buffSlot] = offset;
           __sync_synchronize();
-          volatile uint64_t* sendHead = resources->gdcSync ? resources->gdcSync : &resources->sendMem->head;
           sub->posted += args->sliceSteps;
-          *sendHead = sub->base + sub->posted - NCCL_STEPS;
-          if (resources->gdcSync) wc_store_fence(); // Flush out WC write
+          ncclGdcStore(resources->gdcSync, &resources->sendMem->head, sub->base + sub->posted - NCCL_STEPS);
         } else sub->posted += args->sliceSteps;
         for (uint64_t step=sub->posted-args->sliceSteps; step<sub->posted; step++) {
           ncclProfilingRecord(args, s, step, ncclProxyProfileSendGPUWait);
@@ -1007,11 +1640,36 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
         args->idle = 0;
         continue;
       }
+      // Send a group of adjacent steps from the GPU to the network once they are all ready
+      int nSteps = netCoalesceSteps(args, sub, coalesce, sub->transmitted);
+      volatile uint64_t* recvTail = &resources->recvMem->tail;
+      if (nSteps > 1 && sub->transmitted + nSteps <= sub->posted && *recvTail >= sub->base + sub->transmitted + nSteps) {
+        int buffSlot = (sub->base+sub->transmitted)%NCCL_STEPS;
+        volatile int* sizesFifo = resources->recvMem->sizesFifo;
+        int size = 0;
+        for (int i=0; i<nSteps; i++) {
+          if (i < nSteps-1 && sizesFifo[buffSlot+i] != stepSize) {
+            WARN("NET : step %ld of a coalesced send holds %d bytes instead of %d", sub->transmitted+i, sizesFifo[buffSlot+i], stepSize);
+            return ncclInternalError;
+          }
+          size += sizesFifo[buffSlot+i];
+        }
+        if (resources->curr_hdp_reg && args->hdp_flushed < *recvTail) {
+          args->hdp_flushed = *recvTail;
+          *resources->curr_hdp_reg = 1;
+        }
+        posts[nPosts] = { s, buffSlot, nSteps, 1, -1 };
+        postComms[nPosts] = resources->netSendComm;
+        postData[nPosts] = localBuff+buffSlot*stepSize;
+        postSizes[nPosts] = size;
+        postTags[nPosts] = resources->tpRank;
+        postMhandles[nPosts++] = mhandle;
+        continue;
+      }
       // Check whether we received data from the GPU and send it to the network
-      if (sub->transmitted < sub->posted && sub->transmitted < sub->done + NCCL_STEPS) {
+      if (nSteps == args->sliceSteps && sub->transmitted < sub->posted && sub->transmitted < sub->done + NCCL_STEPS) {
         int buffSlot = (sub->base+sub->transmitted)%NCCL_STEPS;
         volatile int* sizesFifo = resources->recvMem->sizesFifo;
-        volatile uint64_t* recvTail = &resources->recvMem->tail;
         if (sizesFifo[buffSlot] != -1 && ((*recvTail > (sub->base+sub->transmitted)) || p == NCCL_PROTO_LL)) {
           // We have something to receive, let's check if it's completely ready.
           int size = sizesFifo[buffSlot];
@@ -1051,123 +1709,268 @@ static ncclResult_t sendProxyProgress(struct ncclProxyState* proxyState, struct
               *resources->curr_hdp_reg = 1;
             }
             // Data is ready, try to send.
-            NCCLCHECK(proxyState->ncclNet->isend(resources->netSendComm, buff, size, resources->tpRank, mhandle, sub->requests+buffSlot));
-            if (sub->requests[buffSlot] != NULL) {
-
-#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_SEND_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_SEND_EXIT)
-              NpKit::CollectCpuEvent(
-                  NPKIT_EVENT_NET_SEND_ENTRY,
-#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-                  g_npkit_net_poll_cnt,
-#else
-                  size,
-#endif
-                  uint64_t(sub->requests+buffSlot)/sizeof(void*),
-                  *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
-#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-              g_npkit_net_poll_cnt = 0;
-#endif
-              sub->timestamp[buffSlot] = 0;
-#endif
-
-              TRACE(NCCL_NET, "sendProxy [%ld/%d] Isend posted, req %p", sub->transmitted, buffSlot, sub->requests[buffSlot]);
-              sizesFifo[buffSlot] = -1;
-              // Make sure size is reset to zero before we update the head.
-              __sync_synchronize();
-              sub->transmitted += args->sliceSteps;
-              for (uint64_t step=sub->transmitted-args->sliceSteps; step<sub->transmitted; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileSendWait);
-              args->idle = 0;
-              continue;
+            char* sendBuff = buff;
+            int sendSize = size;
+            void* sendMhandle = mhandle;
+            if (resources->compBuff && p == NCCL_PROTO_SIMPLE) {
+              sendBuff = resources->compBuff + buffSlot*netCompressSlotSize(stepSize);
+              sendSize = netCompress(buff, size, sendBuff);
+              sendMhandle = resources->compMhandle;
             }
+            posts[nPosts] = { s, buffSlot, args->sliceSteps, 0, sendBuff != buff ? size : -1 };
+            postComms[nPosts] = resources->netSendComm;
+            postData[nPosts] = sendBuff;
+            postSizes[nPosts] = sendSize;
+            postTags[nPosts] = resources->tpRank;
+            postMhandles[nPosts++] = sendMhandle;
+            continue;
           }
         }
       }
-      // Check whether the network has completed some send operations.
-      if (sub->done < sub->transmitted) {
-        int done;
-        int buffSlot = (sub->base+sub->done)%NCCL_STEPS;
-#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_SEND_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_SEND_EXIT)
-        if (sub->timestamp[buffSlot] == 0)
-          sub->timestamp[buffSlot] = *(volatile uint64_t*)NpKit::GetCpuTimestamp();
-#endif
-        NCCLCHECK(proxyState->ncclNet->test(sub->requests[buffSlot], &done, NULL));
-        if (done) {
+    }
+    NCCLCHECK(netIsendv(proxyState->ncclNet, nPosts, postComms, postData, postSizes, postTags, postMhandles, postRequests));
+    for (int i=0; i<nPosts; i++) {
+      if (postRequests[i] == NULL) continue;
+      struct sendPost* post = posts+i;
+      int s = post->s;
+      int buffSlot = post->buffSlot;
+      struct ncclProxySubArgs* sub = args->subs+s;
+      struct sendResources* resources = (struct sendResources*) (sub->connection->transportResources);
+      volatile int* sizesFifo = resources->recvMem->sizesFifo;
+      sub->requests[buffSlot] = postRequests[i];
+      if (post->rawSize >= 0) {
+        resources->compRawBytes += post->rawSize;
+        resources->compWireBytes += postSizes[i];
+      }
+      if (post->coalesced) {
+        TRACE(NCCL_NET, "sendProxy [%ld/%d] Isend of %d steps posted, req %p", sub->transmitted, buffSlot, post->nSteps, sub->requests[buffSlot]);
+        for (int j=0; j<post->nSteps; j++) sizesFifo[buffSlot+j] = -1;
+      } else {
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_SEND_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_SEND_EXIT)
-          NpKit::CollectCpuEvent(
-              NPKIT_EVENT_NET_SEND_EXIT,
+        NpKit::CollectCpuEvent(
+            NPKIT_EVENT_NET_SEND_ENTRY,
 #if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-              g_npkit_net_poll_cnt,
+            g_npkit_net_poll_cnt,
 #else
-              sub->npKitSizesFifo[buffSlot],
+            post->rawSize >= 0 ? post->rawSize : postSizes[i],
 #endif
-              uint64_t(sub->requests+buffSlot)/sizeof(void*),
-              sub->timestamp[buffSlot], sub->channelId);
+            uint64_t(sub->requests+buffSlot)/sizeof(void*),
+            *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
 #if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-          g_npkit_net_poll_cnt = 0;
+        g_npkit_net_poll_cnt = 0;
 #endif
+        sub->timestamp[buffSlot] = 0;
 #endif
-#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_TEST_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_TEST_EXIT)
-          NpKit::CollectCpuEvent(
-              NPKIT_EVENT_NET_TEST_ENTRY,
-#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-              g_npkit_net_poll_cnt,
+
+        TRACE(NCCL_NET, "sendProxy [%ld/%d] Isend posted, req %p", sub->transmitted, buffSlot, sub->requests[buffSlot]);
+        sizesFifo[buffSlot] = -1;
+      }
+      // Make sure size is reset to zero before we update the head.
+      __sync_synchronize();
+      sub->transmitted += post->nSteps;
+      for (uint64_t step=sub->transmitted-post->nSteps; step<sub->transmitted; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileSendWait);
+      args->idle = 0;
+    }
+    if (args->done == args->nsubs) {
+      args->state = ncclProxyOpNone;
+    }
+  }
+  return ncclSuccess;
+}
+
+static int recvCoalesceSteps(struct ncclProxyArgs* args, struct ncclProxySubArgs* sub, uint64_t step) {
+  struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
+  int coalesce = netCoalesceFactor(args, resources->buffSizes[args->protocol]/NCCL_STEPS, resources->shared, resources->compress);
+  return netCoalesceSteps(args, sub, coalesce, step);
+}
+
+/* GDR flush batching (RCCL_NET_FLUSH_BATCH).
+ *
+ * Rather than flushing each receive as soon as it completes, completed receives
+ * join the open batch of their NIC. The batch is flushed once, when the first of
+ * its receives waits for the flush, which is at the earliest one progress
+ * iteration later; by then the receives completed on that NIC by all the other
+ * ops and channels of this progress thread have joined it. A PCI-E read issued
+ * from the NIC (IB plugin) or the CPU (GDRCOPY_FLUSH_ENABLE) cannot pass the NIC
+ * writes that completed before it, so one read covers all of them. Other net
+ * plugins keep their per receive flush.
+ */
+struct netFlushBatch {
+  int refs;
+  int posted;
+  int done;
+  int netDev; // -1 for GDRCopy reads
+  void* recvComm;
+  void* data;
+  void* mhandle;
+  uint64_t* gdcFlush;
+  void* request;
+};
+
+// Each progress thread owns its connections, so open batches are per thread.
+#define NET_FLUSH_MAX_OPEN 8
+static __thread struct netFlushBatch* netFlushOpen[NET_FLUSH_MAX_OPEN];
+static __thread int netFlushNOpen = 0;
+
+// data/mhandle is any GPU buffer registered on the recvComm, used if this receive ends up issuing the flush
+static ncclResult_t netFlushBatchJoin(struct recvResources* resources, void* data, void* mhandle, void** batchPtr) {
+  int netDev = resources->gdcFlush ? -1 : resources->netDev;
+  struct netFlushBatch* batch = NULL;
+  for (int i=0; i<netFlushNOpen; i++) {
+    if (netFlushOpen[i]->netDev == netDev) { batch = netFlushOpen[i]; break; }
+  }
+  if (batch == NULL) {
+    NCCLCHECK(ncclCalloc(&batch, 1));
+    batch->netDev = netDev;
+    batch->recvComm = resources->netRecvComm;
+    batch->data = data;
+    batch->mhandle = mhandle;
+    batch->gdcFlush = resources->gdcFlush;
+    // A batch which cannot be opened is flushed on its own
+    if (netFlushNOpen < NET_FLUSH_MAX_OPEN) netFlushOpen[netFlushNOpen++] = batch;
+  }
+  batch->refs++;
+  *batchPtr = batch;
+  return ncclSuccess;
+}
+
+// Issues the flush of the batch if needed and tests it. The caller drops its reference once *done is set.
+static ncclResult_t netFlushBatchTest(struct ncclProxyState* proxyState, void* batchPtr, int* done) {
+  struct netFlushBatch* batch = (struct netFlushBatch*)batchPtr;
+  if (batch->posted == 0) {
+    for (int i=0; i<netFlushNOpen; i++) {
+      if (netFlushOpen[i] == batch) { netFlushOpen[i] = netFlushOpen[--netFlushNOpen]; break; }
+    }
+    batch->posted = 1;
+    if (batch->gdcFlush) {
+#if defined (__x86_64__)
+      // Force a PCI-E read from GPU memory
+      asm volatile ("mov (%0), %%eax" :: "l"(batch->gdcFlush) : "%eax");
+      batch->done = 1;
 #else
-              sub->npKitSizesFifo[buffSlot],
-#endif
-              uint64_t(sub->requests+buffSlot)/sizeof(void*),
-              sub->timestamp[buffSlot], sub->channelId);
-#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-          g_npkit_net_poll_cnt = 0;
-#endif
+      WARN("NET: GDR Flush only supported on x86_64");
+      return ncclInternalError;
 #endif
-#if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_TEST_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_TEST_EXIT)
-          NpKit::CollectCpuEvent(
-              NPKIT_EVENT_NET_TEST_EXIT,
-#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-              g_npkit_net_poll_cnt,
+    } else {
+      int size = 1;
+      NCCLCHECK(proxyState->ncclNet->iflush(batch->recvComm, 1, &batch->data, &size, &batch->mhandle, &batch->request));
+      if (batch->request == NULL) batch->done = 1;
+    }
+  }
+  if (batch->done == 0) {
+    NCCLCHECK(proxyState->ncclNet->test(batch->request, &batch->done, NULL));
+    if (batch->done) batch->request = NULL;
+  }
+  *done = batch->done;
+  if (*done && --batch->refs == 0) free(batch);
+  return ncclSuccess;
+}
+
+// Zero-copy receive into a user buffer, see addP2pToPlan(). posted/received
+// count the nsteps network messages, once they are all in (and flushed) the
+// single empty kernel step is released. done jumps to nsteps when the kernel
+// has consumed it.
+static ncclResult_t recvProxyProgressReg(struct ncclProxyState* proxyState, struct ncclProxyArgs* args, struct ncclProxySubArgs* sub, int s) {
+  struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
+  if (sub->regMhandle == NULL) {
+    ncclResult_t res = netRegGet(proxyState, resources->netRecvComm, resources->useDmaBuf, resources->regCache, &resources->regClock,
+          sub->regBuff, sub->nbytes, &sub->regMhandle);
+    if (res == ncclInProgress) return ncclSuccess;
+    NCCLCHECK(res);
+  }
+  if (sub->posted < sub->nsteps && sub->posted < sub->received + NCCL_STEPS) {
+    int slot = sub->posted%NCCL_STEPS;
+    ssize_t offset = sub->posted*sub->regChunkSize;
+    void* ptr = (char*)sub->regBuff+offset;
+    int size = std::min<ssize_t>(sub->regChunkSize, sub->nbytes-offset);
+    int tag = resources->tpRemoteRank;
+    NCCLCHECK(proxyState->ncclNet->irecv(resources->netRecvComm, 1, &ptr, &size, &tag, &sub->regMhandle, sub->requests+slot));
+    if (sub->requests[slot] != NULL) {
+      ncclProfilingRecord(args, s, sub->posted, ncclProxyProfileRecvWait);
+      sub->posted++;
+      args->idle = 0;
+      return ncclSuccess;
+    }
+  }
+  if (sub->received < sub->posted) {
+    int done;
+    int size = 0;
+    int slot = sub->received%NCCL_STEPS;
+    NCCLCHECK(proxyState->ncclNet->test(sub->requests[slot], &done, &size));
+    if (done) {
+      sub->requests[slot] = NULL;
+      ncclProfilingRecord(args, s, sub->received, ncclProxyProfileRecvFlushWait);
+      sub->received++;
+      args->idle = 0;
+    }
+    return ncclSuccess;
+  }
+  if (sub->received == sub->nsteps && sub->transmitted == 0) {
+    // All requests completed, reuse the first one for the flush
+    void** request = sub->requests;
+    if (sub->flushed == 0) {
+      sub->flushed = 1;
+      if (resources->useGdr && resources->needFlush) {
+        if (resources->flushBatch) {
+          NCCLCHECK(netFlushBatchJoin(resources, sub->regBuff, sub->regMhandle, sub->flushBatches));
+        } else if (resources->gdcFlush) {
+#if defined (__x86_64__)
+          // Force a PCI-E read from GPU memory
+          asm volatile ("mov (%0), %%eax" :: "l"(resources->gdcFlush) : "%eax");
 #else
-              sub->npKitSizesFifo[buffSlot],
-#endif
-              uint64_t(sub->requests+buffSlot)/sizeof(void*),
-              *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
-#if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-          g_npkit_net_poll_cnt = 0;
-#endif
+          WARN("NET: GDR Flush only supported on x86_64");
+          return ncclInternalError;
 #endif
-
-          TRACE(NCCL_NET, "sendProxy [%ld/%d] request %p done", sub->done, buffSlot, sub->requests[buffSlot]);
-          sub->done += args->sliceSteps;
-          for (uint64_t step=sub->done-args->sliceSteps; step<sub->done; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileEnd);
-
-          if (resources->shared == 0) {
-            volatile uint64_t* sendHead = resources->gdcSync ? resources->gdcSync : &resources->sendMem->head;
-            *sendHead = sub->base + sub->done;
-            if (resources->gdcSync) wc_store_fence(); // Flush out WC write
-          }
-          args->idle = 0;
-          if (sub->done == sub->nsteps) {
-            resources->step = sub->base + sub->nsteps;
-            args->done++;
-          }
+        } else {
+          int size = sub->nbytes;
+          NCCLCHECK(proxyState->ncclNet->iflush(resources->netRecvComm, 1, &sub->regBuff, &size, &sub->regMhandle, request));
         }
       }
+      args->idle = 0;
+      return ncclSuccess;
     }
-    if (args->done == args->nsubs) {
-      args->state = ncclProxyOpNone;
+    int done = 1;
+    if (sub->flushBatches[0]) {
+      NCCLCHECK(netFlushBatchTest(proxyState, sub->flushBatches[0], &done));
+      if (done) sub->flushBatches[0] = NULL;
+    } else if (*request) NCCLCHECK(proxyState->ncclNet->test(*request, &done, NULL));
+    if (done) {
+      *request = NULL;
+      for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileRecvGPUWait);
+      sub->transmitted = 1;
+      __sync_synchronize();
+      ncclGdcStore(resources->gdcSync, &resources->recvMem->tail, sub->base + 1);
+      args->idle = 0;
     }
+    return ncclSuccess;
+  }
+  volatile uint64_t* sendHead = &resources->sendMem->head;
+  if (sub->transmitted == 1 && *sendHead > sub->base) {
+    for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileEnd);
+    sub->done = sub->nsteps;
+    resources->step = sub->base + 1;
+    args->done++;
+    args->idle = 0;
   }
   return ncclSuccess;
 }
 
 static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct ncclProxyArgs* args) {
+  ncclGdcFlushScope gdcFlush;
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
   g_npkit_net_poll_cnt++;
 #endif
   if (args->state == ncclProxyOpReady) {
-    // Initialize subs and group them by same recvComm.
+    // Initialize subs and group them by same recvComm. Coalesced steps and
+    // user buffer receives are tracked per sub, so don't group them.
     void* recvComm;
     int groupSize = 0;
     int maxRecvs = 1;
+    bool noGroup = false;
+    for (int s=0; s<args->nsubs; s++) {
+      struct recvResources* resources = (struct recvResources*) (args->subs[s].connection->transportResources);
+      if (args->subs[s].reg || netCoalesceFactor(args, resources->buffSizes[args->protocol]/NCCL_STEPS, resources->shared, resources->compress) > 1) noGroup = true;
+    }
     for (int s=0; s<args->nsubs; s++) {
       struct ncclProxySubArgs* sub = args->subs+s;
       if (groupSize == maxRecvs) {
@@ -1189,34 +1992,49 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
       }
       groupSize++;
       struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
-      maxRecvs = resources->maxRecvs;
+      maxRecvs = noGroup ? 1 : resources->maxRecvs;
       recvComm = resources->netRecvComm;
       // Round to next multiple of sliceSteps
       sub->base = ROUNDUP(resources->step, args->chunkSteps);
-      sub->posted = sub->received = sub->transmitted = sub->done = 0;
+      sub->posted = sub->received = sub->flushed = sub->transmitted = sub->done = 0;
       for (int i=0; i<groupSize; i++) sub[-i].groupSize = groupSize;
       for (uint64_t step=0; step<sub->nsteps; step++) ncclProfilingRecord(args, s, step, ncclProxyProfileBegin);
     }
+    netRegPrefetch(proxyState, args, 0);
     args->state = ncclProxyOpProgress;
   }
   args->idle = 1;
   if (args->state == ncclProxyOpProgress) {
     int p = args->protocol;
     int maxDepth = std::min(NCCL_STEPS, NCCL_SHARED_STEPS/args->nsubs);
+    for (int s=0; s<args->nsubs; s++) {
+      struct ncclProxySubArgs* sub = args->subs+s;
+      if (sub->reg && sub->done < sub->nsteps) NCCLCHECK(recvProxyProgressReg(proxyState, args, sub, s));
+    }
+    // Post the receives of all the groups at once. Each group is a multi-receive of its subs.
+    int nGroups = 0, nBuffs = 0;
+    int groupSubs[NCCL_PROXY_MAX_SUBS];
+    void* groupComms[NCCL_PROXY_MAX_SUBS];
+    int groupRecvs[NCCL_PROXY_MAX_SUBS];
+    void* groupRequests[NCCL_PROXY_MAX_SUBS];
+    void* ptrs[NCCL_PROXY_MAX_SUBS];
+    int sizes[NCCL_PROXY_MAX_SUBS];
+    int tags[NCCL_PROXY_MAX_SUBS];
+    void* mhandles[NCCL_PROXY_MAX_SUBS];
     for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
       struct ncclProxySubArgs* subGroup = args->subs+s;
+      if (subGroup->reg) continue;
       int subCount = 0;
-      void* ptrs[NCCL_PROXY_MAX_SUBS];
-      int sizes[NCCL_PROXY_MAX_SUBS];
-      int tags[NCCL_PROXY_MAX_SUBS];
-      void* mhandles[NCCL_PROXY_MAX_SUBS];
 
       for (int i=0; i<subGroup->groupSize; i++) {
         struct ncclProxySubArgs* sub = subGroup + i;
         if (sub->posted < sub->nsteps) {
-          if (sub->posted >= sub->done + maxDepth) { subCount = 0; break; }
           struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
           int stepSize = resources->buffSizes[p] / NCCL_STEPS;
+          int coalesce = netCoalesceFactor(args, stepSize, resources->shared, resources->compress);
+          int nSteps = netCoalesceSteps(args, sub, coalesce, sub->posted);
+          // A coalesced group needs all its slots, a shared buffer is bounded by maxDepth.
+          if (coalesce > 1 ? sub->posted + nSteps > sub->done + NCCL_STEPS : sub->posted >= sub->done + maxDepth) { subCount = 0; break; }
           char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
           int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
           if (p == NCCL_PROTO_SIMPLE && resources->shared) {
@@ -1225,143 +2043,202 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
             NCCLCHECK(sharedBuffersGet(proxyState, sub->channelId, sharedBuffSlot*args->nsubs+s+i, &offset));
             volatile int* offsFifo = (volatile int*)resources->recvMem->offsFifo;
             offsFifo[buffSlot] = offset;
-            ptrs[subCount] = localBuff+offset;
+            ptrs[nBuffs+subCount] = localBuff+offset;
           } else {
-            ptrs[subCount] = localBuff+buffSlot*stepSize;
+            ptrs[nBuffs+subCount] = localBuff+buffSlot*stepSize;
+          }
+          sizes[nBuffs+subCount] = stepSize*args->sliceSteps;
+          if (sub->nbytes < sizes[nBuffs+subCount]) sizes[nBuffs+subCount] = sub->nbytes;
+          sizes[nBuffs+subCount] *= nSteps/args->sliceSteps;
+          tags[nBuffs+subCount] = resources->tpRemoteRank;
+          mhandles[nBuffs+subCount] = resources->mhandles[p];
+          if (resources->compBuff && p == NCCL_PROTO_SIMPLE) {
+            ptrs[nBuffs+subCount] = resources->compBuff + buffSlot*netCompressSlotSize(stepSize);
+            sizes[nBuffs+subCount] += sizeof(struct netCompressHeader);
+            mhandles[nBuffs+subCount] = resources->compMhandle;
           }
-          sizes[subCount] = stepSize*args->sliceSteps;
-          if (sub->nbytes < sizes[subCount]) sizes[subCount] = sub->nbytes;
-          tags[subCount] = resources->tpRemoteRank;
-          mhandles[subCount] = resources->mhandles[p];
           subCount++;
         }
       }
       if (subCount) {
-        uint64_t step = subGroup->posted;
         struct recvResources* resources = (struct recvResources*) (subGroup->connection->transportResources);
-        void** requestPtr = subGroup->requests+(step%NCCL_STEPS);
-        NCCLCHECK(proxyState->ncclNet->irecv(resources->netRecvComm, subCount, ptrs, sizes, tags, mhandles, requestPtr));
-        if (*requestPtr) {
-          for (int i=0; i<subGroup->groupSize; i++) {
-            struct ncclProxySubArgs* sub = subGroup+i;
+        groupSubs[nGroups] = s;
+        groupComms[nGroups] = resources->netRecvComm;
+        groupRecvs[nGroups++] = subCount;
+        nBuffs += subCount;
+      }
+    }
+    NCCLCHECK(netIrecvv(proxyState->ncclNet, nGroups, groupComms, groupRecvs, ptrs, sizes, tags, mhandles, groupRequests));
+    for (int g=0, b=0; g<nGroups; b+=groupRecvs[g++]) {
+      if (groupRequests[g] == NULL) continue;
+      int s = groupSubs[g];
+      struct ncclProxySubArgs* subGroup = args->subs+s;
+      uint64_t step = subGroup->posted;
+      subGroup->requests[step%NCCL_STEPS] = groupRequests[g];
+      for (int i=0; i<subGroup->groupSize; i++) {
+        struct ncclProxySubArgs* sub = subGroup+i;
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_RECV_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_RECV_EXIT)
-            NpKit::CollectCpuEvent(
-                NPKIT_EVENT_NET_RECV_ENTRY,
+        NpKit::CollectCpuEvent(
+            NPKIT_EVENT_NET_RECV_ENTRY,
 #if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-                g_npkit_net_poll_cnt,
+            g_npkit_net_poll_cnt,
 #else
-                sizes[i],
+            sizes[b+i],
 #endif
-                uint64_t(sub->requests+(step%NCCL_STEPS))/sizeof(void*),
-                *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
+            uint64_t(sub->requests+(step%NCCL_STEPS))/sizeof(void*),
+            *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
 #if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-            g_npkit_net_poll_cnt = 0;
+        g_npkit_net_poll_cnt = 0;
 #endif
 #endif
 
-            sub->posted += args->sliceSteps;
-            for (uint64_t step=sub->posted-args->sliceSteps; step<sub->posted; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvWait);
-          }
-          args->idle = 0;
-        }
+        int nSteps = recvCoalesceSteps(args, sub, sub->posted);
+        sub->posted += nSteps;
+        for (uint64_t step=sub->posted-nSteps; step<sub->posted; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvWait);
       }
+      args->idle = 0;
     }
     if (args->idle == 0) return ncclSuccess;
 
+    // Test the oldest receive of every group at once. The sizes of a group go to its own slice
+    // of testSizes, starting at its first sub.
+    int nTests = 0;
+    int testGroups[NCCL_PROXY_MAX_SUBS];
+    void* testRequests[NCCL_PROXY_MAX_SUBS];
+    int testDone[NCCL_PROXY_MAX_SUBS];
+    int testSizes[NCCL_PROXY_MAX_SUBS];
+    int* testSizePtrs[NCCL_PROXY_MAX_SUBS];
     for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
       struct ncclProxySubArgs* subGroup = args->subs+s;
-      if (subGroup->posted > subGroup->received) {
-        uint64_t step = subGroup->received;
-        int done;
-        void* ptrs[NCCL_PROXY_MAX_SUBS];
-        int sizes[NCCL_PROXY_MAX_SUBS];
-        void* mhandles[NCCL_PROXY_MAX_SUBS];
-        for (int i=0; i<NCCL_PROXY_MAX_SUBS; i++) sizes[i] = 0;
-        NCCLCHECK(proxyState->ncclNet->test(subGroup->requests[step%NCCL_STEPS], &done, sizes));
-        if (done) {
-          int needFlush = 0;
-          int totalSize = 0;
-          for (int i=0; i<NCCL_PROXY_MAX_SUBS; i++) totalSize += sizes[i];
-          for (int i=0; i<subGroup->groupSize; i++) {
-            struct ncclProxySubArgs* sub = subGroup + i;
+      if (subGroup->reg || subGroup->posted <= subGroup->received) continue;
+      for (int i=0; i<subGroup->groupSize; i++) testSizes[s+i] = 0;
+      testGroups[nTests] = s;
+      testSizePtrs[nTests] = testSizes+s;
+      testRequests[nTests++] = subGroup->requests[subGroup->received%NCCL_STEPS];
+    }
+    NCCLCHECK(netTestSome(proxyState->ncclNet, nTests, testRequests, testDone, testSizePtrs));
+    for (int t=0; t<nTests; t++) {
+      if (!testDone[t]) continue;
+      int s = testGroups[t];
+      struct ncclProxySubArgs* subGroup = args->subs+s;
+      uint64_t step = subGroup->received;
+      int* sizes = testSizes+s;
+      int needFlush = 0;
+      int totalSize = 0;
+      for (int i=0; i<subGroup->groupSize; i++) totalSize += sizes[i];
+      if (p == NCCL_PROTO_SIMPLE) {
+        // Decode compressed steps into the buffers the GPU reads from
+        for (int i=0, k=0; i<subGroup->groupSize; i++) {
+          struct ncclProxySubArgs* sub = subGroup + i;
+          if (step >= sub->nsteps) continue;
+          struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
+          int wireSize = sizes[k++];
+          if (resources->compBuff == NULL) continue;
+          int stepSize = resources->buffSizes[p] / NCCL_STEPS;
+          int buffSlot = (sub->base+step)%NCCL_STEPS;
+          char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
+          int size = netDecompress(resources->compBuff + buffSlot*netCompressSlotSize(stepSize), wireSize, localBuff+buffSlot*stepSize, stepSize*args->sliceSteps);
+          if (size < 0) {
+            WARN("NET/Compress : malformed step %ld from rank %d on channel %d", step, resources->tpRemoteRank, sub->channelId);
+            return ncclInternalError;
+          }
+          resources->compRawBytes += size;
+          resources->compWireBytes += wireSize;
+        }
+      }
+      for (int i=0; i<subGroup->groupSize; i++) {
+        struct ncclProxySubArgs* sub = subGroup + i;
 
 #if defined(ENABLE_NPKIT) && defined(ENABLE_NPKIT_EVENT_NET_RECV_ENTRY) && defined(ENABLE_NPKIT_EVENT_NET_RECV_EXIT)
-            NpKit::CollectCpuEvent(
-                NPKIT_EVENT_NET_RECV_EXIT,
+        NpKit::CollectCpuEvent(
+            NPKIT_EVENT_NET_RECV_EXIT,
 #if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-                g_npkit_net_poll_cnt,
+            g_npkit_net_poll_cnt,
 #else
-                sizes[i],
+            sizes[i],
 #endif
-                uint64_t(sub->requests+(step%NCCL_STEPS))/sizeof(void*),
-                *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
+            uint64_t(sub->requests+(step%NCCL_STEPS))/sizeof(void*),
+            *(volatile uint64_t*)NpKit::GetCpuTimestamp(), sub->channelId);
 #if defined(ENABLE_NPKIT_NET_COLLECT_POLL_CNT)
-            g_npkit_net_poll_cnt = 0;
+        g_npkit_net_poll_cnt = 0;
 #endif
 #endif
 
-            sub->received += args->sliceSteps;
-            for (uint64_t step=sub->received-args->sliceSteps; step<sub->received; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvFlushWait);
-            if (step < sub->nsteps) {
-              struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
-              if (resources->useGdr) needFlush |= resources->needFlush;
-            }
-          }
-          subGroup->requests[step%NCCL_STEPS] = NULL;
-          if (totalSize > 0 && p == NCCL_PROTO_SIMPLE && needFlush) {
-            // GDRCOPY support
-            struct recvResources* resources = (struct recvResources*) (subGroup->connection->transportResources);
-            if (resources->gdcFlush) {
+        int nSteps = recvCoalesceSteps(args, sub, sub->received);
+        sub->received += nSteps;
+        for (uint64_t step=sub->received-nSteps; step<sub->received; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvFlushWait);
+        if (step < sub->nsteps) {
+          struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
+          if (resources->useGdr) needFlush |= resources->needFlush;
+        }
+      }
+      subGroup->requests[step%NCCL_STEPS] = NULL;
+      if (totalSize > 0 && p == NCCL_PROTO_SIMPLE && needFlush) {
+        // GDRCOPY support
+        struct recvResources* resources = (struct recvResources*) (subGroup->connection->transportResources);
+        if (resources->flushBatch) {
+          // Any buffer of the group does for the flush, take the first one received into
+          struct ncclProxySubArgs* sub = subGroup;
+          while (step >= sub->nsteps) sub++;
+          struct recvResources* subResources = (struct recvResources*) (sub->connection->transportResources);
+          int stepSize = subResources->buffSizes[p] / NCCL_STEPS;
+          char* localBuff = NCCL_NET_MAP_GET_POINTER(&subResources->map, cpu, buffs[p]);
+          int buffSlot = (sub->base+step)%NCCL_STEPS;
+          void* ptr = subResources->shared ? localBuff+subResources->recvMem->offsFifo[buffSlot] : localBuff+buffSlot*stepSize;
+          NCCLCHECK(netFlushBatchJoin(resources, ptr, subResources->mhandles[p], subGroup->flushBatches+(step%NCCL_STEPS)));
+        } else if (resources->gdcFlush) {
 #if defined (__x86_64__)
-              // Force a PCI-E read from GPU memory
-              asm volatile ("mov (%0), %%eax" :: "l"(resources->gdcFlush) : "%eax");
+          // Force a PCI-E read from GPU memory
+          asm volatile ("mov (%0), %%eax" :: "l"(resources->gdcFlush) : "%eax");
 #else
-              WARN("NET: GDR Flush only supported on x86_64");
-              return ncclInternalError;
+          WARN("NET: GDR Flush only supported on x86_64");
+          return ncclInternalError;
 #endif
-            } else {
-              int subCount = 0;
-              for (int i=0; i<subGroup->groupSize; i++) {
-                struct ncclProxySubArgs* sub = subGroup + i;
-                if (step < sub->nsteps) {
-                  struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
-                  int stepSize = resources->buffSizes[p] / NCCL_STEPS;
-                  char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
-                  int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
-                  ptrs[subCount] = resources->shared ? localBuff+resources->recvMem->offsFifo[buffSlot] : localBuff+buffSlot*stepSize;
-                  mhandles[subCount] = resources->mhandles[p];
-                  subCount++;
-                }
-              }
-              struct recvResources* resources = (struct recvResources*) (subGroup->connection->transportResources);
-              NCCLCHECK(proxyState->ncclNet->iflush(resources->netRecvComm, subCount, ptrs, sizes, mhandles, subGroup->requests+(step%NCCL_STEPS)));
+        } else {
+          int subCount = 0;
+          for (int i=0; i<subGroup->groupSize; i++) {
+            struct ncclProxySubArgs* sub = subGroup + i;
+            if (step < sub->nsteps) {
+              struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
+              int stepSize = resources->buffSizes[p] / NCCL_STEPS;
+              char* localBuff = NCCL_NET_MAP_GET_POINTER(&resources->map, cpu, buffs[p]);
+              int buffSlot = (sub->base+sub->posted)%NCCL_STEPS;
+              ptrs[subCount] = resources->shared ? localBuff+resources->recvMem->offsFifo[buffSlot] : localBuff+buffSlot*stepSize;
+              mhandles[subCount] = resources->mhandles[p];
+              subCount++;
             }
           }
-          args->idle = 0;
+          struct recvResources* resources = (struct recvResources*) (subGroup->connection->transportResources);
+          NCCLCHECK(proxyState->ncclNet->iflush(resources->netRecvComm, subCount, ptrs, sizes, mhandles, subGroup->requests+(step%NCCL_STEPS)));
         }
       }
+      args->idle = 0;
     }
     if (args->idle == 0) return ncclSuccess;
 
     for (int s=0; s<args->nsubs; s+=args->subs[s].groupSize) {
       struct ncclProxySubArgs* subGroup = args->subs+s;
+      if (subGroup->reg) continue;
       if (subGroup->received > subGroup->transmitted) {
         uint64_t step = subGroup->transmitted;
         int done = 1;
         void* request = subGroup->requests[step%NCCL_STEPS];
-        if (request) NCCLCHECK(proxyState->ncclNet->test(request, &done, NULL));
+        void** flushBatch = subGroup->flushBatches+(step%NCCL_STEPS);
+        if (*flushBatch) {
+          NCCLCHECK(netFlushBatchTest(proxyState, *flushBatch, &done));
+          if (done) *flushBatch = NULL;
+        } else if (request) NCCLCHECK(proxyState->ncclNet->test(request, &done, NULL));
         if (done) {
           for (int i=0; i<subGroup->groupSize; i++) {
             struct ncclProxySubArgs* sub = subGroup + i;
-            sub->transmitted += args->sliceSteps;
-            for (uint64_t step=sub->transmitted-args->sliceSteps; step<sub->transmitted; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvGPUWait);
+            int nSteps = recvCoalesceSteps(args, sub, sub->transmitted);
+            sub->transmitted += nSteps;
+            for (uint64_t step=sub->transmitted-nSteps; step<sub->transmitted; step++) ncclProfilingRecord(args, s+i, step, ncclProxyProfileRecvGPUWait);
             if (step < sub->nsteps) {
               __sync_synchronize();
               struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
-              volatile uint64_t* recvTail = resources->gdcSync ? resources->gdcSync : &resources->recvMem->tail;
-              *recvTail = sub->base + sub->transmitted;
-              if (resources->gdcSync) wc_store_fence(); // Flush out WC write
+              ncclGdcStore(resources->gdcSync, &resources->recvMem->tail, sub->base + sub->transmitted);
             }
           }
           args->idle = 0;
@@ -1374,7 +2251,7 @@ static ncclResult_t recvProxyProgress(struct ncclProxyState* proxyState, struct
       struct ncclProxySubArgs* subGroup = args->subs+s;
       for (int i=0; i<subGroup->groupSize; i++) {
         struct ncclProxySubArgs* sub = subGroup + i;
-        if (sub->done == sub->nsteps) continue;
+        if (sub->reg || sub->done == sub->nsteps) continue;
         if (sub->transmitted > sub->done) {
           struct recvResources* resources = (struct recvResources*) (sub->connection->transportResources);
           volatile uint64_t* sendHead = &resources->sendMem->head;
@@ -26,8 +26,10 @@
 
 #include "ibvwrap.h"
 #include "graph/xml.h"
+#include "hw_counters.h"
 
 #define MAXNAMESIZE 64
+#define NCCL_IB_MAX_RAILS 4
 static char ncclIbIfName[MAX_IF_NAME_SIZE+1];
 static union ncclSocketAddress ncclIbIfAddr;
 
@@ -36,11 +38,22 @@ struct ncclIbMr {
   int pages;
   int refs;
   ibv_mr *mr;
+  int hashNext;          // Next slot in the bucket, or in the free list
+  int lruPrev, lruNext;  // Unreferenced MRs only
 };
 
+// Registered MRs, indexed by (addr, pages) in a chained hash table. With
+// RCCL_IB_MR_CACHE_SIZE > 0, up to that many MRs are kept registered after
+// their last deregistration and evicted in LRU order. This is only safe when
+// buffers are not freed while cached, e.g. with a framework memory pool.
 struct ncclIbMrCache {
   struct ncclIbMr *slots;
   int capacity, population;
+  int freeSlot;
+  int* buckets;
+  int nBuckets; // Power of two
+  int lruHead, lruTail, nIdle;
+  uint64_t hits, misses, evictions;
 };
 
 static int ncclNIbDevs = -1;
@@ -60,6 +73,10 @@ struct alignas(64) ncclIbDev {
   int maxQp;
   struct ncclIbMrCache mrCache;
   int ar; // ADAPTIVE_ROUTING
+  int nRails; // RCCL_IB_MULTI_RAIL: devices a comm on this one is striped over, rails[0] is itself
+  int rails[NCCL_IB_MAX_RAILS];
+  struct ncclIbSrq* srq; // RCCL_IB_SRQ: receive queue and CQ shared by the comms of this process
+  struct ibv_mr* odpMr;  // RCCL_IB_ODP: implicit ODP MR covering the whole address space of pd
 };
 
 #define MAX_IB_PORT 15
@@ -79,6 +96,7 @@ NCCL_PARAM(IbTimeout, "IB_TIMEOUT", 18);
 NCCL_PARAM(IbRetryCnt, "IB_RETRY_CNT", 7);
 NCCL_PARAM(IbPkey, "IB_PKEY", 0);
 NCCL_PARAM(IbUseInline, "IB_USE_INLINE", 0);
+RCCL_PARAM(IbInlineSize, "IB_INLINE_SIZE", 0);
 NCCL_PARAM(IbSl, "IB_SL", 0);
 NCCL_PARAM(IbTc, "IB_TC", 0);
 NCCL_PARAM(IbArThreshold, "IB_AR_THRESHOLD", 8192);
@@ -107,6 +125,7 @@ static void* ncclIbAsyncThreadMain(void* args) {
 
 NCCL_PARAM(IbDisable, "IB_DISABLE", 0);
 NCCL_PARAM(IbMergeVfs, "IB_MERGE_VFS", 1);
+RCCL_PARAM(IbMultiRail, "IB_MULTI_RAIL", 0);
 
 static ncclResult_t ncclIbGetPciPath(char* devName, char** path, int* realPort) {
   char devicePath[PATH_MAX];
@@ -163,6 +182,52 @@ static int ncclIbRelaxedOrderingCapable(void) {
   return r == ncclInternalError ? 0 : 1;
 }
 
+// Parent of the PCI switch downstream port a NIC sits behind
+static void ncclIbPciSwitchPath(const char* pciPath, char* path) {
+  strncpy(path, pciPath ? pciPath : "", PATH_MAX-1);
+  path[PATH_MAX-1] = '\0';
+  for (int i=0; i<2; i++) {
+    char* slash = strrchr(path, '/');
+    if (slash) *slash = '\0';
+  }
+}
+
+// With RCCL_IB_MULTI_RAIL=n, comms on a device are striped over up to n
+// devices with the same link layer sitting behind the same PCI switch,
+// which a GPU under that switch sees at the same distance.
+static void ncclIbInitRails() {
+  int maxRails = std::min<int64_t>(rcclParamIbMultiRail(), NCCL_IB_MAX_RAILS);
+  char path[PATH_MAX], otherPath[PATH_MAX];
+  for (int d=0; d<ncclNIbDevs; d++) {
+    struct ncclIbDev* dev = ncclIbDevs+d;
+    dev->nRails = 1;
+    dev->rails[0] = d;
+    if (maxRails <= 1) continue;
+    ncclIbPciSwitchPath(dev->pciPath, path);
+    for (int e=0; e<ncclNIbDevs && dev->nRails<maxRails; e++) {
+      if (e == d || ncclIbDevs[e].link != dev->link) continue;
+      ncclIbPciSwitchPath(ncclIbDevs[e].pciPath, otherPath);
+      if (strcmp(path, otherPath) == 0) dev->rails[dev->nRails++] = e;
+    }
+    if (dev->nRails > 1) {
+      char line[256];
+      line[0] = '\0';
+      for (int r=1; r<dev->nRails; r++) snprintf(line+strlen(line), sizeof(line)-strlen(line), " %s", ncclIbDevs[dev->rails[r]].devName);
+      INFO(NCCL_INIT|NCCL_NET, "NET/IB : %s striped over%s", dev->devName, line);
+    }
+  }
+}
+
+// Devices and ports found by ncclIbInit, for the hardware counter sampler
+int ncclIbGetDevPorts(const char** devNames, int* ports, int maxDevs) {
+  int n = 0;
+  for (int d=0; d<ncclNIbDevs && n<maxDevs; d++) {
+    devNames[n] = ncclIbDevs[d].devName;
+    ports[n++] = ncclIbDevs[d].port;
+  }
+  return n;
+}
+
 ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
   if (ncclParamIbDisable()) return ncclInternalError;
   static int shownIbHcaEnv = 0;
@@ -236,9 +301,9 @@ ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
           strncpy(ncclIbDevs[ncclNIbDevs].devName, devices[d]->name, MAXNAMESIZE);
           NCCLCHECK(ncclIbGetPciPath(ncclIbDevs[ncclNIbDevs].devName, &ncclIbDevs[ncclNIbDevs].pciPath, &ncclIbDevs[ncclNIbDevs].realPort));
           ncclIbDevs[ncclNIbDevs].maxQp = devAttr.max_qp;
-          ncclIbDevs[ncclNIbDevs].mrCache.capacity = 0;
-          ncclIbDevs[ncclNIbDevs].mrCache.population = 0;
-          ncclIbDevs[ncclNIbDevs].mrCache.slots = NULL;
+          memset(&ncclIbDevs[ncclNIbDevs].mrCache, 0, sizeof(struct ncclIbMrCache));
+          ncclIbDevs[ncclNIbDevs].mrCache.freeSlot = -1;
+          ncclIbDevs[ncclNIbDevs].mrCache.lruHead = ncclIbDevs[ncclNIbDevs].mrCache.lruTail = -1;
 
           // Enable ADAPTIVE_ROUTING by default on IB networks
           // But allow it to be overloaded by an env parameter
@@ -265,6 +330,7 @@ ncclResult_t ncclIbInit(ncclDebugLogger_t logFunction) {
       line[0] = '\0';
       // Determine whether RELAXED_ORDERING is enabled and possible
       ncclIbRelaxedOrderingEnabled = ncclIbRelaxedOrderingCapable();
+      ncclIbInitRails();
       for (int d=0; d<ncclNIbDevs; d++) {
         snprintf(line+strlen(line), 1023-strlen(line), " [%d]%s:%d/%s", d, ncclIbDevs[d].devName,
             ncclIbDevs[d].port, ncclIbDevs[d].link == IBV_LINK_LAYER_INFINIBAND ? "IB" : "RoCE");
@@ -365,6 +431,14 @@ static_assert(MAX_REQUESTS <= 256, "request id are encoded in wr_id and we need
 
 #define NCCL_IB_MAX_QPS 128
 
+// Address of one rail, the fields above are rail 0
+struct ncclIbRailAddr {
+  uint32_t lid;
+  uint8_t ib_port;
+  uint64_t spn;
+  uint64_t iid;
+};
+
 struct ncclIbQpInfo {
   uint32_t lid;
   uint8_t ib_port;
@@ -379,6 +453,14 @@ struct ncclIbQpInfo {
   // FIFO RDMA info
   uint32_t fifoRkey;
   uint64_t fifoAddr;
+
+  // Multi-rail: QP q is on rail q%nRails
+  int nqps;
+  int nRails;
+  struct ncclIbRailAddr rails[NCCL_IB_MAX_RAILS];
+
+  // Connection pool: id of the connection, or of the parked one offered (nqps 0)
+  uint64_t poolId;
 };
 
 enum ncclIbCommState {
@@ -397,12 +479,15 @@ struct ncclIbCommStage {
   int offset;
   void* buffer;
   void* comm;
+  void* pooled; // Connect: parked send comm offered to the peer
+  int refused;  // Accept: the offered connection is gone, a fresh one follows
 };
 
 struct ncclIbHandle {
   union ncclSocketAddress connectAddr; // Filled by the target
   uint64_t magic; // random number to help debugging
   struct ncclIbCommStage stage; // Used by the other side when connecting
+  int dev; // Listening device, part of the connection pool key
 };
 
 // Retain local and remote RoCE addresses for error logging
@@ -429,8 +514,9 @@ struct ncclIbRequest {
     struct {
       int size;
       void* data;
-      uint32_t lkey;
+      uint32_t lkeys[NCCL_IB_MAX_RAILS];
       int offset;
+      int hostMem;
     } send;
     struct {
       int sizes[NCCL_NET_IB_MAX_RECVS];
@@ -438,14 +524,78 @@ struct ncclIbRequest {
   };
 };
 
+// Only buffers in host memory can be inlined, as the CPU copies them into the WQE
+#define NCCL_IB_MAX_HOST_MRS 8
+
 struct ncclIbVerbs {
   int dev;
   struct ibv_pd* pd; // duplicate of ncclIbDevs[dev].pd
-  struct ibv_cq* cq;
+  struct ibv_cq* cq; // srq->cq when the comm uses the shared receive queue
+  struct ncclIbSrq* srq;
+  struct ncclIbSrqRing* srqRings; // Recv comms on the SRQ: pending receives of each QP, in order
+  // Send comms with RCCL_IB_SIGNAL_INTERVAL > 1 or RCCL_IB_QP_BALANCE: unsignaled sends waiting on each QP
+  int nSignalQueues;
+  struct ncclIbSignalQueue* signalQueues;
+  int signalInterval;
+  int qpBalance;
+  // Inlining: smallest max_inline_data of the QPs (-1 before any), and the host memory handles
+  int maxInline;
+  void* hostMrs[NCCL_IB_MAX_HOST_MRS];
+  // Devices of a multi-rail comm, rail 0 is dev/pd/cq above. Requests all live in reqs.
+  int nRails;
+  int railDevs[NCCL_IB_MAX_RAILS];
+  struct ibv_pd* railPds[NCCL_IB_MAX_RAILS];
+  struct ibv_cq* railCqs[NCCL_IB_MAX_RAILS];
   uint64_t pad[1];
   struct ncclIbRequest reqs[MAX_REQUESTS];
 };
 
+// Selective signaling: only one multi-send in signalInterval is signaled on
+// each QP. Its completion also completes the unsignaled sends posted before it
+// on that QP, as RC QPs complete in order. covers[] holds the unsignaled tail
+// at the time each signaled WR was posted. When a test finds nothing to poll,
+// a signaled 0-byte write fences the unsignaled sends not covered yet.
+#define NCCL_IB_FENCE_WR_ID (~0ULL)
+#define NCCL_IB_MAX_SIGNALED (2*MAX_REQUESTS)
+struct ncclIbSignalQueue {
+  struct ibv_qp* qp;
+  int unsignaled; // Multi-sends since the last signaled one
+  int covered;    // All pending sends are covered by a signaled WR
+  uint64_t lastAddr;
+  uint32_t lastRkey;
+  uint32_t head, tail;
+  uint64_t wrIds[MAX_REQUESTS];
+  uint32_t cHead, cTail;
+  uint32_t covers[NCCL_IB_MAX_SIGNALED];
+  // QP balancing: bytes and post time of each signaled WR, and the rate the QP drains at
+  uint64_t bytes; // Posted since the last signaled WR
+  uint64_t lastDone;
+  double bw;      // Bytes per ns, 0 until measured
+  uint64_t postBytes[NCCL_IB_MAX_SIGNALED];
+  uint64_t postTimes[NCCL_IB_MAX_SIGNALED];
+};
+
+// QP balancing: multi-sends are split over the QPs of a comm in proportion to
+// the rate each QP completed its recent writes at, so QPs whose path is
+// congested get fewer bytes. The rate is measured over the time the QP was
+// busy, and samples of small posts, which measure latency, are skipped.
+// Every QP keeps at least 1/NCCL_IB_BALANCE_MIN_SHARE of the largest weight
+// so it is still sampled when its path recovers.
+#define NCCL_IB_BALANCE_MIN_BYTES (1<<16)
+#define NCCL_IB_BALANCE_MIN_SHARE 8
+
+// Completions are polled in batches and dispatched through the wr_id to requests
+#define NCCL_IB_POLL_BATCH 32
+
+// Memory handle of a multi-rail comm, single rail comms use the ibv_mr directly
+struct ncclIbMrHandle {
+  struct ibv_mr* mrs[NCCL_IB_MAX_RAILS];
+};
+
+static inline struct ibv_mr* ncclIbGetMr(struct ncclIbVerbs* verbs, void* mhandle, int rail) {
+  return verbs->nRails == 1 ? (struct ibv_mr*)mhandle : ((struct ncclIbMrHandle*)mhandle)->mrs[rail];
+}
+
 struct ncclIbListenComm {
   int dev;
   struct ncclSocket sock;
@@ -459,6 +609,9 @@ struct alignas(64) ncclIbSendFifo {
   uint32_t nreqs;
   uint32_t tag;
   uint64_t idx;
+  // Second 32 bytes, only read when the receiver is multi-rail: it may land after the first half
+  uint32_t railRkeys[NCCL_IB_MAX_RAILS-1];
+  uint64_t railIdx;
 };
 
 struct ncclIbSendComm {
@@ -474,9 +627,17 @@ struct ncclIbSendComm {
   struct ibv_qp* qps[NCCL_IB_MAX_QPS];
   int nqps;
   int qpIndex;
+  int remNRails;
+  int srqCredits; // CQ entries reserved for the multi-send of fifoHead
   struct ibv_mr* fifoMr;
   int ar;
   struct ncclIbGidInfo gidInfo;
+  // Connection pool key
+  uint64_t poolId;
+  int remDev;
+  union ncclSocketAddress remAddr;
+  int trafficClass;
+  int serviceLevel;
 };
 // The SendFifo needs to be 32-byte aligned and each element needs
 // to be a 32-byte multiple, so that an entry does not get split and
@@ -484,12 +645,13 @@ struct ncclIbSendComm {
 static_assert((offsetof(struct ncclIbSendComm, fifo) % 32) == 0, "ncclIbSendComm fifo must be 32-byte aligned");
 static_assert((sizeof(struct ncclIbSendFifo) % 32) == 0, "ncclIbSendFifo element size must be 32-byte multiples");
 
+// One loopback QP per rail: a read only flushes the writes of its own NIC
 struct ncclIbGpuFlush {
   int enabled;
   int hostMem;
-  struct ibv_mr* hostMr;
-  struct ibv_sge sge;
-  struct ibv_qp* qp;
+  struct ibv_mr* hostMr[NCCL_IB_MAX_RAILS];
+  struct ibv_sge sge[NCCL_IB_MAX_RAILS];
+  struct ibv_qp* qp[NCCL_IB_MAX_RAILS];
 };
 
 struct ncclIbRemFifo {
@@ -497,7 +659,6 @@ struct ncclIbRemFifo {
   uint64_t fifoTail;
   uint64_t addr;
   uint32_t rkey;
-  uint32_t flags;
   struct ibv_mr* mr;
   struct ibv_sge sge;
 };
@@ -512,59 +673,492 @@ struct ncclIbRecvComm {
   int qpIndex;
   struct ncclIbGpuFlush gpuFlush;
   struct ncclIbGidInfo gidInfo;
+  uint64_t poolId;
 };
 static_assert((offsetof(struct ncclIbRecvComm, remFifo) % 32) == 0, "ncclIbSendComm fifo must be 32-byte aligned");
 
 NCCL_PARAM(IbQpsPerConn, "IB_QPS_PER_CONNECTION", 1);
+RCCL_PARAM(IbSrq, "IB_SRQ", 0);
+RCCL_PARAM(IbOdp, "IB_ODP", 0);
+RCCL_PARAM(IbOdpPrefetchMin, "IB_ODP_PREFETCH_MIN", 1<<20);
+RCCL_PARAM(IbSignalInterval, "IB_SIGNAL_INTERVAL", 1);
+RCCL_PARAM(IbQpBalance, "IB_QP_BALANCE", 0);
+RCCL_PARAM(IbSrqSize, "IB_SRQ_SIZE", 8192);
+RCCL_PARAM(IbSrqCqSize, "IB_SRQ_CQ_SIZE", 16384);
+RCCL_PARAM(IbMrCacheSize, "IB_MR_CACHE_SIZE", 0);
+RCCL_PARAM(IbConnPool, "IB_CONN_POOL", 0);
+
+// Connection pool: with RCCL_IB_CONN_POOL > 0, up to that many idle send and
+// recv comms are parked at close instead of being destroyed. A later connect
+// between the same devices offers the id of a parked send comm in place of
+// its QP info, and when the receiver still holds the recv comm parked under
+// that id both sides carry on with the existing QPs, FIFO and flush
+// resources. Otherwise the sender drops its parked comm and a fresh
+// connection is set up. Both sides evict their least recently parked comm
+// when the pool is full.
+struct ncclIbPoolSlot {
+  void* comm;
+  uint64_t lastUsed;
+};
 
-ncclResult_t ncclIbInitVerbs(int dev, struct ibv_context* ctx, struct ncclIbVerbs* verbs) {
-  verbs->dev = dev;
+static pthread_mutex_t ncclIbPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ncclIbPoolSlot* ncclIbPoolSlots[2]; // Parked send and recv comms
+static uint64_t ncclIbPoolClock;
+
+static ncclResult_t ncclIbDestroySend(struct ncclIbSendComm* comm);
+static ncclResult_t ncclIbDestroyRecv(struct ncclIbRecvComm* comm);
+
+static int ncclIbSameHost(const union ncclSocketAddress* a, const union ncclSocketAddress* b) {
+  if (a->sa.sa_family != b->sa.sa_family) return 0;
+  if (a->sa.sa_family == AF_INET) return a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+  return memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof(struct in6_addr)) == 0;
+}
+
+// Returns 0 when the pool is disabled. *evicted is the comm to destroy to make room.
+static int ncclIbPoolPark(int recv, void* comm, void** evicted) {
+  int size = rcclParamIbConnPool();
+  *evicted = NULL;
+  if (size <= 0) return 0;
+  pthread_mutex_lock(&ncclIbPoolLock);
+  if (ncclIbPoolSlots[recv] == NULL && ncclCalloc(ncclIbPoolSlots+recv, size) != ncclSuccess) {
+    pthread_mutex_unlock(&ncclIbPoolLock);
+    return 0;
+  }
+  struct ncclIbPoolSlot* slot = ncclIbPoolSlots[recv];
+  for (int i=0; i<size && slot->comm; i++) {
+    struct ncclIbPoolSlot* s = ncclIbPoolSlots[recv]+i;
+    if (s->comm == NULL || s->lastUsed < slot->lastUsed) slot = s;
+  }
+  *evicted = slot->comm;
+  slot->comm = comm;
+  slot->lastUsed = ++ncclIbPoolClock;
+  pthread_mutex_unlock(&ncclIbPoolLock);
+  return 1;
+}
 
+static struct ncclIbSendComm* ncclIbPoolTakeSend(int dev, struct ncclIbSendComm* key) {
+  struct ncclIbSendComm* comm = NULL;
+  pthread_mutex_lock(&ncclIbPoolLock);
+  for (int i=0; ncclIbPoolSlots[0] && i<rcclParamIbConnPool() && comm == NULL; i++) {
+    struct ncclIbSendComm* c = (struct ncclIbSendComm*)ncclIbPoolSlots[0][i].comm;
+    if (c == NULL || c->verbs.dev != dev || c->remDev != key->remDev || !ncclIbSameHost(&c->remAddr, &key->remAddr) ||
+        c->trafficClass != key->trafficClass || c->serviceLevel != key->serviceLevel) continue;
+    comm = c;
+    ncclIbPoolSlots[0][i].comm = NULL;
+  }
+  pthread_mutex_unlock(&ncclIbPoolLock);
+  return comm;
+}
+
+static struct ncclIbRecvComm* ncclIbPoolTakeRecv(int dev, uint64_t poolId) {
+  struct ncclIbRecvComm* comm = NULL;
+  pthread_mutex_lock(&ncclIbPoolLock);
+  for (int i=0; ncclIbPoolSlots[1] && i<rcclParamIbConnPool() && comm == NULL; i++) {
+    struct ncclIbRecvComm* c = (struct ncclIbRecvComm*)ncclIbPoolSlots[1][i].comm;
+    if (c == NULL || c->verbs.dev != dev || c->poolId != poolId) continue;
+    comm = c;
+    ncclIbPoolSlots[1][i].comm = NULL;
+  }
+  pthread_mutex_unlock(&ncclIbPoolLock);
+  return comm;
+}
+
+// Only comms without requests in flight can be handed to another connection
+static int ncclIbVerbsIdle(struct ncclIbVerbs* verbs) {
+  for (int i=0; i<MAX_REQUESTS; i++) {
+    if (verbs->reqs[i].type != NCCL_NET_IB_REQ_UNUSED) return 0;
+  }
+  return 1;
+}
+
+/* MR cache helpers, called with the device lock held */
+static inline int ncclIbMrBucket(struct ncclIbMrCache* cache, uintptr_t addr, int pages) {
+  uint64_t h = (addr >> 12) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)pages;
+  return (int)((h ^ (h >> 29)) & (cache->nBuckets-1));
+}
+
+static int ncclIbMrFind(struct ncclIbMrCache* cache, uintptr_t addr, int pages) {
+  if (cache->nBuckets == 0) return -1;
+  for (int slot = cache->buckets[ncclIbMrBucket(cache, addr, pages)]; slot != -1; slot = cache->slots[slot].hashNext) {
+    if (cache->slots[slot].addr == addr && cache->slots[slot].pages == pages) return slot;
+  }
+  return -1;
+}
+
+static ncclResult_t ncclIbMrInsert(struct ncclIbMrCache* cache, uintptr_t addr, int pages, struct ibv_mr* mr) {
+  if (cache->freeSlot == -1) {
+    int capacity = cache->capacity < 32 ? 32 : 2*cache->capacity;
+    NCCLCHECK(ncclRealloc(&cache->slots, cache->capacity, capacity));
+    for (int s=capacity-1; s>=cache->capacity; s--) {
+      cache->slots[s].hashNext = cache->freeSlot;
+      cache->freeSlot = s;
+    }
+    cache->capacity = capacity;
+  }
+  if (cache->population >= cache->nBuckets) {
+    // Keep the load factor under 1, rehash everything
+    int nBuckets = cache->nBuckets ? 2*cache->nBuckets : 64;
+    int* buckets = (int*)malloc(nBuckets*sizeof(int));
+    if (buckets == NULL) {
+      WARN("NET/IB : failed to allocate %d MR cache buckets", nBuckets);
+      return ncclSystemError;
+    }
+    for (int b=0; b<nBuckets; b++) buckets[b] = -1;
+    int* old = cache->buckets;
+    int nOld = cache->nBuckets;
+    cache->buckets = buckets;
+    cache->nBuckets = nBuckets;
+    for (int b=0; b<nOld; b++) {
+      for (int slot = old[b], next; slot != -1; slot = next) {
+        next = cache->slots[slot].hashNext;
+        int nb = ncclIbMrBucket(cache, cache->slots[slot].addr, cache->slots[slot].pages);
+        cache->slots[slot].hashNext = buckets[nb];
+        buckets[nb] = slot;
+      }
+    }
+    free(old);
+  }
+  int slot = cache->freeSlot;
+  struct ncclIbMr* e = cache->slots+slot;
+  cache->freeSlot = e->hashNext;
+  e->addr = addr;
+  e->pages = pages;
+  e->refs = 1;
+  e->mr = mr;
+  e->lruPrev = e->lruNext = -1;
+  int b = ncclIbMrBucket(cache, addr, pages);
+  e->hashNext = cache->buckets[b];
+  cache->buckets[b] = slot;
+  cache->population++;
+  return ncclSuccess;
+}
+
+static void ncclIbMrLruUnlink(struct ncclIbMrCache* cache, int slot) {
+  struct ncclIbMr* e = cache->slots+slot;
+  if (e->lruPrev != -1) cache->slots[e->lruPrev].lruNext = e->lruNext; else cache->lruHead = e->lruNext;
+  if (e->lruNext != -1) cache->slots[e->lruNext].lruPrev = e->lruPrev; else cache->lruTail = e->lruPrev;
+  e->lruPrev = e->lruNext = -1;
+  cache->nIdle--;
+}
+
+// Removes the slot from the cache and deregisters its MR
+static ncclResult_t ncclIbMrRemove(struct ncclIbMrCache* cache, int slot) {
+  struct ncclIbMr* e = cache->slots+slot;
+  int* prev = cache->buckets+ncclIbMrBucket(cache, e->addr, e->pages);
+  while (*prev != slot) prev = &cache->slots[*prev].hashNext;
+  *prev = e->hashNext;
+  struct ibv_mr* mr = e->mr;
+  e->mr = NULL;
+  e->hashNext = cache->freeSlot;
+  cache->freeSlot = slot;
+  cache->population--;
+  NCCLCHECK(wrap_ibv_dereg_mr(mr));
+  return ncclSuccess;
+}
+
+// Drops the last reference of a slot: keep it in the LRU if there is room, evict the oldest ones beyond
+static ncclResult_t ncclIbMrRelease(struct ncclIbMrCache* cache, int slot) {
+  int64_t maxIdle = rcclParamIbMrCacheSize();
+  if (maxIdle <= 0) return ncclIbMrRemove(cache, slot);
+  struct ncclIbMr* e = cache->slots+slot;
+  e->lruPrev = -1;
+  e->lruNext = cache->lruHead;
+  if (cache->lruHead != -1) cache->slots[cache->lruHead].lruPrev = slot; else cache->lruTail = slot;
+  cache->lruHead = slot;
+  cache->nIdle++;
+  while (cache->nIdle > maxIdle) {
+    int victim = cache->lruTail;
+    ncclIbMrLruUnlink(cache, victim);
+    NCCLCHECK(ncclIbMrRemove(cache, victim));
+    cache->evictions++;
+  }
+  return ncclSuccess;
+}
+
+// Deregisters the unreferenced MRs before their PD goes away
+static ncclResult_t ncclIbMrCacheFlush(int dev) {
+  struct ncclIbMrCache* cache = &ncclIbDevs[dev].mrCache;
+  while (cache->lruHead != -1) {
+    int slot = cache->lruHead;
+    ncclIbMrLruUnlink(cache, slot);
+    NCCLCHECK(ncclIbMrRemove(cache, slot));
+  }
+  if (cache->hits + cache->misses) {
+    INFO(NCCL_NET, "NET/IB : %s MR cache hits %lu misses %lu evictions %lu", ncclIbDevs[dev].devName, cache->hits, cache->misses, cache->evictions);
+  }
+  if (cache->population == 0) {
+    free(cache->slots);
+    free(cache->buckets);
+    cache->slots = NULL;
+    cache->buckets = NULL;
+    cache->capacity = cache->nBuckets = 0;
+    cache->freeSlot = -1;
+  }
+  return ncclSuccess;
+}
+
+// Shared receive queue mode: all single-rail comms of the process on a device
+// share one SRQ and one CQ. Receives carry no buffer (data comes as RDMA writes),
+// so any QP may consume any posted WR; the owner of a completion is found from
+// its qp_num and, for receives, the request from the in-order ring of that QP.
+// CQ entries are reserved when posting so the shared CQ can never overflow.
+#define NCCL_IB_SRQ_QP_BUCKETS 1024
+struct ncclIbSrqQp {
+  uint32_t qpn;
+  int qpIndex; // Index of the QP in its recv comm, -1 if it never receives
+  struct ncclIbVerbs* verbs;
+  struct ncclIbSrqQp* next;
+};
+
+struct ncclIbSrqRing {
+  uint32_t head, tail;
+  uint8_t reqs[MAX_REQUESTS];
+};
+
+struct ncclIbSrq {
+  pthread_mutex_t lock;
+  int refs;
+  struct ibv_cq* cq;
+  struct ibv_srq* srq;
+  int cqDepth;
+  int srqDepth;
+  int inflight; // Completions the CQ may still have to hold
+  int posted;   // WRs on the SRQ that were not consumed yet
+  struct ncclIbSrqQp* qps[NCCL_IB_SRQ_QP_BUCKETS];
+};
+
+// Flushes may always use the last MAX_REQUESTS CQ entries, as they complete locally.
+#define NCCL_IB_SRQ_CQ_HEADROOM MAX_REQUESTS
+
+static ncclResult_t ncclIbSrqAttach(int dev, struct ncclIbVerbs* verbs) {
+  ncclResult_t res = ncclSuccess;
+  pthread_mutex_lock(&ncclIbDevs[dev].lock);
+  struct ncclIbSrq* srq = ncclIbDevs[dev].srq;
+  if (srq == NULL) {
+    struct ibv_device_attr devAttr;
+    struct ibv_srq_init_attr srqAttr;
+    NCCLCHECKGOTO(wrap_ibv_query_device(ncclIbDevs[dev].context, &devAttr), res, exit);
+    NCCLCHECKGOTO(ncclCalloc(&srq, 1), res, exit);
+    pthread_mutex_init(&srq->lock, NULL);
+    srq->cqDepth = std::min<int64_t>(rcclParamIbSrqCqSize(), devAttr.max_cqe);
+    srq->srqDepth = std::min<int64_t>(rcclParamIbSrqSize(), devAttr.max_srq_wr);
+    if (srq->cqDepth <= 2*NCCL_IB_SRQ_CQ_HEADROOM || srq->srqDepth < NCCL_IB_MAX_QPS) {
+      WARN("NET/IB : %s SRQ too small, CQ depth %d SRQ depth %d", ncclIbDevs[dev].devName, srq->cqDepth, srq->srqDepth);
+      res = ncclInvalidUsage;
+      goto fail;
+    }
+    NCCLCHECKGOTO(wrap_ibv_create_cq(&srq->cq, ncclIbDevs[dev].context, srq->cqDepth, NULL, NULL, 0), res, fail);
+    memset(&srqAttr, 0, sizeof(srqAttr));
+    srqAttr.attr.max_wr = srq->srqDepth;
+    srqAttr.attr.max_sge = 1;
+    NCCLCHECKGOTO(wrap_ibv_create_srq(&srq->srq, ncclIbDevs[dev].pd, &srqAttr), res, fail);
+    INFO(NCCL_NET, "NET/IB : %s using a shared receive queue of %d WRs and a shared CQ of %d entries", ncclIbDevs[dev].devName, srq->srqDepth, srq->cqDepth);
+    ncclIbDevs[dev].srq = srq;
+  }
+  srq->refs++;
+  verbs->srq = srq;
+  verbs->cq = verbs->railCqs[0] = srq->cq;
+exit:
+  pthread_mutex_unlock(&ncclIbDevs[dev].lock);
+  return res;
+fail:
+  if (srq->cq) wrap_ibv_destroy_cq(srq->cq);
+  pthread_mutex_destroy(&srq->lock);
+  free(srq);
+  goto exit;
+}
+
+static ncclResult_t ncclIbSrqDetach(int dev, struct ncclIbVerbs* verbs) {
+  ncclResult_t res = ncclSuccess;
+  struct ncclIbSrq* srq = verbs->srq;
+  free(verbs->srqRings);
+  verbs->srqRings = NULL;
+  pthread_mutex_lock(&ncclIbDevs[dev].lock);
+  if (0 == --srq->refs) {
+    ncclIbDevs[dev].srq = NULL;
+    NCCLCHECKGOTO(wrap_ibv_destroy_srq(srq->srq), res, exit);
+    NCCLCHECKGOTO(wrap_ibv_destroy_cq(srq->cq), res, exit);
+    pthread_mutex_destroy(&srq->lock);
+    free(srq);
+  }
+exit:
+  pthread_mutex_unlock(&ncclIbDevs[dev].lock);
+  return res;
+}
+
+static ncclResult_t ncclIbSrqAddQp(struct ncclIbVerbs* verbs, struct ibv_qp* qp, int qpIndex) {
+  struct ncclIbSrq* srq = verbs->srq;
+  struct ncclIbSrqQp* e;
+  NCCLCHECK(ncclCalloc(&e, 1));
+  e->qpn = qp->qp_num;
+  e->qpIndex = qpIndex;
+  e->verbs = verbs;
+  pthread_mutex_lock(&srq->lock);
+  e->next = srq->qps[e->qpn%NCCL_IB_SRQ_QP_BUCKETS];
+  srq->qps[e->qpn%NCCL_IB_SRQ_QP_BUCKETS] = e;
+  pthread_mutex_unlock(&srq->lock);
+  return ncclSuccess;
+}
+
+static void ncclIbSrqRemoveQp(struct ncclIbVerbs* verbs, struct ibv_qp* qp) {
+  struct ncclIbSrq* srq = verbs->srq;
+  pthread_mutex_lock(&srq->lock);
+  for (struct ncclIbSrqQp** e = srq->qps+qp->qp_num%NCCL_IB_SRQ_QP_BUCKETS; *e; e = &(*e)->next) {
+    if ((*e)->qpn == qp->qp_num) {
+      struct ncclIbSrqQp* found = *e;
+      *e = found->next;
+      free(found);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&srq->lock);
+}
+
+static struct ncclIbSrqQp* ncclIbSrqFindQp(struct ncclIbSrq* srq, uint32_t qpn) {
+  struct ncclIbSrqQp* e = srq->qps[qpn%NCCL_IB_SRQ_QP_BUCKETS];
+  while (e && e->qpn != qpn) e = e->next;
+  return e;
+}
+
+// Reserves CQ entries and SRQ WRs, leaving 'headroom' CQ entries free. Called with srq->lock held.
+static inline int ncclIbSrqReserve(struct ncclIbSrq* srq, int cqes, int wrs, int headroom) {
+  if (srq->inflight + cqes > srq->cqDepth - headroom || srq->posted + wrs > srq->srqDepth) return 0;
+  srq->inflight += cqes;
+  srq->posted += wrs;
+  return 1;
+}
+
+// Implicit ODP: host buffers need no registration at all, the NIC faults pages
+// in on access and follows the process page tables. GPU memory still needs
+// pinned registrations. Called with the device lock held when its PD is created.
+static void ncclIbOdpInit(int dev) {
+  static int shown = 0;
+  unsigned int flags = IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ|IBV_ACCESS_ON_DEMAND;
+  ncclIbDevs[dev].odpMr = wrap_direct_ibv_reg_mr(ncclIbDevs[dev].pd, NULL, SIZE_MAX, flags);
+  if (shown++ == 0) {
+    if (ncclIbDevs[dev].odpMr) {
+      INFO(NCCL_INIT|NCCL_NET, "NET/IB : %s using implicit ODP for host memory", ncclIbDevs[dev].devName);
+    } else {
+      INFO(NCCL_INIT|NCCL_NET, "NET/IB : %s does not support implicit ODP, host memory is pinned", ncclIbDevs[dev].devName);
+    }
+  }
+}
+
+static int ncclIbOdpPrefetchEnabled = 1;
+
+// Asks the NIC to fault in the pages of a large transfer ahead of it
+static void ncclIbOdpPrefetch(struct ncclIbVerbs* verbs, void* mhandle, void* data, int size, int write) {
+  if (!ncclIbOdpPrefetchEnabled || rcclParamIbOdpPrefetchMin() <= 0 || size < rcclParamIbOdpPrefetchMin()) return;
+  for (int r=0; r<verbs->nRails; r++) {
+    struct ibv_mr* mr = ncclIbGetMr(verbs, mhandle, r);
+    if (mr == NULL || mr != ncclIbDevs[verbs->railDevs[r]].odpMr) continue;
+    // Prefetch is only advice: without it the NIC faults the pages in itself
+    if (wrap_ibv_advise_mr_prefetch(verbs->railPds[r], mr->lkey, data, size, write) != ncclSuccess) {
+      INFO(NCCL_NET, "NET/IB : ODP prefetch is not available, disabling it");
+      ncclIbOdpPrefetchEnabled = 0;
+      return;
+    }
+  }
+}
+
+// Adds a rail on dev to the verbs, the first one is rail 0
+ncclResult_t ncclIbAddRail(int dev, struct ncclIbVerbs* verbs) {
+  struct ibv_context* ctx = ncclIbDevs[dev].context;
   pthread_mutex_lock(&ncclIbDevs[dev].lock);
   if (0 == ncclIbDevs[dev].pdRefs++) {
     ncclResult_t res;
     NCCLCHECKGOTO(wrap_ibv_alloc_pd(&ncclIbDevs[dev].pd, ctx), res, failure);
+    if (rcclParamIbOdp()) ncclIbOdpInit(dev);
     if (0) {
     failure:
+      ncclIbDevs[dev].pdRefs--;
       pthread_mutex_unlock(&ncclIbDevs[dev].lock);
       return res;
     }
   }
-  verbs->pd = ncclIbDevs[dev].pd;
+  int rail = verbs->nRails;
+  verbs->railDevs[rail] = dev;
+  verbs->railPds[rail] = ncclIbDevs[dev].pd;
   pthread_mutex_unlock(&ncclIbDevs[dev].lock);
 
   // Recv requests can generate 2 completions (one for the post FIFO, one for the Recv).
-  NCCLCHECK(wrap_ibv_create_cq(&verbs->cq, ctx, 2*MAX_REQUESTS*ncclParamIbQpsPerConn(), NULL, NULL, 0));
+  if (rail == 0 && rcclParamIbSrq() && ncclIbDevs[dev].nRails == 1) {
+    NCCLCHECK(ncclIbSrqAttach(dev, verbs));
+  } else {
+    NCCLCHECK(wrap_ibv_create_cq(verbs->railCqs+rail, ctx, 2*MAX_REQUESTS*ncclParamIbQpsPerConn(), NULL, NULL, 0));
+  }
+  verbs->nRails++;
+  if (rail == 0) {
+    verbs->dev = dev;
+    verbs->pd = verbs->railPds[0];
+    verbs->cq = verbs->railCqs[0];
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbInitVerbs(int dev, struct ibv_context* ctx, struct ncclIbVerbs* verbs) {
+  verbs->nRails = 0;
+  verbs->srq = NULL;
+  verbs->srqRings = NULL;
+  verbs->signalInterval = 1;
+  verbs->qpBalance = 0;
+  verbs->maxInline = -1;
+  memset(verbs->hostMrs, 0, sizeof(verbs->hostMrs));
+  verbs->nSignalQueues = 0;
+  verbs->signalQueues = NULL;
+  NCCLCHECK(ncclIbAddRail(dev, verbs));
+  for (int r=1; r<ncclIbDevs[dev].nRails; r++) NCCLCHECK(ncclIbAddRail(ncclIbDevs[dev].rails[r], verbs));
   return ncclSuccess;
 }
 
 ncclResult_t ncclIbDestroyVerbs(struct ncclIbVerbs* verbs) {
-  ncclResult_t res;
-  NCCLCHECK(wrap_ibv_destroy_cq(verbs->cq));
+  ncclResult_t res = ncclSuccess;
+  free(verbs->signalQueues);
+  verbs->signalQueues = NULL;
+  for (int r=0; r<verbs->nRails; r++) {
+    int dev = verbs->railDevs[r];
+    if (r == 0 && verbs->srq) {
+      NCCLCHECK(ncclIbSrqDetach(dev, verbs));
+    } else {
+      NCCLCHECK(wrap_ibv_destroy_cq(verbs->railCqs[r]));
+    }
 
-  pthread_mutex_lock(&ncclIbDevs[verbs->dev].lock);
-  if (0 == --ncclIbDevs[verbs->dev].pdRefs) {
-    NCCLCHECKGOTO(wrap_ibv_dealloc_pd(ncclIbDevs[verbs->dev].pd), res, returning);
+    pthread_mutex_lock(&ncclIbDevs[dev].lock);
+    if (0 == --ncclIbDevs[dev].pdRefs) {
+      res = ncclIbMrCacheFlush(dev);
+      if (res == ncclSuccess && ncclIbDevs[dev].odpMr) {
+        res = wrap_ibv_dereg_mr(ncclIbDevs[dev].odpMr);
+        ncclIbDevs[dev].odpMr = NULL;
+      }
+      if (res == ncclSuccess) res = wrap_ibv_dealloc_pd(ncclIbDevs[dev].pd);
+    }
+    pthread_mutex_unlock(&ncclIbDevs[dev].lock);
+    NCCLCHECK(res);
   }
-  res = ncclSuccess;
-returning:
-  pthread_mutex_unlock(&ncclIbDevs[verbs->dev].lock);
-  return res;
+  return ncclSuccess;
 }
 
-ncclResult_t ncclIbCreateQp(uint8_t ib_port, struct ncclIbVerbs* verbs, int access_flags, struct ibv_qp** qp) {
+ncclResult_t ncclIbCreateQp(uint8_t ib_port, struct ncclIbVerbs* verbs, int rail, int access_flags, struct ibv_qp** qp) {
   struct ibv_qp_init_attr qpInitAttr;
   memset(&qpInitAttr, 0, sizeof(struct ibv_qp_init_attr));
-  qpInitAttr.send_cq = verbs->cq;
-  qpInitAttr.recv_cq = verbs->cq;
+  qpInitAttr.send_cq = verbs->railCqs[rail];
+  qpInitAttr.recv_cq = verbs->railCqs[rail];
   qpInitAttr.qp_type = IBV_QPT_RC;
   // We might send 2 messages per send (RDMA and RDMA_WITH_IMM)
   qpInitAttr.cap.max_send_wr = 2*MAX_REQUESTS;
   qpInitAttr.cap.max_recv_wr = MAX_REQUESTS;
   qpInitAttr.cap.max_send_sge = 1;
   qpInitAttr.cap.max_recv_sge = 1;
-  qpInitAttr.cap.max_inline_data = ncclParamIbUseInline() ? sizeof(struct ncclIbSendFifo) : 0;
-  NCCLCHECK(wrap_ibv_create_qp(qp, verbs->pd, &qpInitAttr));
+  if (rail == 0 && verbs->srq) {
+    qpInitAttr.srq = verbs->srq->srq;
+    qpInitAttr.cap.max_recv_wr = 0;
+    qpInitAttr.cap.max_recv_sge = 0;
+  }
+  qpInitAttr.cap.max_inline_data = std::max<int64_t>(ncclParamIbUseInline() ? sizeof(struct ncclIbSendFifo) : 0, rcclParamIbInlineSize());
+  NCCLCHECK(wrap_ibv_create_qp(qp, verbs->railPds[rail], &qpInitAttr));
+  // The provider returns the inline size it actually supports, which may be larger
+  int maxInline = qpInitAttr.cap.max_inline_data;
+  verbs->maxInline = verbs->maxInline < 0 ? maxInline : std::min(verbs->maxInline, maxInline);
   struct ibv_qp_attr qpAttr;
   memset(&qpAttr, 0, sizeof(struct ibv_qp_attr));
   qpAttr.qp_state = IBV_QPS_INIT;
@@ -591,12 +1185,12 @@ ncclResult_t ncclIbRtrQp(struct ibv_qp* qp, uint32_t qpn, struct ncclIbQpInfo* i
     qpAttr.ah_attr.grh.flow_label = 0;
     qpAttr.ah_attr.grh.sgid_index = ncclParamIbGidIndex();
     qpAttr.ah_attr.grh.hop_limit = 255;
-    qpAttr.ah_attr.grh.traffic_class = ncclParamIbTc();
+    qpAttr.ah_attr.grh.traffic_class = ncclNetTrafficClass != NCCL_CONFIG_UNDEF_INT ? ncclNetTrafficClass : ncclParamIbTc();
   } else {
     qpAttr.ah_attr.is_global = 0;
     qpAttr.ah_attr.dlid = info->lid;
   }
-  qpAttr.ah_attr.sl = ncclParamIbSl();
+  qpAttr.ah_attr.sl = ncclNetServiceLevel != NCCL_CONFIG_UNDEF_INT ? ncclNetServiceLevel : ncclParamIbSl();
   qpAttr.ah_attr.src_path_bits = 0;
   qpAttr.ah_attr.port_num = info->ib_port;
   NCCLCHECK(wrap_ibv_modify_qp(qp, &qpAttr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER));
@@ -616,6 +1210,48 @@ ncclResult_t ncclIbRtsQp(struct ibv_qp* qp) {
   return ncclSuccess;
 }
 
+// Fills the address of each rail of the verbs, lowering info->mtu to the smallest one
+static ncclResult_t ncclIbRailsInfo(struct ncclIbVerbs* verbs, struct ncclIbQpInfo* info) {
+  info->nRails = verbs->nRails;
+  for (int r=0; r<verbs->nRails; r++) {
+    struct ncclIbDev* dev = ncclIbDevs+verbs->railDevs[r];
+    struct ibv_port_attr portAttr;
+    NCCLCHECK(wrap_ibv_query_port(dev->context, dev->port, &portAttr));
+    struct ncclIbRailAddr* addr = info->rails+r;
+    addr->lid = portAttr.lid;
+    addr->ib_port = dev->port;
+    addr->spn = addr->iid = 0;
+    if (portAttr.link_layer == IBV_LINK_LAYER_ETHERNET) {
+      union ibv_gid gid;
+      NCCLCHECK(wrap_ibv_query_gid(dev->context, dev->port, ncclParamIbGidIndex(), &gid));
+      addr->spn = gid.global.subnet_prefix;
+      addr->iid = gid.global.interface_id;
+    }
+    info->mtu = std::min(info->mtu, portAttr.active_mtu);
+    if (r > 0) INFO(NCCL_NET,"NET/IB: Rail %d Dev %s Port %d mtu %d LID %d", r, dev->devName, dev->port, portAttr.active_mtu, portAttr.lid);
+  }
+  return ncclSuccess;
+}
+
+// Address QP q of the comm described by info sits on
+static void ncclIbQpRailInfo(const struct ncclIbQpInfo* info, int q, struct ncclIbQpInfo* railInfo) {
+  const struct ncclIbRailAddr* addr = info->rails + q%info->nRails;
+  railInfo->lid = addr->lid;
+  railInfo->ib_port = addr->ib_port;
+  railInfo->spn = addr->spn;
+  railInfo->iid = addr->iid;
+  railInfo->link_layer = info->link_layer;
+  railInfo->mtu = info->mtu;
+}
+
+static ncclResult_t ncclIbCheckQpInfo(const struct ncclIbQpInfo* info) {
+  if (info->nqps < 1 || info->nqps > NCCL_IB_MAX_QPS || info->nRails < 1 || info->nRails > NCCL_IB_MAX_RAILS) {
+    WARN("NET/IB : peer sent invalid connection info, %d QPs on %d rails", info->nqps, info->nRails);
+    return ncclInternalError;
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbListen(int dev, void* opaqueHandle, void** listenComm) {
   struct ncclIbListenComm* comm;
   NCCLCHECK(ncclCalloc(&comm, 1));
@@ -624,6 +1260,7 @@ ncclResult_t ncclIbListen(int dev, void* opaqueHandle, void** listenComm) {
   memset(handle, 0, sizeof(struct ncclIbHandle));
   comm->dev = dev;
   handle->magic = NCCL_SOCKET_MAGIC;
+  handle->dev = dev;
   NCCLCHECK(ncclSocketInit(&comm->sock, &ncclIbIfAddr, handle->magic, ncclSocketTypeNetIb, NULL, 1));
   if (ncclParamIbSockServerPortReuse()) {
     // reuse the socket address and fd for listen system call
@@ -670,15 +1307,48 @@ ib_connect_check:
   NCCLCHECK(ncclSocketReady(&comm->sock, &ready));
   if (!ready) return ncclSuccess;
 
+  comm->remDev = handle->dev;
+  memcpy(&comm->remAddr, &handle->connectAddr, sizeof(union ncclSocketAddress));
+  comm->trafficClass = ncclNetTrafficClass;
+  comm->serviceLevel = ncclNetServiceLevel;
+  stage->pooled = rcclParamIbConnPool() > 0 ? ncclIbPoolTakeSend(dev, comm) : NULL;
+  if (stage->pooled) {
+    // Offer the parked connection, the receiver answers with its id if it still has its side
+    struct ncclIbQpInfo offer;
+    memset(&offer, 0, sizeof(offer));
+    offer.poolId = ((struct ncclIbSendComm*)stage->pooled)->poolId;
+    stage->state = ncclIbCommStateSend;
+    stage->offset = 0;
+    NCCLCHECK(ncclIbMalloc((void**)&stage->buffer, sizeof(offer)));
+    memcpy(stage->buffer, &offer, sizeof(offer));
+    goto ib_send;
+  }
+
+ib_setup:
   // IB Setup
   struct ibv_context* ctx;
   ctx = ncclIbDevs[dev].context;
   NCCLCHECK(ncclIbInitVerbs(dev, ctx, &comm->verbs));
   uint8_t ib_port;
   ib_port = ncclIbDevs[dev].port;
-  comm->nqps = ncclParamIbQpsPerConn();
+  // Multi-rail: QPs are spread over the rails round-robin
+  comm->nqps = std::min<int64_t>(ncclParamIbQpsPerConn()*comm->verbs.nRails, NCCL_IB_MAX_QPS);
   for (int q=0; q<comm->nqps; q++) {
-    NCCLCHECK(ncclIbCreateQp(ib_port, &comm->verbs, IBV_ACCESS_REMOTE_WRITE, comm->qps+q));
+    int rail = q%comm->verbs.nRails;
+    NCCLCHECK(ncclIbCreateQp(ncclIbDevs[comm->verbs.railDevs[rail]].port, &comm->verbs, rail, IBV_ACCESS_REMOTE_WRITE, comm->qps+q));
+    if (comm->verbs.srq) NCCLCHECK(ncclIbSrqAddQp(&comm->verbs, comm->qps[q], -1));
+  }
+  // Unsignaled WRs hold send queue entries until a later signaled one is polled
+  comm->verbs.signalInterval = std::min<int64_t>(std::max<int64_t>(rcclParamIbSignalInterval(), 1), 16);
+  // QP balancing times completions through the signal queues
+  comm->verbs.qpBalance = rcclParamIbQpBalance() && comm->nqps > 1 ? 1 : 0;
+  if (comm->verbs.signalInterval > 1 || comm->verbs.qpBalance) {
+    NCCLCHECK(ncclCalloc(&comm->verbs.signalQueues, comm->nqps));
+    comm->verbs.nSignalQueues = comm->nqps;
+    for (int q=0; q<comm->nqps; q++) {
+      comm->verbs.signalQueues[q].qp = comm->qps[q];
+      comm->verbs.signalQueues[q].covered = 1;
+    }
   }
   comm->ar = ncclIbDevs[dev].ar; // ADAPTIVE_ROUTING
 
@@ -689,6 +1359,13 @@ ib_connect_check:
   qpInfo.ib_port = ib_port;
   for (int q=0; q<comm->nqps; q++) qpInfo.qpn[q] = comm->qps[q]->qp_num;
   qpInfo.mtu = portAttr.active_mtu;
+  qpInfo.nqps = comm->nqps;
+  NCCLCHECK(ncclIbRailsInfo(&comm->verbs, &qpInfo));
+  comm->poolId = 0;
+  if (rcclParamIbConnPool() > 0) {
+    while (comm->poolId == 0) NCCLCHECK(getRandomData(&comm->poolId, sizeof(comm->poolId)));
+  }
+  qpInfo.poolId = comm->poolId;
 
   // Prepare my fifo
   NCCLCHECK(wrap_ibv_reg_mr(&comm->fifoMr, comm->verbs.pd, comm->fifo, sizeof(struct ncclIbSendFifo)*MAX_REQUESTS*NCCL_NET_IB_MAX_RECVS, IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ));
@@ -729,12 +1406,40 @@ ib_connect:
   if (stage->offset != sizeof(remQpInfo)) return ncclSuccess;
 
   memcpy(&remQpInfo, stage->buffer, sizeof(ncclIbQpInfo));
+  if (stage->pooled) {
+    struct ncclIbSendComm* parked = (struct ncclIbSendComm*)stage->pooled;
+    stage->pooled = NULL;
+    free(stage->buffer);
+    stage->buffer = NULL;
+    if (remQpInfo.poolId != parked->poolId) {
+      NCCLCHECK(ncclIbDestroySend(parked));
+      goto ib_setup;
+    }
+    // Carry on with the parked QPs over the new socket
+    INFO(NCCL_NET, "NET/IB: Dev %d reusing pooled connection %lx", dev, parked->poolId);
+    memcpy(&parked->sock, &comm->sock, sizeof(struct ncclSocket));
+    free(comm);
+    comm = parked;
+    stage->comm = comm;
+    comm->ready = 1;
+    stage->state = ncclIbCommStateConnected;
+    stage->offset = 0;
+    goto ib_send_ready;
+  }
+  NCCLCHECK(ncclIbCheckQpInfo(&remQpInfo));
+  if (remQpInfo.nqps != comm->nqps) {
+    WARN("NET/IB : peer created %d QPs, expected %d", remQpInfo.nqps, comm->nqps);
+    return ncclInternalError;
+  }
+  comm->remNRails = remQpInfo.nRails;
 
   comm->gidInfo.remoteGid.global.subnet_prefix = remQpInfo.spn;
   comm->gidInfo.remoteGid.global.interface_id = remQpInfo.iid;
   for (int q=0; q<comm->nqps; q++) {
     struct ibv_qp* qp = comm->qps[q];
-    NCCLCHECK(ncclIbRtrQp(qp, remQpInfo.qpn[q], &remQpInfo));
+    struct ncclIbQpInfo railInfo;
+    ncclIbQpRailInfo(&remQpInfo, q, &railInfo);
+    NCCLCHECK(ncclIbRtrQp(qp, remQpInfo.qpn[q], &railInfo));
     NCCLCHECK(ncclIbRtsQp(qp));
   }
 
@@ -792,6 +1497,27 @@ ib_recv:
 
   /* copy back the received info */
   memcpy(&remQpInfo, stage->buffer, sizeof(struct ncclIbQpInfo));
+  if (remQpInfo.nqps == 0 && remQpInfo.poolId != 0) {
+    // Connection pool offer: take over the recv comm parked under that id, or refuse
+    struct ncclIbRecvComm* parked = ncclIbPoolTakeRecv(lComm->dev, remQpInfo.poolId);
+    struct ncclIbQpInfo reply;
+    memset(&reply, 0, sizeof(reply));
+    if (parked) {
+      memcpy(&parked->sock, &rComm->sock, sizeof(struct ncclSocket));
+      free(rComm);
+      rComm = parked;
+      stage->comm = rComm;
+      reply.poolId = rComm->poolId;
+    } else {
+      stage->refused = 1;
+    }
+    memcpy(stage->buffer, &reply, sizeof(reply));
+    stage->state = ncclIbCommStateSend;
+    stage->offset = 0;
+    goto ib_send;
+  }
+  NCCLCHECK(ncclIbCheckQpInfo(&remQpInfo));
+  rComm->poolId = remQpInfo.poolId;
 
   rComm->gidInfo.remoteGid.global.subnet_prefix = remQpInfo.spn;
   rComm->gidInfo.remoteGid.global.interface_id = remQpInfo.iid;
@@ -805,20 +1531,29 @@ ib_recv:
   NCCLCHECK(wrap_ibv_query_port(ctx, ib_port, &portAttr));
   NCCLCHECK(wrap_ibv_query_gid(ctx, ib_port, ncclParamIbGidIndex(), &rComm->gidInfo.localGid));
 
-  // QP Creation
+  // QP Creation, the sender picks the number of QPs
   NCCLCHECK(ncclIbInitVerbs(lComm->dev, ctx, &rComm->verbs));
-  rComm->nqps = ncclParamIbQpsPerConn();
+  rComm->nqps = remQpInfo.nqps;
+  if (rComm->verbs.srq) NCCLCHECK(ncclCalloc(&rComm->verbs.srqRings, rComm->nqps));
   for (int q=0; q<rComm->nqps; q++) {
-    NCCLCHECK(ncclIbCreateQp(ib_port, &rComm->verbs, IBV_ACCESS_REMOTE_WRITE, rComm->qps+q));
+    int rail = q%rComm->verbs.nRails;
+    NCCLCHECK(ncclIbCreateQp(ncclIbDevs[rComm->verbs.railDevs[rail]].port, &rComm->verbs, rail, IBV_ACCESS_REMOTE_WRITE, rComm->qps+q));
+    if (rComm->verbs.srq) NCCLCHECK(ncclIbSrqAddQp(&rComm->verbs, rComm->qps[q], q));
   }
 
   // Adjust the MTU
-  remQpInfo.mtu = (enum ibv_mtu)std::min(remQpInfo.mtu, portAttr.active_mtu);
+  struct ncclIbQpInfo qpInfo;
+  qpInfo.mtu = (enum ibv_mtu)std::min(remQpInfo.mtu, portAttr.active_mtu);
+  qpInfo.link_layer = rComm->gidInfo.link_layer = portAttr.link_layer;
+  NCCLCHECK(ncclIbRailsInfo(&rComm->verbs, &qpInfo));
+  remQpInfo.mtu = qpInfo.mtu;
 
   // Setup QP
   for (int q=0; q<rComm->nqps; q++) {
     struct ibv_qp* qp = rComm->qps[q];
-    NCCLCHECK(ncclIbRtrQp(qp, remQpInfo.qpn[q], &remQpInfo));
+    struct ncclIbQpInfo railInfo;
+    ncclIbQpRailInfo(&remQpInfo, q, &railInfo);
+    NCCLCHECK(ncclIbRtrQp(qp, remQpInfo.qpn[q], &railInfo));
     NCCLCHECK(ncclIbRtsQp(qp));
   }
 
@@ -827,37 +1562,34 @@ ib_recv:
   rComm->remFifo.addr = remQpInfo.fifoAddr;
   NCCLCHECK(wrap_ibv_reg_mr(&rComm->remFifo.mr, rComm->verbs.pd, &rComm->remFifo.elems, sizeof(struct ncclIbSendFifo)*MAX_REQUESTS*NCCL_NET_IB_MAX_RECVS, IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_READ));
   rComm->remFifo.sge.lkey = rComm->remFifo.mr->lkey;
-  if (ncclParamIbUseInline()) rComm->remFifo.flags = IBV_SEND_INLINE;
 
   // Allocate Flush dummy buffer for GPU Direct RDMA
   rComm->gpuFlush.enabled = ((ncclIbGdrSupport(lComm->dev) == ncclSuccess || ncclIbDmaBufSupport(lComm->dev) == ncclSuccess)
                              && (ncclParamIbGdrFlushDisable() == 0)) ? 1 : 0;
   if (rComm->gpuFlush.enabled) {
-    NCCLCHECK(wrap_ibv_reg_mr(&rComm->gpuFlush.hostMr, rComm->verbs.pd, &rComm->gpuFlush.hostMem, sizeof(int), IBV_ACCESS_LOCAL_WRITE));
-    rComm->gpuFlush.sge.addr = (uint64_t)&rComm->gpuFlush.hostMem;
-    rComm->gpuFlush.sge.length = 1;
-    rComm->gpuFlush.sge.lkey = rComm->gpuFlush.hostMr->lkey;
-    NCCLCHECK(ncclIbCreateQp(ib_port, &rComm->verbs, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ, &rComm->gpuFlush.qp));
-    struct ncclIbQpInfo localQpInfo;
-    localQpInfo.lid=portAttr.lid;
-    localQpInfo.link_layer=portAttr.link_layer;
-    localQpInfo.ib_port=ib_port;
-    localQpInfo.spn=rComm->gidInfo.localGid.global.subnet_prefix;
-    localQpInfo.iid=rComm->gidInfo.localGid.global.interface_id;
-    localQpInfo.mtu=portAttr.active_mtu;
-    NCCLCHECK(ncclIbRtrQp(rComm->gpuFlush.qp, rComm->gpuFlush.qp->qp_num, &localQpInfo));
-    NCCLCHECK(ncclIbRtsQp(rComm->gpuFlush.qp));
+    for (int r=0; r<rComm->verbs.nRails; r++) {
+      NCCLCHECK(wrap_ibv_reg_mr(rComm->gpuFlush.hostMr+r, rComm->verbs.railPds[r], &rComm->gpuFlush.hostMem, sizeof(int), IBV_ACCESS_LOCAL_WRITE));
+      rComm->gpuFlush.sge[r].addr = (uint64_t)&rComm->gpuFlush.hostMem;
+      rComm->gpuFlush.sge[r].length = 1;
+      rComm->gpuFlush.sge[r].lkey = rComm->gpuFlush.hostMr[r]->lkey;
+      NCCLCHECK(ncclIbCreateQp(qpInfo.rails[r].ib_port, &rComm->verbs, r, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ, rComm->gpuFlush.qp+r));
+      if (rComm->verbs.srq) NCCLCHECK(ncclIbSrqAddQp(&rComm->verbs, rComm->gpuFlush.qp[r], -1));
+      struct ncclIbQpInfo localQpInfo;
+      ncclIbQpRailInfo(&qpInfo, r, &localQpInfo);
+      NCCLCHECK(ncclIbRtrQp(rComm->gpuFlush.qp[r], rComm->gpuFlush.qp[r]->qp_num, &localQpInfo));
+      NCCLCHECK(ncclIbRtsQp(rComm->gpuFlush.qp[r]));
+    }
   }
 
   // Fill Handle
-  struct ncclIbQpInfo qpInfo;
   qpInfo.lid=portAttr.lid;
-  qpInfo.link_layer= rComm->gidInfo.link_layer = portAttr.link_layer;
   qpInfo.ib_port=ib_port;
+  qpInfo.nqps=rComm->nqps;
   for (int q=0; q<rComm->nqps; q++) qpInfo.qpn[q]=rComm->qps[q]->qp_num;
   qpInfo.spn=rComm->gidInfo.localGid.global.subnet_prefix;
   qpInfo.iid=rComm->gidInfo.localGid.global.interface_id;
   qpInfo.mtu=remQpInfo.mtu;
+  qpInfo.poolId=rComm->poolId;
 
   stage->state = ncclIbCommStateSend;
   stage->offset = 0;
@@ -870,6 +1602,12 @@ ib_send:
   if (stage->offset < sizeof(struct ncclIbQpInfo)) return ncclSuccess;
 
   stage->offset = 0;
+  if (stage->refused) {
+    // The sender follows up with the info of a fresh connection
+    stage->refused = 0;
+    stage->state = ncclIbCommStateRecv;
+    goto ib_recv;
+  }
   stage->state = ncclIbCommStatePendingReady;
 
 ib_recv_ready:
@@ -911,6 +1649,80 @@ ncclResult_t ncclIbFreeRequest(struct ncclIbRequest* r) {
 ncclResult_t ncclIbTest(void* request, int* done, int* size);
 
 /* DMA-BUF support */
+// Registers [addr, addr+pages) with the MR cache of one rail of the verbs
+static ncclResult_t ncclIbRegMrRail(struct ncclIbVerbs* verbs, int rail, uintptr_t addr, size_t pages, int type, uint64_t offset, int fd, struct ibv_mr** mrPtr) {
+  static __thread uintptr_t pageSize = 0;
+  if (pageSize == 0) pageSize = sysconf(_SC_PAGESIZE);
+
+  int dev = verbs->railDevs[rail];
+  // The verbs hold a reference on the PD, so its ODP MR cannot go away
+  if (type == NCCL_PTR_HOST && fd == -1 && ncclIbDevs[dev].odpMr) {
+    *mrPtr = ncclIbDevs[dev].odpMr;
+    return ncclSuccess;
+  }
+  struct ibv_pd* pd = verbs->railPds[rail];
+  struct ncclIbMrCache* cache = &ncclIbDevs[dev].mrCache;
+  ncclResult_t res = ncclSuccess;
+  pthread_mutex_lock(&ncclIbDevs[dev].lock);
+  int slot = ncclIbMrFind(cache, addr, pages);
+  if (slot != -1) {
+    struct ncclIbMr* e = cache->slots+slot;
+    if (e->refs++ == 0) ncclIbMrLruUnlink(cache, slot);
+    cache->hits++;
+    *mrPtr = e->mr;
+  } else {
+    // Deregister / register
+    struct ibv_mr* mr;
+    unsigned int flags = IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ;
+    if (ncclIbRelaxedOrderingEnabled) flags |= IBV_ACCESS_RELAXED_ORDERING;
+    if (fd != -1) {
+      /* DMA-BUF support */
+      NCCLCHECKGOTO(wrap_ibv_reg_dmabuf_mr(&mr, pd, offset, pages*pageSize, addr, fd, flags), res, returning);
+    } else {
+      if (ncclIbRelaxedOrderingEnabled) {
+        // Use IBVERBS_1.8 API - needed for IBV_ACCESS_RELAXED_ORDERING support
+        NCCLCHECKGOTO(wrap_ibv_reg_mr_iova2(&mr, pd, (void*)addr, pages*pageSize, addr, flags), res, returning);
+      }
+      else {
+        NCCLCHECKGOTO(wrap_ibv_reg_mr(&mr, pd, (void*)addr, pages*pageSize, flags), res, returning);
+      }
+    }
+    TRACE(NCCL_INIT,"regAddr %llx size %lld rkey %x fd %d", (unsigned long long)addr, (long long)pages*pageSize, mr->rkey, fd);
+    res = ncclIbMrInsert(cache, addr, pages, mr);
+    if (res != ncclSuccess) {
+      wrap_ibv_dereg_mr(mr);
+      goto returning;
+    }
+    cache->misses++;
+    *mrPtr = mr;
+  }
+returning:
+  pthread_mutex_unlock(&ncclIbDevs[dev].lock);
+  return res;
+}
+
+static ncclResult_t ncclIbDeregMrRail(struct ncclIbVerbs* verbs, int rail, struct ibv_mr* mr) {
+  static __thread uintptr_t pageSize = 0;
+  if (pageSize == 0) pageSize = sysconf(_SC_PAGESIZE);
+
+  int dev = verbs->railDevs[rail];
+  if (mr == ncclIbDevs[dev].odpMr) return ncclSuccess;
+  struct ncclIbMrCache* cache = &ncclIbDevs[dev].mrCache;
+  ncclResult_t res = ncclSuccess;
+  pthread_mutex_lock(&ncclIbDevs[dev].lock);
+  // MRs are registered with iova == addr over whole pages, see ncclIbRegMrRail()
+  int slot = ncclIbMrFind(cache, (uintptr_t)mr->addr, mr->length/pageSize);
+  if (slot == -1 || cache->slots[slot].mr != mr || cache->slots[slot].refs == 0) {
+    WARN("NET/IB: could not find mr %p inside cache of %d entries", mr, cache->population);
+    res = ncclInternalError;
+    goto returning;
+  }
+  if (0 == --cache->slots[slot].refs) NCCLCHECKGOTO(ncclIbMrRelease(cache, slot), res, returning);
+returning:
+  pthread_mutex_unlock(&ncclIbDevs[dev].lock);
+  return res;
+}
+
 ncclResult_t ncclIbRegMrDmaBuf(void* comm, void* data, size_t size, int type, uint64_t offset, int fd, void** mhandle) {
   static_assert(offsetof(struct ncclIbSendComm, verbs) == offsetof(struct ncclIbRecvComm, verbs), "Send and recv comms must have verbs at the same offset");
   assert(size > 0);
@@ -919,53 +1731,30 @@ ncclResult_t ncclIbRegMrDmaBuf(void* comm, void* data, size_t size, int type, ui
   if (pageSize == 0) pageSize = sysconf(_SC_PAGESIZE);
 
   struct ncclIbVerbs* verbs = (struct ncclIbVerbs*)comm;
-  struct ncclIbMrCache* cache = &ncclIbDevs[verbs->dev].mrCache;
   uintptr_t addr = (uintptr_t)data & -pageSize;
   size_t pages = ((uintptr_t)data + size - addr + pageSize-1)/pageSize;
-  ncclResult_t res;
-  pthread_mutex_lock(&ncclIbDevs[verbs->dev].lock);
-  for (int slot=0; /*true*/; slot++) {
-    if (slot == cache->population) { // didn't find in cache
-      if (cache->population == cache->capacity) { // must grow cache
-        cache->capacity = cache->capacity < 32 ? 32 : 2*cache->capacity;
-        NCCLCHECKGOTO(ncclRealloc(&cache->slots, cache->population, cache->capacity), res, returning);
-      }
-      // Deregister / register
-      struct ibv_mr* mr;
-      unsigned int flags = IBV_ACCESS_LOCAL_WRITE|IBV_ACCESS_REMOTE_WRITE|IBV_ACCESS_REMOTE_READ;
-      if (ncclIbRelaxedOrderingEnabled) flags |= IBV_ACCESS_RELAXED_ORDERING;
-      if (fd != -1) {
-        /* DMA-BUF support */
-        NCCLCHECKGOTO(wrap_ibv_reg_dmabuf_mr(&mr, verbs->pd, offset, pages*pageSize, addr, fd, flags), res, returning);
-      } else {
-        if (ncclIbRelaxedOrderingEnabled) {
-          // Use IBVERBS_1.8 API - needed for IBV_ACCESS_RELAXED_ORDERING support
-          NCCLCHECKGOTO(wrap_ibv_reg_mr_iova2(&mr, verbs->pd, (void*)addr, pages*pageSize, addr, flags), res, returning);
-        }
-        else {
-          NCCLCHECKGOTO(wrap_ibv_reg_mr(&mr, verbs->pd, (void*)addr, pages*pageSize, flags), res, returning);
-        }
+  if (verbs->nRails == 1) {
+    NCCLCHECK(ncclIbRegMrRail(verbs, 0, addr, pages, type, offset, fd, (struct ibv_mr**)mhandle));
+  } else {
+    // Multi-rail: one MR per rail
+    struct ncclIbMrHandle* handle;
+    NCCLCHECK(ncclCalloc(&handle, 1));
+    for (int r=0; r<verbs->nRails; r++) {
+      ncclResult_t res = ncclIbRegMrRail(verbs, r, addr, pages, type, offset, fd, handle->mrs+r);
+      if (res != ncclSuccess) {
+        while (r--) ncclIbDeregMrRail(verbs, r, handle->mrs[r]);
+        free(handle);
+        return res;
       }
-      TRACE(NCCL_INIT,"regAddr %llx size %lld rkey %x fd %d", (unsigned long long)addr, (long long)pages*pageSize, mr->rkey, fd);
-      cache->population += 1;
-      cache->slots[slot].addr = addr;
-      cache->slots[slot].pages = pages;
-      cache->slots[slot].refs = 1;
-      cache->slots[slot].mr = mr;
-      *mhandle = (void*)mr;
-      res = ncclSuccess;
-      goto returning;
     }
-    else if (cache->slots[slot].addr == addr && cache->slots[slot].pages == pages) {
-      cache->slots[slot].refs += 1;
-      *mhandle = (void*)cache->slots[slot].mr;
-      res = ncclSuccess;
-      goto returning;
+    *mhandle = handle;
+  }
+  if (type == NCCL_PTR_HOST) {
+    for (int i=0; i<NCCL_IB_MAX_HOST_MRS; i++) {
+      if (verbs->hostMrs[i] == NULL) { verbs->hostMrs[i] = *mhandle; break; }
     }
   }
-returning:
-  pthread_mutex_unlock(&ncclIbDevs[verbs->dev].lock);
-  return res;
+  return ncclSuccess;
 }
 
 ncclResult_t ncclIbRegMr(void* comm, void* data, int size, int type, void** mhandle) {
@@ -974,33 +1763,34 @@ ncclResult_t ncclIbRegMr(void* comm, void* data, int size, int type, void** mhan
 
 ncclResult_t ncclIbDeregMr(void* comm, void* mhandle) {
   struct ncclIbVerbs* verbs = (struct ncclIbVerbs*)comm;
-  struct ncclIbMrCache* cache = &ncclIbDevs[verbs->dev].mrCache;
-  ncclResult_t res;
-  pthread_mutex_lock(&ncclIbDevs[verbs->dev].lock);
-  for (int i=0; i < cache->population; i++) {
-    if (mhandle == cache->slots[i].mr) {
-      if (0 == --cache->slots[i].refs) {
-        memmove(&cache->slots[i], &cache->slots[--cache->population], sizeof(struct ncclIbMr));
-        if (cache->population == 0) {
-          free(cache->slots);
-          cache->slots = NULL;
-          cache->capacity = 0;
-        }
-        NCCLCHECKGOTO(wrap_ibv_dereg_mr((struct ibv_mr*)mhandle), res, returning);
-      }
-      res = ncclSuccess;
-      goto returning;
-    }
+  // Host registrations may share a handle (implicit ODP), only drop one reference
+  for (int i=0; i<NCCL_IB_MAX_HOST_MRS; i++) if (verbs->hostMrs[i] == mhandle) { verbs->hostMrs[i] = NULL; break; }
+  if (verbs->nRails == 1) return ncclIbDeregMrRail(verbs, 0, (struct ibv_mr*)mhandle);
+  struct ncclIbMrHandle* handle = (struct ncclIbMrHandle*)mhandle;
+  ncclResult_t res = ncclSuccess;
+  for (int r=0; r<verbs->nRails; r++) {
+    ncclResult_t ret = ncclIbDeregMrRail(verbs, r, handle->mrs[r]);
+    if (res == ncclSuccess) res = ret;
   }
-  WARN("NET/IB: could not find mr %p inside cache of %d entries", mhandle, cache->population);
-  res = ncclInternalError;
-returning:
-  pthread_mutex_unlock(&ncclIbDevs[verbs->dev].lock);
+  free(handle);
   return res;
 }
 
 NCCL_PARAM(IbSplitDataOnQps, "IB_SPLIT_DATA_ON_QPS", 1);
 
+// Records a signaled WR about to be posted on sq
+static inline void ncclIbSignalPush(struct ncclIbVerbs* verbs, struct ncclIbSignalQueue* sq) {
+  uint32_t c = sq->cTail++%NCCL_IB_MAX_SIGNALED;
+  sq->covers[c] = sq->tail;
+  if (verbs->qpBalance) {
+    sq->postBytes[c] = sq->bytes;
+    sq->postTimes[c] = clockNano();
+  }
+  sq->bytes = 0;
+  sq->unsignaled = 0;
+  sq->covered = 1;
+}
+
 ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
   struct ncclIbRequest** reqs = comm->fifoReqs[slot];
   volatile struct ncclIbSendFifo* slots = comm->fifo[slot];
@@ -1015,7 +1805,7 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
 
     struct ibv_sge* sge = comm->sges+r;
     sge->addr=(uintptr_t)reqs[r]->send.data;
-    sge->lkey=reqs[r]->send.lkey;
+    sge->lkey=reqs[r]->send.lkeys[0];
 
     wr->opcode = IBV_WR_RDMA_WRITE;
     wr->send_flags = 0;
@@ -1053,13 +1843,47 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
   lastWr->imm_data = immData;
   lastWr->next = NULL;
   lastWr->send_flags = IBV_SEND_SIGNALED;
+  int unsignaledPosts = 0;
 
   // Multi-QP: make sure IB writes are multiples of 128B so that LL and LL128 protocols still work
   const int align = 128;
   const int nqps = ncclParamIbSplitDataOnQps() ? comm->nqps : 1;
+  const int nRails = comm->verbs.nRails;
+  // Multi-rail: stripes are weighted by the link speed of the rail each QP is on,
+  // or by the measured rate of each QP with RCCL_IB_QP_BALANCE
+  int weights[NCCL_IB_MAX_QPS];
+  int weightSum = 0;
+  int weighted = nRails > 1 || (comm->verbs.qpBalance && nqps > 1);
+  if (weighted) {
+    int measured = comm->verbs.qpBalance;
+    for (int q=0; q<nqps && measured; q++) measured = comm->verbs.signalQueues[(comm->qpIndex+q)%comm->nqps].bw > 0;
+    int maxWeight = 0;
+    for (int q=0; q<nqps; q++) {
+      int qi = (comm->qpIndex+q)%comm->nqps;
+      weights[q] = measured ? (int)std::min(comm->verbs.signalQueues[qi].bw*1000, 1e9)+1 :
+        nRails > 1 ? ncclIbDevs[comm->verbs.railDevs[qi%nRails]].speed : 1;
+      maxWeight = std::max(maxWeight, weights[q]);
+    }
+    for (int q=0; q<nqps; q++) {
+      weights[q] = std::max(weights[q], maxWeight/NCCL_IB_BALANCE_MIN_SHARE);
+      weightSum += weights[q];
+    }
+  }
+  int chunkSizes[NCCL_NET_IB_MAX_RECVS];
   for (int q=0; q<nqps; q++) {
+    int qi = comm->qpIndex;
+    int localRail = qi%nRails;
+    int remRail = qi%comm->remNRails;
+    int weight = weighted ? weights[q] : 1;
+    uint64_t qpBytes = 0;
     for (int r=0; r<nreqs; r++) {
-      int chunkSize = DIVUP(DIVUP(reqs[r]->send.size, nqps), align) * align;
+      int chunkSize = weighted && weightSum > 0 ?
+        DIVUP(DIVUP((int64_t)reqs[r]->send.size*weight, weightSum), align) * align :
+        DIVUP(DIVUP(reqs[r]->send.size, nqps), align) * align;
+      // Last QP takes the remainder so rounding never leaves data behind
+      if (q == nqps-1) chunkSize = std::max(chunkSize, reqs[r]->send.size-reqs[r]->send.offset);
+      comm->sges[r].lkey = reqs[r]->send.lkeys[localRail];
+      comm->wrs[r].wr.rdma.rkey = remRail == 0 ? slots[r].rkey : slots[r].railRkeys[remRail-1];
       int length = std::min(reqs[r]->send.size-reqs[r]->send.offset, chunkSize);
       if (length <= 0) {
         comm->wrs[r].sg_list = NULL;
@@ -1068,20 +1892,49 @@ ncclResult_t ncclIbMultiSend(struct ncclIbSendComm* comm, int slot) {
         comm->sges[r].length = length;
         comm->wrs[r].sg_list = comm->sges+r;
         comm->wrs[r].num_sge = 1;
+        qpBytes += length;
+      }
+      // Small host chunks go inline, saving the NIC a DMA read of the payload
+      if (reqs[r]->send.hostMem && length > 0 && length <= comm->verbs.maxInline) {
+        comm->wrs[r].send_flags |= IBV_SEND_INLINE;
+      } else {
+        comm->wrs[r].send_flags &= ~IBV_SEND_INLINE;
+      }
+      chunkSizes[r] = chunkSize;
+    }
+    if (comm->verbs.signalQueues) {
+      struct ncclIbSignalQueue* sq = comm->verbs.signalQueues+qi;
+      sq->lastAddr = comm->wrs[0].wr.rdma.remote_addr;
+      sq->lastRkey = comm->wrs[0].wr.rdma.rkey;
+      sq->bytes += qpBytes;
+      if (++sq->unsignaled < comm->verbs.signalInterval) {
+        lastWr->send_flags &= ~IBV_SEND_SIGNALED;
+        sq->wrIds[sq->tail++%MAX_REQUESTS] = wr_id;
+        sq->covered = 0;
+        unsignaledPosts++;
+      } else {
+        lastWr->send_flags |= IBV_SEND_SIGNALED;
+        ncclIbSignalPush(&comm->verbs, sq);
       }
     }
     struct ibv_send_wr* bad_wr;
-    NCCLCHECK(wrap_ibv_post_send(comm->qps[comm->qpIndex], comm->wrs, &bad_wr));
+    NCCLCHECK(wrap_ibv_post_send(comm->qps[qi], comm->wrs, &bad_wr));
     comm->qpIndex = (comm->qpIndex+1)%comm->nqps;
 
     for (int r=0; r<nreqs; r++) {
-      int chunkSize = DIVUP(DIVUP(reqs[r]->send.size, nqps), align) * align;
+      int chunkSize = chunkSizes[r];
       reqs[r]->send.offset += chunkSize;
       comm->sges[r].addr += chunkSize;
       comm->wrs[r].wr.rdma.remote_addr += chunkSize;
     }
   }
 
+  if (unsignaledPosts && comm->verbs.srq) {
+    // Isend reserved one shared CQ entry per post
+    pthread_mutex_lock(&comm->verbs.srq->lock);
+    comm->verbs.srq->inflight -= unsignaledPosts;
+    pthread_mutex_unlock(&comm->verbs.srq->lock);
+  }
   return ncclSuccess;
 }
 
@@ -1090,8 +1943,6 @@ ncclResult_t ncclIbIsend(void* sendComm, void* data, int size, int tag, void* mh
   if (comm->ready == 0) { WARN("NET/IB: ncclIbIsend() called when comm->ready == 0"); return ncclInternalError; }
   if (comm->ready == 0) { *request = NULL; return ncclSuccess; }
 
-  struct ibv_mr* mr = (struct ibv_mr*)mhandle;
-
   // Wait for the receiver to have posted the corresponding receive
   int nreqs = 0;
   volatile struct ncclIbSendFifo* slots;
@@ -1101,9 +1952,21 @@ ncclResult_t ncclIbIsend(void* sendComm, void* data, int size, int tag, void* mh
   slots = comm->fifo[slot];
   uint64_t idx = comm->fifoHead+1;
   if (slots[0].idx != idx) { *request = NULL; return ncclSuccess; }
+  // Multi-rail receivers also post per-rail rkeys in the second half of each element
+  if (comm->remNRails > 1 && slots[0].railIdx != idx) { *request = NULL; return ncclSuccess; }
+  if (comm->verbs.srq && comm->srqCredits == 0) {
+    // Reserve the shared CQ entries of the whole multi-send before matching any request
+    int credits = ncclParamIbSplitDataOnQps() ? comm->nqps : 1;
+    pthread_mutex_lock(&comm->verbs.srq->lock);
+    int reserved = ncclIbSrqReserve(comm->verbs.srq, credits, 0, NCCL_IB_SRQ_CQ_HEADROOM);
+    pthread_mutex_unlock(&comm->verbs.srq->lock);
+    if (!reserved) { *request = NULL; return ncclSuccess; }
+    comm->srqCredits = credits;
+  }
   nreqs = slots[0].nreqs;
   // Wait until all data has arrived
   for (int r=1; r<nreqs; r++) while(slots[r].idx != idx);
+  if (comm->remNRails > 1) for (int r=1; r<nreqs; r++) while(slots[r].railIdx != idx);
   __sync_synchronize(); // order the nreqsPtr load against tag/rkey/addr loads below
   for (int r=0; r<nreqs; r++) {
     if (reqs[r] != NULL || slots[r].tag != tag) continue;
@@ -1133,7 +1996,10 @@ ncclResult_t ncclIbIsend(void* sendComm, void* data, int size, int tag, void* mh
     req->nreqs = nreqs;
     req->send.size = size;
     req->send.data = data;
-    req->send.lkey = mr->lkey;
+    for (int i=0; i<comm->verbs.nRails; i++) req->send.lkeys[i] = ncclIbGetMr(&comm->verbs, mhandle, i)->lkey;
+    req->send.hostMem = 0;
+    for (int i=0; i<NCCL_IB_MAX_HOST_MRS; i++) if (comm->verbs.hostMrs[i] == mhandle) req->send.hostMem = 1;
+    if (req->send.hostMem) ncclIbOdpPrefetch(&comm->verbs, mhandle, data, size, 0);
     req->send.offset = 0;
     req->events = ncclParamIbSplitDataOnQps() ? comm->nqps : 1;
     if (comm->gidInfo.link_layer == IBV_LINK_LAYER_ETHERNET) req->gidInfo = &comm->gidInfo;
@@ -1151,6 +2017,7 @@ ncclResult_t ncclIbIsend(void* sendComm, void* data, int size, int tag, void* mh
     memset((void*)slots, 0, sizeof(struct ncclIbSendFifo));
     memset(reqs, 0, NCCL_NET_IB_MAX_RECVS*sizeof(struct ncclIbRequest*));
     comm->fifoHead++;
+    comm->srqCredits = 0;
     TIME_STOP(0);
     return ncclSuccess;
   }
@@ -1168,8 +2035,9 @@ ncclResult_t ncclIbPostFifo(struct ncclIbRecvComm* comm, int n, void** data, int
 
   for (int i=0; i<n; i++) {
     localElem[i].addr = (uint64_t)data[i];
-    struct ibv_mr* mr = (struct ibv_mr*)mhandles[i];
-    localElem[i].rkey = mr->rkey;
+    localElem[i].rkey = ncclIbGetMr(&comm->verbs, mhandles[i], 0)->rkey;
+    for (int r=1; r<comm->verbs.nRails; r++) localElem[i].railRkeys[r-1] = ncclIbGetMr(&comm->verbs, mhandles[i], r)->rkey;
+    localElem[i].railIdx = comm->remFifo.fifoTail+1;
     localElem[i].nreqs = n;
     localElem[i].size = sizes[i]; // Sanity/Debugging
     localElem[i].tag = tags[i];
@@ -1183,7 +2051,7 @@ ncclResult_t ncclIbPostFifo(struct ncclIbRecvComm* comm, int n, void** data, int
   wr.sg_list = &comm->remFifo.sge;
   wr.num_sge = 1;
   wr.opcode = IBV_WR_RDMA_WRITE;
-  wr.send_flags = comm->remFifo.flags; // IBV_SEND_INLINE
+  wr.send_flags = (int)comm->remFifo.sge.length <= comm->verbs.maxInline ? IBV_SEND_INLINE : 0;
 
   // We need to occasionally post a request with the IBV_SEND_SIGNALED flag, otherwise
   // the send queue will never empty.
@@ -1225,13 +2093,32 @@ ncclResult_t ncclIbIrecv(void* recvComm, int n, void** data, int* sizes, int* ta
   if (comm->ready == 0) { *request = NULL; return ncclSuccess; }
   if (n > NCCL_NET_IB_MAX_RECVS) return ncclInternalError;
 
+  const int nqps = ncclParamIbSplitDataOnQps() ? comm->nqps : 1;
   struct ncclIbRequest* req;
   NCCLCHECK(ncclIbGetRequest(&comm->verbs, &req));
+  if (comm->verbs.srq) {
+    // One completion per QP, plus one for the signaled FIFO post
+    int cqes = nqps + (comm->remFifo.fifoTail%MAX_REQUESTS == 0 ? 1 : 0);
+    pthread_mutex_lock(&comm->verbs.srq->lock);
+    int reserved = ncclIbSrqReserve(comm->verbs.srq, cqes, nqps, NCCL_IB_SRQ_CQ_HEADROOM);
+    // Any QP may consume a WR of the SRQ, completions find req through the ring of their QP
+    for (int q=0; reserved && q<nqps; q++) {
+      struct ncclIbSrqRing* ring = comm->verbs.srqRings+(comm->qpIndex+q)%comm->nqps;
+      ring->reqs[ring->tail++%MAX_REQUESTS] = req - comm->verbs.reqs;
+    }
+    pthread_mutex_unlock(&comm->verbs.srq->lock);
+    if (!reserved) {
+      NCCLCHECK(ncclIbFreeRequest(req));
+      *request = NULL;
+      return ncclSuccess;
+    }
+  }
   req->type = NCCL_NET_IB_REQ_RECV;
   req->sock = &comm->sock;
   req->nreqs = n;
   if (comm->gidInfo.link_layer == IBV_LINK_LAYER_ETHERNET) req->gidInfo = &comm->gidInfo;
   for (int i=0; i<n; i++) req->recv.sizes[i] = 0;
+  for (int i=0; i<n; i++) ncclIbOdpPrefetch(&comm->verbs, mhandles[i], data[i], sizes[i], 1);
 
   struct ibv_recv_wr wr;
   memset(&wr, 0, sizeof(wr));
@@ -1241,11 +2128,13 @@ ncclResult_t ncclIbIrecv(void* recvComm, int n, void** data, int* sizes, int* ta
   wr.num_sge = 0;
 
   TIME_START(1);
-  const int nqps = ncclParamIbSplitDataOnQps() ? comm->nqps : 1;
   for (int q=0; q<nqps; q++) {
-    struct ibv_qp* qp = comm->qps[comm->qpIndex];
     struct ibv_recv_wr* bad_wr;
-    NCCLCHECK(wrap_ibv_post_recv(qp, &wr, &bad_wr));
+    if (comm->verbs.srq) {
+      NCCLCHECK(wrap_ibv_post_srq_recv(comm->verbs.srq->srq, &wr, &bad_wr));
+    } else {
+      NCCLCHECK(wrap_ibv_post_recv(comm->qps[comm->qpIndex], &wr, &bad_wr));
+    }
     comm->qpIndex = (comm->qpIndex+1)%comm->nqps;
   }
   TIME_STOP(1);
@@ -1260,6 +2149,142 @@ ncclResult_t ncclIbIrecv(void* recvComm, int n, void** data, int* sizes, int* ta
   return ncclSuccess;
 }
 
+static ncclResult_t ncclIbWcError(struct ncclIbRequest* r, struct ibv_wc* wc) {
+  char line[SOCKET_NAME_MAXLEN+1];
+  union ncclSocketAddress addr;
+  ncclSocketGetAddr(r->sock, &addr);
+  char localGidString[INET6_ADDRSTRLEN] = "";
+  char remoteGidString[INET6_ADDRSTRLEN] = "";
+  const char* localGidStr = NULL, *remoteGidStr = NULL;
+  if (r->gidInfo) {
+      localGidStr = inet_ntop(AF_INET6, &r->gidInfo->localGid, localGidString, sizeof(localGidString));
+      remoteGidStr = inet_ntop(AF_INET6, &r->gidInfo->remoteGid, remoteGidString, sizeof(remoteGidString));
+  }
+  WARN("NET/IB : Got completion from peer %s with error %d, opcode %d, len %d, vendor err %d (%s)%s%s%s%s",
+      ncclSocketToString(&addr, line), wc->status, wc->opcode, wc->byte_len, wc->vendor_err, reqTypeStr[r->type],
+      localGidStr ?  " localGid ":"", localGidString, remoteGidStr ? " remoteGid ":"", remoteGidString);
+  return ncclRemoteError;
+}
+
+static ncclResult_t ncclIbSendDone(struct ncclIbVerbs* verbs, uint64_t wrId) {
+  struct ncclIbRequest* req = verbs->reqs+(wrId & 0xff);
+  for (int i=0; i<req->nreqs; i++) {
+    struct ncclIbRequest* sendReq = verbs->reqs+((wrId >> (i*8)) & 0xff);
+    if ((sendReq->events <= 0)) return ncclInternalError;
+    sendReq->events--;
+  }
+  return ncclSuccess;
+}
+
+// A signaled send or fence completed: so did the unsignaled sends before it on that QP
+static ncclResult_t ncclIbSignaledDone(struct ncclIbVerbs* verbs, struct ibv_wc* wc) {
+  struct ncclIbSignalQueue* sq = NULL;
+  for (int q=0; q<verbs->nSignalQueues; q++) {
+    if (verbs->signalQueues[q].qp->qp_num == wc->qp_num) sq = verbs->signalQueues+q;
+  }
+  if (sq == NULL || sq->cHead == sq->cTail) {
+    WARN("NET/IB : unexpected send completion on QP %u", wc->qp_num);
+    return ncclInternalError;
+  }
+  uint32_t c = sq->cHead++%NCCL_IB_MAX_SIGNALED;
+  uint32_t covered = sq->covers[c];
+  if (verbs->qpBalance) {
+    // The QP was busy from the later of the post and the previous completion
+    uint64_t now = clockNano();
+    uint64_t start = std::max(sq->postTimes[c], sq->lastDone);
+    sq->lastDone = now;
+    if (sq->postBytes[c] >= NCCL_IB_BALANCE_MIN_BYTES && now > start) {
+      double bw = (double)sq->postBytes[c]/(now-start);
+      sq->bw = sq->bw > 0 ? 0.75*sq->bw + 0.25*bw : bw;
+    }
+  }
+  while (sq->head != covered) NCCLCHECK(ncclIbSendDone(verbs, sq->wrIds[sq->head++%MAX_REQUESTS]));
+  if (wc->wr_id != NCCL_IB_FENCE_WR_ID) NCCLCHECK(ncclIbSendDone(verbs, wc->wr_id));
+  return ncclSuccess;
+}
+
+// Posts a signaled 0-byte write behind the unsignaled sends no signaled WR covers yet
+static ncclResult_t ncclIbSignalFence(struct ncclIbVerbs* verbs) {
+  for (int q=0; q<verbs->nSignalQueues; q++) {
+    struct ncclIbSignalQueue* sq = verbs->signalQueues+q;
+    if (sq->covered || sq->head == sq->tail) continue;
+    if (verbs->srq) {
+      pthread_mutex_lock(&verbs->srq->lock);
+      int reserved = ncclIbSrqReserve(verbs->srq, 1, 0, 0);
+      pthread_mutex_unlock(&verbs->srq->lock);
+      if (!reserved) continue; // The shared CQ is busy, the next test retries
+    }
+    struct ibv_send_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = NCCL_IB_FENCE_WR_ID;
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = sq->lastAddr;
+    wr.wr.rdma.rkey = sq->lastRkey;
+    struct ibv_send_wr* bad_wr;
+    NCCLCHECK(wrap_ibv_post_send(sq->qp, &wr, &bad_wr));
+    ncclIbSignalPush(verbs, sq);
+  }
+  return ncclSuccess;
+}
+
+// Accounts a successful completion to req and, for sends, to the other requests of the multi-send
+static ncclResult_t ncclIbWcDone(struct ncclIbVerbs* verbs, struct ibv_wc* wc, struct ncclIbRequest* req) {
+  if (verbs->signalQueues) {
+    // Only send comms have signal queues, and all their completions are sends
+    NCCLCHECK(ncclIbSignaledDone(verbs, wc));
+  } else if (req->type == NCCL_NET_IB_REQ_SEND) {
+    NCCLCHECK(ncclIbSendDone(verbs, wc->wr_id));
+  } else {
+    if (req && wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+      if (req->type != NCCL_NET_IB_REQ_RECV) return ncclInternalError;
+      if (req->nreqs > 1) {
+        // In the case of a multi recv, we only set sizes to 0 or 1.
+        for (int i=0; i<req->nreqs; i++) {
+          req->recv.sizes[i] = (wc->imm_data >> i) & 0x1;
+        }
+      } else {
+        req->recv.sizes[0] += wc->imm_data;
+      }
+    }
+    req->events--;
+  }
+  return ncclSuccess;
+}
+
+// Polls the shared CQ and accounts each completion to the comm owning its QP.
+// r is only used to report errors. Called with srq->lock held.
+static ncclResult_t ncclIbSrqProgress(struct ncclIbSrq* srq, struct ncclIbRequest* r, int* nDone) {
+  int wrDone = 0;
+  struct ibv_wc wcs[NCCL_IB_POLL_BATCH];
+  NCCLCHECK(wrap_ibv_poll_cq(srq->cq, NCCL_IB_POLL_BATCH, wcs, &wrDone));
+  srq->inflight -= wrDone;
+  for (int w=0; w<wrDone; w++) {
+    struct ibv_wc *wc = wcs+w;
+    if (wc->status != IBV_WC_SUCCESS) return ncclIbWcError(r, wc);
+    if (wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) srq->posted--;
+    struct ncclIbSrqQp* owner = ncclIbSrqFindQp(srq, wc->qp_num);
+    if (owner == NULL) {
+      TRACE(NCCL_NET, "NET/IB : dropping completion of closed QP %u", wc->qp_num);
+      continue;
+    }
+    struct ncclIbRequest* req;
+    if (wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+      struct ncclIbSrqRing* ring = owner->qpIndex >= 0 ? owner->verbs->srqRings+owner->qpIndex : NULL;
+      if (ring == NULL || ring->head == ring->tail) {
+        WARN("NET/IB : unexpected receive completion on QP %u", wc->qp_num);
+        return ncclInternalError;
+      }
+      req = owner->verbs->reqs+ring->reqs[ring->head++%MAX_REQUESTS];
+    } else {
+      req = owner->verbs->reqs+(wc->wr_id & 0xff);
+    }
+    NCCLCHECK(ncclIbWcDone(owner->verbs, wc, req));
+  }
+  *nDone = wrDone;
+  return ncclSuccess;
+}
+
 ncclResult_t ncclIbIflush(void* recvComm, int n, void** data, int* sizes, void** mhandles, void** request) {
   struct ncclIbRecvComm* comm = (struct ncclIbRecvComm*)recvComm;
   int last = -1;
@@ -1271,22 +2296,37 @@ ncclResult_t ncclIbIflush(void* recvComm, int n, void** data, int* sizes, void**
   NCCLCHECK(ncclIbGetRequest(&comm->verbs, &req));
   req->type = NCCL_NET_IB_REQ_FLUSH;
   req->sock = &comm->sock;
-  struct ibv_mr* mr = (struct ibv_mr*)mhandles[last];
+  // Multi-rail: each rail wrote through its own PCI path, so each needs its own read
+  req->events = comm->verbs.nRails;
+  if (comm->verbs.srq) {
+    // Flushes complete locally: they may use the CQ headroom, and drain the CQ when even that is full
+    struct ncclIbSrq* srq = comm->verbs.srq;
+    ncclResult_t res = ncclSuccess;
+    pthread_mutex_lock(&srq->lock);
+    while (res == ncclSuccess && !ncclIbSrqReserve(srq, 1, 0, 0)) {
+      int nDone;
+      res = ncclIbSrqProgress(srq, req, &nDone);
+    }
+    pthread_mutex_unlock(&srq->lock);
+    NCCLCHECK(res);
+  }
 
-  struct ibv_send_wr wr;
-  memset(&wr, 0, sizeof(wr));
-  wr.wr_id = req - comm->verbs.reqs;
+  TIME_START(4);
+  for (int r=0; r<comm->verbs.nRails; r++) {
+    struct ibv_send_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = req - comm->verbs.reqs;
 
-  wr.wr.rdma.remote_addr = (uint64_t)data[last];
-  wr.wr.rdma.rkey = mr->rkey;
-  wr.sg_list = &comm->gpuFlush.sge;
-  wr.num_sge = 1;
-  wr.opcode = IBV_WR_RDMA_READ;
-  wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = (uint64_t)data[last];
+    wr.wr.rdma.rkey = ncclIbGetMr(&comm->verbs, mhandles[last], r)->rkey;
+    wr.sg_list = comm->gpuFlush.sge+r;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_READ;
+    wr.send_flags = IBV_SEND_SIGNALED;
 
-  TIME_START(4);
-  struct ibv_send_wr* bad_wr;
-  NCCLCHECK(wrap_ibv_post_send(comm->gpuFlush.qp, &wr, &bad_wr));
+    struct ibv_send_wr* bad_wr;
+    NCCLCHECK(wrap_ibv_post_send(comm->gpuFlush.qp[r], &wr, &bad_wr));
+  }
   TIME_STOP(4);
 
   *request = req;
@@ -1307,88 +2347,140 @@ ncclResult_t ncclIbTest(void* request, int* done, int* sizes) {
       return ncclSuccess;
     }
 
-    int wrDone = 0;
-    struct ibv_wc wcs[4];
-    TIME_START(3);
-    NCCLCHECK(wrap_ibv_poll_cq(r->verbs->cq, 4, wcs, &wrDone));
-    if (wrDone == 0) { TIME_CANCEL(3); } else { TIME_STOP(3); }
-    if (wrDone == 0) return ncclSuccess;
-
-    for (int w=0; w<wrDone; w++) {
-      struct ibv_wc *wc = wcs+w;
-      if (wc->status != IBV_WC_SUCCESS) {
-        char line[SOCKET_NAME_MAXLEN+1];
-        union ncclSocketAddress addr;
-        ncclSocketGetAddr(r->sock, &addr);
-        char localGidString[INET6_ADDRSTRLEN] = "";
-        char remoteGidString[INET6_ADDRSTRLEN] = "";
-        const char* localGidStr = NULL, *remoteGidStr = NULL;
-        if (r->gidInfo) {
-            localGidStr = inet_ntop(AF_INET6, &r->gidInfo->localGid, localGidString, sizeof(localGidString));
-            remoteGidStr = inet_ntop(AF_INET6, &r->gidInfo->remoteGid, remoteGidString, sizeof(remoteGidString));
-        }
-        WARN("NET/IB : Got completion from peer %s with error %d, opcode %d, len %d, vendor err %d (%s)%s%s%s%s",
-            ncclSocketToString(&addr, line), wc->status, wc->opcode, wc->byte_len, wc->vendor_err, reqTypeStr[r->type],
-            localGidStr ?  " localGid ":"", localGidString, remoteGidStr ? " remoteGid ":"", remoteGidString);
-        return ncclRemoteError;
+    if (r->verbs->srq) {
+      // Completions of other comms sharing the CQ are accounted as well
+      int wrDone = 0;
+      pthread_mutex_lock(&r->verbs->srq->lock);
+      ncclResult_t res = ncclIbSrqProgress(r->verbs->srq, r, &wrDone);
+      int events = r->events;
+      pthread_mutex_unlock(&r->verbs->srq->lock);
+      NCCLCHECK(res);
+      if (wrDone == 0 && events) {
+        if (r->verbs->signalQueues) NCCLCHECK(ncclIbSignalFence(r->verbs));
+        return ncclSuccess;
       }
+      continue;
+    }
 
-      struct ncclIbRequest* req = r->verbs->reqs+(wc->wr_id & 0xff);
-      if (req->type == NCCL_NET_IB_REQ_SEND) {
-        for (int i=0; i<req->nreqs; i++) {
-          struct ncclIbRequest* sendReq = r->verbs->reqs+((wc->wr_id >> (i*8)) & 0xff);
-          if ((sendReq->events <= 0)) return ncclInternalError;
-          sendReq->events--;
-        }
-      } else {
-        if (req && wc->opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
-          if (req->type != NCCL_NET_IB_REQ_RECV) return ncclInternalError;
-          if (req->nreqs > 1) {
-            // In the case of a multi recv, we only set sizes to 0 or 1.
-            for (int i=0; i<req->nreqs; i++) {
-              req->recv.sizes[i] = (wc->imm_data >> i) & 0x1;
-            }
-          } else {
-            req->recv.sizes[0] += wc->imm_data;
-          }
-        }
-        req->events--;
+    int totalDone = 0;
+    for (int rail=0; rail<r->verbs->nRails; rail++) {
+      int wrDone = 0;
+      struct ibv_wc wcs[NCCL_IB_POLL_BATCH];
+      TIME_START(3);
+      NCCLCHECK(wrap_ibv_poll_cq(r->verbs->railCqs[rail], NCCL_IB_POLL_BATCH, wcs, &wrDone));
+      if (wrDone == 0) { TIME_CANCEL(3); } else { TIME_STOP(3); }
+      totalDone += wrDone;
+
+      for (int w=0; w<wrDone; w++) {
+        struct ibv_wc *wc = wcs+w;
+        if (wc->status != IBV_WC_SUCCESS) return ncclIbWcError(r, wc);
+        NCCLCHECK(ncclIbWcDone(r->verbs, wc, r->verbs->reqs+(wc->wr_id & 0xff)));
       }
     }
+    if (totalDone == 0) {
+      if (r->verbs->signalQueues) NCCLCHECK(ncclIbSignalFence(r->verbs));
+      return ncclSuccess;
+    }
   }
 }
 
-ncclResult_t ncclIbCloseSend(void* sendComm) {
-  struct ncclIbSendComm* comm = (struct ncclIbSendComm*)sendComm;
+// Requests of the same comm share its CQs, and so do all the comms of a device with a shared
+// receive queue. Once a CQ was polled empty, the other requests on it cannot complete during
+// this call, so they only check whether an earlier poll completed them.
+#define NCCL_IB_TEST_SOME_MAX_VERBS 16
+ncclResult_t ncclIbTestSome(int n, void** requests, int* done, int** sizes) {
+  struct ncclIbVerbs* idleVerbs[NCCL_IB_TEST_SOME_MAX_VERBS];
+  int nIdleVerbs = 0;
+  for (int i=0; i<n; i++) {
+    struct ncclIbRequest *r = (struct ncclIbRequest*)requests[i];
+    done[i] = 0;
+    if (r == NULL) continue;
+    struct ncclIbVerbs* verbs = r->verbs;
+    if (r->events) {
+      bool idle = false;
+      for (int v=0; v<nIdleVerbs; v++) idle |= (idleVerbs[v] == verbs);
+      if (idle) continue;
+    }
+    NCCLCHECK(ncclIbTest(r, done+i, sizes ? sizes[i] : NULL));
+    if (done[i] == 0 && nIdleVerbs < NCCL_IB_TEST_SOME_MAX_VERBS) idleVerbs[nIdleVerbs++] = verbs;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclIbDestroySend(struct ncclIbSendComm* comm) {
   if (comm) {
     NCCLCHECK(ncclSocketClose(&comm->sock));
-    for (int q=0; q<comm->nqps; q++)
-      if (comm->qps[q] != NULL) NCCLCHECK(wrap_ibv_destroy_qp(comm->qps[q]));
+    for (int q=0; q<comm->nqps; q++) {
+      if (comm->qps[q] == NULL) continue;
+      if (comm->verbs.srq) ncclIbSrqRemoveQp(&comm->verbs, comm->qps[q]);
+      NCCLCHECK(wrap_ibv_destroy_qp(comm->qps[q]));
+    }
     if (comm->fifoMr != NULL) NCCLCHECK(wrap_ibv_dereg_mr(comm->fifoMr));
+    if (comm->verbs.srq) {
+      pthread_mutex_lock(&comm->verbs.srq->lock);
+      comm->verbs.srq->inflight -= comm->srqCredits;
+      pthread_mutex_unlock(&comm->verbs.srq->lock);
+    }
     NCCLCHECK(ncclIbDestroyVerbs(&comm->verbs));
     free(comm);
   }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIbCloseSend(void* sendComm) {
+  struct ncclIbSendComm* comm = (struct ncclIbSendComm*)sendComm;
+  void* evicted;
+  if (comm && comm->poolId && comm->srqCredits == 0 && ncclIbVerbsIdle(&comm->verbs) && ncclIbPoolPark(0, comm, &evicted)) {
+    // The QPs stay connected for a later comm to the same peer, see ncclIbPoolPark()
+    NCCLCHECK(ncclSocketClose(&comm->sock));
+    NCCLCHECK(ncclIbDestroySend((struct ncclIbSendComm*)evicted));
+  } else {
+    NCCLCHECK(ncclIbDestroySend(comm));
+  }
   TIME_PRINT("IB");
   return ncclSuccess;
 }
 
-ncclResult_t ncclIbCloseRecv(void* recvComm) {
-  struct ncclIbRecvComm* comm = (struct ncclIbRecvComm*)recvComm;
+static ncclResult_t ncclIbDestroyRecv(struct ncclIbRecvComm* comm) {
   if (comm) {
     if (!ncclParamIbSockServerPortReuse() || reusedSockfd != comm->sock.fd) NCCLCHECK(ncclSocketClose(&comm->sock));
-    for (int q=0; q<comm->nqps; q++)
-      if (comm->qps[q] != NULL) NCCLCHECK(wrap_ibv_destroy_qp(comm->qps[q]));
+    for (int q=0; q<comm->nqps; q++) {
+      if (comm->qps[q] == NULL) continue;
+      if (comm->verbs.srq) ncclIbSrqRemoveQp(&comm->verbs, comm->qps[q]);
+      NCCLCHECK(wrap_ibv_destroy_qp(comm->qps[q]));
+    }
     if (comm->gpuFlush.enabled) {
-      if (comm->gpuFlush.qp != NULL) NCCLCHECK(wrap_ibv_destroy_qp(comm->gpuFlush.qp));
-      if (comm->gpuFlush.hostMr != NULL) NCCLCHECK(wrap_ibv_dereg_mr(comm->gpuFlush.hostMr));
+      for (int r=0; r<comm->verbs.nRails; r++) {
+        if (comm->gpuFlush.qp[r] != NULL && comm->verbs.srq) ncclIbSrqRemoveQp(&comm->verbs, comm->gpuFlush.qp[r]);
+        if (comm->gpuFlush.qp[r] != NULL) NCCLCHECK(wrap_ibv_destroy_qp(comm->gpuFlush.qp[r]));
+        if (comm->gpuFlush.hostMr[r] != NULL) NCCLCHECK(wrap_ibv_dereg_mr(comm->gpuFlush.hostMr[r]));
+      }
     }
     if (comm->remFifo.mr != NULL) NCCLCHECK(wrap_ibv_dereg_mr(comm->remFifo.mr));
+    if (comm->verbs.srq && comm->verbs.srqRings) {
+      // Receives that never completed: their WRs stay on the SRQ for other comms, only the CQ entries are returned
+      pthread_mutex_lock(&comm->verbs.srq->lock);
+      for (int q=0; q<comm->nqps; q++) comm->verbs.srq->inflight -= comm->verbs.srqRings[q].tail - comm->verbs.srqRings[q].head;
+      pthread_mutex_unlock(&comm->verbs.srq->lock);
+    }
     NCCLCHECK(ncclIbDestroyVerbs(&comm->verbs));
     free(comm);
   }
   return ncclSuccess;
 }
 
+ncclResult_t ncclIbCloseRecv(void* recvComm) {
+  struct ncclIbRecvComm* comm = (struct ncclIbRecvComm*)recvComm;
+  void* evicted;
+  if (comm && comm->poolId && ncclIbVerbsIdle(&comm->verbs) && ncclIbPoolPark(1, comm, &evicted)) {
+    if (!ncclParamIbSockServerPortReuse() || reusedSockfd != comm->sock.fd) NCCLCHECK(ncclSocketClose(&comm->sock));
+    comm->sock.fd = -1;
+    NCCLCHECK(ncclIbDestroyRecv((struct ncclIbRecvComm*)evicted));
+    return ncclSuccess;
+  }
+  return ncclIbDestroyRecv(comm);
+}
+
 ncclResult_t ncclIbCloseListen(void* listenComm) {
   struct ncclIbListenComm* comm = (struct ncclIbListenComm*)listenComm;
   if (comm) {
@@ -1415,6 +2507,10 @@ ncclNet_t ncclNetIb = {
   ncclIbTest,
   ncclIbCloseSend,
   ncclIbCloseRecv,
-  ncclIbCloseListen
+  ncclIbCloseListen,
+  NULL, // Sends of different comms go to different QPs, isend is as good
+  NULL, // Same for irecv
+  ncclIbTestSome,
+  NULL  // No batched registration
 };
 
@@ -9,12 +9,30 @@
 #include "socket.h"
 #include "net.h"
 #include "param.h"
+#include "rccl_vars.h"
+#include "cpuset.h"
 
 #include <pthread.h>
 #include <stdlib.h>
 #include <poll.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
 
 /* Init functions */
 static int ncclNetIfs = -1;
@@ -106,13 +124,17 @@ ncclResult_t ncclNetSocketGetProperties(int dev, ncclNetProperties_t* props) {
 
 /* Communication functions */
 
-#define MAX_SOCKETS 64
-#define MAX_THREADS 16
+// Socket indices are exchanged as a uint8_t during connection setup
+#define MAX_SOCKETS 128
+#define MAX_THREADS 64
 #define MAX_REQUESTS NCCL_NET_MAX_REQUESTS
 #define MIN_CHUNKSIZE (64*1024)
 
 NCCL_PARAM(SocketNsocksPerThread, "NSOCKS_PERTHREAD", -2);
 NCCL_PARAM(SocketNthreads, "SOCKET_NTHREADS", -2);
+RCCL_PARAM(SocketZeroCopy, "SOCKET_ZEROCOPY", 0);
+RCCL_PARAM(SocketZeroCopyMin, "SOCKET_ZEROCOPY_MIN", 16384);
+RCCL_PARAM(SocketAdaptive, "SOCKET_ADAPTIVE", 0);
 
 enum ncclNetSocketCommState {
   ncclNetSocketCommStateStart = 0,
@@ -134,6 +156,7 @@ struct ncclNetSocketHandle {
   uint64_t magic; // random number to help debugging
   int nSocks;
   int nThreads;
+  int adaptive; // Picked by the receiver, both sides must agree
   struct ncclNetSocketCommStage stage;
 };
 
@@ -145,6 +168,11 @@ struct ncclNetSocketTask {
   int offset;
   int used;
   ncclResult_t result;
+  // Owned by the helper thread
+  struct ncclNetSocketTask* next; // Next task on the same socket
+  int sent;
+  uint32_t zcLast; // Zero-copy sends up to this id must complete before the buffer is released
+  uint64_t start;  // When the socket started on this task
 };
 
 struct ncclNetSocketRequest {
@@ -162,25 +190,104 @@ struct ncclNetSocketRequest {
 struct ncclNetSocketTaskQueue {
   int next;
   int len;
+  uint64_t posted; // Tasks posted so far, tells the helper thread which ones are new
   struct ncclNetSocketTask* tasks;
+  struct ncclNetSocketTask** ring; // Tasks in posting order, slots of tasks complete out of order
 };
 
+// Helper threads wait in epoll on their sockets, edge-triggered, and on an
+// eventfd the main thread writes to when it posts a task or stops the thread.
 struct ncclNetSocketThreadResources {
   struct ncclNetSocketTaskQueue threadTaskQueue;
   int stop;
+  int op;
+  int tid;
+  int epollFd;
+  int eventFd;
   struct ncclNetSocketComm* comm;
   pthread_mutex_t threadLock;
-  pthread_cond_t  threadCond;
 };
 
+#define NCCL_SOCKET_WAKEUP UINT32_MAX
+#define NCCL_SOCKET_MAX_EVENTS 64
+
+// Tasks of a socket progress in posting order, so each socket is a FIFO.
+// A socket stays ready until a send or recv would block, then epoll tells.
+// With RCCL_SOCKET_ZEROCOPY, large sends use MSG_ZEROCOPY: the kernel numbers
+// each such send call and reports completed ranges on the socket error
+// queue, which epoll signals with EPOLLERR. A task is sent once cur moves
+// past it, and done once the ids of its sends are reported.
+struct ncclNetSocketSockState {
+  struct ncclNetSocketTask* head; // Oldest task not done
+  struct ncclNetSocketTask* cur;  // Oldest task not sent
+  struct ncclNetSocketTask* tail;
+  int ready;
+  int errQueue;
+  int zeroCopy;
+  uint32_t zcNext; // Id of the next zero-copy send
+  uint32_t zcDone; // Ids below are complete
+};
+
+static ncclResult_t ncclNetSocketZeroCopySend(struct ncclNetSocketSockState* st, struct ncclNetSocketTask* t) {
+  char* data = (char*)t->data;
+  while (t->sent < t->size) {
+    int bytes = send(t->sock->fd, data+t->sent, t->size-t->sent, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (bytes == -1) {
+      if (errno == EINTR) continue;
+      // ENOBUFS: too many sends waiting for their notification, the next one wakes us up
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) break;
+      char line[SOCKET_NAME_MAXLEN+1];
+      WARN("NET/Socket : zero-copy send to %s failed : %s", ncclSocketToString(&t->sock->addr, line), strerror(errno));
+      return ncclRemoteError;
+    }
+    st->zcNext++;
+    t->sent += bytes;
+  }
+  return ncclSuccess;
+}
+
+// Reads the completion ranges on the error queue. TCP reports them in order.
+static ncclResult_t ncclNetSocketZeroCopyReap(struct ncclNetSocketSockState* st, struct ncclSocket* sock) {
+  while (1) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return ncclSuccess;
+      WARN("NET/Socket : reading the socket error queue failed : %s", strerror(errno));
+      return ncclSystemError;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+            (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) continue;
+      struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cmsg);
+      if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) continue;
+      if ((int32_t)(err->ee_data+1-st->zcDone) > 0) st->zcDone = err->ee_data+1;
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        // The kernel had to copy anyway (e.g. loopback), pinning pages is pure overhead
+        if (st->zeroCopy) INFO(NCCL_NET, "NET/Socket : zero-copy sends were copied, disabling MSG_ZEROCOPY on this socket");
+        st->zeroCopy = 0;
+      }
+    }
+  }
+}
+
 struct ncclNetSocketListenComm {
   struct ncclSocket sock;
   struct ncclNetSocketCommStage stage;
   int nSocks;
   int nThreads;
+  int adaptive;
   int dev;
 };
 
+// With RCCL_SOCKET_ADAPTIVE, the sender puts each chunk of a request on the
+// socket expected to drain it first: its backlog of unfinished bytes over the
+// rate it recently sent at. The chunk to socket map follows the size on the
+// control socket so the receiver posts its chunks on the same sockets.
 struct ncclNetSocketComm {
   struct ncclSocket ctrlSock;
   struct ncclSocket socks[MAX_SOCKETS];
@@ -189,46 +296,173 @@ struct ncclNetSocketComm {
   int nSocks;
   int nThreads;
   int nextSock;
+  int adaptive;
+  int64_t sockBacklog[MAX_SOCKETS]; // Bytes posted and not done, main thread only
+  uint64_t sockRate[MAX_SOCKETS];   // Bytes per us, EWMA written by the helper threads
   struct ncclNetSocketRequest requests[MAX_REQUESTS];
   pthread_t helperThread[MAX_THREADS];
   struct ncclNetSocketThreadResources threadResources[MAX_THREADS];
 };
 
+// Keep helper threads on the CPUs local to their interface, read from sysfs
+// since the plugin has no access to the topology.
+static void ncclNetSocketSetAffinity(int dev) {
+  cpu_set_t mask;
+  if (ncclThreadAffinityOverride("socket", &mask) != ncclSuccess || CPU_COUNT(&mask) == 0) {
+    if (!rcclParamProxyNicAffinity() || ncclNetSocketDevs[dev].pciPath == NULL) return;
+    char path[PATH_MAX], cpus[sizeof(cpu_set_t)*3];
+    snprintf(path, PATH_MAX, "%s/local_cpus", ncclNetSocketDevs[dev].pciPath);
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return;
+    bool ok = fgets(cpus, sizeof(cpus), file) != NULL;
+    fclose(file);
+    if (!ok) return;
+    CPU_ZERO(&mask);
+    ncclStrToCpuset(cpus, &mask);
+    cpu_set_t current;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &current) == 0) CPU_AND(&mask, &mask, &current);
+  }
+  if (CPU_COUNT(&mask)) sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+}
+
 void* persistentSocketThread(void *args_) {
   struct ncclNetSocketThreadResources* resource = (struct ncclNetSocketThreadResources*)args_;
   struct ncclNetSocketComm* comm = resource->comm;
+  ncclNetSocketSetAffinity(comm->dev);
   struct ncclNetSocketTaskQueue* myQueue = &resource->threadTaskQueue;
+  // Thread t drives sockets t, t+nThreads, ...
   int nSocksPerThread = comm->nSocks / comm->nThreads;
+  struct ncclNetSocketSockState* socks;
+  if (ncclCalloc(&socks, nSocksPerThread) != ncclSuccess) return NULL;
+  for (int l=0; l<nSocksPerThread; l++) {
+    socks[l].ready = 1;
+    struct ncclSocket* sock = comm->socks+resource->tid+l*comm->nThreads;
+    int one = 1;
+    if (resource->op == NCCL_SOCKET_SEND && rcclParamSocketZeroCopy()) {
+      if (setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        socks[l].zeroCopy = 1;
+      } else {
+        INFO(NCCL_NET, "NET/Socket : SO_ZEROCOPY not supported (%s), using regular sends", strerror(errno));
+      }
+    }
+  }
+  struct epoll_event events[NCCL_SOCKET_MAX_EVENTS];
+  uint64_t consumed = 0;
   while (1) {
-    int idle = 1;
-    int mark = myQueue->next; // mark newest task seen
-    for (int i=0; i<myQueue->len; i+=nSocksPerThread) {
-      int repeat;
-      do {
-        repeat = 0;
-        for (int j=0; j<nSocksPerThread; j++) {
-          struct ncclNetSocketTask* r = myQueue->tasks+i+j;
-          if (r != NULL && r->used == 1 && r->offset < r->size) {
-            r->result = ncclSocketProgress(r->op, r->sock, r->data, r->size, &r->offset);
-            if (r->result != ncclSuccess) {
-              WARN("NET/Socket : socket progress error");
-              return NULL;
-            }
-            idle = 0;
-            if (r->offset < r->size) repeat = 1;
-          }
+    pthread_mutex_lock(&resource->threadLock);
+    uint64_t posted = myQueue->posted;
+    int stop = resource->stop;
+    pthread_mutex_unlock(&resource->threadLock);
+    if (stop) break;
+
+    // Queue the tasks posted since the last wakeup on their sockets
+    for (; consumed < posted; consumed++) {
+      struct ncclNetSocketTask* t = myQueue->ring[consumed%myQueue->len];
+      struct ncclNetSocketSockState* st = socks+(t->sock-comm->socks)/comm->nThreads;
+      t->next = NULL;
+      t->sent = 0;
+      if (st->tail) st->tail->next = t; else st->head = t;
+      st->tail = t;
+      if (st->cur == NULL) st->cur = t;
+    }
+
+    for (int l=0; l<nSocksPerThread; l++) {
+      struct ncclNetSocketSockState* st = socks+l;
+      ncclResult_t res = ncclSuccess;
+      if (st->errQueue) {
+        st->errQueue = 0;
+        if (st->zcNext != st->zcDone) res = ncclNetSocketZeroCopyReap(st, comm->socks+resource->tid+l*comm->nThreads);
+      }
+      while (res == ncclSuccess && st->ready && st->cur) {
+        struct ncclNetSocketTask* t = st->cur;
+        if (t->sent == 0 && t->start == 0) t->start = clockNano();
+        if (st->zeroCopy && t->size >= rcclParamSocketZeroCopyMin()) {
+          res = ncclNetSocketZeroCopySend(st, t);
+        } else {
+          res = ncclSocketProgress(t->op, t->sock, t->data, t->size, &t->sent);
+        }
+        if (res != ncclSuccess) break;
+        if (t->sent < t->size) {
+          st->ready = 0; // Would block
+        } else {
+          t->zcLast = st->zcNext;
+          st->cur = t->next;
         }
-      } while (repeat);
+      }
+      if (res != ncclSuccess) {
+        WARN("NET/Socket : socket progress error");
+        (st->cur ? st->cur : st->head)->result = res;
+        free(socks);
+        return NULL;
+      }
+      // Release the buffers of the tasks whose zero-copy sends completed, in order
+      while (st->head && st->head != st->cur && (int32_t)(st->zcDone-st->head->zcLast) >= 0) {
+        struct ncclNetSocketTask* t = st->head;
+        if (comm->adaptive && t->size >= MIN_CHUNKSIZE) {
+          uint64_t* rate = comm->sockRate+(t->sock-comm->socks);
+          uint64_t ns = std::max<uint64_t>(clockNano()-t->start, 1);
+          uint64_t sample = std::max<uint64_t>(t->size*1000ULL/ns, 1);
+          uint64_t old = __atomic_load_n(rate, __ATOMIC_RELAXED);
+          __atomic_store_n(rate, old ? (3*old+sample)/4 : sample, __ATOMIC_RELAXED);
+        }
+        // Unlink before publishing, the main thread may recycle the task right away
+        st->head = t->next;
+        if (st->head == NULL) st->tail = NULL;
+        __atomic_store_n(&t->offset, t->size, __ATOMIC_RELEASE);
+      }
+    }
+
+    int nEvents;
+    while ((nEvents = epoll_wait(resource->epollFd, events, NCCL_SOCKET_MAX_EVENTS, -1)) == -1 && errno == EINTR);
+    if (nEvents == -1) {
+      WARN("NET/Socket : epoll_wait failed : %s", strerror(errno));
+      break;
     }
-    if (idle) {
-      pthread_mutex_lock(&resource->threadLock);
-      while (mark == myQueue->next && resource->stop == 0) { // no new tasks, wait
-        pthread_cond_wait(&resource->threadCond, &resource->threadLock);
+    for (int e=0; e<nEvents; e++) {
+      if (events[e].data.u32 == NCCL_SOCKET_WAKEUP) {
+        uint64_t count;
+        (void)!read(resource->eventFd, &count, sizeof(count));
+      } else {
+        // Errors and hang-ups are reported by the next progress call
+        socks[events[e].data.u32].ready = 1;
+        if (events[e].events & EPOLLERR) socks[events[e].data.u32].errQueue = 1;
       }
-      pthread_mutex_unlock(&resource->threadLock);
     }
-    if (resource->stop) return NULL;
   }
+  free(socks);
+  return NULL;
+}
+
+static ncclResult_t ncclNetSocketWakeThread(struct ncclNetSocketThreadResources* res) {
+  uint64_t one = 1;
+  if (write(res->eventFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+    WARN("NET/Socket : failed to wake up helper thread : %s", strerror(errno));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclNetSocketStartThread(struct ncclNetSocketComm* comm, int tid, int op) {
+  struct ncclNetSocketThreadResources* res = comm->threadResources+tid;
+  res->comm = comm;
+  res->op = op;
+  res->tid = tid;
+  SYSCHECKVAL(epoll_create1(EPOLL_CLOEXEC), "epoll_create1", res->epollFd);
+  SYSCHECKVAL(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd", res->eventFd);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = NCCL_SOCKET_WAKEUP;
+  SYSCHECK(epoll_ctl(res->epollFd, EPOLL_CTL_ADD, res->eventFd, &ev), "epoll_ctl");
+  for (int s=tid; s<comm->nSocks; s+=comm->nThreads) {
+    ev.events = (op == NCCL_SOCKET_SEND ? EPOLLOUT : EPOLLIN) | EPOLLET;
+    ev.data.u32 = s/comm->nThreads;
+    SYSCHECK(epoll_ctl(res->epollFd, EPOLL_CTL_ADD, comm->socks[s].fd, &ev), "epoll_ctl");
+  }
+  pthread_mutex_init(&res->threadLock, NULL);
+  pthread_create(comm->helperThread+tid, NULL, persistentSocketThread, res);
+  ncclSetThreadName(comm->helperThread[tid], "NCCL Sock%c%1u%2u%2u", op == NCCL_SOCKET_SEND ? 'S' : 'R', comm->dev, tid, comm->cudaDev);
+  return ncclSuccess;
 }
 
 ncclResult_t ncclNetSocketGetNsockNthread(int dev, int* ns, int* nt) {
@@ -296,6 +530,7 @@ ncclResult_t ncclNetSocketListen(int dev, void* opaqueHandle, void** listenComm)
   NCCLCHECK(ncclNetSocketGetNsockNthread(dev, &comm->nSocks, &comm->nThreads));
   handle->nSocks = comm->nSocks;
   handle->nThreads = comm->nThreads;
+  handle->adaptive = comm->adaptive = comm->nSocks > 1 && rcclParamSocketAdaptive() ? 1 : 0;
   comm->dev = dev;
   *listenComm = comm;
   return ncclSuccess;
@@ -321,6 +556,7 @@ ncclResult_t ncclNetSocketConnect(int dev, void* opaqueHandle, void** sendComm)
   stage->comm = comm;
   comm->nSocks = handle->nSocks;
   comm->nThreads = handle->nThreads;
+  comm->adaptive = handle->adaptive;
   comm->dev = dev;
   CUDACHECK(cudaGetDevice(&comm->cudaDev));
   for (; i<comm->nSocks+1; i++) {
@@ -362,6 +598,7 @@ ncclResult_t ncclNetSocketAccept(void* listenComm, void** recvComm) {
   stage->comm = rComm;
   rComm->nSocks = lComm->nSocks;
   rComm->nThreads = lComm->nThreads;
+  rComm->adaptive = lComm->adaptive;
   rComm->dev = lComm->dev;
   CUDACHECK(cudaGetDevice(&rComm->cudaDev));
   for (; i<rComm->nSocks+1; i++) {
@@ -419,39 +656,63 @@ ncclResult_t ncclNetSocketGetRequest(struct ncclNetSocketComm* comm, int op, voi
   return ncclInternalError;
 }
 
-ncclResult_t ncclNetSocketGetTask(struct ncclNetSocketComm* comm, int op, void* data, int size, struct ncclNetSocketTask** req) {
-  int tid = comm->nextSock % comm->nThreads;
+// Socket the sender expects to drain a chunk of the given size first
+static int ncclNetSocketPickSock(struct ncclNetSocketComm* comm, int size) {
+  int best = comm->nextSock;
+  double bestTime = -1;
+  for (int i=0; i<comm->nSocks; i++) {
+    int s = (comm->nextSock+i) % comm->nSocks;
+    uint64_t rate = __atomic_load_n(comm->sockRate+s, __ATOMIC_RELAXED);
+    if (rate == 0) return comm->nextSock; // Not measured yet, round-robin
+    double time = (double)(comm->sockBacklog[s]+size)/rate;
+    if (bestTime < 0 || time < bestTime) {
+      best = s;
+      bestTime = time;
+    }
+  }
+  return best;
+}
+
+ncclResult_t ncclNetSocketGetTask(struct ncclNetSocketComm* comm, int op, void* data, int size, int sockIdx, struct ncclNetSocketTask** req) {
+  int tid = sockIdx % comm->nThreads;
   struct ncclNetSocketThreadResources* res = comm->threadResources+tid;
   struct ncclNetSocketTaskQueue* queue = &res->threadTaskQueue;
   // create helper threads and prepare per-thread task queue
   if (queue->tasks == NULL) {
     // each request can be divided up to nSocks tasks, and
     // these tasks are distributed to nThreads threads,
-    // we need to make sure each thread queue has enough slots for MAX_REQUESTS
-    queue->len = MAX_REQUESTS * DIVUP(comm->nSocks, comm->nThreads);
+    // we need to make sure each thread queue has enough slots for MAX_REQUESTS.
+    // Adaptive scheduling may put all the tasks of a request on one thread.
+    queue->len = MAX_REQUESTS * (comm->adaptive ? comm->nSocks : DIVUP(comm->nSocks, comm->nThreads));
     NCCLCHECK(ncclCalloc(&queue->tasks, queue->len));
+    NCCLCHECK(ncclCalloc(&queue->ring, queue->len));
     queue->next = 0;
-    res->comm = comm;
-    pthread_mutex_init(&res->threadLock, NULL);
-    pthread_cond_init(&res->threadCond, NULL);
-    pthread_create(comm->helperThread+tid, NULL, persistentSocketThread, res);
-    ncclSetThreadName(comm->helperThread[tid], "NCCL Sock%c%1u%2u%2u", op == NCCL_SOCKET_SEND ? 'S' : 'R', comm->dev, tid, comm->cudaDev);
+    queue->posted = 0;
+    NCCLCHECK(ncclNetSocketStartThread(comm, tid, op));
+  }
+  struct ncclNetSocketTask* r = NULL;
+  for (int i=0; i<queue->len && r == NULL; i++) {
+    struct ncclNetSocketTask* t = queue->tasks+(queue->next+i)%queue->len;
+    if (t->used == 0) r = t;
   }
-  struct ncclNetSocketTask* r = queue->tasks+queue->next;
-  if (r->used == 0) {
+  if (r) {
     r->op = op;
     r->data = data;
     r->size = size;
-    r->sock = comm->socks + comm->nextSock;
+    r->sock = comm->socks + sockIdx;
     r->offset = 0;
+    r->start = 0;
     r->result = ncclSuccess;
-    comm->nextSock = (comm->nextSock + 1) % comm->nSocks;
+    comm->nextSock = (sockIdx + 1) % comm->nSocks;
+    comm->sockBacklog[sockIdx] += size;
     r->used = 1;
     *req = r;
     pthread_mutex_lock(&res->threadLock);
-    queue->next = (queue->next+1)%queue->len;
-    pthread_cond_signal(&res->threadCond);
+    queue->next = (r-queue->tasks+1)%queue->len;
+    queue->ring[queue->posted%queue->len] = r;
+    queue->posted++;
     pthread_mutex_unlock(&res->threadLock);
+    NCCLCHECK(ncclNetSocketWakeThread(res));
     return ncclSuccess;
   }
   WARN("NET/Socket : unable to allocate subtasks");
@@ -493,9 +754,29 @@ ncclResult_t ncclNetSocketTest(void* request, int* done, int* size) {
     if (r->comm->nSocks > 0) {
       // each request can be divided up to nSocks tasks
       int taskSize = std::max(MIN_CHUNKSIZE, DIVUP(r->size, r->comm->nSocks));
+      int nChunks = DIVUP(r->size, taskSize);
+      uint8_t sockMap[MAX_SOCKETS];
+      if (r->comm->adaptive && nChunks > 0) {
+        if (r->op == NCCL_SOCKET_SEND) {
+          for (int c=0; c<nChunks; c++) {
+            int chunkSize = std::min(taskSize, r->size-c*taskSize);
+            sockMap[c] = ncclNetSocketPickSock(r->comm, chunkSize);
+            r->comm->sockBacklog[sockMap[c]] += chunkSize; // Seen by the next picks, undone below
+          }
+          for (int c=0; c<nChunks; c++) r->comm->sockBacklog[sockMap[c]] -= std::min(taskSize, r->size-c*taskSize);
+        }
+        // Small, and it follows the size the peer just exchanged
+        offset = 0;
+        NCCLCHECK(ncclSocketWait(r->op, r->ctrlSock, sockMap, nChunks, &offset));
+      }
       while (chunkOffset < r->size) {
         int chunkSize = std::min(taskSize, r->size-chunkOffset);
-        NCCLCHECK(ncclNetSocketGetTask(r->comm, r->op, (char*)(r->data)+chunkOffset, chunkSize, r->tasks+i++));
+        int sockIdx = r->comm->adaptive ? sockMap[i] : r->comm->nextSock;
+        if (sockIdx >= r->comm->nSocks) {
+          WARN("NET/Socket : peer sent invalid socket index %d", sockIdx);
+          return ncclInternalError;
+        }
+        NCCLCHECK(ncclNetSocketGetTask(r->comm, r->op, (char*)(r->data)+chunkOffset, chunkSize, sockIdx, r->tasks+i++));
         chunkOffset += chunkSize;
       }
     }
@@ -506,8 +787,8 @@ ncclResult_t ncclNetSocketTest(void* request, int* done, int* size) {
       int nCompleted = 0;
       for (int i=0; i<r->nSubs; i++) {
         struct ncclNetSocketTask* sub = r->tasks[i];
-        if (sub->result != ncclSuccess) return sub->result;
-        if (sub->offset == sub->size) nCompleted++;
+        if (__atomic_load_n(&sub->offset, __ATOMIC_ACQUIRE) == sub->size) nCompleted++;
+        else if (sub->result != ncclSuccess) return sub->result;
       }
       if (nCompleted == r->nSubs) {
         if (size) *size = r->size;
@@ -515,6 +796,7 @@ ncclResult_t ncclNetSocketTest(void* request, int* done, int* size) {
         r->used = 0;
         for (int i=0; i<r->nSubs; i++) {
           struct ncclNetSocketTask* sub = r->tasks[i];
+          r->comm->sockBacklog[sub->sock-r->comm->socks] -= sub->size;
           sub->used = 0;
         }
       }
@@ -574,11 +856,14 @@ ncclResult_t ncclNetSocketClose(void* opaqueComm) {
       if (comm->helperThread[i]) {
         pthread_mutex_lock(&res->threadLock);
         res->stop = 1;
-        pthread_cond_signal(&res->threadCond);
         pthread_mutex_unlock(&res->threadLock);
+        NCCLCHECK(ncclNetSocketWakeThread(res));
         pthread_join(comm->helperThread[i], NULL);
+        close(res->epollFd);
+        close(res->eventFd);
       }
       free(res->threadTaskQueue.tasks);
+      free(res->threadTaskQueue.ring);
     }
     int ready;
     NCCLCHECK(ncclSocketReady(&comm->ctrlSock, &ready));
@@ -609,5 +894,9 @@ ncclNet_t ncclNetSocket = {
   ncclNetSocketTest,
   ncclNetSocketClose,
   ncclNetSocketClose,
-  ncclNetSocketCloseListen
+  ncclNetSocketCloseListen,
+  NULL, // No batched calls
+  NULL,
+  NULL,
+  NULL
 };
@@ -155,7 +155,8 @@ ncclResult_t nvlsGroupBindMem(struct ncclComm *comm, struct ncclNvlsSharedRes* r
   CUCHECK(cuMemCreate(&resources->ucHandle, size, &prop, 0));
   CUCHECK(cuMemMap(ptr, size, 0, resources->ucHandle, 0));
   CUCHECK(cuMemSetAccess(ptr, size, &resources->accessDesc, 1));
-  CUDACHECK(cudaMemset((void*)ptr, 0, size));
+  CUDACHECK(cudaMemsetAsync((void*)ptr, 0, size, comm->sideStream));
+  CUDACHECK(cudaStreamSynchronize(comm->sideStream));
   resources->ucBuff = (char*)ptr;
   INFO(NCCL_NVLS, "NVLS Mapped UC at %p size %zi", resources->ucBuff, size);
 
@@ -12,18 +12,24 @@
 #include "graph.h"
 #include "graph/topo.h"
 #include "p2p.h"
+#include "bootstrap.h"
 
 enum p2pType { P2P_DIRECT, P2P_INTERMEDIATE, P2P_IPC, P2P_CUMEM };
 
 struct ncclP2pBuff {
   void* directPtr;
   size_t size;
+  size_t offset; // Offset of the buffer inside the allocation ipcDesc refers to
   ncclIpcDesc ipcDesc;
 };
 
 struct p2pConnectInfo {
   int rank;
   int read;
+  // Bootstrap message from simplePeer carrying the ncclP2pBuff of the SIMPLE buffer when it is in
+  // coarse-grained memory (RCCL_P2P_COARSE_SIMPLE), as it does not fit here. 0 when it is part of p2pBuff.
+  int simplePeer;
+  int simpleTag;
   struct ncclP2pBuff p2pBuff;
   // Used by CE memcpy
   char shmName[7];
@@ -31,6 +37,8 @@ struct p2pConnectInfo {
 };
 static_assert(sizeof(struct p2pConnectInfo) <= CONNECT_SIZE, "p2pConnectInfo is too large");
 
+#define P2P_CE_MAX_STREAMS 4
+
 struct p2pShm {
   struct ncclSendMem sendMem;
   struct ncclRecvMem recvMem;
@@ -52,11 +60,20 @@ struct p2pShmProxyInfo {
 
   // Used by CE memcpy progress only
   uint64_t step;
-  cudaStream_t stream;
+  int nStreams;
+  int nextStream;
+  cudaStream_t streams[P2P_CE_MAX_STREAMS];
   cudaEvent_t events[NCCL_STEPS];
+  cudaEvent_t lastEvent; // Recorded after the last tail update
 };
 static_assert(sizeof(p2pConnectInfo) <= CONNECT_SIZE, "P2P Connect info is too large");
 
+// Proxy resources of a connection without cuMem
+struct p2pProxyBuffs {
+  void* buff;
+  void* simpleBuff;
+};
+
 struct p2pResources {
   enum p2pType type;
   union {
@@ -72,6 +89,20 @@ struct p2pResources {
   int shmSize;
   ncclShmHandle_t handle;
   uint32_t* next_hdp_reg;  // Next GPU in ring (for p2p transport use only)
+  uint32_t protoMask;      // Protocols with a buffer in the connection
+  // Coarse-grained SIMPLE buffer allocated for this connection, and the one of the peer
+  char* simpleDevMem;
+  void* simpleMemIpc;
+  void* remSimpleMemIpc;
+  // Buffers allocated by this rank rather than by its proxy (RCCL_P2P_LOCAL_SETUP)
+  struct p2pProxyBuffs localBuffs;
+};
+
+// Proxy setup request: the buffer with the flags and the fine-grained FIFOs, and the
+// coarse-grained SIMPLE buffer if any. The response is one ncclP2pBuff for each.
+struct p2pSetupReq {
+  int size;
+  int simpleSize;
 };
 
 // cuMem API support
@@ -100,6 +131,8 @@ static int busIdToCudaDev(int64_t busId) {
 
 // CE memcpy support
 NCCL_PARAM(P2pUseCudaMemcpy, "P2P_USE_CUDA_MEMCPY", 0);
+RCCL_PARAM(P2pCeBatch, "P2P_CE_BATCH", 1); // Copy all posted steps with one memcpy
+RCCL_PARAM(P2pCeStreams, "P2P_CE_STREAMS", 2); // Copy streams per connection, spreading batches over SDMA engines
 static int useMemcpy = 0;
 static void initCeOperation();
 
@@ -200,7 +233,7 @@ ncclResult_t p2pCanConnect(int* ret, struct ncclTopoSystem* topo, struct ncclTop
   } while (0)
 
 // cuMem API support
-ncclResult_t ncclP2pAllocateShareableBuffer(size_t size, ncclIpcDesc *ipcDesc, void **ptr) {
+ncclResult_t ncclP2pAllocateShareableBuffer(size_t size, ncclIpcDesc *ipcDesc, void **ptr, bool isFineGrain) {
   if (ncclCuMemEnable()) {
 #if CUDART_VERSION >= 11030
     // cuMem API support
@@ -214,7 +247,7 @@ ncclResult_t ncclP2pAllocateShareableBuffer(size_t size, ncclIpcDesc *ipcDesc, v
 #endif
   } else {
     // Allocate a CUDA buffer and generate an IPC handle for it
-    NCCLCHECK(ncclCudaCalloc((char **)ptr, size, nullptr, true));
+    NCCLCHECK(ncclCudaCalloc((char **)ptr, size, nullptr, isFineGrain));
     cudaError_t res = cudaIpcGetMemHandle(&ipcDesc->devIpc, *ptr);
     if (res != cudaSuccess) {
       WARN("cudaIpcGetMemHandle failed : %s", cudaGetErrorString(res));
@@ -292,15 +325,188 @@ ncclResult_t ncclP2pImportShareableBuffer(struct ncclComm *comm, int tpPeer, siz
   return ncclSuccess;
 }
 
+// Pooled P2P buffers: connection buffers are carved out of large shareable
+// slabs, so a peer opens one IPC handle per slab rather than one per channel.
+RCCL_PARAM(P2pPoolSize, "P2P_POOL_SIZE", 64*1024*1024); // 0 disables pooling
+
+struct p2pPoolSlab {
+  char* base;
+  size_t used;
+  int refs;
+  int cudaDev;
+  bool isFineGrain;
+  ncclIpcDesc ipcDesc;
+  struct p2pPoolSlab* next;
+};
+
+struct p2pPoolImport {
+  ncclIpcDesc ipcDesc;
+  int cudaDev;
+  void* base;
+  int refs;
+  struct p2pPoolImport* next;
+};
+
+static pthread_mutex_t p2pPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static struct p2pPoolSlab* p2pPoolSlabs = NULL;
+static struct p2pPoolImport* p2pPoolImports = NULL;
+
+// Called by the rank owning the buffer or by its proxy
+static ncclResult_t p2pPoolAlloc(size_t size, bool isFineGrain, struct ncclP2pBuff* p2pBuff) {
+  ncclResult_t ret = ncclSuccess;
+  size_t slabSize = rcclParamP2pPoolSize();
+  struct p2pPoolSlab* slab;
+  int cudaDev;
+  p2pBuff->size = size;
+  p2pBuff->offset = 0;
+  ALIGN_SIZE(size, CUDA_IPC_MIN);
+  if (ncclCuMemEnable() || size > slabSize) {
+    return ncclP2pAllocateShareableBuffer(p2pBuff->size, &p2pBuff->ipcDesc, &p2pBuff->directPtr, isFineGrain);
+  }
+  CUDACHECK(cudaGetDevice(&cudaDev));
+  pthread_mutex_lock(&p2pPoolLock);
+  for (slab = p2pPoolSlabs; slab; slab = slab->next) {
+    if (slab->cudaDev == cudaDev && slab->isFineGrain == isFineGrain && slab->used + size <= slabSize) break;
+  }
+  if (slab == NULL) {
+    NCCLCHECKGOTO(ncclCalloc(&slab, 1), ret, exit);
+    NCCLCHECKGOTO(ncclP2pAllocateShareableBuffer(slabSize, &slab->ipcDesc, (void**)&slab->base, isFineGrain), ret, fail);
+    slab->cudaDev = cudaDev;
+    slab->isFineGrain = isFineGrain;
+    slab->next = p2pPoolSlabs;
+    p2pPoolSlabs = slab;
+    INFO(NCCL_P2P|NCCL_ALLOC, "P2P pool: new %s slab %p size %zu on dev %d", isFineGrain ? "fine-grained" : "coarse-grained", slab->base, slabSize, cudaDev);
+  }
+  p2pBuff->directPtr = slab->base + slab->used;
+  p2pBuff->offset = slab->used;
+  p2pBuff->ipcDesc = slab->ipcDesc;
+  slab->used += size;
+  slab->refs++;
+exit:
+  pthread_mutex_unlock(&p2pPoolLock);
+  return ret;
+fail:
+  free(slab);
+  goto exit;
+}
+
+static ncclResult_t p2pPoolFree(void* ptr) {
+  struct p2pPoolSlab* slab = NULL;
+  pthread_mutex_lock(&p2pPoolLock);
+  for (struct p2pPoolSlab** prev = &p2pPoolSlabs; *prev; prev = &(*prev)->next) {
+    if ((char*)ptr >= (*prev)->base && (char*)ptr < (*prev)->base + (*prev)->used) {
+      slab = *prev;
+      if (--slab->refs == 0) *prev = slab->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&p2pPoolLock);
+  if (slab == NULL) return ncclCudaFree(ptr);
+  if (slab->refs == 0) {
+    ncclResult_t ret = ncclCudaFree(slab->base);
+    free(slab);
+    return ret;
+  }
+  return ncclSuccess;
+}
+
+// Returns the base of the imported allocation; the buffer is at base+p2pBuff->offset
+static ncclResult_t p2pPoolImport(struct ncclComm* comm, int tpPeer, struct ncclP2pBuff* p2pBuff, void** base) {
+  ncclResult_t ret = ncclSuccess;
+  struct p2pPoolImport* imp;
+  if (ncclCuMemEnable()) {
+    return ncclP2pImportShareableBuffer(comm, tpPeer, p2pBuff->size, &p2pBuff->ipcDesc, base);
+  }
+  pthread_mutex_lock(&p2pPoolLock);
+  for (imp = p2pPoolImports; imp; imp = imp->next) {
+    if (imp->cudaDev == comm->cudaDev && memcmp(&imp->ipcDesc, &p2pBuff->ipcDesc, sizeof(ncclIpcDesc)) == 0) break;
+  }
+  if (imp == NULL) {
+    NCCLCHECKGOTO(ncclCalloc(&imp, 1), ret, exit);
+    NCCLCHECKGOTO(ncclP2pImportShareableBuffer(comm, tpPeer, p2pBuff->size, &p2pBuff->ipcDesc, &imp->base), ret, fail);
+    imp->ipcDesc = p2pBuff->ipcDesc;
+    imp->cudaDev = comm->cudaDev;
+    imp->next = p2pPoolImports;
+    p2pPoolImports = imp;
+  }
+  imp->refs++;
+  *base = imp->base;
+exit:
+  pthread_mutex_unlock(&p2pPoolLock);
+  return ret;
+fail:
+  free(imp);
+  goto exit;
+}
+
+static ncclResult_t p2pPoolClose(void* base) {
+  struct p2pPoolImport* imp = NULL;
+  pthread_mutex_lock(&p2pPoolLock);
+  for (struct p2pPoolImport** prev = &p2pPoolImports; *prev; prev = &(*prev)->next) {
+    if ((*prev)->base == base) {
+      imp = *prev;
+      if (--imp->refs == 0) *prev = imp->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&p2pPoolLock);
+  if (imp && imp->refs) return ncclSuccess;
+  free(imp);
+  CUDACHECK(cudaIpcCloseMemHandle(base));
+  return ncclSuccess;
+}
+
+// Allocates the buffers of a connection without cuMem, returned in p2pBuff[0] and p2pBuff[1]
+static ncclResult_t p2pAllocBuffs(struct p2pSetupReq* req, struct ncclP2pBuff* p2pBuff, struct p2pProxyBuffs* buffs) {
+  memset(p2pBuff+1, 0, sizeof(struct ncclP2pBuff));
+  NCCLCHECK(p2pPoolAlloc(req->size, true, p2pBuff));
+  buffs->buff = p2pBuff->directPtr;
+  if (req->simpleSize) {
+    NCCLCHECK(p2pPoolAlloc(req->simpleSize, false, p2pBuff+1));
+    buffs->simpleBuff = p2pBuff[1].directPtr;
+  }
+  return ncclSuccess;
+}
+
+static void p2pFreeBuffs(struct p2pProxyBuffs* buffs) {
+  // Do not check return code as CUDA may have already shut down
+  if (buffs->buff) p2pPoolFree(buffs->buff);
+  if (buffs->simpleBuff) p2pPoolFree(buffs->simpleBuff);
+}
+
+// Connections with their buffers on our own GPU allocate them in the calling thread instead of
+// through a blocking RPC to our proxy thread, and never connect to the proxy: once connected, only
+// the kernels touch them. Connections through an intermediate GPU, and P2P/CE copies
+// (NCCL_P2P_USE_CUDA_MEMCPY), whose data the proxy moves, still go through the proxy.
+RCCL_PARAM(P2pLocalSetup, "P2P_LOCAL_SETUP", 1);
+
 // Setting this to non zero causes P2P to use Reads rather than Writes
 NCCL_PARAM(P2pReadEnable, "P2P_READ_ENABLE", -2);
 NCCL_PARAM(P2pDirectDisable, "P2P_DIRECT_DISABLE", 0);
+// Bulk copies into fine-grained memory are slower than into coarse-grained memory, which only
+// the flags and the LL/LL128 lines need to be in. With this set, the SIMPLE buffer of a
+// connection is a separate coarse-grained allocation, and kernels fence around the steps they
+// move through it (NCCL_COARSE_SIMPLE). tools/p2p-latency-test/p2p_grain_bench checks that a
+// platform sees coherent data this way and whether it is faster.
+RCCL_PARAM(P2pCoarseSimple, "P2P_COARSE_SIMPLE", 0);
+
+static bool p2pCoarseSimple() {
+  return rcclParamP2pCoarseSimple() && !useMemcpy && !ncclCuMemEnable();
+}
+
+// Negative bootstrap tags, one per connection and side owning the SIMPLE buffer
+#define P2P_SIMPLE_TAG(channelId, connIndex, send) (-0x10000 - (((channelId)*NCCL_MAX_CONNS + (connIndex))*2 + (send)))
 
-static ncclResult_t p2pGetInfo(struct ncclTopoSystem* topo, struct ncclPeerInfo* info1, struct ncclPeerInfo* info2, int* read, int* intermediateRank) {
+// info1 is the sender when send is set, the receiver otherwise
+static ncclResult_t p2pGetInfo(struct ncclTopoSystem* topo, struct ncclPeerInfo* info1, struct ncclPeerInfo* info2, bool send, int* read, int* intermediateRank) {
   int p2p;
   // Queries the topology to see if the GPUs are Ampere and
   // connected via NVLink, if so we enable P2P Read by default
   NCCLCHECK(ncclTopoCheckP2p(topo, info1->busId, info2->busId, &p2p, read, intermediateRank));
+  // Link calibration, from the same measurements on both sides
+  int64_t sendId = send ? info1->busId : info2->busId;
+  int64_t recvId = send ? info2->busId : info1->busId;
+  NCCLCHECK(ncclTopoCalibP2pRead(topo, sendId, recvId, read));
 
   int readEnable = ncclParamP2pReadEnable();
   if (readEnable != -2) *read = readEnable;
@@ -330,13 +536,43 @@ static ncclResult_t p2pMap(struct ncclComm *comm, struct ncclPeerInfo* myInfo, s
       *ipcPtr = NULL;
     } else {
       // Different PID or different GPU
-      NCCLCHECK(ncclP2pImportShareableBuffer(comm, comm->topParentRanks[peerInfo->rank], p2pBuff->size, &p2pBuff->ipcDesc, devMem));
-      *ipcPtr = *devMem;
+      NCCLCHECK(p2pPoolImport(comm, comm->topParentRanks[peerInfo->rank], p2pBuff, ipcPtr));
+      *devMem = (char*)*ipcPtr + p2pBuff->offset;
     }
   }
   return ncclSuccess;
 }
 
+// Has the proxy allocate the buffers of a connection, or allocates them without proxyConn, and maps them.
+// A coarse-grained SIMPLE buffer is sent to peer under simpleTag.
+static ncclResult_t p2pSetupBuffs(struct ncclComm* comm, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo, int simpleTag,
+    struct ncclProxyConnector* proxyConn, struct p2pSetupReq* req, struct p2pConnectInfo* info, struct p2pResources* resources, void** devMem, void** ipcPtr) {
+  struct ncclP2pBuff buffs[2];
+  if (proxyConn == NULL) {
+    NCCLCHECK(p2pAllocBuffs(req, buffs, &resources->localBuffs));
+  } else {
+    NCCLCHECK(ncclProxyCallBlocking(comm, proxyConn, ncclProxyMsgSetup, req, sizeof(*req), buffs, sizeof(buffs)));
+  }
+  info->p2pBuff = buffs[0];
+  info->simplePeer = myInfo->rank;
+  info->simpleTag = 0;
+  NCCLCHECK(p2pMap(comm, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, devMem, ipcPtr));
+  if (buffs[1].size) {
+    NCCLCHECK(p2pMap(comm, myInfo, comm->peerInfo+info->rank, buffs+1, (void**)&resources->simpleDevMem, &resources->simpleMemIpc));
+    info->simpleTag = simpleTag;
+    NCCLCHECK(bootstrapSend(comm->bootstrap, peerInfo->rank, simpleTag, buffs+1, sizeof(buffs[1])));
+  }
+  return ncclSuccess;
+}
+
+// Receives the coarse-grained SIMPLE buffer of the peer and maps it, see p2pSetupBuffs
+static ncclResult_t p2pMapRemoteSimple(struct ncclComm* comm, struct p2pConnectInfo* info, struct p2pResources* resources, char** buff) {
+  struct ncclP2pBuff simpleBuff;
+  NCCLCHECK(bootstrapRecv(comm->bootstrap, info->simplePeer, info->simpleTag, &simpleBuff, sizeof(simpleBuff)));
+  NCCLCHECK(p2pMap(comm, comm->peerInfo+comm->rank, comm->peerInfo+info->rank, &simpleBuff, (void**)buff, &resources->remSimpleMemIpc));
+  return ncclSuccess;
+}
+
 /* Send: Create and return connect structures for this peer to connect to me */
 ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, struct ncclPeerInfo* myInfo, struct ncclPeerInfo* peerInfo,
     struct ncclConnect* connectInfo, struct ncclConnector* send, int channelId, int connIndex) {
@@ -344,8 +580,9 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
   int tpProxyRank;
   NCCLCHECK(ncclCalloc(&resources, 1));
   send->transportResources = resources;
+  resources->protoMask = ncclConnProtoMask(comm, connIndex);
   int useRead, intermediateRank;
-  NCCLCHECK(p2pGetInfo(comm->topo, myInfo, peerInfo, &useRead, &intermediateRank));
+  NCCLCHECK(p2pGetInfo(comm->topo, myInfo, peerInfo, true, &useRead, &intermediateRank));
   if (useMemcpy) useRead = 0;
 
   resources->next_hdp_reg = 0;
@@ -362,14 +599,18 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
   static_assert(sizeof(struct p2pConnectInfo) <= sizeof(struct ncclConnect), "p2p Connect Info is too big");
   struct p2pConnectInfo* info = (struct p2pConnectInfo*)connectInfo;
   info->read = useRead;
+  info->simpleTag = 0;
   // For CollNet, use write for scatter-reduce (conn 1), read for broadcast-gather (conn 0)
   if (graph && connIndex == 1) info->read = 0;
   const char* useReadStr = info->read ? "/read" : "";
 
-  int sendSize = sizeof(struct ncclSendMem);
+  struct p2pSetupReq req = { (int)sizeof(struct ncclSendMem), 0 };
   // For P2P Read the SIMPLE buffer is tagged on the end of the ncclSendMem structure
-  if (info->read) sendSize += comm->buffSizes[NCCL_PROTO_SIMPLE];
-  ALIGN_SIZE(sendSize, CUDA_IPC_MIN);
+  if (info->read) {
+    if (p2pCoarseSimple()) req.simpleSize = comm->buffSizes[NCCL_PROTO_SIMPLE];
+    else req.size += comm->buffSizes[NCCL_PROTO_SIMPLE];
+  }
+  ALIGN_SIZE(req.size, CUDA_IPC_MIN);
 
   if (intermediateRank == -1) {
     info->rank = myInfo->rank;
@@ -400,6 +641,10 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
 	  comm->peerInfo[intermediateRank].busId, useReadStr, comm, comm->nRanks);
   }
 
+  if (intermediateRank == -1 && !useMemcpy && !ncclCuMemEnable() && rcclParamP2pLocalSetup()) {
+    NCCLCHECK(p2pSetupBuffs(comm, myInfo, peerInfo, P2P_SIMPLE_TAG(channelId, connIndex, 1), NULL, &req, info, resources, (void**)&resources->sendDevMem, &resources->sendMemIpc));
+    return ncclSuccess;
+  }
   tpProxyRank = comm->topParentRanks[info->rank];
   NCCLCHECK(ncclProxyConnect(comm, TRANSPORT_P2P, 1, tpProxyRank, &send->proxyConn));
   if (useMemcpy) {
@@ -407,8 +652,7 @@ ncclResult_t p2pSendSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
     info->shmSize = resources->proxyInfo.shmSize;
     memcpy(info->shmName, resources->proxyInfo.shmName, sizeof(info->shmName));
   } else {
-    NCCLCHECK(ncclProxyCallBlocking(comm, &send->proxyConn, ncclProxyMsgSetup, &sendSize, sizeof(int), &info->p2pBuff, sizeof(struct ncclP2pBuff)));
-    NCCLCHECK(p2pMap(comm, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&resources->sendDevMem, &resources->sendMemIpc));
+    NCCLCHECK(p2pSetupBuffs(comm, myInfo, peerInfo, P2P_SIMPLE_TAG(channelId, connIndex, 1), &send->proxyConn, &req, info, resources, (void**)&resources->sendDevMem, &resources->sendMemIpc));
   }
 
   return ncclSuccess;
@@ -421,19 +665,25 @@ ncclResult_t p2pRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
   int tpProxyRank;
   NCCLCHECK(ncclCalloc(&resources, 1));
   recv->transportResources = resources;
+  resources->protoMask = ncclConnProtoMask(comm, connIndex);
   int useRead, intermediateRank;
-  NCCLCHECK(p2pGetInfo(comm->topo, myInfo, peerInfo, &useRead, &intermediateRank));
+  NCCLCHECK(p2pGetInfo(comm->topo, myInfo, peerInfo, false, &useRead, &intermediateRank));
 
   static_assert(sizeof(struct p2pConnectInfo) <= sizeof(struct ncclConnect), "p2p Connect Info is too big");
   struct p2pConnectInfo* info = (struct p2pConnectInfo*)connectInfo;
   info->read = useRead;
+  info->simpleTag = 0;
   // For CollNet, use write for scatter-reduce (conn 1), read for broadcast-gather (conn 0)
   if (graph && connIndex == 1) info->read = 0;
 
-  int recvSize = sizeof(struct ncclRecvMem);
+  struct p2pSetupReq req = { (int)sizeof(struct ncclRecvMem), 0 };
   // For P2P Read the SIMPLE buffer is tagged on the end of the ncclSendMem structure
-  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) if (!(info->read && p == NCCL_PROTO_SIMPLE)) recvSize += comm->buffSizes[p];
-  ALIGN_SIZE(recvSize, CUDA_IPC_MIN);
+  for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    if (info->read && p == NCCL_PROTO_SIMPLE) continue;
+    if (p == NCCL_PROTO_SIMPLE && p2pCoarseSimple()) req.simpleSize += ncclConnBuffSize(comm, resources->protoMask, p);
+    else req.size += ncclConnBuffSize(comm, resources->protoMask, p);
+  }
+  ALIGN_SIZE(req.size, CUDA_IPC_MIN);
 
   if (intermediateRank == -1) {
     info->rank = myInfo->rank;
@@ -457,11 +707,13 @@ ncclResult_t p2pRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* graph, st
     info->rank = intermediateRank;
   }
 
+  if (intermediateRank == -1 && !ncclCuMemEnable() && rcclParamP2pLocalSetup()) {
+    NCCLCHECK(p2pSetupBuffs(comm, myInfo, peerInfo, P2P_SIMPLE_TAG(channelId, connIndex, 0), NULL, &req, info, resources, (void**)&resources->recvDevMem, &resources->recvMemIpc));
+    return ncclSuccess;
+  }
   tpProxyRank = comm->topParentRanks[info->rank];
   NCCLCHECK(ncclProxyConnect(comm, TRANSPORT_P2P, 0, tpProxyRank, &recv->proxyConn));
-  NCCLCHECK(ncclProxyCallBlocking(comm, &recv->proxyConn, ncclProxyMsgSetup, &recvSize, sizeof(int), &info->p2pBuff, sizeof(struct ncclP2pBuff)));
-
-  NCCLCHECK(p2pMap(comm, myInfo, comm->peerInfo+info->rank, &info->p2pBuff, (void**)&resources->recvDevMem, &resources->recvMemIpc));
+  NCCLCHECK(p2pSetupBuffs(comm, myInfo, peerInfo, P2P_SIMPLE_TAG(channelId, connIndex, 0), &recv->proxyConn, &req, info, resources, (void**)&resources->recvDevMem, &resources->recvMemIpc));
   return ncclSuccess;
 }
 
@@ -478,8 +730,12 @@ static ncclResult_t p2pSendConnect(struct ncclComm* comm, struct ncclConnect* co
     if (info->read && p == NCCL_PROTO_SIMPLE) {
       /* For P2P Read the SIMPLE buffer is local (ncclSendMem) */
       if (resources->sendDevMem == NULL) return ncclInternalError; // We should not use read + memcpy
-      send->conn.buffs[p] = (char*)(resources->sendDevMem+1);
-    } else {
+      send->conn.buffs[p] = resources->simpleDevMem ? resources->simpleDevMem : (char*)(resources->sendDevMem+1);
+      if (resources->simpleDevMem) send->conn.flags |= NCCL_COARSE_SIMPLE;
+    } else if (p == NCCL_PROTO_SIMPLE && info->simpleTag) {
+      NCCLCHECK(p2pMapRemoteSimple(comm, info, resources, &send->conn.buffs[p]));
+      send->conn.flags |= NCCL_COARSE_SIMPLE;
+    } else if (resources->protoMask & (1<<p)) {
       send->conn.buffs[p] = buff;
       buff += comm->buffSizes[p];
     }
@@ -533,8 +789,16 @@ ncclResult_t p2pRecvConnect(struct ncclComm* comm, struct ncclConnect* connectIn
     if (info->read && p == NCCL_PROTO_SIMPLE) {
       if (remDevMem == NULL) return ncclInternalError; // We should not use read + memcpy
       /* For P2P Read the SIMPLE buffer is remote (ncclSendMem) */
-      recv->conn.buffs[p] = (char*)(remDevMem+1);
-    } else {
+      if (info->simpleTag) {
+        NCCLCHECK(p2pMapRemoteSimple(comm, info, resources, &recv->conn.buffs[p]));
+        recv->conn.flags |= NCCL_COARSE_SIMPLE;
+      } else {
+        recv->conn.buffs[p] = (char*)(remDevMem+1);
+      }
+    } else if (p == NCCL_PROTO_SIMPLE && resources->simpleDevMem) {
+      recv->conn.buffs[p] = resources->simpleDevMem;
+      recv->conn.flags |= NCCL_COARSE_SIMPLE;
+    } else if (resources->protoMask & (1<<p)) {
       recv->conn.buffs[p] = buff;
       buff += comm->buffSizes[p];
     }
@@ -551,8 +815,11 @@ ncclResult_t p2pSendFree(struct ncclConnector* send) {
       if (resources->recvMemIpc) NCCLCHECK(ncclCudaFree(resources->recvMemIpc));
     }
     else {
-      if (resources->sendMemIpc) CUDACHECK(cudaIpcCloseMemHandle(resources->sendMemIpc));
-      if (resources->recvMemIpc) CUDACHECK(cudaIpcCloseMemHandle(resources->recvMemIpc));
+      if (resources->sendMemIpc) NCCLCHECK(p2pPoolClose(resources->sendMemIpc));
+      if (resources->recvMemIpc) NCCLCHECK(p2pPoolClose(resources->recvMemIpc));
+      if (resources->simpleMemIpc) NCCLCHECK(p2pPoolClose(resources->simpleMemIpc));
+      if (resources->remSimpleMemIpc) NCCLCHECK(p2pPoolClose(resources->remSimpleMemIpc));
+      p2pFreeBuffs(&resources->localBuffs);
     }
     free(resources);
   }
@@ -568,17 +835,42 @@ ncclResult_t p2pRecvFree(struct ncclConnector* recv) {
       if (resources->recvMemIpc) NCCLCHECK(ncclCudaFree(resources->recvMemIpc));
     }
     else {
-      if (resources->sendMemIpc) CUDACHECK(cudaIpcCloseMemHandle(resources->sendMemIpc));
-      if (resources->recvMemIpc) CUDACHECK(cudaIpcCloseMemHandle(resources->recvMemIpc));
+      if (resources->sendMemIpc) NCCLCHECK(p2pPoolClose(resources->sendMemIpc));
+      if (resources->recvMemIpc) NCCLCHECK(p2pPoolClose(resources->recvMemIpc));
+      if (resources->simpleMemIpc) NCCLCHECK(p2pPoolClose(resources->simpleMemIpc));
+      if (resources->remSimpleMemIpc) NCCLCHECK(p2pPoolClose(resources->remSimpleMemIpc));
       if (useMemcpy) {
         NCCLCHECK(ncclShmClose(resources->handle));
       }
+      p2pFreeBuffs(&resources->localBuffs);
     }
     free(resources);
   }
   return ncclSuccess;
 }
 
+static ncclResult_t p2pProxySetupBuffs(struct ncclProxyConnection* connection, void* reqBuff, int reqSize, void* respBuff, int respSize) {
+  if (reqSize != sizeof(struct p2pSetupReq)) return ncclInternalError;
+  struct p2pSetupReq* req = (struct p2pSetupReq*)reqBuff;
+  if (respSize != 2*sizeof(struct ncclP2pBuff)) return ncclInternalError;
+  struct ncclP2pBuff* p2pBuff = (struct ncclP2pBuff*)respBuff;
+  if (ncclCuMemEnable()) {
+    // cuMem API support
+    memset(p2pBuff+1, 0, sizeof(struct ncclP2pBuff));
+    NCCLCHECK(p2pPoolAlloc(req->size, true, p2pBuff));
+    struct p2pCuMemProxyInfo* proxyInfo;
+    NCCLCHECK(ncclCalloc(&proxyInfo, 1));
+    memcpy(&proxyInfo->p2pBuff, p2pBuff, sizeof(*p2pBuff));
+    connection->transportResources = proxyInfo;
+  } else {
+    struct p2pProxyBuffs* buffs;
+    NCCLCHECK(ncclCalloc(&buffs, 1));
+    connection->transportResources = buffs;
+    NCCLCHECK(p2pAllocBuffs(req, p2pBuff, buffs));
+  }
+  return ncclSuccess;
+}
+
 static ncclResult_t p2pSendProxySetup(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
   if (useMemcpy) {
     // CE memcpy support
@@ -601,43 +893,35 @@ static ncclResult_t p2pSendProxySetup(struct ncclProxyConnection* connection, st
     if (respSize != sizeof(struct p2pShmProxyInfo)) return ncclInternalError;
     memcpy(respBuff, proxyInfo, sizeof(struct p2pShmProxyInfo));
   } else {
-    if (reqSize != sizeof(int)) return ncclInternalError;
-    int size = *((int*)reqBuff);
-    if (respSize != sizeof(struct ncclP2pBuff)) return ncclInternalError;
-    struct ncclP2pBuff* p2pBuff = (struct ncclP2pBuff*)respBuff;
-    NCCLCHECK(ncclP2pAllocateShareableBuffer(size, &p2pBuff->ipcDesc, &p2pBuff->directPtr));
-    p2pBuff->size = size;
-    if (ncclCuMemEnable()) {
-      // cuMem API support
-      struct p2pCuMemProxyInfo* proxyInfo;
-      NCCLCHECK(ncclCalloc(&proxyInfo, 1));
-      memcpy(&proxyInfo->p2pBuff, p2pBuff, sizeof(*p2pBuff));
-      connection->transportResources = proxyInfo;
-    } else {
-      connection->transportResources = p2pBuff->directPtr;
-    }
+    NCCLCHECK(p2pProxySetupBuffs(connection, reqBuff, reqSize, respBuff, respSize));
   }
   *done = 1;
   return ncclSuccess;
 }
 
 static ncclResult_t p2pRecvProxySetup(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState, void* reqBuff, int reqSize, void* respBuff, int respSize, int* done) {
-  if (reqSize != sizeof(int)) return ncclInternalError;
-  int size = *((int*)reqBuff);
-  if (respSize != sizeof(struct ncclP2pBuff)) return ncclInternalError;
-  struct ncclP2pBuff* p2pBuff = (struct ncclP2pBuff*)respBuff;
-  NCCLCHECK(ncclP2pAllocateShareableBuffer(size, &p2pBuff->ipcDesc, &p2pBuff->directPtr));
-  p2pBuff->size = size;
+  NCCLCHECK(p2pProxySetupBuffs(connection, reqBuff, reqSize, respBuff, respSize));
+  *done = 1;
+  return ncclSuccess;
+}
+
+static ncclResult_t p2pProxyFreeBuffs(struct ncclProxyConnection* connection) {
   if (ncclCuMemEnable()) {
     // cuMem API support
-    struct p2pCuMemProxyInfo* proxyInfo;
-    NCCLCHECK(ncclCalloc(&proxyInfo, 1));
-    memcpy(&proxyInfo->p2pBuff, p2pBuff, sizeof(*p2pBuff));
-    connection->transportResources = proxyInfo;
+    struct p2pCuMemProxyInfo *proxyInfo = (struct p2pCuMemProxyInfo *) connection->transportResources;
+    if (proxyInfo) {
+      struct ncclP2pBuff *p2pBuff = &proxyInfo->p2pBuff;
+      ncclP2pFreeShareableBuffer(&p2pBuff->ipcDesc);
+      ncclCudaFree(p2pBuff->directPtr);
+      free(proxyInfo);
+    }
   } else {
-    connection->transportResources = p2pBuff->directPtr;
+    struct p2pProxyBuffs* buffs = (struct p2pProxyBuffs*)connection->transportResources;
+    if (buffs) {
+      p2pFreeBuffs(buffs);
+      free(buffs);
+    }
   }
-  *done = 1;
   return ncclSuccess;
 }
 
@@ -647,7 +931,10 @@ static ncclResult_t p2pSendProxyConnect(struct ncclProxyConnection* connection,
   if (reqSize != sizeof(void*)) return ncclInternalError;
   proxyInfo->recvFifo = *((char**)reqBuff);
 
-  CUDACHECK(cudaStreamCreateWithFlags(&proxyInfo->stream, cudaStreamNonBlocking));
+  proxyInfo->nStreams = std::min(std::max((int)rcclParamP2pCeStreams(), 1), P2P_CE_MAX_STREAMS);
+  for (int i=0; i<proxyInfo->nStreams; i++) {
+    CUDACHECK(cudaStreamCreateWithFlags(proxyInfo->streams+i, cudaStreamNonBlocking));
+  }
   for (int i=0; i<NCCL_STEPS; i++) {
     CUDACHECK(cudaEventCreate(proxyInfo->events+i));
   }
@@ -663,44 +950,22 @@ static ncclResult_t p2pSendProxyFree(struct ncclProxyConnection* connection, str
       NCCLCHECK(ncclShmClose(proxyInfo->handle));
       NCCLCHECK(ncclCudaHostFree(proxyInfo->ceRecvMem));
       NCCLCHECK(ncclCudaFree(proxyInfo->ceDevBuff));
-      CUDACHECK(cudaStreamDestroy(proxyInfo->stream));
+      for (int i=0; i<proxyInfo->nStreams; i++) {
+        CUDACHECK(cudaStreamDestroy(proxyInfo->streams[i]));
+      }
       for (int i=0; i<NCCL_STEPS; i++) {
         CUDACHECK(cudaEventDestroy(proxyInfo->events[i]));
       }
       free(proxyInfo);
     }
   } else {
-    if (ncclCuMemEnable()) {
-      // cuMem API support
-      struct p2pCuMemProxyInfo *proxyInfo = (struct p2pCuMemProxyInfo *) connection->transportResources;
-      if (proxyInfo) {
-        struct ncclP2pBuff *p2pBuff = &proxyInfo->p2pBuff;
-        ncclP2pFreeShareableBuffer(&p2pBuff->ipcDesc);
-        ncclCudaFree(p2pBuff->directPtr);
-        free(proxyInfo);
-      }
-    } else {
-      // Do not check return code as CUDA may have already shut down
-      ncclCudaFree(connection->transportResources);
-    }
+    NCCLCHECK(p2pProxyFreeBuffs(connection));
   }
   return ncclSuccess;
 }
 
 static ncclResult_t p2pRecvProxyFree(struct ncclProxyConnection* connection, struct ncclProxyState* proxyState) {
-  if (ncclCuMemEnable()) {
-    struct p2pCuMemProxyInfo *proxyInfo = (struct p2pCuMemProxyInfo *) connection->transportResources;
-    if (proxyInfo) {
-      struct ncclP2pBuff *p2pBuff = &proxyInfo->p2pBuff;
-      ncclP2pFreeShareableBuffer(&p2pBuff->ipcDesc);
-      ncclCudaFree(p2pBuff->directPtr);
-      free(proxyInfo);
-    }
-  } else {
-    // Do not check return code as CUDA may have already shut down
-    ncclCudaFree(connection->transportResources);
-  }
-  return ncclSuccess;
+  return p2pProxyFreeBuffs(connection);
 }
 
 // CE memcpy support
@@ -731,12 +996,28 @@ static ncclResult_t p2pSendProxyProgress(struct ncclProxyState* proxyState, stru
         int buffSlot = (sub->base+sub->transmitted)%NCCL_STEPS;
         volatile int* sizesFifo = resources->ceRecvMem->sizesFifo;
         volatile uint64_t* recvTail = &resources->ceRecvMem->tail;
-        // Check GPU has sent everything
-        if ((*recvTail > sub->base+sub->transmitted)) {
-          int size = sizesFifo[buffSlot];
-          CUDACHECK(cudaMemcpyAsync(resources->recvFifo+buffSlot*stepSize, resources->ceDevBuff+buffSlot*stepSize, size, cudaMemcpyDeviceToDevice, resources->stream));
-          CUDACHECK(cudaEventRecord(resources->events[buffSlot], resources->stream));
-          sub->transmitted += args->sliceSteps;
+        // Gather all slices the GPU has sent into one copy, up to the end of the FIFO
+        uint64_t transmitted = sub->transmitted;
+        int lastSlot = -1, size = 0;
+        do {
+          int slot = (sub->base+transmitted)%NCCL_STEPS;
+          if (*recvTail <= sub->base+transmitted || slot < lastSlot) break;
+          size = (slot-buffSlot)*stepSize + sizesFifo[slot];
+          lastSlot = slot;
+          transmitted += args->sliceSteps;
+        } while (rcclParamP2pCeBatch() && transmitted < sub->done + NCCL_STEPS && transmitted < sub->nsteps);
+        if (lastSlot != -1) {
+          cudaStream_t stream = resources->streams[resources->nextStream];
+          resources->nextStream = (resources->nextStream+1) % resources->nStreams;
+          CUDACHECK(cudaMemcpyAsync(resources->recvFifo+buffSlot*stepSize, resources->ceDevBuff+buffSlot*stepSize, size, cudaMemcpyDeviceToDevice, stream));
+          // The copy queue publishes the tail itself, after the previous batch did on any other stream
+          if (resources->nStreams > 1 && resources->lastEvent) CUDACHECK(cudaStreamWaitEvent(stream, resources->lastEvent, 0));
+          CUDACHECK(hipStreamWriteValue64(stream, &resources->devShm->recvMem.tail, sub->base + transmitted, 0));
+          for (uint64_t t=sub->transmitted; t<transmitted; t+=args->sliceSteps) {
+            CUDACHECK(cudaEventRecord(resources->events[(sub->base+t)%NCCL_STEPS], stream));
+          }
+          resources->lastEvent = resources->events[lastSlot];
+          sub->transmitted = transmitted;
         }
       }
       if (sub->done < sub->transmitted) {
@@ -744,9 +1025,8 @@ static ncclResult_t p2pSendProxyProgress(struct ncclProxyState* proxyState, stru
         cudaError_t res = cudaEventQuery(resources->events[buffSlot]);
         if (res != cudaErrorNotReady) CUDACHECK(res);
         if (res == cudaSuccess) {
+          // SHM tail was already updated by the copy stream
           sub->done += args->sliceSteps;
-          // Notify SHM
-          resources->shm->recvMem.tail = sub->base + sub->done;
         }
         if (sub->done == sub->nsteps) {
           resources->step = sub->base + sub->nsteps;
@@ -22,6 +22,7 @@ struct shmSendResources {
   struct ncclSendMem* hostMem;
   struct ncclSendMem* devHostMem;
   ncclShmHandle_t hostHandle;
+  uint32_t protoMask; // Protocols with a buffer in the connection
 };
 
 struct shmRecvResources {
@@ -33,6 +34,7 @@ struct shmRecvResources {
   struct ncclRecvMem* hostMem;
   struct ncclRecvMem* devHostMem;
   ncclShmHandle_t hostHandle;
+  uint32_t protoMask; // Protocols with a buffer in the connection
 };
 
 #define SHM_SEND_SIDE 1
@@ -44,6 +46,8 @@ static int useMemcpySend = 0;
 static int useMemcpyRecv = 0;
 NCCL_PARAM(ShmLocality, "SHM_LOCALITY", SHM_RECV_SIDE); // 1 is sender-size, 2 is receiver-size
 static int shmLocality = 0;
+RCCL_PARAM(ShmNumaBind, "SHM_NUMA_BIND", 1); // Place SHM segments on the NUMA node of the GPU polling / reading them
+RCCL_PARAM(ShmHugePages, "SHM_HUGEPAGES", 0); // Back SHM segments with transparent huge pages
 static void initCeOperation();
 
 /* Determine two peers can communicate with SHM */
@@ -77,6 +81,7 @@ static ncclResult_t shmSendSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   struct shmSendResources* resources;
   NCCLCHECK(ncclCalloc(&resources, 1));
   send->transportResources = resources;
+  resources->protoMask = ncclConnProtoMask(comm, connIndex);
 
   static_assert(sizeof(struct shmConnectInfo) <= sizeof(struct ncclConnect), "shm Connect Info is too big");
   struct shmConnectInfo* info = (struct shmConnectInfo*)connectInfo;
@@ -85,10 +90,13 @@ static ncclResult_t shmSendSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   shmPath[0] = '\0';
   int shmSize = sizeof(struct ncclSendMem);
   if (shmLocality == SHM_SEND_SIDE) {
-    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) shmSize += comm->buffSizes[p];
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) shmSize += ncclConnBuffSize(comm, resources->protoMask, p);
   }
   info->shmSize = resources->shmSize = shmSize;
-  NCCLCHECK(ncclShmOpen(shmPath, resources->shmSize, (void**)&resources->hostMem, (void**)&resources->devHostMem, 1, &resources->hostHandle));
+  // With sender-side locality the buffers are read by the receiving GPU, otherwise only the head polled by ours
+  int numaId = -1;
+  if (rcclParamShmNumaBind()) NCCLCHECK(ncclTopoGetLocalNuma(comm->topo, shmLocality == SHM_SEND_SIDE ? peerInfo->rank : myInfo->rank, &numaId));
+  NCCLCHECK(ncclShmOpenNuma(shmPath, resources->shmSize, (void**)&resources->hostMem, (void**)&resources->devHostMem, 1, numaId, rcclParamShmHugePages(), &resources->hostHandle));
   TRACE(NCCL_SHM,"Opened shmName %s shmSize %d", shmPath, info->shmSize);
   memcpy(info->shmName, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof(info->shmName));
 
@@ -100,6 +108,7 @@ static ncclResult_t shmRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   struct shmRecvResources* resources;
   NCCLCHECK(ncclCalloc(&resources, 1));
   recv->transportResources = resources;
+  resources->protoMask = ncclConnProtoMask(comm, connIndex);
 
   static_assert(sizeof(struct shmConnectInfo) <= sizeof(struct ncclConnect), "shm Connect Info is too big");
   struct shmConnectInfo* info = (struct shmConnectInfo*)connectInfo;
@@ -108,10 +117,13 @@ static ncclResult_t shmRecvSetup(struct ncclComm* comm, struct ncclTopoGraph* gr
   shmPath[0] = '\0';
   int shmSize = sizeof(struct ncclRecvMem);
   if (shmLocality == SHM_RECV_SIDE) {
-    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) shmSize += comm->buffSizes[p];
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) shmSize += ncclConnBuffSize(comm, resources->protoMask, p);
   }
   info->shmSize = resources->shmSize = shmSize;
-  NCCLCHECK(ncclShmOpen(shmPath, resources->shmSize, (void**)&resources->hostMem, (void**)&resources->devHostMem, 1, &resources->hostHandle));
+  // Buffers (receiver-side locality) and the tail are both consumed by our GPU
+  int numaId = -1;
+  if (rcclParamShmNumaBind()) NCCLCHECK(ncclTopoGetLocalNuma(comm->topo, myInfo->rank, &numaId));
+  NCCLCHECK(ncclShmOpenNuma(shmPath, resources->shmSize, (void**)&resources->hostMem, (void**)&resources->devHostMem, 1, numaId, rcclParamShmHugePages(), &resources->hostHandle));
   TRACE(NCCL_SHM,"Opened shmName %s shmSize %d", shmPath, info->shmSize);
   memcpy(info->shmName, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof(info->shmName));
 
@@ -145,6 +157,7 @@ static ncclResult_t shmSendConnect(struct ncclComm* comm, struct ncclConnect* co
 
   char* buff = shmLocality == SHM_SEND_SIDE ? (char*)(resources->devHostMem+1) : (char*)(resources->devRemHostMem+1);
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    if (!(resources->protoMask & (1<<p))) continue;
     send->conn.buffs[p] = buff;
     buff += comm->buffSizes[p];
   }
@@ -180,6 +193,7 @@ static ncclResult_t shmRecvConnect(struct ncclComm* comm, struct ncclConnect* co
 
   char* buff = shmLocality == SHM_RECV_SIDE ? (char*)(resources->devHostMem+1) : (char*)(resources->devRemHostMem+1);
   for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    if (!(resources->protoMask & (1<<p))) continue;
     recv->conn.buffs[p] = buff;
     buff += comm->buffSizes[p];
   }
@@ -0,0 +1,42 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+#include "TestBed.hpp"
+
+namespace RcclUnitTesting
+{
+  // Performance regression tests only run when requested [UT_PERF=1]
+  // Results are compared against <UT_PERF_BASELINE_DIR>/<platform>.json, which is
+  // (re)recorded by running with UT_PERF_UPDATE=1
+  static void RunPerfTest(bool const isMultiProcess)
+  {
+    EnvVars ev;
+    if (!ev.perfMode)
+      GTEST_SKIP() << "Performance tests require UT_PERF=1";
+    if (std::find(ev.GetIsMultiProcessList().begin(), ev.GetIsMultiProcessList().end(),
+                  isMultiProcess ? 1 : 0) == ev.GetIsMultiProcessList().end())
+      GTEST_SKIP() << "Disabled by UT_PROCESS_MASK";
+
+    TestBed testBed;
+
+    // Configuration
+    std::vector<ncclFunc_t> const funcTypes    = {ncclCollAllReduce, ncclCollAllGather, ncclCollReduceScatter,
+                                                  ncclCollBroadcast, ncclCollAllToAll};
+    std::vector<size_t>     const numBytesList = {1024, 65536, 1048576, 16777216, 134217728};
+
+    testBed.RunPerfSweep(funcTypes, ncclFloat32, numBytesList, isMultiProcess);
+    testBed.Finalize();
+  }
+
+  TEST(Perf, SingleProcess)
+  {
+    RunPerfTest(false);
+  }
+
+  TEST(Perf, MultiProcess)
+  {
+    RunPerfTest(true);
+  }
+}
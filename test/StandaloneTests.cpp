@@ -6,6 +6,8 @@
 
 #include <gtest/gtest.h>
 #include <rccl/rccl.h>
+#include <algorithm>
+#include <thread>
 
 #include "StandaloneUtils.hpp"
 
@@ -140,4 +142,1360 @@ namespace RcclUnitTesting {
     for (auto& comm : comms)
       NCCLCHECK(ncclCommDestroy(comm));
   }
+
+  TEST(Standalone, CommShrinkGrow)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 3) {
+      GTEST_SKIP() << "This test requires at least 3 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Drop the last rank, which does not take part
+    int const excluded = numDevices - 1;
+    int const numSurvivors = numDevices - 1;
+    std::vector<ncclComm_t> shrunkComms(numSurvivors);
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numSurvivors; r++)
+      NCCLCHECK(ncclCommShrink(comms[r], &excluded, 1, &shrunkComms[r], NULL));
+    NCCLCHECK(ncclGroupEnd());
+
+    for (int r = 0; r < numSurvivors; r++) {
+      int rank, nRanks;
+      NCCLCHECK(ncclCommUserRank(shrunkComms[r], &rank));
+      NCCLCHECK(ncclCommCount(shrunkComms[r], &nRanks));
+      ASSERT_EQ(rank, r);
+      ASSERT_EQ(nRanks, numSurvivors);
+    }
+
+    // The shrunk communicator must be usable
+    size_t const count = 1024;
+    std::vector<hipStream_t> streams(numSurvivors);
+    std::vector<int*> bufs(numSurvivors);
+    for (int r = 0; r < numSurvivors; r++) {
+      std::vector<int> input(count, r + 1);
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&bufs[r], count * sizeof(int)));
+      HIPCALL(hipMemcpy(bufs[r], input.data(), count * sizeof(int), hipMemcpyHostToDevice));
+    }
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numSurvivors; r++)
+      NCCLCHECK(ncclAllReduce(bufs[r], bufs[r], count, ncclInt32, ncclSum, shrunkComms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+    for (int r = 0; r < numSurvivors; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<int> output(count);
+      HIPCALL(hipMemcpy(output.data(), bufs[r], count * sizeof(int), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(output[i], numSurvivors * (numSurvivors + 1) / 2);
+      HIPCALL(hipFree(bufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+
+    // Grow back, the excluded device joins with the last rank
+    ncclUniqueId id;
+    NCCLCHECK(ncclGetUniqueId(&id));
+    std::vector<ncclComm_t> grownComms(numDevices);
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      NCCLCHECK(ncclCommGrow(r < numSurvivors ? shrunkComms[r] : NULL, numDevices, id, r, &grownComms[r], NULL));
+    }
+    NCCLCHECK(ncclGroupEnd());
+
+    for (int r = 0; r < numDevices; r++) {
+      int rank, nRanks;
+      NCCLCHECK(ncclCommUserRank(grownComms[r], &rank));
+      NCCLCHECK(ncclCommCount(grownComms[r], &nRanks));
+      ASSERT_EQ(rank, r);
+      ASSERT_EQ(nRanks, numDevices);
+    }
+
+    for (auto& comm : grownComms)
+      NCCLCHECK(ncclCommDestroy(comm));
+    for (auto& comm : shrunkComms)
+      NCCLCHECK(ncclCommDestroy(comm));
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, AllToAllvDevice)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Rank r sends (1 + r + peer) * chunk elements to peer, packed densely
+    size_t const chunk = 64;
+    size_t const maxCount = (2 * numDevices - 1) * chunk;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<int*> sendBufs(numDevices), recvBufs(numDevices);
+    std::vector<size_t*> devArgs(numDevices);
+    std::vector<std::vector<size_t>> hostArgs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      // sendcounts, sdispls, recvcounts, rdispls
+      std::vector<size_t>& args = hostArgs[r];
+      args.resize(4 * numDevices);
+      size_t totalSend = 0, totalRecv = 0;
+      for (int peer = 0; peer < numDevices; peer++) {
+        args[peer] = (1 + r + peer) * chunk;
+        args[numDevices + peer] = totalSend;
+        args[2 * numDevices + peer] = (1 + r + peer) * chunk;
+        args[3 * numDevices + peer] = totalRecv;
+        totalSend += args[peer];
+        totalRecv += args[2 * numDevices + peer];
+      }
+      std::vector<int> input(totalSend);
+      for (int peer = 0; peer < numDevices; peer++)
+        for (size_t i = 0; i < args[peer]; i++)
+          input[args[numDevices + peer] + i] = r * 1000000 + peer * 10000 + i;
+
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendBufs[r], totalSend * sizeof(int)));
+      HIPCALL(hipMalloc(&recvBufs[r], totalRecv * sizeof(int)));
+      HIPCALL(hipMalloc(&devArgs[r], args.size() * sizeof(size_t)));
+      HIPCALL(hipMemcpy(sendBufs[r], input.data(), totalSend * sizeof(int), hipMemcpyHostToDevice));
+      HIPCALL(hipMemcpy(devArgs[r], args.data(), args.size() * sizeof(size_t), hipMemcpyHostToDevice));
+    }
+
+    // Calls are not grouped, so each rank needs its own thread
+    std::vector<std::thread> threads;
+    for (int r = 0; r < numDevices; r++) {
+      threads.emplace_back([&, r]() {
+        HIPCALL(hipSetDevice(r));
+        NCCLCHECK(ncclAllToAllvDevice(sendBufs[r], devArgs[r], devArgs[r] + numDevices,
+                                      recvBufs[r], devArgs[r] + 2 * numDevices, devArgs[r] + 3 * numDevices,
+                                      maxCount, ncclInt32, comms[r], streams[r]));
+        HIPCALL(hipStreamSynchronize(streams[r]));
+      });
+    }
+    for (auto& t : threads) t.join();
+
+    // Validate results
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<size_t>& args = hostArgs[r];
+      size_t totalRecv = args[4 * numDevices - 1] + args[3 * numDevices - 1];
+      std::vector<int> output(totalRecv);
+      HIPCALL(hipMemcpy(output.data(), recvBufs[r], totalRecv * sizeof(int), hipMemcpyDeviceToHost));
+      for (int peer = 0; peer < numDevices; peer++)
+        for (size_t i = 0; i < args[2 * numDevices + peer]; i++)
+          ASSERT_EQ(output[args[3 * numDevices + peer] + i], (int)(peer * 1000000 + r * 10000 + i));
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(sendBufs[r]));
+      HIPCALL(hipFree(recvBufs[r]));
+      HIPCALL(hipFree(devArgs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, AllGatherV)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Rank r contributes (1 + r) * chunk elements, packed densely
+    size_t const chunk = 1000;
+    std::vector<size_t> counts(numDevices), displs(numDevices);
+    size_t total = 0;
+    for (int r = 0; r < numDevices; r++) {
+      counts[r] = (1 + r) * chunk;
+      displs[r] = total;
+      total += counts[r];
+    }
+
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<int*> sendBufs(numDevices), recvBufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<int> input(counts[r]);
+      for (size_t i = 0; i < counts[r]; i++) input[i] = r * 1000000 + i;
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendBufs[r], counts[r] * sizeof(int)));
+      HIPCALL(hipMalloc(&recvBufs[r], total * sizeof(int)));
+      HIPCALL(hipMemcpy(sendBufs[r], input.data(), counts[r] * sizeof(int), hipMemcpyHostToDevice));
+    }
+
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclAllGatherV(sendBufs[r], counts[r], recvBufs[r], counts.data(), displs.data(),
+                               ncclInt32, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+
+    // Validate results
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<int> output(total);
+      HIPCALL(hipMemcpy(output.data(), recvBufs[r], total * sizeof(int), hipMemcpyDeviceToHost));
+      for (int peer = 0; peer < numDevices; peer++)
+        for (size_t i = 0; i < counts[peer]; i++)
+          ASSERT_EQ(output[displs[peer] + i], (int)(peer * 1000000 + i));
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(sendBufs[r]));
+      HIPCALL(hipFree(recvBufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, AllGatherReadyFlags)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    size_t const count = 1 << 20;
+    int const numCalls = 3;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<int*> sendBufs(numDevices), recvBufs(numDevices);
+    std::vector<uint64_t*> flags(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<int> input(count, r);
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendBufs[r], count * sizeof(int)));
+      HIPCALL(hipMalloc(&recvBufs[r], numDevices * count * sizeof(int)));
+      HIPCALL(hipMalloc(&flags[r], numDevices * sizeof(uint64_t)));
+      HIPCALL(hipMemset(flags[r], 0, numDevices * sizeof(uint64_t)));
+      HIPCALL(hipMemcpy(sendBufs[r], input.data(), count * sizeof(int), hipMemcpyHostToDevice));
+      NCCLCHECK(ncclCommSetReadyFlags(comms[r], flags[r]));
+    }
+
+    for (int call = 0; call < numCalls; call++) {
+      NCCLCHECK(ncclGroupStart());
+      for (int r = 0; r < numDevices; r++)
+        NCCLCHECK(ncclAllGather(sendBufs[r], recvBufs[r], count, ncclInt32, comms[r], streams[r]));
+      NCCLCHECK(ncclGroupEnd());
+    }
+
+    // Every call adds the size of the block of each rank to its counter
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<uint64_t> counters(numDevices);
+      HIPCALL(hipMemcpy(counters.data(), flags[r], numDevices * sizeof(uint64_t), hipMemcpyDeviceToHost));
+      for (int peer = 0; peer < numDevices; peer++)
+        ASSERT_EQ(counters[peer], numCalls * count * sizeof(int));
+      std::vector<int> output(numDevices * count);
+      HIPCALL(hipMemcpy(output.data(), recvBufs[r], numDevices * count * sizeof(int), hipMemcpyDeviceToHost));
+      for (int peer = 0; peer < numDevices; peer++)
+        ASSERT_EQ(output[peer * count + count - 1], peer);
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      NCCLCHECK(ncclCommSetReadyFlags(comms[r], nullptr));
+      HIPCALL(hipFree(sendBufs[r]));
+      HIPCALL(hipFree(recvBufs[r]));
+      HIPCALL(hipFree(flags[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, GraphUpdateBuffers)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    size_t const count = 1 << 20;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<hipGraph_t> graphs(numDevices);
+    std::vector<hipGraphExec_t> graphExecs(numDevices);
+    std::vector<int*> oldBufs(numDevices), newBufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&oldBufs[r], count * sizeof(int)));
+      HIPCALL(hipMalloc(&newBufs[r], count * sizeof(int)));
+    }
+
+    // Capture an in-place allreduce of the old buffers
+    for (int r = 0; r < numDevices; r++)
+      HIPCALL(hipStreamBeginCapture(streams[r], hipStreamCaptureModeRelaxed));
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclAllReduce(oldBufs[r], oldBufs[r], count, ncclInt32, ncclSum, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamEndCapture(streams[r], &graphs[r]));
+      HIPCALL(hipGraphInstantiate(&graphExecs[r], graphs[r], nullptr, nullptr, 0));
+    }
+
+    // Move it to the new buffers and replay
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<int> input(count, r + 1);
+      int nUpdated;
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipMemset(oldBufs[r], 0, count * sizeof(int)));
+      HIPCALL(hipMemcpy(newBufs[r], input.data(), count * sizeof(int), hipMemcpyHostToDevice));
+      NCCLCHECK(ncclCommGraphUpdateBuffers(comms[r], oldBufs[r], newBufs[r], count * sizeof(int), &nUpdated));
+      ASSERT_GT(nUpdated, 0);
+    }
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipGraphLaunch(graphExecs[r], streams[r]));
+    }
+
+    int const expected = numDevices * (numDevices + 1) / 2;
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<int> output(count), old(count);
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      HIPCALL(hipMemcpy(output.data(), newBufs[r], count * sizeof(int), hipMemcpyDeviceToHost));
+      HIPCALL(hipMemcpy(old.data(), oldBufs[r], count * sizeof(int), hipMemcpyDeviceToHost));
+      ASSERT_EQ(output[0], expected);
+      ASSERT_EQ(output[count - 1], expected);
+      ASSERT_EQ(old[count - 1], 0);
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipGraphExecDestroy(graphExecs[r]));
+      HIPCALL(hipGraphDestroy(graphs[r]));
+      HIPCALL(hipFree(oldBufs[r]));
+      HIPCALL(hipFree(newBufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, ReduceScatterV)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Rank r owns a shard of (1 + r) * chunk elements, packed densely
+    size_t const chunk = 1000;
+    std::vector<size_t> counts(numDevices), displs(numDevices);
+    size_t total = 0;
+    for (int r = 0; r < numDevices; r++) {
+      counts[r] = (1 + r) * chunk;
+      displs[r] = total;
+      total += counts[r];
+    }
+
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<int*> sendBufs(numDevices), recvBufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<int> input(total);
+      for (size_t i = 0; i < total; i++) input[i] = r * 1000 + i;
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendBufs[r], total * sizeof(int)));
+      HIPCALL(hipMalloc(&recvBufs[r], counts[r] * sizeof(int)));
+      HIPCALL(hipMemcpy(sendBufs[r], input.data(), total * sizeof(int), hipMemcpyHostToDevice));
+    }
+
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclReduceScatterV(sendBufs[r], counts.data(), displs.data(), recvBufs[r], counts[r],
+                                   ncclInt32, ncclSum, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+
+    // Validate results: sum over ranks of (rank * 1000 + offset)
+    int const rankSum = 1000 * numDevices * (numDevices - 1) / 2;
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<int> output(counts[r]);
+      HIPCALL(hipMemcpy(output.data(), recvBufs[r], counts[r] * sizeof(int), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < counts[r]; i++)
+        ASSERT_EQ(output[i], (int)(rankSum + numDevices * (displs[r] + i)));
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(sendBufs[r]));
+      HIPCALL(hipFree(recvBufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, SparseAllReduce)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // A few pairs per rank are gathered, half of the output per rank is reduced densely.
+    // Rank r sets (1 + r) at the distinct indices (7 * r + i) % count.
+    size_t const cases[2][2] = {{1 << 20, 100}, {4096, 2048}};
+    for (auto const& c : cases) {
+      size_t const count = c[0];
+      std::vector<hipStream_t> streams(numDevices);
+      std::vector<int64_t*> indexBufs(numDevices);
+      std::vector<int*> valueBufs(numDevices), recvBufs(numDevices);
+      std::vector<int> expected(count, 0);
+      for (int r = 0; r < numDevices; r++) {
+        size_t const nnz = c[1] + r;
+        std::vector<int64_t> indices(nnz);
+        std::vector<int> values(nnz, 1 + r);
+        for (size_t i = 0; i < nnz; i++) {
+          indices[i] = (7 * r + i) % count;
+          expected[indices[i]] += 1 + r;
+        }
+        HIPCALL(hipSetDevice(r));
+        HIPCALL(hipStreamCreate(&streams[r]));
+        HIPCALL(hipMalloc(&indexBufs[r], nnz * sizeof(int64_t)));
+        HIPCALL(hipMalloc(&valueBufs[r], nnz * sizeof(int)));
+        HIPCALL(hipMalloc(&recvBufs[r], count * sizeof(int)));
+        HIPCALL(hipMemcpy(indexBufs[r], indices.data(), nnz * sizeof(int64_t), hipMemcpyHostToDevice));
+        HIPCALL(hipMemcpy(valueBufs[r], values.data(), nnz * sizeof(int), hipMemcpyHostToDevice));
+      }
+
+      // Calls are not grouped, so each rank needs its own thread
+      std::vector<std::thread> threads;
+      for (int r = 0; r < numDevices; r++) {
+        threads.emplace_back([&, r]() {
+          HIPCALL(hipSetDevice(r));
+          NCCLCHECK(ncclSparseAllReduce(indexBufs[r], valueBufs[r], c[1] + r, recvBufs[r], count,
+                                        ncclInt32, comms[r], streams[r]));
+          HIPCALL(hipStreamSynchronize(streams[r]));
+        });
+      }
+      for (auto& t : threads) t.join();
+
+      // Validate results
+      for (int r = 0; r < numDevices; r++) {
+        std::vector<int> output(count);
+        HIPCALL(hipMemcpy(output.data(), recvBufs[r], count * sizeof(int), hipMemcpyDeviceToHost));
+        for (size_t i = 0; i < count; i++)
+          ASSERT_EQ(output[i], expected[i]);
+      }
+
+      for (int r = 0; r < numDevices; r++) {
+        HIPCALL(hipFree(indexBufs[r]));
+        HIPCALL(hipFree(valueBufs[r]));
+        HIPCALL(hipFree(recvBufs[r]));
+        HIPCALL(hipStreamDestroy(streams[r]));
+      }
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, Barrier)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<int*> bufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&bufs[r], sizeof(int)));
+    }
+
+    // Each iteration writes a value, then reads the value of the next rank: the first barrier
+    // orders the read after the write of the peer, the second the next write after the read
+    int const numIterations = 100;
+    std::vector<int> errors(numDevices, 0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < numDevices; r++) {
+      threads.emplace_back([&, r]() {
+        HIPCALL(hipSetDevice(r));
+        int const peer = (r + 1) % numDevices;
+        int* peerValue;
+        HIPCALL(hipHostMalloc(&peerValue, sizeof(int)));
+        for (int i = 0; i < numIterations; i++) {
+          int const value = i * numDevices + r;
+          HIPCALL(hipMemcpyAsync(bufs[r], &value, sizeof(int), hipMemcpyHostToDevice, streams[r]));
+          NCCLCHECK(ncclBarrier(comms[r], streams[r]));
+          HIPCALL(hipMemcpyAsync(peerValue, bufs[peer], sizeof(int), hipMemcpyDeviceToHost, streams[r]));
+          NCCLCHECK(ncclBarrier(comms[r], streams[r]));
+          HIPCALL(hipStreamSynchronize(streams[r]));
+          if (*peerValue != i * numDevices + peer) errors[r]++;
+        }
+        HIPCALL(hipHostFree(peerValue));
+      });
+    }
+    for (auto& t : threads) t.join();
+
+    for (int r = 0; r < numDevices; r++) {
+      EXPECT_EQ(errors[r], 0) << "Rank " << r << " read stale values of its peer";
+      HIPCALL(hipFree(bufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, AllReducePartial)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    size_t const count = 4096;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<float*> sendBufs(numDevices), recvBufs(numDevices);
+    std::vector<uint32_t*> masks(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendBufs[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&recvBufs[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&masks[r], sizeof(uint32_t)));
+      std::vector<float> values(count, (float)(r + 1));
+      HIPCALL(hipMemcpy(sendBufs[r], values.data(), count * sizeof(float), hipMemcpyHostToDevice));
+    }
+    if (ncclAllReducePartial(sendBufs[0], recvBufs[0], count, ncclFloat32, ncclSum, 0, masks[0], comms[0], streams[0]) == ncclInvalidUsage) {
+      for (auto& comm : comms) NCCLCHECK(ncclCommDestroy(comm));
+      GTEST_SKIP() << "This test requires P2P between all devices.";
+    }
+    // Integer sums are not supported
+    ASSERT_EQ(ncclAllReducePartial(sendBufs[0], recvBufs[0], count, ncclInt32, ncclSum, 0, masks[0], comms[0], streams[0]), ncclInvalidArgument);
+
+    // Rank 0 already ran one call with no timeout: the others are one call behind it, which it
+    // runs ahead of them up to. With a generous timeout every later call sums all the ranks.
+    int const numIterations = 20;
+    std::vector<int> errors(numDevices, 0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < numDevices; r++) {
+      threads.emplace_back([&, r]() {
+        HIPCALL(hipSetDevice(r));
+        std::vector<float> result(count);
+        uint32_t mask;
+        for (int i = (r == 0); i < numIterations; i++) {
+          NCCLCHECK(ncclAllReducePartial(sendBufs[r], recvBufs[r], count, ncclFloat32, ncclSum, 10000000, masks[r], comms[r], streams[r]));
+          HIPCALL(hipStreamSynchronize(streams[r]));
+          if (i == 0) continue;
+          HIPCALL(hipMemcpy(&mask, masks[r], sizeof(mask), hipMemcpyDeviceToHost));
+          HIPCALL(hipMemcpy(result.data(), recvBufs[r], count * sizeof(float), hipMemcpyDeviceToHost));
+          float expected = 0;
+          for (int p = 0; p < numDevices; p++) if (!(mask & (1u << p))) expected += p + 1;
+          if (mask != 0) errors[r]++;
+          for (size_t j = 0; j < count; j++) if (result[j] != expected) { errors[r]++; break; }
+        }
+      });
+    }
+    for (auto& t : threads) t.join();
+
+    for (int r = 0; r < numDevices; r++) {
+      EXPECT_EQ(errors[r], 0) << "Rank " << r << " got a wrong sum or missed a rank";
+      HIPCALL(hipFree(sendBufs[r]));
+      HIPCALL(hipFree(recvBufs[r]));
+      HIPCALL(hipFree(masks[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, AllReduceEpilogue)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Integer types have no epilogue
+    ncclRedOp_t op;
+    ncclRedOpEpilogue_t const epilogue = {0.5f, 4.0f};
+    ASSERT_EQ(ncclRedOpCreateSumEpilogue(&op, &epilogue, ncclInt32, comms[0]), ncclInvalidArgument);
+
+    size_t const count = 1 << 16;
+    std::vector<ncclRedOp_t> ops(numDevices);
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<float*> bufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      // Inputs cover both sides of the clip once summed and scaled
+      std::vector<float> input(count);
+      for (size_t i = 0; i < count; i++)
+        input[i] = (float)((int)(i % 32) - 16 + r);
+
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&bufs[r], count * sizeof(float)));
+      HIPCALL(hipMemcpy(bufs[r], input.data(), count * sizeof(float), hipMemcpyHostToDevice));
+      NCCLCHECK(ncclRedOpCreateSumEpilogue(&ops[r], &epilogue, ncclFloat32, comms[r]));
+    }
+
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclAllReduce(bufs[r], bufs[r], count, ncclFloat32, ops[r], comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+
+    // Validate results
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<float> output(count);
+      HIPCALL(hipMemcpy(output.data(), bufs[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++) {
+        float sum = 0;
+        for (int peer = 0; peer < numDevices; peer++)
+          sum += (float)((int)(i % 32) - 16 + peer);
+        float const expected = std::min(std::max(sum * epilogue.scale, -epilogue.clip), epilogue.clip);
+        ASSERT_EQ(output[i], expected);
+      }
+      NCCLCHECK(ncclRedOpDestroy(ops[r], comms[r]));
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(bufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, GroupSetMaxCTAs)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+    ASSERT_EQ(ncclGroupSetMaxCTAs(-1), ncclInvalidArgument);
+
+    size_t const count = 1 << 20;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<float*> bufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<float> input(count, (float)(r + 1));
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&bufs[r], count * sizeof(float)));
+      HIPCALL(hipMemcpy(bufs[r], input.data(), count * sizeof(float), hipMemcpyHostToDevice));
+    }
+
+    // Limited to 2 CTAs per collective
+    NCCLCHECK(ncclGroupSetMaxCTAs(2));
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclAllReduce(bufs[r], bufs[r], count, ncclFloat32, ncclSum, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+    NCCLCHECK(ncclGroupSetMaxCTAs(0));
+
+    // Validate results
+    float const expected = numDevices * (numDevices + 1) / 2.0f;
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<float> output(count);
+      HIPCALL(hipMemcpy(output.data(), bufs[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(output[i], expected);
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(bufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, GroupSubmit)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Each rank sends its buffer to the next one and sums it across ranks, in one call
+    size_t const count = 1 << 16;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<float*> sendBufs(numDevices), ringBufs(numDevices), sumBufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<float> input(count, (float)(r + 1));
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendBufs[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&ringBufs[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&sumBufs[r], count * sizeof(float)));
+      HIPCALL(hipMemcpy(sendBufs[r], input.data(), count * sizeof(float), hipMemcpyHostToDevice));
+    }
+
+    // An invalid descriptor fails the whole call
+    ncclOpDesc_t bad = {};
+    bad.type = ncclNumOpTypes;
+    bad.count = count;
+    bad.datatype = ncclFloat32;
+    bad.stream = streams[0];
+    ASSERT_EQ(ncclGroupSubmit(&bad, 1, comms[0]), ncclInvalidArgument);
+
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++) {
+      ncclOpDesc_t ops[3] = {};
+      ops[0].type = ncclOpSend;
+      ops[0].sendbuff = sendBufs[r];
+      ops[0].root = (r + 1) % numDevices;
+      ops[1].type = ncclOpRecv;
+      ops[1].recvbuff = ringBufs[r];
+      ops[1].root = (r + numDevices - 1) % numDevices;
+      ops[2].type = ncclOpAllReduce;
+      ops[2].sendbuff = sendBufs[r];
+      ops[2].recvbuff = sumBufs[r];
+      ops[2].op = ncclSum;
+      for (auto& op : ops) {
+        op.count = count;
+        op.datatype = ncclFloat32;
+        op.stream = streams[r];
+      }
+      NCCLCHECK(ncclGroupSubmit(ops, 3, comms[r]));
+    }
+    NCCLCHECK(ncclGroupEnd());
+
+    // Validate results
+    float const expected = numDevices * (numDevices + 1) / 2.0f;
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<float> output(count);
+      HIPCALL(hipMemcpy(output.data(), ringBufs[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(output[i], (float)((r + numDevices - 1) % numDevices + 1));
+      HIPCALL(hipMemcpy(output.data(), sumBufs[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(output[i], expected);
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(sendBufs[r]));
+      HIPCALL(hipFree(ringBufs[r]));
+      HIPCALL(hipFree(sumBufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, CommWarmup)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+    std::vector<hipStream_t> streams(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+    }
+
+    // An invalid hint fails the call before anything is enqueued
+    ncclOpDesc_t bad = {};
+    bad.type = ncclNumOpTypes;
+    ASSERT_EQ(ncclCommWarmup(&bad, 1, comms[0], streams[0]), ncclInvalidArgument);
+
+    // One thread drives all ranks, so the warmups go in one group
+    size_t const count = 1 << 20;
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++) {
+      ncclOpDesc_t hints[4] = {};
+      hints[0].type = ncclOpAllReduce;
+      hints[0].op = ncclSum;
+      hints[1].type = ncclOpAllGather;
+      hints[2].type = ncclOpSend;
+      hints[2].root = (r + 1) % numDevices;
+      hints[3].type = ncclOpRecv;
+      hints[3].root = (r + numDevices - 1) % numDevices;
+      for (auto& hint : hints) {
+        hint.count = count;
+        hint.datatype = ncclFloat32;
+      }
+      NCCLCHECK(ncclCommWarmup(hints, 4, comms[r], streams[r]));
+    }
+    NCCLCHECK(ncclGroupEnd());
+
+    // The communicators still compute correct results afterwards
+    std::vector<float*> bufs(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      std::vector<float> input(count, (float)(r + 1));
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      HIPCALL(hipMalloc(&bufs[r], count * sizeof(float)));
+      HIPCALL(hipMemcpy(bufs[r], input.data(), count * sizeof(float), hipMemcpyHostToDevice));
+    }
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclAllReduce(bufs[r], bufs[r], count, ncclFloat32, ncclSum, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+
+    float const expected = numDevices * (numDevices + 1) / 2.0f;
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<float> output(count);
+      HIPCALL(hipMemcpy(output.data(), bufs[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(output[i], expected);
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(bufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, OneRankAvg)
+  {
+    // ncclAvg over one rank is a copy, or nothing in place
+    ncclComm_t comm;
+    int const dev = 0;
+    NCCLCHECK(ncclCommInitAll(&comm, 1, &dev));
+
+    size_t const count = 1 << 16;
+    std::vector<float> input(count);
+    for (size_t i = 0; i < count; i++)
+      input[i] = (float)i - 0.5f;
+    hipStream_t stream;
+    float *sendBuf, *recvBuf;
+    HIPCALL(hipSetDevice(dev));
+    HIPCALL(hipStreamCreate(&stream));
+    HIPCALL(hipMalloc(&sendBuf, count * sizeof(float)));
+    HIPCALL(hipMalloc(&recvBuf, count * sizeof(float)));
+    HIPCALL(hipMemcpy(sendBuf, input.data(), count * sizeof(float), hipMemcpyHostToDevice));
+
+    NCCLCHECK(ncclAllReduce(sendBuf, recvBuf, count, ncclFloat32, ncclAvg, comm, stream));
+    NCCLCHECK(ncclAllReduce(sendBuf, sendBuf, count, ncclFloat32, ncclAvg, comm, stream));
+    HIPCALL(hipStreamSynchronize(stream));
+
+    std::vector<float> output(count);
+    for (float* buf : {sendBuf, recvBuf}) {
+      HIPCALL(hipMemcpy(output.data(), buf, count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(output[i], input[i]);
+    }
+
+    HIPCALL(hipFree(sendBuf));
+    HIPCALL(hipFree(recvBuf));
+    HIPCALL(hipStreamDestroy(stream));
+    NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, ReduceScatterUpdateAllGather)
+  {
+    // Check for multi-gpu
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    ncclUpdate_t update = {};
+    update.type = ncclUpdateSgd;
+    update.lr = 0.5f;
+    update.gradScale = 1.0f / numDevices;
+
+    size_t const recvcount = 1 << 16;
+    size_t const count = numDevices * recvcount;
+    std::vector<hipStream_t> streams(numDevices);
+    std::vector<float*> grads(numDevices), params(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      // Only the shard of each rank holds valid parameters on entry
+      std::vector<float> g(count), p(count, -1.0f);
+      for (size_t i = 0; i < count; i++) g[i] = (float)(r + i % 8);
+      for (size_t i = 0; i < recvcount; i++) p[r * recvcount + i] = (float)((r * recvcount + i) % 16);
+
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&grads[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&params[r], count * sizeof(float)));
+      HIPCALL(hipMemcpy(grads[r], g.data(), count * sizeof(float), hipMemcpyHostToDevice));
+      HIPCALL(hipMemcpy(params[r], p.data(), count * sizeof(float), hipMemcpyHostToDevice));
+    }
+
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclReduceScatterUpdateAllGather(grads[r], params[r], recvcount, ncclFloat32, &update, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+
+    // Validate results
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<float> output(count);
+      HIPCALL(hipMemcpy(output.data(), params[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      for (size_t i = 0; i < count; i++) {
+        float sum = 0;
+        for (int peer = 0; peer < numDevices; peer++) sum += (float)(peer + i % 8);
+        float const expected = (float)(i % 16) - update.lr * (sum * update.gradScale);
+        ASSERT_NEAR(output[i], expected, 1e-4f);
+      }
+    }
+
+    // Integer types have no optimizer step
+    ASSERT_EQ(ncclReduceScatterUpdateAllGather(grads[0], params[0], recvcount, ncclInt32, &update, comms[0], streams[0]),
+              ncclInvalidArgument);
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipFree(grads[r]));
+      HIPCALL(hipFree(params[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, ProxyLatencyQuery)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    double percentiles[2] = {0.5, 0.99};
+    double latencies[2];
+    uint64_t count = 1;
+    NCCLCHECK(ncclProxyLatencyQuery(comms[0], -1, ncclProxyMetricStep, 2, percentiles, latencies, &count));
+    if (getenv("RCCL_PROXY_HISTOGRAMS") == nullptr) ASSERT_EQ(count, 0);
+
+    ASSERT_EQ(ncclProxyLatencyQuery(comms[0], -1, ncclProxyMetricNum, 2, percentiles, latencies, &count), ncclInvalidArgument);
+    ASSERT_EQ(ncclProxyLatencyQuery(comms[0], numDevices, ncclProxyMetricStep, 2, percentiles, latencies, &count), ncclInvalidArgument);
+    double badPercentile = 1.5;
+    ASSERT_EQ(ncclProxyLatencyQuery(comms[0], 1, ncclProxyMetricNetWait, 1, &badPercentile, latencies, &count), ncclInvalidArgument);
+
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, ProxyTraceSnapshot)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Intra-node connections do not go through the network proxy, the rings may be empty
+    int available = -1;
+    NCCLCHECK(ncclProxyTraceSnapshot(comms[0], nullptr, 0, &available));
+    ASSERT_GE(available, 0);
+    std::vector<ncclProxyTraceRecord_t> records(16);
+    int nRecords = -1;
+    NCCLCHECK(ncclProxyTraceSnapshot(comms[0], records.data(), records.size(), &nRecords));
+    ASSERT_GE(nRecords, 0);
+    ASSERT_LE(nRecords, 16);
+    for (int i = 1; i < nRecords; i++) ASSERT_LE(records[i-1].timestampNs, records[i].timestampNs);
+
+    ASSERT_EQ(ncclProxyTraceSnapshot(comms[0], nullptr, 4, &nRecords), ncclInvalidArgument);
+    ASSERT_EQ(ncclProxyTraceSnapshot(comms[0], records.data(), -1, &nRecords), ncclInvalidArgument);
+    ASSERT_EQ(ncclProxyTraceSnapshot(comms[0], records.data(), 4, nullptr), ncclInvalidArgument);
+
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, CommGetInitProfile)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    double total[2] = {0, 0};
+    for (int r = 0; r < 2; r++) {
+      for (int p = 0; p < ncclInitPhaseNum; p++) {
+        double localMs, minMs, avgMs, maxMs;
+        NCCLCHECK(ncclCommGetInitProfile(comms[r], (ncclInitPhase_t)p, &localMs, &minMs, &avgMs, &maxMs));
+        ASSERT_GE(localMs, 0);
+        if (getenv("RCCL_INIT_PROFILE") == nullptr) {
+          ASSERT_LE(minMs, localMs);
+          ASSERT_GE(maxMs, localMs);
+          ASSERT_GE(avgMs, 0);
+        }
+        total[r] += localMs;
+      }
+      ASSERT_GT(total[r], 0);
+    }
+    NCCLCHECK(ncclCommGetInitProfile(comms[0], ncclInitPhaseBootstrap, nullptr, nullptr, nullptr, nullptr));
+    ASSERT_EQ(ncclCommGetInitProfile(comms[0], ncclInitPhaseNum, nullptr, nullptr, nullptr, nullptr), ncclInvalidArgument);
+
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, CommGetInitPhase)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    ncclUniqueId id;
+    NCCLCHECK(ncclGetUniqueId(&id));
+    std::vector<ncclComm_t> comms(numDevices);
+    ncclConfig_t config = NCCL_CONFIG_INITIALIZER;
+    config.blocking = 0;
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      ncclResult_t res = ncclCommInitRankConfig(&comms[r], numDevices, id, r, &config);
+      ASSERT_TRUE(res == ncclSuccess || res == ncclInProgress);
+    }
+    ncclResult_t res = ncclGroupEnd();
+    ASSERT_TRUE(res == ncclSuccess || res == ncclInProgress);
+
+    // Phases only move forward while polling, and end at ncclInitPhaseNum
+    std::vector<int> lastPhase(numDevices, ncclInitPhaseBootstrap);
+    for (int r = 0; r < numDevices; r++) {
+      ncclResult_t state;
+      do {
+        ncclInitPhase_t phase;
+        NCCLCHECK(ncclCommGetInitPhase(comms[r], &phase));
+        ASSERT_GE(phase, lastPhase[r]);
+        lastPhase[r] = phase;
+        NCCLCHECK(ncclCommGetAsyncError(comms[r], &state));
+      } while (state == ncclInProgress);
+      ASSERT_EQ(state, ncclSuccess);
+      ncclInitPhase_t phase;
+      NCCLCHECK(ncclCommGetInitPhase(comms[r], &phase));
+      ASSERT_EQ(phase, ncclInitPhaseNum);
+    }
+    ASSERT_EQ(ncclCommGetInitPhase(comms[0], nullptr), ncclInvalidArgument);
+
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, CommRegister)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    const size_t count = 1 << 20;
+    std::vector<float*> sendbuff(numDevices), recvbuff(numDevices);
+    std::vector<void*> sendHandle(numDevices), recvHandle(numDevices);
+    std::vector<hipStream_t> streams(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendbuff[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&recvbuff[r], count * sizeof(float)));
+      std::vector<float> host(count, float(r + 1));
+      HIPCALL(hipMemcpy(sendbuff[r], host.data(), count * sizeof(float), hipMemcpyHostToDevice));
+      NCCLCHECK(ncclCommRegister(comms[r], sendbuff[r], count * sizeof(float), &sendHandle[r]));
+      NCCLCHECK(ncclCommRegister(comms[r], recvbuff[r], count * sizeof(float), &recvHandle[r]));
+    }
+    void* handle;
+    ASSERT_EQ(ncclCommRegister(comms[0], sendbuff[0], 0, &handle), ncclInvalidArgument);
+
+    // Collectives on registered buffers behave as usual
+    for (int iter = 0; iter < 2; iter++) {
+      NCCLCHECK(ncclGroupStart());
+      for (int r = 0; r < numDevices; r++)
+        NCCLCHECK(ncclAllReduce(sendbuff[r], recvbuff[r], count, ncclFloat, ncclSum, comms[r], streams[r]));
+      NCCLCHECK(ncclGroupEnd());
+    }
+    const float expected = numDevices * (numDevices + 1) / 2.0f;
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+      std::vector<float> host(count);
+      HIPCALL(hipMemcpy(host.data(), recvbuff[r], count * sizeof(float), hipMemcpyDeviceToHost));
+      ASSERT_EQ(host[0], expected);
+      ASSERT_EQ(host[count - 1], expected);
+    }
+
+    for (int r = 0; r < numDevices; r++) {
+      NCCLCHECK(ncclCommDeregister(comms[r], sendHandle[r]));
+      NCCLCHECK(ncclCommDeregister(comms[r], recvHandle[r]));
+    }
+    ASSERT_EQ(ncclCommDeregister(comms[0], sendHandle[0]), ncclInvalidArgument);
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipFree(sendbuff[r]));
+      HIPCALL(hipFree(recvbuff[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, CommGetStats)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    const size_t count = 1 << 20;
+    const int iters = 3;
+    std::vector<float*> bufs(numDevices);
+    std::vector<hipStream_t> streams(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&bufs[r], count * sizeof(float)));
+    }
+    for (int iter = 0; iter < iters; iter++) {
+      NCCLCHECK(ncclGroupStart());
+      for (int r = 0; r < numDevices; r++)
+        NCCLCHECK(ncclAllReduce(bufs[r], bufs[r], count, ncclFloat, ncclSum, comms[r], streams[r]));
+      NCCLCHECK(ncclGroupEnd());
+    }
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamSynchronize(streams[r]));
+    }
+
+    ncclCommStats_t stats;
+    stats.version = NCCL_COMM_STATS_VERSION;
+    NCCLCHECK(ncclCommGetStats(comms[0], &stats));
+    const ncclCollStats_t& ar = stats.colls[ncclStatsAllReduce];
+    ASSERT_EQ(ar.calls, iters);
+    ASSERT_EQ(ar.bytes, iters * count * sizeof(float));
+    uint64_t histogram = 0;
+    for (int a = 0; a < NCCL_STATS_MAX_ALGORITHMS; a++)
+      for (int p = 0; p < NCCL_STATS_MAX_PROTOCOLS; p++) histogram += ar.algoProto[a][p];
+    ASSERT_EQ(histogram, iters);
+    if (getenv("RCCL_COMM_STATS_TIME") == nullptr) ASSERT_GT(ar.deviceTimeUs, 0);
+    ASSERT_EQ(stats.colls[ncclStatsAllGather].calls, 0);
+    ASSERT_EQ(stats.persistentPlans, 0);
+    ASSERT_EQ(stats.persistentWorkBytes, 0);
+    ASSERT_GT(stats.arenaSlabs, 0);
+    ASSERT_GT(stats.arenaUsedBytes, 0);
+    ASSERT_LE(stats.arenaUsedBytes, stats.arenaSlabBytes);
+    ASSERT_GE(stats.planPoolHits + stats.planPoolMisses, (uint64_t)iters);
+    ASSERT_GE(stats.workListPoolHits + stats.workListPoolMisses, (uint64_t)iters);
+
+    stats.version = 0;
+    ASSERT_EQ(ncclCommGetStats(comms[0], &stats), ncclInvalidArgument);
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipFree(bufs[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, CommGetMemUsage)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    std::vector<ncclComm_t> comms(numDevices);
+    NCCLCHECK(ncclCommInitAll(comms.data(), numDevices, nullptr));
+
+    // Split communicators with a budget far below the default buffers
+    std::vector<ncclComm_t> capped(numDevices);
+    ncclConfig_t config = NCCL_CONFIG_INITIALIZER;
+    config.memoryCapMB = 16;
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclCommSplit(comms[r], 0, r, &capped[r], &config));
+    NCCLCHECK(ncclGroupEnd());
+
+    ncclMemUsage_t usage, cappedUsage;
+    NCCLCHECK(ncclCommGetMemUsage(comms[0], &usage));
+    NCCLCHECK(ncclCommGetMemUsage(capped[0], &cappedUsage));
+    ASSERT_GT(usage.device[ncclMemTagChannels], 0);
+    ASSERT_GT(usage.device[ncclMemTagBuffers], 0);
+    ASSERT_GT(usage.host[ncclMemTagOther], 0);
+    ASSERT_GT(cappedUsage.device[ncclMemTagBuffers], 0);
+    ASSERT_LE(cappedUsage.device[ncclMemTagBuffers], usage.device[ncclMemTagBuffers]);
+
+    ASSERT_EQ(ncclCommGetMemUsage(comms[0], nullptr), ncclInvalidArgument);
+
+    for (auto& comm : capped)
+      NCCLCHECK(ncclCommDestroy(comm));
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
+
+  TEST(Standalone, SplitShareP2pConnections)
+  {
+    int numDevices;
+    HIPCALL(hipGetDeviceCount(&numDevices));
+    if (numDevices < 2) {
+      GTEST_SKIP() << "This test requires at least 2 devices.";
+    }
+
+    ncclUniqueId id;
+    NCCLCHECK(ncclGetUniqueId(&id));
+    std::vector<ncclComm_t> comms(numDevices);
+    ncclConfig_t config = NCCL_CONFIG_INITIALIZER;
+    config.splitShare = 1;
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      NCCLCHECK(ncclCommInitRankConfig(&comms[r], numDevices, id, r, &config));
+    }
+    NCCLCHECK(ncclGroupEnd());
+
+    const size_t count = 1 << 16;
+    std::vector<float*> sendbuff(numDevices), recvbuff(numDevices);
+    std::vector<hipStream_t> streams(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipStreamCreate(&streams[r]));
+      HIPCALL(hipMalloc(&sendbuff[r], count * sizeof(float)));
+      HIPCALL(hipMalloc(&recvbuff[r], 2 * count * sizeof(float)));
+    }
+    // Exchange with both neighbors, so that each GPU pair of the ring is connected both ways
+    auto exchange = [&](std::vector<ncclComm_t>& c, std::vector<int> const& rankOf) {
+      NCCLCHECK(ncclGroupStart());
+      for (int r = 0; r < numDevices; r++) {
+        int rank = rankOf[r];
+        int next = (rank + 1) % numDevices;
+        int prev = (rank + numDevices - 1) % numDevices;
+        NCCLCHECK(ncclSend(sendbuff[r], count, ncclFloat, next, c[r], streams[r]));
+        NCCLCHECK(ncclSend(sendbuff[r], count, ncclFloat, prev, c[r], streams[r]));
+        NCCLCHECK(ncclRecv(recvbuff[r], count, ncclFloat, prev, c[r], streams[r]));
+        NCCLCHECK(ncclRecv(recvbuff[r] + count, count, ncclFloat, next, c[r], streams[r]));
+      }
+      NCCLCHECK(ncclGroupEnd());
+      for (int r = 0; r < numDevices; r++) {
+        HIPCALL(hipSetDevice(r));
+        HIPCALL(hipStreamSynchronize(streams[r]));
+      }
+    };
+    std::vector<int> rankOf(numDevices), reversed(numDevices);
+    for (int r = 0; r < numDevices; r++) {
+      rankOf[r] = r;
+      reversed[r] = numDevices - 1 - r;
+    }
+    exchange(comms, rankOf);
+
+    // The child numbers the GPUs the other way around, its p2p operations still run between the
+    // GPU pairs connected above and must not allocate buffers of their own
+    std::vector<ncclComm_t> children(numDevices);
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < numDevices; r++)
+      NCCLCHECK(ncclCommSplit(comms[r], 0, reversed[r], &children[r], NULL));
+    NCCLCHECK(ncclGroupEnd());
+
+    ncclMemUsage_t before, after;
+    NCCLCHECK(ncclCommGetMemUsage(children[0], &before));
+    exchange(children, reversed);
+    NCCLCHECK(ncclCommGetMemUsage(children[0], &after));
+    ASSERT_EQ(after.device[ncclMemTagBuffers], before.device[ncclMemTagBuffers]);
+    ASSERT_EQ(after.hostPinned[ncclMemTagBuffers], before.hostPinned[ncclMemTagBuffers]);
+
+    for (int r = 0; r < numDevices; r++) {
+      HIPCALL(hipSetDevice(r));
+      HIPCALL(hipFree(sendbuff[r]));
+      HIPCALL(hipFree(recvbuff[r]));
+      HIPCALL(hipStreamDestroy(streams[r]));
+    }
+    for (auto& comm : children)
+      NCCLCHECK(ncclCommDestroy(comm));
+    for (auto& comm : comms)
+      NCCLCHECK(ncclCommDestroy(comm));
+  }
 }
\ No newline at end of file
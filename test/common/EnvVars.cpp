@@ -63,6 +63,13 @@ namespace RcclUnitTesting
     maxRanksPerGpu = GetEnvVar("UT_MAX_RANKS_PER_GPU", 1);
     showTiming     = GetEnvVar("UT_SHOW_TIMING",  1);
     useInteractive = GetEnvVar("UT_INTERACTIVE",  0);
+    perfMode       = GetEnvVar("UT_PERF",         0);
+    perfUpdate     = GetEnvVar("UT_PERF_UPDATE",  0);
+    perfIterations = GetEnvVar("UT_PERF_ITERATIONS", 20);
+    perfWarmups    = GetEnvVar("UT_PERF_WARMUPS",  5);
+    perfBwTol      = GetEnvVar("UT_PERF_BW_TOLERANCE",  10);
+    perfLatTol     = GetEnvVar("UT_PERF_LAT_TOLERANCE", 25);
+    perfBaselineDir = getenv("UT_PERF_BASELINE_DIR") ? getenv("UT_PERF_BASELINE_DIR") : "perf_baselines";
 
     // Limit number of supported reduction operators to just ncclSum if only allReduce is built
 #ifdef BUILD_ALLREDUCE_ONLY
@@ -195,7 +202,14 @@ namespace RcclUnitTesting
         std::make_tuple("UT_MAX_RANKS_PER_GPU", maxRanksPerGpu, "Maximum number of ranks using the same GPU"),
         std::make_tuple("UT_PRINT_VALUES"     , printValues   , "Print array values (-1 for all)"),
         std::make_tuple("UT_SHOW_TIMING"      , showTiming    , "Show timing table"),
-        std::make_tuple("UT_INTERACTIVE"      , useInteractive, "Run in interactive mode")
+        std::make_tuple("UT_INTERACTIVE"      , useInteractive, "Run in interactive mode"),
+        std::make_tuple("UT_PERF"             , perfMode      , "Run performance regression tests"),
+        std::make_tuple("UT_PERF_UPDATE"      , perfUpdate    , "Record perf baselines instead of comparing"),
+        std::make_tuple("UT_PERF_ITERATIONS"  , perfIterations, "Timed iterations per perf test case"),
+        std::make_tuple("UT_PERF_WARMUPS"     , perfWarmups   , "Warmup iterations per perf test case"),
+        std::make_tuple("UT_PERF_BW_TOLERANCE", perfBwTol     , "Allowed busBw drop vs baseline (%)"),
+        std::make_tuple("UT_PERF_LAT_TOLERANCE", perfLatTol   , "Allowed latency rise vs baseline (%)"),
+        std::make_tuple("UT_PERF_BASELINE_DIR", -1            , "Directory holding perf baseline files")
       };
 
     printf("================================================================================\n");
@@ -6,6 +6,7 @@
 
 #pragma once
 #include <hsa/hsa.h>
+#include <string>
 #include <vector>
 #include "rccl/rccl.h"
 
@@ -28,6 +29,13 @@ namespace RcclUnitTesting
     int  maxRanksPerGpu; // Number of ranks using the same GPU     [UT_MAX_RANKS_PER_GPU]
     bool showTiming;     // Show timing per case at end            [UT_SHOW_TIMING]
     bool useInteractive; // Run in interactive mode                [UT_INTERACTIVE]
+    bool perfMode;       // Run performance regression tests       [UT_PERF]
+    bool perfUpdate;     // Record baselines instead of comparing  [UT_PERF_UPDATE]
+    int  perfIterations; // Timed iterations per perf test case    [UT_PERF_ITERATIONS]
+    int  perfWarmups;    // Warmup iterations per perf test case   [UT_PERF_WARMUPS]
+    int  perfBwTol;      // Allowed busBw drop in percent          [UT_PERF_BW_TOLERANCE]
+    int  perfLatTol;     // Allowed latency rise in percent        [UT_PERF_LAT_TOLERANCE]
+    std::string perfBaselineDir; // Directory of baseline files   [UT_PERF_BASELINE_DIR]
 
     // Constructor that parses and collects environment variables
     EnvVars();
@@ -0,0 +1,172 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "PerfBaseline.hpp"
+#include "ErrCode.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace RcclUnitTesting
+{
+  PerfBaseline::PerfBaseline(double const latencyTolerance, double const busBwTolerance) :
+    latencyTolerance(latencyTolerance), busBwTolerance(busBwTolerance)
+  {
+  }
+
+  // Returns the value of a numeric field of a flat JSON object, or defaultValue if absent
+  static double GetJsonNumber(std::string const& json, std::string const& field, double const defaultValue)
+  {
+    std::smatch match;
+    std::regex const re("\"" + field + "\"\\s*:\\s*([-+0-9.eE]+)");
+    if (std::regex_search(json, match, re)) return atof(match[1].str().c_str());
+    return defaultValue;
+  }
+
+  bool PerfBaseline::Load(std::string const& path)
+  {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string const json = ss.str();
+
+    // Split off the results object, entries do not nest so the first closing brace ends each of them
+    size_t const resultsPos = json.find("\"results\"");
+    if (resultsPos == std::string::npos) return false;
+    size_t const open = json.find('{', resultsPos);
+    if (open == std::string::npos) return false;
+    size_t close = open + 1;
+    for (int depth = 1; close < json.size() && depth > 0; ++close)
+    {
+      if (json[close] == '{') depth++;
+      else if (json[close] == '}') depth--;
+    }
+    std::string const results = json.substr(open + 1, close - open - 2);
+    std::string const header  = json.substr(0, resultsPos) + json.substr(close);
+
+    std::smatch match;
+    if (std::regex_search(header, match, std::regex("\"platform\"\\s*:\\s*\"([^\"]*)\"")))
+      platform = match[1].str();
+    latencyTolerance = GetJsonNumber(header, "latencyTolerance", latencyTolerance);
+    busBwTolerance   = GetJsonNumber(header, "busBwTolerance",   busBwTolerance);
+
+    std::regex const entryRe("\"([^\"]+)\"\\s*:\\s*\\{([^}]*)\\}");
+    for (auto it = std::sregex_iterator(results.begin(), results.end(), entryRe); it != std::sregex_iterator(); ++it)
+    {
+      std::string const fields = (*it)[2].str();
+      Entry entry;
+      entry.result.latencyUs  = GetJsonNumber(fields, "latencyUs", 0);
+      entry.result.busBw      = GetJsonNumber(fields, "busBw", 0);
+      entry.latencyTolerance  = GetJsonNumber(fields, "latencyTolerance", -1);
+      entry.busBwTolerance    = GetJsonNumber(fields, "busBwTolerance", -1);
+      entries[(*it)[1].str()] = entry;
+    }
+    return true;
+  }
+
+  bool PerfBaseline::Save(std::string const& path) const
+  {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == NULL) return false;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"platform\": \"%s\",\n", platform.c_str());
+    fprintf(fp, "  \"latencyTolerance\": %.2f,\n", latencyTolerance);
+    fprintf(fp, "  \"busBwTolerance\": %.2f,\n", busBwTolerance);
+    fprintf(fp, "  \"results\": {\n");
+    size_t count = 0;
+    for (auto const& e : entries)
+    {
+      fprintf(fp, "    \"%s\": { \"latencyUs\": %.2f, \"busBw\": %.2f", e.first.c_str(),
+              e.second.result.latencyUs, e.second.result.busBw);
+      if (e.second.latencyTolerance >= 0) fprintf(fp, ", \"latencyTolerance\": %.2f", e.second.latencyTolerance);
+      if (e.second.busBwTolerance   >= 0) fprintf(fp, ", \"busBwTolerance\": %.2f", e.second.busBwTolerance);
+      fprintf(fp, " }%s\n", ++count < entries.size() ? "," : "");
+    }
+    fprintf(fp, "  }\n}\n");
+    fclose(fp);
+    return true;
+  }
+
+  bool PerfBaseline::Find(std::string const& name, PerfResult& result, double& latTolerance, double& bwTolerance) const
+  {
+    auto it = entries.find(name);
+    if (it == entries.end()) return false;
+    result       = it->second.result;
+    latTolerance = it->second.latencyTolerance >= 0 ? it->second.latencyTolerance : latencyTolerance;
+    bwTolerance  = it->second.busBwTolerance   >= 0 ? it->second.busBwTolerance   : busBwTolerance;
+    return true;
+  }
+
+  void PerfBaseline::Record(std::string const& name, PerfResult const& result)
+  {
+    auto it = entries.find(name);
+    if (it != entries.end())
+    {
+      it->second.result = result;
+      return;
+    }
+    entries[name] = {result, -1, -1};
+  }
+
+  std::string PerfBaseline::GetPlatformName(int const numDevices)
+  {
+    char arch[64] = "unknown";
+    int pipefd[2];
+    if (pipe(pipefd) == 0)
+    {
+      pid_t pid = fork();
+      if (0 == pid)
+      {
+        hipDeviceProp_t prop;
+        char name[64] = "unknown";
+        if (hipGetDeviceProperties(&prop, 0) == hipSuccess)
+          sscanf(prop.gcnArchName, "%63[^:]", name);
+        if (write(pipefd[1], name, sizeof(name)) != sizeof(name)) exit(EXIT_FAILURE);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        exit(EXIT_SUCCESS);
+      }
+      int status;
+      if (read(pipefd[0], arch, sizeof(arch)) != sizeof(arch)) strcpy(arch, "unknown");
+      waitpid(pid, &status, 0);
+      close(pipefd[0]);
+      close(pipefd[1]);
+    }
+    return std::string(arch) + "_" + std::to_string(numDevices) + "gpu";
+  }
+
+  std::string PerfBaseline::GetCaseName(ncclFunc_t     const funcType,
+                                        ncclDataType_t const dataType,
+                                        int            const numRanks,
+                                        bool           const isMultiProcess,
+                                        size_t         const numBytes)
+  {
+    std::stringstream ss;
+    ss << ncclFuncNames[funcType] << "_" << ncclDataTypeNames[dataType] << "_" << numRanks << "ranks_"
+       << (isMultiProcess ? "MP" : "SP") << "_" << numBytes << "B";
+    return ss.str();
+  }
+
+  double PerfBaseline::GetBusBwFactor(ncclFunc_t const funcType, int const numRanks)
+  {
+    switch (funcType)
+    {
+    case ncclCollAllReduce:
+      return 2.0 * (numRanks - 1) / numRanks;
+    case ncclCollAllGather:
+    case ncclCollReduceScatter:
+    case ncclCollAllToAll:
+      return 1.0 * (numRanks - 1) / numRanks;
+    default:
+      return 1.0;
+    }
+  }
+}
@@ -0,0 +1,77 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#pragma once
+#include <map>
+#include <string>
+#include "CollectiveArgs.hpp"
+
+namespace RcclUnitTesting
+{
+  // Measured performance of one test case
+  struct PerfResult
+  {
+    double latencyUs;  // Time per call in usec
+    double busBw;      // Bus bandwidth in GB/s
+  };
+
+  // Stored performance results of one platform, kept in a JSON file:
+  // {
+  //   "platform": "gfx942_8gpu",
+  //   "latencyTolerance": 0.25,
+  //   "busBwTolerance": 0.10,
+  //   "results": {
+  //     "AllReduce_ncclFloat32_8ranks_SP_1048576B": { "latencyUs": 52.10, "busBw": 38.60 },
+  //     ...
+  //   }
+  // }
+  // Tolerances are fractions of the baseline value, and an entry may carry its own
+  // "latencyTolerance" and "busBwTolerance" to override the file wide ones
+  class PerfBaseline
+  {
+  public:
+    std::string platform;
+    double      latencyTolerance;
+    double      busBwTolerance;
+
+    PerfBaseline(double const latencyTolerance, double const busBwTolerance);
+
+    // Reads a baseline file, returns false if it does not exist or cannot be parsed
+    bool Load(std::string const& path);
+
+    // Writes all entries to a baseline file
+    bool Save(std::string const& path) const;
+
+    // Looks up a test case, with the tolerances that apply to it
+    bool Find(std::string const& name, PerfResult& result, double& latTolerance, double& bwTolerance) const;
+
+    // Adds or replaces a test case, keeping its own tolerances if it has some
+    void Record(std::string const& name, PerfResult const& result);
+
+    // Name of the platform: architecture of device 0 and number of devices, e.g. gfx942_8gpu
+    // NOTE: Queries the device from a child process, as HIP cannot be used prior to launching children
+    static std::string GetPlatformName(int const numDevices);
+
+    // Name of a test case within a baseline
+    static std::string GetCaseName(ncclFunc_t     const funcType,
+                                   ncclDataType_t const dataType,
+                                   int            const numRanks,
+                                   bool           const isMultiProcess,
+                                   size_t         const numBytes);
+
+    // Bus bandwidth factor of a collective, as used by rccl-tests
+    static double GetBusBwFactor(ncclFunc_t const funcType, int const numRanks);
+
+  protected:
+    struct Entry
+    {
+      PerfResult result;
+      double     latencyTolerance;  // Negative to use the file wide tolerance
+      double     busBwTolerance;    // Negative to use the file wide tolerance
+    };
+    std::map<std::string, Entry> entries;
+  };
+}
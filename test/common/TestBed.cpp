@@ -4,7 +4,9 @@
  * See LICENSE.txt for license information
  ************************************************************************/
 #include <unistd.h>
+#include <sys/stat.h>
 #include "TestBed.hpp"
+#include "PerfBaseline.hpp"
 #include <rccl/rccl.h>
 
 #define PIPE_WRITE(childId, val)                                        \
@@ -314,6 +316,35 @@ namespace RcclUnitTesting
     InteractiveWait("Finishing ExecuteCollectives");
   }
 
+  void TestBed::TimeCollectives(int const numWarmups, int const numIterations, double& timeUs)
+  {
+    InteractiveWait("Starting TimeCollectives");
+
+    int const cmd = TestBedChild::CHILD_TIME_COLL;
+    ++TestBed::NumTestsRun();
+
+    // Send TimeColl command to each active child process
+    for (int childId = 0; childId < this->numActiveChildren; ++childId)
+    {
+      PIPE_WRITE(childId, cmd);
+      PIPE_WRITE(childId, numWarmups);
+      PIPE_WRITE(childId, numIterations);
+    }
+
+    // Collect the time of each child, followed by its acknowledgement
+    timeUs = 0.0;
+    for (int childId = 0; childId < this->numActiveChildren; ++childId)
+    {
+      double childTimeUs;
+      PIPE_READ(childId, childTimeUs);
+      PIPE_CHECK(childId);
+      ASSERT_GE(childTimeUs, 0.0);
+      timeUs = std::max(timeUs, childTimeUs);
+    }
+
+    InteractiveWait("Finishing TimeCollectives");
+  }
+
   void TestBed::ValidateResults(bool& isCorrect, int const collId, int const rank)
   {
     InteractiveWait("Starting ValidateResults");
@@ -636,6 +667,103 @@ namespace RcclUnitTesting
     }
   }
 
+  void TestBed::RunPerfSweep(std::vector<ncclFunc_t> const& funcTypes,
+                             ncclDataType_t          const  dataType,
+                             std::vector<size_t>     const& numBytesList,
+                             bool                    const  isMultiProcess)
+  {
+    // Performance is only tracked at the largest # of GPUs allowed
+    if (ev.GetNumGpusList().empty()) return;
+    int const numGpus     = ev.GetNumGpusList().back();
+    int const numChildren = isMultiProcess ? numGpus : 1;
+    int const typeSize    = DataTypeToBytes(dataType);
+
+    // Baselines are stored per platform
+    std::string const platform = PerfBaseline::GetPlatformName(numGpus);
+    std::string const path     = ev.perfBaselineDir + "/" + platform + ".json";
+    PerfBaseline baseline(ev.perfLatTol / 100.0, ev.perfBwTol / 100.0);
+    bool const hasBaseline = baseline.Load(path);
+    baseline.platform = platform;
+    if (!hasBaseline && !ev.perfUpdate)
+      INFO("No perf baseline found at %s (set UT_PERF_UPDATE=1 to record one)\n", path.c_str());
+
+    // Sort sizes in descending order to allocate once per collective
+    std::vector<size_t> sortedBytes = numBytesList;
+    std::sort(sortedBytes.rbegin(), sortedBytes.rend());
+
+    this->InitComms(TestBed::GetDeviceIdsList(numChildren, numGpus));
+    if (testing::Test::HasFailure()) return;
+
+    INFO("%-48s %12s %12s %10s %10s\n", "Test case", "Time (us)", "Base (us)", "busBw", "Base busBw");
+    for (auto funcType : funcTypes)
+    {
+      // Like rccl-tests, the size of gather / scatter type collectives covers the whole buffer
+      bool const sizeIsTotal = (funcType == ncclCollAllGather || funcType == ncclCollReduceScatter ||
+                                funcType == ncclCollGather    || funcType == ncclCollScatter       ||
+                                funcType == ncclCollAllToAll);
+      for (int sizeIdx = 0; sizeIdx < sortedBytes.size(); ++sizeIdx)
+      {
+        int const N = std::max(1, (int)(sortedBytes[sizeIdx] / typeSize / (sizeIsTotal ? numGpus : 1)));
+        size_t const numBytes = (size_t)N * typeSize * (sizeIsTotal ? numGpus : 1);
+
+        int numInputElements, numOutputElements;
+        CollectiveArgs::GetNumElementsForFuncType(funcType, N, numGpus, &numInputElements, &numOutputElements);
+        this->SetCollectiveArgs(funcType, dataType, numInputElements, numOutputElements);
+        if (testing::Test::HasFailure()) break;
+
+        // Buffer contents do not affect timing, so data is only prepared for the largest size
+        if (sizeIdx == 0)
+        {
+          this->AllocateMem();
+          if (testing::Test::HasFailure()) break;
+          this->PrepareData();
+          if (testing::Test::HasFailure()) break;
+        }
+
+        double timeUs;
+        this->TimeCollectives(ev.perfWarmups, ev.perfIterations, timeUs);
+        if (testing::Test::HasFailure()) break;
+
+        PerfResult result;
+        result.latencyUs = timeUs;
+        result.busBw     = numBytes / 1.0E3 / timeUs * PerfBaseline::GetBusBwFactor(funcType, numGpus);
+
+        std::string const name = PerfBaseline::GetCaseName(funcType, dataType, numGpus, isMultiProcess, numBytes);
+        PerfResult ref;
+        double latTolerance, bwTolerance;
+        if (ev.perfUpdate)
+        {
+          baseline.Record(name, result);
+          INFO("%-48s %12.2f %12s %10.2f %10s\n", name.c_str(), result.latencyUs, "-", result.busBw, "-");
+        }
+        else if (baseline.Find(name, ref, latTolerance, bwTolerance))
+        {
+          bool const latRegressed = result.latencyUs > ref.latencyUs * (1.0 + latTolerance);
+          bool const bwRegressed  = result.busBw     < ref.busBw     * (1.0 - bwTolerance);
+          INFO("%-48s %12.2f %12.2f %10.2f %10.2f%s\n", name.c_str(), result.latencyUs, ref.latencyUs,
+               result.busBw, ref.busBw, (latRegressed || bwRegressed) ? " REGRESSED" : "");
+          EXPECT_FALSE(latRegressed) << name << " latency " << result.latencyUs << " us exceeds baseline "
+                                     << ref.latencyUs << " us by more than " << latTolerance * 100 << "%";
+          EXPECT_FALSE(bwRegressed)  << name << " busBw " << result.busBw << " GB/s is below baseline "
+                                     << ref.busBw << " GB/s by more than " << bwTolerance * 100 << "%";
+        }
+        else
+        {
+          INFO("%-48s %12.2f %12s %10.2f %10s\n", name.c_str(), result.latencyUs, "n/a", result.busBw, "n/a");
+        }
+      }
+      this->DeallocateMem();
+    }
+    this->DestroyComms();
+
+    if (ev.perfUpdate)
+    {
+      mkdir(ev.perfBaselineDir.c_str(), 0755);
+      EXPECT_TRUE(baseline.Save(path)) << "Unable to write perf baseline " << path;
+      INFO("Perf baseline written to %s\n", path.c_str());
+    }
+  }
+
   void TestBed::InteractiveWait(std::string message)
   {
     if (ev.useInteractive)
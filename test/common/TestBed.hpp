@@ -79,6 +79,10 @@ namespace RcclUnitTesting
     // Blocks until collective is completed
     void ExecuteCollectives(std::vector<int> const &currentRanks = {}, bool const useHipGraph = false);
 
+    // Time repeated launches of the prepared collectives on all test children
+    // Returns the average time per launch in usec of the slowest child
+    void TimeCollectives(int const numWarmups, int const numIterations, double& timeUs);
+
     // Perform results validation - compare output to expected
     void ValidateResults(bool& isCorrect, int collId = -1, int const rank = -1);
 
@@ -130,6 +134,13 @@ namespace RcclUnitTesting
                         std::vector<bool>           const& managedMemList,
                         std::vector<bool>           const& useHipGraphList);
 
+    // Run a performance sweep over message sizes (in bytes) using the largest # of GPUs
+    // Compares latency / bus bandwidth against the stored baseline of the platform [UT_PERF_*]
+    void RunPerfSweep(std::vector<ncclFunc_t> const& funcTypes,
+                      ncclDataType_t          const  dataType,
+                      std::vector<size_t>     const& numBytesList,
+                      bool                    const  isMultiProcess);
+
     // Wait for user-input if in interactive mode
     void InteractiveWait(std::string message);
 
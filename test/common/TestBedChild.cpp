@@ -6,6 +6,7 @@
 
 #include "TestBedChild.hpp"
 
+#include <chrono>
 #include <thread>
 #include <execinfo.h>
 
@@ -99,6 +100,7 @@ namespace RcclUnitTesting
       case CHILD_VALIDATE_RESULTS: status = ValidateResults();    break;
       case CHILD_DEALLOCATE_MEM  : status = DeallocateMem();      break;
       case CHILD_DESTROY_COMMS   : status = DestroyComms();       break;
+      case CHILD_TIME_COLL       : status = TimeCollectives();    break;
       case CHILD_STOP            : goto stop;
       default: exit(0);
       }
@@ -391,57 +393,8 @@ namespace RcclUnitTesting
     return TEST_SUCCESS;
   }
 
-  ErrCode TestBedChild::ExecuteCollectives()
+  ErrCode TestBedChild::LaunchGroup(std::vector<int> const& localRanksToExecute, bool const printInputs)
   {
-    bool useHipGraph = false;
-    PIPE_READ(useHipGraph);
-
-    int numRanksToExecute, tempRank;
-    std::vector<int> ranksToExecute = {};
-    PIPE_READ(numRanksToExecute);
-
-    for (int rank = 0; rank < numRanksToExecute; ++rank){
-      PIPE_READ(tempRank);
-      ranksToExecute.push_back(tempRank - this->rankOffset);
-    }
-    if (this->verbose) INFO("Child %d begins ExecuteCollectives() %s\n", this->childId, useHipGraph ? "(using hipGraphs)" : "");
-
-    // Determine which local ranks to execute on
-    std::vector<int> localRanksToExecute;
-    for (int localRank = 0; localRank < this->deviceIds.size(); ++localRank)
-    {
-      // If ranksToExeute is empty, execute all local ranks belonging to this child
-      if (!ranksToExecute.empty() &&
-          (std::count(ranksToExecute.begin(), ranksToExecute.end(), localRank) == 0)) continue;
-      localRanksToExecute.push_back(localRank);
-    }
-
-    numRanksToExecute = (int)localRanksToExecute.size();
-    std::vector<std::vector<hipGraph_t>> graphs;
-    std::vector<std::vector<hipGraphExec_t>> graphExec;
-    graphs.resize(numRanksToExecute);
-    graphExec.resize(numRanksToExecute);
-    for (int i = 0; i < numRanksToExecute; i++)
-    {
-      graphs[i].resize(this->numStreamsPerGroup);
-      graphExec[i].resize(this->numStreamsPerGroup);
-    }
-
-    // Start HIP graph stream capture if requested
-    if (useHipGraph)
-    {
-      for (int localRank : localRanksToExecute)
-      {
-        CHECK_HIP(hipSetDevice(this->deviceIds[localRank]));
-        if (this->verbose) INFO("Capturing stream for rank %d\n", localRank);
-        CHECK_HIP(hipSetDevice(this->deviceIds[localRank]));
-        for (int i = 0; i < this->numStreamsPerGroup; i++)
-        {
-          CHECK_HIP(hipStreamBeginCapture(this->streams[localRank][i], hipStreamCaptureModeRelaxed));
-        }
-      }
-    }
-
     // Start group call
     CHILD_NCCL_CALL(ncclGroupStart(), "ncclGroupStart");
 
@@ -455,7 +408,7 @@ namespace RcclUnitTesting
 
         CollectiveArgs const& collArg = this->collArgs[localRank][collId];
 
-        if (this->printValues && !useHipGraph)
+        if (printInputs)
         {
           int const numInputElementsToPrint = (this->printValues < 0 ? collArg.numInputElements : this->printValues);
           PtrUnion inputCpu;
@@ -615,6 +568,63 @@ namespace RcclUnitTesting
       CHILD_NCCL_CALL(ncclGroupEnd(), "ncclGroupEnd");
     }
 
+    return TEST_SUCCESS;
+  }
+
+  ErrCode TestBedChild::ExecuteCollectives()
+  {
+    bool useHipGraph = false;
+    PIPE_READ(useHipGraph);
+
+    int numRanksToExecute, tempRank;
+    std::vector<int> ranksToExecute = {};
+    PIPE_READ(numRanksToExecute);
+
+    for (int rank = 0; rank < numRanksToExecute; ++rank){
+      PIPE_READ(tempRank);
+      ranksToExecute.push_back(tempRank - this->rankOffset);
+    }
+    if (this->verbose) INFO("Child %d begins ExecuteCollectives() %s\n", this->childId, useHipGraph ? "(using hipGraphs)" : "");
+
+    // Determine which local ranks to execute on
+    std::vector<int> localRanksToExecute;
+    for (int localRank = 0; localRank < this->deviceIds.size(); ++localRank)
+    {
+      // If ranksToExeute is empty, execute all local ranks belonging to this child
+      if (!ranksToExecute.empty() &&
+          (std::count(ranksToExecute.begin(), ranksToExecute.end(), localRank) == 0)) continue;
+      localRanksToExecute.push_back(localRank);
+    }
+
+    numRanksToExecute = (int)localRanksToExecute.size();
+    std::vector<std::vector<hipGraph_t>> graphs;
+    std::vector<std::vector<hipGraphExec_t>> graphExec;
+    graphs.resize(numRanksToExecute);
+    graphExec.resize(numRanksToExecute);
+    for (int i = 0; i < numRanksToExecute; i++)
+    {
+      graphs[i].resize(this->numStreamsPerGroup);
+      graphExec[i].resize(this->numStreamsPerGroup);
+    }
+
+    // Start HIP graph stream capture if requested
+    if (useHipGraph)
+    {
+      for (int localRank : localRanksToExecute)
+      {
+        CHECK_HIP(hipSetDevice(this->deviceIds[localRank]));
+        if (this->verbose) INFO("Capturing stream for rank %d\n", localRank);
+        CHECK_HIP(hipSetDevice(this->deviceIds[localRank]));
+        for (int i = 0; i < this->numStreamsPerGroup; i++)
+        {
+          CHECK_HIP(hipStreamBeginCapture(this->streams[localRank][i], hipStreamCaptureModeRelaxed));
+        }
+      }
+    }
+
+    // Issue the group call
+    if (LaunchGroup(localRanksToExecute, this->printValues && !useHipGraph) != TEST_SUCCESS) return TEST_FAIL;
+
     // Instantiate and launch HIP graph if requested
     if (useHipGraph)
     {
@@ -703,6 +713,51 @@ namespace RcclUnitTesting
     return TEST_SUCCESS;
   }
 
+  ErrCode TestBedChild::TimeCollectives()
+  {
+    int numWarmups, numIterations;
+    PIPE_READ(numWarmups);
+    PIPE_READ(numIterations);
+    if (this->verbose) INFO("Child %d begins TimeCollectives() (%d warmups, %d iterations)\n",
+                            this->childId, numWarmups, numIterations);
+
+    std::vector<int> localRanks;
+    for (int localRank = 0; localRank < this->deviceIds.size(); ++localRank)
+      localRanks.push_back(localRank);
+
+    // Warmups also line up the children, which receive the command one after the other
+    ErrCode status = TEST_SUCCESS;
+    for (int i = 0; i < numWarmups && status == TEST_SUCCESS; ++i)
+      status = LaunchGroup(localRanks, false);
+    if (status == TEST_SUCCESS) status = SynchronizeStreams(localRanks);
+
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numIterations && status == TEST_SUCCESS; ++i)
+      status = LaunchGroup(localRanks, false);
+    if (status == TEST_SUCCESS) status = SynchronizeStreams(localRanks);
+    auto const stop = std::chrono::steady_clock::now();
+
+    // Time is always sent back (negative on failure) to keep the pipe in step with the parent
+    double timeUs = -1.0;
+    if (status == TEST_SUCCESS && numIterations > 0)
+      timeUs = std::chrono::duration<double, std::micro>(stop - start).count() / numIterations;
+    if (write(childWriteFd, &timeUs, sizeof(timeUs)) != sizeof(timeUs)) return TEST_FAIL;
+
+    if (this->verbose) INFO("Child %d finishes TimeCollectives() %.2f usec per group call\n", this->childId, timeUs);
+    return status;
+  }
+
+  ErrCode TestBedChild::SynchronizeStreams(std::vector<int> const& localRanks)
+  {
+    for (int localRank : localRanks)
+    {
+      CHECK_HIP(hipSetDevice(this->deviceIds[localRank]));
+      for (int i = 0; i < this->numStreamsPerGroup; i++)
+        CHECK_HIP(hipStreamSynchronize(this->streams[localRank][i]));
+    }
+    return TEST_SUCCESS;
+  }
+
   ErrCode TestBedChild::ValidateResults()
   {
     // Read values sent by parent [see TestBed::ValidateResults()]
@@ -30,8 +30,9 @@ namespace RcclUnitTesting
       CHILD_VALIDATE_RESULTS = 6,  // ValidateResults()
       CHILD_DEALLOCATE_MEM   = 7,  // DeallocateMem()
       CHILD_DESTROY_COMMS    = 8,  // DestroyComms()
-      CHILD_STOP             = 9,  // Stop()
-      NUM_CHILD_COMMANDS     = 10
+      CHILD_TIME_COLL        = 9,  // TimeCollectives()
+      CHILD_STOP             = 10, // Stop()
+      NUM_CHILD_COMMANDS     = 11
     };
 
     char const ChildCommandNames[NUM_CHILD_COMMANDS][20] =
@@ -45,6 +46,7 @@ namespace RcclUnitTesting
       "VALIDATE_RESULTS",
       "DEALLOCATE_MEM",
       "DESTROY_COMMS",
+      "TIME_COLL",
       "STOP"
     };
 
@@ -99,6 +101,15 @@ namespace RcclUnitTesting
     // Execute a group of collectives
     ErrCode ExecuteCollectives();
 
+    // Issue the group of collectives of the given local ranks, without waiting for completion
+    ErrCode LaunchGroup(std::vector<int> const& localRanksToExecute, bool const printInputs);
+
+    // Time back to back executions of the group of collectives on all local ranks
+    ErrCode TimeCollectives();
+
+    // Wait for all streams of the given local ranks
+    ErrCode SynchronizeStreams(std::vector<int> const& localRanks);
+
     // Validate that output matches expected
     ErrCode ValidateResults();
 
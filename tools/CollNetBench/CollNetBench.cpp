@@ -0,0 +1,221 @@
+/*
+Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// CollNet benchmark
+//
+// Runs ncclAllReduce across nodes with in-network reduction (CollNetChain, CollNetDirect) and with the
+// Ring and Tree algorithms, so a CollNet plugin and the CollNet entries of the tuning model can be checked
+// against the algorithms they compete with. One MPI rank drives one GPU. Each algorithm gets its own
+// communicator, created with NCCL_ALGO set to it and NCCL_COLLNET_ENABLE=1, and every result is checked.
+// Reported per size and algorithm: the slowest rank's time per allreduce and the bus bandwidth.
+// An algorithm RCCL can not use falls back to another one with a warning at communicator creation,
+// so run with NCCL_DEBUG=INFO NCCL_DEBUG_SUBSYS=INIT,TUNING to see what each communicator ended up with.
+//
+// Configuration comes from environment variables:
+// COLLNET_ALGOS      Comma separated list of algorithms to run  (default CollNetChain,CollNetDirect,Ring,Tree)
+// COLLNET_MIN_BYTES  Smallest allreduce                                                   (default 64KB)
+// COLLNET_MAX_BYTES  Largest allreduce                                                    (default 1GB)
+// COLLNET_STEP       Size multiplier between steps                                        (default 4)
+// COLLNET_ITERS      Timed iterations                                                     (default 20)
+// COLLNET_WARMUPS    Warmup iterations                                                    (default 5)
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <hip/hip_runtime.h>
+#include <rccl/rccl.h>
+#include <mpi.h>
+
+#define HIP_CALL(cmd)                                                 \
+  do {                                                                \
+    hipError_t error = (cmd);                                         \
+    if (error != hipSuccess)                                          \
+    {                                                                   \
+      std::cout << "Encountered HIP error (" << hipGetErrorString(error) << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";         \
+      MPI_Abort(MPI_COMM_WORLD, -1);                                    \
+    }                                                                   \
+  } while (0)
+
+#define NCCL_CALL(cmd) \
+  do { \
+    ncclResult_t error = (cmd);                 \
+    if (error != ncclSuccess)                   \
+    {                                           \
+      std::cout << "Encountered NCCL error (" << ncclGetErrorString(error) << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";         \
+      MPI_Abort(MPI_COMM_WORLD, -1);            \
+    }                                           \
+  } while (0)
+
+#define MPI_CALL(cmd) \
+  do { \
+    int error = (cmd);                          \
+    if (error != MPI_SUCCESS)                   \
+    {                                           \
+      std::cout << "Encountered MPI error (" << error << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";         \
+      MPI_Abort(MPI_COMM_WORLD, -1);            \
+    }                                           \
+  } while (0)
+
+static size_t GetEnvSize(char const* name, size_t defaultValue)
+{
+  char const* value = getenv(name);
+  return value ? strtoull(value, NULL, 0) : defaultValue;
+}
+
+// Every rank contributes rank+1, small integers that sum exactly in float
+__global__ void FillKernel(float* data, size_t count, float value)
+{
+  for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < count; i += gridDim.x * blockDim.x)
+    data[i] = value;
+}
+
+__global__ void CheckKernel(float const* data, size_t count, float expected, unsigned long long* errors)
+{
+  unsigned long long nErrors = 0;
+  for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < count; i += gridDim.x * blockDim.x)
+    nErrors += (data[i] != expected);
+  if (nErrors) atomicAdd(errors, nErrors);
+}
+
+int main(int argc, char** argv)
+{
+  MPI_CALL(MPI_Init(&argc, &argv));
+  int rank, nRanks, localRank;
+  MPI_Comm localComm;
+  MPI_CALL(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+  MPI_CALL(MPI_Comm_size(MPI_COMM_WORLD, &nRanks));
+  MPI_CALL(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &localComm));
+  MPI_CALL(MPI_Comm_rank(localComm, &localRank));
+
+  std::vector<std::string> algos;
+  {
+    char const* value = getenv("COLLNET_ALGOS");
+    std::stringstream ss(value ? value : "CollNetChain,CollNetDirect,Ring,Tree");
+    std::string algo;
+    while (std::getline(ss, algo, ',')) if (!algo.empty()) algos.push_back(algo);
+  }
+  size_t const minBytes = GetEnvSize("COLLNET_MIN_BYTES", 1 << 16);
+  size_t const maxBytes = GetEnvSize("COLLNET_MAX_BYTES", 1 << 30);
+  size_t const step     = std::max(GetEnvSize("COLLNET_STEP", 4), (size_t)2);
+  int    const numIters = GetEnvSize("COLLNET_ITERS", 20);
+  int    const warmups  = GetEnvSize("COLLNET_WARMUPS", 5);
+
+  int numDevices;
+  HIP_CALL(hipGetDeviceCount(&numDevices));
+  HIP_CALL(hipSetDevice(localRank % numDevices));
+
+  size_t const maxCount = maxBytes / sizeof(float);
+  float* sendBuf;
+  float* recvBuf;
+  unsigned long long* errors;
+  hipStream_t stream;
+  hipEvent_t start, stop;
+  HIP_CALL(hipMalloc((void**)&sendBuf, maxCount * sizeof(float)));
+  HIP_CALL(hipMalloc((void**)&recvBuf, maxCount * sizeof(float)));
+  HIP_CALL(hipMalloc((void**)&errors, sizeof(*errors)));
+  HIP_CALL(hipStreamCreateWithFlags(&stream, hipStreamNonBlocking));
+  HIP_CALL(hipEventCreate(&start));
+  HIP_CALL(hipEventCreate(&stop));
+  hipLaunchKernelGGL(FillKernel, dim3(256), dim3(256), 0, stream, sendBuf, maxCount, (float)(rank + 1));
+  HIP_CALL(hipStreamSynchronize(stream));
+  float const expected = 0.5f * nRanks * (nRanks + 1);
+
+  // NCCL_ALGO and NCCL_COLLNET_ENABLE are read when a communicator is created, one per algorithm
+  setenv("NCCL_COLLNET_ENABLE", "1", 0);
+  std::vector<ncclComm_t> comms(algos.size());
+  for (size_t a = 0; a < algos.size(); a++)
+  {
+    ncclUniqueId id;
+    if (rank == 0) NCCL_CALL(ncclGetUniqueId(&id));
+    MPI_CALL(MPI_Bcast(&id, sizeof(id), MPI_BYTE, 0, MPI_COMM_WORLD));
+    setenv("NCCL_ALGO", algos[a].c_str(), 1);
+    NCCL_CALL(ncclCommInitRank(&comms[a], nRanks, id, rank));
+  }
+  unsetenv("NCCL_ALGO");
+
+  if (rank == 0)
+  {
+    printf("%d ranks, %d iterations (%d warmups) per size\n", nRanks, numIters, warmups);
+    printf("%12s", "bytes");
+    for (auto const& algo : algos) printf(" %14s (us) %10s", algo.c_str(), "busBw");
+    printf("\n");
+  }
+
+  int totalErrors = 0;
+  for (size_t bytes = minBytes; bytes <= maxBytes; bytes *= step)
+  {
+    size_t const count = bytes / sizeof(float);
+    if (rank == 0) printf("%12zu", bytes);
+    for (size_t a = 0; a < algos.size(); a++)
+    {
+      HIP_CALL(hipMemsetAsync(recvBuf, 0, count * sizeof(float), stream));
+      HIP_CALL(hipMemsetAsync(errors, 0, sizeof(*errors), stream));
+      for (int i = 0; i < warmups; i++)
+        NCCL_CALL(ncclAllReduce(sendBuf, recvBuf, count, ncclFloat, ncclSum, comms[a], stream));
+      HIP_CALL(hipStreamSynchronize(stream));
+      MPI_CALL(MPI_Barrier(MPI_COMM_WORLD));
+
+      HIP_CALL(hipEventRecord(start, stream));
+      for (int i = 0; i < numIters; i++)
+        NCCL_CALL(ncclAllReduce(sendBuf, recvBuf, count, ncclFloat, ncclSum, comms[a], stream));
+      HIP_CALL(hipEventRecord(stop, stream));
+      hipLaunchKernelGGL(CheckKernel, dim3(256), dim3(256), 0, stream, recvBuf, count, expected, errors);
+      HIP_CALL(hipStreamSynchronize(stream));
+
+      float ms;
+      unsigned long long nErrors;
+      HIP_CALL(hipEventElapsedTime(&ms, start, stop));
+      HIP_CALL(hipMemcpy(&nErrors, errors, sizeof(nErrors), hipMemcpyDeviceToHost));
+      double us = 1000.0 * ms / numIters, maxUs;
+      int failed = nErrors != 0, anyFailed;
+      MPI_CALL(MPI_Reduce(&us, &maxUs, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD));
+      MPI_CALL(MPI_Allreduce(&failed, &anyFailed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD));
+      totalErrors += anyFailed;
+      if (rank == 0)
+      {
+        double busBw = bytes / maxUs / 1.0E3 * 2.0 * (nRanks - 1) / nRanks;
+        printf(" %19.2f %10.2f%s", maxUs, busBw, anyFailed ? "*" : " ");
+      }
+    }
+    if (rank == 0) printf("\n");
+  }
+  if (rank == 0 && totalErrors) printf("* wrong results\n");
+
+  for (auto comm : comms) NCCL_CALL(ncclCommDestroy(comm));
+  HIP_CALL(hipEventDestroy(start));
+  HIP_CALL(hipEventDestroy(stop));
+  HIP_CALL(hipStreamDestroy(stream));
+  HIP_CALL(hipFree(sendBuf));
+  HIP_CALL(hipFree(recvBuf));
+  HIP_CALL(hipFree(errors));
+  MPI_CALL(MPI_Comm_free(&localComm));
+  MPI_CALL(MPI_Finalize());
+  return totalErrors ? 1 : 0;
+}
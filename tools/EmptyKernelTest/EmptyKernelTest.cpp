@@ -71,6 +71,27 @@ THE SOFTWARE.
 
 __global__ void EmptyKernel(){};
 
+#if !defined(__NVCC__)
+// Resident kernel that answers host doorbells without being relaunched, as used by
+// RCCL_RESIDENT_KERNEL=1. Each doorbell written to *head is acknowledged via *done.
+__global__ void ResidentKernel(uint64_t* head, uint64_t* done, uint32_t* stop)
+{
+  if (threadIdx.x != 0) return;
+  uint64_t seq = 0;
+  while (true) {
+    uint64_t h = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    if (h == seq) {
+      if (__atomic_load_n(stop, __ATOMIC_RELAXED)) break;
+      __builtin_amdgcn_s_sleep(8);
+      continue;
+    }
+    seq = h;
+    __threadfence_system();
+    __atomic_fetch_add(done, 1, __ATOMIC_RELEASE);
+  }
+}
+#endif
+
 float calStdDev(const std::vector<float>& allDeltaMs, float mean)
 {
   std::vector<float> diff(allDeltaMs.size());
@@ -85,8 +106,16 @@ int main(int argc, char **argv)
   int numIterations = (argc > 1 ? atoi(argv[1]) : 10);
   int gridSize      = (argc > 2 ? atoi(argv[2]) : 1);
   int blockSize     = (argc > 3 ? atoi(argv[3]) : 1);
+  int useResident   = (argc > 4 ? atoi(argv[4]) : 0);
   int numWarmups    = 3;
-  printf("Running %d iterations <<<%d,%d>>>\n", numIterations, gridSize, blockSize);
+  printf("Running %d iterations <<<%d,%d>>>%s\n", numIterations, gridSize, blockSize,
+         useResident ? " (resident kernel doorbell)" : "");
+#if defined(__NVCC__)
+  if (useResident) {
+    printf("Resident kernel mode is only supported on HIP\n");
+    return 0;
+  }
+#endif
 
   // Create events and stream
   hipEvent_t startEvent, stopEvent;
@@ -95,10 +124,42 @@ int main(int argc, char **argv)
   hipStream_t stream;
   HIP_CALL(hipStreamCreate(&stream));
 
+#if !defined(__NVCC__)
+  // Doorbell shared with the resident kernel, which runs on its own stream
+  uint64_t* residentHead = nullptr;
+  uint64_t* residentDone = nullptr;
+  uint32_t* residentStop = nullptr;
+  uint64_t  residentSeq  = 0;
+  hipStream_t residentStream;
+  if (useResident) {
+    HIP_CALL(hipHostMalloc((void**)&residentHead, sizeof(uint64_t), hipHostMallocCoherent));
+    HIP_CALL(hipHostMalloc((void**)&residentDone, sizeof(uint64_t), hipHostMallocCoherent));
+    HIP_CALL(hipHostMalloc((void**)&residentStop, sizeof(uint32_t), hipHostMallocCoherent));
+    *residentHead = 0;
+    *residentDone = 0;
+    *residentStop = 0;
+    HIP_CALL(hipStreamCreateWithFlags(&residentStream, hipStreamNonBlocking));
+    ResidentKernel<<<1, 1, 0, residentStream>>>(residentHead, residentDone, residentStop);
+  }
+
+  // Either launch an empty kernel or ring the resident kernel's doorbell and wait for it
+  auto launch = [&]() {
+    if (useResident) {
+      residentSeq++;
+      HIP_CALL(hipStreamWriteValue64(stream, residentHead, residentSeq, 0));
+      HIP_CALL(hipStreamWaitValue64(stream, residentDone, residentSeq, hipStreamWaitValueGte, ~uint64_t(0)));
+    } else {
+      EmptyKernel<<<gridSize, blockSize, 0, stream>>>();
+    }
+  };
+#else
+  auto launch = [&]() { EmptyKernel<<<gridSize, blockSize, 0, stream>>>(); };
+#endif
+
   // Run untimed warmup iterations (to cache kernel code)
   for (int iteration = 0; iteration < numWarmups; iteration++)
   {
-    EmptyKernel<<<gridSize, blockSize, 0, stream>>>();
+    launch();
   }
   HIP_CALL(hipStreamSynchronize(stream));
   std::vector<float> allGpuDeltaMsec(numIterations);
@@ -115,7 +176,7 @@ int main(int argc, char **argv)
     HIP_CALL(hipEventRecord(startEvent, stream));
 
     // Launch kernel and wait for completion
-    EmptyKernel<<<gridSize, blockSize, 0, stream>>>();
+    launch();
     HIP_CALL(hipEventRecord(stopEvent, stream));
     HIP_CALL(hipStreamSynchronize(stream));
 
@@ -149,6 +210,16 @@ int main(int argc, char **argv)
   printf("Maximum       Kernel Launch time (usec) %10.5f (CPU) %10.5f (GPU)\n", *maxCpuUsec, *maxGpuUsec);
   printf("Stddev        Kernel Launch time (usec) %10.5f (CPU) %10.5f (GPU)\n", varCpuUsec, varGpuUsec);
   // Cleanup events and stream
+#if !defined(__NVCC__)
+  if (useResident) {
+    __atomic_store_n(residentStop, 1, __ATOMIC_RELEASE);
+    HIP_CALL(hipStreamSynchronize(residentStream));
+    HIP_CALL(hipStreamDestroy(residentStream));
+    HIP_CALL(hipHostFree(residentHead));
+    HIP_CALL(hipHostFree(residentDone));
+    HIP_CALL(hipHostFree(residentStop));
+  }
+#endif
   HIP_CALL(hipStreamDestroy(stream));
   HIP_CALL(hipEventDestroy(startEvent));
   HIP_CALL(hipEventDestroy(stopEvent));
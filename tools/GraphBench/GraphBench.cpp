@@ -20,9 +20,37 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+// Graph capture benchmark
+//
+// For each collective, size and number of operations captured per graph, measures:
+// - Capture:  time to capture the operations into one graph per device
+// - Inst:     hipGraphInstantiate time, summed over the devices
+// - Eager:    latency of issuing the same operations directly
+// - Graph:    latency of replaying the graphs
+// - Delta:    replay speedup over eager issue
+// - Plans, WorkKB, PeerBufs: persistent kernel plans the graphs hold, the device memory of their work
+//             and the peer buffers mapped for them (NCCL_GRAPH_REGISTER=1), from ncclCommGetStats
+// - DevMemMB: device memory used by capture and instantiation, summed over the devices
+//
+// Configuration comes from environment variables:
+// GRAPH_COLLS      Comma separated collectives (AllReduce,AllGather,ReduceScatter,Broadcast,Reduce,AllToAll,SendRecv)
+// GRAPH_MIN_BYTES  Smallest size per rank                                         (default 4)
+// GRAPH_MAX_BYTES  Largest size per rank                                          (default 64MB)
+// GRAPH_STEP       Size multiplier between steps                                  (default 4)
+// GRAPH_OPS        Comma separated numbers of operations captured per graph       (default 1,8)
+// GRAPH_COMMS      Communicator sets the captured operations alternate between    (default 1)
+// GRAPH_ITERS      Timed iterations                                               (default 20)
+// GRAPH_WARMUPS    Warmup iterations                                              (default 3)
+// GRAPH_CHECK      Verify AllReduce results after the replays                     (default 1)
+
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <string>
+#include <sstream>
+#include <vector>
 #include <chrono>
 #include <hip/hip_runtime.h>
 #include <rccl/rccl.h>
@@ -49,174 +77,255 @@ THE SOFTWARE.
     }                                                                   \
   } while (0)
 
-int main(int argc, char **argv)
+enum CollType { AllReduce, AllGather, ReduceScatter, Broadcast, Reduce, AllToAll, SendRecv, NumCollTypes };
+char const* collNames[NumCollTypes] = {"AllReduce", "AllGather", "ReduceScatter", "Broadcast", "Reduce", "AllToAll", "SendRecv"};
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double ElapsedMs(Clock::time_point start)
 {
-  int nranks;
-  HIP_CALL(hipGetDeviceCount(&nranks));
+  return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(Clock::now() - start).count();
+}
 
-  // Initialize communicators for each rank
-  ncclComm_t comm[nranks];
-  NCCL_CALL(ncclCommInitAll(comm, nranks, NULL));
+static std::vector<std::string> GetEnvList(char const* name, char const* defaultValue)
+{
+  std::vector<std::string> values;
+  std::stringstream ss(getenv(name) ? getenv(name) : defaultValue);
+  std::string item;
+  while (std::getline(ss, item, ',')) if (!item.empty()) values.push_back(item);
+  return values;
+}
 
-  // Allocate GPU resources
-  hipStream_t stream[nranks];
-  int* iputCpu[nranks];
-  int* iputGpu[nranks];
-  int* oputGpu[nranks];
-  int* oputCpu[nranks];
-  int* pattern;
-  int* expected;
+static size_t GetEnvSize(char const* name, size_t defaultValue)
+{
+  return getenv(name) ? strtoull(getenv(name), NULL, 0) : defaultValue;
+}
+
+// Issues numOps operations of N floats per rank, one group over all devices per operation.
+// Operation k runs on communicator set k % comms.size().
+static void IssueOps(CollType coll, size_t N, int numOps, std::vector<std::vector<ncclComm_t>>& comms,
+                     std::vector<hipStream_t>& stream, std::vector<float*>& sendbuf, std::vector<float*>& recvbuf)
+{
+  int nranks = stream.size();
+  size_t perRank = N / nranks;
+  for (int k = 0; k < numOps; k++)
+  {
+    std::vector<ncclComm_t>& comm = comms[k % comms.size()];
+    NCCL_CALL(ncclGroupStart());
+    for (int r = 0; r < nranks; r++)
+    {
+      HIP_CALL(hipSetDevice(r));
+      switch (coll)
+      {
+      case AllReduce:     NCCL_CALL(ncclAllReduce(sendbuf[r], recvbuf[r], N, ncclFloat, ncclSum, comm[r], stream[r])); break;
+      case AllGather:     NCCL_CALL(ncclAllGather(sendbuf[r], recvbuf[r], perRank, ncclFloat, comm[r], stream[r])); break;
+      case ReduceScatter: NCCL_CALL(ncclReduceScatter(sendbuf[r], recvbuf[r], perRank, ncclFloat, ncclSum, comm[r], stream[r])); break;
+      case Broadcast:     NCCL_CALL(ncclBroadcast(sendbuf[r], recvbuf[r], N, ncclFloat, 0, comm[r], stream[r])); break;
+      case Reduce:        NCCL_CALL(ncclReduce(sendbuf[r], recvbuf[r], N, ncclFloat, ncclSum, 0, comm[r], stream[r])); break;
+      case AllToAll:      NCCL_CALL(ncclAllToAll(sendbuf[r], recvbuf[r], perRank, ncclFloat, comm[r], stream[r])); break;
+      case SendRecv:
+        NCCL_CALL(ncclSend(sendbuf[r], N, ncclFloat, (r + 1) % nranks, comm[r], stream[r]));
+        NCCL_CALL(ncclRecv(recvbuf[r], N, ncclFloat, (r + nranks - 1) % nranks, comm[r], stream[r]));
+        break;
+      default: break;
+      }
+    }
+    NCCL_CALL(ncclGroupEnd());
+  }
+}
 
-  int maxN = (1<<24);
+static void SyncAll(std::vector<hipStream_t>& stream)
+{
+  for (size_t r = 0; r < stream.size(); r++)
+  {
+    HIP_CALL(hipSetDevice(r));
+    HIP_CALL(hipStreamSynchronize(stream[r]));
+  }
+}
 
-  expected = (int*)calloc(maxN, sizeof(int));
+static size_t UsedDeviceMemory(int nranks)
+{
+  size_t used = 0;
   for (int r = 0; r < nranks; r++)
   {
+    size_t freeBytes, totalBytes;
     HIP_CALL(hipSetDevice(r));
-    HIP_CALL(hipStreamCreate(&stream[r]));
-    HIP_CALL(hipMalloc((void **)&iputGpu[r], maxN * sizeof(int)));
-    HIP_CALL(hipMalloc((void **)&oputGpu[r], maxN * sizeof(int)));
-
-    iputCpu[r] = (int*) malloc(maxN * sizeof(int));
-    oputCpu[r] = (int*) malloc(maxN * sizeof(int));
-    pattern    = (int*) malloc(maxN * sizeof(int));
-
-    for (int i = 0; i < maxN; i++)
-    {
-      iputCpu[r][i] = (r * 235 + i) % 2057;
-      oputCpu[r][i] = 0;
-      expected[i] += iputCpu[r][i];
+    HIP_CALL(hipMemGetInfo(&freeBytes, &totalBytes));
+    used += totalBytes - freeBytes;
+  }
+  return used;
+}
 
-      pattern[i] = -1 - i;
-    }
+int main(int argc, char **argv)
+{
+  int nranks;
+  HIP_CALL(hipGetDeviceCount(&nranks));
 
-    HIP_CALL(hipMemcpy(iputGpu[r], iputCpu[r], maxN * sizeof(int), hipMemcpyHostToDevice));
-    HIP_CALL(hipMemcpy(oputGpu[r], oputCpu[r], maxN * sizeof(int), hipMemcpyHostToDevice));
-  }
+  std::vector<std::string> collList = GetEnvList("GRAPH_COLLS", "AllReduce,AllGather,ReduceScatter,Broadcast,Reduce,AllToAll,SendRecv");
+  std::vector<std::string> opsList  = GetEnvList("GRAPH_OPS", "1,8");
+  size_t minBytes      = GetEnvSize("GRAPH_MIN_BYTES", 4);
+  size_t maxBytes      = GetEnvSize("GRAPH_MAX_BYTES", 1 << 26);
+  size_t step          = std::max(GetEnvSize("GRAPH_STEP", 4), (size_t)2);
+  int    numCommSets   = std::max((int)GetEnvSize("GRAPH_COMMS", 1), 1);
+  int    numIterations = GetEnvSize("GRAPH_ITERS", 20);
+  int    numWarmups    = GetEnvSize("GRAPH_WARMUPS", 3);
+  int    checkResults  = GetEnvSize("GRAPH_CHECK", 1);
 
-  int numWarmups    = 3;
-  int numIterations = 5;
+  printf("Devices %d, communicator sets %d, iterations %d, warmups %d\n", nranks, numCommSets, numIterations, numWarmups);
 
-  hipGraph_t graphs[nranks];
-  hipGraphExec_t graphExec[nranks];
+  // Initialize communicators for each rank, once per set
+  std::vector<std::vector<ncclComm_t>> comms(numCommSets, std::vector<ncclComm_t>(nranks));
+  for (int s = 0; s < numCommSets; s++)
+    NCCL_CALL(ncclCommInitAll(comms[s].data(), nranks, NULL));
 
-  printf("%12s", "NumBytes");
-  for (int usingGraphs = 0; usingGraphs <= 1; usingGraphs++)
+  // Allocate GPU resources, AllGather and AllToAll use N floats per rank in each buffer as well
+  size_t maxN = (maxBytes / sizeof(float) + nranks - 1) / nranks * nranks;
+  std::vector<hipStream_t> stream(nranks);
+  std::vector<float*> sendbuf(nranks), recvbuf(nranks);
+  std::vector<float> input(maxN), output(maxN);
+  for (int r = 0; r < nranks; r++)
   {
-    printf("%12s", "Setup");
-    for (int i = 1; i <= numIterations; ++i)
-      printf("%11s%d", usingGraphs ? "Graph" : "NoGraph", i);
-    printf("%12s", "Avg");
+    HIP_CALL(hipSetDevice(r));
+    HIP_CALL(hipStreamCreate(&stream[r]));
+    HIP_CALL(hipMalloc((void **)&sendbuf[r], maxN * sizeof(float)));
+    HIP_CALL(hipMalloc((void **)&recvbuf[r], maxN * sizeof(float)));
+    // Small integers keep the sums exact
+    for (size_t i = 0; i < maxN; i++) input[i] = (float)((r * 235 + i) % 17);
+    HIP_CALL(hipMemcpy(sendbuf[r], input.data(), maxN * sizeof(float), hipMemcpyHostToDevice));
   }
-  printf("%12s\n", "Speedup");
 
-  for (int N = 1; N <= maxN; N *= 2)
+  std::vector<hipGraph_t> graphs(nranks);
+  std::vector<hipGraphExec_t> graphExec(nranks);
+
+  printf("%-14s %12s %4s %5s %10s %10s %10s %10s %8s %6s %10s %8s %10s\n", "Coll", "Bytes", "Ops", "Comms",
+         "CaptureMs", "InstMs", "EagerUs", "GraphUs", "Delta%", "Plans", "WorkKB", "PeerBufs", "DevMemMB");
+
+  for (size_t c = 0; c < collList.size(); c++)
   {
-    printf("%12lu", N * sizeof(int));
+    int coll = 0;
+    while (coll < NumCollTypes && collList[c] != collNames[coll]) coll++;
+    if (coll == NumCollTypes)
+    {
+      printf("Unknown collective %s in GRAPH_COLLS\n", collList[c].c_str());
+      exit(1);
+    }
 
-    double average[2] = {};
-    for (int usingGraphs = 0; usingGraphs <= 1; usingGraphs++)
+    for (size_t bytes = minBytes; bytes <= maxBytes; bytes *= step)
     {
-      auto setupStart = std::chrono::high_resolution_clock::now();
-      if (usingGraphs)
+      size_t N = std::max((bytes / sizeof(float) + nranks - 1) / nranks * nranks, (size_t)nranks);
+
+      for (size_t o = 0; o < opsList.size(); o++)
       {
-        for (int r = 0; r < nranks; ++r)
+        int numOps = std::max(atoi(opsList[o].c_str()), 1);
+
+        // Eager issue
+        for (int iteration = 0; iteration < numWarmups; iteration++)
+          IssueOps((CollType)coll, N, numOps, comms, stream, sendbuf, recvbuf);
+        SyncAll(stream);
+        Clock::time_point start = Clock::now();
+        for (int iteration = 0; iteration < numIterations; iteration++)
         {
-          HIP_CALL(hipSetDevice(r));
-          HIP_CALL(hipStreamBeginCapture(stream[r], hipStreamCaptureModeThreadLocal));
+          IssueOps((CollType)coll, N, numOps, comms, stream, sendbuf, recvbuf);
+          SyncAll(stream);
         }
+        double eagerUs = ElapsedMs(start) * 1000.0 / numIterations;
 
-        NCCL_CALL(ncclGroupStart());
+        // Capture and instantiate
+        size_t memBefore = UsedDeviceMemory(nranks);
+        start = Clock::now();
         for (int r = 0; r < nranks; ++r)
         {
           HIP_CALL(hipSetDevice(r));
-          NCCL_CALL(ncclAllReduce(iputGpu[r], oputGpu[r], N, ncclInt, ncclSum, comm[r], stream[r]));
+          HIP_CALL(hipStreamBeginCapture(stream[r], hipStreamCaptureModeThreadLocal));
         }
-        NCCL_CALL(ncclGroupEnd());
-
+        IssueOps((CollType)coll, N, numOps, comms, stream, sendbuf, recvbuf);
         for (int r = 0; r < nranks; ++r)
-        {
-          //HIP_CALL(hipSetDevice(r));
           HIP_CALL(hipStreamEndCapture(stream[r], &graphs[r]));
-        }
+        double captureMs = ElapsedMs(start);
 
-        // Instantiating graphs
+        start = Clock::now();
         for (int r = 0; r < nranks; ++r)
         {
           HIP_CALL(hipSetDevice(r));
           HIP_CALL(hipGraphInstantiate(&graphExec[r], graphs[r], NULL, NULL, 0));
         }
-      }
-      auto setupDelta = std::chrono::high_resolution_clock::now() - setupStart;
-      double setupTime = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(setupDelta).count();
-      printf("%12.3f", setupTime);
+        double instMs = ElapsedMs(start);
 
-      // Perform iterations
-      average[usingGraphs] = 0;
-      for (int iteration = -numWarmups; iteration < numIterations; ++iteration)
-      {
-        auto cpuStart = std::chrono::high_resolution_clock::now();
-        if (usingGraphs)
+        // Replay
+        for (int iteration = -numWarmups; iteration < numIterations; iteration++)
         {
+          if (iteration == 0)
+          {
+            SyncAll(stream);
+            start = Clock::now();
+          }
           for (int r = 0; r < nranks; r++)
           {
             HIP_CALL(hipSetDevice(r));
             HIP_CALL(hipGraphLaunch(graphExec[r], stream[r]));
           }
+          SyncAll(stream);
         }
-        else
+        double graphUs = ElapsedMs(start) * 1000.0 / numIterations;
+        double memMB = ((double)UsedDeviceMemory(nranks) - (double)memBefore) / (1 << 20);
+
+        // Memory held by the persistent plans of the graphs, over all communicators
+        uint64_t plans = 0, workBytes = 0, peerBuffers = 0;
+        for (int s = 0; s < numCommSets; s++)
         {
-          NCCL_CALL(ncclGroupStart());
-          for (int r = 0; r < nranks; ++r)
+          for (int r = 0; r < nranks; r++)
           {
-            HIP_CALL(hipSetDevice(r));
-            NCCL_CALL(ncclAllReduce(iputGpu[r], oputGpu[r], N, ncclInt, ncclSum, comm[r], stream[r]));
+            ncclCommStats_t stats;
+            stats.version = NCCL_COMM_STATS_VERSION;
+            NCCL_CALL(ncclCommGetStats(comms[s][r], &stats));
+            plans += stats.persistentPlans;
+            workBytes += stats.persistentWorkBytes;
+            peerBuffers += stats.registeredPeerBuffers;
           }
-          NCCL_CALL(ncclGroupEnd());
         }
 
-        for (int r = 0; r < nranks; r++)
-          HIP_CALL(hipStreamSynchronize(stream[r]));
-
-        auto cpuDelta = std::chrono::high_resolution_clock::now() - cpuStart;
-        double iterationTime = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(cpuDelta).count();
-
-        // Check result and reset
-        bool isCorrect = true;
-        for (int r = 0; r < nranks && isCorrect; r++)
+        if (checkResults && coll == AllReduce)
         {
-          HIP_CALL(hipMemcpy(oputCpu[r], oputGpu[r], N * sizeof(int), hipMemcpyDeviceToHost));
-          for (int i = 0; i < N; i++)
+          for (int r = 0; r < nranks; r++)
           {
-            if (oputCpu[r][i] != expected[i])
+            HIP_CALL(hipMemcpy(output.data(), recvbuf[r], N * sizeof(float), hipMemcpyDeviceToHost));
+            for (size_t i = 0; i < N; i++)
             {
-              isCorrect = false;
-              printf("ERROR: Expected: %d Output %d at Index %d\n", expected[i], oputCpu[r][i], i);
-              exit(1);
+              float expected = 0;
+              for (int q = 0; q < nranks; q++) expected += (float)((q * 235 + i) % 17);
+              if (output[i] != expected)
+              {
+                printf("ERROR: Expected: %f Output %f at Index %zu of rank %d\n", expected, output[i], i, r);
+                exit(1);
+              }
             }
           }
-          // Fill output with input for testing reasons
-          HIP_CALL(hipMemcpy(oputGpu[r], pattern, N * sizeof(int), hipMemcpyHostToDevice));
         }
 
-        if (iteration >= 0)
+        printf("%-14s %12zu %4d %5d %10.3f %10.3f %10.2f %10.2f %8.1f %6lu %10.1f %8lu %10.1f\n", collNames[coll],
+               N * sizeof(float), numOps, numCommSets, captureMs, instMs, eagerUs, graphUs,
+               100.0 * (eagerUs - graphUs) / eagerUs, plans, workBytes / 1024.0, peerBuffers, memMB);
+        fflush(stdout);
+
+        for (int r = 0; r < nranks; r++)
         {
-          printf("%12.3f", iterationTime); fflush(stdout);
-          average[usingGraphs] += iterationTime;
+          HIP_CALL(hipSetDevice(r));
+          HIP_CALL(hipGraphExecDestroy(graphExec[r]));
+          HIP_CALL(hipGraphDestroy(graphs[r]));
         }
       }
-      average[usingGraphs] /= numIterations;
-      printf("%12.3f", average[usingGraphs]);
-
-      for (int r = 0; r < nranks; r++)
-      {
-        HIP_CALL(hipSetDevice(r));
-        HIP_CALL(hipGraphDestroy(graphs[r]));
-        HIP_CALL(hipGraphExecDestroy(graphExec[r]));
-      }
     }
-    printf("%12.3f\n", average[0] / average[1]);
-    fflush(stdout);
+  }
+
+  for (int s = 0; s < numCommSets; s++)
+    for (int r = 0; r < nranks; r++)
+      NCCL_CALL(ncclCommDestroy(comms[s][r]));
+  for (int r = 0; r < nranks; r++)
+  {
+    HIP_CALL(hipSetDevice(r));
+    HIP_CALL(hipFree(sendbuf[r]));
+    HIP_CALL(hipFree(recvbuf[r]));
+    HIP_CALL(hipStreamDestroy(stream[r]));
   }
   return 0;
 }
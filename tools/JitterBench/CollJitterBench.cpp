@@ -0,0 +1,531 @@
+/*
+Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Multi-node collective jitter benchmark
+//
+// Runs a tight loop of small collectives over one GPU per MPI rank, across nodes, and records the
+// latency of every iteration (host time from the call to the end of hipStreamSynchronize). While it
+// runs, a sampler thread reads /proc/self/task/*/stat and status for the threads of the process (RCCL
+// proxy and service threads, HIP runtime threads and the main thread) and records each CPU migration
+// and involuntary context switch with its time. Iterations slower than OUTLIER_FACTOR times the median
+// of the rank are then matched against the events that happened while they ran, to tell outliers caused
+// by scheduling of the threads of the process from the ones that were not.
+// Background noise can be injected with spinning or memory streaming threads, on all or one rank.
+//
+// Rank 0 prints latency percentiles and a log2 histogram per rank and of the slowest rank of each
+// iteration (what a synchronous training step sees), the outlier attribution per rank and the worst
+// iterations. With OUTPUT_PREFIX, each rank also writes <prefix>.rank<N>.csv with the start time
+// (CLOCK_REALTIME ns, comparable across NTP synchronized nodes) and latency of every iteration and
+// <prefix>.rank<N>.events.csv with the scheduling events.
+//
+// Configuration comes from environment variables:
+// COLL             allreduce, allgather, broadcast or reducescatter                     (default allreduce)
+// BYTES            Bytes per rank                                                       (default 8)
+// NUM_ITERATIONS   Timed iterations                                                     (default 10000)
+// NUM_WARMUPS      Warmup iterations                                                    (default 100)
+// ITER_GAP_USEC    Host busy wait between iterations                                    (default 0)
+// SAMPLE_USEC      Sampling period of /proc, 0 disables the sampler                     (default 200)
+// OUTLIER_FACTOR   Outlier threshold as a multiple of the median latency of the rank    (default 2.0)
+// NOISE_THREADS    Background noise threads per rank                                    (default 0)
+// NOISE_MODE       cpu (spin) or mem (stream through 64MB)                              (default cpu)
+// NOISE_DUTY       Percentage of each noise period the noise threads are busy           (default 50)
+// NOISE_PERIOD_USEC Noise period                                                        (default 1000)
+// NOISE_CPUS       Comma separated CPUs the noise threads are pinned to, round robin    (default unpinned)
+// NOISE_RANK       Rank that runs noise threads, -1 for all ranks                       (default -1)
+// OUTPUT_PREFIX    Prefix of the per rank CSV files                                     (default none)
+// RCCL thread names are enabled (NCCL_SET_THREAD_NAME=1) unless set otherwise.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <mpi.h>
+#include <rccl/rccl.h>
+
+#include "Common.hpp"
+#include "Compatibility.hpp"
+
+#define NCCL_CALL(cmd)                                                                  \
+    do {                                                                                \
+        ncclResult_t res = (cmd);                                                       \
+        if (res != ncclSuccess)                                                         \
+        {                                                                               \
+            std::cout << "Encountered NCCL error (" << ncclGetErrorString(res)          \
+                      << ") at line " << __LINE__ << " in file " << __FILE__ << "\n";   \
+            MPI_Abort(MPI_COMM_WORLD, -1);                                              \
+        }                                                                               \
+    } while (0)
+
+#define LOAD(VAR)       __atomic_load_n((VAR),         __ATOMIC_ACQUIRE)
+#define STORE(DST, SRC) __atomic_store_n((DST), (SRC), __ATOMIC_RELEASE)
+
+enum
+{
+  EVENT_MIGRATION   = 0,
+  EVENT_INVOLUNTARY = 1
+};
+
+struct SchedEvent
+{
+  uint64_t timeNs;
+  int      tid;
+  int      type;
+  int      fromCpu;
+  int      toCpu;
+  long     count;
+  char     name[16];
+};
+
+struct ThreadSample
+{
+  int  cpu;
+  long nonVoluntary;
+};
+
+static uint64_t NowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void BusyWaitNs(uint64_t ns)
+{
+  uint64_t start = NowNs();
+  while (NowNs() - start < ns);
+}
+
+static std::vector<int> ListThreads()
+{
+  std::vector<int> tids;
+  DIR* dir = opendir("/proc/self/task");
+  if (!dir) return tids;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL)
+    if (entry->d_name[0] != '.') tids.push_back(atoi(entry->d_name));
+  closedir(dir);
+  return tids;
+}
+
+// Reads the name, last CPU and involuntary context switches of a thread of this process
+static bool ReadThread(int tid, char* name, ThreadSample& sample)
+{
+  char path[64], buff[1024];
+  sprintf(path, "/proc/self/task/%d/stat", tid);
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+  size_t len = fread(buff, 1, sizeof(buff)-1, f);
+  fclose(f);
+  buff[len] = '\0';
+
+  // The name is between parentheses and may contain spaces, fields after it start at field 3 (state)
+  char* open  = strchr(buff, '(');
+  char* close = strrchr(buff, ')');
+  if (!open || !close) return false;
+  int nameLen = std::min((int)(close - open - 1), 15);
+  memcpy(name, open + 1, nameLen);
+  name[nameLen] = '\0';
+  char* field = close + 2;
+  for (int i = 3; i < 39 && field; i++)
+  {
+    field = strchr(field, ' ');
+    if (field) field++;
+  }
+  if (!field) return false;
+  sample.cpu = atoi(field);
+
+  sprintf(path, "/proc/self/task/%d/status", tid);
+  f = fopen(path, "r");
+  if (!f) return false;
+  sample.nonVoluntary = 0;
+  while (fgets(buff, sizeof(buff), f))
+    if (sscanf(buff, "nonvoluntary_ctxt_switches: %ld", &sample.nonVoluntary) == 1) break;
+  fclose(f);
+  return true;
+}
+
+static void SamplerThread(int sampleUsec, bool* abort, std::vector<SchedEvent>* events)
+{
+  pthread_setname_np(pthread_self(), "JitterSampler");
+  std::map<int, ThreadSample> last;
+  std::vector<int> tids;
+  for (uint64_t n = 0; !LOAD(abort); n++)
+  {
+    // Threads are created at init, look for new ones only now and then
+    if (n % 1000 == 0) tids = ListThreads();
+    uint64_t now = NowNs();
+    for (int tid : tids)
+    {
+      SchedEvent ev;
+      ThreadSample sample;
+      if (!ReadThread(tid, ev.name, sample)) continue;
+      if (strncmp(ev.name, "Jitter", 6) == 0) continue;
+      auto it = last.find(tid);
+      if (it != last.end())
+      {
+        ev.timeNs  = now;
+        ev.tid     = tid;
+        ev.fromCpu = it->second.cpu;
+        ev.toCpu   = sample.cpu;
+        if (sample.cpu != it->second.cpu)
+        {
+          ev.type  = EVENT_MIGRATION;
+          ev.count = 1;
+          events->push_back(ev);
+        }
+        if (sample.nonVoluntary > it->second.nonVoluntary)
+        {
+          ev.type  = EVENT_INVOLUNTARY;
+          ev.count = sample.nonVoluntary - it->second.nonVoluntary;
+          events->push_back(ev);
+        }
+      }
+      last[tid] = sample;
+    }
+    usleep(sampleUsec);
+  }
+}
+
+static void NoiseThread(int cpu, int memMode, int duty, int periodUsec, bool* abort)
+{
+  pthread_setname_np(pthread_self(), "JitterNoise");
+  if (cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  std::vector<char> buffer(memMode ? 64 << 20 : 0);
+  size_t offset = 0;
+  uint64_t busyNs = (uint64_t)periodUsec * 10 * duty;
+  uint64_t idleNs = (uint64_t)periodUsec * 1000 - busyNs;
+  while (!LOAD(abort))
+  {
+    uint64_t start = NowNs();
+    while (NowNs() - start < busyNs)
+    {
+      if (memMode)
+      {
+        memset(buffer.data() + offset, (int)offset, 1 << 20);
+        offset = (offset + (1 << 20)) % buffer.size();
+      }
+    }
+    if (idleNs) usleep(idleNs / 1000);
+  }
+}
+
+static double Percentile(std::vector<double> const& sorted, double p)
+{
+  if (sorted.empty()) return 0;
+  size_t idx = std::min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()));
+  return sorted[idx];
+}
+
+static void PrintStats(char const* label, std::vector<double> latencies)
+{
+  std::sort(latencies.begin(), latencies.end());
+  printf("| %-12s | %9.2f | %9.2f | %9.2f | %9.2f | %9.2f | %9.2f |\n", label,
+         latencies.front(), Percentile(latencies, 50), Percentile(latencies, 90),
+         Percentile(latencies, 99), Percentile(latencies, 99.9), latencies.back());
+}
+
+// log2 histogram, bucket b holds [2^b, 2^(b+1)) usec
+static void PrintHistogram(char const* label, std::vector<double> const& latencies)
+{
+  std::vector<int> buckets(32, 0);
+  for (double l : latencies)
+    buckets[std::min(31, std::max(0, (int)std::floor(std::log2(std::max(l, 1.0)))))]++;
+  int maxCount = *std::max_element(buckets.begin(), buckets.end());
+  printf("Histogram of %s (usec)\n", label);
+  for (int b = 0; b < 32; b++)
+  {
+    if (buckets[b] == 0) continue;
+    printf("  [%8d, %8d) %8d ", 1 << b, 1 << (b + 1), buckets[b]);
+    int width = std::max(1, (int)(50.0 * buckets[b] / maxCount));
+    for (int i = 0; i < width; i++) printf("#");
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  MPI_Init(&argc, &argv);
+  int rank, numRanks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+
+  // One GPU per rank, by local rank on the node
+  MPI_Comm localComm;
+  int localRank;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &localComm);
+  MPI_Comm_rank(localComm, &localRank);
+  int numAvailableGpus;
+  HIP_CALL(hipGetDeviceCount(&numAvailableGpus));
+  if (localRank >= numAvailableGpus)
+  {
+    printf("[ERROR] Rank %d: node only has %d devices\n", rank, numAvailableGpus);
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+  HIP_CALL(hipSetDevice(localRank));
+
+  #define GETENV(STR, DEFAULT) (getenv(STR) ? atoi(getenv(STR)) : DEFAULT)
+  std::string coll      = getenv("COLL") ? getenv("COLL") : "allreduce";
+  size_t bytes          = getenv("BYTES") ? strtoull(getenv("BYTES"), NULL, 0) : 8;
+  int numIterations     = GETENV("NUM_ITERATIONS",  10000);
+  int numWarmups        = GETENV("NUM_WARMUPS",       100);
+  int iterGapUsec       = GETENV("ITER_GAP_USEC",       0);
+  int sampleUsec        = GETENV("SAMPLE_USEC",       200);
+  double outlierFactor  = getenv("OUTLIER_FACTOR") ? atof(getenv("OUTLIER_FACTOR")) : 2.0;
+  int numNoiseThreads   = GETENV("NOISE_THREADS",       0);
+  int noiseMem          = getenv("NOISE_MODE") && !strcmp(getenv("NOISE_MODE"), "mem");
+  int noiseDuty         = std::min(100, std::max(0, GETENV("NOISE_DUTY", 50)));
+  int noisePeriodUsec   = GETENV("NOISE_PERIOD_USEC", 1000);
+  int noiseRank         = GETENV("NOISE_RANK",         -1);
+  char const* outPrefix = getenv("OUTPUT_PREFIX");
+  setenv("NCCL_SET_THREAD_NAME", "1", 0);
+
+  std::vector<int> noiseCpus;
+  if (getenv("NOISE_CPUS"))
+  {
+    std::string s = getenv("NOISE_CPUS");
+    for (size_t pos = 0; pos < s.size(); )
+    {
+      size_t next = s.find(',', pos);
+      if (next == std::string::npos) next = s.size();
+      noiseCpus.push_back(atoi(s.substr(pos, next - pos).c_str()));
+      pos = next + 1;
+    }
+  }
+
+  size_t count = std::max(bytes / sizeof(float), (size_t)1);
+  size_t sendCount = count, recvCount = count;
+  if (coll == "allgather")          recvCount = count * numRanks;
+  else if (coll == "reducescatter") sendCount = count * numRanks;
+  else if (coll != "allreduce" && coll != "broadcast")
+  {
+    if (rank == 0) printf("[ERROR] Unsupported COLL %s\n", coll.c_str());
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+
+  if (rank == 0)
+  {
+    printf("Running %d ranks\n", numRanks);
+    printf("COLL           = %8s\n", coll.c_str());
+    printf("BYTES          = %8zu\n", count * sizeof(float));
+    printf("NUM_ITERATIONS = %8d\n", numIterations);
+    printf("NUM_WARMUPS    = %8d\n", numWarmups);
+    printf("ITER_GAP_USEC  = %8d\n", iterGapUsec);
+    printf("SAMPLE_USEC    = %8d\n", sampleUsec);
+    printf("OUTLIER_FACTOR = %8.2f\n", outlierFactor);
+    printf("NOISE_THREADS  = %8d (%s, %d%% of %d usec, rank %d)\n", numNoiseThreads, noiseMem ? "mem" : "cpu",
+           noiseDuty, noisePeriodUsec, noiseRank);
+  }
+
+  ncclUniqueId id;
+  if (rank == 0) NCCL_CALL(ncclGetUniqueId(&id));
+  MPI_Bcast(&id, sizeof(id), MPI_BYTE, 0, MPI_COMM_WORLD);
+  ncclComm_t comm;
+  NCCL_CALL(ncclCommInitRank(&comm, numRanks, id, rank));
+
+  float *sendBuff, *recvBuff;
+  hipStream_t stream;
+  HIP_CALL(hipMalloc((void**)&sendBuff, sendCount * sizeof(float)));
+  HIP_CALL(hipMalloc((void**)&recvBuff, recvCount * sizeof(float)));
+  HIP_CALL(hipMemset(sendBuff, 0, sendCount * sizeof(float)));
+  HIP_CALL(hipStreamCreate(&stream));
+
+  auto runColl = [&]()
+  {
+    if (coll == "allreduce")          NCCL_CALL(ncclAllReduce(sendBuff, recvBuff, count, ncclFloat, ncclSum, comm, stream));
+    else if (coll == "allgather")     NCCL_CALL(ncclAllGather(sendBuff, recvBuff, count, ncclFloat, comm, stream));
+    else if (coll == "broadcast")     NCCL_CALL(ncclBroadcast(sendBuff, recvBuff, count, ncclFloat, 0, comm, stream));
+    else                              NCCL_CALL(ncclReduceScatter(sendBuff, recvBuff, count, ncclFloat, ncclSum, comm, stream));
+  };
+
+  for (int i = 0; i < numWarmups; i++) runColl();
+  HIP_CALL(hipStreamSynchronize(stream));
+
+  // Start noise and sampler threads once RCCL threads exist
+  bool abortThreads = false;
+  std::vector<std::thread> noiseThreads;
+  if (noiseRank < 0 || noiseRank == rank)
+    for (int i = 0; i < numNoiseThreads; i++)
+      noiseThreads.push_back(std::thread(NoiseThread, noiseCpus.empty() ? -1 : noiseCpus[i % noiseCpus.size()],
+                                         noiseMem, noiseDuty, noisePeriodUsec, &abortThreads));
+  std::vector<SchedEvent> events;
+  events.reserve(1 << 20);
+  std::thread sampler;
+  if (sampleUsec > 0) sampler = std::thread(SamplerThread, sampleUsec, &abortThreads, &events);
+
+  std::vector<uint64_t> startTimes(numIterations);
+  std::vector<double>   latencies(numIterations);
+  MPI_Barrier(MPI_COMM_WORLD);
+  for (int iteration = 0; iteration < numIterations; iteration++)
+  {
+    uint64_t start = NowNs();
+    runColl();
+    HIP_CALL(hipStreamSynchronize(stream));
+    uint64_t stop = NowNs();
+    startTimes[iteration] = start;
+    latencies[iteration]  = (stop - start) / 1000.0;
+    if (iterGapUsec) BusyWaitNs((uint64_t)iterGapUsec * 1000);
+  }
+
+  STORE(&abortThreads, true);
+  for (auto& t : noiseThreads) t.join();
+  if (sampler.joinable()) sampler.join();
+
+  // Match outliers of this rank with the events seen while they ran. Events are sampled, so the window
+  // starts one sampling period before the iteration.
+  std::vector<double> sorted = latencies;
+  std::sort(sorted.begin(), sorted.end());
+  double threshold = outlierFactor * Percentile(sorted, 50);
+  std::vector<int> iterMigrations(numIterations, 0), iterInvoluntary(numIterations, 0);
+  size_t first = 0;
+  for (int iteration = 0; iteration < numIterations; iteration++)
+  {
+    uint64_t windowStart = startTimes[iteration] - (uint64_t)sampleUsec * 1000;
+    uint64_t windowStop  = startTimes[iteration] + (uint64_t)(latencies[iteration] * 1000);
+    while (first < events.size() && events[first].timeNs < windowStart) first++;
+    for (size_t e = first; e < events.size() && events[e].timeNs <= windowStop; e++)
+      (events[e].type == EVENT_MIGRATION ? iterMigrations : iterInvoluntary)[iteration] += events[e].count;
+  }
+  // outliers, with migrations, with involuntary switches, with either, with neither
+  int outlierStats[5] = {0, 0, 0, 0, 0};
+  for (int iteration = 0; iteration < numIterations; iteration++)
+  {
+    if (latencies[iteration] <= threshold) continue;
+    outlierStats[0]++;
+    if (iterMigrations[iteration])  outlierStats[1]++;
+    if (iterInvoluntary[iteration]) outlierStats[2]++;
+    if (iterMigrations[iteration] || iterInvoluntary[iteration]) outlierStats[3]++;
+    else outlierStats[4]++;
+  }
+
+  if (outPrefix)
+  {
+    char path[512];
+    sprintf(path, "%s.rank%d.csv", outPrefix, rank);
+    FILE* f = fopen(path, "w");
+    if (f)
+    {
+      fprintf(f, "iteration,startNs,latencyUs,outlier,migrations,involuntarySwitches\n");
+      for (int iteration = 0; iteration < numIterations; iteration++)
+        fprintf(f, "%d,%lu,%.3f,%d,%d,%d\n", iteration, startTimes[iteration], latencies[iteration],
+                latencies[iteration] > threshold, iterMigrations[iteration], iterInvoluntary[iteration]);
+      fclose(f);
+    }
+    sprintf(path, "%s.rank%d.events.csv", outPrefix, rank);
+    f = fopen(path, "w");
+    if (f)
+    {
+      fprintf(f, "timeNs,tid,thread,event,fromCpu,toCpu,count\n");
+      for (auto const& ev : events)
+        fprintf(f, "%lu,%d,%s,%s,%d,%d,%ld\n", ev.timeNs, ev.tid, ev.name,
+                ev.type == EVENT_MIGRATION ? "migration" : "involuntary", ev.fromCpu, ev.toCpu, ev.count);
+      fclose(f);
+    }
+  }
+
+  // Collect results on rank 0
+  std::vector<double> allLatencies(rank == 0 ? (size_t)numIterations * numRanks : 0);
+  std::vector<int>    allMigrations(rank == 0 ? (size_t)numIterations * numRanks : 0);
+  std::vector<int>    allInvoluntary(rank == 0 ? (size_t)numIterations * numRanks : 0);
+  std::vector<int>    allOutlierStats(rank == 0 ? 5 * numRanks : 0);
+  std::vector<char>   allHosts(rank == 0 ? 64 * numRanks : 0);
+  char host[64] = {};
+  gethostname(host, sizeof(host) - 1);
+  MPI_Gather(latencies.data(), numIterations, MPI_DOUBLE, allLatencies.data(), numIterations, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Gather(iterMigrations.data(), numIterations, MPI_INT, allMigrations.data(), numIterations, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Gather(iterInvoluntary.data(), numIterations, MPI_INT, allInvoluntary.data(), numIterations, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Gather(outlierStats, 5, MPI_INT, allOutlierStats.data(), 5, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Gather(host, 64, MPI_CHAR, allHosts.data(), 64, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+  if (rank == 0)
+  {
+    char label[32];
+    printf("===============================================================================\n");
+    printf("| Latency usec |       MIN |       P50 |       P90 |       P99 |     P99.9 |       MAX |\n");
+    printf("===============================================================================\n");
+    std::vector<double> slowest(numIterations, 0);
+    std::vector<int>    slowestRank(numIterations, 0);
+    for (int r = 0; r < numRanks; r++)
+    {
+      std::vector<double> rankLatencies(allLatencies.begin() + (size_t)r * numIterations,
+                                        allLatencies.begin() + (size_t)(r + 1) * numIterations);
+      sprintf(label, "Rank %d", r);
+      PrintStats(label, rankLatencies);
+      for (int iteration = 0; iteration < numIterations; iteration++)
+      {
+        if (rankLatencies[iteration] > slowest[iteration])
+        {
+          slowest[iteration]     = rankLatencies[iteration];
+          slowestRank[iteration] = r;
+        }
+      }
+    }
+    PrintStats("Slowest rank", slowest);
+    printf("===============================================================================\n");
+    PrintHistogram("slowest rank per iteration", slowest);
+
+    printf("Outliers (> %.2fx median of the rank) and scheduling events of the threads of the rank\n", outlierFactor);
+    printf("| Rank | Host                 | Outliers | Migration | Involuntary | Either | Neither |\n");
+    for (int r = 0; r < numRanks; r++)
+    {
+      int* s = allOutlierStats.data() + 5 * r;
+      printf("| %4d | %-20.20s | %8d | %9d | %11d | %6d | %7d |\n", r, allHosts.data() + 64 * r, s[0], s[1], s[2], s[3], s[4]);
+    }
+
+    std::vector<int> order(numIterations);
+    for (int i = 0; i < numIterations; i++) order[i] = i;
+    int numWorst = std::min(numIterations, 10);
+    std::partial_sort(order.begin(), order.begin() + numWorst, order.end(),
+                      [&](int a, int b) { return slowest[a] > slowest[b]; });
+    printf("Worst iterations\n");
+    printf("| Iteration | Latency usec | Slowest rank | Migrations | Involuntary switches |\n");
+    for (int i = 0; i < numWorst; i++)
+    {
+      int iteration = order[i];
+      size_t idx = (size_t)slowestRank[iteration] * numIterations + iteration;
+      printf("| %9d | %12.2f | %12d | %10d | %20d |\n", iteration, slowest[iteration], slowestRank[iteration],
+             allMigrations[idx], allInvoluntary[idx]);
+    }
+  }
+
+  NCCL_CALL(ncclCommDestroy(comm));
+  HIP_CALL(hipFree(sendBuff));
+  HIP_CALL(hipFree(recvBuff));
+  HIP_CALL(hipStreamDestroy(stream));
+  MPI_Comm_free(&localComm);
+  MPI_Finalize();
+  return 0;
+}
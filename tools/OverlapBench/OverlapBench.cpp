@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Compute/communication overlap benchmark
+//
+// Measures how much an allreduce running next to a cache-bound kernel slows that kernel down. One
+// process drives all GPUs of the node through ncclCommInitAll. On every GPU a compute kernel reads
+// the same working set over and over, sized to stay in L2 and MALL, first alone and then while
+// allreduces run on another stream. Reported per GPU: the compute kernel time alone and overlapped,
+// the slowdown, and the bus bandwidth of the overlapped allreduces. The stores of the SIMPLE protocol
+// evict the working set unless RCCL_SIMPLE_NT_STORES makes them non-temporal, so run once per value
+// to compare, e.g. RCCL_SIMPLE_NT_STORES=0 and RCCL_SIMPLE_NT_STORES=3.
+//
+// Configuration comes from environment variables:
+// OVERLAP_BYTES      Size of each allreduce                                 (default 256MB)
+// OVERLAP_WS_BYTES   Working set of the compute kernel                      (default 4MB)
+// OVERLAP_PASSES     Passes of the compute kernel over its working set      (default 2000)
+// OVERLAP_ALLREDUCES Allreduces launched next to the compute kernel         (default 20)
+// NCCL_PROTO is set to Simple unless already set.
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <hip/hip_runtime.h>
+#include <rccl/rccl.h>
+
+#define HIP_CALL(cmd)                                                 \
+  do {                                                                \
+    hipError_t error = (cmd);                                         \
+    if (error != hipSuccess)                                          \
+    {                                                                 \
+      std::cout << "Encountered HIP error (" << hipGetErrorString(error) << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";       \
+      exit(-1);                                                       \
+    }                                                                 \
+  } while (0)
+
+#define NCCL_CALL(cmd)                                                \
+  do {                                                                \
+    ncclResult_t error = (cmd);                                       \
+    if (error != ncclSuccess)                                         \
+    {                                                                 \
+      std::cout << "Encountered NCCL error (" << ncclGetErrorString(error) << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";       \
+      exit(-1);                                                       \
+    }                                                                 \
+  } while (0)
+
+static size_t GetEnvSize(char const* name, size_t defaultValue)
+{
+  char const* value = getenv(name);
+  return value ? strtoull(value, NULL, 0) : defaultValue;
+}
+
+// Every block walks the whole working set, so it is read from the caches after the first pass
+__global__ void CacheKernel(float4 const* ws, size_t count, int passes, float* out)
+{
+  float4 acc = make_float4(0, 0, 0, 0);
+  for (int p = 0; p < passes; p++)
+    for (size_t i = threadIdx.x; i < count; i += blockDim.x)
+    {
+      float4 v = ws[i];
+      acc.x += v.x; acc.y += v.y; acc.z += v.z; acc.w += v.w;
+    }
+  // Keeps the loads from being optimized out
+  if (acc.x + acc.y + acc.z + acc.w == -1.0f) out[blockIdx.x] = acc.x;
+}
+
+struct Device
+{
+  ncclComm_t comm;
+  hipStream_t commStream, computeStream;
+  hipEvent_t computeStart, computeStop, commStart, commStop;
+  float *sendBuf, *recvBuf, *out;
+  float4* ws;
+};
+
+int main(int argc, char** argv)
+{
+  size_t const bytes     = GetEnvSize("OVERLAP_BYTES", 256 << 20);
+  size_t const wsBytes   = GetEnvSize("OVERLAP_WS_BYTES", 4 << 20);
+  int    const passes    = GetEnvSize("OVERLAP_PASSES", 2000);
+  int    const numAllRed = GetEnvSize("OVERLAP_ALLREDUCES", 20);
+  setenv("NCCL_PROTO", "Simple", 0);
+
+  int numDevices;
+  HIP_CALL(hipGetDeviceCount(&numDevices));
+  int numBlocks;
+  {
+    hipDeviceProp_t prop;
+    HIP_CALL(hipGetDeviceProperties(&prop, 0));
+    numBlocks = prop.multiProcessorCount;
+  }
+  size_t const count = bytes / sizeof(float);
+  size_t const wsCount = wsBytes / sizeof(float4);
+
+  std::vector<ncclComm_t> comms(numDevices);
+  NCCL_CALL(ncclCommInitAll(comms.data(), numDevices, NULL));
+  std::vector<Device> devs(numDevices);
+  for (int d = 0; d < numDevices; d++)
+  {
+    Device& dev = devs[d];
+    dev.comm = comms[d];
+    HIP_CALL(hipSetDevice(d));
+    HIP_CALL(hipStreamCreateWithFlags(&dev.commStream, hipStreamNonBlocking));
+    HIP_CALL(hipStreamCreateWithFlags(&dev.computeStream, hipStreamNonBlocking));
+    HIP_CALL(hipEventCreate(&dev.computeStart));
+    HIP_CALL(hipEventCreate(&dev.computeStop));
+    HIP_CALL(hipEventCreate(&dev.commStart));
+    HIP_CALL(hipEventCreate(&dev.commStop));
+    HIP_CALL(hipMalloc((void**)&dev.sendBuf, bytes));
+    HIP_CALL(hipMalloc((void**)&dev.recvBuf, bytes));
+    HIP_CALL(hipMalloc((void**)&dev.out, numBlocks * sizeof(float)));
+    HIP_CALL(hipMalloc((void**)&dev.ws, wsCount * sizeof(float4)));
+    HIP_CALL(hipMemset(dev.sendBuf, 0, bytes));
+    HIP_CALL(hipMemset(dev.ws, 0, wsCount * sizeof(float4)));
+  }
+
+  auto launchCompute = [&](Device& dev) {
+    HIP_CALL(hipEventRecord(dev.computeStart, dev.computeStream));
+    hipLaunchKernelGGL(CacheKernel, dim3(numBlocks), dim3(256), 0, dev.computeStream, dev.ws, wsCount, passes, dev.out);
+    HIP_CALL(hipEventRecord(dev.computeStop, dev.computeStream));
+  };
+  auto syncAll = [&]() {
+    for (int d = 0; d < numDevices; d++)
+    {
+      HIP_CALL(hipSetDevice(d));
+      HIP_CALL(hipStreamSynchronize(devs[d].commStream));
+      HIP_CALL(hipStreamSynchronize(devs[d].computeStream));
+    }
+  };
+  auto allReduces = [&](int n) {
+    for (int d = 0; d < numDevices; d++)
+    {
+      HIP_CALL(hipSetDevice(d));
+      HIP_CALL(hipEventRecord(devs[d].commStart, devs[d].commStream));
+    }
+    for (int i = 0; i < n; i++)
+    {
+      NCCL_CALL(ncclGroupStart());
+      for (int d = 0; d < numDevices; d++)
+        NCCL_CALL(ncclAllReduce(devs[d].sendBuf, devs[d].recvBuf, count, ncclFloat, ncclSum, devs[d].comm, devs[d].commStream));
+      NCCL_CALL(ncclGroupEnd());
+    }
+    for (int d = 0; d < numDevices; d++)
+    {
+      HIP_CALL(hipSetDevice(d));
+      HIP_CALL(hipEventRecord(devs[d].commStop, devs[d].commStream));
+    }
+  };
+
+  // Warm up both kernels and the connections
+  allReduces(2);
+  for (int d = 0; d < numDevices; d++) { HIP_CALL(hipSetDevice(d)); launchCompute(devs[d]); }
+  syncAll();
+
+  std::vector<float> aloneMs(numDevices);
+  for (int d = 0; d < numDevices; d++) { HIP_CALL(hipSetDevice(d)); launchCompute(devs[d]); }
+  syncAll();
+  for (int d = 0; d < numDevices; d++) HIP_CALL(hipEventElapsedTime(&aloneMs[d], devs[d].computeStart, devs[d].computeStop));
+
+  // Queue the allreduces first so they are running when the compute kernel starts
+  allReduces(numAllRed);
+  for (int d = 0; d < numDevices; d++) { HIP_CALL(hipSetDevice(d)); launchCompute(devs[d]); }
+  syncAll();
+
+  char const* ntStores = getenv("RCCL_SIMPLE_NT_STORES");
+  printf("%d GPUs, %zu byte allreduces, %zu byte working set, RCCL_SIMPLE_NT_STORES=%s\n",
+         numDevices, bytes, wsBytes, ntStores ? ntStores : "0");
+  printf("%4s %14s %16s %10s %12s\n", "GPU", "alone (ms)", "overlapped (ms)", "slowdown", "busBw (GB/s)");
+  for (int d = 0; d < numDevices; d++)
+  {
+    float overlappedMs, commMs;
+    HIP_CALL(hipEventElapsedTime(&overlappedMs, devs[d].computeStart, devs[d].computeStop));
+    HIP_CALL(hipEventElapsedTime(&commMs, devs[d].commStart, devs[d].commStop));
+    double busBw = (double)bytes * numAllRed / commMs / 1.0E6 * 2.0 * (numDevices - 1) / numDevices;
+    printf("%4d %14.3f %16.3f %9.1f%% %12.2f\n", d, aloneMs[d], overlappedMs,
+           100.0 * (overlappedMs - aloneMs[d]) / aloneMs[d], busBw);
+  }
+
+  for (int d = 0; d < numDevices; d++)
+  {
+    Device& dev = devs[d];
+    HIP_CALL(hipSetDevice(d));
+    NCCL_CALL(ncclCommDestroy(dev.comm));
+    HIP_CALL(hipEventDestroy(dev.computeStart));
+    HIP_CALL(hipEventDestroy(dev.computeStop));
+    HIP_CALL(hipEventDestroy(dev.commStart));
+    HIP_CALL(hipEventDestroy(dev.commStop));
+    HIP_CALL(hipStreamDestroy(dev.commStream));
+    HIP_CALL(hipStreamDestroy(dev.computeStream));
+    HIP_CALL(hipFree(dev.sendBuf));
+    HIP_CALL(hipFree(dev.recvBuf));
+    HIP_CALL(hipFree(dev.out));
+    HIP_CALL(hipFree(dev.ws));
+  }
+  return 0;
+}
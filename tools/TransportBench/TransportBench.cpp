@@ -0,0 +1,291 @@
+/*
+Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Transport benchmark
+//
+// Runs concurrent copies between pairs of GPUs through RCCL's own transports, so transport changes can be
+// measured on the library itself rather than on raw HIP copies. Each link is a source and destination
+// device with its own 2-rank communicator and streams; all links of an iteration are issued as one
+// group of ncclSend/ncclRecv calls so they run concurrently. Reported per size:
+// - per-link bandwidth, from events on the streams of the link (slowest side)
+// - aggregate bandwidth, all bytes moved over the wall time of the iteration
+// - CPU cost, process CPU time (proxy threads included) as busy cores and as CPU time per GB moved
+//
+// Configuration comes from environment variables:
+// TRANSPORT_MODE       auto, p2p, shm or net: the transports are restricted with NCCL_P2P_DISABLE,
+//                      NCCL_SHM_DISABLE and NCCL_NET_DISABLE_INTRA before RCCL is initialized (default auto).
+//                      net goes through the ncclNet plugin selected by NCCL_NET (IB or Socket)
+// TRANSPORT_LINKS      ring (each device to the next), bidir (both directions of the ring), pairs (every
+//                      ordered pair of devices) or a list like 0>1,2>3                    (default ring)
+// TRANSPORT_MIN_BYTES  Smallest copy per link                                             (default 1KB)
+// TRANSPORT_MAX_BYTES  Largest copy per link                                              (default 256MB)
+// TRANSPORT_STEP       Size multiplier between steps                                      (default 4)
+// TRANSPORT_ITERS      Timed iterations                                                   (default 20)
+// TRANSPORT_WARMUPS    Warmup iterations                                                  (default 3)
+// Run with NCCL_DEBUG=INFO NCCL_DEBUG_SUBSYS=INIT to see the transport of each channel.
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <time.h>
+#include <hip/hip_runtime.h>
+#include <rccl/rccl.h>
+
+#define HIP_CALL(cmd)                                                 \
+  do {                                                                \
+    hipError_t error = (cmd);                                         \
+    if (error != hipSuccess)                                          \
+    {                                                                   \
+      std::cout << "Encountered HIP error (" << hipGetErrorString(error) << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";         \
+      exit(-1);                                                         \
+    }                                                                   \
+  } while (0)
+
+#define NCCL_CALL(cmd) \
+  do { \
+    ncclResult_t error = (cmd);                 \
+    if (error != ncclSuccess)                   \
+    {                                           \
+      std::cout << "Encountered NCCL error (" << ncclGetErrorString(error) << ") at line " \
+                << __LINE__ << " in file " << __FILE__ << "\n";         \
+      exit(-1);                                                         \
+    }                                                                   \
+  } while (0)
+
+struct Link
+{
+  int         dev[2];      // Source, destination
+  ncclComm_t  comm[2];
+  hipStream_t stream[2];
+  hipEvent_t  start[2];
+  hipEvent_t  stop[2];
+  char*       buf[2];
+  double      totalMs;     // Device time summed over the timed iterations
+};
+
+static size_t GetEnvSize(char const* name, size_t defaultValue)
+{
+  return getenv(name) ? strtoull(getenv(name), NULL, 0) : defaultValue;
+}
+
+static double CpuSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Restricts the transports RCCL may use, before any communicator reads its parameters
+static void SetTransportMode(std::string const& mode)
+{
+  if (mode == "p2p")
+  {
+    setenv("NCCL_SHM_DISABLE", "1", 1);
+    setenv("NCCL_NET_DISABLE_INTRA", "1", 1);
+  }
+  else if (mode == "shm")
+  {
+    setenv("NCCL_P2P_DISABLE", "1", 1);
+    setenv("NCCL_NET_DISABLE_INTRA", "1", 1);
+  }
+  else if (mode == "net")
+  {
+    setenv("NCCL_P2P_DISABLE", "1", 1);
+    setenv("NCCL_SHM_DISABLE", "1", 1);
+  }
+  else if (mode != "auto")
+  {
+    printf("Unknown TRANSPORT_MODE %s, expected auto, p2p, shm or net\n", mode.c_str());
+    exit(1);
+  }
+}
+
+static std::vector<std::pair<int, int>> ParseLinks(std::string const& spec, int numDevices)
+{
+  std::vector<std::pair<int, int>> links;
+  if (spec == "ring" || spec == "bidir")
+  {
+    for (int i = 0; i < numDevices; i++)
+    {
+      links.push_back(std::make_pair(i, (i + 1) % numDevices));
+      if (spec == "bidir" && numDevices > 2) links.push_back(std::make_pair((i + 1) % numDevices, i));
+    }
+  }
+  else if (spec == "pairs")
+  {
+    for (int i = 0; i < numDevices; i++)
+      for (int j = 0; j < numDevices; j++)
+        if (i != j) links.push_back(std::make_pair(i, j));
+  }
+  else
+  {
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+      int src, dst;
+      if (sscanf(item.c_str(), "%d>%d", &src, &dst) != 2 || src == dst ||
+          src < 0 || dst < 0 || src >= numDevices || dst >= numDevices)
+      {
+        printf("Invalid link %s in TRANSPORT_LINKS\n", item.c_str());
+        exit(1);
+      }
+      links.push_back(std::make_pair(src, dst));
+    }
+  }
+  return links;
+}
+
+// Issues one copy of the given size on every link, all in one group
+static void IssueCopies(std::vector<Link>& links, size_t bytes, bool timed)
+{
+  for (auto& link : links)
+    for (int side = 0; side < 2; side++)
+    {
+      HIP_CALL(hipSetDevice(link.dev[side]));
+      if (timed) HIP_CALL(hipEventRecord(link.start[side], link.stream[side]));
+    }
+  NCCL_CALL(ncclGroupStart());
+  for (auto& link : links)
+  {
+    HIP_CALL(hipSetDevice(link.dev[0]));
+    NCCL_CALL(ncclSend(link.buf[0], bytes, ncclChar, 1, link.comm[0], link.stream[0]));
+    HIP_CALL(hipSetDevice(link.dev[1]));
+    NCCL_CALL(ncclRecv(link.buf[1], bytes, ncclChar, 0, link.comm[1], link.stream[1]));
+  }
+  NCCL_CALL(ncclGroupEnd());
+  for (auto& link : links)
+    for (int side = 0; side < 2; side++)
+    {
+      HIP_CALL(hipSetDevice(link.dev[side]));
+      if (timed) HIP_CALL(hipEventRecord(link.stop[side], link.stream[side]));
+    }
+  for (auto& link : links)
+    for (int side = 0; side < 2; side++)
+    {
+      HIP_CALL(hipSetDevice(link.dev[side]));
+      HIP_CALL(hipStreamSynchronize(link.stream[side]));
+    }
+  if (!timed) return;
+  for (auto& link : links)
+  {
+    float ms[2];
+    for (int side = 0; side < 2; side++)
+      HIP_CALL(hipEventElapsedTime(&ms[side], link.start[side], link.stop[side]));
+    link.totalMs += std::max(ms[0], ms[1]);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int numDevices;
+  HIP_CALL(hipGetDeviceCount(&numDevices));
+  if (numDevices < 2)
+  {
+    printf("TransportBench needs at least 2 devices\n");
+    return 1;
+  }
+
+  std::string mode = getenv("TRANSPORT_MODE") ? getenv("TRANSPORT_MODE") : "auto";
+  std::string linkSpec = getenv("TRANSPORT_LINKS") ? getenv("TRANSPORT_LINKS") : "ring";
+  size_t minBytes      = GetEnvSize("TRANSPORT_MIN_BYTES", 1 << 10);
+  size_t maxBytes      = GetEnvSize("TRANSPORT_MAX_BYTES", 1 << 28);
+  size_t step          = std::max(GetEnvSize("TRANSPORT_STEP", 4), (size_t)2);
+  int    numIterations = GetEnvSize("TRANSPORT_ITERS", 20);
+  int    numWarmups    = GetEnvSize("TRANSPORT_WARMUPS", 3);
+
+  SetTransportMode(mode);
+  std::vector<std::pair<int, int>> pairs = ParseLinks(linkSpec, numDevices);
+
+  // One communicator per link
+  std::vector<Link> links(pairs.size());
+  for (size_t l = 0; l < links.size(); l++)
+  {
+    Link& link = links[l];
+    link.dev[0] = pairs[l].first;
+    link.dev[1] = pairs[l].second;
+    link.totalMs = 0;
+    NCCL_CALL(ncclCommInitAll(link.comm, 2, link.dev));
+  }
+  for (auto& link : links)
+    for (int side = 0; side < 2; side++)
+    {
+      HIP_CALL(hipSetDevice(link.dev[side]));
+      HIP_CALL(hipStreamCreate(&link.stream[side]));
+      HIP_CALL(hipEventCreate(&link.start[side]));
+      HIP_CALL(hipEventCreate(&link.stop[side]));
+      HIP_CALL(hipMalloc((void**)&link.buf[side], maxBytes));
+      HIP_CALL(hipMemset(link.buf[side], side, maxBytes));
+    }
+
+  printf("Transport mode %s, %zu links:", mode.c_str(), links.size());
+  for (auto& link : links) printf(" %d>%d", link.dev[0], link.dev[1]);
+  printf("\n");
+
+  printf("%12s", "Bytes");
+  for (auto& link : links)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "%d>%d GB/s", link.dev[0], link.dev[1]);
+    printf("%12s", name);
+  }
+  printf("%12s %10s %10s %10s\n", "Total GB/s", "WallUs", "CpuCores", "CpuUs/GB");
+
+  for (size_t bytes = minBytes; bytes <= maxBytes; bytes *= step)
+  {
+    for (int iteration = 0; iteration < numWarmups; iteration++) IssueCopies(links, bytes, false);
+
+    for (auto& link : links) link.totalMs = 0;
+    double cpuStart = CpuSeconds();
+    auto wallStart = std::chrono::high_resolution_clock::now();
+    for (int iteration = 0; iteration < numIterations; iteration++) IssueCopies(links, bytes, true);
+    double wallSec = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - wallStart).count();
+    double cpuSec = CpuSeconds() - cpuStart;
+
+    printf("%12zu", bytes);
+    for (auto& link : links)
+      printf("%12.2f", (double)bytes * numIterations / (link.totalMs * 1e-3) / 1e9);
+    double totalGB = (double)bytes * links.size() * numIterations / 1e9;
+    printf("%12.2f %10.1f %10.2f %10.1f\n", totalGB / wallSec, wallSec * 1e6 / numIterations,
+           cpuSec / wallSec, cpuSec * 1e6 / totalGB);
+    fflush(stdout);
+  }
+
+  for (auto& link : links)
+    for (int side = 0; side < 2; side++)
+    {
+      NCCL_CALL(ncclCommDestroy(link.comm[side]));
+      HIP_CALL(hipSetDevice(link.dev[side]));
+      HIP_CALL(hipFree(link.buf[side]));
+      HIP_CALL(hipEventDestroy(link.start[side]));
+      HIP_CALL(hipEventDestroy(link.stop[side]));
+      HIP_CALL(hipStreamDestroy(link.stream[side]));
+    }
+  return 0;
+}
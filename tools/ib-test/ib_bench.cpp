@@ -0,0 +1,448 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// ib_bench drives the RCCL IB net plugin (ncclNetIb) directly, without collectives:
+// windowed isend / irecv over several comms spread across several NICs, sweeping the
+// message size, and reports bandwidth, message rate and the host cost of posting
+// requests and of polling them to completion.
+//
+// Server : ib_bench [options]
+// Client : ib_bench -d <server ip> [options]
+//
+// The client decides the sweep (sizes, iterations, window, # of comms) and sends it to
+// the server over a TCP socket, which also carries the plugin connection handles.
+// Plugin settings are per side, and are applied through the usual environment
+// variables before the plugin is initialized (-q and -l set them for convenience).
+
+#include <hip/hip_runtime.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "nccl_net.h"
+
+// Defined in transport/net_ib.cc, reachable when linking the static RCCL library
+extern ncclNet_t ncclNetIb;
+
+#define NETCHECK(cmd)                                                   \
+  do {                                                                  \
+    ncclResult_t res = (cmd);                                           \
+    if (res != ncclSuccess) {                                           \
+      fprintf(stderr, "[ERROR] %s failed with %d (%s:%d)\n", #cmd, res, __FILE__, __LINE__); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+#define HIPCHECK(cmd)                                                   \
+  do {                                                                  \
+    hipError_t err = (cmd);                                             \
+    if (err != hipSuccess) {                                            \
+      fprintf(stderr, "[ERROR] %s failed with %s (%s:%d)\n", #cmd, hipGetErrorString(err), __FILE__, __LINE__); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+#define SYSCHECK(cond, what)                                            \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "[ERROR] %s failed: %s (%s:%d)\n", what, strerror(errno), __FILE__, __LINE__); \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+typedef std::chrono::steady_clock Clock;
+
+static inline double ElapsedNs(Clock::time_point const& start, Clock::time_point const& stop) {
+  return std::chrono::duration<double, std::nano>(stop - start).count();
+}
+
+// Sweep settings, sent from the client to the server
+struct BenchConfig {
+  uint64_t minBytes;
+  uint64_t maxBytes;
+  int      stepFactor;
+  int      iterations;   // Messages per comm and size
+  int      warmups;      // Warmup messages per comm and size
+  int      window;       // Requests in flight per comm
+  int      numComms;     // Total # of comms, spread round-robin over the NICs of each side
+};
+
+static void PluginLogger(ncclDebugLogLevel level, unsigned long flags, const char* file, int line, const char* fmt, ...) {
+  if (level > NCCL_LOG_WARN && getenv("IB_BENCH_VERBOSE") == NULL) return;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[NET/IB] ");
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+// Out-of-band TCP helpers
+static void SendAll(int fd, void const* data, size_t size) {
+  char const* ptr = (char const*)data;
+  while (size > 0) {
+    ssize_t n = send(fd, ptr, size, 0);
+    SYSCHECK(n > 0, "send");
+    ptr += n; size -= n;
+  }
+}
+
+static void RecvAll(int fd, void* data, size_t size) {
+  char* ptr = (char*)data;
+  while (size > 0) {
+    ssize_t n = recv(fd, ptr, size, 0);
+    SYSCHECK(n > 0, "recv");
+    ptr += n; size -= n;
+  }
+}
+
+static void Barrier(int fd) {
+  char token = 0;
+  SendAll(fd, &token, 1);
+  RecvAll(fd, &token, 1);
+}
+
+static int ServerSocket(uint16_t port) {
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  SYSCHECK(lfd >= 0, "socket");
+  int one = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port        = htons(port);
+  SYSCHECK(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == 0, "bind");
+  SYSCHECK(listen(lfd, 1) == 0, "listen");
+  printf("Waiting for client on port %d\n", port);
+  int fd = accept(lfd, NULL, NULL);
+  SYSCHECK(fd >= 0, "accept");
+  close(lfd);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static int ClientSocket(char const* ip, uint16_t port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  SYSCHECK(inet_pton(AF_INET, ip, &addr.sin_addr) == 1, "inet_pton");
+  int fd = -1;
+  for (int retry = 0; retry < 100; retry++) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    SYSCHECK(fd >= 0, "socket");
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) break;
+    close(fd);
+    fd = -1;
+    usleep(100000);
+  }
+  SYSCHECK(fd >= 0, "connect");
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// One plugin comm with its registered buffer and ring of in-flight requests
+struct BenchComm {
+  int    nic;
+  void*  comm;
+  void*  mhandle;
+  char*  buffer;          // window slots of maxBytes each
+  std::vector<void*> reqs;
+  std::vector<int>   flushing;
+  int    posted;
+  int    completed;
+};
+
+// Host side costs accumulated over one measured run
+struct BenchStats {
+  double postNs;
+  long   postCalls;
+  long   postRetries;     // Posts that returned a NULL request
+  double testNs;
+  long   testCalls;
+  double flushNs;
+  long   flushCalls;
+};
+
+// Keeps up to window requests in flight on each comm until count messages completed
+static void RunComms(std::vector<BenchComm>& comms, bool const isSender, bool const useGpu,
+                     int const size, int const count, int const window, uint64_t const slotBytes,
+                     BenchStats& stats) {
+  for (auto& c : comms) {
+    c.posted = c.completed = 0;
+    std::fill(c.reqs.begin(), c.reqs.end(), (void*)NULL);
+    std::fill(c.flushing.begin(), c.flushing.end(), 0);
+  }
+
+  int tag = 0;
+  int remaining = comms.size();
+  while (remaining > 0) {
+    for (auto& c : comms) {
+      if (c.completed == count) continue;
+
+      // Post as many requests as the window allows
+      while (c.posted < count && c.posted - c.completed < window) {
+        int const slot = c.posted % window;
+        void* data = c.buffer + slot * slotBytes;
+        int reqSize = size;
+        Clock::time_point const t0 = Clock::now();
+        if (isSender)
+          NETCHECK(ncclNetIb.isend(c.comm, data, size, tag, c.mhandle, &c.reqs[slot]));
+        else
+          NETCHECK(ncclNetIb.irecv(c.comm, 1, &data, &reqSize, &tag, &c.mhandle, &c.reqs[slot]));
+        stats.postNs += ElapsedNs(t0, Clock::now());
+        stats.postCalls++;
+        if (c.reqs[slot] == NULL) {
+          stats.postRetries++;
+          break;
+        }
+        c.posted++;
+      }
+
+      // Completions are consumed in order, as the RCCL proxy does
+      if (c.completed == c.posted) continue;
+      int const slot = c.completed % window;
+      int done = 0, doneSize = 0;
+      Clock::time_point const t0 = Clock::now();
+      NETCHECK(ncclNetIb.test(c.reqs[slot], &done, &doneSize));
+      double const ns = ElapsedNs(t0, Clock::now());
+      if (c.flushing[slot]) {
+        stats.flushNs += ns;
+      } else {
+        stats.testNs += ns;
+        stats.testCalls++;
+      }
+      if (!done) continue;
+
+      // Received data in GPU memory needs a flush before the GPU could consume it
+      if (!isSender && useGpu && !c.flushing[slot]) {
+        void* data = c.buffer + slot * slotBytes;
+        void* flushReq = NULL;
+        Clock::time_point const f0 = Clock::now();
+        NETCHECK(ncclNetIb.iflush(c.comm, 1, &data, &doneSize, &c.mhandle, &flushReq));
+        stats.flushNs += ElapsedNs(f0, Clock::now());
+        stats.flushCalls++;
+        if (flushReq != NULL) {
+          c.reqs[slot] = flushReq;
+          c.flushing[slot] = 1;
+          continue;
+        }
+      }
+      c.flushing[slot] = 0;
+      c.reqs[slot] = NULL;
+      if (++c.completed == count) remaining--;
+    }
+  }
+}
+
+static void PrintUsage(char const* name) {
+  printf("Usage: %s [-d <server ip>] [options]\n", name);
+  printf("  -d <ip>    Run as client, connecting to the server at <ip>\n");
+  printf("  -p <port>  TCP port of the out-of-band socket (23456)\n");
+  printf("  -n <list>  Comma separated IB devices (NICs) to use, as numbered by the plugin (0)\n");
+  printf("  -g <gpu>   GPU whose memory is used with -m gpu (0)\n");
+  printf("  -m <mem>   Buffer memory: gpu (GDR) or host (gpu)\n");
+  printf("  -q <qps>   QPs per connection [NCCL_IB_QPS_PER_CONNECTION]\n");
+  printf("  -l <bytes> Inline size of the QPs, host memory only [RCCL_IB_INLINE_SIZE]\n");
+  printf("Client only, the server follows the client:\n");
+  printf("  -c <n>     Comms per NIC of the client (1)\n");
+  printf("  -b <bytes> Minimum message size (8)\n");
+  printf("  -e <bytes> Maximum message size (4M)\n");
+  printf("  -f <n>     Size multiplication factor (2)\n");
+  printf("  -w <n>     Requests in flight per comm, up to %d (%d)\n", NCCL_NET_MAX_REQUESTS, NCCL_NET_MAX_REQUESTS);
+  printf("  -i <n>     Messages per comm and size (1000)\n");
+  printf("  -W <n>     Warmup messages per comm and size (100)\n");
+}
+
+static uint64_t ParseBytes(char const* str) {
+  char* end;
+  uint64_t val = strtoull(str, &end, 0);
+  switch (*end) {
+  case 'G': case 'g': val <<= 10; // fall through
+  case 'M': case 'm': val <<= 10; // fall through
+  case 'K': case 'k': val <<= 10;
+  }
+  return val;
+}
+
+int main(int argc, char** argv) {
+  char const* serverIp = NULL;
+  uint16_t    port     = 23456;
+  std::vector<int> nics;
+  int  gpu = 0;
+  bool useGpu = true;
+  int  commsPerNic = 1;
+
+  BenchConfig config;
+  config.minBytes   = 8;
+  config.maxBytes   = 4 << 20;
+  config.stepFactor = 2;
+  config.iterations = 1000;
+  config.warmups    = 100;
+  config.window     = NCCL_NET_MAX_REQUESTS;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:p:n:g:m:q:l:c:b:e:f:w:i:W:h")) != -1) {
+    switch (opt) {
+    case 'd': serverIp = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'n': {
+      std::string list(optarg);
+      size_t pos = 0;
+      while (pos != std::string::npos) {
+        size_t next = list.find(',', pos);
+        nics.push_back(atoi(list.substr(pos, next - pos).c_str()));
+        pos = (next == std::string::npos) ? next : next + 1;
+      }
+      break;
+    }
+    case 'g': gpu = atoi(optarg); break;
+    case 'm': useGpu = strcmp(optarg, "host") != 0; break;
+    case 'q': setenv("NCCL_IB_QPS_PER_CONNECTION", optarg, 1); break;
+    case 'l': setenv("RCCL_IB_INLINE_SIZE", optarg, 1); break;
+    case 'c': commsPerNic = atoi(optarg); break;
+    case 'b': config.minBytes = ParseBytes(optarg); break;
+    case 'e': config.maxBytes = ParseBytes(optarg); break;
+    case 'f': config.stepFactor = atoi(optarg); break;
+    case 'w': config.window = atoi(optarg); break;
+    case 'i': config.iterations = atoi(optarg); break;
+    case 'W': config.warmups = atoi(optarg); break;
+    default:
+      PrintUsage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (nics.empty()) nics.push_back(0);
+  config.numComms = commsPerNic * nics.size();
+  if (config.window < 1 || config.window > NCCL_NET_MAX_REQUESTS || config.stepFactor < 2 ||
+      config.minBytes < 1 || config.minBytes > config.maxBytes ||
+      config.maxBytes * config.window > (1ULL << 31) - 1) {
+    printf("[ERROR] Invalid window or size range (window * max size must stay below 2GB)\n");
+    return 1;
+  }
+
+  bool const isSender = (serverIp != NULL);
+  int const fd = isSender ? ClientSocket(serverIp, port) : ServerSocket(port);
+  if (isSender) SendAll(fd, &config, sizeof(config));
+  else          RecvAll(fd, &config, sizeof(config));
+
+  // Environment variables have to be in place before the plugin reads its parameters
+  NETCHECK(ncclNetIb.init(PluginLogger));
+  int numDevs;
+  NETCHECK(ncclNetIb.devices(&numDevs));
+  for (int nic : nics) {
+    if (nic < 0 || nic >= numDevs) {
+      printf("[ERROR] IB device %d not available (%d found)\n", nic, numDevs);
+      return 1;
+    }
+    ncclNetProperties_t props;
+    NETCHECK(ncclNetIb.getProperties(nic, &props));
+    printf("NIC %d: %s port %d, %d Mbps, GDR %s\n", nic, props.name, props.port, props.speed,
+           (props.ptrSupport & NCCL_PTR_CUDA) ? "supported" : "not supported");
+    if (useGpu && !(props.ptrSupport & NCCL_PTR_CUDA)) {
+      printf("[ERROR] GPU memory requested but NIC %d does not support GDR, use -m host\n", nic);
+      return 1;
+    }
+  }
+  printf("%s: %d comms over %zu NIC(s), %s memory, QPs/conn %s, inline size %s\n",
+         isSender ? "Client" : "Server", config.numComms, nics.size(), useGpu ? "GPU" : "host",
+         getenv("NCCL_IB_QPS_PER_CONNECTION") ? getenv("NCCL_IB_QPS_PER_CONNECTION") : "default",
+         getenv("RCCL_IB_INLINE_SIZE") ? getenv("RCCL_IB_INLINE_SIZE") : "default");
+
+  // Establish the comms, the server listens and passes its handles to the client
+  std::vector<BenchComm> comms(config.numComms);
+  std::vector<char> handles(config.numComms * NCCL_NET_HANDLE_MAXSIZE);
+  std::vector<void*> listenComms(config.numComms, NULL);
+  for (int i = 0; i < config.numComms; i++) {
+    comms[i].nic  = nics[i % nics.size()];
+    comms[i].comm = NULL;
+    if (!isSender) NETCHECK(ncclNetIb.listen(comms[i].nic, &handles[i * NCCL_NET_HANDLE_MAXSIZE], &listenComms[i]));
+  }
+  if (isSender) RecvAll(fd, handles.data(), handles.size());
+  else          SendAll(fd, handles.data(), handles.size());
+
+  for (int connected = 0; connected < config.numComms; ) {
+    for (int i = 0; i < config.numComms; i++) {
+      if (comms[i].comm != NULL) continue;
+      if (isSender) NETCHECK(ncclNetIb.connect(comms[i].nic, &handles[i * NCCL_NET_HANDLE_MAXSIZE], &comms[i].comm));
+      else          NETCHECK(ncclNetIb.accept(listenComms[i], &comms[i].comm));
+      if (comms[i].comm != NULL) connected++;
+    }
+  }
+  if (!isSender) for (auto lc : listenComms) NETCHECK(ncclNetIb.closeListen(lc));
+
+  // One slot of the largest size per request in flight
+  uint64_t const slotBytes   = config.maxBytes;
+  uint64_t const bufferBytes = slotBytes * config.window;
+  if (useGpu) HIPCHECK(hipSetDevice(gpu));
+  for (auto& c : comms) {
+    if (useGpu) HIPCHECK(hipMalloc((void**)&c.buffer, bufferBytes));
+    else        HIPCHECK(hipHostMalloc((void**)&c.buffer, bufferBytes));
+    NETCHECK(ncclNetIb.regMr(c.comm, c.buffer, bufferBytes, useGpu ? NCCL_PTR_CUDA : NCCL_PTR_HOST, &c.mhandle));
+    c.reqs.resize(config.window);
+    c.flushing.resize(config.window);
+  }
+
+  printf("%12s %10s %10s %10s %10s %10s %10s %10s", "Bytes", "GB/s", "Mmsg/s", "usec/msg",
+         "Post ns", "Test ns", "Tests/msg", "Retry %");
+  if (!isSender && useGpu) printf(" %10s", "Flush ns");
+  if (nics.size() > 1) for (int nic : nics) printf("  NIC%-2d GB/s", nic);
+  printf("\n");
+
+  for (uint64_t size = config.minBytes; size <= config.maxBytes; size *= config.stepFactor) {
+    BenchStats stats;
+    memset(&stats, 0, sizeof(stats));
+    Barrier(fd);
+    RunComms(comms, isSender, useGpu, size, config.warmups, config.window, slotBytes, stats);
+
+    memset(&stats, 0, sizeof(stats));
+    Barrier(fd);
+    Clock::time_point const start = Clock::now();
+    RunComms(comms, isSender, useGpu, size, config.iterations, config.window, slotBytes, stats);
+    double const elapsedNs = ElapsedNs(start, Clock::now());
+
+    long   const numMsgs = (long)config.iterations * config.numComms;
+    double const gbps    = (double)size * numMsgs / elapsedNs;
+    printf("%12lu %10.2f %10.3f %10.2f %10.1f %10.1f %10.2f %10.2f", size, gbps, numMsgs / elapsedNs * 1.0E3,
+           elapsedNs / 1.0E3 / config.iterations,
+           stats.postCalls ? stats.postNs / stats.postCalls : 0.0,
+           stats.testCalls ? stats.testNs / stats.testCalls : 0.0,
+           (double)stats.testCalls / numMsgs,
+           stats.postCalls ? 100.0 * stats.postRetries / stats.postCalls : 0.0);
+    if (!isSender && useGpu) printf(" %10.1f", stats.flushCalls ? stats.flushNs / stats.flushCalls : 0.0);
+    if (nics.size() > 1) {
+      // All comms run concurrently, so each NIC gets its share of the same elapsed time
+      for (int nic : nics) {
+        long nicMsgs = 0;
+        for (auto const& c : comms) if (c.nic == nic) nicMsgs += c.completed;
+        printf(" %11.2f", (double)size * nicMsgs / elapsedNs);
+      }
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  Barrier(fd);
+
+  for (auto& c : comms) {
+    NETCHECK(ncclNetIb.deregMr(c.comm, c.mhandle));
+    if (isSender) NETCHECK(ncclNetIb.closeSend(c.comm));
+    else          NETCHECK(ncclNetIb.closeRecv(c.comm));
+    if (useGpu) HIPCHECK(hipFree(c.buffer));
+    else        HIPCHECK(hipHostFree(c.buffer));
+  }
+  close(fd);
+  return 0;
+}
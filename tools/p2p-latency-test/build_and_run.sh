@@ -16,6 +16,12 @@ echo Running p2p_latency_test using GPU pair 1 0
 
 sleep 1
 
+echo Running p2p_latency_test using GPU pair 0 1 with a word written 64 and 128 bytes after the flag
+./p2p_latency_test 0 1 64
+./p2p_latency_test 0 1 128
+
+sleep 1
+
 echo Running ll_latency_test using GPU pair 0 1
 ./ll_latency_test 0 1
 
@@ -23,3 +29,13 @@ sleep 1
 
 echo Running ll_latency_test using GPU pair 1 0
 ./ll_latency_test 1 0
+
+sleep 1
+
+echo Running p2p_grain_bench using GPU pair 0 1
+./p2p_grain_bench 0 1
+
+sleep 1
+
+echo Running p2p_matrix_test over all GPU pairs, protocols and P2P read/write
+LD_LIBRARY_PATH=../../build/release ./p2p_matrix_test -o p2p_matrix.csv
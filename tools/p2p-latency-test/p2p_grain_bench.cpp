@@ -0,0 +1,188 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ * Licensed under the MIT License.
+ ************************************************************************/
+
+// Fine- vs coarse-grained FIFO memory for the SIMPLE protocol.
+//
+// Moves data between two devices the way a P2P connection of RCCL does: each
+// block owns a FIFO of NSTEPS steps, the producer fills a step and posts a
+// tail flag, the consumer waits for it, reads the step and posts a head flag
+// that returns the credit. Flags always live in fine-grained (uncached on
+// gfx94x) memory, the FIFO in fine-grained memory as by default or in
+// coarse-grained memory as with RCCL_P2P_COARSE_SIMPLE=1, with the same fences
+// as prims_simple.h uses for it. With P2P write the FIFO is on the consumer,
+// with P2P read (NCCL_P2P_READ_ENABLE) on the producer.
+//
+// The consumer checks every element, so a configuration reporting errors sees
+// stale data through the fences and must not be used on this platform. Coarse-
+// grained FIFOs are worth enabling when they report no errors and a higher
+// bandwidth than fine-grained ones, in both modes the platform uses.
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <hip/hip_runtime.h>
+#include <hip/hip_ext.h>
+#include <iostream> //cerr
+
+#define NSTEPS 8
+#define NTHREADS 256
+
+#define HIPCHECK(cmd)                                                          \
+do {                                                                           \
+  hipError_t error = (cmd);                                                    \
+  if (error != hipSuccess)                                                     \
+  {                                                                            \
+    std::cerr << "Encountered HIP error (" << error << ") at line "            \
+              << __LINE__ << " in file " << __FILE__ << "\n";                  \
+    exit(-1);                                                                  \
+  }                                                                            \
+} while (0)
+
+__device__ __forceinline__ uint64_t Pattern(uint64_t step, uint64_t i) {
+  return (step << 40) ^ (i * 0x9E3779B97F4A7C15ull);
+}
+
+__device__ __forceinline__ void WaitFlag(uint64_t* flag, uint64_t value) {
+  while (__atomic_load_n(flag, __ATOMIC_RELAXED) < value) __builtin_amdgcn_s_sleep(1);
+}
+
+// Each block has its own head flag on the producer and tail flag on the consumer, a cache line apart
+__global__ void ProducerKernel(uint64_t* fifo, uint64_t* head, uint64_t* tail, size_t stepElems, int nIters, int coarse) {
+  fifo += blockIdx.x * NSTEPS * stepElems;
+  head += blockIdx.x * 8;
+  tail += blockIdx.x * 8;
+  for (int step = 0; step < nIters; step++) {
+    if (threadIdx.x == 0 && step >= NSTEPS) WaitFlag(head, step - NSTEPS + 1);
+    __syncthreads();
+    uint64_t* buff = fifo + (step % NSTEPS) * stepElems;
+    for (size_t i = threadIdx.x; i < stepElems; i += NTHREADS) buff[i] = Pattern(step, i);
+    __syncthreads();
+    if (threadIdx.x == 0) {
+      if (coarse)
+        __builtin_amdgcn_fence(__ATOMIC_RELEASE, "");
+      else
+#ifdef __GFX9__
+        __builtin_amdgcn_buffer_wbinvl1();
+#else
+        __threadfence_system();
+#endif
+      __atomic_store_n(tail, step + 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+__global__ void ConsumerKernel(uint64_t* fifo, uint64_t* head, uint64_t* tail, size_t stepElems, int nIters, int coarse, unsigned long long* errors) {
+  fifo += blockIdx.x * NSTEPS * stepElems;
+  head += blockIdx.x * 8;
+  tail += blockIdx.x * 8;
+  unsigned long long nErrors = 0;
+  for (int step = 0; step < nIters; step++) {
+    if (threadIdx.x == 0) {
+      WaitFlag(tail, step + 1);
+      if (coarse) __builtin_amdgcn_fence(__ATOMIC_ACQUIRE, "");
+    }
+    __syncthreads();
+    uint64_t* buff = fifo + (step % NSTEPS) * stepElems;
+    for (size_t i = threadIdx.x; i < stepElems; i += NTHREADS) nErrors += (buff[i] != Pattern(step, i));
+    __syncthreads();
+    if (threadIdx.x == 0) __atomic_store_n(head, step + 1, __ATOMIC_RELAXED);
+  }
+  if (nErrors) atomicAdd(errors, nErrors);
+}
+
+static void* AllocFlags(int dev, size_t size) {
+  hipDeviceProp_t prop;
+  void* ptr;
+  HIPCHECK(hipSetDevice(dev));
+  HIPCHECK(hipGetDeviceProperties(&prop, dev));
+  HIPCHECK(hipExtMallocWithFlags(&ptr, size, prop.gcnArch / 10 == 94 ? hipDeviceMallocUncached : hipDeviceMallocFinegrained));
+  HIPCHECK(hipMemset(ptr, 0, size));
+  return ptr;
+}
+
+static void* AllocFifo(int dev, size_t size, int coarse) {
+  void* ptr;
+  HIPCHECK(hipSetDevice(dev));
+  if (coarse) HIPCHECK(hipMalloc(&ptr, size));
+  else HIPCHECK(hipExtMallocWithFlags(&ptr, size, hipDeviceMallocFinegrained));
+  HIPCHECK(hipMemset(ptr, 0, size));
+  return ptr;
+}
+
+// Returns the bandwidth in GB/s, and the number of elements read with a wrong value
+static double Run(int src, int dst, int read, int coarse, size_t stepBytes, int nBlocks, int nIters, unsigned long long* nErrors) {
+  size_t stepElems = stepBytes / sizeof(uint64_t);
+  size_t fifoBytes = nBlocks * NSTEPS * stepElems * sizeof(uint64_t);
+  uint64_t* fifo = (uint64_t*)AllocFifo(read ? src : dst, fifoBytes, coarse);
+  uint64_t* head = (uint64_t*)AllocFlags(src, nBlocks * 64);
+  uint64_t* tail = (uint64_t*)AllocFlags(dst, nBlocks * 64);
+  unsigned long long* errors;
+  hipStream_t streams[2];
+  HIPCHECK(hipSetDevice(dst));
+  HIPCHECK(hipMalloc((void**)&errors, sizeof(*errors)));
+  HIPCHECK(hipMemset(errors, 0, sizeof(*errors)));
+  HIPCHECK(hipStreamCreateWithFlags(&streams[1], hipStreamNonBlocking));
+  HIPCHECK(hipSetDevice(src));
+  HIPCHECK(hipStreamCreateWithFlags(&streams[0], hipStreamNonBlocking));
+
+  auto start = std::chrono::steady_clock::now();
+  HIPCHECK(hipSetDevice(dst));
+  hipLaunchKernelGGL(ConsumerKernel, dim3(nBlocks), dim3(NTHREADS), 0, streams[1], fifo, head, tail, stepElems, nIters, coarse, errors);
+  HIPCHECK(hipGetLastError());
+  HIPCHECK(hipSetDevice(src));
+  hipLaunchKernelGGL(ProducerKernel, dim3(nBlocks), dim3(NTHREADS), 0, streams[0], fifo, head, tail, stepElems, nIters, coarse);
+  HIPCHECK(hipGetLastError());
+  HIPCHECK(hipStreamSynchronize(streams[0]));
+  HIPCHECK(hipStreamSynchronize(streams[1]));
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  HIPCHECK(hipMemcpy(nErrors, errors, sizeof(*errors), hipMemcpyDeviceToHost));
+  HIPCHECK(hipFree(errors));
+  HIPCHECK(hipFree(fifo));
+  HIPCHECK(hipFree(head));
+  HIPCHECK(hipFree(tail));
+  HIPCHECK(hipStreamDestroy(streams[0]));
+  HIPCHECK(hipStreamDestroy(streams[1]));
+  return (double)nBlocks * nIters * stepBytes / us / 1.0E3;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3 || argc > 6) {
+    fprintf(stderr, "Usage: ./p2p_grain_bench src_dev_id dst_dev_id [step_bytes] [blocks] [iterations]\n");
+    return -1;
+  }
+  int src = atoi(argv[1]);
+  int dst = atoi(argv[2]);
+  // Default to the steps of the default 4MB SIMPLE buffer
+  size_t stepBytes = argc > 3 ? strtoull(argv[3], NULL, 0) : (4 << 20) / NSTEPS;
+  int nBlocks = argc > 4 ? atoi(argv[4]) : 16;
+  int nIters = argc > 5 ? atoi(argv[5]) : 1000;
+  stepBytes = (stepBytes + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+
+  HIPCHECK(hipSetDevice(src));
+  HIPCHECK(hipDeviceEnablePeerAccess(dst, 0));
+  HIPCHECK(hipSetDevice(dst));
+  HIPCHECK(hipDeviceEnablePeerAccess(src, 0));
+
+  fprintf(stdout, "Devices %d -> %d, %d blocks, %zu bytes per step, %d steps per block\n", src, dst, nBlocks, stepBytes, nIters);
+  fprintf(stdout, "%-10s %-8s %10s %10s\n", "P2P", "FIFO", "GB/s", "errors");
+  bool coarseOk = true, coarseFaster = true;
+  for (int read = 0; read < 2; read++) {
+    double bw[2];
+    for (int coarse = 0; coarse < 2; coarse++) {
+      unsigned long long nErrors;
+      // Warm up with a few steps, then measure
+      Run(src, dst, read, coarse, stepBytes, nBlocks, 2*NSTEPS, &nErrors);
+      bw[coarse] = Run(src, dst, read, coarse, stepBytes, nBlocks, nIters, &nErrors);
+      fprintf(stdout, "%-10s %-8s %10.2f %10llu\n", read ? "read" : "write", coarse ? "coarse" : "fine", bw[coarse], nErrors);
+      if (coarse && nErrors) coarseOk = false;
+    }
+    if (bw[1] <= bw[0]) coarseFaster = false;
+  }
+  fprintf(stdout, "RCCL_P2P_COARSE_SIMPLE=%d recommended for this pair (%s)\n", coarseOk && coarseFaster ? 1 : 0,
+          !coarseOk ? "coarse-grained FIFOs read stale data" :
+          !coarseFaster ? "coarse-grained FIFOs are not faster" : "coarse-grained FIFOs are correct and faster");
+  return coarseOk ? 0 : 1;
+}
@@ -53,6 +53,14 @@ __global__ void PongKernel(uint64_t* local_flag, uint64_t* remote_flag, uint64_t
   *time_delta = end_time - start_time;
 }
 
+// Keeps writing a word `offset` bytes after the flag polled by the ping kernel, as the proxy or a
+// peer GPU writes the fields next to a connection counter, until the last round trip is done.
+__global__ void NeighborKernel(uint64_t* local_flag, uint64_t* neighbor) {
+  uint64_t n = 0;
+  while (__atomic_load_n(local_flag, __ATOMIC_RELAXED) < NUM_LOOPS_WARMUP + NUM_LOOPS_RUN)
+    __atomic_store_n(neighbor, ++n, __ATOMIC_RELAXED);
+}
+
 #define HIPCHECK(cmd)                                                          \
 do {                                                                           \
   hipError_t error = (cmd);                                                    \
@@ -65,19 +73,23 @@ do {                                                                           \
 } while (0)
 
 int main(int argc, char** argv) {
-  hipStream_t stream[2];
+  hipStream_t stream[2], neighborStream;
   hipError_t err = hipSuccess;
   int device_id[2];
   hipDeviceProp_t prop[2];
 
-  if (argc != 3) {
-    fprintf(stderr, "Usage: ./p2p_latency_test ping_dev_id pong_dev_id\n");
+  if (argc != 3 && argc != 4) {
+    fprintf(stderr, "Usage: ./p2p_latency_test ping_dev_id pong_dev_id [neighbor_offset]\n");
     return -1;
   }
   device_id[0] = atoi(argv[1]);
   device_id[1] = atoi(argv[2]);
+  // Bytes between the polled flag and a word written concurrently, 0 for none. Offsets within
+  // a cache line show the cost of false sharing, e.g. 64 against 128 for the GPU L2 line.
+  size_t neighbor_offset = argc > 3 ? strtoull(argv[3], NULL, 0) / sizeof(uint64_t) * sizeof(uint64_t) : 0;
 
   fprintf(stdout, "Using devices %d %d\n", device_id[0], device_id[1]);
+  if (neighbor_offset) fprintf(stdout, "Writing a neighbor word %zu bytes after the flag\n", neighbor_offset);
 
   uint64_t *flag[2];
   uint64_t *time_delta[2];
@@ -101,6 +113,10 @@ int main(int argc, char** argv) {
   HIPCHECK(hipStreamSynchronize(stream[1]));
 
   HIPCHECK(hipSetDevice(device_id[0]));
+  if (neighbor_offset) {
+    HIPCHECK(hipStreamCreateWithFlags(&neighborStream, hipStreamNonBlocking));
+    NeighborKernel<<<1, 1, 0, neighborStream>>>(flag[0], flag[0] + neighbor_offset / sizeof(uint64_t));
+  }
   PingKernel<<<1, 1, 0, stream[0]>>>(flag[0], flag[1], time_delta[0]);
 
   HIPCHECK(hipSetDevice(device_id[1]));
@@ -116,6 +132,11 @@ int main(int argc, char** argv) {
   vega_gpu_rtc_freq = (prop[1].gcnArch / 10 == 94) ? 1.0E8 : 2.5E7;
   fprintf(stdout, "One-way latency in us: %g\n", double(*time_delta[1]) * 1e6 / NUM_LOOPS_RUN / vega_gpu_rtc_freq / 2);
 
+  if (neighbor_offset) {
+    HIPCHECK(hipSetDevice(device_id[0]));
+    HIPCHECK(hipStreamSynchronize(neighborStream));
+    HIPCHECK(hipStreamDestroy(neighborStream));
+  }
   HIPCHECK(hipFree(flag[0]));
   HIPCHECK(hipFree(time_delta[0]));
   HIPCHECK(hipFree(flag[1]));
@@ -0,0 +1,373 @@
+/*************************************************************************
+ * Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+ * Licensed under the MIT License.
+ ************************************************************************/
+
+// All-pairs latency and bandwidth sweep through RCCL.
+//
+// p2p_latency_test and ll_latency_test measure flag round trips between two
+// devices with hand written kernels. This test measures every ordered pair of
+// devices with the library itself: for each pair a 2-rank communicator runs a
+// broadcast from the first device to the second, which moves data over the one
+// ring connection between them. Each configuration of protocol (NCCL_PROTO
+// Simple, LL, LL128) and P2P read or write (NCCL_P2P_READ_ENABLE, only Simple
+// uses reads) runs in its own child process, since RCCL reads these once per
+// process. Reported per configuration:
+// - one-way latency matrix (us) for a small broadcast, host timed, launch included
+// - bandwidth matrix (GB/s) for a large broadcast
+// Pairs slower than the median of the pairs with the same link type and hop
+// count by more than the tolerance are flagged, to catch degraded xGMI links.
+// With -o the results are written as CSV, and -c compares with such a file
+// from another run or node.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <hip/hip_runtime.h>
+#include <hip/hip_ext.h>
+#include <rccl/rccl.h>
+#include <iostream> //cerr
+
+#define HIPCHECK(cmd)                                                          \
+do {                                                                           \
+  hipError_t error = (cmd);                                                    \
+  if (error != hipSuccess)                                                     \
+  {                                                                            \
+    std::cerr << "Encountered HIP error (" << error << ") at line "            \
+              << __LINE__ << " in file " << __FILE__ << "\n";                  \
+    exit(-1);                                                                  \
+  }                                                                            \
+} while (0)
+
+#define NCCLCHECK(cmd)                                                         \
+do {                                                                           \
+  ncclResult_t res = (cmd);                                                    \
+  if (res != ncclSuccess)                                                      \
+  {                                                                            \
+    std::cerr << "Encountered NCCL error (" << ncclGetErrorString(res)         \
+              << ") at line " << __LINE__ << " in file " << __FILE__ << "\n";  \
+    exit(-1);                                                                  \
+  }                                                                            \
+} while (0)
+
+#define MAX_DEVICES 64
+#define LINK_TYPE_XGMI 4 // HSA_AMD_LINK_INFO_TYPE_XGMI
+
+struct Options {
+  std::vector<std::string> protos = {"Simple", "LL", "LL128"};
+  std::vector<int> readModes = {0, 1};
+  size_t latBytes = 8;
+  size_t bwBytes = 64 << 20;
+  int latIters = 1000;
+  int bwIters = 20;
+  double tolerance = 0.15;
+  const char* output = nullptr;
+  const char* baseline = nullptr;
+};
+
+struct PairResult {
+  double latUs;
+  double bwGBs;
+};
+
+struct Config {
+  std::string proto;
+  int read;
+  int nDev;
+  std::vector<PairResult> results; // [src*nDev+dst]
+};
+
+static double NowUs() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Broadcasts from device src to device dst iters times, returns the time per broadcast in us
+static double TimeBroadcast(ncclComm_t* comms, hipStream_t* streams, float** buffs, size_t count, int iters) {
+  double start = NowUs();
+  for (int i = 0; i < iters; i++) {
+    NCCLCHECK(ncclGroupStart());
+    for (int r = 0; r < 2; r++)
+      NCCLCHECK(ncclBroadcast(buffs[r], buffs[r], count, ncclFloat, 0, comms[r], streams[r]));
+    NCCLCHECK(ncclGroupEnd());
+  }
+  for (int r = 0; r < 2; r++) HIPCHECK(hipStreamSynchronize(streams[r]));
+  return (NowUs() - start) / iters;
+}
+
+// Runs in a child process, with NCCL_PROTO and NCCL_P2P_READ_ENABLE set, and
+// writes the device count and the results of all pairs to fd
+static void RunConfig(const Options& opt, int fd) {
+  int nDev;
+  HIPCHECK(hipGetDeviceCount(&nDev));
+  nDev = std::min(nDev, MAX_DEVICES);
+  std::vector<PairResult> results(nDev*nDev, PairResult{0, 0});
+  size_t maxBytes = std::max(opt.latBytes, opt.bwBytes);
+  for (int src = 0; src < nDev; src++) {
+    for (int dst = 0; dst < nDev; dst++) {
+      if (src == dst) continue;
+      int devs[2] = {src, dst};
+      ncclComm_t comms[2];
+      hipStream_t streams[2];
+      float* buffs[2];
+      NCCLCHECK(ncclCommInitAll(comms, 2, devs));
+      for (int r = 0; r < 2; r++) {
+        HIPCHECK(hipSetDevice(devs[r]));
+        HIPCHECK(hipStreamCreateWithFlags(&streams[r], hipStreamNonBlocking));
+        HIPCHECK(hipMalloc((void**)&buffs[r], maxBytes));
+        HIPCHECK(hipMemset(buffs[r], 0, maxBytes));
+      }
+      size_t latCount = std::max(opt.latBytes / sizeof(float), (size_t)1);
+      size_t bwCount = std::max(opt.bwBytes / sizeof(float), (size_t)1);
+      TimeBroadcast(comms, streams, buffs, latCount, 10);
+      results[src*nDev+dst].latUs = TimeBroadcast(comms, streams, buffs, latCount, opt.latIters);
+      TimeBroadcast(comms, streams, buffs, bwCount, 2);
+      double us = TimeBroadcast(comms, streams, buffs, bwCount, opt.bwIters);
+      results[src*nDev+dst].bwGBs = bwCount * sizeof(float) / us / 1.0E3;
+      for (int r = 0; r < 2; r++) {
+        HIPCHECK(hipSetDevice(devs[r]));
+        HIPCHECK(hipFree(buffs[r]));
+        HIPCHECK(hipStreamDestroy(streams[r]));
+        NCCLCHECK(ncclCommDestroy(comms[r]));
+      }
+    }
+  }
+  if (write(fd, &nDev, sizeof(nDev)) != sizeof(nDev) ||
+      write(fd, results.data(), results.size()*sizeof(PairResult)) != (ssize_t)(results.size()*sizeof(PairResult))) {
+    fprintf(stderr, "Could not send results to the parent process\n");
+    exit(-1);
+  }
+}
+
+static bool ReadAll(int fd, void* buff, size_t size) {
+  char* p = (char*)buff;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool ForkConfig(const Options& opt, Config& config) {
+  int fds[2];
+  if (pipe(fds)) return false;
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    setenv("NCCL_PROTO", config.proto.c_str(), 1);
+    setenv("NCCL_P2P_READ_ENABLE", config.read ? "1" : "0", 1);
+    RunConfig(opt, fds[1]);
+    close(fds[1]);
+    _exit(0);
+  }
+  close(fds[1]);
+  bool ok = ReadAll(fds[0], &config.nDev, sizeof(config.nDev));
+  if (ok) {
+    config.results.resize(config.nDev*config.nDev);
+    ok = ReadAll(fds[0], config.results.data(), config.results.size()*sizeof(PairResult));
+  }
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static double Median(std::vector<double> v) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[v.size()/2];
+}
+
+static void PrintMatrix(const char* title, const Config& c, bool latency, const std::vector<char>& flagged) {
+  printf("%s, %s, P2P %s\n", title, c.proto.c_str(), c.read ? "read" : "write");
+  printf("%8s", "src\\dst");
+  for (int d = 0; d < c.nDev; d++) printf(" %9d", d);
+  printf("\n");
+  for (int s = 0; s < c.nDev; s++) {
+    printf("%8d", s);
+    for (int d = 0; d < c.nDev; d++) {
+      if (s == d) { printf(" %9s", "-"); continue; }
+      const PairResult& r = c.results[s*c.nDev+d];
+      printf(" %8.2f%c", latency ? r.latUs : r.bwGBs, flagged[s*c.nDev+d] ? '*' : ' ');
+    }
+    printf("\n");
+  }
+}
+
+static std::vector<std::string> Split(const char* s) {
+  std::vector<std::string> items;
+  std::string str(s);
+  for (size_t pos = 0; pos <= str.size(); ) {
+    size_t next = str.find(',', pos);
+    if (next == std::string::npos) next = str.size();
+    if (next > pos) items.push_back(str.substr(pos, next-pos));
+    pos = next+1;
+  }
+  return items;
+}
+
+static void Usage() {
+  printf("Usage: ./p2p_matrix_test [-p Simple,LL,LL128] [-r 0,1] [-l latency_bytes] [-b bandwidth_bytes]\n");
+  printf("                         [-n latency_iters] [-m bandwidth_iters] [-t tolerance] [-o out.csv] [-c baseline.csv]\n");
+}
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    if (i+1 >= argc) { Usage(); return -1; }
+    std::string arg = argv[i];
+    const char* val = argv[++i];
+    if (arg == "-p") opt.protos = Split(val);
+    else if (arg == "-r") { opt.readModes.clear(); for (auto& s : Split(val)) opt.readModes.push_back(atoi(s.c_str())); }
+    else if (arg == "-l") opt.latBytes = strtoull(val, NULL, 0);
+    else if (arg == "-b") opt.bwBytes = strtoull(val, NULL, 0);
+    else if (arg == "-n") opt.latIters = atoi(val);
+    else if (arg == "-m") opt.bwIters = atoi(val);
+    else if (arg == "-t") opt.tolerance = atof(val);
+    else if (arg == "-o") opt.output = val;
+    else if (arg == "-c") opt.baseline = val;
+    else { Usage(); return -1; }
+  }
+
+  // No HIP calls before all children are done, they are forked from this process
+  std::vector<Config> configs;
+  for (auto& proto : opt.protos) {
+    for (int read : opt.readModes) {
+      Config c;
+      c.proto = proto;
+      c.read = read;
+      if (!ForkConfig(opt, c)) {
+        fprintf(stderr, "Run of %s with P2P %s failed\n", proto.c_str(), read ? "read" : "write");
+        return -1;
+      }
+      configs.push_back(c);
+    }
+  }
+  if (configs.empty()) return 0;
+
+  int nDev = configs[0].nDev;
+  std::vector<uint32_t> linkType(nDev*nDev, 0), hops(nDev*nDev, 0);
+  for (int s = 0; s < nDev; s++)
+    for (int d = 0; d < nDev; d++)
+      if (s != d) HIPCHECK(hipExtGetLinkTypeAndHopCount(s, d, &linkType[s*nDev+d], &hops[s*nDev+d]));
+
+  printf("Links (X: xGMI, P: PCIe, with hop count)\n%8s", "src\\dst");
+  for (int d = 0; d < nDev; d++) printf(" %9d", d);
+  printf("\n");
+  for (int s = 0; s < nDev; s++) {
+    printf("%8d", s);
+    for (int d = 0; d < nDev; d++) {
+      if (s == d) printf(" %9s", "-");
+      else printf(" %8c%u", linkType[s*nDev+d] == LINK_TYPE_XGMI ? 'X' : 'P', hops[s*nDev+d]);
+    }
+    printf("\n");
+  }
+
+  // Flag pairs slower than the median of their link class
+  int nFlagged = 0;
+  std::vector<std::string> flagLines;
+  std::vector<std::vector<char>> latFlags, bwFlags;
+  for (auto& c : configs) {
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<double>> lats, bws;
+    for (int s = 0; s < nDev; s++)
+      for (int d = 0; d < nDev; d++)
+        if (s != d) {
+          auto cls = std::make_pair(linkType[s*nDev+d], hops[s*nDev+d]);
+          lats[cls].push_back(c.results[s*nDev+d].latUs);
+          bws[cls].push_back(c.results[s*nDev+d].bwGBs);
+        }
+    std::vector<char> latFlag(nDev*nDev, 0), bwFlag(nDev*nDev, 0);
+    for (int s = 0; s < nDev; s++) {
+      for (int d = 0; d < nDev; d++) {
+        if (s == d) continue;
+        auto cls = std::make_pair(linkType[s*nDev+d], hops[s*nDev+d]);
+        double latMedian = Median(lats[cls]), bwMedian = Median(bws[cls]);
+        const PairResult& r = c.results[s*nDev+d];
+        latFlag[s*nDev+d] = r.latUs > latMedian * (1 + opt.tolerance);
+        bwFlag[s*nDev+d] = r.bwGBs < bwMedian * (1 - opt.tolerance);
+        if (latFlag[s*nDev+d] || bwFlag[s*nDev+d]) {
+          char line[256];
+          snprintf(line, sizeof(line), "%-6s %-5s %3d -> %-3d %s%u latency %8.2f us (median %8.2f) bandwidth %8.2f GB/s (median %8.2f)",
+                   c.proto.c_str(), c.read ? "read" : "write", s, d, linkType[s*nDev+d] == LINK_TYPE_XGMI ? "xGMI/" : "PCIe/",
+                   hops[s*nDev+d], r.latUs, latMedian, r.bwGBs, bwMedian);
+          flagLines.push_back(line);
+          nFlagged++;
+        }
+      }
+    }
+    latFlags.push_back(latFlag);
+    bwFlags.push_back(bwFlag);
+  }
+
+  for (size_t i = 0; i < configs.size(); i++) {
+    char title[64];
+    snprintf(title, sizeof(title), "Latency (us) of %zu bytes", opt.latBytes);
+    PrintMatrix(title, configs[i], true, latFlags[i]);
+    snprintf(title, sizeof(title), "Bandwidth (GB/s) of %zu bytes", opt.bwBytes);
+    PrintMatrix(title, configs[i], false, bwFlags[i]);
+  }
+  printf("%d pair(s) more than %.0f%% off the median of their link type and hop count (*)\n", nFlagged, opt.tolerance*100);
+  for (auto& line : flagLines) printf("  %s\n", line.c_str());
+
+  if (opt.output) {
+    FILE* f = fopen(opt.output, "w");
+    if (!f) {
+      fprintf(stderr, "Could not open %s\n", opt.output);
+      return -1;
+    }
+    fprintf(f, "proto,read,src,dst,link,hops,latencyUs,bandwidthGBs\n");
+    for (auto& c : configs)
+      for (int s = 0; s < nDev; s++)
+        for (int d = 0; d < nDev; d++)
+          if (s != d)
+            fprintf(f, "%s,%d,%d,%d,%s,%u,%.3f,%.3f\n", c.proto.c_str(), c.read, s, d,
+                    linkType[s*nDev+d] == LINK_TYPE_XGMI ? "xGMI" : "PCIe", hops[s*nDev+d],
+                    c.results[s*nDev+d].latUs, c.results[s*nDev+d].bwGBs);
+    fclose(f);
+    printf("Results written to %s\n", opt.output);
+  }
+
+  int nChanged = 0;
+  if (opt.baseline) {
+    FILE* f = fopen(opt.baseline, "r");
+    if (!f) {
+      fprintf(stderr, "Could not open %s\n", opt.baseline);
+      return -1;
+    }
+    std::map<std::tuple<std::string, int, int, int>, PairResult> base;
+    char line[256], proto[16], link[16];
+    int read, s, d;
+    unsigned h;
+    PairResult r;
+    while (fgets(line, sizeof(line), f))
+      if (sscanf(line, "%15[^,],%d,%d,%d,%15[^,],%u,%lf,%lf", proto, &read, &s, &d, link, &h, &r.latUs, &r.bwGBs) == 8)
+        base[std::make_tuple(std::string(proto), read, s, d)] = r;
+    fclose(f);
+    printf("Pairs more than %.0f%% off %s\n", opt.tolerance*100, opt.baseline);
+    for (auto& c : configs) {
+      for (int s = 0; s < nDev; s++) {
+        for (int d = 0; d < nDev; d++) {
+          auto it = base.find(std::make_tuple(c.proto, c.read, s, d));
+          if (s == d || it == base.end()) continue;
+          const PairResult& cur = c.results[s*nDev+d];
+          if (cur.latUs > it->second.latUs * (1 + opt.tolerance) || cur.bwGBs < it->second.bwGBs * (1 - opt.tolerance)) {
+            printf("  %-6s %-5s %3d -> %-3d latency %8.2f us (was %8.2f) bandwidth %8.2f GB/s (was %8.2f)\n",
+                   c.proto.c_str(), c.read ? "read" : "write", s, d, cur.latUs, it->second.latUs, cur.bwGBs, it->second.bwGBs);
+            nChanged++;
+          }
+        }
+      }
+    }
+    printf("%d pair(s) changed\n", nChanged);
+  }
+  return (nFlagged || nChanged) ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+/*
+Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * @file prims_proto_test.cpp
+ *
+ * test performance of the LL and LL128 Primitives of the rccl device code
+ * with fan-out (one sender, several receivers) and fan-in (several senders
+ * reduced by one receiver) between GPUs.
+ *
+ * rccl_prim_test measures hand written copy and reduce loops. This test
+ * instead instantiates the Primitives<> classes the collective kernels use,
+ * from the hipified sources of an rccl build, so flag polling, flow control
+ * and the LL/LL128 line formats are part of what is measured. The
+ * connections are set up here the way the P2P transport sets them up: the
+ * fifo buffers are fine grained memory on the receiving GPU and the head
+ * counter is fine grained memory on the sending GPU.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <hip/hip_runtime.h>
+#include "devcomm.h"
+#include "primitives.h"
+
+__shared__ ncclShmemData ncclShmem;
+#if __CUDA_ARCH__ < 700
+  __shared__ ulong2 ncclShmemPerWarp[ncclShmemScratchWarpSize()*(NCCL_MAX_NTHREADS/WARP_SIZE)/sizeof(ulong2)];
+#endif
+
+#define MAX_PEERS 8
+#define DEFAULT_LL_BUFFSIZE (NCCL_LL_LINES_PER_THREAD*NCCL_LL_MAX_NTHREADS*NCCL_STEPS*sizeof(union ncclLLFifoLine))
+#define DEFAULT_LL128_BUFFSIZE (NCCL_LL128_ELEMS_PER_THREAD*NCCL_LL128_MAX_NTHREADS*NCCL_STEPS*sizeof(uint64_t))
+
+#define HIPCHECK(cmd)                                                          \
+do {                                                                           \
+  hipError_t error = (cmd);                                                    \
+  if (error != hipSuccess) {                                                   \
+    std::cerr << "Encountered HIP error (" << hipGetErrorString(error)         \
+              << ") at line " << __LINE__ << " in file " << __FILE__ << "\n";  \
+    exit(-1);                                                                  \
+  }                                                                            \
+} while (0)
+
+enum Role { RootSend, RootRecv, LeafSend, LeafRecv };
+
+struct primsArgs {
+  struct ncclDevComm* comm;
+  struct ncclDevChannel* channel;
+  int recvPeers[MAX_PEERS];
+  int sendPeers[MAX_PEERS];
+  const float* in;
+  float* out;
+  int count;
+  int iters;
+};
+
+template<typename Proto, int R>
+__global__ void primsKernel(struct primsArgs args) {
+  const int tid = threadIdx.x;
+  const int nthreads = blockDim.x;
+  if (tid == 0) {
+    ncclShmem.comm = *args.comm;
+    ncclShmem.channel = *args.channel;
+    ncclShmem.aborted = 0;
+  }
+  ncclShmemResetBarriers(tid);
+  __syncthreads();
+
+  // The root talks to all leaves at once, each leaf only to the root
+  using Fan = typename std::conditional<R == RootSend, FanAsymmetric<1, MAX_PEERS>,
+              typename std::conditional<R == RootRecv, FanAsymmetric<MAX_PEERS, 1>, FanAsymmetric<1, 1>>::type>::type;
+  Primitives<float, FuncSum<float>, Fan, 0, Proto, 0>
+    prims(tid, nthreads, args.recvPeers, args.sendPeers, args.in, args.out, 0);
+
+  // Chunking as in the ring broadcast
+  const int chunkSize = Proto::calcBytePerStep()/sizeof(float);
+  const int minChunkSizeLL128 = nthreads*(Proto::calcBytePerGrain()/sizeof(float));
+  for (int i = 0; i < args.iters; i++) {
+    for (int offset = 0; offset < args.count; ) {
+      int nelem = Proto::Id == NCCL_PROTO_LL128 ?
+        min(chunkSize, divUp(args.count-offset, minChunkSizeLL128)*minChunkSizeLL128) : chunkSize;
+      nelem = min(nelem, args.count-offset);
+      if (R == RootSend || R == LeafSend) prims.send(offset, nelem);
+      else if (R == LeafRecv) prims.recv(offset, nelem);
+      else prims.recvReduceCopy(offset, offset, nelem);
+      offset += nelem;
+    }
+  }
+}
+
+struct gpuState {
+  int dev;
+  hipStream_t stream;
+  hipEvent_t start, stop;
+  struct ncclDevChannelPeer* peerStructs;  // [nRanks]
+  struct ncclDevChannelPeer** peerPtrs;    // [nRanks]
+  struct ncclDevChannel* channel;
+  struct ncclDevComm* comm;
+  float* in;
+  float* out;
+  std::vector<void*> allocs;
+};
+
+static hipDeviceProp_t prop;
+
+static void* allocFine(int dev, size_t size, std::vector<void*>& allocs) {
+  void* ptr;
+  HIPCHECK(hipSetDevice(dev));
+  HIPCHECK(hipExtMallocWithFlags(&ptr, size, prop.gcnArch/10 == 94 ? hipDeviceMallocUncached : hipDeviceMallocFinegrained));
+  HIPCHECK(hipMemset(ptr, 0, size));
+  allocs.push_back(ptr);
+  return ptr;
+}
+
+// Connects send[0] of rank src to recv[0] of rank dst for both protocols
+static void connect(std::vector<gpuState>& gpus, int src, int dst) {
+  struct ncclConnInfo conn;
+  memset(&conn, 0, sizeof(conn));
+  conn.buffs[NCCL_PROTO_LL] = (char*)allocFine(gpus[dst].dev, DEFAULT_LL_BUFFSIZE, gpus[dst].allocs);
+  conn.buffs[NCCL_PROTO_LL128] = (char*)allocFine(gpus[dst].dev, DEFAULT_LL128_BUFFSIZE, gpus[dst].allocs);
+  conn.head = (uint64_t*)allocFine(gpus[src].dev, 64, gpus[src].allocs);
+  HIPCHECK(hipSetDevice(gpus[src].dev));
+  HIPCHECK(hipMemcpy(&gpus[src].peerStructs[dst].send[0], &conn, sizeof(conn), hipMemcpyHostToDevice));
+  HIPCHECK(hipSetDevice(gpus[dst].dev));
+  HIPCHECK(hipMemcpy(&gpus[dst].peerStructs[src].recv[0], &conn, sizeof(conn), hipMemcpyHostToDevice));
+}
+
+static void setupGpus(std::vector<gpuState>& gpus, int nPeers, int fanIn, size_t maxBytes, uint32_t* abortFlag) {
+  int nRanks = nPeers+1;
+  gpus.resize(nRanks);
+  for (int r = 0; r < nRanks; r++) {
+    gpuState& g = gpus[r];
+    g.dev = r;
+    HIPCHECK(hipSetDevice(g.dev));
+    for (int p = 0; p < nRanks; p++) {
+      if (p == r) continue;
+      hipError_t err = hipDeviceEnablePeerAccess(p, 0);
+      if (err != hipSuccess && err != hipErrorPeerAccessAlreadyEnabled) HIPCHECK(err);
+    }
+    HIPCHECK(hipStreamCreateWithFlags(&g.stream, hipStreamNonBlocking));
+    HIPCHECK(hipEventCreate(&g.start));
+    HIPCHECK(hipEventCreate(&g.stop));
+    HIPCHECK(hipMalloc(&g.peerStructs, nRanks*sizeof(struct ncclDevChannelPeer)));
+    HIPCHECK(hipMemset(g.peerStructs, 0, nRanks*sizeof(struct ncclDevChannelPeer)));
+    std::vector<struct ncclDevChannelPeer*> ptrs(nRanks);
+    for (int p = 0; p < nRanks; p++) ptrs[p] = g.peerStructs+p;
+    HIPCHECK(hipMalloc(&g.peerPtrs, nRanks*sizeof(struct ncclDevChannelPeer*)));
+    HIPCHECK(hipMemcpy(g.peerPtrs, ptrs.data(), nRanks*sizeof(struct ncclDevChannelPeer*), hipMemcpyHostToDevice));
+
+    struct ncclDevChannel channel;
+    memset(&channel, 0, sizeof(channel));
+    channel.peers = g.peerPtrs;
+    HIPCHECK(hipMalloc(&g.channel, sizeof(channel)));
+    HIPCHECK(hipMemcpy(g.channel, &channel, sizeof(channel), hipMemcpyHostToDevice));
+
+    struct ncclDevComm comm;
+    memset(&comm, 0, sizeof(comm));
+    comm.rank = r;
+    comm.nRanks = nRanks;
+    comm.buffSizes[NCCL_PROTO_LL] = DEFAULT_LL_BUFFSIZE;
+    comm.buffSizes[NCCL_PROTO_LL128] = DEFAULT_LL128_BUFFSIZE;
+    comm.abortFlag = abortFlag;
+    HIPCHECK(hipMalloc(&g.comm, sizeof(comm)));
+    HIPCHECK(hipMemcpy(g.comm, &comm, sizeof(comm), hipMemcpyHostToDevice));
+
+    HIPCHECK(hipMalloc(&g.in, maxBytes));
+    HIPCHECK(hipMalloc(&g.out, maxBytes));
+    // Small integers so that fan-in sums are exact
+    std::vector<float> init(maxBytes/sizeof(float));
+    for (size_t i = 0; i < init.size(); i++) init[i] = (float)((i + r) % 64);
+    HIPCHECK(hipMemcpy(g.in, init.data(), maxBytes, hipMemcpyHostToDevice));
+    HIPCHECK(hipMemset(g.out, 0, maxBytes));
+  }
+  for (int p = 1; p < nRanks; p++) {
+    if (fanIn) connect(gpus, p, 0);
+    else connect(gpus, 0, p);
+  }
+}
+
+static void freeGpus(std::vector<gpuState>& gpus) {
+  for (auto& g : gpus) {
+    HIPCHECK(hipSetDevice(g.dev));
+    for (void* ptr : g.allocs) HIPCHECK(hipFree(ptr));
+    HIPCHECK(hipFree(g.peerStructs));
+    HIPCHECK(hipFree(g.peerPtrs));
+    HIPCHECK(hipFree(g.channel));
+    HIPCHECK(hipFree(g.comm));
+    HIPCHECK(hipFree(g.in));
+    HIPCHECK(hipFree(g.out));
+    HIPCHECK(hipEventDestroy(g.start));
+    HIPCHECK(hipEventDestroy(g.stop));
+    HIPCHECK(hipStreamDestroy(g.stream));
+  }
+  gpus.clear();
+}
+
+template<typename Proto>
+static void launch(gpuState& g, int role, struct primsArgs& args, int nthreads) {
+  switch (role) {
+  case RootSend: hipLaunchKernelGGL((primsKernel<Proto, RootSend>), dim3(1), dim3(nthreads), 0, g.stream, args); break;
+  case RootRecv: hipLaunchKernelGGL((primsKernel<Proto, RootRecv>), dim3(1), dim3(nthreads), 0, g.stream, args); break;
+  case LeafSend: hipLaunchKernelGGL((primsKernel<Proto, LeafSend>), dim3(1), dim3(nthreads), 0, g.stream, args); break;
+  case LeafRecv: hipLaunchKernelGGL((primsKernel<Proto, LeafRecv>), dim3(1), dim3(nthreads), 0, g.stream, args); break;
+  }
+  HIPCHECK(hipGetLastError());
+}
+
+// Runs iters operations of count floats on all GPUs, returns the time of the
+// slowest GPU in ms
+static float run(std::vector<gpuState>& gpus, int proto, int fanIn, int count, int iters, int nthreads) {
+  int nPeers = gpus.size()-1;
+  for (int r = 0; r <= nPeers; r++) {
+    gpuState& g = gpus[r];
+    struct primsArgs args;
+    args.comm = g.comm;
+    args.channel = g.channel;
+    for (int i = 0; i < MAX_PEERS; i++) args.recvPeers[i] = args.sendPeers[i] = -1;
+    int role;
+    if (r == 0) {
+      role = fanIn ? RootRecv : RootSend;
+      for (int p = 0; p < nPeers; p++) (fanIn ? args.recvPeers : args.sendPeers)[p] = p+1;
+    } else {
+      role = fanIn ? LeafSend : LeafRecv;
+      (fanIn ? args.sendPeers : args.recvPeers)[0] = 0;
+    }
+    args.in = g.in;
+    args.out = g.out;
+    args.count = count;
+    args.iters = iters;
+    HIPCHECK(hipSetDevice(g.dev));
+    HIPCHECK(hipEventRecord(g.start, g.stream));
+    if (proto == NCCL_PROTO_LL) launch<ProtoLL>(g, role, args, nthreads);
+    else launch<ProtoLL128>(g, role, args, NCCL_LL128_MAX_NTHREADS);
+    HIPCHECK(hipEventRecord(g.stop, g.stream));
+  }
+  float maxMs = 0;
+  for (auto& g : gpus) {
+    float ms;
+    HIPCHECK(hipSetDevice(g.dev));
+    HIPCHECK(hipEventSynchronize(g.stop));
+    HIPCHECK(hipEventElapsedTime(&ms, g.start, g.stop));
+    maxMs = std::max(maxMs, ms);
+  }
+  return maxMs;
+}
+
+static bool check(std::vector<gpuState>& gpus, int fanIn, int count) {
+  int nPeers = gpus.size()-1;
+  std::vector<float> out(count);
+  for (int r = fanIn ? 0 : 1; r <= (fanIn ? 0 : nPeers); r++) {
+    HIPCHECK(hipSetDevice(gpus[r].dev));
+    HIPCHECK(hipMemcpy(out.data(), gpus[r].out, count*sizeof(float), hipMemcpyDeviceToHost));
+    for (int i = 0; i < count; i++) {
+      float expected = 0;
+      if (fanIn) for (int p = 0; p <= nPeers; p++) expected += (float)((i + p) % 64);
+      else expected = (float)(i % 64);
+      if (out[i] != expected) {
+        fprintf(stderr, "Rank %d element %d is %g, expected %g\n", r, i, out[i], expected);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+  char ** itr = std::find(begin, end, option);
+  if (itr != end && ++itr != end)
+    return *itr;
+  return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+  return std::find(begin, end, option) != end;
+}
+
+int main(int argc, char **argv) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("./prims_proto_test -p proto -t pattern -f peers -n bytes -i iterations -b threads\n");
+    printf("  -p ll|ll128|all (default all)\n");
+    printf("  -t fanout|fanin|all (default all)\n");
+    printf("  -f comma separated peer counts, GPU 0 is the root (default 1,2,... up to the GPU count - 1)\n");
+    printf("  -n largest size in bytes per peer, sizes go from 8 bytes up by 4x (default 64MB)\n");
+    printf("  -i iterations (default 20), -b LL threads (default %d)\n", NCCL_LL_MAX_NTHREADS);
+    exit(0);
+  }
+  const char* p = getCmdOption(argv, argv + argc, "-p");
+  std::string protoOpt = p ? p : "all";
+  const char* t = getCmdOption(argv, argv + argc, "-t");
+  std::string patternOpt = t ? t : "all";
+  const char* n = getCmdOption(argv, argv + argc, "-n");
+  size_t maxBytes = n ? strtoull(n, NULL, 0) : 64 << 20;
+  const char* it = getCmdOption(argv, argv + argc, "-i");
+  int iters = it ? atoi(it) : 20;
+  const char* b = getCmdOption(argv, argv + argc, "-b");
+  int nthreads = b ? atoi(b) : NCCL_LL_MAX_NTHREADS;
+  if (nthreads < WARP_SIZE || nthreads > NCCL_LL_MAX_NTHREADS || nthreads % WARP_SIZE) {
+    fprintf(stderr, "Invalid thread count %d\n", nthreads);
+    return 1;
+  }
+  maxBytes = std::max(maxBytes, sizeof(float)*2) & ~(sizeof(float)-1);
+
+  int ngpu;
+  HIPCHECK(hipGetDeviceCount(&ngpu));
+  if (ngpu < 2) {
+    fprintf(stderr, "At least 2 GPUs are needed\n");
+    return 1;
+  }
+  HIPCHECK(hipGetDeviceProperties(&prop, 0));
+
+  std::vector<int> peerCounts;
+  const char* f = getCmdOption(argv, argv + argc, "-f");
+  if (f) {
+    std::string s(f);
+    for (size_t pos = 0; pos < s.size(); ) {
+      size_t next = s.find(',', pos);
+      if (next == std::string::npos) next = s.size();
+      peerCounts.push_back(atoi(s.substr(pos, next-pos).c_str()));
+      pos = next+1;
+    }
+  } else {
+    for (int i = 1; i < std::min(ngpu, MAX_PEERS+1); i++) peerCounts.push_back(i);
+  }
+  for (int c : peerCounts) {
+    if (c < 1 || c > MAX_PEERS || c >= ngpu) {
+      fprintf(stderr, "Invalid peer count %d, must be between 1 and %d\n", c, std::min(MAX_PEERS, ngpu-1));
+      return 1;
+    }
+  }
+
+  printf("Links from GPU 0:");
+  for (int i = 1; i < ngpu; i++) {
+    uint32_t linktype, hopcount;
+    HIPCHECK(hipExtGetLinkTypeAndHopCount(0, i, &linktype, &hopcount));
+    printf(" %d:%s/%u", i, linktype == 4 /* HSA_AMD_LINK_INFO_TYPE_XGMI */ ? "xGMI" : "PCIe", hopcount);
+  }
+  printf("\n");
+
+  uint32_t* abortFlag;
+  uint32_t* abortFlagDev;
+  HIPCHECK(hipHostMalloc(&abortFlag, sizeof(uint32_t), hipHostMallocMapped));
+  *abortFlag = 0;
+  HIPCHECK(hipHostGetDevicePointer((void**)&abortFlagDev, abortFlag, 0));
+
+  printf("%-6s %-7s %5s %12s %10s %12s %12s %6s\n", "proto", "pattern", "peers", "bytes", "time(us)", "peer(GB/s)", "total(GB/s)", "check");
+  bool allOk = true;
+  for (int proto : {NCCL_PROTO_LL, NCCL_PROTO_LL128}) {
+    const char* protoName = proto == NCCL_PROTO_LL ? "ll" : "ll128";
+    if (protoOpt != "all" && protoOpt != protoName) continue;
+    for (int fanIn = 0; fanIn < 2; fanIn++) {
+      const char* patternName = fanIn ? "fanin" : "fanout";
+      if (patternOpt != "all" && patternOpt != patternName) continue;
+      for (int nPeers : peerCounts) {
+        std::vector<gpuState> gpus;
+        setupGpus(gpus, nPeers, fanIn, maxBytes, abortFlagDev);
+        for (size_t bytes = 8; bytes <= maxBytes; bytes *= 4) {
+          int count = bytes/sizeof(float);
+          run(gpus, proto, fanIn, count, 1, nthreads);
+          float ms = run(gpus, proto, fanIn, count, iters, nthreads);
+          bool ok = check(gpus, fanIn, count);
+          allOk &= ok;
+          double us = ms*1000.0/iters;
+          double peerBw = bytes/us/1.0E3;
+          printf("%-6s %-7s %5d %12zu %10.2f %12.2f %12.2f %6s\n", protoName, patternName, nPeers, bytes, us,
+                 peerBw, peerBw*nPeers, ok ? "OK" : "FAIL");
+        }
+        freeGpus(gpus);
+      }
+    }
+  }
+  HIPCHECK(hipHostFree(abortFlag));
+  return allOk ? 0 : 1;
+}
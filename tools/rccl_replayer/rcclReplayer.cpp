@@ -4,20 +4,64 @@
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <thread>
+#include <cmath>
 #include <mpi.h>
 
 #include "rcclReplayer.hpp"
 
 bool ParseLineItem(char const* line, LineItem& li)
 {
-    return sscanf(line,
-                    "%[^:]:%d:%d [%d] NCCL INFO %[^:]: opCount %d sendbuff %s "
+    int n = sscanf(line,
+                    "%[^:]:%d:%d [%d] NCCL INFO %[^:]: opCount %x sendbuff %s "
                     "recvbuff %s count %lu datatype %d op %d root %d comm %s "
-                    "[nranks=%d] stream %p task %d globalrank %d",
+                    "[nranks=%d] stream %p task %d globalrank %d timeUs %lu",
                     li.hostname, &li.pid, &li.tid, &li.cudaDev, li.opName,
                     &li.opCount, li.sendbuff, li.recvbuff,
                     &li.count, &li.datatype, &li.op, &li.root, li.comm,
-                    &li.nRanks, &li.stream, &li.task, &li.globalRank) == 17;
+                    &li.nRanks, &li.stream, &li.task, &li.globalRank, &li.timeUs);
+    // Logs of older releases have no timeUs
+    if (n == 17) li.timeUs = 0;
+    return n >= 17;
+}
+
+bool ReadCallRecord(FILE* fp, LineItem& li)
+{
+    static_assert(sizeof(CallRecord) == sizeof(CallRecordHeader), "Headers and records share the block size");
+    CallRecord rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        // Each concatenated file starts with its header
+        if (!memcmp(&rec, CALL_RECORD_MAGIC, 8)) {
+            CallRecordHeader* header = (CallRecordHeader*)&rec;
+            if (header->recordSize != sizeof(CallRecord)) {
+                printf("[ERROR] Call record has %u byte records, expected %lu\n", header->recordSize, sizeof(CallRecord));
+                exit(-1);
+            }
+            snprintf(li.hostname, sizeof(li.hostname), "%.*s", (int)sizeof(header->hostname), header->hostname);
+            li.pid = header->pid;
+            continue;
+        }
+        if (rec.func >= sizeof(CallRecordFuncNames)/sizeof(CallRecordFuncNames[0]) || !CallRecordFuncNames[rec.func]) continue;
+        li.tid        = 0;
+        li.cudaDev    = 0;
+        snprintf(li.opName, sizeof(li.opName), "%s", CallRecordFuncNames[rec.func]);
+        li.opCount    = rec.opCount;
+        // Only whether the buffers match is replayed
+        snprintf(li.sendbuff, sizeof(li.sendbuff), "0x1");
+        snprintf(li.recvbuff, sizeof(li.recvbuff), rec.inPlace ? "0x1" : "0x2");
+        li.count      = rec.count;
+        li.datatype   = rec.datatype;
+        li.op         = rec.op;
+        li.root       = rec.root;
+        snprintf(li.comm, sizeof(li.comm), "%lx", rec.commHash);
+        li.nRanks     = rec.nRanks;
+        li.stream     = (void*)rec.stream;
+        li.task       = rec.task;
+        li.globalRank = rec.rank;
+        li.timeUs     = rec.timeNs / 1000;
+        return true;
+    }
+    return false;
 }
 
 void ParseCollectives(char const* logFilename, int const numGlobalRanks, std::vector<GroupCall>& groupCalls) {
@@ -32,14 +76,29 @@ void ParseCollectives(char const* logFilename, int const numGlobalRanks, std::ve
         exit(-1);
     }
 
+    // Binary call records start with the magic, anything else is read as a log
+    char magic[8];
+    bool const binary = fread(magic, sizeof(magic), 1, fp) == 1 && !memcmp(magic, CALL_RECORD_MAGIC, sizeof(magic));
+    rewind(fp);
+    if (binary && mpiRank == 0) printf("Reading binary call record %s\n", logFilename);
+
     char line[1000];
     LineItem li;
     int lineNum = 0;
-    while (fgets(line, 1000, fp)) {
-        ++lineNum;
+    std::map<int, size_t> lastGroupCall;  // Group call that took the latest task 0 of each rank
+    while (true) {
+        // lineNum counts records of a binary call record
+        if (binary) {
+            if (!ReadCallRecord(fp, li)) break;
+            ++lineNum;
+        } else {
+            if (!fgets(line, 1000, fp)) break;
+            ++lineNum;
+            if (!ParseLineItem(line, li)) continue;
+        }
 
         //Ignore invalid lines and collectives
-        if (!ParseLineItem(line, li) || li.nRanks != numGlobalRanks) continue;
+        if (li.nRanks != numGlobalRanks) continue;
 
         TaskInfo taskInfo;
         taskInfo.funcType   = GetFuncType(li.opName);
@@ -48,14 +107,19 @@ void ParseCollectives(char const* logFilename, int const numGlobalRanks, std::ve
         taskInfo.datatype   = (ncclDataType_t) li.datatype;
         taskInfo.op         = (ncclRedOp_t) li.op;
         taskInfo.root       = li.root;
+        taskInfo.stream     = li.stream;
+        taskInfo.timeUs     = li.timeUs;
 
         // Find the appropriate GroupCall that this task belongs to
         // If it doesn't exist yet, then create it
         bool found = false;
-        for (auto& gc : groupCalls) {
+        for (size_t gcIdx = 0; gcIdx < groupCalls.size(); gcIdx++) {
+            GroupCall& gc = groupCalls[gcIdx];
             if (gc.rankData.count(li.globalRank)) {
                 RankData& rd = gc.rankData[li.globalRank];
-                if (rd.comm != li.comm || rd.tasks.size() != li.task)
+                // Only the latest group call of the rank can continue, an earlier one with as many tasks would
+                // otherwise take the task
+                if (rd.comm != li.comm || rd.tasks.size() != li.task || gcIdx != lastGroupCall[li.globalRank])
                     continue;
                 
                 rd.tasks.push_back(taskInfo);
@@ -67,6 +131,7 @@ void ParseCollectives(char const* logFilename, int const numGlobalRanks, std::ve
                 gc.rankData[li.globalRank].comm = li.comm;
                 gc.rankData[li.globalRank].lineNum = lineNum;
                 gc.rankData[li.globalRank].tasks.push_back(taskInfo);
+                lastGroupCall[li.globalRank] = gcIdx;
                 found = true;
                 break;
             }
@@ -84,6 +149,7 @@ void ParseCollectives(char const* logFilename, int const numGlobalRanks, std::ve
             gc.rankData[li.globalRank].comm = li.comm;
             gc.rankData[li.globalRank].lineNum = lineNum;
             gc.rankData[li.globalRank].tasks.push_back(taskInfo);
+            lastGroupCall[li.globalRank] = groupCalls.size() - 1;
         }
     }
 
@@ -281,10 +347,146 @@ void ReplayRccl(GroupCall& groupCall, std::vector<ncclComm_t> comms, std::vector
     }
 }
 
+// Function of a single call or "Group", and power of two size class of the first call
+static std::string TimedKey(RankData& rankData, int numGlobalRanks) {
+    TaskInfo& first = rankData.tasks[0];
+    std::pair<size_t, size_t> numBytes = GetSize(first, numGlobalRanks);
+    size_t bytes = std::max(numBytes.first, numBytes.second);
+    return std::string(rankData.tasks.size() > 1 ? "Group" : ncclFuncNames[first.funcType]) + " " +
+           std::to_string(bytes ? 1UL << (63 - __builtin_clzl(bytes)) : 0) + "B";
+}
+
+static hipEvent_t GetEvent(TimedReplay& timed) {
+    hipEvent_t event;
+    if (timed.freeEvents.empty()) {
+        HIPCALL(hipEventCreate(&event));
+    } else {
+        event = timed.freeEvents.back();
+        timed.freeEvents.pop_back();
+    }
+    return event;
+}
+
+// Accounts the oldest group calls that completed, or all of them when wait is set
+static void PollTimedReplay(TimedReplay& timed, bool wait) {
+    while (!timed.pending.empty()) {
+        TimedOp& op = timed.pending.front();
+        if (!wait) {
+            hipError_t err = hipEventQuery(op.stopEvents.back());
+            if (err == hipErrorNotReady) return;
+            HIPCALL(err);
+        }
+        float latencyMs = 0;
+        for (size_t s = 0; s < op.streams.size(); s++) {
+            float ms;
+            HIPCALL(hipEventSynchronize(op.stopEvents[s]));
+            HIPCALL(hipEventElapsedTime(&ms, op.startEvents[s], op.stopEvents[s]));
+            latencyMs = std::max(latencyMs, ms);
+            timed.freeEvents.push_back(op.startEvents[s]);
+            timed.freeEvents.push_back(op.stopEvents[s]);
+        }
+        timed.latencyUs[op.key].push_back(latencyMs * 1e3);
+        timed.pending.pop_front();
+    }
+}
+
+void ReplayRcclTimed(GroupCall& groupCall, int const groupIdx, TimedReplay& timed, std::vector<ncclComm_t> comms,
+                     int const localGpuOffset, int const numGpusPerMpiRank, int const firstGlobalRank, int const numGlobalRanks) {
+    // Wait for the recorded time of the earliest local call of the group
+    uint64_t timeUs = UINT64_MAX;
+    for (int localIdx = 0; localIdx < numGpusPerMpiRank; localIdx++) {
+        RankData& rankData = groupCall.rankData[firstGlobalRank + localIdx];
+        if (!rankData.tasks.empty()) timeUs = std::min(timeUs, rankData.tasks[0].timeUs);
+    }
+    if (timeUs == UINT64_MAX) return;
+    auto target = timed.replayStart + std::chrono::microseconds(timeUs - timed.logStartUs);
+    std::this_thread::sleep_until(target);
+    double lagUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - target).count();
+    timed.lagUs.push_back(lagUs);
+
+    std::vector<TimedOp> ops;
+    for (int localIdx = 0; localIdx < numGpusPerMpiRank; localIdx++) {
+        RankData& rankData = groupCall.rankData[firstGlobalRank + localIdx];
+        if (rankData.tasks.empty()) continue;
+        TimedOp op;
+        op.groupIdx = groupIdx;
+        op.localIdx = localIdx;
+        op.key = TimedKey(rankData, numGlobalRanks);
+        op.lagUs = lagUs;
+        HIPCALL(hipSetDevice(localGpuOffset + localIdx));
+        for (auto& task : rankData.tasks) {
+            hipStream_t& stream = timed.streamMaps[localIdx][task.stream];
+            if (stream == nullptr) HIPCALL(hipStreamCreateWithFlags(&stream, hipStreamNonBlocking));
+            if (std::find(op.streams.begin(), op.streams.end(), stream) != op.streams.end()) continue;
+            op.streams.push_back(stream);
+            op.startEvents.push_back(GetEvent(timed));
+            op.stopEvents.push_back(GetEvent(timed));
+            HIPCALL(hipEventRecord(op.startEvents.back(), stream));
+        }
+        ops.push_back(op);
+    }
+
+    NCCLCHECK(ncclGroupStart());
+    for (auto& op : ops) {
+        RankData& rankData = groupCall.rankData[firstGlobalRank + op.localIdx];
+        HIPCALL(hipSetDevice(localGpuOffset + op.localIdx));
+        for (auto& task : rankData.tasks) {
+            void* recvbuff = task.inPlace ? timed.sendbuff[op.localIdx] : timed.recvbuff[op.localIdx];
+            ExecuteCollective(task, comms[op.localIdx], timed.streamMaps[op.localIdx][task.stream],
+                              timed.sendbuff[op.localIdx], recvbuff);
+        }
+    }
+    NCCLCHECK(ncclGroupEnd());
+
+    for (auto& op : ops) {
+        HIPCALL(hipSetDevice(localGpuOffset + op.localIdx));
+        for (size_t s = 0; s < op.streams.size(); s++) HIPCALL(hipEventRecord(op.stopEvents[s], op.streams[s]));
+        timed.pending.push_back(op);
+    }
+    PollTimedReplay(timed, false);
+}
+
+static double Percentile(std::vector<double>& values, double p) {
+    size_t idx = std::min(values.size() - 1, (size_t)std::ceil(p * values.size()) - (p > 0 ? 1 : 0));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+void ReportTimedReplay(TimedReplay& timed, int const mpiRank) {
+    PollTimedReplay(timed, true);
+    if (!timed.lagUs.empty()) {
+        printf("Rank %d: issue lag behind the recorded schedule p50 %.1f us p99 %.1f us max %.1f us\n", mpiRank,
+               Percentile(timed.lagUs, 0.5), Percentile(timed.lagUs, 0.99), Percentile(timed.lagUs, 1.0));
+    }
+    printf("Rank %d: %-24s %8s %12s %12s %12s %16s\n", mpiRank, "call", "count", "p50 us", "p99 us", "max us", "recorded gap us");
+    for (auto& e : timed.latencyUs) {
+        std::vector<double>& gaps = timed.recordedGapUs[e.first];
+        printf("Rank %d: %-24s %8zu %12.1f %12.1f %12.1f %16.1f\n", mpiRank, e.first.c_str(), e.second.size(),
+               Percentile(e.second, 0.5), Percentile(e.second, 0.99), Percentile(e.second, 1.0),
+               gaps.empty() ? 0.0 : Percentile(gaps, 0.5));
+    }
+    for (auto event : timed.freeEvents) HIPCALL(hipEventDestroy(event));
+    timed.freeEvents.clear();
+    for (size_t i = 0; i < timed.streamMaps.size(); i++) {
+        for (auto& s : timed.streamMaps[i]) HIPCALL(hipStreamDestroy(s.second));
+        HIPCALL(hipFree(timed.sendbuff[i]));
+        HIPCALL(hipFree(timed.recvbuff[i]));
+    }
+}
+
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
+    // --timed may appear anywhere on the command line
+    bool timedReplay = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--timed") != 0) continue;
+        timedReplay = true;
+        for (int j = i; j < argc - 1; j++) argv[j] = argv[j + 1];
+        argc--;
+        break;
+    }
     if (argc <= 1) {
-        printf("Usage: %s logfile [numGpusPerMpiRank = 1]\n", argv[0]);
+        printf("Usage: %s [--timed] logfile [numGpusPerMpiRank = 1]\n", argv[0]);
         exit(1);
     }
 
@@ -345,10 +547,54 @@ int main(int argc, char **argv) {
     }
     NCCLCHECK(ncclGroupEnd());
     
+    TimedReplay timed;
+    if (timedReplay) {
+        // Offsets are taken from the earliest call of the log and buffers sized for the largest one
+        timed.logStartUs = UINT64_MAX;
+        timed.streamMaps.resize(numGpusPerMpiRank);
+        std::vector<size_t> maxBytes(numGpusPerMpiRank, 1);
+        std::vector<uint64_t> lastUs(numGpusPerMpiRank, 0);
+        for (auto& gc : groupCalls) {
+            if (!gc.isValid) continue;
+            for (auto& rd : gc.rankData) {
+                if (rd.second.tasks.empty()) continue;
+                TaskInfo& first = rd.second.tasks[0];
+                if (first.timeUs == 0) {
+                    if (mpiRank == 0) printf("[ERROR] --timed needs a log with timeUs, line %d has none\n", rd.second.lineNum);
+                    exit(1);
+                }
+                timed.logStartUs = std::min(timed.logStartUs, (uint64_t)first.timeUs);
+                int localIdx = rd.first - firstGlobalRank;
+                if (localIdx < 0 || localIdx >= numGpusPerMpiRank) continue;
+                for (auto& task : rd.second.tasks) {
+                    std::pair<size_t, size_t> numBytes = GetSize(task, numGlobalRanks);
+                    maxBytes[localIdx] = std::max(maxBytes[localIdx], std::max(numBytes.first, numBytes.second));
+                }
+                if (lastUs[localIdx]) timed.recordedGapUs[TimedKey(rd.second, numGlobalRanks)].push_back(first.timeUs - lastUs[localIdx]);
+                lastUs[localIdx] = first.timeUs;
+            }
+        }
+        timed.sendbuff.resize(numGpusPerMpiRank);
+        timed.recvbuff.resize(numGpusPerMpiRank);
+        for (int i = 0; i < numGpusPerMpiRank; i++) {
+            HIPCALL(hipSetDevice(localGpuOffset + i));
+            HIPCALL(hipMalloc(&timed.sendbuff[i], maxBytes[i]));
+            HIPCALL(hipMalloc(&timed.recvbuff[i], maxBytes[i]));
+            HIPCALL(hipMemset(timed.sendbuff[i], 0, maxBytes[i]));
+            HIPCALL(hipMemset(timed.recvbuff[i], 0, maxBytes[i]));
+            HIPCALL(hipDeviceSynchronize());
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        timed.replayStart = std::chrono::steady_clock::now();
+    }
+
     int numSkippedCalls = 0;
     auto start = std::chrono::high_resolution_clock::now();
-    for (auto groupCall : groupCalls)
-        if (groupCall.isValid)
+    for (int groupIdx = 0; groupIdx < groupCalls.size(); groupIdx++) {
+        GroupCall& groupCall = groupCalls[groupIdx];
+        if (groupCall.isValid && timedReplay)
+            ReplayRcclTimed(groupCall, groupIdx, timed, comms, localGpuOffset, numGpusPerMpiRank, firstGlobalRank, numGlobalRanks);
+        else if (groupCall.isValid)
             ReplayRccl(groupCall, comms, streams, localGpuOffset, numGpusPerMpiRank, firstGlobalRank, numGlobalRanks);
         else {
             if (mpiRank == 0) printf("[ERROR] in group call: (skipping...)\n");
@@ -363,6 +609,8 @@ int main(int argc, char **argv) {
             }
             numSkippedCalls++;
         }
+    }
+    if (timedReplay) ReportTimedReplay(timed, mpiRank);
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = end - start;
 
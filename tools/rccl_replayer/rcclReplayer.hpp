@@ -1,16 +1,60 @@
 #pragma once
+#include <chrono>
+#include <deque>
 #include <map>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include <rccl/rccl.h>
 
 // NOTE: Parsing is based on this line logging collective information in enqueue.cc
 // INFO(NCCL_COLL,"%s: opCount %lx sendbuff %p recvbuff %p count %zi datatype %d op %d \
-                       root %d comm %p [nranks=%d] stream %p task %d globalrank %d",
+                       root %d comm %p [nranks=%d] stream %p task %d globalrank %d timeUs %lu",
 //                info->opName, info->comm->opCount, info->sendbuff, info->recvbuff, info->count,
 //                info->datatype, info->op, info->root, info->comm, info->comm->nRanks, info->stream,
 //                info->comm->tasks.nTasksP2p + info->comm->tasks.nTasksColl,
-//                info->comm->localRankToRank[info->comm->localRank]);
+//                info->comm->localRankToRank[info->comm->localRank], timeUs);
+// timeUs is missing from logs of older releases, they can only be replayed back to back.
+//
+// The log can also be a binary call record written with RCCL_CALL_RECORD_FILE, or several of them
+// concatenated, see src/misc/call_record.cc. Its layout is mirrored below.
+#define CALL_RECORD_MAGIC "RCCLCALL"
+
+struct CallRecordHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  int32_t  pid;
+  int32_t  reserved;
+  char     hostname[40];
+};
+
+struct CallRecord
+{
+  uint64_t timeNs;
+  uint64_t commHash;
+  uint64_t opCount;
+  uint64_t count;
+  uint64_t stream;
+  int32_t  rank;
+  int32_t  nRanks;
+  int32_t  root;
+  uint32_t task;
+  uint8_t  func;      // ncclFunc_t of the library, indexes CallRecordFuncNames
+  uint8_t  datatype;
+  uint8_t  op;
+  uint8_t  inPlace;
+  uint32_t reserved;
+};
+static_assert(sizeof(CallRecordHeader) == 64 && sizeof(CallRecord) == 64, "Call record layout mismatch");
+
+// Names of the library ncclFunc_t values as logged in opName, SendRecv is never recorded
+char const* const CallRecordFuncNames[] =
+  {"Broadcast", "Reduce", "AllGather", "ReduceScatter", "AllReduce", nullptr, "Send", "Recv", "AllToAll"};
 
 #define MPICHECK(cmd) do {                          \
   int e = cmd;                                      \
@@ -47,7 +91,7 @@ struct LineItem
   int    tid;
   int    cudaDev;
   char   opName[32];
-  int    opCount;
+  unsigned opCount;
   char   sendbuff[32];
   char   recvbuff[32];
   size_t count;
@@ -59,6 +103,7 @@ struct LineItem
   void*  stream;
   int    task;
   int    globalRank;
+  unsigned long timeUs;
 };
 
 // Enumeration of all collective functions currently supported
@@ -101,6 +146,8 @@ struct TaskInfo
   ncclDataType_t datatype;
   ncclRedOp_t    op;
   int            root;
+  void*          stream;  // Recorded stream, replayed on a matching stream in timed mode
+  uint64_t       timeUs;  // Recorded host time of the call, 0 when not logged
 };
 
 struct RankData
@@ -147,6 +194,9 @@ ncclFunc_t GetFuncType(char* func)
 // parse the logs and assign them into lineItem
 bool ParseLineItem(char const* line, LineItem& li);
 
+// reads the next call of a binary call record into lineItem, returns false at the end of the file
+bool ReadCallRecord(FILE* fp, LineItem& li);
+
 // this covers grouping the logs based on opCount and task number, 
 // validatation of the groupCalls for both non-send/recv collectives and send/recv
 void ParseCollectives(char const* logFilename,
@@ -167,4 +217,38 @@ void ReplayRccl(GroupCall& groupCall, std::vector<ncclComm_t> comms, std::vector
                                                                             int const localGpuOffset,
                                                                             int const numGpusPerMpiRank,
                                                                             int const firstGlobalRank,
-                                                                            int const numGlobalRanks);
\ No newline at end of file
+                                                                            int const numGlobalRanks);
+
+// Timed replay (--timed): group calls are issued at their recorded time offsets without waiting for
+// the previous ones, each on a replay stream matching its recorded stream, and the issue-to-completion
+// latency of every group call is measured with events.
+struct TimedOp
+{
+  int                      groupIdx;
+  int                      localIdx;
+  std::string              key;          // Function and size class the latency is reported under
+  double                   lagUs;        // Issued this late compared to the recorded schedule
+  std::vector<hipStream_t> streams;
+  std::vector<hipEvent_t>  startEvents;
+  std::vector<hipEvent_t>  stopEvents;
+};
+
+struct TimedReplay
+{
+  uint64_t                                  logStartUs;   // Earliest recorded call
+  std::chrono::steady_clock::time_point     replayStart;
+  std::vector<std::map<void*, hipStream_t>> streamMaps;   // Recorded to replay stream, per local GPU
+  std::vector<void*>                        sendbuff;     // Shared by all calls of a local GPU, sized for the largest
+  std::vector<void*>                        recvbuff;
+  std::vector<hipEvent_t>                   freeEvents;
+  std::deque<TimedOp>                       pending;
+  std::map<std::string, std::vector<double>> latencyUs;
+  std::map<std::string, std::vector<double>> recordedGapUs; // Recorded time since the previous call on the same GPU
+  std::vector<double>                       lagUs;
+};
+
+void ReplayRcclTimed(GroupCall& groupCall, int const groupIdx, TimedReplay& timed, std::vector<ncclComm_t> comms,
+                     int const localGpuOffset, int const numGpusPerMpiRank, int const firstGlobalRank, int const numGlobalRanks);
+
+// Waits for the calls in flight and prints the latency distributions of the timed replay
+void ReportTimedReplay(TimedReplay& timed, int const mpiRank);
\ No newline at end of file
@@ -0,0 +1,257 @@
+# Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+# Licensed under the MIT License.
+
+# Generates collective logs of synthetic training and inference workloads in the
+# NCCL_DEBUG_SUBSYS=COLL format read by rcclReplayer, with call times for --timed replay.
+# example runs
+# python3 ./workload_generator.py zero3 --ranks 16 -o zero3.log
+# python3 ./workload_generator.py suite --ranks 16 --gpus-per-rank 8 --outdir suite \
+#     --run "mpirun -np 2 --hostfile hosts" --replayer ./rcclReplayer
+
+import argparse
+import os
+import random
+import shlex
+import subprocess
+
+# ncclDataType_t and ncclRedOp_t values of nccl.h
+DTYPES = {'int8': (0, 1), 'int32': (2, 4), 'float16': (6, 2), 'float32': (7, 4), 'bfloat16': (9, 2)}
+OP_SUM = 0
+
+class Trace:
+    """Group calls issued by all ranks of the world communicator at a modeled time.
+
+    Every group call has tasks on every rank, which is how rcclReplayer lines
+    up the calls of the different ranks. Communication inside subgroups of
+    ranks (tensor, pipeline or data parallel groups) is expressed with Send and
+    Recv on the world communicator, since the replayer only replays calls of
+    communicators spanning all ranks."""
+
+    def __init__(self, args):
+        self.n_ranks = args.ranks
+        self.gpus_per_node = args.gpus_per_node
+        self.dtype, self.dtype_size = DTYPES[args.dtype]
+        self.bw = args.bw_gbps * 1e3  # bytes per us
+        self.latency_us = args.latency_us
+        self.groups = []
+
+    def coll_us(self, func, count):
+        # Ring estimate of the time a call takes, used to space calls that depend on each other
+        n = self.n_ranks
+        nbytes = count * self.dtype_size
+        factor = {'AllReduce': 2.0 * (n - 1) / n, 'AllGather': n - 1, 'ReduceScatter': n - 1,
+                  'AllToAll': n - 1, 'Broadcast': 1.0, 'Send': 1.0}.get(func, 1.0)
+        return self.latency_us + factor * nbytes / self.bw
+
+    def add(self, time_us, stream, tasks):
+        """tasks: one list of (func, count, root) per rank."""
+        self.groups.append((time_us, stream, tasks))
+
+    def collective(self, time_us, stream, func, count, root=0):
+        self.add(time_us, stream, [[(func, count, root)] for _ in range(self.n_ranks)])
+        return self.coll_us(func, count)
+
+    def ring_exchange(self, time_us, stream, groups, count):
+        """One ring step inside each group of ranks: send to the next member, receive from the previous one."""
+        tasks = [[] for _ in range(self.n_ranks)]
+        for members in groups:
+            g = len(members)
+            for i, r in enumerate(members):
+                tasks[r].append(('Send', count, members[(i + 1) % g]))
+                tasks[r].append(('Recv', count, members[(i - 1) % g]))
+        self.add(time_us, stream, tasks)
+        return self.coll_us('Send', count)
+
+    def group_allreduce(self, time_us, stream, groups, count):
+        """Ring allreduce inside each group of ranks: reduce-scatter then allgather steps of count/g elements."""
+        g = len(groups[0])
+        if g == 1:
+            return 0.0
+        t = time_us
+        for _ in range(2 * (g - 1)):
+            t += self.ring_exchange(t, stream, groups, max(1, count // g))
+        return t - time_us
+
+    def write(self, path):
+        # Calls are ordered by time as the replayer issues group calls in log order
+        self.groups.sort(key=lambda g: g[0])
+        op_count = [0] * self.n_ranks
+        with open(path, 'w') as f:
+            for time_us, stream, tasks in self.groups:
+                for rank in range(self.n_ranks):
+                    node, dev = divmod(rank, self.gpus_per_node)
+                    comm = 0x10000000 + rank * 0x1000
+                    for task, (func, count, root) in enumerate(tasks[rank]):
+                        buff = 0x7f0000000000 + rank * 0x100000000 + task * 0x1000000
+                        f.write('node%d:%d:%d [%d] NCCL INFO %s: opCount %x sendbuff 0x%x recvbuff 0x%x count %d '
+                                'datatype %d op %d root %d comm 0x%x [nranks=%d] stream 0x%x task %d globalrank %d timeUs %d\n'
+                                % (node, 1000 + rank, 1000 + rank, dev, func, op_count[rank], buff, buff + 0x800000, count,
+                                   self.dtype, OP_SUM, root, comm, self.n_ranks, 0x20000000 + stream * 0x100, task, rank,
+                                   1000000 + int(time_us)))
+                    op_count[rank] += 1
+        return len(self.groups)
+
+def zero3(trace, args):
+    """ZeRO-3: parameters are sharded over all ranks. Each layer bucket is allgathered before its forward
+    and backward computation, prefetched on a separate stream, and its gradients are reduce-scattered."""
+    shard = args.bucket_elems // trace.n_ranks
+    t = 0.0
+    for _ in range(args.steps):
+        # Forward: allgather of bucket i+1 overlaps the compute of bucket i
+        t += trace.collective(t, 1, 'AllGather', shard)
+        for b in range(args.buckets):
+            if b + 1 < args.buckets:
+                trace.collective(t, 1, 'AllGather', shard)
+            t += max(args.compute_us, trace.coll_us('AllGather', shard))
+        # Backward: allgather again, reduce-scatter of the previous bucket overlaps the compute of the next
+        for b in range(args.buckets):
+            t += trace.collective(t, 1, 'AllGather', shard)
+            t += 2 * args.compute_us
+            trace.collective(t, 2, 'ReduceScatter', shard)
+        t += trace.coll_us('ReduceScatter', shard)
+
+def moe(trace, args):
+    """MoE: tokens are dispatched to experts with an all-to-all and combined back with a second one. Expert
+    popularity follows a Zipf distribution, so a few ranks receive most tokens, and the hot experts change
+    every layer. The uneven all-to-alls are expressed as Send/Recv groups."""
+    rng = random.Random(args.seed)
+    n = trace.n_ranks
+    experts_per_rank = max(1, args.experts // n)
+    t = 0.0
+    for _ in range(args.steps):
+        for _ in range(args.layers):
+            weights = [1.0 / (e + 1) ** args.skew for e in range(experts_per_rank * n)]
+            rng.shuffle(weights)
+            rank_weights = [sum(weights[r * experts_per_rank:(r + 1) * experts_per_rank]) for r in range(n)]
+            counts = []
+            for src in range(n):
+                noisy = [w * rng.uniform(0.8, 1.2) for w in rank_weights]
+                s = sum(noisy)
+                counts.append([max(1, int(args.tokens * w / s) * args.hidden) for w in noisy])
+            max_count = max(max(c) for c in counts)
+            for phase in range(2):
+                tasks = [[] for _ in range(n)]
+                for src in range(n):
+                    for dst in range(n):
+                        # Combine sends tokens back, dst to src
+                        c = counts[src][dst] if phase == 0 else counts[dst][src]
+                        a, b = (src, dst) if phase == 0 else (dst, src)
+                        tasks[a].append(('Send', c, b))
+                        tasks[b].append(('Recv', c, a))
+                trace.add(t, 0, tasks)
+                t += trace.latency_us + max_count * n * trace.dtype_size / trace.bw
+                t += args.compute_us
+
+def parallel3d(trace, args):
+    """TP+PP+DP: ranks are laid out tensor parallel first, then pipeline stages, then data parallel
+    replicas. Each pipeline stage does a tensor parallel allreduce per layer and micro batch, sends its
+    activations to the next stage and, in backward, gradients to the previous one. The data parallel
+    gradient allreduce of each stage runs on its own stream, overlapping the remaining backward passes."""
+    tp, pp = args.tp, args.pp
+    n = trace.n_ranks
+    if n % (tp * pp):
+        raise ValueError('ranks (%d) must be a multiple of tp*pp (%d)' % (n, tp * pp))
+    dp = n // (tp * pp)
+    rank = lambda d, p, t: (d * pp + p) * tp + t
+    tp_groups = [[rank(d, p, t) for t in range(tp)] for d in range(dp) for p in range(pp)]
+    dp_groups = [[rank(d, p, t) for d in range(dp)] for p in range(pp) for t in range(tp)]
+    act = args.micro_batch * args.seq * args.hidden // tp
+    grad = args.layers_per_stage * 12 * args.hidden * args.hidden // tp
+
+    def stage_exchange(t, forward):
+        tasks = [[] for _ in range(n)]
+        for d in range(dp):
+            for p in range(pp - 1):
+                a, b = (p, p + 1) if forward else (p + 1, p)
+                for x in range(tp):
+                    tasks[rank(d, a, x)].append(('Send', act, rank(d, b, x)))
+                    tasks[rank(d, b, x)].append(('Recv', act, rank(d, a, x)))
+        if pp > 1:
+            trace.add(t, 0, tasks)
+        return trace.coll_us('Send', act) if pp > 1 else 0.0
+
+    t = 0.0
+    for _ in range(args.steps):
+        for forward in (True, False):
+            for mb in range(args.micro_batches):
+                for _ in range(args.layers_per_stage):
+                    t += args.compute_us
+                    t += trace.group_allreduce(t, 0, tp_groups, act * tp)
+                t += stage_exchange(t, forward)
+                # Gradients are complete once the last micro batch went through backward
+                if not forward and mb == args.micro_batches - 1:
+                    trace.group_allreduce(t, 1, dp_groups, grad)
+        # Optimizer step once the data parallel allreduce is done
+        t += (trace.coll_us('AllReduce', grad) if dp > 1 else 0.0) + args.compute_us
+
+def decode(trace, args):
+    """LLM decode with tensor parallelism over all ranks: two allreduces of batch*hidden elements per layer
+    and generated token, swept over batch sizes."""
+    t = 0.0
+    for batch in args.batch_sizes:
+        count = batch * args.hidden
+        for _ in range(args.tokens_out):
+            for _ in range(args.layers):
+                for _ in range(2):
+                    t += args.compute_us
+                    t += trace.collective(t, 0, 'AllReduce', count)
+
+PATTERNS = {'zero3': zero3, 'moe': moe, '3d': parallel3d, 'decode': decode}
+
+def generate(pattern, args, path):
+    trace = Trace(args)
+    PATTERNS[pattern](trace, args)
+    n = trace.write(path)
+    print('%s: %d group calls for %d ranks written to %s' % (pattern, n, args.ranks, path))
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('pattern', choices=list(PATTERNS) + ['suite'], help='Workload, suite generates all of them.')
+    parser.add_argument('-o', '--output', help='Log file to write, <pattern>.log by default.')
+    parser.add_argument('--ranks', type=int, default=8, help='Global ranks of the replay.')
+    parser.add_argument('--gpus-per-node', type=int, default=8, help='GPUs per node, sets host names and devices.')
+    parser.add_argument('--dtype', choices=list(DTYPES), default='bfloat16')
+    parser.add_argument('--steps', type=int, default=2, help='Training steps.')
+    parser.add_argument('--compute-us', type=float, default=200.0, help='Compute time between dependent calls.')
+    parser.add_argument('--bw-gbps', type=float, default=50.0, help='Bus bandwidth used to space dependent calls.')
+    parser.add_argument('--latency-us', type=float, default=10.0, help='Latency used to space dependent calls.')
+    parser.add_argument('--seed', type=int, default=0)
+    zero = parser.add_argument_group('zero3')
+    zero.add_argument('--buckets', type=int, default=16, help='Parameter buckets, one per layer group.')
+    zero.add_argument('--bucket-elems', type=int, default=50 * 2**20, help='Parameters per bucket.')
+    moe_args = parser.add_argument_group('moe')
+    moe_args.add_argument('--experts', type=int, default=64)
+    moe_args.add_argument('--tokens', type=int, default=4096, help='Tokens per rank and layer.')
+    moe_args.add_argument('--skew', type=float, default=1.2, help='Zipf exponent of expert popularity.')
+    moe_args.add_argument('--layers', type=int, default=8, help='MoE or decoder layers.')
+    par = parser.add_argument_group('3d')
+    par.add_argument('--tp', type=int, default=2)
+    par.add_argument('--pp', type=int, default=2)
+    par.add_argument('--micro-batches', type=int, default=4)
+    par.add_argument('--micro-batch', type=int, default=1, help='Sequences per micro batch.')
+    par.add_argument('--seq', type=int, default=2048, help='Sequence length.')
+    par.add_argument('--layers-per-stage', type=int, default=4)
+    parser.add_argument('--hidden', type=int, default=4096, help='Hidden size (moe, 3d, decode).')
+    dec = parser.add_argument_group('decode')
+    dec.add_argument('--batch-sizes', type=lambda s: [int(x) for x in s.split(',')], default=[1, 8, 32, 128])
+    dec.add_argument('--tokens-out', type=int, default=16, help='Generated tokens per batch size.')
+    suite = parser.add_argument_group('suite')
+    suite.add_argument('--outdir', default='.', help='Directory of the suite logs.')
+    suite.add_argument('--run', help='Launcher to replay each log with, e.g. "mpirun -np 2".')
+    suite.add_argument('--replayer', default='./rcclReplayer')
+    suite.add_argument('--gpus-per-rank', type=int, default=1, help='GPUs per MPI rank of the replay.')
+    suite.add_argument('--timed', action='store_true', help='Replay with --timed.')
+    args = parser.parse_args()
+
+    patterns = list(PATTERNS) if args.pattern == 'suite' else [args.pattern]
+    for pattern in patterns:
+        if args.pattern == 'suite' or not args.output:
+            os.makedirs(args.outdir, exist_ok=True)
+            path = os.path.join(args.outdir, pattern + '.log')
+        else:
+            path = args.output
+        generate(pattern, args, path)
+        if args.run:
+            cmd = shlex.split(args.run) + [args.replayer] + (['--timed'] if args.timed else []) + [path, str(args.gpus_per_rank)]
+            print(' '.join(cmd), flush=True)
+            subprocess.run(cmd, check=True)
@@ -0,0 +1,107 @@
+# Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+# Licensed under the MIT License.
+
+# Prints the binary kernel collective trace files written with RCCL_KERNEL_COLL_TRACE_FILE
+# as the lines RCCL_KERNEL_COLL_TRACE_ENABLE prints with NCCL_DEBUG_SUBSYS=COLL.
+# example run
+# python3 ./[rccl]/tools/scripts/colltrace_decoder.py [trace_file ...]
+
+import argparse
+import struct
+
+# struct ncclCollTraceFileHeader in colltrace_file.h
+HEADER_FORMAT = '<8sIIiiQqdIHHQ'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+FILE_MAGIC = b'RCCLCTRC'
+# struct ncclCollTrace in devcomm.h
+RECORD_FORMAT = '<BBhIQQQ'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+# ncclCollTraceDataType_t
+TRACE_KERNEL_LAUNCH = 1
+TRACE_KERNEL_END = 2
+TRACE_COLL_LAUNCH = 3
+TRACE_ABORT = 4
+TRACE_DATA = 5
+TRACE_COLL_ELEM = 1 << 4
+TRACE_P2P_ELEM = 1 << 5
+
+def decode_coll(data_1, bus_id, n_ranks):
+    n_warps, bid, n_channels = data_1 & 0xff, (data_1 >> 8) & 0xff, (data_1 >> 16) & 0xff
+    return 'nw %d bi %d nc %d busId %x nRanks %d' % (n_warps, bid, n_channels, bus_id, n_ranks)
+
+def decode_p2p(data_1):
+    p2p = []
+    for i in range(2):
+        word = (data_1 >> (32*i)) & 0xffffffff
+        peer = word & 0xffff
+        if peer >= 0x8000:
+            peer -= 0x10000
+        p2p.append({'peer': peer, 'ngroups': (word >> 16) & 0xf, 'connIndex': (word >> 20) & 0xf,
+                    'warpStart': (word >> 24) & 0xf, 'nWarps': (word >> 28) & 0xf})
+    return p2p
+
+def format_p2p(p2p, bus_id, n_ranks):
+    return '%d -> %d/%d/%d/%d conn/nw/ws/ng %d/%d/%d/%d -> %d busId %x nRanks %d' % (
+        p2p[0]['peer'], p2p[0]['connIndex'], p2p[0]['nWarps'], p2p[0]['warpStart'], p2p[0]['ngroups'],
+        p2p[1]['connIndex'], p2p[1]['nWarps'], p2p[1]['warpStart'], p2p[1]['ngroups'], p2p[1]['peer'], bus_id, n_ranks)
+
+def format_record(header, names, record):
+    trace_type, bid, func_index, data_0, time_stamp, op_count, data_1 = record
+    rank, n_ranks, bus_id, freq, func_index_p2p = header['rank'], header['nRanks'], header['busId'], header['rtcFreqHz'], header['funcIndexP2p']
+    ts = time_stamp / freq
+    if trace_type == TRACE_DATA:
+        return '## [%012.6f] [%02d:%02d] L:%04d DT %08x %016x %016x' % (ts, rank, bid, func_index, data_0, op_count, data_1)
+    name = names[func_index] if 0 <= func_index < len(names) else '?'
+    if func_index == func_index_p2p or trace_type == TRACE_P2P_ELEM:
+        line = '## [%012.6f] [%02d:%02d] %06x-%06x' % (ts, rank, bid, op_count & 0xffffffff, op_count >> 32)
+    else:
+        line = '## [%012.6f] [%02d:%02d] %06x' % (ts, rank, bid, op_count)
+    if trace_type == TRACE_COLL_ELEM:
+        return line + ' CE %s %s' % (name, decode_coll(data_1, bus_id, n_ranks))
+    if trace_type == TRACE_P2P_ELEM:
+        return line + ' PE %s %s' % (name, format_p2p(decode_p2p(data_1), bus_id, n_ranks))
+    kind = trace_type & 0xf
+    if kind in (TRACE_KERNEL_LAUNCH, TRACE_COLL_LAUNCH):
+        if kind == TRACE_KERNEL_LAUNCH:
+            line += ' KL HWID %8x %s' % (data_0, name)
+        else:
+            line += ' CL %s' % name
+        if trace_type & 0xf0 == TRACE_COLL_ELEM:
+            line += ' ' + decode_coll(data_1, bus_id, n_ranks)
+        elif trace_type & 0xf0 == TRACE_P2P_ELEM:
+            line += ' ' + format_p2p(decode_p2p(data_1), bus_id, n_ranks)
+        return line
+    if kind == TRACE_KERNEL_END:
+        return line + ' KE busId %x nRanks %d' % (bus_id, n_ranks)
+    if kind == TRACE_ABORT:
+        return line + ' Abort'
+    return line + ' unknown collective trace data type'
+
+def decode_file(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    fields = struct.unpack_from(HEADER_FORMAT, data, 0)
+    if fields[0] != FILE_MAGIC:
+        raise ValueError('%s is not a kernel collective trace file' % path)
+    header = dict(zip(['magic', 'version', 'recordSize', 'rank', 'nRanks', 'commHash', 'busId', 'rtcFreqHz',
+                       'nNames', 'nameLength', 'funcIndexP2p', 'nRecords'], fields))
+    if header['recordSize'] != RECORD_SIZE:
+        raise ValueError('%s has %d byte records, expected %d' % (path, header['recordSize'], RECORD_SIZE))
+    names = []
+    offset = HEADER_SIZE
+    for i in range(header['nNames']):
+        names.append(data[offset:offset+header['nameLength']].split(b'\0')[0].decode())
+        offset += header['nameLength']
+    offset = (offset + RECORD_SIZE - 1) // RECORD_SIZE * RECORD_SIZE
+    # Stop at the end of the file if it was not truncated to its content
+    n_records = min(header['nRecords'], (len(data) - offset) // RECORD_SIZE)
+    for i in range(n_records):
+        print(format_record(header, names, struct.unpack_from(RECORD_FORMAT, data, offset + i*RECORD_SIZE)))
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('files', nargs='+', help='RCCL_KERNEL_COLL_TRACE_FILE outputs.')
+    args = parser.parse_args()
+    for path in args.files:
+        decode_file(path)
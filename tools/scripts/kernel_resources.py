@@ -0,0 +1,111 @@
+# Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+# Licensed under the MIT License.
+
+# Prints the LDS and registers of every kernel of librccl.so per GPU target, and what they leave to
+# compute kernels sharing a CU with one RCCL block: the LDS left and how many compute workgroups of
+# --compute-lds bytes still fit in it, and the VGPRs left per SIMD lane. With --compare, prints the
+# differences to another build, e.g. one configured with -DENABLE_COMPACT_SHMEM=ON.
+# Needs objcopy, and clang-offload-bundler and llvm-readelf from $ROCM_PATH/llvm/bin or the PATH.
+# example run
+# python3 ./[rccl]/tools/scripts/kernel_resources.py build/librccl.so --compare build-compact/librccl.so
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+
+LDS_PER_CU = 65536
+VGPRS_PER_SIMD = 512
+VGPR_GRANULE = 8
+BUNDLE_MAGIC = b'__CLANG_OFFLOAD_BUNDLE__'
+
+def tool(name):
+    path = os.path.join(os.environ.get('ROCM_PATH', '/opt/rocm'), 'llvm', 'bin', name)
+    return path if os.path.exists(path) else shutil.which(name) or name
+
+def code_objects(lib, tmp):
+    fatbin = os.path.join(tmp, 'fatbin')
+    subprocess.run(['objcopy', '--dump-section', '.hip_fatbin=' + fatbin, lib], check=True)
+    data = open(fatbin, 'rb').read()
+    # Libraries built without -fgpu-rdc hold one bundle per source file
+    starts = [m.start() for m in re.finditer(re.escape(BUNDLE_MAGIC), data)]
+    objects = []
+    for i, start in enumerate(starts):
+        bundle = os.path.join(tmp, 'bundle%d' % i)
+        open(bundle, 'wb').write(data[start:starts[i+1] if i+1 < len(starts) else len(data)])
+        targets = subprocess.run([tool('clang-offload-bundler'), '--list', '--type=o', '--input=' + bundle],
+                                 check=True, capture_output=True, text=True).stdout.split()
+        for j, target in enumerate(targets):
+            if 'amdgcn' not in target:
+                continue
+            co = os.path.join(tmp, 'bundle%d-%d.co' % (i, j))
+            subprocess.run([tool('clang-offload-bundler'), '--unbundle', '--type=o', '--input=' + bundle,
+                            '--targets=' + target, '--output=' + co], check=True)
+            objects.append((target.split('--')[-1], co))
+    return objects
+
+def kernels(co):
+    # Kernel entries of the amdhsa.kernels list in the YAML metadata, without their .args
+    notes = subprocess.run([tool('llvm-readelf'), '--notes', co], check=True, capture_output=True, text=True).stdout
+    entries, entry, inKernels, listIndent = [], None, False, None
+    for line in notes.splitlines():
+        if re.match(r'\s*amdhsa\.', line):
+            inKernels = line.strip().startswith('amdhsa.kernels:')
+            continue
+        m = re.match(r'(\s*)(- )?\.(\w+):\s*(\S*)', line)
+        if not inKernels or not m:
+            continue
+        indent = len(m.group(1))
+        if listIndent is None:
+            listIndent = indent
+        if m.group(2) and indent == listIndent:
+            entry = {}
+            entries.append(entry)
+            indent += 2
+        if entry is not None and indent == listIndent + 2:
+            value = m.group(4)
+            entry[m.group(3)] = int(value) if value.isdigit() else value
+    return {e['name']: e for e in entries if 'name' in e}
+
+def resources(lib):
+    result = {}
+    with tempfile.TemporaryDirectory() as tmp:
+        for arch, co in code_objects(lib, tmp):
+            for name, k in kernels(co).items():
+                if 'group_segment_fixed_size' in k:
+                    result[(arch, name)] = k
+    return result
+
+def left(k, computeLds):
+    lds = k['group_segment_fixed_size']
+    vgprs = k.get('vgpr_count', 0) + k.get('agpr_count', 0)
+    vgprs = -(-vgprs // VGPR_GRANULE) * VGPR_GRANULE
+    return lds, (LDS_PER_CU - lds) // computeLds, VGPRS_PER_SIMD - vgprs
+
+def main():
+    parser = argparse.ArgumentParser(description='LDS and register use of the RCCL kernels')
+    parser.add_argument('lib', help='librccl.so')
+    parser.add_argument('--compare', help='another librccl.so to print the differences to')
+    parser.add_argument('--compute-lds', type=int, default=32768, help='LDS of one compute workgroup (default 32768)')
+    parser.add_argument('--filter', default='', help='only kernels whose name contains this')
+    args = parser.parse_args()
+
+    base = resources(args.lib)
+    other = resources(args.compare) if args.compare else {}
+    print('%d compute workgroups of %d bytes fit in the LDS of an idle CU' % (LDS_PER_CU // args.compute_lds, args.compute_lds))
+    print('%-8s %8s %8s %6s %6s %10s %10s  %s' % ('arch', 'LDS', 'scratch', 'VGPRs', 'SGPRs', 'computeWGs', 'VGPRsLeft', 'kernel'))
+    for (arch, name), k in sorted(base.items()):
+        if args.filter not in name:
+            continue
+        lds, wgs, vgprs = left(k, args.compute_lds)
+        line = '%-8s %8d %8d %6d %6d %10d %10d  %s' % (arch, lds, k.get('private_segment_fixed_size', 0),
+               k.get('vgpr_count', 0), k.get('sgpr_count', 0), wgs, vgprs, name)
+        if (arch, name) in other:
+            lds2, wgs2, vgprs2 = left(other[(arch, name)], args.compute_lds)
+            line += '  (compare: LDS %+d, computeWGs %+d, VGPRsLeft %+d)' % (lds2 - lds, wgs2 - wgs, vgprs2 - vgprs)
+        print(line)
+
+if __name__ == '__main__':
+    main()
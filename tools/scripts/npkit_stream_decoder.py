@@ -0,0 +1,78 @@
+# Copyright (c) 2023 Advanced Micro Devices, Inc. All rights reserved.
+# Licensed under the MIT License.
+
+# Expands the npkit_stream_rank_* files written with NPKIT_STREAM_INTERVAL_MS into the
+# per buffer event files read by npkit_trace_generator.py.
+# example run
+# python3 ./[rccl]/tools/scripts/npkit_stream_decoder.py --npkit_dump_dir=[npkit_dump_dir]
+
+import argparse
+import os
+import struct
+
+# struct NpKitStreamRecord in npkit_struct.h
+RECORD_FORMAT = '<IHHIIQ'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+STREAM_MAGIC = 0x534b504e
+
+def read_varint(data, idx):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[idx]
+        idx += 1
+        value |= (byte & 0x7f) << shift
+        if byte < 0x80:
+            return value, idx
+        shift += 7
+
+def decode_events(payload, num_events):
+    events = bytearray()
+    idx = 0
+    timestamp = 0
+    for _ in range(num_events):
+        event_type = payload[idx]
+        size, idx = read_varint(payload, idx + 1)
+        rsvd, idx = read_varint(payload, idx)
+        delta, idx = read_varint(payload, idx)
+        timestamp = (timestamp + ((delta >> 1) ^ -(delta & 1))) & 0xffffffffffffffff
+        # Same layout as union NpKitEvent: 8 bits of type, 32 of size, 24 of rsvd, then the timestamp
+        events += struct.pack('<QQ', event_type | (size << 8) | (rsvd << 40), timestamp)
+    return events
+
+def decode_stream(stream_file_path, rank, output_dir):
+    buffers = {}
+    dropped = {}
+    with open(stream_file_path, 'rb') as f:
+        data = f.read()
+    idx = 0
+    while idx + RECORD_SIZE <= len(data):
+        magic, source, buf_idx, num_events, num_bytes, num_dropped = struct.unpack_from(RECORD_FORMAT, data, idx)
+        if magic != STREAM_MAGIC:
+            raise ValueError('corrupted record at offset %d of %s' % (idx, stream_file_path))
+        idx += RECORD_SIZE
+        key = (source, buf_idx)
+        buffers.setdefault(key, bytearray()).extend(decode_events(data[idx : idx + num_bytes], num_events))
+        dropped[key] = dropped.get(key, 0) + num_dropped
+        idx += num_bytes
+    for (source, buf_idx), events in buffers.items():
+        if source == 0:
+            file_name = 'gpu_events_rank_%d_buf_%d' % (rank, buf_idx)
+        else:
+            file_name = 'cpu_events_rank_%d_channel_%d' % (rank, buf_idx)
+        with open(os.path.join(output_dir, file_name), 'wb') as f:
+            f.write(events)
+        if dropped[(source, buf_idx)] > 0:
+            print('%s: %d events were dropped' % (file_name, dropped[(source, buf_idx)]))
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--npkit_dump_dir', type=str, required=True, help='NPKit dump directory.')
+    parser.add_argument('--output_dir', type=str, default=None, help='Directory for the event files, the dump directory by default.')
+    args = parser.parse_args()
+    output_dir = args.output_dir if args.output_dir else args.npkit_dump_dir
+    os.makedirs(output_dir, exist_ok=True)
+    for file_name in os.listdir(args.npkit_dump_dir):
+        if file_name.startswith('npkit_stream_rank_'):
+            rank = int(file_name[len('npkit_stream_rank_'):])
+            decode_stream(os.path.join(args.npkit_dump_dir, file_name), rank, output_dir)
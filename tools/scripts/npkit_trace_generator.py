@@ -27,6 +27,21 @@ def parse_npkit_event_header(npkit_event_header_path):
             line_idx += 1
     return npkit_event_def
 
+# Indexed by the MSCCL_* transmission types of msccl_struct.h
+MSCCL_TRANSMISSION_TYPES = ['s', 'r', 'rcs', 'rrs', 'rrc', 'rrcs', 'cpy', 're']
+MSCCL_REDUCE_TYPES = ['rrs', 'rrc', 'rrcs', 're']
+MSCCL_STEP_EVENTS = ['NPKIT_EVENT_MSCCL_DEP_WAIT_ENTRY', 'NPKIT_EVENT_MSCCL_DEP_WAIT_EXIT',
+                     'NPKIT_EVENT_MSCCL_STEP_ENTRY', 'NPKIT_EVENT_MSCCL_STEP_EXIT']
+
+def decode_msccl_step_id(rsvd):
+    # Inverse of MSCCL_STEP_ID in msccl_kernel_impl.h
+    type_idx = (rsvd >> 8) & 0xf
+    return {
+        'iter': (rsvd >> 12) & 0xfff,
+        'type': MSCCL_TRANSMISSION_TYPES[type_idx] if type_idx < len(MSCCL_TRANSMISSION_TYPES) else str(type_idx),
+        'step': rsvd & 0xff
+    }
+
 def parse_gpu_clock_scale(gpu_clock_file_path):
     with open(gpu_clock_file_path, 'r') as f:
         freq_in_khz = f.read()
@@ -39,6 +54,13 @@ def parse_cpu_clock_scale(cpu_clock_den_file_path, cpu_clock_num_file_path):
         den = float(f.read())
     return den / num / 1e6
 
+def parse_cpu_clock_offset(cpu_clock_offset_file_path):
+    # Offset of the CPU clock to rank 0 in us, written when clock sync is enabled
+    if not os.path.exists(cpu_clock_offset_file_path):
+        return 0
+    with open(cpu_clock_offset_file_path, 'r') as f:
+        return float(f.read()) / 1e3
+
 def parse_gpu_event(event_bytes):
     return {
         'id': int.from_bytes(event_bytes[0:1], byteorder='little', signed=False),
@@ -173,6 +195,11 @@ def parse_gpu_event_file(rank_cpu_time_xcid, npkit_dump_dir, npkit_event_def, ra
                             'size_0': parsed_gpu_event['size']
                         }
                     })
+                    if event_type in MSCCL_STEP_EVENTS:
+                        # MSCCL kernels use one buffer per thread block
+                        step_id = decode_msccl_step_id(parsed_gpu_event['rsvd'])
+                        gpu_events[-1]['name'] = '%s tb %d step %d %s' % (event_type[len('NPKIT_EVENT_'):-len('_ENTRY')], buf_idx, step_id['step'], step_id['type'])
+                        gpu_events[-1]['args'].update(step_id)
                     event_type_to_seq[event_type] += 1
                 else:
                     gpu_events[-1]['args'] = {'size': parsed_gpu_event['size'], 'rsvd': parsed_gpu_event['rsvd']}
@@ -286,7 +313,61 @@ def parse_cpu_event_file(npkit_dump_dir, npkit_event_def, rank, channel, cpu_clo
 
 
 
-def convert_npkit_dump_to_trace(npkit_dump_dir, output_dir, npkit_event_def, gpu_statistics):
+def parse_msccl_steps(npkit_dump_dir, npkit_event_def, rank, buf_idx, gpu_clock_scale, steps):
+    # Accumulates, per step of the thread block, the time spent waiting for dependencies and
+    # the time spent moving (or reducing) data, over all loop iterations and launches
+    gpu_event_file_path = os.path.join(npkit_dump_dir, 'gpu_events_rank_%d_buf_%d' % (rank, buf_idx))
+    raw_event_size = 16
+    open_ts = {}
+    with open(gpu_event_file_path, 'rb') as f:
+        raw_content = f.read()
+    for raw_content_idx in range(0, len(raw_content) - raw_event_size + 1, raw_event_size):
+        parsed_gpu_event = parse_gpu_event(raw_content[raw_content_idx : raw_content_idx + raw_event_size])
+        event_type = npkit_event_def['id_to_type'].get(parsed_gpu_event['id'])
+        if event_type not in MSCCL_STEP_EVENTS:
+            continue
+        step_id = decode_msccl_step_id(parsed_gpu_event['rsvd'])
+        kind = 'wait' if 'DEP_WAIT' in event_type else 'xfer'
+        if event_type.endswith('_ENTRY'):
+            open_ts[kind] = parsed_gpu_event['timestamp']
+            continue
+        if kind not in open_ts:
+            continue
+        key = (rank, buf_idx, step_id['step'])
+        if key not in steps:
+            steps[key] = {'type': step_id['type'], 'wait': 0.0, 'xfer': 0.0, 'bytes': 0, 'count': 0}
+        steps[key][kind] += (parsed_gpu_event['timestamp'] - open_ts.pop(kind)) / gpu_clock_scale
+        if kind == 'xfer':
+            steps[key]['bytes'] += parsed_gpu_event['size']
+            steps[key]['count'] += 1
+
+def write_msccl_step_lattice(steps, output_dir):
+    # One grid per rank, thread blocks as rows and steps as columns. Each cell shows the
+    # transmission type and the average wait/transfer time in us, '*' marking steps that
+    # waited on a dependency longer than they moved data
+    with open(os.path.join(output_dir, 'npkit_msccl_steps.txt'), 'w') as f:
+        for rank in sorted(set(k[0] for k in steps)):
+            tbs = sorted(set(k[1] for k in steps if k[0] == rank))
+            n_steps = max(k[2] for k in steps if k[0] == rank) + 1
+            f.write('rank %d\n' % rank)
+            f.write('%6s' % 'tb' + ''.join('%22s' % ('step %d' % s) for s in range(n_steps)) + '%12s%12s%12s\n' % ('wait', 'transfer', 'reduce'))
+            for tb in tbs:
+                totals = {'wait': 0.0, 'transfer': 0.0, 'reduce': 0.0}
+                line = '%6d' % tb
+                for s in range(n_steps):
+                    step = steps.get((rank, tb, s))
+                    if step is None or step['count'] == 0:
+                        line += '%22s' % '-'
+                        continue
+                    wait = step['wait'] / step['count']
+                    xfer = step['xfer'] / step['count']
+                    totals['wait'] += step['wait']
+                    totals['reduce' if step['type'] in MSCCL_REDUCE_TYPES else 'transfer'] += step['xfer']
+                    line += '%22s' % ('%s %.2f/%.2f%s' % (step['type'], wait, xfer, '*' if wait > xfer else ''))
+                f.write(line + '%12.2f%12.2f%12.2f\n' % (totals['wait'], totals['transfer'], totals['reduce']))
+            f.write('\n')
+
+def convert_npkit_dump_to_trace(npkit_dump_dir, output_dir, npkit_event_def, gpu_statistics, msccl_lattice=False):
     files_in_dump_dir = next(os.walk(npkit_dump_dir))[2]
     gpu_event_files = [x for x in files_in_dump_dir if x.startswith('gpu_events_rank_')]
     cpu_event_files = [x for x in files_in_dump_dir if x.startswith('cpu_events_rank_')]
@@ -296,6 +377,7 @@ def convert_npkit_dump_to_trace(npkit_dump_dir, output_dir, npkit_event_def, gpu
     channels = list(set([int(x.split('_channel_')[1].split('_')[0]) for x in cpu_event_files]))
     trace = {'traceEvents': []}
     dictionary_of_stats = {}
+    msccl_steps = {}
     for rank in ranks:
         cpu_clock_den_file_path = os.path.join(npkit_dump_dir, 'cpu_clock_period_den_rank_%d' % rank)
         cpu_clock_num_file_path = os.path.join(npkit_dump_dir, 'cpu_clock_period_num_rank_%d' % rank)
@@ -304,6 +386,8 @@ def convert_npkit_dump_to_trace(npkit_dump_dir, output_dir, npkit_event_def, gpu
         gpu_clock_file_path = os.path.join(npkit_dump_dir, 'gpu_clock_rate_rank_%d' % rank)
         gpu_clock_scale = parse_gpu_clock_scale(gpu_clock_file_path)
 
+        cpu_clock_offset = parse_cpu_clock_offset(os.path.join(npkit_dump_dir, 'cpu_clock_offset_ns_rank_%d' % rank))
+
         sync_dictionary = {} # per rank
         avg_time = {}
         number_events=0
@@ -318,17 +402,24 @@ def convert_npkit_dump_to_trace(npkit_dump_dir, output_dir, npkit_event_def, gpu
 
         for buf_idx in buf_indices:
             gpu_events = parse_gpu_event_file(avg_time, npkit_dump_dir, npkit_event_def, rank, buf_idx, gpu_clock_scale, cpu_clock_scale, dictionary_of_stats)
+            for event in gpu_events:
+                event['ts'] += cpu_clock_offset
             trace['traceEvents'].extend(gpu_events)
-
+            if msccl_lattice:
+                parse_msccl_steps(npkit_dump_dir, npkit_event_def, rank, buf_idx, gpu_clock_scale, msccl_steps)
 
         for channel in channels:
             cpu_events = parse_cpu_event_file(npkit_dump_dir, npkit_event_def, rank, channel, cpu_clock_scale)
+            for event in cpu_events:
+                event['ts'] += cpu_clock_offset
             trace['traceEvents'].extend(cpu_events)
 
 
     trace['traceEvents'].sort(key=lambda x : x['ts'])
     trace['displayTimeUnit'] = 'ns'
     os.makedirs(output_dir, exist_ok=True)
+    if msccl_lattice:
+        write_msccl_step_lattice(msccl_steps, output_dir)
     if gpu_statistics == True:
         with open(os.path.join(output_dir, 'npkit_event_stats.txt'), 'w') as f:
             for key in dictionary_of_stats:
@@ -345,9 +436,10 @@ if __name__ == '__main__':
     parser.add_argument('--npkit_event_header_path', type=str, required=True, help='Path to npkit_event.h.')
     parser.add_argument('--output_dir', type=str, required=True, help='Path to output directory.')
     parser.add_argument('--gpu_run_stats', type=bool, nargs='?', const=True, default=False, help="print stats instead.")
+    parser.add_argument('--msccl_lattice', type=bool, nargs='?', const=True, default=False, help="also write MSCCL wait/transfer times per thread block and step.")
     args = parser.parse_args()
     gpu_statistics = False
     if args.gpu_run_stats is not None:
         gpu_statistics = args.gpu_run_stats
     npkit_event_def = parse_npkit_event_header(args.npkit_event_header_path)
-    convert_npkit_dump_to_trace(args.npkit_dump_dir, args.output_dir, npkit_event_def, gpu_statistics)
\ No newline at end of file
+    convert_npkit_dump_to_trace(args.npkit_dump_dir, args.output_dir, npkit_event_def, gpu_statistics, args.msccl_lattice)
\ No newline at end of file
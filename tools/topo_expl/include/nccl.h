@@ -253,7 +253,9 @@ typedef enum { ncclInt8       = 0, ncclChar       = 0,
                ncclFloat32    = 7, ncclFloat      = 7,
                ncclFloat64    = 8, ncclDouble     = 8,
                ncclBfloat16   = 9,
-               ncclNumTypes   = 10 } ncclDataType_t;
+               ncclFloat8e4m3 = 10,
+               ncclFloat8e5m2 = 11,
+               ncclNumTypes   = 12 } ncclDataType_t;
 
 /*! @brief ncclScalarResidence_t: Location and dereferencing logic for scalar arguments. */
 typedef enum {
@@ -43,6 +43,9 @@ THE SOFTWARE.
 #include <cstdio>
 #include <iostream>
 #include <cstring>
+#include <map>
+#include <set>
+#include <vector>
 #include "model.h"
 #include "utils.h"
 #include "topo.h"
@@ -158,6 +161,141 @@ NodeModelDesc model_descs[] = {
   {2, "topo_8p_940vm.xml",      "2 nodes gfx940 VM"},
 };
 
+// Measured times of a rccl-tests sweep, run with NCCL_ALGO/NCCL_PROTO set to algorithm/protocol,
+// or with both -1 when RCCL made its own choice.
+struct Sweep {
+    int algorithm, protocol;
+    const char* file;
+    std::map<size_t, float> times; // out-of-place time in us for each size in bytes
+};
+
+static int findName(const char* names[], int count, const char* name, size_t len) {
+    for (int i = 0; i < count; i++) {
+        if (names[i] && strlen(names[i]) == len && strncasecmp(names[i], name, len) == 0) return i;
+    }
+    return -1;
+}
+
+// [algo/proto:]file
+static bool parseSweepArg(char* arg, Sweep* sweep) {
+    sweep->algorithm = sweep->protocol = -1;
+    sweep->file = arg;
+    char* colon = strchr(arg, ':');
+    if (colon == NULL) return true;
+    char* slash = strchr(arg, '/');
+    if (slash == NULL || slash > colon) return false;
+    sweep->algorithm = findName(ncclAlgoStr, NCCL_NUM_ALGORITHMS, arg, slash-arg);
+    sweep->protocol = findName(ncclProtoStr, NCCL_NUM_PROTOCOLS, slash+1, colon-slash-1);
+    sweep->file = colon+1;
+    return sweep->algorithm >= 0 && sweep->protocol >= 0;
+}
+
+// Data lines of rccl-tests: size count type redop root time algbw busbw #wrong ...
+static bool readSweep(Sweep* sweep) {
+    FILE* file = fopen(sweep->file, "r");
+    if (file == NULL) {
+        printf("Could not open %s\n", sweep->file);
+        return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        char* tokens[6];
+        int ntokens = 0;
+        if (line[0] == '#') continue;
+        for (char* tok = strtok(line, " \t\n"); tok && ntokens < 6; tok = strtok(NULL, " \t\n")) tokens[ntokens++] = tok;
+        if (ntokens < 6) continue;
+        char* end;
+        size_t size = strtoull(tokens[0], &end, 10);
+        if (*end != '\0' || size == 0) continue;
+        sweep->times[size] = atof(tokens[5]);
+    }
+    fclose(file);
+    return true;
+}
+
+static const char* sweepName(int algorithm, int protocol, char* name, size_t len) {
+    if (algorithm < 0) snprintf(name, len, "default");
+    else snprintf(name, len, "%s/%s", ncclAlgoStr[algorithm], ncclProtoStr[protocol]);
+    return name;
+}
+
+// Prints the ncclTopoGetAlgoTime() prediction next to each measurement, then the size ranges where
+// the algorithm/protocol the model picks was measured slower than the best one by more than tolerance.
+static ncclResult_t reportSweeps(struct ncclComm* comm, ncclFunc_t coll, std::vector<Sweep>& sweeps, float tolerance) {
+    std::set<size_t> sizes;
+    for (auto& sweep : sweeps) for (auto& t : sweep.times) sizes.insert(t.first);
+
+    printf("Model vs. measured %s, time in us\n", ncclFuncStr[coll]);
+    int rangeChoice = -1, rangeBest = -1;
+    size_t rangeStart = 0, rangeEnd = 0;
+    float rangeSlowdown = 0;
+    int nFlagged = 0;
+    for (auto it = sizes.begin(); ; it++) {
+        int choice = -1, best = -1;
+        float slowdown = 0;
+        size_t size = 0;
+        if (it != sizes.end()) {
+            size = *it;
+            struct ncclInfo info;
+            memset(&info, 0, sizeof(info));
+            info.comm = comm;
+            info.coll = coll;
+            info.nBytes = size;
+            float predicted[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+            float minTime = -1;
+            for (int a = 0; a < NCCL_NUM_ALGORITHMS; a++) {
+                for (int p = 0; p < NCCL_NUM_PROTOCOLS; p++) {
+                    NCCLCHECK(ncclTopoGetAlgoTime(&info, a, p, 1, &predicted[a][p]));
+                    if (predicted[a][p] >= 0 && (minTime < 0 || predicted[a][p] < minTime)) {
+                        minTime = predicted[a][p];
+                        choice = a*NCCL_NUM_PROTOCOLS+p;
+                    }
+                }
+            }
+            float choiceTime = -1, bestTime = -1;
+            for (auto& sweep : sweeps) {
+                auto t = sweep.times.find(size);
+                if (t == sweep.times.end()) continue;
+                int a = sweep.algorithm, p = sweep.protocol;
+                float pred = a >= 0 ? predicted[a][p] : minTime;
+                char name[64];
+                printf("%12zu %-20s predicted %10.2f measured %10.2f", size, sweepName(a, p, name, sizeof(name)), pred, t->second);
+                if (pred > 0) printf(" (%+.1f%%)", (t->second/pred-1)*100);
+                printf("\n");
+                if (a >= 0 && (bestTime < 0 || t->second < bestTime)) {
+                    bestTime = t->second;
+                    best = a*NCCL_NUM_PROTOCOLS+p;
+                }
+                // A default run measures what RCCL picked, used when the model choice has no sweep of its own
+                if (choice >= 0 && (a*NCCL_NUM_PROTOCOLS+p == choice || (a < 0 && choiceTime < 0))) choiceTime = t->second;
+            }
+            if (choiceTime > 0 && bestTime > 0 && choiceTime > bestTime*(1+tolerance)) slowdown = choiceTime/bestTime-1;
+            else best = -1;
+        }
+        if (rangeBest >= 0 && (best != rangeBest || choice != rangeChoice)) {
+            char choiceName[64], bestName[64];
+            printf("Suboptimal model choice for %zu-%zu bytes: %s, measured best %s (up to %.1f%% slower)\n",
+                rangeStart, rangeEnd, sweepName(rangeChoice/NCCL_NUM_PROTOCOLS, rangeChoice%NCCL_NUM_PROTOCOLS, choiceName, sizeof(choiceName)),
+                sweepName(rangeBest/NCCL_NUM_PROTOCOLS, rangeBest%NCCL_NUM_PROTOCOLS, bestName, sizeof(bestName)), rangeSlowdown*100);
+            nFlagged++;
+            rangeBest = -1;
+        }
+        if (it == sizes.end()) break;
+        if (best >= 0) {
+            if (rangeBest < 0) {
+                rangeStart = size;
+                rangeSlowdown = 0;
+            }
+            rangeChoice = choice;
+            rangeBest = best;
+            rangeEnd = size;
+            rangeSlowdown = std::max(rangeSlowdown, slowdown);
+        }
+    }
+    printf("%d size range(s) where the model choice is more than %.0f%% slower than measured best\n", nFlagged, tolerance*100);
+    return ncclSuccess;
+}
+
 NCCL_PARAM(MaxCTAs, "MAX_CTAS", MAXCHANNELS);
 NCCL_PARAM(MinCTAs, "MIN_CTAS", 1);
 
@@ -169,7 +307,10 @@ int main(int argc,char* argv[])
   int maxCTAsEnv;
 
   if (!cmdOptionExists(argv, argv + argc, "-m")) {
-    printf("Usage: ./topo_expl -m model_id\n");
+    printf("Usage: ./topo_expl -m model_id [-c collective] [-r [algo/proto:]rccl_tests_output]... [-t tolerance_percent]\n");
+    printf("  -r compares ncclTopoGetAlgoTime predictions with a rccl-tests sweep of the collective (default AllReduce),\n");
+    printf("     run with NCCL_ALGO=algo NCCL_PROTO=proto or, without a prefix, with RCCL's own choice. Size ranges where\n");
+    printf("     the model choice is slower than the measured best by more than the tolerance (default 10%%) are flagged.\n");
     printf("List of model_id:\n");
     for (int i = 0; i < num_models; i++)
       printf("  %d: %s\n", i, model_descs[i].description);
@@ -186,6 +327,32 @@ int main(int argc,char* argv[])
       exit(0);
   }
 
+  ncclFunc_t coll = ncclFuncAllReduce;
+  char *ci = getCmdOption(argv, argv + argc, "-c");
+  if (ci) {
+    int c = findName(ncclFuncStr, NCCL_NUM_FUNCTIONS, ci, strlen(ci));
+    if (c < 0) {
+      printf("Invalid collective %s\n", ci);
+      exit(0);
+    }
+    coll = (ncclFunc_t)c;
+  }
+  float tolerance = 0.1;
+  char *ti = getCmdOption(argv, argv + argc, "-t");
+  if (ti)
+    tolerance = atof(ti)/100;
+  std::vector<Sweep> sweeps;
+  for (int i = 1; i+1 < argc; i++) {
+    if (strcmp(argv[i], "-r")) continue;
+    Sweep sweep;
+    if (!parseSweepArg(argv[++i], &sweep)) {
+      printf("Invalid sweep %s, expected [algo/proto:]file\n", argv[i]);
+      exit(0);
+    }
+    if (!readSweep(&sweep)) exit(0);
+    sweeps.push_back(sweep);
+  }
+
   NetworkModel network;
   NodeModel* node;
 
@@ -299,6 +466,8 @@ int main(int argc,char* argv[])
     INFO(NCCL_TUNING, "%10ld %s %s time %f", info.nBytes, ncclAlgoStr[info.algorithm], ncclProtoStr[info.protocol], minTime);
   }
 
+  if (!sweeps.empty()) NCCLCHECK(reportSweeps(&comm[0], coll, sweeps, tolerance));
+
   for (int i = 0; i < nranks; i++) {
     free(comm[i].connectSend);
     free(comm[i].connectRecv);
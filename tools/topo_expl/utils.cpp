@@ -222,6 +222,9 @@ void ncclDebugLog(ncclDebugLogLevel level, unsigned long flags, const char *file
 #endif
 }
 
+void ncclSetThreadName(pthread_t thread, const char *fmt, ...) {
+}
+
 ncclResult_t ncclTopoGetSystem(const char* xmlTopoFile, struct ncclTopoSystem** system) {
   struct ncclXml* xml;
   NCCLCHECK(ncclCalloc(&xml, 1));